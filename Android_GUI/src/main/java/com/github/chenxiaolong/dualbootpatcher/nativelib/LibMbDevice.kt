@@ -21,6 +21,7 @@ import android.os.Parcel
 import android.os.Parcelable
 
 import com.github.chenxiaolong.dualbootpatcher.nativelib.LibMbDevice.CWrapper.CDevice
+import com.github.chenxiaolong.dualbootpatcher.nativelib.LibMbDevice.CWrapper.CDeviceIndex
 import com.github.chenxiaolong.dualbootpatcher.nativelib.LibMbDevice.CWrapper.CJsonError
 import com.sun.jna.IntegerType
 import com.sun.jna.Native
@@ -46,6 +47,8 @@ object LibMbDevice {
             constructor(p: Pointer) : super(p)
         }
 
+        class CDeviceIndex : PointerType()
+
         class CJsonError : PointerType()
 
         class SizeT @JvmOverloads constructor(value: Long = 0)
@@ -225,6 +228,17 @@ object LibMbDevice {
 
         @JvmStatic
         external fun mb_device_equals(a: CDevice, b: CDevice): Boolean
+
+        /* Index */
+
+        @JvmStatic
+        external fun mb_device_index_new(devices: Array<Pointer>): CDeviceIndex? /* CDevice ** */
+
+        @JvmStatic
+        external fun mb_device_index_free(index: CDeviceIndex?)
+
+        @JvmStatic
+        external fun mb_device_index_find(index: CDeviceIndex, codename: String): Long /* int64_t */
         // END: device.h
 
         // BEGIN: json.h
@@ -338,6 +352,46 @@ object LibMbDevice {
         }
     }
 
+    /**
+     * Codename lookup index over a list of devices.
+     *
+     * The index is built once in native code, so lookups do not need to query the codenames of
+     * every device through JNA. The devices must outlive the index.
+     */
+    class DeviceIndex(devices: List<Device>) {
+        private val devices = devices.toList()
+        private var pointer: CDeviceIndex? = null
+
+        init {
+            // JNA passes Pointer arrays as NULL-terminated C arrays
+            val cDevices = this.devices.map { it.pointer!!.pointer }.toTypedArray()
+            pointer = CWrapper.mb_device_index_new(cDevices)
+            if (pointer == null) {
+                throw IllegalStateException("Failed to allocate CDeviceIndex object")
+            }
+        }
+
+        fun destroy() {
+            if (pointer != null) {
+                CWrapper.mb_device_index_free(pointer!!)
+            }
+            pointer = null
+        }
+
+        @Suppress("ProtectedInFinal")
+        protected fun finalize() {
+            destroy()
+        }
+
+        /**
+         * Find the first device that lists [codename] as one of its codenames.
+         */
+        fun find(codename: String): Device? {
+            val position = CWrapper.mb_device_index_find(pointer!!, codename)
+            return if (position < 0) null else devices[position.toInt()]
+        }
+    }
+
     @Suppress("unused", "MemberVisibilityCanBePrivate")
     class Device : Parcelable {
         internal var pointer: CDevice? = null
@@ -18,6 +18,7 @@
 package com.github.chenxiaolong.dualbootpatcher.nativelib.libmiscstuff
 
 import java.io.IOException
+import java.nio.ByteBuffer
 
 object LibMiscStuff {
     @Throws(IOException::class)
@@ -28,6 +29,24 @@ object LibMiscStuff {
     @Throws(IOException::class)
     external fun getBootImageRomId(filename: String): String?
 
+    /**
+     * Get the ROM IDs of several boot images with a single native call
+     *
+     * @return Array with the same size as [filenames]. Elements are null for boot images that
+     *         have no ROM ID.
+     */
+    @Throws(IOException::class)
+    external fun getBootImageRomIds(filenames: Array<String>): Array<String?>
+
+    /**
+     * Get the ROM ID of a boot image stored in the first [size] bytes of a direct [ByteBuffer]
+     *
+     * The buffer is read in place, so it must have been created with
+     * [ByteBuffer.allocateDirect] or by mapping a file.
+     */
+    @Throws(IOException::class)
+    external fun getBootImageRomIdFromBuffer(buffer: ByteBuffer, size: Int): String?
+
     @Throws(IOException::class)
     external fun bootImagesEqual(filename1: String, filename2: String): Boolean
 
@@ -38,7 +38,7 @@ internal class PatcherOptionsLiveData(
     private inner class PatcherOptionsLoadTask : AsyncTask<Void, Void, PatcherOptionsData>() {
         override fun doInBackground(vararg params: Void?): PatcherOptionsData {
             val devices = PatcherUtils.getDevices(context) ?: Collections.emptyList()
-            val currentDevice = PatcherUtils.getCurrentDevice(context, devices)
+            val currentDevice = PatcherUtils.getCurrentDevice(context)
 
             // Build list of fixed install locations
             val installLocations = ArrayList<InstallLocation>()
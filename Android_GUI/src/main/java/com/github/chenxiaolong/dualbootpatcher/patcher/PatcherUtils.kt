@@ -26,6 +26,7 @@ import com.github.chenxiaolong.dualbootpatcher.R
 import com.github.chenxiaolong.dualbootpatcher.RomUtils
 import com.github.chenxiaolong.dualbootpatcher.ThreadUtils
 import com.github.chenxiaolong.dualbootpatcher.nativelib.LibMbDevice.Device
+import com.github.chenxiaolong.dualbootpatcher.nativelib.LibMbDevice.DeviceIndex
 import com.github.chenxiaolong.dualbootpatcher.nativelib.LibMbPatcher.PatcherConfig
 import com.github.chenxiaolong.dualbootpatcher.nativelib.libmiscstuff.LibMiscStuff
 import java.io.File
@@ -69,6 +70,7 @@ object PatcherUtils {
     private var initialized: Boolean = false
 
     private var devices: List<Device>? = null
+    private var deviceIndex: DeviceIndex? = null
     private var currentDevice: Device? = null
 
     private var targetFile: String
@@ -130,6 +132,7 @@ object PatcherUtils {
 
                 if (!validDevices.isEmpty()) {
                     this.devices = validDevices
+                    this.deviceIndex = DeviceIndex(validDevices)
                 }
             } catch (e: IOException) {
                 Log.w(TAG, "Failed to read $path", e)
@@ -143,30 +146,13 @@ object PatcherUtils {
     fun getCurrentDevice(context: Context): Device? {
         ThreadUtils.enforceExecutionOnNonMainThread()
 
-        if (currentDevice == null) {
-            val devices = getDevices(context)
-            if (devices != null) {
-                currentDevice = getCurrentDevice(context, devices)
-            }
+        if (currentDevice == null && getDevices(context) != null) {
+            currentDevice = deviceIndex!!.find(RomUtils.getDeviceCodename(context))
         }
 
         return currentDevice
     }
 
-    fun getCurrentDevice(context: Context, devices: Collection<Device>): Device? {
-        val realCodename = RomUtils.getDeviceCodename(context)
-
-        for (d in devices) {
-            for (codename in d.codenames!!) {
-                if (realCodename == codename) {
-                    return d
-                }
-            }
-        }
-
-        return null
-    }
-
     @Synchronized
     fun extractPatcher(context: Context) {
         context.cacheDir.listFiles()
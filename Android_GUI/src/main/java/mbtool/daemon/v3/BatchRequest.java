@@ -0,0 +1,37 @@
+// automatically generated by the FlatBuffers compiler, do not modify
+
+package mbtool.daemon.v3;
+
+import java.nio.*;
+import java.lang.*;
+import java.util.*;
+import com.google.flatbuffers.*;
+
+@SuppressWarnings("unused")
+public final class BatchRequest extends Table {
+  public static BatchRequest getRootAsBatchRequest(ByteBuffer _bb) { return getRootAsBatchRequest(_bb, new BatchRequest()); }
+  public static BatchRequest getRootAsBatchRequest(ByteBuffer _bb, BatchRequest obj) { _bb.order(ByteOrder.LITTLE_ENDIAN); return (obj.__assign(_bb.getInt(_bb.position()) + _bb.position(), _bb)); }
+  public void __init(int _i, ByteBuffer _bb) { bb_pos = _i; bb = _bb; }
+  public BatchRequest __assign(int _i, ByteBuffer _bb) { __init(_i, _bb); return this; }
+
+  public Request requests(int j) { return requests(new Request(), j); }
+  public Request requests(Request obj, int j) { int o = __offset(4); return o != 0 ? obj.__assign(__indirect(__vector(o) + j * 4), bb) : null; }
+  public int requestsLength() { int o = __offset(4); return o != 0 ? __vector_len(o) : 0; }
+
+  public static int createBatchRequest(FlatBufferBuilder builder,
+      int requestsOffset) {
+    builder.startObject(1);
+    BatchRequest.addRequests(builder, requestsOffset);
+    return BatchRequest.endBatchRequest(builder);
+  }
+
+  public static void startBatchRequest(FlatBufferBuilder builder) { builder.startObject(1); }
+  public static void addRequests(FlatBufferBuilder builder, int requestsOffset) { builder.addOffset(0, requestsOffset, 0); }
+  public static int createRequestsVector(FlatBufferBuilder builder, int[] data) { builder.startVector(4, data.length, 4); for (int i = data.length - 1; i >= 0; i--) builder.addOffset(data[i]); return builder.endVector(); }
+  public static void startRequestsVector(FlatBufferBuilder builder, int numElems) { builder.startVector(4, numElems, 4); }
+  public static int endBatchRequest(FlatBufferBuilder builder) {
+    int o = builder.endObject();
+    return o;
+  }
+}
+
@@ -0,0 +1,33 @@
+// automatically generated by the FlatBuffers compiler, do not modify
+
+package mbtool.daemon.v3;
+
+import java.nio.*;
+import java.lang.*;
+import java.util.*;
+import com.google.flatbuffers.*;
+
+@SuppressWarnings("unused")
+public final class BatchResponse extends Table {
+  public static BatchResponse getRootAsBatchResponse(ByteBuffer _bb) { return getRootAsBatchResponse(_bb, new BatchResponse()); }
+  public static BatchResponse getRootAsBatchResponse(ByteBuffer _bb, BatchResponse obj) { _bb.order(ByteOrder.LITTLE_ENDIAN); return (obj.__assign(_bb.getInt(_bb.position()) + _bb.position(), _bb)); }
+  public void __init(int _i, ByteBuffer _bb) { bb_pos = _i; bb = _bb; }
+  public BatchResponse __assign(int _i, ByteBuffer _bb) { __init(_i, _bb); return this; }
+
+  public long count() { int o = __offset(4); return o != 0 ? (long)bb.getInt(o + bb_pos) & 0xFFFFFFFFL : 0L; }
+
+  public static int createBatchResponse(FlatBufferBuilder builder,
+      long count) {
+    builder.startObject(1);
+    BatchResponse.addCount(builder, count);
+    return BatchResponse.endBatchResponse(builder);
+  }
+
+  public static void startBatchResponse(FlatBufferBuilder builder) { builder.startObject(1); }
+  public static void addCount(FlatBufferBuilder builder, long count) { builder.addInt(0, (int)count, (int)0L); }
+  public static int endBatchResponse(FlatBufferBuilder builder) {
+    int o = builder.endObject();
+    return o;
+  }
+}
+
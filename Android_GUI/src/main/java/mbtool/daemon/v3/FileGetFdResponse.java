@@ -0,0 +1,34 @@
+// automatically generated by the FlatBuffers compiler, do not modify
+
+package mbtool.daemon.v3;
+
+import java.nio.*;
+import java.lang.*;
+import java.util.*;
+import com.google.flatbuffers.*;
+
+@SuppressWarnings("unused")
+public final class FileGetFdResponse extends Table {
+  public static FileGetFdResponse getRootAsFileGetFdResponse(ByteBuffer _bb) { return getRootAsFileGetFdResponse(_bb, new FileGetFdResponse()); }
+  public static FileGetFdResponse getRootAsFileGetFdResponse(ByteBuffer _bb, FileGetFdResponse obj) { _bb.order(ByteOrder.LITTLE_ENDIAN); return (obj.__assign(_bb.getInt(_bb.position()) + _bb.position(), _bb)); }
+  public void __init(int _i, ByteBuffer _bb) { bb_pos = _i; bb = _bb; }
+  public FileGetFdResponse __assign(int _i, ByteBuffer _bb) { __init(_i, _bb); return this; }
+
+  public FileGetFdError error() { return error(new FileGetFdError()); }
+  public FileGetFdError error(FileGetFdError obj) { int o = __offset(4); return o != 0 ? obj.__assign(__indirect(o + bb_pos), bb) : null; }
+
+  public static int createFileGetFdResponse(FlatBufferBuilder builder,
+      int errorOffset) {
+    builder.startObject(1);
+    FileGetFdResponse.addError(builder, errorOffset);
+    return FileGetFdResponse.endFileGetFdResponse(builder);
+  }
+
+  public static void startFileGetFdResponse(FlatBufferBuilder builder) { builder.startObject(1); }
+  public static void addError(FlatBufferBuilder builder, int errorOffset) { builder.addOffset(0, errorOffset, 0); }
+  public static int endFileGetFdResponse(FlatBufferBuilder builder) {
+    int o = builder.endObject();
+    return o;
+  }
+}
+
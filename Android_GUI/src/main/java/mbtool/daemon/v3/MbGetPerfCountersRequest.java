@@ -0,0 +1,33 @@
+// automatically generated by the FlatBuffers compiler, do not modify
+
+package mbtool.daemon.v3;
+
+import java.nio.*;
+import java.lang.*;
+import java.util.*;
+import com.google.flatbuffers.*;
+
+@SuppressWarnings("unused")
+public final class MbGetPerfCountersRequest extends Table {
+  public static MbGetPerfCountersRequest getRootAsMbGetPerfCountersRequest(ByteBuffer _bb) { return getRootAsMbGetPerfCountersRequest(_bb, new MbGetPerfCountersRequest()); }
+  public static MbGetPerfCountersRequest getRootAsMbGetPerfCountersRequest(ByteBuffer _bb, MbGetPerfCountersRequest obj) { _bb.order(ByteOrder.LITTLE_ENDIAN); return (obj.__assign(_bb.getInt(_bb.position()) + _bb.position(), _bb)); }
+  public void __init(int _i, ByteBuffer _bb) { bb_pos = _i; bb = _bb; }
+  public MbGetPerfCountersRequest __assign(int _i, ByteBuffer _bb) { __init(_i, _bb); return this; }
+
+  public boolean reset() { int o = __offset(4); return o != 0 ? 0!=bb.get(o + bb_pos) : false; }
+
+  public static int createMbGetPerfCountersRequest(FlatBufferBuilder builder,
+      boolean reset) {
+    builder.startObject(1);
+    MbGetPerfCountersRequest.addReset(builder, reset);
+    return MbGetPerfCountersRequest.endMbGetPerfCountersRequest(builder);
+  }
+
+  public static void startMbGetPerfCountersRequest(FlatBufferBuilder builder) { builder.startObject(1); }
+  public static void addReset(FlatBufferBuilder builder, boolean reset) { builder.addBoolean(0, reset, false); }
+  public static int endMbGetPerfCountersRequest(FlatBufferBuilder builder) {
+    int o = builder.endObject();
+    return o;
+  }
+}
+
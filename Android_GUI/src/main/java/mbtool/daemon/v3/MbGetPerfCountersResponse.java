@@ -0,0 +1,37 @@
+// automatically generated by the FlatBuffers compiler, do not modify
+
+package mbtool.daemon.v3;
+
+import java.nio.*;
+import java.lang.*;
+import java.util.*;
+import com.google.flatbuffers.*;
+
+@SuppressWarnings("unused")
+public final class MbGetPerfCountersResponse extends Table {
+  public static MbGetPerfCountersResponse getRootAsMbGetPerfCountersResponse(ByteBuffer _bb) { return getRootAsMbGetPerfCountersResponse(_bb, new MbGetPerfCountersResponse()); }
+  public static MbGetPerfCountersResponse getRootAsMbGetPerfCountersResponse(ByteBuffer _bb, MbGetPerfCountersResponse obj) { _bb.order(ByteOrder.LITTLE_ENDIAN); return (obj.__assign(_bb.getInt(_bb.position()) + _bb.position(), _bb)); }
+  public void __init(int _i, ByteBuffer _bb) { bb_pos = _i; bb = _bb; }
+  public MbGetPerfCountersResponse __assign(int _i, ByteBuffer _bb) { __init(_i, _bb); return this; }
+
+  public PerfMetric metrics(int j) { return metrics(new PerfMetric(), j); }
+  public PerfMetric metrics(PerfMetric obj, int j) { int o = __offset(4); return o != 0 ? obj.__assign(__indirect(__vector(o) + j * 4), bb) : null; }
+  public int metricsLength() { int o = __offset(4); return o != 0 ? __vector_len(o) : 0; }
+
+  public static int createMbGetPerfCountersResponse(FlatBufferBuilder builder,
+      int metricsOffset) {
+    builder.startObject(1);
+    MbGetPerfCountersResponse.addMetrics(builder, metricsOffset);
+    return MbGetPerfCountersResponse.endMbGetPerfCountersResponse(builder);
+  }
+
+  public static void startMbGetPerfCountersResponse(FlatBufferBuilder builder) { builder.startObject(1); }
+  public static void addMetrics(FlatBufferBuilder builder, int metricsOffset) { builder.addOffset(0, metricsOffset, 0); }
+  public static int createMetricsVector(FlatBufferBuilder builder, int[] data) { builder.startVector(4, data.length, 4); for (int i = data.length - 1; i >= 0; i--) builder.addOffset(data[i]); return builder.endVector(); }
+  public static void startMetricsVector(FlatBufferBuilder builder, int numElems) { builder.startVector(4, numElems, 4); }
+  public static int endMbGetPerfCountersResponse(FlatBufferBuilder builder) {
+    int o = builder.endObject();
+    return o;
+  }
+}
+
@@ -32,6 +32,9 @@ public final class MbRom extends Table {
   public String build() { int o = __offset(14); return o != 0 ? __string(o + bb_pos) : null; }
   public ByteBuffer buildAsByteBuffer() { return __vector_as_bytebuffer(14, 1); }
   public ByteBuffer buildInByteBuffer(ByteBuffer _bb) { return __vector_in_bytebuffer(_bb, 14, 1); }
+  public String thumbnailPath() { int o = __offset(16); return o != 0 ? __string(o + bb_pos) : null; }
+  public ByteBuffer thumbnailPathAsByteBuffer() { return __vector_as_bytebuffer(16, 1); }
+  public ByteBuffer thumbnailPathInByteBuffer(ByteBuffer _bb) { return __vector_in_bytebuffer(_bb, 16, 1); }
 
   public static int createMbRom(FlatBufferBuilder builder,
       int idOffset,
@@ -39,8 +42,10 @@ public final class MbRom extends Table {
       int cache_pathOffset,
       int data_pathOffset,
       int versionOffset,
-      int buildOffset) {
-    builder.startObject(6);
+      int buildOffset,
+      int thumbnail_pathOffset) {
+    builder.startObject(7);
+    MbRom.addThumbnailPath(builder, thumbnail_pathOffset);
     MbRom.addBuild(builder, buildOffset);
     MbRom.addVersion(builder, versionOffset);
     MbRom.addDataPath(builder, data_pathOffset);
@@ -50,13 +55,14 @@ public final class MbRom extends Table {
     return MbRom.endMbRom(builder);
   }
 
-  public static void startMbRom(FlatBufferBuilder builder) { builder.startObject(6); }
+  public static void startMbRom(FlatBufferBuilder builder) { builder.startObject(7); }
   public static void addId(FlatBufferBuilder builder, int idOffset) { builder.addOffset(0, idOffset, 0); }
   public static void addSystemPath(FlatBufferBuilder builder, int systemPathOffset) { builder.addOffset(1, systemPathOffset, 0); }
   public static void addCachePath(FlatBufferBuilder builder, int cachePathOffset) { builder.addOffset(2, cachePathOffset, 0); }
   public static void addDataPath(FlatBufferBuilder builder, int dataPathOffset) { builder.addOffset(3, dataPathOffset, 0); }
   public static void addVersion(FlatBufferBuilder builder, int versionOffset) { builder.addOffset(4, versionOffset, 0); }
   public static void addBuild(FlatBufferBuilder builder, int buildOffset) { builder.addOffset(5, buildOffset, 0); }
+  public static void addThumbnailPath(FlatBufferBuilder builder, int thumbnailPathOffset) { builder.addOffset(6, thumbnailPathOffset, 0); }
   public static int endMbRom(FlatBufferBuilder builder) {
     int o = builder.endObject();
     return o;
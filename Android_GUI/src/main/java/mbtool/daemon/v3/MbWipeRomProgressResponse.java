@@ -0,0 +1,41 @@
+// automatically generated by the FlatBuffers compiler, do not modify
+
+package mbtool.daemon.v3;
+
+import java.nio.*;
+import java.lang.*;
+import java.util.*;
+import com.google.flatbuffers.*;
+
+@SuppressWarnings("unused")
+public final class MbWipeRomProgressResponse extends Table {
+  public static MbWipeRomProgressResponse getRootAsMbWipeRomProgressResponse(ByteBuffer _bb) { return getRootAsMbWipeRomProgressResponse(_bb, new MbWipeRomProgressResponse()); }
+  public static MbWipeRomProgressResponse getRootAsMbWipeRomProgressResponse(ByteBuffer _bb, MbWipeRomProgressResponse obj) { _bb.order(ByteOrder.LITTLE_ENDIAN); return (obj.__assign(_bb.getInt(_bb.position()) + _bb.position(), _bb)); }
+  public void __init(int _i, ByteBuffer _bb) { bb_pos = _i; bb = _bb; }
+  public MbWipeRomProgressResponse __assign(int _i, ByteBuffer _bb) { __init(_i, _bb); return this; }
+
+  public long entriesDeleted() { int o = __offset(4); return o != 0 ? bb.getLong(o + bb_pos) : 0L; }
+  public long targetsDone() { int o = __offset(6); return o != 0 ? (long)bb.getInt(o + bb_pos) & 0xFFFFFFFFL : 0L; }
+  public long targetsTotal() { int o = __offset(8); return o != 0 ? (long)bb.getInt(o + bb_pos) & 0xFFFFFFFFL : 0L; }
+
+  public static int createMbWipeRomProgressResponse(FlatBufferBuilder builder,
+      long entries_deleted,
+      long targets_done,
+      long targets_total) {
+    builder.startObject(3);
+    MbWipeRomProgressResponse.addEntriesDeleted(builder, entries_deleted);
+    MbWipeRomProgressResponse.addTargetsTotal(builder, targets_total);
+    MbWipeRomProgressResponse.addTargetsDone(builder, targets_done);
+    return MbWipeRomProgressResponse.endMbWipeRomProgressResponse(builder);
+  }
+
+  public static void startMbWipeRomProgressResponse(FlatBufferBuilder builder) { builder.startObject(3); }
+  public static void addEntriesDeleted(FlatBufferBuilder builder, long entriesDeleted) { builder.addLong(0, entriesDeleted, 0L); }
+  public static void addTargetsDone(FlatBufferBuilder builder, long targetsDone) { builder.addInt(1, (int)targetsDone, (int)0L); }
+  public static void addTargetsTotal(FlatBufferBuilder builder, long targetsTotal) { builder.addInt(2, (int)targetsTotal, (int)0L); }
+  public static int endMbWipeRomProgressResponse(FlatBufferBuilder builder) {
+    int o = builder.endObject();
+    return o;
+  }
+}
+
@@ -0,0 +1,33 @@
+// automatically generated by the FlatBuffers compiler, do not modify
+
+package mbtool.daemon.v3;
+
+import java.nio.*;
+import java.lang.*;
+import java.util.*;
+import com.google.flatbuffers.*;
+
+@SuppressWarnings("unused")
+public final class PathCopyJobCancelRequest extends Table {
+  public static PathCopyJobCancelRequest getRootAsPathCopyJobCancelRequest(ByteBuffer _bb) { return getRootAsPathCopyJobCancelRequest(_bb, new PathCopyJobCancelRequest()); }
+  public static PathCopyJobCancelRequest getRootAsPathCopyJobCancelRequest(ByteBuffer _bb, PathCopyJobCancelRequest obj) { _bb.order(ByteOrder.LITTLE_ENDIAN); return (obj.__assign(_bb.getInt(_bb.position()) + _bb.position(), _bb)); }
+  public void __init(int _i, ByteBuffer _bb) { bb_pos = _i; bb = _bb; }
+  public PathCopyJobCancelRequest __assign(int _i, ByteBuffer _bb) { __init(_i, _bb); return this; }
+
+  public long jobId() { int o = __offset(4); return o != 0 ? bb.getLong(o + bb_pos) : 0L; }
+
+  public static int createPathCopyJobCancelRequest(FlatBufferBuilder builder,
+      long job_id) {
+    builder.startObject(1);
+    PathCopyJobCancelRequest.addJobId(builder, job_id);
+    return PathCopyJobCancelRequest.endPathCopyJobCancelRequest(builder);
+  }
+
+  public static void startPathCopyJobCancelRequest(FlatBufferBuilder builder) { builder.startObject(1); }
+  public static void addJobId(FlatBufferBuilder builder, long jobId) { builder.addLong(0, jobId, 0L); }
+  public static int endPathCopyJobCancelRequest(FlatBufferBuilder builder) {
+    int o = builder.endObject();
+    return o;
+  }
+}
+
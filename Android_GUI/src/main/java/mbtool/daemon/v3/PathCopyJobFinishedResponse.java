@@ -0,0 +1,50 @@
+// automatically generated by the FlatBuffers compiler, do not modify
+
+package mbtool.daemon.v3;
+
+import java.nio.*;
+import java.lang.*;
+import java.util.*;
+import com.google.flatbuffers.*;
+
+@SuppressWarnings("unused")
+public final class PathCopyJobFinishedResponse extends Table {
+  public static PathCopyJobFinishedResponse getRootAsPathCopyJobFinishedResponse(ByteBuffer _bb) { return getRootAsPathCopyJobFinishedResponse(_bb, new PathCopyJobFinishedResponse()); }
+  public static PathCopyJobFinishedResponse getRootAsPathCopyJobFinishedResponse(ByteBuffer _bb, PathCopyJobFinishedResponse obj) { _bb.order(ByteOrder.LITTLE_ENDIAN); return (obj.__assign(_bb.getInt(_bb.position()) + _bb.position(), _bb)); }
+  public void __init(int _i, ByteBuffer _bb) { bb_pos = _i; bb = _bb; }
+  public PathCopyJobFinishedResponse __assign(int _i, ByteBuffer _bb) { __init(_i, _bb); return this; }
+
+  public long jobId() { int o = __offset(4); return o != 0 ? bb.getLong(o + bb_pos) : 0L; }
+  public boolean cancelled() { int o = __offset(6); return o != 0 ? 0!=bb.get(o + bb_pos) : false; }
+  public long bytesDone() { int o = __offset(8); return o != 0 ? bb.getLong(o + bb_pos) : 0L; }
+  public long filesDone() { int o = __offset(10); return o != 0 ? bb.getLong(o + bb_pos) : 0L; }
+  public PathCopyJobError error() { return error(new PathCopyJobError()); }
+  public PathCopyJobError error(PathCopyJobError obj) { int o = __offset(12); return o != 0 ? obj.__assign(__indirect(o + bb_pos), bb) : null; }
+
+  public static int createPathCopyJobFinishedResponse(FlatBufferBuilder builder,
+      long job_id,
+      boolean cancelled,
+      long bytes_done,
+      long files_done,
+      int errorOffset) {
+    builder.startObject(5);
+    PathCopyJobFinishedResponse.addFilesDone(builder, files_done);
+    PathCopyJobFinishedResponse.addBytesDone(builder, bytes_done);
+    PathCopyJobFinishedResponse.addJobId(builder, job_id);
+    PathCopyJobFinishedResponse.addError(builder, errorOffset);
+    PathCopyJobFinishedResponse.addCancelled(builder, cancelled);
+    return PathCopyJobFinishedResponse.endPathCopyJobFinishedResponse(builder);
+  }
+
+  public static void startPathCopyJobFinishedResponse(FlatBufferBuilder builder) { builder.startObject(5); }
+  public static void addJobId(FlatBufferBuilder builder, long jobId) { builder.addLong(0, jobId, 0L); }
+  public static void addCancelled(FlatBufferBuilder builder, boolean cancelled) { builder.addBoolean(1, cancelled, false); }
+  public static void addBytesDone(FlatBufferBuilder builder, long bytesDone) { builder.addLong(2, bytesDone, 0L); }
+  public static void addFilesDone(FlatBufferBuilder builder, long filesDone) { builder.addLong(3, filesDone, 0L); }
+  public static void addError(FlatBufferBuilder builder, int errorOffset) { builder.addOffset(4, errorOffset, 0); }
+  public static int endPathCopyJobFinishedResponse(FlatBufferBuilder builder) {
+    int o = builder.endObject();
+    return o;
+  }
+}
+
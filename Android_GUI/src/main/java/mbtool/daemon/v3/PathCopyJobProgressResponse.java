@@ -0,0 +1,45 @@
+// automatically generated by the FlatBuffers compiler, do not modify
+
+package mbtool.daemon.v3;
+
+import java.nio.*;
+import java.lang.*;
+import java.util.*;
+import com.google.flatbuffers.*;
+
+@SuppressWarnings("unused")
+public final class PathCopyJobProgressResponse extends Table {
+  public static PathCopyJobProgressResponse getRootAsPathCopyJobProgressResponse(ByteBuffer _bb) { return getRootAsPathCopyJobProgressResponse(_bb, new PathCopyJobProgressResponse()); }
+  public static PathCopyJobProgressResponse getRootAsPathCopyJobProgressResponse(ByteBuffer _bb, PathCopyJobProgressResponse obj) { _bb.order(ByteOrder.LITTLE_ENDIAN); return (obj.__assign(_bb.getInt(_bb.position()) + _bb.position(), _bb)); }
+  public void __init(int _i, ByteBuffer _bb) { bb_pos = _i; bb = _bb; }
+  public PathCopyJobProgressResponse __assign(int _i, ByteBuffer _bb) { __init(_i, _bb); return this; }
+
+  public long jobId() { int o = __offset(4); return o != 0 ? bb.getLong(o + bb_pos) : 0L; }
+  public long bytesDone() { int o = __offset(6); return o != 0 ? bb.getLong(o + bb_pos) : 0L; }
+  public long bytesTotal() { int o = __offset(8); return o != 0 ? bb.getLong(o + bb_pos) : 0L; }
+  public long filesDone() { int o = __offset(10); return o != 0 ? bb.getLong(o + bb_pos) : 0L; }
+
+  public static int createPathCopyJobProgressResponse(FlatBufferBuilder builder,
+      long job_id,
+      long bytes_done,
+      long bytes_total,
+      long files_done) {
+    builder.startObject(4);
+    PathCopyJobProgressResponse.addFilesDone(builder, files_done);
+    PathCopyJobProgressResponse.addBytesTotal(builder, bytes_total);
+    PathCopyJobProgressResponse.addBytesDone(builder, bytes_done);
+    PathCopyJobProgressResponse.addJobId(builder, job_id);
+    return PathCopyJobProgressResponse.endPathCopyJobProgressResponse(builder);
+  }
+
+  public static void startPathCopyJobProgressResponse(FlatBufferBuilder builder) { builder.startObject(4); }
+  public static void addJobId(FlatBufferBuilder builder, long jobId) { builder.addLong(0, jobId, 0L); }
+  public static void addBytesDone(FlatBufferBuilder builder, long bytesDone) { builder.addLong(1, bytesDone, 0L); }
+  public static void addBytesTotal(FlatBufferBuilder builder, long bytesTotal) { builder.addLong(2, bytesTotal, 0L); }
+  public static void addFilesDone(FlatBufferBuilder builder, long filesDone) { builder.addLong(3, filesDone, 0L); }
+  public static int endPathCopyJobProgressResponse(FlatBufferBuilder builder) {
+    int o = builder.endObject();
+    return o;
+  }
+}
+
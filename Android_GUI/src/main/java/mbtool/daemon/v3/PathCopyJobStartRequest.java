@@ -0,0 +1,45 @@
+// automatically generated by the FlatBuffers compiler, do not modify
+
+package mbtool.daemon.v3;
+
+import java.nio.*;
+import java.lang.*;
+import java.util.*;
+import com.google.flatbuffers.*;
+
+@SuppressWarnings("unused")
+public final class PathCopyJobStartRequest extends Table {
+  public static PathCopyJobStartRequest getRootAsPathCopyJobStartRequest(ByteBuffer _bb) { return getRootAsPathCopyJobStartRequest(_bb, new PathCopyJobStartRequest()); }
+  public static PathCopyJobStartRequest getRootAsPathCopyJobStartRequest(ByteBuffer _bb, PathCopyJobStartRequest obj) { _bb.order(ByteOrder.LITTLE_ENDIAN); return (obj.__assign(_bb.getInt(_bb.position()) + _bb.position(), _bb)); }
+  public void __init(int _i, ByteBuffer _bb) { bb_pos = _i; bb = _bb; }
+  public PathCopyJobStartRequest __assign(int _i, ByteBuffer _bb) { __init(_i, _bb); return this; }
+
+  public String source() { int o = __offset(4); return o != 0 ? __string(o + bb_pos) : null; }
+  public ByteBuffer sourceAsByteBuffer() { return __vector_as_bytebuffer(4, 1); }
+  public ByteBuffer sourceInByteBuffer(ByteBuffer _bb) { return __vector_in_bytebuffer(_bb, 4, 1); }
+  public String target() { int o = __offset(6); return o != 0 ? __string(o + bb_pos) : null; }
+  public ByteBuffer targetAsByteBuffer() { return __vector_as_bytebuffer(6, 1); }
+  public ByteBuffer targetInByteBuffer(ByteBuffer _bb) { return __vector_in_bytebuffer(_bb, 6, 1); }
+  public boolean recursive() { int o = __offset(8); return o != 0 ? 0!=bb.get(o + bb_pos) : false; }
+
+  public static int createPathCopyJobStartRequest(FlatBufferBuilder builder,
+      int sourceOffset,
+      int targetOffset,
+      boolean recursive) {
+    builder.startObject(3);
+    PathCopyJobStartRequest.addTarget(builder, targetOffset);
+    PathCopyJobStartRequest.addSource(builder, sourceOffset);
+    PathCopyJobStartRequest.addRecursive(builder, recursive);
+    return PathCopyJobStartRequest.endPathCopyJobStartRequest(builder);
+  }
+
+  public static void startPathCopyJobStartRequest(FlatBufferBuilder builder) { builder.startObject(3); }
+  public static void addSource(FlatBufferBuilder builder, int sourceOffset) { builder.addOffset(0, sourceOffset, 0); }
+  public static void addTarget(FlatBufferBuilder builder, int targetOffset) { builder.addOffset(1, targetOffset, 0); }
+  public static void addRecursive(FlatBufferBuilder builder, boolean recursive) { builder.addBoolean(2, recursive, false); }
+  public static int endPathCopyJobStartRequest(FlatBufferBuilder builder) {
+    int o = builder.endObject();
+    return o;
+  }
+}
+
@@ -0,0 +1,33 @@
+// automatically generated by the FlatBuffers compiler, do not modify
+
+package mbtool.daemon.v3;
+
+import java.nio.*;
+import java.lang.*;
+import java.util.*;
+import com.google.flatbuffers.*;
+
+@SuppressWarnings("unused")
+public final class PathCopyJobStartResponse extends Table {
+  public static PathCopyJobStartResponse getRootAsPathCopyJobStartResponse(ByteBuffer _bb) { return getRootAsPathCopyJobStartResponse(_bb, new PathCopyJobStartResponse()); }
+  public static PathCopyJobStartResponse getRootAsPathCopyJobStartResponse(ByteBuffer _bb, PathCopyJobStartResponse obj) { _bb.order(ByteOrder.LITTLE_ENDIAN); return (obj.__assign(_bb.getInt(_bb.position()) + _bb.position(), _bb)); }
+  public void __init(int _i, ByteBuffer _bb) { bb_pos = _i; bb = _bb; }
+  public PathCopyJobStartResponse __assign(int _i, ByteBuffer _bb) { __init(_i, _bb); return this; }
+
+  public long jobId() { int o = __offset(4); return o != 0 ? bb.getLong(o + bb_pos) : 0L; }
+
+  public static int createPathCopyJobStartResponse(FlatBufferBuilder builder,
+      long job_id) {
+    builder.startObject(1);
+    PathCopyJobStartResponse.addJobId(builder, job_id);
+    return PathCopyJobStartResponse.endPathCopyJobStartResponse(builder);
+  }
+
+  public static void startPathCopyJobStartResponse(FlatBufferBuilder builder) { builder.startObject(1); }
+  public static void addJobId(FlatBufferBuilder builder, long jobId) { builder.addLong(0, jobId, 0L); }
+  public static int endPathCopyJobStartResponse(FlatBufferBuilder builder) {
+    int o = builder.endObject();
+    return o;
+  }
+}
+
@@ -0,0 +1,50 @@
+// automatically generated by the FlatBuffers compiler, do not modify
+
+package mbtool.daemon.v3;
+
+import java.nio.*;
+import java.lang.*;
+import java.util.*;
+import com.google.flatbuffers.*;
+
+@SuppressWarnings("unused")
+public final class PathDirectoryEntry extends Table {
+  public static PathDirectoryEntry getRootAsPathDirectoryEntry(ByteBuffer _bb) { return getRootAsPathDirectoryEntry(_bb, new PathDirectoryEntry()); }
+  public static PathDirectoryEntry getRootAsPathDirectoryEntry(ByteBuffer _bb, PathDirectoryEntry obj) { _bb.order(ByteOrder.LITTLE_ENDIAN); return (obj.__assign(_bb.getInt(_bb.position()) + _bb.position(), _bb)); }
+  public void __init(int _i, ByteBuffer _bb) { bb_pos = _i; bb = _bb; }
+  public PathDirectoryEntry __assign(int _i, ByteBuffer _bb) { __init(_i, _bb); return this; }
+
+  public String name() { int o = __offset(4); return o != 0 ? __string(o + bb_pos) : null; }
+  public ByteBuffer nameAsByteBuffer() { return __vector_as_bytebuffer(4, 1); }
+  public ByteBuffer nameInByteBuffer(ByteBuffer _bb) { return __vector_in_bytebuffer(_bb, 4, 1); }
+  public int type() { int o = __offset(6); return o != 0 ? bb.get(o + bb_pos) & 0xFF : 0; }
+  public StructStat stat() { return stat(new StructStat()); }
+  public StructStat stat(StructStat obj) { int o = __offset(8); return o != 0 ? obj.__assign(__indirect(o + bb_pos), bb) : null; }
+  public String label() { int o = __offset(10); return o != 0 ? __string(o + bb_pos) : null; }
+  public ByteBuffer labelAsByteBuffer() { return __vector_as_bytebuffer(10, 1); }
+  public ByteBuffer labelInByteBuffer(ByteBuffer _bb) { return __vector_in_bytebuffer(_bb, 10, 1); }
+
+  public static int createPathDirectoryEntry(FlatBufferBuilder builder,
+      int nameOffset,
+      int type,
+      int statOffset,
+      int labelOffset) {
+    builder.startObject(4);
+    PathDirectoryEntry.addLabel(builder, labelOffset);
+    PathDirectoryEntry.addStat(builder, statOffset);
+    PathDirectoryEntry.addName(builder, nameOffset);
+    PathDirectoryEntry.addType(builder, type);
+    return PathDirectoryEntry.endPathDirectoryEntry(builder);
+  }
+
+  public static void startPathDirectoryEntry(FlatBufferBuilder builder) { builder.startObject(4); }
+  public static void addName(FlatBufferBuilder builder, int nameOffset) { builder.addOffset(0, nameOffset, 0); }
+  public static void addType(FlatBufferBuilder builder, int type) { builder.addByte(1, (byte)type, (byte)0); }
+  public static void addStat(FlatBufferBuilder builder, int statOffset) { builder.addOffset(2, statOffset, 0); }
+  public static void addLabel(FlatBufferBuilder builder, int labelOffset) { builder.addOffset(3, labelOffset, 0); }
+  public static int endPathDirectoryEntry(FlatBufferBuilder builder) {
+    int o = builder.endObject();
+    return o;
+  }
+}
+
@@ -0,0 +1,47 @@
+// automatically generated by the FlatBuffers compiler, do not modify
+
+package mbtool.daemon.v3;
+
+import java.nio.*;
+import java.lang.*;
+import java.util.*;
+import com.google.flatbuffers.*;
+
+@SuppressWarnings("unused")
+public final class PathListDirectoryRequest extends Table {
+  public static PathListDirectoryRequest getRootAsPathListDirectoryRequest(ByteBuffer _bb) { return getRootAsPathListDirectoryRequest(_bb, new PathListDirectoryRequest()); }
+  public static PathListDirectoryRequest getRootAsPathListDirectoryRequest(ByteBuffer _bb, PathListDirectoryRequest obj) { _bb.order(ByteOrder.LITTLE_ENDIAN); return (obj.__assign(_bb.getInt(_bb.position()) + _bb.position(), _bb)); }
+  public void __init(int _i, ByteBuffer _bb) { bb_pos = _i; bb = _bb; }
+  public PathListDirectoryRequest __assign(int _i, ByteBuffer _bb) { __init(_i, _bb); return this; }
+
+  public String path() { int o = __offset(4); return o != 0 ? __string(o + bb_pos) : null; }
+  public ByteBuffer pathAsByteBuffer() { return __vector_as_bytebuffer(4, 1); }
+  public ByteBuffer pathInByteBuffer(ByteBuffer _bb) { return __vector_in_bytebuffer(_bb, 4, 1); }
+  public boolean withStat() { int o = __offset(6); return o != 0 ? 0!=bb.get(o + bb_pos) : false; }
+  public boolean withLabels() { int o = __offset(8); return o != 0 ? 0!=bb.get(o + bb_pos) : false; }
+  public boolean followSymlinks() { int o = __offset(10); return o != 0 ? 0!=bb.get(o + bb_pos) : false; }
+
+  public static int createPathListDirectoryRequest(FlatBufferBuilder builder,
+      int pathOffset,
+      boolean with_stat,
+      boolean with_labels,
+      boolean follow_symlinks) {
+    builder.startObject(4);
+    PathListDirectoryRequest.addPath(builder, pathOffset);
+    PathListDirectoryRequest.addFollowSymlinks(builder, follow_symlinks);
+    PathListDirectoryRequest.addWithLabels(builder, with_labels);
+    PathListDirectoryRequest.addWithStat(builder, with_stat);
+    return PathListDirectoryRequest.endPathListDirectoryRequest(builder);
+  }
+
+  public static void startPathListDirectoryRequest(FlatBufferBuilder builder) { builder.startObject(4); }
+  public static void addPath(FlatBufferBuilder builder, int pathOffset) { builder.addOffset(0, pathOffset, 0); }
+  public static void addWithStat(FlatBufferBuilder builder, boolean withStat) { builder.addBoolean(1, withStat, false); }
+  public static void addWithLabels(FlatBufferBuilder builder, boolean withLabels) { builder.addBoolean(2, withLabels, false); }
+  public static void addFollowSymlinks(FlatBufferBuilder builder, boolean followSymlinks) { builder.addBoolean(3, followSymlinks, false); }
+  public static int endPathListDirectoryRequest(FlatBufferBuilder builder) {
+    int o = builder.endObject();
+    return o;
+  }
+}
+
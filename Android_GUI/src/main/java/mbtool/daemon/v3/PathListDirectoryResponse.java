@@ -0,0 +1,42 @@
+// automatically generated by the FlatBuffers compiler, do not modify
+
+package mbtool.daemon.v3;
+
+import java.nio.*;
+import java.lang.*;
+import java.util.*;
+import com.google.flatbuffers.*;
+
+@SuppressWarnings("unused")
+public final class PathListDirectoryResponse extends Table {
+  public static PathListDirectoryResponse getRootAsPathListDirectoryResponse(ByteBuffer _bb) { return getRootAsPathListDirectoryResponse(_bb, new PathListDirectoryResponse()); }
+  public static PathListDirectoryResponse getRootAsPathListDirectoryResponse(ByteBuffer _bb, PathListDirectoryResponse obj) { _bb.order(ByteOrder.LITTLE_ENDIAN); return (obj.__assign(_bb.getInt(_bb.position()) + _bb.position(), _bb)); }
+  public void __init(int _i, ByteBuffer _bb) { bb_pos = _i; bb = _bb; }
+  public PathListDirectoryResponse __assign(int _i, ByteBuffer _bb) { __init(_i, _bb); return this; }
+
+  public PathDirectoryEntry entries(int j) { return entries(new PathDirectoryEntry(), j); }
+  public PathDirectoryEntry entries(PathDirectoryEntry obj, int j) { int o = __offset(4); return o != 0 ? obj.__assign(__indirect(__vector(o) + j * 4), bb) : null; }
+  public int entriesLength() { int o = __offset(4); return o != 0 ? __vector_len(o) : 0; }
+  public PathListDirectoryError error() { return error(new PathListDirectoryError()); }
+  public PathListDirectoryError error(PathListDirectoryError obj) { int o = __offset(6); return o != 0 ? obj.__assign(__indirect(o + bb_pos), bb) : null; }
+
+  public static int createPathListDirectoryResponse(FlatBufferBuilder builder,
+      int entriesOffset,
+      int errorOffset) {
+    builder.startObject(2);
+    PathListDirectoryResponse.addError(builder, errorOffset);
+    PathListDirectoryResponse.addEntries(builder, entriesOffset);
+    return PathListDirectoryResponse.endPathListDirectoryResponse(builder);
+  }
+
+  public static void startPathListDirectoryResponse(FlatBufferBuilder builder) { builder.startObject(2); }
+  public static void addEntries(FlatBufferBuilder builder, int entriesOffset) { builder.addOffset(0, entriesOffset, 0); }
+  public static int createEntriesVector(FlatBufferBuilder builder, int[] data) { builder.startVector(4, data.length, 4); for (int i = data.length - 1; i >= 0; i--) builder.addOffset(data[i]); return builder.endVector(); }
+  public static void startEntriesVector(FlatBufferBuilder builder, int numElems) { builder.startVector(4, numElems, 4); }
+  public static void addError(FlatBufferBuilder builder, int errorOffset) { builder.addOffset(1, errorOffset, 0); }
+  public static int endPathListDirectoryResponse(FlatBufferBuilder builder) {
+    int o = builder.endObject();
+    return o;
+  }
+}
+
@@ -0,0 +1,60 @@
+// automatically generated by the FlatBuffers compiler, do not modify
+
+package mbtool.daemon.v3;
+
+import java.nio.*;
+import java.lang.*;
+import java.util.*;
+import com.google.flatbuffers.*;
+
+@SuppressWarnings("unused")
+public final class PerfMetric extends Table {
+  public static PerfMetric getRootAsPerfMetric(ByteBuffer _bb) { return getRootAsPerfMetric(_bb, new PerfMetric()); }
+  public static PerfMetric getRootAsPerfMetric(ByteBuffer _bb, PerfMetric obj) { _bb.order(ByteOrder.LITTLE_ENDIAN); return (obj.__assign(_bb.getInt(_bb.position()) + _bb.position(), _bb)); }
+  public void __init(int _i, ByteBuffer _bb) { bb_pos = _i; bb = _bb; }
+  public PerfMetric __assign(int _i, ByteBuffer _bb) { __init(_i, _bb); return this; }
+
+  public String name() { int o = __offset(4); return o != 0 ? __string(o + bb_pos) : null; }
+  public ByteBuffer nameAsByteBuffer() { return __vector_as_bytebuffer(4, 1); }
+  public ByteBuffer nameInByteBuffer(ByteBuffer _bb) { return __vector_in_bytebuffer(_bb, 4, 1); }
+  public short type() { int o = __offset(6); return o != 0 ? bb.getShort(o + bb_pos) : 0; }
+  public long count() { int o = __offset(8); return o != 0 ? bb.getLong(o + bb_pos) : 0L; }
+  public long sum() { int o = __offset(10); return o != 0 ? bb.getLong(o + bb_pos) : 0L; }
+  public long max() { int o = __offset(12); return o != 0 ? bb.getLong(o + bb_pos) : 0L; }
+  public long buckets(int j) { int o = __offset(14); return o != 0 ? bb.getLong(__vector(o) + j * 8) : 0; }
+  public int bucketsLength() { int o = __offset(14); return o != 0 ? __vector_len(o) : 0; }
+  public ByteBuffer bucketsAsByteBuffer() { return __vector_as_bytebuffer(14, 8); }
+  public ByteBuffer bucketsInByteBuffer(ByteBuffer _bb) { return __vector_in_bytebuffer(_bb, 14, 8); }
+
+  public static int createPerfMetric(FlatBufferBuilder builder,
+      int nameOffset,
+      short type,
+      long count,
+      long sum,
+      long max,
+      int bucketsOffset) {
+    builder.startObject(6);
+    PerfMetric.addMax(builder, max);
+    PerfMetric.addSum(builder, sum);
+    PerfMetric.addCount(builder, count);
+    PerfMetric.addBuckets(builder, bucketsOffset);
+    PerfMetric.addName(builder, nameOffset);
+    PerfMetric.addType(builder, type);
+    return PerfMetric.endPerfMetric(builder);
+  }
+
+  public static void startPerfMetric(FlatBufferBuilder builder) { builder.startObject(6); }
+  public static void addName(FlatBufferBuilder builder, int nameOffset) { builder.addOffset(0, nameOffset, 0); }
+  public static void addType(FlatBufferBuilder builder, short type) { builder.addShort(1, type, 0); }
+  public static void addCount(FlatBufferBuilder builder, long count) { builder.addLong(2, count, 0L); }
+  public static void addSum(FlatBufferBuilder builder, long sum) { builder.addLong(3, sum, 0L); }
+  public static void addMax(FlatBufferBuilder builder, long max) { builder.addLong(4, max, 0L); }
+  public static void addBuckets(FlatBufferBuilder builder, int bucketsOffset) { builder.addOffset(5, bucketsOffset, 0); }
+  public static int createBucketsVector(FlatBufferBuilder builder, long[] data) { builder.startVector(8, data.length, 8); for (int i = data.length - 1; i >= 0; i--) builder.addLong(data[i]); return builder.endVector(); }
+  public static void startBucketsVector(FlatBufferBuilder builder, int numElems) { builder.startVector(8, numElems, 8); }
+  public static int endPerfMetric(FlatBufferBuilder builder) {
+    int o = builder.endObject();
+    return o;
+  }
+}
+
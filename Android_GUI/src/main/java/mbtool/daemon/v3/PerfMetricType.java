@@ -0,0 +1,14 @@
+// automatically generated by the FlatBuffers compiler, do not modify
+
+package mbtool.daemon.v3;
+
+public final class PerfMetricType {
+  private PerfMetricType() { }
+  public static final short COUNTER = 0;
+  public static final short HISTOGRAM = 1;
+
+  public static final String[] names = { "COUNTER", "HISTOGRAM", };
+
+  public static String name(int e) { return names[e]; }
+}
+
@@ -34,8 +34,14 @@ public final class RequestType {
   public static final byte CryptoDecryptRequest = 27;
   public static final byte CryptoGetPwTypeRequest = 28;
   public static final byte PathReadlinkRequest = 29;
+  public static final byte BatchRequest = 30;
+  public static final byte FileGetFdRequest = 31;
+  public static final byte PathCopyJobStartRequest = 32;
+  public static final byte PathCopyJobCancelRequest = 33;
+  public static final byte MbGetPerfCountersRequest = 34;
+  public static final byte PathListDirectoryRequest = 35;
 
-  public static final String[] names = { "NONE", "FileChmodRequest", "FileCloseRequest", "FileOpenRequest", "FileReadRequest", "FileSeekRequest", "FileStatRequest", "FileWriteRequest", "FileSELinuxGetLabelRequest", "FileSELinuxSetLabelRequest", "PathChmodRequest", "PathCopyRequest", "PathSELinuxGetLabelRequest", "PathSELinuxSetLabelRequest", "PathGetDirectorySizeRequest", "MbGetVersionRequest", "MbGetInstalledRomsRequest", "MbGetBootedRomIdRequest", "MbSwitchRomRequest", "MbSetKernelRequest", "MbWipeRomRequest", "MbGetPackagesCountRequest", "RebootRequest", "SignedExecRequest", "ShutdownRequest", "PathDeleteRequest", "PathMkdirRequest", "CryptoDecryptRequest", "CryptoGetPwTypeRequest", "PathReadlinkRequest", };
+  public static final String[] names = { "NONE", "FileChmodRequest", "FileCloseRequest", "FileOpenRequest", "FileReadRequest", "FileSeekRequest", "FileStatRequest", "FileWriteRequest", "FileSELinuxGetLabelRequest", "FileSELinuxSetLabelRequest", "PathChmodRequest", "PathCopyRequest", "PathSELinuxGetLabelRequest", "PathSELinuxSetLabelRequest", "PathGetDirectorySizeRequest", "MbGetVersionRequest", "MbGetInstalledRomsRequest", "MbGetBootedRomIdRequest", "MbSwitchRomRequest", "MbSetKernelRequest", "MbWipeRomRequest", "MbGetPackagesCountRequest", "RebootRequest", "SignedExecRequest", "ShutdownRequest", "PathDeleteRequest", "PathMkdirRequest", "CryptoDecryptRequest", "CryptoGetPwTypeRequest", "PathReadlinkRequest", "BatchRequest", "FileGetFdRequest", "PathCopyJobStartRequest", "PathCopyJobCancelRequest", "MbGetPerfCountersRequest", "PathListDirectoryRequest", };
 
   public static String name(int e) { return names[e]; }
 }
@@ -37,8 +37,17 @@ public final class ResponseType {
   public static final byte CryptoDecryptResponse = 30;
   public static final byte CryptoGetPwTypeResponse = 31;
   public static final byte PathReadlinkResponse = 32;
+  public static final byte BatchResponse = 33;
+  public static final byte FileGetFdResponse = 34;
+  public static final byte PathCopyJobStartResponse = 35;
+  public static final byte PathCopyJobProgressResponse = 36;
+  public static final byte PathCopyJobFinishedResponse = 37;
+  public static final byte PathCopyJobCancelResponse = 38;
+  public static final byte MbWipeRomProgressResponse = 39;
+  public static final byte MbGetPerfCountersResponse = 40;
+  public static final byte PathListDirectoryResponse = 41;
 
-  public static final String[] names = { "NONE", "Invalid", "Unsupported", "FileChmodResponse", "FileCloseResponse", "FileOpenResponse", "FileReadResponse", "FileSeekResponse", "FileStatResponse", "FileWriteResponse", "FileSELinuxGetLabelResponse", "FileSELinuxSetLabelResponse", "PathChmodResponse", "PathCopyResponse", "PathSELinuxGetLabelResponse", "PathSELinuxSetLabelResponse", "PathGetDirectorySizeResponse", "MbGetVersionResponse", "MbGetInstalledRomsResponse", "MbGetBootedRomIdResponse", "MbSwitchRomResponse", "MbSetKernelResponse", "MbWipeRomResponse", "MbGetPackagesCountResponse", "RebootResponse", "SignedExecOutputResponse", "SignedExecResponse", "ShutdownResponse", "PathDeleteResponse", "PathMkdirResponse", "CryptoDecryptResponse", "CryptoGetPwTypeResponse", "PathReadlinkResponse", };
+  public static final String[] names = { "NONE", "Invalid", "Unsupported", "FileChmodResponse", "FileCloseResponse", "FileOpenResponse", "FileReadResponse", "FileSeekResponse", "FileStatResponse", "FileWriteResponse", "FileSELinuxGetLabelResponse", "FileSELinuxSetLabelResponse", "PathChmodResponse", "PathCopyResponse", "PathSELinuxGetLabelResponse", "PathSELinuxSetLabelResponse", "PathGetDirectorySizeResponse", "MbGetVersionResponse", "MbGetInstalledRomsResponse", "MbGetBootedRomIdResponse", "MbSwitchRomResponse", "MbSetKernelResponse", "MbWipeRomResponse", "MbGetPackagesCountResponse", "RebootResponse", "SignedExecOutputResponse", "SignedExecResponse", "ShutdownResponse", "PathDeleteResponse", "PathMkdirResponse", "CryptoDecryptResponse", "CryptoGetPwTypeResponse", "PathReadlinkResponse", "BatchResponse", "FileGetFdResponse", "PathCopyJobStartResponse", "PathCopyJobProgressResponse", "PathCopyJobFinishedResponse", "PathCopyJobCancelResponse", "MbWipeRomProgressResponse", "MbGetPerfCountersResponse", "PathListDirectoryResponse", };
 
   public static String name(int e) { return names[e]; }
 }
@@ -18,13 +18,20 @@
  */
 
 #include <algorithm>
+#include <atomic>
 #include <limits>
 #include <memory>
+#include <optional>
 #include <string>
+#include <string_view>
+#include <thread>
 #include <type_traits>
 #include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 #include <cassert>
+#include <cerrno>
 #include <climits>
 #include <cstdarg>
 #include <cstdio>
@@ -42,11 +49,15 @@
 
 // libmbcommon
 #include <mbcommon/common.h>
+#include <mbcommon/file/standard.h>
+#include <mbcommon/file/stats.h>
 #include <mbcommon/integer.h>
 #include <mbcommon/string.h>
 
 // libmbbootimg
+#include <mbbootimg/delta.h>
 #include <mbbootimg/entry.h>
+#include <mbbootimg/format.h>
 #include <mbbootimg/format/android_defs.h>
 #include <mbbootimg/header.h>
 #include <mbbootimg/reader.h>
@@ -127,6 +138,10 @@ typedef std::unique_ptr<FILE, decltype(fclose) *> ScopedFILE;
     "Available commands:\n" \
     "  unpack         Unpack a boot image\n" \
     "  pack           Assemble boot image from unpacked files\n" \
+    "  repack         Modify a boot image without unpacking it\n" \
+    "  batch          Unpack many boot images in parallel\n" \
+    "  diff           Create a delta between two boot images\n" \
+    "  patch          Apply a delta created by \"diff\" to a boot image\n" \
     "\n" \
     "Pass -h/--help as a argument to a command to see its available options.\n"
 
@@ -146,6 +161,7 @@ typedef std::unique_ptr<FILE, decltype(fclose) *> ScopedFILE;
     "                  (can be specified multiple times)\n" \
     "  --output-<item> <item path>\n" \
     "                  Custom path for a particular item\n" \
+    "  --io-stats      Print I/O statistics for the boot image file\n" \
     "\n" \
     "The following items are extracted from the boot image.\n" \
     "\n" \
@@ -198,6 +214,7 @@ typedef std::unique_ptr<FILE, decltype(fclose) *> ScopedFILE;
     "                  (one of: android, bump, loki, mtk, sony_elf)\n" \
     "  --input-<item> <item path>\n" \
     "                  Custom path for a particular item\n" \
+    "  --io-stats      Print I/O statistics for the boot image file\n" \
     "\n" \
     "The following items are loaded to create a new boot image.\n" \
     "\n" \
@@ -237,6 +254,118 @@ typedef std::unique_ptr<FILE, decltype(fclose) *> ScopedFILE;
     "        bootimgtool pack boot.img -i /tmp/android --input-kernel /tmp/newkernel\n" \
     "\n"
 
+#define HELP_REPACK_USAGE \
+    "Usage: bootimgtool repack <input file> <output file> [<option>...]\n" \
+    "\n" \
+    "Options:\n" \
+    "  -s, --set <field>=<value>\n" \
+    "                  Set a header field (can be specified multiple times)\n" \
+    "  --replace-<image> <image path>\n" \
+    "                  Replace a particular image with the contents of\n" \
+    "                  <image path> (\"-\" for stdin)\n" \
+    "  --io-stats      Print I/O statistics for the boot image files\n" \
+    "\n" \
+    "The output boot image is written directly from the input boot image. The\n" \
+    "header fields and images that are not replaced are copied unchanged and no\n" \
+    "intermediate files are created. The output has the same type as the input.\n" \
+    "\n" \
+    HELP_HEADERS \
+    "\n" \
+    "The header fields use the same names and units as in header.json. If some\n" \
+    "of base and the *_offset fields are set, the others are computed from the\n" \
+    "input boot image, as they would be by \"unpack\".\n" \
+    "\n" \
+    HELP_IMAGES \
+    HELP_IMAGES_ABOOT \
+    "\n" \
+    HELP_LEGEND \
+    "\n" \
+    "Examples:\n" \
+    "\n" \
+    "1. Replace the ramdisk and the kernel command line\n" \
+    "\n" \
+    "        bootimgtool repack boot.img new.img --replace-ramdisk ramdisk.gz \\\n" \
+    "            -s cmdline='console=ttyHSL0,115200,n8'\n" \
+    "\n" \
+    "2. Replace the ramdisk with the output of another command\n" \
+    "\n" \
+    "        patch-ramdisk | bootimgtool repack boot.img new.img --replace-ramdisk -\n" \
+    "\n"
+
+#define HELP_BATCH_USAGE \
+    "Usage: bootimgtool batch [<manifest file>] [<option>...]\n" \
+    "\n" \
+    "Options:\n" \
+    "  -o, --output <output directory>\n" \
+    "                  Output directory (current directory if unspecified)\n" \
+    "  -j, --jobs <count>\n" \
+    "                  Number of images to unpack in parallel\n" \
+    "                  (number of CPUs if unspecified)\n" \
+    "  -t, --type <type>\n" \
+    "                  Enable input format (all enabled if unspecified)\n" \
+    "                  (one of: android, bump, loki, mtk, sony_elf)\n" \
+    "                  (can be specified multiple times)\n" \
+    "\n" \
+    "The manifest is a list of newline-separated boot image paths. Lines\n" \
+    "containing only whitespace and lines that begin with '#' are ignored. If no\n" \
+    "manifest is specified or if it is \"-\", the paths are read from stdin.\n" \
+    "\n" \
+    "Each boot image is unpacked as if by \"bootimgtool unpack -n\" into its own\n" \
+    "directory:\n" \
+    "\n" \
+    "    <output directory>/<image file name>/\n" \
+    "\n" \
+    "If several images have the same file name, \".<n>\" is appended to the names\n" \
+    "of the later directories. A summary with one line per image is printed to\n" \
+    "stdout once all images have been processed.\n" \
+    "\n" \
+    "Examples:\n" \
+    "\n" \
+    "1. Unpack all boot images in the current directory using 4 threads\n" \
+    "\n" \
+    "        ls *.img | bootimgtool batch -j 4 -o extracted\n" \
+    "\n"
+
+#define HELP_DIFF_USAGE \
+    "Usage: bootimgtool diff <old file> <new file> <delta file> [<option>...]\n" \
+    "\n" \
+    "Options:\n" \
+    "  -t, --type <type>\n" \
+    "                  Enable input format (all enabled if unspecified)\n" \
+    "                  (one of: android, bump, loki, mtk, sony_elf)\n" \
+    "                  (can be specified multiple times)\n" \
+    "\n" \
+    "Each image in <new file> is compared with the image of the same type in\n" \
+    "<old file>. Only the data that is not found in the old image is stored in\n" \
+    "the delta, along with the header fields and the type of <new file>.\n" \
+    "\n" \
+    "Examples:\n" \
+    "\n" \
+    "1. Create a delta for a kernel update\n" \
+    "\n" \
+    "        bootimgtool diff boot.img boot-new.img boot.delta\n" \
+    "\n"
+
+#define HELP_PATCH_USAGE \
+    "Usage: bootimgtool patch <old file> <delta file> <output file> [<option>...]\n" \
+    "\n" \
+    "Options:\n" \
+    "  -t, --type <type>\n" \
+    "                  Enable input format (all enabled if unspecified)\n" \
+    "                  (one of: android, bump, loki, mtk, sony_elf)\n" \
+    "                  (can be specified multiple times)\n" \
+    "\n" \
+    "<old file> must be the same boot image that the delta was created from. Each\n" \
+    "image written to <output file> is checked against the checksum stored in\n" \
+    "the delta.\n" \
+    "\n" \
+    "Examples:\n" \
+    "\n" \
+    "1. Apply a delta created by \"bootimgtool diff\"\n" \
+    "\n" \
+    "        bootimgtool patch boot.img boot.delta boot-new.img\n" \
+    "\n"
+
 enum class SourceType
 {
     Header,
@@ -254,6 +383,9 @@ enum class SourceType
 
 using PathMap = std::unordered_map<SourceType, std::string>;
 
+// Long-only options (values must not collide with SourceTypeArg::arg_index)
+constexpr int OPT_IO_STATS = 1000;
+
 static std::string_view source_type_to_string(SourceType type)
 {
     switch (type) {
@@ -547,9 +679,13 @@ static bool write_header(const std::string &path, const Header &header)
     bool failed =
             !writer.StartObject()
             || (cmdline && !cmdline->empty()
-                    && !(writer.Key(FIELD_CMDLINE) && writer.String(*cmdline)))
+                    && !(writer.Key(FIELD_CMDLINE)
+                            && writer.String(cmdline->data(), static_cast<
+                                    rj::SizeType>(cmdline->size()))))
             || (board_name && !board_name->empty()
-                    && !(writer.Key(FIELD_BOARD) && writer.String(*board_name)))
+                    && !(writer.Key(FIELD_BOARD)
+                            && writer.String(board_name->data(), static_cast<
+                                    rj::SizeType>(board_name->size()))))
             || (base
                     && !(writer.Key(FIELD_BASE) && writer.Uint(*base)))
             || (kernel_offset
@@ -589,25 +725,14 @@ static bool write_header(const std::string &path, const Header &header)
     return true;
 }
 
-static bool write_data_file_to_entry(const std::string &path, Writer &writer)
+static bool write_stream_to_entry(FILE *fp, const std::string &path,
+                                  Writer &writer)
 {
-    ScopedFILE fp(fopen(path.c_str(), "rb" CLOEXEC_FLAG), fclose);
-    if (!fp) {
-        // Entries are optional
-        if (errno == ENOENT) {
-            return true;
-        } else {
-            fprintf(stderr, "%s: Failed to open for reading: %s\n",
-                    path.c_str(), strerror(errno));
-            return false;
-        }
-    }
-
     char buf[10240];
     size_t n;
 
     while (true) {
-        n = fread(buf, 1, sizeof(buf), fp.get());
+        n = fread(buf, 1, sizeof(buf), fp);
 
         auto bytes_written = writer.write_data(buf, n);
         if (!bytes_written) {
@@ -617,9 +742,10 @@ static bool write_data_file_to_entry(const std::string &path, Writer &writer)
         }
 
         if (n < sizeof(buf)) {
-            if (ferror(fp.get())) {
+            if (ferror(fp)) {
                 fprintf(stderr, "%s: Failed to read file: %s\n",
                         path.c_str(), strerror(errno));
+                return false;
             } else {
                 break;
             }
@@ -629,6 +755,23 @@ static bool write_data_file_to_entry(const std::string &path, Writer &writer)
     return true;
 }
 
+static bool write_data_file_to_entry(const std::string &path, Writer &writer)
+{
+    ScopedFILE fp(fopen(path.c_str(), "rb" CLOEXEC_FLAG), fclose);
+    if (!fp) {
+        // Entries are optional
+        if (errno == ENOENT) {
+            return true;
+        } else {
+            fprintf(stderr, "%s: Failed to open for reading: %s\n",
+                    path.c_str(), strerror(errno));
+            return false;
+        }
+    }
+
+    return write_stream_to_entry(fp.get(), path, writer);
+}
+
 static bool write_data_entry_to_file(const std::string &path, Reader &reader)
 {
     ScopedFILE fp(fopen(path.c_str(), "wb" CLOEXEC_FLAG), fclose);
@@ -689,6 +832,13 @@ static bool write_entry_to_file(const PathMap &paths, Reader &reader,
     return write_data_entry_to_file(path, reader);
 }
 
+static void print_io_stats(const std::string &path,
+                           const mb::StatsFile &file)
+{
+    fprintf(stderr, "%s: I/O statistics:\n%s", path.c_str(),
+            mb::format_file_stats(file.stats()).c_str());
+}
+
 struct SourceTypeArg
 {
     SourceType type;
@@ -704,10 +854,80 @@ struct SourceTypeArg
     }
 };
 
+static bool unpack_image(const std::string &input_file, const PathMap &paths,
+                         Formats formats, bool io_stats, Format *format_out)
+{
+    // Load the boot image
+    mb::StandardFile file;
+    mb::StatsFile stats_file;
+    Reader reader;
+
+    if (auto r = reader.enable_formats(formats); !r) {
+        fprintf(stderr, "Failed to enable formats: %s\n",
+                r.error().message().c_str());
+        return false;
+    }
+
+    if (io_stats) {
+        if (auto r = file.open(input_file, mb::FileOpenMode::ReadOnly); !r) {
+            fprintf(stderr, "%s: Failed to open for reading: %s\n",
+                    input_file.c_str(), r.error().message().c_str());
+            return false;
+        }
+
+        (void) stats_file.open(&file);
+    }
+
+    if (auto r = io_stats ? reader.open(&stats_file)
+                          : reader.open_filename(input_file); !r) {
+        fprintf(stderr, "%s: Failed to open for reading: %s\n",
+                input_file.c_str(), r.error().message().c_str());
+        return false;
+    }
+
+    auto header = reader.read_header();
+    if (!header) {
+        fprintf(stderr, "%s: Failed to read header: %s\n",
+                input_file.c_str(), header.error().message().c_str());
+        return false;
+    }
+
+    if (!write_header(paths.at(SourceType::Header), header.value())) {
+        return false;
+    }
+
+    while (true) {
+        auto entry = reader.read_entry();
+        if (!entry) {
+            if (entry.error() == ReaderError::EndOfEntries) {
+                break;
+            }
+            fprintf(stderr, "Failed to read entry: %s\n",
+                    entry.error().message().c_str());
+            return false;
+        }
+
+        if (!write_entry_to_file(paths, reader, entry.value())) {
+            return false;
+        }
+    }
+
+    if (io_stats) {
+        print_io_stats(input_file, stats_file);
+    }
+
+    if (format_out) {
+        *format_out = *reader.format();
+    }
+
+    return true;
+}
+
 static bool unpack_main(int argc, char *argv[])
 {
     int opt;
     bool no_prefix = false;
+    bool io_stats = false;
     std::string input_file;
     std::string output_dir;
     std::string prefix;
@@ -736,6 +956,7 @@ static bool unpack_main(int argc, char *argv[])
         {"prefix",   required_argument, nullptr, 'p'},
         {"noprefix", required_argument, nullptr, 'n'},
         {"type",     required_argument, nullptr, 't'},
+        {"io-stats", no_argument,       nullptr, OPT_IO_STATS},
         {"help",     no_argument,       nullptr, 'h'},
     };
 
@@ -767,6 +988,7 @@ static bool unpack_main(int argc, char *argv[])
         case 'o': output_dir = optarg; break;
         case 'p': prefix = optarg;     break;
         case 'n': no_prefix = true;    break;
+        case OPT_IO_STATS: io_stats = true; break;
         case 't': {
             if (auto f = name_to_format(optarg)) {
                 formats |= *f;
@@ -817,59 +1039,18 @@ static bool unpack_main(int argc, char *argv[])
         return false;
     }
 
-    // Load the boot image
-    Reader reader;
-
     if (!formats) {
         formats = ALL_FORMATS;
     }
 
-    if (auto r = reader.enable_formats(formats); !r) {
-        fprintf(stderr, "Failed to enable formats: %s\n",
-                r.error().message().c_str());
-        return false;
-    }
-
-    if (auto r = reader.open_filename(input_file); !r) {
-        fprintf(stderr, "%s: Failed to open for reading: %s\n",
-                input_file.c_str(), r.error().message().c_str());
-        return false;
-    }
-
-    auto header = reader.read_header();
-    if (!header) {
-        fprintf(stderr, "%s: Failed to read header: %s\n",
-                input_file.c_str(), header.error().message().c_str());
-        return false;
-    }
-
-    if (!write_header(paths[SourceType::Header], header.value())) {
-        return false;
-    }
-
-    while (true) {
-        auto entry = reader.read_entry();
-        if (!entry) {
-            if (entry.error() == ReaderError::EndOfEntries) {
-                break;
-            }
-            fprintf(stderr, "Failed to read entry: %s\n",
-                    entry.error().message().c_str());
-            return false;
-        }
-
-        if (!write_entry_to_file(paths, reader, entry.value())) {
-            return false;
-        }
-    }
-
-    return true;
+    return unpack_image(input_file, paths, formats, io_stats, nullptr);
 }
 
 static bool pack_main(int argc, char *argv[])
 {
     int opt;
     bool no_prefix = false;
+    bool io_stats = false;
     std::string output_file;
     std::string input_dir;
     std::string prefix;
@@ -899,6 +1080,7 @@ static bool pack_main(int argc, char *argv[])
         {"prefix",   required_argument, nullptr, 'p'},
         {"noprefix", required_argument, nullptr, 'n'},
         {"type",     required_argument, nullptr, 't'},
+        {"io-stats", no_argument,       nullptr, OPT_IO_STATS},
         {"help",     no_argument,       nullptr, 'h'},
     };
 
@@ -930,6 +1112,7 @@ static bool pack_main(int argc, char *argv[])
         case 'i': input_dir = optarg; break;
         case 'p': prefix = optarg;    break;
         case 'n': no_prefix = true;   break;
+        case OPT_IO_STATS: io_stats = true; break;
         case 't': {
             if (auto f = name_to_format(optarg)) {
                 format = *f;
@@ -975,6 +1158,8 @@ static bool pack_main(int argc, char *argv[])
     }
 
     // Load the boot image
+    mb::StandardFile file;
+    mb::StatsFile stats_file;
     Writer writer;
 
     if (auto r = writer.set_format(format); !r) {
@@ -983,7 +1168,20 @@ static bool pack_main(int argc, char *argv[])
         return false;
     }
 
-    if (auto r = writer.open_filename(output_file); !r) {
+    if (io_stats) {
+        // Open in read/write mode since some formats need to reread the file
+        if (auto r = file.open(output_file, mb::FileOpenMode::ReadWriteTrunc);
+                !r) {
+            fprintf(stderr, "%s: Failed to open for writing: %s\n",
+                    output_file.c_str(), r.error().message().c_str());
+            return false;
+        }
+
+        (void) stats_file.open(&file);
+    }
+
+    if (auto r = io_stats ? writer.open(&stats_file)
+                          : writer.open_filename(output_file); !r) {
         fprintf(stderr, "%s: Failed to open for writing: %s\n",
                 output_file.c_str(), r.error().message().c_str());
         return false;
@@ -1028,6 +1226,747 @@ static bool pack_main(int argc, char *argv[])
         return false;
     }
 
+    if (io_stats) {
+        if (auto r = file.close(); !r) {
+            fprintf(stderr, "%s: Failed to close file: %s\n",
+                    output_file.c_str(), r.error().message().c_str());
+            return false;
+        }
+
+        print_io_stats(output_file, stats_file);
+    }
+
+    return true;
+}
+
+static bool set_header_fields(Header &header,
+                              const std::vector<std::string> &fields)
+{
+    static const char *fmt_unsupported =
+            "Ignoring unsupported key for boot image type: '%s'\n";
+
+    std::optional<uint32_t> base;
+    std::optional<uint32_t> kernel_offset;
+    std::optional<uint32_t> ramdisk_offset;
+    std::optional<uint32_t> second_offset;
+    std::optional<uint32_t> tags_offset;
+    bool have_offsets = false;
+
+    for (auto const &field : fields) {
+        auto pos = field.find('=');
+        if (pos == std::string::npos) {
+            fprintf(stderr, "Invalid header field (expected <field>=<value>): "
+                    "'%s'\n", field.c_str());
+            return false;
+        }
+
+        auto key = field.substr(0, pos);
+        auto value = field.substr(pos + 1);
+        uint32_t num = 0;
+
+        if (key != FIELD_CMDLINE && key != FIELD_BOARD
+                && !mb::str_to_num(value.c_str(), 0, num)) {
+            fprintf(stderr, "Invalid value for '%s': '%s'\n",
+                    key.c_str(), value.c_str());
+            return false;
+        }
+
+        bool ret = true;
+
+        if (key == FIELD_CMDLINE) {
+            ret = header.set_kernel_cmdline(value);
+        } else if (key == FIELD_BOARD) {
+            ret = header.set_board_name(value);
+        } else if (key == FIELD_BASE) {
+            base = num;
+            have_offsets = true;
+        } else if (key == FIELD_KERNEL_OFFSET) {
+            kernel_offset = num;
+            have_offsets = true;
+        } else if (key == FIELD_RAMDISK_OFFSET) {
+            ramdisk_offset = num;
+            have_offsets = true;
+        } else if (key == FIELD_SECOND_OFFSET) {
+            second_offset = num;
+            have_offsets = true;
+        } else if (key == FIELD_TAGS_OFFSET) {
+            tags_offset = num;
+            have_offsets = true;
+        } else if (key == FIELD_IPL_ADDRESS) {
+            ret = header.set_sony_ipl_address(num);
+        } else if (key == FIELD_RPM_ADDRESS) {
+            ret = header.set_sony_rpm_address(num);
+        } else if (key == FIELD_APPSBL_ADDRESS) {
+            ret = header.set_sony_appsbl_address(num);
+        } else if (key == FIELD_ENTRYPOINT) {
+            ret = header.set_entrypoint_address(num);
+        } else if (key == FIELD_PAGE_SIZE) {
+            ret = header.set_page_size(num);
+        } else {
+            fprintf(stderr, "Unknown key '%s'\n", key.c_str());
+            return false;
+        }
+
+        if (!ret) {
+            fprintf(stderr, fmt_unsupported, key.c_str());
+        }
+    }
+
+    if (!have_offsets) {
+        return true;
+    }
+
+    // Fill in the fields that were not specified from the existing header
+    std::optional<uint32_t> old_base;
+    auto old_kernel = header.kernel_address();
+    auto old_ramdisk = header.ramdisk_address();
+    auto old_second = header.secondboot_address();
+    auto old_tags = header.kernel_tags_address();
+
+    absolute_to_offset(old_base, old_kernel, old_ramdisk, old_second,
+                       old_tags);
+
+    if (!base) {
+        base = old_base;
+    }
+    if (!kernel_offset) {
+        kernel_offset = old_kernel;
+    }
+    if (!ramdisk_offset) {
+        ramdisk_offset = old_ramdisk;
+    }
+    if (!second_offset) {
+        second_offset = old_second;
+    }
+    if (!tags_offset) {
+        tags_offset = old_tags;
+    }
+
+    if (!offset_to_absolute(base, kernel_offset, ramdisk_offset, second_offset,
+                            tags_offset)) {
+        return false;
+    }
+
+    if (kernel_offset && !header.set_kernel_address(kernel_offset)) {
+        fprintf(stderr, fmt_unsupported, FIELD_KERNEL_OFFSET);
+    }
+    if (ramdisk_offset && !header.set_ramdisk_address(ramdisk_offset)) {
+        fprintf(stderr, fmt_unsupported, FIELD_RAMDISK_OFFSET);
+    }
+    if (second_offset && !header.set_secondboot_address(second_offset)) {
+        fprintf(stderr, fmt_unsupported, FIELD_SECOND_OFFSET);
+    }
+    if (tags_offset && !header.set_kernel_tags_address(tags_offset)) {
+        fprintf(stderr, fmt_unsupported, FIELD_TAGS_OFFSET);
+    }
+
+    return true;
+}
+
+static bool repack_main(int argc, char *argv[])
+{
+    int opt;
+    bool io_stats = false;
+    std::string input_file;
+    std::string output_file;
+    std::vector<std::string> fields;
+    PathMap paths;
+
+    constexpr char source_arg_prefix[] = "replace-";
+
+    auto sources = {
+        SourceTypeArg(SourceType::Kernel, source_arg_prefix),
+        SourceTypeArg(SourceType::Ramdisk, source_arg_prefix),
+        SourceTypeArg(SourceType::SecondBoot, source_arg_prefix),
+        SourceTypeArg(SourceType::DeviceTree, source_arg_prefix),
+        SourceTypeArg(SourceType::Aboot, source_arg_prefix),
+        SourceTypeArg(SourceType::MtkKernelHeader, source_arg_prefix),
+        SourceTypeArg(SourceType::MtkRamdiskHeader, source_arg_prefix),
+        SourceTypeArg(SourceType::SonyIpl, source_arg_prefix),
+        SourceTypeArg(SourceType::SonyRpm, source_arg_prefix),
+        SourceTypeArg(SourceType::SonyAppsbl, source_arg_prefix),
+    };
+
+    static const char short_options[] = "s:" "h";
+
+    std::vector<option> long_options{
+        {"set",      required_argument, nullptr, 's'},
+        {"io-stats", no_argument,       nullptr, OPT_IO_STATS},
+        {"help",     no_argument,       nullptr, 'h'},
+    };
+
+    for (auto const &s : sources) {
+        long_options.push_back({s.arg_name.c_str(), required_argument, nullptr,
+                                s.arg_index});
+    }
+
+    long_options.push_back({nullptr, 0, nullptr, 0});
+
+    int long_index = 0;
+
+    while ((opt = getopt_long(argc, argv, short_options,
+                              long_options.data(), &long_index)) != -1) {
+        auto it = std::find_if(
+            sources.begin(), sources.end(),
+            [&opt](auto const &s) {
+                return s.arg_index == opt;
+            }
+        );
+
+        if (it != sources.end()) {
+            paths[it->type] = optarg;
+            continue;
+        }
+
+        switch (opt) {
+        case 's': fields.emplace_back(optarg); break;
+        case OPT_IO_STATS: io_stats = true; break;
+        case 'h':
+            fputs(HELP_REPACK_USAGE, stdout);
+            return true;
+        default:
+            fputs(HELP_REPACK_USAGE, stderr);
+            return false;
+        }
+    }
+
+    // There should be two other arguments
+    if (argc - optind != 2) {
+        fputs(HELP_REPACK_USAGE, stderr);
+        return false;
+    }
+
+    input_file = argv[optind];
+    output_file = argv[optind + 1];
+
+    if (std::count_if(paths.begin(), paths.end(), [](auto const &p) {
+        return p.second == "-";
+    }) > 1) {
+        fprintf(stderr, "stdin can only be used for one image\n");
+        return false;
+    }
+
+    mb::StandardFile in_file;
+    mb::StandardFile out_file;
+    mb::StatsFile in_stats_file;
+    mb::StatsFile out_stats_file;
+    Reader reader;
+    Writer writer;
+
+    if (auto r = reader.enable_formats_all(); !r) {
+        fprintf(stderr, "Failed to enable formats: %s\n",
+                r.error().message().c_str());
+        return false;
+    }
+
+    if (io_stats) {
+        if (auto r = in_file.open(input_file, mb::FileOpenMode::ReadOnly);
+                !r) {
+            fprintf(stderr, "%s: Failed to open for reading: %s\n",
+                    input_file.c_str(), r.error().message().c_str());
+            return false;
+        }
+
+        (void) in_stats_file.open(&in_file);
+    }
+
+    if (auto r = io_stats ? reader.open(&in_stats_file)
+                          : reader.open_filename(input_file); !r) {
+        fprintf(stderr, "%s: Failed to open for reading: %s\n",
+                input_file.c_str(), r.error().message().c_str());
+        return false;
+    }
+
+    auto header = reader.read_header();
+    if (!header) {
+        fprintf(stderr, "%s: Failed to read header: %s\n",
+                input_file.c_str(), header.error().message().c_str());
+        return false;
+    }
+
+    if (!set_header_fields(header.value(), fields)) {
+        return false;
+    }
+
+    if (auto r = writer.set_format(*reader.format()); !r) {
+        fprintf(stderr, "Failed to set format: %s\n",
+                r.error().message().c_str());
+        return false;
+    }
+
+    if (io_stats) {
+        if (auto r = out_file.open(output_file, mb::FileOpenMode::ReadWriteTrunc);
+                !r) {
+            fprintf(stderr, "%s: Failed to open for writing: %s\n",
+                    output_file.c_str(), r.error().message().c_str());
+            return false;
+        }
+
+        (void) out_stats_file.open(&out_file);
+    }
+
+    if (auto r = io_stats ? writer.open(&out_stats_file)
+                          : writer.open_filename(output_file); !r) {
+        fprintf(stderr, "%s: Failed to open for writing: %s\n",
+                output_file.c_str(), r.error().message().c_str());
+        return false;
+    }
+
+    if (auto r = writer.write_header(header.value()); !r) {
+        fprintf(stderr, "%s: Failed to write header: %s\n",
+                output_file.c_str(), r.error().message().c_str());
+        return false;
+    }
+
+    while (true) {
+        auto entry = writer.get_entry();
+        if (!entry) {
+            if (entry.error() == WriterError::EndOfEntries) {
+                break;
+            }
+            fprintf(stderr, "Failed to get entry: %s\n",
+                    entry.error().message().c_str());
+            return false;
+        }
+
+        auto type = entry.value().type();
+
+        if (auto r = writer.write_entry(entry.value()); !r) {
+            fprintf(stderr, "Failed to write entry: %s\n",
+                    r.error().message().c_str());
+            return false;
+        }
+
+        auto it = paths.find(entry_type_to_source_type(type));
+
+        if (it == paths.end()) {
+            // Copy entry directly. Entries missing from the input are left
+            // empty.
+            if (auto r = writer.copy_entry_from(reader, type);
+                    !r && r.error() != ReaderError::EndOfEntries) {
+                fprintf(stderr, "Failed to copy entry: %s\n",
+                        r.error().message().c_str());
+                return false;
+            }
+        } else if (it->second == "-") {
+            if (!write_stream_to_entry(stdin, "<stdin>", writer)) {
+                return false;
+            }
+        } else {
+            ScopedFILE fp(fopen(it->second.c_str(), "rb" CLOEXEC_FLAG),
+                          fclose);
+            if (!fp) {
+                fprintf(stderr, "%s: Failed to open for reading: %s\n",
+                        it->second.c_str(), strerror(errno));
+                return false;
+            }
+
+            if (!write_stream_to_entry(fp.get(), it->second, writer)) {
+                return false;
+            }
+        }
+    }
+
+    if (auto r = writer.close(); !r) {
+        fprintf(stderr, "%s: Failed to close boot image: %s\n",
+                output_file.c_str(), r.error().message().c_str());
+        return false;
+    }
+
+    if (io_stats) {
+        print_io_stats(input_file, in_stats_file);
+        print_io_stats(output_file, out_stats_file);
+    }
+
+    return true;
+}
+
+static bool read_manifest(const std::string &path,
+                          std::vector<std::string> &images)
+{
+    ScopedFILE fp(nullptr, fclose);
+    FILE *input = stdin;
+
+    if (path != "-") {
+        fp.reset(fopen(path.c_str(), "r" CLOEXEC_FLAG));
+        if (!fp) {
+            fprintf(stderr, "%s: Failed to open for reading: %s\n",
+                    path.c_str(), strerror(errno));
+            return false;
+        }
+        input = fp.get();
+    }
+
+    char buf[PATH_MAX + 2];
+
+    while (fgets(buf, sizeof(buf), input)) {
+        std::string_view line(buf);
+
+        while (!line.empty() && (line.back() == '\n' || line.back() == '\r')) {
+            line.remove_suffix(1);
+        }
+
+        auto start = line.find_first_not_of(" \t");
+        if (start == std::string_view::npos || line[start] == '#') {
+            continue;
+        }
+
+        images.emplace_back(line);
+    }
+
+    if (ferror(input)) {
+        fprintf(stderr, "%s: Failed to read manifest: %s\n",
+                path.c_str(), strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+struct BatchJob
+{
+    std::string input_file;
+    std::string output_dir;
+    std::optional<Format> format;
+    bool success = false;
+};
+
+static void batch_unpack(BatchJob &job, Formats formats)
+{
+    PathMap paths;
+
+    for (auto type : {
+        SourceType::Header,
+        SourceType::Kernel,
+        SourceType::Ramdisk,
+        SourceType::SecondBoot,
+        SourceType::DeviceTree,
+        SourceType::MtkKernelHeader,
+        SourceType::MtkRamdiskHeader,
+        SourceType::SonyIpl,
+        SourceType::SonyRpm,
+        SourceType::SonyAppsbl,
+    }) {
+        paths[type] = mb::io::path_join({job.output_dir,
+                std::string(get_default_filename(type))});
+    }
+
+    if (auto r = mb::io::create_directories(job.output_dir); !r) {
+        fprintf(stderr, "%s: Failed to create directory: %s\n",
+                job.output_dir.c_str(), r.error().message().c_str());
+        return;
+    }
+
+    Format format;
+
+    job.success = unpack_image(job.input_file, paths, formats, false, &format);
+    if (job.success) {
+        job.format = format;
+    }
+}
+
+static bool batch_main(int argc, char *argv[])
+{
+    int opt;
+    std::string manifest_file;
+    std::string output_dir;
+    unsigned int jobs = 0;
+    Formats formats;
+
+    static const char short_options[] = "o:j:t:" "h";
+
+    static const option long_options[] = {
+        {"output", required_argument, nullptr, 'o'},
+        {"jobs",   required_argument, nullptr, 'j'},
+        {"type",   required_argument, nullptr, 't'},
+        {"help",   no_argument,       nullptr, 'h'},
+        {nullptr,  0,                 nullptr, 0},
+    };
+
+    int long_index = 0;
+
+    while ((opt = getopt_long(argc, argv, short_options,
+                              long_options, &long_index)) != -1) {
+        switch (opt) {
+        case 'o': output_dir = optarg; break;
+        case 'j':
+            if (!mb::str_to_num(optarg, 10, jobs) || jobs == 0) {
+                fprintf(stderr, "Invalid job count: '%s'\n", optarg);
+                return false;
+            }
+            break;
+        case 't': {
+            if (auto f = name_to_format(optarg)) {
+                formats |= *f;
+            } else {
+                fprintf(stderr, "Invalid format '%s'\n", optarg);
+                return false;
+            }
+            break;
+        }
+        case 'h':
+            fputs(HELP_BATCH_USAGE, stdout);
+            return true;
+        default:
+            fputs(HELP_BATCH_USAGE, stderr);
+            return false;
+        }
+    }
+
+    // There can be at most one other argument
+    if (argc - optind > 1) {
+        fputs(HELP_BATCH_USAGE, stderr);
+        return false;
+    }
+
+    manifest_file = argc - optind == 1 ? argv[optind] : "-";
+
+    if (output_dir.empty()) {
+        output_dir = ".";
+    }
+
+    if (!formats) {
+        formats = ALL_FORMATS;
+    }
+
+    std::vector<std::string> images;
+
+    if (!read_manifest(manifest_file, images)) {
+        return false;
+    }
+
+    // Assign output directories up front so that the results do not depend on
+    // the order in which the workers finish
+    std::vector<BatchJob> batch(images.size());
+    std::unordered_set<std::string> dir_names;
+
+    for (size_t i = 0; i < images.size(); ++i) {
+        auto name = mb::io::base_name(images[i]);
+        auto unique_name = name;
+
+        for (size_t n = 1; !dir_names.insert(unique_name).second; ++n) {
+            unique_name = mb::format("%s.%zu", name.c_str(), n);
+        }
+
+        batch[i].input_file = std::move(images[i]);
+        batch[i].output_dir = mb::io::path_join({output_dir, unique_name});
+    }
+
+    if (jobs == 0) {
+        jobs = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+    jobs = static_cast<unsigned int>(
+            std::min<size_t>(jobs, std::max<size_t>(batch.size(), 1)));
+
+    // Images differ greatly in size, so workers take the next image as soon as
+    // they are done instead of being assigned a fixed share
+    std::atomic_size_t next_job{0};
+    std::vector<std::thread> workers;
+
+    auto worker = [&] {
+        size_t i;
+        while ((i = next_job++) < batch.size()) {
+            batch_unpack(batch[i], formats);
+        }
+    };
+
+    for (unsigned int i = 1; i < jobs; ++i) {
+        workers.emplace_back(worker);
+    }
+    worker();
+
+    for (auto &t : workers) {
+        t.join();
+    }
+
+    // Summary
+    size_t failed = 0;
+
+    for (auto const &job : batch) {
+        if (job.success) {
+            printf("OK      %s (%s) -> %s\n", job.input_file.c_str(),
+                   std::string(format_to_name(*job.format)).c_str(),
+                   job.output_dir.c_str());
+        } else {
+            printf("FAILED  %s\n", job.input_file.c_str());
+            ++failed;
+        }
+    }
+
+    printf("\n%zu images, %zu succeeded, %zu failed\n",
+           batch.size(), batch.size() - failed, failed);
+
+    return failed == 0;
+}
+
+static bool parse_delta_args(int argc, char *argv[], const char *usage,
+                             Formats &formats, std::string (&args)[3],
+                             bool &show_help)
+{
+    int opt;
+
+    static const char short_options[] = "t:" "h";
+
+    static const option long_options[] = {
+        {"type",   required_argument, nullptr, 't'},
+        {"help",   no_argument,       nullptr, 'h'},
+        {nullptr,  0,                 nullptr, 0},
+    };
+
+    int long_index = 0;
+
+    show_help = false;
+
+    while ((opt = getopt_long(argc, argv, short_options,
+                              long_options, &long_index)) != -1) {
+        switch (opt) {
+        case 't': {
+            if (auto f = name_to_format(optarg)) {
+                formats |= *f;
+            } else {
+                fprintf(stderr, "Invalid format '%s'\n", optarg);
+                return false;
+            }
+            break;
+        }
+        case 'h':
+            fputs(usage, stdout);
+            show_help = true;
+            return true;
+        default:
+            fputs(usage, stderr);
+            return false;
+        }
+    }
+
+    // There should be three other arguments
+    if (argc - optind != 3) {
+        fputs(usage, stderr);
+        return false;
+    }
+
+    for (size_t i = 0; i < 3; ++i) {
+        args[i] = argv[optind + static_cast<int>(i)];
+    }
+
+    if (!formats) {
+        formats = ALL_FORMATS;
+    }
+
+    return true;
+}
+
+static bool open_delta_reader(Reader &reader, Formats formats,
+                              const std::string &path)
+{
+    if (auto r = reader.enable_formats(formats); !r) {
+        fprintf(stderr, "Failed to enable input boot image formats: %s\n",
+                r.error().message().c_str());
+        return false;
+    }
+
+    if (auto r = reader.open_filename(path); !r) {
+        fprintf(stderr, "%s: Failed to open for reading: %s\n",
+                path.c_str(), r.error().message().c_str());
+        return false;
+    }
+
+    return true;
+}
+
+static bool diff_main(int argc, char *argv[])
+{
+    Formats formats;
+    std::string args[3];
+    bool show_help;
+
+    if (!parse_delta_args(argc, argv, HELP_DIFF_USAGE, formats, args,
+                          show_help)) {
+        return false;
+    } else if (show_help) {
+        return true;
+    }
+
+    auto const &[old_file, new_file, delta_file] = args;
+
+    Reader old_reader;
+    Reader new_reader;
+    mb::StandardFile out_file;
+
+    if (!open_delta_reader(old_reader, formats, old_file)
+            || !open_delta_reader(new_reader, formats, new_file)) {
+        return false;
+    }
+
+    if (auto r = out_file.open(delta_file, mb::FileOpenMode::WriteOnly); !r) {
+        fprintf(stderr, "%s: Failed to open for writing: %s\n",
+                delta_file.c_str(), r.error().message().c_str());
+        return false;
+    }
+
+    if (auto r = delta_create(old_reader, new_reader, out_file); !r) {
+        fprintf(stderr, "%s: Failed to create delta: %s\n",
+                delta_file.c_str(), r.error().message().c_str());
+        return false;
+    }
+
+    if (auto r = out_file.close(); !r) {
+        fprintf(stderr, "%s: Failed to close file: %s\n",
+                delta_file.c_str(), r.error().message().c_str());
+        return false;
+    }
+
+    return true;
+}
+
+static bool patch_main(int argc, char *argv[])
+{
+    Formats formats;
+    std::string args[3];
+    bool show_help;
+
+    if (!parse_delta_args(argc, argv, HELP_PATCH_USAGE, formats, args,
+                          show_help)) {
+        return false;
+    } else if (show_help) {
+        return true;
+    }
+
+    auto const &[old_file, delta_file, output_file] = args;
+
+    Reader old_reader;
+    mb::StandardFile delta_in;
+    mb::StandardFile out_file;
+
+    if (!open_delta_reader(old_reader, formats, old_file)) {
+        return false;
+    }
+
+    if (auto r = delta_in.open(delta_file, mb::FileOpenMode::ReadOnly); !r) {
+        fprintf(stderr, "%s: Failed to open for reading: %s\n",
+                delta_file.c_str(), r.error().message().c_str());
+        return false;
+    }
+
+    if (auto r = out_file.open(output_file, mb::FileOpenMode::ReadWriteTrunc);
+            !r) {
+        fprintf(stderr, "%s: Failed to open for writing: %s\n",
+                output_file.c_str(), r.error().message().c_str());
+        return false;
+    }
+
+    if (auto r = delta_apply(old_reader, delta_in, out_file); !r) {
+        fprintf(stderr, "%s: Failed to apply delta: %s\n",
+                delta_file.c_str(), r.error().message().c_str());
+        return false;
+    }
+
+    if (auto r = out_file.close(); !r) {
+        fprintf(stderr, "%s: Failed to close file: %s\n",
+                output_file.c_str(), r.error().message().c_str());
+        return false;
+    }
+
     return true;
 }
 
@@ -1045,6 +1984,14 @@ int main(int argc, char *argv[])
         ret = unpack_main(--argc, ++argv);
     } else if (command == "pack") {
         ret = pack_main(--argc, ++argv);
+    } else if (command == "repack") {
+        ret = repack_main(--argc, ++argv);
+    } else if (command == "batch") {
+        ret = batch_main(--argc, ++argv);
+    } else if (command == "diff") {
+        ret = diff_main(--argc, ++argv);
+    } else if (command == "patch") {
+        ret = patch_main(--argc, ++argv);
     } else {
         fputs(HELP_MAIN_USAGE, stderr);
         return EXIT_FAILURE;
@@ -1,4 +1,5 @@
 set(MBP_ENABLE_TESTS TRUE CACHE BOOL "Enable building of tests")
+set(MBP_ENABLE_BENCHMARKS FALSE CACHE BOOL "Enable building of benchmarks")
 
 if(MBP_ENABLE_TESTS)
     enable_testing()
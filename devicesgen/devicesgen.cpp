@@ -25,9 +25,11 @@
 
 #include <rapidjson/filewritestream.h>
 #include <rapidjson/prettywriter.h>
+#include <rapidjson/stringbuffer.h>
 #include <rapidjson/writer.h>
 #include <yaml-cpp/yaml.h>
 
+#include "mbdevice/binary.h"
 #include "mbdevice/json.h"
 #include "mbdevice/schema.h"
 
@@ -169,8 +171,59 @@ static void usage(FILE *stream)
             "Options:\n"
             "  -o, --output <file>\n"
             "                   Output file (outputs to stdout if omitted)\n"
+            "  -f, --format <json|binary>\n"
+            "                   Output format (defaults to json)\n"
             "  -h, --help       Display this help message\n"
-            "  --styled         Output in human-readable format\n");
+            "  --styled         Output in human-readable format (json only)\n");
+}
+
+/*!
+ * \brief Write validated device list as a binary device table
+ *
+ * The document is validated against the schema while it is serialized and the
+ * devices are then loaded with the same code paths that consume devices.json.
+ */
+static bool write_binary(Document &d, const SchemaDocument &sd, FILE *fp)
+{
+    StringBuffer sb;
+    Writer<StringBuffer> writer(sb);
+
+    if (!validate_and_write(d, sd, writer)) {
+        return false;
+    }
+
+    std::vector<Device> devices;
+    JsonError error;
+
+    if (!device_list_from_json({sb.GetString(), sb.GetSize()}, devices,
+                               error)) {
+        fprintf(stderr, "Failed to load validated device list\n");
+        return false;
+    }
+
+    for (auto const &device : devices) {
+        if (auto flags = device.validate()) {
+            fprintf(stderr, "%s: Device failed validation: 0x%" PRIx32 "\n",
+                    device.id().c_str(), static_cast<uint32_t>(flags));
+            return false;
+        }
+    }
+
+    auto data = device_list_to_binary(devices);
+    if (!data) {
+        fprintf(stderr, "Failed to create binary device table: %s\n",
+                data.error().message().c_str());
+        return false;
+    }
+
+    if (fwrite(data.value().data(), 1, data.value().size(), fp)
+            != data.value().size()) {
+        fprintf(stderr, "Failed to write binary device table: %s\n",
+                strerror(errno));
+        return false;
+    }
+
+    return true;
 }
 
 int main(int argc, char *argv[])
@@ -181,11 +234,12 @@ int main(int argc, char *argv[])
         OPT_STYLED             = 1000,
     };
 
-    static const char short_options[] = "o:h";
+    static const char short_options[] = "o:f:h";
 
     static struct option long_options[] = {
         {"styled", no_argument, 0, OPT_STYLED},
         {"output", required_argument, 0, 'o'},
+        {"format", required_argument, 0, 'f'},
         {"help", no_argument, 0, 'h'},
         {0, 0, 0, 0}
     };
@@ -194,6 +248,7 @@ int main(int argc, char *argv[])
 
     const char *output_file = nullptr;
     bool styled = false;
+    bool binary = false;
 
     while ((opt = getopt_long(argc, argv, short_options,
                               long_options, &long_index)) != -1) {
@@ -206,6 +261,18 @@ int main(int argc, char *argv[])
             output_file = optarg;
             break;
 
+        case 'f':
+            if (strcmp(optarg, "json") == 0) {
+                binary = false;
+            } else if (strcmp(optarg, "binary") == 0) {
+                binary = true;
+            } else {
+                fprintf(stderr, "Invalid format: %s\n", optarg);
+                usage(stderr);
+                return EXIT_FAILURE;
+            }
+            break;
+
         case 'h':
             usage(stdout);
             return EXIT_SUCCESS;
@@ -219,7 +286,7 @@ int main(int argc, char *argv[])
     FILE *fp = stdout;
 
     if (output_file) {
-        fp = fopen(output_file, "we");
+        fp = fopen(output_file, binary ? "wbe" : "we");
         if (!fp) {
             fprintf(stderr, "%s: Failed to open file: %s\n",
                     output_file, strerror(errno));
@@ -245,7 +312,9 @@ int main(int argc, char *argv[])
         return EXIT_FAILURE;
     }
 
-    if (styled) {
+    if (binary) {
+        ret = write_binary(d, *sd, fp);
+    } else if (styled) {
         PrettyWriter<FileWriteStream> writer(os);
         ret = validate_and_write(d, *sd, writer);
     } else {
@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <getopt.h>
+
+#include "mblog/binary_log.h"
+#include "mblog/logging.h"
+
+static void usage(FILE *stream, const char *prog_name)
+{
+    fprintf(stream,
+            "Usage: %s [option...] <binary log file>\n"
+            "\n"
+            "Options:\n"
+            "  -f, --format <format>\n"
+            "                   Output format (default: %s)\n"
+            "  -h, --help       Display this help message\n",
+            prog_name, mb::log::format().c_str());
+}
+
+int main(int argc, char *argv[])
+{
+    int opt;
+
+    static constexpr char short_options[] = "f:h";
+
+    static option long_options[] = {
+        {"format", required_argument, nullptr, 'f'},
+        {"help",   no_argument,       nullptr, 'h'},
+        {nullptr,  0,                 nullptr, 0},
+    };
+
+    int long_index = 0;
+
+    while ((opt = getopt_long(argc, argv, short_options,
+                              long_options, &long_index)) != -1) {
+        switch (opt) {
+        case 'f':
+            mb::log::set_format(optarg);
+            break;
+
+        case 'h':
+            usage(stdout, argv[0]);
+            return EXIT_SUCCESS;
+
+        default:
+            usage(stderr, argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (argc - optind != 1) {
+        usage(stderr, argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    const char *path = argv[optind];
+    std::string data;
+
+    FILE *fp = fopen(path, "rb");
+    if (!fp) {
+        fprintf(stderr, "%s: Failed to open for reading: %s\n",
+                path, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    char buf[65536];
+    size_t n;
+
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+        data.append(buf, n);
+    }
+
+    bool read_error = ferror(fp);
+    fclose(fp);
+
+    if (read_error) {
+        fprintf(stderr, "%s: Failed to read file\n", path);
+        return EXIT_FAILURE;
+    }
+
+    bool ok = mb::log::decode_binary_log(
+            data.data(), data.size(), [](const mb::log::LogRecord &rec) {
+        printf("%s\n", mb::log::format_record(rec).c_str());
+    });
+
+    if (!ok) {
+        fprintf(stderr, "%s: Invalid or corrupt binary log\n", path);
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
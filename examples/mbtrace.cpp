@@ -17,9 +17,14 @@
  * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <chrono>
 #include <optional>
+#include <string>
+#include <vector>
 
 #include <cerrno>
+#include <cinttypes>
+#include <climits>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
@@ -28,8 +33,10 @@
 #include <unistd.h>
 
 #include "mbcommon/integer.h"
+#include "mbcommon/string.h"
 
 #include "mbsystrace/hooks.h"
+#include "mbsystrace/stats.h"
 #include "mbsystrace/tracer.h"
 #include "mbsystrace/tracee.h"
 
@@ -41,9 +48,14 @@ static void usage(FILE *stream, const char *prog_name)
             "       %s [option...] -p <PID>\n"
             "\n"
             "Options:\n"
+            "  -c, --summary    Print syscall statistics instead of events\n"
+            "  -e, --syscalls <name>[,<name>...]\n"
+            "                   Only stop at the listed syscalls (new command only)\n"
             "  -f, --follow     Trace new children of tracee\n"
             "  -h, --help       Display this help message\n"
-            "  -p, --pid <PID>  Attach to PID instead of running new command\n",
+            "  -p, --pid <PID>  Attach to PID instead of running new command\n"
+            "  --per-tracee     Print syscall statistics for each tracee\n"
+            "  --json <file>    Write syscall statistics as JSON to file\n",
             prog_name, prog_name);
 }
 
@@ -53,22 +65,43 @@ int main(int argc, char *argv[])
 
     int opt;
 
-    static constexpr char short_options[] = "fhp:";
+    static constexpr char short_options[] = "ce:fhp:";
+
+    enum {
+        OPT_PER_TRACEE = CHAR_MAX + 1,
+        OPT_JSON       = CHAR_MAX + 2,
+    };
 
     static option long_options[] = {
-        {"follow", no_argument,       nullptr, 'f'},
-        {"help",   no_argument,       nullptr, 'h'},
-        {"pid",    required_argument, nullptr, 'p'},
-        {nullptr,  0,                 nullptr, 0},
+        {"summary",    no_argument,       nullptr, 'c'},
+        {"syscalls",   required_argument, nullptr, 'e'},
+        {"follow",     no_argument,       nullptr, 'f'},
+        {"help",       no_argument,       nullptr, 'h'},
+        {"pid",        required_argument, nullptr, 'p'},
+        {"per-tracee", no_argument,       nullptr, OPT_PER_TRACEE},
+        {"json",       required_argument, nullptr, OPT_JSON},
+        {nullptr,      0,                 nullptr, 0},
     };
 
     std::optional<pid_t> pid;
+    std::optional<std::vector<std::string>> syscalls;
+    bool summary = false;
+    bool per_tracee = false;
+    const char *json_path = nullptr;
     Flags flags;
     int long_index = 0;
 
     while ((opt = getopt_long(argc, argv, short_options,
                               long_options, &long_index)) != -1) {
         switch (opt) {
+        case 'c':
+            summary = true;
+            break;
+
+        case 'e':
+            syscalls = mb::split(optarg, ',');
+            break;
+
         case 'f':
             flags |= Flag::TraceChildren;
             break;
@@ -82,6 +115,14 @@ int main(int argc, char *argv[])
             pid = value;
             break;
 
+        case OPT_PER_TRACEE:
+            per_tracee = true;
+            break;
+
+        case OPT_JSON:
+            json_path = optarg;
+            break;
+
         case 'h':
             usage(stdout, argv[0]);
             return EXIT_SUCCESS;
@@ -92,11 +133,13 @@ int main(int argc, char *argv[])
         }
     }
 
-    if (pid ? (argc - optind > 0) : (argc - optind == 0)) {
+    if (pid ? (argc - optind > 0 || syscalls) : (argc - optind == 0)) {
         usage(stderr, argv[0]);
         return EXIT_FAILURE;
     }
 
+    bool collect_stats = summary || per_tracee || json_path;
+
     Hooks hooks;
 
     hooks.new_tracee = [](auto tracee) {
@@ -148,6 +191,13 @@ int main(int argc, char *argv[])
                tid, status);
     };
 
+    SysCallStats stats;
+
+    if (collect_stats) {
+        // Like strace -c, only report the statistics
+        hooks = stats.wrap({});
+    }
+
     Tracer tracer;
 
     if (pid) {
@@ -157,11 +207,15 @@ int main(int argc, char *argv[])
             return EXIT_FAILURE;
         }
     } else {
-        if (auto r = tracer.fork([&] {
-            execvp(argv[1], argv + 1);
+        auto child = [&] {
+            execvp(argv[optind], argv + optind);
             fprintf(stderr, "%s: Failed to execute: %s\n",
-                    argv[1], strerror(errno));
-        }, flags); !r) {
+                    argv[optind], strerror(errno));
+        };
+
+        if (auto r = syscalls
+                ? tracer.fork(child, flags, *syscalls)
+                : tracer.fork(child, flags); !r) {
             fprintf(stderr, "Failed to create process: %s\n",
                     r.error().message().c_str());
             return EXIT_FAILURE;
@@ -174,5 +228,42 @@ int main(int argc, char *argv[])
         return EXIT_FAILURE;
     }
 
+    if (summary) {
+        auto &overhead = tracer.stats();
+
+        stats.print_summary(stderr);
+        fprintf(stderr, "\nTracer: %" PRIu64 " events in %" PRIu64 " batches"
+                " (max %" PRIu64 "), collect %.6fs, dispatch %.6fs\n",
+                overhead.events, overhead.batches, overhead.max_batch_size,
+                std::chrono::duration<double>(overhead.collect_time).count(),
+                std::chrono::duration<double>(overhead.dispatch_time).count());
+    }
+
+    if (per_tracee) {
+        if (summary) {
+            fputc('\n', stderr);
+        }
+        stats.print_per_tracee(stderr);
+    }
+
+    if (json_path) {
+        FILE *fp = fopen(json_path, "w");
+        if (!fp) {
+            fprintf(stderr, "%s: Failed to open: %s\n",
+                    json_path, strerror(errno));
+            return EXIT_FAILURE;
+        }
+
+        auto json = stats.to_json();
+        bool ok = fwrite(json.data(), 1, json.size(), fp) == json.size()
+                && fputc('\n', fp) != EOF;
+
+        if (fclose(fp) != 0 || !ok) {
+            fprintf(stderr, "%s: Failed to write: %s\n",
+                    json_path, strerror(errno));
+            return EXIT_FAILURE;
+        }
+    }
+
     return EXIT_SUCCESS;
 }
@@ -0,0 +1,138 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string>
+
+#include <cstdlib>
+#include <cstdio>
+
+#include "mbcommon/file/standard.h"
+#include "mbcommon/integer.h"
+#include "mbcommon/string.h"
+#include "mbsparse/sparse.h"
+#include "mbsparse/sparse_error.h"
+#include "mbsparse/sparse_split.h"
+#include "mbsparse/sparse_writer.h"
+
+int main(int argc, char *argv[])
+{
+    if (argc != 4 && argc != 5) {
+        std::fprintf(stderr, "Usage: %s <input file> <output prefix>"
+                     " <max size> [<block size>]\n\n"
+                     "Splits a sparse or raw image into sparse files named"
+                     " <output prefix>.<n>\n"
+                     "that are each at most <max size> bytes. The block size"
+                     " is only used for raw\nimages.\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    const char *input_path = argv[1];
+    const char *output_prefix = argv[2];
+    uint64_t max_size;
+    uint32_t block_size = mb::sparse::SPARSE_DEFAULT_BLOCK_SIZE;
+
+    if (!mb::str_to_num(argv[3], 10, max_size)) {
+        fprintf(stderr, "Invalid max size: %s\n", argv[3]);
+        return EXIT_FAILURE;
+    }
+    if (argc == 5 && !mb::str_to_num(argv[4], 10, block_size)) {
+        fprintf(stderr, "Invalid block size: %s\n", argv[4]);
+        return EXIT_FAILURE;
+    }
+
+    mb::StandardFile input_file;
+    mb::StandardFile output_file;
+    mb::sparse::SparseFile sparse_file;
+    std::string output_path;
+
+    auto open_ret = input_file.open(input_path, mb::FileOpenMode::ReadOnly);
+    if (!open_ret) {
+        fprintf(stderr, "%s: Failed to open for reading: %s\n",
+                input_path, open_ret.error().message().c_str());
+        return EXIT_FAILURE;
+    }
+
+    auto open_output = [&](size_t index) -> mb::oc::result<mb::File *> {
+        if (output_file.is_open()) {
+            if (auto r = output_file.close(); !r) {
+                fprintf(stderr, "%s: Failed to close file: %s\n",
+                        output_path.c_str(), r.error().message().c_str());
+                return r.as_failure();
+            }
+        }
+
+        output_path = mb::format("%s.%zu", output_prefix, index);
+
+        if (auto r = output_file.open(output_path,
+                                      mb::FileOpenMode::WriteOnly); !r) {
+            fprintf(stderr, "%s: Failed to open for writing: %s\n",
+                    output_path.c_str(), r.error().message().c_str());
+            return r.as_failure();
+        }
+
+        return &output_file;
+    };
+
+    mb::oc::result<size_t> split_ret = mb::oc::success(0);
+
+    open_ret = sparse_file.open(&input_file);
+    if (open_ret) {
+        split_ret = mb::sparse::split_sparse_file(sparse_file, max_size,
+                                                  open_output);
+    } else if (open_ret.error()
+            == mb::sparse::SparseFileError::InvalidSparseMagic) {
+        // Not a sparse file, so encode it as one
+        auto size = input_file.seek(0, SEEK_END);
+        if (size) {
+            if (auto r = input_file.seek(0, SEEK_SET); !r) {
+                size = r.as_failure();
+            }
+        }
+        if (!size) {
+            fprintf(stderr, "%s: Failed to seek file: %s\n",
+                    input_path, size.error().message().c_str());
+            return EXIT_FAILURE;
+        }
+
+        split_ret = mb::sparse::split_raw_file(input_file, size.value(),
+                                               block_size, max_size,
+                                               open_output);
+    } else {
+        fprintf(stderr, "%s: %s\n",
+                input_path, open_ret.error().message().c_str());
+        return EXIT_FAILURE;
+    }
+
+    if (!split_ret) {
+        fprintf(stderr, "%s: Failed to split image: %s\n",
+                input_path, split_ret.error().message().c_str());
+        return EXIT_FAILURE;
+    }
+
+    auto close_ret = output_file.close();
+    if (!close_ret) {
+        fprintf(stderr, "%s: Failed to close file: %s\n",
+                output_path.c_str(), close_ret.error().message().c_str());
+        return EXIT_FAILURE;
+    }
+
+    printf("Wrote %zu sparse files\n", split_ret.value());
+
+    return EXIT_SUCCESS;
+}
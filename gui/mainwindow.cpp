@@ -22,6 +22,7 @@
 
 #include <cassert>
 
+#include <mbdevice/binary.h>
 #include <mbdevice/json.h>
 #include <mbpatcher/errors.h>
 
@@ -35,7 +36,6 @@
 
 const int patcherPtrTypeId = qRegisterMetaType<PatcherPtr>("PatcherPtr");
 const int fileInfoPtrTypeId = qRegisterMetaType<FileInfoPtr>("FileInfoPtr");
-const int uint64TypeId = qRegisterMetaType<uint64_t>("uint64_t");
 
 MainWindowPrivate::MainWindowPrivate()
     : settings(qApp->applicationDirPath() % QStringLiteral("/settings.ini"),
@@ -88,14 +88,14 @@ MainWindow::MainWindow(mb::patcher::PatcherConfig *pc, QWidget *parent)
             d->task, &PatcherTask::patch);
     connect(d->task, &PatcherTask::finished,
             this, &MainWindow::onPatchingFinished);
-    connect(d->task, &PatcherTask::progressUpdated,
-            this, &MainWindow::onProgressUpdated);
-    connect(d->task, &PatcherTask::filesUpdated,
-            this, &MainWindow::onFilesUpdated);
-    connect(d->task, &PatcherTask::detailsUpdated,
-            this, &MainWindow::onDetailsUpdated);
 
     d->thread->start();
+
+    // Refresh the progress at ~30 Hz while patching
+    d->progressTimer = new QTimer(this);
+    d->progressTimer->setInterval(1000 / 30);
+    connect(d->progressTimer, &QTimer::timeout,
+            this, &MainWindow::onProgressTimeout);
 }
 
 MainWindow::~MainWindow()
@@ -104,14 +104,18 @@ MainWindow::~MainWindow()
 
     if (d->patcher) {
         d->patcher->cancel_patching();
-        d->pc->destroy_patcher(d->patcher);
-        d->patcher = nullptr;
     }
 
+    // The patcher can't be destroyed until the task has returned
     if (d->thread != nullptr) {
         d->thread->quit();
         d->thread->wait();
     }
+
+    if (d->patcher) {
+        d->pc->destroy_patcher(d->patcher);
+        d->patcher = nullptr;
+    }
 }
 
 void MainWindow::onDeviceSelected(int index)
@@ -211,10 +215,46 @@ void MainWindow::onChooseFileItemClicked(QAction *action)
     }
 }
 
-void MainWindow::onProgressUpdated(uint64_t bytes, uint64_t maxBytes)
+void MainWindow::onProgressTimeout()
+{
+    updateProgress();
+}
+
+void MainWindow::onPatchingFinished(const QString &newFile, bool failed,
+                                    const QString &errorMessage)
 {
     Q_D(MainWindow);
 
+    d->progressTimer->stop();
+
+    d->pc->destroy_patcher(d->patcher);
+    d->patcher = nullptr;
+
+    d->patcherNewFile = newFile;
+    d->patcherFailed = failed;
+    d->patcherError = errorMessage;
+
+    d->state = MainWindowPrivate::FinishedPatching;
+    updateWidgetsVisibility();
+}
+
+void MainWindow::updateProgress()
+{
+    Q_D(MainWindow);
+
+    uint64_t bytes, maxBytes, files, maxFiles;
+    d->task->progress(&bytes, &maxBytes, &files, &maxFiles);
+
+    QString details;
+    if (d->task->takeDetails(&details)) {
+        d->detailsLbl->setText(details);
+    }
+
+    if (bytes == d->bytes && maxBytes == d->maxBytes
+            && files == d->files && maxFiles == d->maxFiles) {
+        return;
+    }
+
     // Normalize values to 1000000
     static const int normalize = 1000000;
 
@@ -225,7 +265,7 @@ void MainWindow::onProgressUpdated(uint64_t bytes, uint64_t maxBytes)
         max = 0;
     } else {
         value = static_cast<int>(static_cast<double>(bytes)
-                / static_cast<double>(maxBytes * normalize));
+                / static_cast<double>(maxBytes) * normalize);
         max = normalize;
     }
 
@@ -233,43 +273,12 @@ void MainWindow::onProgressUpdated(uint64_t bytes, uint64_t maxBytes)
     d->progressBar->setValue(value);
     d->bytes = bytes;
     d->maxBytes = maxBytes;
-
-    updateProgressText();
-}
-
-void MainWindow::onFilesUpdated(uint64_t files, uint64_t maxFiles)
-{
-    Q_D(MainWindow);
-
     d->files = files;
     d->maxFiles = maxFiles;
 
     updateProgressText();
 }
 
-void MainWindow::onDetailsUpdated(const QString &text)
-{
-    Q_D(MainWindow);
-
-    d->detailsLbl->setText(text);
-}
-
-void MainWindow::onPatchingFinished(const QString &newFile, bool failed,
-                                    const QString &errorMessage)
-{
-    Q_D(MainWindow);
-
-    d->pc->destroy_patcher(d->patcher);
-    d->patcher = nullptr;
-
-    d->patcherNewFile = newFile;
-    d->patcherFailed = failed;
-    d->patcherError = errorMessage;
-
-    d->state = MainWindowPrivate::FinishedPatching;
-    updateWidgetsVisibility();
-}
-
 void MainWindow::updateProgressText()
 {
     Q_D(MainWindow);
@@ -426,6 +435,21 @@ void MainWindow::populateDevices()
     Q_D(MainWindow);
 
     // TODO: This shouldn't be done in the GUI thread
+
+    // Prefer the precompiled binary device table
+    auto table = mb::device::DeviceTable::open(
+            d->pc->data_directory() + "/devices.bin");
+    if (table) {
+        for (size_t i = 0; i < table.value().size(); ++i) {
+            auto device = table.value()[i].to_device();
+            d->deviceSel->addItem(QStringLiteral("%1 - %2")
+                    .arg(QString::fromStdString(device.id()))
+                    .arg(QString::fromStdString(device.name())));
+            d->devices.push_back(std::move(device));
+        }
+        return;
+    }
+
     QString path(QString::fromStdString(d->pc->data_directory())
             % QStringLiteral("/devices.json"));
     QFile file(path);
@@ -568,6 +592,9 @@ void MainWindow::startPatching()
     d->progressBar->setValue(0);
     d->detailsLbl->clear();
 
+    d->task->resetProgress();
+    d->progressTimer->start();
+
     d->state = MainWindowPrivate::Patching;
     updateWidgetsVisibility();
 
@@ -686,6 +713,7 @@ static QString errorToString(const mb::patcher::ErrorCode &error) {
 PatcherTask::PatcherTask(QWidget *parent)
     : QObject(parent)
 {
+    resetProgress();
 }
 
 void PatcherTask::patch(PatcherPtr patcher, FileInfoPtr info)
@@ -713,15 +741,51 @@ void PatcherTask::patch(PatcherPtr patcher, FileInfoPtr info)
 
 void PatcherTask::progressUpdatedCb(uint64_t bytes, uint64_t maxBytes)
 {
-    emit progressUpdated(bytes, maxBytes);
+    m_maxBytes.store(maxBytes, std::memory_order_relaxed);
+    m_bytes.store(bytes, std::memory_order_relaxed);
 }
 
 void PatcherTask::filesUpdatedCb(uint64_t files, uint64_t maxFiles)
 {
-    emit filesUpdated(files, maxFiles);
+    m_maxFiles.store(maxFiles, std::memory_order_relaxed);
+    m_files.store(files, std::memory_order_relaxed);
 }
 
 void PatcherTask::detailsUpdatedCb(const std::string &text)
 {
-    emit detailsUpdated(QString::fromStdString(text));
+    QMutexLocker locker(&m_detailsLock);
+    m_details = text;
+    m_detailsChanged = true;
+}
+
+void PatcherTask::resetProgress()
+{
+    m_bytes = 0;
+    m_maxBytes = 0;
+    m_files = 0;
+    m_maxFiles = 0;
+
+    QMutexLocker locker(&m_detailsLock);
+    m_details.clear();
+    m_detailsChanged = false;
+}
+
+void PatcherTask::progress(uint64_t *bytes, uint64_t *maxBytes,
+                           uint64_t *files, uint64_t *maxFiles) const
+{
+    *bytes = m_bytes.load(std::memory_order_relaxed);
+    *maxBytes = m_maxBytes.load(std::memory_order_relaxed);
+    *files = m_files.load(std::memory_order_relaxed);
+    *maxFiles = m_maxFiles.load(std::memory_order_relaxed);
+}
+
+bool PatcherTask::takeDetails(QString *text)
+{
+    QMutexLocker locker(&m_detailsLock);
+    if (!m_detailsChanged) {
+        return false;
+    }
+    *text = QString::fromStdString(m_details);
+    m_detailsChanged = false;
+    return true;
 }
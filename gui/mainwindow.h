@@ -24,7 +24,11 @@
 #include <mbpatcher/patcherconfig.h>
 #include <mbpatcher/patcherinterface.h>
 
+#include <atomic>
+#include <string>
+
 #include <QtCore/QMetaType>
+#include <QtCore/QMutex>
 #include <QtWidgets/QAbstractButton>
 #include <QtWidgets/QWidget>
 
@@ -55,9 +59,7 @@ private slots:
     void onChooseFileItemClicked(QAction *action);
 
     // Progress
-    void onProgressUpdated(uint64_t bytes, uint64_t maxBytes);
-    void onFilesUpdated(uint64_t files, uint64_t maxFiles);
-    void onDetailsUpdated(const QString &text);
+    void onProgressTimeout();
 
     void onPatchingFinished(const QString &newFile, bool failed,
                             const QString &errorMessage);
@@ -66,6 +68,7 @@ private:
     virtual void closeEvent(QCloseEvent *event) override;
 
     void updateRomIdDescText(const QString &text);
+    void updateProgress();
     void updateProgressText();
 
     void addWidgets();
@@ -99,12 +102,27 @@ public:
     void filesUpdatedCb(uint64_t files, uint64_t maxFiles);
     void detailsUpdatedCb(const std::string &text);
 
+    // The patcher callbacks can fire tens of thousands of times per second,
+    // so they only record the latest values and the UI thread samples them
+    // periodically instead of receiving a queued signal for each one
+    void resetProgress();
+    void progress(uint64_t *bytes, uint64_t *maxBytes,
+                  uint64_t *files, uint64_t *maxFiles) const;
+    bool takeDetails(QString *text);
+
 signals:
     void finished(const QString &newFile, bool failed,
                   const QString &errorMessage);
-    void progressUpdated(uint64_t bytes, uint64_t maxBytes);
-    void filesUpdated(uint64_t files, uint64_t maxFiles);
-    void detailsUpdated(const QString &text);
+
+private:
+    std::atomic<uint64_t> m_bytes;
+    std::atomic<uint64_t> m_maxBytes;
+    std::atomic<uint64_t> m_files;
+    std::atomic<uint64_t> m_maxFiles;
+
+    QMutex m_detailsLock;
+    std::string m_details;
+    bool m_detailsChanged;
 };
 
 #endif // MAINWINDOW_H
@@ -31,6 +31,7 @@
 
 #include <QtCore/QSettings>
 #include <QtCore/QThread>
+#include <QtCore/QTimer>
 #include <QtWidgets/QCheckBox>
 #include <QtWidgets/QComboBox>
 #include <QtWidgets/QDialogButtonBox>
@@ -92,6 +93,9 @@ public:
     QThread *thread;
     PatcherTask *task;
 
+    // Samples the task's progress while patching
+    QTimer *progressTimer;
+
     // Selected device
     mb::device::Device *device = nullptr;
 
@@ -0,0 +1,502 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "benchmark.h"
+
+#include <iterator>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <unistd.h>
+
+#include "mbcommon/endian.h"
+#include "mbcommon/file/fd.h"
+#include "mbcommon/file/memory.h"
+#include "mbcommon/file_error.h"
+#include "mbcommon/file_util.h"
+#include "mbcommon/finally.h"
+#include "mbcommon/string.h"
+
+#include "mbbootimg/entry.h"
+#include "mbbootimg/format.h"
+#include "mbbootimg/format/loki_defs.h"
+#include "mbbootimg/format/loki_p.h"
+#include "mbbootimg/format/mtk_defs.h"
+#include "mbbootimg/format/mtk_p.h"
+#include "mbbootimg/header.h"
+#include "mbbootimg/reader.h"
+#include "mbbootimg/writer.h"
+
+using namespace mb;
+using namespace mb::bench;
+using namespace mb::bootimg;
+
+// Roughly the size of a typical arm64 kernel and a stock ramdisk
+static constexpr size_t KERNEL_SIZE = 8 * 1024 * 1024;
+static constexpr size_t RAMDISK_SIZE = 2 * 1024 * 1024;
+static constexpr uint32_t PAGE_SIZE = 2048;
+static constexpr size_t READ_BUFFER_SIZE = 65536;
+
+static constexpr Format FORMATS[] = {
+    Format::Android,
+    Format::Bump,
+    Format::Loki,
+    Format::Mtk,
+    Format::SonyElf,
+};
+
+static std::vector<unsigned char> make_data(size_t size, uint32_t seed)
+{
+    std::vector<unsigned char> data(size);
+    uint32_t x = seed;
+
+    // xorshift so that magic strings do not appear in the payloads
+    for (auto &c : data) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        c = static_cast<unsigned char>(x);
+    }
+
+    return data;
+}
+
+static const std::vector<unsigned char> & kernel_data()
+{
+    static auto data = make_data(KERNEL_SIZE, 0x12345678);
+    return data;
+}
+
+static const std::vector<unsigned char> & ramdisk_data()
+{
+    static auto data = make_data(RAMDISK_SIZE, 0x87654321);
+    return data;
+}
+
+static oc::result<void> write_image(File &file, Format format)
+{
+    Writer writer;
+    OUTCOME_TRYV(writer.set_format(format));
+    OUTCOME_TRYV(writer.open(&file));
+
+    OUTCOME_TRY(header, writer.get_header());
+    header.set_board_name("bench");
+    header.set_kernel_cmdline("console=ttyHSL0,115200,n8");
+    header.set_page_size(PAGE_SIZE);
+    header.set_kernel_address(0x80008000);
+    header.set_ramdisk_address(0x81000000);
+    header.set_kernel_tags_address(0x80000100);
+    OUTCOME_TRYV(writer.write_header(header));
+
+    while (true) {
+        auto entry = writer.get_entry();
+        if (!entry) {
+            if (entry.error() == WriterError::EndOfEntries) {
+                break;
+            }
+            return entry.as_failure();
+        }
+
+        OUTCOME_TRYV(writer.write_entry(entry.value()));
+
+        auto type = entry.value().type();
+
+        if (type == EntryType::Kernel) {
+            auto const &data = kernel_data();
+            OUTCOME_TRYV(writer.write_data(data.data(), data.size()));
+        } else if (type == EntryType::Ramdisk) {
+            auto const &data = ramdisk_data();
+            OUTCOME_TRYV(writer.write_data(data.data(), data.size()));
+        } else if (type == EntryType::MtkKernelHeader
+                || type == EntryType::MtkRamdiskHeader) {
+            // The writer fills in the size
+            mtk::MtkHeader mhdr = {};
+            memcpy(mhdr.magic, mtk::MTK_MAGIC, mtk::MTK_MAGIC_SIZE);
+            strncpy(mhdr.type, type == EntryType::MtkKernelHeader
+                    ? "KERNEL" : "ROOTFS", sizeof(mhdr.type));
+            memset(mhdr.unused, 0xff, sizeof(mhdr.unused));
+            OUTCOME_TRYV(writer.write_data(&mhdr, sizeof(mhdr)));
+        }
+    }
+
+    return writer.close();
+}
+
+// LokiFormatWriter needs a real aboot image, so construct a new-style Loki
+// image from an Android image the same way that loki_patch does: save the
+// original sizes in the Loki header and append the shellcode.
+static oc::result<void> convert_to_loki(std::vector<unsigned char> &data)
+{
+    static_assert(KERNEL_SIZE % PAGE_SIZE == 0 && RAMDISK_SIZE % PAGE_SIZE == 0,
+                  "Payloads must be page aligned");
+
+    constexpr uint32_t ramdisk_addr = 0x81000000;
+    constexpr size_t image_size = PAGE_SIZE + KERNEL_SIZE + RAMDISK_SIZE;
+
+    loki::LokiHeader lhdr = {};
+    memcpy(lhdr.magic, loki::LOKI_MAGIC, loki::LOKI_MAGIC_SIZE);
+    lhdr.orig_kernel_size = static_cast<uint32_t>(KERNEL_SIZE);
+    lhdr.orig_ramdisk_size = static_cast<uint32_t>(RAMDISK_SIZE);
+    lhdr.ramdisk_addr = ramdisk_addr;
+    loki::loki_fix_header_byte_order(lhdr);
+
+    if (data.size() < image_size) {
+        return FileError::UnexpectedEof;
+    }
+
+    // Drop the SEAndroid magic so that the image is not detected as a plain
+    // Android image
+    data.resize(image_size);
+    memcpy(data.data() + loki::LOKI_MAGIC_OFFSET, &lhdr, sizeof(lhdr));
+
+    std::vector<unsigned char> shellcode(PAGE_SIZE);
+    memcpy(shellcode.data(), loki::LOKI_SHELLCODE, loki::LOKI_SHELLCODE_SIZE);
+    auto le_ramdisk_addr = mb_htole32(ramdisk_addr);
+    memcpy(shellcode.data() + loki::LOKI_SHELLCODE_SIZE - 5, &le_ramdisk_addr,
+           sizeof(le_ramdisk_addr));
+
+    data.insert(data.end(), shellcode.begin(), shellcode.end());
+
+    return oc::success();
+}
+
+static oc::result<std::vector<unsigned char>> make_image(Format format)
+{
+    void *buf = nullptr;
+    size_t size = 0;
+    auto free_buf = finally([&] {
+        free(buf);
+    });
+
+    {
+        MemoryFile file(&buf, &size);
+        if (!file.is_open()) {
+            return FileError::InvalidState;
+        }
+
+        OUTCOME_TRYV(write_image(file, format == Format::Loki
+                                 ? Format::Android : format));
+    }
+
+    auto *ptr = static_cast<unsigned char *>(buf);
+    std::vector<unsigned char> data(ptr, ptr + size);
+
+    if (format == Format::Loki) {
+        OUTCOME_TRYV(convert_to_loki(data));
+    }
+
+    return data;
+}
+
+// Images are generated once per format and shared by all benchmarks. Not const
+// since MemoryFile only accepts mutable buffers. Only read from them.
+static std::vector<unsigned char> * image_data(Format format)
+{
+    static std::vector<unsigned char> images[std::size(FORMATS)];
+    static bool generated[std::size(FORMATS)];
+
+    for (size_t i = 0; i < std::size(FORMATS); ++i) {
+        if (FORMATS[i] != format) {
+            continue;
+        }
+
+        if (!generated[i]) {
+            generated[i] = true;
+            if (auto data = make_image(format)) {
+                images[i] = std::move(data.value());
+            } else {
+                fprintf(stderr, "Failed to generate %s image: %s\n",
+                        std::string(format_to_name(format)).c_str(),
+                        data.error().message().c_str());
+            }
+        }
+
+        return images[i].empty() ? nullptr : &images[i];
+    }
+
+    return nullptr;
+}
+
+// Temporary copy of an image that is deleted when the object is destroyed
+class TempImage
+{
+public:
+    TempImage(const std::vector<unsigned char> *data)
+    {
+        const char *tmpdir = getenv("TMPDIR");
+        m_path = format("%s/bootimg_bench.XXXXXX",
+                        tmpdir && *tmpdir ? tmpdir : "/tmp");
+
+        int fd = mkstemp(m_path.data());
+        if (fd < 0) {
+            m_path.clear();
+            return;
+        }
+
+        FdFile file(fd, true);
+        if (data && !file_write_exact(file, data->data(), data->size())) {
+            unlink(m_path.c_str());
+            m_path.clear();
+        }
+    }
+
+    ~TempImage()
+    {
+        if (!m_path.empty()) {
+            unlink(m_path.c_str());
+        }
+    }
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(TempImage)
+
+    const std::string & path() const
+    {
+        return m_path;
+    }
+
+private:
+    std::string m_path;
+};
+
+// The source of the image for read benchmarks
+enum class Source
+{
+    // MemoryFile over the generated image, which exposes mapped_data()
+    Memory,
+    // FdFile over a temporary copy of the image
+    File,
+};
+
+// Run a read benchmark against the chosen source. The setup is not timed.
+template<typename Fn>
+static void with_image_file(State &state, Format format, Source source, Fn fn)
+{
+    state.pause_timing();
+
+    auto *data = image_data(format);
+    if (!data) {
+        return state.skip("Failed to generate image");
+    }
+
+    std::optional<TempImage> temp;
+    MemoryFile mem_file;
+    FdFile fd_file;
+    File *file;
+
+    if (source == Source::Memory) {
+        if (!mem_file.open(data->data(), data->size())) {
+            return state.skip("Failed to open memory file");
+        }
+        file = &mem_file;
+    } else {
+        temp.emplace(data);
+        if (temp->path().empty()) {
+            return state.skip("Failed to create temporary file");
+        }
+        if (!fd_file.open(temp->path(), FileOpenMode::ReadOnly)) {
+            return state.skip("Failed to open temporary file");
+        }
+        file = &fd_file;
+    }
+
+    state.resume_timing();
+
+    fn(*file, data->size());
+}
+
+static void bench_open(State &state, Format format, Source source)
+{
+    with_image_file(state, format, source, [&](File &file, size_t size) {
+        for (uint64_t i = 0; i < state.iterations(); ++i) {
+            Reader reader;
+            if (!reader.enable_formats_all() || !reader.open(&file)) {
+                return state.skip("Failed to open image");
+            } else if (reader.format() != format) {
+                return state.skip("Image detected as wrong format");
+            }
+        }
+
+        (void) size;
+    });
+}
+
+static void bench_read_header(State &state, Format format, Source source)
+{
+    with_image_file(state, format, source, [&](File &file, size_t size) {
+        for (uint64_t i = 0; i < state.iterations(); ++i) {
+            state.pause_timing();
+            Reader reader;
+            if (!reader.enable_formats(format) || !reader.open(&file)) {
+                return state.skip("Failed to open image");
+            }
+            state.resume_timing();
+
+            auto header = reader.read_header();
+            if (!header) {
+                return state.skip("Failed to read header");
+            }
+            do_not_optimize(header.value());
+        }
+
+        (void) size;
+    });
+}
+
+static void bench_read_entries(State &state, Format format, Source source,
+                               bool use_view)
+{
+    with_image_file(state, format, source, [&](File &file, size_t size) {
+        std::vector<unsigned char> buf(READ_BUFFER_SIZE);
+        uint64_t total = 0;
+
+        for (uint64_t i = 0; i < state.iterations(); ++i) {
+            Reader reader;
+            if (!reader.enable_formats(format) || !reader.open(&file)
+                    || !reader.read_header()) {
+                return state.skip("Failed to open image");
+            }
+
+            while (true) {
+                auto entry = reader.read_entry();
+                if (!entry) {
+                    if (entry.error() == ReaderError::EndOfEntries) {
+                        break;
+                    }
+                    return state.skip("Failed to read entry");
+                }
+
+                if (use_view) {
+                    auto view = reader.read_data_view();
+                    if (!view) {
+                        return state.skip("Data view not available");
+                    }
+                    do_not_optimize(view.value().data);
+                    total += view.value().size;
+                    continue;
+                }
+
+                while (true) {
+                    auto n = reader.read_data(buf.data(), buf.size());
+                    if (!n) {
+                        return state.skip("Failed to read data");
+                    } else if (n.value() == 0) {
+                        break;
+                    }
+                    do_not_optimize(buf);
+                    total += n.value();
+                }
+            }
+        }
+
+        (void) size;
+        state.set_bytes_processed(total);
+    });
+}
+
+static void bench_write(State &state, Format format, Source source)
+{
+    if (format == Format::Loki) {
+        return state.skip("Loki writer requires a real aboot image");
+    }
+
+    state.pause_timing();
+
+    std::optional<TempImage> temp;
+    if (source == Source::File) {
+        temp.emplace(nullptr);
+        if (temp->path().empty()) {
+            return state.skip("Failed to create temporary file");
+        }
+    }
+
+    // Generate the payloads outside of the timed region
+    (void) kernel_data();
+    (void) ramdisk_data();
+
+    state.resume_timing();
+
+    for (uint64_t i = 0; i < state.iterations(); ++i) {
+        if (source == Source::Memory) {
+            void *buf = nullptr;
+            size_t size = 0;
+            auto free_buf = finally([&] {
+                free(buf);
+            });
+
+            MemoryFile file(&buf, &size);
+            if (!file.is_open() || !write_image(file, format)) {
+                return state.skip("Failed to write image");
+            }
+        } else {
+            FdFile file;
+            if (!file.open(temp->path(), FileOpenMode::ReadWriteTrunc)
+                    || !write_image(file, format)) {
+                return state.skip("Failed to write image");
+            }
+        }
+    }
+
+    state.set_bytes_processed(state.iterations()
+            * (KERNEL_SIZE + RAMDISK_SIZE));
+}
+
+static bool register_format_benchmarks()
+{
+    for (auto image_format : FORMATS) {
+        auto name = std::string(format_to_name(image_format));
+
+        for (auto source : {Source::Memory, Source::File}) {
+            auto suffix = source == Source::Memory ? "memory" : "file";
+            auto prefix = format("bootimg_%s_", name.c_str());
+
+            register_benchmark(prefix + "open_" + suffix,
+                               [=](State &state) {
+                bench_open(state, image_format, source);
+            });
+            register_benchmark(prefix + "read_header_" + suffix,
+                               [=](State &state) {
+                bench_read_header(state, image_format, source);
+            });
+            register_benchmark(prefix + "read_entries_" + suffix,
+                               [=](State &state) {
+                bench_read_entries(state, image_format, source, false);
+            });
+            register_benchmark(prefix + "write_" + suffix,
+                               [=](State &state) {
+                bench_write(state, image_format, source);
+            });
+        }
+
+        // Only MemoryFile exposes the mapping needed for zero-copy reads
+        register_benchmark(format("bootimg_%s_read_entries_view_memory",
+                                  name.c_str()), [=](State &state) {
+            bench_read_entries(state, image_format, Source::Memory, true);
+        });
+    }
+
+    return true;
+}
+
+[[maybe_unused]] static bool format_benchmarks_registered =
+        register_format_benchmarks();
@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "mbcommon/common.h"
+#include "mbcommon/outcome.h"
+
+#include <array>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <cstdint>
+
+#include "mbbootimg/dt_table_error.h"
+
+namespace mb::bootimg
+{
+
+enum class DtTableFormat
+{
+    // Qualcomm dt.img ("QCDT"), stored in the Android format's DeviceTree entry
+    Qcdt,
+    // Android DTBO partition image
+    Dtbo,
+};
+
+struct DtTableEntry
+{
+    // QCDT: chipset (msm) ID. DTBO: id.
+    uint32_t platform_id = 0;
+    // QCDT: platform (board) ID. DTBO: unused.
+    uint32_t variant_id = 0;
+    // QCDT v2+: board subtype. DTBO: unused.
+    uint32_t subtype_id = 0;
+    // QCDT: SoC revision. DTBO: rev.
+    uint32_t revision = 0;
+    // QCDT v3: PMIC IDs. DTBO: custom fields.
+    std::array<uint32_t, 4> extra{};
+    // Location of the DTB in the table. Ignored by dt_table_build().
+    uint32_t offset = 0;
+    uint32_t size = 0;
+};
+
+class MB_EXPORT DtTable
+{
+public:
+    DtTable();
+
+    static oc::result<DtTable> parse(std::string_view data);
+
+    DtTableFormat format() const;
+    uint32_t version() const;
+    uint32_t page_size() const;
+
+    const std::vector<DtTableEntry> & entries() const;
+
+    const DtTableEntry * find(uint32_t platform_id, uint32_t variant_id,
+                              uint32_t revision) const;
+    std::string_view blob(const DtTableEntry &entry) const;
+
+private:
+    /*! \cond INTERNAL */
+    std::string_view m_data;
+    DtTableFormat m_format;
+    uint32_t m_version;
+    uint32_t m_page_size;
+    std::vector<DtTableEntry> m_entries;
+    // Indexes into m_entries sorted by (platform, variant, revision)
+    std::vector<size_t> m_index;
+    /*! \endcond */
+};
+
+using DtTableBlob = std::pair<DtTableEntry, std::string_view>;
+
+MB_EXPORT oc::result<std::string>
+dt_table_build(DtTableFormat format, uint32_t version, uint32_t page_size,
+               const std::vector<DtTableBlob> &blobs);
+
+}
@@ -24,9 +24,8 @@
 #include <cstdint>
 
 #include "mbcommon/common.h"
-#include "mbcommon/endian.h"
-
 #include "mbbootimg/format/android_defs.h"
+#include "mbbootimg/format/byte_order_p.h"
 
 namespace mb::bootimg::android
 {
@@ -55,23 +54,26 @@ struct AndroidHeader
     uint32_t id[8]; /* timestamp / checksum / sha1 / etc */
 };
 
+// We read the ID directly, not as integers, so don't change its byte order
+using AndroidHeaderFields = LittleEndianFields<
+    AndroidHeader,
+    &AndroidHeader::kernel_size,
+    &AndroidHeader::kernel_addr,
+    &AndroidHeader::ramdisk_size,
+    &AndroidHeader::ramdisk_addr,
+    &AndroidHeader::second_size,
+    &AndroidHeader::second_addr,
+    &AndroidHeader::tags_addr,
+    &AndroidHeader::page_size,
+    &AndroidHeader::dt_size,
+    &AndroidHeader::unused
+>;
+
+// Converting little endian values is its own inverse, so this is used in both
+// directions
 static inline void android_fix_header_byte_order(AndroidHeader &header)
 {
-    header.kernel_size = mb_le32toh(header.kernel_size);
-    header.kernel_addr = mb_le32toh(header.kernel_addr);
-    header.ramdisk_size = mb_le32toh(header.ramdisk_size);
-    header.ramdisk_addr = mb_le32toh(header.ramdisk_addr);
-    header.second_size = mb_le32toh(header.second_size);
-    header.second_addr = mb_le32toh(header.second_addr);
-    header.tags_addr = mb_le32toh(header.tags_addr);
-    header.page_size = mb_le32toh(header.page_size);
-    header.dt_size = mb_le32toh(header.dt_size);
-    header.unused = mb_le32toh(header.unused);
-
-    // We read the ID directly, not as integers, so don't change the byte order
-    //for (size_t i = 0; i < sizeof(header.id) / sizeof(header.id[0]); ++i) {
-    //    header.id[i] = mb_le32toh(header.id[i]);
-    //}
+    AndroidHeaderFields::to_host(header);
 }
 
 }
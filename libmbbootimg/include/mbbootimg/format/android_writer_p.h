@@ -22,6 +22,7 @@
 #include "mbbootimg/guard_p.h"
 
 #include <optional>
+#include <vector>
 
 #include <openssl/sha.h>
 
@@ -54,12 +55,17 @@ public:
     oc::result<void> finish_entry(File &file) override;
 
 private:
+    oc::result<void> sha1_update(const void *data, size_t size);
+    oc::result<void> sha1_flush();
+
     const bool m_is_bump;
 
     // Header values
     AndroidHeader m_hdr;
 
     SHA_CTX m_sha_ctx;
+    // Small writes are batched here before being passed to SHA1_Update()
+    std::vector<unsigned char> m_sha_buf;
 
     std::optional<SegmentWriter> m_seg;
 };
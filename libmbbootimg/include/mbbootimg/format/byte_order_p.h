@@ -0,0 +1,126 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "mbbootimg/guard_p.h"
+
+#include <type_traits>
+
+#include <cstdint>
+
+#include "mbcommon/endian.h"
+
+namespace mb::bootimg
+{
+
+// Byte order conversion for on-disk structs. Each format lists the integer
+// fields of a header once, for example:
+//
+//   using MtkHeaderFields = LittleEndianFields<MtkHeader, &MtkHeader::size>;
+//
+// and the conversions in both directions are generated from that list. On
+// little endian hosts, they compile to nothing, so reading or writing a header
+// is just the memcpy between the struct and the file data.
+
+namespace detail
+{
+
+template<typename T>
+struct MemberOf;
+
+template<typename C, typename M>
+struct MemberOf<M C::*>
+{
+    using Class = C;
+    using Type = M;
+};
+
+template<typename T>
+constexpr T le_to_host(T value)
+{
+    static_assert(std::is_integral_v<T>, "Field is not an integer");
+
+    if constexpr (sizeof(T) == 1) {
+        return value;
+    } else if constexpr (sizeof(T) == 2) {
+        return static_cast<T>(mb_le16toh(static_cast<uint16_t>(value)));
+    } else if constexpr (sizeof(T) == 4) {
+        return static_cast<T>(mb_le32toh(static_cast<uint32_t>(value)));
+    } else {
+        static_assert(sizeof(T) == 8, "Unsupported field size");
+        return static_cast<T>(mb_le64toh(static_cast<uint64_t>(value)));
+    }
+}
+
+template<typename T>
+constexpr T host_to_le(T value)
+{
+    static_assert(std::is_integral_v<T>, "Field is not an integer");
+
+    if constexpr (sizeof(T) == 1) {
+        return value;
+    } else if constexpr (sizeof(T) == 2) {
+        return static_cast<T>(mb_htole16(static_cast<uint16_t>(value)));
+    } else if constexpr (sizeof(T) == 4) {
+        return static_cast<T>(mb_htole32(static_cast<uint32_t>(value)));
+    } else {
+        static_assert(sizeof(T) == 8, "Unsupported field size");
+        return static_cast<T>(mb_htole64(static_cast<uint64_t>(value)));
+    }
+}
+
+}
+
+template<typename T, auto... Fields>
+struct LittleEndianFields
+{
+    static_assert(std::is_trivially_copyable_v<T>,
+                  "On-disk structs must be trivially copyable");
+    static_assert((std::is_same_v<
+                           typename detail::MemberOf<decltype(Fields)>::Class,
+                           T> && ...),
+                  "Field does not belong to the struct");
+    static_assert((std::is_integral_v<
+                           typename detail::MemberOf<decltype(Fields)>::Type>
+                           && ...),
+                  "Field is not an integer");
+
+    //! Convert fields from their on-disk byte order to the host byte order
+    static void to_host(T &s)
+    {
+        if constexpr (MB_BYTE_ORDER != MB_LITTLE_ENDIAN) {
+            ((s.*Fields = detail::le_to_host(s.*Fields)), ...);
+        } else {
+            (void) s;
+        }
+    }
+
+    //! Convert fields from the host byte order to their on-disk byte order
+    static void from_host(T &s)
+    {
+        if constexpr (MB_BYTE_ORDER != MB_LITTLE_ENDIAN) {
+            ((s.*Fields = detail::host_to_le(s.*Fields)), ...);
+        } else {
+            (void) s;
+        }
+    }
+};
+
+}
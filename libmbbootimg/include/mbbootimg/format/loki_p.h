@@ -24,9 +24,9 @@
 #include <cstdint>
 
 #include "mbcommon/common.h"
-#include "mbcommon/endian.h"
 #include "mbcommon/file.h"
 
+#include "mbbootimg/format/byte_order_p.h"
 #include "mbbootimg/format/loki_defs.h"
 
 namespace mb::bootimg::loki
@@ -43,12 +43,17 @@ struct LokiHeader
     uint32_t ramdisk_addr;
 };
 
+using LokiHeaderFields = LittleEndianFields<
+    LokiHeader,
+    &LokiHeader::recovery,
+    &LokiHeader::orig_kernel_size,
+    &LokiHeader::orig_ramdisk_size,
+    &LokiHeader::ramdisk_addr
+>;
+
 static inline void loki_fix_header_byte_order(LokiHeader &header)
 {
-    header.recovery = mb_le32toh(header.recovery);
-    header.orig_kernel_size = mb_le32toh(header.orig_kernel_size);
-    header.orig_ramdisk_size = mb_le32toh(header.orig_ramdisk_size);
-    header.ramdisk_addr = mb_le32toh(header.ramdisk_addr);
+    LokiHeaderFields::to_host(header);
 }
 
 oc::result<void> _loki_patch_file(File &file,
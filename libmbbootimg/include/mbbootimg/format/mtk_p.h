@@ -24,8 +24,7 @@
 #include <cstdint>
 
 #include "mbcommon/common.h"
-#include "mbcommon/endian.h"
-
+#include "mbbootimg/format/byte_order_p.h"
 #include "mbbootimg/format/mtk_defs.h"
 
 namespace mb::bootimg::mtk
@@ -39,9 +38,11 @@ struct MtkHeader
     char unused[MTK_UNUSED_SIZE];           // Unused (all 0xff)
 };
 
+using MtkHeaderFields = LittleEndianFields<MtkHeader, &MtkHeader::size>;
+
 static inline void mtk_fix_header_byte_order(MtkHeader &header)
 {
-    header.size = mb_le32toh(header.size);
+    MtkHeaderFields::to_host(header);
 }
 
 }
@@ -47,7 +47,9 @@ public:
     oc::result<Entry> read_entry(File &file) override;
     oc::result<Entry> go_to_entry(File &file,
                                   std::optional<EntryType> entry_type) override;
+    oc::result<std::vector<Entry>> list_entries(File &file) override;
     oc::result<size_t> read_data(File &file, void *buf, size_t buf_size) override;
+    oc::result<ConstIoVec> read_data_view(File &file) override;
 
 private:
     // Header values
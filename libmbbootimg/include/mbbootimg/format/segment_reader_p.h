@@ -61,7 +61,9 @@ public:
 
     oc::result<Entry> read_entry(File &file);
     oc::result<Entry> go_to_entry(File &file, std::optional<EntryType> entry_type);
+    std::vector<Entry> list_entries() const;
     oc::result<size_t> read_data(File &file, void *buf, size_t buf_size);
+    oc::result<ConstIoVec> read_data_view(File &file);
 
 private:
     SegmentReaderState m_state;
@@ -22,40 +22,49 @@
 #include "mbbootimg/guard_p.h"
 
 #include "mbcommon/common.h"
-#include "mbcommon/endian.h"
-
+#include "mbbootimg/format/byte_order_p.h"
 #include "mbbootimg/format/sony_elf_glibc_p.h"
 
 namespace mb::bootimg::sonyelf
 {
 
+using SonyElfEhdrFields = LittleEndianFields<
+    Sony_Elf32_Ehdr,
+    &Sony_Elf32_Ehdr::e_type,
+    &Sony_Elf32_Ehdr::e_machine,
+    &Sony_Elf32_Ehdr::e_version,
+    &Sony_Elf32_Ehdr::e_entry,
+    &Sony_Elf32_Ehdr::e_phoff,
+    &Sony_Elf32_Ehdr::e_shoff,
+    &Sony_Elf32_Ehdr::e_flags,
+    &Sony_Elf32_Ehdr::e_ehsize,
+    &Sony_Elf32_Ehdr::e_phentsize,
+    &Sony_Elf32_Ehdr::e_phnum,
+    &Sony_Elf32_Ehdr::e_shentsize,
+    &Sony_Elf32_Ehdr::e_shnum,
+    &Sony_Elf32_Ehdr::e_shstrndx
+>;
+
+using SonyElfPhdrFields = LittleEndianFields<
+    Sony_Elf32_Phdr,
+    &Sony_Elf32_Phdr::p_type,
+    &Sony_Elf32_Phdr::p_offset,
+    &Sony_Elf32_Phdr::p_vaddr,
+    &Sony_Elf32_Phdr::p_paddr,
+    &Sony_Elf32_Phdr::p_filesz,
+    &Sony_Elf32_Phdr::p_memsz,
+    &Sony_Elf32_Phdr::p_flags,
+    &Sony_Elf32_Phdr::p_align
+>;
+
 static inline void sony_elf_fix_ehdr_byte_order(Sony_Elf32_Ehdr &header)
 {
-    header.e_type = mb_le16toh(header.e_type);
-    header.e_machine = mb_le16toh(header.e_machine);
-    header.e_version = mb_le32toh(header.e_version);
-    header.e_entry = mb_le32toh(header.e_entry);
-    header.e_phoff = mb_le32toh(header.e_phoff);
-    header.e_shoff = mb_le32toh(header.e_shoff);
-    header.e_flags = mb_le32toh(header.e_flags);
-    header.e_ehsize = mb_le16toh(header.e_ehsize);
-    header.e_phentsize = mb_le16toh(header.e_phentsize);
-    header.e_phnum = mb_le16toh(header.e_phnum);
-    header.e_shentsize = mb_le16toh(header.e_shentsize);
-    header.e_shnum = mb_le16toh(header.e_shnum);
-    header.e_shstrndx = mb_le16toh(header.e_shstrndx);
+    SonyElfEhdrFields::to_host(header);
 }
 
 static inline void sony_elf_fix_phdr_byte_order(Sony_Elf32_Phdr &header)
 {
-    header.p_type = mb_le32toh(header.p_type);
-    header.p_offset = mb_le32toh(header.p_offset);
-    header.p_vaddr = mb_le32toh(header.p_vaddr);
-    header.p_paddr = mb_le32toh(header.p_paddr);
-    header.p_filesz = mb_le32toh(header.p_filesz);
-    header.p_memsz = mb_le32toh(header.p_memsz);
-    header.p_flags = mb_le32toh(header.p_flags);
-    header.p_align = mb_le32toh(header.p_align);
+    SonyElfPhdrFields::to_host(header);
 }
 
 }
@@ -22,6 +22,7 @@
 #include <memory>
 #include <optional>
 #include <string>
+#include <string_view>
 
 #include <cstdint>
 
@@ -90,11 +91,11 @@ public:
     HeaderFields supported_fields() const;
     void set_supported_fields(HeaderFields fields);
 
-    std::optional<std::string> board_name() const;
-    bool set_board_name(std::optional<std::string> name);
+    std::optional<std::string_view> board_name() const;
+    bool set_board_name(std::optional<std::string_view> name);
 
-    std::optional<std::string> kernel_cmdline() const;
-    bool set_kernel_cmdline(std::optional<std::string> cmdline);
+    std::optional<std::string_view> kernel_cmdline() const;
+    bool set_kernel_cmdline(std::optional<std::string_view> cmdline);
 
     std::optional<uint32_t> page_size() const;
     bool set_page_size(std::optional<uint32_t> page_size);
@@ -124,6 +125,22 @@ public:
     bool set_entrypoint_address(std::optional<uint32_t> address);
 
 private:
+    // Optional string that is stored inline if it fits in N bytes. Longer
+    // values, which none of the on-disk formats can hold, spill to the heap.
+    template<size_t N>
+    class InlineString
+    {
+    public:
+        std::optional<std::string_view> get() const noexcept;
+        void set(std::optional<std::string_view> value);
+
+    private:
+        bool m_present = false;
+        size_t m_size = 0;
+        char m_buf[N] = {};
+        std::string m_overflow;
+    };
+
     // Bitmap of fields that are supported
     HeaderFields m_fields_supported;
 
@@ -136,8 +153,8 @@ private:
     std::optional<uint32_t> m_rpm_addr;         // |         |      |      |     | X    |
     std::optional<uint32_t> m_appsbl_addr;      // |         |      |      |     | X    |
     std::optional<uint32_t> m_page_size;        // | X       | X    | X    | X   |      |
-    std::optional<std::string> m_board_name;    // | X       | X    | X    | X   |      |
-    std::optional<std::string> m_cmdline;       // | X       | X    | X    | X   |      |
+    InlineString<16> m_board_name;              // | X       | X    | X    | X   |      |
+    InlineString<512> m_cmdline;                // | X       | X    | X    | X   |      |
     // Raw header values                           |---------|------|------|-----|------|
 
     // TODO TODO TODO
@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+
+#include <cstddef>
+#include <cstdint>
+
+#include "mbcommon/common.h"
+
+#include "mbbootimg/format.h"
+
+namespace mb::bootimg
+{
+
+class Reader;
+
+class MB_EXPORT ProbeCache
+{
+public:
+    ProbeCache() noexcept;
+    ~ProbeCache() noexcept;
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(ProbeCache)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(ProbeCache)
+
+    void clear();
+    size_t size() const;
+
+private:
+    struct Stamp
+    {
+        uint64_t dev;
+        uint64_t ino;
+        uint64_t size;
+        int64_t mtime_sec;
+        int64_t mtime_nsec;
+        int64_t ctime_sec;
+        int64_t ctime_nsec;
+
+        bool operator==(const Stamp &rhs) const noexcept;
+    };
+
+    struct CachedFormat
+    {
+        Stamp stamp;
+        Format format;
+    };
+
+    static std::optional<Stamp> stamp_file(const std::string &path);
+
+    std::optional<Format> lookup(const std::string &path,
+                                 const Stamp &stamp) const;
+    void insert(const std::string &path, const Stamp &stamp, Format format);
+
+    mutable std::mutex m_lock;
+    std::unordered_map<std::string, CachedFormat> m_entries;
+
+    friend class Reader;
+};
+
+}
@@ -32,6 +32,7 @@
 #include "mbbootimg/entry.h"
 #include "mbbootimg/format.h"
 #include "mbbootimg/header.h"
+#include "mbbootimg/probe_cache.h"
 #include "mbbootimg/reader_error.h"
 #include "mbbootimg/reader_p.h"
 
@@ -45,6 +46,8 @@ namespace bootimg
 class MB_EXPORT Reader
 {
 public:
+    static constexpr size_t DEFAULT_PROBE_SIZE = 64 * 1024;
+
     Reader() noexcept;
     ~Reader() noexcept;
 
@@ -64,17 +67,26 @@ public:
     oc::result<Header> read_header();
     oc::result<Entry> read_entry();
     oc::result<Entry> go_to_entry(std::optional<EntryType> entry_type);
+    oc::result<std::vector<Entry>> list_entries();
     oc::result<size_t> read_data(void *buf, size_t size);
+    oc::result<ConstIoVec> read_data_view();
 
     // Format operations
     std::optional<Format> format();
     oc::result<void> enable_formats(Formats formats);
     oc::result<void> enable_formats_all();
 
+    // Autodetection options
+    oc::result<void> set_probe_size(size_t size);
+    oc::result<void> set_probe_cache(ProbeCache *cache);
+
     // Reader state
     bool is_open();
 
 private:
+    oc::result<void> open_cached(std::unique_ptr<File> file,
+                                 const std::string &filename);
+
     // Global state
     detail::ReaderState m_state;
 
@@ -84,6 +96,11 @@ private:
 
     std::vector<std::unique_ptr<detail::FormatReader>> m_formats;
     detail::FormatReader *m_format;
+
+    // Number of bytes to cache for autodetection
+    size_t m_probe_size;
+    // Detected formats of previously opened files (not owned)
+    ProbeCache *m_probe_cache;
 };
 
 }
@@ -21,20 +21,18 @@
 
 #include <optional>
 #include <string>
+#include <vector>
 
 #include <cstddef>
 
 #include "mbcommon/common.h"
+#include "mbcommon/file.h"
 
 #include "mbbootimg/entry.h"
 #include "mbbootimg/format.h"
 #include "mbbootimg/header.h"
 
-namespace mb
-{
-class File;
-
-namespace bootimg::detail
+namespace mb::bootimg::detail
 {
 
 class FormatReader
@@ -60,8 +58,12 @@ public:
     read_entry(File &file) = 0;
     virtual oc::result<Entry>
     go_to_entry(File &file, std::optional<EntryType> entry_type);
+    virtual oc::result<std::vector<Entry>>
+    list_entries(File &file);
     virtual oc::result<size_t>
     read_data(File &file, void *buf, size_t buf_size) = 0;
+    virtual oc::result<ConstIoVec>
+    read_data_view(File &file);
 };
 
 enum class ReaderState : uint8_t
@@ -75,4 +77,3 @@ MB_DECLARE_FLAGS(ReaderStates, ReaderState)
 MB_DECLARE_OPERATORS_FOR_FLAGS(ReaderStates)
 
 }
-}
@@ -41,6 +41,8 @@ class File;
 namespace bootimg
 {
 
+class Reader;
+
 class MB_EXPORT Writer
 {
 public:
@@ -65,6 +67,7 @@ public:
     oc::result<Entry> get_entry();
     oc::result<void> write_entry(const Entry &entry);
     oc::result<size_t> write_data(const void *buf, size_t size);
+    oc::result<uint64_t> copy_entry_from(Reader &reader, EntryType type);
 
     // Format operations
     std::optional<Format> format();
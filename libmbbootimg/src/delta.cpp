@@ -0,0 +1,750 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbbootimg/delta.h"
+
+#include <algorithm>
+#include <array>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include <cstring>
+
+#include <openssl/sha.h>
+
+#include "mbcommon/endian.h"
+#include "mbcommon/file.h"
+#include "mbcommon/file_util.h"
+
+#include "mbbootimg/entry.h"
+#include "mbbootimg/header.h"
+#include "mbbootimg/reader.h"
+#include "mbbootimg/writer.h"
+
+/*!
+ * \file mbbootimg/delta.h
+ * \brief Entry-wise deltas between boot images
+ *
+ * A delta describes how to build a target boot image from a source boot image.
+ * Each entry (kernel, ramdisk, device tree, etc.) is diffed against the entry
+ * of the same type in the source. The target entry is split into chunks at
+ * content-defined boundaries (gear hashing) and every chunk that also occurs in
+ * the source entry is stored as a reference to it. The boundaries only depend
+ * on the nearby bytes, so data that moved within an entry is still found.
+ *
+ * Format (all integers are little endian):
+ *
+ *     magic          "MBBTDLT1"
+ *     format         u8 (target Format)
+ *     header fields  (u8 tag, value)..., terminated by tag 0
+ *     entries        (u8 1, entry)..., terminated by u8 0
+ *
+ * Header field values are u32 or, for strings, a u32 length followed by the
+ * bytes. Each entry is:
+ *
+ *     type           u32 (EntryType)
+ *     source size    u64 (UINT64_MAX if the source has no such entry)
+ *     source SHA1    20 bytes (only present if the source has the entry)
+ *     target size    u64
+ *     target SHA1    20 bytes
+ *     ops            (u8 op, ...)..., terminated by op 0
+ *
+ * Op 1 copies u64 length bytes from u64 offset in the source entry. Op 2 inserts
+ * the u64 length bytes that follow it.
+ */
+
+namespace mb::bootimg
+{
+
+constexpr char DELTA_MAGIC[8] = {'M', 'B', 'B', 'T', 'D', 'L', 'T', '1'};
+
+constexpr size_t CHUNK_SIZE_MIN = 512;
+constexpr size_t CHUNK_SIZE_AVG = 4 * 1024;
+constexpr size_t CHUNK_SIZE_MAX = 32 * 1024;
+
+// Normalized chunking, as in mbtool's chunk store
+constexpr uint64_t CHUNK_MASK_SMALL = 0xfffc000000000000ull; // 14 bits
+constexpr uint64_t CHUNK_MASK_LARGE = 0xffc0000000000000ull; // 10 bits
+
+constexpr size_t INSERT_BUFFER_SIZE = 64 * 1024;
+
+constexpr uint64_t NO_SOURCE_ENTRY = UINT64_MAX;
+
+enum class HeaderTag : uint8_t
+{
+    End                 = 0,
+    BoardName           = 1,
+    KernelCmdline       = 2,
+    PageSize            = 3,
+    KernelAddress       = 4,
+    RamdiskAddress      = 5,
+    SecondbootAddress   = 6,
+    KernelTagsAddress   = 7,
+    SonyIplAddress      = 8,
+    SonyRpmAddress      = 9,
+    SonyAppsblAddress   = 10,
+    EntrypointAddress   = 11,
+};
+
+enum class Op : uint8_t
+{
+    End                 = 0,
+    Copy                = 1,
+    Insert              = 2,
+};
+
+using Digest = std::array<unsigned char, SHA_DIGEST_LENGTH>;
+
+static constexpr std::array<uint64_t, 256> make_gear_table()
+{
+    std::array<uint64_t, 256> table{};
+    uint64_t state = 0x9e3779b97f4a7c15ull;
+
+    // splitmix64
+    for (auto &value : table) {
+        state += 0x9e3779b97f4a7c15ull;
+        uint64_t z = state;
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+        value = z ^ (z >> 31);
+    }
+
+    return table;
+}
+
+static constexpr auto GEAR_TABLE = make_gear_table();
+
+static size_t find_cut_point(const unsigned char *data, size_t size)
+{
+    if (size <= CHUNK_SIZE_MIN) {
+        return size;
+    }
+
+    size = std::min(size, CHUNK_SIZE_MAX);
+    size_t normal = std::min(size, CHUNK_SIZE_AVG);
+    uint64_t fp = 0;
+    size_t i = CHUNK_SIZE_MIN;
+
+    for (; i < normal; ++i) {
+        fp = (fp << 1) + GEAR_TABLE[data[i]];
+        if (!(fp & CHUNK_MASK_SMALL)) {
+            return i + 1;
+        }
+    }
+
+    for (; i < size; ++i) {
+        fp = (fp << 1) + GEAR_TABLE[data[i]];
+        if (!(fp & CHUNK_MASK_LARGE)) {
+            return i + 1;
+        }
+    }
+
+    return size;
+}
+
+static size_t hash_chunk(const unsigned char *data, size_t size)
+{
+    return std::hash<std::string_view>()(
+            {reinterpret_cast<const char *>(data), size});
+}
+
+static Digest compute_digest(const std::vector<unsigned char> &data)
+{
+    Digest digest;
+    SHA1(data.data(), data.size(), digest.data());
+    return digest;
+}
+
+static oc::result<std::vector<unsigned char>>
+read_entry_data(Reader &reader, const Entry &entry)
+{
+    std::vector<unsigned char> data;
+
+    if (auto view = reader.read_data_view()) {
+        auto ptr = static_cast<const unsigned char *>(view.value().data);
+        data.assign(ptr, ptr + view.value().size);
+        return std::move(data);
+    } else if (view.error() != ReaderError::UnsupportedDataView) {
+        return view.as_failure();
+    }
+
+    if (auto size = entry.size()) {
+        data.reserve(static_cast<size_t>(*size));
+    }
+
+    unsigned char buf[INSERT_BUFFER_SIZE];
+
+    while (true) {
+        OUTCOME_TRY(n, reader.read_data(buf, sizeof(buf)));
+        if (n == 0) {
+            break;
+        }
+
+        data.insert(data.end(), buf, buf + n);
+    }
+
+    return std::move(data);
+}
+
+// Encoding
+
+class PatchWriter
+{
+public:
+    explicit PatchWriter(File &file) : m_file(file)
+    {
+    }
+
+    void put_u8(uint8_t value)
+    {
+        m_buf.push_back(value);
+    }
+
+    void put_u32(uint32_t value)
+    {
+        value = mb_htole32(value);
+        put_bytes(&value, sizeof(value));
+    }
+
+    void put_u64(uint64_t value)
+    {
+        value = mb_htole64(value);
+        put_bytes(&value, sizeof(value));
+    }
+
+    void put_bytes(const void *data, size_t size)
+    {
+        auto ptr = static_cast<const unsigned char *>(data);
+        m_buf.insert(m_buf.end(), ptr, ptr + size);
+    }
+
+    oc::result<void> put_insert(const unsigned char *data, size_t size)
+    {
+        put_u8(static_cast<uint8_t>(Op::Insert));
+        put_u64(size);
+
+        // Avoid copying large literals through the buffer
+        if (size >= INSERT_BUFFER_SIZE) {
+            OUTCOME_TRYV(flush());
+            return file_write_exact(m_file, data, size);
+        }
+
+        put_bytes(data, size);
+        return oc::success();
+    }
+
+    oc::result<void> flush()
+    {
+        OUTCOME_TRYV(file_write_exact(m_file, m_buf.data(), m_buf.size()));
+        m_buf.clear();
+        return oc::success();
+    }
+
+private:
+    File &m_file;
+    std::vector<unsigned char> m_buf;
+};
+
+static void put_string_field(PatchWriter &w, HeaderTag tag,
+                             std::optional<std::string_view> value)
+{
+    if (value) {
+        w.put_u8(static_cast<uint8_t>(tag));
+        w.put_u32(static_cast<uint32_t>(value->size()));
+        w.put_bytes(value->data(), value->size());
+    }
+}
+
+static void put_u32_field(PatchWriter &w, HeaderTag tag,
+                          std::optional<uint32_t> value)
+{
+    if (value) {
+        w.put_u8(static_cast<uint8_t>(tag));
+        w.put_u32(*value);
+    }
+}
+
+static void put_header(PatchWriter &w, const Header &header)
+{
+    put_string_field(w, HeaderTag::BoardName, header.board_name());
+    put_string_field(w, HeaderTag::KernelCmdline, header.kernel_cmdline());
+    put_u32_field(w, HeaderTag::PageSize, header.page_size());
+    put_u32_field(w, HeaderTag::KernelAddress, header.kernel_address());
+    put_u32_field(w, HeaderTag::RamdiskAddress, header.ramdisk_address());
+    put_u32_field(w, HeaderTag::SecondbootAddress,
+                  header.secondboot_address());
+    put_u32_field(w, HeaderTag::KernelTagsAddress,
+                  header.kernel_tags_address());
+    put_u32_field(w, HeaderTag::SonyIplAddress, header.sony_ipl_address());
+    put_u32_field(w, HeaderTag::SonyRpmAddress, header.sony_rpm_address());
+    put_u32_field(w, HeaderTag::SonyAppsblAddress,
+                  header.sony_appsbl_address());
+    put_u32_field(w, HeaderTag::EntrypointAddress,
+                  header.entrypoint_address());
+    w.put_u8(static_cast<uint8_t>(HeaderTag::End));
+}
+
+/*!
+ * \brief Write the ops that build \p target from \p source
+ *
+ * Every content-defined chunk of \p target that also appears in \p source is
+ * copied. Matches are extended past the end of the chunk for as long as the
+ * data is the same, so unchanged regions become a single copy even if their
+ * chunk boundaries shifted.
+ */
+static oc::result<void> put_ops(PatchWriter &w,
+                                const std::vector<unsigned char> &source,
+                                const std::vector<unsigned char> &target)
+{
+    // Offset of the first occurrence of each source chunk
+    std::unordered_map<size_t, size_t> index;
+
+    for (size_t pos = 0; pos < source.size();) {
+        size_t n = find_cut_point(source.data() + pos, source.size() - pos);
+        index.emplace(hash_chunk(source.data() + pos, n), pos);
+        pos += n;
+    }
+
+    size_t literal_begin = 0;
+    size_t pos = 0;
+
+    while (pos < target.size()) {
+        size_t n = find_cut_point(target.data() + pos, target.size() - pos);
+        auto it = index.find(hash_chunk(target.data() + pos, n));
+
+        if (it == index.end() || it->second + n > source.size()
+                || memcmp(source.data() + it->second, target.data() + pos,
+                          n) != 0) {
+            pos += n;
+            continue;
+        }
+
+        size_t src_offset = it->second;
+        size_t length = n;
+
+        while (pos + length < target.size()
+                && src_offset + length < source.size()
+                && target[pos + length] == source[src_offset + length]) {
+            ++length;
+        }
+
+        if (literal_begin < pos) {
+            OUTCOME_TRYV(w.put_insert(target.data() + literal_begin,
+                                      pos - literal_begin));
+        }
+
+        w.put_u8(static_cast<uint8_t>(Op::Copy));
+        w.put_u64(src_offset);
+        w.put_u64(length);
+
+        pos += length;
+        literal_begin = pos;
+    }
+
+    if (literal_begin < target.size()) {
+        OUTCOME_TRYV(w.put_insert(target.data() + literal_begin,
+                                  target.size() - literal_begin));
+    }
+
+    w.put_u8(static_cast<uint8_t>(Op::End));
+
+    return oc::success();
+}
+
+/*!
+ * \brief Create a delta between two boot images
+ *
+ * \param source Reader for the boot image that the delta will be applied to.
+ *               It must be open and its header must not have been read yet.
+ * \param target Reader for the boot image that the delta will produce. It must
+ *               be open and its header must not have been read yet.
+ * \param patch File to write the delta to
+ *
+ * \return Nothing if the delta is successfully written. Otherwise, the error
+ *         code.
+ */
+oc::result<void> delta_create(Reader &source, Reader &target, File &patch)
+{
+    OUTCOME_TRYV(source.read_header());
+    OUTCOME_TRY(header, target.read_header());
+
+    auto format = target.format();
+    if (!format) {
+        return DeltaError::InvalidFormat;
+    }
+
+    PatchWriter w(patch);
+
+    w.put_bytes(DELTA_MAGIC, sizeof(DELTA_MAGIC));
+    w.put_u8(static_cast<uint8_t>(*format));
+    put_header(w, header);
+
+    while (true) {
+        auto entry = target.read_entry();
+        if (!entry) {
+            if (entry.error() == ReaderError::EndOfEntries) {
+                break;
+            }
+            return entry.as_failure();
+        }
+
+        auto type = entry.value().type();
+        OUTCOME_TRY(target_data, read_entry_data(target, entry.value()));
+
+        std::vector<unsigned char> source_data;
+        bool have_source = true;
+
+        if (auto source_entry = source.go_to_entry(type)) {
+            OUTCOME_TRY(data, read_entry_data(source, source_entry.value()));
+            source_data = std::move(data);
+        } else if (source_entry.error() == ReaderError::EndOfEntries) {
+            have_source = false;
+        } else {
+            return source_entry.as_failure();
+        }
+
+        w.put_u8(1);
+        w.put_u32(static_cast<uint32_t>(type));
+
+        if (have_source) {
+            w.put_u64(source_data.size());
+            w.put_bytes(compute_digest(source_data).data(), SHA_DIGEST_LENGTH);
+        } else {
+            w.put_u64(NO_SOURCE_ENTRY);
+        }
+
+        w.put_u64(target_data.size());
+        w.put_bytes(compute_digest(target_data).data(), SHA_DIGEST_LENGTH);
+
+        OUTCOME_TRYV(put_ops(w, source_data, target_data));
+        OUTCOME_TRYV(w.flush());
+    }
+
+    w.put_u8(0);
+
+    return w.flush();
+}
+
+// Decoding
+
+static oc::result<uint8_t> get_u8(File &file)
+{
+    uint8_t value;
+    OUTCOME_TRYV(file_read_exact(file, &value, sizeof(value)));
+    return value;
+}
+
+static oc::result<uint32_t> get_u32(File &file)
+{
+    uint32_t value;
+    OUTCOME_TRYV(file_read_exact(file, &value, sizeof(value)));
+    return mb_le32toh(value);
+}
+
+static oc::result<uint64_t> get_u64(File &file)
+{
+    uint64_t value;
+    OUTCOME_TRYV(file_read_exact(file, &value, sizeof(value)));
+    return mb_le64toh(value);
+}
+
+static oc::result<void> get_header(File &patch, Header &header)
+{
+    while (true) {
+        OUTCOME_TRY(tag, get_u8(patch));
+
+        switch (static_cast<HeaderTag>(tag)) {
+        case HeaderTag::End:
+            return oc::success();
+
+        case HeaderTag::BoardName:
+        case HeaderTag::KernelCmdline: {
+            OUTCOME_TRY(size, get_u32(patch));
+            if (size > INSERT_BUFFER_SIZE) {
+                return DeltaError::InvalidRecord;
+            }
+
+            std::string value(size, '\0');
+            OUTCOME_TRYV(file_read_exact(patch, value.data(), value.size()));
+
+            // Fields unsupported by the output format are ignored, like they
+            // are when copying headers between formats
+            if (static_cast<HeaderTag>(tag) == HeaderTag::BoardName) {
+                header.set_board_name(value);
+            } else {
+                header.set_kernel_cmdline(value);
+            }
+            break;
+        }
+
+        default: {
+            OUTCOME_TRY(value, get_u32(patch));
+
+            switch (static_cast<HeaderTag>(tag)) {
+            case HeaderTag::PageSize:
+                header.set_page_size(value);
+                break;
+            case HeaderTag::KernelAddress:
+                header.set_kernel_address(value);
+                break;
+            case HeaderTag::RamdiskAddress:
+                header.set_ramdisk_address(value);
+                break;
+            case HeaderTag::SecondbootAddress:
+                header.set_secondboot_address(value);
+                break;
+            case HeaderTag::KernelTagsAddress:
+                header.set_kernel_tags_address(value);
+                break;
+            case HeaderTag::SonyIplAddress:
+                header.set_sony_ipl_address(value);
+                break;
+            case HeaderTag::SonyRpmAddress:
+                header.set_sony_rpm_address(value);
+                break;
+            case HeaderTag::SonyAppsblAddress:
+                header.set_sony_appsbl_address(value);
+                break;
+            case HeaderTag::EntrypointAddress:
+                header.set_entrypoint_address(value);
+                break;
+            default:
+                return DeltaError::InvalidRecord;
+            }
+            break;
+        }
+        }
+    }
+}
+
+struct PatchEntry
+{
+    EntryType type;
+    uint64_t source_size;
+    Digest source_digest;
+    uint64_t target_size;
+    Digest target_digest;
+};
+
+static oc::result<std::optional<PatchEntry>> get_entry_header(File &patch)
+{
+    OUTCOME_TRY(marker, get_u8(patch));
+    if (marker == 0) {
+        return std::nullopt;
+    } else if (marker != 1) {
+        return DeltaError::InvalidRecord;
+    }
+
+    PatchEntry entry;
+
+    OUTCOME_TRY(type, get_u32(patch));
+    entry.type = static_cast<EntryType>(type);
+
+    OUTCOME_TRY(source_size, get_u64(patch));
+    entry.source_size = source_size;
+
+    if (source_size != NO_SOURCE_ENTRY) {
+        OUTCOME_TRYV(file_read_exact(patch, entry.source_digest.data(),
+                                     entry.source_digest.size()));
+    }
+
+    OUTCOME_TRY(target_size, get_u64(patch));
+    entry.target_size = target_size;
+
+    OUTCOME_TRYV(file_read_exact(patch, entry.target_digest.data(),
+                                 entry.target_digest.size()));
+
+    return std::move(entry);
+}
+
+/*!
+ * \brief Stream the ops of one entry into the writer
+ */
+static oc::result<void> apply_ops(File &patch, Writer &writer,
+                                  const PatchEntry &pe,
+                                  const std::vector<unsigned char> &source)
+{
+    SHA_CTX sha_ctx;
+    if (!SHA1_Init(&sha_ctx)) {
+        return std::errc::io_error;
+    }
+
+    std::vector<unsigned char> buf(INSERT_BUFFER_SIZE);
+    uint64_t written = 0;
+
+    auto emit = [&](const unsigned char *data, size_t size)
+            -> oc::result<void> {
+        if (size > pe.target_size - written) {
+            return DeltaError::TargetEntryMismatch;
+        }
+
+        OUTCOME_TRYV(writer.write_data(data, size));
+        SHA1_Update(&sha_ctx, data, size);
+        written += size;
+
+        return oc::success();
+    };
+
+    while (true) {
+        OUTCOME_TRY(op, get_u8(patch));
+
+        if (static_cast<Op>(op) == Op::End) {
+            break;
+        } else if (static_cast<Op>(op) == Op::Copy) {
+            OUTCOME_TRY(offset, get_u64(patch));
+            OUTCOME_TRY(length, get_u64(patch));
+
+            if (offset > source.size() || length > source.size() - offset) {
+                return DeltaError::CopyOutOfRange;
+            }
+
+            OUTCOME_TRYV(emit(source.data() + offset,
+                              static_cast<size_t>(length)));
+        } else if (static_cast<Op>(op) == Op::Insert) {
+            OUTCOME_TRY(length, get_u64(patch));
+
+            while (length > 0) {
+                auto n = static_cast<size_t>(
+                        std::min<uint64_t>(length, buf.size()));
+
+                OUTCOME_TRYV(file_read_exact(patch, buf.data(), n));
+                OUTCOME_TRYV(emit(buf.data(), n));
+
+                length -= n;
+            }
+        } else {
+            return DeltaError::InvalidRecord;
+        }
+    }
+
+    Digest digest;
+    if (!SHA1_Final(digest.data(), &sha_ctx)) {
+        return std::errc::io_error;
+    }
+
+    if (written != pe.target_size || digest != pe.target_digest) {
+        return DeltaError::TargetEntryMismatch;
+    }
+
+    return oc::success();
+}
+
+/*!
+ * \brief Apply a delta to a boot image
+ *
+ * The output boot image is written through a Writer for the format recorded
+ * in the delta. The data of each output entry is streamed from the delta and
+ * from the corresponding entry of \p source, and is verified against the
+ * checksum recorded in the delta.
+ *
+ * \param source Reader for the boot image that the delta was created from. It
+ *               must be open and its header must not have been read yet.
+ * \param patch File containing the delta
+ * \param output File to write the output boot image to
+ *
+ * \return Nothing if the delta is successfully applied. Otherwise, the error
+ *         code. If \p source is not the boot image that the delta was created
+ *         from, DeltaError::SourceEntryMismatch is returned.
+ */
+oc::result<void> delta_apply(Reader &source, File &patch, File &output)
+{
+    char magic[sizeof(DELTA_MAGIC)];
+    OUTCOME_TRYV(file_read_exact(patch, magic, sizeof(magic)));
+    if (memcmp(magic, DELTA_MAGIC, sizeof(magic)) != 0) {
+        return DeltaError::InvalidMagic;
+    }
+
+    OUTCOME_TRY(format_code, get_u8(patch));
+
+    std::optional<Format> format;
+    for (auto const f : ALL_FORMATS) {
+        if (static_cast<uint8_t>(f) == format_code) {
+            format = f;
+        }
+    }
+    if (!format) {
+        return DeltaError::InvalidFormat;
+    }
+
+    OUTCOME_TRYV(source.read_header());
+
+    Writer writer;
+    OUTCOME_TRYV(writer.set_format(*format));
+    OUTCOME_TRYV(writer.open(&output));
+
+    OUTCOME_TRY(header, writer.get_header());
+    OUTCOME_TRYV(get_header(patch, header));
+    OUTCOME_TRYV(writer.write_header(header));
+
+    OUTCOME_TRY(pending, get_entry_header(patch));
+
+    // Entries in the delta are in the target image's order, which is the order
+    // that the writer asks for them. Entries that the target does not have are
+    // left empty.
+    while (true) {
+        auto entry = writer.get_entry();
+        if (!entry) {
+            if (entry.error() == WriterError::EndOfEntries) {
+                break;
+            }
+            return entry.as_failure();
+        }
+
+        OUTCOME_TRYV(writer.write_entry(entry.value()));
+
+        if (!pending || pending->type != entry.value().type()) {
+            continue;
+        }
+
+        std::vector<unsigned char> source_data;
+
+        if (pending->source_size != NO_SOURCE_ENTRY) {
+            auto source_entry = source.go_to_entry(pending->type);
+            if (!source_entry) {
+                if (source_entry.error() == ReaderError::EndOfEntries) {
+                    return DeltaError::SourceEntryMismatch;
+                }
+                return source_entry.as_failure();
+            }
+
+            OUTCOME_TRY(data, read_entry_data(source, source_entry.value()));
+
+            if (data.size() != pending->source_size
+                    || compute_digest(data) != pending->source_digest) {
+                return DeltaError::SourceEntryMismatch;
+            }
+
+            source_data = std::move(data);
+        }
+
+        OUTCOME_TRYV(apply_ops(patch, writer, *pending, source_data));
+
+        OUTCOME_TRY(next, get_entry_header(patch));
+        pending = std::move(next);
+    }
+
+    if (pending) {
+        return DeltaError::UnexpectedEntry;
+    }
+
+    return writer.close();
+}
+
+}
@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbbootimg/delta_error.h"
+
+#include <string>
+
+namespace mb::bootimg
+{
+
+struct DeltaErrorCategory : std::error_category
+{
+    const char * name() const noexcept override;
+
+    std::string message(int ev) const override;
+};
+
+const std::error_category & delta_error_category()
+{
+    static DeltaErrorCategory c;
+    return c;
+}
+
+std::error_code make_error_code(DeltaError e)
+{
+    return {static_cast<int>(e), delta_error_category()};
+}
+
+const char * DeltaErrorCategory::name() const noexcept
+{
+    return "delta";
+}
+
+std::string DeltaErrorCategory::message(int ev) const
+{
+    switch (static_cast<DeltaError>(ev)) {
+    case DeltaError::InvalidMagic:
+        return "not a boot image delta";
+    case DeltaError::InvalidFormat:
+        return "invalid boot image format in delta";
+    case DeltaError::InvalidRecord:
+        return "invalid delta record";
+    case DeltaError::CopyOutOfRange:
+        return "delta copies data past the end of the source entry";
+    case DeltaError::SourceEntryMismatch:
+        return "source entry does not match delta";
+    case DeltaError::TargetEntryMismatch:
+        return "patched entry does not match delta";
+    case DeltaError::UnexpectedEntry:
+        return "delta entry not expected by output format";
+    default:
+        return "(unknown delta error)";
+    }
+}
+
+}
@@ -0,0 +1,499 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbbootimg/dt_table.h"
+
+#include <algorithm>
+#include <tuple>
+#include <unordered_map>
+
+#include <cstring>
+
+#include "mbcommon/endian.h"
+
+/*!
+ * \file mbbootimg/dt_table.h
+ * \brief Device tree tables (Qualcomm dt.img and Android DTBO images)
+ *
+ * A device tree table bundles the DTBs for several boards along with the IDs
+ * that the bootloader uses to pick one. DtTable parses a table that is already
+ * in memory (eg. from Reader::read_data_view()) without copying it and indexes
+ * the entries so that the DTB for a board can be looked up directly.
+ * dt_table_build() writes a table and stores DTBs that are shared by several
+ * entries only once.
+ *
+ * QCDT format (all integers are little endian):
+ *
+ *     magic          "QCDT"
+ *     version        u32 (1, 2, or 3)
+ *     entry count    u32
+ *     entries        v1: platform, variant, revision, offset, size
+ *                    v2: platform, variant, subtype, revision, offset, size
+ *                    v3: platform, variant, subtype, revision, pmic[4],
+ *                        offset, size
+ *     terminator     u32 (0)
+ *
+ * The DTBs follow the table. The table and each DTB are padded to the page
+ * size and the size recorded in each entry includes the padding.
+ *
+ * DTBO format (all integers are big endian):
+ *
+ *     magic          0xd7b7ab1e
+ *     total size     u32
+ *     header size    u32
+ *     entry size     u32
+ *     entry count    u32
+ *     entries offset u32
+ *     page size      u32
+ *     version        u32 (0 or 1)
+ *     entries        size, offset, id, rev, custom[4]
+ */
+
+namespace mb::bootimg
+{
+
+constexpr char QCDT_MAGIC[4] = {'Q', 'C', 'D', 'T'};
+constexpr size_t QCDT_HEADER_SIZE = 12;
+constexpr uint32_t QCDT_VERSION_MIN = 1;
+constexpr uint32_t QCDT_VERSION_MAX = 3;
+
+constexpr uint32_t DTBO_MAGIC = 0xd7b7ab1e;
+constexpr size_t DTBO_HEADER_SIZE = 32;
+constexpr size_t DTBO_ENTRY_SIZE = 32;
+constexpr uint32_t DTBO_VERSION_MAX = 1;
+
+constexpr uint32_t FDT_MAGIC = 0xd00dfeed;
+
+static uint32_t read_le32(const char *ptr)
+{
+    uint32_t value;
+    memcpy(&value, ptr, sizeof(value));
+    return mb_le32toh(value);
+}
+
+static uint32_t read_be32(const char *ptr)
+{
+    uint32_t value;
+    memcpy(&value, ptr, sizeof(value));
+    return mb_be32toh(value);
+}
+
+static void write_le32(char *ptr, uint32_t value)
+{
+    value = mb_htole32(value);
+    memcpy(ptr, &value, sizeof(value));
+}
+
+static void write_be32(char *ptr, uint32_t value)
+{
+    value = mb_htobe32(value);
+    memcpy(ptr, &value, sizeof(value));
+}
+
+static size_t qcdt_entry_size(uint32_t version)
+{
+    switch (version) {
+    case 1:
+        return 20;
+    case 2:
+        return 24;
+    default:
+        return 40;
+    }
+}
+
+static uint64_t align_up(uint64_t value, uint64_t alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+static std::tuple<uint32_t, uint32_t, uint32_t> entry_key(const DtTableEntry &e)
+{
+    return {e.platform_id, e.variant_id, e.revision};
+}
+
+/*!
+ * \class DtTable
+ *
+ * \brief Parsed device tree table
+ *
+ * The table does not own the data it was parsed from. The data must outlive
+ * the DtTable and the slices returned by blob().
+ */
+
+/*!
+ * \brief Construct an empty QCDT table
+ */
+DtTable::DtTable()
+    : m_format(DtTableFormat::Qcdt)
+    , m_version(0)
+    , m_page_size(0)
+{
+}
+
+/*!
+ * \brief Parse a QCDT or DTBO table
+ *
+ * The format is detected from the magic. The table is validated, including
+ * that every entry lies within \p data, so blob() never fails afterwards.
+ *
+ * \param data Table data
+ *
+ * \return Parsed table or a DtTableError
+ */
+oc::result<DtTable> DtTable::parse(std::string_view data)
+{
+    DtTable table;
+
+    if (data.size() >= sizeof(QCDT_MAGIC)
+            && memcmp(data.data(), QCDT_MAGIC, sizeof(QCDT_MAGIC)) == 0) {
+        if (data.size() < QCDT_HEADER_SIZE) {
+            return DtTableError::TableTruncated;
+        }
+
+        table.m_format = DtTableFormat::Qcdt;
+        table.m_version = read_le32(data.data() + 4);
+
+        if (table.m_version < QCDT_VERSION_MIN
+                || table.m_version > QCDT_VERSION_MAX) {
+            return DtTableError::UnsupportedVersion;
+        }
+
+        uint32_t count = read_le32(data.data() + 8);
+        size_t entry_size = qcdt_entry_size(table.m_version);
+
+        if (count > (data.size() - QCDT_HEADER_SIZE) / entry_size) {
+            return DtTableError::TableTruncated;
+        }
+
+        table.m_entries.resize(count);
+
+        for (uint32_t i = 0; i < count; ++i) {
+            auto ptr = data.data() + QCDT_HEADER_SIZE + i * entry_size;
+            auto &entry = table.m_entries[i];
+
+            entry.platform_id = read_le32(ptr);
+            entry.variant_id = read_le32(ptr + 4);
+            ptr += 8;
+
+            if (table.m_version >= 2) {
+                entry.subtype_id = read_le32(ptr);
+                ptr += 4;
+            }
+
+            entry.revision = read_le32(ptr);
+            ptr += 4;
+
+            if (table.m_version >= 3) {
+                for (auto &pmic : entry.extra) {
+                    pmic = read_le32(ptr);
+                    ptr += 4;
+                }
+            }
+
+            entry.offset = read_le32(ptr);
+            entry.size = read_le32(ptr + 4);
+        }
+    } else if (data.size() >= sizeof(uint32_t)
+            && read_be32(data.data()) == DTBO_MAGIC) {
+        if (data.size() < DTBO_HEADER_SIZE) {
+            return DtTableError::TableTruncated;
+        }
+
+        uint32_t total_size = read_be32(data.data() + 4);
+        uint32_t header_size = read_be32(data.data() + 8);
+        uint32_t entry_size = read_be32(data.data() + 12);
+        uint32_t count = read_be32(data.data() + 16);
+        uint32_t entries_offset = read_be32(data.data() + 20);
+
+        table.m_format = DtTableFormat::Dtbo;
+        table.m_page_size = read_be32(data.data() + 24);
+        table.m_version = read_be32(data.data() + 28);
+
+        if (table.m_version > DTBO_VERSION_MAX) {
+            return DtTableError::UnsupportedVersion;
+        } else if (header_size < DTBO_HEADER_SIZE
+                || entry_size < DTBO_ENTRY_SIZE) {
+            return DtTableError::InvalidHeader;
+        } else if (total_size > data.size()) {
+            return DtTableError::TableTruncated;
+        }
+
+        data = data.substr(0, total_size);
+
+        if (entries_offset > data.size() || count
+                > (data.size() - entries_offset) / entry_size) {
+            return DtTableError::TableTruncated;
+        }
+
+        table.m_entries.resize(count);
+
+        for (uint32_t i = 0; i < count; ++i) {
+            auto ptr = data.data() + entries_offset
+                    + static_cast<size_t>(i) * entry_size;
+            auto &entry = table.m_entries[i];
+
+            entry.size = read_be32(ptr);
+            entry.offset = read_be32(ptr + 4);
+            entry.platform_id = read_be32(ptr + 8);
+            entry.revision = read_be32(ptr + 12);
+            for (size_t j = 0; j < entry.extra.size(); ++j) {
+                entry.extra[j] = read_be32(ptr + 16 + j * 4);
+            }
+        }
+    } else {
+        return DtTableError::InvalidMagic;
+    }
+
+    for (auto const &entry : table.m_entries) {
+        if (entry.offset > data.size()
+                || entry.size > data.size() - entry.offset) {
+            return DtTableError::EntryOutOfRange;
+        }
+    }
+
+    table.m_data = data;
+
+    table.m_index.resize(table.m_entries.size());
+    for (size_t i = 0; i < table.m_index.size(); ++i) {
+        table.m_index[i] = i;
+    }
+
+    // Stable, so that find() returns the first matching entry in table order
+    std::stable_sort(table.m_index.begin(), table.m_index.end(),
+                     [&](size_t a, size_t b) {
+        return entry_key(table.m_entries[a]) < entry_key(table.m_entries[b]);
+    });
+
+    return std::move(table);
+}
+
+DtTableFormat DtTable::format() const
+{
+    return m_format;
+}
+
+uint32_t DtTable::version() const
+{
+    return m_version;
+}
+
+/*!
+ * \brief Page size recorded in the table
+ *
+ * \return Page size or 0 if the format does not record it (QCDT)
+ */
+uint32_t DtTable::page_size() const
+{
+    return m_page_size;
+}
+
+const std::vector<DtTableEntry> & DtTable::entries() const
+{
+    return m_entries;
+}
+
+/*!
+ * \brief Find the entry for a board
+ *
+ * For DTBO tables, \p platform_id is the entry's id and \p variant_id must be
+ * 0.
+ *
+ * \return First matching entry in table order or nullptr if there is none
+ */
+const DtTableEntry * DtTable::find(uint32_t platform_id, uint32_t variant_id,
+                                   uint32_t revision) const
+{
+    auto key = std::make_tuple(platform_id, variant_id, revision);
+
+    auto it = std::lower_bound(m_index.begin(), m_index.end(), key,
+                               [&](size_t i, const auto &k) {
+        return entry_key(m_entries[i]) < k;
+    });
+
+    if (it == m_index.end() || entry_key(m_entries[*it]) != key) {
+        return nullptr;
+    }
+
+    return &m_entries[*it];
+}
+
+/*!
+ * \brief Get the DTB for an entry without copying it
+ *
+ * If the data is a flattened device tree, the padding after it is excluded.
+ *
+ * \param entry Entry from entries() or find()
+ *
+ * \return Slice of the data passed to parse()
+ */
+std::string_view DtTable::blob(const DtTableEntry &entry) const
+{
+    auto data = m_data.substr(entry.offset, entry.size);
+
+    if (data.size() >= 8 && read_be32(data.data()) == FDT_MAGIC) {
+        uint32_t fdt_size = read_be32(data.data() + 4);
+        if (fdt_size <= data.size()) {
+            data = data.substr(0, fdt_size);
+        }
+    }
+
+    return data;
+}
+
+/*!
+ * \brief Build a QCDT or DTBO table
+ *
+ * DTBs with identical contents are stored once and all of their entries point
+ * to the same copy. The offset and size fields of the entries in \p blobs are
+ * ignored.
+ *
+ * \param format Table format
+ * \param version Table version (1-3 for QCDT, 0-1 for DTBO)
+ * \param page_size Page size. For QCDT, the table and DTBs are padded to this
+ *                  size, so it must be a power of 2. For DTBO, it is only
+ *                  recorded in the header.
+ * \param blobs Entries and their DTBs in table order
+ *
+ * \return Table data or a DtTableError
+ */
+oc::result<std::string>
+dt_table_build(DtTableFormat format, uint32_t version, uint32_t page_size,
+               const std::vector<DtTableBlob> &blobs)
+{
+    if (page_size == 0 || (format == DtTableFormat::Qcdt
+            && (page_size & (page_size - 1)) != 0)) {
+        return DtTableError::InvalidPageSize;
+    }
+
+    if (format == DtTableFormat::Qcdt ? (version < QCDT_VERSION_MIN
+            || version > QCDT_VERSION_MAX) : version > DTBO_VERSION_MAX) {
+        return DtTableError::UnsupportedVersion;
+    }
+
+    uint64_t header_size;
+    if (format == DtTableFormat::Qcdt) {
+        header_size = align_up(QCDT_HEADER_SIZE + blobs.size()
+                * qcdt_entry_size(version) + sizeof(uint32_t), page_size);
+    } else {
+        header_size = DTBO_HEADER_SIZE + blobs.size() * DTBO_ENTRY_SIZE;
+    }
+
+    // Assign offsets, storing identical DTBs only once
+    std::unordered_map<std::string_view, std::pair<uint32_t, uint32_t>> stored;
+    std::vector<std::pair<uint32_t, uint32_t>> locations;
+    std::vector<std::pair<uint32_t, std::string_view>> unique;
+    uint64_t total_size = header_size;
+
+    locations.reserve(blobs.size());
+
+    for (auto const &[entry, data] : blobs) {
+        (void) entry;
+
+        auto it = stored.find(data);
+        if (it == stored.end()) {
+            uint64_t size = format == DtTableFormat::Qcdt
+                    ? align_up(data.size(), page_size) : data.size();
+
+            if (total_size + size > UINT32_MAX) {
+                return DtTableError::TableTooLarge;
+            }
+
+            auto location = std::make_pair(static_cast<uint32_t>(total_size),
+                                           static_cast<uint32_t>(size));
+            it = stored.emplace(data, location).first;
+            unique.emplace_back(location.first, data);
+            total_size += size;
+        }
+
+        locations.push_back(it->second);
+    }
+
+    std::string result(static_cast<size_t>(total_size), '\0');
+    char *ptr = result.data();
+
+    if (format == DtTableFormat::Qcdt) {
+        memcpy(ptr, QCDT_MAGIC, sizeof(QCDT_MAGIC));
+        write_le32(ptr + 4, version);
+        write_le32(ptr + 8, static_cast<uint32_t>(blobs.size()));
+        ptr += QCDT_HEADER_SIZE;
+
+        for (size_t i = 0; i < blobs.size(); ++i) {
+            auto const &entry = blobs[i].first;
+
+            write_le32(ptr, entry.platform_id);
+            write_le32(ptr + 4, entry.variant_id);
+            ptr += 8;
+
+            if (version >= 2) {
+                write_le32(ptr, entry.subtype_id);
+                ptr += 4;
+            }
+
+            write_le32(ptr, entry.revision);
+            ptr += 4;
+
+            if (version >= 3) {
+                for (auto pmic : entry.extra) {
+                    write_le32(ptr, pmic);
+                    ptr += 4;
+                }
+            }
+
+            write_le32(ptr, locations[i].first);
+            write_le32(ptr + 4, locations[i].second);
+            ptr += 8;
+        }
+
+        // The terminator is already zero
+    } else {
+        write_be32(ptr, DTBO_MAGIC);
+        write_be32(ptr + 4, static_cast<uint32_t>(total_size));
+        write_be32(ptr + 8, DTBO_HEADER_SIZE);
+        write_be32(ptr + 12, DTBO_ENTRY_SIZE);
+        write_be32(ptr + 16, static_cast<uint32_t>(blobs.size()));
+        write_be32(ptr + 20, DTBO_HEADER_SIZE);
+        write_be32(ptr + 24, page_size);
+        write_be32(ptr + 28, version);
+        ptr += DTBO_HEADER_SIZE;
+
+        for (size_t i = 0; i < blobs.size(); ++i) {
+            auto const &entry = blobs[i].first;
+
+            write_be32(ptr, locations[i].second);
+            write_be32(ptr + 4, locations[i].first);
+            write_be32(ptr + 8, entry.platform_id);
+            write_be32(ptr + 12, entry.revision);
+            for (size_t j = 0; j < entry.extra.size(); ++j) {
+                write_be32(ptr + 16 + j * 4, entry.extra[j]);
+            }
+            ptr += DTBO_ENTRY_SIZE;
+        }
+    }
+
+    for (auto const &[offset, data] : unique) {
+        if (!data.empty()) {
+            memcpy(result.data() + offset, data.data(), data.size());
+        }
+    }
+
+    return std::move(result);
+}
+
+}
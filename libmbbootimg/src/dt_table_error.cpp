@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbbootimg/dt_table_error.h"
+
+#include <string>
+
+namespace mb::bootimg
+{
+
+struct DtTableErrorCategory : std::error_category
+{
+    const char * name() const noexcept override;
+
+    std::string message(int ev) const override;
+};
+
+const std::error_category & dt_table_error_category()
+{
+    static DtTableErrorCategory c;
+    return c;
+}
+
+std::error_code make_error_code(DtTableError e)
+{
+    return {static_cast<int>(e), dt_table_error_category()};
+}
+
+const char * DtTableErrorCategory::name() const noexcept
+{
+    return "dt_table";
+}
+
+std::string DtTableErrorCategory::message(int ev) const
+{
+    switch (static_cast<DtTableError>(ev)) {
+    case DtTableError::InvalidMagic:
+        return "not a device tree table";
+    case DtTableError::UnsupportedVersion:
+        return "unsupported device tree table version";
+    case DtTableError::InvalidHeader:
+        return "invalid device tree table header";
+    case DtTableError::TableTruncated:
+        return "device tree table is truncated";
+    case DtTableError::EntryOutOfRange:
+        return "device tree table entry points past the end of the table";
+    case DtTableError::TableTooLarge:
+        return "device tree table is too large";
+    case DtTableError::InvalidPageSize:
+        return "invalid device tree table page size";
+    default:
+        return "(unknown device tree table error)";
+    }
+}
+
+}
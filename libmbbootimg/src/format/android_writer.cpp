@@ -44,6 +44,9 @@
 namespace mb::bootimg::android
 {
 
+//! Minimum number of bytes to pass to SHA1_Update() at once
+static constexpr size_t SHA1_BATCH_SIZE = 64 * 1024;
+
 AndroidFormatWriter::AndroidFormatWriter(bool is_bump) noexcept
     : FormatWriter()
     , m_is_bump(is_bump)
@@ -71,6 +74,9 @@ oc::result<void> AndroidFormatWriter::open(File &file)
         return AndroidError::Sha1InitError;
     }
 
+    m_sha_buf.clear();
+    m_sha_buf.reserve(SHA1_BATCH_SIZE);
+
     m_seg = SegmentWriter();
 
     return oc::success();
@@ -81,6 +87,8 @@ oc::result<void> AndroidFormatWriter::close(File &file)
     auto reset_state = finally([&] {
         m_hdr = {};
         m_sha_ctx = {};
+        m_sha_buf.clear();
+        m_sha_buf.shrink_to_fit();
         m_seg = {};
     });
 
@@ -99,6 +107,8 @@ oc::result<void> AndroidFormatWriter::close(File &file)
             OUTCOME_TRYV(file_write_exact(file, magic, magic_size));
 
             // Set ID
+            OUTCOME_TRYV(sha1_flush());
+
             unsigned char digest[SHA_DIGEST_LENGTH];
             if (!SHA1_Final(digest, &m_sha_ctx)) {
                 return AndroidError::Sha1UpdateError;
@@ -172,18 +182,18 @@ AndroidFormatWriter::write_header(File &file, const Header &header)
             return AndroidError::BoardNameTooLong;
         }
 
-        strncpy(reinterpret_cast<char *>(m_hdr.name), board_name->c_str(),
-                sizeof(m_hdr.name) - 1);
-        m_hdr.name[sizeof(m_hdr.name) - 1] = '\0';
+        memcpy(m_hdr.name, board_name->data(), board_name->size());
+        memset(m_hdr.name + board_name->size(), 0,
+               sizeof(m_hdr.name) - board_name->size());
     }
     if (auto cmdline = header.kernel_cmdline()) {
         if (cmdline->size() >= sizeof(m_hdr.cmdline)) {
             return AndroidError::KernelCmdlineTooLong;
         }
 
-        strncpy(reinterpret_cast<char *>(m_hdr.cmdline), cmdline->c_str(),
-                sizeof(m_hdr.cmdline) - 1);
-        m_hdr.cmdline[sizeof(m_hdr.cmdline) - 1] = '\0';
+        memcpy(m_hdr.cmdline, cmdline->data(), cmdline->size());
+        memset(m_hdr.cmdline + cmdline->size(), 0,
+               sizeof(m_hdr.cmdline) - cmdline->size());
     }
 
     // TODO: UNUSED
@@ -222,9 +232,7 @@ AndroidFormatWriter::write_data(File &file, const void *buf, size_t buf_size)
 
     // We always include the image in the hash. The size is sometimes included
     // and is handled in finish_entry().
-    if (!SHA1_Update(&m_sha_ctx, buf, n)) {
-        return AndroidError::Sha1UpdateError;
-    }
+    OUTCOME_TRYV(sha1_update(buf, n));
 
     return n;
 }
@@ -239,9 +247,8 @@ oc::result<void> AndroidFormatWriter::finish_entry(File &file)
     uint32_t le32_size = mb_htole32(*swentry->size);
 
     // Include size for everything except empty DT images
-    if ((swentry->type != EntryType::DeviceTree || *swentry->size > 0)
-            && !SHA1_Update(&m_sha_ctx, &le32_size, sizeof(le32_size))) {
-        return AndroidError::Sha1UpdateError;
+    if (swentry->type != EntryType::DeviceTree || *swentry->size > 0) {
+        OUTCOME_TRYV(sha1_update(&le32_size, sizeof(le32_size)));
     }
 
     switch (swentry->type) {
@@ -264,4 +271,44 @@ oc::result<void> AndroidFormatWriter::finish_entry(File &file)
     return oc::success();
 }
 
+/*!
+ * \brief Add data to the SHA1 hash
+ *
+ * Callers (eg. zlib and LZ4 stream compressors) tend to write entry data in
+ * small pieces. Passing each of those to SHA1_Update() separately does not let
+ * the assembly implementations, which use the ARMv8 crypto extensions or
+ * SHA-NI when available, process many blocks per call. Small updates are
+ * coalesced into \ref SHA1_BATCH_SIZE chunks instead. Large updates are hashed
+ * directly without copying.
+ */
+oc::result<void> AndroidFormatWriter::sha1_update(const void *data, size_t size)
+{
+    if (m_sha_buf.size() + size > SHA1_BATCH_SIZE) {
+        OUTCOME_TRYV(sha1_flush());
+    }
+
+    if (size >= SHA1_BATCH_SIZE) {
+        if (!SHA1_Update(&m_sha_ctx, data, size)) {
+            return AndroidError::Sha1UpdateError;
+        }
+    } else {
+        auto ptr = static_cast<const unsigned char *>(data);
+        m_sha_buf.insert(m_sha_buf.end(), ptr, ptr + size);
+    }
+
+    return oc::success();
+}
+
+oc::result<void> AndroidFormatWriter::sha1_flush()
+{
+    if (!m_sha_buf.empty()) {
+        if (!SHA1_Update(&m_sha_ctx, m_sha_buf.data(), m_sha_buf.size())) {
+            return AndroidError::Sha1UpdateError;
+        }
+        m_sha_buf.clear();
+    }
+
+    return oc::success();
+}
+
 }
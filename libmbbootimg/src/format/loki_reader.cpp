@@ -21,6 +21,7 @@
 
 #include <algorithm>
 #include <optional>
+#include <vector>
 
 #include <cerrno>
 #include <cinttypes>
@@ -167,12 +168,23 @@ LokiFormatReader::go_to_entry(File &file, std::optional<EntryType> entry_type)
     return m_seg->go_to_entry(file, entry_type);
 }
 
+oc::result<std::vector<Entry>> LokiFormatReader::list_entries(File &file)
+{
+    (void) file;
+    return m_seg->list_entries();
+}
+
 oc::result<size_t>
 LokiFormatReader::read_data(File &file, void *buf, size_t buf_size)
 {
     return m_seg->read_data(file, buf, buf_size);
 }
 
+oc::result<ConstIoVec> LokiFormatReader::read_data_view(File &file)
+{
+    return m_seg->read_data_view(file);
+}
+
 /*!
  * \brief Find and read Loki boot image header
  *
@@ -273,6 +285,84 @@ LokiFormatReader::find_ramdisk_address(File &file,
     return ramdisk_addr;
 }
 
+/*! \cond INTERNAL */
+
+//! Size of the reads used when scanning a file that is not memory-backed
+static constexpr size_t GZIP_SCAN_WINDOW_SIZE = 256 * 1024;
+
+struct GzipScanResult
+{
+    std::optional<uint64_t> flag0_offset;
+    std::optional<uint64_t> flag8_offset;
+
+    bool done() const
+    {
+        return flag0_offset && flag8_offset;
+    }
+};
+
+/*!
+ * \brief Find the first gzip headers with a flags byte of 0x00 and 0x08
+ *
+ * Candidates are located with memchr(), which is vectorized by the C library,
+ * rather than by comparing every byte.
+ *
+ * \param data Buffer to scan
+ * \param size Size of buffer
+ * \param base File offset of \p data
+ * \param result Offsets found in this and previous buffers
+ *
+ * \return Number of bytes at the beginning of \p data that do not need to be
+ *         scanned again. The remaining bytes (at most 3) may be the start of a
+ *         header that continues past the end of the buffer.
+ */
+static size_t scan_gzip_headers(const unsigned char *data, size_t size,
+                                uint64_t base, GzipScanResult &result)
+{
+    // Magic (0x1f, 0x8b), compression method (0x08 = deflate), flags
+    static constexpr size_t header_size = 4;
+
+    if (size < header_size) {
+        return 0;
+    }
+
+    const size_t limit = size - header_size + 1;
+    size_t i = 0;
+
+    while (i < limit) {
+        auto ptr = static_cast<const unsigned char *>(
+                memchr(data + i, 0x1f, limit - i));
+        if (!ptr) {
+            i = limit;
+            break;
+        }
+
+        i = static_cast<size_t>(ptr - data);
+
+        if (ptr[1] != 0x8b || ptr[2] != 0x08) {
+            ++i;
+            continue;
+        }
+
+        if (!result.flag0_offset && ptr[3] == 0x00) {
+            result.flag0_offset = base + i;
+        } else if (!result.flag8_offset && ptr[3] == 0x08) {
+            result.flag8_offset = base + i;
+        }
+
+        if (result.done()) {
+            return size;
+        }
+
+        // Matches do not overlap
+        i += 3;
+    }
+
+    return std::min(i, size);
+}
+
+/*! \endcond */
+
 /*!
  * \brief Find gzip ramdisk offset in old-style Loki image
  *
@@ -306,62 +396,48 @@ LokiFormatReader::find_gzip_offset_old(File &file, uint32_t start_offset)
     // byte 8   : compression flags
     // byte 9   : operating system
 
-    static constexpr unsigned char gzip_deflate_magic[] = { 0x1f, 0x8b, 0x08 };
-
-    OUTCOME_TRYV(file.seek(static_cast<int64_t>(start_offset), SEEK_SET));
+    GzipScanResult result;
 
-    FileSearcher searcher(&file, gzip_deflate_magic,
-                          sizeof(gzip_deflate_magic));
-    std::optional<uint64_t> flag0_offset;
-    std::optional<uint64_t> flag8_offset;
-
-    // Find first result with flags == 0x00 and flags == 0x08
-    while (true) {
-        OUTCOME_TRY(offset, searcher.next());
-        if (!offset) {
-            break;
+    // If the file is memory-backed, scan the whole image in place
+    if (auto mapped = file.mapped_data()) {
+        if (start_offset < mapped->size) {
+            scan_gzip_headers(static_cast<const unsigned char *>(mapped->data)
+                                      + start_offset,
+                              mapped->size - start_offset, start_offset,
+                              result);
         }
+    } else {
+        OUTCOME_TRYV(file.seek(static_cast<int64_t>(start_offset), SEEK_SET));
 
-        // Offset is relative to starting position
-        *offset += start_offset;
-
-        // Save original position
-        OUTCOME_TRY(orig_offset, file.seek(0, SEEK_CUR));
-
-        // Seek to flags byte
-        OUTCOME_TRYV(file.seek(static_cast<int64_t>(*offset + 3), SEEK_SET));
+        std::vector<unsigned char> buf(GZIP_SCAN_WINDOW_SIZE);
+        uint64_t buf_offset = start_offset;
+        size_t buf_used = 0;
 
-        // Read next bytes for flags
-        unsigned char flags;
-        if (auto r = file_read_exact(file, &flags, sizeof(flags)); !r) {
-            if (r.error() == FileError::UnexpectedEof) {
+        while (!result.done()) {
+            OUTCOME_TRY(n, file_read_retry(file, buf.data() + buf_used,
+                                           buf.size() - buf_used));
+            if (n == 0) {
                 break;
-            } else {
-                return r.as_failure();
             }
-        }
 
-        if (!flag0_offset && flags == 0x00) {
-            flag0_offset = *offset;
-        } else if (!flag8_offset && flags == 0x08) {
-            flag8_offset = *offset;
-        }
-
-        // Restore original position as per contract
-        OUTCOME_TRYV(file.seek(static_cast<int64_t>(orig_offset), SEEK_SET));
+            buf_used += n;
 
-        // Stop early if possible
-        if (flag0_offset && flag8_offset) {
-            break;
+            // Keep the bytes that may be the start of a header that crosses
+            // into the next window
+            auto scanned = scan_gzip_headers(buf.data(), buf_used, buf_offset,
+                                             result);
+            memmove(buf.data(), buf.data() + scanned, buf_used - scanned);
+            buf_used -= scanned;
+            buf_offset += scanned;
         }
     }
 
     // Prefer gzip header with original filename flag since most loki'd boot
     // images will have been compressed manually with the gzip tool
-    if (flag8_offset) {
-        return *flag8_offset;
-    } else if (flag0_offset) {
-        return *flag0_offset;
+    if (result.flag8_offset) {
+        return *result.flag8_offset;
+    } else if (result.flag0_offset) {
+        return *result.flag0_offset;
     } else {
         return LokiError::NoRamdiskGzipHeaderFound;
     }
@@ -171,18 +171,18 @@ LokiFormatWriter::write_header(File &file, const Header &header)
             return android::AndroidError::BoardNameTooLong;
         }
 
-        strncpy(reinterpret_cast<char *>(m_hdr.name), board_name->c_str(),
-                sizeof(m_hdr.name) - 1);
-        m_hdr.name[sizeof(m_hdr.name) - 1] = '\0';
+        memcpy(m_hdr.name, board_name->data(), board_name->size());
+        memset(m_hdr.name + board_name->size(), 0,
+               sizeof(m_hdr.name) - board_name->size());
     }
     if (auto cmdline = header.kernel_cmdline()) {
         if (cmdline->size() >= sizeof(m_hdr.cmdline)) {
             return android::AndroidError::KernelCmdlineTooLong;
         }
 
-        strncpy(reinterpret_cast<char *>(m_hdr.cmdline), cmdline->c_str(),
-                sizeof(m_hdr.cmdline) - 1);
-        m_hdr.cmdline[sizeof(m_hdr.cmdline) - 1] = '\0';
+        memcpy(m_hdr.cmdline, cmdline->data(), cmdline->size());
+        memset(m_hdr.cmdline + cmdline->size(), 0,
+               sizeof(m_hdr.cmdline) - cmdline->size());
     }
 
     // TODO: UNUSED
@@ -139,6 +139,20 @@ SegmentReader::go_to_entry(File &file, std::optional<EntryType> entry_type)
     return move_to_entry(file, srentry);
 }
 
+std::vector<Entry> SegmentReader::list_entries() const
+{
+    std::vector<Entry> entries;
+    entries.reserve(m_entries.size());
+
+    for (auto const &srentry : m_entries) {
+        Entry entry(srentry.type);
+        entry.set_size(srentry.size);
+        entries.push_back(std::move(entry));
+    }
+
+    return entries;
+}
+
 oc::result<size_t> SegmentReader::read_data(File &file, void *buf,
                                             size_t buf_size)
 {
@@ -167,4 +181,32 @@ oc::result<size_t> SegmentReader::read_data(File &file, void *buf,
     return n;
 }
 
+oc::result<ConstIoVec> SegmentReader::read_data_view(File &file)
+{
+    auto mapped = file.mapped_data();
+    if (!mapped) {
+        return ReaderError::UnsupportedDataView;
+    }
+
+    auto file_size = static_cast<uint64_t>(mapped->size);
+    auto begin = std::min(m_read_cur_offset, file_size);
+    auto end = std::min(m_read_end_offset, file_size);
+
+    // Same truncation rules as read_data()
+    if (end != m_read_end_offset && !m_entry->can_truncate) {
+        return FileError::UnexpectedEof;
+    }
+
+    // Keep the file position in sync with m_read_cur_offset since
+    // move_to_entry() skips the seek when it matches the next entry's offset
+    OUTCOME_TRYV(file.seek(static_cast<int64_t>(end), SEEK_SET));
+
+    m_read_cur_offset = end;
+
+    return ConstIoVec{
+        static_cast<const unsigned char *>(mapped->data) + begin,
+        static_cast<size_t>(end - begin),
+    };
+}
+
 }
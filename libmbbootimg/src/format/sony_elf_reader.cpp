@@ -215,12 +215,23 @@ SonyElfFormatReader::go_to_entry(File &file, std::optional<EntryType> entry_type
     return m_seg->go_to_entry(file, entry_type);
 }
 
+oc::result<std::vector<Entry>> SonyElfFormatReader::list_entries(File &file)
+{
+    (void) file;
+    return m_seg->list_entries();
+}
+
 oc::result<size_t>
 SonyElfFormatReader::read_data(File &file, void *buf, size_t buf_size)
 {
     return m_seg->read_data(file, buf, buf_size);
 }
 
+oc::result<ConstIoVec> SonyElfFormatReader::read_data_view(File &file)
+{
+    return m_seg->read_data_view(file);
+}
+
 /*!
  * \brief Find and read Sony ELF boot image header
  *
@@ -30,7 +30,7 @@
 
 #include "mbcommon/endian.h"
 #include "mbcommon/file.h"
-#include "mbcommon/file_util.h"
+#include "mbcommon/file_error.h"
 #include "mbcommon/finally.h"
 
 #include "mbbootimg/entry.h"
@@ -41,6 +41,31 @@
 namespace mb::bootimg::sonyelf
 {
 
+static oc::result<void> write_exact_at(File &file, uint64_t offset,
+                                       const void *buf, size_t size)
+{
+    auto ptr = static_cast<const unsigned char *>(buf);
+
+    while (size > 0) {
+        auto n = file.write_at(offset, ptr, size);
+        if (!n) {
+            if (n.error() == std::errc::interrupted) {
+                continue;
+            } else {
+                return n.as_failure();
+            }
+        } else if (n.value() == 0) {
+            return FileError::UnexpectedEof;
+        }
+
+        ptr += n.value();
+        offset += n.value();
+        size -= n.value();
+    }
+
+    return oc::success();
+}
+
 SonyElfFormatWriter::SonyElfFormatWriter() noexcept
     : FormatWriter()
     , m_hdr()
@@ -111,15 +136,22 @@ oc::result<void> SonyElfFormatWriter::close(File &file)
             sony_elf_fix_phdr_byte_order(m_hdr_rpm);
             sony_elf_fix_phdr_byte_order(m_hdr_appsbl);
 
-            // Seek back to beginning to write headers
-            OUTCOME_TRYV(file.seek(0, SEEK_SET));
+            // The program headers are packed, so their layout is only known
+            // once all segments have been written. Assemble all headers into
+            // one buffer and write it with a single positional write instead
+            // of seeking back to the beginning.
+            unsigned char buf[sizeof(headers) / sizeof(headers[0])
+                    * std::max(sizeof(Sony_Elf32_Ehdr), sizeof(Sony_Elf32_Phdr))];
+            size_t buf_size = 0;
 
-            // Write headers
             for (auto const &header : headers) {
                 if (header.can_write) {
-                    OUTCOME_TRYV(file_write_exact(file, header.ptr, header.size));
+                    memcpy(buf + buf_size, header.ptr, header.size);
+                    buf_size += header.size;
                 }
             }
+
+            OUTCOME_TRYV(write_exact_at(file, 0, buf, buf_size));
         }
     }
 
@@ -37,6 +37,34 @@
 namespace mb::bootimg
 {
 
+template<size_t N>
+std::optional<std::string_view> Header::InlineString<N>::get() const noexcept
+{
+    if (!m_present) {
+        return std::nullopt;
+    } else if (m_size > N) {
+        return m_overflow;
+    } else {
+        return std::string_view(m_buf, m_size);
+    }
+}
+
+template<size_t N>
+void Header::InlineString<N>::set(std::optional<std::string_view> value)
+{
+    m_present = !!value;
+    m_size = value ? value->size() : 0;
+
+    if (m_size > N) {
+        m_overflow = *value;
+    } else {
+        m_overflow.clear();
+        if (m_size > 0) {
+            memmove(m_buf, value->data(), m_size);
+        }
+    }
+}
+
 Header::Header() noexcept
     : m_fields_supported(ALL_FIELDS)
 {
@@ -54,8 +82,8 @@ bool Header::operator==(const Header &rhs) const noexcept
             && m_rpm_addr == rhs.m_rpm_addr
             && m_appsbl_addr == rhs.m_appsbl_addr
             && m_page_size == rhs.m_page_size
-            && m_board_name == rhs.m_board_name
-            && m_cmdline == rhs.m_cmdline
+            && m_board_name.get() == rhs.m_board_name.get()
+            && m_cmdline.get() == rhs.m_cmdline.get()
             && m_hdr_kernel_size == rhs.m_hdr_kernel_size
             && m_hdr_ramdisk_size == rhs.m_hdr_ramdisk_size
             && m_hdr_second_size == rhs.m_hdr_second_size
@@ -91,27 +119,53 @@ void Header::set_supported_fields(HeaderFields fields)
 
 // Fields
 
-std::optional<std::string> Header::board_name() const
+/*!
+ * \brief Get board name
+ *
+ * \return View of the board name, which is only valid until the header is
+ *         modified or destroyed
+ */
+std::optional<std::string_view> Header::board_name() const
 {
-    return m_board_name;
+    return m_board_name.get();
 }
 
-bool Header::set_board_name(std::optional<std::string> name)
+/*!
+ * \brief Set board name
+ *
+ * \param name Board name. The value is copied.
+ *
+ * \return Whether the field is supported
+ */
+bool Header::set_board_name(std::optional<std::string_view> name)
 {
     ENSURE_SUPPORTED(HeaderField::BoardName);
-    m_board_name = std::move(name);
+    m_board_name.set(name);
     return true;
 }
 
-std::optional<std::string> Header::kernel_cmdline() const
+/*!
+ * \brief Get kernel command line
+ *
+ * \return View of the kernel command line, which is only valid until the
+ *         header is modified or destroyed
+ */
+std::optional<std::string_view> Header::kernel_cmdline() const
 {
-    return m_cmdline;
+    return m_cmdline.get();
 }
 
-bool Header::set_kernel_cmdline(std::optional<std::string> cmdline)
+/*!
+ * \brief Set kernel command line
+ *
+ * \param cmdline Kernel command line. The value is copied.
+ *
+ * \return Whether the field is supported
+ */
+bool Header::set_kernel_cmdline(std::optional<std::string_view> cmdline)
 {
     ENSURE_SUPPORTED(HeaderField::KernelCmdline);
-    m_cmdline = std::move(cmdline);
+    m_cmdline.set(cmdline);
     return true;
 }
 
@@ -0,0 +1,125 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbbootimg/probe_cache.h"
+
+#include <sys/stat.h>
+
+/*!
+ * \file mbbootimg/probe_cache.h
+ * \brief Cache of detected boot image formats
+ */
+
+namespace mb::bootimg
+{
+
+/*!
+ * \class ProbeCache
+ *
+ * \brief Cache of detected formats for boot image files
+ *
+ * When a Reader that has a ProbeCache opens a file by name, it remembers which
+ * format won the autodetection. Later opens of the same unchanged file only run
+ * that format's bidder, which finds the header (and, for example, the Loki or
+ * Bump magic) again, instead of having every enabled format probe the file.
+ *
+ * A file is considered unchanged if its device, inode, size, modification time,
+ * and status change time are the same. If the cached format no longer accepts
+ * the file, full autodetection is performed again.
+ *
+ * The cache can be shared by any number of readers, including ones in different
+ * threads. It must outlive all readers that use it.
+ */
+
+ProbeCache::ProbeCache() noexcept = default;
+
+ProbeCache::~ProbeCache() noexcept = default;
+
+bool ProbeCache::Stamp::operator==(const Stamp &rhs) const noexcept
+{
+    return dev == rhs.dev
+            && ino == rhs.ino
+            && size == rhs.size
+            && mtime_sec == rhs.mtime_sec
+            && mtime_nsec == rhs.mtime_nsec
+            && ctime_sec == rhs.ctime_sec
+            && ctime_nsec == rhs.ctime_nsec;
+}
+
+/*!
+ * \brief Remove all cached formats
+ */
+void ProbeCache::clear()
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_entries.clear();
+}
+
+/*!
+ * \brief Get number of cached formats
+ */
+size_t ProbeCache::size() const
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    return m_entries.size();
+}
+
+std::optional<ProbeCache::Stamp> ProbeCache::stamp_file(const std::string &path)
+{
+    struct stat sb;
+
+    if (stat(path.c_str(), &sb) < 0) {
+        return std::nullopt;
+    }
+
+    Stamp stamp{};
+    stamp.dev = static_cast<uint64_t>(sb.st_dev);
+    stamp.ino = static_cast<uint64_t>(sb.st_ino);
+    stamp.size = static_cast<uint64_t>(sb.st_size);
+    stamp.mtime_sec = static_cast<int64_t>(sb.st_mtime);
+    stamp.ctime_sec = static_cast<int64_t>(sb.st_ctime);
+#ifdef __linux__
+    stamp.mtime_nsec = static_cast<int64_t>(sb.st_mtim.tv_nsec);
+    stamp.ctime_nsec = static_cast<int64_t>(sb.st_ctim.tv_nsec);
+#endif
+
+    return stamp;
+}
+
+std::optional<Format> ProbeCache::lookup(const std::string &path,
+                                         const Stamp &stamp) const
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+
+    if (auto it = m_entries.find(path);
+            it != m_entries.end() && it->second.stamp == stamp) {
+        return it->second.format;
+    }
+
+    return std::nullopt;
+}
+
+void ProbeCache::insert(const std::string &path, const Stamp &stamp,
+                        Format format)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_entries.insert_or_assign(path, CachedFormat{stamp, format});
+}
+
+}
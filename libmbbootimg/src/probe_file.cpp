@@ -0,0 +1,203 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbbootimg/probe_file_p.h"
+
+#include <algorithm>
+
+#include <cstdio>
+#include <cstring>
+
+#include "mbcommon/file_error.h"
+#include "mbcommon/file_util.h"
+
+/*!
+ * \file mbbootimg/probe_file_p.h
+ * \brief Shared probe buffer for format autodetection
+ */
+
+namespace mb::bootimg::detail
+{
+
+/*!
+ * \class ProbeFile
+ *
+ * \brief Read-only File handle that caches the beginning of another file
+ *
+ * Every format reader inspects the first few KiB of the boot image during
+ * autodetection. This class reads that region from the underlying file once so
+ * that the bidders can share it. Reads past the cached region are passed
+ * through to the underlying file.
+ *
+ * The underlying file is not owned and its file position is left unspecified.
+ */
+
+ProbeFile::ProbeFile()
+    : File()
+    , m_file()
+    , m_buf()
+    , m_buf_is_file()
+    , m_pos()
+    , m_file_pos()
+{
+}
+
+ProbeFile::~ProbeFile()
+{
+    (void) close();
+}
+
+/*!
+ * \brief Read the beginning of a file into the probe buffer.
+ *
+ * \param file Underlying file. Reads begin at offset 0 regardless of the
+ *             current file position.
+ * \param probe_size Maximum number of bytes to cache
+ *
+ * \return Nothing if the probe buffer is successfully filled. Otherwise, the
+ *         error code.
+ */
+oc::result<void> ProbeFile::open(File *file, size_t probe_size)
+{
+    if (is_open()) return FileError::InvalidState;
+
+    OUTCOME_TRYV(file->seek(0, SEEK_SET));
+
+    m_buf.resize(probe_size);
+
+    OUTCOME_TRY(n, file_read_retry(*file, m_buf.data(), m_buf.size()));
+
+    m_buf.resize(n);
+    m_buf_is_file = n < probe_size;
+    m_file = file;
+    m_pos = 0;
+    m_file_pos = n;
+
+    return oc::success();
+}
+
+oc::result<void> ProbeFile::close()
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    m_file = nullptr;
+    m_buf.clear();
+    m_buf.shrink_to_fit();
+    m_buf_is_file = false;
+    m_pos = 0;
+    m_file_pos = std::nullopt;
+
+    return oc::success();
+}
+
+oc::result<size_t> ProbeFile::read(void *buf, size_t size)
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    if (m_pos < m_buf.size()) {
+        auto n = std::min(size, m_buf.size() - static_cast<size_t>(m_pos));
+        memcpy(buf, m_buf.data() + m_pos, n);
+        m_pos += n;
+        return n;
+    } else if (m_buf_is_file) {
+        return 0;
+    }
+
+    if (m_file_pos != m_pos) {
+        m_file_pos = std::nullopt;
+        OUTCOME_TRY(pos, m_file->seek(static_cast<int64_t>(m_pos), SEEK_SET));
+        m_file_pos = pos;
+    }
+
+    auto n = m_file->read(buf, size);
+    if (!n) {
+        m_file_pos = std::nullopt;
+        return n.as_failure();
+    }
+
+    m_pos += n.value();
+    m_file_pos = m_pos;
+
+    return n;
+}
+
+oc::result<size_t> ProbeFile::write(const void *buf, size_t size)
+{
+    (void) buf;
+    (void) size;
+
+    if (!is_open()) return FileError::InvalidState;
+
+    return FileError::UnsupportedWrite;
+}
+
+oc::result<uint64_t> ProbeFile::seek(int64_t offset, int whence)
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    uint64_t base;
+
+    switch (whence) {
+    case SEEK_SET:
+        base = 0;
+        break;
+    case SEEK_CUR:
+        base = m_pos;
+        break;
+    case SEEK_END:
+        if (!m_buf_is_file) {
+            m_file_pos = std::nullopt;
+            OUTCOME_TRY(pos, m_file->seek(offset, SEEK_END));
+            m_file_pos = pos;
+            return m_pos = pos;
+        }
+        base = m_buf.size();
+        break;
+    default:
+        MB_UNREACHABLE("Invalid whence argument: %d", whence);
+    }
+
+    if (offset < 0) {
+        if (static_cast<uint64_t>(-offset) > base) {
+            return FileError::ArgumentOutOfRange;
+        }
+        return m_pos = base - static_cast<uint64_t>(-offset);
+    } else {
+        if (static_cast<uint64_t>(offset) > INT64_MAX - base) {
+            return FileError::ArgumentOutOfRange;
+        }
+        return m_pos = base + static_cast<uint64_t>(offset);
+    }
+}
+
+oc::result<void> ProbeFile::truncate(uint64_t size)
+{
+    (void) size;
+
+    if (!is_open()) return FileError::InvalidState;
+
+    return FileError::UnsupportedTruncate;
+}
+
+bool ProbeFile::is_open()
+{
+    return m_file;
+}
+
+}
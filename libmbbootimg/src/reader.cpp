@@ -19,6 +19,8 @@
 
 #include "mbbootimg/reader.h"
 
+#include <algorithm>
+
 #include <cassert>
 #include <cerrno>
 #include <cinttypes>
@@ -36,6 +38,7 @@
 #include "mbbootimg/format/mtk_reader_p.h"
 #include "mbbootimg/format/sony_elf_reader_p.h"
 #include "mbbootimg/header.h"
+#include "mbbootimg/probe_file_p.h"
 
 #define ENSURE_STATE_OR_RETURN(STATES, RETVAL) \
     do { \
@@ -85,6 +88,10 @@
  * file position is set to the beginning of the file before this function is
  * called and also after.
  *
+ * \note \p file may be a read-only handle that serves the beginning of the
+ *       boot image from a buffer shared by all bidders. It is only valid for
+ *       the duration of this call and must not be written to.
+ *
  * If this function returns an error code or if the bid is lost, close() will be
  * called in Reader::open() to clean up any state. Otherwise, close() will be
  * called in Reader::close() when the user closes the Reader.
@@ -160,6 +167,23 @@
  *   * Return a specific error code if an error occurs
  */
 
+/*!
+ * \fn FormatReader::list_entries
+ *
+ * \brief Format reader callback to list all entries
+ *
+ * This is called after read_header() and must not change the current entry or
+ * the position within its data.
+ *
+ * \param file Reference to file handle
+ *
+ * \return
+ *   * Return the entries in the order they would be returned by read_entry()
+ *   * Return ReaderError::UnsupportedGoTo if the entries cannot be listed
+ *     without reading them sequentially
+ *   * Return a specific error code if an error occurs
+ */
+
 /*!
  * \fn FormatReader::read_data
  *
@@ -176,6 +200,24 @@
  *   * Return a specific error code if an error occurs
  */
 
+/*!
+ * \fn FormatReader::read_data_view
+ *
+ * \brief Format reader callback to read entry data in place
+ *
+ * This should only be implemented for formats that store entry data
+ * uncompressed in the file. The remaining data of the current entry is
+ * returned directly from File::mapped_data() and is marked as read.
+ *
+ * \param file Reference to file handle
+ *
+ * \return
+ *   * Return a view of the remaining entry data
+ *   * Return ReaderError::UnsupportedDataView if the file is not memory-backed
+ *     or the format does not support views
+ *   * Return a specific error code if an error occurs
+ */
+
 ///
 
 namespace mb::bootimg
@@ -208,6 +250,18 @@ oc::result<Entry> FormatReader::go_to_entry(File &file,
     return ReaderError::UnsupportedGoTo;
 }
 
+oc::result<std::vector<Entry>> FormatReader::list_entries(File &file)
+{
+    (void) file;
+    return ReaderError::UnsupportedGoTo;
+}
+
+oc::result<ConstIoVec> FormatReader::read_data_view(File &file)
+{
+    (void) file;
+    return ReaderError::UnsupportedDataView;
+}
+
 /*!
  * \brief Construct new Reader.
  */
@@ -216,6 +270,8 @@ Reader::Reader() noexcept
     , m_owned_file()
     , m_file()
     , m_format()
+    , m_probe_size(DEFAULT_PROBE_SIZE)
+    , m_probe_cache()
 {
 }
 
@@ -239,6 +295,8 @@ Reader::Reader(Reader &&other) noexcept
     std::swap(m_file, other.m_file);
     std::swap(m_formats, other.m_formats);
     std::swap(m_format, other.m_format);
+    std::swap(m_probe_size, other.m_probe_size);
+    std::swap(m_probe_cache, other.m_probe_cache);
 }
 
 Reader & Reader::operator=(Reader &&rhs) noexcept
@@ -254,6 +312,8 @@ Reader & Reader::operator=(Reader &&rhs) noexcept
         std::swap(m_file, rhs.m_file);
         std::swap(m_formats, rhs.m_formats);
         std::swap(m_format, rhs.m_format);
+        std::swap(m_probe_size, rhs.m_probe_size);
+        std::swap(m_probe_cache, rhs.m_probe_cache);
     }
 
     return *this;
@@ -262,6 +322,9 @@ Reader & Reader::operator=(Reader &&rhs) noexcept
 /*!
  * \brief Open boot image from filename (MBS).
  *
+ * If a probe cache was set with set_probe_cache(), it is used to skip format
+ * autodetection for files that have been opened before.
+ *
  * \param filename MBS filename
  *
  * \return Nothing if the boot image is successfully opened. Otherwise, a
@@ -274,6 +337,10 @@ oc::result<void> Reader::open_filename(const std::string &filename)
     auto file = std::make_unique<StandardFile>();
     OUTCOME_TRYV(file->open(filename, FileOpenMode::ReadOnly));
 
+    if (m_probe_cache) {
+        return open_cached(std::move(file), filename);
+    }
+
     return open(std::move(file));
 }
 
@@ -339,28 +406,37 @@ oc::result<void> Reader::open(File *file)
     int best_bid = 0;
     FormatReader *format = nullptr;
 
+    // Read the beginning of the file once and share it between all bidders
+    ProbeFile probe_file;
+    File *bid_file = file;
+
+    if (m_probe_size > 0) {
+        OUTCOME_TRYV(probe_file.open(file, m_probe_size));
+        bid_file = &probe_file;
+    }
+
     auto close_format = finally([&] {
         if (format) {
-            (void) format->close(*file);
+            (void) format->close(*bid_file);
         }
     });
 
     // Perform bid for autodetection
     for (auto &f : m_formats) {
         // Seek to beginning
-        OUTCOME_TRYV(file->seek(0, SEEK_SET));
+        OUTCOME_TRYV(bid_file->seek(0, SEEK_SET));
 
         auto close_f = finally([&] {
-            (void) f->close(*file);
+            (void) f->close(*bid_file);
         });
 
         // Call bidder
-        OUTCOME_TRY(bid, f->open(*file, best_bid));
+        OUTCOME_TRY(bid, f->open(*bid_file, best_bid));
 
         if (bid > best_bid) {
             // Close previous best format
             if (format) {
-                (void) format->close(*file);
+                (void) format->close(*bid_file);
             }
 
             // Don't close this format
@@ -386,6 +462,53 @@ oc::result<void> Reader::open(File *file)
     return oc::success();
 }
 
+oc::result<void> Reader::open_cached(std::unique_ptr<File> file,
+                                     const std::string &filename)
+{
+    if (m_formats.empty()) {
+        return ReaderError::NoFormatsRegistered;
+    }
+
+    // Stamp the file before probing so that a concurrent modification is
+    // never cached with the old format
+    auto stamp = ProbeCache::stamp_file(filename);
+
+    if (auto cached = stamp ? m_probe_cache->lookup(filename, *stamp)
+                            : std::nullopt) {
+        auto it = std::find_if(m_formats.begin(), m_formats.end(),
+                               [&](auto const &f) {
+            return f->type() == *cached;
+        });
+
+        if (it != m_formats.end()) {
+            auto format = it->get();
+
+            // Only the cached format needs to find its header again. If it no
+            // longer can, fall back to full autodetection.
+            OUTCOME_TRYV(file->seek(0, SEEK_SET));
+
+            if (auto bid = format->open(*file, 0); bid && bid.value() > 0) {
+                m_format = format;
+                m_state = ReaderState::Header;
+                m_file = file.get();
+                m_owned_file = std::move(file);
+                return oc::success();
+            }
+
+            (void) format->close(*file);
+        }
+    }
+
+    OUTCOME_TRYV(open(file.get()));
+    m_owned_file = std::move(file);
+
+    if (stamp) {
+        m_probe_cache->insert(filename, *stamp, m_format->type());
+    }
+
+    return oc::success();
+}
+
 /*!
  * \brief Close a Reader.
  *
@@ -481,6 +604,25 @@ oc::result<Entry> Reader::go_to_entry(std::optional<EntryType> entry_type)
     return std::move(entry);
 }
 
+/*!
+ * \brief List all boot image entries.
+ *
+ * The entries are determined when the header is read, so this does not read
+ * any entry data or change the current entry. Any of the listed entries can be
+ * passed to go_to_entry() in any order.
+ *
+ * \return The type and size of each entry in the boot image in the order they
+ *         would be returned by read_entry(). If the format does not support
+ *         listing entries, ReaderError::UnsupportedGoTo is returned. If any
+ *         other error occurs, a specific error code will be returned.
+ */
+oc::result<std::vector<Entry>> Reader::list_entries()
+{
+    ENSURE_STATE_OR_RETURN_ERROR(ReaderState::Entry | ReaderState::Data);
+
+    return m_format->list_entries(*m_file);
+}
+
 /*!
  * \brief Read current boot image entry data.
  *
@@ -499,6 +641,28 @@ oc::result<size_t> Reader::read_data(void *buf, size_t size)
     return m_format->read_data(*m_file, buf, size);
 }
 
+/*!
+ * \brief Read the remaining current boot image entry data in place.
+ *
+ * If the boot image was opened from a memory-backed File handle, such as
+ * MmapFile, this returns a pointer to the remaining data of the current entry
+ * within the mapping instead of copying it. The data is considered read, so a
+ * subsequent call to read_data() will return 0. The view is valid until the
+ * underlying file is closed or modified.
+ *
+ * If ReaderError::UnsupportedDataView is returned, nothing is consumed and the
+ * data can still be read with read_data().
+ *
+ * \return View of the remaining entry data. If an error occurs, a specific
+ *         error code will be returned.
+ */
+oc::result<ConstIoVec> Reader::read_data_view()
+{
+    ENSURE_STATE_OR_RETURN_ERROR(ReaderState::Data);
+
+    return m_format->read_data_view(*m_file);
+}
+
 /*!
  * \brief Get detected boot image format code.
  *
@@ -585,6 +749,47 @@ oc::result<void> Reader::enable_formats_all()
     return enable_formats(ALL_FORMATS);
 }
 
+/*!
+ * \brief Set size of the buffer used for format autodetection.
+ *
+ * When opening a boot image, this many bytes are read from the beginning of the
+ * file once and shared by all of the enabled format readers while they check
+ * whether they can parse the file. Reads past the buffer still go to the file.
+ *
+ * \param size Number of bytes to buffer (0 to disable). The default is
+ *             \ref DEFAULT_PROBE_SIZE.
+ *
+ * \return Nothing if the size is successfully set. Otherwise, the error code.
+ */
+oc::result<void> Reader::set_probe_size(size_t size)
+{
+    ENSURE_STATE_OR_RETURN_ERROR(ReaderState::New);
+
+    m_probe_size = size;
+
+    return oc::success();
+}
+
+/*!
+ * \brief Set cache of detected formats.
+ *
+ * The cache is only used by open_filename(). Boot images opened from a File
+ * handle are always autodetected.
+ *
+ * \param cache Cache to use (nullptr to disable). The cache is not owned and
+ *              must outlive the reader.
+ *
+ * \return Nothing if the cache is successfully set. Otherwise, the error code.
+ */
+oc::result<void> Reader::set_probe_cache(ProbeCache *cache)
+{
+    ENSURE_STATE_OR_RETURN_ERROR(ReaderState::New);
+
+    m_probe_cache = cache;
+
+    return oc::success();
+}
+
 /*!
  * \brief Check whether reader is opened
  *
@@ -25,8 +25,11 @@
 #include <cstdlib>
 #include <cstring>
 
+#include <vector>
+
 #include "mbcommon/file.h"
 #include "mbcommon/file/standard.h"
+#include "mbcommon/file_util.h"
 #include "mbcommon/finally.h"
 
 #include "mbbootimg/entry.h"
@@ -35,6 +38,7 @@
 #include "mbbootimg/format/mtk_writer_p.h"
 #include "mbbootimg/format/sony_elf_writer_p.h"
 #include "mbbootimg/header.h"
+#include "mbbootimg/reader.h"
 
 #define ENSURE_STATE_OR_RETURN(STATES, RETVAL) \
     do { \
@@ -505,6 +509,54 @@ oc::result<size_t> Writer::write_data(const void *buf, size_t size)
     return m_format->write_data(*m_file, buf, size);
 }
 
+/*!
+ * \brief Copy entry data from another boot image.
+ *
+ * This seeks \p reader to the entry of type \p type and writes all of its data
+ * as the data of the current entry. It is equivalent to calling write_data()
+ * with the result of Reader::read_data() until EOF, but if \p reader was
+ * opened from a memory-backed File handle (eg. MmapFile), the data is written
+ * directly from the mapping in a single call without an intermediate buffer.
+ * Checksums maintained by the output format, such as the Android SHA1 ID, are
+ * updated as usual.
+ *
+ * \param reader Reader that has already read the boot image header
+ * \param type Type of entry to copy from \p reader
+ *
+ * \return Number of bytes copied. If \p reader does not have an entry of type
+ *         \p type, ReaderError::EndOfEntries is returned and no data is
+ *         written. If any other error occurs, a specific error code will be
+ *         returned.
+ */
+oc::result<uint64_t> Writer::copy_entry_from(Reader &reader, EntryType type)
+{
+    ENSURE_STATE_OR_RETURN_ERROR(WriterState::Data);
+
+    OUTCOME_TRYV(reader.go_to_entry(type));
+
+    if (auto view = reader.read_data_view()) {
+        OUTCOME_TRYV(write_data(view.value().data, view.value().size));
+        return view.value().size;
+    } else if (view.error() != ReaderError::UnsupportedDataView) {
+        return view.as_failure();
+    }
+
+    std::vector<unsigned char> buf(mb::detail::COPY_BUFFER_SIZE);
+    uint64_t total = 0;
+
+    while (true) {
+        OUTCOME_TRY(n, reader.read_data(buf.data(), buf.size()));
+        if (n == 0) {
+            break;
+        }
+
+        OUTCOME_TRYV(write_data(buf.data(), n));
+        total += n;
+    }
+
+    return total;
+}
+
 /*!
  * \brief Get selected boot image format code.
  *
@@ -19,7 +19,11 @@
 
 #include <gtest/gtest.h>
 
+#include <algorithm>
 #include <memory>
+#include <vector>
+
+#include <cstring>
 
 #include "mbcommon/file/memory.h"
 
@@ -155,3 +159,66 @@ TEST_F(AndroidWriterSHA1Test, HandlesKernelRamdiskSecondbootDT)
     TestChecksum(expected, EntryType::Kernel | EntryType::Ramdisk
             | EntryType::SecondBoot | EntryType::DeviceTree);
 }
+
+static void WriteImageInChunks(const std::vector<unsigned char> &data,
+                               size_t chunk_size, unsigned char id_out[20])
+{
+    void *buf = nullptr;
+    size_t buf_size = 0;
+    MemoryFile file(&buf, &buf_size);
+    ASSERT_TRUE(file.is_open());
+
+    Writer writer;
+    ASSERT_TRUE(writer.set_format(Format::Android));
+    ASSERT_TRUE(writer.open(&file));
+
+    auto header = writer.get_header();
+    ASSERT_TRUE(header);
+    ASSERT_TRUE(header.value().set_page_size(2048));
+    ASSERT_TRUE(writer.write_header(header.value()));
+
+    while (true) {
+        auto entry = writer.get_entry();
+        if (!entry) {
+            ASSERT_EQ(entry.error(), WriterError::EndOfEntries);
+            break;
+        }
+
+        ASSERT_TRUE(writer.write_entry(entry.value()));
+
+        if (entry.value().type() == EntryType::Kernel
+                || entry.value().type() == EntryType::Ramdisk) {
+            for (size_t i = 0; i < data.size(); i += chunk_size) {
+                auto n = std::min(chunk_size, data.size() - i);
+                ASSERT_EQ(writer.write_data(data.data() + i, n),
+                          oc::success(n));
+            }
+        }
+    }
+
+    ASSERT_TRUE(writer.close());
+
+    memcpy(id_out, static_cast<unsigned char *>(buf) + 576, 20);
+    free(buf);
+}
+
+TEST(AndroidWriterSHA1BatchTest, ChunkSizeDoesNotAffectChecksum)
+{
+    // Larger than the internal batch size so that both the buffered and the
+    // direct paths are used
+    std::vector<unsigned char> data(300 * 1024 + 7);
+    for (size_t i = 0; i < data.size(); ++i) {
+        data[i] = static_cast<unsigned char>(i * 31);
+    }
+
+    unsigned char expected[20];
+    ASSERT_NO_FATAL_FAILURE(WriteImageInChunks(data, data.size(), expected));
+
+    for (size_t chunk_size : {size_t(1), size_t(100), size_t(4096),
+            size_t(64 * 1024), size_t(100 * 1024)}) {
+        unsigned char id[20];
+        ASSERT_NO_FATAL_FAILURE(WriteImageInChunks(data, chunk_size, id));
+        ASSERT_EQ(memcmp(id, expected, sizeof(id)), 0)
+                << "Chunk size: " << chunk_size;
+    }
+}
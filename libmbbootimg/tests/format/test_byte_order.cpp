@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <cstring>
+
+#include "mbbootimg/format/android_p.h"
+#include "mbbootimg/format/sony_elf_p.h"
+
+using namespace mb::bootimg;
+
+TEST(ByteOrderTest, AndroidHeaderFromLittleEndian)
+{
+    static const unsigned char data[] = {
+        'A', 'N', 'D', 'R', 'O', 'I', 'D', '!',
+        0x00, 0x10, 0x00, 0x00, // kernel_size
+        0x00, 0x80, 0x00, 0x10, // kernel_addr
+    };
+
+    android::AndroidHeader header = {};
+    memcpy(&header, data, sizeof(data));
+
+    android::android_fix_header_byte_order(header);
+
+    ASSERT_EQ(header.kernel_size, 0x1000u);
+    ASSERT_EQ(header.kernel_addr, 0x10008000u);
+}
+
+TEST(ByteOrderTest, SonyElfRoundTrip)
+{
+    sonyelf::Sony_Elf32_Ehdr header = {};
+    header.e_type = 0x0102;
+    header.e_version = 0x01020304;
+    header.e_shstrndx = 0x0506;
+
+    sonyelf::SonyElfEhdrFields::from_host(header);
+
+    unsigned char raw[sizeof(header)];
+    memcpy(raw, &header, sizeof(header));
+    ASSERT_EQ(raw[offsetof(sonyelf::Sony_Elf32_Ehdr, e_type)], 0x02);
+    ASSERT_EQ(raw[offsetof(sonyelf::Sony_Elf32_Ehdr, e_version)], 0x04);
+
+    sonyelf::SonyElfEhdrFields::to_host(header);
+
+    ASSERT_EQ(header.e_type, 0x0102);
+    ASSERT_EQ(header.e_version, 0x01020304u);
+    ASSERT_EQ(header.e_shstrndx, 0x0506);
+}
@@ -20,9 +20,13 @@
 #include <gtest/gtest.h>
 
 #include <memory>
+#include <vector>
+
+#include <cstring>
 
 #include "mbcommon/file.h"
 #include "mbcommon/file/memory.h"
+#include "mbcommon/file/stats.h"
 #include "mbcommon/file_error.h"
 
 #include "mbbootimg/format/loki_error.h"
@@ -269,6 +273,40 @@ TEST(LokiOldFindGzipOffsetTest, MissingFlagsShouldFail)
     ASSERT_EQ(ret.error(), LokiError::NoRamdiskGzipHeaderFound);
 }
 
+TEST(LokiOldFindGzipOffsetTest, HeaderAcrossReadWindowsShouldSucceed)
+{
+    // Larger than the scan window so the unmapped path has to read several
+    // times. Each header straddles a 256 KiB boundary.
+    std::vector<unsigned char> data(1024 * 1024);
+    memcpy(data.data() + 256 * 1024 - 2, "\x1f\x8b\x08\x00", 4);
+    memcpy(data.data() + 768 * 1024 - 3, "\x1f\x8b\x08\x08", 4);
+
+    MemoryFile file(data.data(), data.size());
+    ASSERT_TRUE(file.is_open());
+
+    // StatsFile does not expose the mapping of the MemoryFile
+    StatsFile stats_file(&file);
+    ASSERT_TRUE(stats_file.is_open());
+
+    for (File *f : {static_cast<File *>(&file),
+            static_cast<File *>(&stats_file)}) {
+        auto gzip_offset = LokiFormatReader::find_gzip_offset_old(*f, 0);
+        ASSERT_TRUE(gzip_offset);
+        ASSERT_EQ(gzip_offset.value(), 768u * 1024 - 3);
+
+        gzip_offset = LokiFormatReader::find_gzip_offset_old(*f, 300 * 1024);
+        ASSERT_TRUE(gzip_offset);
+        ASSERT_EQ(gzip_offset.value(), 768u * 1024 - 3);
+
+        // Only the header with a zero flags byte remains
+        data[768 * 1024] = 0x01;
+        gzip_offset = LokiFormatReader::find_gzip_offset_old(*f, 0);
+        ASSERT_TRUE(gzip_offset);
+        ASSERT_EQ(gzip_offset.value(), 256u * 1024 - 2);
+        data[768 * 1024] = 0x08;
+    }
+}
+
 // Tests for find_ramdisk_size_old()
 
 TEST(LokiOldFindRamdiskSizeTest, ValidSamsungImageShouldSucceed)
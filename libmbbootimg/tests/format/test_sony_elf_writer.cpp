@@ -18,3 +18,108 @@
  */
 
 #include <gtest/gtest.h>
+
+#include <string>
+
+#include <cstdlib>
+#include <cstring>
+
+#include "mbcommon/file/memory.h"
+
+#include "mbbootimg/entry.h"
+#include "mbbootimg/format/sony_elf_p.h"
+#include "mbbootimg/header.h"
+#include "mbbootimg/reader.h"
+#include "mbbootimg/writer.h"
+
+using namespace mb;
+using namespace mb::bootimg;
+using namespace mb::bootimg::sonyelf;
+
+TEST(SonyElfWriterTest, WriteHeadersForNonEmptySegmentsOnly)
+{
+    void *buf = nullptr;
+    size_t size = 0;
+
+    {
+        MemoryFile file(&buf, &size);
+        ASSERT_TRUE(file.is_open());
+
+        Writer writer;
+        ASSERT_TRUE(writer.set_format(Format::SonyElf));
+        ASSERT_TRUE(writer.open(&file));
+
+        auto header = writer.get_header();
+        ASSERT_TRUE(header);
+        ASSERT_TRUE(header.value().set_kernel_cmdline({"cmdline"}));
+        ASSERT_TRUE(header.value().set_kernel_address(0x80008000));
+        ASSERT_TRUE(writer.write_header(header.value()));
+
+        while (true) {
+            auto entry = writer.get_entry();
+            if (!entry) {
+                ASSERT_EQ(entry.error(), WriterError::EndOfEntries);
+                break;
+            }
+
+            ASSERT_TRUE(writer.write_entry(entry.value()));
+
+            // Leave the ramdisk and RPM segments empty
+            auto type = entry.value().type();
+            if (type == EntryType::Kernel) {
+                ASSERT_TRUE(writer.write_data("kernel", 6));
+            } else if (type == EntryType::SonyIpl) {
+                ASSERT_TRUE(writer.write_data("ipl", 3));
+            } else if (type == EntryType::SonyAppsbl) {
+                ASSERT_TRUE(writer.write_data("appsbl", 6));
+            }
+        }
+
+        ASSERT_TRUE(writer.close());
+    }
+
+    std::string data(static_cast<char *>(buf), size);
+    free(buf);
+
+    ASSERT_GE(data.size(), sizeof(Sony_Elf32_Ehdr) + 4 * sizeof(Sony_Elf32_Phdr));
+
+    Sony_Elf32_Ehdr ehdr;
+    memcpy(&ehdr, data.data(), sizeof(ehdr));
+    sony_elf_fix_ehdr_byte_order(ehdr);
+
+    ASSERT_EQ(memcmp(ehdr.e_ident, SONY_E_IDENT, SONY_EI_NIDENT), 0);
+    ASSERT_EQ(ehdr.e_phnum, 4);
+    ASSERT_EQ(ehdr.e_entry, 0x80008000u);
+
+    // Program headers are packed in segment order
+    Elf32_Word expected_flags[] = {
+        SONY_E_FLAGS_KERNEL,
+        SONY_E_FLAGS_CMDLINE,
+        SONY_E_FLAGS_IPL,
+        SONY_E_FLAGS_APPSBL,
+    };
+    const char *expected_data[] = { "kernel", "cmdline", "ipl", "appsbl" };
+
+    for (size_t i = 0; i < 4; ++i) {
+        Sony_Elf32_Phdr phdr;
+        memcpy(&phdr, data.data() + ehdr.e_phoff + i * sizeof(phdr),
+               sizeof(phdr));
+        sony_elf_fix_phdr_byte_order(phdr);
+
+        ASSERT_EQ(phdr.p_flags, expected_flags[i]);
+        ASSERT_EQ(data.substr(phdr.p_offset, phdr.p_filesz), expected_data[i]);
+    }
+
+    // The image can be read back
+    MemoryFile file(data.data(), data.size());
+    ASSERT_TRUE(file.is_open());
+
+    Reader reader;
+    ASSERT_TRUE(reader.enable_formats_all());
+    ASSERT_TRUE(reader.open(&file));
+    ASSERT_EQ(reader.format(), Format::SonyElf);
+
+    auto header = reader.read_header();
+    ASSERT_TRUE(header);
+    ASSERT_EQ(header.value().kernel_cmdline(), "cmdline");
+}
@@ -0,0 +1,205 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+#include <cstdlib>
+
+#include "mbcommon/file/memory.h"
+
+#include "mbbootimg/delta.h"
+#include "mbbootimg/entry.h"
+#include "mbbootimg/header.h"
+#include "mbbootimg/reader.h"
+#include "mbbootimg/writer.h"
+
+using namespace mb;
+using namespace mb::bootimg;
+
+using Data = std::vector<unsigned char>;
+
+static Data make_image(const Data &kernel, const Data &ramdisk,
+                       const char *cmdline)
+{
+    void *buf = nullptr;
+    size_t buf_size = 0;
+
+    {
+        MemoryFile file(&buf, &buf_size);
+        Writer writer;
+
+        EXPECT_TRUE(writer.set_format(Format::Android));
+        EXPECT_TRUE(writer.open(&file));
+
+        auto header = writer.get_header();
+        EXPECT_TRUE(header);
+        EXPECT_TRUE(header.value().set_page_size(2048));
+        EXPECT_TRUE(header.value().set_kernel_cmdline({cmdline}));
+        EXPECT_TRUE(writer.write_header(header.value()));
+
+        while (true) {
+            auto entry = writer.get_entry();
+            if (!entry) {
+                EXPECT_EQ(entry.error(), WriterError::EndOfEntries);
+                break;
+            }
+
+            EXPECT_TRUE(writer.write_entry(entry.value()));
+
+            if (entry.value().type() == EntryType::Kernel) {
+                EXPECT_TRUE(writer.write_data(kernel.data(), kernel.size()));
+            } else if (entry.value().type() == EntryType::Ramdisk) {
+                EXPECT_TRUE(writer.write_data(ramdisk.data(), ramdisk.size()));
+            }
+        }
+
+        EXPECT_TRUE(writer.close());
+    }
+
+    auto ptr = static_cast<unsigned char *>(buf);
+    Data image(ptr, ptr + buf_size);
+    free(buf);
+
+    return image;
+}
+
+static Data random_data(size_t size, unsigned int seed)
+{
+    Data data(size);
+    for (auto &c : data) {
+        seed = seed * 1103515245u + 12345u;
+        c = static_cast<unsigned char>(seed >> 16);
+    }
+    return data;
+}
+
+struct DeltaTest : testing::Test
+{
+    Data _source;
+    Data _target;
+
+    void SetUp() override
+    {
+        auto kernel = random_data(512 * 1024, 1);
+        auto ramdisk = random_data(128 * 1024, 2);
+
+        _source = make_image(kernel, ramdisk, "console=ttyHSL0");
+
+        // Change a few bytes and insert data in the middle of the kernel
+        kernel[1000] ^= 0xff;
+        auto extra = random_data(3000, 3);
+        kernel.insert(kernel.begin() + 200000, extra.begin(), extra.end());
+
+        _target = make_image(kernel, ramdisk, "console=ttyHSL0 quiet");
+    }
+
+    void create_delta(Data &source, Data &target, Data &patch)
+    {
+        MemoryFile source_file(source.data(), source.size());
+        MemoryFile target_file(target.data(), target.size());
+        Reader source_reader;
+        Reader target_reader;
+
+        ASSERT_TRUE(source_reader.enable_formats_all());
+        ASSERT_TRUE(source_reader.open(&source_file));
+        ASSERT_TRUE(target_reader.enable_formats_all());
+        ASSERT_TRUE(target_reader.open(&target_file));
+
+        void *buf = nullptr;
+        size_t buf_size = 0;
+        MemoryFile patch_file(&buf, &buf_size);
+
+        ASSERT_TRUE(delta_create(source_reader, target_reader, patch_file));
+        ASSERT_TRUE(patch_file.close());
+
+        auto ptr = static_cast<unsigned char *>(buf);
+        patch.assign(ptr, ptr + buf_size);
+        free(buf);
+    }
+
+    oc::result<void> apply_delta(Data &source, Data &patch,
+                                 Data &output)
+    {
+        MemoryFile source_file(source.data(), source.size());
+        MemoryFile patch_file(patch.data(), patch.size());
+        Reader source_reader;
+
+        OUTCOME_TRYV(source_reader.enable_formats_all());
+        OUTCOME_TRYV(source_reader.open(&source_file));
+
+        void *buf = nullptr;
+        size_t buf_size = 0;
+        MemoryFile output_file(&buf, &buf_size);
+
+        auto ret = delta_apply(source_reader, patch_file, output_file);
+        (void) output_file.close();
+
+        auto ptr = static_cast<unsigned char *>(buf);
+        output.assign(ptr, ptr + buf_size);
+        free(buf);
+
+        return ret;
+    }
+};
+
+TEST_F(DeltaTest, RoundTrip)
+{
+    Data patch;
+    ASSERT_NO_FATAL_FAILURE(create_delta(_source, _target, patch));
+
+    // Only the changed regions are stored
+    ASSERT_LT(patch.size(), _target.size() / 10);
+
+    Data output;
+    ASSERT_TRUE(apply_delta(_source, patch, output));
+    ASSERT_EQ(output, _target);
+}
+
+TEST_F(DeltaTest, IdenticalImages)
+{
+    Data patch;
+    ASSERT_NO_FATAL_FAILURE(create_delta(_source, _source, patch));
+    ASSERT_LT(patch.size(), 512u);
+
+    Data output;
+    ASSERT_TRUE(apply_delta(_source, patch, output));
+    ASSERT_EQ(output, _source);
+}
+
+TEST_F(DeltaTest, WrongSourceShouldFail)
+{
+    Data patch;
+    ASSERT_NO_FATAL_FAILURE(create_delta(_source, _target, patch));
+
+    Data output;
+    ASSERT_EQ(apply_delta(_target, patch, output),
+              oc::failure(DeltaError::SourceEntryMismatch));
+}
+
+TEST_F(DeltaTest, InvalidMagicShouldFail)
+{
+    Data patch(64);
+
+    Data output;
+    ASSERT_EQ(apply_delta(_source, patch, output),
+              oc::failure(DeltaError::InvalidMagic));
+}
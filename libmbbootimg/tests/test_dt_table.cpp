@@ -0,0 +1,187 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+#include "mbbootimg/dt_table.h"
+
+using namespace mb;
+using namespace mb::bootimg;
+
+// Minimal flattened device tree header followed by some payload
+static std::string make_dtb(char fill, uint32_t size)
+{
+    std::string data(size, fill);
+    data[0] = '\xd0';
+    data[1] = '\x0d';
+    data[2] = '\xfe';
+    data[3] = '\xed';
+    data[4] = static_cast<char>(size >> 24);
+    data[5] = static_cast<char>(size >> 16);
+    data[6] = static_cast<char>(size >> 8);
+    data[7] = static_cast<char>(size);
+    return data;
+}
+
+static DtTableEntry make_entry(uint32_t platform, uint32_t variant,
+                               uint32_t revision)
+{
+    DtTableEntry entry;
+    entry.platform_id = platform;
+    entry.variant_id = variant;
+    entry.subtype_id = 7;
+    entry.revision = revision;
+    return entry;
+}
+
+struct DtTableTest : testing::TestWithParam<std::pair<DtTableFormat, uint32_t>>
+{
+};
+
+TEST_P(DtTableTest, BuildAndParseRoundTrip)
+{
+    auto [format, version] = GetParam();
+    bool is_dtbo = format == DtTableFormat::Dtbo;
+
+    auto dtb_a = make_dtb('a', 3000);
+    auto dtb_b = make_dtb('b', 1000);
+
+    std::vector<DtTableBlob> blobs{
+        {make_entry(10, is_dtbo ? 0 : 1, 0x10000), dtb_a},
+        {make_entry(10, is_dtbo ? 0 : 2, 0x10000), dtb_b},
+        {make_entry(11, is_dtbo ? 0 : 1, 0x20000), dtb_a},
+    };
+
+    auto data = dt_table_build(format, version, 2048, blobs);
+    ASSERT_TRUE(data) << data.error().message();
+
+    auto table = DtTable::parse(data.value());
+    ASSERT_TRUE(table) << table.error().message();
+
+    ASSERT_EQ(table.value().format(), format);
+    ASSERT_EQ(table.value().version(), version);
+    ASSERT_EQ(table.value().page_size(), is_dtbo ? 2048u : 0u);
+    ASSERT_EQ(table.value().entries().size(), 3u);
+
+    auto &entries = table.value().entries();
+
+    // Identical DTBs are stored once
+    ASSERT_EQ(entries[0].offset, entries[2].offset);
+    ASSERT_NE(entries[0].offset, entries[1].offset);
+
+    for (size_t i = 0; i < blobs.size(); ++i) {
+        ASSERT_EQ(table.value().blob(entries[i]), blobs[i].second);
+    }
+
+    auto entry = table.value().find(11, is_dtbo ? 0 : 1, 0x20000);
+    ASSERT_TRUE(entry);
+    ASSERT_EQ(entry, &entries[2]);
+    if (!is_dtbo && version >= 2) {
+        ASSERT_EQ(entry->subtype_id, 7u);
+    }
+
+    // Zero-copy slice of the input
+    auto blob = table.value().blob(*entry);
+    ASSERT_GE(blob.data(), data.value().data());
+    ASSERT_LE(blob.data() + blob.size(),
+              data.value().data() + data.value().size());
+
+    ASSERT_FALSE(table.value().find(12, 0, 0));
+}
+
+INSTANTIATE_TEST_CASE_P(
+    AllFormats,
+    DtTableTest,
+    testing::Values(
+        std::make_pair(DtTableFormat::Qcdt, 1u),
+        std::make_pair(DtTableFormat::Qcdt, 2u),
+        std::make_pair(DtTableFormat::Qcdt, 3u),
+        std::make_pair(DtTableFormat::Dtbo, 0u)
+    )
+);
+
+TEST(DtTableQcdtTest, DeduplicationShrinksTable)
+{
+    auto dtb = make_dtb('x', 10000);
+
+    std::vector<DtTableBlob> blobs;
+    for (uint32_t i = 0; i < 8; ++i) {
+        blobs.emplace_back(make_entry(1, i, 0), dtb);
+    }
+
+    auto data = dt_table_build(DtTableFormat::Qcdt, 2, 4096, blobs);
+    ASSERT_TRUE(data);
+
+    // One page of table and three pages of DTB
+    ASSERT_EQ(data.value().size(), 4u * 4096u);
+}
+
+TEST(DtTableQcdtTest, FindReturnsFirstMatch)
+{
+    auto dtb_a = make_dtb('a', 100);
+    auto dtb_b = make_dtb('b', 100);
+
+    auto data = dt_table_build(DtTableFormat::Qcdt, 1, 2048, {
+        {make_entry(1, 1, 0), dtb_a},
+        {make_entry(1, 1, 0), dtb_b},
+    });
+    ASSERT_TRUE(data);
+
+    auto table = DtTable::parse(data.value());
+    ASSERT_TRUE(table);
+
+    auto entry = table.value().find(1, 1, 0);
+    ASSERT_TRUE(entry);
+    ASSERT_EQ(table.value().blob(*entry), dtb_a);
+}
+
+TEST(DtTableQcdtTest, RejectInvalidTables)
+{
+    ASSERT_EQ(DtTable::parse("ABCD"),
+              oc::failure(DtTableError::InvalidMagic));
+    ASSERT_EQ(DtTable::parse({"QCDT\x01\x00", 6}),
+              oc::failure(DtTableError::TableTruncated));
+    ASSERT_EQ(DtTable::parse({"QCDT\x04\x00\x00\x00\x00\x00\x00\x00", 12}),
+              oc::failure(DtTableError::UnsupportedVersion));
+    // Claims one entry, but has no room for it
+    ASSERT_EQ(DtTable::parse({"QCDT\x01\x00\x00\x00\x01\x00\x00\x00", 12}),
+              oc::failure(DtTableError::TableTruncated));
+
+    auto dtb = make_dtb('a', 100);
+    auto data = dt_table_build(DtTableFormat::Qcdt, 1, 2048,
+                               {{make_entry(1, 1, 0), dtb}});
+    ASSERT_TRUE(data);
+
+    // Cut off the DTB
+    ASSERT_EQ(DtTable::parse(std::string_view(data.value()).substr(0, 2100)),
+              oc::failure(DtTableError::EntryOutOfRange));
+}
+
+TEST(DtTableQcdtTest, RejectInvalidBuildParameters)
+{
+    ASSERT_EQ(dt_table_build(DtTableFormat::Qcdt, 1, 1000, {}),
+              oc::failure(DtTableError::InvalidPageSize));
+    ASSERT_EQ(dt_table_build(DtTableFormat::Qcdt, 4, 2048, {}),
+              oc::failure(DtTableError::UnsupportedVersion));
+    ASSERT_EQ(dt_table_build(DtTableFormat::Dtbo, 2, 2048, {}),
+              oc::failure(DtTableError::UnsupportedVersion));
+}
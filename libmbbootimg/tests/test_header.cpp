@@ -20,6 +20,7 @@
 #include <gtest/gtest.h>
 
 #include <memory>
+#include <string>
 
 #include "mbbootimg/header.h"
 
@@ -45,6 +46,32 @@ TEST(BootImgHeaderTest, CheckDefaultValues)
     ASSERT_FALSE(header.entrypoint_address());
 }
 
+TEST(BootImgHeaderTest, CheckLongStrings)
+{
+    // Longer than any on-disk field, so stored out of line
+    std::string long_name(100, 'n');
+    std::string long_cmdline(2000, 'c');
+
+    Header header;
+    ASSERT_TRUE(header.set_board_name(long_name));
+    ASSERT_TRUE(header.set_kernel_cmdline(long_cmdline));
+
+    Header header2(header);
+    ASSERT_EQ(header2.board_name(), long_name);
+    ASSERT_EQ(header2.kernel_cmdline(), long_cmdline);
+    ASSERT_EQ(header, header2);
+
+    // Switching back to an inline value must not return stale data
+    ASSERT_TRUE(header2.set_board_name({"short"}));
+    ASSERT_EQ(header2.board_name(), "short");
+    ASSERT_NE(header, header2);
+
+    // Empty values are distinct from unset values
+    ASSERT_TRUE(header2.set_kernel_cmdline({""}));
+    ASSERT_TRUE(header2.kernel_cmdline());
+    ASSERT_TRUE(header2.kernel_cmdline()->empty());
+}
+
 TEST(BootImgHeaderTest, CheckGettersSetters)
 {
     Header header;
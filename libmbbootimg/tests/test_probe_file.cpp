@@ -0,0 +1,130 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <numeric>
+#include <vector>
+
+#include <cstring>
+
+#include "mbcommon/file/memory.h"
+#include "mbcommon/file/stats.h"
+#include "mbcommon/file_error.h"
+#include "mbcommon/file_util.h"
+
+#include "mbbootimg/probe_file_p.h"
+
+using namespace mb;
+using namespace mb::bootimg::detail;
+
+struct ProbeFileTest : testing::Test
+{
+    std::vector<unsigned char> _data;
+    MemoryFile _file;
+    StatsFile _stats_file;
+
+    ProbeFileTest() : _data(1000)
+    {
+        std::iota(_data.begin(), _data.end(), 0);
+    }
+
+    void SetUp() override
+    {
+        ASSERT_TRUE(_file.open(_data.data(), _data.size()));
+        ASSERT_TRUE(_stats_file.open(&_file));
+    }
+};
+
+TEST_F(ProbeFileTest, CheckInvalidStates)
+{
+    ProbeFile file;
+
+    auto error = oc::failure(FileError::InvalidState);
+
+    ASSERT_EQ(file.close(), error);
+    ASSERT_EQ(file.read(nullptr, 0), error);
+    ASSERT_EQ(file.write(nullptr, 0), error);
+    ASSERT_EQ(file.seek(0, SEEK_SET), error);
+    ASSERT_EQ(file.truncate(0), error);
+
+    ASSERT_TRUE(file.open(&_stats_file, 100));
+    ASSERT_EQ(file.open(&_stats_file, 100), error);
+    ASSERT_EQ(file.write("x", 1), oc::failure(FileError::UnsupportedWrite));
+    ASSERT_EQ(file.truncate(0), oc::failure(FileError::UnsupportedTruncate));
+}
+
+TEST_F(ProbeFileTest, ReadsFromBufferAreNotPassedThrough)
+{
+    ProbeFile file;
+    ASSERT_TRUE(file.open(&_stats_file, 100));
+
+    auto reads = _stats_file.stats().read.count;
+
+    unsigned char buf[50];
+
+    for (int i = 0; i < 3; ++i) {
+        ASSERT_EQ(file.seek(10, SEEK_SET), oc::success(10u));
+        ASSERT_TRUE(file_read_exact(file, buf, sizeof(buf)));
+        ASSERT_EQ(memcmp(buf, _data.data() + 10, sizeof(buf)), 0);
+    }
+
+    ASSERT_EQ(_stats_file.stats().read.count, reads);
+}
+
+TEST_F(ProbeFileTest, ReadsPastBufferArePassedThrough)
+{
+    ProbeFile file;
+    ASSERT_TRUE(file.open(&_stats_file, 100));
+
+    unsigned char buf[100];
+
+    // Spanning the end of the buffer
+    ASSERT_EQ(file.seek(80, SEEK_SET), oc::success(80u));
+    ASSERT_TRUE(file_read_exact(file, buf, sizeof(buf)));
+    ASSERT_EQ(memcmp(buf, _data.data() + 80, sizeof(buf)), 0);
+
+    // Underlying file moved in the meantime
+    ASSERT_TRUE(_file.seek(0, SEEK_SET));
+    ASSERT_EQ(file.seek(-50, SEEK_END), oc::success(950u));
+    ASSERT_EQ(file_read_retry(file, buf, sizeof(buf)), oc::success(50u));
+    ASSERT_EQ(memcmp(buf, _data.data() + 950, 50), 0);
+    ASSERT_EQ(file.read(buf, sizeof(buf)), oc::success(0u));
+}
+
+TEST_F(ProbeFileTest, SmallFileIsFullyBuffered)
+{
+    ProbeFile file;
+    ASSERT_TRUE(file.open(&_stats_file, 4096));
+
+    auto stats = _stats_file.stats();
+
+    ASSERT_EQ(file.seek(0, SEEK_END), oc::success(_data.size()));
+    ASSERT_EQ(file.seek(-10, SEEK_CUR), oc::success(_data.size() - 10));
+
+    unsigned char buf[20];
+    ASSERT_EQ(file_read_retry(file, buf, sizeof(buf)), oc::success(10u));
+    ASSERT_EQ(memcmp(buf, _data.data() + _data.size() - 10, 10), 0);
+
+    ASSERT_EQ(file.seek(-1, SEEK_SET),
+              oc::failure(FileError::ArgumentOutOfRange));
+
+    ASSERT_EQ(_stats_file.stats().read.count, stats.read.count);
+    ASSERT_EQ(_stats_file.stats().seek.count, stats.seek.count);
+}
@@ -0,0 +1,302 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+#include <cstdio>
+#include <cstdlib>
+
+#include "mbcommon/file/memory.h"
+#include "mbcommon/file/stats.h"
+
+#include "mbbootimg/entry.h"
+#include "mbbootimg/header.h"
+#include "mbbootimg/probe_cache.h"
+#include "mbbootimg/reader.h"
+#include "mbbootimg/writer.h"
+
+using namespace mb;
+using namespace mb::bootimg;
+
+struct ReaderTest : testing::Test
+{
+    void *_buf = nullptr;
+    size_t _buf_size = 0;
+
+    ~ReaderTest()
+    {
+        free(_buf);
+    }
+
+    void SetUp() override
+    {
+        MemoryFile file(&_buf, &_buf_size);
+        ASSERT_TRUE(file.is_open());
+
+        Writer writer;
+        ASSERT_TRUE(writer.set_format(Format::Android));
+        ASSERT_TRUE(writer.open(&file));
+
+        auto header = writer.get_header();
+        ASSERT_TRUE(header);
+        ASSERT_TRUE(header.value().set_page_size(2048));
+        ASSERT_TRUE(writer.write_header(header.value()));
+
+        while (true) {
+            auto entry = writer.get_entry();
+            if (!entry) {
+                ASSERT_EQ(entry.error(), WriterError::EndOfEntries);
+                break;
+            }
+
+            ASSERT_TRUE(writer.write_entry(entry.value()));
+
+            if (entry.value().type() == EntryType::Kernel) {
+                ASSERT_TRUE(writer.write_data("kernel", 6));
+            } else if (entry.value().type() == EntryType::Ramdisk) {
+                ASSERT_TRUE(writer.write_data("ramdisk", 7));
+            }
+        }
+
+        ASSERT_TRUE(writer.close());
+    }
+
+    // Open the generated image with all formats enabled
+    void OpenImage(Reader &reader, StatsFile &stats_file, MemoryFile &file)
+    {
+        ASSERT_TRUE(file.open(_buf, _buf_size));
+        ASSERT_TRUE(stats_file.open(&file));
+        ASSERT_TRUE(reader.enable_formats_all());
+        ASSERT_TRUE(reader.open(&stats_file));
+        ASSERT_EQ(reader.format(), Format::Android);
+    }
+};
+
+TEST_F(ReaderTest, ProbeBufferIsSharedByBidders)
+{
+    // Every bidder has to look at an unrecognized file
+    std::vector<unsigned char> data(16384);
+    uint64_t reads[2];
+
+    for (size_t i = 0; i < 2; ++i) {
+        MemoryFile file(data.data(), data.size());
+        StatsFile stats_file(&file);
+        Reader reader;
+
+        ASSERT_TRUE(reader.enable_formats_all());
+        if (i == 1) {
+            ASSERT_TRUE(reader.set_probe_size(0));
+        }
+        ASSERT_EQ(reader.open(&stats_file),
+                  oc::failure(ReaderError::UnknownFileFormat));
+
+        reads[i] = stats_file.stats().read.count;
+    }
+
+    // The whole file fits in the probe buffer
+    ASSERT_LE(reads[0], 2u);
+    ASSERT_LT(reads[0], reads[1]);
+}
+
+TEST_F(ReaderTest, ProbeDoesNotChangeDetection)
+{
+    for (size_t probe_size : {size_t(0), size_t(512), Reader::DEFAULT_PROBE_SIZE}) {
+        MemoryFile file;
+        StatsFile stats_file;
+        Reader reader;
+
+        ASSERT_TRUE(reader.set_probe_size(probe_size));
+        OpenImage(reader, stats_file, file);
+    }
+}
+
+TEST_F(ReaderTest, EntriesReadableAfterProbing)
+{
+    MemoryFile file;
+    StatsFile stats_file;
+    Reader reader;
+
+    ASSERT_TRUE(reader.set_probe_size(512));
+    OpenImage(reader, stats_file, file);
+
+    auto header = reader.read_header();
+    ASSERT_TRUE(header);
+    ASSERT_EQ(header.value().page_size(), 2048u);
+
+    auto entry = reader.go_to_entry(EntryType::Ramdisk);
+    ASSERT_TRUE(entry);
+
+    char buf[16];
+    auto n = reader.read_data(buf, sizeof(buf));
+    ASSERT_TRUE(n);
+    ASSERT_EQ(std::string(buf, n.value()), "ramdisk");
+}
+
+TEST_F(ReaderTest, ProbeSizeCannotBeSetWhileOpen)
+{
+    MemoryFile file;
+    StatsFile stats_file;
+    Reader reader;
+
+    OpenImage(reader, stats_file, file);
+
+    ASSERT_EQ(reader.set_probe_size(0),
+              oc::failure(ReaderError::InvalidState));
+}
+
+TEST_F(ReaderTest, ListEntriesAndReadInAnyOrder)
+{
+    MemoryFile file;
+    StatsFile stats_file;
+    Reader reader;
+
+    OpenImage(reader, stats_file, file);
+
+    // Entries are only known after the header is read
+    ASSERT_EQ(reader.list_entries(), oc::failure(ReaderError::InvalidState));
+
+    ASSERT_TRUE(reader.read_header());
+
+    auto entries = reader.list_entries();
+    ASSERT_TRUE(entries);
+    ASSERT_EQ(entries.value().size(), 2u);
+    ASSERT_EQ(entries.value()[0].type(), EntryType::Kernel);
+    ASSERT_EQ(entries.value()[0].size(), 6u);
+    ASSERT_EQ(entries.value()[1].type(), EntryType::Ramdisk);
+    ASSERT_EQ(entries.value()[1].size(), 7u);
+
+    char buf[16];
+
+    for (auto type : {EntryType::Ramdisk, EntryType::Kernel,
+            EntryType::Ramdisk}) {
+        auto entry = reader.go_to_entry(type);
+        ASSERT_TRUE(entry);
+        ASSERT_EQ(entry.value().type(), type);
+
+        // Listing does not change the current entry
+        ASSERT_TRUE(reader.list_entries());
+
+        auto n = reader.read_data(buf, sizeof(buf));
+        ASSERT_TRUE(n);
+        ASSERT_EQ(std::string(buf, n.value()),
+                  type == EntryType::Kernel ? "kernel" : "ramdisk");
+    }
+}
+
+TEST_F(ReaderTest, ReadDataViewFromMemory)
+{
+    MemoryFile file(_buf, _buf_size);
+    Reader reader;
+
+    ASSERT_TRUE(reader.enable_formats_all());
+    ASSERT_TRUE(reader.open(&file));
+    ASSERT_TRUE(reader.read_header());
+
+    auto entry = reader.read_entry();
+    ASSERT_TRUE(entry);
+    ASSERT_EQ(entry.value().type(), EntryType::Kernel);
+
+    // Partially read entry
+    char buf[16];
+    ASSERT_EQ(reader.read_data(buf, 2), oc::success(2u));
+
+    auto view = reader.read_data_view();
+    ASSERT_TRUE(view);
+    ASSERT_EQ(std::string(static_cast<const char *>(view.value().data),
+                          view.value().size), "rnel");
+
+    // Entry data is consumed
+    ASSERT_EQ(reader.read_data(buf, sizeof(buf)), oc::success(0u));
+
+    // Following entry is still read correctly
+    entry = reader.read_entry();
+    ASSERT_TRUE(entry);
+    ASSERT_EQ(entry.value().type(), EntryType::Ramdisk);
+    auto n = reader.read_data(buf, sizeof(buf));
+    ASSERT_TRUE(n);
+    ASSERT_EQ(std::string(buf, n.value()), "ramdisk");
+}
+
+TEST_F(ReaderTest, ReadDataViewUnsupported)
+{
+    MemoryFile file;
+    StatsFile stats_file;
+    Reader reader;
+
+    OpenImage(reader, stats_file, file);
+
+    ASSERT_TRUE(reader.read_header());
+    ASSERT_TRUE(reader.go_to_entry(EntryType::Ramdisk));
+
+    // StatsFile does not expose the mapping of the underlying file
+    ASSERT_EQ(reader.read_data_view(),
+              oc::failure(ReaderError::UnsupportedDataView));
+
+    char buf[16];
+    auto n = reader.read_data(buf, sizeof(buf));
+    ASSERT_TRUE(n);
+    ASSERT_EQ(std::string(buf, n.value()), "ramdisk");
+}
+
+TEST_F(ReaderTest, ProbeCacheRemembersFormat)
+{
+    auto path = testing::TempDir() + "probe_cache.img";
+    auto write_file = [&](const void *data, size_t size) {
+        FILE *fp = fopen(path.c_str(), "wb");
+        ASSERT_TRUE(fp);
+        ASSERT_EQ(fwrite(data, 1, size, fp), size);
+        ASSERT_EQ(fclose(fp), 0);
+    };
+
+    write_file(_buf, _buf_size);
+
+    ProbeCache cache;
+
+    for (size_t i = 0; i < 2; ++i) {
+        Reader reader;
+        ASSERT_TRUE(reader.enable_formats_all());
+        ASSERT_TRUE(reader.set_probe_cache(&cache));
+        ASSERT_TRUE(reader.open_filename(path));
+        ASSERT_EQ(reader.format(), Format::Android);
+        ASSERT_EQ(cache.size(), 1u);
+
+        ASSERT_TRUE(reader.read_header());
+        ASSERT_TRUE(reader.go_to_entry(EntryType::Ramdisk));
+
+        char buf[16];
+        auto n = reader.read_data(buf, sizeof(buf));
+        ASSERT_TRUE(n);
+        ASSERT_EQ(std::string(buf, n.value()), "ramdisk");
+    }
+
+    // A modified file is detected again
+    std::vector<unsigned char> zeros(_buf_size + 1);
+    write_file(zeros.data(), zeros.size());
+
+    Reader reader;
+    ASSERT_TRUE(reader.enable_formats_all());
+    ASSERT_TRUE(reader.set_probe_cache(&cache));
+    ASSERT_EQ(reader.open_filename(path),
+              oc::failure(ReaderError::UnknownFileFormat));
+
+    remove(path.c_str());
+}
@@ -18,3 +18,163 @@
  */
 
 #include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+#include <cstdlib>
+
+#include "mbcommon/file/memory.h"
+#include "mbcommon/file/stats.h"
+
+#include "mbbootimg/entry.h"
+#include "mbbootimg/header.h"
+#include "mbbootimg/reader.h"
+#include "mbbootimg/writer.h"
+
+using namespace mb;
+using namespace mb::bootimg;
+
+struct WriterTest : testing::Test
+{
+    void *_src_buf = nullptr;
+    size_t _src_size = 0;
+    void *_dest_buf = nullptr;
+    size_t _dest_size = 0;
+
+    ~WriterTest()
+    {
+        free(_src_buf);
+        free(_dest_buf);
+    }
+
+    void SetUp() override
+    {
+        MemoryFile file(&_src_buf, &_src_size);
+        ASSERT_TRUE(file.is_open());
+
+        Writer writer;
+        ASSERT_TRUE(writer.set_format(Format::Android));
+        ASSERT_TRUE(writer.open(&file));
+
+        auto header = writer.get_header();
+        ASSERT_TRUE(header);
+        ASSERT_TRUE(header.value().set_page_size(2048));
+        ASSERT_TRUE(writer.write_header(header.value()));
+
+        while (true) {
+            auto entry = writer.get_entry();
+            if (!entry) {
+                ASSERT_EQ(entry.error(), WriterError::EndOfEntries);
+                break;
+            }
+
+            ASSERT_TRUE(writer.write_entry(entry.value()));
+
+            if (entry.value().type() == EntryType::Kernel) {
+                ASSERT_TRUE(writer.write_data("kernel", 6));
+            } else if (entry.value().type() == EntryType::Ramdisk) {
+                ASSERT_TRUE(writer.write_data("ramdisk", 7));
+            }
+        }
+
+        ASSERT_TRUE(writer.close());
+    }
+
+    // Rebuild the source image by copying all of its entries
+    void CopyImage(Reader &reader)
+    {
+        ASSERT_TRUE(reader.read_header());
+
+        MemoryFile file(&_dest_buf, &_dest_size);
+        ASSERT_TRUE(file.is_open());
+
+        Writer writer;
+        ASSERT_TRUE(writer.set_format(Format::Android));
+        ASSERT_TRUE(writer.open(&file));
+
+        auto header = writer.get_header();
+        ASSERT_TRUE(header);
+        ASSERT_TRUE(header.value().set_page_size(2048));
+        ASSERT_TRUE(writer.write_header(header.value()));
+
+        while (true) {
+            auto entry = writer.get_entry();
+            if (!entry) {
+                ASSERT_EQ(entry.error(), WriterError::EndOfEntries);
+                break;
+            }
+
+            auto type = entry.value().type();
+            ASSERT_TRUE(writer.write_entry(entry.value()));
+
+            auto n = writer.copy_entry_from(reader, type);
+            if (type == EntryType::Kernel) {
+                ASSERT_EQ(n, oc::success(6u));
+            } else if (type == EntryType::Ramdisk) {
+                ASSERT_EQ(n, oc::success(7u));
+            } else {
+                ASSERT_EQ(n, oc::failure(ReaderError::EndOfEntries));
+            }
+        }
+
+        ASSERT_TRUE(writer.close());
+    }
+};
+
+TEST_F(WriterTest, CopyEntryFromMappedImage)
+{
+    MemoryFile file(_src_buf, _src_size);
+    ASSERT_TRUE(file.is_open());
+
+    Reader reader;
+    ASSERT_TRUE(reader.enable_formats_all());
+    ASSERT_TRUE(reader.open(&file));
+
+    CopyImage(reader);
+
+    // Identical entries produce an identical image, including the SHA1 ID
+    ASSERT_EQ(std::string(static_cast<char *>(_dest_buf), _dest_size),
+              std::string(static_cast<char *>(_src_buf), _src_size));
+}
+
+TEST_F(WriterTest, CopyEntryFromUnmappedImage)
+{
+    MemoryFile file(_src_buf, _src_size);
+    ASSERT_TRUE(file.is_open());
+
+    // StatsFile does not expose the mapping, so the data must be read
+    StatsFile stats_file(&file);
+    ASSERT_TRUE(stats_file.is_open());
+
+    Reader reader;
+    ASSERT_TRUE(reader.enable_formats_all());
+    ASSERT_TRUE(reader.open(&stats_file));
+
+    CopyImage(reader);
+
+    ASSERT_EQ(std::string(static_cast<char *>(_dest_buf), _dest_size),
+              std::string(static_cast<char *>(_src_buf), _src_size));
+}
+
+TEST_F(WriterTest, CopyEntryFromInvalidState)
+{
+    MemoryFile file(_src_buf, _src_size);
+    ASSERT_TRUE(file.is_open());
+
+    Reader reader;
+    ASSERT_TRUE(reader.enable_formats_all());
+    ASSERT_TRUE(reader.open(&file));
+    ASSERT_TRUE(reader.read_header());
+
+    MemoryFile dest_file(&_dest_buf, &_dest_size);
+    ASSERT_TRUE(dest_file.is_open());
+
+    Writer writer;
+    ASSERT_TRUE(writer.set_format(Format::Android));
+    ASSERT_TRUE(writer.open(&dest_file));
+
+    // No entry has been started yet
+    ASSERT_EQ(writer.copy_entry_from(reader, EntryType::Kernel),
+              oc::failure(WriterError::InvalidState));
+}
@@ -0,0 +1,337 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "benchmark.h"
+
+#include <string>
+#include <vector>
+
+#include <cstdio>
+#include <cstdlib>
+
+#include <unistd.h>
+
+#include "mbcommon/file/fd.h"
+#include "mbcommon/file/memory.h"
+#include "mbcommon/file/posix.h"
+#include "mbcommon/file/standard.h"
+#include "mbcommon/file_util.h"
+#include "mbcommon/string.h"
+
+using namespace mb;
+using namespace mb::bench;
+
+static constexpr size_t DATA_SIZE = 8 * 1024 * 1024;
+static constexpr size_t IO_BUFFER_SIZES[] = { 512, 4096, 65536, 1048576 };
+
+static std::vector<unsigned char> make_data(size_t size)
+{
+    std::vector<unsigned char> data(size);
+    uint32_t x = 0x12345678;
+
+    // xorshift so that short patterns do not match too often
+    for (auto &c : data) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        c = static_cast<unsigned char>(x);
+    }
+
+    return data;
+}
+
+// Not const since MemoryFile only accepts mutable buffers. Only read from it.
+static std::vector<unsigned char> & test_data()
+{
+    static auto data = make_data(DATA_SIZE);
+    return data;
+}
+
+// Temporary file that is deleted when the object is destroyed
+class TempFile
+{
+public:
+    TempFile()
+    {
+        const char *tmpdir = getenv("TMPDIR");
+        m_path = format("%s/mbcommon_bench.XXXXXX",
+                        tmpdir && *tmpdir ? tmpdir : "/tmp");
+
+        int fd = mkstemp(m_path.data());
+        if (fd < 0) {
+            m_path.clear();
+            return;
+        }
+
+        auto const &data = test_data();
+        FdFile file(fd, true);
+        if (!file_write_exact(file, data.data(), data.size())) {
+            m_path.clear();
+        }
+    }
+
+    ~TempFile()
+    {
+        if (!m_path.empty()) {
+            unlink(m_path.c_str());
+        }
+    }
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(TempFile)
+
+    const std::string & path() const
+    {
+        return m_path;
+    }
+
+private:
+    std::string m_path;
+};
+
+// FileSearcher
+
+static void search_memory(State &state, const void *pattern,
+                          size_t pattern_size)
+{
+    auto &data = test_data();
+    MemoryFile file(data.data(), data.size());
+    uint64_t matches = 0;
+
+    for (uint64_t i = 0; i < state.iterations(); ++i) {
+        if (!file.seek(0, SEEK_SET)) {
+            return state.skip("Failed to seek");
+        }
+
+        FileSearcher searcher(&file, pattern, pattern_size);
+
+        while (true) {
+            auto result = searcher.next();
+            if (!result) {
+                return state.skip("Search failed");
+            } else if (!result.value()) {
+                break;
+            }
+            ++matches;
+        }
+    }
+
+    do_not_optimize(matches);
+    state.set_bytes_processed(state.iterations() * data.size());
+}
+
+MB_BENCHMARK(FileSearcher_next_short)
+{
+    search_memory(state, "ANDROID!", 8);
+}
+
+MB_BENCHMARK(FileSearcher_next_long)
+{
+    search_memory(state, "SEANDROIDENFORCE", 16);
+}
+
+// file_util
+
+MB_BENCHMARK(file_read_exact)
+{
+    auto &data = test_data();
+    MemoryFile file(data.data(), data.size());
+    std::vector<unsigned char> buf(65536);
+
+    for (uint64_t i = 0; i < state.iterations(); ++i) {
+        if (!file.seek(0, SEEK_SET)) {
+            return state.skip("Failed to seek");
+        }
+
+        for (size_t n = 0; n < data.size(); n += buf.size()) {
+            if (!file_read_exact(file, buf.data(), buf.size())) {
+                return state.skip("Failed to read");
+            }
+        }
+
+        do_not_optimize(buf);
+    }
+
+    state.set_bytes_processed(state.iterations() * data.size());
+}
+
+MB_BENCHMARK(file_move)
+{
+    auto data = test_data();
+    MemoryFile file(data.data(), data.size());
+    constexpr size_t move_size = DATA_SIZE / 2;
+    constexpr size_t distance = DATA_SIZE / 8;
+
+    for (uint64_t i = 0; i < state.iterations(); ++i) {
+        // Alternate between moving forwards and backwards
+        auto src = i % 2 == 0 ? 0 : distance;
+        auto dest = i % 2 == 0 ? distance : 0;
+
+        auto n = file_move(file, src, dest, move_size);
+        if (!n || n.value() != move_size) {
+            return state.skip("Failed to move data");
+        }
+    }
+
+    state.set_bytes_processed(state.iterations() * move_size);
+}
+
+// MemoryFile
+
+MB_BENCHMARK(MemoryFile_read)
+{
+    auto &data = test_data();
+    MemoryFile file(data.data(), data.size());
+    unsigned char buf[4096];
+
+    for (uint64_t i = 0; i < state.iterations(); ++i) {
+        if (!file.seek(0, SEEK_SET)) {
+            return state.skip("Failed to seek");
+        }
+
+        while (true) {
+            auto n = file.read(buf, sizeof(buf));
+            if (!n) {
+                return state.skip("Failed to read");
+            } else if (n.value() == 0) {
+                break;
+            }
+        }
+
+        do_not_optimize(buf);
+    }
+
+    state.set_bytes_processed(state.iterations() * data.size());
+}
+
+MB_BENCHMARK(MemoryFile_write_dynamic)
+{
+    auto const &data = test_data();
+    constexpr size_t chunk_size = 4096;
+
+    for (uint64_t i = 0; i < state.iterations(); ++i) {
+        void *buf = nullptr;
+        size_t size = 0;
+
+        {
+            MemoryFile file(&buf, &size);
+
+            for (size_t n = 0; n < data.size(); n += chunk_size) {
+                if (!file_write_exact(file, data.data() + n, chunk_size)) {
+                    free(buf);
+                    return state.skip("Failed to write");
+                }
+            }
+        }
+
+        do_not_optimize(buf);
+        free(buf);
+    }
+
+    state.set_bytes_processed(state.iterations() * data.size());
+}
+
+// Throughput of the OS-backed file implementations
+
+template<typename FileType>
+static void read_throughput(State &state, size_t buf_size)
+{
+    TempFile temp;
+    if (temp.path().empty()) {
+        return state.skip("Failed to create temporary file");
+    }
+
+    FileType file;
+    if (!file.open(temp.path(), FileOpenMode::ReadOnly)) {
+        return state.skip("Failed to open temporary file");
+    }
+
+    std::vector<unsigned char> buf(buf_size);
+
+    for (uint64_t i = 0; i < state.iterations(); ++i) {
+        if (!file.seek(0, SEEK_SET)) {
+            return state.skip("Failed to seek");
+        }
+
+        while (true) {
+            auto n = file.read(buf.data(), buf.size());
+            if (!n) {
+                return state.skip("Failed to read");
+            } else if (n.value() == 0) {
+                break;
+            }
+        }
+
+        do_not_optimize(buf);
+    }
+
+    state.set_bytes_processed(state.iterations() * DATA_SIZE);
+}
+
+template<typename FileType>
+static void write_throughput(State &state, size_t buf_size)
+{
+    TempFile temp;
+    if (temp.path().empty()) {
+        return state.skip("Failed to create temporary file");
+    }
+
+    FileType file;
+    if (!file.open(temp.path(), FileOpenMode::WriteOnly)) {
+        return state.skip("Failed to open temporary file");
+    }
+
+    auto const &data = test_data();
+
+    for (uint64_t i = 0; i < state.iterations(); ++i) {
+        if (!file.seek(0, SEEK_SET)) {
+            return state.skip("Failed to seek");
+        }
+
+        for (size_t n = 0; n < data.size(); n += buf_size) {
+            if (!file_write_exact(file, data.data() + n,
+                                  std::min(buf_size, data.size() - n))) {
+                return state.skip("Failed to write");
+            }
+        }
+    }
+
+    state.set_bytes_processed(state.iterations() * DATA_SIZE);
+}
+
+template<typename FileType>
+static bool register_throughput(const char *name)
+{
+    for (size_t size : IO_BUFFER_SIZES) {
+        register_benchmark(format("%s_read/%zu", name, size),
+                           [size](State &state) {
+            read_throughput<FileType>(state, size);
+        });
+        register_benchmark(format("%s_write/%zu", name, size),
+                           [size](State &state) {
+            write_throughput<FileType>(state, size);
+        });
+    }
+
+    return true;
+}
+
+[[maybe_unused]] static bool g_throughput_registered =
+        register_throughput<FdFile>("FdFile")
+        && register_throughput<PosixFile>("PosixFile")
+        && register_throughput<StandardFile>("StandardFile");
@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "benchmark.h"
+
+#include <string>
+
+#include <cinttypes>
+
+#include "mbcommon/string.h"
+
+using namespace mb;
+using namespace mb::bench;
+
+// Typical set of mount options from /proc/self/mountinfo
+static constexpr char MOUNT_OPTIONS[] =
+        "rw,seclabel,nosuid,nodev,noatime,background_gc=on,discard,"
+        "no_heap,user_xattr,inline_xattr,acl,inline_data,inline_dentry,"
+        "flush_merge,extent_cache,mode=adaptive,active_logs=6,"
+        "alloc_mode=default,fsync_mode=posix";
+
+MB_BENCHMARK(split)
+{
+    for (uint64_t i = 0; i < state.iterations(); ++i) {
+        auto pieces = mb::split(MOUNT_OPTIONS, ',');
+        do_not_optimize(pieces);
+    }
+}
+
+MB_BENCHMARK(split_sv)
+{
+    for (uint64_t i = 0; i < state.iterations(); ++i) {
+        auto pieces = split_sv(MOUNT_OPTIONS, ',');
+        do_not_optimize(pieces);
+    }
+}
+
+MB_BENCHMARK(split_range)
+{
+    for (uint64_t i = 0; i < state.iterations(); ++i) {
+        size_t count = 0;
+        for (auto const &piece : split_range(MOUNT_OPTIONS, ',')) {
+            count += piece.size();
+        }
+        do_not_optimize(count);
+    }
+}
+
+MB_BENCHMARK(format)
+{
+    for (uint64_t i = 0; i < state.iterations(); ++i) {
+        auto str = mb::format("%s[%" PRIu64 "]: %s", "mbtool", i,
+                              "Mounting /system");
+        do_not_optimize(str);
+    }
+}
+
+MB_BENCHMARK(format_to_string)
+{
+    std::string buf;
+
+    for (uint64_t i = 0; i < state.iterations(); ++i) {
+        buf.clear();
+        auto n = format_to(buf, "%s[%" PRIu64 "]: %s", "mbtool", i,
+                           "Mounting /system");
+        do_not_optimize(n);
+    }
+}
+
+MB_BENCHMARK(format_to_buffer)
+{
+    char buf[128];
+
+    for (uint64_t i = 0; i < state.iterations(); ++i) {
+        auto n = format_to(buf, sizeof(buf), "%s[%" PRIu64 "]: %s", "mbtool",
+                           i, "Mounting /system");
+        do_not_optimize(n);
+    }
+}
@@ -0,0 +1,388 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "benchmark.h"
+
+#include <algorithm>
+#include <map>
+#include <vector>
+
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "mbcommon/string.h"
+
+namespace mb::bench
+{
+
+using namespace std::chrono;
+
+struct Benchmark
+{
+    std::string name;
+    BenchmarkFunc func;
+};
+
+struct Result
+{
+    std::string name;
+    uint64_t iterations;
+    double ns_per_iter;
+    double bytes_per_second;
+    std::vector<std::pair<std::string, double>> counters;
+    std::string skip_reason;
+};
+
+static std::vector<Benchmark> & registry()
+{
+    static std::vector<Benchmark> benchmarks;
+    return benchmarks;
+}
+
+// Parameters passed with --param
+static std::map<std::string, std::string> & given_params()
+{
+    static std::map<std::string, std::string> params;
+    return params;
+}
+
+// Effective values of all parameters that the benchmarks asked for
+static std::map<std::string, std::string> & used_params()
+{
+    static std::map<std::string, std::string> params;
+    return params;
+}
+
+State::State(uint64_t iterations)
+    : m_iterations(iterations)
+    , m_bytes(0)
+    , m_excluded(0)
+{
+}
+
+uint64_t State::iterations() const
+{
+    return m_iterations;
+}
+
+void State::pause_timing()
+{
+    m_pause_start = Clock::now();
+}
+
+void State::resume_timing()
+{
+    m_excluded += duration_cast<nanoseconds>(Clock::now() - m_pause_start);
+}
+
+void State::set_bytes_processed(uint64_t bytes)
+{
+    m_bytes = bytes;
+}
+
+uint64_t State::bytes_processed() const
+{
+    return m_bytes;
+}
+
+// Report an additional benchmark-specific value, such as memory usage. Setting
+// the same counter again replaces its value.
+void State::set_counter(std::string name, double value)
+{
+    for (auto &[n, v] : m_counters) {
+        if (n == name) {
+            v = value;
+            return;
+        }
+    }
+
+    m_counters.emplace_back(std::move(name), value);
+}
+
+const std::vector<std::pair<std::string, double>> & State::counters() const
+{
+    return m_counters;
+}
+
+void State::skip(std::string reason)
+{
+    m_skip_reason = std::move(reason);
+}
+
+const std::string & State::skip_reason() const
+{
+    return m_skip_reason;
+}
+
+nanoseconds State::excluded_time() const
+{
+    return m_excluded;
+}
+
+// Report the time taken by all iterations instead of using the wall-clock
+// time. This is for benchmarks that do the measured work in another process.
+void State::set_manual_time(nanoseconds time)
+{
+    m_manual_time = time;
+}
+
+std::optional<nanoseconds> State::manual_time() const
+{
+    return m_manual_time;
+}
+
+bool register_benchmark(std::string name, BenchmarkFunc func)
+{
+    registry().push_back({std::move(name), std::move(func)});
+    return true;
+}
+
+/*!
+ * \brief Get the value of a workload parameter
+ *
+ * Parameters are set on the command line with `--param=<name>=<value>`. The
+ * effective value of every parameter that is queried is included in the
+ * output so that results are only compared between runs with the same
+ * workload.
+ */
+const std::string & param(const std::string &name,
+                          const std::string &default_value)
+{
+    auto it = given_params().find(name);
+    auto const &value = it != given_params().end() ? it->second : default_value;
+
+    return used_params().insert_or_assign(name, value).first->second;
+}
+
+uint64_t param_u64(const std::string &name, uint64_t default_value)
+{
+    auto const &value = param(name, std::to_string(default_value));
+
+    char *end;
+    errno = 0;
+    auto result = strtoull(value.c_str(), &end, 10);
+    if (errno != 0 || value.empty() || *end != '\0') {
+        fprintf(stderr, "Invalid value for parameter %s: %s\n",
+                name.c_str(), value.c_str());
+        exit(EXIT_FAILURE);
+    }
+
+    return result;
+}
+
+static Result run_benchmark(const Benchmark &benchmark, nanoseconds min_time)
+{
+    uint64_t iterations = 1;
+
+    while (true) {
+        State state(iterations);
+
+        auto start = steady_clock::now();
+        benchmark.func(state);
+        auto elapsed = duration_cast<nanoseconds>(steady_clock::now() - start)
+                - state.excluded_time();
+        if (auto time = state.manual_time()) {
+            elapsed = *time;
+        }
+
+        if (!state.skip_reason().empty()) {
+            return {benchmark.name, 0, 0, 0, {}, state.skip_reason()};
+        }
+
+        if (elapsed >= min_time || iterations >= UINT64_MAX / 10) {
+            auto ns = static_cast<double>(std::max<nanoseconds::rep>(
+                    elapsed.count(), 1));
+
+            return {
+                benchmark.name,
+                iterations,
+                ns / static_cast<double>(iterations),
+                static_cast<double>(state.bytes_processed()) * 1e9 / ns,
+                state.counters(),
+                {},
+            };
+        }
+
+        // Aim slightly past the minimum time, but grow by at most 10x per run
+        auto target = static_cast<double>(min_time.count()) * 1.5;
+        auto scale = target / static_cast<double>(
+                std::max<nanoseconds::rep>(elapsed.count(), 1));
+        iterations = static_cast<uint64_t>(static_cast<double>(iterations)
+                * std::clamp(scale, 2.0, 10.0));
+    }
+}
+
+static void print_text(const std::vector<Result> &results)
+{
+    printf("%-40s %12s %16s %14s\n", "Benchmark", "Iterations", "Time/iter (ns)",
+           "MiB/s");
+
+    for (auto const &r : results) {
+        if (!r.skip_reason.empty()) {
+            printf("%-40s skipped: %s\n", r.name.c_str(), r.skip_reason.c_str());
+        } else if (r.bytes_per_second > 0) {
+            printf("%-40s %12" PRIu64 " %16.1f %14.1f\n", r.name.c_str(),
+                   r.iterations, r.ns_per_iter,
+                   r.bytes_per_second / (1024 * 1024));
+        } else {
+            printf("%-40s %12" PRIu64 " %16.1f %14s\n", r.name.c_str(),
+                   r.iterations, r.ns_per_iter, "-");
+        }
+
+        for (auto const &[name, value] : r.counters) {
+            printf("    %s: %.0f\n", name.c_str(), value);
+        }
+    }
+}
+
+static void print_json(const std::vector<Result> &results)
+{
+    printf("{\n  \"params\": {");
+
+    bool first_param = true;
+    for (auto const &[name, value] : used_params()) {
+        printf("%s\"%s\": \"%s\"", first_param ? "" : ", ",
+               name.c_str(), value.c_str());
+        first_param = false;
+    }
+
+    printf("},\n  \"benchmarks\": [");
+
+    bool first = true;
+    for (auto const &r : results) {
+        printf("%s\n    {\"name\": \"%s\", ", first ? "" : ",", r.name.c_str());
+        first = false;
+
+        if (!r.skip_reason.empty()) {
+            printf("\"skipped\": true}");
+        } else {
+            printf("\"iterations\": %" PRIu64 ", \"ns_per_iter\": %.3f, "
+                   "\"bytes_per_second\": %.0f",
+                   r.iterations, r.ns_per_iter, r.bytes_per_second);
+
+            if (!r.counters.empty()) {
+                printf(", \"counters\": {");
+                for (size_t i = 0; i < r.counters.size(); ++i) {
+                    printf("%s\"%s\": %.0f", i == 0 ? "" : ", ",
+                           r.counters[i].first.c_str(), r.counters[i].second);
+                }
+                printf("}");
+            }
+
+            printf("}");
+        }
+    }
+
+    printf("\n  ]\n}\n");
+}
+
+static void usage(FILE *stream, const char *prog_name)
+{
+    fprintf(stream,
+            "Usage: %s [option...]\n\n"
+            "Options:\n"
+            "  --filter=<substring>  Only run benchmarks whose name contains <substring>\n"
+            "  --format=<json|text>  Output format (default: json)\n"
+            "  --min-time=<ms>       Minimum run time per benchmark (default: 500)\n"
+            "  --param=<name>=<val>  Set a workload parameter\n"
+            "  --list                List benchmarks and exit\n"
+            "  -h, --help            Display this help message\n",
+            prog_name);
+}
+
+static int bench_main(int argc, char *argv[])
+{
+    std::string filter;
+    bool json = true;
+    bool list = false;
+    milliseconds min_time(500);
+
+    for (int i = 1; i < argc; ++i) {
+        std::string_view arg = argv[i];
+
+        if (starts_with(arg, "--filter=")) {
+            filter = arg.substr(strlen("--filter="));
+        } else if (arg == "--format=json") {
+            json = true;
+        } else if (arg == "--format=text") {
+            json = false;
+        } else if (starts_with(arg, "--min-time=")) {
+            char *end;
+            auto value = strtoul(argv[i] + strlen("--min-time="), &end, 10);
+            if (*end != '\0') {
+                fprintf(stderr, "Invalid minimum time: %s\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+            min_time = milliseconds(value);
+        } else if (starts_with(arg, "--param=")) {
+            auto kv = arg.substr(strlen("--param="));
+            auto pos = kv.find('=');
+            if (pos == std::string_view::npos || pos == 0) {
+                fprintf(stderr, "Invalid parameter: %s\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+            given_params().insert_or_assign(std::string(kv.substr(0, pos)),
+                                            std::string(kv.substr(pos + 1)));
+        } else if (arg == "--list") {
+            list = true;
+        } else if (arg == "-h" || arg == "--help") {
+            usage(stdout, argv[0]);
+            return EXIT_SUCCESS;
+        } else {
+            usage(stderr, argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    std::vector<Result> results;
+
+    for (auto const &b : registry()) {
+        if (b.name.find(filter) == std::string::npos) {
+            continue;
+        }
+
+        if (list) {
+            printf("%s\n", b.name.c_str());
+            continue;
+        }
+
+        fprintf(stderr, "Running %s...\n", b.name.c_str());
+        results.push_back(run_benchmark(b, min_time));
+    }
+
+    if (!list) {
+        if (json) {
+            print_json(results);
+        } else {
+            print_text(results);
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    return mb::bench::bench_main(argc, argv);
+}
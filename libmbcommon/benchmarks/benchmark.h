@@ -0,0 +1,96 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <cstdint>
+
+namespace mb::bench
+{
+
+class State
+{
+public:
+    explicit State(uint64_t iterations);
+
+    uint64_t iterations() const;
+
+    void pause_timing();
+    void resume_timing();
+
+    void set_bytes_processed(uint64_t bytes);
+    uint64_t bytes_processed() const;
+
+    void set_counter(std::string name, double value);
+    const std::vector<std::pair<std::string, double>> & counters() const;
+
+    void skip(std::string reason);
+    const std::string & skip_reason() const;
+
+    std::chrono::nanoseconds excluded_time() const;
+
+    void set_manual_time(std::chrono::nanoseconds time);
+    std::optional<std::chrono::nanoseconds> manual_time() const;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    uint64_t m_iterations;
+    uint64_t m_bytes;
+    std::vector<std::pair<std::string, double>> m_counters;
+    std::string m_skip_reason;
+    Clock::time_point m_pause_start;
+    std::chrono::nanoseconds m_excluded;
+    std::optional<std::chrono::nanoseconds> m_manual_time;
+};
+
+using BenchmarkFunc = std::function<void(State &)>;
+
+bool register_benchmark(std::string name, BenchmarkFunc func);
+
+const std::string & param(const std::string &name,
+                          const std::string &default_value);
+uint64_t param_u64(const std::string &name, uint64_t default_value);
+
+// Prevent the compiler from optimizing away the computation of a value
+template<typename T>
+inline void do_not_optimize(const T &value)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    asm volatile("" : : "r,m"(value) : "memory");
+#else
+    static volatile const void *sink;
+    sink = &value;
+#endif
+}
+
+}
+
+#define MB_BENCHMARK(name) \
+    static void bench_##name(mb::bench::State &state); \
+    [[maybe_unused]] static bool bench_##name##_registered = \
+            mb::bench::register_benchmark(#name, bench_##name); \
+    static void bench_##name(mb::bench::State &state)
@@ -0,0 +1,123 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "mbcommon/common.h"
+
+#include <string>
+#include <vector>
+
+#include <cstddef>
+
+namespace mb
+{
+
+// Monotonic allocator for objects that share a lifetime. Memory is carved out
+// of large blocks and is only returned to the system by release() or the
+// destructor, so many small, short-lived allocations don't fragment the heap.
+// Not thread-safe.
+class MB_EXPORT Arena
+{
+public:
+    static constexpr size_t DEFAULT_BLOCK_SIZE = 16 * 1024;
+
+    explicit Arena(size_t block_size = DEFAULT_BLOCK_SIZE);
+    ~Arena();
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(Arena)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(Arena)
+
+    void * allocate(size_t size, size_t alignment = alignof(std::max_align_t));
+    void release();
+
+    size_t bytes_allocated() const;
+    size_t bytes_reserved() const;
+
+private:
+    struct Block;
+
+    void * allocate_block(size_t size, size_t alignment);
+
+    Block *m_head;
+    char *m_cur;
+    char *m_end;
+    size_t m_block_size;
+    size_t m_allocated;
+    size_t m_reserved;
+};
+
+// Standard allocator that takes memory from an Arena. Deallocation is a no-op,
+// so containers using it should not outlive the arena's next release().
+template<typename T>
+class ArenaAllocator
+{
+public:
+    using value_type = T;
+
+    explicit ArenaAllocator(Arena &arena) noexcept
+        : m_arena(&arena)
+    {
+    }
+
+    template<typename U>
+    ArenaAllocator(const ArenaAllocator<U> &other) noexcept
+        : m_arena(other.arena())
+    {
+    }
+
+    T * allocate(size_t n)
+    {
+        return static_cast<T *>(m_arena->allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T *, size_t) noexcept
+    {
+    }
+
+    Arena * arena() const noexcept
+    {
+        return m_arena;
+    }
+
+private:
+    Arena *m_arena;
+};
+
+template<typename T, typename U>
+inline bool operator==(const ArenaAllocator<T> &lhs,
+                       const ArenaAllocator<U> &rhs) noexcept
+{
+    return lhs.arena() == rhs.arena();
+}
+
+template<typename T, typename U>
+inline bool operator!=(const ArenaAllocator<T> &lhs,
+                       const ArenaAllocator<U> &rhs) noexcept
+{
+    return !(lhs == rhs);
+}
+
+template<typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+
+using ArenaString = std::basic_string<char, std::char_traits<char>,
+                                      ArenaAllocator<char>>;
+
+}
@@ -21,6 +21,8 @@
 
 #include "mbcommon/common.h"
 
+#include <optional>
+
 #include <cstddef>
 #include <cstdint>
 
@@ -29,6 +31,18 @@
 namespace mb
 {
 
+struct IoVec
+{
+    void *data;
+    size_t size;
+};
+
+struct ConstIoVec
+{
+    const void *data;
+    size_t size;
+};
+
 class MB_EXPORT File
 {
 public:
@@ -46,8 +60,20 @@ public:
     virtual oc::result<uint64_t> seek(int64_t offset, int whence) = 0;
     virtual oc::result<void> truncate(uint64_t size) = 0;
 
+    // Positional file operations
+    virtual oc::result<size_t> read_at(uint64_t offset,
+                                       void *buf, size_t size);
+    virtual oc::result<size_t> write_at(uint64_t offset,
+                                        const void *buf, size_t size);
+
+    // Vectored file operations
+    virtual oc::result<size_t> readv(const IoVec *iov, size_t count);
+    virtual oc::result<size_t> writev(const ConstIoVec *iov, size_t count);
+
     // File state
     virtual bool is_open() = 0;
+    virtual int native_fd();
+    virtual std::optional<ConstIoVec> mapped_data();
 };
 
 }
@@ -0,0 +1,61 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "mbcommon/file.h"
+
+#include <memory>
+
+namespace mb
+{
+
+class MB_EXPORT BlockReader
+{
+public:
+    static constexpr size_t DEFAULT_BLOCK_SIZE = 1024 * 1024;
+
+    BlockReader();
+    BlockReader(File *file, size_t block_size = DEFAULT_BLOCK_SIZE);
+    ~BlockReader();
+
+    BlockReader(BlockReader &&other) noexcept;
+    BlockReader & operator=(BlockReader &&rhs) noexcept;
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(BlockReader)
+
+    void reset(File *file, size_t block_size = DEFAULT_BLOCK_SIZE);
+
+    File * file() const;
+    size_t block_size() const;
+
+    oc::result<size_t> read(const void **data);
+    oc::result<uint64_t> skip(uint64_t size);
+    oc::result<uint64_t> seek(int64_t offset, int whence);
+
+private:
+    /*! \cond INTERNAL */
+    File *m_file;
+    size_t m_block_size;
+    // Only allocated if the file is not memory mapped
+    std::unique_ptr<unsigned char[]> m_buf;
+    /*! \endcond */
+};
+
+}
@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "mbcommon/file.h"
+
+#include <vector>
+
+namespace mb
+{
+
+class MB_EXPORT BufferedFile : public File
+{
+public:
+    static constexpr size_t DEFAULT_READ_BUFFER_SIZE = 64 * 1024;
+    static constexpr size_t DEFAULT_WRITE_BUFFER_SIZE = 64 * 1024;
+
+    BufferedFile();
+    BufferedFile(File *file,
+                 size_t read_buf_size = DEFAULT_READ_BUFFER_SIZE,
+                 size_t write_buf_size = DEFAULT_WRITE_BUFFER_SIZE);
+    virtual ~BufferedFile();
+
+    BufferedFile(BufferedFile &&other) noexcept;
+    BufferedFile & operator=(BufferedFile &&rhs) noexcept;
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(BufferedFile)
+
+    oc::result<void> open(File *file,
+                          size_t read_buf_size = DEFAULT_READ_BUFFER_SIZE,
+                          size_t write_buf_size = DEFAULT_WRITE_BUFFER_SIZE);
+
+    oc::result<void> close() override;
+
+    oc::result<size_t> read(void *buf, size_t size) override;
+    oc::result<size_t> write(const void *buf, size_t size) override;
+    oc::result<uint64_t> seek(int64_t offset, int whence) override;
+    oc::result<void> truncate(uint64_t size) override;
+
+    oc::result<size_t> read_at(uint64_t offset,
+                               void *buf, size_t size) override;
+    oc::result<size_t> write_at(uint64_t offset,
+                                const void *buf, size_t size) override;
+
+    bool is_open() override;
+
+    oc::result<void> flush();
+
+private:
+    /*! \cond INTERNAL */
+    enum class Mode
+    {
+        None,
+        Read,
+        Write,
+    };
+
+    oc::result<void> discard_read_buffer();
+    oc::result<void> reset_buffer();
+
+    void clear() noexcept;
+
+    File *m_file;
+
+    size_t m_read_buf_size;
+    size_t m_write_buf_size;
+
+    Mode m_mode;
+    std::vector<unsigned char> m_buf;
+    // Logical file offset of m_buf[0]
+    uint64_t m_buf_offset;
+    // Number of valid (read mode) or pending (write mode) bytes in m_buf
+    size_t m_buf_len;
+
+    // Logical file position
+    uint64_t m_pos;
+    // Whether m_pos is an absolute offset or is relative to when the file was
+    // opened
+    bool m_pos_known;
+    /*! \endcond */
+};
+
+}
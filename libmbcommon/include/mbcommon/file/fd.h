@@ -52,7 +52,16 @@ public:
     oc::result<uint64_t> seek(int64_t offset, int whence) override;
     oc::result<void> truncate(uint64_t size) override;
 
+    oc::result<size_t> read_at(uint64_t offset,
+                               void *buf, size_t size) override;
+    oc::result<size_t> write_at(uint64_t offset,
+                                const void *buf, size_t size) override;
+
+    oc::result<size_t> readv(const IoVec *iov, size_t count) override;
+    oc::result<size_t> writev(const ConstIoVec *iov, size_t count) override;
+
     bool is_open() override;
+    int native_fd() override;
 
 protected:
     /*! \cond INTERNAL */
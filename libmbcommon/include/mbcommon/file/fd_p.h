@@ -22,6 +22,9 @@
 #include <cstddef>
 
 #include <sys/stat.h>
+#ifndef _WIN32
+#  include <sys/uio.h>
+#endif
 
 /*! \cond INTERNAL */
 namespace mb
@@ -47,8 +50,20 @@ struct FdFileFuncs
     virtual int fn_close(int fd) = 0;
     virtual int fn_ftruncate64(int fd, off64_t length) = 0;
     virtual off64_t fn_lseek64(int fd, off64_t offset, int whence) = 0;
+#ifndef _WIN32
+    virtual ssize_t fn_pread64(int fd, void *buf, size_t count,
+                               off64_t offset) = 0;
+    virtual ssize_t fn_pwrite64(int fd, const void *buf, size_t count,
+                                off64_t offset) = 0;
+#endif
     virtual ssize_t fn_read(int fd, void *buf, size_t count) = 0;
     virtual ssize_t fn_write(int fd, const void *buf, size_t count) = 0;
+
+#ifndef _WIN32
+    // sys/uio.h
+    virtual ssize_t fn_readv(int fd, const struct iovec *iov, int iovcnt) = 0;
+    virtual ssize_t fn_writev(int fd, const struct iovec *iov, int iovcnt) = 0;
+#endif
 };
 
 }
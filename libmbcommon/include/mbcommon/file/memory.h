@@ -47,16 +47,33 @@ public:
     oc::result<uint64_t> seek(int64_t offset, int whence) override;
     oc::result<void> truncate(uint64_t size) override;
 
+    oc::result<size_t> read_at(uint64_t offset,
+                               void *buf, size_t size) override;
+    oc::result<size_t> write_at(uint64_t offset,
+                                const void *buf, size_t size) override;
+
+    oc::result<size_t> readv(const IoVec *iov, size_t count) override;
+    oc::result<size_t> writev(const ConstIoVec *iov, size_t count) override;
+
     bool is_open() override;
+    std::optional<ConstIoVec> mapped_data() override;
+
+    oc::result<void> reserve(size_t capacity);
+    oc::result<void> shrink_to_fit();
+    size_t capacity();
 
 private:
     /*! \cond INTERNAL */
+    oc::result<void> resize(size_t size);
+
     void clear() noexcept;
 
     bool m_is_open;
 
     void *m_data;
     size_t m_size;
+    // Allocated size of m_data (dynamic buffers only)
+    size_t m_capacity;
 
     void **m_data_ptr;
     size_t *m_size_ptr;
@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "mbcommon/file.h"
+
+#include <memory>
+
+namespace mb
+{
+
+class MB_EXPORT ReadAheadFile : public File
+{
+public:
+    static constexpr size_t DEFAULT_BUFFER_COUNT = 4;
+    static constexpr size_t DEFAULT_BUFFER_SIZE = 1024 * 1024;
+
+    ReadAheadFile();
+    ReadAheadFile(File *file,
+                  size_t buffer_count = DEFAULT_BUFFER_COUNT,
+                  size_t buffer_size = DEFAULT_BUFFER_SIZE);
+    virtual ~ReadAheadFile();
+
+    ReadAheadFile(ReadAheadFile &&other) noexcept;
+    ReadAheadFile & operator=(ReadAheadFile &&rhs) noexcept;
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(ReadAheadFile)
+
+    oc::result<void> open(File *file,
+                          size_t buffer_count = DEFAULT_BUFFER_COUNT,
+                          size_t buffer_size = DEFAULT_BUFFER_SIZE);
+
+    oc::result<void> close() override;
+
+    oc::result<size_t> read(void *buf, size_t size) override;
+    oc::result<size_t> write(const void *buf, size_t size) override;
+    oc::result<uint64_t> seek(int64_t offset, int whence) override;
+    oc::result<void> truncate(uint64_t size) override;
+
+    bool is_open() override;
+
+private:
+    /*! \cond INTERNAL */
+    struct State;
+
+    void clear() noexcept;
+
+    File *m_file;
+    // Shared with the reader thread. Heap allocated so that the address stays
+    // the same when this object is moved.
+    std::unique_ptr<State> m_state;
+    /*! \endcond */
+};
+
+}
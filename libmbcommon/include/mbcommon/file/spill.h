@@ -0,0 +1,93 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "mbcommon/file.h"
+
+#include "mbcommon/file/fd.h"
+
+namespace mb
+{
+
+class MemoryBudget;
+
+class MB_EXPORT SpillFile : public File
+{
+public:
+    SpillFile();
+    explicit SpillFile(MemoryBudget &budget);
+    virtual ~SpillFile();
+
+    SpillFile(SpillFile &&other) noexcept;
+    SpillFile & operator=(SpillFile &&rhs) noexcept;
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(SpillFile)
+
+    oc::result<void> open();
+    oc::result<void> open(MemoryBudget &budget);
+
+    oc::result<void> close() override;
+
+    oc::result<size_t> read(void *buf, size_t size) override;
+    oc::result<size_t> write(const void *buf, size_t size) override;
+    oc::result<uint64_t> seek(int64_t offset, int whence) override;
+    oc::result<void> truncate(uint64_t size) override;
+
+    oc::result<size_t> read_at(uint64_t offset,
+                               void *buf, size_t size) override;
+    oc::result<size_t> write_at(uint64_t offset,
+                                const void *buf, size_t size) override;
+
+    oc::result<size_t> writev(const ConstIoVec *iov, size_t count) override;
+
+    bool is_open() override;
+    int native_fd() override;
+    std::optional<ConstIoVec> mapped_data() override;
+
+    oc::result<void> reserve(uint64_t capacity);
+    oc::result<void> spill();
+
+    bool spilled() const;
+    uint64_t size() const;
+
+private:
+    /*! \cond INTERNAL */
+    oc::result<void> grow(uint64_t size);
+    void free_memory() noexcept;
+
+    void clear() noexcept;
+
+    bool m_is_open;
+    MemoryBudget *m_budget;
+
+    // In-memory contents. m_capacity bytes are reserved from the budget.
+    void *m_data;
+    size_t m_capacity;
+
+    // Temporary file after spilling
+    bool m_spilled;
+    FdFile m_file;
+
+    uint64_t m_size;
+    uint64_t m_pos;
+    /*! \endcond */
+};
+
+}
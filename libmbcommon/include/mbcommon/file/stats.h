@@ -0,0 +1,108 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "mbcommon/file.h"
+
+#include <array>
+#include <chrono>
+#include <optional>
+#include <string>
+
+namespace mb
+{
+
+// Bucket i counts operations that took less than 2^i microseconds (and at
+// least 2^(i-1) microseconds). The last bucket counts everything slower.
+constexpr size_t FILE_STATS_LATENCY_BUCKETS = 20;
+
+struct FileOpStats
+{
+    uint64_t count = 0;
+    uint64_t errors = 0;
+    uint64_t bytes = 0;
+    uint64_t total_ns = 0;
+    uint64_t max_ns = 0;
+    std::array<uint64_t, FILE_STATS_LATENCY_BUCKETS> latency_histogram = {};
+};
+
+struct FileStats
+{
+    FileOpStats read;
+    FileOpStats write;
+    FileOpStats seek;
+    FileOpStats truncate;
+    // Sum of the absolute distances moved by successful seeks
+    uint64_t seek_distance = 0;
+};
+
+MB_EXPORT std::string format_file_stats(const FileStats &stats);
+
+class MB_EXPORT StatsFile : public File
+{
+public:
+    StatsFile();
+    StatsFile(File *file);
+    virtual ~StatsFile();
+
+    StatsFile(StatsFile &&other) noexcept;
+    StatsFile & operator=(StatsFile &&rhs) noexcept;
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(StatsFile)
+
+    oc::result<void> open(File *file);
+
+    oc::result<void> close() override;
+
+    oc::result<size_t> read(void *buf, size_t size) override;
+    oc::result<size_t> write(const void *buf, size_t size) override;
+    oc::result<uint64_t> seek(int64_t offset, int whence) override;
+    oc::result<void> truncate(uint64_t size) override;
+
+    oc::result<size_t> read_at(uint64_t offset,
+                               void *buf, size_t size) override;
+    oc::result<size_t> write_at(uint64_t offset,
+                                const void *buf, size_t size) override;
+
+    oc::result<size_t> readv(const IoVec *iov, size_t count) override;
+    oc::result<size_t> writev(const ConstIoVec *iov, size_t count) override;
+
+    bool is_open() override;
+
+    const FileStats & stats() const;
+    void reset_stats();
+
+private:
+    /*! \cond INTERNAL */
+    using Clock = std::chrono::steady_clock;
+
+    static void record(FileOpStats &op, Clock::time_point start, bool success,
+                       uint64_t bytes);
+
+    void clear() noexcept;
+
+    File *m_file;
+    FileStats m_stats;
+    // Logical file position, if known
+    std::optional<uint64_t> m_pos;
+    /*! \endcond */
+};
+
+}
@@ -0,0 +1,132 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "mbcommon/file.h"
+
+#include <memory>
+#include <system_error>
+#include <vector>
+
+namespace mb
+{
+
+namespace detail
+{
+struct UringQueue;
+}
+
+class MB_EXPORT UringFile : public File
+{
+public:
+    static constexpr size_t DEFAULT_QUEUE_DEPTH = 4;
+    static constexpr size_t DEFAULT_BLOCK_SIZE = 256 * 1024;
+
+    UringFile();
+    UringFile(int fd, bool owned,
+              size_t queue_depth = DEFAULT_QUEUE_DEPTH,
+              size_t block_size = DEFAULT_BLOCK_SIZE);
+    virtual ~UringFile();
+
+    UringFile(UringFile &&other) noexcept;
+    UringFile & operator=(UringFile &&rhs) noexcept;
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(UringFile)
+
+    oc::result<void> open(int fd, bool owned,
+                          size_t queue_depth = DEFAULT_QUEUE_DEPTH,
+                          size_t block_size = DEFAULT_BLOCK_SIZE);
+
+    oc::result<void> close() override;
+
+    oc::result<size_t> read(void *buf, size_t size) override;
+    oc::result<size_t> write(const void *buf, size_t size) override;
+    oc::result<uint64_t> seek(int64_t offset, int whence) override;
+    oc::result<void> truncate(uint64_t size) override;
+
+    bool is_open() override;
+
+    oc::result<void> flush();
+
+    bool is_async();
+
+private:
+    /*! \cond INTERNAL */
+    enum class Mode
+    {
+        None,
+        Read,
+        Write,
+    };
+
+    enum class SlotState
+    {
+        Free,
+        InFlight,
+        Done,
+    };
+
+    struct Slot
+    {
+        unsigned char *data;
+        // File offset of data[0]
+        uint64_t offset;
+        // Number of bytes requested (in flight) or filled (write mode, free)
+        size_t len;
+        // Result of the completed operation
+        int64_t res;
+        bool is_write;
+        SlotState state;
+    };
+
+    oc::result<void> submit(size_t index, bool is_write);
+    oc::result<void> wait_slot(size_t index);
+    void complete_write(size_t index);
+
+    oc::result<void> start_readahead();
+    oc::result<void> drain();
+    oc::result<void> set_mode(Mode mode);
+
+    void clear() noexcept;
+
+    int m_fd;
+    bool m_owned;
+
+    std::unique_ptr<detail::UringQueue> m_queue;
+
+    size_t m_block_size;
+    std::vector<unsigned char> m_buf;
+    std::vector<Slot> m_slots;
+
+    Mode m_mode;
+    // Read mode: oldest outstanding slot. Write mode: slot being filled.
+    size_t m_head;
+    // Read mode: file offset of the next block to read ahead
+    uint64_t m_next_offset;
+
+    // Logical file position
+    uint64_t m_pos;
+
+    // Deferred error from a write that completed asynchronously
+    std::error_code m_error;
+    /*! \endcond */
+};
+
+}
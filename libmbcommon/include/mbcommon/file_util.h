@@ -41,6 +41,7 @@ namespace std2 = std;
 #endif
 
 constexpr size_t DEFAULT_BUFFER_SIZE = 8 * 1024 * 1024;
+constexpr size_t COPY_BUFFER_SIZE = 1024 * 1024;
 
 }
 
@@ -54,8 +55,15 @@ MB_EXPORT oc::result<void> file_read_exact(File &file,
 MB_EXPORT oc::result<void> file_write_exact(File &file,
                                             const void *buf, size_t size);
 
+MB_EXPORT oc::result<void> file_writev_exact(File &file,
+                                             const ConstIoVec *iov,
+                                             size_t count);
+
 MB_EXPORT oc::result<uint64_t> file_read_discard(File &file, uint64_t size);
 
+MB_EXPORT oc::result<uint64_t> file_copy(File &src, File &dst,
+                                         uint64_t size);
+
 MB_EXPORT oc::result<uint64_t> file_move(File &file, uint64_t src,
                                          uint64_t dest, uint64_t size);
 
@@ -79,7 +87,8 @@ private:
     // Pattern to search for
     const void *m_pattern;
     size_t m_pattern_size;
-    // Boyer-Moore searcher (NOTE std::byte does not work on Android)
+    // Boyer-Moore searcher for long patterns (NOTE std::byte does not work on
+    // Android). Short patterns are scanned with memchr() instead.
     std::optional<detail::std2::boyer_moore_searcher<
             const unsigned char *>> m_searcher;
     // Search buffer
@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "mbcommon/common.h"
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <string_view>
+
+#include <cstdint>
+
+#include "mbcommon/outcome.h"
+
+namespace mb
+{
+
+enum class MemoryContext
+{
+    // Booted Android system. Memory is shared with apps.
+    System,
+    // Recovery. Few other processes are running.
+    Recovery,
+};
+
+class MB_EXPORT MemoryBudget
+{
+public:
+    static constexpr uint64_t UNLIMITED = UINT64_MAX;
+
+    explicit MemoryBudget(uint64_t limit = UNLIMITED);
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(MemoryBudget)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(MemoryBudget)
+
+    void set_limit(uint64_t limit);
+    void set_auto_limit(MemoryContext context);
+    uint64_t limit();
+    uint64_t used() const;
+
+    bool try_reserve(uint64_t size);
+    void release(uint64_t size);
+
+    void set_spill_dir(std::string dir);
+    std::string spill_dir() const;
+
+    static MemoryBudget & instance();
+
+private:
+    /*! \cond INTERNAL */
+    void resolve_auto_limit();
+
+    std::atomic_uint64_t m_limit;
+    std::atomic_uint64_t m_used;
+    // Whether the limit still needs to be computed for m_auto_context
+    std::atomic_bool m_auto_pending;
+
+    mutable std::mutex m_mutex;
+    MemoryContext m_auto_context;
+    std::string m_spill_dir;
+    /*! \endcond */
+};
+
+MB_EXPORT oc::result<uint64_t> memory_budget_limit(std::string_view meminfo,
+                                                   MemoryContext context);
+MB_EXPORT oc::result<void> memory_budget_configure(MemoryContext context);
+
+}
@@ -0,0 +1,137 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "mbcommon/common.h"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+namespace mb::perf
+{
+
+enum class MetricType
+{
+    Counter,
+    Histogram,
+};
+
+class MB_EXPORT Metric
+{
+public:
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(Metric)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(Metric)
+
+    const std::string & name() const;
+    MetricType type() const;
+    const Metric * next() const;
+
+protected:
+    Metric(std::string name, MetricType type);
+    ~Metric();
+
+private:
+    std::string m_name;
+    MetricType m_type;
+    // Next metric in the registry. Immutable once registered.
+    Metric *m_next;
+};
+
+class MB_EXPORT Counter : public Metric
+{
+public:
+    explicit Counter(std::string name);
+
+    void add(uint64_t n = 1)
+    {
+        m_value.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    uint64_t value() const;
+    void reset();
+
+private:
+    std::atomic_uint64_t m_value;
+};
+
+class MB_EXPORT Histogram : public Metric
+{
+public:
+    // Bucket 0 holds zeros. Bucket i holds values in [2^(i-1), 2^i).
+    static constexpr size_t BUCKETS = 65;
+
+    explicit Histogram(std::string name);
+
+    void record(uint64_t value);
+
+    uint64_t count() const;
+    uint64_t sum() const;
+    uint64_t max() const;
+    uint64_t bucket(size_t index) const;
+    void reset();
+
+private:
+    std::array<std::atomic_uint64_t, BUCKETS> m_buckets;
+    std::atomic_uint64_t m_count;
+    std::atomic_uint64_t m_sum;
+    std::atomic_uint64_t m_max;
+};
+
+// Records the lifetime of the object in microseconds
+class MB_EXPORT ScopedTimer
+{
+public:
+    explicit ScopedTimer(Histogram &histogram);
+    ~ScopedTimer();
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(ScopedTimer)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(ScopedTimer)
+
+private:
+    Histogram &m_histogram;
+    std::chrono::steady_clock::time_point m_start;
+};
+
+struct MetricSnapshot
+{
+    std::string name;
+    MetricType type;
+    // Counter value or number of histogram samples
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+    std::vector<uint64_t> buckets;
+};
+
+MB_EXPORT const Metric * first_metric();
+
+MB_EXPORT std::vector<MetricSnapshot> snapshot();
+MB_EXPORT void reset();
+
+MB_EXPORT uint64_t percentile(const MetricSnapshot &metric, double p);
+MB_EXPORT std::string format_snapshot(const std::vector<MetricSnapshot> &metrics);
+
+}
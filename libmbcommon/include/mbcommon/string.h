@@ -21,8 +21,10 @@
 
 #include "mbcommon/common.h"
 
+#include <iterator>
 #include <string>
 #include <string_view>
+#include <type_traits>
 #include <vector>
 
 #include <cstdarg>
@@ -59,6 +61,17 @@ MB_EXPORT std::string format(const char *fmt, ...);
 MB_EXPORT oc::result<std::string> format_v_safe(const char *fmt, va_list ap);
 MB_EXPORT std::string format_v(const char *fmt, va_list ap);
 
+// String formatting into existing buffers
+MB_PRINTF(2, 3)
+MB_EXPORT oc::result<size_t> format_to(std::string &out, const char *fmt, ...);
+MB_PRINTF(3, 4)
+MB_EXPORT oc::result<size_t> format_to(char *buf, size_t size,
+                                       const char *fmt, ...);
+MB_EXPORT oc::result<size_t> format_to_v(std::string &out, const char *fmt,
+                                         va_list ap);
+MB_EXPORT oc::result<size_t> format_to_v(char *buf, size_t size,
+                                         const char *fmt, va_list ap);
+
 // String starts with
 MB_EXPORT bool starts_with(std::string_view string, std::string_view prefix);
 MB_EXPORT bool starts_with_icase(std::string_view string, std::string_view prefix);
@@ -128,6 +141,162 @@ std::vector<std::string_view> split_sv(std::string_view str, const DelimType &de
     return result;
 }
 
+/*!
+ * \brief Forward iterator over the components of a split string
+ *
+ * \sa split_range()
+ */
+template<typename DelimType>
+class SplitIterator
+{
+public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = std::string_view;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const std::string_view *;
+    using reference = const std::string_view &;
+
+    /*! \brief Construct end iterator */
+    SplitIterator()
+        : m_str()
+        , m_delim()
+        , m_begin(std::string_view::npos)
+        , m_end(std::string_view::npos)
+        , m_token()
+    {
+    }
+
+    /*! \brief Construct iterator pointing to the first component of \p str */
+    SplitIterator(std::string_view str, DelimType delim)
+        : m_str(str)
+        , m_delim(delim)
+        , m_begin(0)
+        , m_end(str.find_first_of(delim))
+        , m_token(str.substr(0, m_end))
+    {
+    }
+
+    reference operator*() const
+    {
+        return m_token;
+    }
+
+    pointer operator->() const
+    {
+        return &m_token;
+    }
+
+    SplitIterator & operator++()
+    {
+        if (m_end == std::string_view::npos) {
+            m_begin = std::string_view::npos;
+            m_token = {};
+        } else {
+            m_begin = m_end + 1;
+            m_end = m_str.find_first_of(m_delim, m_begin);
+            m_token = m_str.substr(m_begin, m_end == std::string_view::npos
+                    ? std::string_view::npos : m_end - m_begin);
+        }
+        return *this;
+    }
+
+    SplitIterator operator++(int)
+    {
+        SplitIterator prev(*this);
+        ++*this;
+        return prev;
+    }
+
+    bool operator==(const SplitIterator &other) const
+    {
+        return m_begin == other.m_begin;
+    }
+
+    bool operator!=(const SplitIterator &other) const
+    {
+        return !(*this == other);
+    }
+
+private:
+    /*! \cond INTERNAL */
+    std::string_view m_str;
+    DelimType m_delim;
+    // Start of the current component or npos if past the end
+    std::size_t m_begin;
+    // Position of the delimiter after the current component or npos if it is
+    // the last component
+    std::size_t m_end;
+    std::string_view m_token;
+    /*! \endcond */
+};
+
+/*!
+ * \brief Lazily evaluated range of the components of a split string
+ *
+ * \sa split_range()
+ */
+template<typename DelimType>
+class SplitRange
+{
+public:
+    using iterator = SplitIterator<DelimType>;
+    using const_iterator = iterator;
+
+    SplitRange(std::string_view str, DelimType delim)
+        : m_str(str)
+        , m_delim(delim)
+    {
+    }
+
+    iterator begin() const
+    {
+        return iterator(m_str, m_delim);
+    }
+
+    iterator end() const
+    {
+        return iterator();
+    }
+
+private:
+    /*! \cond INTERNAL */
+    std::string_view m_str;
+    DelimType m_delim;
+    /*! \endcond */
+};
+
+/*! \cond INTERNAL */
+namespace detail
+{
+
+template<typename DelimType>
+using SplitDelimType = std::conditional_t<
+    std::is_same_v<std::decay_t<DelimType>, char>, char, std::string_view
+>;
+
+}
+/*! \endcond */
+
+/*!
+ * \brief Split a string by one or more delimiters without allocating
+ *
+ * This yields the same components as split_sv(), but they are computed on
+ * demand while iterating and no memory is allocated. The returned range
+ * references \p str and \p delim (if it is a string), so both must outlive
+ * the range.
+ *
+ * \param str Input string
+ * \param delim `char` delimiter or string of delimiters
+ *
+ * \return Forward range of split components as string views
+ */
+template<typename DelimType>
+SplitRange<detail::SplitDelimType<DelimType>>
+split_range(std::string_view str, const DelimType &delim)
+{
+    return {str, delim};
+}
+
 /*!
  * \brief Join a string from a container of components
  *
@@ -0,0 +1,107 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "mbcommon/common.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <cstddef>
+
+namespace mb
+{
+
+using Task = std::function<void()>;
+
+MB_EXPORT void set_thread_limit(unsigned int limit);
+MB_EXPORT unsigned int thread_limit();
+MB_EXPORT unsigned int thread_count(unsigned int min_threads,
+                                    unsigned int max_threads);
+
+class MB_EXPORT ThreadPool
+{
+public:
+    explicit ThreadPool(unsigned int threads);
+    ~ThreadPool();
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(ThreadPool)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(ThreadPool)
+
+    unsigned int threads() const;
+
+    void submit(Task task);
+    bool run_pending_task();
+
+    static ThreadPool & global();
+
+private:
+    /*! \cond INTERNAL */
+    struct Worker;
+
+    bool pop_task(size_t index, bool own, Task &task);
+    void worker(size_t index);
+
+    std::vector<std::unique_ptr<Worker>> m_workers;
+    std::atomic_size_t m_next;
+
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    // Number of queued tasks. Only incremented while m_mutex is held.
+    std::atomic_size_t m_pending;
+    bool m_stop;
+    /*! \endcond */
+};
+
+class MB_EXPORT TaskGroup
+{
+public:
+    TaskGroup();
+    explicit TaskGroup(ThreadPool &pool);
+    ~TaskGroup();
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(TaskGroup)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(TaskGroup)
+
+    void run(Task task);
+    void wait();
+
+    void cancel();
+    bool is_cancelled() const;
+
+private:
+    /*! \cond INTERNAL */
+    struct State;
+
+    ThreadPool &m_pool;
+    std::shared_ptr<State> m_state;
+    /*! \endcond */
+};
+
+MB_EXPORT void parallel_for(size_t n, unsigned int max_threads,
+                            const std::function<void(size_t)> &fn);
+MB_EXPORT void run_bounded(size_t n, unsigned int max_threads,
+                           const std::function<void(size_t)> &fn);
+
+}
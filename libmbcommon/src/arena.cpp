@@ -0,0 +1,186 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbcommon/arena.h"
+
+#include <algorithm>
+#include <new>
+
+#include <cstdint>
+
+/*!
+ * \file mbcommon/arena.h
+ * \brief Monotonic memory arena
+ *
+ * Typical usage is to give containers that are built and thrown away many
+ * times during one long operation an ArenaAllocator and to release the arena
+ * when the operation is done:
+ *
+ * \code{.cpp}
+ * Arena arena;
+ *
+ * ArenaVector<ArenaString> paths{ArenaAllocator<ArenaString>(arena)};
+ * paths.emplace_back("/system", ArenaAllocator<char>(arena));
+ *
+ * // ...
+ *
+ * paths = ArenaVector<ArenaString>{ArenaAllocator<ArenaString>(arena)};
+ * arena.release();
+ * \endcode
+ */
+
+namespace mb
+{
+
+struct Arena::Block
+{
+    Block *next;
+    size_t size;
+};
+
+/*!
+ * \class Arena
+ *
+ * \brief Monotonic allocator whose memory is freed all at once
+ */
+
+/*!
+ * \brief Construct an empty arena
+ *
+ * No memory is allocated until the first call to allocate().
+ *
+ * \param block_size Size of the blocks that small allocations are carved out
+ *                   of. Allocations larger than a quarter of this get their own
+ *                   block.
+ */
+Arena::Arena(size_t block_size)
+    : m_head(nullptr)
+    , m_cur(nullptr)
+    , m_end(nullptr)
+    , m_block_size(std::max<size_t>(block_size, 256))
+    , m_allocated(0)
+    , m_reserved(0)
+{
+}
+
+Arena::~Arena()
+{
+    release();
+}
+
+/*!
+ * \brief Allocate memory from the arena
+ *
+ * The memory remains valid until release() is called or the arena is
+ * destroyed.
+ *
+ * \param size Number of bytes
+ * \param alignment Alignment (must be a power of 2)
+ *
+ * \return Pointer to uninitialized memory
+ */
+void * Arena::allocate(size_t size, size_t alignment)
+{
+    if (size == 0) {
+        size = 1;
+    }
+
+    m_allocated += size;
+
+    if (m_cur) {
+        auto addr = reinterpret_cast<uintptr_t>(m_cur);
+        auto aligned = (addr + alignment - 1) & ~(uintptr_t(alignment) - 1);
+        auto padding = static_cast<size_t>(aligned - addr);
+
+        if (padding <= static_cast<size_t>(m_end - m_cur)
+                && size <= static_cast<size_t>(m_end - m_cur) - padding) {
+            m_cur += padding + size;
+            return reinterpret_cast<void *>(aligned);
+        }
+    }
+
+    return allocate_block(size, alignment);
+}
+
+void * Arena::allocate_block(size_t size, size_t alignment)
+{
+    // Space for the header and worst case alignment padding
+    size_t header = sizeof(Block) + alignment;
+    bool dedicated = size > m_block_size / 4;
+    size_t block_size = header + (dedicated ? size : m_block_size);
+
+    auto block = static_cast<Block *>(::operator new(block_size));
+    block->size = block_size;
+    m_reserved += block_size;
+
+    char *data = reinterpret_cast<char *>(block + 1);
+    auto addr = reinterpret_cast<uintptr_t>(data);
+    auto aligned = (addr + alignment - 1) & ~(uintptr_t(alignment) - 1);
+    char *ptr = data + (aligned - addr);
+
+    if (dedicated && m_head) {
+        // Keep carving small allocations out of the current block
+        block->next = m_head->next;
+        m_head->next = block;
+    } else {
+        block->next = m_head;
+        m_head = block;
+        m_cur = ptr + size;
+        m_end = reinterpret_cast<char *>(block) + block_size;
+    }
+
+    return ptr;
+}
+
+/*!
+ * \brief Free all memory allocated from the arena
+ *
+ * All pointers previously returned by allocate() become invalid.
+ */
+void Arena::release()
+{
+    while (m_head) {
+        Block *next = m_head->next;
+        ::operator delete(m_head);
+        m_head = next;
+    }
+
+    m_cur = nullptr;
+    m_end = nullptr;
+    m_allocated = 0;
+    m_reserved = 0;
+}
+
+/*!
+ * \brief Total number of bytes requested since the last release()
+ */
+size_t Arena::bytes_allocated() const
+{
+    return m_allocated;
+}
+
+/*!
+ * \brief Total size of the blocks currently held by the arena
+ */
+size_t Arena::bytes_reserved() const
+{
+    return m_reserved;
+}
+
+}
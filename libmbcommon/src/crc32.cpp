@@ -0,0 +1,454 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbcommon/crc32.h"
+
+#include <array>
+
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#  include <cpuid.h>
+#  include <immintrin.h>
+#  define CRC32_HAVE_PCLMUL
+#elif defined(__GNUC__) && defined(__aarch64__) && defined(__linux__)
+#  include <sys/auxv.h>
+#  ifndef HWCAP_CRC32
+#    define HWCAP_CRC32 (1 << 7)
+#  endif
+#  define CRC32_HAVE_ARMV8
+#endif
+
+#include "mbcommon/endian.h"
+
+/*!
+ * \file mbcommon/crc32.h
+ * \brief Standard 802.3 CRC32 (same as zlib's crc32())
+ *
+ * The implementation is selected at runtime based on the CPU features
+ * available: ARMv8 CRC32 instructions on aarch64, carry-less multiplication
+ * (PCLMULQDQ) on x86, and slicing-by-8 everywhere else. All implementations
+ * produce identical results.
+ *
+ * The initial value for all functions is 0. Data can be processed in any
+ * number of pieces by passing the previous result as \p crc.
+ */
+
+namespace mb
+{
+
+// Reflected 802.3 polynomial
+constexpr uint32_t CRC32_POLY = 0xedb88320;
+
+// Data smaller than this is hashed directly by crc32_update_repeated()
+constexpr uint64_t REPEATED_DIRECT_THRESHOLD = 64;
+
+// The functions below operate on the raw CRC register (ie. without the
+// initial and final inversion) since the register update is linear.
+
+using Crc32Tables = std::array<std::array<uint32_t, 256>, 8>;
+
+// Tables for slicing-by-8. tables[t][b] is the CRC of byte b followed by t
+// zero bytes.
+static constexpr Crc32Tables make_crc32_tables()
+{
+    Crc32Tables tables = {};
+
+    for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; ++k) {
+            c = c & 1 ? CRC32_POLY ^ (c >> 1) : c >> 1;
+        }
+        tables[0][i] = c;
+    }
+
+    for (size_t t = 1; t < tables.size(); ++t) {
+        for (size_t i = 0; i < 256; ++i) {
+            auto prev = tables[t - 1][i];
+            tables[t][i] = (prev >> 8) ^ tables[0][prev & 0xff];
+        }
+    }
+
+    return tables;
+}
+
+static constexpr Crc32Tables CRC32_TABLES = make_crc32_tables();
+
+static inline uint32_t load_le32(const unsigned char *p)
+{
+    return static_cast<uint32_t>(p[0])
+            | static_cast<uint32_t>(p[1]) << 8
+            | static_cast<uint32_t>(p[2]) << 16
+            | static_cast<uint32_t>(p[3]) << 24;
+}
+
+static uint32_t crc32_raw_generic(uint32_t crc, const unsigned char *p,
+                                  size_t size) noexcept
+{
+    const auto &t = CRC32_TABLES;
+
+    for (; size >= 8; size -= 8) {
+        uint32_t lo = crc ^ load_le32(p);
+        uint32_t hi = load_le32(p + 4);
+
+        crc = t[7][lo & 0xff] ^ t[6][(lo >> 8) & 0xff]
+                ^ t[5][(lo >> 16) & 0xff] ^ t[4][lo >> 24]
+                ^ t[3][hi & 0xff] ^ t[2][(hi >> 8) & 0xff]
+                ^ t[1][(hi >> 16) & 0xff] ^ t[0][hi >> 24];
+        p += 8;
+    }
+
+    for (; size > 0; --size) {
+        crc = t[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    }
+
+    return crc;
+}
+
+#ifdef CRC32_HAVE_PCLMUL
+#define PCLMUL_TARGET __attribute__((target("pclmul,sse4.1")))
+
+PCLMUL_TARGET
+static inline __m128i pclmul_load(const unsigned char *p) noexcept
+{
+    return _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+}
+
+// Multiply both halves of x by the constants in k and add data
+PCLMUL_TARGET
+static inline __m128i pclmul_fold(__m128i x, __m128i k, __m128i data) noexcept
+{
+    __m128i lo = _mm_clmulepi64_si128(x, k, 0x00);
+    __m128i hi = _mm_clmulepi64_si128(x, k, 0x11);
+    return _mm_xor_si128(_mm_xor_si128(hi, lo), data);
+}
+
+// Folds 64 bytes at a time with carry-less multiplication and finishes with a
+// Barrett reduction, as described in Intel's "Fast CRC Computation for Generic
+// Polynomials Using PCLMULQDQ Instruction". The constants are for the
+// bit-reflected 802.3 polynomial.
+PCLMUL_TARGET
+static uint32_t crc32_raw_pclmul(uint32_t crc, const unsigned char *p,
+                                 size_t size) noexcept
+{
+    if (size < 64) {
+        return crc32_raw_generic(crc, p, size);
+    }
+
+    alignas(16) static const uint64_t k1k2[] = { 0x0154442bd4, 0x01c6e41596 };
+    alignas(16) static const uint64_t k3k4[] = { 0x01751997d0, 0x00ccaa009e };
+    alignas(16) static const uint64_t k5k0[] = { 0x0163cd6124, 0x0000000000 };
+    alignas(16) static const uint64_t poly[] = { 0x01db710641, 0x01f7011641 };
+
+    __m128i x1 = _mm_xor_si128(pclmul_load(p), _mm_cvtsi32_si128(
+            static_cast<int>(crc)));
+    __m128i x2 = pclmul_load(p + 16);
+    __m128i x3 = pclmul_load(p + 32);
+    __m128i x4 = pclmul_load(p + 48);
+    p += 64;
+    size -= 64;
+
+    // Fold four 128-bit lanes in parallel
+    __m128i k = _mm_load_si128(reinterpret_cast<const __m128i *>(k1k2));
+
+    for (; size >= 64; size -= 64, p += 64) {
+        x1 = pclmul_fold(x1, k, pclmul_load(p));
+        x2 = pclmul_fold(x2, k, pclmul_load(p + 16));
+        x3 = pclmul_fold(x3, k, pclmul_load(p + 32));
+        x4 = pclmul_fold(x4, k, pclmul_load(p + 48));
+    }
+
+    // Fold the lanes into one
+    k = _mm_load_si128(reinterpret_cast<const __m128i *>(k3k4));
+
+    x1 = pclmul_fold(x1, k, x2);
+    x1 = pclmul_fold(x1, k, x3);
+    x1 = pclmul_fold(x1, k, x4);
+
+    for (; size >= 16; size -= 16, p += 16) {
+        x1 = pclmul_fold(x1, k, pclmul_load(p));
+    }
+
+    // Fold 128 bits to 64 bits
+    const __m128i mask32 = _mm_setr_epi32(~0, 0, ~0, 0);
+
+    x2 = _mm_clmulepi64_si128(x1, k, 0x10);
+    x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+
+    k = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(k5k0));
+
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_clmulepi64_si128(_mm_and_si128(x1, mask32), k, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    // Barrett reduction to 32 bits
+    k = _mm_load_si128(reinterpret_cast<const __m128i *>(poly));
+
+    x2 = _mm_clmulepi64_si128(_mm_and_si128(x1, mask32), k, 0x10);
+    x2 = _mm_clmulepi64_si128(_mm_and_si128(x2, mask32), k, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    crc = static_cast<uint32_t>(_mm_extract_epi32(x1, 1));
+
+    return crc32_raw_generic(crc, p, size);
+}
+
+static bool has_pclmul() noexcept
+{
+    unsigned int eax, ebx, ecx, edx;
+
+    return __get_cpuid(1, &eax, &ebx, &ecx, &edx)
+            && (ecx & bit_PCLMUL) && (ecx & bit_SSE4_1);
+}
+#endif
+
+#ifdef CRC32_HAVE_ARMV8
+// Inline assembly is used instead of the ACLE intrinsics so that this builds
+// without +crc in the target flags. It is only called if the CPU supports it.
+static inline uint32_t armv8_crc32x(uint32_t crc, uint64_t v) noexcept
+{
+    __asm__(".arch_extension crc\n\tcrc32x %w0, %w0, %x1"
+            : "+r"(crc) : "r"(v));
+    return crc;
+}
+
+static inline uint32_t armv8_crc32b(uint32_t crc, uint8_t v) noexcept
+{
+    __asm__(".arch_extension crc\n\tcrc32b %w0, %w0, %w1"
+            : "+r"(crc) : "r"(static_cast<uint32_t>(v)));
+    return crc;
+}
+
+static uint32_t crc32_raw_armv8(uint32_t crc, const unsigned char *p,
+                                size_t size) noexcept
+{
+    for (; size >= sizeof(uint64_t); size -= sizeof(uint64_t)) {
+        uint64_t v;
+        memcpy(&v, p, sizeof(v));
+        crc = armv8_crc32x(crc, mb_le64toh(v));
+        p += sizeof(v);
+    }
+
+    for (; size > 0; --size) {
+        crc = armv8_crc32b(crc, *p++);
+    }
+
+    return crc;
+}
+#endif
+
+struct Crc32Impl
+{
+    const char *name;
+    uint32_t (*fn)(uint32_t, const unsigned char *, size_t) noexcept;
+};
+
+static Crc32Impl select_impl() noexcept
+{
+#if defined(CRC32_HAVE_PCLMUL)
+    if (has_pclmul()) {
+        return {"pclmul", &crc32_raw_pclmul};
+    }
+#elif defined(CRC32_HAVE_ARMV8)
+    if (getauxval(AT_HWCAP) & HWCAP_CRC32) {
+        return {"armv8", &crc32_raw_armv8};
+    }
+#endif
+
+    return {"slice8", &crc32_raw_generic};
+}
+
+static const Crc32Impl & impl() noexcept
+{
+    static const Crc32Impl selected = select_impl();
+    return selected;
+}
+
+static inline uint32_t crc32_raw(uint32_t crc, const unsigned char *p,
+                                 size_t size) noexcept
+{
+    return impl().fn(crc, p, size);
+}
+
+// 32x32 matrix over GF(2). Element i is the column for bit i.
+using Gf2Matrix = std::array<uint32_t, 32>;
+
+static uint32_t gf2_times(const Gf2Matrix &m, uint32_t v) noexcept
+{
+    uint32_t result = 0;
+
+    for (size_t i = 0; v != 0; ++i, v >>= 1) {
+        if (v & 1) {
+            result ^= m[i];
+        }
+    }
+
+    return result;
+}
+
+static Gf2Matrix gf2_square(const Gf2Matrix &m) noexcept
+{
+    Gf2Matrix result;
+
+    for (size_t i = 0; i < m.size(); ++i) {
+        result[i] = gf2_times(m, m[i]);
+    }
+
+    return result;
+}
+
+using ZeroBytesOperators = std::array<Gf2Matrix, 64>;
+
+// ops[k] advances the raw CRC register over 2^k zero bytes
+static ZeroBytesOperators make_zero_bytes_operators() noexcept
+{
+    ZeroBytesOperators ops;
+    Gf2Matrix m;
+
+    // One zero bit
+    m[0] = CRC32_POLY;
+    for (size_t i = 1; i < m.size(); ++i) {
+        m[i] = uint32_t(1) << (i - 1);
+    }
+
+    // 2^3 = 8 zero bits
+    for (int i = 0; i < 3; ++i) {
+        m = gf2_square(m);
+    }
+
+    for (auto &op : ops) {
+        op = m;
+        m = gf2_square(m);
+    }
+
+    return ops;
+}
+
+static const ZeroBytesOperators & zero_bytes_operators() noexcept
+{
+    static const ZeroBytesOperators ops = make_zero_bytes_operators();
+    return ops;
+}
+
+/*!
+ * \brief Update CRC32 with data
+ *
+ * \param crc Previous CRC32 value (0 for new data)
+ * \param buf Data buffer
+ * \param size Size of \p buf
+ *
+ * \return New CRC32 value
+ */
+uint32_t crc32_update(uint32_t crc, const void *buf, size_t size) noexcept
+{
+    return ~crc32_raw(~crc, static_cast<const unsigned char *>(buf), size);
+}
+
+/*!
+ * \brief Update CRC32 with a repeated 32-bit pattern
+ *
+ * This is equivalent to calling crc32_update() on \p size bytes consisting of
+ * the little-endian representation of \p pattern repeated, but runs in
+ * O(log size) time without materializing the data.
+ *
+ * \param crc Previous CRC32 value (0 for new data)
+ * \param pattern 32-bit pattern
+ * \param size Number of bytes
+ *
+ * \return New CRC32 value
+ */
+uint32_t crc32_update_repeated(uint32_t crc, uint32_t pattern,
+                               uint64_t size) noexcept
+{
+    unsigned char bytes[sizeof(uint32_t)];
+    uint32_t pattern_le = mb_htole32(pattern);
+    memcpy(bytes, &pattern_le, sizeof(bytes));
+
+    uint32_t reg = ~crc;
+
+    if (size < REPEATED_DIRECT_THRESHOLD) {
+        for (; size >= sizeof(bytes); size -= sizeof(bytes)) {
+            reg = crc32_raw_generic(reg, bytes, sizeof(bytes));
+        }
+        return ~crc32_raw_generic(reg, bytes, static_cast<size_t>(size));
+    }
+
+    auto const &ops = zero_bytes_operators();
+
+    // One repetition of the pattern is the affine map reg -> A * reg ^ c.
+    // Applying it 2^k times is (A^(2^k), A^(2^k - 1) * c ^ ... ^ c), which can
+    // be computed by repeated squaring. Powers of the same map commute, so
+    // they can be applied to the register in any order. A^(2^k) advances over
+    // 2^(k+2) zero bytes.
+    uint32_t c = crc32_raw_generic(0, bytes, sizeof(bytes));
+    size_t k = 2;
+
+    for (uint64_t count = size / sizeof(bytes); count > 0; count >>= 1, ++k) {
+        if (count & 1) {
+            reg = gf2_times(ops[k], reg) ^ c;
+        }
+        if (count > 1) {
+            c = gf2_times(ops[k], c) ^ c;
+        }
+    }
+
+    return ~crc32_raw_generic(reg, bytes,
+                              static_cast<size_t>(size % sizeof(bytes)));
+}
+
+/*!
+ * \brief Combine the CRC32 values of two consecutive pieces of data
+ *
+ * This allows pieces of data to be checksummed independently (eg. in
+ * parallel) and combined afterwards. It is equivalent to zlib's
+ * crc32_combine() and runs in O(log size2) time.
+ *
+ * \param crc1 CRC32 of the first piece
+ * \param crc2 CRC32 of the second piece
+ * \param size2 Size of the second piece
+ *
+ * \return CRC32 of the first piece followed by the second piece
+ */
+uint32_t crc32_concat(uint32_t crc1, uint32_t crc2, uint64_t size2) noexcept
+{
+    auto const &ops = zero_bytes_operators();
+
+    // Since the register update is linear, the result is crc1 advanced over
+    // size2 zero bytes, xor'd with crc2. The initial and final inversions
+    // cancel out.
+    for (size_t k = 0; size2 != 0; ++k, size2 >>= 1) {
+        if (size2 & 1) {
+            crc1 = gf2_times(ops[k], crc1);
+        }
+    }
+
+    return crc1 ^ crc2;
+}
+
+/*!
+ * \brief Get the name of the implementation selected for this CPU
+ *
+ * \return "pclmul", "armv8", or "slice8"
+ */
+const char * crc32_implementation() noexcept
+{
+    return impl().name;
+}
+
+}
@@ -19,6 +19,10 @@
 
 #include "mbcommon/file.h"
 
+#include <cstdio>
+
+#include "mbcommon/file_error.h"
+
 // File documentation
 
 /*!
@@ -29,6 +33,18 @@
 namespace mb
 {
 
+/*!
+ * \struct IoVec
+ *
+ * \brief Buffer descriptor for File::readv().
+ */
+
+/*!
+ * \struct ConstIoVec
+ *
+ * \brief Buffer descriptor for File::writev().
+ */
+
 /*!
  * \class File
  *
@@ -163,10 +179,214 @@ File::~File() = default;
  *   * Otherwise, a specific error code
  */
 
+/*!
+ * \brief Read from a File handle at the specified offset.
+ *
+ * This function reads data starting at \p offset without changing the file
+ * position of the File handle. If the File implementation does not provide a
+ * native positional read, the default implementation will seek to \p offset,
+ * call File::read(), and then restore the original file position. The default
+ * implementation is therefore not safe to call from multiple threads at the
+ * same time.
+ *
+ * \param[in] offset File offset to read from
+ * \param[out] buf Buffer to read into
+ * \param[in] size Buffer size
+ *
+ * \return
+ *   * Number of bytes read if some bytes are successfully read or EOF is
+ *     reached
+ *   * std::errc::interrupted if the same operation should be reattempted
+ *   * FileError::ArgumentOutOfRange if \p offset cannot be represented as a
+ *     file position
+ *   * FileError::UnsupportedRead if the file does not support reading
+ *   * FileError::UnsupportedSeek if the file does not support seeking
+ *   * Otherwise, a specific error code
+ */
+oc::result<size_t> File::read_at(uint64_t offset, void *buf, size_t size)
+{
+    if (offset > static_cast<uint64_t>(INT64_MAX)) {
+        return FileError::ArgumentOutOfRange;
+    }
+
+    OUTCOME_TRY(orig_pos, seek(0, SEEK_CUR));
+    OUTCOME_TRYV(seek(static_cast<int64_t>(offset), SEEK_SET));
+
+    auto n = read(buf, size);
+
+    OUTCOME_TRYV(seek(static_cast<int64_t>(orig_pos), SEEK_SET));
+
+    return n;
+}
+
+/*!
+ * \brief Write to a File handle at the specified offset.
+ *
+ * This function writes data starting at \p offset without changing the file
+ * position of the File handle. If the File implementation does not provide a
+ * native positional write, the default implementation will seek to \p offset,
+ * call File::write(), and then restore the original file position. The default
+ * implementation is therefore not safe to call from multiple threads at the
+ * same time.
+ *
+ * \note The behavior of this function for files opened in append mode is
+ *       implementation-defined. On Linux, native positional writes to a file
+ *       opened with `O_APPEND` always append to the end of the file.
+ *
+ * \param offset File offset to write to
+ * \param buf Buffer to write from
+ * \param size Buffer size
+ *
+ * \return
+ *   * Number of bytes written if some bytes are successfully written or EOF is
+ *     reached
+ *   * std::errc::interrupted if the same operation should be reattempted
+ *   * FileError::ArgumentOutOfRange if \p offset cannot be represented as a
+ *     file position
+ *   * FileError::UnsupportedWrite if the file does not support writing
+ *   * FileError::UnsupportedSeek if the file does not support seeking
+ *   * Otherwise, a specific error code
+ */
+oc::result<size_t> File::write_at(uint64_t offset,
+                                  const void *buf, size_t size)
+{
+    if (offset > static_cast<uint64_t>(INT64_MAX)) {
+        return FileError::ArgumentOutOfRange;
+    }
+
+    OUTCOME_TRY(orig_pos, seek(0, SEEK_CUR));
+    OUTCOME_TRYV(seek(static_cast<int64_t>(offset), SEEK_SET));
+
+    auto n = write(buf, size);
+
+    OUTCOME_TRYV(seek(static_cast<int64_t>(orig_pos), SEEK_SET));
+
+    return n;
+}
+
+/*!
+ * \brief Read from a File handle into multiple buffers.
+ *
+ * The buffers in \p iov are filled in order. Like File::read(), fewer bytes
+ * than the total size of the buffers may be read. If the File implementation
+ * does not support native scatter reads, the default implementation will call
+ * File::read() for each buffer until a short read occurs.
+ *
+ * \param iov Array of buffers to read into
+ * \param count Number of elements in \p iov
+ *
+ * \return
+ *   * Total number of bytes read if some bytes are successfully read or EOF is
+ *     reached
+ *   * std::errc::interrupted if the same operation should be reattempted
+ *   * FileError::UnsupportedRead if the file does not support reading
+ *   * Otherwise, a specific error code
+ */
+oc::result<size_t> File::readv(const IoVec *iov, size_t count)
+{
+    size_t total = 0;
+
+    for (size_t i = 0; i < count; ++i) {
+        auto n = read(iov[i].data, iov[i].size);
+        if (!n) {
+            // Report the error on the next call if some data was read
+            if (total > 0) {
+                break;
+            }
+            return n.as_failure();
+        }
+
+        total += n.value();
+
+        if (n.value() < iov[i].size) {
+            break;
+        }
+    }
+
+    return total;
+}
+
+/*!
+ * \brief Write to a File handle from multiple buffers.
+ *
+ * The buffers in \p iov are written in order. Like File::write(), fewer bytes
+ * than the total size of the buffers may be written. If the File
+ * implementation does not support native gather writes, the default
+ * implementation will call File::write() for each buffer until a short write
+ * occurs.
+ *
+ * \param iov Array of buffers to write from
+ * \param count Number of elements in \p iov
+ *
+ * \return
+ *   * Total number of bytes written if some bytes are successfully written or
+ *     EOF is reached
+ *   * std::errc::interrupted if the same operation should be reattempted
+ *   * FileError::UnsupportedWrite if the file does not support writing
+ *   * Otherwise, a specific error code
+ */
+oc::result<size_t> File::writev(const ConstIoVec *iov, size_t count)
+{
+    size_t total = 0;
+
+    for (size_t i = 0; i < count; ++i) {
+        auto n = write(iov[i].data, iov[i].size);
+        if (!n) {
+            // Report the error on the next call if some data was written
+            if (total > 0) {
+                break;
+            }
+            return n.as_failure();
+        }
+
+        total += n.value();
+
+        if (n.value() < iov[i].size) {
+            break;
+        }
+    }
+
+    return total;
+}
+
 /*!
  * \brief Check whether file is opened
  *
  * \return Whether file is opened
  */
 
+/*!
+ * \brief Get the native file descriptor backing the File handle.
+ *
+ * This allows utility functions, such as file_copy(), to use kernel-assisted
+ * operations when the File handle is a thin wrapper around a file descriptor.
+ * Implementations that buffer data in userspace must not return the underlying
+ * file descriptor because operating on it directly would bypass the buffer.
+ *
+ * The file position of the returned file descriptor must be the same as the
+ * file position of the File handle.
+ *
+ * \return File descriptor if the File handle is backed by one. Otherwise, -1.
+ */
+int File::native_fd()
+{
+    return -1;
+}
+
+/*!
+ * \brief Get the entire contents of the file if it is directly addressable.
+ *
+ * This allows callers to access the data of memory-backed File handles in
+ * place instead of copying it with read(). The returned region is only valid
+ * until the file is modified or closed. Implementations that buffer data in
+ * userspace must not return the underlying region.
+ *
+ * \return Pointer to and size of the file contents if the File handle is
+ *         backed by memory. Otherwise, std::nullopt.
+ */
+std::optional<ConstIoVec> File::mapped_data()
+{
+    return std::nullopt;
+}
+
 }
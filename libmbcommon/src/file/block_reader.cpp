@@ -0,0 +1,211 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbcommon/file/block_reader.h"
+
+#include <algorithm>
+
+#include <cstdint>
+#include <cstdio>
+
+#include "mbcommon/file_error.h"
+#include "mbcommon/file_util.h"
+
+/*!
+ * \file mbcommon/file/block_reader.h
+ * \brief Read a File in large blocks without copying mapped data
+ */
+
+namespace mb
+{
+
+/*!
+ * \class BlockReader
+ *
+ * \brief Read a File in large blocks without copying mapped data.
+ *
+ * This is meant for feeding stream parsers that take a pointer to the next
+ * block of input, such as libarchive's read callbacks. If the file is memory
+ * mapped (eg. MmapFile or MemoryFile), read() returns pointers into the mapping
+ * and no buffer is allocated. Otherwise, each block is read into an internal
+ * buffer of block_size() bytes. The pointer returned by read() is only valid
+ * until the next call.
+ *
+ * skip() and seek() move the file position without reading anything, so parsers
+ * can jump over data they don't need.
+ */
+
+/*!
+ * \brief Construct unbound BlockReader.
+ *
+ * reset() will need to be called before reading.
+ */
+BlockReader::BlockReader()
+    : BlockReader(nullptr)
+{
+}
+
+/*!
+ * \brief Construct BlockReader for a File.
+ *
+ * \param file File to read from. The caller retains ownership and must keep it
+ *             alive for the lifetime of the BlockReader.
+ * \param block_size Maximum number of bytes returned by each call to read()
+ */
+BlockReader::BlockReader(File *file, size_t block_size)
+    : m_file(file)
+    , m_block_size(std::max<size_t>(block_size, 1))
+{
+}
+
+BlockReader::~BlockReader() = default;
+
+BlockReader::BlockReader(BlockReader &&other) noexcept = default;
+
+BlockReader & BlockReader::operator=(BlockReader &&rhs) noexcept = default;
+
+/*!
+ * \brief Switch to a different File.
+ *
+ * The internal buffer is kept if the block size did not change.
+ *
+ * \param file File to read from
+ * \param block_size Maximum number of bytes returned by each call to read()
+ */
+void BlockReader::reset(File *file, size_t block_size)
+{
+    block_size = std::max<size_t>(block_size, 1);
+
+    if (block_size != m_block_size) {
+        m_buf.reset();
+    }
+
+    m_file = file;
+    m_block_size = block_size;
+}
+
+File * BlockReader::file() const
+{
+    return m_file;
+}
+
+size_t BlockReader::block_size() const
+{
+    return m_block_size;
+}
+
+/*!
+ * \brief Read the next block.
+ *
+ * Short blocks are only returned at EOF.
+ *
+ * \param[out] data Receives a pointer to the block
+ *
+ * \return
+ *   * Size of the block or 0 if EOF is reached
+ *   * An error if the read fails
+ */
+oc::result<size_t> BlockReader::read(const void **data)
+{
+    if (!m_file) {
+        return FileError::InvalidState;
+    }
+
+    if (auto mapped = m_file->mapped_data()) {
+        OUTCOME_TRY(pos, m_file->seek(0, SEEK_CUR));
+
+        if (pos >= mapped->size) {
+            *data = nullptr;
+            return 0;
+        }
+
+        auto n = static_cast<size_t>(std::min<uint64_t>(
+                mapped->size - pos, m_block_size));
+        OUTCOME_TRYV(m_file->seek(static_cast<int64_t>(n), SEEK_CUR));
+
+        *data = static_cast<const unsigned char *>(mapped->data) + pos;
+        return n;
+    }
+
+    if (!m_buf) {
+        m_buf.reset(new unsigned char[m_block_size]);
+    }
+
+    OUTCOME_TRY(n, file_read_retry(*m_file, m_buf.get(), m_block_size));
+
+    *data = m_buf.get();
+    return n;
+}
+
+/*!
+ * \brief Skip over data without reading it.
+ *
+ * For memory mapped files, the skip is clamped to EOF. For other files, the
+ * position may end up past EOF, in which case the next read() returns 0.
+ *
+ * \param size Number of bytes to skip
+ *
+ * \return
+ *   * Number of bytes skipped. This is 0 if the file is not seekable, in which
+ *     case the caller must read and discard the data instead.
+ *   * An error if seeking fails for any other reason
+ */
+oc::result<uint64_t> BlockReader::skip(uint64_t size)
+{
+    if (!m_file) {
+        return FileError::InvalidState;
+    }
+
+    size = std::min<uint64_t>(size, INT64_MAX);
+
+    if (auto mapped = m_file->mapped_data()) {
+        OUTCOME_TRY(pos, m_file->seek(0, SEEK_CUR));
+        size = std::min<uint64_t>(size, pos < mapped->size
+                                  ? mapped->size - pos : 0);
+    }
+
+    if (auto r = m_file->seek(static_cast<int64_t>(size), SEEK_CUR); !r) {
+        if (r.error() == FileErrorC::Unsupported
+                || r.error() == std::errc::invalid_seek) {
+            return 0;
+        }
+        return r.as_failure();
+    }
+
+    return size;
+}
+
+/*!
+ * \brief Set the file position.
+ *
+ * \param offset Offset
+ * \param whence One of `SEEK_SET`, `SEEK_CUR`, or `SEEK_END`
+ *
+ * \return New file position or an error if seeking fails
+ */
+oc::result<uint64_t> BlockReader::seek(int64_t offset, int whence)
+{
+    if (!m_file) {
+        return FileError::InvalidState;
+    }
+
+    return m_file->seek(offset, whence);
+}
+
+}
@@ -0,0 +1,457 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbcommon/file/buffered.h"
+
+#include <algorithm>
+
+#include <cstdio>
+#include <cstring>
+
+#include "mbcommon/file_error.h"
+#include "mbcommon/file_util.h"
+#include "mbcommon/finally.h"
+
+/*!
+ * \file mbcommon/file/buffered.h
+ * \brief Buffered wrapper for other File handles
+ */
+
+namespace mb
+{
+
+/*!
+ * \class BufferedFile
+ *
+ * \brief Add read and write buffering to another File handle.
+ *
+ * This class wraps another File handle and coalesces small reads and writes
+ * into larger operations on the underlying File. Reads are satisfied from a
+ * readahead buffer and writes are accumulated in a write-behind buffer until
+ * the buffer is full, flush() is called, or an operation that requires the
+ * underlying file to be up to date is performed. Seeking within the readahead
+ * buffer does not require any operations on the underlying File.
+ *
+ * Reads or writes that are at least as large as the corresponding buffer are
+ * passed directly to the underlying File. A buffer size of 0 disables
+ * buffering for that direction.
+ *
+ * The underlying File handle is not owned by this class and will not be
+ * closed when this File handle is closed. The underlying File handle must not
+ * be used directly while it is wrapped by a BufferedFile.
+ *
+ * \note Because writes are deferred, errors from writing buffered data may only
+ *       be reported from a later operation, flush(), or close().
+ */
+
+/*!
+ * \brief Construct unbound BufferedFile.
+ *
+ * The File handle will not be bound to any file. open() will need to be called
+ * to wrap a file.
+ */
+BufferedFile::BufferedFile()
+    : File()
+{
+    clear();
+}
+
+/*!
+ * \brief Wrap File handle.
+ *
+ * Construct the file handle and wrap the file. Use is_open() to check if the
+ * file was successfully opened.
+ *
+ * \sa open(File *, size_t, size_t)
+ *
+ * \param file File handle to wrap
+ * \param read_buf_size Size of readahead buffer
+ * \param write_buf_size Size of write-behind buffer
+ */
+BufferedFile::BufferedFile(File *file, size_t read_buf_size,
+                           size_t write_buf_size)
+    : BufferedFile()
+{
+    (void) open(file, read_buf_size, write_buf_size);
+}
+
+BufferedFile::~BufferedFile()
+{
+    (void) close();
+}
+
+/*!
+ * \brief Move construct new File handle.
+ *
+ * \p other will be left in a state as if it was newly constructed with the
+ * default constructor.
+ *
+ * \param other File handle to move from
+ */
+BufferedFile::BufferedFile(BufferedFile &&other) noexcept
+{
+    clear();
+
+    std::swap(m_file, other.m_file);
+    std::swap(m_read_buf_size, other.m_read_buf_size);
+    std::swap(m_write_buf_size, other.m_write_buf_size);
+    std::swap(m_mode, other.m_mode);
+    std::swap(m_buf, other.m_buf);
+    std::swap(m_buf_offset, other.m_buf_offset);
+    std::swap(m_buf_len, other.m_buf_len);
+    std::swap(m_pos, other.m_pos);
+    std::swap(m_pos_known, other.m_pos_known);
+}
+
+/*!
+ * \brief Move assign a File handle
+ *
+ * This file handle will be closed and then \p rhs will be moved into this
+ * object. \p rhs will be left in a state as if it was newly constructed with
+ * the default constructor.
+ *
+ * \param rhs File handle to move from
+ */
+BufferedFile & BufferedFile::operator=(BufferedFile &&rhs) noexcept
+{
+    if (this != &rhs) {
+        (void) close();
+
+        std::swap(m_file, rhs.m_file);
+        std::swap(m_read_buf_size, rhs.m_read_buf_size);
+        std::swap(m_write_buf_size, rhs.m_write_buf_size);
+        std::swap(m_mode, rhs.m_mode);
+        std::swap(m_buf, rhs.m_buf);
+        std::swap(m_buf_offset, rhs.m_buf_offset);
+        std::swap(m_buf_len, rhs.m_buf_len);
+        std::swap(m_pos, rhs.m_pos);
+        std::swap(m_pos_known, rhs.m_pos_known);
+    }
+
+    return *this;
+}
+
+/*!
+ * \brief Wrap File handle.
+ *
+ * If the current file position of \p file can be determined, then positions
+ * reported by this File handle are absolute. Otherwise, they are relative to
+ * the position when this function was called.
+ *
+ * \param file File handle to wrap
+ * \param read_buf_size Size of readahead buffer
+ * \param write_buf_size Size of write-behind buffer
+ *
+ * \return Nothing if the file is successfully opened. Otherwise, the error
+ *         code.
+ */
+oc::result<void> BufferedFile::open(File *file, size_t read_buf_size,
+                                    size_t write_buf_size)
+{
+    if (is_open()) return FileError::InvalidState;
+
+    if (!file || !file->is_open()) {
+        return FileError::InvalidState;
+    }
+
+    m_file = file;
+    m_read_buf_size = read_buf_size;
+    m_write_buf_size = write_buf_size;
+    m_mode = Mode::None;
+    m_buf.resize(std::max(read_buf_size, write_buf_size));
+    m_buf_offset = 0;
+    m_buf_len = 0;
+
+    if (auto pos = file->seek(0, SEEK_CUR)) {
+        m_pos = pos.value();
+        m_pos_known = true;
+    } else {
+        m_pos = 0;
+        m_pos_known = false;
+    }
+
+    return oc::success();
+}
+
+oc::result<void> BufferedFile::close()
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    // Reset to allow opening another file
+    auto reset = finally([&] {
+        clear();
+    });
+
+    return flush();
+}
+
+oc::result<size_t> BufferedFile::read(void *buf, size_t size)
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    if (m_mode == Mode::Write) {
+        OUTCOME_TRYV(flush());
+    }
+
+    if (m_mode == Mode::Read) {
+        auto avail = static_cast<size_t>(m_buf_offset + m_buf_len - m_pos);
+        if (avail > 0) {
+            size_t n = std::min(avail, size);
+            memcpy(buf, m_buf.data() + (m_pos - m_buf_offset), n);
+            m_pos += n;
+            return n;
+        }
+
+        // Buffer is exhausted, so the underlying file is at m_pos
+        m_mode = Mode::None;
+        m_buf_len = 0;
+    }
+
+    if (size == 0) {
+        return 0;
+    }
+
+    // Bypass the buffer for large reads
+    if (size >= m_read_buf_size) {
+        OUTCOME_TRY(n, m_file->read(buf, size));
+        m_pos += n;
+        return n;
+    }
+
+    OUTCOME_TRY(n, m_file->read(m_buf.data(), m_read_buf_size));
+
+    m_mode = Mode::Read;
+    m_buf_offset = m_pos;
+    m_buf_len = n;
+
+    size_t to_copy = std::min(n, size);
+    memcpy(buf, m_buf.data(), to_copy);
+    m_pos += to_copy;
+
+    return to_copy;
+}
+
+oc::result<size_t> BufferedFile::write(const void *buf, size_t size)
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    if (m_mode == Mode::Read) {
+        OUTCOME_TRYV(discard_read_buffer());
+    } else if (m_mode == Mode::Write && size > m_write_buf_size - m_buf_len) {
+        OUTCOME_TRYV(flush());
+    }
+
+    // Bypass the buffer for large writes
+    if (size >= m_write_buf_size) {
+        OUTCOME_TRY(n, m_file->write(buf, size));
+        m_pos += n;
+        return n;
+    }
+
+    if (m_mode != Mode::Write) {
+        m_mode = Mode::Write;
+        m_buf_offset = m_pos;
+        m_buf_len = 0;
+    }
+
+    memcpy(m_buf.data() + m_buf_len, buf, size);
+    m_buf_len += size;
+    m_pos += size;
+
+    return size;
+}
+
+oc::result<uint64_t> BufferedFile::seek(int64_t offset, int whence)
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    // Try to seek within the readahead buffer
+    if (m_mode == Mode::Read
+            && (whence == SEEK_CUR || (whence == SEEK_SET && m_pos_known))) {
+        uint64_t target;
+
+        if (whence == SEEK_SET) {
+            if (offset < 0) {
+                return FileError::ArgumentOutOfRange;
+            }
+            target = static_cast<uint64_t>(offset);
+        } else if (offset < 0) {
+            if (static_cast<uint64_t>(-offset) > m_pos) {
+                return FileError::ArgumentOutOfRange;
+            }
+            target = m_pos - static_cast<uint64_t>(-offset);
+        } else {
+            target = m_pos + static_cast<uint64_t>(offset);
+        }
+
+        if (target >= m_buf_offset && target - m_buf_offset <= m_buf_len) {
+            m_pos = target;
+            return m_pos;
+        }
+    }
+
+    if (m_mode == Mode::Read && whence != SEEK_CUR) {
+        // No need to restore the underlying file position before an absolute
+        // seek unless the seek fails
+        auto ret = m_file->seek(offset, whence);
+        if (!ret) {
+            OUTCOME_TRYV(discard_read_buffer());
+            return ret.as_failure();
+        }
+
+        m_mode = Mode::None;
+        m_buf_len = 0;
+        m_pos = ret.value();
+        m_pos_known = true;
+
+        return ret;
+    }
+
+    OUTCOME_TRYV(reset_buffer());
+
+    // The underlying file is now at m_pos, so SEEK_CUR can be passed through
+    OUTCOME_TRY(new_pos, m_file->seek(offset, whence));
+
+    m_pos = new_pos;
+    m_pos_known = true;
+
+    return new_pos;
+}
+
+oc::result<void> BufferedFile::truncate(uint64_t size)
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    OUTCOME_TRYV(reset_buffer());
+
+    return m_file->truncate(size);
+}
+
+/*!
+ * \brief Read from the underlying file at the specified offset.
+ *
+ * Pending writes are flushed first. The readahead buffer is not used.
+ *
+ * \sa File::read_at()
+ */
+oc::result<size_t> BufferedFile::read_at(uint64_t offset,
+                                         void *buf, size_t size)
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    if (m_mode == Mode::Write) {
+        OUTCOME_TRYV(flush());
+    }
+
+    return m_file->read_at(offset, buf, size);
+}
+
+/*!
+ * \brief Write to the underlying file at the specified offset.
+ *
+ * Pending writes are flushed and the readahead buffer is discarded first.
+ *
+ * \sa File::write_at()
+ */
+oc::result<size_t> BufferedFile::write_at(uint64_t offset,
+                                          const void *buf, size_t size)
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    OUTCOME_TRYV(reset_buffer());
+
+    return m_file->write_at(offset, buf, size);
+}
+
+bool BufferedFile::is_open()
+{
+    return m_file;
+}
+
+/*!
+ * \brief Write pending data to the underlying file.
+ *
+ * If an error occurs, the pending data is discarded.
+ *
+ * \return Nothing if the pending data is successfully written. Otherwise, the
+ *         error code.
+ */
+oc::result<void> BufferedFile::flush()
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    if (m_mode != Mode::Write) {
+        return oc::success();
+    }
+
+    auto reset = finally([&] {
+        m_mode = Mode::None;
+        m_buf_len = 0;
+    });
+
+    return file_write_exact(*m_file, m_buf.data(), m_buf_len);
+}
+
+/*!
+ * \brief Discard readahead buffer and restore the underlying file position.
+ */
+oc::result<void> BufferedFile::discard_read_buffer()
+{
+    auto end = m_buf_offset + m_buf_len;
+
+    if (end != m_pos) {
+        OUTCOME_TRYV(m_file->seek(-static_cast<int64_t>(end - m_pos),
+                                  SEEK_CUR));
+    }
+
+    m_mode = Mode::None;
+    m_buf_len = 0;
+
+    return oc::success();
+}
+
+/*!
+ * \brief Make the underlying file consistent with the logical file position.
+ */
+oc::result<void> BufferedFile::reset_buffer()
+{
+    switch (m_mode) {
+    case Mode::Read:
+        return discard_read_buffer();
+    case Mode::Write:
+        return flush();
+    default:
+        return oc::success();
+    }
+}
+
+void BufferedFile::clear() noexcept
+{
+    m_file = nullptr;
+    m_read_buf_size = 0;
+    m_write_buf_size = 0;
+    m_mode = Mode::None;
+    std::vector<unsigned char>().swap(m_buf);
+    m_buf_offset = 0;
+    m_buf_len = 0;
+    m_pos = 0;
+    m_pos_known = false;
+}
+
+}
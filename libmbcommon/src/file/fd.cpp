@@ -19,6 +19,8 @@
 
 #include "mbcommon/file/fd.h"
 
+#include <algorithm>
+
 #include <cerrno>
 #include <climits>
 #include <cstdlib>
@@ -26,6 +28,9 @@
 
 #include <fcntl.h>
 #include <sys/stat.h>
+#ifndef _WIN32
+#  include <sys/uio.h>
+#endif
 #include <unistd.h>
 
 #include "mbcommon/error_code.h"
@@ -81,6 +86,20 @@ struct RealFdFileFuncs : public FdFileFuncs
         return lseek64(fd, offset, whence);
     }
 
+#ifndef _WIN32
+    ssize_t fn_pread64(int fd, void *buf, size_t count,
+                       off64_t offset) override
+    {
+        return pread64(fd, buf, count, offset);
+    }
+
+    ssize_t fn_pwrite64(int fd, const void *buf, size_t count,
+                        off64_t offset) override
+    {
+        return pwrite64(fd, buf, count, offset);
+    }
+#endif
+
     ssize_t fn_read(int fd, void *buf, size_t count) override
     {
         return read(fd, buf, count);
@@ -90,6 +109,18 @@ struct RealFdFileFuncs : public FdFileFuncs
     {
         return write(fd, buf, count);
     }
+
+#ifndef _WIN32
+    ssize_t fn_readv(int fd, const struct iovec *iov, int iovcnt) override
+    {
+        return readv(fd, iov, iovcnt);
+    }
+
+    ssize_t fn_writev(int fd, const struct iovec *iov, int iovcnt) override
+    {
+        return writev(fd, iov, iovcnt);
+    }
+#endif
 };
 /*! \endcond */
 
@@ -135,6 +166,39 @@ static int convert_mode(FileOpenMode mode)
     return ret;
 }
 
+#ifndef _WIN32
+//! Maximum number of buffers passed to a single readv()/writev() call
+static constexpr size_t MAX_IOV_COUNT = 64;
+
+/*!
+ * Convert up to MAX_IOV_COUNT buffer descriptors to `struct iovec` so that the
+ * total size does not exceed SSIZE_MAX.
+ *
+ * \return Number of elements populated in \p out
+ */
+template<typename T>
+static int to_native_iov(const T *iov, size_t count, struct iovec *out)
+{
+    size_t n = std::min(count, MAX_IOV_COUNT);
+    size_t remain = SSIZE_MAX;
+
+    for (size_t i = 0; i < n; ++i) {
+        size_t size = std::min(iov[i].size, remain);
+
+        out[i].iov_base = const_cast<void *>(iov[i].data);
+        out[i].iov_len = size;
+        remain -= size;
+
+        if (size < iov[i].size) {
+            n = i + 1;
+            break;
+        }
+    }
+
+    return static_cast<int>(n);
+}
+#endif
+
 /*! \endcond */
 
 /*!
@@ -483,11 +547,139 @@ oc::result<void> FdFile::truncate(uint64_t size)
     return oc::success();
 }
 
+/*!
+ * \brief Read from file descriptor at the specified offset.
+ *
+ * On Unix-like systems, this uses `pread64()`, which does not change the file
+ * position and may safely be called from multiple threads on the same File
+ * handle. On Windows, this falls back to File::read_at().
+ *
+ * \sa File::read_at()
+ */
+oc::result<size_t> FdFile::read_at(uint64_t offset, void *buf, size_t size)
+{
+    if (!is_open()) return FileError::InvalidState;
+
+#ifdef _WIN32
+    return File::read_at(offset, buf, size);
+#else
+    if (offset > static_cast<uint64_t>(INT64_MAX)) {
+        return FileError::ArgumentOutOfRange;
+    }
+
+    if (size > SSIZE_MAX) {
+        size = SSIZE_MAX;
+    }
+
+    ssize_t n = m_funcs->fn_pread64(m_fd, buf, size,
+                                    static_cast<off64_t>(offset));
+    if (n < 0) {
+        return ec_from_errno();
+    }
+
+    return static_cast<size_t>(n);
+#endif
+}
+
+/*!
+ * \brief Write to file descriptor at the specified offset.
+ *
+ * On Unix-like systems, this uses `pwrite64()`, which does not change the file
+ * position and may safely be called from multiple threads on the same File
+ * handle. On Windows, this falls back to File::write_at().
+ *
+ * \sa File::write_at()
+ */
+oc::result<size_t> FdFile::write_at(uint64_t offset,
+                                    const void *buf, size_t size)
+{
+    if (!is_open()) return FileError::InvalidState;
+
+#ifdef _WIN32
+    return File::write_at(offset, buf, size);
+#else
+    if (offset > static_cast<uint64_t>(INT64_MAX)) {
+        return FileError::ArgumentOutOfRange;
+    }
+
+    if (size > SSIZE_MAX) {
+        size = SSIZE_MAX;
+    }
+
+    ssize_t n = m_funcs->fn_pwrite64(m_fd, buf, size,
+                                     static_cast<off64_t>(offset));
+    if (n < 0) {
+        return ec_from_errno();
+    }
+
+    return static_cast<size_t>(n);
+#endif
+}
+
+/*!
+ * \brief Read from file descriptor into multiple buffers.
+ *
+ * On Unix-like systems, this uses a single `readv()` call for up to 64
+ * buffers. On Windows, this falls back to File::readv().
+ *
+ * \sa File::readv()
+ */
+oc::result<size_t> FdFile::readv(const IoVec *iov, size_t count)
+{
+    if (!is_open()) return FileError::InvalidState;
+
+#ifdef _WIN32
+    return File::readv(iov, count);
+#else
+    struct iovec native_iov[MAX_IOV_COUNT];
+    int native_count = to_native_iov(iov, count, native_iov);
+
+    ssize_t n = m_funcs->fn_readv(m_fd, native_iov, native_count);
+    if (n < 0) {
+        return ec_from_errno();
+    }
+
+    return static_cast<size_t>(n);
+#endif
+}
+
+/*!
+ * \brief Write to file descriptor from multiple buffers.
+ *
+ * On Unix-like systems, this uses a single `writev()` call for up to 64
+ * buffers. On Windows, this falls back to File::writev().
+ *
+ * \sa File::writev()
+ */
+oc::result<size_t> FdFile::writev(const ConstIoVec *iov, size_t count)
+{
+    if (!is_open()) return FileError::InvalidState;
+
+#ifdef _WIN32
+    return File::writev(iov, count);
+#else
+    struct iovec native_iov[MAX_IOV_COUNT];
+    int native_count = to_native_iov(iov, count, native_iov);
+
+    ssize_t n = m_funcs->fn_writev(m_fd, native_iov, native_count);
+    if (n < 0) {
+        return ec_from_errno();
+    }
+
+    return static_cast<size_t>(n);
+#endif
+}
+
 bool FdFile::is_open()
 {
     return m_fd >= 0;
 }
 
+int FdFile::native_fd()
+{
+    return m_fd;
+}
+
 void FdFile::clear() noexcept
 {
     m_fd = -1;
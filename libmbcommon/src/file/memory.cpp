@@ -43,6 +43,13 @@ namespace mb
  * \class MemoryFile
  *
  * \brief Open file from statically or dynamically sized memory buffers.
+ *
+ * Dynamically sized buffers grow geometrically as data is written past the end,
+ * so writing a file piece by piece requires only a logarithmic number of
+ * reallocations. The allocation may therefore be larger than the size reported
+ * through `size_ptr`. Use shrink_to_fit() to release the excess space once
+ * writing is complete and reserve() to preallocate space if the final size is
+ * known in advance.
  */
 
 /*!
@@ -111,6 +118,7 @@ MemoryFile::MemoryFile(MemoryFile &&other) noexcept
     std::swap(m_is_open, other.m_is_open);
     std::swap(m_data, other.m_data);
     std::swap(m_size, other.m_size);
+    std::swap(m_capacity, other.m_capacity);
     std::swap(m_data_ptr, other.m_data_ptr);
     std::swap(m_size_ptr, other.m_size_ptr);
     std::swap(m_pos, other.m_pos);
@@ -134,6 +142,7 @@ MemoryFile & MemoryFile::operator=(MemoryFile &&rhs) noexcept
         std::swap(m_is_open, rhs.m_is_open);
         std::swap(m_data, rhs.m_data);
         std::swap(m_size, rhs.m_size);
+        std::swap(m_capacity, rhs.m_capacity);
         std::swap(m_data_ptr, rhs.m_data_ptr);
         std::swap(m_size_ptr, rhs.m_size_ptr);
         std::swap(m_pos, rhs.m_pos);
@@ -159,6 +168,7 @@ oc::result<void> MemoryFile::open(void *buf, size_t size)
     m_is_open = true;
     m_data = buf;
     m_size = size;
+    m_capacity = size;
     m_data_ptr = nullptr;
     m_size_ptr = nullptr;
     m_pos = 0;
@@ -183,6 +193,7 @@ oc::result<void> MemoryFile::open(void **buf_ptr, size_t *size_ptr)
     m_is_open = true;
     m_data = *buf_ptr;
     m_size = *size_ptr;
+    m_capacity = *size_ptr;
     m_data_ptr = buf_ptr;
     m_size_ptr = size_ptr;
     m_pos = 0;
@@ -203,59 +214,20 @@ oc::result<void> MemoryFile::close()
 
 oc::result<size_t> MemoryFile::read(void *buf, size_t size)
 {
-    if (!is_open()) return FileError::InvalidState;
-
-    size_t to_read = 0;
-    if (m_pos < m_size) {
-        to_read = std::min(m_size - m_pos, size);
-    }
+    OUTCOME_TRY(n, read_at(m_pos, buf, size));
 
-    memcpy(buf, static_cast<char *>(m_data) + m_pos, to_read);
-    m_pos += to_read;
+    m_pos += n;
 
-    return to_read;
+    return n;
 }
 
 oc::result<size_t> MemoryFile::write(const void *buf, size_t size)
 {
-    if (!is_open()) return FileError::InvalidState;
+    OUTCOME_TRY(n, write_at(m_pos, buf, size));
 
-    if (m_pos > SIZE_MAX - size) {
-        return FileError::ArgumentOutOfRange;
-    }
-
-    size_t desired_size = m_pos + size;
-    size_t to_write = size;
+    m_pos += n;
 
-    if (desired_size > m_size) {
-        if (m_fixed_size) {
-            to_write = m_pos <= m_size ? m_size - m_pos : 0;
-        } else {
-            // Enlarge buffer
-            void *new_data = realloc(m_data, desired_size);
-            if (!new_data) {
-                return ec_from_errno();
-            }
-
-            // Zero-initialize new space
-            std::fill_n(static_cast<char *>(new_data) + m_size,
-                        desired_size - m_size, 0);
-
-            m_data = new_data;
-            m_size = desired_size;
-            if (m_data_ptr) {
-                *m_data_ptr = m_data;
-            }
-            if (m_size_ptr) {
-                *m_size_ptr = m_size;
-            }
-        }
-    }
-
-    memcpy(static_cast<char *>(m_data) + m_pos, buf, to_write);
-    m_pos += to_write;
-
-    return to_write;
+    return n;
 }
 
 oc::result<uint64_t> MemoryFile::seek(int64_t offset, int whence)
@@ -304,29 +276,135 @@ oc::result<void> MemoryFile::truncate(uint64_t size)
     if (m_fixed_size) {
         // Cannot truncate fixed buffer
         return FileError::UnsupportedTruncate;
-    } else {
-        void *new_data = realloc(m_data, static_cast<size_t>(size));
-        if (!new_data) {
-            return ec_from_errno();
+    } else if (size > SIZE_MAX) {
+        return FileError::ArgumentOutOfRange;
+    }
+
+    return resize(static_cast<size_t>(size));
+}
+
+/*!
+ * \brief Read from memory buffer at the specified offset.
+ *
+ * This does not change the file position.
+ *
+ * \sa File::read_at()
+ */
+oc::result<size_t> MemoryFile::read_at(uint64_t offset,
+                                       void *buf, size_t size)
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    size_t to_read = 0;
+    if (offset < m_size) {
+        auto pos = static_cast<size_t>(offset);
+        to_read = std::min(m_size - pos, size);
+
+        memcpy(buf, static_cast<char *>(m_data) + pos, to_read);
+    }
+
+    return to_read;
+}
+
+/*!
+ * \brief Write to memory buffer at the specified offset.
+ *
+ * This does not change the file position. If the memory buffer is dynamically
+ * sized, it will be enlarged as needed.
+ *
+ * \sa File::write_at()
+ */
+oc::result<size_t> MemoryFile::write_at(uint64_t offset,
+                                        const void *buf, size_t size)
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    if (offset > SIZE_MAX || static_cast<size_t>(offset) > SIZE_MAX - size) {
+        return FileError::ArgumentOutOfRange;
+    }
+
+    auto pos = static_cast<size_t>(offset);
+    size_t desired_size = pos + size;
+    size_t to_write = size;
+
+    if (desired_size > m_size) {
+        if (m_fixed_size) {
+            to_write = pos <= m_size ? m_size - pos : 0;
+        } else {
+            OUTCOME_TRYV(resize(desired_size));
         }
+    }
 
-        // Zero-initialize new space
-        if (size > m_size) {
-            std::fill_n(static_cast<char *>(new_data) + m_size,
-                        static_cast<size_t>(size) - m_size, 0);
+    memcpy(static_cast<char *>(m_data) + pos, buf, to_write);
+
+    return to_write;
+}
+
+/*!
+ * \brief Read from memory buffer into multiple buffers.
+ *
+ * \sa File::readv()
+ */
+oc::result<size_t> MemoryFile::readv(const IoVec *iov, size_t count)
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    size_t total = 0;
+
+    for (size_t i = 0; i < count; ++i) {
+        OUTCOME_TRY(n, read_at(m_pos, iov[i].data, iov[i].size));
+
+        m_pos += n;
+        total += n;
+
+        if (n < iov[i].size) {
+            break;
         }
+    }
 
-        m_data = new_data;
-        m_size = static_cast<size_t>(size);
-        if (m_data_ptr) {
-            *m_data_ptr = m_data;
+    return total;
+}
+
+/*!
+ * \brief Write to memory buffer from multiple buffers.
+ *
+ * If the memory buffer is dynamically sized, it will be enlarged only once to
+ * fit all of the buffers.
+ *
+ * \sa File::writev()
+ */
+oc::result<size_t> MemoryFile::writev(const ConstIoVec *iov, size_t count)
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    size_t end = m_pos;
+
+    for (size_t i = 0; i < count; ++i) {
+        if (iov[i].size > SIZE_MAX - end) {
+            return FileError::ArgumentOutOfRange;
         }
-        if (m_size_ptr) {
-            *m_size_ptr = m_size;
+        end += iov[i].size;
+    }
+
+    // Enlarge buffer up front to avoid multiple reallocations
+    if (!m_fixed_size && end > m_size) {
+        OUTCOME_TRYV(resize(end));
+    }
+
+    size_t total = 0;
+
+    for (size_t i = 0; i < count; ++i) {
+        OUTCOME_TRY(n, write_at(m_pos, iov[i].data, iov[i].size));
+
+        m_pos += n;
+        total += n;
+
+        if (n < iov[i].size) {
+            break;
         }
     }
 
-    return oc::success();
+    return total;
 }
 
 bool MemoryFile::is_open()
@@ -334,11 +412,139 @@ bool MemoryFile::is_open()
     return m_is_open;
 }
 
+std::optional<ConstIoVec> MemoryFile::mapped_data()
+{
+    if (!is_open()) {
+        return std::nullopt;
+    }
+
+    return ConstIoVec{m_data, m_size};
+}
+
+/*!
+ * \brief Preallocate space for a dynamically sized memory buffer.
+ *
+ * This does not change the size of the file. Writes that do not extend the
+ * file beyond \p capacity bytes are guaranteed not to reallocate the buffer.
+ *
+ * \param capacity Minimum number of bytes to allocate
+ *
+ * \return
+ *   * Nothing if the space is successfully allocated
+ *   * FileError::UnsupportedWrite if the memory buffer has a fixed size and
+ *     \p capacity is larger than the buffer
+ *   * Otherwise, a specific error code
+ */
+oc::result<void> MemoryFile::reserve(size_t capacity)
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    if (capacity <= m_capacity) {
+        return oc::success();
+    } else if (m_fixed_size) {
+        return FileError::UnsupportedWrite;
+    }
+
+    void *new_data = realloc(m_data, capacity);
+    if (!new_data) {
+        return ec_from_errno();
+    }
+
+    m_data = new_data;
+    m_capacity = capacity;
+    if (m_data_ptr) {
+        *m_data_ptr = m_data;
+    }
+
+    return oc::success();
+}
+
+/*!
+ * \brief Release unused space of a dynamically sized memory buffer.
+ *
+ * \return Nothing if the buffer is successfully shrunk or there is no unused
+ *         space. Otherwise, the error code.
+ */
+oc::result<void> MemoryFile::shrink_to_fit()
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    // realloc() with a size of 0 may free the buffer
+    if (m_fixed_size || m_size == 0 || m_capacity == m_size) {
+        return oc::success();
+    }
+
+    void *new_data = realloc(m_data, m_size);
+    if (!new_data) {
+        return ec_from_errno();
+    }
+
+    m_data = new_data;
+    m_capacity = m_size;
+    if (m_data_ptr) {
+        *m_data_ptr = m_data;
+    }
+
+    return oc::success();
+}
+
+/*!
+ * \brief Get number of bytes that can be stored without reallocating.
+ *
+ * \return Allocated size of the memory buffer. For fixed size buffers, this is
+ *         the buffer size.
+ */
+size_t MemoryFile::capacity()
+{
+    return m_capacity;
+}
+
+/*!
+ * Set the size of a dynamically sized memory buffer. If the allocation needs to
+ * grow, it is at least doubled. New space is zero-initialized.
+ */
+oc::result<void> MemoryFile::resize(size_t size)
+{
+    if (size > m_capacity) {
+        size_t new_capacity = std::max(
+                size, m_capacity > SIZE_MAX / 2 ? SIZE_MAX : m_capacity * 2);
+
+        void *new_data = realloc(m_data, new_capacity);
+        if (!new_data && new_capacity > size) {
+            // Retry without the extra space
+            new_capacity = size;
+            new_data = realloc(m_data, new_capacity);
+        }
+        if (!new_data) {
+            return ec_from_errno();
+        }
+
+        m_data = new_data;
+        m_capacity = new_capacity;
+        if (m_data_ptr) {
+            *m_data_ptr = m_data;
+        }
+    }
+
+    // Zero-initialize new space
+    if (size > m_size) {
+        std::fill_n(static_cast<char *>(m_data) + m_size, size - m_size, 0);
+    }
+
+    m_size = size;
+    if (m_size_ptr) {
+        *m_size_ptr = m_size;
+    }
+
+    return oc::success();
+}
+
 void MemoryFile::clear() noexcept
 {
     m_is_open = false;
     m_data = nullptr;
     m_size = 0;
+    m_capacity = 0;
     m_data_ptr = nullptr;
     m_size_ptr = nullptr;
     m_pos = 0;
@@ -0,0 +1,439 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbcommon/file/mmap.h"
+
+#include <algorithm>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "mbcommon/error_code.h"
+#include "mbcommon/file_error.h"
+#include "mbcommon/finally.h"
+#include "mbcommon/locale.h"
+
+/*!
+ * \file mbcommon/file/mmap.h
+ * \brief Open file as a read-only memory mapping
+ */
+
+namespace mb
+{
+
+/*!
+ * \class MmapFile
+ *
+ * \brief Open file as a read-only memory mapping.
+ *
+ * The entire file is mapped into memory when it is opened. In addition to the
+ * File interface, the mapped bytes can be accessed directly with data() and
+ * size(), which allows callers to process the file without copying it into
+ * intermediate buffers.
+ *
+ * Regular files and block devices are supported. Since the file is mapped in
+ * its entirety, opening files larger than the address space (eg. > 4 GiB on
+ * 32-bit systems) will fail with `std::errc::file_too_large`.
+ */
+
+/*!
+ * \brief Construct unbound MmapFile.
+ *
+ * The File handle will not be bound to any file. One of the open functions will
+ * need to be called to open a file.
+ */
+MmapFile::MmapFile()
+    : File()
+{
+    clear();
+}
+
+/*!
+ * \brief Open File handle from file descriptor.
+ *
+ * Construct the file handle and open the file. Use is_open() to check if the
+ * file was successfully opened.
+ *
+ * \sa open(int)
+ *
+ * \param fd File descriptor
+ */
+MmapFile::MmapFile(int fd)
+    : MmapFile()
+{
+    (void) open(fd);
+}
+
+/*!
+ * \brief Open File handle from a multi-byte filename.
+ *
+ * Construct the file handle and open the file. Use is_open() to check if the
+ * file was successfully opened.
+ *
+ * \sa open(const std::string &)
+ *
+ * \param filename MBS filename
+ */
+MmapFile::MmapFile(const std::string &filename)
+    : MmapFile()
+{
+    (void) open(filename);
+}
+
+/*!
+ * \brief Open File handle from a wide-character filename.
+ *
+ * Construct the file handle and open the file. Use is_open() to check if the
+ * file was successfully opened.
+ *
+ * \sa open(const std::wstring &)
+ *
+ * \param filename WCS filename
+ */
+MmapFile::MmapFile(const std::wstring &filename)
+    : MmapFile()
+{
+    (void) open(filename);
+}
+
+MmapFile::~MmapFile()
+{
+    (void) close();
+}
+
+/*!
+ * \brief Move construct new File handle.
+ *
+ * \p other will be left in a state as if it was newly constructed with the
+ * default constructor.
+ *
+ * \param other File handle to move from
+ */
+MmapFile::MmapFile(MmapFile &&other) noexcept
+{
+    clear();
+
+    std::swap(m_is_open, other.m_is_open);
+    std::swap(m_data, other.m_data);
+    std::swap(m_size, other.m_size);
+    std::swap(m_pos, other.m_pos);
+}
+
+/*!
+ * \brief Move assign a File handle
+ *
+ * This file handle will be closed and then \p rhs will be moved into this
+ * object. \p rhs will be left in a state as if it was newly constructed with
+ * the default constructor.
+ *
+ * \param rhs File handle to move from
+ */
+MmapFile & MmapFile::operator=(MmapFile &&rhs) noexcept
+{
+    if (this != &rhs) {
+        (void) close();
+
+        std::swap(m_is_open, rhs.m_is_open);
+        std::swap(m_data, rhs.m_data);
+        std::swap(m_size, rhs.m_size);
+        std::swap(m_pos, rhs.m_pos);
+    }
+
+    return *this;
+}
+
+/*!
+ * \brief Map file descriptor.
+ *
+ * The file descriptor is not owned by the File handle and may be closed by the
+ * caller once this function returns. The file position of \p fd is not
+ * changed.
+ *
+ * \param fd File descriptor
+ *
+ * \return Nothing if the file is successfully mapped. Otherwise, the error
+ *         code.
+ */
+oc::result<void> MmapFile::open(int fd)
+{
+    if (is_open()) return FileError::InvalidState;
+
+    struct stat sb;
+
+    if (fstat(fd, &sb) < 0) {
+        return ec_from_errno();
+    }
+
+    if (S_ISDIR(sb.st_mode)) {
+        return std::make_error_code(std::errc::is_a_directory);
+    }
+
+    uint64_t file_size;
+
+    if (S_ISBLK(sb.st_mode)) {
+        // st_size is not meaningful for block devices
+        off64_t orig_pos = lseek64(fd, 0, SEEK_CUR);
+        if (orig_pos < 0) {
+            return ec_from_errno();
+        }
+
+        off64_t end_pos = lseek64(fd, 0, SEEK_END);
+        if (end_pos < 0) {
+            return ec_from_errno();
+        }
+
+        if (lseek64(fd, orig_pos, SEEK_SET) < 0) {
+            return ec_from_errno();
+        }
+
+        file_size = static_cast<uint64_t>(end_pos);
+    } else {
+        file_size = static_cast<uint64_t>(sb.st_size);
+    }
+
+    if (file_size > SIZE_MAX) {
+        return std::make_error_code(std::errc::file_too_large);
+    }
+
+    void *data = nullptr;
+
+    // Mapping zero bytes is not allowed
+    if (file_size > 0) {
+        data = mmap(nullptr, static_cast<size_t>(file_size), PROT_READ,
+                    MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            return ec_from_errno();
+        }
+    }
+
+    m_is_open = true;
+    m_data = data;
+    m_size = static_cast<size_t>(file_size);
+    m_pos = 0;
+
+    return oc::success();
+}
+
+/*!
+ * \brief Map file from a multi-byte filename.
+ *
+ * \param filename MBS filename
+ *
+ * \return Nothing if the file is successfully mapped. Otherwise, the error
+ *         code.
+ */
+oc::result<void> MmapFile::open(const std::string &filename)
+{
+    if (is_open()) return FileError::InvalidState;
+
+    int fd = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return ec_from_errno();
+    }
+
+    // The mapping remains valid after the file descriptor is closed
+    auto close_fd = finally([&] {
+        ::close(fd);
+    });
+
+    return open(fd);
+}
+
+/*!
+ * \brief Map file from a wide-character filename.
+ *
+ * \p filename is converted to MBS using wcs_to_mbs() before being passed to
+ * `open()`.
+ *
+ * \param filename WCS filename
+ *
+ * \return Nothing if the file is successfully mapped. Otherwise, the error
+ *         code.
+ */
+oc::result<void> MmapFile::open(const std::wstring &filename)
+{
+    if (is_open()) return FileError::InvalidState;
+
+    auto converted = wcs_to_mbs(filename);
+    if (!converted) {
+        return FileError::CannotConvertEncoding;
+    }
+
+    return open(converted.value());
+}
+
+oc::result<void> MmapFile::close()
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    // Reset to allow opening another file
+    auto reset = finally([&] {
+        clear();
+    });
+
+    if (m_data && munmap(m_data, m_size) < 0) {
+        return ec_from_errno();
+    }
+
+    return oc::success();
+}
+
+oc::result<size_t> MmapFile::read(void *buf, size_t size)
+{
+    OUTCOME_TRY(n, read_at(m_pos, buf, size));
+
+    m_pos += n;
+
+    return n;
+}
+
+oc::result<size_t> MmapFile::write(const void *buf, size_t size)
+{
+    (void) buf;
+    (void) size;
+
+    if (!is_open()) return FileError::InvalidState;
+
+    return FileError::UnsupportedWrite;
+}
+
+oc::result<uint64_t> MmapFile::seek(int64_t offset, int whence)
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    switch (whence) {
+    case SEEK_SET:
+        if (offset < 0 || static_cast<uint64_t>(offset) > SIZE_MAX) {
+            return FileError::ArgumentOutOfRange;
+        }
+        return m_pos = static_cast<size_t>(offset);
+    case SEEK_CUR:
+        if (offset < 0) {
+            if (static_cast<uint64_t>(-offset) > m_pos) {
+                return FileError::ArgumentOutOfRange;
+            }
+            return m_pos -= static_cast<size_t>(-offset);
+        } else {
+            if (static_cast<uint64_t>(offset) > SIZE_MAX - m_pos) {
+                return FileError::ArgumentOutOfRange;
+            }
+            return m_pos += static_cast<size_t>(offset);
+        }
+    case SEEK_END:
+        if (offset < 0) {
+            if (static_cast<uint64_t>(-offset) > m_size) {
+                return FileError::ArgumentOutOfRange;
+            }
+            return m_pos = m_size - static_cast<size_t>(-offset);
+        } else {
+            if (static_cast<uint64_t>(offset) > SIZE_MAX - m_size) {
+                return FileError::ArgumentOutOfRange;
+            }
+            return m_pos = m_size + static_cast<size_t>(offset);
+        }
+    default:
+        MB_UNREACHABLE("Invalid whence argument: %d", whence);
+    }
+}
+
+oc::result<void> MmapFile::truncate(uint64_t size)
+{
+    (void) size;
+
+    if (!is_open()) return FileError::InvalidState;
+
+    return FileError::UnsupportedTruncate;
+}
+
+/*!
+ * \brief Read from mapping at the specified offset.
+ *
+ * This does not change the file position and may safely be called from
+ * multiple threads on the same File handle.
+ *
+ * \sa File::read_at()
+ */
+oc::result<size_t> MmapFile::read_at(uint64_t offset, void *buf, size_t size)
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    size_t to_read = 0;
+    if (offset < m_size) {
+        auto pos = static_cast<size_t>(offset);
+        to_read = std::min(m_size - pos, size);
+
+        memcpy(buf, static_cast<unsigned char *>(m_data) + pos, to_read);
+    }
+
+    return to_read;
+}
+
+bool MmapFile::is_open()
+{
+    return m_is_open;
+}
+
+std::optional<ConstIoVec> MmapFile::mapped_data()
+{
+    if (!is_open()) {
+        return std::nullopt;
+    }
+
+    return ConstIoVec{m_data, m_size};
+}
+
+/*!
+ * \brief Get pointer to the mapped data.
+ *
+ * The pointer remains valid until the File handle is closed.
+ *
+ * \return Pointer to the first byte of the mapping or nullptr if the file is
+ *         not open or is empty
+ */
+const unsigned char * MmapFile::data() const
+{
+    return static_cast<const unsigned char *>(m_data);
+}
+
+/*!
+ * \brief Get size of the mapped data.
+ *
+ * \return Size of the mapping or 0 if the file is not open
+ */
+size_t MmapFile::size() const
+{
+    return m_size;
+}
+
+void MmapFile::clear() noexcept
+{
+    m_is_open = false;
+    m_data = nullptr;
+    m_size = 0;
+    m_pos = 0;
+}
+
+}
@@ -20,6 +20,7 @@
 #include "mbcommon/file/posix.h"
 
 #include <cerrno>
+#include <climits>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
@@ -64,6 +65,11 @@ struct RealPosixFileFuncs : public PosixFileFuncs
         return ferror(stream);
     }
 
+    int fn_fflush(FILE *stream) override
+    {
+        return fflush(stream);
+    }
+
     int fn_fileno(FILE *stream) override
     {
         return fileno(stream);
@@ -106,6 +112,20 @@ struct RealPosixFileFuncs : public PosixFileFuncs
     {
         return ftruncate64(fd, length);
     }
+
+#ifndef _WIN32
+    ssize_t fn_pread64(int fd, void *buf, size_t count,
+                       off64_t offset) override
+    {
+        return pread64(fd, buf, count, offset);
+    }
+
+    ssize_t fn_pwrite64(int fd, const void *buf, size_t count,
+                        off64_t offset) override
+    {
+        return pwrite64(fd, buf, count, offset);
+    }
+#endif
 };
 /*! \endcond */
 
@@ -535,6 +555,106 @@ oc::result<void> PosixFile::truncate(uint64_t size)
     return oc::success();
 }
 
+/*!
+ * \brief Read from file at the specified offset.
+ *
+ * If the `FILE *` stream is backed by a file descriptor, the stream's buffers
+ * are flushed and `pread64()` is used to read from the file descriptor
+ * directly. Otherwise, or on Windows, this falls back to File::read_at().
+ *
+ * \sa File::read_at()
+ */
+oc::result<size_t> PosixFile::read_at(uint64_t offset, void *buf, size_t size)
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    if (!m_can_seek) {
+        return FileError::UnsupportedSeek;
+    }
+
+#ifdef _WIN32
+    return File::read_at(offset, buf, size);
+#else
+    int fd = m_funcs->fn_fileno(m_fp);
+    if (fd < 0) {
+        // fileno() not supported for fp
+        return File::read_at(offset, buf, size);
+    }
+
+    if (offset > static_cast<uint64_t>(INT64_MAX)) {
+        return FileError::ArgumentOutOfRange;
+    }
+
+    if (size > SSIZE_MAX) {
+        size = SSIZE_MAX;
+    }
+
+    // Ensure that pending writes are visible to pread64()
+    if (m_funcs->fn_fflush(m_fp) == EOF) {
+        return ec_from_errno();
+    }
+
+    ssize_t n = m_funcs->fn_pread64(fd, buf, size,
+                                    static_cast<off64_t>(offset));
+    if (n < 0) {
+        return ec_from_errno();
+    }
+
+    return static_cast<size_t>(n);
+#endif
+}
+
+/*!
+ * \brief Write to file at the specified offset.
+ *
+ * If the `FILE *` stream is backed by a file descriptor, the stream's buffers
+ * are flushed and `pwrite64()` is used to write to the file descriptor
+ * directly. Otherwise, or on Windows, this falls back to File::write_at().
+ *
+ * \sa File::write_at()
+ */
+oc::result<size_t> PosixFile::write_at(uint64_t offset,
+                                       const void *buf, size_t size)
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    if (!m_can_seek) {
+        return FileError::UnsupportedSeek;
+    }
+
+#ifdef _WIN32
+    return File::write_at(offset, buf, size);
+#else
+    int fd = m_funcs->fn_fileno(m_fp);
+    if (fd < 0) {
+        // fileno() not supported for fp
+        return File::write_at(offset, buf, size);
+    }
+
+    if (offset > static_cast<uint64_t>(INT64_MAX)) {
+        return FileError::ArgumentOutOfRange;
+    }
+
+    if (size > SSIZE_MAX) {
+        size = SSIZE_MAX;
+    }
+
+    // Ensure that buffered data does not later overwrite the new data and that
+    // the read buffer is discarded
+    if (m_funcs->fn_fflush(m_fp) == EOF) {
+        return ec_from_errno();
+    }
+
+    ssize_t n = m_funcs->fn_pwrite64(fd, buf, size,
+                                     static_cast<off64_t>(offset));
+    if (n < 0) {
+        return ec_from_errno();
+    }
+
+    return static_cast<size_t>(n);
+#endif
+}
+
 bool PosixFile::is_open()
 {
     return m_fp;
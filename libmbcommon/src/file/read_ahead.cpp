@@ -0,0 +1,368 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbcommon/file/read_ahead.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <cstring>
+
+#include "mbcommon/file_error.h"
+
+/*!
+ * \file mbcommon/file/read_ahead.h
+ * \brief Threaded readahead wrapper for other File handles
+ */
+
+namespace mb
+{
+
+/*! \cond INTERNAL */
+struct ReadAheadFile::State
+{
+    struct Buffer
+    {
+        std::vector<unsigned char> data;
+        // Number of valid bytes in data
+        size_t size;
+    };
+
+    std::mutex mutex;
+    // Signaled when a buffer is filled or the reader thread stops
+    std::condition_variable filled_cv;
+    // Signaled when a buffer is released or the reader thread should stop
+    std::condition_variable released_cv;
+
+    std::vector<Buffer> buffers;
+    // Index of the buffer being consumed
+    size_t head = 0;
+    // Number of filled buffers, starting at head
+    size_t filled = 0;
+    // Bytes already consumed from the head buffer
+    size_t head_pos = 0;
+
+    // Set by the reader thread when the underlying file reaches EOF or fails
+    bool eof = false;
+    std::error_code error;
+    // Set by close() to make the reader thread exit
+    bool stop = false;
+
+    std::thread thread;
+
+    void run(File &file);
+};
+
+void ReadAheadFile::State::run(File &file)
+{
+    std::unique_lock lock(mutex);
+
+    while (true) {
+        released_cv.wait(lock, [&] {
+            return stop || filled < buffers.size();
+        });
+        if (stop) {
+            return;
+        }
+
+        // The buffer after the filled ones is owned by this thread until it
+        // is marked as filled
+        auto &buf = buffers[(head + filled) % buffers.size()];
+
+        lock.unlock();
+
+        auto n = file.read(buf.data.data(), buf.data.size());
+        while (!n && n.error() == std::errc::interrupted) {
+            n = file.read(buf.data.data(), buf.data.size());
+        }
+
+        lock.lock();
+
+        if (!n) {
+            error = n.error();
+        } else if (n.value() == 0) {
+            eof = true;
+        } else {
+            buf.size = n.value();
+            ++filled;
+        }
+
+        filled_cv.notify_one();
+
+        if (!n || eof) {
+            return;
+        }
+    }
+}
+/*! \endcond */
+
+/*!
+ * \class ReadAheadFile
+ *
+ * \brief Read another File handle on a background thread.
+ *
+ * This class wraps another File handle and reads it sequentially from a
+ * background thread into a ring of buffers. Reads from this File handle are
+ * satisfied from the filled buffers, so that the work done by the underlying
+ * File (eg. decompressing an archive entry) overlaps with the work done by the
+ * caller between reads (eg. writing to a block device).
+ *
+ * Only sequential reading is supported. Writing, seeking, and truncation are
+ * not supported. To callers that probe for seekability (eg. SparseFile), this
+ * File handle behaves the same as a pipe.
+ *
+ * The underlying File handle is not owned by this class and will not be
+ * closed when this File handle is closed. The underlying File handle must not
+ * be used in any way while it is wrapped by a ReadAheadFile since it is
+ * accessed from another thread. If the underlying File reports an error, the
+ * error is returned once all data read before the error has been consumed.
+ */
+
+/*!
+ * \brief Construct unbound ReadAheadFile.
+ *
+ * The File handle will not be bound to any file. open() will need to be called
+ * to wrap a file.
+ */
+ReadAheadFile::ReadAheadFile()
+    : File()
+{
+    clear();
+}
+
+/*!
+ * \brief Wrap File handle.
+ *
+ * Construct the file handle and wrap the file. Use is_open() to check if the
+ * file was successfully opened.
+ *
+ * \sa open(File *, size_t, size_t)
+ *
+ * \param file File handle to wrap
+ * \param buffer_count Number of buffers
+ * \param buffer_size Size of each buffer
+ */
+ReadAheadFile::ReadAheadFile(File *file, size_t buffer_count,
+                             size_t buffer_size)
+    : ReadAheadFile()
+{
+    (void) open(file, buffer_count, buffer_size);
+}
+
+ReadAheadFile::~ReadAheadFile()
+{
+    (void) close();
+}
+
+/*!
+ * \brief Move construct new File handle.
+ *
+ * \p other will be left in a state as if it was newly constructed with the
+ * default constructor.
+ *
+ * \param other File handle to move from
+ */
+ReadAheadFile::ReadAheadFile(ReadAheadFile &&other) noexcept
+{
+    clear();
+
+    std::swap(m_file, other.m_file);
+    std::swap(m_state, other.m_state);
+}
+
+/*!
+ * \brief Move assign a File handle
+ *
+ * This file handle will be closed and then \p rhs will be moved into this
+ * object. \p rhs will be left in a state as if it was newly constructed with
+ * the default constructor.
+ *
+ * \param rhs File handle to move from
+ */
+ReadAheadFile & ReadAheadFile::operator=(ReadAheadFile &&rhs) noexcept
+{
+    if (this != &rhs) {
+        (void) close();
+
+        std::swap(m_file, rhs.m_file);
+        std::swap(m_state, rhs.m_state);
+    }
+
+    return *this;
+}
+
+/*!
+ * \brief Wrap File handle.
+ *
+ * The background thread starts reading immediately. Up to
+ * `buffer_count * buffer_size` bytes will be read ahead of the caller.
+ *
+ * \param file File handle to wrap
+ * \param buffer_count Number of buffers (must be at least 2 for reading and
+ *                     consuming to overlap)
+ * \param buffer_size Size of each buffer
+ *
+ * \return
+ *   * Nothing if the file is successfully opened
+ *   * FileError::InvalidState if this File handle is already open or \p file
+ *     is not open
+ *   * std::errc::invalid_argument if \p buffer_count or \p buffer_size is 0
+ */
+oc::result<void> ReadAheadFile::open(File *file, size_t buffer_count,
+                                     size_t buffer_size)
+{
+    if (is_open()) return FileError::InvalidState;
+
+    if (!file || !file->is_open()) {
+        return FileError::InvalidState;
+    } else if (buffer_count == 0 || buffer_size == 0) {
+        return std::errc::invalid_argument;
+    }
+
+    auto state = std::make_unique<State>();
+    state->buffers.resize(buffer_count);
+    for (auto &buf : state->buffers) {
+        buf.data.resize(buffer_size);
+        buf.size = 0;
+    }
+
+    state->thread = std::thread(&State::run, state.get(), std::ref(*file));
+
+    m_file = file;
+    m_state = std::move(state);
+
+    return oc::success();
+}
+
+/*!
+ * \brief Stop the background thread and unwrap the File handle.
+ *
+ * Any data that was read ahead, but not consumed, is discarded. The position
+ * of the underlying File handle is unspecified.
+ *
+ * \return Always returns nothing if the file is open
+ */
+oc::result<void> ReadAheadFile::close()
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    {
+        std::lock_guard lock(m_state->mutex);
+        m_state->stop = true;
+    }
+    m_state->released_cv.notify_one();
+
+    // Waits for an in-progress read of the underlying file to finish
+    m_state->thread.join();
+
+    clear();
+
+    return oc::success();
+}
+
+oc::result<size_t> ReadAheadFile::read(void *buf, size_t size)
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    auto &s = *m_state;
+    auto out = static_cast<unsigned char *>(buf);
+    size_t total = 0;
+
+    std::unique_lock lock(s.mutex);
+
+    while (total < size) {
+        // Only block if nothing has been read yet so that callers can process
+        // data as soon as it is available
+        if (s.filled == 0) {
+            if (total > 0) {
+                break;
+            }
+
+            s.filled_cv.wait(lock, [&] {
+                return s.filled > 0 || s.eof || s.error;
+            });
+
+            if (s.filled == 0) {
+                if (s.error) {
+                    return s.error;
+                }
+                break;
+            }
+        }
+
+        auto &head = s.buffers[s.head];
+
+        // The head buffer is not written by the reader thread while it is
+        // filled, so it can be copied without holding the lock
+        lock.unlock();
+
+        auto n = std::min(size - total, head.size - s.head_pos);
+        memcpy(out + total, head.data.data() + s.head_pos, n);
+        total += n;
+
+        lock.lock();
+
+        s.head_pos += n;
+
+        if (s.head_pos == head.size) {
+            s.head = (s.head + 1) % s.buffers.size();
+            --s.filled;
+            s.head_pos = 0;
+            s.released_cv.notify_one();
+        }
+    }
+
+    return total;
+}
+
+oc::result<size_t> ReadAheadFile::write(const void *buf, size_t size)
+{
+    (void) buf;
+    (void) size;
+    return FileError::UnsupportedWrite;
+}
+
+oc::result<uint64_t> ReadAheadFile::seek(int64_t offset, int whence)
+{
+    (void) offset;
+    (void) whence;
+    return FileError::UnsupportedSeek;
+}
+
+oc::result<void> ReadAheadFile::truncate(uint64_t size)
+{
+    (void) size;
+    return FileError::UnsupportedTruncate;
+}
+
+bool ReadAheadFile::is_open()
+{
+    return m_file;
+}
+
+void ReadAheadFile::clear() noexcept
+{
+    m_file = nullptr;
+    m_state.reset();
+}
+
+}
@@ -0,0 +1,540 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbcommon/file/spill.h"
+
+#include <algorithm>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "mbcommon/error_code.h"
+#include "mbcommon/file_error.h"
+#include "mbcommon/file_util.h"
+#include "mbcommon/memory_budget.h"
+#include "mbcommon/perf.h"
+
+/*!
+ * \file mbcommon/file/spill.h
+ * \brief Open an in-memory file that moves to disk when memory is short
+ */
+
+namespace mb
+{
+
+static perf::Counter g_spilled_files("common.spill.files");
+static perf::Counter g_spilled_bytes("common.spill.bytes");
+
+/*!
+ * \class SpillFile
+ *
+ * \brief Dynamically sized memory buffer backed by a MemoryBudget.
+ *
+ * The file behaves like a dynamically sized MemoryFile as long as its
+ * allocation can be reserved from the budget. Once a reservation is refused
+ * (or the allocation itself fails), the contents are moved to an unlinked
+ * temporary file in MemoryBudget::spill_dir() and all further operations go
+ * to that file. Either way, the temporary storage disappears when the file is
+ * closed.
+ *
+ * mapped_data() is only available while the contents are in memory, so
+ * consumers that use it as a fast path must handle falling back to read_at().
+ */
+
+/*!
+ * \brief Construct unbound SpillFile.
+ *
+ * The File handle will not be bound to any file. One of the open functions will
+ * need to be called to open a file.
+ */
+SpillFile::SpillFile()
+    : File()
+{
+    clear();
+}
+
+/*!
+ * \brief Open empty file that reserves memory from \p budget.
+ *
+ * \sa open(MemoryBudget &)
+ */
+SpillFile::SpillFile(MemoryBudget &budget)
+    : SpillFile()
+{
+    (void) open(budget);
+}
+
+SpillFile::~SpillFile()
+{
+    (void) close();
+}
+
+/*!
+ * \brief Move construct new File handle.
+ *
+ * \p other will be left in a state as if it was newly constructed with the
+ * default constructor.
+ *
+ * \param other File handle to move from
+ */
+SpillFile::SpillFile(SpillFile &&other) noexcept
+{
+    clear();
+
+    std::swap(m_is_open, other.m_is_open);
+    std::swap(m_budget, other.m_budget);
+    std::swap(m_data, other.m_data);
+    std::swap(m_capacity, other.m_capacity);
+    std::swap(m_spilled, other.m_spilled);
+    std::swap(m_file, other.m_file);
+    std::swap(m_size, other.m_size);
+    std::swap(m_pos, other.m_pos);
+}
+
+/*!
+ * \brief Move assign a File handle
+ *
+ * This file handle will be closed and then \p rhs will be moved into this
+ * object. \p rhs will be left in a state as if it was newly constructed with
+ * the default constructor.
+ *
+ * \param rhs File handle to move from
+ */
+SpillFile & SpillFile::operator=(SpillFile &&rhs) noexcept
+{
+    if (this != &rhs) {
+        (void) close();
+
+        std::swap(m_is_open, rhs.m_is_open);
+        std::swap(m_budget, rhs.m_budget);
+        std::swap(m_data, rhs.m_data);
+        std::swap(m_capacity, rhs.m_capacity);
+        std::swap(m_spilled, rhs.m_spilled);
+        std::swap(m_file, rhs.m_file);
+        std::swap(m_size, rhs.m_size);
+        std::swap(m_pos, rhs.m_pos);
+    }
+
+    return *this;
+}
+
+/*!
+ * \brief Open empty file that reserves memory from the process-wide budget.
+ *
+ * \sa MemoryBudget::instance()
+ */
+oc::result<void> SpillFile::open()
+{
+    return open(MemoryBudget::instance());
+}
+
+/*!
+ * \brief Open empty file that reserves memory from \p budget.
+ *
+ * \param budget Memory budget. Must outlive the file.
+ *
+ * \return Nothing if the file is successfully opened. Otherwise, the error
+ *         code.
+ */
+oc::result<void> SpillFile::open(MemoryBudget &budget)
+{
+    if (is_open()) return FileError::InvalidState;
+
+    m_budget = &budget;
+    m_is_open = true;
+
+    return oc::success();
+}
+
+/*!
+ * \brief Close the file and free its memory or temporary file.
+ */
+oc::result<void> SpillFile::close()
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    oc::result<void> ret = oc::success();
+
+    if (m_spilled) {
+        ret = m_file.close();
+    }
+
+    free_memory();
+    clear();
+
+    return ret;
+}
+
+oc::result<size_t> SpillFile::read(void *buf, size_t size)
+{
+    OUTCOME_TRY(n, read_at(m_pos, buf, size));
+
+    m_pos += n;
+
+    return n;
+}
+
+oc::result<size_t> SpillFile::write(const void *buf, size_t size)
+{
+    OUTCOME_TRY(n, write_at(m_pos, buf, size));
+
+    m_pos += n;
+
+    return n;
+}
+
+oc::result<uint64_t> SpillFile::seek(int64_t offset, int whence)
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    uint64_t base;
+
+    switch (whence) {
+    case SEEK_SET:
+        base = 0;
+        break;
+    case SEEK_CUR:
+        base = m_pos;
+        break;
+    case SEEK_END:
+        base = m_size;
+        break;
+    default:
+        MB_UNREACHABLE("Invalid whence argument: %d", whence);
+    }
+
+    if (offset < 0 && static_cast<uint64_t>(-offset) > base) {
+        return FileError::ArgumentOutOfRange;
+    } else if (offset > 0 && static_cast<uint64_t>(offset) > UINT64_MAX - base) {
+        return FileError::ArgumentOutOfRange;
+    }
+
+    m_pos = base + static_cast<uint64_t>(offset);
+
+    return m_pos;
+}
+
+/*!
+ * \brief Set the file size.
+ *
+ * New space is zero-initialized. The file may spill to disk if it grows.
+ */
+oc::result<void> SpillFile::truncate(uint64_t size)
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    OUTCOME_TRYV(grow(size));
+
+    if (m_spilled) {
+        OUTCOME_TRYV(m_file.truncate(size));
+    } else if (size > m_size) {
+        memset(static_cast<char *>(m_data) + m_size, 0,
+               static_cast<size_t>(size - m_size));
+    }
+
+    m_size = size;
+
+    return oc::success();
+}
+
+/*!
+ * \brief Read from the file at the specified offset.
+ *
+ * This does not change the file position.
+ *
+ * \sa File::read_at()
+ */
+oc::result<size_t> SpillFile::read_at(uint64_t offset,
+                                      void *buf, size_t size)
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    if (m_spilled) {
+        return m_file.read_at(offset, buf, size);
+    }
+
+    size_t to_read = 0;
+    if (offset < m_size) {
+        auto pos = static_cast<size_t>(offset);
+        to_read = std::min(static_cast<size_t>(m_size) - pos, size);
+
+        memcpy(buf, static_cast<char *>(m_data) + pos, to_read);
+    }
+
+    return to_read;
+}
+
+/*!
+ * \brief Write to the file at the specified offset.
+ *
+ * This does not change the file position. Writing past the end of the file
+ * grows it and may cause it to spill to disk.
+ *
+ * \sa File::write_at()
+ */
+oc::result<size_t> SpillFile::write_at(uint64_t offset,
+                                       const void *buf, size_t size)
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    if (size > UINT64_MAX - offset) {
+        return FileError::ArgumentOutOfRange;
+    }
+
+    uint64_t end = offset + size;
+
+    OUTCOME_TRYV(grow(end));
+
+    if (m_spilled) {
+        OUTCOME_TRY(n, m_file.write_at(offset, buf, size));
+        m_size = std::max(m_size, offset + n);
+        return n;
+    }
+
+    auto data = static_cast<char *>(m_data);
+
+    // Zero-initialize the gap when writing past the end
+    if (offset > m_size) {
+        memset(data + m_size, 0, static_cast<size_t>(offset - m_size));
+    }
+
+    memcpy(data + offset, buf, size);
+    m_size = std::max(m_size, end);
+
+    return size;
+}
+
+/*!
+ * \brief Write to the file from multiple buffers.
+ *
+ * The file is enlarged only once to fit all of the buffers.
+ *
+ * \sa File::writev()
+ */
+oc::result<size_t> SpillFile::writev(const ConstIoVec *iov, size_t count)
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    uint64_t end = m_pos;
+
+    for (size_t i = 0; i < count; ++i) {
+        if (iov[i].size > UINT64_MAX - end) {
+            return FileError::ArgumentOutOfRange;
+        }
+        end += iov[i].size;
+    }
+
+    OUTCOME_TRYV(grow(end));
+
+    size_t total = 0;
+
+    for (size_t i = 0; i < count; ++i) {
+        OUTCOME_TRY(n, write(iov[i].data, iov[i].size));
+
+        total += n;
+
+        if (n < iov[i].size) {
+            break;
+        }
+    }
+
+    return total;
+}
+
+bool SpillFile::is_open()
+{
+    return m_is_open;
+}
+
+/*!
+ * \brief Get the file descriptor of the temporary file.
+ *
+ * \return File descriptor if the file has spilled to disk. Otherwise, -1.
+ */
+int SpillFile::native_fd()
+{
+    return m_spilled ? m_file.native_fd() : -1;
+}
+
+/*!
+ * \brief Get the in-memory contents.
+ *
+ * \return Contents if the file has not spilled to disk. Otherwise, nothing.
+ */
+std::optional<ConstIoVec> SpillFile::mapped_data()
+{
+    if (!is_open() || m_spilled) {
+        return std::nullopt;
+    }
+
+    return ConstIoVec{m_data, static_cast<size_t>(m_size)};
+}
+
+/*!
+ * \brief Preallocate space for the file.
+ *
+ * This does not change the size of the file. If the space cannot be reserved
+ * from the budget, the file spills to disk immediately, which avoids copying
+ * data that was already written.
+ *
+ * \param capacity Expected final size of the file
+ *
+ * \return Nothing if the space is allocated or the file was moved to disk.
+ *         Otherwise, the error code.
+ */
+oc::result<void> SpillFile::reserve(uint64_t capacity)
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    return grow(capacity);
+}
+
+/*!
+ * \brief Move the contents to a temporary file.
+ *
+ * This is called automatically when the budget is exhausted, but may also be
+ * called explicitly. Does nothing if the file has already spilled to disk.
+ *
+ * \return Nothing on success or the error code on failure. On failure, the
+ *         contents remain in memory.
+ */
+oc::result<void> SpillFile::spill()
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    if (m_spilled) {
+        return oc::success();
+    }
+
+    auto dir = m_budget->spill_dir();
+    int fd = -1;
+
+#ifdef O_TMPFILE
+    fd = ::open(dir.c_str(), O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+#endif
+    if (fd < 0) {
+        // Filesystem or kernel does not support O_TMPFILE
+        std::string path = dir;
+        path += "/.mbspill.XXXXXX";
+
+        fd = mkstemp(path.data());
+        if (fd < 0) {
+            return ec_from_errno();
+        }
+
+        unlink(path.c_str());
+    }
+
+    FdFile file;
+    if (auto r = file.open(fd, true); !r) {
+        ::close(fd);
+        return r.as_failure();
+    }
+
+    OUTCOME_TRYV(file_write_exact(file, m_data, static_cast<size_t>(m_size)));
+
+    m_file = std::move(file);
+    m_spilled = true;
+
+    free_memory();
+
+    g_spilled_files.add();
+    g_spilled_bytes.add(m_size);
+
+    return oc::success();
+}
+
+/*!
+ * \brief Check whether the contents have been moved to a temporary file.
+ */
+bool SpillFile::spilled() const
+{
+    return m_spilled;
+}
+
+uint64_t SpillFile::size() const
+{
+    return m_size;
+}
+
+/*!
+ * Make sure the file can hold \p size bytes. If the in-memory allocation needs
+ * to grow, it is at least doubled. If neither the doubled nor the exact size
+ * can be reserved from the budget, the file spills to disk.
+ */
+oc::result<void> SpillFile::grow(uint64_t size)
+{
+    if (m_spilled || size <= m_capacity) {
+        return oc::success();
+    } else if (size > SIZE_MAX) {
+        return spill();
+    }
+
+    auto exact = static_cast<size_t>(size);
+    size_t new_capacity = std::max(
+            exact, m_capacity > SIZE_MAX / 2 ? SIZE_MAX : m_capacity * 2);
+
+    if (!m_budget->try_reserve(new_capacity - m_capacity)) {
+        // Retry without the extra space
+        new_capacity = exact;
+        if (!m_budget->try_reserve(new_capacity - m_capacity)) {
+            return spill();
+        }
+    }
+
+    void *new_data = realloc(m_data, new_capacity);
+    if (!new_data) {
+        m_budget->release(new_capacity - m_capacity);
+        return spill();
+    }
+
+    m_data = new_data;
+    m_capacity = new_capacity;
+
+    return oc::success();
+}
+
+void SpillFile::free_memory() noexcept
+{
+    free(m_data);
+    if (m_budget) {
+        m_budget->release(m_capacity);
+    }
+
+    m_data = nullptr;
+    m_capacity = 0;
+}
+
+void SpillFile::clear() noexcept
+{
+    m_is_open = false;
+    m_budget = nullptr;
+    m_data = nullptr;
+    m_capacity = 0;
+    m_spilled = false;
+    m_size = 0;
+    m_pos = 0;
+}
+
+}
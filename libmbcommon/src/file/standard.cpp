@@ -143,9 +143,36 @@ oc::result<void> StandardFile::truncate(uint64_t size)
     return m_file.truncate(size);
 }
 
+oc::result<size_t> StandardFile::read_at(uint64_t offset,
+                                         void *buf, size_t size)
+{
+    return m_file.read_at(offset, buf, size);
+}
+
+oc::result<size_t> StandardFile::write_at(uint64_t offset,
+                                          const void *buf, size_t size)
+{
+    return m_file.write_at(offset, buf, size);
+}
+
+oc::result<size_t> StandardFile::readv(const IoVec *iov, size_t count)
+{
+    return m_file.readv(iov, count);
+}
+
+oc::result<size_t> StandardFile::writev(const ConstIoVec *iov, size_t count)
+{
+    return m_file.writev(iov, count);
+}
+
 bool StandardFile::is_open()
 {
     return m_file.is_open();
 }
 
+int StandardFile::native_fd()
+{
+    return m_file.native_fd();
+}
+
 }
@@ -0,0 +1,411 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbcommon/file/stats.h"
+
+#include <algorithm>
+
+#include <cinttypes>
+#include <cstdio>
+
+#include "mbcommon/file_error.h"
+#include "mbcommon/finally.h"
+#include "mbcommon/string.h"
+
+/*!
+ * \file mbcommon/file/stats.h
+ * \brief Instrumented wrapper for other File handles
+ */
+
+namespace mb
+{
+
+/*!
+ * \struct FileOpStats
+ *
+ * \brief Statistics for one type of File operation.
+ *
+ * Bucket `i` of \ref latency_histogram counts operations that took less than
+ * `2^i` microseconds, but at least `2^(i-1)` microseconds. The last bucket
+ * also counts all slower operations.
+ */
+
+/*!
+ * \struct FileStats
+ *
+ * \brief Statistics collected by StatsFile.
+ *
+ * Positional and vectored reads and writes are included in \ref read and
+ * \ref write.
+ */
+
+static void format_op_stats(std::string &out, const char *name,
+                            const FileOpStats &op)
+{
+    out += format("%-8s %" PRIu64 " calls, %" PRIu64 " errors, %" PRIu64
+                  " bytes, %" PRIu64 " us total, %" PRIu64 " us max\n",
+                  name, op.count, op.errors, op.bytes, op.total_ns / 1000,
+                  op.max_ns / 1000);
+
+    if (op.count == 0) {
+        return;
+    }
+
+    out += "         latency:";
+
+    for (size_t i = 0; i < op.latency_histogram.size(); ++i) {
+        if (op.latency_histogram[i] == 0) {
+            continue;
+        }
+
+        if (i == op.latency_histogram.size() - 1) {
+            out += format(" >=%" PRIu64 "us:%" PRIu64,
+                          uint64_t(1) << (i - 1), op.latency_histogram[i]);
+        } else {
+            out += format(" <%" PRIu64 "us:%" PRIu64,
+                          uint64_t(1) << i, op.latency_histogram[i]);
+        }
+    }
+
+    out += "\n";
+}
+
+/*!
+ * \brief Format statistics as human-readable text.
+ *
+ * \param stats Statistics
+ *
+ * \return Multi-line summary of \p stats
+ */
+std::string format_file_stats(const FileStats &stats)
+{
+    std::string out;
+
+    format_op_stats(out, "read", stats.read);
+    format_op_stats(out, "write", stats.write);
+    format_op_stats(out, "seek", stats.seek);
+    format_op_stats(out, "truncate", stats.truncate);
+    out += format("seek distance: %" PRIu64 " bytes\n", stats.seek_distance);
+
+    return out;
+}
+
+/*!
+ * \class StatsFile
+ *
+ * \brief Collect I/O statistics for another File handle.
+ *
+ * This class wraps another File handle and records the number of calls, the
+ * number of failed calls, the number of bytes transferred, and a latency
+ * histogram for each type of operation. The total distance moved by seeks is
+ * also recorded if the file position can be determined.
+ *
+ * All operations, including positional and vectored operations, are passed
+ * through to the underlying File handle unchanged.
+ *
+ * The underlying File handle is not owned by this class and will not be
+ * closed when this File handle is closed. The statistics remain available
+ * after close() until the handle is reopened or reset_stats() is called.
+ *
+ * \note StatsFile does not expose the underlying file descriptor via
+ *       File::native_fd(), so that all I/O is accounted for.
+ */
+
+/*!
+ * \brief Construct unbound StatsFile.
+ *
+ * The File handle will not be bound to any file. open() will need to be called
+ * to wrap a file.
+ */
+StatsFile::StatsFile()
+    : File()
+{
+    clear();
+}
+
+/*!
+ * \brief Wrap File handle.
+ *
+ * Construct the file handle and wrap the file. Use is_open() to check if the
+ * file was successfully opened.
+ *
+ * \sa open(File *)
+ *
+ * \param file File handle to wrap
+ */
+StatsFile::StatsFile(File *file)
+    : StatsFile()
+{
+    (void) open(file);
+}
+
+StatsFile::~StatsFile()
+{
+    (void) close();
+}
+
+/*!
+ * \brief Move construct new File handle.
+ *
+ * \p other will be left in a state as if it was newly constructed with the
+ * default constructor.
+ *
+ * \param other File handle to move from
+ */
+StatsFile::StatsFile(StatsFile &&other) noexcept
+{
+    clear();
+
+    std::swap(m_file, other.m_file);
+    std::swap(m_stats, other.m_stats);
+    std::swap(m_pos, other.m_pos);
+}
+
+/*!
+ * \brief Move assign a File handle
+ *
+ * This file handle will be closed and then \p rhs will be moved into this
+ * object. \p rhs will be left in a state as if it was newly constructed with
+ * the default constructor.
+ *
+ * \param rhs File handle to move from
+ */
+StatsFile & StatsFile::operator=(StatsFile &&rhs) noexcept
+{
+    if (this != &rhs) {
+        (void) close();
+
+        std::swap(m_file, rhs.m_file);
+        std::swap(m_stats, rhs.m_stats);
+        std::swap(m_pos, rhs.m_pos);
+    }
+
+    return *this;
+}
+
+/*!
+ * \brief Wrap File handle.
+ *
+ * The statistics are reset when a new file is opened.
+ *
+ * \param file File handle to wrap
+ *
+ * \return Nothing if the file is successfully opened. Otherwise, the error
+ *         code.
+ */
+oc::result<void> StatsFile::open(File *file)
+{
+    if (is_open()) return FileError::InvalidState;
+
+    if (!file || !file->is_open()) {
+        return FileError::InvalidState;
+    }
+
+    clear();
+    m_file = file;
+
+    // Not recorded since it is not an operation requested by the caller
+    if (auto pos = file->seek(0, SEEK_CUR)) {
+        m_pos = pos.value();
+    }
+
+    return oc::success();
+}
+
+oc::result<void> StatsFile::close()
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    // Keep the statistics so they can be queried after closing
+    m_file = nullptr;
+    m_pos = std::nullopt;
+
+    return oc::success();
+}
+
+oc::result<size_t> StatsFile::read(void *buf, size_t size)
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    auto start = Clock::now();
+    auto n = m_file->read(buf, size);
+    record(m_stats.read, start, !!n, n ? n.value() : 0);
+
+    if (n && m_pos) {
+        *m_pos += n.value();
+    }
+
+    return n;
+}
+
+oc::result<size_t> StatsFile::write(const void *buf, size_t size)
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    auto start = Clock::now();
+    auto n = m_file->write(buf, size);
+    record(m_stats.write, start, !!n, n ? n.value() : 0);
+
+    if (n && m_pos) {
+        *m_pos += n.value();
+    }
+
+    return n;
+}
+
+oc::result<uint64_t> StatsFile::seek(int64_t offset, int whence)
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    auto start = Clock::now();
+    auto pos = m_file->seek(offset, whence);
+    record(m_stats.seek, start, !!pos, 0);
+
+    if (pos) {
+        if (m_pos) {
+            m_stats.seek_distance += pos.value() > *m_pos
+                    ? pos.value() - *m_pos : *m_pos - pos.value();
+        }
+        m_pos = pos.value();
+    }
+
+    return pos;
+}
+
+oc::result<void> StatsFile::truncate(uint64_t size)
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    auto start = Clock::now();
+    auto ret = m_file->truncate(size);
+    record(m_stats.truncate, start, !!ret, 0);
+
+    return ret;
+}
+
+oc::result<size_t> StatsFile::read_at(uint64_t offset, void *buf, size_t size)
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    auto start = Clock::now();
+    auto n = m_file->read_at(offset, buf, size);
+    record(m_stats.read, start, !!n, n ? n.value() : 0);
+
+    return n;
+}
+
+oc::result<size_t> StatsFile::write_at(uint64_t offset, const void *buf,
+                                       size_t size)
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    auto start = Clock::now();
+    auto n = m_file->write_at(offset, buf, size);
+    record(m_stats.write, start, !!n, n ? n.value() : 0);
+
+    return n;
+}
+
+oc::result<size_t> StatsFile::readv(const IoVec *iov, size_t count)
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    auto start = Clock::now();
+    auto n = m_file->readv(iov, count);
+    record(m_stats.read, start, !!n, n ? n.value() : 0);
+
+    if (n && m_pos) {
+        *m_pos += n.value();
+    }
+
+    return n;
+}
+
+oc::result<size_t> StatsFile::writev(const ConstIoVec *iov, size_t count)
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    auto start = Clock::now();
+    auto n = m_file->writev(iov, count);
+    record(m_stats.write, start, !!n, n ? n.value() : 0);
+
+    if (n && m_pos) {
+        *m_pos += n.value();
+    }
+
+    return n;
+}
+
+bool StatsFile::is_open()
+{
+    return m_file;
+}
+
+/*!
+ * \brief Get collected statistics.
+ *
+ * \return Statistics for all operations since the file was opened or
+ *         reset_stats() was last called
+ */
+const FileStats & StatsFile::stats() const
+{
+    return m_stats;
+}
+
+/*!
+ * \brief Reset all statistics to zero.
+ */
+void StatsFile::reset_stats()
+{
+    m_stats = {};
+}
+
+void StatsFile::record(FileOpStats &op, Clock::time_point start, bool success,
+                       uint64_t bytes)
+{
+    auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            Clock::now() - start).count();
+    auto ns = static_cast<uint64_t>(std::max<decltype(elapsed)>(elapsed, 0));
+
+    ++op.count;
+    if (!success) {
+        ++op.errors;
+    }
+    op.bytes += bytes;
+    op.total_ns += ns;
+    op.max_ns = std::max(op.max_ns, ns);
+
+    // Find the smallest power of two (in microseconds) greater than the
+    // latency
+    size_t bucket = 0;
+    for (auto us = ns / 1000; us > 0 && bucket < op.latency_histogram.size() - 1;
+            us >>= 1) {
+        ++bucket;
+    }
+    ++op.latency_histogram[bucket];
+}
+
+void StatsFile::clear() noexcept
+{
+    m_file = nullptr;
+    m_stats = {};
+    m_pos = std::nullopt;
+}
+
+}
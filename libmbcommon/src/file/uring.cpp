@@ -0,0 +1,913 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbcommon/file/uring.h"
+
+#include <algorithm>
+
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "mbcommon/error_code.h"
+#include "mbcommon/file_error.h"
+#include "mbcommon/finally.h"
+
+/*!
+ * \file mbcommon/file/uring.h
+ * \brief Pipelined File implementation using io_uring
+ */
+
+namespace mb
+{
+
+namespace detail
+{
+
+/*! \cond INTERNAL */
+
+struct UringQueue
+{
+    int ring_fd = -1;
+
+    void *sq_ptr = MAP_FAILED;
+    size_t sq_size = 0;
+    void *cq_ptr = MAP_FAILED;
+    size_t cq_size = 0;
+    io_uring_sqe *sqes = static_cast<io_uring_sqe *>(MAP_FAILED);
+    size_t sqes_size = 0;
+
+    unsigned *sq_tail = nullptr;
+    unsigned *sq_mask = nullptr;
+    unsigned *sq_array = nullptr;
+    unsigned *cq_head = nullptr;
+    unsigned *cq_tail = nullptr;
+    unsigned *cq_mask = nullptr;
+    io_uring_cqe *cqes = nullptr;
+
+    bool fixed_file = false;
+    bool fixed_buffers = false;
+    std::vector<iovec> iovs;
+
+    ~UringQueue()
+    {
+        if (sqes != MAP_FAILED) {
+            munmap(sqes, sqes_size);
+        }
+        if (cq_ptr != MAP_FAILED && cq_ptr != sq_ptr) {
+            munmap(cq_ptr, cq_size);
+        }
+        if (sq_ptr != MAP_FAILED) {
+            munmap(sq_ptr, sq_size);
+        }
+        if (ring_fd >= 0) {
+            ::close(ring_fd);
+        }
+    }
+};
+
+/*! \endcond */
+
+}
+
+using namespace detail;
+
+/*! \cond INTERNAL */
+
+template<typename T>
+static T * ring_ptr(void *base, uint32_t offset)
+{
+    return reinterpret_cast<T *>(static_cast<unsigned char *>(base) + offset);
+}
+
+/*!
+ * Set up an io_uring instance for \p fd with one registered buffer per block
+ * of \p buf. Registering the file and buffers is best-effort since it can fail
+ * due to RLIMIT_MEMLOCK. In that case, the non-fixed operations are used.
+ */
+static oc::result<std::unique_ptr<UringQueue>>
+create_queue(int fd, unsigned entries, unsigned char *buf, size_t count,
+             size_t block_size)
+{
+    auto queue = std::make_unique<UringQueue>();
+
+    // The completion queue is twice the size of the submission queue, so every
+    // slot's completion fits even if none have been reaped
+    io_uring_params params = {};
+
+    int ring_fd = static_cast<int>(
+            syscall(__NR_io_uring_setup, entries, &params));
+    if (ring_fd < 0) {
+        return ec_from_errno();
+    }
+    queue->ring_fd = ring_fd;
+
+    queue->sq_size = params.sq_off.array
+            + params.sq_entries * sizeof(unsigned);
+    queue->cq_size = params.cq_off.cqes
+            + params.cq_entries * sizeof(io_uring_cqe);
+
+#ifdef IORING_FEAT_SINGLE_MMAP
+    const bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+#else
+    const bool single_mmap = false;
+#endif
+    if (single_mmap) {
+        queue->sq_size = queue->cq_size =
+                std::max(queue->sq_size, queue->cq_size);
+    }
+
+    queue->sq_ptr = mmap(nullptr, queue->sq_size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, ring_fd,
+                         IORING_OFF_SQ_RING);
+    if (queue->sq_ptr == MAP_FAILED) {
+        return ec_from_errno();
+    }
+
+    if (single_mmap) {
+        queue->cq_ptr = queue->sq_ptr;
+    } else {
+        queue->cq_ptr = mmap(nullptr, queue->cq_size, PROT_READ | PROT_WRITE,
+                             MAP_SHARED | MAP_POPULATE, ring_fd,
+                             IORING_OFF_CQ_RING);
+        if (queue->cq_ptr == MAP_FAILED) {
+            return ec_from_errno();
+        }
+    }
+
+    queue->sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+    queue->sqes = static_cast<io_uring_sqe *>(mmap(
+            nullptr, queue->sqes_size, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES));
+    if (queue->sqes == MAP_FAILED) {
+        return ec_from_errno();
+    }
+
+    queue->sq_tail = ring_ptr<unsigned>(queue->sq_ptr, params.sq_off.tail);
+    queue->sq_mask = ring_ptr<unsigned>(queue->sq_ptr,
+                                        params.sq_off.ring_mask);
+    queue->sq_array = ring_ptr<unsigned>(queue->sq_ptr, params.sq_off.array);
+    queue->cq_head = ring_ptr<unsigned>(queue->cq_ptr, params.cq_off.head);
+    queue->cq_tail = ring_ptr<unsigned>(queue->cq_ptr, params.cq_off.tail);
+    queue->cq_mask = ring_ptr<unsigned>(queue->cq_ptr,
+                                        params.cq_off.ring_mask);
+    queue->cqes = ring_ptr<io_uring_cqe>(queue->cq_ptr, params.cq_off.cqes);
+
+    queue->fixed_file = syscall(__NR_io_uring_register, ring_fd,
+                                IORING_REGISTER_FILES, &fd, 1) == 0;
+
+    queue->iovs.resize(count);
+    for (size_t i = 0; i < count; ++i) {
+        queue->iovs[i].iov_base = buf + i * block_size;
+        queue->iovs[i].iov_len = block_size;
+    }
+
+    queue->fixed_buffers = syscall(__NR_io_uring_register, ring_fd,
+                                   IORING_REGISTER_BUFFERS, queue->iovs.data(),
+                                   static_cast<unsigned>(count)) == 0;
+
+    return queue;
+}
+
+static oc::result<void> queue_enter(UringQueue &queue, unsigned to_submit,
+                                    unsigned min_complete)
+{
+    unsigned flags = min_complete > 0 ? IORING_ENTER_GETEVENTS : 0;
+
+    while (syscall(__NR_io_uring_enter, queue.ring_fd, to_submit, min_complete,
+                   flags, nullptr, 0) < 0) {
+        if (errno != EINTR) {
+            return ec_from_errno();
+        }
+    }
+
+    return oc::success();
+}
+
+/*!
+ * Complete a positional read or write synchronously.
+ *
+ * \return Number of bytes transferred or -errno if nothing was transferred
+ */
+static int64_t sync_io(int fd, bool is_write, unsigned char *data, size_t len,
+                       uint64_t offset)
+{
+    size_t done = 0;
+
+    while (done < len) {
+        ssize_t n;
+
+        if (is_write) {
+            n = pwrite64(fd, data + done, len - done,
+                         static_cast<off64_t>(offset + done));
+        } else {
+            n = pread64(fd, data + done, len - done,
+                        static_cast<off64_t>(offset + done));
+        }
+
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            } else if (done == 0) {
+                return -errno;
+            }
+            break;
+        } else if (n == 0) {
+            break;
+        }
+
+        done += static_cast<size_t>(n);
+    }
+
+    return static_cast<int64_t>(done);
+}
+
+/*! \endcond */
+
+/*!
+ * \class UringFile
+ *
+ * \brief Pipelined File implementation for file descriptors using io_uring.
+ *
+ * This class keeps up to `queue_depth` blocks of `block_size` bytes in flight
+ * at a time. In read mode, sequential blocks are read ahead of the file
+ * position. In write mode, each block is submitted as soon as it is full and
+ * the caller can continue filling the next block while the kernel writes the
+ * previous ones. Switching between reading and writing, seeking outside of
+ * the current block, or truncating waits for all operations to complete.
+ *
+ * The buffers and file descriptor are registered with the kernel when
+ * possible so that the kernel does not need to map them for every operation.
+ *
+ * If io_uring is not available at runtime (eg. older kernels or seccomp
+ * filters), the same blocks are read and written with synchronous `pread64()`
+ * and `pwrite64()` calls instead. Use is_async() to check which mode is in
+ * use.
+ *
+ * This class is only available on Linux when libmbcommon is built with the
+ * `MBP_ENABLE_IO_URING` CMake option.
+ *
+ * \note The file descriptor must refer to a seekable file. Its file position
+ *       is not updated by this class.
+ *
+ * \note Because writes are completed asynchronously, errors may only be
+ *       reported by a later operation, flush(), or close().
+ */
+
+/*!
+ * \brief Construct unbound UringFile.
+ *
+ * The File handle will not be bound to any file. open() will need to be called
+ * to open a file.
+ */
+UringFile::UringFile()
+    : File()
+{
+    clear();
+}
+
+/*!
+ * \brief Open File handle from file descriptor.
+ *
+ * Construct the file handle and open the file. Use is_open() to check if the
+ * file was successfully opened.
+ *
+ * \sa open(int, bool, size_t, size_t)
+ *
+ * \param fd File descriptor
+ * \param owned Whether the file descriptor should be owned by the File handle
+ * \param queue_depth Maximum number of operations in flight
+ * \param block_size Size of each operation
+ */
+UringFile::UringFile(int fd, bool owned, size_t queue_depth,
+                     size_t block_size)
+    : UringFile()
+{
+    (void) open(fd, owned, queue_depth, block_size);
+}
+
+UringFile::~UringFile()
+{
+    (void) close();
+}
+
+/*!
+ * \brief Move construct new File handle.
+ *
+ * \p other will be left in a state as if it was newly constructed with the
+ * default constructor.
+ *
+ * \param other File handle to move from
+ */
+UringFile::UringFile(UringFile &&other) noexcept
+{
+    clear();
+
+    std::swap(m_fd, other.m_fd);
+    std::swap(m_owned, other.m_owned);
+    std::swap(m_queue, other.m_queue);
+    std::swap(m_block_size, other.m_block_size);
+    std::swap(m_buf, other.m_buf);
+    std::swap(m_slots, other.m_slots);
+    std::swap(m_mode, other.m_mode);
+    std::swap(m_head, other.m_head);
+    std::swap(m_next_offset, other.m_next_offset);
+    std::swap(m_pos, other.m_pos);
+    std::swap(m_error, other.m_error);
+}
+
+/*!
+ * \brief Move assign a File handle
+ *
+ * This file handle will be closed and then \p rhs will be moved into this
+ * object. \p rhs will be left in a state as if it was newly constructed with
+ * the default constructor.
+ *
+ * \param rhs File handle to move from
+ */
+UringFile & UringFile::operator=(UringFile &&rhs) noexcept
+{
+    if (this != &rhs) {
+        (void) close();
+
+        std::swap(m_fd, rhs.m_fd);
+        std::swap(m_owned, rhs.m_owned);
+        std::swap(m_queue, rhs.m_queue);
+        std::swap(m_block_size, rhs.m_block_size);
+        std::swap(m_buf, rhs.m_buf);
+        std::swap(m_slots, rhs.m_slots);
+        std::swap(m_mode, rhs.m_mode);
+        std::swap(m_head, rhs.m_head);
+        std::swap(m_next_offset, rhs.m_next_offset);
+        std::swap(m_pos, rhs.m_pos);
+        std::swap(m_error, rhs.m_error);
+    }
+
+    return *this;
+}
+
+/*!
+ * \brief Open from file descriptor.
+ *
+ * The file position of \p fd is used as the initial file position.
+ *
+ * \param fd File descriptor
+ * \param owned Whether the file descriptor should be owned by the File handle
+ * \param queue_depth Maximum number of operations in flight
+ * \param block_size Size of each operation
+ *
+ * \return
+ *   * Nothing if the file is successfully opened
+ *   * std::errc::invalid_argument if \p queue_depth or \p block_size is 0 or
+ *     too large
+ *   * Otherwise, a specific error code
+ */
+oc::result<void> UringFile::open(int fd, bool owned, size_t queue_depth,
+                                 size_t block_size)
+{
+    if (is_open()) return FileError::InvalidState;
+
+    if (queue_depth == 0 || queue_depth > 4096 || block_size == 0
+            || block_size > UINT_MAX || block_size > SIZE_MAX / queue_depth) {
+        return std::errc::invalid_argument;
+    }
+
+    off64_t pos = lseek64(fd, 0, SEEK_CUR);
+    if (pos < 0) {
+        return ec_from_errno();
+    }
+
+    m_fd = fd;
+    m_owned = owned;
+    m_block_size = block_size;
+    m_buf.resize(queue_depth * block_size);
+    m_slots.resize(queue_depth);
+    for (size_t i = 0; i < queue_depth; ++i) {
+        m_slots[i] = {m_buf.data() + i * block_size, 0, 0, 0, false,
+                      SlotState::Free};
+    }
+    m_mode = Mode::None;
+    m_head = 0;
+    m_next_offset = 0;
+    m_pos = static_cast<uint64_t>(pos);
+    m_error.clear();
+
+    // Fall back to synchronous I/O if io_uring is unavailable
+    if (auto queue = create_queue(fd, static_cast<unsigned>(queue_depth),
+                                  m_buf.data(), queue_depth, block_size)) {
+        m_queue = std::move(queue.value());
+    }
+
+    return oc::success();
+}
+
+oc::result<void> UringFile::close()
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    // Reset to allow opening another file
+    auto reset = finally([&] {
+        clear();
+    });
+
+    auto ret = drain();
+
+    // All operations have completed, so the ring can be torn down
+    m_queue.reset();
+
+    if (m_owned && ::close(m_fd) < 0 && ret) {
+        return ec_from_errno();
+    }
+
+    return ret;
+}
+
+oc::result<size_t> UringFile::read(void *buf, size_t size)
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    OUTCOME_TRYV(set_mode(Mode::Read));
+
+    auto out = static_cast<unsigned char *>(buf);
+    size_t total = 0;
+
+    while (total < size) {
+        Slot &slot = m_slots[m_head];
+
+        if (slot.state == SlotState::Free) {
+            // Resubmit after an earlier submission failure
+            if (auto r = submit(m_head, false); !r) {
+                if (total > 0) break;
+                return r.as_failure();
+            }
+        }
+
+        if (auto r = wait_slot(m_head); !r) {
+            if (total > 0) break;
+            return r.as_failure();
+        }
+
+        if (slot.res < 0) {
+            if (total > 0) break;
+            // Reattempt the read on the next call
+            slot.state = SlotState::Free;
+            return std::error_code(static_cast<int>(-slot.res),
+                                   std::generic_category());
+        }
+
+        auto avail = static_cast<size_t>(slot.res)
+                - static_cast<size_t>(m_pos - slot.offset);
+        if (avail == 0) {
+            // Reached EOF
+            break;
+        }
+
+        auto n = std::min(avail, size - total);
+        memcpy(out + total, slot.data + (m_pos - slot.offset), n);
+        m_pos += n;
+        total += n;
+
+        // Read the next block ahead once this one is fully consumed
+        if (n == avail && static_cast<size_t>(slot.res) == slot.len) {
+            slot.offset = m_next_offset;
+            slot.len = m_block_size;
+            m_next_offset += m_block_size;
+
+            auto ret = submit(m_head, false);
+            m_head = (m_head + 1) % m_slots.size();
+
+            if (!ret) {
+                if (total > 0) break;
+                return ret.as_failure();
+            }
+        }
+    }
+
+    return total;
+}
+
+oc::result<size_t> UringFile::write(const void *buf, size_t size)
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    OUTCOME_TRYV(set_mode(Mode::Write));
+
+    if (m_error) {
+        auto ec = m_error;
+        m_error.clear();
+        return ec;
+    }
+
+    auto in = static_cast<const unsigned char *>(buf);
+    size_t total = 0;
+
+    while (total < size) {
+        if (m_pos > UINT64_MAX - (size - total)) {
+            if (total > 0) break;
+            return FileError::ArgumentOutOfRange;
+        }
+
+        Slot &slot = m_slots[m_head];
+
+        if (slot.state != SlotState::Free) {
+            // Wait for an earlier write of this slot to finish
+            OUTCOME_TRYV(wait_slot(m_head));
+            complete_write(m_head);
+
+            if (m_error) {
+                if (total > 0) break;
+                auto ec = m_error;
+                m_error.clear();
+                return ec;
+            }
+        }
+
+        if (slot.len == 0) {
+            slot.offset = m_pos;
+        }
+
+        auto n = std::min(m_block_size - slot.len, size - total);
+        memcpy(slot.data + slot.len, in + total, n);
+        slot.len += n;
+        m_pos += n;
+        total += n;
+
+        if (slot.len == m_block_size) {
+            auto ret = submit(m_head, true);
+            if (!ret) {
+                // Data was accepted, so report the failure later
+                m_error = ret.error();
+                slot.len = 0;
+            }
+            m_head = (m_head + 1) % m_slots.size();
+        }
+    }
+
+    return total;
+}
+
+oc::result<uint64_t> UringFile::seek(int64_t offset, int whence)
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    uint64_t new_pos;
+
+    switch (whence) {
+    case SEEK_SET:
+        if (offset < 0) {
+            return FileError::ArgumentOutOfRange;
+        }
+        new_pos = static_cast<uint64_t>(offset);
+        break;
+    case SEEK_CUR:
+        if ((offset < 0 && static_cast<uint64_t>(-offset) > m_pos)
+                || (offset > 0 && static_cast<uint64_t>(offset)
+                        > static_cast<uint64_t>(INT64_MAX) - m_pos)) {
+            return FileError::ArgumentOutOfRange;
+        }
+        new_pos = m_pos + static_cast<uint64_t>(offset);
+        break;
+    case SEEK_END: {
+        // Pending writes may extend the file
+        OUTCOME_TRYV(drain());
+
+        off64_t size = lseek64(m_fd, 0, SEEK_END);
+        if (size < 0) {
+            return ec_from_errno();
+        }
+        if ((offset < 0 && static_cast<uint64_t>(-offset)
+                        > static_cast<uint64_t>(size))
+                || (offset > 0 && offset > INT64_MAX - size)) {
+            return FileError::ArgumentOutOfRange;
+        }
+        new_pos = static_cast<uint64_t>(size + offset);
+        break;
+    }
+    default:
+        MB_UNREACHABLE("Invalid whence argument: %d", whence);
+    }
+
+    if (new_pos == m_pos) {
+        return new_pos;
+    }
+
+    // Seeking within the current readahead block does not require any I/O
+    if (m_mode == Mode::Read) {
+        Slot &slot = m_slots[m_head];
+
+        if (slot.state == SlotState::Done && slot.res >= 0
+                && new_pos >= slot.offset
+                && new_pos - slot.offset < static_cast<uint64_t>(slot.res)) {
+            m_pos = new_pos;
+            return new_pos;
+        }
+    }
+
+    OUTCOME_TRYV(drain());
+
+    m_pos = new_pos;
+    return new_pos;
+}
+
+oc::result<void> UringFile::truncate(uint64_t size)
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    if (size > static_cast<uint64_t>(INT64_MAX)) {
+        return FileError::ArgumentOutOfRange;
+    }
+
+    OUTCOME_TRYV(drain());
+
+    if (ftruncate64(m_fd, static_cast<off64_t>(size)) < 0) {
+        return ec_from_errno();
+    }
+
+    return oc::success();
+}
+
+bool UringFile::is_open()
+{
+    return m_fd >= 0;
+}
+
+/*!
+ * \brief Wait for all pending writes to complete.
+ *
+ * \return Nothing if all data is successfully written or there is no pending
+ *         data. Otherwise, the error code of the first write that failed.
+ */
+oc::result<void> UringFile::flush()
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    if (m_mode != Mode::Write) {
+        return oc::success();
+    }
+
+    return drain();
+}
+
+/*!
+ * \brief Check whether operations are submitted asynchronously.
+ *
+ * \return Whether io_uring is in use. If false, reads and writes are performed
+ *         synchronously.
+ */
+bool UringFile::is_async()
+{
+    return m_queue != nullptr;
+}
+
+/*!
+ * Submit the operation described by slot \p index.
+ *
+ * If io_uring is not available, the operation is completed before returning.
+ */
+oc::result<void> UringFile::submit(size_t index, bool is_write)
+{
+    Slot &slot = m_slots[index];
+
+    slot.res = 0;
+    slot.is_write = is_write;
+
+    if (!m_queue) {
+        slot.res = sync_io(m_fd, is_write, slot.data, slot.len, slot.offset);
+        slot.state = SlotState::Done;
+        return oc::success();
+    }
+
+    UringQueue &queue = *m_queue;
+
+    unsigned tail = *queue.sq_tail;
+    unsigned sq_index = tail & *queue.sq_mask;
+    io_uring_sqe *sqe = &queue.sqes[sq_index];
+
+    memset(sqe, 0, sizeof(*sqe));
+    if (queue.fixed_buffers) {
+        sqe->opcode = is_write ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+        sqe->addr = reinterpret_cast<uintptr_t>(slot.data);
+        sqe->len = static_cast<uint32_t>(slot.len);
+        sqe->buf_index = static_cast<uint16_t>(index);
+    } else {
+        queue.iovs[index].iov_base = slot.data;
+        queue.iovs[index].iov_len = slot.len;
+
+        sqe->opcode = is_write ? IORING_OP_WRITEV : IORING_OP_READV;
+        sqe->addr = reinterpret_cast<uintptr_t>(&queue.iovs[index]);
+        sqe->len = 1;
+    }
+    if (queue.fixed_file) {
+        sqe->fd = 0;
+        sqe->flags = IOSQE_FIXED_FILE;
+    } else {
+        sqe->fd = m_fd;
+    }
+    sqe->off = slot.offset;
+    sqe->user_data = index;
+
+    queue.sq_array[sq_index] = sq_index;
+    __atomic_store_n(queue.sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    auto ret = queue_enter(queue, 1, 0);
+    if (!ret) {
+        // The kernel did not consume the entry, so take it back
+        __atomic_store_n(queue.sq_tail, tail, __ATOMIC_RELEASE);
+        slot.state = SlotState::Free;
+        return ret.as_failure();
+    }
+
+    slot.state = SlotState::InFlight;
+    return oc::success();
+}
+
+/*!
+ * Wait until slot \p index is no longer in flight.
+ *
+ * Short transfers are completed synchronously so that callers only see a
+ * short result at EOF.
+ */
+oc::result<void> UringFile::wait_slot(size_t index)
+{
+    Slot &slot = m_slots[index];
+
+    while (slot.state == SlotState::InFlight) {
+        UringQueue &queue = *m_queue;
+
+        unsigned head = *queue.cq_head;
+        unsigned tail = __atomic_load_n(queue.cq_tail, __ATOMIC_ACQUIRE);
+
+        if (head == tail) {
+            OUTCOME_TRYV(queue_enter(queue, 0, 1));
+            continue;
+        }
+
+        for (; head != tail; ++head) {
+            io_uring_cqe *cqe = &queue.cqes[head & *queue.cq_mask];
+            Slot &done = m_slots[static_cast<size_t>(cqe->user_data)];
+
+            done.res = cqe->res;
+            done.state = SlotState::Done;
+
+            if (done.res > 0 && static_cast<size_t>(done.res) < done.len) {
+                auto n = sync_io(m_fd, done.is_write, done.data + done.res,
+                                 done.len - static_cast<size_t>(done.res),
+                                 done.offset
+                                         + static_cast<uint64_t>(done.res));
+                if (n > 0) {
+                    done.res += n;
+                }
+            }
+        }
+
+        __atomic_store_n(queue.cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    return oc::success();
+}
+
+/*!
+ * Release completed write slot \p index and record any error in m_error.
+ */
+void UringFile::complete_write(size_t index)
+{
+    Slot &slot = m_slots[index];
+
+    if (slot.state == SlotState::Done && !m_error) {
+        if (slot.res < 0) {
+            m_error = std::error_code(static_cast<int>(-slot.res),
+                                      std::generic_category());
+        } else if (static_cast<size_t>(slot.res) < slot.len) {
+            m_error = FileError::UnexpectedEof;
+        }
+    }
+
+    slot.state = SlotState::Free;
+    slot.len = 0;
+}
+
+/*!
+ * Fill all slots with reads of the blocks at and following m_pos.
+ */
+oc::result<void> UringFile::start_readahead()
+{
+    m_head = 0;
+    m_next_offset = m_pos;
+
+    for (size_t i = 0; i < m_slots.size(); ++i) {
+        m_slots[i].offset = m_next_offset;
+        m_slots[i].len = m_block_size;
+        m_next_offset += m_block_size;
+
+        OUTCOME_TRYV(submit(i, false));
+    }
+
+    return oc::success();
+}
+
+/*!
+ * Submit any partially filled write block, wait for all operations to
+ * complete, and discard any readahead data.
+ *
+ * \return The first deferred write error, if any
+ */
+oc::result<void> UringFile::drain()
+{
+    if (m_mode == Mode::Write) {
+        Slot &slot = m_slots[m_head];
+
+        if (slot.state == SlotState::Free && slot.len > 0) {
+            if (auto r = submit(m_head, true); !r && !m_error) {
+                m_error = r.error();
+            }
+        }
+    }
+
+    oc::result<void> ret = oc::success();
+
+    for (size_t i = 0; i < m_slots.size(); ++i) {
+        if (auto r = wait_slot(i); !r && ret) {
+            ret = r.as_failure();
+        }
+
+        if (m_slots[i].state == SlotState::Done && m_slots[i].is_write) {
+            complete_write(i);
+        }
+
+        m_slots[i].state = SlotState::Free;
+        m_slots[i].len = 0;
+    }
+
+    m_mode = Mode::None;
+    m_head = 0;
+
+    if (!ret) {
+        return ret;
+    } else if (m_error) {
+        auto ec = m_error;
+        m_error.clear();
+        return ec;
+    }
+
+    return oc::success();
+}
+
+oc::result<void> UringFile::set_mode(Mode mode)
+{
+    if (m_mode == mode) {
+        return oc::success();
+    }
+
+    OUTCOME_TRYV(drain());
+
+    m_mode = mode;
+
+    if (mode == Mode::Read) {
+        if (auto r = start_readahead(); !r) {
+            (void) drain();
+            return r.as_failure();
+        }
+    }
+
+    return oc::success();
+}
+
+void UringFile::clear() noexcept
+{
+    m_fd = -1;
+    m_owned = false;
+    m_queue.reset();
+    m_block_size = 0;
+    std::vector<unsigned char>().swap(m_buf);
+    std::vector<Slot>().swap(m_slots);
+    m_mode = Mode::None;
+    m_head = 0;
+    m_next_offset = 0;
+    m_pos = 0;
+    m_error.clear();
+}
+
+}
@@ -561,6 +561,110 @@ oc::result<void> Win32File::truncate(uint64_t size)
     return oc::success();
 }
 
+/*!
+ * \brief Read from file at the specified offset.
+ *
+ * The offset is passed to `ReadFile()` via an `OVERLAPPED` structure. Because
+ * Windows updates the file pointer of synchronous handles even when an offset
+ * is specified, the original file position is restored afterwards.
+ *
+ * \sa File::read_at()
+ */
+oc::result<size_t> Win32File::read_at(uint64_t offset, void *buf, size_t size)
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    if (offset > static_cast<uint64_t>(INT64_MAX)) {
+        return FileError::ArgumentOutOfRange;
+    }
+
+    if (size > UINT_MAX) {
+        size = UINT_MAX;
+    }
+
+    OUTCOME_TRY(orig_pos, seek(0, SEEK_CUR));
+
+    OVERLAPPED overlapped{};
+    overlapped.Offset = static_cast<DWORD>(offset);
+    overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+
+    DWORD n = 0;
+
+    bool ret = m_funcs->fn_ReadFile(
+        m_handle,   // hFile
+        buf,        // lpBuffer
+        size,       // nNumberOfBytesToRead
+        &n,         // lpNumberOfBytesRead
+        &overlapped // lpOverlapped
+    );
+
+    // Reading past EOF with an offset is not an error
+    std::error_code ec;
+    if (!ret && GetLastError() != ERROR_HANDLE_EOF) {
+        ec = ec_from_win32();
+    }
+
+    OUTCOME_TRYV(seek(static_cast<int64_t>(orig_pos), SEEK_SET));
+
+    if (ec) {
+        return ec;
+    }
+
+    return n;
+}
+
+/*!
+ * \brief Write to file at the specified offset.
+ *
+ * The offset is passed to `WriteFile()` via an `OVERLAPPED` structure. Because
+ * Windows updates the file pointer of synchronous handles even when an offset
+ * is specified, the original file position is restored afterwards.
+ *
+ * \sa File::write_at()
+ */
+oc::result<size_t> Win32File::write_at(uint64_t offset,
+                                       const void *buf, size_t size)
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    if (offset > static_cast<uint64_t>(INT64_MAX)) {
+        return FileError::ArgumentOutOfRange;
+    }
+
+    if (size > UINT_MAX) {
+        size = UINT_MAX;
+    }
+
+    OUTCOME_TRY(orig_pos, seek(0, SEEK_CUR));
+
+    OVERLAPPED overlapped{};
+    overlapped.Offset = static_cast<DWORD>(offset);
+    overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+
+    DWORD n = 0;
+
+    bool ret = m_funcs->fn_WriteFile(
+        m_handle,   // hFile
+        buf,        // lpBuffer
+        size,       // nNumberOfBytesToWrite
+        &n,         // lpNumberOfBytesWritten
+        &overlapped // lpOverlapped
+    );
+
+    std::error_code ec;
+    if (!ret) {
+        ec = ec_from_win32();
+    }
+
+    OUTCOME_TRYV(seek(static_cast<int64_t>(orig_pos), SEEK_SET));
+
+    if (ec) {
+        return ec;
+    }
+
+    return n;
+}
+
 bool Win32File::is_open()
 {
     return m_handle != INVALID_HANDLE_VALUE;
@@ -28,9 +28,16 @@
 #endif
 
 #include <cerrno>
+#include <climits>
 #include <cstdio>
 #include <cstring>
 
+#ifdef __linux__
+#  include <sys/sendfile.h>
+#  include <sys/syscall.h>
+#  include <unistd.h>
+#endif
+
 #include "mbcommon/error_code.h"
 #include "mbcommon/file_error.h"
 
@@ -188,6 +195,68 @@ oc::result<void> file_write_exact(File &file, const void *buf, size_t size)
     return oc::success();
 }
 
+/*!
+ * \brief Write to a File handle from multiple buffers.
+ *
+ * This function differs from File::writev() in that it will call
+ * File::writev() repeatedly until all of the buffers in \p iov are written. If
+ * File::writev() returns std::errc::interrupted, then the write operation will
+ * be automatically reattempted. If EOF is reached before all of the data is
+ * written, then FileError::UnexpectedEof will be returned.
+ *
+ * If this function fails, it is unspecified how many bytes were written.
+ *
+ * \param file File handle
+ * \param iov Array of buffers to write from
+ * \param count Number of elements in \p iov
+ *
+ * \return Nothing if all of the buffers were successfully written. Otherwise,
+ *         the error code.
+ */
+oc::result<void> file_writev_exact(File &file, const ConstIoVec *iov,
+                                   size_t count)
+{
+    // Local copy so that partially written buffers can be adjusted
+    std::vector<ConstIoVec> remain(iov, iov + count);
+    size_t index = 0;
+
+    while (true) {
+        // Skip empty and fully written buffers
+        while (index < remain.size() && remain[index].size == 0) {
+            ++index;
+        }
+        if (index == remain.size()) {
+            break;
+        }
+
+        auto n = file.writev(remain.data() + index, remain.size() - index);
+        if (!n) {
+            if (n.error() == std::errc::interrupted) {
+                continue;
+            } else {
+                return n.as_failure();
+            }
+        } else if (n.value() == 0) {
+            return FileError::UnexpectedEof;
+        }
+
+        for (size_t written = n.value(); written > 0; ++index) {
+            auto &vec = remain[index];
+            auto consumed = std::min(written, vec.size);
+
+            vec.data = static_cast<const char *>(vec.data) + consumed;
+            vec.size -= consumed;
+            written -= consumed;
+
+            if (vec.size > 0) {
+                break;
+            }
+        }
+    }
+
+    return oc::success();
+}
+
 /*!
  * \brief Read from a File handle and discard the data.
  *
@@ -222,6 +291,53 @@ oc::result<uint64_t> file_read_discard(File &file, uint64_t size)
     return bytes_discarded;
 }
 
+/*! \cond INTERNAL */
+
+//! Patterns up to this size are searched with memchr() instead of Boyer-Moore
+static constexpr size_t MAX_SCAN_PATTERN_SIZE = 8;
+
+/*!
+ * Find the first occurrence of \p pattern in [\p begin, \p end).
+ *
+ * For short patterns, Boyer-Moore can only skip a few bytes at a time and does
+ * worse than the libc memchr(), which is vectorized on every platform we
+ * target. memchr() is used to find candidates for the first byte and each
+ * candidate is rejected by its last byte before comparing the full pattern.
+ *
+ * \return Pointer to the match or \p end if the pattern is not found
+ */
+static const unsigned char * scan_short_pattern(const unsigned char *begin,
+                                                const unsigned char *end,
+                                                const unsigned char *pattern,
+                                                size_t pattern_size)
+{
+    if (static_cast<size_t>(end - begin) < pattern_size) {
+        return end;
+    }
+
+    const unsigned char first = pattern[0];
+    const unsigned char last = pattern[pattern_size - 1];
+    // Last position where a match can begin (exclusive)
+    const unsigned char *limit = end - pattern_size + 1;
+
+    for (auto it = begin; it < limit; ++it) {
+        it = static_cast<const unsigned char *>(
+                memchr(it, first, static_cast<size_t>(limit - it)));
+        if (!it) {
+            break;
+        }
+
+        if (it[pattern_size - 1] == last
+                && memcmp(it + 1, pattern + 1, pattern_size - 1) == 0) {
+            return it;
+        }
+    }
+
+    return end;
+}
+
+/*! \endcond */
+
 /*!
  * \class FileSearcher
  *
@@ -239,12 +355,16 @@ FileSearcher::FileSearcher(File *file, const void *pattern, size_t pattern_size)
     : m_file(file)
     , m_pattern(pattern)
     , m_pattern_size(pattern_size)
-    , m_searcher({static_cast<const unsigned char *>(pattern),
-                  static_cast<const unsigned char *>(pattern) + pattern_size})
     , m_region_begin(0)
     , m_region_end(0)
     , m_offset(0)
 {
+    if (pattern_size > MAX_SCAN_PATTERN_SIZE) {
+        m_searcher.emplace(
+                static_cast<const unsigned char *>(pattern),
+                static_cast<const unsigned char *>(pattern) + pattern_size);
+    }
+
     auto buf_size = DEFAULT_BUFFER_SIZE;
 
     if (pattern_size > SIZE_MAX / 2) {
@@ -340,10 +460,20 @@ oc::result<std::optional<uint64_t>> FileSearcher::next()
     }
 
     while (true) {
+        const unsigned char *begin = m_buf.data() + m_region_begin;
+        const unsigned char *end = m_buf.data() + m_region_end;
+        const unsigned char *it;
+
         // Find pattern in current buffer
-        if (auto it = std2::search(m_buf.data() + m_region_begin,
-                                   m_buf.data() + m_region_end, *m_searcher);
-                it != m_buf.data() + m_region_end) {
+        if (m_searcher) {
+            it = std2::search(begin, end, *m_searcher);
+        } else {
+            it = scan_short_pattern(
+                    begin, end, static_cast<const unsigned char *>(m_pattern),
+                    m_pattern_size);
+        }
+
+        if (it != end) {
             auto match_index = static_cast<size_t>(it - m_buf.data());
             auto match_offset = m_offset + match_index;
 
@@ -394,6 +524,166 @@ void FileSearcher::clear() noexcept
     m_offset = 0;
 }
 
+#ifdef __linux__
+/*! \cond INTERNAL */
+
+//! Maximum number of bytes the kernel will transfer in a single call
+static constexpr size_t KERNEL_COPY_MAX = 0x7ffff000;
+
+static ssize_t sys_copy_file_range(int fd_in, loff_t *off_in,
+                                   int fd_out, loff_t *off_out, size_t len)
+{
+#ifdef __NR_copy_file_range
+    return syscall(__NR_copy_file_range, fd_in, off_in, fd_out, off_out,
+                   len, 0u);
+#else
+    (void) fd_in;
+    (void) off_in;
+    (void) fd_out;
+    (void) off_out;
+    (void) len;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+/*!
+ * Check if the error returned by copy_file_range() or sendfile() means that
+ * the operation is not supported for the pair of file descriptors, as opposed
+ * to an actual I/O error.
+ */
+static bool is_kernel_copy_unsupported(int error)
+{
+    return error == ENOSYS || error == EXDEV || error == EINVAL
+            || error == EOPNOTSUPP || error == EBADF;
+}
+
+/*!
+ * Copy data between file descriptors without going through userspace.
+ *
+ * If \p src_off and \p dst_off are nullptr, the file positions of the file
+ * descriptors are used and updated. Otherwise, the file positions are left
+ * unchanged. sendfile() is only used as a fallback in the former case.
+ *
+ * \return Number of bytes copied or std::nullopt if nothing was copied because
+ *         the kernel does not support copying between the file descriptors
+ *         or reported EOF before copying anything. Files in procfs, sysfs, and
+ *         some FUSE filesystems have a size of 0, so the kernel copy returns 0
+ *         for them even though reading them returns data.
+ */
+static oc::result<std::optional<uint64_t>>
+kernel_copy(int src_fd, loff_t *src_off, int dst_fd, loff_t *dst_off,
+            uint64_t size)
+{
+    bool use_copy_file_range = true;
+    uint64_t copied = 0;
+
+    while (copied < size) {
+        auto to_copy = static_cast<size_t>(
+                std::min<uint64_t>(KERNEL_COPY_MAX, size - copied));
+        ssize_t n;
+
+        if (use_copy_file_range) {
+            n = sys_copy_file_range(src_fd, src_off, dst_fd, dst_off, to_copy);
+        } else {
+            n = sendfile(dst_fd, src_fd, src_off, to_copy);
+        }
+
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            } else if (copied == 0 && is_kernel_copy_unsupported(errno)) {
+                if (use_copy_file_range && !dst_off) {
+                    use_copy_file_range = false;
+                    continue;
+                }
+                return std::nullopt;
+            }
+            return ec_from_errno();
+        } else if (n == 0) {
+            if (copied == 0) {
+                return std::nullopt;
+            }
+            break;
+        }
+
+        copied += static_cast<size_t>(n);
+    }
+
+    return copied;
+}
+
+/*! \endcond */
+#endif
+
+/*!
+ * \brief Copy data between File handles
+ *
+ * This function copies up to \p size bytes from the current file position of
+ * \p src to the current file position of \p dst. Both file positions are
+ * advanced by the number of bytes copied.
+ *
+ * If both File handles are backed by file descriptors (see File::native_fd())
+ * and the platform supports it, the data is copied by the kernel with
+ * `copy_file_range()` or `sendfile()` and never passes through userspace.
+ * Otherwise, the data is copied through a buffer of
+ * `detail::COPY_BUFFER_SIZE` bytes.
+ *
+ * \note If the return value, \p r, is less than \p size, then EOF was reached
+ *       in \p src after \p r bytes were copied.
+ *
+ * \param src Source file handle
+ * \param dst Destination file handle
+ * \param size Maximum number of bytes to copy
+ *
+ * \return Number of bytes copied if the data is successfully copied. Otherwise,
+ *         the error code. If an error occurs, the number of bytes copied is
+ *         unspecified.
+ */
+oc::result<uint64_t> file_copy(File &src, File &dst, uint64_t size)
+{
+    if (size == 0) {
+        return 0;
+    }
+
+#ifdef __linux__
+    int src_fd = src.native_fd();
+    int dst_fd = dst.native_fd();
+
+    if (src_fd >= 0 && dst_fd >= 0) {
+        OUTCOME_TRY(copied, kernel_copy(src_fd, nullptr, dst_fd, nullptr,
+                                        size));
+        if (copied) {
+            return *copied;
+        }
+    }
+#endif
+
+    std::vector<unsigned char> buf(static_cast<size_t>(
+            std::min<uint64_t>(COPY_BUFFER_SIZE, size)));
+    uint64_t copied = 0;
+
+    while (copied < size) {
+        auto to_read = static_cast<size_t>(
+                std::min<uint64_t>(buf.size(), size - copied));
+
+        OUTCOME_TRY(n_read, file_read_retry(src, buf.data(), to_read));
+        if (n_read == 0) {
+            break;
+        }
+
+        OUTCOME_TRYV(file_write_exact(dst, buf.data(), n_read));
+
+        copied += n_read;
+
+        if (n_read < to_read) {
+            break;
+        }
+    }
+
+    return copied;
+}
+
 /*!
  * \brief Move data in file
  *
@@ -404,7 +694,11 @@ void FileSearcher::clear() noexcept
  *
  * \note This function is very seek-heavy and may be slow if the handle cannot
  *       seek efficiently. It will perform two seeks per loop interation. Each
- *       iteration moves up to 10240 bytes.
+ *       iteration moves up to 10240 bytes. If the handle is backed by a file
+ *       descriptor (see File::native_fd()) and the source and destination
+ *       regions do not overlap, the data is instead moved by the kernel with
+ *       `copy_file_range()` where supported. In that case, the file position
+ *       is left unchanged.
  *
  * \note If the return value, \p r, is less than \p size, then the *first* \p r
  *       bytes have been copied from offset \p src to offset \p dest. This is
@@ -431,6 +725,22 @@ oc::result<uint64_t> file_move(File &file, uint64_t src, uint64_t dest,
         return FileError::ArgumentOutOfRange;
     }
 
+#ifdef __linux__
+    int fd = file.native_fd();
+
+    if (fd >= 0 && (src + size <= dest || dest + size <= src)
+            && src + size <= static_cast<uint64_t>(INT64_MAX)
+            && dest + size <= static_cast<uint64_t>(INT64_MAX)) {
+        auto src_off = static_cast<loff_t>(src);
+        auto dest_off = static_cast<loff_t>(dest);
+
+        OUTCOME_TRY(moved, kernel_copy(fd, &src_off, fd, &dest_off, size));
+        if (moved) {
+            return *moved;
+        }
+    }
+#endif
+
     char buf[10240];
     uint64_t size_moved = 0;
     const bool copy_forwards = dest < src;
@@ -0,0 +1,307 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbcommon/memory_budget.h"
+
+#include <algorithm>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+
+#include "mbcommon/error_code.h"
+#include "mbcommon/finally.h"
+#include "mbcommon/integer.h"
+#include "mbcommon/string.h"
+
+/*!
+ * \file mbcommon/memory_budget.h
+ * \brief Process-wide limit for large in-memory buffers
+ *
+ * Code paths that hold whole images or archives in memory reserve the space
+ * from the budget before allocating it. When a reservation is refused, they
+ * are expected to fall back to a temporary file in spill_dir() instead (see
+ * SpillFile). The budget starts out unlimited. Programs that may run on
+ * low-memory devices should call memory_budget_configure() or
+ * MemoryBudget::set_auto_limit() on startup.
+ */
+
+namespace mb
+{
+
+// Never budget less than this, even if the system is already low on memory
+static constexpr uint64_t MIN_LIMIT = 16 * 1024 * 1024;
+
+static oc::result<std::string> read_meminfo()
+{
+    FILE *fp = fopen("/proc/meminfo", "rb");
+    if (!fp) {
+        return ec_from_errno();
+    }
+
+    auto close_fp = finally([&] {
+        fclose(fp);
+    });
+
+    std::string meminfo;
+    char buf[1024];
+    size_t n;
+
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+        meminfo.append(buf, n);
+    }
+    if (ferror(fp)) {
+        return ec_from_errno();
+    }
+
+    return std::move(meminfo);
+}
+
+/*!
+ * \class MemoryBudget
+ *
+ * \brief Counter of reserved bytes with an upper bound
+ *
+ * Reservations are lock-free. The budget does not track who reserved what, so
+ * every successful try_reserve() must be paired with a release() of the same
+ * size.
+ */
+
+MemoryBudget::MemoryBudget(uint64_t limit)
+    : m_limit(limit)
+    , m_used(0)
+    , m_auto_pending(false)
+    , m_auto_context(MemoryContext::System)
+{
+}
+
+/*!
+ * \brief Set the maximum number of bytes that can be reserved
+ *
+ * Lowering the limit does not affect existing reservations. It only causes
+ * new reservations to fail until enough space is released.
+ */
+void MemoryBudget::set_limit(uint64_t limit)
+{
+    std::lock_guard lock(m_mutex);
+    m_limit.store(limit, std::memory_order_relaxed);
+    m_auto_pending.store(false, std::memory_order_release);
+}
+
+/*!
+ * \brief Compute the limit from the system's free memory on first use
+ *
+ * This is like calling memory_budget_configure(), except that
+ * `/proc/meminfo` is only read when the budget is first used. Programs that
+ * are executed often can call this on startup at no cost. If the limit cannot
+ * be computed, it remains unchanged.
+ *
+ * \param context Environment that the program runs in
+ */
+void MemoryBudget::set_auto_limit(MemoryContext context)
+{
+    std::lock_guard lock(m_mutex);
+    m_auto_context = context;
+    m_auto_pending.store(true, std::memory_order_release);
+}
+
+uint64_t MemoryBudget::limit()
+{
+    if (m_auto_pending.load(std::memory_order_acquire)) {
+        resolve_auto_limit();
+    }
+
+    return m_limit.load(std::memory_order_relaxed);
+}
+
+uint64_t MemoryBudget::used() const
+{
+    return m_used.load(std::memory_order_relaxed);
+}
+
+/*!
+ * \brief Reserve space from the budget
+ *
+ * \param size Number of bytes to reserve
+ *
+ * \return Whether the space was reserved. Nothing is reserved on failure.
+ */
+bool MemoryBudget::try_reserve(uint64_t size)
+{
+    uint64_t limit = this->limit();
+    uint64_t cur = m_used.load(std::memory_order_relaxed);
+
+    do {
+        if (cur > limit || size > limit - cur) {
+            return false;
+        }
+    } while (!m_used.compare_exchange_weak(cur, cur + size,
+                                           std::memory_order_relaxed));
+
+    return true;
+}
+
+/*!
+ * \brief Return previously reserved space to the budget
+ */
+void MemoryBudget::release(uint64_t size)
+{
+    m_used.fetch_sub(size, std::memory_order_relaxed);
+}
+
+/*!
+ * \brief Set the directory where temporary files are created when the budget
+ *        is exhausted
+ *
+ * The directory should not be on a tmpfs, which would defeat the purpose. An
+ * empty string (the default) means `$TMPDIR` or `/tmp`.
+ */
+void MemoryBudget::set_spill_dir(std::string dir)
+{
+    std::lock_guard lock(m_mutex);
+    m_spill_dir = std::move(dir);
+}
+
+std::string MemoryBudget::spill_dir() const
+{
+    {
+        std::lock_guard lock(m_mutex);
+        if (!m_spill_dir.empty()) {
+            return m_spill_dir;
+        }
+    }
+
+    const char *tmpdir = getenv("TMPDIR");
+    return tmpdir && *tmpdir ? tmpdir : "/tmp";
+}
+
+void MemoryBudget::resolve_auto_limit()
+{
+    std::lock_guard lock(m_mutex);
+
+    if (!m_auto_pending.load(std::memory_order_relaxed)) {
+        return;
+    }
+
+    if (auto meminfo = read_meminfo()) {
+        if (auto limit = memory_budget_limit(meminfo.value(), m_auto_context)) {
+            m_limit.store(limit.value(), std::memory_order_relaxed);
+        }
+    }
+
+    m_auto_pending.store(false, std::memory_order_release);
+}
+
+/*!
+ * \brief Get the process-wide budget
+ */
+MemoryBudget & MemoryBudget::instance()
+{
+    static MemoryBudget budget;
+    return budget;
+}
+
+/*!
+ * \brief Compute a budget from the contents of `/proc/meminfo`
+ *
+ * The budget is a fraction of the available memory (`MemAvailable`, or
+ * `MemFree` plus `Cached` on kernels older than 3.14): half in recovery and a
+ * quarter in the booted system, where apps may be killed to make room for us
+ * otherwise.
+ *
+ * \param meminfo Contents of `/proc/meminfo`
+ * \param context Environment that the program runs in
+ *
+ * \return Budget in bytes or std::errc::invalid_argument if the memory
+ *         statistics are missing
+ */
+oc::result<uint64_t> memory_budget_limit(std::string_view meminfo,
+                                         MemoryContext context)
+{
+    uint64_t available = 0;
+    uint64_t mem_free = 0;
+    uint64_t cached = 0;
+    bool have_available = false;
+    bool have_free = false;
+
+    for (auto const &line : split_sv(meminfo, "\n")) {
+        auto colon = line.find(':');
+        if (colon == std::string_view::npos) {
+            continue;
+        }
+
+        auto key = line.substr(0, colon);
+        auto value = line.substr(colon + 1);
+        uint64_t *target;
+
+        if (key == "MemAvailable") {
+            target = &available;
+            have_available = true;
+        } else if (key == "MemFree") {
+            target = &mem_free;
+            have_free = true;
+        } else if (key == "Cached") {
+            target = &cached;
+        } else {
+            continue;
+        }
+
+        // Values are in kiB
+        auto begin = value.find_first_not_of(' ');
+        auto end = value.find(' ', begin);
+        if (begin == std::string_view::npos
+                || !str_to_num(std::string(value.substr(begin, end - begin)).c_str(),
+                               10, *target)) {
+            return std::errc::invalid_argument;
+        }
+        *target *= 1024;
+    }
+
+    if (!have_available) {
+        if (!have_free) {
+            return std::errc::invalid_argument;
+        }
+        available = mem_free + cached;
+    }
+
+    uint64_t limit = context == MemoryContext::Recovery
+            ? available / 2 : available / 4;
+
+    return std::max(limit, MIN_LIMIT);
+}
+
+/*!
+ * \brief Set the process-wide budget based on the system's free memory
+ *
+ * \param context Environment that the program runs in
+ *
+ * \return Nothing on success or the error code on failure. The budget is not
+ *         changed on failure.
+ */
+oc::result<void> memory_budget_configure(MemoryContext context)
+{
+    OUTCOME_TRY(meminfo, read_meminfo());
+    OUTCOME_TRY(limit, memory_budget_limit(meminfo, context));
+
+    MemoryBudget::instance().set_limit(limit);
+
+    return oc::success();
+}
+
+}
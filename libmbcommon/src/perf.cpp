@@ -0,0 +1,336 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbcommon/perf.h"
+
+#include <algorithm>
+
+#include <cinttypes>
+#include <cmath>
+
+#include "mbcommon/string.h"
+
+/*!
+ * \file mbcommon/perf.h
+ * \brief Process-wide performance counters
+ *
+ * Metrics are usually declared as static objects next to the code they
+ * measure:
+ *
+ * \code{.cpp}
+ * static perf::Counter g_bytes_copied("util.copy.bytes");
+ *
+ * g_bytes_copied.add(n);
+ * \endcode
+ *
+ * Metrics register themselves on construction and all updates are lock-free
+ * relaxed atomic operations, so they are cheap enough for hot paths. Metrics
+ * are never unregistered, so they must outlive all calls to snapshot() and
+ * reset().
+ */
+
+namespace mb::perf
+{
+
+// Head of the intrusive list of registered metrics. Constant-initialized, so
+// metrics can be registered from other static initializers.
+static std::atomic<Metric *> g_head{nullptr};
+
+Metric::Metric(std::string name, MetricType type)
+    : m_name(std::move(name))
+    , m_type(type)
+    , m_next(g_head.load(std::memory_order_relaxed))
+{
+    while (!g_head.compare_exchange_weak(m_next, this,
+                                         std::memory_order_release,
+                                         std::memory_order_relaxed)) {
+    }
+}
+
+Metric::~Metric() = default;
+
+const std::string & Metric::name() const
+{
+    return m_name;
+}
+
+MetricType Metric::type() const
+{
+    return m_type;
+}
+
+/*!
+ * \brief Get the next registered metric
+ *
+ * \return Next metric or nullptr if this is the last one
+ */
+const Metric * Metric::next() const
+{
+    return m_next;
+}
+
+/*!
+ * \class Counter
+ *
+ * \brief Monotonically increasing counter
+ */
+
+Counter::Counter(std::string name)
+    : Metric(std::move(name), MetricType::Counter)
+    , m_value(0)
+{
+}
+
+uint64_t Counter::value() const
+{
+    return m_value.load(std::memory_order_relaxed);
+}
+
+void Counter::reset()
+{
+    m_value.store(0, std::memory_order_relaxed);
+}
+
+/*!
+ * \class Histogram
+ *
+ * \brief Distribution of values in power-of-two buckets
+ *
+ * The count, sum, and buckets are updated independently, so a snapshot taken
+ * while values are being recorded may be off by the in-flight samples.
+ */
+
+Histogram::Histogram(std::string name)
+    : Metric(std::move(name), MetricType::Histogram)
+    , m_count(0)
+    , m_sum(0)
+    , m_max(0)
+{
+    for (auto &b : m_buckets) {
+        b.store(0, std::memory_order_relaxed);
+    }
+}
+
+void Histogram::record(uint64_t value)
+{
+    size_t index = 0;
+#ifdef __GNUC__
+    if (value != 0) {
+        index = 64 - static_cast<size_t>(__builtin_clzll(value));
+    }
+#else
+    while (index < 64 && (value >> index) != 0) {
+        ++index;
+    }
+#endif
+
+    m_buckets[index].fetch_add(1, std::memory_order_relaxed);
+    m_count.fetch_add(1, std::memory_order_relaxed);
+    m_sum.fetch_add(value, std::memory_order_relaxed);
+
+    uint64_t cur = m_max.load(std::memory_order_relaxed);
+    while (cur < value && !m_max.compare_exchange_weak(
+            cur, value, std::memory_order_relaxed)) {
+    }
+}
+
+uint64_t Histogram::count() const
+{
+    return m_count.load(std::memory_order_relaxed);
+}
+
+uint64_t Histogram::sum() const
+{
+    return m_sum.load(std::memory_order_relaxed);
+}
+
+uint64_t Histogram::max() const
+{
+    return m_max.load(std::memory_order_relaxed);
+}
+
+uint64_t Histogram::bucket(size_t index) const
+{
+    return m_buckets[index].load(std::memory_order_relaxed);
+}
+
+void Histogram::reset()
+{
+    for (auto &b : m_buckets) {
+        b.store(0, std::memory_order_relaxed);
+    }
+    m_count.store(0, std::memory_order_relaxed);
+    m_sum.store(0, std::memory_order_relaxed);
+    m_max.store(0, std::memory_order_relaxed);
+}
+
+/*!
+ * \class ScopedTimer
+ *
+ * \brief Record the lifetime of the timer in a histogram (in microseconds)
+ */
+
+ScopedTimer::ScopedTimer(Histogram &histogram)
+    : m_histogram(histogram)
+    , m_start(std::chrono::steady_clock::now())
+{
+}
+
+ScopedTimer::~ScopedTimer()
+{
+    auto elapsed = std::chrono::steady_clock::now() - m_start;
+    m_histogram.record(static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::microseconds>(elapsed)
+                    .count()));
+}
+
+/*!
+ * \brief Get the most recently registered metric
+ *
+ * Use Metric::next() to iterate over the rest of the registered metrics.
+ *
+ * \return Metric or nullptr if no metrics are registered
+ */
+const Metric * first_metric()
+{
+    return g_head.load(std::memory_order_acquire);
+}
+
+/*!
+ * \brief Take a snapshot of all registered metrics
+ *
+ * \return Metrics sorted by name
+ */
+std::vector<MetricSnapshot> snapshot()
+{
+    std::vector<MetricSnapshot> result;
+
+    for (auto m = first_metric(); m; m = m->next()) {
+        MetricSnapshot s{};
+        s.name = m->name();
+        s.type = m->type();
+
+        if (m->type() == MetricType::Counter) {
+            s.count = static_cast<const Counter *>(m)->value();
+        } else {
+            auto h = static_cast<const Histogram *>(m);
+            s.count = h->count();
+            s.sum = h->sum();
+            s.max = h->max();
+            s.buckets.resize(Histogram::BUCKETS);
+            for (size_t i = 0; i < Histogram::BUCKETS; ++i) {
+                s.buckets[i] = h->bucket(i);
+            }
+        }
+
+        result.push_back(std::move(s));
+    }
+
+    std::sort(result.begin(), result.end(),
+              [](const MetricSnapshot &a, const MetricSnapshot &b) {
+        return a.name < b.name;
+    });
+
+    return result;
+}
+
+/*!
+ * \brief Reset all registered metrics to zero
+ */
+void reset()
+{
+    for (auto m = g_head.load(std::memory_order_acquire); m;
+            m = const_cast<Metric *>(m->next())) {
+        if (m->type() == MetricType::Counter) {
+            static_cast<Counter *>(m)->reset();
+        } else {
+            static_cast<Histogram *>(m)->reset();
+        }
+    }
+}
+
+/*!
+ * \brief Estimate a percentile of a histogram snapshot
+ *
+ * \param metric Histogram snapshot
+ * \param p Percentile in [0, 1]
+ *
+ * \return Upper bound of the bucket containing the percentile (capped at the
+ *         maximum value) or 0 if there are no samples
+ */
+uint64_t percentile(const MetricSnapshot &metric, double p)
+{
+    uint64_t total = 0;
+    for (auto n : metric.buckets) {
+        total += n;
+    }
+    if (total == 0) {
+        return 0;
+    }
+
+    auto rank = static_cast<uint64_t>(std::ceil(p * static_cast<double>(total)));
+    rank = std::clamp<uint64_t>(rank, 1, total);
+
+    uint64_t seen = 0;
+    for (size_t i = 0; i < metric.buckets.size(); ++i) {
+        seen += metric.buckets[i];
+        if (seen >= rank) {
+            uint64_t upper = i == 0 ? 0
+                    : i >= 64 ? UINT64_MAX
+                    : (UINT64_C(1) << i) - 1;
+            return std::min(upper, metric.max);
+        }
+    }
+
+    return metric.max;
+}
+
+/*!
+ * \brief Format metrics as human-readable text
+ *
+ * Each metric is printed on its own line. Counters show their value.
+ * Histograms show the number of samples, average, approximate percentiles, and
+ * the maximum.
+ *
+ * \param metrics Metrics returned by snapshot()
+ *
+ * \return Formatted text
+ */
+std::string format_snapshot(const std::vector<MetricSnapshot> &metrics)
+{
+    std::string result;
+
+    for (auto const &m : metrics) {
+        if (m.type == MetricType::Counter) {
+            result += format("%-44s %" PRIu64 "\n", m.name.c_str(), m.count);
+        } else {
+            result += format("%-44s count=%" PRIu64 " avg=%" PRIu64
+                             " p50<=%" PRIu64 " p90<=%" PRIu64
+                             " p99<=%" PRIu64 " max=%" PRIu64 "\n",
+                             m.name.c_str(), m.count,
+                             m.count ? m.sum / m.count : 0,
+                             percentile(m, 0.5), percentile(m, 0.9),
+                             percentile(m, 0.99), m.max);
+        }
+    }
+
+    return result;
+}
+
+}
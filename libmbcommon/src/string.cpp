@@ -162,37 +162,9 @@ std::string format(const char *fmt, ...)
  */
 oc::result<std::string> format_v_safe(const char *fmt, va_list ap)
 {
-    static_assert(INT_MAX <= SIZE_MAX, "INT_MAX > SIZE_MAX");
-
-    ErrorRestorer restorer;
-    int ret;
-    va_list copy;
     std::string buf;
 
-    va_copy(copy, ap);
-    ret = vsnprintf(nullptr, 0, fmt, copy);
-    va_end(copy);
-
-    if (ret < 0) {
-        return ec_from_errno();
-    } else if (static_cast<size_t>(ret) == SIZE_MAX) {
-        return std::make_error_code(std::errc::value_too_large);
-    }
-
-    // C++11 guarantees that the memory is contiguous, but does not guarantee
-    // that the internal buffer is NULL-terminated, so we'll make room for '\0'
-    // and then get rid of it.
-    buf.resize(static_cast<size_t>(ret) + 1);
-
-    va_copy(copy, ap);
-    ret = vsnprintf(buf.data(), buf.size(), fmt, copy);
-    va_end(copy);
-
-    if (ret < 0) {
-        return ec_from_errno();
-    }
-
-    buf.resize(static_cast<size_t>(ret));
+    OUTCOME_TRYV(format_to_v(buf, fmt, ap));
 
     return std::move(buf);
 }
@@ -225,6 +197,156 @@ std::string format_v(const char *fmt, va_list ap)
     return std::move(result.value());
 }
 
+/*!
+ * \brief Format a string and append it to an existing string
+ *
+ * Unlike format(), this reuses the existing capacity of \p out. If the result
+ * fits in the unused capacity, the arguments are only formatted once and no
+ * memory is allocated. This makes it suitable for reusing a single buffer in
+ * frequently called code.
+ *
+ * \note The value of `errno` and `GetLastError()` (on Win32) are always
+ *       preserved.
+ *
+ * \param[in,out] out String to append to. The contents are left unchanged if
+ *                    an error occurs.
+ * \param fmt Format string
+ * \param ... Format arguments
+ *
+ * \return Number of characters appended to \p out or error.
+ */
+oc::result<size_t> format_to(std::string &out, const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    auto result = format_to_v(out, fmt, ap);
+    va_end(ap);
+
+    return result;
+}
+
+/*!
+ * \brief Format a string into a fixed-size buffer
+ *
+ * \note The value of `errno` and `GetLastError()` (on Win32) are always
+ *       preserved.
+ *
+ * \param buf Output buffer. If \p size is non-zero, it is always
+ *            NULL-terminated, even if an error occurs.
+ * \param size Size of \p buf, including space for the NULL terminator
+ * \param fmt Format string
+ * \param ... Format arguments
+ *
+ * \return Number of characters written to \p buf, excluding the NULL
+ *         terminator, or error. If the result does not fit in \p buf,
+ *         `std::errc::value_too_large` is returned and \p buf contains the
+ *         truncated result.
+ */
+oc::result<size_t> format_to(char *buf, size_t size, const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    auto result = format_to_v(buf, size, fmt, ap);
+    va_end(ap);
+
+    return result;
+}
+
+/*!
+ * \brief Format a string using a `va_list` and append it to an existing string
+ *
+ * \sa format_to(std::string &, const char *, ...)
+ *
+ * \param[in,out] out String to append to
+ * \param fmt Format string
+ * \param ap Format arguments as `va_list`
+ *
+ * \return Number of characters appended to \p out or error.
+ */
+oc::result<size_t> format_to_v(std::string &out, const char *fmt, va_list ap)
+{
+    static_assert(INT_MAX <= SIZE_MAX, "INT_MAX > SIZE_MAX");
+
+    ErrorRestorer restorer;
+    int ret;
+    va_list copy;
+    size_t old_size = out.size();
+
+    // Format directly into the unused capacity first. std::string always has
+    // room for the NULL terminator past capacity(), but we temporarily resize
+    // to capacity() so that the characters written are part of the string.
+    out.resize(out.capacity());
+    size_t avail = out.size() - old_size;
+
+    va_copy(copy, ap);
+    ret = vsnprintf(out.data() + old_size, avail + 1, fmt, copy);
+    va_end(copy);
+
+    if (ret < 0) {
+        out.resize(old_size);
+        return ec_from_errno();
+    } else if (static_cast<size_t>(ret) > SIZE_MAX - 1 - old_size) {
+        out.resize(old_size);
+        return std::make_error_code(std::errc::value_too_large);
+    }
+
+    auto n = static_cast<size_t>(ret);
+
+    if (n > avail) {
+        out.resize(old_size + n);
+
+        va_copy(copy, ap);
+        ret = vsnprintf(out.data() + old_size, n + 1, fmt, copy);
+        va_end(copy);
+
+        if (ret < 0) {
+            out.resize(old_size);
+            return ec_from_errno();
+        }
+    }
+
+    out.resize(old_size + n);
+
+    return n;
+}
+
+/*!
+ * \brief Format a string using a `va_list` into a fixed-size buffer
+ *
+ * \sa format_to(char *, size_t, const char *, ...)
+ *
+ * \param buf Output buffer
+ * \param size Size of \p buf, including space for the NULL terminator
+ * \param fmt Format string
+ * \param ap Format arguments as `va_list`
+ *
+ * \return Number of characters written to \p buf, excluding the NULL
+ *         terminator, or error.
+ */
+oc::result<size_t> format_to_v(char *buf, size_t size, const char *fmt,
+                               va_list ap)
+{
+    ErrorRestorer restorer;
+    va_list copy;
+
+    va_copy(copy, ap);
+    int ret = vsnprintf(buf, size, fmt, copy);
+    va_end(copy);
+
+    if (ret < 0) {
+        if (size > 0) {
+            buf[0] = '\0';
+        }
+        return ec_from_errno();
+    } else if (static_cast<size_t>(ret) >= size) {
+        return std::make_error_code(std::errc::value_too_large);
+    }
+
+    return static_cast<size_t>(ret);
+}
+
 /*!
  * \brief Check if string has prefix (case sensitive)
  *
@@ -0,0 +1,482 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbcommon/thread_pool.h"
+
+#include <algorithm>
+#include <deque>
+#include <limits>
+#include <thread>
+
+/*!
+ * \file mbcommon/thread_pool.h
+ * \brief Shared work-stealing thread pool
+ */
+
+namespace mb
+{
+
+/*! \cond INTERNAL */
+struct ThreadPool::Worker
+{
+    std::mutex mutex;
+    // The owning thread pushes and pops at the back. Other threads steal from
+    // the front.
+    std::deque<Task> tasks;
+    std::thread thread;
+};
+
+struct TaskGroup::State
+{
+    std::mutex mutex;
+    // Signaled when the last outstanding task completes
+    std::condition_variable cv;
+    size_t outstanding = 0;
+    std::atomic_bool cancelled{false};
+};
+
+static std::atomic_uint g_thread_limit{0};
+
+// Pool and worker index of the current thread, if it is a pool worker
+static thread_local ThreadPool *t_pool = nullptr;
+static thread_local size_t t_index = 0;
+/*! \endcond */
+
+/*!
+ * \brief Limit the number of threads used by all parallel operations
+ *
+ * This is the one place where the process-wide parallelism is configured. It
+ * affects ThreadPool::global(), thread_count(), parallel_for(), and
+ * run_bounded(). Since the global pool is created on first use, this should be
+ * called before anything submits work to it.
+ *
+ * A limit of 1 makes ThreadPool::global() run all tasks inline on the calling
+ * thread. This is meant for environments where spawning threads is undesirable,
+ * like mbtool running as init.
+ *
+ * \param limit Maximum number of threads or 0 to use all available CPUs
+ */
+void set_thread_limit(unsigned int limit)
+{
+    g_thread_limit.store(limit, std::memory_order_relaxed);
+}
+
+/*!
+ * \brief Get the limit set by set_thread_limit()
+ *
+ * \return Maximum number of threads or 0 if there is no limit
+ */
+unsigned int thread_limit()
+{
+    return g_thread_limit.load(std::memory_order_relaxed);
+}
+
+/*!
+ * \brief Get the number of threads a CPU-bound operation should use
+ *
+ * The result is the number of available CPUs (or 1 if it cannot be
+ * determined, eg. because /sys is not mounted yet), capped by thread_limit()
+ * and then clamped to [\p min_threads, \p max_threads]. The lower bound takes
+ * precedence over the thread limit for callers that require a minimum number
+ * of threads to function.
+ *
+ * \param min_threads Minimum number of threads
+ * \param max_threads Maximum number of threads (must be >= \p min_threads)
+ *
+ * \return Number of threads to use
+ */
+unsigned int thread_count(unsigned int min_threads, unsigned int max_threads)
+{
+    unsigned int n = std::max(std::thread::hardware_concurrency(), 1u);
+
+    if (auto limit = thread_limit(); limit > 0) {
+        n = std::min(n, limit);
+    }
+
+    return std::clamp(n, min_threads, max_threads);
+}
+
+/*!
+ * \class ThreadPool
+ *
+ * \brief Fixed-size work-stealing thread pool
+ *
+ * Each worker has its own task deque. Tasks submitted from a worker thread are
+ * pushed to that worker's deque and are run in LIFO order by the worker. Tasks
+ * submitted from other threads are distributed round-robin. Idle workers steal
+ * from the front of the other workers' deques.
+ *
+ * A pool with no worker threads runs tasks inline in submit().
+ */
+
+/*!
+ * \brief Construct pool and start worker threads
+ *
+ * \param threads Number of worker threads. If this is 0 or 1, no threads are
+ *                started and tasks run inline in submit().
+ */
+ThreadPool::ThreadPool(unsigned int threads)
+    : m_next(0)
+    , m_pending(0)
+    , m_stop(false)
+{
+    if (threads > 1) {
+        for (unsigned int i = 0; i < threads; ++i) {
+            m_workers.push_back(std::make_unique<Worker>());
+        }
+        for (size_t i = 0; i < m_workers.size(); ++i) {
+            m_workers[i]->thread = std::thread(&ThreadPool::worker, this, i);
+        }
+    }
+}
+
+/*!
+ * \brief Run all remaining tasks and stop the worker threads
+ */
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard lock(m_mutex);
+        m_stop = true;
+    }
+    m_cv.notify_all();
+
+    for (auto &w : m_workers) {
+        w->thread.join();
+    }
+}
+
+/*!
+ * \brief Get the number of worker threads
+ *
+ * \return Number of worker threads or 0 if tasks run inline
+ */
+unsigned int ThreadPool::threads() const
+{
+    return static_cast<unsigned int>(m_workers.size());
+}
+
+/*!
+ * \brief Queue a task
+ *
+ * \param task Task to run on one of the worker threads
+ */
+void ThreadPool::submit(Task task)
+{
+    if (m_workers.empty()) {
+        task();
+        return;
+    }
+
+    size_t index = t_pool == this
+            ? t_index
+            : m_next.fetch_add(1, std::memory_order_relaxed) % m_workers.size();
+
+    // Count the task before it becomes visible so that a worker that takes it
+    // immediately cannot underflow the counter
+    {
+        std::lock_guard lock(m_mutex);
+        ++m_pending;
+    }
+
+    {
+        auto &w = *m_workers[index];
+        std::lock_guard lock(w.mutex);
+        w.tasks.push_back(std::move(task));
+    }
+
+    m_cv.notify_one();
+}
+
+/*!
+ * \brief Run one queued task on the calling thread
+ *
+ * This allows threads that are waiting for tasks to help complete them instead
+ * of blocking, which also prevents deadlocks when a task waits for subtasks.
+ *
+ * \return Whether a task was run
+ */
+bool ThreadPool::run_pending_task()
+{
+    if (m_workers.empty()) {
+        return false;
+    }
+
+    Task task;
+    bool found = t_pool == this
+            ? pop_task(t_index, true, task)
+            : pop_task(m_next.load(std::memory_order_relaxed)
+                    % m_workers.size(), false, task);
+
+    if (found) {
+        task();
+    }
+
+    return found;
+}
+
+/*!
+ * \brief Get the process-wide thread pool
+ *
+ * The pool is created on first use with thread_count(1, UINT_MAX) workers. If
+ * that is 1, the pool runs tasks inline.
+ *
+ * \return Global thread pool
+ */
+ThreadPool & ThreadPool::global()
+{
+    static ThreadPool pool(
+            thread_count(1, std::numeric_limits<unsigned int>::max()));
+    return pool;
+}
+
+/*! \cond INTERNAL */
+bool ThreadPool::pop_task(size_t index, bool own, Task &task)
+{
+    const size_t n = m_workers.size();
+
+    for (size_t i = 0; i < n; ++i) {
+        auto &w = *m_workers[(index + i) % n];
+        std::lock_guard lock(w.mutex);
+
+        if (w.tasks.empty()) {
+            continue;
+        }
+
+        if (i == 0 && own) {
+            task = std::move(w.tasks.back());
+            w.tasks.pop_back();
+        } else {
+            task = std::move(w.tasks.front());
+            w.tasks.pop_front();
+        }
+
+        m_pending.fetch_sub(1);
+        return true;
+    }
+
+    return false;
+}
+
+void ThreadPool::worker(size_t index)
+{
+    t_pool = this;
+    t_index = index;
+
+    while (true) {
+        Task task;
+
+        if (pop_task(index, true, task)) {
+            task();
+            continue;
+        }
+
+        std::unique_lock lock(m_mutex);
+        m_cv.wait(lock, [&] {
+            return m_stop || m_pending > 0;
+        });
+
+        if (m_stop && m_pending == 0) {
+            break;
+        }
+    }
+}
+/*! \endcond */
+
+/*!
+ * \class TaskGroup
+ *
+ * \brief Set of tasks that can be waited on and cancelled together
+ *
+ * The destructor waits for all tasks in the group to complete.
+ */
+
+/*!
+ * \brief Construct task group that runs tasks on ThreadPool::global()
+ */
+TaskGroup::TaskGroup()
+    : TaskGroup(ThreadPool::global())
+{
+}
+
+/*!
+ * \brief Construct task group that runs tasks on \p pool
+ *
+ * \param pool Thread pool to run tasks on
+ */
+TaskGroup::TaskGroup(ThreadPool &pool)
+    : m_pool(pool)
+    , m_state(std::make_shared<State>())
+{
+}
+
+TaskGroup::~TaskGroup()
+{
+    wait();
+}
+
+/*!
+ * \brief Run a task as part of the group
+ *
+ * If the group has been cancelled, \p task is discarded.
+ *
+ * \param task Task to run
+ */
+void TaskGroup::run(Task task)
+{
+    if (is_cancelled()) {
+        return;
+    }
+
+    {
+        std::lock_guard lock(m_state->mutex);
+        ++m_state->outstanding;
+    }
+
+    m_pool.submit([state = m_state, task = std::move(task)] {
+        if (!state->cancelled.load(std::memory_order_relaxed)) {
+            task();
+        }
+
+        std::lock_guard lock(state->mutex);
+        if (--state->outstanding == 0) {
+            state->cv.notify_all();
+        }
+    });
+}
+
+/*!
+ * \brief Wait for all tasks in the group to complete
+ *
+ * While waiting, the calling thread runs queued tasks from the pool.
+ */
+void TaskGroup::wait()
+{
+    std::unique_lock lock(m_state->mutex);
+
+    while (m_state->outstanding > 0) {
+        lock.unlock();
+        bool ran = m_pool.run_pending_task();
+        lock.lock();
+
+        // Nothing is queued, so the remaining tasks are running elsewhere
+        if (!ran && m_state->outstanding > 0) {
+            m_state->cv.wait(lock);
+        }
+    }
+}
+
+/*!
+ * \brief Cancel the group
+ *
+ * Tasks that have not started yet are skipped and further calls to run() are
+ * ignored. Running tasks can check is_cancelled() to stop early.
+ */
+void TaskGroup::cancel()
+{
+    m_state->cancelled.store(true, std::memory_order_relaxed);
+}
+
+/*!
+ * \brief Check whether the group has been cancelled
+ *
+ * \return Whether cancel() has been called
+ */
+bool TaskGroup::is_cancelled() const
+{
+    return m_state->cancelled.load(std::memory_order_relaxed);
+}
+
+/*!
+ * \brief Run CPU-bound work in parallel on the global thread pool
+ *
+ * \p fn is called once for each index in [0, \p n). The calling thread
+ * participates, so at most \p max_threads threads (including the caller) run
+ * \p fn at the same time.
+ *
+ * \param n Number of items
+ * \param max_threads Maximum number of threads or 0 for no limit
+ * \param fn Function to call for each index
+ */
+void parallel_for(size_t n, unsigned int max_threads,
+                  const std::function<void(size_t)> &fn)
+{
+    if (n == 0) {
+        return;
+    }
+
+    auto &pool = ThreadPool::global();
+    size_t n_tasks = std::min<size_t>(n, pool.threads() + 1);
+    if (max_threads > 0) {
+        n_tasks = std::min<size_t>(n_tasks, max_threads);
+    }
+
+    std::atomic_size_t next(0);
+    auto loop = [&] {
+        for (size_t i; (i = next.fetch_add(1)) < n;) {
+            fn(i);
+        }
+    };
+
+    TaskGroup group(pool);
+    for (size_t i = 1; i < n_tasks; ++i) {
+        group.run(loop);
+    }
+    loop();
+    group.wait();
+}
+
+/*!
+ * \brief Run I/O-bound work with bounded parallelism
+ *
+ * Like parallel_for(), but uses dedicated threads instead of the global thread
+ * pool so that blocking I/O does not tie up the pool's workers. The number of
+ * threads (including the caller) is bounded by \p max_threads and
+ * thread_limit(), but not by the number of CPUs.
+ *
+ * \param n Number of items
+ * \param max_threads Maximum number of threads
+ * \param fn Function to call for each index
+ */
+void run_bounded(size_t n, unsigned int max_threads,
+                 const std::function<void(size_t)> &fn)
+{
+    size_t n_threads = std::min<size_t>(n, std::max(max_threads, 1u));
+    if (auto limit = thread_limit(); limit > 0) {
+        n_threads = std::min<size_t>(n_threads, limit);
+    }
+
+    std::atomic_size_t next(0);
+    auto loop = [&] {
+        for (size_t i; (i = next.fetch_add(1)) < n;) {
+            fn(i);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < n_threads; ++i) {
+        threads.emplace_back(loop);
+    }
+    loop();
+    for (auto &t : threads) {
+        t.join();
+    }
+}
+
+}
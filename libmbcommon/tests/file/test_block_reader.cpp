@@ -0,0 +1,162 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <optional>
+#include <vector>
+
+#include <cstdio>
+
+#include "mbcommon/file/block_reader.h"
+#include "mbcommon/file/memory.h"
+#include "mbcommon/file_error.h"
+
+using namespace mb;
+
+// Behaves like a regular file that cannot be accessed as a mapping
+class UnmappedMemoryFile : public MemoryFile
+{
+public:
+    using MemoryFile::MemoryFile;
+
+    std::optional<ConstIoVec> mapped_data() override
+    {
+        return std::nullopt;
+    }
+};
+
+// Behaves like a pipe
+class UnseekableMemoryFile : public UnmappedMemoryFile
+{
+public:
+    using UnmappedMemoryFile::UnmappedMemoryFile;
+
+    oc::result<uint64_t> seek(int64_t offset, int whence) override
+    {
+        (void) offset;
+        (void) whence;
+        return FileError::UnsupportedSeek;
+    }
+};
+
+struct FileBlockReaderTest : testing::Test
+{
+    std::vector<unsigned char> _data;
+
+    void SetUp() override
+    {
+        _data.resize(1000);
+        for (size_t i = 0; i < _data.size(); ++i) {
+            _data[i] = static_cast<unsigned char>(i % 251);
+        }
+    }
+};
+
+TEST_F(FileBlockReaderTest, CheckInvalidStates)
+{
+    BlockReader reader;
+    const void *data;
+
+    auto error = oc::failure(FileError::InvalidState);
+
+    ASSERT_EQ(reader.read(&data), error);
+    ASSERT_EQ(reader.skip(1), error);
+    ASSERT_EQ(reader.seek(0, SEEK_SET), error);
+}
+
+TEST_F(FileBlockReaderTest, ReadMappedFileWithoutCopying)
+{
+    MemoryFile file(_data.data(), _data.size());
+    ASSERT_TRUE(file.is_open());
+
+    BlockReader reader(&file, 300);
+    const void *data;
+
+    for (size_t offset = 0; offset < _data.size(); offset += 300) {
+        auto n = reader.read(&data);
+        ASSERT_TRUE(n);
+        ASSERT_EQ(n.value(), std::min<size_t>(300, _data.size() - offset));
+        ASSERT_EQ(data, _data.data() + offset);
+    }
+
+    ASSERT_EQ(reader.read(&data), oc::success(0u));
+}
+
+TEST_F(FileBlockReaderTest, ReadUnmappedFileInFullBlocks)
+{
+    UnmappedMemoryFile file(_data.data(), _data.size());
+    ASSERT_TRUE(file.is_open());
+
+    BlockReader reader(&file, 300);
+    const void *data;
+    std::vector<unsigned char> result;
+
+    while (true) {
+        auto n = reader.read(&data);
+        ASSERT_TRUE(n);
+        if (n.value() == 0) {
+            break;
+        }
+
+        ASSERT_NE(data, _data.data());
+        auto ptr = static_cast<const unsigned char *>(data);
+        result.insert(result.end(), ptr, ptr + n.value());
+    }
+
+    ASSERT_EQ(result, _data);
+}
+
+TEST_F(FileBlockReaderTest, SkipDoesNotRead)
+{
+    UnmappedMemoryFile file(_data.data(), _data.size());
+    ASSERT_TRUE(file.is_open());
+
+    BlockReader reader(&file, 100);
+    const void *data;
+
+    ASSERT_EQ(reader.skip(950), oc::success(950u));
+
+    auto n = reader.read(&data);
+    ASSERT_EQ(n, oc::success(50u));
+    ASSERT_EQ(*static_cast<const unsigned char *>(data), _data[950]);
+}
+
+TEST_F(FileBlockReaderTest, SkipMappedFileClampsToEof)
+{
+    MemoryFile file(_data.data(), _data.size());
+    ASSERT_TRUE(file.is_open());
+
+    BlockReader reader(&file);
+    const void *data;
+
+    ASSERT_EQ(reader.skip(900), oc::success(900u));
+    ASSERT_EQ(reader.skip(900), oc::success(100u));
+    ASSERT_EQ(reader.read(&data), oc::success(0u));
+}
+
+TEST_F(FileBlockReaderTest, SkipUnseekableFileSkipsNothing)
+{
+    UnseekableMemoryFile file(_data.data(), _data.size());
+    ASSERT_TRUE(file.is_open());
+
+    BlockReader reader(&file);
+
+    ASSERT_EQ(reader.skip(100), oc::success(0u));
+}
@@ -0,0 +1,225 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <cstdlib>
+#include <cstring>
+
+#include "mbcommon/file.h"
+#include "mbcommon/file/buffered.h"
+#include "mbcommon/file/memory.h"
+#include "mbcommon/file_error.h"
+#include "mbcommon/file_util.h"
+
+using namespace mb;
+
+class CountingMemoryFile : public MemoryFile
+{
+public:
+    using MemoryFile::MemoryFile;
+
+    oc::result<size_t> read(void *buf, size_t size) override
+    {
+        ++reads;
+        return MemoryFile::read(buf, size);
+    }
+
+    oc::result<size_t> write(const void *buf, size_t size) override
+    {
+        ++writes;
+        return MemoryFile::write(buf, size);
+    }
+
+    oc::result<uint64_t> seek(int64_t offset, int whence) override
+    {
+        ++seeks;
+        return MemoryFile::seek(offset, whence);
+    }
+
+    unsigned int reads = 0;
+    unsigned int writes = 0;
+    unsigned int seeks = 0;
+};
+
+struct FileBufferedTest : testing::Test
+{
+    char _data[64];
+
+    void SetUp() override
+    {
+        for (size_t i = 0; i < sizeof(_data); ++i) {
+            _data[i] = static_cast<char>('0' + i % 10);
+        }
+    }
+};
+
+TEST_F(FileBufferedTest, CheckInvalidStates)
+{
+    BufferedFile file;
+
+    auto error = oc::failure(FileError::InvalidState);
+
+    ASSERT_EQ(file.close(), error);
+    ASSERT_EQ(file.read(nullptr, 0), error);
+    ASSERT_EQ(file.write(nullptr, 0), error);
+    ASSERT_EQ(file.seek(0, SEEK_SET), error);
+    ASSERT_EQ(file.truncate(1024), error);
+    ASSERT_EQ(file.flush(), error);
+
+    ASSERT_EQ(file.open(nullptr), error);
+
+    CountingMemoryFile source(_data, sizeof(_data));
+    ASSERT_TRUE(file.open(&source));
+    ASSERT_EQ(file.open(&source), error);
+}
+
+TEST_F(FileBufferedTest, SmallReadsAreCoalesced)
+{
+    CountingMemoryFile source(_data, sizeof(_data));
+    BufferedFile file(&source, 16, 16);
+    ASSERT_TRUE(file.is_open());
+
+    source.seeks = 0;
+
+    char buf[4];
+    for (size_t i = 0; i < 4; ++i) {
+        ASSERT_TRUE(file_read_exact(file, buf, sizeof(buf)));
+        ASSERT_EQ(memcmp(buf, _data + i * 4, sizeof(buf)), 0);
+    }
+
+    ASSERT_EQ(source.reads, 1u);
+    ASSERT_EQ(source.seeks, 0u);
+}
+
+TEST_F(FileBufferedTest, LargeReadsBypassBuffer)
+{
+    CountingMemoryFile source(_data, sizeof(_data));
+    BufferedFile file(&source, 16, 16);
+    ASSERT_TRUE(file.is_open());
+
+    char buf[32];
+    ASSERT_EQ(file.read(buf, sizeof(buf)), oc::success(32u));
+    ASSERT_EQ(memcmp(buf, _data, sizeof(buf)), 0);
+    ASSERT_EQ(source.reads, 1u);
+}
+
+TEST_F(FileBufferedTest, SeekWithinBuffer)
+{
+    CountingMemoryFile source(_data, sizeof(_data));
+    BufferedFile file(&source, 16, 16);
+    ASSERT_TRUE(file.is_open());
+
+    source.seeks = 0;
+
+    char c;
+    ASSERT_EQ(file.read(&c, 1), oc::success(1u));
+    ASSERT_EQ(file.seek(10, SEEK_SET), oc::success(10u));
+    ASSERT_EQ(file.read(&c, 1), oc::success(1u));
+    ASSERT_EQ(c, _data[10]);
+    ASSERT_EQ(file.seek(-5, SEEK_CUR), oc::success(6u));
+    ASSERT_EQ(file.read(&c, 1), oc::success(1u));
+    ASSERT_EQ(c, _data[6]);
+
+    ASSERT_EQ(source.reads, 1u);
+    ASSERT_EQ(source.seeks, 0u);
+
+    // Seeking outside of the buffer must reach the underlying file
+    ASSERT_EQ(file.seek(40, SEEK_SET), oc::success(40u));
+    ASSERT_EQ(file.read(&c, 1), oc::success(1u));
+    ASSERT_EQ(c, _data[40]);
+    ASSERT_EQ(source.seeks, 1u);
+}
+
+TEST_F(FileBufferedTest, SmallWritesAreCoalesced)
+{
+    void *data = nullptr;
+    size_t data_size = 0;
+
+    CountingMemoryFile target(&data, &data_size);
+    BufferedFile file(&target, 16, 16);
+    ASSERT_TRUE(file.is_open());
+
+    for (size_t i = 0; i < 4; ++i) {
+        ASSERT_TRUE(file_write_exact(file, _data + i * 4, 4));
+    }
+
+    ASSERT_EQ(target.writes, 0u);
+    ASSERT_EQ(file.seek(0, SEEK_CUR), oc::success(16u));
+    ASSERT_EQ(target.writes, 1u);
+
+    ASSERT_TRUE(file.close());
+    ASSERT_EQ(data_size, 16u);
+    ASSERT_EQ(memcmp(data, _data, 16), 0);
+
+    ASSERT_TRUE(target.close());
+    free(data);
+}
+
+TEST_F(FileBufferedTest, ReadAfterWrite)
+{
+    char data[16] = {};
+
+    CountingMemoryFile target(data, sizeof(data));
+    BufferedFile file(&target, 8, 8);
+    ASSERT_TRUE(file.is_open());
+
+    ASSERT_TRUE(file_write_exact(file, "abcd", 4));
+    ASSERT_TRUE(file.seek(0, SEEK_SET));
+
+    char buf[4];
+    ASSERT_TRUE(file_read_exact(file, buf, sizeof(buf)));
+    ASSERT_EQ(memcmp(buf, "abcd", 4), 0);
+
+    // Writing after reading must write at the logical position
+    ASSERT_TRUE(file.seek(1, SEEK_SET));
+    ASSERT_TRUE(file.read(buf, 1));
+    ASSERT_TRUE(file_write_exact(file, "x", 1));
+    ASSERT_TRUE(file.flush());
+    ASSERT_EQ(memcmp(data, "abxd", 4), 0);
+    ASSERT_EQ(file.seek(0, SEEK_CUR), oc::success(3u));
+}
+
+TEST_F(FileBufferedTest, PositionalIoFlushesWrites)
+{
+    char data[16] = {};
+
+    CountingMemoryFile target(data, sizeof(data));
+    BufferedFile file(&target, 8, 8);
+    ASSERT_TRUE(file.is_open());
+
+    ASSERT_TRUE(file_write_exact(file, "abcd", 4));
+
+    char buf[2];
+    ASSERT_EQ(file.read_at(2, buf, sizeof(buf)), oc::success(2u));
+    ASSERT_EQ(memcmp(buf, "cd", 2), 0);
+    ASSERT_EQ(file.seek(0, SEEK_CUR), oc::success(4u));
+}
+
+TEST_F(FileBufferedTest, UnbufferedMode)
+{
+    CountingMemoryFile source(_data, sizeof(_data));
+    BufferedFile file(&source, 0, 0);
+    ASSERT_TRUE(file.is_open());
+
+    char c;
+    ASSERT_EQ(file.read(&c, 1), oc::success(1u));
+    ASSERT_EQ(file.read(&c, 1), oc::success(1u));
+    ASSERT_EQ(source.reads, 2u);
+}
@@ -19,6 +19,8 @@
 
 #include <gmock/gmock.h>
 
+#include <vector>
+
 #include <climits>
 
 #include <fcntl.h>
@@ -47,9 +49,23 @@ struct MockFdFileFuncs : public FdFileFuncs
     MOCK_METHOD1(fn_close, int(int fd));
     MOCK_METHOD2(fn_ftruncate64, int(int fd, off64_t length));
     MOCK_METHOD3(fn_lseek64, off64_t(int fd, off64_t offset, int whence));
+#ifndef _WIN32
+    MOCK_METHOD4(fn_pread64, ssize_t(int fd, void *buf, size_t count,
+                                     off64_t offset));
+    MOCK_METHOD4(fn_pwrite64, ssize_t(int fd, const void *buf, size_t count,
+                                      off64_t offset));
+#endif
     MOCK_METHOD3(fn_read, ssize_t(int fd, void *buf, size_t count));
     MOCK_METHOD3(fn_write, ssize_t(int fd, const void *buf, size_t count));
 
+#ifndef _WIN32
+    // sys/uio.h
+    MOCK_METHOD3(fn_readv, ssize_t(int fd, const struct iovec *iov,
+                                   int iovcnt));
+    MOCK_METHOD3(fn_writev, ssize_t(int fd, const struct iovec *iov,
+                                    int iovcnt));
+#endif
+
     struct stat _sb_regfile{};
 
     MockFdFileFuncs()
@@ -72,10 +88,22 @@ struct MockFdFileFuncs : public FdFileFuncs
                 .WillByDefault(SetErrnoAndReturn(EIO, -1));
         ON_CALL(*this, fn_lseek64(_, _, _))
                 .WillByDefault(SetErrnoAndReturn(EIO, -1));
+#ifndef _WIN32
+        ON_CALL(*this, fn_pread64(_, _, _, _))
+                .WillByDefault(SetErrnoAndReturn(EIO, -1));
+        ON_CALL(*this, fn_pwrite64(_, _, _, _))
+                .WillByDefault(SetErrnoAndReturn(EIO, -1));
+#endif
         ON_CALL(*this, fn_read(_, _, _))
                 .WillByDefault(SetErrnoAndReturn(EIO, -1));
         ON_CALL(*this, fn_write(_, _, _))
                 .WillByDefault(SetErrnoAndReturn(EIO, -1));
+#ifndef _WIN32
+        ON_CALL(*this, fn_readv(_, _, _))
+                .WillByDefault(SetErrnoAndReturn(EIO, -1));
+        ON_CALL(*this, fn_writev(_, _, _))
+                .WillByDefault(SetErrnoAndReturn(EIO, -1));
+#endif
     }
 
     void report_as_regular_file()
@@ -144,6 +172,10 @@ TEST_F(FileFdTest, CheckInvalidStates)
     ASSERT_EQ(file.write(nullptr, 0), error);
     ASSERT_EQ(file.seek(0, SEEK_SET), error);
     ASSERT_EQ(file.truncate(1024), error);
+    ASSERT_EQ(file.read_at(0, nullptr, 0), error);
+    ASSERT_EQ(file.write_at(0, nullptr, 0), error);
+    ASSERT_EQ(file.readv(nullptr, 0), error);
+    ASSERT_EQ(file.writev(nullptr, 0), error);
 
     _funcs.report_as_regular_file();
     _funcs.open_with_success();
@@ -525,6 +557,163 @@ TEST_F(FileFdTest, SeekFseekFailed)
     ASSERT_EQ(file.seek(10, SEEK_SET), oc::failure(std::errc::io_error));
 }
 
+#ifndef _WIN32
+TEST_F(FileFdTest, ReadAtSuccess)
+{
+    _funcs.report_as_regular_file();
+
+    // Ensure that the pread callback is called and that the file position is
+    // not touched
+    EXPECT_CALL(_funcs, fn_pread64(_, _, _, 10))
+            .Times(1)
+            .WillOnce(ReturnArg<2>());
+    EXPECT_CALL(_funcs, fn_lseek64(_, _, _))
+            .Times(0);
+
+    TestableFdFile file(&_funcs, 0, true);
+    ASSERT_TRUE(file.is_open());
+
+    char c;
+    ASSERT_EQ(file.read_at(10, &c, 1), oc::success(1u));
+}
+
+TEST_F(FileFdTest, ReadAtFailure)
+{
+    _funcs.report_as_regular_file();
+
+    EXPECT_CALL(_funcs, fn_pread64(_, _, _, _))
+            .Times(1);
+
+    TestableFdFile file(&_funcs, 0, true);
+    ASSERT_TRUE(file.is_open());
+
+    char c;
+    ASSERT_EQ(file.read_at(10, &c, 1), oc::failure(std::errc::io_error));
+}
+
+TEST_F(FileFdTest, ReadAtOutOfRange)
+{
+    _funcs.report_as_regular_file();
+
+    EXPECT_CALL(_funcs, fn_pread64(_, _, _, _))
+            .Times(0);
+
+    TestableFdFile file(&_funcs, 0, true);
+    ASSERT_TRUE(file.is_open());
+
+    char c;
+    ASSERT_EQ(file.read_at(UINT64_MAX, &c, 1),
+              oc::failure(FileError::ArgumentOutOfRange));
+}
+
+TEST_F(FileFdTest, WriteAtSuccess)
+{
+    _funcs.report_as_regular_file();
+
+    EXPECT_CALL(_funcs, fn_pwrite64(_, _, _, 10))
+            .Times(1)
+            .WillOnce(ReturnArg<2>());
+    EXPECT_CALL(_funcs, fn_lseek64(_, _, _))
+            .Times(0);
+
+    TestableFdFile file(&_funcs, 0, true);
+    ASSERT_TRUE(file.is_open());
+
+    ASSERT_EQ(file.write_at(10, "x", 1), oc::success(1u));
+}
+
+TEST_F(FileFdTest, WriteAtFailure)
+{
+    _funcs.report_as_regular_file();
+
+    EXPECT_CALL(_funcs, fn_pwrite64(_, _, _, _))
+            .Times(1);
+
+    TestableFdFile file(&_funcs, 0, true);
+    ASSERT_TRUE(file.is_open());
+
+    ASSERT_EQ(file.write_at(10, "x", 1), oc::failure(std::errc::io_error));
+}
+
+TEST_F(FileFdTest, ReadvSuccess)
+{
+    _funcs.report_as_regular_file();
+
+    // Ensure that all buffers are passed to a single readv() call
+    EXPECT_CALL(_funcs, fn_readv(_, _, 2))
+            .Times(1)
+            .WillOnce(Return(3));
+
+    TestableFdFile file(&_funcs, 0, true);
+    ASSERT_TRUE(file.is_open());
+
+    char a[1];
+    char b[2];
+    IoVec iov[] = { { a, sizeof(a) }, { b, sizeof(b) } };
+    ASSERT_EQ(file.readv(iov, 2), oc::success(3u));
+}
+
+TEST_F(FileFdTest, ReadvFailure)
+{
+    _funcs.report_as_regular_file();
+
+    EXPECT_CALL(_funcs, fn_readv(_, _, _))
+            .Times(1);
+
+    TestableFdFile file(&_funcs, 0, true);
+    ASSERT_TRUE(file.is_open());
+
+    char a[1];
+    IoVec iov[] = { { a, sizeof(a) } };
+    ASSERT_EQ(file.readv(iov, 1), oc::failure(std::errc::io_error));
+}
+
+TEST_F(FileFdTest, WritevSuccess)
+{
+    _funcs.report_as_regular_file();
+
+    EXPECT_CALL(_funcs, fn_writev(_, _, 2))
+            .Times(1)
+            .WillOnce(Return(3));
+
+    TestableFdFile file(&_funcs, 0, true);
+    ASSERT_TRUE(file.is_open());
+
+    ConstIoVec iov[] = { { "x", 1 }, { "yz", 2 } };
+    ASSERT_EQ(file.writev(iov, 2), oc::success(3u));
+}
+
+TEST_F(FileFdTest, WritevTooManyBuffers)
+{
+    _funcs.report_as_regular_file();
+
+    // Excess buffers should be left for the next call
+    EXPECT_CALL(_funcs, fn_writev(_, _, 64))
+            .Times(1)
+            .WillOnce(Return(64));
+
+    TestableFdFile file(&_funcs, 0, true);
+    ASSERT_TRUE(file.is_open());
+
+    std::vector<ConstIoVec> iov(100, { "x", 1 });
+    ASSERT_EQ(file.writev(iov.data(), iov.size()), oc::success(64u));
+}
+
+TEST_F(FileFdTest, WritevFailure)
+{
+    _funcs.report_as_regular_file();
+
+    EXPECT_CALL(_funcs, fn_writev(_, _, _))
+            .Times(1);
+
+    TestableFdFile file(&_funcs, 0, true);
+    ASSERT_TRUE(file.is_open());
+
+    ConstIoVec iov[] = { { "x", 1 } };
+    ASSERT_EQ(file.writev(iov, 1), oc::failure(std::errc::io_error));
+}
+#endif
+
 TEST_F(FileFdTest, TruncateSuccess)
 {
     _funcs.report_as_regular_file();
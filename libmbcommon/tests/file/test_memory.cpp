@@ -21,6 +21,8 @@
 
 #include <memory>
 
+#include <cstring>
+
 #include "mbcommon/file.h"
 #include "mbcommon/file/memory.h"
 #include "mbcommon/file_error.h"
@@ -38,6 +40,10 @@ TEST(FileMemoryTest, CheckInvalidStates)
     ASSERT_EQ(file.write(nullptr, 0), error);
     ASSERT_EQ(file.seek(0, SEEK_SET), error);
     ASSERT_EQ(file.truncate(1024), error);
+    ASSERT_EQ(file.read_at(0, nullptr, 0), error);
+    ASSERT_EQ(file.write_at(0, nullptr, 0), error);
+    ASSERT_EQ(file.readv(nullptr, 0), error);
+    ASSERT_EQ(file.writev(nullptr, 0), error);
 
     void *in = nullptr;
     size_t in_size = 0;
@@ -118,6 +124,73 @@ TEST(FileStaticMemoryTest, ReadTooLarge)
     ASSERT_EQ(out[0], 'x');
 }
 
+TEST(FileStaticMemoryTest, ReadAt)
+{
+    char in[] = "abc";
+    constexpr size_t in_size = 3;
+    char out[2];
+
+    MemoryFile file(in, in_size);
+    ASSERT_TRUE(file.is_open());
+
+    ASSERT_EQ(file.read_at(1, out, sizeof(out)), oc::success(2u));
+    ASSERT_EQ(out[0], 'b');
+    ASSERT_EQ(out[1], 'c');
+    ASSERT_EQ(file.read_at(2, out, sizeof(out)), oc::success(1u));
+    ASSERT_EQ(out[0], 'c');
+    ASSERT_EQ(file.read_at(10, out, sizeof(out)), oc::success(0u));
+
+    // File position should not have changed
+    ASSERT_EQ(file.seek(0, SEEK_CUR), oc::success(0u));
+}
+
+TEST(FileStaticMemoryTest, WriteAt)
+{
+    char in[] = "abc";
+    constexpr size_t in_size = 3;
+
+    MemoryFile file(in, in_size);
+    ASSERT_TRUE(file.is_open());
+
+    ASSERT_EQ(file.write_at(1, "xyz", 3), oc::success(2u));
+    ASSERT_EQ(memcmp(in, "axy", 3), 0);
+    ASSERT_EQ(file.write_at(10, "x", 1), oc::success(0u));
+
+    // File position should not have changed
+    ASSERT_EQ(file.seek(0, SEEK_CUR), oc::success(0u));
+}
+
+TEST(FileStaticMemoryTest, Readv)
+{
+    char in[] = "abc";
+    constexpr size_t in_size = 3;
+    char a[1];
+    char b[3];
+
+    MemoryFile file(in, in_size);
+    ASSERT_TRUE(file.is_open());
+
+    IoVec iov[] = { { a, sizeof(a) }, { b, sizeof(b) } };
+    ASSERT_EQ(file.readv(iov, 2), oc::success(3u));
+    ASSERT_EQ(a[0], 'a');
+    ASSERT_EQ(memcmp(b, "bc", 2), 0);
+    ASSERT_EQ(file.seek(0, SEEK_CUR), oc::success(3u));
+}
+
+TEST(FileStaticMemoryTest, Writev)
+{
+    char in[] = "abc";
+    constexpr size_t in_size = 3;
+
+    MemoryFile file(in, in_size);
+    ASSERT_TRUE(file.is_open());
+
+    ConstIoVec iov[] = { { "x", 1 }, { "yzw", 3 } };
+    ASSERT_EQ(file.writev(iov, 2), oc::success(3u));
+    ASSERT_EQ(memcmp(in, "xyz", 3), 0);
+    ASSERT_EQ(file.seek(0, SEEK_CUR), oc::success(3u));
+}
+
 TEST(FileStaticMemoryTest, WriteInBounds)
 {
     char in[] = "x";
@@ -217,6 +290,33 @@ TEST(FileStaticMemoryTest, SeekInvalid)
 #endif
 }
 
+TEST(FileStaticMemoryTest, MappedData)
+{
+    char buf[] = "abc";
+
+    MemoryFile file;
+    ASSERT_FALSE(file.mapped_data());
+
+    ASSERT_TRUE(file.open(buf, 3));
+
+    auto mapped = file.mapped_data();
+    ASSERT_TRUE(mapped);
+    ASSERT_EQ(mapped->data, buf);
+    ASSERT_EQ(mapped->size, 3u);
+}
+
+TEST(FileStaticMemoryTest, CheckReserveUnsupported)
+{
+    char buf[] = "abc";
+
+    MemoryFile file(buf, 3);
+    ASSERT_TRUE(file.is_open());
+
+    ASSERT_TRUE(file.reserve(3));
+    ASSERT_EQ(file.reserve(4), oc::failure(FileError::UnsupportedWrite));
+    ASSERT_EQ(file.capacity(), 3u);
+}
+
 TEST(FileStaticMemoryTest, CheckTruncateUnsupported)
 {
     char in[] = "x";
@@ -318,6 +418,49 @@ TEST(FileDynamicMemoryTest, ReadTooLarge)
     free(in);
 }
 
+TEST(FileDynamicMemoryTest, WriteAt)
+{
+    void *data = nullptr;
+    size_t data_size = 0;
+
+    MemoryFile file(&data, &data_size);
+    ASSERT_TRUE(file.is_open());
+
+    ASSERT_EQ(file.write_at(2, "x", 1), oc::success(1u));
+    ASSERT_EQ(data_size, 3u);
+    ASSERT_EQ(memcmp(data, "\0\0x", 3), 0);
+
+    // File position should not have changed
+    ASSERT_EQ(file.seek(0, SEEK_CUR), oc::success(0u));
+
+    ASSERT_TRUE(file.close());
+    free(data);
+}
+
+TEST(FileDynamicMemoryTest, Writev)
+{
+    void *data = nullptr;
+    size_t data_size = 0;
+
+    MemoryFile file(&data, &data_size);
+    ASSERT_TRUE(file.is_open());
+
+    ConstIoVec iov[] = { { "ab", 2 }, { "", 0 }, { "cd", 2 } };
+    ASSERT_EQ(file.writev(iov, 3), oc::success(4u));
+    ASSERT_EQ(data_size, 4u);
+    ASSERT_EQ(memcmp(data, "abcd", 4), 0);
+
+    // Existing data should not be clobbered when the buffer is not enlarged
+    ASSERT_TRUE(file.seek(0, SEEK_SET));
+    ConstIoVec iov2[] = { { "x", 1 } };
+    ASSERT_EQ(file.writev(iov2, 1), oc::success(1u));
+    ASSERT_EQ(data_size, 4u);
+    ASSERT_EQ(memcmp(data, "xbcd", 4), 0);
+
+    ASSERT_TRUE(file.close());
+    free(data);
+}
+
 TEST(FileDynamicMemoryTest, WriteInBounds)
 {
     void *in = strdup("x");
@@ -479,3 +622,69 @@ TEST(FileDynamicMemoryTest, TruncateFile)
 
     free(in);
 }
+
+TEST(FileDynamicMemoryTest, GrowGeometrically)
+{
+    void *in = nullptr;
+    size_t in_size = 0;
+
+    MemoryFile file(&in, &in_size);
+    ASSERT_TRUE(file.is_open());
+
+    size_t reallocations = 0;
+    size_t prev_capacity = file.capacity();
+
+    for (size_t i = 0; i < 10000; ++i) {
+        ASSERT_EQ(file.write("x", 1), oc::success(1u));
+        if (file.capacity() != prev_capacity) {
+            ++reallocations;
+            prev_capacity = file.capacity();
+        }
+    }
+
+    ASSERT_EQ(in_size, 10000u);
+    ASSERT_GE(file.capacity(), in_size);
+    ASSERT_LE(reallocations, 15u);
+
+    ASSERT_TRUE(file.shrink_to_fit());
+    ASSERT_EQ(file.capacity(), 10000u);
+    ASSERT_EQ(in_size, 10000u);
+    for (size_t i = 0; i < in_size; ++i) {
+        ASSERT_EQ(static_cast<char *>(in)[i], 'x');
+    }
+
+    ASSERT_TRUE(file.close());
+    free(in);
+}
+
+TEST(FileDynamicMemoryTest, ReserveSpace)
+{
+    void *in = strdup("x");
+    size_t in_size = 1;
+
+    ASSERT_NE(in, nullptr);
+
+    MemoryFile file(&in, &in_size);
+    ASSERT_TRUE(file.is_open());
+
+    ASSERT_TRUE(file.reserve(100));
+    ASSERT_EQ(file.capacity(), 100u);
+    ASSERT_EQ(in_size, 1u);
+
+    void *reserved = in;
+
+    ASSERT_TRUE(file.seek(0, SEEK_END));
+    ASSERT_EQ(file.write("yz", 2), oc::success(2u));
+    ASSERT_EQ(in, reserved);
+    ASSERT_EQ(in_size, 3u);
+    ASSERT_EQ(memcmp(in, "xyz", 3), 0);
+
+    // Shrinking the file keeps the allocation; growing it again zero-fills
+    ASSERT_TRUE(file.truncate(1));
+    ASSERT_TRUE(file.truncate(3));
+    ASSERT_EQ(file.capacity(), 100u);
+    ASSERT_EQ(memcmp(in, "x\0\0", 3), 0);
+
+    ASSERT_TRUE(file.close());
+    free(in);
+}
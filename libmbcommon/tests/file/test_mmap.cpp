@@ -0,0 +1,174 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <cstring>
+
+#include "mbcommon/file.h"
+#include "mbcommon/file/mmap.h"
+#include "mbcommon/file_error.h"
+
+using namespace mb;
+
+struct FileMmapTest : testing::Test
+{
+    FILE *_fp = nullptr;
+
+    void SetUp() override
+    {
+        _fp = tmpfile();
+        ASSERT_TRUE(_fp);
+    }
+
+    void TearDown() override
+    {
+        if (_fp) {
+            fclose(_fp);
+        }
+    }
+
+    void write_contents(const char *data, size_t size)
+    {
+        ASSERT_EQ(fwrite(data, 1, size, _fp), size);
+        ASSERT_EQ(fflush(_fp), 0);
+    }
+};
+
+TEST_F(FileMmapTest, CheckInvalidStates)
+{
+    MmapFile file;
+
+    auto error = oc::failure(FileError::InvalidState);
+
+    ASSERT_EQ(file.close(), error);
+    ASSERT_EQ(file.read(nullptr, 0), error);
+    ASSERT_EQ(file.write(nullptr, 0), error);
+    ASSERT_EQ(file.seek(0, SEEK_SET), error);
+    ASSERT_EQ(file.truncate(1024), error);
+    ASSERT_EQ(file.read_at(0, nullptr, 0), error);
+    ASSERT_FALSE(file.mapped_data());
+
+    ASSERT_TRUE(file.open(fileno(_fp)));
+    ASSERT_EQ(file.open(fileno(_fp)), error);
+    ASSERT_EQ(file.open("x"), error);
+    ASSERT_EQ(file.open(L"x"), error);
+}
+
+TEST_F(FileMmapTest, OpenEmptyFile)
+{
+    MmapFile file(fileno(_fp));
+    ASSERT_TRUE(file.is_open());
+    ASSERT_EQ(file.size(), 0u);
+    ASSERT_EQ(file.data(), nullptr);
+
+    char c;
+    ASSERT_EQ(file.read(&c, 1), oc::success(0u));
+}
+
+TEST_F(FileMmapTest, OpenNonexistentFile)
+{
+    MmapFile file;
+    ASSERT_EQ(file.open("/nonexistent/file"),
+              oc::failure(std::errc::no_such_file_or_directory));
+    ASSERT_FALSE(file.is_open());
+}
+
+TEST_F(FileMmapTest, ReadAndView)
+{
+    write_contents("hello", 5);
+
+    MmapFile file(fileno(_fp));
+    ASSERT_TRUE(file.is_open());
+
+    ASSERT_EQ(file.size(), 5u);
+    ASSERT_EQ(memcmp(file.data(), "hello", 5), 0);
+
+    auto mapped = file.mapped_data();
+    ASSERT_TRUE(mapped);
+    ASSERT_EQ(mapped->data, file.data());
+    ASSERT_EQ(mapped->size, 5u);
+
+    char buf[3];
+    ASSERT_EQ(file.read(buf, sizeof(buf)), oc::success(3u));
+    ASSERT_EQ(memcmp(buf, "hel", 3), 0);
+    ASSERT_EQ(file.read(buf, sizeof(buf)), oc::success(2u));
+    ASSERT_EQ(memcmp(buf, "lo", 2), 0);
+    ASSERT_EQ(file.read(buf, sizeof(buf)), oc::success(0u));
+}
+
+TEST_F(FileMmapTest, ReadAt)
+{
+    write_contents("hello", 5);
+
+    MmapFile file(fileno(_fp));
+    ASSERT_TRUE(file.is_open());
+
+    char buf[3];
+    ASSERT_EQ(file.read_at(3, buf, sizeof(buf)), oc::success(2u));
+    ASSERT_EQ(memcmp(buf, "lo", 2), 0);
+    ASSERT_EQ(file.read_at(10, buf, sizeof(buf)), oc::success(0u));
+
+    // File position should not have changed
+    ASSERT_EQ(file.seek(0, SEEK_CUR), oc::success(0u));
+}
+
+TEST_F(FileMmapTest, Seek)
+{
+    write_contents("hello", 5);
+
+    MmapFile file(fileno(_fp));
+    ASSERT_TRUE(file.is_open());
+
+    ASSERT_EQ(file.seek(0, SEEK_END), oc::success(5u));
+    ASSERT_EQ(file.seek(-2, SEEK_CUR), oc::success(3u));
+    ASSERT_EQ(file.seek(-6, SEEK_END),
+              oc::failure(FileError::ArgumentOutOfRange));
+    ASSERT_EQ(file.seek(-1, SEEK_SET),
+              oc::failure(FileError::ArgumentOutOfRange));
+}
+
+TEST_F(FileMmapTest, CheckWriteAndTruncateUnsupported)
+{
+    write_contents("hello", 5);
+
+    MmapFile file(fileno(_fp));
+    ASSERT_TRUE(file.is_open());
+
+    ASSERT_EQ(file.write("x", 1), oc::failure(FileError::UnsupportedWrite));
+    ASSERT_EQ(file.truncate(1), oc::failure(FileError::UnsupportedTruncate));
+}
+
+TEST_F(FileMmapTest, MoveFile)
+{
+    write_contents("hello", 5);
+
+    MmapFile file1(fileno(_fp));
+    ASSERT_TRUE(file1.is_open());
+
+    MmapFile file2(std::move(file1));
+    ASSERT_FALSE(file1.is_open());
+    ASSERT_TRUE(file2.is_open());
+    ASSERT_EQ(file2.size(), 5u);
+
+    ASSERT_TRUE(file2.close());
+    ASSERT_FALSE(file2.is_open());
+    ASSERT_EQ(file2.size(), 0u);
+}
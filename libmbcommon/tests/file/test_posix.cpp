@@ -38,6 +38,7 @@ struct MockPosixFileFuncs : public PosixFileFuncs
     // stdio.h
     MOCK_METHOD1(fn_fclose, int(FILE *stream));
     MOCK_METHOD1(fn_ferror, int(FILE *stream));
+    MOCK_METHOD1(fn_fflush, int(FILE *stream));
     MOCK_METHOD1(fn_fileno, int(FILE *stream));
 #ifdef _WIN32
     MOCK_METHOD2(fn_wfopen, FILE *(const wchar_t *filename,
@@ -54,6 +55,12 @@ struct MockPosixFileFuncs : public PosixFileFuncs
 
     // unistd.h
     MOCK_METHOD2(fn_ftruncate64, int(int fd, off64_t length));
+#ifndef _WIN32
+    MOCK_METHOD4(fn_pread64, ssize_t(int fd, void *buf, size_t count,
+                                     off64_t offset));
+    MOCK_METHOD4(fn_pwrite64, ssize_t(int fd, const void *buf, size_t count,
+                                      off64_t offset));
+#endif
 
     bool stream_error = false;
 
@@ -73,6 +80,8 @@ struct MockPosixFileFuncs : public PosixFileFuncs
                 .WillByDefault(SetErrnoAndReturn(EIO, -1));
         ON_CALL(*this, fn_ferror(_))
                 .WillByDefault(ReturnPointee(&stream_error));
+        ON_CALL(*this, fn_fflush(_))
+                .WillByDefault(SetErrnoAndReturn(EIO, EOF));
         ON_CALL(*this, fn_fileno(_))
                 .WillByDefault(Return(-1));
         ON_CALL(*this, fn_fread(_, _, _, _))
@@ -91,6 +100,12 @@ struct MockPosixFileFuncs : public PosixFileFuncs
                         SetErrnoAndReturn(EIO, 0)));
         ON_CALL(*this, fn_ftruncate64(_, _))
                 .WillByDefault(SetErrnoAndReturn(EIO, -1));
+#ifndef _WIN32
+        ON_CALL(*this, fn_pread64(_, _, _, _))
+                .WillByDefault(SetErrnoAndReturn(EIO, -1));
+        ON_CALL(*this, fn_pwrite64(_, _, _, _))
+                .WillByDefault(SetErrnoAndReturn(EIO, -1));
+#endif
     }
 
     void set_ferror_fail()
@@ -156,6 +171,8 @@ TEST_F(FilePosixTest, CheckInvalidStates)
     ASSERT_EQ(file.write(nullptr, 0), error);
     ASSERT_EQ(file.seek(0, SEEK_SET), error);
     ASSERT_EQ(file.truncate(1024), error);
+    ASSERT_EQ(file.read_at(0, nullptr, 0), error);
+    ASSERT_EQ(file.write_at(0, nullptr, 0), error);
 
     _funcs.open_with_success();
 
@@ -562,6 +579,96 @@ TEST_F(FilePosixTest, SeekUnsupported)
     ASSERT_EQ(file.seek(10, SEEK_SET), oc::failure(FileError::UnsupportedSeek));
 }
 
+#ifndef _WIN32
+TEST_F(FilePosixTest, ReadAtSuccess)
+{
+    EXPECT_CALL(_funcs, fn_fflush(_))
+            .Times(1)
+            .WillOnce(Return(0));
+    EXPECT_CALL(_funcs, fn_pread64(_, _, _, 10))
+            .Times(1)
+            .WillOnce(ReturnArg<2>());
+    EXPECT_CALL(_funcs, fn_fseeko(_, _, _))
+            .Times(0);
+
+    ON_CALL(_funcs, fn_fileno(_))
+            .WillByDefault(Return(0));
+
+    struct stat sb{};
+    sb.st_mode = S_IFREG | S_IRWXU | S_IRWXG | S_IRWXO;
+
+    ON_CALL(_funcs, fn_fstat(_, _))
+            .WillByDefault(DoAll(SetArgPointee<1>(sb), Return(0)));
+
+    TestablePosixFile file(&_funcs, g_fp, true);
+    ASSERT_TRUE(file.is_open());
+
+    char c;
+    ASSERT_EQ(file.read_at(10, &c, 1), oc::success(1u));
+}
+
+TEST_F(FilePosixTest, ReadAtFflushFailed)
+{
+    EXPECT_CALL(_funcs, fn_fflush(_))
+            .Times(1);
+    EXPECT_CALL(_funcs, fn_pread64(_, _, _, _))
+            .Times(0);
+
+    ON_CALL(_funcs, fn_fileno(_))
+            .WillByDefault(Return(0));
+
+    struct stat sb{};
+    sb.st_mode = S_IFREG | S_IRWXU | S_IRWXG | S_IRWXO;
+
+    ON_CALL(_funcs, fn_fstat(_, _))
+            .WillByDefault(DoAll(SetArgPointee<1>(sb), Return(0)));
+
+    TestablePosixFile file(&_funcs, g_fp, true);
+    ASSERT_TRUE(file.is_open());
+
+    char c;
+    ASSERT_EQ(file.read_at(10, &c, 1), oc::failure(std::errc::io_error));
+}
+
+TEST_F(FilePosixTest, WriteAtSuccess)
+{
+    EXPECT_CALL(_funcs, fn_fflush(_))
+            .Times(1)
+            .WillOnce(Return(0));
+    EXPECT_CALL(_funcs, fn_pwrite64(_, _, _, 10))
+            .Times(1)
+            .WillOnce(ReturnArg<2>());
+    EXPECT_CALL(_funcs, fn_fseeko(_, _, _))
+            .Times(0);
+
+    ON_CALL(_funcs, fn_fileno(_))
+            .WillByDefault(Return(0));
+
+    struct stat sb{};
+    sb.st_mode = S_IFREG | S_IRWXU | S_IRWXG | S_IRWXO;
+
+    ON_CALL(_funcs, fn_fstat(_, _))
+            .WillByDefault(DoAll(SetArgPointee<1>(sb), Return(0)));
+
+    TestablePosixFile file(&_funcs, g_fp, true);
+    ASSERT_TRUE(file.is_open());
+
+    ASSERT_EQ(file.write_at(10, "x", 1), oc::success(1u));
+}
+#endif
+
+TEST_F(FilePosixTest, ReadAtUnsupported)
+{
+    TestablePosixFile file(&_funcs, g_fp, true);
+    ASSERT_TRUE(file.is_open());
+
+    char c;
+    ASSERT_EQ(file.read_at(10, &c, 1),
+              oc::failure(FileError::UnsupportedSeek));
+    ASSERT_EQ(file.write_at(10, "x", 1),
+              oc::failure(FileError::UnsupportedSeek));
+}
+
 TEST_F(FilePosixTest, TruncateSuccess)
 {
     // Fail when opening to avoid fstat check
@@ -0,0 +1,172 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <optional>
+#include <vector>
+
+#include <cstdio>
+#include <cstring>
+
+#include "mbcommon/file.h"
+#include "mbcommon/file/memory.h"
+#include "mbcommon/file/read_ahead.h"
+#include "mbcommon/file_error.h"
+#include "mbcommon/file_util.h"
+
+using namespace mb;
+
+// Returns data in small pieces and then fails after a certain offset
+class FailingMemoryFile : public MemoryFile
+{
+public:
+    using MemoryFile::MemoryFile;
+
+    oc::result<size_t> read(void *buf, size_t size) override
+    {
+        if (fail_after && bytes_read >= *fail_after) {
+            return std::errc::io_error;
+        }
+
+        OUTCOME_TRY(n, MemoryFile::read(buf, std::min<size_t>(size, 100)));
+        bytes_read += n;
+        return n;
+    }
+
+    std::optional<size_t> fail_after;
+    size_t bytes_read = 0;
+};
+
+struct FileReadAheadTest : testing::Test
+{
+    std::vector<unsigned char> _data;
+
+    void SetUp() override
+    {
+        _data.resize(10000);
+        for (size_t i = 0; i < _data.size(); ++i) {
+            _data[i] = static_cast<unsigned char>(i % 251);
+        }
+    }
+};
+
+TEST_F(FileReadAheadTest, CheckInvalidStates)
+{
+    ReadAheadFile file;
+
+    auto error = oc::failure(FileError::InvalidState);
+
+    ASSERT_EQ(file.close(), error);
+    ASSERT_EQ(file.read(nullptr, 0), error);
+    ASSERT_EQ(file.open(nullptr), error);
+
+    MemoryFile source(_data.data(), _data.size());
+    ASSERT_TRUE(source.is_open());
+
+    ASSERT_EQ(file.open(&source, 0, 1),
+              oc::failure(std::errc::invalid_argument));
+    ASSERT_EQ(file.open(&source, 1, 0),
+              oc::failure(std::errc::invalid_argument));
+    ASSERT_FALSE(file.is_open());
+
+    ASSERT_TRUE(file.open(&source, 2, 64));
+    ASSERT_EQ(file.open(&source, 2, 64), error);
+
+    ASSERT_EQ(file.write("x", 1), oc::failure(FileError::UnsupportedWrite));
+    ASSERT_EQ(file.seek(0, SEEK_CUR), oc::failure(FileError::UnsupportedSeek));
+    ASSERT_EQ(file.truncate(0), oc::failure(FileError::UnsupportedTruncate));
+
+    // Closing with unconsumed data must not block
+    ASSERT_TRUE(file.close());
+}
+
+TEST_F(FileReadAheadTest, ReadAllData)
+{
+    FailingMemoryFile source(_data.data(), _data.size());
+    ASSERT_TRUE(source.is_open());
+
+    // Buffers are not aligned to the reads of the underlying file or the
+    // reads of the caller
+    ReadAheadFile file(&source, 3, 64);
+    ASSERT_TRUE(file.is_open());
+
+    std::vector<unsigned char> buf(_data.size() + 10);
+    size_t total = 0;
+
+    while (true) {
+        auto n = file.read(buf.data() + total,
+                           std::min<size_t>(77, buf.size() - total));
+        ASSERT_TRUE(n);
+        if (n.value() == 0) {
+            break;
+        }
+        total += n.value();
+    }
+
+    ASSERT_EQ(total, _data.size());
+    buf.resize(total);
+    ASSERT_EQ(buf, _data);
+
+    // EOF is sticky
+    ASSERT_EQ(file.read(buf.data(), 1), oc::success(0u));
+
+    ASSERT_TRUE(file.close());
+}
+
+TEST_F(FileReadAheadTest, ReportErrorAfterData)
+{
+    FailingMemoryFile source(_data.data(), _data.size());
+    ASSERT_TRUE(source.is_open());
+    source.fail_after = 1000;
+
+    ReadAheadFile file(&source, 2, 300);
+    ASSERT_TRUE(file.is_open());
+
+    std::vector<unsigned char> buf(_data.size());
+    ASSERT_EQ(file_read_retry(file, buf.data(), 1000), oc::success(1000u));
+    ASSERT_EQ(memcmp(buf.data(), _data.data(), 1000), 0);
+
+    ASSERT_EQ(file.read(buf.data(), buf.size()),
+              oc::failure(std::errc::io_error));
+
+    ASSERT_TRUE(file.close());
+}
+
+TEST_F(FileReadAheadTest, MoveWhileReading)
+{
+    MemoryFile source(_data.data(), _data.size());
+    ASSERT_TRUE(source.is_open());
+
+    ReadAheadFile file1(&source, 2, 128);
+    ASSERT_TRUE(file1.is_open());
+
+    unsigned char buf[100];
+    ASSERT_EQ(file_read_retry(file1, buf, sizeof(buf)),
+              oc::success(sizeof(buf)));
+
+    ReadAheadFile file2(std::move(file1));
+    ASSERT_FALSE(file1.is_open());
+    ASSERT_TRUE(file2.is_open());
+
+    ASSERT_EQ(file_read_retry(file2, buf, sizeof(buf)),
+              oc::success(sizeof(buf)));
+    ASSERT_EQ(memcmp(buf, _data.data() + 100, sizeof(buf)), 0);
+}
@@ -0,0 +1,160 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+#include <cstdio>
+#include <cstdlib>
+
+#include "mbcommon/file/spill.h"
+#include "mbcommon/file_error.h"
+#include "mbcommon/file_util.h"
+#include "mbcommon/memory_budget.h"
+
+using namespace mb;
+
+struct FileSpillTest : testing::Test
+{
+    MemoryBudget _budget{16};
+
+    void SetUp() override
+    {
+        const char *tmpdir = getenv("TMPDIR");
+        _budget.set_spill_dir(tmpdir && *tmpdir ? tmpdir : "/tmp");
+    }
+
+    static std::string read_all(SpillFile &file)
+    {
+        std::string data(file.size(), '\0');
+        auto n = file.read_at(0, data.data(), data.size());
+        EXPECT_TRUE(n);
+        EXPECT_EQ(n.value(), data.size());
+        return data;
+    }
+};
+
+TEST_F(FileSpillTest, CheckInvalidStates)
+{
+    SpillFile file;
+
+    auto error = oc::failure(FileError::InvalidState);
+
+    ASSERT_EQ(file.close(), error);
+    ASSERT_EQ(file.read(nullptr, 0), error);
+    ASSERT_EQ(file.write(nullptr, 0), error);
+    ASSERT_EQ(file.seek(0, SEEK_SET), error);
+    ASSERT_EQ(file.truncate(1024), error);
+    ASSERT_EQ(file.spill(), error);
+    ASSERT_FALSE(file.mapped_data());
+
+    ASSERT_TRUE(file.open(_budget));
+    ASSERT_EQ(file.open(_budget), error);
+}
+
+TEST_F(FileSpillTest, SmallFileStaysInMemory)
+{
+    SpillFile file(_budget);
+    ASSERT_TRUE(file.is_open());
+
+    ASSERT_TRUE(file_write_exact(file, "hello", 5));
+    ASSERT_TRUE(file_write_exact(file, "world", 5));
+    ASSERT_FALSE(file.spilled());
+    ASSERT_EQ(file.native_fd(), -1);
+    ASSERT_GE(_budget.used(), 10u);
+
+    auto data = file.mapped_data();
+    ASSERT_TRUE(data);
+    ASSERT_EQ(std::string(static_cast<const char *>(data->data), data->size),
+              "helloworld");
+
+    ASSERT_TRUE(file.close());
+    ASSERT_EQ(_budget.used(), 0u);
+}
+
+TEST_F(FileSpillTest, SpillsWhenBudgetIsExhausted)
+{
+    SpillFile file(_budget);
+
+    ASSERT_TRUE(file_write_exact(file, "0123456789", 10));
+    ASSERT_FALSE(file.spilled());
+
+    // Exceeds the 16 byte budget
+    ASSERT_TRUE(file_write_exact(file, "abcdefghij", 10));
+    ASSERT_TRUE(file.spilled());
+    ASSERT_NE(file.native_fd(), -1);
+    ASSERT_FALSE(file.mapped_data());
+    ASSERT_EQ(_budget.used(), 0u);
+
+    ASSERT_EQ(file.size(), 20u);
+    ASSERT_EQ(read_all(file), "0123456789abcdefghij");
+
+    // Position is preserved across the switch
+    ASSERT_EQ(file.seek(0, SEEK_CUR), oc::success(20u));
+    ASSERT_TRUE(file.seek(5, SEEK_SET));
+    char buf[5];
+    ASSERT_TRUE(file_read_exact(file, buf, sizeof(buf)));
+    ASSERT_EQ(std::string(buf, sizeof(buf)), "56789");
+
+    ASSERT_TRUE(file.truncate(4));
+    ASSERT_EQ(read_all(file), "0123");
+}
+
+TEST_F(FileSpillTest, ReserveSpillsEarly)
+{
+    SpillFile file(_budget);
+
+    ASSERT_TRUE(file.reserve(8));
+    ASSERT_FALSE(file.spilled());
+
+    ASSERT_TRUE(file.reserve(1024));
+    ASSERT_TRUE(file.spilled());
+    ASSERT_EQ(file.size(), 0u);
+}
+
+TEST_F(FileSpillTest, WritePastEndZeroFills)
+{
+    SpillFile file(_budget);
+
+    ASSERT_TRUE(file.write_at(4, "ab", 2));
+    ASSERT_EQ(read_all(file), std::string("\0\0\0\0ab", 6));
+
+    ASSERT_TRUE(file.truncate(8));
+    ASSERT_EQ(read_all(file), std::string("\0\0\0\0ab\0\0", 8));
+
+    ASSERT_TRUE(file.truncate(32));
+    ASSERT_TRUE(file.spilled());
+    ASSERT_EQ(read_all(file), std::string("\0\0\0\0ab", 6)
+              + std::string(26, '\0'));
+}
+
+TEST_F(FileSpillTest, MoveKeepsReservation)
+{
+    SpillFile file(_budget);
+    ASSERT_TRUE(file_write_exact(file, "abc", 3));
+
+    SpillFile other(std::move(file));
+    ASSERT_FALSE(file.is_open());
+    ASSERT_TRUE(other.is_open());
+    ASSERT_EQ(read_all(other), "abc");
+
+    ASSERT_TRUE(other.close());
+    ASSERT_EQ(_budget.used(), 0u);
+}
@@ -0,0 +1,114 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <numeric>
+
+#include <cstdio>
+
+#include "mbcommon/file/memory.h"
+#include "mbcommon/file/stats.h"
+#include "mbcommon/file_error.h"
+
+using namespace mb;
+
+static uint64_t histogram_total(const FileOpStats &op)
+{
+    return std::accumulate(op.latency_histogram.begin(),
+                           op.latency_histogram.end(), uint64_t(0));
+}
+
+TEST(FileStatsTest, CheckInvalidStates)
+{
+    StatsFile file;
+
+    auto error = oc::failure(FileError::InvalidState);
+
+    ASSERT_EQ(file.close(), error);
+    ASSERT_EQ(file.read(nullptr, 0), error);
+    ASSERT_EQ(file.write(nullptr, 0), error);
+    ASSERT_EQ(file.seek(0, SEEK_SET), error);
+    ASSERT_EQ(file.truncate(1024), error);
+    ASSERT_EQ(file.open(nullptr), error);
+
+    MemoryFile closed;
+    ASSERT_EQ(file.open(&closed), error);
+}
+
+TEST(FileStatsTest, RecordOperations)
+{
+    char buf[] = "abcdefgh";
+
+    MemoryFile mem(buf, sizeof(buf) - 1);
+    ASSERT_TRUE(mem.is_open());
+
+    StatsFile file(&mem);
+    ASSERT_TRUE(file.is_open());
+
+    char tmp[4];
+    ASSERT_EQ(file.read(tmp, 3), oc::success(3u));
+    ASSERT_EQ(file.write("xy", 2), oc::success(2u));
+    ASSERT_EQ(file.seek(1, SEEK_SET), oc::success(1u));
+    ASSERT_EQ(file.seek(6, SEEK_SET), oc::success(6u));
+    ASSERT_EQ(file.read_at(0, tmp, 4), oc::success(4u));
+    ASSERT_EQ(file.truncate(20), oc::failure(FileError::UnsupportedTruncate));
+
+    auto const &stats = file.stats();
+
+    ASSERT_EQ(stats.read.count, 2u);
+    ASSERT_EQ(stats.read.errors, 0u);
+    ASSERT_EQ(stats.read.bytes, 7u);
+    ASSERT_EQ(histogram_total(stats.read), 2u);
+
+    ASSERT_EQ(stats.write.count, 1u);
+    ASSERT_EQ(stats.write.bytes, 2u);
+
+    ASSERT_EQ(stats.seek.count, 2u);
+    // 5 -> 1 -> 6
+    ASSERT_EQ(stats.seek_distance, 9u);
+
+    ASSERT_EQ(stats.truncate.count, 1u);
+    ASSERT_EQ(stats.truncate.errors, 1u);
+
+    ASSERT_STREQ(buf, "abcxyfgh");
+
+    // Statistics survive close, but not reset
+    ASSERT_TRUE(file.close());
+    ASSERT_EQ(file.stats().read.count, 2u);
+    file.reset_stats();
+    ASSERT_EQ(file.stats().read.count, 0u);
+
+    ASSERT_TRUE(mem.is_open());
+}
+
+TEST(FileStatsTest, FormatStats)
+{
+    FileStats stats;
+    stats.read.count = 1;
+    stats.read.bytes = 10;
+    stats.read.latency_histogram[3] = 1;
+    stats.seek_distance = 42;
+
+    auto str = format_file_stats(stats);
+    ASSERT_NE(str.find("read     1 calls, 0 errors, 10 bytes"),
+              std::string::npos);
+    ASSERT_NE(str.find("<8us:1"), std::string::npos);
+    ASSERT_NE(str.find("seek distance: 42 bytes"), std::string::npos);
+}
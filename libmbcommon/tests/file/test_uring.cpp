@@ -0,0 +1,208 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "mbcommon/file.h"
+#include "mbcommon/file/uring.h"
+#include "mbcommon/file_error.h"
+#include "mbcommon/file_util.h"
+
+using namespace mb;
+
+static constexpr size_t TEST_QUEUE_DEPTH = 3;
+static constexpr size_t TEST_BLOCK_SIZE = 4096;
+
+struct FileUringTest : testing::Test
+{
+    FILE *_fp = nullptr;
+
+    void SetUp() override
+    {
+        _fp = tmpfile();
+        ASSERT_TRUE(_fp);
+    }
+
+    void TearDown() override
+    {
+        if (_fp) {
+            fclose(_fp);
+        }
+    }
+
+    static std::vector<unsigned char> make_data(size_t size)
+    {
+        std::vector<unsigned char> data(size);
+        for (size_t i = 0; i < size; ++i) {
+            data[i] = static_cast<unsigned char>(i % 251);
+        }
+        return data;
+    }
+};
+
+TEST_F(FileUringTest, CheckInvalidStates)
+{
+    UringFile file;
+
+    auto error = oc::failure(FileError::InvalidState);
+
+    ASSERT_EQ(file.close(), error);
+    ASSERT_EQ(file.read(nullptr, 0), error);
+    ASSERT_EQ(file.write(nullptr, 0), error);
+    ASSERT_EQ(file.seek(0, SEEK_SET), error);
+    ASSERT_EQ(file.truncate(1024), error);
+    ASSERT_EQ(file.flush(), error);
+
+    ASSERT_TRUE(file.open(fileno(_fp), false));
+    ASSERT_EQ(file.open(fileno(_fp), false), error);
+}
+
+TEST_F(FileUringTest, OpenInvalidArguments)
+{
+    UringFile file;
+
+    auto error = oc::failure(std::errc::invalid_argument);
+
+    ASSERT_EQ(file.open(fileno(_fp), false, 0, TEST_BLOCK_SIZE), error);
+    ASSERT_EQ(file.open(fileno(_fp), false, TEST_QUEUE_DEPTH, 0), error);
+    ASSERT_FALSE(file.is_open());
+}
+
+TEST_F(FileUringTest, WriteThenReadBack)
+{
+    auto data = make_data(TEST_BLOCK_SIZE * TEST_QUEUE_DEPTH * 3 + 123);
+
+    UringFile file(fileno(_fp), false, TEST_QUEUE_DEPTH, TEST_BLOCK_SIZE);
+    ASSERT_TRUE(file.is_open());
+
+    // Write in pieces that do not line up with the block size
+    for (size_t i = 0; i < data.size(); i += 1000) {
+        auto n = std::min<size_t>(1000, data.size() - i);
+        ASSERT_EQ(file.write(data.data() + i, n), oc::success(n));
+    }
+    ASSERT_TRUE(file.flush());
+
+    ASSERT_EQ(file.seek(0, SEEK_CUR), oc::success(data.size()));
+    ASSERT_EQ(file.seek(0, SEEK_END), oc::success(data.size()));
+    ASSERT_EQ(file.seek(0, SEEK_SET), oc::success(0u));
+
+    std::vector<unsigned char> buf(data.size() + 10);
+    ASSERT_EQ(file_read_retry(file, buf.data(), buf.size()),
+              oc::success(data.size()));
+    buf.resize(data.size());
+    ASSERT_EQ(buf, data);
+
+    // EOF
+    ASSERT_EQ(file.read(buf.data(), 1), oc::success(0u));
+
+    ASSERT_TRUE(file.close());
+}
+
+TEST_F(FileUringTest, ReadWithSeeks)
+{
+    auto data = make_data(TEST_BLOCK_SIZE * 10);
+    ASSERT_EQ(fwrite(data.data(), 1, data.size(), _fp), data.size());
+    ASSERT_EQ(fflush(_fp), 0);
+    ASSERT_EQ(fseeko(_fp, 100, SEEK_SET), 0);
+
+    UringFile file(fileno(_fp), false, TEST_QUEUE_DEPTH, TEST_BLOCK_SIZE);
+    ASSERT_TRUE(file.is_open());
+
+    // Initial position is taken from the file descriptor
+    ASSERT_EQ(file.seek(0, SEEK_CUR), oc::success(100u));
+
+    unsigned char buf[1000];
+    ASSERT_EQ(file_read_retry(file, buf, sizeof(buf)),
+              oc::success(sizeof(buf)));
+    ASSERT_EQ(memcmp(buf, data.data() + 100, sizeof(buf)), 0);
+
+    // Within the current block
+    ASSERT_EQ(file.seek(-500, SEEK_CUR), oc::success(600u));
+    ASSERT_EQ(file_read_retry(file, buf, sizeof(buf)),
+              oc::success(sizeof(buf)));
+    ASSERT_EQ(memcmp(buf, data.data() + 600, sizeof(buf)), 0);
+
+    // Outside of the readahead window
+    ASSERT_EQ(file.seek(TEST_BLOCK_SIZE * 8 + 5, SEEK_SET),
+              oc::success(TEST_BLOCK_SIZE * 8 + 5));
+    ASSERT_EQ(file_read_retry(file, buf, sizeof(buf)),
+              oc::success(sizeof(buf)));
+    ASSERT_EQ(memcmp(buf, data.data() + TEST_BLOCK_SIZE * 8 + 5, sizeof(buf)),
+              0);
+
+    // Near EOF
+    ASSERT_EQ(file.seek(-10, SEEK_END), oc::success(data.size() - 10));
+    ASSERT_EQ(file_read_retry(file, buf, sizeof(buf)), oc::success(10u));
+    ASSERT_EQ(memcmp(buf, data.data() + data.size() - 10, 10), 0);
+}
+
+TEST_F(FileUringTest, OverwriteAfterRead)
+{
+    auto data = make_data(TEST_BLOCK_SIZE * 2);
+    ASSERT_EQ(fwrite(data.data(), 1, data.size(), _fp), data.size());
+    ASSERT_EQ(fflush(_fp), 0);
+    rewind(_fp);
+
+    UringFile file(fileno(_fp), false, TEST_QUEUE_DEPTH, TEST_BLOCK_SIZE);
+    ASSERT_TRUE(file.is_open());
+
+    unsigned char buf[10];
+    ASSERT_EQ(file_read_retry(file, buf, sizeof(buf)), oc::success(10u));
+
+    // Write at the current position, which is not block-aligned
+    ASSERT_EQ(file.write("abcde", 5), oc::success(5u));
+
+    ASSERT_EQ(file.seek(8, SEEK_SET), oc::success(8u));
+    ASSERT_EQ(file_read_retry(file, buf, sizeof(buf)), oc::success(10u));
+    ASSERT_EQ(memcmp(buf, data.data() + 8, 2), 0);
+    ASSERT_EQ(memcmp(buf + 2, "abcde", 5), 0);
+    ASSERT_EQ(memcmp(buf + 7, data.data() + 15, 3), 0);
+}
+
+TEST_F(FileUringTest, TruncateFile)
+{
+    UringFile file(fileno(_fp), false, TEST_QUEUE_DEPTH, TEST_BLOCK_SIZE);
+    ASSERT_TRUE(file.is_open());
+
+    ASSERT_EQ(file.write("abcdef", 6), oc::success(6u));
+    ASSERT_TRUE(file.truncate(3));
+    ASSERT_EQ(file.seek(0, SEEK_END), oc::success(3u));
+
+    ASSERT_TRUE(file.close());
+}
+
+TEST_F(FileUringTest, CloseOwnedFd)
+{
+    int fd = dup(fileno(_fp));
+    ASSERT_GE(fd, 0);
+
+    UringFile file(fd, true, TEST_QUEUE_DEPTH, TEST_BLOCK_SIZE);
+    ASSERT_TRUE(file.is_open());
+    ASSERT_TRUE(file.close());
+
+    ASSERT_LT(fcntl(fd, F_GETFD), 0);
+}
@@ -0,0 +1,148 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <map>
+
+#include <cstdint>
+
+#include "mbcommon/arena.h"
+
+using namespace mb;
+
+static bool is_aligned(const void *ptr, size_t alignment)
+{
+    return reinterpret_cast<uintptr_t>(ptr) % alignment == 0;
+}
+
+TEST(ArenaTest, EmptyArenaHasNoBlocks)
+{
+    Arena arena;
+    ASSERT_EQ(arena.bytes_allocated(), 0u);
+    ASSERT_EQ(arena.bytes_reserved(), 0u);
+}
+
+TEST(ArenaTest, SmallAllocationsShareBlock)
+{
+    Arena arena(4096);
+
+    auto a = static_cast<char *>(arena.allocate(16, 1));
+    auto reserved = arena.bytes_reserved();
+    auto b = static_cast<char *>(arena.allocate(16, 1));
+
+    ASSERT_EQ(b, a + 16);
+    ASSERT_EQ(arena.bytes_reserved(), reserved);
+    ASSERT_EQ(arena.bytes_allocated(), 32u);
+}
+
+TEST(ArenaTest, AllocationsAreAligned)
+{
+    Arena arena(4096);
+
+    for (size_t alignment : {1, 2, 4, 8, 16, 64, 256}) {
+        arena.allocate(1, 1);
+        ASSERT_TRUE(is_aligned(arena.allocate(3, alignment), alignment));
+    }
+
+    ASSERT_TRUE(is_aligned(arena.allocate(8192, 64), 64));
+}
+
+TEST(ArenaTest, LargeAllocationKeepsCurrentBlock)
+{
+    Arena arena(4096);
+
+    auto a = static_cast<char *>(arena.allocate(16, 1));
+    auto large = arena.allocate(10000, 1);
+    auto b = static_cast<char *>(arena.allocate(16, 1));
+
+    ASSERT_NE(large, nullptr);
+    ASSERT_EQ(b, a + 16);
+    ASSERT_GE(arena.bytes_reserved(), 4096u + 10000u);
+}
+
+TEST(ArenaTest, ExhaustedBlockIsReplaced)
+{
+    Arena arena(1024);
+
+    for (int i = 0; i < 100; ++i) {
+        auto ptr = static_cast<char *>(arena.allocate(200, 1));
+        // Memory must be writable
+        std::fill(ptr, ptr + 200, static_cast<char>(i));
+    }
+
+    ASSERT_EQ(arena.bytes_allocated(), 20000u);
+    ASSERT_GE(arena.bytes_reserved(), 20000u);
+}
+
+TEST(ArenaTest, ReleaseFreesEverything)
+{
+    Arena arena(1024);
+
+    arena.allocate(100);
+    arena.allocate(5000);
+    arena.release();
+
+    ASSERT_EQ(arena.bytes_allocated(), 0u);
+    ASSERT_EQ(arena.bytes_reserved(), 0u);
+
+    // Arena is usable after being released
+    ASSERT_NE(arena.allocate(100), nullptr);
+}
+
+TEST(ArenaTest, ContainersUseArena)
+{
+    Arena arena(1024);
+
+    {
+        ArenaVector<ArenaString> strings{ArenaAllocator<ArenaString>(arena)};
+        for (int i = 0; i < 100; ++i) {
+            strings.emplace_back(
+                    "a string that is too long for the small string buffer",
+                    ArenaAllocator<char>(arena));
+        }
+
+        ASSERT_EQ(strings.size(), 100u);
+        ASSERT_EQ(strings[99], strings[0]);
+        ASSERT_GT(arena.bytes_allocated(), 100u * 50u);
+    }
+
+    {
+        using Alloc = ArenaAllocator<std::pair<const int, int>>;
+        std::map<int, int, std::less<int>, Alloc> map{Alloc(arena)};
+        for (int i = 0; i < 100; ++i) {
+            map[i] = i * 2;
+        }
+
+        ASSERT_EQ(map.size(), 100u);
+        ASSERT_EQ(map[42], 84);
+    }
+
+    arena.release();
+    ASSERT_EQ(arena.bytes_reserved(), 0u);
+}
+
+TEST(ArenaTest, AllocatorEquality)
+{
+    Arena a;
+    Arena b;
+
+    ASSERT_EQ(ArenaAllocator<int>(a), ArenaAllocator<char>(a));
+    ASSERT_NE(ArenaAllocator<int>(a), ArenaAllocator<int>(b));
+}
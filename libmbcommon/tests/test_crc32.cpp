@@ -0,0 +1,139 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <vector>
+
+#include <cstring>
+
+#include "mbcommon/crc32.h"
+#include "mbcommon/endian.h"
+
+using namespace mb;
+
+// Bitwise reference implementation
+static uint32_t reference_crc32(const unsigned char *p, size_t size)
+{
+    uint32_t crc = 0xffffffff;
+
+    for (size_t i = 0; i < size; ++i) {
+        crc ^= p[i];
+        for (int k = 0; k < 8; ++k) {
+            crc = crc & 1 ? 0xedb88320 ^ (crc >> 1) : crc >> 1;
+        }
+    }
+
+    return ~crc;
+}
+
+static std::vector<unsigned char> make_data(size_t size)
+{
+    std::vector<unsigned char> data(size);
+    uint32_t state = 0x12345678;
+
+    for (auto &b : data) {
+        state = state * 1103515245 + 12345;
+        b = static_cast<unsigned char>(state >> 24);
+    }
+
+    return data;
+}
+
+TEST(Crc32Test, CheckKnownValue)
+{
+    ASSERT_EQ(crc32_update(0, "123456789", 9), 0xcbf43926u);
+    ASSERT_EQ(crc32_update(0, nullptr, 0), 0u);
+}
+
+TEST(Crc32Test, IncrementalUpdateMatchesSingleUpdate)
+{
+    std::vector<unsigned char> data(1000);
+    for (size_t i = 0; i < data.size(); ++i) {
+        data[i] = static_cast<unsigned char>(i * 7 + 3);
+    }
+
+    auto expected = crc32_update(0, data.data(), data.size());
+
+    // Split at sizes that aren't multiples of the slicing width
+    uint32_t crc = 0;
+    for (size_t i = 0; i < data.size(); i += 13) {
+        crc = crc32_update(crc, data.data() + i,
+                           std::min<size_t>(13, data.size() - i));
+    }
+
+    ASSERT_EQ(crc, expected);
+}
+
+TEST(Crc32Test, RepeatedPatternMatchesMaterializedData)
+{
+    const uint32_t pattern = 0x12345678;
+    const uint32_t pattern_le = mb_htole32(pattern);
+
+    std::vector<unsigned char> data(300);
+    for (size_t i = 0; i < data.size(); i += sizeof(pattern_le)) {
+        memcpy(data.data() + i, &pattern_le, sizeof(pattern_le));
+    }
+
+    // Covers both the direct and the arithmetic paths
+    for (size_t size = 0; size <= data.size(); ++size) {
+        ASSERT_EQ(crc32_update_repeated(0xdeadbeef, pattern, size),
+                  crc32_update(0xdeadbeef, data.data(), size))
+                << "Size: " << size;
+    }
+
+    // Checked against zlib
+    ASSERT_EQ(crc32_update_repeated(0, pattern, 400002), 0x735d0259u);
+}
+
+TEST(Crc32Test, SelectedImplementationMatchesReference)
+{
+    auto data = make_data(4096 + 64);
+
+    // Cover the vectorized paths, their tails, and unaligned buffers
+    for (size_t offset = 0; offset < 16; offset += 3) {
+        for (size_t size : {0, 1, 15, 16, 63, 64, 65, 127, 128, 200, 1000,
+                            4096}) {
+            ASSERT_EQ(crc32_update(0, data.data() + offset, size),
+                      reference_crc32(data.data() + offset, size))
+                    << "Implementation: " << crc32_implementation()
+                    << ", offset: " << offset << ", size: " << size;
+        }
+    }
+}
+
+TEST(Crc32Test, ConcatMatchesSingleUpdate)
+{
+    auto data = make_data(10000);
+    auto expected = crc32_update(0, data.data(), data.size());
+
+    for (size_t split : {0, 1, 7, 64, 4097, 9999, 10000}) {
+        auto crc1 = crc32_update(0, data.data(), split);
+        auto crc2 = crc32_update(0, data.data() + split, data.size() - split);
+
+        ASSERT_EQ(crc32_concat(crc1, crc2, data.size() - split), expected)
+                << "Split: " << split;
+    }
+
+    // Sizes too large to materialize must compose
+    ASSERT_EQ(crc32_concat(0xcbf43926, 0x12345678, UINT64_C(1) << 40),
+              crc32_concat(crc32_concat(0xcbf43926, 0, UINT64_C(1) << 39),
+                            0x12345678, UINT64_C(1) << 39));
+}
@@ -24,7 +24,9 @@
 #include <vector>
 
 #include <cinttypes>
+#include <cstdio>
 
+#include "mbcommon/file/fd.h"
 #include "mbcommon/file/memory.h"
 #include "mbcommon/file_error.h"
 #include "mbcommon/file_util.h"
@@ -36,6 +38,38 @@ using namespace mb;
 using namespace mb::detail;
 using namespace testing;
 
+struct ScopedTmpFile
+{
+    FILE *fp = tmpfile();
+
+    ~ScopedTmpFile()
+    {
+        if (fp) {
+            fclose(fp);
+        }
+    }
+};
+
+// Like a procfs or sysfs file: the fd looks empty to the kernel, but reading
+// through the File handle returns data
+class ZeroSizeFdFile : public MemoryFile
+{
+public:
+    ZeroSizeFdFile(void *buf, size_t size, int fd)
+        : MemoryFile(buf, size)
+        , _fd(fd)
+    {
+    }
+
+    int native_fd() override
+    {
+        return _fd;
+    }
+
+private:
+    int _fd;
+};
+
 struct FileUtilTest : Test
 {
     NiceMock<MockFile> _file;
@@ -222,6 +256,44 @@ TEST_F(FileUtilTest, WriteExactPartialFail)
               oc::failure(std::error_code()));
 }
 
+TEST_F(FileUtilTest, WritevExactNormal)
+{
+    // Default File::writev() implementation calls File::write() per buffer
+    EXPECT_CALL(_file, write(_, _))
+            .Times(4)
+            .WillRepeatedly(Return(2u));
+
+    ConstIoVec iov[] = { { "xxx", 3 }, { "", 0 }, { "xxxxx", 5 } };
+    ASSERT_TRUE(file_writev_exact(_file, iov, 3));
+}
+
+TEST_F(FileUtilTest, WritevExactEOF)
+{
+    EXPECT_CALL(_file, write(_, _))
+            .Times(3)
+            .WillOnce(Return(3u))
+            .WillOnce(Return(2u))
+            .WillOnce(Return(0u));
+
+    ConstIoVec iov[] = { { "xxx", 3 }, { "xxxxx", 5 } };
+    ASSERT_EQ(file_writev_exact(_file, iov, 2),
+              oc::failure(FileError::UnexpectedEof));
+}
+
+TEST_F(FileUtilTest, WritevExactInterrupted)
+{
+    auto eintr = std::make_error_code(std::errc::interrupted);
+
+    EXPECT_CALL(_file, write(_, _))
+            .Times(3)
+            .WillOnce(Return(eintr))
+            .WillOnce(Return(3u))
+            .WillOnce(Return(5u));
+
+    ConstIoVec iov[] = { { "xxx", 3 }, { "xxxxx", 5 } };
+    ASSERT_TRUE(file_writev_exact(_file, iov, 2));
+}
+
 TEST_F(FileUtilTest, ReadDiscardNormal)
 {
     EXPECT_CALL(_file, read(_, _))
@@ -351,6 +423,48 @@ TEST(FileSearchTest, FindNonMatchingAtBoundary)
     ASSERT_TRUE(searcher.next() == oc::success(std::nullopt));
 }
 
+TEST(FileSearchTest, FindWithPartialCandidates)
+{
+    std::string buf = "axcdabxdabcaabcd";
+
+    MemoryFile file(buf.data(), buf.size());
+    ASSERT_TRUE(file.is_open());
+
+    FileSearcher searcher(&file, "abcd", 4);
+    // gtest fails to compile with ASSERT_EQ due to operator<<() shenanigans
+    ASSERT_TRUE(searcher.next() == oc::success(12));
+    ASSERT_TRUE(searcher.next() == oc::success(std::nullopt));
+}
+
+TEST(FileSearchTest, FindSingleByte)
+{
+    std::string buf = "xaxxa";
+
+    MemoryFile file(buf.data(), buf.size());
+    ASSERT_TRUE(file.is_open());
+
+    FileSearcher searcher(&file, "a", 1);
+    // gtest fails to compile with ASSERT_EQ due to operator<<() shenanigans
+    ASSERT_TRUE(searcher.next() == oc::success(1));
+    ASSERT_TRUE(searcher.next() == oc::success(4));
+    ASSERT_TRUE(searcher.next() == oc::success(std::nullopt));
+}
+
+TEST(FileSearchTest, FindLongPatternOnBoundaryOfBuffer)
+{
+    std::string buf;
+    buf.resize(DEFAULT_BUFFER_SIZE - 8);
+    buf += "0123456789abcdefxxxx";
+
+    MemoryFile file(buf.data(), buf.size());
+    ASSERT_TRUE(file.is_open());
+
+    FileSearcher searcher(&file, "0123456789abcdef", 16);
+    // gtest fails to compile with ASSERT_EQ due to operator<<() shenanigans
+    ASSERT_TRUE(searcher.next() == oc::success(DEFAULT_BUFFER_SIZE - 8));
+    ASSERT_TRUE(searcher.next() == oc::success(std::nullopt));
+}
+
 TEST(FileMoveTest, DegenerateCasesShouldSucceed)
 {
     char buf[] = "abcdef";
@@ -447,4 +561,156 @@ TEST(FileMoveTest, LargeBackwardsCopyShouldSucceed)
     }
 }
 
+TEST(FileMoveTest, NonOverlappingFdMoveShouldSucceed)
+{
+    ScopedTmpFile tmp;
+    ASSERT_TRUE(tmp.fp);
+
+    FdFile file(fileno(tmp.fp), false);
+    ASSERT_TRUE(file.is_open());
+
+    ASSERT_TRUE(file_write_exact(file, "abcdef", 6));
+
+    ASSERT_EQ(file_move(file, 0, 3, 3), oc::success(3u));
+
+    char buf[7] = {};
+    ASSERT_EQ(file.read_at(0, buf, 6), oc::success(6u));
+    ASSERT_STREQ(buf, "abcabc");
+}
+
+TEST(FileCopyTest, ZeroSizeShouldSucceed)
+{
+    char src_buf[] = "abcdef";
+    char dst_buf[] = "ghijkl";
+
+    MemoryFile src(src_buf, sizeof(src_buf) - 1);
+    ASSERT_TRUE(src.is_open());
+    MemoryFile dst(dst_buf, sizeof(dst_buf) - 1);
+    ASSERT_TRUE(dst.is_open());
+
+    ASSERT_EQ(file_copy(src, dst, 0), oc::success(0u));
+    ASSERT_STREQ(dst_buf, "ghijkl");
+}
+
+TEST(FileCopyTest, NormalCopyShouldSucceed)
+{
+    char src_buf[] = "abcdef";
+    char dst_buf[] = "ghijkl";
+
+    MemoryFile src(src_buf, sizeof(src_buf) - 1);
+    ASSERT_TRUE(src.is_open());
+    MemoryFile dst(dst_buf, sizeof(dst_buf) - 1);
+    ASSERT_TRUE(dst.is_open());
+
+    ASSERT_TRUE(src.seek(1, SEEK_SET));
+    ASSERT_TRUE(dst.seek(2, SEEK_SET));
+
+    ASSERT_EQ(file_copy(src, dst, 3), oc::success(3u));
+    ASSERT_STREQ(dst_buf, "ghbcdl");
+
+    // File positions should be advanced
+    ASSERT_EQ(src.seek(0, SEEK_CUR), oc::success(4u));
+    ASSERT_EQ(dst.seek(0, SEEK_CUR), oc::success(5u));
+}
+
+TEST(FileCopyTest, CopyPastEofShouldCopyPartially)
+{
+    char src_buf[] = "abcdef";
+    char dst_buf[] = "ghijklmnop";
+
+    MemoryFile src(src_buf, sizeof(src_buf) - 1);
+    ASSERT_TRUE(src.is_open());
+    MemoryFile dst(dst_buf, sizeof(dst_buf) - 1);
+    ASSERT_TRUE(dst.is_open());
+
+    ASSERT_TRUE(src.seek(2, SEEK_SET));
+
+    ASSERT_EQ(file_copy(src, dst, 10), oc::success(4u));
+    ASSERT_STREQ(dst_buf, "cdefklmnop");
+}
+
+TEST(FileCopyTest, LargeCopyShouldSucceed)
+{
+    std::vector<unsigned char> src_buf(COPY_BUFFER_SIZE * 2 + 100);
+    std::vector<unsigned char> dst_buf(src_buf.size());
+
+    for (size_t i = 0; i < src_buf.size(); ++i) {
+        src_buf[i] = static_cast<unsigned char>(i % 251);
+    }
+
+    MemoryFile src(src_buf.data(), src_buf.size());
+    ASSERT_TRUE(src.is_open());
+    MemoryFile dst(dst_buf.data(), dst_buf.size());
+    ASSERT_TRUE(dst.is_open());
+
+    ASSERT_EQ(file_copy(src, dst, src_buf.size()),
+              oc::success(src_buf.size()));
+    ASSERT_EQ(dst_buf, src_buf);
+}
+
+TEST(FileCopyTest, FdCopyShouldSucceed)
+{
+    ScopedTmpFile src_tmp;
+    ASSERT_TRUE(src_tmp.fp);
+    ScopedTmpFile dst_tmp;
+    ASSERT_TRUE(dst_tmp.fp);
+
+    FdFile src(fileno(src_tmp.fp), false);
+    ASSERT_TRUE(src.is_open());
+    FdFile dst(fileno(dst_tmp.fp), false);
+    ASSERT_TRUE(dst.is_open());
+
+    ASSERT_TRUE(file_write_exact(src, "abcdef", 6));
+    ASSERT_TRUE(src.seek(1, SEEK_SET));
+
+    ASSERT_EQ(file_copy(src, dst, 10), oc::success(5u));
+
+    ASSERT_EQ(src.seek(0, SEEK_CUR), oc::success(6u));
+    ASSERT_EQ(dst.seek(0, SEEK_CUR), oc::success(5u));
+
+    char buf[6] = {};
+    ASSERT_EQ(dst.read_at(0, buf, 5), oc::success(5u));
+    ASSERT_STREQ(buf, "bcdef");
+}
+
+TEST(FileCopyTest, MixedCopyShouldSucceed)
+{
+    char src_buf[] = "abcdef";
+
+    ScopedTmpFile dst_tmp;
+    ASSERT_TRUE(dst_tmp.fp);
+
+    MemoryFile src(src_buf, sizeof(src_buf) - 1);
+    ASSERT_TRUE(src.is_open());
+    FdFile dst(fileno(dst_tmp.fp), false);
+    ASSERT_TRUE(dst.is_open());
+
+    ASSERT_EQ(file_copy(src, dst, 6), oc::success(6u));
+
+    char buf[7] = {};
+    ASSERT_EQ(dst.read_at(0, buf, 6), oc::success(6u));
+    ASSERT_STREQ(buf, "abcdef");
+}
+
+TEST(FileCopyTest, ZeroSizeFdCopyShouldFallBackToBuffer)
+{
+    char src_buf[] = "abcdef";
+
+    ScopedTmpFile src_tmp;
+    ASSERT_TRUE(src_tmp.fp);
+    ScopedTmpFile dst_tmp;
+    ASSERT_TRUE(dst_tmp.fp);
+
+    ZeroSizeFdFile src(src_buf, sizeof(src_buf) - 1, fileno(src_tmp.fp));
+    ASSERT_TRUE(src.is_open());
+    FdFile dst(fileno(dst_tmp.fp), false);
+    ASSERT_TRUE(dst.is_open());
+
+    ASSERT_EQ(file_copy(src, dst, 10), oc::success(6u));
+
+    char buf[7] = {};
+    ASSERT_EQ(dst.read_at(0, buf, 6), oc::success(6u));
+    ASSERT_STREQ(buf, "abcdef");
+}
+
 // TODO: Add more tests after integrating gmock
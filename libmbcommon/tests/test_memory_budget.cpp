@@ -0,0 +1,119 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include "mbcommon/memory_budget.h"
+
+using namespace mb;
+
+TEST(MemoryBudgetTest, ReservationsAreBounded)
+{
+    MemoryBudget budget(100);
+
+    ASSERT_TRUE(budget.try_reserve(60));
+    ASSERT_FALSE(budget.try_reserve(41));
+    ASSERT_EQ(budget.used(), 60u);
+    ASSERT_TRUE(budget.try_reserve(40));
+    ASSERT_FALSE(budget.try_reserve(1));
+
+    budget.release(50);
+    ASSERT_EQ(budget.used(), 50u);
+    ASSERT_TRUE(budget.try_reserve(50));
+
+    // Lowering the limit only affects new reservations
+    budget.set_limit(10);
+    ASSERT_EQ(budget.used(), 100u);
+    ASSERT_FALSE(budget.try_reserve(0));
+    budget.release(100);
+    ASSERT_TRUE(budget.try_reserve(10));
+}
+
+TEST(MemoryBudgetTest, UnlimitedByDefault)
+{
+    MemoryBudget budget;
+
+    ASSERT_EQ(budget.limit(), MemoryBudget::UNLIMITED);
+    ASSERT_TRUE(budget.try_reserve(UINT64_MAX / 2));
+    ASSERT_TRUE(budget.try_reserve(UINT64_MAX / 2));
+}
+
+TEST(MemoryBudgetTest, AutoLimitIsComputedOnFirstUse)
+{
+    MemoryBudget budget;
+
+    budget.set_auto_limit(MemoryContext::Recovery);
+    auto limit = budget.limit();
+    ASSERT_NE(limit, MemoryBudget::UNLIMITED);
+    ASSERT_GE(limit, 16u * 1024 * 1024);
+
+    // An explicit limit replaces a pending automatic one
+    budget.set_auto_limit(MemoryContext::System);
+    budget.set_limit(100);
+    ASSERT_EQ(budget.limit(), 100u);
+    ASSERT_FALSE(budget.try_reserve(101));
+}
+
+TEST(MemoryBudgetTest, LimitFromMeminfo)
+{
+    constexpr char meminfo[] =
+            "MemTotal:        2000000 kB\n"
+            "MemFree:          300000 kB\n"
+            "MemAvailable:    1000000 kB\n"
+            "Buffers:           10000 kB\n"
+            "Cached:           500000 kB\n";
+
+    auto limit = memory_budget_limit(meminfo, MemoryContext::Recovery);
+    ASSERT_TRUE(limit);
+    ASSERT_EQ(limit.value(), 500000u * 1024);
+
+    limit = memory_budget_limit(meminfo, MemoryContext::System);
+    ASSERT_TRUE(limit);
+    ASSERT_EQ(limit.value(), 250000u * 1024);
+}
+
+TEST(MemoryBudgetTest, LimitFromOldMeminfo)
+{
+    // MemAvailable does not exist before Linux 3.14
+    constexpr char meminfo[] =
+            "MemTotal:        2000000 kB\n"
+            "MemFree:          300000 kB\n"
+            "Cached:           500000 kB\n";
+
+    auto limit = memory_budget_limit(meminfo, MemoryContext::Recovery);
+    ASSERT_TRUE(limit);
+    ASSERT_EQ(limit.value(), 400000u * 1024);
+}
+
+TEST(MemoryBudgetTest, LimitHasMinimum)
+{
+    auto limit = memory_budget_limit("MemAvailable: 1024 kB\n",
+                                     MemoryContext::System);
+    ASSERT_TRUE(limit);
+    ASSERT_EQ(limit.value(), 16u * 1024 * 1024);
+}
+
+TEST(MemoryBudgetTest, LimitFromInvalidMeminfo)
+{
+    ASSERT_EQ(memory_budget_limit("", MemoryContext::System),
+              oc::failure(std::errc::invalid_argument));
+    ASSERT_EQ(memory_budget_limit("MemAvailable: abc kB\n",
+                                  MemoryContext::System),
+              oc::failure(std::errc::invalid_argument));
+}
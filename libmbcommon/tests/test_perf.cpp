@@ -0,0 +1,121 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+#include "mbcommon/perf.h"
+
+using namespace mb::perf;
+
+static const MetricSnapshot * find(const std::vector<MetricSnapshot> &metrics,
+                                   const std::string &name)
+{
+    auto it = std::find_if(metrics.begin(), metrics.end(),
+                           [&](const MetricSnapshot &m) {
+        return m.name == name;
+    });
+    return it == metrics.end() ? nullptr : &*it;
+}
+
+TEST(PerfTest, CounterIsRegistered)
+{
+    static Counter counter("test.perf.counter");
+    counter.reset();
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; ++i) {
+        threads.emplace_back([] {
+            for (int j = 0; j < 1000; ++j) {
+                counter.add();
+            }
+        });
+    }
+    for (auto &t : threads) {
+        t.join();
+    }
+
+    auto metrics = snapshot();
+    auto m = find(metrics, "test.perf.counter");
+    ASSERT_NE(m, nullptr);
+    ASSERT_EQ(m->type, MetricType::Counter);
+    ASSERT_EQ(m->count, 4000u);
+
+    ASSERT_TRUE(std::is_sorted(metrics.begin(), metrics.end(),
+                               [](const MetricSnapshot &a,
+                                  const MetricSnapshot &b) {
+        return a.name < b.name;
+    }));
+}
+
+TEST(PerfTest, HistogramBuckets)
+{
+    static Histogram histogram("test.perf.histogram");
+    histogram.reset();
+
+    histogram.record(0);
+    histogram.record(1);
+    histogram.record(5);
+    histogram.record(5);
+    histogram.record(1000);
+
+    ASSERT_EQ(histogram.count(), 5u);
+    ASSERT_EQ(histogram.sum(), 1011u);
+    ASSERT_EQ(histogram.max(), 1000u);
+    ASSERT_EQ(histogram.bucket(0), 1u);
+    ASSERT_EQ(histogram.bucket(1), 1u);
+    // [4, 8)
+    ASSERT_EQ(histogram.bucket(3), 2u);
+    // [512, 1024)
+    ASSERT_EQ(histogram.bucket(10), 1u);
+
+    auto metrics = snapshot();
+    auto m = find(metrics, "test.perf.histogram");
+    ASSERT_NE(m, nullptr);
+    ASSERT_EQ(percentile(*m, 0.5), 7u);
+    ASSERT_EQ(percentile(*m, 1.0), 1000u);
+}
+
+TEST(PerfTest, ScopedTimerRecordsSample)
+{
+    static Histogram histogram("test.perf.timer");
+    histogram.reset();
+
+    {
+        ScopedTimer timer(histogram);
+    }
+
+    ASSERT_EQ(histogram.count(), 1u);
+}
+
+TEST(PerfTest, ResetAndFormat)
+{
+    static Counter counter("test.perf.reset");
+    counter.add(42);
+
+    auto text = format_snapshot(snapshot());
+    ASSERT_NE(text.find("test.perf.reset"), std::string::npos);
+    ASSERT_NE(text.find("42"), std::string::npos);
+
+    reset();
+    ASSERT_EQ(counter.value(), 0u);
+}
@@ -19,6 +19,8 @@
 
 #include <gtest/gtest.h>
 
+#include <algorithm>
+
 #include "mbcommon/string.h"
 
 using namespace mb;
@@ -46,6 +48,46 @@ TEST(StringTest, FormatSizeT)
     ASSERT_EQ(format("%" MB_PRIzX, unsigned_val), "FFFFFFFF");
 }
 
+TEST(StringTest, FormatToString)
+{
+    std::string buf = "Hello";
+
+    // Appends to existing contents
+    ASSERT_EQ(format_to(buf, ", %s!", "World"), oc::success(8u));
+    ASSERT_EQ(buf, "Hello, World!");
+
+    // Reuses existing capacity
+    buf.clear();
+    buf.reserve(100);
+    auto data = buf.data();
+    ASSERT_EQ(format_to(buf, "%d", 12345), oc::success(5u));
+    ASSERT_EQ(buf, "12345");
+    ASSERT_EQ(buf.data(), data);
+
+    // Grows if needed
+    std::string big(1000, 'x');
+    buf.clear();
+    buf.shrink_to_fit();
+    ASSERT_EQ(format_to(buf, "%s%s", "a", big.c_str()), oc::success(1001u));
+    ASSERT_EQ(buf, "a" + big);
+}
+
+TEST(StringTest, FormatToFixedBuffer)
+{
+    char buf[8];
+
+    ASSERT_EQ(format_to(buf, sizeof(buf), "%d-%d", 12, 34), oc::success(5u));
+    ASSERT_STREQ(buf, "12-34");
+
+    ASSERT_EQ(format_to(buf, sizeof(buf), "%s", ""), oc::success(0u));
+    ASSERT_STREQ(buf, "");
+
+    // Truncated output is still NULL-terminated
+    ASSERT_EQ(format_to(buf, sizeof(buf), "%s", "Hello, World!"),
+              oc::failure(std::errc::value_too_large));
+    ASSERT_STREQ(buf, "Hello, ");
+}
+
 TEST(StringTest, CheckStartsWithNormal)
 {
     // Check equal strings
@@ -229,6 +271,45 @@ TEST(StringTest, CheckSplitStringView)
     ASSERT_EQ(split_sv("a:,:;b", ",:;"), VSV({"a", "", "", "", "b"}));
 }
 
+TEST(StringTest, CheckSplitRange)
+{
+    using VSV = std::vector<std::string_view>;
+
+    auto collect = [](auto &&range) {
+        return VSV(range.begin(), range.end());
+    };
+
+    // Empty delimiter or string
+    ASSERT_EQ(collect(split_range("", "")), VSV({""}));
+    ASSERT_EQ(collect(split_range("abc", "")), VSV({"abc"}));
+    ASSERT_EQ(collect(split_range("", ':')), VSV({""}));
+
+    // Normal split
+    ASSERT_EQ(collect(split_range(":a:b:c:", ':')),
+              VSV({"", "a", "b", "c", ""}));
+
+    // Repeated delimiters in source
+    ASSERT_EQ(collect(split_range("a:::b", ':')), VSV({"a", "", "", "b"}));
+
+    // Multiple delimiters
+    ASSERT_EQ(collect(split_range("a:b;c,d", ",:;")),
+              VSV({"a", "b", "c", "d"}));
+
+    // Multiple repeated delimiters
+    ASSERT_EQ(collect(split_range("a:,:;b", ",:;")),
+              VSV({"a", "", "", "", "b"}));
+
+    // Range can be iterated multiple times and stopped early
+    auto range = split_range("a,b,c", ',');
+    auto it = range.begin();
+    ASSERT_EQ(*it, "a");
+    ASSERT_EQ((it++)->size(), 1u);
+    ASSERT_EQ(*it, "b");
+    ASSERT_EQ(collect(range), VSV({"a", "b", "c"}));
+    ASSERT_NE(std::find(range.begin(), range.end(), "c"), range.end());
+    ASSERT_EQ(std::find(range.begin(), range.end(), "d"), range.end());
+}
+
 TEST(StringTest, CheckJoin)
 {
     using VS = std::vector<std::string>;
@@ -0,0 +1,158 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+
+#include "mbcommon/thread_pool.h"
+
+using namespace mb;
+
+TEST(ThreadPoolTest, RunsAllTasks)
+{
+    ThreadPool pool(4);
+    ASSERT_EQ(pool.threads(), 4u);
+
+    std::atomic_int count(0);
+
+    {
+        TaskGroup group(pool);
+        for (int i = 0; i < 1000; ++i) {
+            group.run([&] { ++count; });
+        }
+        group.wait();
+        ASSERT_EQ(count, 1000);
+    }
+}
+
+TEST(ThreadPoolTest, InlineFallback)
+{
+    ThreadPool pool(1);
+    ASSERT_EQ(pool.threads(), 0u);
+
+    auto caller = std::this_thread::get_id();
+    std::thread::id ran_on;
+
+    pool.submit([&] { ran_on = std::this_thread::get_id(); });
+    ASSERT_EQ(ran_on, caller);
+    ASSERT_FALSE(pool.run_pending_task());
+}
+
+TEST(ThreadPoolTest, NestedGroupsDoNotDeadlock)
+{
+    ThreadPool pool(2);
+    std::atomic_int count(0);
+
+    TaskGroup outer(pool);
+    for (int i = 0; i < 16; ++i) {
+        outer.run([&] {
+            // Every worker blocks in an inner wait, so the subtasks can only
+            // complete if waiting threads run them
+            TaskGroup inner(pool);
+            for (int j = 0; j < 16; ++j) {
+                inner.run([&] { ++count; });
+            }
+            inner.wait();
+        });
+    }
+    outer.wait();
+
+    ASSERT_EQ(count, 256);
+}
+
+TEST(ThreadPoolTest, CancelSkipsQueuedTasks)
+{
+    ThreadPool pool(1);
+    TaskGroup group(pool);
+    int count = 0;
+
+    group.run([&] { ++count; });
+    group.cancel();
+    ASSERT_TRUE(group.is_cancelled());
+    group.run([&] { ++count; });
+    group.wait();
+
+    ASSERT_EQ(count, 1);
+}
+
+TEST(ThreadPoolTest, DestructorDrainsQueue)
+{
+    std::atomic_int count(0);
+
+    {
+        ThreadPool pool(3);
+        for (int i = 0; i < 100; ++i) {
+            pool.submit([&] { ++count; });
+        }
+    }
+
+    ASSERT_EQ(count, 100);
+}
+
+TEST(ThreadPoolTest, ParallelForVisitsEachIndexOnce)
+{
+    std::vector<std::atomic_int> visits(500);
+
+    parallel_for(visits.size(), 0, [&](size_t i) { ++visits[i]; });
+
+    for (auto &v : visits) {
+        ASSERT_EQ(v, 1);
+    }
+}
+
+TEST(ThreadPoolTest, RunBoundedLimitsThreads)
+{
+    std::mutex mutex;
+    std::set<std::thread::id> ids;
+    std::atomic_int active(0);
+    std::atomic_int max_active(0);
+
+    run_bounded(64, 3, [&](size_t) {
+        int n = ++active;
+        int prev = max_active.load();
+        while (prev < n && !max_active.compare_exchange_weak(prev, n)) {}
+
+        {
+            std::lock_guard lock(mutex);
+            ids.insert(std::this_thread::get_id());
+        }
+
+        std::this_thread::yield();
+        --active;
+    });
+
+    ASSERT_LE(max_active, 3);
+    ASSERT_LE(ids.size(), 3u);
+}
+
+TEST(ThreadPoolTest, ThreadCountHonorsLimit)
+{
+    set_thread_limit(1);
+    ASSERT_EQ(thread_count(1, 8), 1u);
+    ASSERT_EQ(thread_count(2, 8), 2u);
+
+    set_thread_limit(0);
+    ASSERT_GE(thread_count(1, 8), 1u);
+    ASSERT_LE(thread_count(1, 8), 8u);
+}
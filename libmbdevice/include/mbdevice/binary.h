@@ -0,0 +1,170 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+#include <cstdint>
+
+#include "mbcommon/common.h"
+#include "mbcommon/outcome.h"
+
+#include "mbdevice/device.h"
+
+namespace mb::device
+{
+
+enum class DeviceTableError
+{
+    InvalidMagic = 1,
+    UnsupportedVersion,
+    Truncated,
+    OutOfBounds,
+    UnsortedIndex,
+    InvalidDevice,
+    TooLarge,
+};
+
+MB_EXPORT std::error_code make_error_code(DeviceTableError e);
+
+MB_EXPORT const std::error_category & device_table_error_category();
+
+class MB_EXPORT StringListView
+{
+public:
+    std::size_t size() const;
+    bool empty() const;
+
+    std::string_view operator[](std::size_t index) const;
+
+    std::vector<std::string> to_vector() const;
+
+private:
+    /*! \cond INTERNAL */
+    StringListView(const unsigned char *base, uint32_t first, uint32_t count);
+
+    const unsigned char *m_base;
+    uint32_t m_first;
+    uint32_t m_count;
+
+    friend class DeviceView;
+    /*! \endcond */
+};
+
+class MB_EXPORT DeviceView
+{
+public:
+    std::size_t index() const;
+
+    std::string_view id() const;
+    StringListView codenames() const;
+    std::string_view name() const;
+    std::string_view architecture() const;
+    DeviceFlags flags() const;
+
+    StringListView block_dev_base_dirs() const;
+    StringListView system_block_devs() const;
+    StringListView cache_block_devs() const;
+    StringListView data_block_devs() const;
+    StringListView boot_block_devs() const;
+    StringListView recovery_block_devs() const;
+    StringListView extra_block_devs() const;
+
+    bool tw_supported() const;
+    TwFlags tw_flags() const;
+    TwPixelFormat tw_pixel_format() const;
+    TwForcePixelFormat tw_force_pixel_format() const;
+    int tw_overscan_percent() const;
+    int tw_default_x_offset() const;
+    int tw_default_y_offset() const;
+    std::string_view tw_brightness_path() const;
+    std::string_view tw_secondary_brightness_path() const;
+    int tw_max_brightness() const;
+    int tw_default_brightness() const;
+    std::string_view tw_battery_path() const;
+    std::string_view tw_cpu_temp_path() const;
+    std::string_view tw_input_blacklist() const;
+    std::string_view tw_input_whitelist() const;
+    StringListView tw_graphics_backends() const;
+    std::string_view tw_theme() const;
+
+    Device to_device() const;
+
+private:
+    /*! \cond INTERNAL */
+    DeviceView(const unsigned char *base, const unsigned char *record);
+
+    uint32_t word(std::size_t index) const;
+    std::string_view string(std::size_t index) const;
+    StringListView string_list(std::size_t index) const;
+
+    const unsigned char *m_base;
+    const unsigned char *m_record;
+
+    friend class DeviceTable;
+    /*! \endcond */
+};
+
+class MB_EXPORT DeviceTable
+{
+public:
+    DeviceTable();
+
+    static oc::result<DeviceTable> open(const std::string &path);
+    static oc::result<DeviceTable> from_data(std::string data);
+
+    std::size_t size() const;
+
+    DeviceView operator[](std::size_t index) const;
+
+    std::optional<DeviceView> find(std::string_view codename) const;
+
+private:
+    /*! \cond INTERNAL */
+    DeviceTable(std::shared_ptr<const void> storage,
+                const unsigned char *data, std::size_t size);
+
+    static oc::result<void> validate(const unsigned char *data,
+                                     std::size_t size);
+
+    std::shared_ptr<const void> m_storage;
+    const unsigned char *m_data;
+    std::size_t m_size;
+    /*! \endcond */
+};
+
+MB_EXPORT oc::result<std::string>
+device_list_to_binary(const std::vector<Device> &devices);
+
+}
+
+namespace std
+{
+    template<>
+    struct MB_EXPORT is_error_code_enum<mb::device::DeviceTableError>
+        : true_type
+    {
+    };
+}
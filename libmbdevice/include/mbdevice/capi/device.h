@@ -138,6 +138,16 @@ MB_EXPORT uint32_t mb_device_validate(const CDevice *device);
 
 MB_EXPORT bool mb_device_equals(const CDevice *a, const CDevice *b);
 
+struct CDeviceIndex;
+typedef struct CDeviceIndex CDeviceIndex;
+
+MB_EXPORT CDeviceIndex * mb_device_index_new(const CDevice * const *devices);
+
+MB_EXPORT void mb_device_index_free(CDeviceIndex *index);
+
+MB_EXPORT int64_t mb_device_index_find(const CDeviceIndex *index,
+                                       const char *codename);
+
 #undef GETTER
 #undef SETTER
 
@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "mbcommon/common.h"
+
+#include "mbdevice/device.h"
+
+namespace mb::device
+{
+
+class MB_EXPORT DeviceIndex
+{
+public:
+    DeviceIndex();
+    explicit DeviceIndex(const std::vector<Device> &devices);
+
+    std::size_t add(const Device &device);
+
+    std::size_t size() const;
+
+    std::optional<std::size_t> find(std::string_view codename) const;
+
+private:
+    /*! \cond INTERNAL */
+    std::unordered_map<std::string, std::size_t> m_codenames;
+    std::size_t m_size;
+    /*! \endcond */
+};
+
+}
@@ -0,0 +1,886 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbdevice/binary.h"
+
+#include <algorithm>
+#include <unordered_map>
+
+#include <cstring>
+
+#include "mbcommon/endian.h"
+
+#ifdef _WIN32
+#  include "mbcommon/file/standard.h"
+#  include "mbcommon/file_util.h"
+#else
+#  include "mbcommon/file/mmap.h"
+#endif
+
+/*!
+ * \file mbdevice/binary.h
+ * \brief Precompiled binary device table
+ *
+ * The binary device table is generated by devicesgen from the same definitions
+ * as the JSON device list. Unlike the JSON list, it can be memory mapped and
+ * queried directly. Devices are exposed as lightweight views that only decode
+ * a field when it is accessed and lookups by codename are a binary search over
+ * a pre-sorted index.
+ *
+ * All integers are 32-bit little endian. The file consists of:
+ *
+ * - A header (see `HeaderField`)
+ * - An array of fixed-size device records (see `RecordField`). Strings are
+ *   stored as (offset, length) pairs into the string pool and string lists are
+ *   stored as (first, count) pairs into the list entry array.
+ * - The codename index, containing (string offset, string length, device index)
+ *   triples sorted by codename and then by device index
+ * - The list entry array, containing (string offset, string length) pairs
+ * - The string pool
+ */
+
+namespace mb::device
+{
+
+static constexpr char MAGIC[] = "MBDEVTBL";
+static constexpr std::size_t MAGIC_SIZE = sizeof(MAGIC) - 1;
+static constexpr uint32_t VERSION = 1;
+
+// Indexes of 32-bit words in the header
+enum HeaderField : std::size_t
+{
+    HEADER_VERSION = MAGIC_SIZE / 4,
+    HEADER_DEVICE_COUNT,
+    HEADER_DEVICES_OFFSET,
+    HEADER_INDEX_COUNT,
+    HEADER_INDEX_OFFSET,
+    HEADER_LIST_COUNT,
+    HEADER_LISTS_OFFSET,
+    HEADER_STRINGS_SIZE,
+    HEADER_STRINGS_OFFSET,
+    HEADER_WORDS,
+};
+
+// Indexes of 32-bit words in a device record. String and string list fields
+// occupy two words.
+enum RecordField : std::size_t
+{
+    RECORD_ID                       = 0,
+    RECORD_CODENAMES                = 2,
+    RECORD_NAME                     = 4,
+    RECORD_ARCHITECTURE             = 6,
+    RECORD_FLAGS                    = 8,
+    RECORD_BASE_DIRS                = 9,
+    RECORD_SYSTEM_DEVS              = 11,
+    RECORD_CACHE_DEVS               = 13,
+    RECORD_DATA_DEVS                = 15,
+    RECORD_BOOT_DEVS                = 17,
+    RECORD_RECOVERY_DEVS            = 19,
+    RECORD_EXTRA_DEVS               = 21,
+    RECORD_TW_SUPPORTED             = 23,
+    RECORD_TW_FLAGS                 = 24,
+    RECORD_TW_PIXEL_FORMAT          = 25,
+    RECORD_TW_FORCE_PIXEL_FORMAT    = 26,
+    RECORD_TW_OVERSCAN_PERCENT      = 27,
+    RECORD_TW_DEFAULT_X_OFFSET      = 28,
+    RECORD_TW_DEFAULT_Y_OFFSET      = 29,
+    RECORD_TW_BRIGHTNESS_PATH       = 30,
+    RECORD_TW_SECONDARY_BRIGHTNESS  = 32,
+    RECORD_TW_MAX_BRIGHTNESS        = 34,
+    RECORD_TW_DEFAULT_BRIGHTNESS    = 35,
+    RECORD_TW_BATTERY_PATH          = 36,
+    RECORD_TW_CPU_TEMP_PATH         = 38,
+    RECORD_TW_INPUT_BLACKLIST       = 40,
+    RECORD_TW_INPUT_WHITELIST       = 42,
+    RECORD_TW_GRAPHICS_BACKENDS     = 44,
+    RECORD_TW_THEME                 = 46,
+    RECORD_WORDS                    = 48,
+};
+
+static constexpr std::size_t HEADER_SIZE = HEADER_WORDS * 4;
+static constexpr std::size_t RECORD_SIZE = RECORD_WORDS * 4;
+static constexpr std::size_t INDEX_ENTRY_SIZE = 3 * 4;
+static constexpr std::size_t LIST_ENTRY_SIZE = 2 * 4;
+
+static constexpr std::size_t STRING_FIELDS[] = {
+    RECORD_ID,
+    RECORD_NAME,
+    RECORD_ARCHITECTURE,
+    RECORD_TW_BRIGHTNESS_PATH,
+    RECORD_TW_SECONDARY_BRIGHTNESS,
+    RECORD_TW_BATTERY_PATH,
+    RECORD_TW_CPU_TEMP_PATH,
+    RECORD_TW_INPUT_BLACKLIST,
+    RECORD_TW_INPUT_WHITELIST,
+    RECORD_TW_THEME,
+};
+
+static constexpr std::size_t LIST_FIELDS[] = {
+    RECORD_CODENAMES,
+    RECORD_BASE_DIRS,
+    RECORD_SYSTEM_DEVS,
+    RECORD_CACHE_DEVS,
+    RECORD_DATA_DEVS,
+    RECORD_BOOT_DEVS,
+    RECORD_RECOVERY_DEVS,
+    RECORD_EXTRA_DEVS,
+    RECORD_TW_GRAPHICS_BACKENDS,
+};
+
+static inline uint32_t read_word(const unsigned char *base, std::size_t index)
+{
+    uint32_t value;
+    std::memcpy(&value, base + index * 4, sizeof(value));
+    return mb_le32toh(value);
+}
+
+static inline void write_word(std::string &buf, std::size_t offset,
+                              uint32_t value)
+{
+    value = mb_htole32(value);
+    std::memcpy(buf.data() + offset, &value, sizeof(value));
+}
+
+static inline std::string_view pool_string(const unsigned char *base,
+                                           uint32_t offset, uint32_t size)
+{
+    auto pool = base + read_word(base, HEADER_STRINGS_OFFSET);
+    return {reinterpret_cast<const char *>(pool + offset), size};
+}
+
+struct DeviceTableErrorCategory : std::error_category
+{
+    const char * name() const noexcept override;
+
+    std::string message(int ev) const override;
+};
+
+const std::error_category & device_table_error_category()
+{
+    static DeviceTableErrorCategory c;
+    return c;
+}
+
+std::error_code make_error_code(DeviceTableError e)
+{
+    return {static_cast<int>(e), device_table_error_category()};
+}
+
+const char * DeviceTableErrorCategory::name() const noexcept
+{
+    return "device_table";
+}
+
+std::string DeviceTableErrorCategory::message(int ev) const
+{
+    switch (static_cast<DeviceTableError>(ev)) {
+    case DeviceTableError::InvalidMagic:
+        return "invalid device table magic";
+    case DeviceTableError::UnsupportedVersion:
+        return "unsupported device table version";
+    case DeviceTableError::Truncated:
+        return "device table is truncated";
+    case DeviceTableError::OutOfBounds:
+        return "device table reference is out of bounds";
+    case DeviceTableError::UnsortedIndex:
+        return "device table codename index is not sorted";
+    case DeviceTableError::InvalidDevice:
+        return "device failed validation";
+    case DeviceTableError::TooLarge:
+        return "device table is too large";
+    default:
+        return "(unknown device table error)";
+    }
+}
+
+StringListView::StringListView(const unsigned char *base, uint32_t first,
+                               uint32_t count)
+    : m_base(base)
+    , m_first(first)
+    , m_count(count)
+{
+}
+
+std::size_t StringListView::size() const
+{
+    return m_count;
+}
+
+bool StringListView::empty() const
+{
+    return m_count == 0;
+}
+
+std::string_view StringListView::operator[](std::size_t index) const
+{
+    auto entry = m_base + read_word(m_base, HEADER_LISTS_OFFSET)
+            + (m_first + index) * LIST_ENTRY_SIZE;
+    return pool_string(m_base, read_word(entry, 0), read_word(entry, 1));
+}
+
+std::vector<std::string> StringListView::to_vector() const
+{
+    std::vector<std::string> result;
+    result.reserve(m_count);
+
+    for (std::size_t i = 0; i < m_count; ++i) {
+        result.emplace_back((*this)[i]);
+    }
+
+    return result;
+}
+
+DeviceView::DeviceView(const unsigned char *base, const unsigned char *record)
+    : m_base(base)
+    , m_record(record)
+{
+}
+
+uint32_t DeviceView::word(std::size_t index) const
+{
+    return read_word(m_record, index);
+}
+
+std::string_view DeviceView::string(std::size_t index) const
+{
+    return pool_string(m_base, word(index), word(index + 1));
+}
+
+StringListView DeviceView::string_list(std::size_t index) const
+{
+    return {m_base, word(index), word(index + 1)};
+}
+
+std::size_t DeviceView::index() const
+{
+    auto devices = m_base + read_word(m_base, HEADER_DEVICES_OFFSET);
+    return static_cast<std::size_t>(m_record - devices) / RECORD_SIZE;
+}
+
+std::string_view DeviceView::id() const
+{
+    return string(RECORD_ID);
+}
+
+StringListView DeviceView::codenames() const
+{
+    return string_list(RECORD_CODENAMES);
+}
+
+std::string_view DeviceView::name() const
+{
+    return string(RECORD_NAME);
+}
+
+std::string_view DeviceView::architecture() const
+{
+    return string(RECORD_ARCHITECTURE);
+}
+
+DeviceFlags DeviceView::flags() const
+{
+    return static_cast<DeviceFlag>(word(RECORD_FLAGS));
+}
+
+StringListView DeviceView::block_dev_base_dirs() const
+{
+    return string_list(RECORD_BASE_DIRS);
+}
+
+StringListView DeviceView::system_block_devs() const
+{
+    return string_list(RECORD_SYSTEM_DEVS);
+}
+
+StringListView DeviceView::cache_block_devs() const
+{
+    return string_list(RECORD_CACHE_DEVS);
+}
+
+StringListView DeviceView::data_block_devs() const
+{
+    return string_list(RECORD_DATA_DEVS);
+}
+
+StringListView DeviceView::boot_block_devs() const
+{
+    return string_list(RECORD_BOOT_DEVS);
+}
+
+StringListView DeviceView::recovery_block_devs() const
+{
+    return string_list(RECORD_RECOVERY_DEVS);
+}
+
+StringListView DeviceView::extra_block_devs() const
+{
+    return string_list(RECORD_EXTRA_DEVS);
+}
+
+bool DeviceView::tw_supported() const
+{
+    return word(RECORD_TW_SUPPORTED) != 0;
+}
+
+TwFlags DeviceView::tw_flags() const
+{
+    return static_cast<TwFlag>(word(RECORD_TW_FLAGS));
+}
+
+TwPixelFormat DeviceView::tw_pixel_format() const
+{
+    return static_cast<TwPixelFormat>(word(RECORD_TW_PIXEL_FORMAT));
+}
+
+TwForcePixelFormat DeviceView::tw_force_pixel_format() const
+{
+    return static_cast<TwForcePixelFormat>(
+            word(RECORD_TW_FORCE_PIXEL_FORMAT));
+}
+
+int DeviceView::tw_overscan_percent() const
+{
+    return static_cast<int32_t>(word(RECORD_TW_OVERSCAN_PERCENT));
+}
+
+int DeviceView::tw_default_x_offset() const
+{
+    return static_cast<int32_t>(word(RECORD_TW_DEFAULT_X_OFFSET));
+}
+
+int DeviceView::tw_default_y_offset() const
+{
+    return static_cast<int32_t>(word(RECORD_TW_DEFAULT_Y_OFFSET));
+}
+
+std::string_view DeviceView::tw_brightness_path() const
+{
+    return string(RECORD_TW_BRIGHTNESS_PATH);
+}
+
+std::string_view DeviceView::tw_secondary_brightness_path() const
+{
+    return string(RECORD_TW_SECONDARY_BRIGHTNESS);
+}
+
+int DeviceView::tw_max_brightness() const
+{
+    return static_cast<int32_t>(word(RECORD_TW_MAX_BRIGHTNESS));
+}
+
+int DeviceView::tw_default_brightness() const
+{
+    return static_cast<int32_t>(word(RECORD_TW_DEFAULT_BRIGHTNESS));
+}
+
+std::string_view DeviceView::tw_battery_path() const
+{
+    return string(RECORD_TW_BATTERY_PATH);
+}
+
+std::string_view DeviceView::tw_cpu_temp_path() const
+{
+    return string(RECORD_TW_CPU_TEMP_PATH);
+}
+
+std::string_view DeviceView::tw_input_blacklist() const
+{
+    return string(RECORD_TW_INPUT_BLACKLIST);
+}
+
+std::string_view DeviceView::tw_input_whitelist() const
+{
+    return string(RECORD_TW_INPUT_WHITELIST);
+}
+
+StringListView DeviceView::tw_graphics_backends() const
+{
+    return string_list(RECORD_TW_GRAPHICS_BACKENDS);
+}
+
+std::string_view DeviceView::tw_theme() const
+{
+    return string(RECORD_TW_THEME);
+}
+
+/*!
+ * \brief Decode all fields into a Device
+ */
+Device DeviceView::to_device() const
+{
+    Device device;
+
+    device.set_id(std::string(id()));
+    device.set_codenames(codenames().to_vector());
+    device.set_name(std::string(name()));
+    device.set_architecture(std::string(architecture()));
+    device.set_flags(flags());
+
+    device.set_block_dev_base_dirs(block_dev_base_dirs().to_vector());
+    device.set_system_block_devs(system_block_devs().to_vector());
+    device.set_cache_block_devs(cache_block_devs().to_vector());
+    device.set_data_block_devs(data_block_devs().to_vector());
+    device.set_boot_block_devs(boot_block_devs().to_vector());
+    device.set_recovery_block_devs(recovery_block_devs().to_vector());
+    device.set_extra_block_devs(extra_block_devs().to_vector());
+
+    device.set_tw_supported(tw_supported());
+    device.set_tw_flags(tw_flags());
+    device.set_tw_pixel_format(tw_pixel_format());
+    device.set_tw_force_pixel_format(tw_force_pixel_format());
+    device.set_tw_overscan_percent(tw_overscan_percent());
+    device.set_tw_default_x_offset(tw_default_x_offset());
+    device.set_tw_default_y_offset(tw_default_y_offset());
+    device.set_tw_brightness_path(std::string(tw_brightness_path()));
+    device.set_tw_secondary_brightness_path(
+            std::string(tw_secondary_brightness_path()));
+    device.set_tw_max_brightness(tw_max_brightness());
+    device.set_tw_default_brightness(tw_default_brightness());
+    device.set_tw_battery_path(std::string(tw_battery_path()));
+    device.set_tw_cpu_temp_path(std::string(tw_cpu_temp_path()));
+    device.set_tw_input_blacklist(std::string(tw_input_blacklist()));
+    device.set_tw_input_whitelist(std::string(tw_input_whitelist()));
+    device.set_tw_graphics_backends(tw_graphics_backends().to_vector());
+    device.set_tw_theme(std::string(tw_theme()));
+
+    return device;
+}
+
+/*!
+ * \brief Construct empty device table
+ */
+DeviceTable::DeviceTable()
+    : m_data(nullptr)
+    , m_size(0)
+{
+}
+
+DeviceTable::DeviceTable(std::shared_ptr<const void> storage,
+                         const unsigned char *data, std::size_t size)
+    : m_storage(std::move(storage))
+    , m_data(data)
+    , m_size(size)
+{
+}
+
+/*!
+ * \brief Check that every offset in the table is in bounds
+ *
+ * This is done once when the table is loaded so that the accessors do not need
+ * to perform any bounds checking.
+ */
+oc::result<void> DeviceTable::validate(const unsigned char *data,
+                                       std::size_t size)
+{
+    if (size < MAGIC_SIZE
+            || std::memcmp(data, MAGIC, MAGIC_SIZE) != 0) {
+        return DeviceTableError::InvalidMagic;
+    } else if (size < HEADER_SIZE) {
+        return DeviceTableError::Truncated;
+    } else if (read_word(data, HEADER_VERSION) != VERSION) {
+        return DeviceTableError::UnsupportedVersion;
+    }
+
+    auto in_bounds = [](uint64_t offset, uint64_t length, uint64_t limit) {
+        return offset <= limit && length <= limit - offset;
+    };
+
+    uint32_t device_count = read_word(data, HEADER_DEVICE_COUNT);
+    uint32_t devices_offset = read_word(data, HEADER_DEVICES_OFFSET);
+    uint32_t index_count = read_word(data, HEADER_INDEX_COUNT);
+    uint32_t index_offset = read_word(data, HEADER_INDEX_OFFSET);
+    uint32_t list_count = read_word(data, HEADER_LIST_COUNT);
+    uint32_t lists_offset = read_word(data, HEADER_LISTS_OFFSET);
+    uint32_t strings_size = read_word(data, HEADER_STRINGS_SIZE);
+    uint32_t strings_offset = read_word(data, HEADER_STRINGS_OFFSET);
+
+    if (!in_bounds(devices_offset, uint64_t(device_count) * RECORD_SIZE, size)
+            || !in_bounds(index_offset,
+                          uint64_t(index_count) * INDEX_ENTRY_SIZE, size)
+            || !in_bounds(lists_offset,
+                          uint64_t(list_count) * LIST_ENTRY_SIZE, size)
+            || !in_bounds(strings_offset, strings_size, size)) {
+        return DeviceTableError::Truncated;
+    }
+
+    auto check_string = [&](const unsigned char *p) {
+        return in_bounds(read_word(p, 0), read_word(p, 1), strings_size);
+    };
+
+    for (uint32_t i = 0; i < list_count; ++i) {
+        if (!check_string(data + lists_offset + i * LIST_ENTRY_SIZE)) {
+            return DeviceTableError::OutOfBounds;
+        }
+    }
+
+    for (uint32_t i = 0; i < device_count; ++i) {
+        auto record = data + devices_offset + i * RECORD_SIZE;
+
+        for (auto field : STRING_FIELDS) {
+            if (!check_string(record + field * 4)) {
+                return DeviceTableError::OutOfBounds;
+            }
+        }
+        for (auto field : LIST_FIELDS) {
+            if (!in_bounds(read_word(record, field),
+                           read_word(record, field + 1), list_count)) {
+                return DeviceTableError::OutOfBounds;
+            }
+        }
+    }
+
+    std::string_view prev_codename;
+    uint32_t prev_device = 0;
+
+    for (uint32_t i = 0; i < index_count; ++i) {
+        auto entry = data + index_offset + i * INDEX_ENTRY_SIZE;
+        if (!check_string(entry)) {
+            return DeviceTableError::OutOfBounds;
+        }
+
+        uint32_t device = read_word(entry, 2);
+        if (device >= device_count) {
+            return DeviceTableError::OutOfBounds;
+        }
+
+        auto codename = pool_string(data, read_word(entry, 0),
+                                    read_word(entry, 1));
+        if (i > 0 && (codename < prev_codename
+                || (codename == prev_codename && device < prev_device))) {
+            return DeviceTableError::UnsortedIndex;
+        }
+
+        prev_codename = codename;
+        prev_device = device;
+    }
+
+    return oc::success();
+}
+
+/*!
+ * \brief Load device table from a file
+ *
+ * On platforms that support it, the file is memory mapped instead of being
+ * read into memory.
+ *
+ * \param path Path to binary device table
+ *
+ * \return Device table or an error if the file could not be read or is not a
+ *         valid device table. A file that is not a binary device table (eg. a
+ *         JSON device list) will fail with DeviceTableError::InvalidMagic.
+ */
+oc::result<DeviceTable> DeviceTable::open(const std::string &path)
+{
+#ifdef _WIN32
+    StandardFile file;
+    OUTCOME_TRYV(file.open(path, FileOpenMode::ReadOnly));
+
+    OUTCOME_TRY(size, file.seek(0, SEEK_END));
+    OUTCOME_TRYV(file.seek(0, SEEK_SET));
+
+    std::string data;
+    data.resize(static_cast<std::size_t>(size));
+    OUTCOME_TRYV(file_read_exact(file, data.data(), data.size()));
+
+    return from_data(std::move(data));
+#else
+    auto file = std::make_shared<MmapFile>();
+    OUTCOME_TRYV(file->open(path));
+
+    OUTCOME_TRYV(validate(file->data(), file->size()));
+
+    auto data = file->data();
+    auto size = file->size();
+
+    return DeviceTable(std::move(file), data, size);
+#endif
+}
+
+/*!
+ * \brief Load device table from an in-memory buffer
+ *
+ * \param data Contents of binary device table
+ *
+ * \return Device table or an error if \p data is not a valid device table
+ */
+oc::result<DeviceTable> DeviceTable::from_data(std::string data)
+{
+    auto buf = std::make_shared<std::string>(std::move(data));
+    auto ptr = reinterpret_cast<const unsigned char *>(buf->data());
+    auto size = buf->size();
+
+    OUTCOME_TRYV(validate(ptr, size));
+
+    return DeviceTable(std::move(buf), ptr, size);
+}
+
+/*!
+ * \brief Number of devices in the table
+ */
+std::size_t DeviceTable::size() const
+{
+    return m_data ? read_word(m_data, HEADER_DEVICE_COUNT) : 0;
+}
+
+/*!
+ * \brief Get view of the device at \p index
+ *
+ * The view remains valid for as long as any copy of this DeviceTable exists.
+ *
+ * \pre \p index is less than size()
+ */
+DeviceView DeviceTable::operator[](std::size_t index) const
+{
+    return {m_data, m_data + read_word(m_data, HEADER_DEVICES_OFFSET)
+            + index * RECORD_SIZE};
+}
+
+/*!
+ * \brief Find device by codename
+ *
+ * \param codename Device codename
+ *
+ * \return View of the first device (in the original definition order) that
+ *         lists \p codename or std::nullopt if there is no such device
+ */
+std::optional<DeviceView> DeviceTable::find(std::string_view codename) const
+{
+    if (!m_data) {
+        return std::nullopt;
+    }
+
+    auto index = m_data + read_word(m_data, HEADER_INDEX_OFFSET);
+    std::size_t lo = 0;
+    std::size_t hi = read_word(m_data, HEADER_INDEX_COUNT);
+
+    // Lower bound so that the device that was defined first wins
+    while (lo < hi) {
+        std::size_t mid = lo + (hi - lo) / 2;
+        auto entry = index + mid * INDEX_ENTRY_SIZE;
+
+        if (pool_string(m_data, read_word(entry, 0), read_word(entry, 1))
+                < codename) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    if (lo == read_word(m_data, HEADER_INDEX_COUNT)) {
+        return std::nullopt;
+    }
+
+    auto entry = index + lo * INDEX_ENTRY_SIZE;
+    if (pool_string(m_data, read_word(entry, 0), read_word(entry, 1))
+            != codename) {
+        return std::nullopt;
+    }
+
+    return (*this)[read_word(entry, 2)];
+}
+
+/*!
+ * \brief Serialize list of devices to a binary device table
+ *
+ * Every device must pass Device::validate(). Identical strings are only stored
+ * once.
+ *
+ * \param devices List of devices
+ *
+ * \return Binary device table or an error if a device is invalid or the table
+ *         would exceed 4 GiB
+ */
+oc::result<std::string>
+device_list_to_binary(const std::vector<Device> &devices)
+{
+    struct IndexEntry
+    {
+        std::string_view codename;
+        uint32_t string_offset;
+        uint32_t device;
+    };
+
+    std::string pool;
+    std::unordered_map<std::string, uint32_t> pool_offsets;
+    std::vector<std::pair<uint32_t, uint32_t>> list_entries;
+    std::vector<IndexEntry> index;
+    std::string records;
+    bool too_large = false;
+
+    auto add_string = [&](const std::string &str) -> std::pair<uint32_t, uint32_t> {
+        auto [it, inserted] = pool_offsets.try_emplace(
+                str, static_cast<uint32_t>(pool.size()));
+        if (inserted) {
+            if (pool.size() + str.size() > UINT32_MAX) {
+                too_large = true;
+            }
+            pool += str;
+        }
+        return {it->second, static_cast<uint32_t>(str.size())};
+    };
+
+    auto set_string = [&](std::size_t record, std::size_t field,
+                          const std::string &str) {
+        auto [offset, size] = add_string(str);
+        write_word(records, record + field * 4, offset);
+        write_word(records, record + (field + 1) * 4, size);
+    };
+
+    auto set_list = [&](std::size_t record, std::size_t field,
+                        const std::vector<std::string> &list) {
+        write_word(records, record + field * 4,
+                   static_cast<uint32_t>(list_entries.size()));
+        write_word(records, record + (field + 1) * 4,
+                   static_cast<uint32_t>(list.size()));
+        for (auto const &str : list) {
+            list_entries.push_back(add_string(str));
+        }
+    };
+
+    auto set_word = [&](std::size_t record, std::size_t field,
+                        uint32_t value) {
+        write_word(records, record + field * 4, value);
+    };
+
+    if (devices.size() > UINT32_MAX / RECORD_SIZE) {
+        return DeviceTableError::TooLarge;
+    }
+
+    records.resize(devices.size() * RECORD_SIZE);
+
+    for (std::size_t i = 0; i < devices.size(); ++i) {
+        auto const &d = devices[i];
+        std::size_t r = i * RECORD_SIZE;
+
+        if (d.validate()) {
+            return DeviceTableError::InvalidDevice;
+        }
+
+        auto codenames = d.codenames();
+
+        set_string(r, RECORD_ID, d.id());
+        set_list(r, RECORD_CODENAMES, codenames);
+        set_string(r, RECORD_NAME, d.name());
+        set_string(r, RECORD_ARCHITECTURE, d.architecture());
+        set_word(r, RECORD_FLAGS, static_cast<uint32_t>(d.flags()));
+        set_list(r, RECORD_BASE_DIRS, d.block_dev_base_dirs());
+        set_list(r, RECORD_SYSTEM_DEVS, d.system_block_devs());
+        set_list(r, RECORD_CACHE_DEVS, d.cache_block_devs());
+        set_list(r, RECORD_DATA_DEVS, d.data_block_devs());
+        set_list(r, RECORD_BOOT_DEVS, d.boot_block_devs());
+        set_list(r, RECORD_RECOVERY_DEVS, d.recovery_block_devs());
+        set_list(r, RECORD_EXTRA_DEVS, d.extra_block_devs());
+        set_word(r, RECORD_TW_SUPPORTED, d.tw_supported());
+        set_word(r, RECORD_TW_FLAGS, static_cast<uint32_t>(d.tw_flags()));
+        set_word(r, RECORD_TW_PIXEL_FORMAT,
+                 static_cast<uint32_t>(d.tw_pixel_format()));
+        set_word(r, RECORD_TW_FORCE_PIXEL_FORMAT,
+                 static_cast<uint32_t>(d.tw_force_pixel_format()));
+        set_word(r, RECORD_TW_OVERSCAN_PERCENT,
+                 static_cast<uint32_t>(d.tw_overscan_percent()));
+        set_word(r, RECORD_TW_DEFAULT_X_OFFSET,
+                 static_cast<uint32_t>(d.tw_default_x_offset()));
+        set_word(r, RECORD_TW_DEFAULT_Y_OFFSET,
+                 static_cast<uint32_t>(d.tw_default_y_offset()));
+        set_string(r, RECORD_TW_BRIGHTNESS_PATH, d.tw_brightness_path());
+        set_string(r, RECORD_TW_SECONDARY_BRIGHTNESS,
+                   d.tw_secondary_brightness_path());
+        set_word(r, RECORD_TW_MAX_BRIGHTNESS,
+                 static_cast<uint32_t>(d.tw_max_brightness()));
+        set_word(r, RECORD_TW_DEFAULT_BRIGHTNESS,
+                 static_cast<uint32_t>(d.tw_default_brightness()));
+        set_string(r, RECORD_TW_BATTERY_PATH, d.tw_battery_path());
+        set_string(r, RECORD_TW_CPU_TEMP_PATH, d.tw_cpu_temp_path());
+        set_string(r, RECORD_TW_INPUT_BLACKLIST, d.tw_input_blacklist());
+        set_string(r, RECORD_TW_INPUT_WHITELIST, d.tw_input_whitelist());
+        set_list(r, RECORD_TW_GRAPHICS_BACKENDS, d.tw_graphics_backends());
+        set_string(r, RECORD_TW_THEME, d.tw_theme());
+
+        for (auto const &codename : codenames) {
+            auto it = pool_offsets.find(codename);
+            index.push_back({it->first, it->second,
+                             static_cast<uint32_t>(i)});
+        }
+    }
+
+    if (too_large) {
+        return DeviceTableError::TooLarge;
+    }
+
+    std::stable_sort(index.begin(), index.end(),
+                     [](const IndexEntry &a, const IndexEntry &b) {
+        return a.codename < b.codename;
+    });
+
+    uint64_t devices_offset = HEADER_SIZE;
+    uint64_t index_offset = devices_offset + records.size();
+    uint64_t lists_offset = index_offset + index.size() * INDEX_ENTRY_SIZE;
+    uint64_t strings_offset = lists_offset
+            + list_entries.size() * LIST_ENTRY_SIZE;
+    uint64_t total_size = strings_offset + pool.size();
+
+    if (total_size > UINT32_MAX) {
+        return DeviceTableError::TooLarge;
+    }
+
+    std::string buf;
+    buf.resize(static_cast<std::size_t>(strings_offset));
+
+    std::memcpy(buf.data(), MAGIC, MAGIC_SIZE);
+    write_word(buf, HEADER_VERSION * 4, VERSION);
+    write_word(buf, HEADER_DEVICE_COUNT * 4,
+               static_cast<uint32_t>(devices.size()));
+    write_word(buf, HEADER_DEVICES_OFFSET * 4,
+               static_cast<uint32_t>(devices_offset));
+    write_word(buf, HEADER_INDEX_COUNT * 4,
+               static_cast<uint32_t>(index.size()));
+    write_word(buf, HEADER_INDEX_OFFSET * 4,
+               static_cast<uint32_t>(index_offset));
+    write_word(buf, HEADER_LIST_COUNT * 4,
+               static_cast<uint32_t>(list_entries.size()));
+    write_word(buf, HEADER_LISTS_OFFSET * 4,
+               static_cast<uint32_t>(lists_offset));
+    write_word(buf, HEADER_STRINGS_SIZE * 4,
+               static_cast<uint32_t>(pool.size()));
+    write_word(buf, HEADER_STRINGS_OFFSET * 4,
+               static_cast<uint32_t>(strings_offset));
+
+    std::copy(records.begin(), records.end(),
+              buf.begin() + static_cast<ptrdiff_t>(devices_offset));
+
+    for (std::size_t i = 0; i < index.size(); ++i) {
+        auto offset = index_offset + i * INDEX_ENTRY_SIZE;
+        write_word(buf, offset, index[i].string_offset);
+        write_word(buf, offset + 4,
+                   static_cast<uint32_t>(index[i].codename.size()));
+        write_word(buf, offset + 8, index[i].device);
+    }
+
+    for (std::size_t i = 0; i < list_entries.size(); ++i) {
+        auto offset = lists_offset + i * LIST_ENTRY_SIZE;
+        write_word(buf, offset, list_entries[i].first);
+        write_word(buf, offset + 4, list_entries[i].second);
+    }
+
+    buf += pool;
+
+    return std::move(buf);
+}
+
+}
@@ -25,6 +25,7 @@
 
 #include "mbcommon/capi/util.h"
 #include "mbdevice/device.h"
+#include "mbdevice/index.h"
 
 #define GETTER(TYPE, NAME) \
     TYPE mb_device_ ## NAME (const CDevice *device)
@@ -419,4 +420,49 @@ bool mb_device_equals(const CDevice *a, const CDevice *b)
     return *device_a == *device_b;
 }
 
+/*!
+ * \brief Build codename index over a list of devices
+ *
+ * \param devices NULL-terminated array of devices. Positions returned by
+ *                mb_device_index_find() are indexes into this array.
+ *
+ * \return New index. It must be freed with mb_device_index_free().
+ */
+CDeviceIndex * mb_device_index_new(const CDevice * const *devices)
+{
+    auto *index = new DeviceIndex();
+
+    if (devices) {
+        for (auto it = devices; *it; ++it) {
+            index->add(*reinterpret_cast<const Device *>(*it));
+        }
+    }
+
+    return reinterpret_cast<CDeviceIndex *>(index);
+}
+
+void mb_device_index_free(CDeviceIndex *index)
+{
+    delete reinterpret_cast<DeviceIndex *>(index);
+}
+
+/*!
+ * \brief Find device by codename
+ *
+ * \return Position of the first device in the array passed to
+ *         mb_device_index_new() that lists \p codename or -1 if no device
+ *         matches
+ */
+int64_t mb_device_index_find(const CDeviceIndex *index, const char *codename)
+{
+    assert(index != nullptr);
+    assert(codename != nullptr);
+    auto const *i = reinterpret_cast<const DeviceIndex *>(index);
+
+    if (auto position = i->find(codename)) {
+        return static_cast<int64_t>(*position);
+    }
+    return -1;
+}
+
 MB_END_C_DECLS
@@ -0,0 +1,106 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbdevice/index.h"
+
+/*!
+ * \file mbdevice/index.h
+ * \brief Codename lookup index over a list of devices
+ */
+
+namespace mb::device
+{
+
+/*!
+ * \class DeviceIndex
+ *
+ * \brief Hash index from device codenames to positions in a device list.
+ *
+ * The index only stores positions, so it can be built over any sequence of
+ * devices (eg. a `std::vector<Device>` or an array of C API handles) without
+ * copying them. If multiple devices share a codename, the device that was added
+ * first wins, which matches a linear search through the list.
+ */
+
+/*!
+ * \brief Construct empty index
+ */
+DeviceIndex::DeviceIndex()
+    : m_size(0)
+{
+}
+
+/*!
+ * \brief Construct index over a list of devices
+ *
+ * \param devices List of devices. Positions returned by find() are indexes into
+ *                this list.
+ */
+DeviceIndex::DeviceIndex(const std::vector<Device> &devices)
+    : DeviceIndex()
+{
+    for (auto const &device : devices) {
+        add(device);
+    }
+}
+
+/*!
+ * \brief Add device to the index
+ *
+ * \param device Device to add
+ *
+ * \return Position assigned to the device
+ */
+std::size_t DeviceIndex::add(const Device &device)
+{
+    std::size_t position = m_size++;
+
+    for (auto &codename : device.codenames()) {
+        m_codenames.try_emplace(std::move(codename), position);
+    }
+
+    return position;
+}
+
+/*!
+ * \brief Number of devices that have been added to the index
+ */
+std::size_t DeviceIndex::size() const
+{
+    return m_size;
+}
+
+/*!
+ * \brief Find device by codename
+ *
+ * \param codename Device codename
+ *
+ * \return Position of the first device that lists \p codename or std::nullopt
+ *         if there is no such device
+ */
+std::optional<std::size_t> DeviceIndex::find(std::string_view codename) const
+{
+    if (auto it = m_codenames.find(std::string(codename));
+            it != m_codenames.end()) {
+        return it->second;
+    }
+    return std::nullopt;
+}
+
+}
@@ -0,0 +1,143 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include "mbdevice/binary.h"
+#include "mbdevice/device.h"
+
+using namespace mb::device;
+
+static Device make_device(std::string id, std::vector<std::string> codenames)
+{
+    Device device;
+    device.set_id(std::move(id));
+    device.set_codenames(std::move(codenames));
+    device.set_name("Test Device");
+    device.set_architecture(ARCH_ARM64_V8A);
+    device.set_flags(DeviceFlag::HasCombinedBootAndRecovery);
+    device.set_block_dev_base_dirs({"/dev/block/bootdevice/by-name"});
+    device.set_system_block_devs({"/dev/block/bootdevice/by-name/system"});
+    device.set_cache_block_devs({"/dev/block/bootdevice/by-name/cache"});
+    device.set_data_block_devs({"/dev/block/bootdevice/by-name/userdata"});
+    device.set_boot_block_devs({"/dev/block/bootdevice/by-name/boot"});
+    device.set_recovery_block_devs({"/dev/block/bootdevice/by-name/recovery"});
+    device.set_extra_block_devs({"/dev/block/bootdevice/by-name/modem"});
+    device.set_tw_supported(true);
+    device.set_tw_flags(TwFlag::TouchscreenFlipX | TwFlag::RoundScreen);
+    device.set_tw_pixel_format(TwPixelFormat::Rgba8888);
+    device.set_tw_force_pixel_format(TwForcePixelFormat::Rgb565);
+    device.set_tw_overscan_percent(10);
+    device.set_tw_default_x_offset(-20);
+    device.set_tw_default_y_offset(30);
+    device.set_tw_brightness_path("/sys/class/backlight/panel/brightness");
+    device.set_tw_max_brightness(255);
+    device.set_tw_default_brightness(-1);
+    device.set_tw_battery_path("/sys/class/power_supply/battery");
+    device.set_tw_graphics_backends({"fbdev", "adf"});
+    device.set_tw_theme("portrait_hdpi");
+    return device;
+}
+
+TEST(DeviceTableTest, RoundTrip)
+{
+    std::vector<Device> devices{
+        make_device("zeta", {"zeta", "zetalte"}),
+        make_device("alpha", {"alpha"}),
+    };
+
+    auto data = device_list_to_binary(devices);
+    ASSERT_TRUE(data);
+
+    auto table = DeviceTable::from_data(std::move(data.value()));
+    ASSERT_TRUE(table);
+    ASSERT_EQ(table.value().size(), 2u);
+
+    for (std::size_t i = 0; i < devices.size(); ++i) {
+        auto view = table.value()[i];
+        ASSERT_EQ(view.index(), i);
+        ASSERT_EQ(view.id(), devices[i].id());
+        ASSERT_EQ(view.codenames().to_vector(), devices[i].codenames());
+        ASSERT_EQ(view.tw_default_x_offset(), -20);
+        ASSERT_EQ(view.to_device(), devices[i]);
+    }
+}
+
+TEST(DeviceTableTest, FindByCodename)
+{
+    std::vector<Device> devices{
+        make_device("c", {"shared", "c1"}),
+        make_device("a", {"a1", "a2"}),
+        make_device("b", {"shared", "b1"}),
+    };
+
+    auto data = device_list_to_binary(devices);
+    ASSERT_TRUE(data);
+
+    auto table = DeviceTable::from_data(std::move(data.value()));
+    ASSERT_TRUE(table);
+
+    auto a2 = table.value().find("a2");
+    ASSERT_TRUE(a2);
+    ASSERT_EQ(a2->id(), "a");
+
+    auto b1 = table.value().find("b1");
+    ASSERT_TRUE(b1);
+    ASSERT_EQ(b1->id(), "b");
+
+    // The device that was defined first wins
+    auto shared = table.value().find("shared");
+    ASSERT_TRUE(shared);
+    ASSERT_EQ(shared->id(), "c");
+
+    ASSERT_FALSE(table.value().find("missing"));
+    ASSERT_FALSE(table.value().find(""));
+    ASSERT_FALSE(table.value().find("zzz"));
+}
+
+TEST(DeviceTableTest, RejectInvalidDevice)
+{
+    std::vector<Device> devices{Device()};
+
+    auto data = device_list_to_binary(devices);
+    ASSERT_FALSE(data);
+    ASSERT_EQ(data.error(), DeviceTableError::InvalidDevice);
+}
+
+TEST(DeviceTableTest, RejectInvalidData)
+{
+    auto table = DeviceTable::from_data("[{\"id\": \"test\"}]");
+    ASSERT_FALSE(table);
+    ASSERT_EQ(table.error(), DeviceTableError::InvalidMagic);
+
+    auto data = device_list_to_binary({make_device("test", {"test"})});
+    ASSERT_TRUE(data);
+
+    auto truncated = data.value();
+    truncated.resize(truncated.size() - 1);
+    table = DeviceTable::from_data(truncated);
+    ASSERT_FALSE(table);
+    ASSERT_EQ(table.error(), DeviceTableError::Truncated);
+
+    auto bad_version = data.value();
+    bad_version[8] = 2;
+    table = DeviceTable::from_data(bad_version);
+    ASSERT_FALSE(table);
+    ASSERT_EQ(table.error(), DeviceTableError::UnsupportedVersion);
+}
@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include "mbdevice/index.h"
+
+using namespace mb::device;
+
+static Device make_device(std::string id, std::vector<std::string> codenames)
+{
+    Device device;
+    device.set_id(std::move(id));
+    device.set_codenames(std::move(codenames));
+    return device;
+}
+
+TEST(DeviceIndexTest, EmptyIndex)
+{
+    DeviceIndex index;
+
+    ASSERT_EQ(index.size(), 0u);
+    ASSERT_FALSE(index.find("hammerhead"));
+}
+
+TEST(DeviceIndexTest, FindByAnyCodename)
+{
+    std::vector<Device> devices{
+        make_device("hammerhead", {"hammerhead"}),
+        make_device("jflte", {"jflte", "jfltexx", "jfltetmo"}),
+        make_device("klte", {"klte", "kltexx"}),
+    };
+
+    DeviceIndex index(devices);
+    ASSERT_EQ(index.size(), 3u);
+
+    ASSERT_EQ(index.find("hammerhead"), 0u);
+    ASSERT_EQ(index.find("jfltetmo"), 1u);
+    ASSERT_EQ(index.find("jflte"), 1u);
+    ASSERT_EQ(index.find("kltexx"), 2u);
+    ASSERT_FALSE(index.find("kltespr"));
+    ASSERT_FALSE(index.find(""));
+}
+
+TEST(DeviceIndexTest, FirstDeviceWinsOnDuplicateCodename)
+{
+    DeviceIndex index;
+
+    ASSERT_EQ(index.add(make_device("a", {"shared", "a"})), 0u);
+    ASSERT_EQ(index.add(make_device("b", {"b", "shared"})), 1u);
+
+    ASSERT_EQ(index.find("shared"), 0u);
+    ASSERT_EQ(index.find("b"), 1u);
+}
@@ -0,0 +1,93 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "mblog/base_logger.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include <cstddef>
+#include <cstdint>
+
+namespace mb::log
+{
+
+// Logger that hands records to a background thread, which formats them and
+// passes them to the wrapped logger. Records are queued in a bounded lock-free
+// ring buffer. If the buffer is full, non-error records are dropped and
+// counted. Error records and destruction of the logger flush the queue
+// synchronously. Records still queued when the process exits via _exit() or a
+// crash are lost.
+class MB_EXPORT AsyncLogger : public BaseLogger
+{
+public:
+    AsyncLogger(std::shared_ptr<BaseLogger> logger, std::size_t capacity = 1024);
+    virtual ~AsyncLogger();
+
+    virtual void log(const LogRecord &rec) override;
+
+    virtual bool formatted() override;
+
+    virtual bool thread_safe() override;
+
+    void flush();
+
+    uint64_t dropped() const;
+
+private:
+    struct Slot
+    {
+        std::atomic<std::size_t> seq;
+        LogRecord rec;
+    };
+
+    std::shared_ptr<BaseLogger> _logger;
+    bool _logger_formatted;
+
+    std::unique_ptr<Slot[]> _slots;
+    std::size_t _mask;
+    std::atomic<std::size_t> _head;
+    std::size_t _tail;
+
+    std::atomic<uint64_t> _pushed;
+    std::atomic<uint64_t> _processed;
+    std::atomic<uint64_t> _dropped;
+    uint64_t _reported_dropped;
+
+    std::mutex _mutex;
+    std::condition_variable _wake_cv;
+    std::condition_variable _flush_cv;
+    std::atomic<bool> _sleeping;
+    bool _stop;
+
+    std::thread _thread;
+
+    bool push(const LogRecord &rec);
+    bool pop(LogRecord &rec);
+    void wake();
+    void run();
+    void write(LogRecord &rec);
+};
+
+}
@@ -36,6 +36,10 @@ public:
     virtual void log(const LogRecord &rec) = 0;
 
     virtual bool formatted() = 0;
+
+    // Whether log() may be called concurrently from multiple threads. If
+    // false, calls are serialized by mb::log::log().
+    virtual bool thread_safe();
 };
 
 }
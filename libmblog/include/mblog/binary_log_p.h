@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// On-disk layout of binary log files written by BinaryLogger. All fields are
+// in the byte order of the device that wrote the file.
+//
+// The file consists of a header, followed by a ring buffer of records. Records
+// are 8-byte aligned. If a record does not fit at the end of the ring buffer,
+// a record header with a size of 0 is written as a wrap marker (unless the
+// end was reached exactly) and the record is written at the beginning. The
+// oldest records are evicted to make room for new records.
+
+namespace mb::log::binary_log
+{
+
+constexpr char MAGIC[8] = {'M', 'B', 'L', 'O', 'G', 'B', 'I', 'N'};
+constexpr uint32_t VERSION = 1;
+
+constexpr std::size_t MAX_TAGS = 256;
+constexpr std::size_t MAX_TAG_SIZE = 64;
+constexpr uint16_t INLINE_TAG = UINT16_MAX;
+
+constexpr std::size_t HEADER_SIZE = 20480;
+constexpr std::size_t RECORD_ALIGNMENT = 8;
+
+struct FileHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    uint64_t data_size;
+    // Offset of the next record in the data region
+    uint64_t head;
+    // Offset of the oldest record in the data region
+    uint64_t tail;
+    // Sequence number of the oldest record
+    uint64_t first_seq;
+    // Sequence number of the next record. The ring is empty if this is equal
+    // to first_seq.
+    uint64_t next_seq;
+    // PID of the process currently writing to the file or 0
+    uint32_t lock;
+    uint32_t tag_count;
+    // NULL-terminated tags referenced by RecordHeader::tag_id
+    char tags[MAX_TAGS][MAX_TAG_SIZE];
+};
+
+static_assert(sizeof(FileHeader) <= HEADER_SIZE);
+
+struct RecordHeader
+{
+    // Total size of record, including padding, or 0 for a wrap marker
+    uint32_t size;
+    // Index into FileHeader::tags or INLINE_TAG if the tag precedes the
+    // message
+    uint16_t tag_id;
+    uint8_t level;
+    uint8_t reserved;
+    uint64_t seq;
+    // Nanoseconds since the Unix epoch
+    int64_t time;
+    uint64_t pid;
+    uint64_t tid;
+    uint32_t tag_size;
+    uint32_t msg_size;
+};
+
+static_assert(sizeof(RecordHeader) % RECORD_ALIGNMENT == 0);
+
+}
@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "mblog/base_logger.h"
+
+#include <string>
+#include <unordered_map>
+
+#include <cstdint>
+
+namespace mb::log
+{
+
+namespace binary_log
+{
+struct FileHeader;
+}
+
+// Logger that writes compact binary records to a memory-mapped ring buffer
+// file. The file has a fixed size and the oldest records are overwritten when
+// it is full. Since the records are written directly to the shared mapping,
+// nothing is lost if the process crashes. Multiple processes (eg. after a
+// fork) may write to the same file. Use decode_binary_log() to read the file.
+class MB_EXPORT BinaryLogger : public BaseLogger
+{
+public:
+    BinaryLogger(const std::string &path, uint64_t size);
+    virtual ~BinaryLogger();
+
+    virtual void log(const LogRecord &rec) override;
+
+    virtual bool formatted() override;
+
+    bool is_open() const;
+
+private:
+    void *_map;
+    std::size_t _map_size;
+    binary_log::FileHeader *_header;
+    unsigned char *_data;
+    std::unordered_map<std::string, uint16_t> _tags;
+
+    void lock();
+    void unlock();
+    uint16_t tag_id(const std::string &tag);
+    void evict(uint64_t begin, uint64_t end);
+};
+
+}
@@ -20,12 +20,14 @@
 #pragma once
 
 #include <memory>
+#include <string>
 
 #include <cstdarg>
 
 #include "mbcommon/common.h"
 
 #include "mblog/log_level.h"
+#include "mblog/log_record.h"
 
 #define TLOGE(TAG, ...) \
     mb::log::log(mb::log::LogLevel::Error, (TAG), __VA_ARGS__)
@@ -75,5 +77,6 @@ MB_EXPORT void log_v(LogLevel prio, const char *tag, const char *fmt, va_list ap
 
 MB_EXPORT std::string format();
 MB_EXPORT void set_format(std::string fmt);
+MB_EXPORT std::string format_record(const LogRecord &rec);
 
 }
@@ -0,0 +1,258 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mblog/async_logger.h"
+
+#include <chrono>
+
+#include "mblog/logging.h"
+
+namespace mb::log
+{
+
+// Maximum number of records written before checking for flush requests
+static constexpr std::size_t WRITE_BATCH_SIZE = 64;
+
+static std::size_t _round_up_pow2(std::size_t n)
+{
+    std::size_t result = 2;
+    while (result < n) {
+        result <<= 1;
+    }
+    return result;
+}
+
+AsyncLogger::AsyncLogger(std::shared_ptr<BaseLogger> logger,
+                         std::size_t capacity)
+    : _logger(std::move(logger))
+    , _logger_formatted(_logger->formatted())
+    , _head(0)
+    , _tail(0)
+    , _pushed(0)
+    , _processed(0)
+    , _dropped(0)
+    , _reported_dropped(0)
+    , _sleeping(false)
+    , _stop(false)
+{
+    capacity = _round_up_pow2(capacity);
+
+    _slots.reset(new Slot[capacity]);
+    _mask = capacity - 1;
+
+    for (std::size_t i = 0; i < capacity; ++i) {
+        _slots[i].seq.store(i, std::memory_order_relaxed);
+    }
+
+    _thread = std::thread(&AsyncLogger::run, this);
+}
+
+AsyncLogger::~AsyncLogger()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+    }
+    _wake_cv.notify_one();
+
+    _thread.join();
+}
+
+void AsyncLogger::log(const LogRecord &rec)
+{
+    bool is_error = rec.prio == LogLevel::Error;
+    bool on_thread = std::this_thread::get_id() == _thread.get_id();
+
+    while (!push(rec)) {
+        // Never drop errors unless this would deadlock
+        if (!is_error || on_thread) {
+            _dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+
+        flush();
+    }
+
+    _pushed.fetch_add(1, std::memory_order_release);
+    wake();
+
+    if (is_error) {
+        flush();
+    }
+}
+
+bool AsyncLogger::formatted()
+{
+    // Formatting is done on the background thread
+    return false;
+}
+
+bool AsyncLogger::thread_safe()
+{
+    return true;
+}
+
+// Wait until all records queued before this call have been written
+void AsyncLogger::flush()
+{
+    if (std::this_thread::get_id() == _thread.get_id()) {
+        return;
+    }
+
+    auto target = _pushed.load(std::memory_order_acquire);
+
+    wake();
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    _flush_cv.wait(lock, [&] {
+        return _processed.load(std::memory_order_acquire) >= target;
+    });
+}
+
+uint64_t AsyncLogger::dropped() const
+{
+    return _dropped.load(std::memory_order_relaxed);
+}
+
+// Bounded MPMC queue by Dmitry Vyukov, with a single consumer. Each slot's
+// sequence number tells producers and the consumer whose turn it is.
+bool AsyncLogger::push(const LogRecord &rec)
+{
+    auto pos = _head.load(std::memory_order_relaxed);
+    Slot *slot;
+
+    while (true) {
+        slot = &_slots[pos & _mask];
+        auto seq = slot->seq.load(std::memory_order_acquire);
+        auto diff = static_cast<std::ptrdiff_t>(seq)
+                - static_cast<std::ptrdiff_t>(pos);
+
+        if (diff == 0) {
+            if (_head.compare_exchange_weak(pos, pos + 1,
+                                            std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            // Full
+            return false;
+        } else {
+            pos = _head.load(std::memory_order_relaxed);
+        }
+    }
+
+    slot->rec = rec;
+    slot->seq.store(pos + 1, std::memory_order_release);
+
+    return true;
+}
+
+bool AsyncLogger::pop(LogRecord &rec)
+{
+    auto &slot = _slots[_tail & _mask];
+
+    if (slot.seq.load(std::memory_order_acquire) != _tail + 1) {
+        return false;
+    }
+
+    rec = std::move(slot.rec);
+    slot.seq.store(_tail + _mask + 1, std::memory_order_release);
+    ++_tail;
+
+    return true;
+}
+
+void AsyncLogger::wake()
+{
+    // Pairs with the fence in run() so that either the producer sees that the
+    // consumer is going to sleep or the consumer sees the new record
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    if (_sleeping.load(std::memory_order_relaxed)) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _wake_cv.notify_one();
+    }
+}
+
+void AsyncLogger::run()
+{
+    LogRecord rec;
+
+    while (true) {
+        std::size_t count = 0;
+
+        while (count < WRITE_BATCH_SIZE && pop(rec)) {
+            write(rec);
+            ++count;
+        }
+
+        if (auto dropped = _dropped.load(std::memory_order_relaxed);
+                dropped != _reported_dropped) {
+            LogRecord warning;
+            warning.time = std::chrono::system_clock::now();
+            warning.pid = rec.pid;
+            warning.tid = 0;
+            warning.prio = LogLevel::Warning;
+            warning.tag = "mblog";
+            warning.msg = std::to_string(dropped - _reported_dropped)
+                    + " log records were dropped";
+
+            write(warning);
+
+            _reported_dropped = dropped;
+        }
+
+        if (count > 0) {
+            _processed.fetch_add(count, std::memory_order_release);
+
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+            }
+            _flush_cv.notify_all();
+
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(_mutex);
+
+        if (_stop) {
+            break;
+        }
+
+        _sleeping.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        auto &slot = _slots[_tail & _mask];
+        if (slot.seq.load(std::memory_order_acquire) != _tail + 1) {
+            _wake_cv.wait_for(lock, std::chrono::seconds(1));
+        }
+
+        _sleeping.store(false, std::memory_order_relaxed);
+    }
+}
+
+void AsyncLogger::write(LogRecord &rec)
+{
+    if (_logger_formatted) {
+        rec.fmt_msg = format_record(rec);
+    }
+
+    _logger->log(rec);
+}
+
+}
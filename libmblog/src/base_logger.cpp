@@ -30,4 +30,9 @@ BaseLogger::~BaseLogger()
 {
 }
 
+bool BaseLogger::thread_safe()
+{
+    return false;
+}
+
 }
@@ -0,0 +1,124 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mblog/binary_log.h"
+
+#include <chrono>
+
+#include <cstring>
+
+#include "mblog/binary_log_p.h"
+
+namespace mb::log
+{
+
+using namespace binary_log;
+
+// Decode a binary log file written by BinaryLogger. func is called for each
+// record from oldest to newest. Returns false if the file is corrupt, in which
+// case func may have been called for some of the records.
+bool decode_binary_log(const void *data, std::size_t size,
+                       const std::function<void(const LogRecord &)> &func)
+{
+    FileHeader header;
+
+    if (size < sizeof(header)) {
+        return false;
+    }
+
+    memcpy(&header, data, sizeof(header));
+
+    if (memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0
+            || header.version != VERSION
+            || header.header_size < sizeof(header)
+            || header.header_size > size
+            || header.data_size > size - header.header_size
+            || header.data_size % RECORD_ALIGNMENT != 0
+            || header.tail >= header.data_size
+            || header.tail % RECORD_ALIGNMENT != 0
+            || header.first_seq > header.next_seq
+            || header.tag_count > MAX_TAGS) {
+        return false;
+    }
+
+    auto base = static_cast<const unsigned char *>(data) + header.header_size;
+    auto data_size = header.data_size;
+    auto pos = header.tail;
+    LogRecord rec;
+
+    for (auto seq = header.first_seq; seq != header.next_seq;) {
+        uint32_t record_size;
+        memcpy(&record_size, base + pos, sizeof(record_size));
+
+        if (record_size == 0) {
+            // Wrap marker
+            if (pos == 0) {
+                return false;
+            }
+            pos = 0;
+            continue;
+        } else if (record_size < sizeof(RecordHeader)
+                || record_size > data_size - pos
+                || record_size % RECORD_ALIGNMENT != 0) {
+            return false;
+        }
+
+        RecordHeader rh;
+        memcpy(&rh, base + pos, sizeof(rh));
+
+        if (rh.seq != seq
+                || rh.level > static_cast<uint8_t>(LogLevel::Verbose)
+                || uint64_t(rh.tag_size) + rh.msg_size
+                        > record_size - sizeof(rh)) {
+            return false;
+        }
+
+        auto payload = reinterpret_cast<const char *>(base + pos + sizeof(rh));
+
+        if (rh.tag_id == INLINE_TAG) {
+            rec.tag.assign(payload, rh.tag_size);
+        } else if (rh.tag_id < header.tag_count) {
+            auto &entry = header.tags[rh.tag_id];
+            rec.tag.assign(entry, strnlen(entry, MAX_TAG_SIZE));
+        } else {
+            return false;
+        }
+
+        rec.time = std::chrono::system_clock::time_point(
+                std::chrono::duration_cast<std::chrono::system_clock::duration>(
+                        std::chrono::nanoseconds(rh.time)));
+        rec.pid = rh.pid;
+        rec.tid = rh.tid;
+        rec.prio = static_cast<LogLevel>(rh.level);
+        rec.msg.assign(payload + rh.tag_size, rh.msg_size);
+        rec.fmt_msg.clear();
+
+        func(rec);
+
+        pos += record_size;
+        if (pos == data_size) {
+            pos = 0;
+        }
+        ++seq;
+    }
+
+    return true;
+}
+
+}
@@ -0,0 +1,280 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mblog/binary_logger.h"
+
+#include <algorithm>
+
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "mblog/binary_log_p.h"
+
+namespace mb::log
+{
+
+using namespace binary_log;
+
+// Smallest ring buffer that can hold a reasonable number of records
+static constexpr uint64_t MIN_DATA_SIZE = 4096;
+// Largest record, including the header
+static constexpr uint64_t MAX_RECORD_SIZE = 65536;
+
+static bool _is_dead(uint32_t pid)
+{
+    return kill(static_cast<pid_t>(pid), 0) < 0 && errno == ESRCH;
+}
+
+static bool _is_valid_header(const FileHeader &header, uint64_t data_size)
+{
+    return memcmp(header.magic, MAGIC, sizeof(MAGIC)) == 0
+            && header.version == VERSION
+            && header.header_size == HEADER_SIZE
+            && header.data_size == data_size
+            && header.head < data_size
+            && header.head % RECORD_ALIGNMENT == 0
+            && header.tail < data_size
+            && header.tail % RECORD_ALIGNMENT == 0
+            && header.first_seq <= header.next_seq
+            && header.tag_count <= MAX_TAGS;
+}
+
+BinaryLogger::BinaryLogger(const std::string &path, uint64_t size)
+    : _map(MAP_FAILED)
+    , _map_size(0)
+    , _header(nullptr)
+    , _data(nullptr)
+{
+    if (size < HEADER_SIZE + MIN_DATA_SIZE) {
+        return;
+    }
+
+    uint64_t data_size = (size - HEADER_SIZE) / RECORD_ALIGNMENT
+            * RECORD_ALIGNMENT;
+
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return;
+    }
+
+    struct stat sb;
+
+    _map_size = static_cast<std::size_t>(HEADER_SIZE + data_size);
+
+    if (fstat(fd, &sb) < 0 || (static_cast<uint64_t>(sb.st_size) != _map_size
+            && ftruncate(fd, static_cast<off_t>(_map_size)) < 0)) {
+        close(fd);
+        return;
+    }
+
+    _map = mmap(nullptr, _map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (_map == MAP_FAILED) {
+        return;
+    }
+
+    _header = static_cast<FileHeader *>(_map);
+    _data = static_cast<unsigned char *>(_map) + HEADER_SIZE;
+
+    if (_is_valid_header(*_header, data_size)) {
+        // Continue appending to the existing log
+        if (_header->lock != 0 && (_header->lock == static_cast<uint32_t>(getpid())
+                || _is_dead(_header->lock))) {
+            _header->lock = 0;
+        }
+    } else {
+        memset(_header, 0, sizeof(FileHeader));
+        memcpy(_header->magic, MAGIC, sizeof(MAGIC));
+        _header->version = VERSION;
+        _header->header_size = HEADER_SIZE;
+        _header->data_size = data_size;
+    }
+}
+
+BinaryLogger::~BinaryLogger()
+{
+    if (_map != MAP_FAILED) {
+        munmap(_map, _map_size);
+    }
+}
+
+void BinaryLogger::log(const LogRecord &rec)
+{
+    if (!_header) {
+        return;
+    }
+
+    lock();
+
+    auto data_size = _header->data_size;
+    auto id = tag_id(rec.tag);
+
+    auto max_payload = std::min(data_size / 4, MAX_RECORD_SIZE)
+            - sizeof(RecordHeader);
+    auto tag_size = id == INLINE_TAG
+            ? std::min<uint64_t>(rec.tag.size(), MAX_TAG_SIZE)
+            : 0;
+    auto msg_size = std::min<uint64_t>(rec.msg.size(), max_payload - tag_size);
+    auto total = (sizeof(RecordHeader) + tag_size + msg_size
+            + RECORD_ALIGNMENT - 1) / RECORD_ALIGNMENT * RECORD_ALIGNMENT;
+
+    auto head = _header->head;
+
+    if (head + total > data_size) {
+        evict(head, data_size);
+
+        // Wrap marker
+        uint32_t marker = 0;
+        memcpy(_data + head, &marker, sizeof(marker));
+
+        head = 0;
+    }
+
+    evict(head, head + total);
+
+    if (_header->first_seq == _header->next_seq) {
+        _header->tail = head;
+    }
+
+    RecordHeader rh = {};
+    rh.size = static_cast<uint32_t>(total);
+    rh.tag_id = id;
+    rh.level = static_cast<uint8_t>(rec.prio);
+    rh.seq = _header->next_seq;
+    rh.time = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            rec.time.time_since_epoch()).count();
+    rh.pid = rec.pid;
+    rh.tid = rec.tid;
+    rh.tag_size = static_cast<uint32_t>(tag_size);
+    rh.msg_size = static_cast<uint32_t>(msg_size);
+
+    auto ptr = _data + head;
+    memcpy(ptr, &rh, sizeof(rh));
+    ptr += sizeof(rh);
+    memcpy(ptr, rec.tag.data(), tag_size);
+    ptr += tag_size;
+    memcpy(ptr, rec.msg.data(), msg_size);
+    ptr += msg_size;
+    memset(ptr, 0, total - sizeof(rh) - tag_size - msg_size);
+
+    // Only publish the record once it is complete
+    _header->head = head + total == data_size ? 0 : head + total;
+    ++_header->next_seq;
+
+    unlock();
+}
+
+bool BinaryLogger::formatted()
+{
+    return false;
+}
+
+bool BinaryLogger::is_open() const
+{
+    return _header;
+}
+
+// The lock word holds the PID of the owner so that a lock held by a process
+// that died in the middle of writing a record can be recovered
+void BinaryLogger::lock()
+{
+    auto pid = static_cast<uint32_t>(getpid());
+
+    for (unsigned int i = 1; ; ++i) {
+        uint32_t expected = 0;
+
+        if (__atomic_compare_exchange_n(&_header->lock, &expected, pid, false,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            return;
+        }
+
+        if (i % 1024 == 0 && _is_dead(expected)) {
+            __atomic_compare_exchange_n(&_header->lock, &expected, 0, false,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+        }
+
+        sched_yield();
+    }
+}
+
+void BinaryLogger::unlock()
+{
+    __atomic_store_n(&_header->lock, 0, __ATOMIC_RELEASE);
+}
+
+uint16_t BinaryLogger::tag_id(const std::string &tag)
+{
+    if (auto it = _tags.find(tag); it != _tags.end()) {
+        return it->second;
+    }
+
+    // Pick up tags added by other processes
+    for (auto i = _tags.size(); i < _header->tag_count; ++i) {
+        auto &entry = _header->tags[i];
+        _tags.emplace(std::string(entry, strnlen(entry, MAX_TAG_SIZE)),
+                      static_cast<uint16_t>(i));
+    }
+
+    if (auto it = _tags.find(tag); it != _tags.end()) {
+        return it->second;
+    } else if (_header->tag_count == MAX_TAGS || tag.size() >= MAX_TAG_SIZE) {
+        return INLINE_TAG;
+    }
+
+    auto id = static_cast<uint16_t>(_header->tag_count);
+    auto &entry = _header->tags[id];
+
+    memcpy(entry, tag.c_str(), tag.size() + 1);
+    ++_header->tag_count;
+
+    _tags.emplace(tag, id);
+
+    return id;
+}
+
+// Evict records that start in [begin, end)
+void BinaryLogger::evict(uint64_t begin, uint64_t end)
+{
+    while (_header->first_seq != _header->next_seq
+            && _header->tail >= begin && _header->tail < end) {
+        uint32_t size;
+        memcpy(&size, _data + _header->tail, sizeof(size));
+
+        if (size == 0) {
+            _header->tail = 0;
+            continue;
+        }
+
+        _header->tail += size;
+        if (_header->tail >= _header->data_size) {
+            _header->tail = 0;
+        }
+        ++_header->first_seq;
+    }
+}
+
+}
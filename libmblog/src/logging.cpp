@@ -23,9 +23,10 @@
 #include <mutex>
 #include <optional>
 #include <string>
+#include <string_view>
+#include <vector>
 
 #include <cerrno>
-#include <cinttypes>
 #include <cstdarg>
 #include <cstdlib>
 #include <ctime>
@@ -63,11 +64,11 @@ using Tid = pid_t;
 #endif
 
 
+// Accessed with std::atomic_load()/std::atomic_store() so that thread-safe
+// loggers can be called without taking g_mutex
 static std::shared_ptr<BaseLogger> g_logger;
 static std::mutex g_mutex;
 
-static std::string g_format{"[%t][%P:%T][%l] %N: %m"};
-
 // %l - Level
 // %m - Message
 // %n - Tag
@@ -76,6 +77,48 @@ static std::string g_format{"[%t][%P:%T][%l] %N: %m"};
 // %P - Process ID
 // %T - Thread ID
 
+// Format string compiled into a list of operations by set_format()
+struct FormatOp
+{
+    enum class Type
+    {
+        Literal,
+        Level,
+        Message,
+        Tag,
+        ShortTag,
+        Time,
+        Pid,
+        Tid,
+    };
+
+    Type type;
+    std::string literal;
+};
+
+struct CompiledFormat
+{
+    std::string source;
+    std::vector<FormatOp> ops;
+};
+
+static CompiledFormat _compile_format(std::string fmt);
+
+// Null until set_format() is called. The default format is compiled on first
+// use so that processes that never log don't pay for it at startup.
+static std::shared_ptr<const CompiledFormat> g_format;
+
+static std::shared_ptr<const CompiledFormat> _current_format()
+{
+    if (auto format = std::atomic_load(&g_format)) {
+        return format;
+    }
+
+    static const auto default_format = std::make_shared<const CompiledFormat>(
+            _compile_format("[%t][%P:%T][%l] %N: %m"));
+    return default_format;
+}
+
 
 static Pid _get_pid()
 {
@@ -273,21 +316,82 @@ static bool _local_time_ns(const std::chrono::system_clock::time_point &tp,
     return true;
 }
 
-static std::string _format_iso8601(const std::tm &tm, long nanoseconds,
-                                   long gmtoff)
+// Date and timezone parts of the ISO 8601 timestamp, which only change once per
+// second
+struct TimeCache
+{
+    std::optional<std::time_t> seconds;
+    std::string date;
+    std::string zone;
+    bool valid;
+};
+
+static void _fill_time_cache(TimeCache &cache,
+                             const std::chrono::system_clock::time_point &tp)
 {
+    std::tm tm;
+    long nanos;
+    long gmtoff;
+
+    cache.valid = _local_time_ns(tp, tm, nanos, gmtoff);
+    if (!cache.valid) {
+        tm = _tm_epoch();
+        gmtoff = 0;
+    }
+
     // Sample: 2017-09-17T23:27:00.000000000+00:00
-    return mb::format("%04d-%02d-%02dT%02d:%02d:%02d.%09ld%c%02ld:%02ld",
-                      tm.tm_year + 1900,
-                      tm.tm_mon + 1,
-                      tm.tm_mday,
-                      tm.tm_hour,
-                      tm.tm_min,
-                      tm.tm_sec,
-                      nanoseconds,
-                      gmtoff >= 0 ? '+' : '-',
-                      std::abs(gmtoff) / 3600,
-                      std::abs(gmtoff / 60) % 60);
+    cache.date = mb::format("%04d-%02d-%02dT%02d:%02d:%02d.",
+                            tm.tm_year + 1900,
+                            tm.tm_mon + 1,
+                            tm.tm_mday,
+                            tm.tm_hour,
+                            tm.tm_min,
+                            tm.tm_sec);
+    cache.zone = mb::format("%c%02ld:%02ld",
+                            gmtoff >= 0 ? '+' : '-',
+                            std::abs(gmtoff) / 3600,
+                            std::abs(gmtoff / 60) % 60);
+    cache.seconds = std::chrono::system_clock::to_time_t(tp);
+}
+
+static void _append_number(std::string &buf, uint64_t value,
+                           std::size_t min_digits = 1)
+{
+    char digits[20];
+    std::size_t n = 0;
+
+    do {
+        digits[n++] = static_cast<char>('0' + value % 10);
+        value /= 10;
+    } while (value > 0);
+
+    for (; n < min_digits; --min_digits) {
+        buf += '0';
+    }
+    while (n > 0) {
+        buf += digits[--n];
+    }
+}
+
+static void _append_iso8601(std::string &buf,
+                            const std::chrono::system_clock::time_point &tp)
+{
+    using namespace std::chrono;
+
+    thread_local TimeCache cache;
+
+    if (cache.seconds != system_clock::to_time_t(tp)) {
+        _fill_time_cache(cache, tp);
+    }
+
+    auto nanos = cache.valid
+            ? duration_cast<nanoseconds>(tp - time_point_cast<seconds>(tp))
+                    .count()
+            : 0;
+
+    buf += cache.date;
+    _append_number(buf, static_cast<uint64_t>(nanos), 9);
+    buf += cache.zone;
 }
 
 static char _format_prio(LogLevel prio)
@@ -308,82 +412,120 @@ static char _format_prio(LogLevel prio)
     }
 }
 
-static std::string _format_short_tag(std::string_view tag)
+static void _append_short_tag(std::string &buf, std::string_view tag)
 {
-    // Keep first letter in each component
-    auto pieces = split_sv(tag, '/');
-    if (!pieces.empty()) {
-        for (auto it = pieces.begin(); it != pieces.end() - 1; ++it) {
-            if (!it->empty() && isalnum(it->front())) {
-                *it = it->substr(0, 1);
-            }
+    // Keep first letter in each component, except for the last one
+    while (true) {
+        auto pos = tag.find('/');
+        if (pos == std::string_view::npos) {
+            buf += tag;
+            break;
+        }
+
+        auto component = tag.substr(0, pos);
+        if (!component.empty() && isalnum(component.front())) {
+            buf += component.front();
+        } else {
+            buf += component;
+        }
+        buf += '/';
+
+        tag.remove_prefix(pos + 1);
+    }
+}
+
+static CompiledFormat _compile_format(std::string fmt)
+{
+    CompiledFormat result;
+    std::string literal;
+
+    auto push = [&](FormatOp::Type type) {
+        if (!literal.empty()) {
+            result.ops.push_back({FormatOp::Type::Literal, std::move(literal)});
+            literal.clear();
+        }
+        if (type != FormatOp::Type::Literal) {
+            result.ops.push_back({type, {}});
+        }
+    };
+
+    for (auto it = fmt.begin(); it != fmt.end(); ++it) {
+        if (*it != '%') {
+            literal += *it;
+            continue;
+        } else if (it + 1 == fmt.end()) {
+            literal += '%';
+            break;
+        }
+
+        switch (*++it) {
+        case 'l':
+            push(FormatOp::Type::Level);
+            break;
+        case 'm':
+            push(FormatOp::Type::Message);
+            break;
+        case 'n':
+            push(FormatOp::Type::Tag);
+            break;
+        case 'N':
+            push(FormatOp::Type::ShortTag);
+            break;
+        case 't':
+            push(FormatOp::Type::Time);
+            break;
+        case 'P':
+            push(FormatOp::Type::Pid);
+            break;
+        case 'T':
+            push(FormatOp::Type::Tid);
+            break;
+        default:
+            literal += *it;
+            break;
         }
     }
-    return join(pieces, '/');
+
+    push(FormatOp::Type::Literal);
+
+    result.source = std::move(fmt);
+
+    return result;
 }
 
 static std::string _format_rec(const LogRecord &rec)
 {
-    std::string buf;
-    std::optional<std::string> time_buf;
-
-    for (auto it = g_format.begin(); it != g_format.end(); ++it) {
-        if (*it == '%') {
-            if (it + 1 == g_format.end()) {
-                buf += '%';
-                break;
-            }
-
-            ++it;
-
-            switch (*it) {
-            case 'l':
-                buf += _format_prio(rec.prio);
-                break;
-
-            case 'm':
-                buf += rec.msg;
-                break;
-
-            case 'n':
-                buf += rec.tag;
-                break;
-
-            case 'N':
-                buf += _format_short_tag(rec.tag);
-                break;
-
-            case 't':
-                if (!time_buf) {
-                    std::tm tm;
-                    long nanos;
-                    long gmtoff;
-
-                    if (!_local_time_ns(rec.time, tm, nanos, gmtoff)) {
-                        tm = _tm_epoch();
-                        nanos = 0;
-                        gmtoff = 0;
-                    }
-
-                    time_buf = _format_iso8601(tm, nanos, gmtoff);
-                }
-                buf += *time_buf;
-                break;
-
-            case 'P':
-                buf += mb::format("%" PRIu64, rec.pid);
-                break;
-
-            case 'T':
-                buf += mb::format("%" PRIu64, rec.tid);
-                break;
-
-            default:
-                buf += *it;
-                break;
-            }
-        } else {
-            buf += *it;
+    thread_local std::string buf;
+    auto format = _current_format();
+
+    buf.clear();
+
+    for (auto const &op : format->ops) {
+        switch (op.type) {
+        case FormatOp::Type::Literal:
+            buf += op.literal;
+            break;
+        case FormatOp::Type::Level:
+            buf += _format_prio(rec.prio);
+            break;
+        case FormatOp::Type::Message:
+            buf += rec.msg;
+            break;
+        case FormatOp::Type::Tag:
+            buf += rec.tag;
+            break;
+        case FormatOp::Type::ShortTag:
+            _append_short_tag(buf, rec.tag);
+            break;
+        case FormatOp::Type::Time:
+            _append_iso8601(buf, rec.time);
+            break;
+        case FormatOp::Type::Pid:
+            _append_number(buf, rec.pid);
+            break;
+        case FormatOp::Type::Tid:
+            _append_number(buf, rec.tid);
+            break;
         }
     }
 
@@ -392,12 +534,12 @@ static std::string _format_rec(const LogRecord &rec)
 
 std::shared_ptr<BaseLogger> logger()
 {
-    return g_logger;
+    return std::atomic_load(&g_logger);
 }
 
 void set_logger(std::shared_ptr<BaseLogger> logger)
 {
-    g_logger = std::move(logger);
+    std::atomic_store(&g_logger, std::move(logger));
 }
 
 void log(LogLevel prio, const char *tag, const char *fmt, ...)
@@ -414,7 +556,6 @@ void log_v(LogLevel prio, const char *tag, const char *fmt, va_list ap)
 {
     ErrorRestorer restorer;
     LogRecord rec;
-    std::lock_guard<std::mutex> guard(g_mutex);
 
     rec.time = std::chrono::system_clock::now();
     rec.pid = static_cast<uint64_t>(_get_pid());
@@ -423,25 +564,43 @@ void log_v(LogLevel prio, const char *tag, const char *fmt, va_list ap)
     rec.tag = tag;
     rec.msg = format_v(fmt, ap);
 
-    if (!g_logger) {
-        g_logger = std::make_shared<StdioLogger>(stdout);
+    auto logger = std::atomic_load(&g_logger);
+    if (!logger) {
+        std::lock_guard<std::mutex> guard(g_mutex);
+
+        logger = std::atomic_load(&g_logger);
+        if (!logger) {
+            logger = std::make_shared<StdioLogger>(stdout);
+            std::atomic_store(&g_logger, logger);
+        }
     }
 
-    if (g_logger->formatted()) {
+    if (logger->formatted()) {
         rec.fmt_msg = _format_rec(rec);
     }
 
-    g_logger->log(rec);
+    if (logger->thread_safe()) {
+        logger->log(rec);
+    } else {
+        std::lock_guard<std::mutex> guard(g_mutex);
+        logger->log(rec);
+    }
 }
 
 std::string format()
 {
-    return g_format;
+    return _current_format()->source;
 }
 
 void set_format(std::string fmt)
 {
-    g_format = std::move(fmt);
+    std::atomic_store(&g_format, std::make_shared<const CompiledFormat>(
+            _compile_format(std::move(fmt))));
+}
+
+std::string format_record(const LogRecord &rec)
+{
+    return _format_rec(rec);
 }
 
 }
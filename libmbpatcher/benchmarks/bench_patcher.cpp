@@ -0,0 +1,1001 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+// Whole-file benchmarks for ZipPatcher and OdinPatcher
+//
+// The inputs are synthetic ROM zips and Odin tarballs that are generated from
+// the workload parameters on first use, so results are comparable between
+// commits as long as the parameters (which are included in the JSON output)
+// are the same:
+//
+//   --param=workdir=<dir>          Scratch directory (default:
+//                                  /tmp/patcher_bench)
+//   --param=entries=<n>            Number of files in the many-entries zip
+//   --param=entry_size=<bytes>     Size of each of those files
+//   --param=large_size=<bytes>     Size of the large zip member
+//   --param=script_lines=<n>       Lines in the long updater-script
+//   --param=image_size=<bytes>     Expanded size of the system sparse image
+//                                  (the cache image is a quarter of this)
+//   --param=boot_size=<bytes>      Size of the boot and recovery images
+//
+// The throughput is relative to the size of the input file. Each benchmark
+// also reports the peak RSS of the process while patching (peak_rss_kib) and
+// the average time per iteration spent in each phase of the patcher:
+//
+//   ZipPatcher:  pass1_ms, pass2_ms (includes autopatchers_ms), extras_ms
+//   OdinPatcher: contents_ms, extras_ms
+//
+// The peak RSS is reset through /proc/self/clear_refs before each benchmark.
+// On kernels that do not support that, the peak for the whole process is
+// reported instead. Patching takes seconds per iteration with the default
+// workload, so `--min-time=0` (one iteration each) is usually what you want.
+
+#include "benchmark.h"
+
+#include <algorithm>
+#include <functional>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <archive.h>
+#include <archive_entry.h>
+#include <lz4frame.h>
+
+#include "mbcommon/endian.h"
+#include "mbcommon/finally.h"
+#include "mbcommon/perf.h"
+#include "mbcommon/string.h"
+
+#include "mbdevice/device.h"
+
+#include "mblog/base_logger.h"
+#include "mblog/logging.h"
+
+#include "mbpatcher/fileinfo.h"
+#include "mbpatcher/patcherconfig.h"
+#include "mbpatcher/patcherinterface.h"
+#include "mbpatcher/patchers/odinpatcher.h"
+#include "mbpatcher/patchers/zippatcher.h"
+
+#include "mbsparse/sparse_p.h"
+
+using namespace mb;
+using namespace mb::bench;
+using namespace mb::patcher;
+using namespace mb::sparse::detail;
+
+static constexpr char ARCHITECTURE[] = "armeabi-v7a";
+static constexpr char SYSTEM_BLOCK_DEV[] =
+        "/dev/block/platform/msm_sdcc.1/by-name/system";
+static constexpr char CACHE_BLOCK_DEV[] =
+        "/dev/block/platform/msm_sdcc.1/by-name/cache";
+static constexpr char DATA_BLOCK_DEV[] =
+        "/dev/block/platform/msm_sdcc.1/by-name/userdata";
+static constexpr char BOOT_BLOCK_DEV[] =
+        "/dev/block/platform/msm_sdcc.1/by-name/boot";
+
+static constexpr uint32_t BLOCK_SIZE = 4096;
+static constexpr size_t BUFFER_SIZE = 1024 * 1024;
+
+struct Workload
+{
+    uint64_t entries;
+    uint64_t entry_size;
+    uint64_t large_size;
+    uint64_t script_lines;
+    uint64_t image_size;
+    uint64_t boot_size;
+};
+
+static const Workload & workload()
+{
+    static Workload w{
+        param_u64("entries", 5000),
+        param_u64("entry_size", 16384),
+        param_u64("large_size", 256 * 1024 * 1024),
+        param_u64("script_lines", 20000),
+        param_u64("image_size", 256 * 1024 * 1024),
+        param_u64("boot_size", 16 * 1024 * 1024),
+    };
+    return w;
+}
+
+static const std::string & work_dir()
+{
+    return param("workdir", "/tmp/patcher_bench");
+}
+
+// Only warnings and errors are printed (to stderr), so the per-file messages
+// of the patchers do not end up in the timings or the JSON output
+class QuietLogger : public log::BaseLogger
+{
+public:
+    void log(const log::LogRecord &rec) override
+    {
+        if (rec.prio == log::LogLevel::Error
+                || rec.prio == log::LogLevel::Warning) {
+            fprintf(stderr, "%s: %s\n", rec.tag.c_str(), rec.msg.c_str());
+        }
+    }
+
+    bool formatted() override
+    {
+        return false;
+    }
+};
+
+static bool make_dirs(const std::string &path)
+{
+    size_t pos = 0;
+
+    do {
+        pos = path.find('/', pos + 1);
+        auto dir = path.substr(0, pos);
+
+        if (mkdir(dir.c_str(), 0755) < 0 && errno != EEXIST) {
+            fprintf(stderr, "%s: Failed to create directory: %s\n",
+                    dir.c_str(), strerror(errno));
+            return false;
+        }
+    } while (pos != std::string::npos);
+
+    return true;
+}
+
+static uint32_t xorshift(uint32_t &x)
+{
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return x;
+}
+
+// Fill a buffer with deterministic data. The first half is pseudo-random
+// (xorshift64*) and the second half is repetitive, so the data compresses
+// roughly 2:1, like a typical mix of apps and libraries.
+static void fill_data(unsigned char *buf, size_t size, uint64_t seed)
+{
+    uint64_t x = seed * UINT64_C(0x9e3779b97f4a7c15) + 1;
+    size_t half = size / 2;
+
+    for (size_t i = 0; i < half; ++i) {
+        x ^= x >> 12;
+        x ^= x << 25;
+        x ^= x >> 27;
+        buf[i] = static_cast<unsigned char>((x * UINT64_C(0x2545f4914f6cdd1d)) >> 56);
+    }
+    for (size_t i = half; i < size; ++i) {
+        buf[i] = static_cast<unsigned char>("patcher benchmark data\n"[i % 23]);
+    }
+}
+
+using DataWriter = std::function<bool(const void *, size_t)>;
+
+// File to be added to a generated archive. The contents are streamed to the
+// writer, so large members are never held in memory.
+struct Member
+{
+    std::string name;
+    uint64_t size;
+    std::function<bool(const DataWriter &)> write;
+};
+
+static Member data_member(std::string name, uint64_t size, uint64_t seed)
+{
+    return {std::move(name), size, [size, seed](const DataWriter &writer) {
+        std::vector<unsigned char> buf(static_cast<size_t>(
+                std::min<uint64_t>(size, BUFFER_SIZE)));
+        uint64_t offset = 0;
+
+        for (uint64_t i = 0; offset < size; ++i) {
+            auto n = static_cast<size_t>(
+                    std::min<uint64_t>(buf.size(), size - offset));
+            fill_data(buf.data(), n, seed + i);
+
+            if (!writer(buf.data(), n)) {
+                return false;
+            }
+
+            offset += n;
+        }
+
+        return true;
+    }};
+}
+
+static Member text_member(std::string name, std::string contents)
+{
+    auto size = contents.size();
+
+    return {std::move(name), size,
+            [contents = std::move(contents)](const DataWriter &writer) {
+        return writer(contents.data(), contents.size());
+    }};
+}
+
+static Member file_member(std::string name, const std::string &path)
+{
+    struct stat sb;
+    bool exists = stat(path.c_str(), &sb) == 0;
+    uint64_t size = exists ? static_cast<uint64_t>(sb.st_size) : 0;
+
+    return {std::move(name), size,
+            [path, exists, size](const DataWriter &writer) {
+        FILE *fp = exists ? fopen(path.c_str(), "rbe") : nullptr;
+        if (!fp) {
+            return false;
+        }
+
+        auto close_fp = finally([&] {
+            fclose(fp);
+        });
+
+        std::vector<unsigned char> buf(BUFFER_SIZE);
+
+        for (uint64_t remain = size; remain > 0;) {
+            auto n = fread(buf.data(), 1, static_cast<size_t>(
+                    std::min<uint64_t>(buf.size(), remain)), fp);
+            if (n == 0 || !writer(buf.data(), n)) {
+                return false;
+            }
+
+            remain -= n;
+        }
+
+        return true;
+    }};
+}
+
+static bool write_file(const std::string &path, const Member &member)
+{
+    FILE *fp = fopen(path.c_str(), "wbe");
+    if (!fp) {
+        fprintf(stderr, "%s: Failed to open for writing: %s\n",
+                path.c_str(), strerror(errno));
+        return false;
+    }
+
+    bool ok = member.write([&](const void *buf, size_t size) {
+        return fwrite(buf, 1, size, fp) == size;
+    });
+
+    if (fclose(fp) != 0 || !ok) {
+        fprintf(stderr, "%s: Failed to write file\n", path.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+enum class ArchiveFormat
+{
+    Tar,
+    Zip,
+    ZipStored,
+};
+
+static bool write_archive(const std::string &path, ArchiveFormat format,
+                          const std::vector<Member> &members)
+{
+    archive *a = archive_write_new();
+    if (!a) {
+        return false;
+    }
+
+    auto free_a = finally([&] {
+        archive_write_free(a);
+    });
+
+    archive_entry *entry = archive_entry_new();
+    if (!entry) {
+        return false;
+    }
+
+    auto free_entry = finally([&] {
+        archive_entry_free(entry);
+    });
+
+    int ret = format == ArchiveFormat::Tar
+            ? archive_write_set_format_ustar(a)
+            : archive_write_set_format_zip(a);
+    if (ret == ARCHIVE_OK && format == ArchiveFormat::ZipStored) {
+        ret = archive_write_set_format_option(a, "zip", "compression", "store");
+    }
+
+    if (ret != ARCHIVE_OK
+            || archive_write_open_filename(a, path.c_str()) != ARCHIVE_OK) {
+        fprintf(stderr, "%s: Failed to create archive: %s\n",
+                path.c_str(), archive_error_string(a));
+        return false;
+    }
+
+    auto writer = [&](const void *buf, size_t size) {
+        return archive_write_data(a, buf, size)
+                == static_cast<la_ssize_t>(size);
+    };
+
+    for (auto const &member : members) {
+        archive_entry_clear(entry);
+        archive_entry_set_pathname(entry, member.name.c_str());
+        archive_entry_set_filetype(entry, AE_IFREG);
+        archive_entry_set_perm(entry, 0644);
+        archive_entry_set_size(entry, static_cast<la_int64_t>(member.size));
+
+        if (archive_write_header(a, entry) != ARCHIVE_OK
+                || !member.write(writer)) {
+            fprintf(stderr, "%s: Failed to write %s: %s\n",
+                    path.c_str(), member.name.c_str(),
+                    archive_error_string(a));
+            return false;
+        }
+    }
+
+    return archive_write_close(a) == ARCHIVE_OK;
+}
+
+// Android sparse image with a mix of raw, fill, and don't care chunks, similar
+// to what img2simg produces for an ext4 image
+static bool write_sparse_file(const std::string &path, uint64_t size,
+                              uint32_t seed)
+{
+    struct Chunk
+    {
+        uint16_t type;
+        uint32_t blocks;
+    };
+
+    std::vector<Chunk> chunks;
+    auto total_blocks = static_cast<uint32_t>(size / BLOCK_SIZE);
+    uint32_t x = seed;
+
+    for (uint32_t blocks_left = total_blocks; blocks_left > 0;) {
+        auto roll = xorshift(x) % 100;
+        Chunk chunk;
+
+        if (roll < 60) {
+            chunk = {CHUNK_TYPE_RAW, xorshift(x) % 512 + 1};
+        } else if (roll < 85) {
+            chunk = {CHUNK_TYPE_FILL, xorshift(x) % 32 + 1};
+        } else {
+            chunk = {CHUNK_TYPE_DONT_CARE, xorshift(x) % 2048 + 1};
+        }
+
+        chunk.blocks = std::min(chunk.blocks, blocks_left);
+        blocks_left -= chunk.blocks;
+        chunks.push_back(chunk);
+    }
+
+    FILE *fp = fopen(path.c_str(), "wbe");
+    if (!fp) {
+        fprintf(stderr, "%s: Failed to open for writing: %s\n",
+                path.c_str(), strerror(errno));
+        return false;
+    }
+
+    SparseHeader shdr = {};
+    shdr.magic = mb_htole32(SPARSE_HEADER_MAGIC);
+    shdr.major_version = mb_htole16(
+            static_cast<uint16_t>(SPARSE_HEADER_MAJOR_VER));
+    shdr.file_hdr_sz = mb_htole16(
+            static_cast<uint16_t>(sizeof(SparseHeader)));
+    shdr.chunk_hdr_sz = mb_htole16(
+            static_cast<uint16_t>(sizeof(ChunkHeader)));
+    shdr.blk_sz = mb_htole32(BLOCK_SIZE);
+    shdr.total_blks = mb_htole32(total_blocks);
+    shdr.total_chunks = mb_htole32(static_cast<uint32_t>(chunks.size()));
+
+    bool ok = fwrite(&shdr, sizeof(shdr), 1, fp) == 1;
+    std::vector<unsigned char> buf(BUFFER_SIZE);
+    uint64_t data_seed = seed;
+
+    for (auto it = chunks.begin(); ok && it != chunks.end(); ++it) {
+        uint64_t data_size = it->type == CHUNK_TYPE_RAW
+                ? uint64_t(it->blocks) * BLOCK_SIZE
+                : it->type == CHUNK_TYPE_FILL ? sizeof(uint32_t) : 0;
+
+        ChunkHeader chdr = {};
+        chdr.chunk_type = mb_htole16(it->type);
+        chdr.chunk_sz = mb_htole32(it->blocks);
+        chdr.total_sz = mb_htole32(
+                static_cast<uint32_t>(sizeof(ChunkHeader) + data_size));
+
+        ok = fwrite(&chdr, sizeof(chdr), 1, fp) == 1;
+
+        if (ok && it->type == CHUNK_TYPE_FILL) {
+            // Mostly zeros, like the free space of a filesystem
+            uint32_t fill_val = mb_htole32(xorshift(x) % 4 == 0 ? x : 0);
+            ok = fwrite(&fill_val, sizeof(fill_val), 1, fp) == 1;
+        } else if (it->type == CHUNK_TYPE_RAW) {
+            for (uint64_t remain = data_size; ok && remain > 0;) {
+                auto n = static_cast<size_t>(
+                        std::min<uint64_t>(buf.size(), remain));
+                fill_data(buf.data(), n, data_seed++);
+                ok = fwrite(buf.data(), 1, n, fp) == n;
+                remain -= n;
+            }
+        }
+    }
+
+    if (fclose(fp) != 0 || !ok) {
+        fprintf(stderr, "%s: Failed to write sparse image\n", path.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+// Compress a file into an LZ4 frame, like the .lz4 images in newer Samsung
+// firmware packages
+static bool write_lz4_file(const std::string &path, const std::string &source)
+{
+    FILE *fp_in = fopen(source.c_str(), "rbe");
+    if (!fp_in) {
+        fprintf(stderr, "%s: Failed to open for reading: %s\n",
+                source.c_str(), strerror(errno));
+        return false;
+    }
+
+    auto close_fp_in = finally([&] {
+        fclose(fp_in);
+    });
+
+    FILE *fp_out = fopen(path.c_str(), "wbe");
+    if (!fp_out) {
+        fprintf(stderr, "%s: Failed to open for writing: %s\n",
+                path.c_str(), strerror(errno));
+        return false;
+    }
+
+    LZ4F_cctx *cctx = nullptr;
+
+    auto free_cctx = finally([&] {
+        LZ4F_freeCompressionContext(cctx);
+    });
+
+    LZ4F_preferences_t prefs = {};
+    prefs.frameInfo.blockSizeID = LZ4F_max4MB;
+    prefs.frameInfo.blockMode = LZ4F_blockIndependent;
+
+    std::vector<char> in_buf(BUFFER_SIZE);
+    std::vector<char> out_buf(std::max<size_t>(
+            LZ4F_compressBound(in_buf.size(), &prefs), LZ4F_HEADER_SIZE_MAX));
+
+    auto write = [&](size_t lz4_ret) {
+        return !LZ4F_isError(lz4_ret)
+                && fwrite(out_buf.data(), 1, lz4_ret, fp_out) == lz4_ret;
+    };
+
+    bool ok = !LZ4F_isError(LZ4F_createCompressionContext(
+                    &cctx, LZ4F_VERSION))
+            && write(LZ4F_compressBegin(
+                    cctx, out_buf.data(), out_buf.size(), &prefs));
+
+    size_t n;
+    while (ok && (n = fread(in_buf.data(), 1, in_buf.size(), fp_in)) > 0) {
+        ok = write(LZ4F_compressUpdate(cctx, out_buf.data(), out_buf.size(),
+                                       in_buf.data(), n, nullptr));
+    }
+
+    ok = ok && !ferror(fp_in)
+            && write(LZ4F_compressEnd(cctx, out_buf.data(), out_buf.size(),
+                                      nullptr));
+
+    if (fclose(fp_out) != 0 || !ok) {
+        fprintf(stderr, "%s: Failed to write LZ4 file\n", path.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+// Generated files are created once and shared by all benchmarks
+static const std::string * input_file(
+        const std::string &name,
+        const std::function<bool(const std::string &)> &create)
+{
+    static std::map<std::string, std::optional<std::string>> files;
+
+    if (auto it = files.find(name); it != files.end()) {
+        return it->second ? &*it->second : nullptr;
+    }
+
+    std::string path = work_dir() + "/" + name;
+    std::optional<std::string> result;
+
+    fprintf(stderr, "Generating %s...\n", path.c_str());
+
+    if (make_dirs(work_dir()) && create(path)) {
+        result = std::move(path);
+    }
+
+    auto &file = files[name] = std::move(result);
+    return file ? &*file : nullptr;
+}
+
+// Data directory with the placeholder binaries and scripts that the patchers
+// add to every output file
+static const std::string * data_dir()
+{
+    static std::optional<std::string> path = [] {
+        std::string dir = work_dir() + "/data";
+        std::string arch_dir = dir + "/binaries/android/" + ARCHITECTURE;
+        std::optional<std::string> result;
+
+        if (!make_dirs(arch_dir) || !make_dirs(dir + "/scripts")) {
+            return result;
+        }
+
+        std::vector<std::string> files{
+            dir + "/scripts/bb-wrapper.sh",
+        };
+        for (auto const &binary : {
+            "file-contexts-tool",
+            "fsck-wrapper",
+            "fuse-sparse",
+            "mbtool",
+            "mbtool_recovery",
+            "mount.exfat",
+            "odinupdater",
+        }) {
+            files.push_back(arch_dir + "/" + binary);
+        }
+
+        uint64_t seed = 0;
+
+        for (auto const &file : files) {
+            if (!write_file(file, data_member({}, 1024 * 1024, ++seed))
+                    || !write_file(file + ".sig",
+                                   data_member({}, 512, ++seed))) {
+                return result;
+            }
+        }
+
+        result = std::move(dir);
+        return result;
+    }();
+
+    return path ? &*path : nullptr;
+}
+
+static device::Device bench_device()
+{
+    device::Device device;
+    device.set_id("bench");
+    device.set_codenames({"bench"});
+    device.set_name("Benchmark device");
+    device.set_architecture(ARCHITECTURE);
+    device.set_system_block_devs({SYSTEM_BLOCK_DEV});
+    device.set_cache_block_devs({CACHE_BLOCK_DEV});
+    device.set_data_block_devs({DATA_BLOCK_DEV});
+    device.set_boot_block_devs({BOOT_BLOCK_DEV});
+
+    return device;
+}
+
+// Edify script that exercises all of the functions that StandardPatcher
+// rewrites
+static std::string updater_script(uint64_t lines)
+{
+    std::string script;
+
+    for (uint64_t i = 0; i < lines; ++i) {
+        switch (i % 8) {
+        case 0:
+            script += format("ui_print(\"Installing part %" PRIu64 "...\");\n",
+                             i);
+            break;
+        case 1:
+            script += format("mount(\"ext4\", \"EMMC\", \"%s\", \"/system\");\n",
+                             SYSTEM_BLOCK_DEV);
+            break;
+        case 2:
+            script += format("package_extract_dir(\"system/app%" PRIu64
+                             "\", \"/system/app/App%" PRIu64 "\");\n", i, i);
+            break;
+        case 3:
+            script += format("set_metadata_recursive(\"/system/app/App%" PRIu64
+                             "\", \"uid\", 0, \"gid\", 0, \"dmode\", 0755, "
+                             "\"fmode\", 0644, \"capabilities\", 0x0, "
+                             "\"selabel\", \"u:object_r:system_file:s0\");\n",
+                             i);
+            break;
+        case 4:
+            script += "run_program(\"/sbin/busybox\", \"mount\", \"/system\");\n";
+            break;
+        case 5:
+            script += "delete_recursive(\"/system/priv-app/Stale\");\n";
+            break;
+        case 6:
+            script += format("format(\"ext4\", \"EMMC\", \"%s\", \"0\", "
+                             "\"/cache\");\n", CACHE_BLOCK_DEV);
+            break;
+        case 7:
+            script += "unmount(\"/system\");\n";
+            break;
+        }
+    }
+
+    return script;
+}
+
+static std::string transfer_list(uint64_t size)
+{
+    auto blocks = (size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+
+    return format("4\n%" PRIu64 "\n0\n0\n"
+                  "erase 2,0,%" PRIu64 "\n"
+                  "new 2,0,%" PRIu64 "\n", blocks, blocks, blocks);
+}
+
+// Files that every generated ROM zip contains
+static std::vector<Member> rom_members(uint64_t script_lines)
+{
+    std::vector<Member> members;
+    members.push_back(data_member(
+            "META-INF/com/google/android/update-binary", 512 * 1024, 1));
+    members.push_back(text_member(
+            "META-INF/com/google/android/updater-script",
+            updater_script(script_lines)));
+    members.push_back(data_member("boot.img", workload().boot_size, 2));
+
+    return members;
+}
+
+static const std::string * zip_entries()
+{
+    return input_file("entries.zip", [](const std::string &path) {
+        auto members = rom_members(100);
+
+        for (uint64_t i = 0; i < workload().entries; ++i) {
+            members.push_back(data_member(
+                    format("system/app/App%" PRIu64 "/App%" PRIu64 ".apk",
+                           i, i),
+                    workload().entry_size, 1000 + i));
+        }
+
+        return write_archive(path, ArchiveFormat::Zip, members);
+    });
+}
+
+static bool write_block_zip(const std::string &path, ArchiveFormat format)
+{
+    auto members = rom_members(100);
+    members.push_back(text_member("system.transfer.list",
+                                  transfer_list(workload().large_size)));
+    members.push_back(data_member("system.new.dat", workload().large_size, 3));
+
+    return write_archive(path, format, members);
+}
+
+static const std::string * zip_large_stored()
+{
+    return input_file("large_stored.zip", [](const std::string &path) {
+        return write_block_zip(path, ArchiveFormat::ZipStored);
+    });
+}
+
+static const std::string * zip_large_deflated()
+{
+    return input_file("large_deflated.zip", [](const std::string &path) {
+        return write_block_zip(path, ArchiveFormat::Zip);
+    });
+}
+
+static const std::string * zip_long_script()
+{
+    return input_file("long_script.zip", [](const std::string &path) {
+        return write_archive(path, ArchiveFormat::Zip,
+                             rom_members(workload().script_lines));
+    });
+}
+
+static const std::string * boot_img()
+{
+    return input_file("boot.img", [](const std::string &path) {
+        return write_file(path, data_member({}, workload().boot_size, 2));
+    });
+}
+
+static const std::string * system_img()
+{
+    return input_file("system.img.ext4", [](const std::string &path) {
+        return write_sparse_file(path, workload().image_size, 0x12345678);
+    });
+}
+
+static const std::string * cache_img()
+{
+    return input_file("cache.img.ext4", [](const std::string &path) {
+        return write_sparse_file(path, workload().image_size / 4, 0x87654321);
+    });
+}
+
+static const std::string * lz4_file(const std::string *source)
+{
+    if (!source) {
+        return nullptr;
+    }
+
+    auto name = source->substr(source->rfind('/') + 1) + ".lz4";
+
+    return input_file(name, [source](const std::string &path) {
+        return write_lz4_file(path, *source);
+    });
+}
+
+// The md5 trailer of the nested .tar.md5 files is omitted since the patcher
+// does not check it
+
+static const std::string * odin_flat()
+{
+    return input_file("odin_flat.tar", [](const std::string &path) {
+        auto boot = boot_img();
+        auto system = system_img();
+        auto cache = cache_img();
+
+        return boot && system && cache && write_archive(
+                path, ArchiveFormat::Tar, {
+                    file_member("boot.img", *boot),
+                    data_member("recovery.img", workload().boot_size, 4),
+                    file_member("system.img.ext4", *system),
+                    file_member("cache.img.ext4", *cache),
+                });
+    });
+}
+
+static const std::string * odin_nested()
+{
+    return input_file("odin_nested.tar", [](const std::string &path) {
+        auto boot = boot_img();
+        auto system = system_img();
+        auto cache = cache_img();
+        if (!boot || !system || !cache) {
+            return false;
+        }
+
+        auto ap = input_file("AP_bench.tar.md5", [&](const std::string &p) {
+            return write_archive(p, ArchiveFormat::Tar, {
+                file_member("boot.img", *boot),
+                data_member("recovery.img", workload().boot_size, 4),
+                file_member("system.img.ext4", *system),
+            });
+        });
+        auto csc = input_file("CSC_bench.tar.md5", [&](const std::string &p) {
+            return write_archive(p, ArchiveFormat::Tar, {
+                file_member("cache.img.ext4", *cache),
+            });
+        });
+
+        // HOME_CSC contains the same cache image, which must be skipped
+        return ap && csc && write_archive(path, ArchiveFormat::Tar, {
+            file_member("AP_bench.tar.md5", *ap),
+            file_member("CSC_bench.tar.md5", *csc),
+            file_member("HOME_CSC_bench.tar.md5", *csc),
+        });
+    });
+}
+
+static const std::string * odin_lz4()
+{
+    return input_file("odin_lz4.tar", [](const std::string &path) {
+        auto boot = lz4_file(boot_img());
+        auto system = lz4_file(system_img());
+        auto cache = lz4_file(cache_img());
+        if (!boot || !system || !cache) {
+            return false;
+        }
+
+        auto ap = input_file("AP_bench_lz4.tar.md5", [&](const std::string &p) {
+            return write_archive(p, ArchiveFormat::Tar, {
+                file_member("boot.img.lz4", *boot),
+                file_member("system.img.ext4.lz4", *system),
+                file_member("cache.img.ext4.lz4", *cache),
+            });
+        });
+
+        return ap && write_archive(path, ArchiveFormat::Tar, {
+            file_member("AP_bench.tar.md5", *ap),
+        });
+    });
+}
+
+// Reset the peak RSS (VmHWM) of the process. This needs Linux 4.0 or newer.
+static bool reset_peak_rss()
+{
+    int fd = open("/proc/self/clear_refs", O_WRONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+
+    bool ret = write(fd, "5", 1) == 1;
+    close(fd);
+
+    return ret;
+}
+
+static uint64_t peak_rss_kib()
+{
+    if (FILE *fp = fopen("/proc/self/status", "re")) {
+        auto close_fp = finally([&] {
+            fclose(fp);
+        });
+
+        char line[256];
+        unsigned long long kib;
+
+        while (fgets(line, sizeof(line), fp)) {
+            if (sscanf(line, "VmHWM: %llu kB", &kib) == 1) {
+                return kib;
+            }
+        }
+    }
+
+    rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+        return static_cast<uint64_t>(usage.ru_maxrss);
+    }
+
+    return 0;
+}
+
+static void run_patcher(State &state, const std::string &patcher_id,
+                        const std::string * (*input_fn)(),
+                        ImageCompression compression)
+{
+    state.pause_timing();
+    static bool quiet = [] {
+        log::set_logger(std::make_shared<QuietLogger>());
+        return true;
+    }();
+    (void) quiet;
+    auto input = input_fn();
+    auto data = data_dir();
+    auto output = work_dir() + "/output.zip";
+    state.resume_timing();
+
+    if (!input) {
+        return state.skip("Failed to generate input file");
+    } else if (!data) {
+        return state.skip("Failed to generate data directory");
+    }
+
+    struct stat sb;
+    if (stat(input->c_str(), &sb) < 0) {
+        return state.skip("Failed to stat input file");
+    }
+
+    PatcherConfig pc;
+    pc.set_data_directory(*data);
+    pc.set_temp_directory(work_dir());
+    pc.set_image_compression(compression);
+
+    FileInfo info;
+    info.set_input_path(*input);
+    info.set_output_path(output);
+    info.set_device(bench_device());
+    info.set_rom_id("dual");
+
+    perf::reset();
+    reset_peak_rss();
+
+    for (uint64_t i = 0; i < state.iterations(); ++i) {
+        state.pause_timing();
+        unlink(output.c_str());
+        state.resume_timing();
+
+        Patcher *patcher = pc.create_patcher(patcher_id);
+        if (!patcher) {
+            return state.skip("Failed to create " + patcher_id);
+        }
+
+        auto destroy_patcher = finally([&] {
+            pc.destroy_patcher(patcher);
+        });
+
+        patcher->set_file_info(&info);
+
+        if (!patcher->patch_file({}, {}, {})) {
+            return state.skip(format("Failed to patch file (error code %d)",
+                                     static_cast<int>(patcher->error())));
+        }
+    }
+
+    state.pause_timing();
+    unlink(output.c_str());
+    state.resume_timing();
+
+    state.set_bytes_processed(state.iterations()
+            * static_cast<uint64_t>(sb.st_size));
+    state.set_counter("peak_rss_kib", static_cast<double>(peak_rss_kib()));
+
+    // Phase timers are named patcher.<type>.<phase> and are in microseconds
+    for (auto const &m : perf::snapshot()) {
+        if (m.type == perf::MetricType::Histogram && m.count > 0
+                && starts_with(m.name, "patcher.")) {
+            state.set_counter(m.name.substr(m.name.rfind('.') + 1) + "_ms",
+                              static_cast<double>(m.sum) / 1000.0
+                                      / static_cast<double>(state.iterations()));
+        }
+    }
+}
+
+MB_BENCHMARK(zip_patch_many_entries)
+{
+    run_patcher(state, ZipPatcher::Id, &zip_entries, ImageCompression::Lz4);
+}
+
+MB_BENCHMARK(zip_patch_large_stored)
+{
+    run_patcher(state, ZipPatcher::Id, &zip_large_stored,
+                ImageCompression::Lz4);
+}
+
+MB_BENCHMARK(zip_patch_large_deflated)
+{
+    run_patcher(state, ZipPatcher::Id, &zip_large_deflated,
+                ImageCompression::Lz4);
+}
+
+MB_BENCHMARK(zip_patch_long_script)
+{
+    run_patcher(state, ZipPatcher::Id, &zip_long_script,
+                ImageCompression::Lz4);
+}
+
+MB_BENCHMARK(odin_patch_flat)
+{
+    run_patcher(state, OdinPatcher::Id, &odin_flat, ImageCompression::Lz4);
+}
+
+// All images are deflated, which is what the parallel deflate speeds up
+MB_BENCHMARK(odin_patch_flat_deflate)
+{
+    run_patcher(state, OdinPatcher::Id, &odin_flat, ImageCompression::Deflate);
+}
+
+MB_BENCHMARK(odin_patch_nested)
+{
+    run_patcher(state, OdinPatcher::Id, &odin_nested, ImageCompression::Lz4);
+}
+
+// The LZ4 sparse images are copied without being decompressed
+MB_BENCHMARK(odin_patch_lz4)
+{
+    run_patcher(state, OdinPatcher::Id, &odin_lz4, ImageCompression::Lz4);
+}
+
+// The LZ4 sparse images are decompressed and deflated
+MB_BENCHMARK(odin_patch_lz4_deflate)
+{
+    run_patcher(state, OdinPatcher::Id, &odin_lz4, ImageCompression::Deflate);
+}
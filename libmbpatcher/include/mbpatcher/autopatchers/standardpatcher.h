@@ -48,10 +48,10 @@ public:
     std::vector<std::string> new_files() const override;
     std::vector<std::string> existing_files() const override;
 
-    bool patch_files(const std::string &directory) override;
+    bool patch_data(FileMap &files) override;
 
-    bool patch_updater(const std::string &directory);
-    bool patch_transfer_list(const std::string &directory);
+    bool patch_updater(std::string &contents);
+    bool patch_transfer_list(std::string &contents);
 
 private:
     const FileInfo &m_info;
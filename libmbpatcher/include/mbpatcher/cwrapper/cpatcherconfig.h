@@ -20,6 +20,7 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stdint.h>
 
 #include "mbcommon/common.h"
 #include "mbpatcher/cwrapper/ctypes.h"
@@ -37,6 +38,12 @@ MB_EXPORT char * mbpatcher_config_temp_directory(const CPatcherConfig *pc);
 MB_EXPORT void mbpatcher_config_set_data_directory(CPatcherConfig *pc, char *path);
 MB_EXPORT void mbpatcher_config_set_temp_directory(CPatcherConfig *pc, char *path);
 
+MB_EXPORT /* enum ImageCompression */ int mbpatcher_config_image_compression(const CPatcherConfig *pc);
+MB_EXPORT uint64_t mbpatcher_config_image_compression_threshold(const CPatcherConfig *pc);
+
+MB_EXPORT void mbpatcher_config_set_image_compression(CPatcherConfig *pc, /* enum ImageCompression */ int compression);
+MB_EXPORT void mbpatcher_config_set_image_compression_threshold(CPatcherConfig *pc, uint64_t size);
+
 MB_EXPORT char ** mbpatcher_config_patchers(const CPatcherConfig *pc);
 MB_EXPORT char ** mbpatcher_config_autopatchers(const CPatcherConfig *pc);
 
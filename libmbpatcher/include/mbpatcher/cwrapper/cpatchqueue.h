@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mbcommon/common.h"
+#include "mbpatcher/cwrapper/ctypes.h"
+
+MB_BEGIN_C_DECLS
+
+typedef void (*PatchQueueProgressCallback) (size_t, uint64_t, uint64_t, void *);
+typedef void (*PatchQueueFilesCallback) (size_t, uint64_t, uint64_t, void *);
+typedef void (*PatchQueueDetailsCallback) (size_t, const char *, void *);
+typedef void (*PatchQueueFinishedCallback) (size_t, int, int, void *);
+
+MB_EXPORT CPatchQueue * mbpatcher_queue_create(CPatcherConfig *pc,
+                                               unsigned int max_jobs,
+                                               PatchQueueProgressCallback progress_cb,
+                                               PatchQueueFilesCallback files_cb,
+                                               PatchQueueDetailsCallback details_cb,
+                                               PatchQueueFinishedCallback finished_cb,
+                                               void *userdata);
+MB_EXPORT void mbpatcher_queue_destroy(CPatchQueue *queue);
+
+MB_EXPORT size_t mbpatcher_queue_submit(CPatchQueue *queue,
+                                        const char *patcher_id,
+                                        const CFileInfo *info);
+
+MB_EXPORT void mbpatcher_queue_cancel(CPatchQueue *queue, size_t job);
+MB_EXPORT void mbpatcher_queue_cancel_all(CPatchQueue *queue);
+
+MB_EXPORT void mbpatcher_queue_wait(CPatchQueue *queue);
+
+MB_EXPORT size_t mbpatcher_queue_size(const CPatchQueue *queue);
+MB_EXPORT /* enum JobState */ int mbpatcher_queue_job_state(const CPatchQueue *queue, size_t job);
+MB_EXPORT /* enum ErrorCode */ int mbpatcher_queue_job_error(const CPatchQueue *queue, size_t job);
+
+MB_END_C_DECLS
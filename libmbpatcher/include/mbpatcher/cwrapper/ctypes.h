@@ -34,4 +34,7 @@ typedef struct CPatcher CPatcher;
 struct CAutoPatcher;
 typedef struct CAutoPatcher CAutoPatcher;
 
+struct CPatchQueue;
+typedef struct CPatchQueue CPatchQueue;
+
 MB_END_C_DECLS
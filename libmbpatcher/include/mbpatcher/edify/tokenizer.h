@@ -19,6 +19,7 @@
 
 #pragma once
 
+#include <memory>
 #include <string>
 #include <string_view>
 #include <vector>
@@ -47,10 +48,32 @@ MB_EXPORT std::error_code make_error_code(EdifyError e);
 
 MB_EXPORT const std::error_category & edify_error_category();
 
+/*!
+ * \brief Bump allocator for strings referenced by edify tokens
+ *
+ * Tokens only hold views into their backing buffer. Strings that do not come
+ * from the source buffer (eg. replacement functions) are copied into an arena
+ * so that they outlive the tokens that reference them.
+ */
+class EdifyStringArena
+{
+public:
+    EdifyStringArena();
+
+    std::string_view store(std::string_view str);
+
+private:
+    std::vector<std::unique_ptr<char[]>> m_blocks;
+    char *m_cur;
+    std::size_t m_avail;
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(EdifyStringArena)
+};
+
 class EdifyTokenIf
 {
 public:
-    std::string generate() const
+    std::string_view generate() const
     {
         return "if";
     }
@@ -59,7 +82,7 @@ public:
 class EdifyTokenThen
 {
 public:
-    std::string generate() const
+    std::string_view generate() const
     {
         return "then";
     }
@@ -68,7 +91,7 @@ public:
 class EdifyTokenElse
 {
 public:
-    std::string generate() const
+    std::string_view generate() const
     {
         return "else";
     }
@@ -77,7 +100,7 @@ public:
 class EdifyTokenEndif
 {
 public:
-    std::string generate() const
+    std::string_view generate() const
     {
         return "endif";
     }
@@ -86,7 +109,7 @@ public:
 class EdifyTokenAnd
 {
 public:
-    std::string generate() const
+    std::string_view generate() const
     {
         return "&&";
     }
@@ -95,7 +118,7 @@ public:
 class EdifyTokenOr
 {
 public:
-    std::string generate() const
+    std::string_view generate() const
     {
         return "||";
     }
@@ -104,7 +127,7 @@ public:
 class EdifyTokenEquals
 {
 public:
-    std::string generate() const
+    std::string_view generate() const
     {
         return "==";
     }
@@ -113,7 +136,7 @@ public:
 class EdifyTokenNotEquals
 {
 public:
-    std::string generate() const
+    std::string_view generate() const
     {
         return "!=";
     }
@@ -122,7 +145,7 @@ public:
 class EdifyTokenNot
 {
 public:
-    std::string generate() const
+    std::string_view generate() const
     {
         return "!";
     }
@@ -131,7 +154,7 @@ public:
 class EdifyTokenLeftParen
 {
 public:
-    std::string generate() const
+    std::string_view generate() const
     {
         return "(";
     }
@@ -140,7 +163,7 @@ public:
 class EdifyTokenRightParen
 {
 public:
-    std::string generate() const
+    std::string_view generate() const
     {
         return ")";
     }
@@ -149,7 +172,7 @@ public:
 class EdifyTokenSemicolon
 {
 public:
-    std::string generate() const
+    std::string_view generate() const
     {
         return ";";
     }
@@ -158,7 +181,7 @@ public:
 class EdifyTokenComma
 {
 public:
-    std::string generate() const
+    std::string_view generate() const
     {
         return ",";
     }
@@ -167,7 +190,7 @@ public:
 class EdifyTokenConcat
 {
 public:
-    std::string generate() const
+    std::string_view generate() const
     {
         return "+";
     }
@@ -176,7 +199,7 @@ public:
 class EdifyTokenNewline
 {
 public:
-    std::string generate() const
+    std::string_view generate() const
     {
         return "\n";
     }
@@ -185,7 +208,7 @@ public:
 class EdifyTokenWhitespace
 {
 public:
-    EdifyTokenWhitespace(std::string str) : m_str(std::move(str))
+    EdifyTokenWhitespace(std::string_view str) : m_str(str)
     {
         assert(!m_str.empty());
 
@@ -194,49 +217,55 @@ public:
         }
     }
 
-    std::string generate() const
+    std::string_view generate() const
     {
         return m_str;
     }
 
 private:
-    std::string m_str;
+    std::string_view m_str;
 };
 
 class EdifyTokenComment
 {
 public:
-    EdifyTokenComment(std::string str) : m_str(std::move(str))
+    //! \p str must include the leading '#' character
+    EdifyTokenComment(std::string_view str) : m_str(str)
     {
+        assert(!m_str.empty() && m_str.front() == '#');
     }
 
-    std::string generate() const
+    std::string_view generate() const
     {
-        return '#' + m_str;
+        return m_str;
     }
 
 private:
-    std::string m_str;
+    std::string_view m_str;
 };
 
 class EdifyTokenString
 {
 public:
-    static oc::result<EdifyTokenString> from_raw(std::string str, bool quoted);
-    static oc::result<EdifyTokenString> from_string(std::string str, bool make_quoted);
+    static oc::result<EdifyTokenString> from_raw(std::string_view str,
+                                                 bool quoted);
+    static oc::result<EdifyTokenString> from_string(std::string_view str,
+                                                    bool make_quoted,
+                                                    EdifyStringArena &arena);
 
-    std::string generate() const;
+    std::string_view generate() const;
 
     oc::result<std::string> unescaped_string() const;
 
-    std::string raw_string() const;
+    std::string_view raw_string() const;
 
     bool quoted() const;
 
     static bool is_valid_unquoted(char c);
 
 protected:
-    std::string m_str;
+    //! Raw token text, including quotes if the string is quoted
+    std::string_view m_raw;
     bool m_quoted;
 
     EdifyTokenString() = default;
@@ -248,17 +277,18 @@ protected:
 class EdifyTokenUnknown
 {
 public:
-    EdifyTokenUnknown(char c) : m_char(c)
+    EdifyTokenUnknown(std::string_view c) : m_char(c)
     {
+        assert(m_char.size() == 1);
     }
 
-    std::string generate() const
+    std::string_view generate() const
     {
-        return std::string(1, m_char);
+        return m_char;
     }
 
 private:
-    char m_char;
+    std::string_view m_char;
 };
 
 using EdifyToken = std::variant<
@@ -283,15 +313,55 @@ using EdifyToken = std::variant<
     EdifyTokenUnknown
 >;
 
+using EdifyTokens = std::vector<EdifyToken>;
+
+/*!
+ * \brief Piece table of replacements applied on top of a token list
+ *
+ * The original token list is never modified. Each replacement records the
+ * range of tokens it covers and the tokens that take its place, so replacing
+ * a function call is O(1) regardless of the script size. Replacements must be
+ * added in order and must not overlap.
+ */
+class EdifyTokenEdits
+{
+public:
+    explicit EdifyTokenEdits(const EdifyTokens &tokens);
+
+    oc::result<void> replace(EdifyTokens::const_iterator begin,
+                             EdifyTokens::const_iterator end,
+                             std::string_view replacement);
+
+    std::string untokenize() const;
+
+    const EdifyTokens & tokens() const
+    {
+        return m_tokens;
+    }
+
+private:
+    struct Piece
+    {
+        std::size_t begin;
+        std::size_t end;
+        EdifyTokens tokens;
+    };
+
+    const EdifyTokens &m_tokens;
+    std::vector<Piece> m_pieces;
+    EdifyStringArena m_arena;
+};
+
 class EdifyTokenizer
 {
 public:
-    static oc::result<std::vector<EdifyToken>> tokenize(std::string_view str);
-    static std::string untokenize(const std::vector<EdifyToken> &tokens);
-    static std::string untokenize(std::vector<EdifyToken>::const_iterator begin,
-                                  std::vector<EdifyToken>::const_iterator end);
+    //! Tokens reference \p str, which must outlive them
+    static oc::result<EdifyTokens> tokenize(std::string_view str);
+    static std::string untokenize(const EdifyTokens &tokens);
+    static std::string untokenize(EdifyTokens::const_iterator begin,
+                                  EdifyTokens::const_iterator end);
 
-    static void dump(const std::vector<EdifyToken> &tokens);
+    static void dump(const EdifyTokens &tokens);
 
 private:
     static oc::result<EdifyToken> next_token(std::string_view str,
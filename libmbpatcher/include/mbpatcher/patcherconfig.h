@@ -20,8 +20,12 @@
 #pragma once
 
 #include <memory>
+#include <mutex>
+#include <string>
 #include <vector>
 
+#include <cstdint>
+
 #include "mbcommon/common.h"
 
 #include "mbpatcher/errors.h"
@@ -34,6 +38,17 @@ namespace mb::patcher
 class Patcher;
 class AutoPatcher;
 
+enum class ImageCompression : int
+{
+    // Deflate images like every other zip entry
+    Deflate = 0,
+    // Store images uncompressed
+    Store = 1,
+    // Store images as LZ4 frames. LZ4-compressed images in the source archive
+    // are copied without being recompressed.
+    Lz4 = 2,
+};
+
 class MB_EXPORT PatcherConfig
 {
 public:
@@ -48,6 +63,12 @@ public:
     void set_data_directory(std::string path);
     void set_temp_directory(std::string path);
 
+    ImageCompression image_compression() const;
+    uint64_t image_compression_threshold() const;
+
+    void set_image_compression(ImageCompression compression);
+    void set_image_compression_threshold(uint64_t size);
+
     std::vector<std::string> patchers() const;
     std::vector<std::string> auto_patchers() const;
 
@@ -66,10 +87,16 @@ private:
     std::string m_data_dir;
     std::string m_temp_dir;
 
+    // Compression of large sparse images
+    ImageCompression m_image_compression = ImageCompression::Lz4;
+    uint64_t m_image_compression_threshold = 64 * 1024 * 1024;
+
     // Errors
     ErrorCode m_error;
 
-    // Created patchers
+    // Created patchers. Guarded by m_mutex since patchers may be created and
+    // destroyed from multiple threads (eg. by PatchQueue).
+    std::mutex m_mutex;
     std::vector<std::unique_ptr<Patcher>> m_patchers;
     std::vector<std::unique_ptr<AutoPatcher>> m_auto_patchers;
 };
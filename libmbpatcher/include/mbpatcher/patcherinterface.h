@@ -20,6 +20,9 @@
 #pragma once
 
 #include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 #include "mbcommon/common.h"
 
@@ -103,6 +106,9 @@ public:
 class AutoPatcher
 {
 public:
+    //! Map of zip entry paths to their contents
+    using FileMap = std::unordered_map<std::string, std::string>;
+
     virtual ~AutoPatcher() {}
 
     /*!
@@ -132,12 +138,23 @@ public:
      */
     virtual std::vector<std::string> existing_files() const = 0;
 
+    /*!
+     * \brief Patch files in memory
+     *
+     * \param files Contents of the files in existing_files() that exist in the
+     *              zip file. The contents are modified in place.
+     */
+    virtual bool patch_data(FileMap &files) = 0;
+
     /*!
      * \brief Start patching the file
      *
+     * The default implementation loads the files in existing_files() from
+     * \p directory, patches them with patch_data(), and writes them back.
+     *
      * \param directory Directory containing the files to be patched
      */
-    virtual bool patch_files(const std::string &directory) = 0;
+    virtual bool patch_files(const std::string &directory);
 };
 
 }
@@ -19,11 +19,14 @@
 
 #pragma once
 
+#include <functional>
 #include <unordered_set>
 
 #include <archive.h>
 #include <archive_entry.h>
 
+#include "mbcommon/file/block_reader.h"
+
 #include "mbpatcher/patcherconfig.h"
 #include "mbpatcher/patcherinterface.h"
 
@@ -73,13 +76,13 @@ private:
 
     ErrorCode m_error;
 
-    unsigned char m_la_buf[10240];
 #ifdef __ANDROID__
     FdFile m_la_file;
     int m_fd;
 #else
     StandardFile m_la_file;
 #endif
+    BlockReader m_la_reader;
 
     std::unordered_set<std::string> m_added_files;
 
@@ -93,6 +96,13 @@ private:
 
     bool patch_tar();
 
+    using ReadFn = std::function<int64_t(void *buf, size_t size)>;
+
+    bool write_stored_file(const std::string &zip_name, const ReadFn &read_fn,
+                           bool lz4);
+    int64_t read_data(archive *a, const char *name, void *buf, size_t size);
+    bool process_lz4_file(archive *a, archive_entry *entry,
+                          const std::string &zip_name);
     bool process_file(archive *a, archive_entry *entry, bool sparse);
     bool process_contents(archive *a, unsigned int depth,
                           const char *raw_entry_path);
@@ -20,6 +20,9 @@
 #pragma once
 
 #include <unordered_set>
+#include <vector>
+
+#include <ctime>
 
 #include "mbpatcher/patcherconfig.h"
 #include "mbpatcher/patcherinterface.h"
@@ -30,6 +33,7 @@ namespace mb::patcher
 
 struct UnzCtx;
 struct ZipCtx;
+class ZipIndex;
 
 class ZipPatcher : public Patcher
 {
@@ -81,12 +85,21 @@ private:
     ZipCtx *m_z_output = nullptr;
     std::vector<AutoPatcher *> m_auto_patchers;
 
+    // Zip entry loaded into memory for the autopatchers
+    struct LoadedEntry
+    {
+        std::string name;
+        time_t modified_date;
+    };
+
     bool patch_zip();
 
-    bool pass1(const std::string &temporary_dir,
-               const std::unordered_set<std::string> &exclude);
-    bool pass2(const std::string &temporary_dir,
-               const std::unordered_set<std::string> &files);
+    bool pass1(const ZipIndex &index,
+               const std::unordered_set<std::string> &exclude,
+               std::vector<LoadedEntry> &entries,
+               AutoPatcher::FileMap &files);
+    bool pass2(const std::vector<LoadedEntry> &entries,
+               AutoPatcher::FileMap &files);
     bool open_input_archive();
     void close_input_archive();
     bool open_output_archive();
@@ -0,0 +1,123 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+#include "mbcommon/common.h"
+
+#include "mbpatcher/errors.h"
+#include "mbpatcher/fileinfo.h"
+
+
+namespace mb::patcher
+{
+
+class Patcher;
+class PatcherConfig;
+
+class MB_EXPORT PatchQueue
+{
+public:
+    enum class JobState : int
+    {
+        Queued = 0,
+        Running = 1,
+        Succeeded = 2,
+        Failed = 3,
+        Cancelled = 4,
+    };
+
+    using ProgressUpdatedCallback =
+            std::function<void(size_t, uint64_t, uint64_t)>;
+    using FilesUpdatedCallback =
+            std::function<void(size_t, uint64_t, uint64_t)>;
+    using DetailsUpdatedCallback =
+            std::function<void(size_t, const std::string &)>;
+    using JobFinishedCallback =
+            std::function<void(size_t, JobState, ErrorCode)>;
+
+    struct Callbacks
+    {
+        ProgressUpdatedCallback progress;
+        FilesUpdatedCallback files;
+        DetailsUpdatedCallback details;
+        JobFinishedCallback finished;
+    };
+
+    PatchQueue(PatcherConfig &pc, Callbacks callbacks,
+               unsigned int max_jobs = 0);
+    ~PatchQueue();
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(PatchQueue)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(PatchQueue)
+
+    size_t submit(std::string patcher_id, FileInfo info);
+
+    void cancel(size_t job);
+    void cancel_all();
+
+    void wait();
+
+    size_t size() const;
+    JobState state(size_t job) const;
+    ErrorCode error(size_t job) const;
+
+private:
+    struct Job
+    {
+        std::string patcher_id;
+        FileInfo info;
+        Patcher *patcher = nullptr;
+        JobState state = JobState::Queued;
+        ErrorCode error = ErrorCode::NoError;
+        bool cancelled = false;
+    };
+
+    PatcherConfig &m_pc;
+    const Callbacks m_callbacks;
+    const unsigned int m_max_jobs;
+
+    mutable std::mutex m_mutex;
+    // Signalled when a job finishes
+    std::condition_variable m_finished_cv;
+
+    std::vector<std::unique_ptr<Job>> m_jobs;
+    // Index of the next job to start
+    size_t m_next_job = 0;
+    size_t m_finished_jobs = 0;
+
+    std::vector<std::thread> m_threads;
+    unsigned int m_active_threads = 0;
+
+    void worker_thread();
+    void run_job(size_t index, Job &job);
+};
+
+}
@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+
+namespace mb::patcher
+{
+
+class DeflateUtils
+{
+public:
+    struct DeflateResult
+    {
+        uint64_t uncompressed_size;
+        uint64_t compressed_size;
+        uint32_t crc;
+    };
+
+    struct DeflatedData
+    {
+        std::string data;
+        uint64_t uncompressed_size;
+        uint32_t crc;
+    };
+
+    /*!
+     * \brief Read data into a buffer
+     *
+     * \return Number of bytes read, 0 on EOF, or a negative number on error
+     */
+    using ReadFn = std::function<int64_t(void *buf, size_t size)>;
+
+    /*!
+     * \brief Write a block of compressed data
+     *
+     * \return Whether all of the data was written
+     */
+    using WriteFn = std::function<bool(const void *buf, size_t size)>;
+
+    static unsigned int default_threads();
+
+    static bool parallel_deflate(const ReadFn &read_fn,
+                                 const WriteFn &write_fn,
+                                 int level, unsigned int threads,
+                                 DeflateResult &result);
+
+    static bool deflate_buffers(const std::vector<std::string_view> &inputs,
+                                int level, unsigned int threads,
+                                std::vector<DeflatedData> &outputs);
+};
+
+}
@@ -21,11 +21,17 @@
 
 #include <functional>
 #include <string>
+#include <string_view>
+#include <unordered_map>
 #include <vector>
 
+#include <ctime>
+
 #include "mz.h"
 #include "mz_zip.h"
 
+#include "mbcommon/common.h"
+
 #include "mbpatcher/errors.h"
 
 
@@ -40,6 +46,46 @@ enum class ZipOpenMode
     Write,
 };
 
+struct ZipEntryInfo
+{
+    std::string name;
+    uint64_t compressed_size;
+    uint64_t uncompressed_size;
+    uint32_t crc;
+    uint16_t compression_method;
+    time_t modified_date;
+    int64_t local_header_offset;
+};
+
+/*!
+ * \brief In-memory index of a zip's central directory
+ *
+ * Entries are kept in central directory order. Name lookups resolve to the
+ * last entry with that name, which matches what extraction would produce.
+ */
+class ZipIndex
+{
+public:
+    ZipIndex() = default;
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(ZipIndex)
+    MB_DEFAULT_MOVE_CONSTRUCT_AND_ASSIGN(ZipIndex)
+
+    const std::vector<ZipEntryInfo> & entries() const;
+
+    const ZipEntryInfo * find(std::string_view name) const;
+
+    uint64_t total_size() const;
+
+private:
+    std::vector<ZipEntryInfo> m_entries;
+    // Keys point into m_entries, which is never modified after indexing
+    std::unordered_map<std::string_view, std::size_t> m_by_name;
+    uint64_t m_total_size = 0;
+
+    friend class MinizipUtils;
+};
+
 class MinizipUtils
 {
 public:
@@ -55,10 +101,16 @@ public:
 
     static int close_zip_file(ZipCtx *ctx);
 
+    static ErrorCode index_archive(void *handle, ZipIndex &index);
+
     static ErrorCode archive_stats(const std::string &path,
                                    ArchiveStats &stats,
                                    const std::vector<std::string> &ignore);
 
+    static void archive_stats(const ZipIndex &index,
+                              ArchiveStats &stats,
+                              const std::vector<std::string> &ignore);
+
     static bool copy_file_raw(void *source_handle,
                               void *target_handle,
                               const std::string &name,
@@ -74,6 +126,12 @@ public:
                                         const std::string &name,
                                         const std::string &data);
 
+    static ErrorCode add_file_from_raw_data(void *handle,
+                                            const mz_zip_file &file_info,
+                                            const std::string &data,
+                                            uint64_t uncompressed_size,
+                                            uint32_t crc);
+
     static ErrorCode add_file_from_path(void *handle,
                                         const std::string &name,
                                         const std::string &path);
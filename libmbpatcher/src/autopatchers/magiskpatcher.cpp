@@ -24,7 +24,6 @@
 #include "mbcommon/string.h"
 
 #include "mbpatcher/autopatchers/standardpatcher.h"
-#include "mbpatcher/private/fileutils.h"
 
 
 namespace mb::patcher
@@ -78,17 +77,10 @@ static void replace_all(std::string &source, std::string_view from,
     }
 }
 
-static bool patch_file(const std::string &path, bool is_updater)
+static void patch_contents(std::string &contents, bool is_updater)
 {
-    std::string contents;
-
-    ErrorCode ret = FileUtils::read_to_string(path, &contents);
-    if (ret != ErrorCode::NoError) {
-        return false;
-    }
-
     if (is_updater && !starts_with(contents, "#MAGISK")) {
-        return true;
+        return;
     }
 
     replace_all(contents, "mount /data", "/update-binary-tool mount /data");
@@ -108,19 +100,20 @@ static bool patch_file(const std::string &path, bool is_updater)
     // continuing. This race condition leads to a corrupted boot image on
     // devices with slow internal storage like the Galaxy S4.
     replace_all(contents, "sleep 5", "sleep 10");
-
-    FileUtils::write_from_string(path, contents);
-
-    return true;
 }
 
-bool MagiskPatcher::patch_files(const std::string &directory)
+bool MagiskPatcher::patch_data(FileMap &files)
 {
-    patch_file(directory + "/" + StandardPatcher::UpdaterScript, true);
-    patch_file(directory + "/" + AddonDScript, false);
-    patch_file(directory + "/" + UtilFunctions, false);
+    for (auto const &[name, is_updater] : {
+        std::pair{&StandardPatcher::UpdaterScript, true},
+        std::pair{&AddonDScript, false},
+        std::pair{&UtilFunctions, false},
+    }) {
+        if (auto it = files.find(*name); it != files.end()) {
+            patch_contents(it->second, is_updater);
+        }
+    }
 
-    // Don't fail if an error occurs
     return true;
 }
 
@@ -23,7 +23,6 @@
 
 #include "mbcommon/string.h"
 
-#include "mbpatcher/private/fileutils.h"
 
 
 namespace mb::patcher
@@ -72,15 +71,8 @@ static bool space_or_end(const char *ptr)
     return !*ptr || isspace(*ptr);
 }
 
-static bool patch_file(const std::string &path)
+static void patch_contents(std::string &contents)
 {
-    std::string contents;
-
-    ErrorCode ret = FileUtils::read_to_string(path, &contents);
-    if (ret != ErrorCode::NoError) {
-        return false;
-    }
-
     auto lines = split(contents, '\n');
 
     for (auto &line : lines) {
@@ -96,17 +88,16 @@ static bool patch_file(const std::string &path)
     }
 
     contents = join(lines, "\n");
-    FileUtils::write_from_string(path, contents);
-
-    return true;
 }
 
-bool MountCmdPatcher::patch_files(const std::string &directory)
+bool MountCmdPatcher::patch_data(FileMap &files)
 {
-    patch_file(directory + "/" + FlashScript);
-    patch_file(directory + "/" + InstallerScript);
+    for (auto const *name : { &FlashScript, &InstallerScript }) {
+        if (auto it = files.find(*name); it != files.end()) {
+            patch_contents(it->second);
+        }
+    }
 
-    // Don't fail if an error occurs
     return true;
 }
 
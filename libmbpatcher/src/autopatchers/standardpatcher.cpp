@@ -20,6 +20,8 @@
 #include "mbpatcher/autopatchers/standardpatcher.h"
 
 #include <optional>
+#include <string_view>
+#include <unordered_map>
 
 #include <cstring>
 
@@ -27,7 +29,6 @@
 #include "mblog/logging.h"
 
 #include "mbpatcher/edify/tokenizer.h"
-#include "mbpatcher/private/fileutils.h"
 
 #define LOG_TAG "mbpatcher/autopatchers/standardpatcher"
 
@@ -94,7 +95,7 @@ static bool find_items_in_string(const std::string &haystack,
     return false;
 }
 
-using TokenIter = std::vector<EdifyToken>::iterator;
+using TokenIter = EdifyTokens::const_iterator;
 
 struct FunctionBounds
 {
@@ -103,10 +104,49 @@ struct FunctionBounds
     TokenIter right_paren;
 };
 
+struct BlockDevs
+{
+    std::vector<std::string> system;
+    std::vector<std::string> cache;
+    std::vector<std::string> data;
+};
+
+static constexpr std::size_t NO_MATCH = static_cast<std::size_t>(-1);
+
+/*!
+ * \brief Match every left parenthesis with its right parenthesis
+ *
+ * \param tokens List of edify tokens
+ *
+ * \return Vector where the element at the index of each left parenthesis
+ *         holds the index of the matching right parenthesis (or NO_MATCH if
+ *         it is unterminated)
+ */
+static std::vector<std::size_t> match_parens(const EdifyTokens &tokens)
+{
+    std::vector<std::size_t> matches(tokens.size(), NO_MATCH);
+    std::vector<std::size_t> stack;
+
+    for (std::size_t i = 0; i < tokens.size(); ++i) {
+        if (std::holds_alternative<EdifyTokenLeftParen>(tokens[i])) {
+            stack.push_back(i);
+        } else if (std::holds_alternative<EdifyTokenRightParen>(tokens[i])
+                && !stack.empty()) {
+            matches[stack.back()] = i;
+            stack.pop_back();
+        }
+    }
+
+    return matches;
+}
+
 static std::optional<FunctionBounds>
-find_function(const TokenIter begin, const TokenIter end)
+find_function(const EdifyTokens &tokens,
+              const std::vector<std::size_t> &paren_matches,
+              const TokenIter begin)
 {
     FunctionBounds bounds;
+    auto const end = tokens.end();
 
     for (auto it = begin; it != end; ++it) {
         // Find string representing the function name
@@ -117,7 +157,6 @@ find_function(const TokenIter begin, const TokenIter end)
         bounds.func_name = it;
 
         bool found_left_paren = false;
-        bool found_right_paren = false;
 
         // Barring any whitespace, newlines, or comments, the function name
         // should be followed by a left parenthesis
@@ -139,29 +178,18 @@ find_function(const TokenIter begin, const TokenIter end)
             continue;
         }
 
-        // Left for matching right parenthesis
-        std::size_t depth = 0;
-
-        for (auto it2 = bounds.left_paren; it2 != end; ++it2) {
-            if (std::holds_alternative<EdifyTokenLeftParen>(*it2)) {
-                ++depth;
-            } else if (std::holds_alternative<EdifyTokenRightParen>(*it2)) {
-                --depth;
-            }
-            if (depth == 0) {
-                found_right_paren = true;
-                bounds.right_paren = it2;
-                break;
-            }
-        }
+        auto match = paren_matches[static_cast<std::size_t>(
+                bounds.left_paren - tokens.begin())];
 
         // If a right parenthesis was not found, but the function name and left
         // parenthesis were found, then assume there's a syntax error and bail
         // out
-        if (!found_right_paren) {
+        if (match == NO_MATCH) {
             return {};
         }
 
+        bounds.right_paren = tokens.begin() + static_cast<ptrdiff_t>(match);
+
         return bounds;
     }
 
@@ -171,56 +199,43 @@ find_function(const TokenIter begin, const TokenIter end)
 /*!
  * \brief Replace edify function
  *
- * \param tokens List of edify tokens
+ * \param edits Pending edits to the edify tokens
  * \param bounds Iterator bounds of the function to replace
  * \param replacement Replacement edify function (in string form)
  *
  * \return New iterator pointing to position *after* the right parenthesis of
- *         the replaced function. Returns tokens.end() if the replacement
+ *         the replaced function. Returns edits.tokens().end() if the replacement
  *         string could not be tokenized.
  */
 static TokenIter
-replace_function(std::vector<EdifyToken> &tokens,
+replace_function(EdifyTokenEdits &edits,
                  const FunctionBounds &bounds, const std::string &replacement)
 {
-    auto ret = EdifyTokenizer::tokenize(replacement);
-    if (!ret) {
+    auto end = bounds.right_paren + 1;
+
+    if (auto r = edits.replace(bounds.func_name, end, replacement); !r) {
         LOGE("Failed to tokenize replacement function string: %s: %s",
-             replacement.c_str(), ret.error().message().c_str());
-        return tokens.end();
+             replacement.c_str(), r.error().message().c_str());
+        return edits.tokens().end();
     }
-    auto &rtokens = ret.value();
-
-    // Remove replaced tokens
-    auto it = tokens.erase(bounds.func_name, bounds.right_paren + 1);
 
-    // Add replacement tokens
-    it = tokens.insert(it, rtokens.begin(), rtokens.end());
-
-    // Move iterator to the end of the replaced tokens
-    it += static_cast<ptrdiff_t>(rtokens.size());
-
-    return it;
+    return end;
 }
 
 /*!
  * \brief Replace edify mount() command
  *
- * \param tokens List of edify tokens
+ * \param edits Pending edits to the edify tokens
  * \param bounds Iterator bounds of the function to replace
- * \param system_devs List of system partition block devices
- * \param cache_devs List of cache partition block devices
- * \param data_devs List of data partition block devices
+ * \param devs Block devices belonging to each partition
  *
  * \return Iterator pointing to position immediately after the right parenthesis
- *         or tokens.end() if an error occurs.
+ *         or edits.tokens().end() if an error occurs.
  */
 static TokenIter
-replace_edify_mount(std::vector<EdifyToken> &tokens,
+replace_edify_mount(EdifyTokenEdits &edits,
                     const FunctionBounds &bounds,
-                    const std::vector<std::string> &system_devs,
-                    const std::vector<std::string> &cache_devs,
-                    const std::vector<std::string> &data_devs)
+                    const BlockDevs &devs)
 {
     // For the mount() edify function, replace with the corresponding
     // update-binary-tool command
@@ -230,24 +245,24 @@ replace_edify_mount(std::vector<EdifyToken> &tokens,
         }
 
         auto const &token = std::get<EdifyTokenString>(*it);
-        const std::string str = token.raw_string();
+        const std::string str(token.raw_string());
 
         bool is_system = str.find("/system") != std::string::npos
-                || find_items_in_string(str.c_str(), system_devs);
+                || find_items_in_string(str.c_str(), devs.system);
         bool is_cache = str.find("/cache") != std::string::npos
-                || find_items_in_string(str.c_str(), cache_devs);
+                || find_items_in_string(str.c_str(), devs.cache);
         bool is_data = str.find("/data") != std::string::npos
                 || str.find("/userdata") != std::string::npos
-                || find_items_in_string(str.c_str(), data_devs);
+                || find_items_in_string(str.c_str(), devs.data);
 
         if (is_system) {
-            return replace_function(tokens, bounds,
+            return replace_function(edits, bounds,
                                     format(MOUNT_FMT, "/system"));
         } else if (is_cache) {
-            return replace_function(tokens, bounds,
+            return replace_function(edits, bounds,
                                     format(MOUNT_FMT, "/cache"));
         } else if (is_data) {
-            return replace_function(tokens, bounds,
+            return replace_function(edits, bounds,
                                     format(MOUNT_FMT, "/data"));
         }
     }
@@ -257,21 +272,17 @@ replace_edify_mount(std::vector<EdifyToken> &tokens,
 /*!
  * \brief Replace edify unmount() command
  *
- * \param tokens List of edify tokens
+ * \param edits Pending edits to the edify tokens
  * \param bounds Iterator bounds of the function to replace
- * \param system_devs List of system partition block devices
- * \param cache_devs List of cache partition block devices
- * \param data_devs List of data partition block devices
+ * \param devs Block devices belonging to each partition
  *
  * \return Iterator pointing to position immediately after the right parenthesis
- *         or tokens.end() if an error occurs.
+ *         or edits.tokens().end() if an error occurs.
  */
 static TokenIter
-replace_edify_unmount(std::vector<EdifyToken> &tokens,
+replace_edify_unmount(EdifyTokenEdits &edits,
                       const FunctionBounds &bounds,
-                      const std::vector<std::string> &system_devs,
-                      const std::vector<std::string> &cache_devs,
-                      const std::vector<std::string> &data_devs)
+                      const BlockDevs &devs)
 {
     // For the unmount() edify function, replace with the corresponding
     // update-binary-tool command
@@ -281,24 +292,24 @@ replace_edify_unmount(std::vector<EdifyToken> &tokens,
         }
 
         auto const &token = std::get<EdifyTokenString>(*it);
-        const std::string str = token.raw_string();
+        const std::string str(token.raw_string());
 
         bool is_system = str.find("/system") != std::string::npos
-                || find_items_in_string(str.c_str(), system_devs);
+                || find_items_in_string(str.c_str(), devs.system);
         bool is_cache = str.find("/cache") != std::string::npos
-                || find_items_in_string(str.c_str(), cache_devs);
+                || find_items_in_string(str.c_str(), devs.cache);
         bool is_data = str.find("/data") != std::string::npos
                 || str.find("/userdata") != std::string::npos
-                || find_items_in_string(str.c_str(), data_devs);
+                || find_items_in_string(str.c_str(), devs.data);
 
         if (is_system) {
-            return replace_function(tokens, bounds,
+            return replace_function(edits, bounds,
                                     format(UNMOUNT_FMT, "/system"));
         } else if (is_cache) {
-            return replace_function(tokens, bounds,
+            return replace_function(edits, bounds,
                                     format(UNMOUNT_FMT, "/cache"));
         } else if (is_data) {
-            return replace_function(tokens, bounds,
+            return replace_function(edits, bounds,
                                     format(UNMOUNT_FMT, "/data"));
         }
     }
@@ -308,21 +319,17 @@ replace_edify_unmount(std::vector<EdifyToken> &tokens,
 /*!
  * \brief Replace edify run_program() command
  *
- * \param tokens List of edify tokens
+ * \param edits Pending edits to the edify tokens
  * \param bounds Iterator bounds of the function to replace
- * \param system_devs List of system partition block devices
- * \param cache_devs List of cache partition block devices
- * \param data_devs List of data partition block devices
+ * \param devs Block devices belonging to each partition
  *
  * \return Iterator pointing to position immediately after the right parenthesis
- *         or tokens.end() if an error occurs.
+ *         or edits.tokens().end() if an error occurs.
  */
 static TokenIter
-replace_edify_run_program(std::vector<EdifyToken> &tokens,
+replace_edify_run_program(EdifyTokenEdits &edits,
                           const FunctionBounds &bounds,
-                          const std::vector<std::string> &system_devs,
-                          const std::vector<std::string> &cache_devs,
-                          const std::vector<std::string> &data_devs)
+                          const BlockDevs &devs)
 {
     bool found_reboot = false;
     bool found_mount = false;
@@ -342,8 +349,8 @@ replace_edify_run_program(std::vector<EdifyToken> &tokens,
         auto ret = token.unescaped_string();
         if (!ret) {
             LOGE("Failed to unescape string token: %s: %s",
-                 token.raw_string().c_str(), ret.error().message().c_str());
-            return tokens.end();
+                 std::string(token.raw_string()).c_str(), ret.error().message().c_str());
+            return edits.tokens().end();
         }
         auto const &unescaped = ret.value();
 
@@ -364,57 +371,57 @@ replace_edify_run_program(std::vector<EdifyToken> &tokens,
         }
 
         if (unescaped.find("/system") != std::string::npos
-                || find_items_in_string(unescaped.c_str(), system_devs)) {
+                || find_items_in_string(unescaped.c_str(), devs.system)) {
             is_system = true;
         }
         if (unescaped.find("/cache") != std::string::npos
-                || find_items_in_string(unescaped.c_str(), cache_devs)) {
+                || find_items_in_string(unescaped.c_str(), devs.cache)) {
             is_cache = true;
         }
         if (unescaped.find("/data") != std::string::npos
                 || unescaped.find("/userdata") != std::string::npos
-                || find_items_in_string(unescaped.c_str(), data_devs)) {
+                || find_items_in_string(unescaped.c_str(), devs.data)) {
             is_data = true;
         }
     }
 
     if (found_reboot) {
-        return replace_function(tokens, bounds,
+        return replace_function(edits, bounds,
                                 "(ui_print(\"Removed reboot command\") == 0)");
     } else if (found_umount) {
         if (is_system) {
-            return replace_function(tokens, bounds,
+            return replace_function(edits, bounds,
                                     format(UNMOUNT_FMT, "/system"));
         } else if (is_cache) {
-            return replace_function(tokens, bounds,
+            return replace_function(edits, bounds,
                                     format(UNMOUNT_FMT, "/cache"));
         } else if (is_data) {
-            return replace_function(tokens, bounds,
+            return replace_function(edits, bounds,
                                     format(UNMOUNT_FMT, "/data"));
         }
     } else if (found_mount) {
         if (is_system) {
-            return replace_function(tokens, bounds,
+            return replace_function(edits, bounds,
                                     format(MOUNT_FMT, "/system"));
         } else if (is_cache) {
-            return replace_function(tokens, bounds,
+            return replace_function(edits, bounds,
                                     format(MOUNT_FMT, "/cache"));
         } else if (is_data) {
-            return replace_function(tokens, bounds,
+            return replace_function(edits, bounds,
                                     format(MOUNT_FMT, "/data"));
         }
     } else if (found_format_sh) {
-        return replace_function(tokens, bounds,
+        return replace_function(edits, bounds,
                                 format(FORMAT_FMT, "/system"));
     } else if (found_mke2fs) {
         if (is_system) {
-            return replace_function(tokens, bounds,
+            return replace_function(edits, bounds,
                                     format(FORMAT_FMT, "/system"));
         } else if (is_cache) {
-            return replace_function(tokens, bounds,
+            return replace_function(edits, bounds,
                                     format(FORMAT_FMT, "/cache"));
         } else if (is_data) {
-            return replace_function(tokens, bounds,
+            return replace_function(edits, bounds,
                                     format(FORMAT_FMT, "/data"));
         }
     }
@@ -425,16 +432,20 @@ replace_edify_run_program(std::vector<EdifyToken> &tokens,
 /*!
  * \brief Replace edify delete_recursive() command
  *
- * \param tokens List of edify tokens
+ * \param edits Pending edits to the edify tokens
  * \param bounds Iterator bounds of the function to replace
+ * \param devs Unused
  *
  * \return Iterator pointing to position immediately after the right parenthesis
- *         or tokens.end() if an error occurs.
+ *         or edits.tokens().end() if an error occurs.
  */
 static TokenIter
-replace_edify_delete_recursive(std::vector<EdifyToken> &tokens,
-                               const FunctionBounds &bounds)
+replace_edify_delete_recursive(EdifyTokenEdits &edits,
+                               const FunctionBounds &bounds,
+                               const BlockDevs &devs)
 {
+    (void) devs;
+
     for (auto it = bounds.left_paren + 1; it != bounds.right_paren; ++it) {
         if (!std::holds_alternative<EdifyTokenString>(*it)) {
             continue;
@@ -444,16 +455,16 @@ replace_edify_delete_recursive(std::vector<EdifyToken> &tokens,
         auto ret = token.unescaped_string();
         if (!ret) {
             LOGE("Failed to unescape string token: %s: %s",
-                 token.raw_string().c_str(), ret.error().message().c_str());
-            return tokens.end();
+                 std::string(token.raw_string()).c_str(), ret.error().message().c_str());
+            return edits.tokens().end();
         }
         auto const &unescaped = ret.value();
 
         if (unescaped == "/system" || unescaped == "/system/") {
-            return replace_function(tokens, bounds,
+            return replace_function(edits, bounds,
                                     format(FORMAT_FMT, "/system"));
         } else if (unescaped == "/cache" || unescaped == "/cache/") {
-            return replace_function(tokens, bounds,
+            return replace_function(edits, bounds,
                                     format(FORMAT_FMT, "/cache"));
         }
     }
@@ -463,21 +474,17 @@ replace_edify_delete_recursive(std::vector<EdifyToken> &tokens,
 /*!
  * \brief Replace edify format() command
  *
- * \param tokens List of edify tokens
+ * \param edits Pending edits to the edify tokens
  * \param bounds Iterator bounds of the function to replace
- * \param system_devs List of system partition block devices
- * \param cache_devs List of cache partition block devices
- * \param data_devs List of data partition block devices
+ * \param devs Block devices belonging to each partition
  *
  * \return Iterator pointing to position immediately after the right parenthesis
- *         or tokens.end() if an error occurs.
+ *         or edits.tokens().end() if an error occurs.
  */
 static TokenIter
-replace_edify_format(std::vector<EdifyToken> &tokens,
+replace_edify_format(EdifyTokenEdits &edits,
                      const FunctionBounds &bounds,
-                     const std::vector<std::string> &system_devs,
-                     const std::vector<std::string> &cache_devs,
-                     const std::vector<std::string> &data_devs)
+                     const BlockDevs &devs)
 {
     // For the format() edify function, replace with the corresponding
     // update-binary-tool command
@@ -487,54 +494,60 @@ replace_edify_format(std::vector<EdifyToken> &tokens,
         }
 
         auto const &token = std::get<EdifyTokenString>(*it);
-        const std::string str = token.raw_string();
+        const std::string str(token.raw_string());
 
         bool is_system = str.find("/system") != std::string::npos
-                || find_items_in_string(str.c_str(), system_devs);
+                || find_items_in_string(str.c_str(), devs.system);
         bool is_cache = str.find("/cache") != std::string::npos
-                || find_items_in_string(str.c_str(), cache_devs);
+                || find_items_in_string(str.c_str(), devs.cache);
         bool is_data = str.find("/data") != std::string::npos
                 || str.find("/userdata") != std::string::npos
-                || find_items_in_string(str.c_str(), data_devs);
+                || find_items_in_string(str.c_str(), devs.data);
 
         if (is_system) {
-            return replace_function(tokens, bounds,
+            return replace_function(edits, bounds,
                                     format(FORMAT_FMT, "/system"));
         } else if (is_cache) {
-            return replace_function(tokens, bounds,
+            return replace_function(edits, bounds,
                                     format(FORMAT_FMT, "/cache"));
         } else if (is_data) {
-            return replace_function(tokens, bounds,
+            return replace_function(edits, bounds,
                                     format(FORMAT_FMT, "/data"));
         }
     }
     return bounds.right_paren + 1;
 }
 
-bool StandardPatcher::patch_files(const std::string &directory)
+using ReplaceFn = TokenIter (*)(EdifyTokenEdits &edits,
+                                const FunctionBounds &bounds,
+                                const BlockDevs &devs);
+
+/*! Edify functions that are rewritten, keyed by function name */
+static const std::unordered_map<std::string_view, ReplaceFn> REPLACERS{
+    { "mount",            replace_edify_mount },
+    { "unmount",          replace_edify_unmount },
+    { "run_program",      replace_edify_run_program },
+    { "delete_recursive", replace_edify_delete_recursive },
+    { "format",           replace_edify_format },
+};
+
+bool StandardPatcher::patch_data(FileMap &files)
 {
-    if (!patch_updater(directory)) {
+    if (auto it = files.find(UpdaterScript);
+            it != files.end() && !patch_updater(it->second)) {
         return false;
     }
 
-    if (!patch_transfer_list(directory)) {
+    if (auto it = files.find(SystemTransferList);
+            it != files.end() && !patch_transfer_list(it->second)) {
         return false;
     }
 
     return true;
 }
 
-bool StandardPatcher::patch_updater(const std::string &directory)
+bool StandardPatcher::patch_updater(std::string &contents)
 {
-    std::string contents;
-    std::string path;
-
-    path += directory;
-    path += "/";
-    path += UpdaterScript;
-
-    FileUtils::read_to_string(path, &contents);
-
     if (starts_with(contents, "#!")) {
         // Ignore any script with a shebang line
         return true;
@@ -547,55 +560,55 @@ bool StandardPatcher::patch_updater(const std::string &directory)
         return false;
     }
     auto &tokens = ret.value();
+    EdifyTokenEdits edits(tokens);
 
 #if DUMP_DEBUG
     EdifyTokenizer::dump(tokens);
 #endif
 
     auto &&device = m_info.device();
-    auto system_devs = device.system_block_devs();
-    auto cache_devs = device.cache_block_devs();
-    auto data_devs = device.data_block_devs();
+    BlockDevs devs{
+        device.system_block_devs(),
+        device.cache_block_devs(),
+        device.data_block_devs(),
+    };
+
+    // Matching parentheses are computed once so that finding the bounds of
+    // each function does not rescan its arguments
+    auto paren_matches = match_parens(tokens);
 
     TokenIter begin = tokens.begin();
-    TokenIter end;
 
     while (true) {
-        end = tokens.end();
-
         // Need to find:
         // 1. String containing function name
         // 2. Left parenthesis for the function
         // 3. Right parenthesis for the function
-        auto bounds = find_function(begin, end);
+        auto bounds = find_function(tokens, paren_matches, begin);
         if (!bounds) {
             break;
         }
 
-        // Tokens (types are checked by findFunction())
+        // Tokens (types are checked by find_function())
         auto const &t_func_name = std::get<EdifyTokenString>(*bounds->func_name);
-        auto unescaped = t_func_name.unescaped_string();
-        if (!unescaped) {
-            LOGE("Failed to unescape string token: %s: %s",
-                 t_func_name.raw_string().c_str(),
-                 unescaped.error().message().c_str());
-            return false;
+        std::string unescaped;
+
+        if (t_func_name.quoted()) {
+            auto ret = t_func_name.unescaped_string();
+            if (!ret) {
+                LOGE("Failed to unescape string token: %s: %s",
+                     std::string(t_func_name.raw_string()).c_str(),
+                     ret.error().message().c_str());
+                return false;
+            }
+            unescaped = std::move(ret.value());
         }
 
-        if (unescaped.value() == "mount") {
-            begin = replace_edify_mount(tokens, *bounds,
-                                        system_devs, cache_devs, data_devs);
-        } else if (unescaped.value() == "unmount") {
-            begin = replace_edify_unmount(tokens, *bounds,
-                                          system_devs, cache_devs, data_devs);
-        } else if (unescaped.value() == "run_program") {
-            begin = replace_edify_run_program(tokens, *bounds,
-                                              system_devs, cache_devs, data_devs);
-        } else if (unescaped.value() == "delete_recursive") {
-            begin = replace_edify_delete_recursive(tokens, *bounds);
-        } else if (unescaped.value() == "format") {
-            begin = replace_edify_format(tokens, *bounds,
-                                         system_devs, cache_devs, data_devs);
+        auto name = t_func_name.quoted()
+                ? std::string_view(unescaped) : t_func_name.raw_string();
+
+        if (auto it = REPLACERS.find(name); it != REPLACERS.end()) {
+            begin = it->second(edits, *bounds, devs);
         } else {
             // Only skip function name so that we catch nested function calls
             begin = bounds->func_name + 1;
@@ -606,41 +619,47 @@ bool StandardPatcher::patch_updater(const std::string &directory)
         }
     }
 
+    // The tokens reference the original contents, so the output must be built
+    // before it is replaced
+    contents = edits.untokenize();
+
 #if DUMP_DEBUG
-    EdifyTokenizer::dump(tokens);
+    if (auto r = EdifyTokenizer::tokenize(contents)) {
+        EdifyTokenizer::dump(r.value());
+    }
 #endif
 
-    FileUtils::write_from_string(path, EdifyTokenizer::untokenize(tokens));
-
     return true;
 }
 
-bool StandardPatcher::patch_transfer_list(const std::string &directory)
+bool StandardPatcher::patch_transfer_list(std::string &contents)
 {
-    std::string contents;
-    std::string path;
-
-    path += directory;
-    path += "/";
-    path += SystemTransferList;
+    // Drop "erase" commands by compacting the remaining lines in place
+    std::size_t out = 0;
+    std::size_t pos = 0;
+    bool first = true;
 
-    auto ret = FileUtils::read_to_string(path, &contents);
-    if (ret != ErrorCode::NoError) {
-        return ret == ErrorCode::FileOpenError;
-    }
+    while (true) {
+        auto newline = contents.find('\n', pos);
+        auto line_end = newline == std::string::npos ? contents.size() : newline;
+        std::string_view line(contents.data() + pos, line_end - pos);
 
-    auto lines = split_sv(contents, '\n');
+        if (!starts_with(line, "erase ")) {
+            if (!first) {
+                contents[out++] = '\n';
+            }
+            std::memmove(&contents[out], line.data(), line.size());
+            out += line.size();
+            first = false;
+        }
 
-    for (auto it = lines.begin(); it != lines.end();) {
-        if (starts_with(*it, "erase ")) {
-            it = lines.erase(it);
-        } else {
-            ++it;
+        if (newline == std::string::npos) {
+            break;
         }
+        pos = newline + 1;
     }
 
-    contents = join(lines, "\n");
-    FileUtils::write_from_string(path, contents);
+    contents.resize(out);
 
     return true;
 }
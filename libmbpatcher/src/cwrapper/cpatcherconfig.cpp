@@ -155,6 +155,66 @@ void mbpatcher_config_set_temp_directory(CPatcherConfig *pc, char *path)
     config->set_temp_directory(path);
 }
 
+/*!
+ * \brief Get how large sparse images are stored in patched zips
+ *
+ * \param pc CPatcherConfig object
+ * \return Compression policy for large sparse images
+ *
+ * \sa PatcherConfig::image_compression()
+ */
+/* enum ImageCompression */ int
+mbpatcher_config_image_compression(const CPatcherConfig *pc)
+{
+    CCAST(pc);
+    return static_cast<int>(config->image_compression());
+}
+
+/*!
+ * \brief Get the size at which a sparse image is considered large
+ *
+ * \param pc CPatcherConfig object
+ * \return Size threshold in bytes
+ *
+ * \sa PatcherConfig::image_compression_threshold()
+ */
+uint64_t mbpatcher_config_image_compression_threshold(const CPatcherConfig *pc)
+{
+    CCAST(pc);
+    return config->image_compression_threshold();
+}
+
+/*!
+ * \brief Set how large sparse images are stored in patched zips
+ *
+ * \param pc CPatcherConfig object
+ * \param compression Compression policy for large sparse images
+ *
+ * \sa PatcherConfig::set_image_compression()
+ */
+void mbpatcher_config_set_image_compression(CPatcherConfig *pc,
+                                            /* enum ImageCompression */ int compression)
+{
+    CAST(pc);
+    config->set_image_compression(
+            static_cast<mb::patcher::ImageCompression>(compression));
+}
+
+/*!
+ * \brief Set the size at which a sparse image is considered large
+ *
+ * \param pc CPatcherConfig object
+ * \param size Size threshold in bytes
+ *
+ * \sa PatcherConfig::set_image_compression_threshold()
+ */
+void mbpatcher_config_set_image_compression_threshold(CPatcherConfig *pc,
+                                                      uint64_t size)
+{
+    CAST(pc);
+    config->set_image_compression_threshold(size);
+}
+
 /*!
  * \brief Get list of Patcher IDs
  *
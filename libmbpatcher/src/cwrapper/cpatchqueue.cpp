@@ -0,0 +1,224 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbpatcher/cwrapper/cpatchqueue.h"
+
+#include <cassert>
+
+#include "mbpatcher/patcherconfig.h"
+#include "mbpatcher/patchqueue.h"
+
+
+#define CAST(x) \
+    assert(x != nullptr); \
+    auto *q = reinterpret_cast<mb::patcher::PatchQueue *>(x);
+#define CCAST(x) \
+    assert(x != nullptr); \
+    auto const *q = reinterpret_cast<const mb::patcher::PatchQueue *>(x);
+
+
+/*!
+ * \file cpatchqueue.h
+ * \brief C Wrapper for PatchQueue
+ *
+ * Please see the documentation for PatchQueue from the C++ API for more
+ * details. The C functions directly correspond to the PatchQueue member
+ * functions.
+ *
+ * \sa PatchQueue
+ */
+
+extern "C"
+{
+
+/*!
+ * \brief Create a new CPatchQueue object.
+ *
+ * \note The returned object must be freed with mbpatcher_queue_destroy().
+ *
+ * \note The callbacks are called from the worker threads.
+ *
+ * \param pc CPatcherConfig to create patchers from
+ * \param max_jobs Maximum number of concurrent jobs (0 for number of CPUs)
+ * \param progress_cb Callback for receiving current progress values
+ * \param files_cb Callback for receiving current files count
+ * \param details_cb Callback for receiving detailed progress text
+ * \param finished_cb Callback for receiving the final state and error of jobs
+ * \param userdata Pointer to pass to callback functions
+ * \return New CPatchQueue
+ */
+CPatchQueue * mbpatcher_queue_create(CPatcherConfig *pc,
+                                     unsigned int max_jobs,
+                                     PatchQueueProgressCallback progress_cb,
+                                     PatchQueueFilesCallback files_cb,
+                                     PatchQueueDetailsCallback details_cb,
+                                     PatchQueueFinishedCallback finished_cb,
+                                     void *userdata)
+{
+    assert(pc != nullptr);
+    auto *config = reinterpret_cast<mb::patcher::PatcherConfig *>(pc);
+
+    mb::patcher::PatchQueue::Callbacks callbacks;
+
+    if (progress_cb) {
+        callbacks.progress = [=](size_t job, uint64_t bytes,
+                                 uint64_t max_bytes) {
+            progress_cb(job, bytes, max_bytes, userdata);
+        };
+    }
+    if (files_cb) {
+        callbacks.files = [=](size_t job, uint64_t files, uint64_t max_files) {
+            files_cb(job, files, max_files, userdata);
+        };
+    }
+    if (details_cb) {
+        callbacks.details = [=](size_t job, const std::string &text) {
+            details_cb(job, text.c_str(), userdata);
+        };
+    }
+    if (finished_cb) {
+        callbacks.finished = [=](size_t job,
+                                 mb::patcher::PatchQueue::JobState state,
+                                 mb::patcher::ErrorCode error) {
+            finished_cb(job, static_cast<int>(state), static_cast<int>(error),
+                        userdata);
+        };
+    }
+
+    return reinterpret_cast<CPatchQueue *>(new mb::patcher::PatchQueue(
+            *config, std::move(callbacks), max_jobs));
+}
+
+/*!
+ * \brief Cancels all jobs and destroys a CPatchQueue object.
+ *
+ * \param queue CPatchQueue to destroy
+ */
+void mbpatcher_queue_destroy(CPatchQueue *queue)
+{
+    CAST(queue);
+    delete q;
+}
+
+/*!
+ * \brief Add a file to the queue
+ *
+ * \param queue CPatchQueue object
+ * \param patcher_id ID of the patcher to use
+ * \param info CFileInfo describing the file to patch. It is copied.
+ * \return Index of the new job
+ *
+ * \sa PatchQueue::submit()
+ */
+size_t mbpatcher_queue_submit(CPatchQueue *queue, const char *patcher_id,
+                              const CFileInfo *info)
+{
+    CAST(queue);
+    assert(info != nullptr);
+    return q->submit(patcher_id,
+                     *reinterpret_cast<const mb::patcher::FileInfo *>(info));
+}
+
+/*!
+ * \brief Cancel a job
+ *
+ * \param queue CPatchQueue object
+ * \param job Index of the job
+ *
+ * \sa PatchQueue::cancel()
+ */
+void mbpatcher_queue_cancel(CPatchQueue *queue, size_t job)
+{
+    CAST(queue);
+    q->cancel(job);
+}
+
+/*!
+ * \brief Cancel all queued and running jobs
+ *
+ * \param queue CPatchQueue object
+ *
+ * \sa PatchQueue::cancel_all()
+ */
+void mbpatcher_queue_cancel_all(CPatchQueue *queue)
+{
+    CAST(queue);
+    q->cancel_all();
+}
+
+/*!
+ * \brief Wait for all submitted jobs to finish
+ *
+ * \param queue CPatchQueue object
+ *
+ * \sa PatchQueue::wait()
+ */
+void mbpatcher_queue_wait(CPatchQueue *queue)
+{
+    CAST(queue);
+    q->wait();
+}
+
+/*!
+ * \brief Get the number of submitted jobs
+ *
+ * \param queue CPatchQueue object
+ * \return Number of jobs
+ *
+ * \sa PatchQueue::size()
+ */
+size_t mbpatcher_queue_size(const CPatchQueue *queue)
+{
+    CCAST(queue);
+    return q->size();
+}
+
+/*!
+ * \brief Get the state of a job
+ *
+ * \param queue CPatchQueue object
+ * \param job Index of the job
+ * \return JobState
+ *
+ * \sa PatchQueue::state()
+ */
+/* enum JobState */ int mbpatcher_queue_job_state(const CPatchQueue *queue,
+                                                  size_t job)
+{
+    CCAST(queue);
+    return static_cast<int>(q->state(job));
+}
+
+/*!
+ * \brief Get the error of a failed job
+ *
+ * \param queue CPatchQueue object
+ * \param job Index of the job
+ * \return ErrorCode
+ *
+ * \sa PatchQueue::error()
+ */
+/* enum ErrorCode */ int mbpatcher_queue_job_error(const CPatchQueue *queue,
+                                                  size_t job)
+{
+    CCAST(queue);
+    return static_cast<int>(q->error(job));
+}
+
+}
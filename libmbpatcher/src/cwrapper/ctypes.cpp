@@ -20,3 +20,8 @@
  * \typedef CPatcherConfig
  * \brief C wrapper for PatcherConfig object
  */
+
+/*!
+ * \typedef CPatchQueue
+ * \brief C wrapper for PatchQueue object
+ */
@@ -19,6 +19,8 @@
 
 #include "mbpatcher/edify/tokenizer.h"
 
+#include <algorithm>
+
 #include <cassert>
 #include <cstring>
 
@@ -77,8 +79,34 @@ std::string EdifyErrorCategory::message(int ev) const
     }
 }
 
+/*! Minimum size of each arena block */
+static constexpr std::size_t ARENA_BLOCK_SIZE = 16 * 1024;
+
+EdifyStringArena::EdifyStringArena()
+    : m_cur(nullptr)
+    , m_avail(0)
+{
+}
+
+std::string_view EdifyStringArena::store(std::string_view str)
+{
+    if (str.size() > m_avail) {
+        std::size_t size = std::max(str.size(), ARENA_BLOCK_SIZE);
+        m_blocks.push_back(std::make_unique<char[]>(size));
+        m_cur = m_blocks.back().get();
+        m_avail = size;
+    }
+
+    char *ptr = m_cur;
+    std::copy(str.begin(), str.end(), ptr);
+    m_cur += str.size();
+    m_avail -= str.size();
+
+    return {ptr, str.size()};
+}
+
 oc::result<EdifyTokenString>
-EdifyTokenString::from_raw(std::string str, bool quoted)
+EdifyTokenString::from_raw(std::string_view str, bool quoted)
 {
     if (quoted && (str.size() < 2 || str.front() != '"' || str.back() != '"')) {
         return EdifyError::ValueNotQuoted;
@@ -86,17 +114,14 @@ EdifyTokenString::from_raw(std::string str, bool quoted)
 
     EdifyTokenString token;
     token.m_quoted = quoted;
-    if (quoted) {
-        token.m_str = str.substr(1, str.size() - 2);
-    } else {
-        token.m_str = std::move(str);
-    }
+    token.m_raw = str;
 
     return std::move(token);
 }
 
 oc::result<EdifyTokenString>
-EdifyTokenString::from_string(std::string str, bool make_quoted)
+EdifyTokenString::from_string(std::string_view str, bool make_quoted,
+                              EdifyStringArena &arena)
 {
     if (!make_quoted) {
         for (char c : str) {
@@ -109,40 +134,39 @@ EdifyTokenString::from_string(std::string str, bool make_quoted)
     EdifyTokenString token;
     token.m_quoted = make_quoted;
     if (make_quoted) {
-        token.m_str = escape(str);
+        std::string buf;
+        buf += '"';
+        buf += escape(str);
+        buf += '"';
+        token.m_raw = arena.store(buf);
     } else {
-        token.m_str = std::move(str);
+        token.m_raw = arena.store(str);
     }
 
     return std::move(token);
 }
 
-std::string EdifyTokenString::generate() const
+std::string_view EdifyTokenString::generate() const
 {
-    std::string buf;
-    buf.reserve(2 + m_str.size());
-    if (m_quoted) {
-        buf += '"';
-    }
-    buf += m_str;
-    if (m_quoted) {
-        buf += '"';
-    }
-    return buf;
+    return m_raw;
 }
 
 oc::result<std::string> EdifyTokenString::unescaped_string() const
 {
     if (m_quoted) {
-        return unescape(m_str);
+        return unescape(raw_string());
     } else {
-        return m_str;
+        return std::string(m_raw);
     }
 }
 
-std::string EdifyTokenString::raw_string() const
+std::string_view EdifyTokenString::raw_string() const
 {
-    return m_str;
+    if (m_quoted) {
+        return m_raw.substr(1, m_raw.size() - 2);
+    } else {
+        return m_raw;
+    }
 }
 
 bool EdifyTokenString::quoted() const
@@ -270,13 +294,84 @@ oc::result<std::string> EdifyTokenString::unescape(std::string_view str)
     return std::move(output);
 }
 
-static std::string generate_token(const EdifyToken &token)
+static std::string_view generate_token(const EdifyToken &token)
 {
-    return std::visit([](auto &&t) {
+    return std::visit([](auto &&t) -> std::string_view {
         return t.generate();
     }, token);
 }
 
+static void append_tokens(std::string &output,
+                          EdifyTokens::const_iterator begin,
+                          EdifyTokens::const_iterator end)
+{
+    for (auto it = begin; it != end; ++it) {
+        output += generate_token(*it);
+    }
+}
+
+static std::size_t tokens_size(EdifyTokens::const_iterator begin,
+                               EdifyTokens::const_iterator end)
+{
+    std::size_t size = 0;
+    for (auto it = begin; it != end; ++it) {
+        size += generate_token(*it).size();
+    }
+    return size;
+}
+
+EdifyTokenEdits::EdifyTokenEdits(const EdifyTokens &tokens)
+    : m_tokens(tokens)
+{
+}
+
+oc::result<void>
+EdifyTokenEdits::replace(EdifyTokens::const_iterator begin,
+                         EdifyTokens::const_iterator end,
+                         std::string_view replacement)
+{
+    auto begin_index = static_cast<std::size_t>(begin - m_tokens.begin());
+    auto end_index = static_cast<std::size_t>(end - m_tokens.begin());
+
+    assert(begin_index <= end_index && end_index <= m_tokens.size());
+    assert(m_pieces.empty() || m_pieces.back().end <= begin_index);
+
+    OUTCOME_TRY(tokens, EdifyTokenizer::tokenize(m_arena.store(replacement)));
+
+    m_pieces.push_back({begin_index, end_index, std::move(tokens)});
+
+    return oc::success();
+}
+
+std::string EdifyTokenEdits::untokenize() const
+{
+    auto begin = m_tokens.begin();
+    std::size_t size = tokens_size(m_tokens.begin(), m_tokens.end());
+
+    for (auto const &piece : m_pieces) {
+        size -= tokens_size(begin + static_cast<ptrdiff_t>(piece.begin),
+                            begin + static_cast<ptrdiff_t>(piece.end));
+        size += tokens_size(piece.tokens.begin(), piece.tokens.end());
+    }
+
+    std::string output;
+    output.reserve(size);
+
+    std::size_t index = 0;
+
+    for (auto const &piece : m_pieces) {
+        append_tokens(output, begin + static_cast<ptrdiff_t>(index),
+                      begin + static_cast<ptrdiff_t>(piece.begin));
+        append_tokens(output, piece.tokens.begin(), piece.tokens.end());
+        index = piece.end;
+    }
+
+    append_tokens(output, begin + static_cast<ptrdiff_t>(index),
+                  m_tokens.end());
+
+    return output;
+}
+
 oc::result<EdifyToken> EdifyTokenizer::next_token(std::string_view str,
                                                   std::size_t &consumed)
 {
@@ -328,39 +423,29 @@ oc::result<EdifyToken> EdifyTokenizer::next_token(std::string_view str,
         consumed = 1;
         return EdifyTokenNewline();
     } else if (char c = str.front(); c != '\n' && std::isspace(c)) {
-        std::string buf;
-        buf += c;
         consumed = 1;
         for (auto it = str.begin() + 1;
                 it != str.end() && *it != '\n' && std::isspace(*it); ++it) {
-            buf += *it;
             consumed += 1;
         }
-        return EdifyTokenWhitespace(std::move(buf));
+        return EdifyTokenWhitespace(str.substr(0, consumed));
     } else if (str.front() == '#') {
-        std::string buf;
-        // Omit '#' character
         consumed = 1;
         for (auto it = str.begin() + 1; it != str.end() && *it != '\n'; ++it) {
-            buf += *it;
             consumed += 1;
         }
-        return EdifyTokenComment(std::move(buf));
+        return EdifyTokenComment(str.substr(0, consumed));
     } else if (char c = str.front(); EdifyTokenString::is_valid_unquoted(c)) {
-        std::string buf;
-        buf += c;
         consumed = 1;
         for (auto it = str.begin() + 1;
                 it != str.end() && EdifyTokenString::is_valid_unquoted(*it);
                 ++it) {
-            buf += *it;
             consumed += 1;
         }
-        OUTCOME_TRY(r, EdifyTokenString::from_raw(std::move(buf), false));
+        OUTCOME_TRY(r, EdifyTokenString::from_raw(
+                str.substr(0, consumed), false));
         return std::move(r);
     } else if (char c = str.front(); c == '"') {
-        std::string buf;
-        buf += c;
         consumed = 1;
         bool escaped = false;
         bool terminated = false;
@@ -368,29 +453,27 @@ oc::result<EdifyToken> EdifyTokenizer::next_token(std::string_view str,
             if (*it == '\\' || escaped) {
                 escaped = !escaped;
             } else if (!escaped && *it == '"') {
-                buf += *it;
                 consumed += 1;
                 terminated = true;
                 break;
             }
-            buf += *it;
             consumed += 1;
         }
         if (!terminated) {
             return EdifyError::UnterminatedQuote;
         }
-        OUTCOME_TRY(r,  EdifyTokenString::from_raw(std::move(buf), true));
+        OUTCOME_TRY(r, EdifyTokenString::from_raw(
+                str.substr(0, consumed), true));
         return std::move(r);
     } else {
         consumed = 1;
-        return EdifyTokenUnknown(str.front());
+        return EdifyTokenUnknown(str.substr(0, 1));
     }
 }
 
-oc::result<std::vector<EdifyToken>>
-EdifyTokenizer::tokenize(std::string_view str)
+oc::result<EdifyTokens> EdifyTokenizer::tokenize(std::string_view str)
 {
-    std::vector<EdifyToken> temp;
+    EdifyTokens temp;
 
     while (true) {
         if (str.empty()) {
@@ -407,22 +490,21 @@ EdifyTokenizer::tokenize(std::string_view str)
     return std::move(temp);
 }
 
-std::string EdifyTokenizer::untokenize(const std::vector<EdifyToken> &tokens)
+std::string EdifyTokenizer::untokenize(const EdifyTokens &tokens)
 {
     return untokenize(tokens.begin(), tokens.end());
 }
 
-std::string EdifyTokenizer::untokenize(std::vector<EdifyToken>::const_iterator begin,
-                                       std::vector<EdifyToken>::const_iterator end)
+std::string EdifyTokenizer::untokenize(EdifyTokens::const_iterator begin,
+                                       EdifyTokens::const_iterator end)
 {
     std::string output;
-    for (auto it = begin; it != end; ++it) {
-        output += generate_token(*it);
-    }
+    output.reserve(tokens_size(begin, end));
+    append_tokens(output, begin, end);
     return output;
 }
 
-void EdifyTokenizer::dump(const std::vector<EdifyToken> &tokens)
+void EdifyTokenizer::dump(const EdifyTokens &tokens)
 {
     for (std::size_t i = 0; i < tokens.size(); ++i) {
         auto const &t = tokens[i];
@@ -473,8 +555,10 @@ void EdifyTokenizer::dump(const std::vector<EdifyToken> &tokens)
             t
         );
 
-        LOGD("%" MB_PRIzu ": %-20s: %s",
-             i, token_name, generate_token(t).c_str());
+        auto str = generate_token(t);
+
+        LOGD("%" MB_PRIzu ": %-20s: %.*s",
+             i, token_name, static_cast<int>(str.size()), str.data());
     }
 }
 
@@ -111,6 +111,51 @@ void PatcherConfig::set_temp_directory(std::string path)
     m_temp_dir = std::move(path);
 }
 
+/*!
+ * \brief Get how large sparse images are stored in patched zips
+ *
+ * The default is ImageCompression::Lz4.
+ *
+ * \return Compression policy for large sparse images
+ */
+ImageCompression PatcherConfig::image_compression() const
+{
+    return m_image_compression;
+}
+
+/*!
+ * \brief Get the size at which a sparse image is considered large
+ *
+ * Sparse images smaller than this are always deflated. Images whose size is
+ * not known in advance are treated as large.
+ *
+ * \return Size threshold in bytes
+ */
+uint64_t PatcherConfig::image_compression_threshold() const
+{
+    return m_image_compression_threshold;
+}
+
+/*!
+ * \brief Set how large sparse images are stored in patched zips
+ *
+ * \param compression Compression policy for large sparse images
+ */
+void PatcherConfig::set_image_compression(ImageCompression compression)
+{
+    m_image_compression = compression;
+}
+
+/*!
+ * \brief Set the size at which a sparse image is considered large
+ *
+ * \param size Size threshold in bytes
+ */
+void PatcherConfig::set_image_compression_threshold(uint64_t size)
+{
+    m_image_compression_threshold = size;
+}
+
 /*!
  * \brief Get list of Patcher IDs
  *
@@ -163,6 +208,7 @@ Patcher * PatcherConfig::create_patcher(const std::string &id)
     }
 
     auto *ptr = p.get();
+    std::lock_guard<std::mutex> lock(m_mutex);
     m_patchers.push_back(std::move(p));
     return ptr;
 }
@@ -193,6 +239,7 @@ AutoPatcher * PatcherConfig::create_auto_patcher(const std::string &id,
     }
 
     auto *ptr = ap.get();
+    std::lock_guard<std::mutex> lock(m_mutex);
     m_auto_patchers.push_back(std::move(ap));
     return ptr;
 }
@@ -204,6 +251,8 @@ AutoPatcher * PatcherConfig::create_auto_patcher(const std::string &id,
  */
 void PatcherConfig::destroy_patcher(Patcher *patcher)
 {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
     auto it = std::find_if(
         m_patchers.begin(),
         m_patchers.end(),
@@ -222,6 +271,8 @@ void PatcherConfig::destroy_patcher(Patcher *patcher)
  */
 void PatcherConfig::destroy_auto_patcher(AutoPatcher *patcher)
 {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
     auto it = std::find_if(
         m_auto_patchers.begin(),
         m_auto_patchers.end(),
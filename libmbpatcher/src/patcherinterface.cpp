@@ -0,0 +1,56 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbpatcher/patcherinterface.h"
+
+#include "mbpatcher/private/fileutils.h"
+
+
+namespace mb::patcher
+{
+
+bool AutoPatcher::patch_files(const std::string &directory)
+{
+    FileMap files;
+
+    for (auto const &file : existing_files()) {
+        std::string contents;
+
+        if (FileUtils::read_to_string(directory + "/" + file, &contents)
+                == ErrorCode::NoError) {
+            files.emplace(file, std::move(contents));
+        }
+    }
+
+    if (!patch_data(files)) {
+        return false;
+    }
+
+    for (auto const &[file, contents] : files) {
+        auto ret = FileUtils::write_from_string(directory + "/" + file,
+                                                contents);
+        if (ret != ErrorCode::NoError) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+}
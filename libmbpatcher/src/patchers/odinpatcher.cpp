@@ -28,12 +28,18 @@
 #include <cinttypes>
 #include <cstring>
 
+#include <lz4frame.h>
+#include <zlib.h>
+
 #ifdef __ANDROID__
 #  include <cerrno>
 #endif
 
+#include "mbcommon/crc32.h"
+#include "mbcommon/finally.h"
 #include "mbcommon/integer.h"
 #include "mbcommon/locale.h"
+#include "mbcommon/perf.h"
 #include "mbcommon/string.h"
 
 #include "mbdevice/json.h"
@@ -42,6 +48,7 @@
 
 #include "mbpatcher/patcherconfig.h"
 #include "mbpatcher/patchers/zippatcher.h"
+#include "mbpatcher/private/deflateutils.h"
 #include "mbpatcher/private/fileutils.h"
 #include "mbpatcher/private/miniziputils.h"
 
@@ -56,6 +63,10 @@ namespace mb::patcher
 
 const std::string OdinPatcher::Id("OdinPatcher");
 
+// Time spent in each phase of patching a tarball (in microseconds)
+static perf::Histogram g_contents_time("patcher.odin.contents");
+static perf::Histogram g_extras_time("patcher.odin.extras");
+
 
 OdinPatcher::OdinPatcher(PatcherConfig &pc)
     : m_pc(pc)
@@ -65,11 +76,11 @@ OdinPatcher::OdinPatcher(PatcherConfig &pc)
     , m_max_bytes(0)
     , m_cancelled(0)
     , m_error()
-    , m_la_buf()
     , m_la_file()
 #ifdef __ANDROID__
     , m_fd(-1)
 #endif
+    , m_la_reader(&m_la_file)
     , m_added_files()
     , m_progress_cb()
     , m_details_cb()
@@ -200,10 +211,17 @@ bool OdinPatcher::patch_tar()
 
     if (m_cancelled) return false;
 
-    if (!process_contents(m_a_input, 0, nullptr)) {
-        return false;
+    {
+        perf::ScopedTimer timer(g_contents_time);
+
+        if (!process_contents(m_a_input, 0, nullptr)) {
+            return false;
+        }
     }
 
+    // Add the multiboot files
+    perf::ScopedTimer timer(g_extras_time);
+
     std::string arch_dir(m_pc.data_directory());
     arch_dir += "/binaries/android/";
     arch_dir += m_info->device().architecture();
@@ -303,59 +321,287 @@ bool OdinPatcher::patch_tar()
     return true;
 }
 
-bool OdinPatcher::process_file(archive *a, archive_entry *entry, bool sparse)
+static bool is_sparse_image(const std::string &name)
 {
-    const char *name = archive_entry_pathname(entry);
-    std::string zip_name(name);
+    return starts_with(name, "cache.img") || starts_with(name, "system.img");
+}
+
+static std::string sparse_zip_name(std::string name)
+{
+    if (ends_with(name, ".ext4")) {
+        name.erase(name.size() - 5);
+    }
+    name += ".sparse";
+
+    return name;
+}
+
+static bool write_zip_data(void *handle, const void *buf, size_t size)
+{
+    auto ptr = static_cast<const char *>(buf);
 
-    if (sparse) {
-        if (ends_with(name, ".ext4")) {
-            zip_name.erase(zip_name.size() - 5);
+    // minizip no longer supports buffers larger than UINT16_MAX
+    while (size > 0) {
+        auto n = static_cast<uint32_t>(std::min<size_t>(size, UINT16_MAX));
+
+        if (mz_zip_entry_write(handle, ptr, n) != static_cast<int>(n)) {
+            return false;
         }
-        zip_name += ".sparse";
+
+        ptr += n;
+        size -= n;
     }
 
+    return true;
+}
+
+/*!
+ * \brief Write an uncompressed zip entry
+ *
+ * If \p lz4 is true, the data returned by \p read_fn is encoded as an LZ4
+ * frame before being stored. odinupdater recognizes the ".lz4" suffix and
+ * decodes the frame while flashing.
+ */
+bool OdinPatcher::write_stored_file(const std::string &zip_name,
+                                    const ReadFn &read_fn, bool lz4)
+{
     mz_zip_file file_info = {};
-    file_info.compression_method = MZ_COMPRESS_METHOD_DEFLATE;
+    file_info.compression_method = MZ_COMPRESS_METHOD_STORE;
     file_info.filename = zip_name.c_str();
     file_info.filename_size = static_cast<uint16_t>(zip_name.size());
 
     void *handle = MinizipUtils::ctx_get_zip_handle(m_z_output);
 
-    // Open file in output zip
-    int mz_ret = mz_zip_entry_write_open(handle, &file_info,
-                                         MZ_COMPRESS_LEVEL_DEFAULT, nullptr);
+    // Stored data is written raw so that the size and CRC are what we compute
+    int mz_ret = mz_zip_entry_write_open(handle, &file_info, 0, nullptr);
     if (mz_ret != MZ_OK) {
         LOGE("minizip: Failed to open new file in output zip: %d", mz_ret);
         m_error = ErrorCode::ArchiveWriteHeaderError;
         return false;
     }
 
-    la_ssize_t n_read;
-    char buf[10240];
-    while ((n_read = archive_read_data(a, buf, sizeof(buf))) > 0) {
-        if (m_cancelled) return false;
+    auto close_entry = finally([&] {
+        mz_zip_entry_close(handle);
+    });
 
-        int n_written = mz_zip_entry_write(
-                handle, buf, static_cast<uint32_t>(n_read));
-        if (static_cast<la_ssize_t>(n_written) != n_read) {
+    LZ4F_cctx *cctx = nullptr;
+
+    auto free_cctx = finally([&] {
+        LZ4F_freeCompressionContext(cctx);
+    });
+
+    LZ4F_preferences_t prefs = {};
+    prefs.frameInfo.blockSizeID = LZ4F_max4MB;
+    prefs.frameInfo.blockMode = LZ4F_blockIndependent;
+    // Fastest compression level
+    prefs.compressionLevel = 0;
+
+    std::vector<char> in_buf(1024 * 1024);
+    std::vector<char> out_buf;
+    uint64_t size = 0;
+    uint32_t crc = 0;
+
+    auto write = [&](const char *buf, size_t n) {
+        if (!write_zip_data(handle, buf, n)) {
             LOGE("minizip: Failed to write %s in output zip", zip_name.c_str());
             m_error = ErrorCode::ArchiveWriteDataError;
-            mz_zip_entry_close(handle);
+            return false;
+        }
+
+        crc = crc32_update(crc, buf, n);
+        size += n;
+        return true;
+    };
+
+    if (lz4) {
+        size_t lz4_ret = LZ4F_createCompressionContext(&cctx, LZ4F_VERSION);
+        if (LZ4F_isError(lz4_ret)) {
+            LOGE("lz4: Failed to create compression context: %s",
+                 LZ4F_getErrorName(lz4_ret));
+            m_error = ErrorCode::MemoryAllocationError;
+            return false;
+        }
+
+        out_buf.resize(std::max<size_t>(
+                LZ4F_compressBound(in_buf.size(), &prefs),
+                LZ4F_HEADER_SIZE_MAX));
+
+        lz4_ret = LZ4F_compressBegin(cctx, out_buf.data(), out_buf.size(),
+                                     &prefs);
+        if (LZ4F_isError(lz4_ret)) {
+            LOGE("lz4: Failed to write frame header: %s",
+                 LZ4F_getErrorName(lz4_ret));
+            m_error = ErrorCode::ArchiveWriteDataError;
+            return false;
+        } else if (!write(out_buf.data(), lz4_ret)) {
+            return false;
+        }
+    }
+
+    int64_t n_read;
+    while ((n_read = read_fn(in_buf.data(), in_buf.size())) > 0) {
+        auto n = static_cast<size_t>(n_read);
+
+        if (lz4) {
+            size_t lz4_ret = LZ4F_compressUpdate(
+                    cctx, out_buf.data(), out_buf.size(), in_buf.data(), n,
+                    nullptr);
+            if (LZ4F_isError(lz4_ret)) {
+                LOGE("lz4: Failed to compress %s: %s",
+                     zip_name.c_str(), LZ4F_getErrorName(lz4_ret));
+                m_error = ErrorCode::ArchiveWriteDataError;
+                return false;
+            } else if (!write(out_buf.data(), lz4_ret)) {
+                return false;
+            }
+        } else if (!write(in_buf.data(), n)) {
             return false;
         }
     }
 
     if (n_read != 0) {
+        // The caller reports the error
+        return false;
+    }
+
+    if (lz4) {
+        size_t lz4_ret = LZ4F_compressEnd(cctx, out_buf.data(), out_buf.size(),
+                                          nullptr);
+        if (LZ4F_isError(lz4_ret)) {
+            LOGE("lz4: Failed to finish frame: %s",
+                 LZ4F_getErrorName(lz4_ret));
+            m_error = ErrorCode::ArchiveWriteDataError;
+            return false;
+        } else if (!write(out_buf.data(), lz4_ret)) {
+            return false;
+        }
+    }
+
+    close_entry.dismiss();
+
+    mz_ret = mz_zip_entry_close_raw(handle, size, crc);
+    if (mz_ret != MZ_OK) {
+        LOGE("minizip: Failed to close file in output zip: %d", mz_ret);
+        m_error = ErrorCode::ArchiveWriteDataError;
+        return false;
+    }
+
+    return true;
+}
+
+int64_t OdinPatcher::read_data(archive *a, const char *name,
+                               void *buf, size_t size)
+{
+    if (m_cancelled) {
+        return -1;
+    }
+
+    la_ssize_t n = archive_read_data(a, buf, size);
+    if (n < 0) {
         LOGE("libarchive: Failed to read %s: %s",
              name, archive_error_string(a));
         m_error = ErrorCode::ArchiveReadDataError;
+    }
+
+    return n;
+}
+
+/*!
+ * \brief Copy an LZ4-compressed image from the source archive as is
+ */
+bool OdinPatcher::process_lz4_file(archive *a, archive_entry *entry,
+                                   const std::string &zip_name)
+{
+    const char *name = archive_entry_pathname(entry);
+
+    return write_stored_file(zip_name, [&](void *buf, size_t size) {
+        return read_data(a, name, buf, size);
+    }, false);
+}
+
+bool OdinPatcher::process_file(archive *a, archive_entry *entry, bool sparse)
+{
+    const char *name = archive_entry_pathname(entry);
+    std::string zip_name(sparse ? sparse_zip_name(name) : name);
+
+    // Large images are only streamed back out by odinupdater, so deflating
+    // them is mostly wasted time. Images of unknown size (eg. from nested LZ4
+    // archives) are assumed to be large.
+    auto compression = m_pc.image_compression();
+    if (sparse && compression != ImageCompression::Deflate
+            && (!archive_entry_size_is_set(entry)
+                    || static_cast<uint64_t>(archive_entry_size(entry))
+                            >= m_pc.image_compression_threshold())) {
+        bool lz4 = compression == ImageCompression::Lz4;
+        if (lz4) {
+            zip_name += ".lz4";
+        }
+
+        return write_stored_file(zip_name, [&](void *buf, size_t size) {
+            return read_data(a, name, buf, size);
+        }, lz4);
+    }
+
+    mz_zip_file file_info = {};
+    file_info.compression_method = MZ_COMPRESS_METHOD_DEFLATE;
+    file_info.filename = zip_name.c_str();
+    file_info.filename_size = static_cast<uint16_t>(zip_name.size());
+
+    void *handle = MinizipUtils::ctx_get_zip_handle(m_z_output);
+
+    // Open raw file in output zip. The data is deflated by DeflateUtils so
+    // that the compression can be spread across all cores.
+    int mz_ret = mz_zip_entry_write_open(handle, &file_info, 0, nullptr);
+    if (mz_ret != MZ_OK) {
+        LOGE("minizip: Failed to open new file in output zip: %d", mz_ret);
+        m_error = ErrorCode::ArchiveWriteHeaderError;
+        return false;
+    }
+
+    // Reading and decompressing the (possibly nested) archives stays on this
+    // thread since libarchive handles are not thread safe
+    bool read_failed = false;
+    bool write_failed = false;
+
+    auto read_fn = [&](void *buf, size_t size) {
+        int64_t n = read_data(a, name, buf, size);
+        if (n < 0) {
+            read_failed = true;
+        }
+        return n;
+    };
+
+    auto write_fn = [&](const void *buf, size_t size) {
+        int n_written = mz_zip_entry_write(
+                handle, buf, static_cast<uint32_t>(size));
+        if (n_written < 0 || static_cast<size_t>(n_written) != size) {
+            write_failed = true;
+            return false;
+        }
+        return true;
+    };
+
+    DeflateUtils::DeflateResult result;
+
+    if (!DeflateUtils::parallel_deflate(
+            read_fn, write_fn, MZ_COMPRESS_LEVEL_DEFAULT,
+            DeflateUtils::default_threads(), result)) {
+        // Read errors are already reported by read_data()
+        if (write_failed) {
+            LOGE("minizip: Failed to write %s in output zip",
+                 zip_name.c_str());
+            m_error = ErrorCode::ArchiveWriteDataError;
+        } else if (!read_failed && !m_cancelled) {
+            LOGE("zlib: Failed to compress %s", zip_name.c_str());
+            m_error = ErrorCode::ArchiveWriteDataError;
+        }
         mz_zip_entry_close(handle);
         return false;
     }
 
     // Close file in output zip
-    mz_ret = mz_zip_entry_close(handle);
+    mz_ret = mz_zip_entry_close_raw(handle, result.uncompressed_size,
+                                    result.crc);
     if (mz_ret != MZ_OK) {
         LOGE("minizip: Failed to close file in output zip: %d", mz_ret);
         m_error = ErrorCode::ArchiveWriteDataError;
@@ -383,7 +629,12 @@ struct NestedCtx
 {
     archive *nested;
     archive *parent;
-    char buf[10240];
+    // Number of bytes of the parent entry returned so far
+    uint64_t offset = 0;
+    // Last block read from the parent entry. It may follow a sparse hole.
+    const void *pending = nullptr;
+    size_t pending_size = 0;
+    uint64_t pending_offset = 0;
 
     NestedCtx(archive *a) : nested(archive_read_new()), parent(a)
     {
@@ -452,6 +703,26 @@ bool OdinPatcher::process_contents(archive *a, unsigned int depth,
             if (!process_contents(ctx.nested, depth + 1, nullptr)) {
                 return false;
             }
+        } else if (ends_with(name, ".lz4")
+                && m_pc.image_compression() == ImageCompression::Lz4
+                && is_sparse_image(name)) {
+            // Strip off ".lz4"
+            std::string new_entry_name(name, name + strlen(name) - 4);
+
+            if (m_added_files.find(new_entry_name) != m_added_files.end()) {
+                LOGV("%sSkipping duplicate file: %s", indent(depth), name);
+                continue;
+            }
+
+            LOGV("%sCopying LZ4-compressed sparse image: %s",
+                 indent(depth), name);
+            m_added_files.insert(new_entry_name);
+
+            if (!process_lz4_file(
+                    a, entry,
+                    sparse_zip_name(std::move(new_entry_name)) + ".lz4")) {
+                return false;
+            }
         } else if (ends_with(name, ".lz4")) {
             LOGV("%sHandling nested LZ4-compressed image: %s",
                  indent(depth), name);
@@ -630,13 +901,48 @@ void OdinPatcher::update_details(const std::string &msg)
 la_ssize_t OdinPatcher::la_nested_read_cb(archive *a, void *userdata,
                                           const void **buffer)
 {
-    (void) a;
+    // Returned for sparse holes in the parent entry
+    static const char zeros[65536] = {};
 
     NestedCtx *ctx = static_cast<NestedCtx *>(userdata);
 
-    *buffer = ctx->buf;
+    // Pass the parent's blocks through without copying them. Returning 0
+    // means EOF, so keep going until there's something to return.
+    while (ctx->pending_offset + ctx->pending_size <= ctx->offset) {
+        const void *block;
+        size_t size;
+        la_int64_t offset;
+
+        int ret = archive_read_data_block(ctx->parent, &block, &size, &offset);
+        if (ret == ARCHIVE_EOF) {
+            return 0;
+        } else if (ret < ARCHIVE_WARN) {
+            archive_copy_error(a, ctx->parent);
+            return -1;
+        } else if (offset < 0 || static_cast<uint64_t>(offset) < ctx->offset) {
+            archive_set_error(a, EINVAL, "Invalid offset in parent entry");
+            return -1;
+        }
 
-    return archive_read_data(ctx->parent, ctx->buf, sizeof(ctx->buf));
+        ctx->pending = block;
+        ctx->pending_size = size;
+        ctx->pending_offset = static_cast<uint64_t>(offset);
+    }
+
+    size_t n;
+
+    if (ctx->pending_offset > ctx->offset) {
+        n = static_cast<size_t>(std::min<uint64_t>(
+                ctx->pending_offset - ctx->offset, sizeof(zeros)));
+        *buffer = zeros;
+    } else {
+        n = ctx->pending_size;
+        *buffer = ctx->pending;
+    }
+
+    ctx->offset += n;
+
+    return static_cast<la_ssize_t>(n);
 }
 
 la_ssize_t OdinPatcher::la_read_cb(archive *a, void *userdata,
@@ -644,9 +950,8 @@ la_ssize_t OdinPatcher::la_read_cb(archive *a, void *userdata,
 {
     (void) a;
     auto *p = static_cast<OdinPatcher *>(userdata);
-    *buffer = p->m_la_buf;
 
-    auto bytes_read = p->m_la_file.read(p->m_la_buf, sizeof(p->m_la_buf));
+    auto bytes_read = p->m_la_reader.read(buffer);
     if (!bytes_read) {
         LOGE("%s: Failed to read: %s", p->m_info->input_path().c_str(),
              bytes_read.error().message().c_str());
@@ -665,18 +970,17 @@ la_int64_t OdinPatcher::la_skip_cb(archive *a, void *userdata,
     (void) a;
     auto *p = static_cast<OdinPatcher *>(userdata);
 
-    auto seek_ret = p->m_la_file.seek(request, SEEK_CUR);
-    if (!seek_ret) {
+    auto skipped = p->m_la_reader.skip(static_cast<uint64_t>(request));
+    if (!skipped) {
         LOGE("%s: Failed to seek: %s", p->m_info->input_path().c_str(),
-             seek_ret.error().message().c_str());
+             skipped.error().message().c_str());
         p->m_error = ErrorCode::FileSeekError;
         return -1;
     }
 
-    p->m_bytes = static_cast<uint64_t>(
-            static_cast<int64_t>(p->m_bytes) + request);
+    p->m_bytes += skipped.value();
     p->update_progress(p->m_bytes, p->m_max_bytes);
-    return request;
+    return static_cast<la_int64_t>(skipped.value());
 }
 
 int OdinPatcher::la_open_cb(archive *a, void *userdata)
@@ -20,22 +20,23 @@
 #include "mbpatcher/patchers/zippatcher.h"
 
 #include <algorithm>
+#include <string_view>
 #include <unordered_set>
 
 #include <cassert>
 #include <cstring>
 
+#include "mbcommon/perf.h"
 #include "mbcommon/string.h"
 #include "mbcommon/version.h"
 #include "mbdevice/json.h"
 #include "mblog/logging.h"
-#include "mbpio/delete.h"
 
 #include "mbpatcher/autopatchers/magiskpatcher.h"
 #include "mbpatcher/autopatchers/mountcmdpatcher.h"
 #include "mbpatcher/autopatchers/standardpatcher.h"
 #include "mbpatcher/patcherconfig.h"
-#include "mbpatcher/private/fileutils.h"
+#include "mbpatcher/private/deflateutils.h"
 #include "mbpatcher/private/miniziputils.h"
 
 // minizip
@@ -49,6 +50,12 @@ namespace mb::patcher
 
 const std::string ZipPatcher::Id("ZipPatcher");
 
+// Time spent in each phase of patching a zip (in microseconds)
+static perf::Histogram g_pass1_time("patcher.zip.pass1");
+static perf::Histogram g_pass2_time("patcher.zip.pass2");
+static perf::Histogram g_autopatchers_time("patcher.zip.autopatchers");
+static perf::Histogram g_extras_time("patcher.zip.extras");
+
 
 ZipPatcher::ZipPatcher(PatcherConfig &pc)
     : m_pc(pc)
@@ -170,13 +177,23 @@ bool ZipPatcher::patch_zip()
 
     if (m_cancelled) return false;
 
-    MinizipUtils::ArchiveStats stats;
-    auto result = MinizipUtils::archive_stats(m_info->input_path(), stats, {});
+    if (!open_input_archive()) {
+        return false;
+    }
+
+    // The central directory is only walked once. Both the progress totals and
+    // the first pass use the resulting index.
+    ZipIndex index;
+    auto result = MinizipUtils::index_archive(
+            MinizipUtils::ctx_get_zip_handle(m_z_input), index);
     if (result != ErrorCode::NoError) {
         m_error = result;
         return false;
     }
 
+    MinizipUtils::ArchiveStats stats;
+    MinizipUtils::archive_stats(index, stats, {});
+
     m_max_bytes = stats.total_size;
 
     if (m_cancelled) return false;
@@ -222,16 +239,11 @@ bool ZipPatcher::patch_zip()
     m_max_files = stats.files + to_copy.size() + 2;
     update_files(m_files, m_max_files);
 
-    if (!open_input_archive()) {
-        return false;
-    }
-
-    // Create temporary dir for extracted files for autopatchers
-    std::string temp_dir =
-            FileUtils::create_temporary_dir(m_pc.temp_directory());
+    // Files needed by the autopatchers are kept in memory
+    std::vector<LoadedEntry> loaded_entries;
+    AutoPatcher::FileMap loaded_files;
 
-    if (!pass1(temp_dir, exclude_from_pass1)) {
-        (void) io::delete_recursively(temp_dir);
+    if (!pass1(index, exclude_from_pass1, loaded_entries, loaded_files)) {
         return false;
     }
 
@@ -239,12 +251,12 @@ bool ZipPatcher::patch_zip()
 
     // On the second pass, run the autopatchers on the rest of the files
 
-    if (!pass2(temp_dir, exclude_from_pass1)) {
-        (void) io::delete_recursively(temp_dir);
+    if (!pass2(loaded_entries, loaded_files)) {
         return false;
     }
 
-    (void) io::delete_recursively(temp_dir);
+    // Add the multiboot files
+    perf::ScopedTimer timer(g_extras_time);
 
     for (const CopySpec &spec : to_copy) {
         if (m_cancelled) return false;
@@ -301,14 +313,22 @@ bool ZipPatcher::patch_zip()
  *
  * This performs the following operations:
  *
- * - Files needed by an AutoPatcher are extracted to the temporary directory.
+ * - Files needed by an AutoPatcher are read into \p files. Their names are
+ *   added to \p entries in the order they appear in the zip.
  * - Otherwise, the file is copied directly to the output zip.
+ *
+ * Entry metadata comes from \p index, which must have been built from the
+ * input zip.
  */
-bool ZipPatcher::pass1(const std::string &temporary_dir,
-                       const std::unordered_set<std::string> &exclude)
+bool ZipPatcher::pass1(const ZipIndex &index,
+                       const std::unordered_set<std::string> &exclude,
+                       std::vector<LoadedEntry> &entries,
+                       AutoPatcher::FileMap &files)
 {
     using namespace std::placeholders;
 
+    perf::ScopedTimer timer(g_pass1_time);
+
     void *h_in = MinizipUtils::ctx_get_zip_handle(m_z_input);
     void *h_out = MinizipUtils::ctx_get_zip_handle(m_z_output);
 
@@ -318,29 +338,40 @@ bool ZipPatcher::pass1(const std::string &temporary_dir,
         return false;
     }
 
+    auto const &index_entries = index.entries();
+    std::size_t i = 0;
+
     if (ret != MZ_END_OF_LIST) {
         do {
             if (m_cancelled) return false;
 
-            mz_zip_file *file_info;
-
-            ret = mz_zip_entry_get_info(h_in, &file_info);
-            if (ret != MZ_OK) {
+            if (i >= index_entries.size()) {
+                LOGE("minizip: Zip has more entries than its index");
                 m_error = ErrorCode::ArchiveReadHeaderError;
                 return false;
             }
 
-            std::string cur_file{file_info->filename, file_info->filename_size};
+            auto const &entry = index_entries[i++];
+            std::string cur_file = entry.name;
 
             update_files(++m_files, m_max_files);
             update_details(cur_file);
 
             // Skip files that should be patched and added in pass 2
             if (exclude.find(cur_file) != exclude.end()) {
-                if (!MinizipUtils::extract_file(h_in, temporary_dir)) {
+                std::string contents;
+
+                if (!MinizipUtils::read_to_memory(h_in, contents, {})) {
                     m_error = ErrorCode::ArchiveReadDataError;
                     return false;
                 }
+
+                // Like extracting, the last duplicate entry wins
+                if (auto [_, inserted] = files.insert_or_assign(
+                        cur_file, std::move(contents)); inserted) {
+                    entries.push_back({std::move(cur_file),
+                                       entry.modified_date});
+                }
                 continue;
             }
 
@@ -356,7 +387,7 @@ bool ZipPatcher::pass1(const std::string &temporary_dir,
                 return false;
             }
 
-            m_bytes += file_info->uncompressed_size;
+            m_bytes += entry.uncompressed_size;
         } while ((ret = mz_zip_goto_next_entry(h_in)) == MZ_OK);
 
         if (ret != MZ_END_OF_LIST) {
@@ -375,44 +406,69 @@ bool ZipPatcher::pass1(const std::string &temporary_dir,
  *
  * This performs the following operations:
  *
- * - Patch files in the temporary directory using the AutoPatchers and add the
- *   resulting files to the output zip
+ * - Patch the files loaded in the first pass using the AutoPatchers
+ * - Compress all of the patched files concurrently and add them to the output
+ *   zip in their original order
  */
-bool ZipPatcher::pass2(const std::string &temporary_dir,
-                       const std::unordered_set<std::string> &files)
+bool ZipPatcher::pass2(const std::vector<LoadedEntry> &entries,
+                       AutoPatcher::FileMap &files)
 {
+    perf::ScopedTimer timer(g_pass2_time);
+
     void *handle = MinizipUtils::ctx_get_zip_handle(m_z_output);
 
-    for (auto *ap : m_auto_patchers) {
-        if (m_cancelled) return false;
-        if (!ap->patch_files(temporary_dir)) {
-            m_error = ap->error();
-            return false;
+    {
+        perf::ScopedTimer ap_timer(g_autopatchers_time);
+
+        for (auto *ap : m_auto_patchers) {
+            if (m_cancelled) return false;
+            if (!ap->patch_data(files)) {
+                m_error = ap->error();
+                return false;
+            }
         }
     }
 
-    // TODO Headers are being discarded
+    if (m_cancelled) return false;
+
+    std::vector<std::string_view> inputs;
+    inputs.reserve(entries.size());
+
+    for (auto const &entry : entries) {
+        inputs.push_back(files[entry.name]);
+    }
+
+    std::vector<DeflateUtils::DeflatedData> outputs;
 
-    for (auto const &file : files) {
+    if (!DeflateUtils::deflate_buffers(inputs, MZ_COMPRESS_LEVEL_DEFAULT,
+                                       DeflateUtils::default_threads(),
+                                       outputs)) {
+        m_error = ErrorCode::ArchiveWriteDataError;
+        return false;
+    }
+
+    // TODO Headers other than the modification time are being discarded
+
+    for (size_t i = 0; i < entries.size(); ++i) {
         if (m_cancelled) return false;
 
-        ErrorCode ret;
-
-        if (file == "META-INF/com/google/android/update-binary") {
-            ret = MinizipUtils::add_file_from_path(
-                    handle,
-                    "META-INF/com/google/android/update-binary.orig",
-                    temporary_dir + "/" + file);
-        } else {
-            ret = MinizipUtils::add_file_from_path(
-                    handle,
-                    file,
-                    temporary_dir + "/" + file);
+        std::string name = entries[i].name;
+
+        // Rename the installer for mbtool
+        if (name == "META-INF/com/google/android/update-binary") {
+            name = "META-INF/com/google/android/update-binary.orig";
         }
 
-        if (ret == ErrorCode::FileOpenError) {
-            LOGW("File does not exist in temporary directory: %s", file.c_str());
-        } else if (ret != ErrorCode::NoError) {
+        mz_zip_file file_info = {};
+        file_info.compression_method = MZ_COMPRESS_METHOD_DEFLATE;
+        file_info.filename = name.c_str();
+        file_info.filename_size = static_cast<uint16_t>(name.size());
+        file_info.modified_date = entries[i].modified_date;
+
+        auto ret = MinizipUtils::add_file_from_raw_data(
+                handle, file_info, outputs[i].data,
+                outputs[i].uncompressed_size, outputs[i].crc);
+        if (ret != ErrorCode::NoError) {
             m_error = ret;
             return false;
         }
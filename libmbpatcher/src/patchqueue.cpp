@@ -0,0 +1,272 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbpatcher/patchqueue.h"
+
+#include <algorithm>
+
+#include <cassert>
+
+#include "mblog/logging.h"
+
+#include "mbpatcher/patcherconfig.h"
+#include "mbpatcher/patcherinterface.h"
+
+#define LOG_TAG "mbpatcher/patchqueue"
+
+
+namespace mb::patcher
+{
+
+/*!
+ * \class PatchQueue
+ * \brief Patch multiple files concurrently
+ *
+ * Jobs are run in submission order on a pool of at most \p max_jobs threads.
+ * Each job uses its own Patcher created from the shared PatcherConfig. The
+ * callbacks are invoked from the worker threads and receive the index of the
+ * job as their first argument.
+ *
+ * \note The PatcherConfig must not be modified while jobs are running.
+ */
+
+/*!
+ * \brief Construct a new job queue
+ *
+ * \param pc PatcherConfig to create patchers from
+ * \param callbacks Callbacks for reporting the progress of jobs
+ * \param max_jobs Maximum number of jobs to run concurrently. If 0, the
+ *                 number of CPUs is used.
+ */
+PatchQueue::PatchQueue(PatcherConfig &pc, Callbacks callbacks,
+                       unsigned int max_jobs)
+    : m_pc(pc)
+    , m_callbacks(std::move(callbacks))
+    , m_max_jobs(max_jobs > 0 ? max_jobs
+            : std::max(std::thread::hardware_concurrency(), 1u))
+{
+}
+
+/*!
+ * \brief Cancel all jobs and wait for the worker threads to exit
+ */
+PatchQueue::~PatchQueue()
+{
+    cancel_all();
+    wait();
+
+    for (auto &t : m_threads) {
+        t.join();
+    }
+}
+
+/*!
+ * \brief Add a file to the queue
+ *
+ * \param patcher_id ID of the Patcher to use
+ * \param info FileInfo describing the file to patch
+ *
+ * \return Index of the new job
+ */
+size_t PatchQueue::submit(std::string patcher_id, FileInfo info)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    auto job = std::make_unique<Job>();
+    job->patcher_id = std::move(patcher_id);
+    job->info = std::move(info);
+
+    size_t index = m_jobs.size();
+    m_jobs.push_back(std::move(job));
+
+    // Threads exit once the queue is empty, so start a new one if needed
+    if (m_active_threads < m_max_jobs) {
+        ++m_active_threads;
+        m_threads.emplace_back(&PatchQueue::worker_thread, this);
+    }
+
+    return index;
+}
+
+/*!
+ * \brief Cancel a job
+ *
+ * If the job has not started yet, it will not be run. If it is running, the
+ * patcher is asked to stop.
+ *
+ * \param job Index of the job
+ */
+void PatchQueue::cancel(size_t job)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    assert(job < m_jobs.size());
+    auto &j = *m_jobs[job];
+
+    j.cancelled = true;
+    if (j.patcher) {
+        j.patcher->cancel_patching();
+    }
+}
+
+/*!
+ * \brief Cancel all queued and running jobs
+ */
+void PatchQueue::cancel_all()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    for (auto &j : m_jobs) {
+        j->cancelled = true;
+        if (j->patcher) {
+            j->patcher->cancel_patching();
+        }
+    }
+}
+
+/*!
+ * \brief Wait for all submitted jobs to finish
+ */
+void PatchQueue::wait()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    m_finished_cv.wait(lock, [&] {
+        return m_finished_jobs == m_jobs.size();
+    });
+}
+
+/*!
+ * \brief Get the number of submitted jobs
+ */
+size_t PatchQueue::size() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_jobs.size();
+}
+
+/*!
+ * \brief Get the state of a job
+ *
+ * \param job Index of the job
+ */
+PatchQueue::JobState PatchQueue::state(size_t job) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    assert(job < m_jobs.size());
+    return m_jobs[job]->state;
+}
+
+/*!
+ * \brief Get the error of a failed job
+ *
+ * \param job Index of the job
+ *
+ * \return The job's ErrorCode. The value is invalid unless the job failed.
+ */
+ErrorCode PatchQueue::error(size_t job) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    assert(job < m_jobs.size());
+    return m_jobs[job]->error;
+}
+
+void PatchQueue::worker_thread()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    while (m_next_job < m_jobs.size()) {
+        size_t index = m_next_job++;
+        Job &job = *m_jobs[index];
+
+        lock.unlock();
+        run_job(index, job);
+        lock.lock();
+    }
+
+    --m_active_threads;
+}
+
+void PatchQueue::run_job(size_t index, Job &job)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        if (job.cancelled) {
+            job.state = JobState::Cancelled;
+            job.error = ErrorCode::PatchingCancelled;
+        } else {
+            job.patcher = m_pc.create_patcher(job.patcher_id);
+            if (job.patcher) {
+                job.patcher->set_file_info(&job.info);
+                job.state = JobState::Running;
+            } else {
+                LOGE("Job %zu: Invalid patcher ID: %s",
+                     index, job.patcher_id.c_str());
+                job.state = JobState::Failed;
+                job.error = ErrorCode::PatcherCreateError;
+            }
+        }
+    }
+
+    if (job.state == JobState::Running) {
+        bool ret = job.patcher->patch_file(
+            [&](uint64_t bytes, uint64_t max_bytes) {
+                if (m_callbacks.progress) {
+                    m_callbacks.progress(index, bytes, max_bytes);
+                }
+            },
+            [&](uint64_t files, uint64_t max_files) {
+                if (m_callbacks.files) {
+                    m_callbacks.files(index, files, max_files);
+                }
+            },
+            [&](const std::string &text) {
+                if (m_callbacks.details) {
+                    m_callbacks.details(index, text);
+                }
+            }
+        );
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        if (ret) {
+            job.state = JobState::Succeeded;
+        } else {
+            job.error = job.patcher->error();
+            job.state = job.error == ErrorCode::PatchingCancelled
+                    ? JobState::Cancelled : JobState::Failed;
+        }
+
+        m_pc.destroy_patcher(job.patcher);
+        job.patcher = nullptr;
+    }
+
+    if (m_callbacks.finished) {
+        m_callbacks.finished(index, job.state, job.error);
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    ++m_finished_jobs;
+    m_finished_cv.notify_all();
+}
+
+}
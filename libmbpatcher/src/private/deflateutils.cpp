@@ -0,0 +1,476 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbpatcher/private/deflateutils.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <zlib.h>
+
+#include "mbcommon/crc32.h"
+
+#include "mblog/logging.h"
+
+#define LOG_TAG "mbpatcher/private/deflateutils"
+
+
+namespace mb::patcher
+{
+
+/*
+ * The input is split into fixed-size chunks that are compressed independently
+ * as raw deflate data. Each chunk is primed with the last 32 KiB of the
+ * previous chunk as its dictionary and ends with a sync flush, so the
+ * concatenation of all chunks, followed by an empty final block, is a single
+ * valid deflate stream.
+ */
+
+// Size of the input chunks handed to the workers
+static constexpr size_t CHUNK_SIZE = 1024 * 1024;
+// Size of the deflate window
+static constexpr size_t DICT_SIZE = 32 * 1024;
+// Maximum number of chunks in flight per worker
+static constexpr size_t CHUNKS_PER_WORKER = 2;
+// minizip does not accept writes larger than this
+static constexpr size_t MAX_WRITE_SIZE = UINT16_MAX;
+
+struct DeflateChunk
+{
+    std::string input;
+    std::string dict;
+    std::string output;
+    size_t size = 0;
+    uint32_t crc = 0;
+    bool done = false;
+    bool failed = false;
+};
+
+struct DeflatePipeline
+{
+    std::mutex mutex;
+    // Signalled when a chunk is queued or the pipeline is shutting down
+    std::condition_variable work_cv;
+    // Signalled when a chunk finishes compressing or the input ends
+    std::condition_variable done_cv;
+    // Signalled when the writer consumes a chunk or an error occurs
+    std::condition_variable space_cv;
+
+    // Chunks waiting for a worker
+    std::deque<DeflateChunk *> pending;
+    // All chunks that have not been written yet, in input order
+    std::deque<std::unique_ptr<DeflateChunk>> ordered;
+
+    bool eof = false;
+    bool failed = false;
+
+    void fail()
+    {
+        failed = true;
+        work_cv.notify_all();
+        done_cv.notify_all();
+        space_cv.notify_all();
+    }
+};
+
+static bool deflate_chunk(DeflateChunk &chunk, int level)
+{
+    z_stream zs = {};
+
+    // Negative window bits produce raw deflate data without a zlib header
+    int ret = deflateInit2(&zs, level, Z_DEFLATED, -MAX_WBITS, 8,
+                           Z_DEFAULT_STRATEGY);
+    if (ret != Z_OK) {
+        LOGE("zlib: Failed to initialize deflate stream: %d", ret);
+        return false;
+    }
+
+    if (!chunk.dict.empty()) {
+        ret = deflateSetDictionary(
+                &zs, reinterpret_cast<const Bytef *>(chunk.dict.data()),
+                static_cast<uInt>(chunk.dict.size()));
+        if (ret != Z_OK) {
+            LOGE("zlib: Failed to set dictionary: %d", ret);
+            deflateEnd(&zs);
+            return false;
+        }
+    }
+
+    // deflateBound() does not account for the sync flush marker
+    chunk.output.resize(deflateBound(
+            &zs, static_cast<uLong>(chunk.input.size())) + 16);
+
+    zs.next_in = reinterpret_cast<Bytef *>(chunk.input.data());
+    zs.avail_in = static_cast<uInt>(chunk.input.size());
+    zs.next_out = reinterpret_cast<Bytef *>(chunk.output.data());
+    zs.avail_out = static_cast<uInt>(chunk.output.size());
+
+    ret = deflate(&zs, Z_SYNC_FLUSH);
+    if (ret != Z_OK || zs.avail_in != 0 || zs.avail_out == 0) {
+        LOGE("zlib: Failed to compress chunk: %d", ret);
+        deflateEnd(&zs);
+        return false;
+    }
+
+    chunk.output.resize(chunk.output.size() - zs.avail_out);
+    deflateEnd(&zs);
+
+    chunk.size = chunk.input.size();
+    chunk.crc = crc32_update(0, chunk.input.data(), chunk.input.size());
+
+    std::string().swap(chunk.input);
+    std::string().swap(chunk.dict);
+
+    return true;
+}
+
+static bool final_block(std::string &output)
+{
+    z_stream zs = {};
+
+    int ret = deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS,
+                           8, Z_DEFAULT_STRATEGY);
+    if (ret != Z_OK) {
+        LOGE("zlib: Failed to initialize deflate stream: %d", ret);
+        return false;
+    }
+
+    output.resize(16);
+
+    zs.next_out = reinterpret_cast<Bytef *>(output.data());
+    zs.avail_out = static_cast<uInt>(output.size());
+
+    ret = deflate(&zs, Z_FINISH);
+    if (ret != Z_STREAM_END) {
+        LOGE("zlib: Failed to finish deflate stream: %d", ret);
+        deflateEnd(&zs);
+        return false;
+    }
+
+    output.resize(output.size() - zs.avail_out);
+    deflateEnd(&zs);
+
+    return true;
+}
+
+static bool write_data(const DeflateUtils::WriteFn &write_fn,
+                       const std::string &data)
+{
+    const char *ptr = data.data();
+    size_t remain = data.size();
+
+    while (remain > 0) {
+        size_t n = std::min(remain, MAX_WRITE_SIZE);
+        if (!write_fn(ptr, n)) {
+            return false;
+        }
+        ptr += n;
+        remain -= n;
+    }
+
+    return true;
+}
+
+static void worker_thread(DeflatePipeline &p, int level)
+{
+    std::unique_lock<std::mutex> lock(p.mutex);
+
+    while (true) {
+        p.work_cv.wait(lock, [&] {
+            return !p.pending.empty() || p.eof || p.failed;
+        });
+
+        if (p.failed || p.pending.empty()) {
+            return;
+        }
+
+        DeflateChunk *chunk = p.pending.front();
+        p.pending.pop_front();
+
+        lock.unlock();
+        bool ok = deflate_chunk(*chunk, level);
+        lock.lock();
+
+        chunk->done = true;
+        chunk->failed = !ok;
+        p.done_cv.notify_all();
+    }
+}
+
+static void writer_thread(DeflatePipeline &p,
+                          const DeflateUtils::WriteFn &write_fn,
+                          DeflateUtils::DeflateResult &result)
+{
+    std::unique_lock<std::mutex> lock(p.mutex);
+
+    while (true) {
+        p.done_cv.wait(lock, [&] {
+            return p.failed
+                    || (!p.ordered.empty() && p.ordered.front()->done)
+                    || (p.ordered.empty() && p.eof);
+        });
+
+        if (p.failed || p.ordered.empty()) {
+            return;
+        }
+
+        std::unique_ptr<DeflateChunk> chunk = std::move(p.ordered.front());
+        p.ordered.pop_front();
+        p.space_cv.notify_all();
+
+        if (chunk->failed) {
+            p.fail();
+            return;
+        }
+
+        lock.unlock();
+        bool ok = write_data(write_fn, chunk->output);
+        lock.lock();
+
+        if (!ok) {
+            LOGE("Failed to write compressed chunk");
+            p.fail();
+            return;
+        }
+
+        result.crc = crc32_concat(result.crc, chunk->crc, chunk->size);
+        result.uncompressed_size += chunk->size;
+        result.compressed_size += chunk->output.size();
+    }
+}
+
+static bool read_chunk(const DeflateUtils::ReadFn &read_fn, std::string &buf)
+{
+    size_t filled = 0;
+
+    buf.resize(CHUNK_SIZE);
+
+    while (filled < buf.size()) {
+        int64_t n = read_fn(buf.data() + filled, buf.size() - filled);
+        if (n < 0) {
+            return false;
+        } else if (n == 0) {
+            break;
+        }
+        filled += static_cast<size_t>(n);
+    }
+
+    buf.resize(filled);
+
+    return true;
+}
+
+unsigned int DeflateUtils::default_threads()
+{
+    return std::max(std::thread::hardware_concurrency(), 1u);
+}
+
+/*!
+ * \brief Compress a stream with multiple threads
+ *
+ * The calling thread reads the input in chunks with \p read_fn, a pool of
+ * \p threads workers compresses the chunks, and a separate writer thread
+ * passes the compressed chunks to \p write_fn in order. The output is raw
+ * deflate data suitable for storing in a zip entry opened in raw mode.
+ *
+ * \param[in] read_fn Function for reading the uncompressed input
+ * \param[in] write_fn Function for writing the compressed output
+ * \param[in] level zlib compression level
+ * \param[in] threads Number of compression threads
+ * \param[out] result Sizes and CRC32 of the data
+ *
+ * \return Whether the data was successfully compressed and written
+ */
+bool DeflateUtils::parallel_deflate(const ReadFn &read_fn,
+                                    const WriteFn &write_fn,
+                                    int level, unsigned int threads,
+                                    DeflateResult &result)
+{
+    threads = std::max(threads, 1u);
+    const size_t max_in_flight = threads * CHUNKS_PER_WORKER;
+
+    DeflatePipeline p;
+    result = {};
+
+    std::vector<std::thread> workers;
+    workers.reserve(threads);
+    for (unsigned int i = 0; i < threads; ++i) {
+        workers.emplace_back(worker_thread, std::ref(p), level);
+    }
+    std::thread writer(writer_thread, std::ref(p), std::cref(write_fn),
+                       std::ref(result));
+
+    std::string dict;
+    bool read_ok = true;
+
+    while (true) {
+        auto chunk = std::make_unique<DeflateChunk>();
+
+        if (!read_chunk(read_fn, chunk->input)) {
+            read_ok = false;
+            break;
+        } else if (chunk->input.empty()) {
+            break;
+        }
+
+        chunk->dict = std::move(dict);
+        dict.assign(chunk->input,
+                    chunk->input.size() - std::min(chunk->input.size(),
+                                                   DICT_SIZE));
+
+        std::unique_lock<std::mutex> lock(p.mutex);
+
+        p.space_cv.wait(lock, [&] {
+            return p.failed || p.ordered.size() < max_in_flight;
+        });
+        if (p.failed) {
+            break;
+        }
+
+        p.pending.push_back(chunk.get());
+        p.ordered.push_back(std::move(chunk));
+        p.work_cv.notify_one();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(p.mutex);
+
+        if (!read_ok) {
+            p.fail();
+        } else {
+            p.eof = true;
+            p.work_cv.notify_all();
+            p.done_cv.notify_all();
+        }
+    }
+
+    for (auto &t : workers) {
+        t.join();
+    }
+    writer.join();
+
+    if (p.failed) {
+        return false;
+    }
+
+    std::string trailer;
+    if (!final_block(trailer) || !write_data(write_fn, trailer)) {
+        return false;
+    }
+    result.compressed_size += trailer.size();
+
+    return true;
+}
+
+static bool deflate_buffer(std::string_view input, int level,
+                           DeflateUtils::DeflatedData &output)
+{
+    z_stream zs = {};
+
+    int ret = deflateInit2(&zs, level, Z_DEFLATED, -MAX_WBITS, 8,
+                           Z_DEFAULT_STRATEGY);
+    if (ret != Z_OK) {
+        LOGE("zlib: Failed to initialize deflate stream: %d", ret);
+        return false;
+    }
+
+    output.data.resize(deflateBound(&zs, static_cast<uLong>(input.size())));
+
+    zs.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(input.data()));
+    zs.avail_in = static_cast<uInt>(input.size());
+    zs.next_out = reinterpret_cast<Bytef *>(output.data.data());
+    zs.avail_out = static_cast<uInt>(output.data.size());
+
+    ret = deflate(&zs, Z_FINISH);
+    if (ret != Z_STREAM_END) {
+        LOGE("zlib: Failed to compress buffer: %d", ret);
+        deflateEnd(&zs);
+        return false;
+    }
+
+    output.data.resize(output.data.size() - zs.avail_out);
+    deflateEnd(&zs);
+
+    output.uncompressed_size = input.size();
+    output.crc = crc32_update(0, input.data(), input.size());
+
+    return true;
+}
+
+/*!
+ * \brief Compress independent buffers concurrently
+ *
+ * Each buffer is compressed into its own raw deflate stream. The buffers are
+ * distributed among \p threads threads.
+ *
+ * \param[in] inputs Buffers to compress
+ * \param[in] level zlib compression level
+ * \param[in] threads Number of compression threads
+ * \param[out] outputs Compressed data for each of the buffers in \p inputs
+ *
+ * \return Whether all of the buffers were successfully compressed
+ */
+bool DeflateUtils::deflate_buffers(const std::vector<std::string_view> &inputs,
+                                   int level, unsigned int threads,
+                                   std::vector<DeflatedData> &outputs)
+{
+    std::vector<DeflatedData> results(inputs.size());
+    std::atomic_size_t next{0};
+    std::atomic_bool failed{false};
+
+    auto work = [&] {
+        for (size_t i; !failed && (i = next++) < inputs.size();) {
+            if (!deflate_buffer(inputs[i], level, results[i])) {
+                failed = true;
+            }
+        }
+    };
+
+    threads = static_cast<unsigned int>(std::clamp<size_t>(
+            threads, 1, std::max<size_t>(inputs.size(), 1)));
+
+    std::vector<std::thread> workers;
+    workers.reserve(threads - 1);
+    for (unsigned int i = 1; i < threads; ++i) {
+        workers.emplace_back(work);
+    }
+
+    // The calling thread does its share of the work too
+    work();
+
+    for (auto &t : workers) {
+        t.join();
+    }
+
+    if (failed) {
+        return false;
+    }
+
+    outputs.swap(results);
+    return true;
+}
+
+}
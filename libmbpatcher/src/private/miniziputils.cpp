@@ -54,6 +54,7 @@
 #  include <sys/stat.h>
 #endif
 
+#include "mbpatcher/private/deflateutils.h"
 #include "mbpatcher/private/fileutils.h"
 
 #define LOG_TAG "mbpatcher/private/miniziputils"
@@ -62,6 +63,9 @@
 namespace mb::patcher
 {
 
+// Entries at least this large are compressed on all cores
+static constexpr uint64_t PARALLEL_DEFLATE_THRESHOLD = 4 * 1024 * 1024;
+
 struct ZipCtx
 {
     void *stream;
@@ -158,25 +162,42 @@ int MinizipUtils::close_zip_file(ZipCtx *ctx)
     return ret;
 }
 
-ErrorCode MinizipUtils::archive_stats(const std::string &path,
-                                      MinizipUtils::ArchiveStats &stats,
-                                      const std::vector<std::string> &ignore)
+const std::vector<ZipEntryInfo> & ZipIndex::entries() const
 {
-    ZipCtx *ctx = open_zip_file(path, ZipOpenMode::Read);
-    if (!ctx) {
-        LOGE("minizip: Failed to open for reading: %s", path.c_str());
-        return ErrorCode::ArchiveReadOpenError;
+    return m_entries;
+}
+
+const ZipEntryInfo * ZipIndex::find(std::string_view name) const
+{
+    if (auto it = m_by_name.find(name); it != m_by_name.end()) {
+        return &m_entries[it->second];
     }
+    return nullptr;
+}
 
-    auto close_ctx = finally([&] {
-        close_zip_file(ctx);
-    });
+uint64_t ZipIndex::total_size() const
+{
+    return m_total_size;
+}
 
-    uint64_t count = 0;
+/*!
+ * \brief Read the central directory of a zip into an index
+ *
+ * This walks the central directory exactly once. The position of \p handle is
+ * left at the end of the central directory.
+ *
+ * \param handle Zip handle opened for reading
+ * \param index Index to populate
+ *
+ * \return ErrorCode::NoError if the central directory was successfully read
+ */
+ErrorCode MinizipUtils::index_archive(void *handle, ZipIndex &index)
+{
+    std::vector<ZipEntryInfo> entries;
     uint64_t total_size = 0;
     mz_zip_file *file_info;
 
-    int ret = mz_zip_goto_first_entry(ctx->handle);
+    int ret = mz_zip_goto_first_entry(handle);
     if (ret != MZ_OK && ret != MZ_END_OF_LIST) {
         LOGE("minizip: Failed to move to first file: %d", ret);
         return ErrorCode::ArchiveReadHeaderError;
@@ -184,18 +205,23 @@ ErrorCode MinizipUtils::archive_stats(const std::string &path,
 
     if (ret != MZ_END_OF_LIST) {
         do {
-            ret = mz_zip_entry_get_info(ctx->handle, &file_info);
+            ret = mz_zip_entry_get_info(handle, &file_info);
             if (ret != MZ_OK) {
                 LOGE("minizip: Failed to get inner file metadata: %d", ret);
                 return ErrorCode::ArchiveReadHeaderError;
             }
 
-            std::string filename{file_info->filename, file_info->filename_size};
-            if (std::find(ignore.begin(), ignore.end(), filename) == ignore.end()) {
-                ++count;
-                total_size += file_info->uncompressed_size;
-            }
-        } while ((ret = mz_zip_goto_next_entry(ctx->handle)) == MZ_OK);
+            entries.push_back({
+                {file_info->filename, file_info->filename_size},
+                static_cast<uint64_t>(file_info->compressed_size),
+                static_cast<uint64_t>(file_info->uncompressed_size),
+                file_info->crc,
+                file_info->compression_method,
+                file_info->modified_date,
+                static_cast<int64_t>(file_info->disk_offset),
+            });
+            total_size += entries.back().uncompressed_size;
+        } while ((ret = mz_zip_goto_next_entry(handle)) == MZ_OK);
 
         if (ret != MZ_END_OF_LIST) {
             LOGE("minizip: Finished before EOF: %d", ret);
@@ -203,12 +229,65 @@ ErrorCode MinizipUtils::archive_stats(const std::string &path,
         }
     }
 
-    stats.files = count;
-    stats.total_size = total_size;
+    index.m_entries = std::move(entries);
+    index.m_by_name.clear();
+    index.m_by_name.reserve(index.m_entries.size());
+    index.m_total_size = total_size;
+
+    // Build the lookup table only after the entries vector is final so that
+    // the keys remain valid
+    for (std::size_t i = 0; i < index.m_entries.size(); ++i) {
+        index.m_by_name.insert_or_assign(index.m_entries[i].name, i);
+    }
 
     return ErrorCode::NoError;
 }
 
+ErrorCode MinizipUtils::archive_stats(const std::string &path,
+                                      MinizipUtils::ArchiveStats &stats,
+                                      const std::vector<std::string> &ignore)
+{
+    ZipCtx *ctx = open_zip_file(path, ZipOpenMode::Read);
+    if (!ctx) {
+        LOGE("minizip: Failed to open for reading: %s", path.c_str());
+        return ErrorCode::ArchiveReadOpenError;
+    }
+
+    auto close_ctx = finally([&] {
+        close_zip_file(ctx);
+    });
+
+    ZipIndex index;
+
+    auto ret = index_archive(ctx->handle, index);
+    if (ret != ErrorCode::NoError) {
+        return ret;
+    }
+
+    archive_stats(index, stats, ignore);
+
+    return ErrorCode::NoError;
+}
+
+void MinizipUtils::archive_stats(const ZipIndex &index,
+                                 MinizipUtils::ArchiveStats &stats,
+                                 const std::vector<std::string> &ignore)
+{
+    uint64_t count = index.m_entries.size();
+    uint64_t total_size = index.m_total_size;
+
+    for (auto const &entry : index.m_entries) {
+        if (std::find(ignore.begin(), ignore.end(), entry.name)
+                != ignore.end()) {
+            --count;
+            total_size -= entry.uncompressed_size;
+        }
+    }
+
+    stats.files = count;
+    stats.total_size = total_size;
+}
+
 bool MinizipUtils::copy_file_raw(void *source_handle,
                                  void *target_handle,
                                  const std::string &name,
@@ -427,6 +506,65 @@ bool MinizipUtils::extract_file(void *handle, const std::string &directory)
     return n == 0;
 }
 
+/*!
+ * \brief Add a deflated file, compressing the data on all cores
+ *
+ * The entry is opened in raw mode and the deflate stream, size, and CRC32 are
+ * produced by DeflateUtils::parallel_deflate().
+ */
+static ErrorCode add_file_parallel(void *handle, const mz_zip_file &file_info,
+                                   const DeflateUtils::ReadFn &read_fn)
+{
+    // Compression level 0 opens the entry for raw writing
+    int ret = mz_zip_entry_write_open(handle, &file_info, 0, nullptr);
+    if (ret != MZ_OK) {
+        LOGE("minizip: Failed to open inner file: %d", ret);
+        return ErrorCode::ArchiveWriteDataError;
+    }
+
+    auto close_inner_write = finally([&] {
+        mz_zip_entry_close(handle);
+    });
+
+    bool read_failed = false;
+
+    auto checked_read_fn = [&](void *buf, size_t size) {
+        int64_t n = read_fn(buf, size);
+        if (n < 0) {
+            read_failed = true;
+        }
+        return n;
+    };
+
+    auto write_fn = [&](const void *buf, size_t size) {
+        return mz_zip_entry_write(handle, buf, static_cast<uint32_t>(size))
+                == static_cast<int>(size);
+    };
+
+    DeflateUtils::DeflateResult result;
+
+    if (!DeflateUtils::parallel_deflate(
+            checked_read_fn, write_fn, MZ_COMPRESS_LEVEL_DEFAULT,
+            DeflateUtils::default_threads(), result)) {
+        if (read_failed) {
+            // Already reported by the caller
+            return ErrorCode::FileReadError;
+        }
+        LOGE("minizip: Failed to write inner file data");
+        return ErrorCode::ArchiveWriteDataError;
+    }
+
+    close_inner_write.dismiss();
+
+    ret = mz_zip_entry_close_raw(handle, result.uncompressed_size, result.crc);
+    if (ret != MZ_OK) {
+        LOGE("minizip: Failed to close inner file: %d", ret);
+        return ErrorCode::ArchiveWriteDataError;
+    }
+
+    return ErrorCode::NoError;
+}
+
 ErrorCode MinizipUtils::add_file_from_data(void *handle,
                                            const std::string &name,
                                            const std::string &data)
@@ -436,6 +574,18 @@ ErrorCode MinizipUtils::add_file_from_data(void *handle,
     file_info.filename = name.c_str();
     file_info.filename_size = static_cast<uint16_t>(name.size());
 
+    if (data.size() >= PARALLEL_DEFLATE_THRESHOLD) {
+        size_t offset = 0;
+
+        return add_file_parallel(handle, file_info,
+                                 [&](void *buf, size_t size) {
+            size_t n = std::min(size, data.size() - offset);
+            memcpy(buf, data.data() + offset, n);
+            offset += n;
+            return static_cast<int64_t>(n);
+        });
+    }
+
     int ret = mz_zip_entry_write_open(handle, &file_info,
                                       MZ_COMPRESS_LEVEL_DEFAULT, nullptr);
     if (ret != MZ_OK) {
@@ -466,6 +616,54 @@ ErrorCode MinizipUtils::add_file_from_data(void *handle,
     return ErrorCode::NoError;
 }
 
+/*!
+ * \brief Add a file whose data is already compressed
+ *
+ * \p data is written as is. It must be compressed with the method specified in
+ * \p file_info.
+ */
+ErrorCode MinizipUtils::add_file_from_raw_data(void *handle,
+                                               const mz_zip_file &file_info,
+                                               const std::string &data,
+                                               uint64_t uncompressed_size,
+                                               uint32_t crc)
+{
+    // Compression level 0 opens the entry for raw writing
+    int ret = mz_zip_entry_write_open(handle, &file_info, 0, nullptr);
+    if (ret != MZ_OK) {
+        LOGE("minizip: Failed to open inner file: %d", ret);
+        return ErrorCode::ArchiveWriteDataError;
+    }
+
+    auto close_inner_write = finally([&] {
+        mz_zip_entry_close(handle);
+    });
+
+    // minizip no longer supports buffers larger than UINT16_MAX
+    for (size_t offset = 0; offset < data.size();) {
+        auto n = static_cast<uint32_t>(
+                std::min<size_t>(data.size() - offset, UINT16_MAX));
+
+        if (mz_zip_entry_write(handle, data.data() + offset, n)
+                != static_cast<int>(n)) {
+            LOGE("minizip: Failed to write inner file data");
+            return ErrorCode::ArchiveWriteDataError;
+        }
+
+        offset += n;
+    }
+
+    close_inner_write.dismiss();
+
+    ret = mz_zip_entry_close_raw(handle, uncompressed_size, crc);
+    if (ret != MZ_OK) {
+        LOGE("minizip: Failed to close inner file: %d", ret);
+        return ErrorCode::ArchiveWriteDataError;
+    }
+
+    return ErrorCode::NoError;
+}
+
 ErrorCode MinizipUtils::add_file_from_path(void *handle,
                                            const std::string &name,
                                            const std::string &path)
@@ -494,6 +692,22 @@ ErrorCode MinizipUtils::add_file_from_path(void *handle,
         return ErrorCode::FileOpenError;
     }
 
+    // Unseekable files are compressed serially below
+    auto file_size = file.seek(0, SEEK_END);
+    if (file_size && file.seek(0, SEEK_SET)
+            && file_size.value() >= PARALLEL_DEFLATE_THRESHOLD) {
+        return add_file_parallel(handle, file_info,
+                                 [&](void *buf, size_t size) -> int64_t {
+            auto n = file.read(buf, size);
+            if (!n) {
+                LOGE("%s: Failed to read data: %s",
+                     path.c_str(), n.error().message().c_str());
+                return -1;
+            }
+            return static_cast<int64_t>(n.value());
+        });
+    }
+
     ret = mz_zip_entry_write_open(handle, &file_info,
                                   MZ_COMPRESS_LEVEL_DEFAULT, nullptr);
     if (ret != MZ_OK) {
@@ -22,6 +22,9 @@
 #include "mbcommon/common.h"
 
 #include <memory>
+#include <vector>
+
+#include <cstdint>
 
 #include <openssl/evp.h>
 
@@ -38,6 +41,12 @@ enum class KeyFormat
     Pkcs12,
 };
 
+struct Signature
+{
+    uint32_t version;
+    std::vector<unsigned char> data;
+};
+
 MB_EXPORT Result<ScopedEVP_PKEY>
 load_private_key(BIO &bio_key, KeyFormat format, const char *pass);
 MB_EXPORT Result<ScopedEVP_PKEY>
@@ -53,4 +62,14 @@ sign_data(BIO &bio_data_in, BIO &bio_sig_out, EVP_PKEY &pkey);
 MB_EXPORT Result<void>
 verify_data(BIO &bio_data_in, BIO &bio_sig_in, EVP_PKEY &pkey);
 
+MB_EXPORT Result<Signature>
+load_signature(BIO &bio_sig_in);
+MB_EXPORT Result<std::vector<unsigned char>>
+digest_data(BIO &bio_data_in, const Signature &sig);
+MB_EXPORT Result<std::vector<unsigned char>>
+digest_data(const void *data, size_t size, const Signature &sig);
+MB_EXPORT Result<void>
+verify_digest(const std::vector<unsigned char> &digest, const Signature &sig,
+              EVP_PKEY &pkey);
+
 }
@@ -65,6 +65,8 @@ template <typename T>
 using ScopedMallocable = std::unique_ptr<T, decltype(free) *>;
 
 using ScopedBIO = std::unique_ptr<BIO, decltype(BIO_free) *>;
+using ScopedEVP_PKEY_CTX =
+        std::unique_ptr<EVP_PKEY_CTX, decltype(EVP_PKEY_CTX_free) *>;
 using ScopedPKCS12 = std::unique_ptr<PKCS12, decltype(PKCS12_free) *>;
 
 /*!
@@ -393,6 +395,20 @@ Result<void> sign_data(BIO &bio_data_in, BIO &bio_sig_out, EVP_PKEY &pkey)
     return oc::success();
 }
 
+/*!
+ * \brief Get message digest algorithm for signature version
+ *
+ * \return EVP_MD for the version or nullptr if the version is unsupported
+ */
+static const EVP_MD * md_for_version(uint32_t version)
+{
+    if (version == VERSION_1_SHA512_DGST) {
+        return EVP_sha512();
+    } else {
+        return nullptr;
+    }
+}
+
 /*!
  * \brief Verify signature of data from stream
  *
@@ -407,8 +423,85 @@ Result<void> sign_data(BIO &bio_data_in, BIO &bio_sig_out, EVP_PKEY &pkey)
 Result<void>
 verify_data(BIO &bio_data_in, BIO &bio_sig_in, EVP_PKEY &pkey)
 {
+    OUTCOME_TRY(sig, load_signature(bio_sig_in));
+    OUTCOME_TRY(digest, digest_data(bio_data_in, sig));
+
+    return verify_digest(digest, sig, pkey);
+}
+
+/*!
+ * \brief Load signature from stream
+ *
+ * The signature can then be checked against any number of public keys with
+ * verify_digest() while only hashing the data once.
+ *
+ * \param bio_sig_in Input stream for signature
+ *
+ * \return Signature version and data
+ */
+Result<Signature> load_signature(BIO &bio_sig_in)
+{
+    // Read header from signature file
+    SigHeader hdr;
+    if (BIO_read(&bio_sig_in, &hdr, static_cast<int>(sizeof(hdr)))
+            != static_cast<int>(sizeof(hdr))) {
+        return ErrorInfo{Error::IoError, true};
+    }
+
+    // Verify header
+    if (memcmp(hdr.magic, MAGIC, MAGIC_SIZE) != 0) {
+        return ErrorInfo{Error::InvalidSignatureMagic, false};
+    }
+
+    // Verify version
+    if (!md_for_version(hdr.version)) {
+        return ErrorInfo{Error::InvalidSignatureVersion, false};
+    }
+
+    Signature sig;
+    sig.version = hdr.version;
+
+    // The signature is the rest of the file
+    constexpr size_t buf_size = 1024;
+    unsigned char buf[buf_size];
+
+    while (true) {
+        int n = BIO_read(&bio_sig_in, buf, buf_size);
+        // Empty writable memory BIOs return -1 instead of 0
+        if (n < 0 && !BIO_eof(&bio_sig_in)) {
+            return ErrorInfo{Error::IoError, true};
+        }
+        if (n <= 0) {
+            break;
+        }
+        sig.data.insert(sig.data.end(), buf, buf + n);
+    }
+
+    if (sig.data.empty()) {
+        return ErrorInfo{Error::IoError, false};
+    }
+
+    return sig;
+}
+
+/*!
+ * \brief Compute message digest of data from stream
+ *
+ * \param bio_data_in Input stream for data
+ * \param sig Signature that determines the digest algorithm
+ *
+ * \return Message digest
+ */
+Result<std::vector<unsigned char>>
+digest_data(BIO &bio_data_in, const Signature &sig)
+{
+    const EVP_MD *md_type = md_for_version(sig.version);
     EVP_MD_CTX *mctx = nullptr;
 
+    if (!md_type) {
+        return ErrorInfo{Error::InvalidSignatureVersion, false};
+    }
+
 #ifdef OPENSSL_IS_BORINGSSL
     EVP_MD_CTX ctx;
     EVP_MD_CTX_init(&ctx);
@@ -429,27 +522,7 @@ verify_data(BIO &bio_data_in, BIO &bio_sig_in, EVP_PKEY &pkey)
     }
 #endif
 
-    // Read header from signature file
-    SigHeader hdr;
-    if (BIO_read(&bio_sig_in, &hdr, static_cast<int>(sizeof(hdr)))
-            != static_cast<int>(sizeof(hdr))) {
-        return ErrorInfo{Error::IoError, true};
-    }
-
-    // Verify header
-    if (memcmp(hdr.magic, MAGIC, MAGIC_SIZE) != 0) {
-        return ErrorInfo{Error::InvalidSignatureMagic, false};
-    }
-
-    // Verify version
-    const EVP_MD *md_type = nullptr;
-    if (hdr.version == VERSION_1_SHA512_DGST) {
-        md_type = EVP_sha512();
-    } else {
-        return ErrorInfo{Error::InvalidSignatureVersion, false};
-    }
-
-    if (!EVP_DigestVerifyInit(mctx, nullptr, md_type, nullptr, &pkey)) {
+    if (!EVP_DigestInit_ex(mctx, md_type, nullptr)) {
         return ErrorInfo{Error::OpensslError, true};
     }
 
@@ -461,22 +534,15 @@ verify_data(BIO &bio_data_in, BIO &bio_sig_in, EVP_PKEY &pkey)
         return ErrorInfo{Error::OpensslError, true};
     }
 
-    int siglen = EVP_PKEY_size(&pkey);
-    ScopedMallocable<unsigned char> sigbuf(static_cast<unsigned char *>(
-            OPENSSL_malloc(static_cast<size_t>(siglen))),
-            openssl_free_wrapper);
-    if (!sigbuf) {
-        return ErrorInfo{Error::OpensslError, true};
-    }
-    siglen = BIO_read(&bio_sig_in, sigbuf.get(), siglen);
-    if (siglen <= 0) {
-        return ErrorInfo{Error::IoError, true};
-    }
-
 #ifdef OPENSSL_IS_BORINGSSL
     BIO *bio_input = &bio_data_in;
 #else
     BIO *bio_input = BIO_push(bio_md.get(), &bio_data_in);
+
+    // Don't free the caller's BIO with the digest BIO
+    auto pop_bio = finally([&bio_md] {
+        BIO_pop(bio_md.get());
+    });
 #endif
 
     while (true) {
@@ -494,8 +560,78 @@ verify_data(BIO &bio_data_in, BIO &bio_sig_in, EVP_PKEY &pkey)
 #endif
     }
 
-    int n = EVP_DigestVerifyFinal(mctx, sigbuf.get(),
-                                  static_cast<size_t>(siglen));
+    std::vector<unsigned char> digest(EVP_MAX_MD_SIZE);
+    unsigned int len;
+
+    if (!EVP_DigestFinal_ex(mctx, digest.data(), &len)) {
+        return ErrorInfo{Error::OpensslError, true};
+    }
+
+    digest.resize(len);
+    return digest;
+}
+
+/*!
+ * \brief Compute message digest of data in memory
+ *
+ * \param data Data (eg. from a mapped file)
+ * \param size Size of data
+ * \param sig Signature that determines the digest algorithm
+ *
+ * \return Message digest
+ */
+Result<std::vector<unsigned char>>
+digest_data(const void *data, size_t size, const Signature &sig)
+{
+    const EVP_MD *md_type = md_for_version(sig.version);
+    if (!md_type) {
+        return ErrorInfo{Error::InvalidSignatureVersion, false};
+    }
+
+    std::vector<unsigned char> digest(EVP_MAX_MD_SIZE);
+    unsigned int len;
+
+    if (!EVP_Digest(data, size, digest.data(), &len, md_type, nullptr)) {
+        return ErrorInfo{Error::OpensslError, true};
+    }
+
+    digest.resize(len);
+    return digest;
+}
+
+/*!
+ * \brief Verify signature against a precomputed message digest
+ *
+ * \param digest Message digest from digest_data()
+ * \param sig Signature from load_signature()
+ * \param pkey Public key
+ *
+ * \return Whether the verification operation completed successfully. If the
+ *         signature is invalid, the error code will be set to
+ *         Error::BadSignature.
+ */
+Result<void>
+verify_digest(const std::vector<unsigned char> &digest, const Signature &sig,
+              EVP_PKEY &pkey)
+{
+    const EVP_MD *md_type = md_for_version(sig.version);
+    if (!md_type) {
+        return ErrorInfo{Error::InvalidSignatureVersion, false};
+    }
+
+    ScopedEVP_PKEY_CTX ctx(EVP_PKEY_CTX_new(&pkey, nullptr),
+                           EVP_PKEY_CTX_free);
+    if (!ctx) {
+        return ErrorInfo{Error::OpensslError, true};
+    }
+
+    if (EVP_PKEY_verify_init(ctx.get()) <= 0
+            || EVP_PKEY_CTX_set_signature_md(ctx.get(), md_type) <= 0) {
+        return ErrorInfo{Error::OpensslError, true};
+    }
+
+    int n = EVP_PKEY_verify(ctx.get(), sig.data.data(), sig.data.size(),
+                            digest.data(), digest.size());
     if (n == 1) {
         return oc::success();
     } else if (n == 0) {
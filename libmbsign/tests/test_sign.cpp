@@ -173,3 +173,90 @@ TEST(SignTest, TestLoadValidPemKeysWithInvalidPassphrase)
     auto private_key_read = load_private_key(*bio, KeyFormat::Pem, "gnitset");
     ASSERT_FALSE(private_key_read);
 }
+
+TEST(SignTest, TestVerifyDigest)
+{
+    ScopedEVP_PKEY private_key(nullptr, EVP_PKEY_free);
+    ScopedEVP_PKEY public_key(nullptr, EVP_PKEY_free);
+    ScopedEVP_PKEY other_private_key(nullptr, EVP_PKEY_free);
+    ScopedEVP_PKEY other_public_key(nullptr, EVP_PKEY_free);
+
+    // Generate keys
+    generate_keys(private_key, public_key);
+    generate_keys(other_private_key, other_public_key);
+
+    static constexpr char data[] = "The quick brown fox jumps over the lazy dog";
+
+    // Sign data
+    ScopedBIO bio_data(BIO_new_mem_buf(data, sizeof(data) - 1), BIO_free);
+    ASSERT_TRUE(!!bio_data);
+    ScopedBIO bio_sig(BIO_new(BIO_s_mem()), BIO_free);
+    ASSERT_TRUE(!!bio_sig);
+
+    ASSERT_TRUE(sign_data(*bio_data, *bio_sig, *private_key));
+
+    // Load signature
+    auto sig = load_signature(*bio_sig);
+    ASSERT_TRUE(sig);
+
+    // Digests of the stream and of the memory buffer must match
+    ScopedBIO bio_data2(BIO_new_mem_buf(data, sizeof(data) - 1), BIO_free);
+    ASSERT_TRUE(!!bio_data2);
+
+    auto digest = digest_data(*bio_data2, sig.value());
+    ASSERT_TRUE(digest);
+    auto digest2 = digest_data(data, sizeof(data) - 1, sig.value());
+    ASSERT_TRUE(digest2);
+    ASSERT_EQ(digest.value(), digest2.value());
+
+    // Verify against the correct and the wrong key
+    ASSERT_TRUE(verify_digest(digest.value(), sig.value(), *public_key));
+
+    auto ret = verify_digest(digest.value(), sig.value(), *other_public_key);
+    ASSERT_FALSE(ret);
+    ASSERT_EQ(ret.error().ec, Error::BadSignature);
+
+    // Verify modified data
+    auto digest3 = digest_data(data, sizeof(data) - 2, sig.value());
+    ASSERT_TRUE(digest3);
+
+    ret = verify_digest(digest3.value(), sig.value(), *public_key);
+    ASSERT_FALSE(ret);
+    ASSERT_EQ(ret.error().ec, Error::BadSignature);
+}
+
+TEST(SignTest, TestVerifyData)
+{
+    ScopedEVP_PKEY private_key(nullptr, EVP_PKEY_free);
+    ScopedEVP_PKEY public_key(nullptr, EVP_PKEY_free);
+
+    // Generate keys
+    generate_keys(private_key, public_key);
+
+    static constexpr char data[] = "foobar";
+
+    ScopedBIO bio_data(BIO_new_mem_buf(data, sizeof(data) - 1), BIO_free);
+    ASSERT_TRUE(!!bio_data);
+    ScopedBIO bio_sig(BIO_new(BIO_s_mem()), BIO_free);
+    ASSERT_TRUE(!!bio_sig);
+
+    ASSERT_TRUE(sign_data(*bio_data, *bio_sig, *private_key));
+
+    ScopedBIO bio_data2(BIO_new_mem_buf(data, sizeof(data) - 1), BIO_free);
+    ASSERT_TRUE(!!bio_data2);
+
+    ASSERT_TRUE(verify_data(*bio_data2, *bio_sig, *public_key));
+}
+
+TEST(SignTest, TestLoadInvalidSignature)
+{
+    static constexpr char sig_data[] = "!NOSIGN!\x01\0\0\0\0\0\0\0\0\0\0\0abcd";
+
+    ScopedBIO bio_sig(BIO_new_mem_buf(sig_data, sizeof(sig_data) - 1),
+                      BIO_free);
+    ASSERT_TRUE(!!bio_sig);
+
+    auto sig = load_signature(*bio_sig);
+    ASSERT_FALSE(sig);
+    ASSERT_EQ(sig.error().ec, Error::InvalidSignatureMagic);
+}
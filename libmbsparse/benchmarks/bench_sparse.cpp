@@ -0,0 +1,639 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "benchmark.h"
+
+#include <algorithm>
+#include <atomic>
+#include <new>
+#include <optional>
+#include <vector>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <malloc.h>
+
+#include "mbcommon/endian.h"
+#include "mbcommon/file.h"
+#include "mbcommon/file/memory.h"
+#include "mbcommon/file_error.h"
+#include "mbcommon/finally.h"
+
+#include "mbsparse/sparse.h"
+#include "mbsparse/sparse_p.h"
+
+using namespace mb;
+using namespace mb::bench;
+using namespace mb::sparse;
+using namespace mb::sparse::detail;
+
+static constexpr uint32_t BLOCK_SIZE = 4096;
+static constexpr uint64_t IMAGE_SIZE = 4ull * 1024 * 1024 * 1024;
+static constexpr size_t PATTERN_SIZE = 1024 * 1024;
+static constexpr size_t READ_BUFFER_SIZE = 1024 * 1024;
+static constexpr size_t RANDOM_READ_SIZE = 4096;
+
+// Heap accounting for measuring the peak memory use while reading an image.
+// Only the default operator new is replaced, which is what std::vector uses.
+
+static std::atomic<size_t> g_heap_current;
+static std::atomic<size_t> g_heap_peak;
+
+static void * counted_alloc(size_t size)
+{
+    void *ptr = malloc(size ? size : 1);
+    if (!ptr) {
+        fprintf(stderr, "Out of memory\n");
+        abort();
+    }
+
+    auto current = g_heap_current += malloc_usable_size(ptr);
+    auto peak = g_heap_peak.load();
+    while (current > peak && !g_heap_peak.compare_exchange_weak(peak, current));
+
+    return ptr;
+}
+
+static void counted_free(void *ptr)
+{
+    if (ptr) {
+        g_heap_current -= malloc_usable_size(ptr);
+        free(ptr);
+    }
+}
+
+void * operator new(size_t size)
+{
+    return counted_alloc(size);
+}
+
+void * operator new[](size_t size)
+{
+    return counted_alloc(size);
+}
+
+void operator delete(void *ptr) noexcept
+{
+    counted_free(ptr);
+}
+
+void operator delete[](void *ptr) noexcept
+{
+    counted_free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept
+{
+    counted_free(ptr);
+}
+
+void operator delete[](void *ptr, size_t) noexcept
+{
+    counted_free(ptr);
+}
+
+// Tracks the heap usage above the level at construction time
+class HeapWatermark
+{
+public:
+    HeapWatermark() : m_baseline(g_heap_current.load())
+    {
+        g_heap_peak = m_baseline;
+    }
+
+    size_t peak() const
+    {
+        auto peak = g_heap_peak.load();
+        return peak > m_baseline ? peak - m_baseline : 0;
+    }
+
+private:
+    size_t m_baseline;
+};
+
+// Distribution of chunk types and lengths. The typical layout is similar to an
+// ext4 system image from img2simg (long raw and skip runs, occasional fills).
+// The fragmented layout is a worst case for the size of the chunk list.
+enum class Layout
+{
+    Typical,
+    Fragmented,
+};
+
+struct ChunkSpec
+{
+    uint16_t type;
+    uint32_t blocks;
+    uint32_t fill_val;
+    // Offset of the chunk header in the sparse image
+    uint64_t src_offset;
+};
+
+struct ImageSpec
+{
+    std::vector<ChunkSpec> chunks;
+    uint64_t sparse_size;
+};
+
+static uint32_t xorshift(uint32_t &x)
+{
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return x;
+}
+
+static ImageSpec make_image_spec(Layout layout)
+{
+    // Percent chance of each chunk type and maximum run length in blocks
+    struct TypeParams
+    {
+        uint16_t type;
+        uint32_t percent;
+        uint32_t max_blocks;
+    };
+
+    static constexpr TypeParams typical[] = {
+        { CHUNK_TYPE_RAW,       60, 512 },
+        { CHUNK_TYPE_FILL,      25, 32 },
+        { CHUNK_TYPE_DONT_CARE, 15, 2048 },
+    };
+    static constexpr TypeParams fragmented[] = {
+        { CHUNK_TYPE_RAW,       50, 8 },
+        { CHUNK_TYPE_FILL,      25, 4 },
+        { CHUNK_TYPE_DONT_CARE, 25, 8 },
+    };
+
+    auto const &params = layout == Layout::Typical ? typical : fragmented;
+
+    ImageSpec spec;
+    uint64_t src_offset = sizeof(SparseHeader);
+    uint32_t blocks_left = static_cast<uint32_t>(IMAGE_SIZE / BLOCK_SIZE);
+    uint32_t x = 0x12345678;
+
+    while (blocks_left > 0) {
+        auto roll = xorshift(x) % 100;
+        auto const *p = std::begin(params);
+        for (; roll >= p->percent; ++p) {
+            roll -= p->percent;
+        }
+
+        ChunkSpec chunk;
+        chunk.type = p->type;
+        chunk.blocks = std::min(xorshift(x) % p->max_blocks + 1, blocks_left);
+        chunk.fill_val = chunk.type == CHUNK_TYPE_FILL ? xorshift(x) % 4 : 0;
+        chunk.src_offset = src_offset;
+
+        src_offset += sizeof(ChunkHeader);
+        if (chunk.type == CHUNK_TYPE_RAW) {
+            src_offset += uint64_t(chunk.blocks) * BLOCK_SIZE;
+        } else if (chunk.type == CHUNK_TYPE_FILL) {
+            src_offset += sizeof(uint32_t);
+        }
+
+        blocks_left -= chunk.blocks;
+        spec.chunks.push_back(chunk);
+    }
+
+    spec.sparse_size = src_offset;
+
+    return spec;
+}
+
+// Layouts are generated once and shared by all benchmarks
+static const ImageSpec & image_spec(Layout layout)
+{
+    static std::optional<ImageSpec> specs[2];
+    auto &spec = specs[static_cast<size_t>(layout)];
+
+    if (!spec) {
+        spec = make_image_spec(layout);
+    }
+
+    return *spec;
+}
+
+static const std::vector<unsigned char> & raw_pattern()
+{
+    static auto data = [] {
+        std::vector<unsigned char> buf(PATTERN_SIZE);
+        uint32_t x = 0x87654321;
+        for (auto &c : buf) {
+            c = static_cast<unsigned char>(xorshift(x));
+        }
+        return buf;
+    }();
+    return data;
+}
+
+// Read-only File that generates the bytes of a sparse image on the fly so that
+// multi-GB images do not need to be stored anywhere
+class GeneratedImageFile : public File
+{
+public:
+    GeneratedImageFile(const ImageSpec &spec, Seekability seekability)
+        : m_spec(&spec)
+        , m_seekability(seekability)
+        , m_pos(0)
+    {
+        SparseHeader shdr = {};
+        shdr.magic = SPARSE_HEADER_MAGIC;
+        shdr.major_version = SPARSE_HEADER_MAJOR_VER;
+        shdr.file_hdr_sz = sizeof(SparseHeader);
+        shdr.chunk_hdr_sz = sizeof(ChunkHeader);
+        shdr.blk_sz = BLOCK_SIZE;
+        shdr.total_blks = static_cast<uint32_t>(IMAGE_SIZE / BLOCK_SIZE);
+        shdr.total_chunks = static_cast<uint32_t>(spec.chunks.size());
+        to_le_sparse_header(shdr);
+        memcpy(m_header, &shdr, sizeof(shdr));
+    }
+
+    oc::result<void> close() override
+    {
+        m_spec = nullptr;
+        return oc::success();
+    }
+
+    oc::result<size_t> read(void *buf, size_t size) override
+    {
+        if (!is_open()) return FileError::InvalidState;
+
+        auto *out = static_cast<unsigned char *>(buf);
+        size_t total = 0;
+
+        while (total < size && m_pos < m_spec->sparse_size) {
+            auto n = generate(m_pos, out + total, size - total);
+            m_pos += n;
+            total += n;
+        }
+
+        return total;
+    }
+
+    oc::result<size_t> write(const void *buf, size_t size) override
+    {
+        (void) buf;
+        (void) size;
+        return FileError::UnsupportedWrite;
+    }
+
+    oc::result<uint64_t> seek(int64_t offset, int whence) override
+    {
+        if (!is_open()) return FileError::InvalidState;
+
+        switch (m_seekability) {
+        case Seekability::CanSeek:
+            break;
+        case Seekability::CanSkip:
+            if (whence == SEEK_CUR && offset >= 0) {
+                break;
+            }
+            return FileError::UnsupportedSeek;
+        case Seekability::CanRead:
+            return FileError::UnsupportedSeek;
+        }
+
+        int64_t base;
+        if (whence == SEEK_SET) {
+            base = 0;
+        } else if (whence == SEEK_CUR) {
+            base = static_cast<int64_t>(m_pos);
+        } else if (whence == SEEK_END) {
+            base = static_cast<int64_t>(m_spec->sparse_size);
+        } else {
+            return std::make_error_code(std::errc::invalid_argument);
+        }
+
+        if (offset < 0 && -offset > base) {
+            return FileError::ArgumentOutOfRange;
+        }
+
+        m_pos = static_cast<uint64_t>(base + offset);
+        return m_pos;
+    }
+
+    oc::result<void> truncate(uint64_t size) override
+    {
+        (void) size;
+        return FileError::UnsupportedTruncate;
+    }
+
+    bool is_open() override
+    {
+        return m_spec;
+    }
+
+private:
+    // Generate bytes starting at offset, stopping at the end of the header or
+    // chunk section containing the offset
+    size_t generate(uint64_t offset, unsigned char *out, size_t size)
+    {
+        if (offset < sizeof(m_header)) {
+            auto n = std::min<size_t>(size,
+                    sizeof(m_header) - static_cast<size_t>(offset));
+            memcpy(out, m_header + offset, n);
+            return n;
+        }
+
+        auto const &chunks = m_spec->chunks;
+        auto it = std::upper_bound(chunks.begin(), chunks.end(), offset,
+                                   [](uint64_t o, const ChunkSpec &c) {
+            return o < c.src_offset;
+        }) - 1;
+        auto rel = offset - it->src_offset;
+
+        if (rel < sizeof(ChunkHeader)) {
+            ChunkHeader chdr = {};
+            chdr.chunk_type = it->type;
+            chdr.chunk_sz = it->blocks;
+            chdr.total_sz = sizeof(ChunkHeader);
+            if (it->type == CHUNK_TYPE_RAW) {
+                chdr.total_sz += it->blocks * BLOCK_SIZE;
+            } else if (it->type == CHUNK_TYPE_FILL) {
+                chdr.total_sz += static_cast<uint32_t>(sizeof(uint32_t));
+            }
+            to_le_chunk_header(chdr);
+
+            auto n = std::min<size_t>(size,
+                    sizeof(chdr) - static_cast<size_t>(rel));
+            memcpy(out, reinterpret_cast<unsigned char *>(&chdr) + rel, n);
+            return n;
+        }
+
+        rel -= sizeof(ChunkHeader);
+
+        if (it->type == CHUNK_TYPE_FILL) {
+            uint32_t fill_val = mb_htole32(it->fill_val);
+            auto n = std::min<size_t>(size,
+                    sizeof(fill_val) - static_cast<size_t>(rel));
+            memcpy(out, reinterpret_cast<unsigned char *>(&fill_val) + rel, n);
+            return n;
+        }
+
+        // Raw data is a repeating pattern indexed by the source offset
+        auto const &pattern = raw_pattern();
+        auto pattern_offset = static_cast<size_t>(offset % pattern.size());
+        auto n = std::min<uint64_t>({
+            size,
+            uint64_t(it->blocks) * BLOCK_SIZE - rel,
+            pattern.size() - pattern_offset,
+        });
+        memcpy(out, pattern.data() + pattern_offset, static_cast<size_t>(n));
+        return static_cast<size_t>(n);
+    }
+
+    const ImageSpec *m_spec;
+    Seekability m_seekability;
+    uint64_t m_pos;
+    unsigned char m_header[sizeof(SparseHeader)];
+};
+
+static void set_image_counters(State &state, const ImageSpec &spec,
+                               const HeapWatermark &heap)
+{
+    state.set_counter("chunks", static_cast<double>(spec.chunks.size()));
+    state.set_counter("sparse_bytes", static_cast<double>(spec.sparse_size));
+    state.set_counter("peak_heap_bytes", static_cast<double>(heap.peak()));
+}
+
+static void bench_read(State &state, Layout layout, Seekability seekability,
+                       SparseFileFlags flags)
+{
+    state.pause_timing();
+    auto const &spec = image_spec(layout);
+    (void) raw_pattern();
+    std::vector<unsigned char> buf(READ_BUFFER_SIZE);
+    state.resume_timing();
+
+    HeapWatermark heap;
+    uint64_t total = 0;
+
+    for (uint64_t i = 0; i < state.iterations(); ++i) {
+        GeneratedImageFile file(spec, seekability);
+        SparseFile sparse_file;
+
+        if (!sparse_file.open(&file, flags)) {
+            return state.skip("Failed to open sparse image");
+        }
+
+        while (true) {
+            auto n = sparse_file.read(buf.data(), buf.size());
+            if (!n) {
+                return state.skip("Failed to read sparse image");
+            } else if (n.value() == 0) {
+                break;
+            }
+            do_not_optimize(buf);
+            total += n.value();
+        }
+    }
+
+    if (total != state.iterations() * IMAGE_SIZE) {
+        return state.skip("Image size mismatch");
+    }
+
+    state.set_bytes_processed(total);
+    set_image_counters(state, spec, heap);
+}
+
+static void bench_extents(State &state, Layout layout, Seekability seekability)
+{
+    state.pause_timing();
+    auto const &spec = image_spec(layout);
+    (void) raw_pattern();
+    state.resume_timing();
+
+    HeapWatermark heap;
+    uint64_t total = 0;
+
+    for (uint64_t i = 0; i < state.iterations(); ++i) {
+        GeneratedImageFile file(spec, seekability);
+        SparseFile sparse_file;
+
+        if (!sparse_file.open(&file)) {
+            return state.skip("Failed to open sparse image");
+        }
+
+        while (true) {
+            auto extent = sparse_file.next_extent();
+            if (!extent) {
+                return state.skip("Failed to get extent");
+            } else if (!extent.value()) {
+                break;
+            } else if (!sparse_file.skip_extent()) {
+                return state.skip("Failed to skip extent");
+            }
+            total += extent.value()->length;
+        }
+    }
+
+    state.set_bytes_processed(total);
+    set_image_counters(state, spec, heap);
+}
+
+// Time to build the full chunk list by seeking to the end of the image
+static void bench_build_index(State &state, Layout layout)
+{
+    state.pause_timing();
+    auto const &spec = image_spec(layout);
+    state.resume_timing();
+
+    HeapWatermark heap;
+
+    for (uint64_t i = 0; i < state.iterations(); ++i) {
+        GeneratedImageFile file(spec, Seekability::CanSeek);
+        SparseFile sparse_file;
+
+        if (!sparse_file.open(&file)
+                || !sparse_file.seek(0, SEEK_END)) {
+            return state.skip("Failed to index sparse image");
+        }
+    }
+
+    set_image_counters(state, spec, heap);
+}
+
+static void bench_load_index(State &state, Layout layout)
+{
+    state.pause_timing();
+
+    auto const &spec = image_spec(layout);
+    void *index_buf = nullptr;
+    size_t index_size = 0;
+    auto free_index_buf = finally([&] {
+        free(index_buf);
+    });
+
+    {
+        GeneratedImageFile file(spec, Seekability::CanSeek);
+        SparseFile sparse_file;
+        MemoryFile index_file(&index_buf, &index_size);
+
+        if (!sparse_file.open(&file) || !sparse_file.save_index(index_file)) {
+            return state.skip("Failed to save chunk index");
+        }
+    }
+
+    state.resume_timing();
+
+    HeapWatermark heap;
+
+    for (uint64_t i = 0; i < state.iterations(); ++i) {
+        GeneratedImageFile file(spec, Seekability::CanSeek);
+        SparseFile sparse_file;
+        MemoryFile index_file(index_buf, index_size);
+
+        if (!sparse_file.open(&file) || !sparse_file.load_index(index_file)) {
+            return state.skip("Failed to load chunk index");
+        }
+    }
+
+    state.set_bytes_processed(state.iterations() * index_size);
+    set_image_counters(state, spec, heap);
+}
+
+// Latency of a random 4 KiB read once the chunk list is complete
+static void bench_random_read(State &state, Layout layout)
+{
+    state.pause_timing();
+
+    auto const &spec = image_spec(layout);
+    (void) raw_pattern();
+    std::vector<unsigned char> buf(RANDOM_READ_SIZE);
+
+    GeneratedImageFile file(spec, Seekability::CanSeek);
+    SparseFile sparse_file;
+
+    if (!sparse_file.open(&file) || !sparse_file.seek(0, SEEK_END)) {
+        return state.skip("Failed to index sparse image");
+    }
+
+    state.resume_timing();
+
+    uint32_t x = 0x2468ace0;
+
+    for (uint64_t i = 0; i < state.iterations(); ++i) {
+        auto block = xorshift(x) % (IMAGE_SIZE / BLOCK_SIZE);
+        auto offset = static_cast<int64_t>(block * BLOCK_SIZE);
+
+        if (!sparse_file.seek(offset, SEEK_SET)
+                || !sparse_file.read(buf.data(), buf.size())) {
+            return state.skip("Failed to read sparse image");
+        }
+        do_not_optimize(buf);
+    }
+
+    state.set_bytes_processed(state.iterations() * RANDOM_READ_SIZE);
+}
+
+static bool register_sparse_benchmarks()
+{
+    static constexpr struct
+    {
+        Seekability seekability;
+        const char *name;
+    } sources[] = {
+        { Seekability::CanSeek, "seekable" },
+        { Seekability::CanSkip, "skippable" },
+        { Seekability::CanRead, "unseekable" },
+    };
+
+    for (auto layout : {Layout::Typical, Layout::Fragmented}) {
+        auto prefix = std::string("sparse_")
+                + (layout == Layout::Typical ? "typical_" : "fragmented_");
+
+        for (auto const &source : sources) {
+            auto seekability = source.seekability;
+
+            register_benchmark(prefix + "read_" + source.name,
+                               [=](State &state) {
+                bench_read(state, layout, seekability, {});
+            });
+            register_benchmark(prefix + "read_verify_" + source.name,
+                               [=](State &state) {
+                bench_read(state, layout, seekability,
+                           SparseFileFlag::VerifyCrc32);
+            });
+            register_benchmark(prefix + "extents_" + source.name,
+                               [=](State &state) {
+                bench_extents(state, layout, seekability);
+            });
+        }
+
+        register_benchmark(prefix + "build_index_seekable",
+                           [=](State &state) {
+            bench_build_index(state, layout);
+        });
+        register_benchmark(prefix + "load_index_seekable",
+                           [=](State &state) {
+            bench_load_index(state, layout);
+        });
+        register_benchmark(prefix + "random_read_seekable",
+                           [=](State &state) {
+            bench_random_read(state, layout);
+        });
+    }
+
+    return true;
+}
+
+[[maybe_unused]] static bool sparse_benchmarks_registered =
+        register_sparse_benchmarks();
@@ -0,0 +1,39 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "mbcommon/common.h"
+
+namespace mb::sparse
+{
+
+MB_EXPORT void fill_repeated(void *buf, size_t size, uint32_t fill_val) noexcept;
+
+MB_EXPORT bool is_zero_block(const void *buf, size_t size) noexcept;
+MB_EXPORT bool is_fill_block(const void *buf, size_t size,
+                             uint32_t &fill_val) noexcept;
+
+MB_EXPORT const char * fill_implementation() noexcept;
+
+}
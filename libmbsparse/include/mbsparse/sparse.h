@@ -20,20 +20,51 @@
 
 #pragma once
 
+#include <optional>
 #include <vector>
 
 #include "mbcommon/file.h"
+#include "mbcommon/flags.h"
 
 #include "mbsparse/sparse_p.h"
 
 namespace mb::sparse
 {
 
+enum class SparseFileFlag : uint8_t
+{
+    // Verify CRC32 chunks and the image checksum. Only sequential reads are
+    // allowed.
+    VerifyCrc32 = 1 << 0,
+};
+MB_DECLARE_FLAGS(SparseFileFlags, SparseFileFlag)
+MB_DECLARE_OPERATORS_FOR_FLAGS(SparseFileFlags)
+
+enum class ExtentType
+{
+    Data,
+    Fill,
+    Hole,
+};
+
+struct Extent
+{
+    // Offset of the extent in the output file
+    uint64_t offset;
+    // Length of the extent in bytes
+    uint64_t length;
+    ExtentType type;
+    // [ExtentType::Fill only] Filler value (in host byte order), rotated so
+    // that the first byte of the little-endian representation is the byte at
+    // the start of the extent
+    uint32_t fill_val;
+};
+
 class MB_EXPORT SparseFile : public File
 {
 public:
     SparseFile();
-    SparseFile(File *file);
+    SparseFile(File *file, SparseFileFlags flags = {});
     virtual ~SparseFile();
 
     SparseFile(SparseFile &&other) noexcept;
@@ -42,7 +73,7 @@ public:
     MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(SparseFile)
 
     // File open
-    oc::result<void> open(File *file);
+    oc::result<void> open(File *file, SparseFileFlags flags = {});
 
     oc::result<void> close() override;
 
@@ -55,6 +86,15 @@ public:
 
     // File size
     uint64_t size() noexcept;
+    uint32_t block_size() noexcept;
+
+    // Extents
+    oc::result<std::optional<Extent>> next_extent();
+    oc::result<void> skip_extent();
+
+    // Chunk index
+    oc::result<void> save_index(File &file);
+    oc::result<void> load_index(File &file);
 
 private:
     void clear() noexcept;
@@ -85,12 +125,21 @@ private:
 
     oc::result<void> move_to_chunk(uint64_t offset) noexcept;
 
+    oc::result<void> validate_chunk(const detail::ChunkInfo &chunk) noexcept;
+
+    oc::result<void> verify_image_checksum() noexcept;
+
     File *m_file;
+    SparseFileFlags m_flags;
     detail::Seekability m_seekability;
 
-    // Expected CRC32 checksum. We currently do *not* validate this. It would
-    // only work if the entire file was read sequentially anyway.
+    // Expected CRC32 checksum from the last CRC32 chunk. This is only
+    // validated with SparseFileFlag::VerifyCrc32 since it requires the entire
+    // file to be read sequentially.
     uint32_t m_expected_crc32;
+    // [SparseFileFlag::VerifyCrc32 only] CRC32 checksum of the output data up
+    // to m_cur_tgt_offset
+    uint32_t m_crc32;
     // Relative offset in input file
     uint64_t m_cur_src_offset;
     // Absolute offset in output file
@@ -44,6 +44,14 @@ enum class SparseFileError
     InvalidCrc32Chunk           = 36,
 
     InternalError               = 40,
+
+    // Chunk index errors
+    InvalidIndexHeader          = 50,
+    IndexDoesNotMatchImage      = 51,
+    InvalidIndexEntry           = 52,
+
+    // Verification errors
+    ChecksumMismatch            = 60,
 };
 
 MB_EXPORT std::error_code make_error_code(SparseFileError e);
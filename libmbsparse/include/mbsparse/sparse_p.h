@@ -20,8 +20,11 @@
 
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
 
+#include "mbcommon/endian.h"
+
 namespace mb::sparse::detail
 {
 
@@ -90,6 +93,41 @@ struct ChunkInfo
     uint32_t fill_val;
 };
 
+/*
+ * Serialized chunk index (all fields are little-endian). The index header is
+ * followed by one IndexEntry per chunk, in order. The sparse header fields are
+ * copied so that an index cannot be used with a different image.
+ */
+
+constexpr char SPARSE_INDEX_MAGIC[] =       "MBSPIDX";
+constexpr size_t SPARSE_INDEX_MAGIC_SIZE =  8;
+constexpr uint32_t SPARSE_INDEX_VERSION =   1;
+
+struct IndexHeader
+{
+    unsigned char magic[SPARSE_INDEX_MAGIC_SIZE];
+    uint32_t version;
+    uint16_t file_hdr_sz;
+    uint16_t chunk_hdr_sz;
+    uint32_t blk_sz;
+    uint32_t total_blks;
+    uint32_t total_chunks;
+    uint32_t image_checksum;
+};
+
+struct IndexEntry
+{
+    uint16_t type;
+    uint16_t reserved;
+    uint32_t fill_val;
+    uint64_t begin;
+    uint64_t end;
+    uint64_t src_begin;
+    uint64_t src_end;
+    uint64_t raw_begin;
+    uint64_t raw_end;
+};
+
 enum class Seekability : uint8_t
 {
     CanSeek,
@@ -97,6 +135,27 @@ enum class Seekability : uint8_t
     CanRead,
 };
 
+static inline void to_le_sparse_header(SparseHeader &header) noexcept
+{
+    header.magic = mb_htole32(header.magic);
+    header.major_version = mb_htole16(header.major_version);
+    header.minor_version = mb_htole16(header.minor_version);
+    header.file_hdr_sz = mb_htole16(header.file_hdr_sz);
+    header.chunk_hdr_sz = mb_htole16(header.chunk_hdr_sz);
+    header.blk_sz = mb_htole32(header.blk_sz);
+    header.total_blks = mb_htole32(header.total_blks);
+    header.total_chunks = mb_htole32(header.total_chunks);
+    header.image_checksum = mb_htole32(header.image_checksum);
+}
+
+static inline void to_le_chunk_header(ChunkHeader &header) noexcept
+{
+    header.chunk_type = mb_htole16(header.chunk_type);
+    header.reserved1 = mb_htole16(header.reserved1);
+    header.chunk_sz = mb_htole32(header.chunk_sz);
+    header.total_sz = mb_htole32(header.total_sz);
+}
+
 /*! \endcond */
 
 }
@@ -0,0 +1,43 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <functional>
+
+#include "mbcommon/file.h"
+
+namespace mb::sparse
+{
+
+class SparseFile;
+
+// Called to get the output File handle for each piece. The File handle for the
+// previous piece is no longer used once this is called for the next piece.
+using SparseSplitOpenCallback = std::function<oc::result<File *>(size_t index)>;
+
+MB_EXPORT oc::result<size_t>
+split_sparse_file(SparseFile &input, uint64_t max_size,
+                  const SparseSplitOpenCallback &open_output);
+
+MB_EXPORT oc::result<size_t>
+split_raw_file(File &input, uint64_t size, uint32_t block_size,
+               uint64_t max_size, const SparseSplitOpenCallback &open_output);
+
+}
@@ -0,0 +1,108 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <vector>
+
+#include "mbcommon/file.h"
+#include "mbcommon/flags.h"
+
+namespace mb::sparse
+{
+
+enum class SparseWriterFlag : uint8_t
+{
+    // Store all-zero blocks as "don't care" chunks instead of fill chunks
+    DontCareZeroBlocks = 1 << 0,
+    // Append a CRC32 chunk and set the image checksum in the sparse header
+    WriteCrc32         = 1 << 1,
+};
+MB_DECLARE_FLAGS(SparseWriterFlags, SparseWriterFlag)
+MB_DECLARE_OPERATORS_FOR_FLAGS(SparseWriterFlags)
+
+constexpr uint32_t SPARSE_DEFAULT_BLOCK_SIZE = 4096;
+
+class MB_EXPORT SparseWriter : public File
+{
+public:
+    SparseWriter();
+    SparseWriter(File *file, uint32_t block_size = SPARSE_DEFAULT_BLOCK_SIZE,
+                 SparseWriterFlags flags = {});
+    virtual ~SparseWriter();
+
+    SparseWriter(SparseWriter &&other) noexcept;
+    SparseWriter & operator=(SparseWriter &&rhs) noexcept;
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(SparseWriter)
+
+    // File open
+    oc::result<void> open(File *file,
+                          uint32_t block_size = SPARSE_DEFAULT_BLOCK_SIZE,
+                          SparseWriterFlags flags = {});
+
+    oc::result<void> close() override;
+
+    oc::result<size_t> read(void *buf, size_t size) override;
+    oc::result<size_t> write(const void *buf, size_t size) override;
+    oc::result<uint64_t> seek(int64_t offset, int whence) override;
+    oc::result<void> truncate(uint64_t size) override;
+
+    bool is_open() override;
+
+    // Number of chunks written so far
+    uint32_t chunk_count() const noexcept;
+
+private:
+    /*! \cond INTERNAL */
+    void clear() noexcept;
+
+    oc::result<void> add_block(const unsigned char *block);
+    oc::result<void> add_dont_care_blocks(uint64_t count);
+    oc::result<void> add_zeros(uint64_t size);
+    oc::result<void> extend_chunk(uint16_t type, uint32_t fill_val,
+                                  const unsigned char *raw_block);
+    oc::result<void> flush_chunk();
+    oc::result<void> write_chunk(uint16_t type, uint32_t blocks,
+                                 const void *data, size_t data_size);
+
+    File *m_file;
+    uint32_t m_block_size;
+    SparseWriterFlags m_flags;
+
+    // Offset of the sparse header in the output file
+    uint64_t m_header_offset;
+
+    // Partially filled block
+    std::vector<unsigned char> m_block;
+    size_t m_block_used;
+
+    // Chunk currently being coalesced
+    uint16_t m_chunk_type;
+    uint32_t m_chunk_blocks;
+    uint32_t m_chunk_fill_val;
+    std::vector<unsigned char> m_chunk_raw;
+
+    uint32_t m_total_blocks;
+    uint32_t m_total_chunks;
+    uint32_t m_crc32;
+    /*! \endcond */
+};
+
+}
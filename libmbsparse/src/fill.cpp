@@ -0,0 +1,334 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "mbsparse/fill.h"
+
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#  include <cpuid.h>
+#  include <emmintrin.h>
+#  define FILL_HAVE_SSE2
+#elif defined(__GNUC__) && defined(__aarch64__) && defined(__linux__)
+#  include <sys/auxv.h>
+#  include <arm_neon.h>
+#  ifndef HWCAP_ASIMD
+#    define HWCAP_ASIMD (1 << 1)
+#  endif
+#  define FILL_HAVE_NEON
+#endif
+
+#include "mbcommon/endian.h"
+
+/*!
+ * \file mbsparse/fill.h
+ * \brief Expand and detect blocks of a repeating 32-bit value
+ *
+ * The implementation is selected at runtime based on the CPU features
+ * available: SSE2 on x86, NEON (ASIMD) on aarch64, and portable loops over
+ * 64-bit words everywhere else. All implementations produce identical results.
+ */
+
+namespace mb::sparse
+{
+
+// Bytes processed per iteration of the main loops
+static constexpr size_t GROUP_SIZE = 64;
+static constexpr size_t GROUP_WORDS = GROUP_SIZE / sizeof(uint64_t);
+
+// Write size bytes of a 64-byte pattern to out. Used for the tail that is
+// shorter than a group.
+static inline void fill_tail(unsigned char *out, size_t size,
+                             uint32_t word) noexcept
+{
+    unsigned char pattern[GROUP_SIZE];
+    for (size_t i = 0; i < GROUP_SIZE; i += sizeof(word)) {
+        memcpy(pattern + i, &word, sizeof(word));
+    }
+
+    memcpy(out, pattern, size);
+}
+
+// Compare size bytes, which are fewer than a group, against the pattern
+static inline bool matches_tail(const unsigned char *buf, size_t size,
+                                uint64_t pattern) noexcept
+{
+    unsigned char expected[GROUP_SIZE];
+    for (size_t i = 0; i < GROUP_WORDS; ++i) {
+        memcpy(expected + i * sizeof(pattern), &pattern, sizeof(pattern));
+    }
+
+    return memcmp(buf, expected, size) == 0;
+}
+
+// The fill functions take the 4-byte value in memory order (ie. word's bytes
+// are written as-is) and the match functions take an 8-byte pattern in memory
+// order.
+
+static void fill_generic(unsigned char *out, size_t size,
+                         uint32_t word) noexcept
+{
+    unsigned char pattern[GROUP_SIZE];
+    for (size_t i = 0; i < GROUP_SIZE; i += sizeof(word)) {
+        memcpy(pattern + i, &word, sizeof(word));
+    }
+
+    for (; size >= GROUP_SIZE; size -= GROUP_SIZE, out += GROUP_SIZE) {
+        memcpy(out, pattern, GROUP_SIZE);
+    }
+
+    memcpy(out, pattern, size);
+}
+
+// Load a group of words (alignment-safe) and return the OR of each word XOR'd
+// with the pattern. The result is 0 if and only if the group matches.
+static inline uint64_t group_diff(const unsigned char *ptr,
+                                  uint64_t pattern) noexcept
+{
+    uint64_t words[GROUP_WORDS];
+    memcpy(words, ptr, sizeof(words));
+
+    uint64_t diff = 0;
+    for (size_t i = 0; i < GROUP_WORDS; ++i) {
+        diff |= words[i] ^ pattern;
+    }
+
+    return diff;
+}
+
+static bool matches_generic(const unsigned char *buf, size_t size,
+                            uint64_t pattern) noexcept
+{
+    for (; size >= GROUP_SIZE; size -= GROUP_SIZE, buf += GROUP_SIZE) {
+        if (group_diff(buf, pattern) != 0) {
+            return false;
+        }
+    }
+
+    return matches_tail(buf, size, pattern);
+}
+
+#ifdef FILL_HAVE_SSE2
+#define SSE2_TARGET __attribute__((target("sse2")))
+
+SSE2_TARGET
+static void fill_sse2(unsigned char *out, size_t size, uint32_t word) noexcept
+{
+    const __m128i v = _mm_set1_epi32(static_cast<int>(word));
+
+    for (; size >= GROUP_SIZE; size -= GROUP_SIZE, out += GROUP_SIZE) {
+        auto p = reinterpret_cast<__m128i *>(out);
+        _mm_storeu_si128(p, v);
+        _mm_storeu_si128(p + 1, v);
+        _mm_storeu_si128(p + 2, v);
+        _mm_storeu_si128(p + 3, v);
+    }
+
+    fill_tail(out, size, word);
+}
+
+// XOR four 16-byte lanes with the pattern and OR the results together. The
+// group matches if and only if every byte of the result is zero.
+SSE2_TARGET
+static bool matches_sse2(const unsigned char *buf, size_t size,
+                         uint64_t pattern) noexcept
+{
+    const __m128i v = _mm_set1_epi64x(static_cast<long long>(pattern));
+    const __m128i zero = _mm_setzero_si128();
+
+    for (; size >= GROUP_SIZE; size -= GROUP_SIZE, buf += GROUP_SIZE) {
+        auto p = reinterpret_cast<const __m128i *>(buf);
+        __m128i x1 = _mm_xor_si128(_mm_loadu_si128(p), v);
+        __m128i x2 = _mm_xor_si128(_mm_loadu_si128(p + 1), v);
+        __m128i x3 = _mm_xor_si128(_mm_loadu_si128(p + 2), v);
+        __m128i x4 = _mm_xor_si128(_mm_loadu_si128(p + 3), v);
+        __m128i diff = _mm_or_si128(_mm_or_si128(x1, x2),
+                                    _mm_or_si128(x3, x4));
+
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(diff, zero)) != 0xffff) {
+            return false;
+        }
+    }
+
+    return matches_tail(buf, size, pattern);
+}
+
+static bool has_sse2() noexcept
+{
+    unsigned int eax, ebx, ecx, edx;
+
+    return __get_cpuid(1, &eax, &ebx, &ecx, &edx) && (edx & bit_SSE2);
+}
+#endif
+
+#ifdef FILL_HAVE_NEON
+static void fill_neon(unsigned char *out, size_t size, uint32_t word) noexcept
+{
+    const uint8x16_t v = vreinterpretq_u8_u32(vdupq_n_u32(word));
+
+    for (; size >= GROUP_SIZE; size -= GROUP_SIZE, out += GROUP_SIZE) {
+        vst1q_u8(out, v);
+        vst1q_u8(out + 16, v);
+        vst1q_u8(out + 32, v);
+        vst1q_u8(out + 48, v);
+    }
+
+    fill_tail(out, size, word);
+}
+
+// Same approach as matches_sse2(), using a horizontal max to test for zero
+static bool matches_neon(const unsigned char *buf, size_t size,
+                         uint64_t pattern) noexcept
+{
+    const uint8x16_t v = vreinterpretq_u8_u64(vdupq_n_u64(pattern));
+
+    for (; size >= GROUP_SIZE; size -= GROUP_SIZE, buf += GROUP_SIZE) {
+        uint8x16_t x1 = veorq_u8(vld1q_u8(buf), v);
+        uint8x16_t x2 = veorq_u8(vld1q_u8(buf + 16), v);
+        uint8x16_t x3 = veorq_u8(vld1q_u8(buf + 32), v);
+        uint8x16_t x4 = veorq_u8(vld1q_u8(buf + 48), v);
+        uint8x16_t diff = vorrq_u8(vorrq_u8(x1, x2), vorrq_u8(x3, x4));
+
+        if (vmaxvq_u8(diff) != 0) {
+            return false;
+        }
+    }
+
+    return matches_tail(buf, size, pattern);
+}
+#endif
+
+struct FillImpl
+{
+    const char *name;
+    void (*fill)(unsigned char *, size_t, uint32_t) noexcept;
+    bool (*matches)(const unsigned char *, size_t, uint64_t) noexcept;
+};
+
+static FillImpl select_impl() noexcept
+{
+#if defined(FILL_HAVE_SSE2)
+    if (has_sse2()) {
+        return {"sse2", &fill_sse2, &matches_sse2};
+    }
+#elif defined(FILL_HAVE_NEON)
+    if (getauxval(AT_HWCAP) & HWCAP_ASIMD) {
+        return {"neon", &fill_neon, &matches_neon};
+    }
+#endif
+
+    return {"generic", &fill_generic, &matches_generic};
+}
+
+static const FillImpl & impl() noexcept
+{
+    static const FillImpl selected = select_impl();
+    return selected;
+}
+
+/*!
+ * \brief Fill a buffer with a repeating 32-bit value
+ *
+ * The value is written 64 bytes at a time. Values whose bytes are all the same
+ * (eg. zero) are written with memset().
+ *
+ * \param buf Output buffer
+ * \param size Size of \p buf in bytes. Does not need to be a multiple of 4.
+ * \param fill_val Filler value (in host byte order). The first byte of its
+ *                 little-endian representation is written to the start of
+ *                 \p buf.
+ */
+void fill_repeated(void *buf, size_t size, uint32_t fill_val) noexcept
+{
+    auto out = static_cast<unsigned char *>(buf);
+    auto le_val = mb_htole32(fill_val);
+
+    unsigned char bytes[sizeof(le_val)];
+    memcpy(bytes, &le_val, sizeof(bytes));
+
+    if (bytes[0] == bytes[1] && bytes[0] == bytes[2] && bytes[0] == bytes[3]) {
+        memset(out, bytes[0], size);
+        return;
+    }
+
+    uint32_t word;
+    memcpy(&word, bytes, sizeof(word));
+
+    impl().fill(out, size, word);
+}
+
+/*!
+ * \brief Check if a buffer contains only zeros
+ *
+ * \param buf Buffer
+ * \param size Size of \p buf in bytes
+ *
+ * \return Whether every byte of \p buf is zero
+ */
+bool is_zero_block(const void *buf, size_t size) noexcept
+{
+    return impl().matches(static_cast<const unsigned char *>(buf), size, 0);
+}
+
+/*!
+ * \brief Check if a block consists of a repeating 32-bit value
+ *
+ * \param buf Block data
+ * \param size Block size. Must be a non-zero multiple of 4.
+ * \param[out] fill_val Filler value (in host byte order) if the block is
+ *                      uniform
+ *
+ * \return Whether the block can be stored as a fill chunk
+ */
+bool is_fill_block(const void *buf, size_t size, uint32_t &fill_val) noexcept
+{
+    auto data = static_cast<const unsigned char *>(buf);
+
+    if (size < sizeof(uint32_t) || size % sizeof(uint32_t) != 0) {
+        return false;
+    }
+
+    uint32_t value;
+    memcpy(&value, data, sizeof(value));
+
+    uint64_t pattern;
+    memcpy(&pattern, &value, sizeof(value));
+    memcpy(reinterpret_cast<unsigned char *>(&pattern) + sizeof(value),
+           &value, sizeof(value));
+
+    if (!impl().matches(data, size, pattern)) {
+        return false;
+    }
+
+    fill_val = mb_le32toh(value);
+    return true;
+}
+
+/*!
+ * \brief Get the name of the implementation selected for this CPU
+ *
+ * \return "sse2", "neon", or "generic"
+ */
+const char * fill_implementation() noexcept
+{
+    return impl().name;
+}
+
+}
@@ -31,12 +31,15 @@
 #include <cstring>
 
 #include "mbcommon/algorithm.h"
+#include "mbcommon/crc32.h"
 #include "mbcommon/endian.h"
 #include "mbcommon/file_error.h"
 #include "mbcommon/file_util.h"
 #include "mbcommon/finally.h"
+#include "mbcommon/perf.h"
 #include "mbcommon/string.h"
 
+#include "mbsparse/fill.h"
 #include "mbsparse/sparse_error.h"
 
 // Enable debug logging of headers, offsets, etc.?
@@ -65,6 +68,8 @@ namespace mb::sparse
 {
 using namespace detail;
 
+static perf::Counter g_chunks_read("sparse.chunks_read");
+
 static void fix_sparse_header_byte_order(SparseHeader &header) noexcept
 {
     header.magic = mb_le32toh(header.magic);
@@ -86,6 +91,19 @@ static void fix_chunk_header_byte_order(ChunkHeader &header) noexcept
     header.total_sz = mb_le32toh(header.total_sz);
 }
 
+// Get fill value for the fill chunk, rotated so that the first byte of its
+// little-endian representation is the byte at \p offset
+static uint32_t fill_val_at(const ChunkInfo &chunk, uint64_t offset) noexcept
+{
+    auto shift = (offset - chunk.begin) % sizeof(uint32_t);
+    if (shift == 0) {
+        return chunk.fill_val;
+    }
+
+    return (chunk.fill_val >> (shift * 8))
+            | (chunk.fill_val << ((sizeof(uint32_t) - shift) * 8));
+}
+
 #if SPARSE_DEBUG
 static void dump_sparse_header(const SparseHeader &header) noexcept
 {
@@ -169,14 +187,15 @@ SparseFile::SparseFile()
  * Construct the file handle and open the file. Use is_open() to check if the
  * file was successfully opened.
  *
- * \sa open(File *)
+ * \sa open(File *, SparseFileFlags)
  *
  * \param file File to open
+ * \param flags Flags
  */
-SparseFile::SparseFile(File *file)
+SparseFile::SparseFile(File *file, SparseFileFlags flags)
     : SparseFile()
 {
-    (void) open(file);
+    (void) open(file, flags);
 }
 
 SparseFile::~SparseFile()
@@ -189,8 +208,10 @@ SparseFile::SparseFile(SparseFile &&other) noexcept
     clear();
 
     std::swap(m_file, other.m_file);
+    std::swap(m_flags, other.m_flags);
     std::swap(m_seekability, other.m_seekability);
     std::swap(m_expected_crc32, other.m_expected_crc32);
+    std::swap(m_crc32, other.m_crc32);
     std::swap(m_cur_src_offset, other.m_cur_src_offset);
     std::swap(m_cur_tgt_offset, other.m_cur_tgt_offset);
     std::swap(m_file_size, other.m_file_size);
@@ -205,8 +226,10 @@ SparseFile & SparseFile::operator=(SparseFile &&rhs) noexcept
         (void) close();
 
         std::swap(m_file, rhs.m_file);
+        std::swap(m_flags, rhs.m_flags);
         std::swap(m_seekability, rhs.m_seekability);
         std::swap(m_expected_crc32, rhs.m_expected_crc32);
+        std::swap(m_crc32, rhs.m_crc32);
         std::swap(m_cur_src_offset, rhs.m_cur_src_offset);
         std::swap(m_cur_tgt_offset, rhs.m_cur_tgt_offset);
         std::swap(m_file_size, rhs.m_file_size);
@@ -247,6 +270,14 @@ SparseFile & SparseFile::operator=(SparseFile &&rhs) noexcept
  * // Random seeking unsupported if FileError::UnsupportedSeek is returned
  * \endcode
  *
+ * If \p flags contains SparseFileFlag::VerifyCrc32, then the CRC32 checksums
+ * in CRC32 chunks and in the sparse header are verified as the data is read.
+ * read() and skip_extent() will fail with SparseFileError::ChecksumMismatch
+ * when reaching a CRC32 chunk or EOF if the checksum does not match. Since the
+ * checksum covers all data before it, seek(), save_index(), and load_index()
+ * are not supported in this mode. Fill and "don't care" regions are
+ * checksummed without being materialized.
+ *
  * \note This function will fail if the file handle is not open.
  *
  * \pre The caller should position the file at the beginning of the sparse file
@@ -254,10 +285,13 @@ SparseFile & SparseFile::operator=(SparseFile &&rhs) noexcept
  *      relative seeks. This allows for opening sparse files where the data
  *      isn't at the beginning of the file.
  *
+ * \param file File to open
+ * \param flags Flags
+ *
  * \return Nothing if the sparse file is successfully opened. Otherwise, the
  *         error code.
  */
-oc::result<void> SparseFile::open(File *file)
+oc::result<void> SparseFile::open(File *file, SparseFileFlags flags)
 {
     if (is_open()) return FileError::InvalidState;
 
@@ -271,6 +305,7 @@ oc::result<void> SparseFile::open(File *file)
     });
 
     m_file = file;
+    m_flags = flags;
     m_seekability = Seekability::CanRead;
 
     if (auto seek_ret = m_file->seek(0, SEEK_CUR)) {
@@ -358,6 +393,7 @@ oc::result<size_t> SparseFile::read(void *buf, size_t size)
 
         if (m_chunk == m_chunks.end()) {
             OPER("Reached EOF");
+            OUTCOME_TRYV(verify_image_checksum());
             break;
         }
 
@@ -396,32 +432,32 @@ oc::result<size_t> SparseFile::read(void *buf, size_t size)
 
             OUTCOME_TRYV(wread(buf, static_cast<size_t>(to_read)));
 
+            if (m_flags & SparseFileFlag::VerifyCrc32) {
+                m_crc32 = crc32_update(m_crc32, buf,
+                                       static_cast<size_t>(to_read));
+            }
+
             n_read = to_read;
             break;
         }
         case CHUNK_TYPE_FILL: {
             static_assert(sizeof(m_chunk->fill_val) == sizeof(uint32_t),
                           "Mismatched fill_val size");
-            auto shift = (m_cur_tgt_offset - m_chunk->begin) % sizeof(uint32_t);
-            uint32_t fill_val = mb_htole32(m_chunk->fill_val);
-            unsigned char shifted[4];
-            for (size_t i = 0; i < sizeof(uint32_t); ++i) {
-                shifted[i] = reinterpret_cast<unsigned char *>(&fill_val)
-                        [(i + shift) % sizeof(uint32_t)];
-            }
-            unsigned char *temp_buf = reinterpret_cast<unsigned char *>(buf);
-            while (to_read > 0) {
-                size_t to_write = std::min<size_t>(
-                        sizeof(shifted), static_cast<size_t>(to_read));
-                memcpy(temp_buf, &shifted, to_write);
-                n_read += to_write;
-                to_read -= to_write;
-                temp_buf += to_write;
+            auto fill_val = fill_val_at(*m_chunk, m_cur_tgt_offset);
+
+            if (m_flags & SparseFileFlag::VerifyCrc32) {
+                m_crc32 = crc32_update_repeated(m_crc32, fill_val, to_read);
             }
+
+            fill_repeated(buf, static_cast<size_t>(to_read), fill_val);
+            n_read = to_read;
             break;
         }
         case CHUNK_TYPE_DONT_CARE:
             std::fill_n(reinterpret_cast<unsigned char *>(buf), to_read, 0);
+            if (m_flags & SparseFileFlag::VerifyCrc32) {
+                m_crc32 = crc32_update_repeated(m_crc32, 0, to_read);
+            }
             n_read = to_read;
             break;
         default:
@@ -459,7 +495,9 @@ oc::result<size_t> SparseFile::write(const void *buf, size_t size)
  * \p whence takes the same \a SEEK_SET, \a SEEK_CUR, and \a SEEK_END values as
  * \a lseek() in `\<stdio.h\>`.
  *
- * \note Seeking will only work if the underlying file handle supports seeking.
+ * \note Seeking will only work if the underlying file handle supports seeking
+ *       and SparseFileFlag::VerifyCrc32 was not specified when opening the
+ *       file.
  *
  * \param offset Offset to seek
  * \param whence \a SEEK_SET, \a SEEK_CUR, or \a SEEK_END
@@ -476,6 +514,9 @@ oc::result<uint64_t> SparseFile::seek(int64_t offset, int whence)
     if (m_seekability != Seekability::CanSeek) {
         DEBUG("Underlying file does not support seeking");
         return FileError::UnsupportedSeek;
+    } else if (m_flags & SparseFileFlag::VerifyCrc32) {
+        DEBUG("Cannot seek while verifying checksums");
+        return FileError::UnsupportedSeek;
     }
 
     uint64_t new_offset;
@@ -546,10 +587,342 @@ uint64_t SparseFile::size() noexcept
     return m_file_size;
 }
 
+/*!
+ * \brief Get the block size of the sparse file
+ *
+ * \return Block size from the sparse header. The return value is undefined if
+ *         the sparse file is not opened.
+ */
+uint32_t SparseFile::block_size() noexcept
+{
+    return m_shdr.blk_sz;
+}
+
+/*!
+ * \brief Get the extent at the current file position
+ *
+ * The returned extent starts at the current file position and ends at the end
+ * of the chunk containing it. Consumers that only care about the data can call
+ * read() for ExtentType::Data extents and skip_extent() for everything else,
+ * avoiding the need to materialize fill and hole regions as bytes.
+ *
+ * ExtentType::Hole extents correspond to `DONT_CARE` chunks. Their contents
+ * are undefined, though read() returns zeros for them.
+ *
+ * The file position is not changed.
+ *
+ * \return
+ *   * The extent at the current file position
+ *   * std::nullopt if the file position is at or past EOF
+ *   * The error code if the chunk header could not be read or is invalid
+ */
+oc::result<std::optional<Extent>> SparseFile::next_extent()
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    OUTCOME_TRYV(move_to_chunk(m_cur_tgt_offset));
+
+    if (m_chunk == m_chunks.end()) {
+        return std::nullopt;
+    }
+
+    Extent extent = {};
+    extent.offset = m_cur_tgt_offset;
+    extent.length = m_chunk->end - m_cur_tgt_offset;
+
+    switch (m_chunk->type) {
+    case CHUNK_TYPE_RAW:
+        extent.type = ExtentType::Data;
+        break;
+    case CHUNK_TYPE_FILL:
+        extent.type = ExtentType::Fill;
+        extent.fill_val = fill_val_at(*m_chunk, m_cur_tgt_offset);
+        break;
+    case CHUNK_TYPE_DONT_CARE:
+        extent.type = ExtentType::Hole;
+        break;
+    default:
+        MB_UNREACHABLE("Invalid chunk type: %" PRIu16, m_chunk->type);
+    }
+
+    return extent;
+}
+
+/*!
+ * \brief Move the file position to the end of the current extent
+ *
+ * Unlike seek(), this function works even if the underlying file does not
+ * support seeking. Any skipped raw data is read and discarded if necessary.
+ *
+ * If SparseFileFlag::VerifyCrc32 was specified when opening the file, skipped
+ * raw data is always read so that it can be checksummed.
+ *
+ * \return Nothing if the file position is successfully moved or is already at
+ *         EOF. Otherwise, the error code.
+ */
+oc::result<void> SparseFile::skip_extent()
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    OUTCOME_TRYV(move_to_chunk(m_cur_tgt_offset));
+
+    if (m_chunk == m_chunks.end()) {
+        return verify_image_checksum();
+    }
+
+    if (m_flags & SparseFileFlag::VerifyCrc32) {
+        switch (m_chunk->type) {
+        case CHUNK_TYPE_RAW:
+            // read() updates the checksum
+            for (uint64_t remaining = m_chunk->end - m_cur_tgt_offset;
+                    remaining > 0;) {
+                char buf[10240];
+
+                OUTCOME_TRY(n, read(buf, static_cast<size_t>(
+                        std::min<uint64_t>(sizeof(buf), remaining))));
+                remaining -= n;
+            }
+            return oc::success();
+        case CHUNK_TYPE_FILL:
+            m_crc32 = crc32_update_repeated(
+                    m_crc32, fill_val_at(*m_chunk, m_cur_tgt_offset),
+                    m_chunk->end - m_cur_tgt_offset);
+            break;
+        case CHUNK_TYPE_DONT_CARE:
+            m_crc32 = crc32_update_repeated(
+                    m_crc32, 0, m_chunk->end - m_cur_tgt_offset);
+            break;
+        default:
+            MB_UNREACHABLE("Invalid chunk type: %" PRIu16, m_chunk->type);
+        }
+    }
+
+    m_cur_tgt_offset = m_chunk->end;
+
+    return oc::success();
+}
+
+/*!
+ * \brief Write an index of all chunks in the sparse file
+ *
+ * All remaining chunk headers are parsed and the offsets of every chunk are
+ * written to \p file. The index can be loaded with load_index() when the same
+ * sparse file is opened again to allow random access without parsing the
+ * chunk headers first.
+ *
+ * \note If the underlying file does not support random seeking, reading the
+ *       remaining chunk headers consumes the input, so data before the end of
+ *       the sparse file can no longer be read.
+ *
+ * \note This function fails with FileError::InvalidState if the file was
+ *       opened with SparseFileFlag::VerifyCrc32.
+ *
+ * \param file File to write the index to
+ *
+ * \return Nothing if the index is successfully written. Otherwise, the error
+ *         code.
+ */
+oc::result<void> SparseFile::save_index(File &file)
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    if (m_flags & SparseFileFlag::VerifyCrc32) {
+        DEBUG("Cannot parse ahead while verifying checksums");
+        return FileError::InvalidState;
+    }
+
+    // Offsets in the sparse file never reach the file size, so this parses
+    // every remaining chunk
+    OUTCOME_TRYV(move_to_chunk(m_file_size));
+
+    if (m_chunks.size() != m_shdr.total_chunks) {
+        DEBUG("Only found %" MB_PRIzu " of %" PRIu32 " chunks",
+              m_chunks.size(), m_shdr.total_chunks);
+        return SparseFileError::InternalError;
+    }
+
+    IndexHeader ihdr = {};
+    memcpy(ihdr.magic, SPARSE_INDEX_MAGIC, SPARSE_INDEX_MAGIC_SIZE);
+    ihdr.version = mb_htole32(SPARSE_INDEX_VERSION);
+    ihdr.file_hdr_sz = mb_htole16(m_shdr.file_hdr_sz);
+    ihdr.chunk_hdr_sz = mb_htole16(m_shdr.chunk_hdr_sz);
+    ihdr.blk_sz = mb_htole32(m_shdr.blk_sz);
+    ihdr.total_blks = mb_htole32(m_shdr.total_blks);
+    ihdr.total_chunks = mb_htole32(m_shdr.total_chunks);
+    ihdr.image_checksum = mb_htole32(m_shdr.image_checksum);
+
+    std::vector<IndexEntry> entries;
+    entries.reserve(m_chunks.size());
+
+    for (auto const &chunk : m_chunks) {
+        IndexEntry entry = {};
+        entry.type = mb_htole16(chunk.type);
+        entry.begin = mb_htole64(chunk.begin);
+        entry.end = mb_htole64(chunk.end);
+        entry.src_begin = mb_htole64(chunk.src_begin);
+        entry.src_end = mb_htole64(chunk.src_end);
+
+        if (chunk.type == CHUNK_TYPE_RAW) {
+            entry.raw_begin = mb_htole64(chunk.raw_begin);
+            entry.raw_end = mb_htole64(chunk.raw_end);
+        } else if (chunk.type == CHUNK_TYPE_FILL) {
+            entry.fill_val = mb_htole32(chunk.fill_val);
+        }
+
+        entries.push_back(entry);
+    }
+
+    OUTCOME_TRYV(file_write_exact(file, &ihdr, sizeof(ihdr)));
+    OUTCOME_TRYV(file_write_exact(file, entries.data(),
+                                  entries.size() * sizeof(IndexEntry)));
+
+    return oc::success();
+}
+
+/*!
+ * \brief Load an index previously written by save_index()
+ *
+ * After the index is loaded, seeking to any offset in the sparse file is a
+ * binary search and does not require parsing any chunk headers. The index is
+ * checked against the sparse header and every entry is validated before it is
+ * used.
+ *
+ * \pre The sparse file must have just been opened without
+ *      SparseFileFlag::VerifyCrc32 and the underlying file must support random
+ *      seeking.
+ *
+ * \param file File to read the index from
+ *
+ * \return Nothing if the index is successfully loaded. Otherwise, the error
+ *         code. The sparse file can still be read without the index if this
+ *         function fails.
+ */
+oc::result<void> SparseFile::load_index(File &file)
+{
+    if (!is_open() || !m_chunks.empty()
+            || (m_flags & SparseFileFlag::VerifyCrc32)) {
+        return FileError::InvalidState;
+    }
+
+    if (m_seekability != Seekability::CanSeek) {
+        DEBUG("Underlying file does not support seeking");
+        return FileError::UnsupportedSeek;
+    }
+
+    IndexHeader ihdr;
+
+    auto ret = file_read_exact(file, &ihdr, sizeof(ihdr));
+    if (!ret) {
+        if (ret.error() == FileError::UnexpectedEof) {
+            return SparseFileError::InvalidIndexHeader;
+        }
+        return ret.as_failure();
+    }
+
+    if (memcmp(ihdr.magic, SPARSE_INDEX_MAGIC, SPARSE_INDEX_MAGIC_SIZE) != 0
+            || mb_le32toh(ihdr.version) != SPARSE_INDEX_VERSION) {
+        DEBUG("Invalid index magic or version");
+        return SparseFileError::InvalidIndexHeader;
+    }
+
+    if (mb_le16toh(ihdr.file_hdr_sz) != m_shdr.file_hdr_sz
+            || mb_le16toh(ihdr.chunk_hdr_sz) != m_shdr.chunk_hdr_sz
+            || mb_le32toh(ihdr.blk_sz) != m_shdr.blk_sz
+            || mb_le32toh(ihdr.total_blks) != m_shdr.total_blks
+            || mb_le32toh(ihdr.total_chunks) != m_shdr.total_chunks
+            || mb_le32toh(ihdr.image_checksum) != m_shdr.image_checksum) {
+        DEBUG("Index was generated for a different sparse file");
+        return SparseFileError::IndexDoesNotMatchImage;
+    }
+
+    auto reset = finally([&] {
+        m_chunks.clear();
+        m_chunk = m_chunks.end();
+    });
+
+    uint64_t tgt_offset = 0;
+    uint64_t src_offset = m_shdr.file_hdr_sz;
+
+    for (uint32_t i = 0; i < m_shdr.total_chunks; ++i) {
+        IndexEntry entry;
+
+        ret = file_read_exact(file, &entry, sizeof(entry));
+        if (!ret) {
+            if (ret.error() == FileError::UnexpectedEof) {
+                return SparseFileError::InvalidIndexEntry;
+            }
+            return ret.as_failure();
+        }
+
+        ChunkInfo ci = {};
+        ci.type = mb_le16toh(entry.type);
+        ci.begin = mb_le64toh(entry.begin);
+        ci.end = mb_le64toh(entry.end);
+        ci.src_begin = mb_le64toh(entry.src_begin);
+        ci.src_end = mb_le64toh(entry.src_end);
+        ci.raw_begin = mb_le64toh(entry.raw_begin);
+        ci.raw_end = mb_le64toh(entry.raw_end);
+        ci.fill_val = mb_le32toh(entry.fill_val);
+
+        // Chunks must be contiguous in both the source and output files
+        if (ci.begin != tgt_offset || ci.end < ci.begin
+                || ci.src_begin != src_offset || ci.src_end < ci.src_begin
+                || ci.src_end - ci.src_begin < m_shdr.chunk_hdr_sz
+                || (ci.end - ci.begin) % m_shdr.blk_sz != 0) {
+            DEBUG("Index entry #%" PRIu32 " is not contiguous", i);
+            return SparseFileError::InvalidIndexEntry;
+        }
+
+        uint64_t tgt_size = ci.end - ci.begin;
+        uint64_t src_size = ci.src_end - ci.src_begin;
+        bool valid;
+
+        switch (ci.type) {
+        case CHUNK_TYPE_RAW:
+            valid = src_size - m_shdr.chunk_hdr_sz == tgt_size
+                    && ci.raw_begin == ci.src_begin + m_shdr.chunk_hdr_sz
+                    && ci.raw_end == ci.src_end;
+            break;
+        case CHUNK_TYPE_FILL:
+            valid = src_size == m_shdr.chunk_hdr_sz + sizeof(uint32_t);
+            break;
+        case CHUNK_TYPE_DONT_CARE:
+            valid = src_size == m_shdr.chunk_hdr_sz;
+            break;
+        case CHUNK_TYPE_CRC32:
+            valid = tgt_size == 0
+                    && src_size == m_shdr.chunk_hdr_sz + sizeof(uint32_t);
+            break;
+        default:
+            valid = false;
+            break;
+        }
+
+        if (!valid) {
+            DEBUG("Index entry #%" PRIu32 " is invalid", i);
+            return SparseFileError::InvalidIndexEntry;
+        }
+
+        OUTCOME_TRYV(validate_chunk(ci));
+
+        m_chunks.push_back(ci);
+
+        tgt_offset = ci.end;
+        src_offset = ci.src_end;
+    }
+
+    m_chunk = m_chunks.end();
+    reset.dismiss();
+
+    return oc::success();
+}
+
 void SparseFile::clear() noexcept
 {
     m_file = nullptr;
+    m_flags = {};
     m_expected_crc32 = 0;
+    m_crc32 = 0;
     m_cur_src_offset = 0;
     m_cur_tgt_offset = 0;
     m_file_size = 0;
@@ -830,6 +1203,8 @@ SparseFile::process_crc32_chunk(const ChunkHeader &chdr, uint64_t tgt_offset)
         return SparseFileError::InvalidCrc32Chunk;
     }
 
+    uint64_t src_begin = m_cur_src_offset - m_shdr.chunk_hdr_sz;
+
     OUTCOME_TRYV(wread(&crc32, sizeof(crc32)));
 
     m_expected_crc32 = mb_le32toh(crc32);
@@ -839,8 +1214,8 @@ SparseFile::process_crc32_chunk(const ChunkHeader &chdr, uint64_t tgt_offset)
     ci.type = chdr.chunk_type;
     ci.begin = tgt_offset;
     ci.end = tgt_offset;
-    ci.src_begin = tgt_offset - m_shdr.chunk_hdr_sz;
-    ci.src_end = tgt_offset + data_size;
+    ci.src_begin = src_begin;
+    ci.src_end = m_cur_src_offset;
 
     return std::move(ci);
 }
@@ -890,6 +1265,41 @@ SparseFile::process_chunk(const ChunkHeader &chdr, uint64_t tgt_offset)
     }
 }
 
+/*!
+ * \brief Check that a chunk is within the bounds given by the sparse header
+ *
+ * This function will check the following properties:
+ *   * The chunk does not end after the header-specified file size
+ *   * If this is the last chunk, it ends at the header-specified file size
+ *
+ * \pre The chunks before \p chunk must already be in \a m_chunks
+ *
+ * \param chunk Chunk to check
+ *
+ * \return Nothing if the chunk is valid. Otherwise, the error code.
+ */
+oc::result<void> SparseFile::validate_chunk(const ChunkInfo &chunk) noexcept
+{
+    size_t chunk_num = m_chunks.size();
+    (void) chunk_num;
+
+    if (chunk.end > m_file_size) {
+        DEBUG("Chunk #%" MB_PRIzu " ends (%" PRIu64 ") after the file size "
+              "specified in the sparse header (%" PRIu64 ")",
+              chunk_num, chunk.end, m_file_size);
+        return SparseFileError::InvalidChunkBounds;
+    }
+
+    if (chunk_num + 1 == m_shdr.total_chunks && chunk.end != m_file_size) {
+        DEBUG("Last chunk does not end (%" PRIu64 ") at position"
+              " specified by sparse header (%" PRIu64 ")",
+              chunk.end, m_file_size);
+        return SparseFileError::InvalidChunkBounds;
+    }
+
+    return oc::success();
+}
+
 /*!
  * \brief Move to chunk that is responsible for the specified offset
  *
@@ -898,6 +1308,23 @@ SparseFile::process_chunk(const ChunkHeader &chdr, uint64_t tgt_offset)
  *
  * \return Nothing unless an error occurs
  */
+oc::result<void> SparseFile::verify_image_checksum() noexcept
+{
+    // The image checksum is optional
+    if (!(m_flags & SparseFileFlag::VerifyCrc32)
+            || m_shdr.image_checksum == 0) {
+        return oc::success();
+    }
+
+    if (m_crc32 != m_shdr.image_checksum) {
+        DEBUG("Expected image CRC32 0x%08" PRIx32 ", but have 0x%08" PRIx32,
+              m_shdr.image_checksum, m_crc32);
+        return SparseFileError::ChecksumMismatch;
+    }
+
+    return oc::success();
+}
+
 oc::result<void> SparseFile::move_to_chunk(uint64_t offset) noexcept
 {
     // No action needed if the offset is in the current chunk
@@ -985,25 +1412,21 @@ oc::result<void> SparseFile::move_to_chunk(uint64_t offset) noexcept
         OPER("Chunk #%" MB_PRIzu " covers output range (%" PRIu64 " - %" PRIu64 ")",
              chunk_num, chunk_info.begin, chunk_info.end);
 
-        // Make sure the chunk does not end after the header-specified file size
-        if (chunk_info.end > m_file_size) {
-            DEBUG("Chunk #%" MB_PRIzu " ends (%" PRIu64 ") after the file size "
-                  "specified in the sparse header (%" PRIu64 ")",
-                  chunk_num, chunk_info.end, m_file_size);
-            return SparseFileError::InvalidChunkBounds;
+        OUTCOME_TRYV(validate_chunk(chunk_info));
+
+        // Chunks are only parsed as they are reached when verifying, so the
+        // checksum covers exactly the data before this chunk
+        if (chunk_info.type == CHUNK_TYPE_CRC32
+                && (m_flags & SparseFileFlag::VerifyCrc32)
+                && m_crc32 != m_expected_crc32) {
+            DEBUG("Chunk #%" MB_PRIzu ": expected CRC32 0x%08" PRIx32
+                  ", but have 0x%08" PRIx32, chunk_num, m_expected_crc32,
+                  m_crc32);
+            return SparseFileError::ChecksumMismatch;
         }
 
         m_chunks.push_back(std::move(chunk_info));
-
-        // If we just read the last chunk, make sure it ends at the same
-        // position as specified in the sparse header
-        if (m_chunks.size() == m_shdr.total_chunks
-                && m_chunks.back().end != m_file_size) {
-            DEBUG("Last chunk does not end (%" PRIu64 ") at position"
-                  " specified by sparse header (%" PRIu64 ")",
-                  m_chunks.back().end, m_file_size);
-            return SparseFileError::InvalidChunkBounds;
-        }
+        g_chunks_read.add();
 
         if (offset >= m_chunks.back().begin && offset < m_chunks.back().end) {
             m_chunk = m_chunks.end() - 1;
@@ -63,6 +63,14 @@ std::string SparseFileErrorCategory::message(int ev) const
         return "invalid 'crc32' chunk";
     case SparseFileError::InternalError:
         return "(internal error)";
+    case SparseFileError::InvalidIndexHeader:
+        return "invalid chunk index header";
+    case SparseFileError::IndexDoesNotMatchImage:
+        return "chunk index does not match sparse image";
+    case SparseFileError::InvalidIndexEntry:
+        return "invalid chunk index entry";
+    case SparseFileError::ChecksumMismatch:
+        return "CRC32 checksum mismatch";
     default:
         return "(unknown sparse file error)";
     }
@@ -0,0 +1,494 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbsparse/sparse_split.h"
+
+#include <algorithm>
+#include <optional>
+#include <vector>
+
+#include <cstdio>
+#include <cstring>
+
+#include "mbcommon/file_error.h"
+#include "mbcommon/file_util.h"
+
+#include "mbsparse/fill.h"
+#include "mbsparse/sparse.h"
+#include "mbsparse/sparse_error.h"
+#include "mbsparse/sparse_p.h"
+
+/*!
+ * \file mbsparse/sparse_split.h
+ * \brief Split images into multiple sparse files
+ */
+
+namespace mb::sparse
+{
+using namespace detail;
+
+// Flush raw chunks once they reach this size to bound memory usage
+constexpr size_t MAX_RAW_CHUNK_SIZE = 1024 * 1024;
+
+namespace
+{
+
+/*!
+ * \brief Write a stream of blocks as a series of size-limited sparse files
+ *
+ * Every piece describes the full image. Blocks that belong to other pieces are
+ * covered by "don't care" chunks at the start and end of the piece, so that
+ * flashing all pieces in order produces the original image.
+ */
+class SparseSplitter
+{
+public:
+    SparseSplitter(uint32_t block_size, uint32_t total_blocks,
+                   uint64_t max_size,
+                   const SparseSplitOpenCallback &open_output)
+        : m_block_size(block_size)
+        , m_total_blocks(total_blocks)
+        , m_max_size(max_size)
+        , m_open_output(open_output)
+    {
+    }
+
+    oc::result<void> add_raw(const unsigned char *data, uint32_t blocks);
+    oc::result<void> add_fill(uint32_t fill_val, uint32_t blocks);
+    oc::result<void> add_dont_care(uint32_t blocks);
+
+    oc::result<size_t> finish();
+
+private:
+    oc::result<void> reserve(uint16_t type, uint32_t fill_val,
+                             uint64_t data_size);
+
+    oc::result<void> begin_piece();
+    oc::result<void> end_piece();
+
+    oc::result<void> flush_chunk();
+    oc::result<void> write_chunk(uint16_t type, uint32_t blocks,
+                                 const void *data, size_t data_size);
+
+    uint64_t pending_size() const;
+
+    uint32_t m_block_size;
+    uint32_t m_total_blocks;
+    uint64_t m_max_size;
+    const SparseSplitOpenCallback &m_open_output;
+
+    // Current output
+    File *m_file = nullptr;
+    size_t m_pieces = 0;
+    uint64_t m_header_offset = 0;
+    // Bytes written to the current piece, not counting the pending chunk
+    uint64_t m_piece_size = 0;
+    uint32_t m_piece_chunks = 0;
+
+    // Number of image blocks added so far, including the pending chunk
+    uint32_t m_cur_block = 0;
+
+    // Pending chunk
+    uint16_t m_chunk_type = 0;
+    uint32_t m_chunk_fill_val = 0;
+    uint32_t m_chunk_blocks = 0;
+    std::vector<unsigned char> m_chunk_raw;
+};
+
+uint64_t SparseSplitter::pending_size() const
+{
+    if (m_chunk_blocks == 0) {
+        return 0;
+    }
+
+    switch (m_chunk_type) {
+    case CHUNK_TYPE_RAW:
+        return sizeof(ChunkHeader) + m_chunk_raw.size();
+    case CHUNK_TYPE_FILL:
+        return sizeof(ChunkHeader) + sizeof(uint32_t);
+    default:
+        return sizeof(ChunkHeader);
+    }
+}
+
+// Make sure that the next block fits in the current piece. Starts a new piece
+// if it doesn't.
+oc::result<void> SparseSplitter::reserve(uint16_t type, uint32_t fill_val,
+                                         uint64_t data_size)
+{
+    bool extends = m_chunk_blocks > 0 && m_chunk_type == type
+            && (type != CHUNK_TYPE_FILL || m_chunk_fill_val == fill_val)
+            && (type != CHUNK_TYPE_RAW
+                    || m_chunk_raw.size() < MAX_RAW_CHUNK_SIZE);
+
+    if (!extends) {
+        OUTCOME_TRYV(flush_chunk());
+    }
+
+    uint64_t needed = data_size + (extends ? 0 : sizeof(ChunkHeader));
+
+    // Always leave room for the trailing "don't care" chunk
+    auto fits = [&] {
+        return m_piece_size + pending_size() + needed + sizeof(ChunkHeader)
+                <= m_max_size;
+    };
+
+    if (m_file && !fits()) {
+        OUTCOME_TRYV(flush_chunk());
+        OUTCOME_TRYV(end_piece());
+        needed = data_size + sizeof(ChunkHeader);
+    }
+
+    if (!m_file) {
+        OUTCOME_TRYV(begin_piece());
+
+        // The minimum size is checked before splitting, so this can only
+        // happen due to a bug
+        if (!fits()) {
+            return SparseFileError::InternalError;
+        }
+    }
+
+    return oc::success();
+}
+
+oc::result<void> SparseSplitter::add_raw(const unsigned char *data,
+                                         uint32_t blocks)
+{
+    for (; blocks > 0; --blocks, data += m_block_size) {
+        OUTCOME_TRYV(reserve(CHUNK_TYPE_RAW, 0, m_block_size));
+
+        m_chunk_type = CHUNK_TYPE_RAW;
+        m_chunk_raw.insert(m_chunk_raw.end(), data, data + m_block_size);
+        ++m_chunk_blocks;
+        ++m_cur_block;
+    }
+
+    return oc::success();
+}
+
+oc::result<void> SparseSplitter::add_fill(uint32_t fill_val, uint32_t blocks)
+{
+    if (blocks == 0) {
+        return oc::success();
+    }
+
+    // Extending a fill chunk is free, so the whole range always fits
+    OUTCOME_TRYV(reserve(CHUNK_TYPE_FILL, fill_val, sizeof(uint32_t)));
+
+    m_chunk_type = CHUNK_TYPE_FILL;
+    m_chunk_fill_val = fill_val;
+    m_chunk_blocks += blocks;
+    m_cur_block += blocks;
+
+    return oc::success();
+}
+
+oc::result<void> SparseSplitter::add_dont_care(uint32_t blocks)
+{
+    if (blocks == 0) {
+        return oc::success();
+    }
+
+    OUTCOME_TRYV(reserve(CHUNK_TYPE_DONT_CARE, 0, 0));
+
+    m_chunk_type = CHUNK_TYPE_DONT_CARE;
+    m_chunk_blocks += blocks;
+    m_cur_block += blocks;
+
+    return oc::success();
+}
+
+oc::result<size_t> SparseSplitter::finish()
+{
+    if (m_cur_block != m_total_blocks) {
+        return SparseFileError::InternalError;
+    }
+
+    // An empty image still produces one (empty) piece
+    if (!m_file && m_pieces == 0) {
+        OUTCOME_TRYV(begin_piece());
+    }
+
+    if (m_file) {
+        OUTCOME_TRYV(flush_chunk());
+        OUTCOME_TRYV(end_piece());
+    }
+
+    return m_pieces;
+}
+
+oc::result<void> SparseSplitter::begin_piece()
+{
+    OUTCOME_TRY(file, m_open_output(m_pieces));
+    OUTCOME_TRY(offset, file->seek(0, SEEK_CUR));
+
+    m_file = file;
+    m_header_offset = offset;
+    m_piece_size = 0;
+    m_piece_chunks = 0;
+
+    // Placeholder until the number of chunks is known
+    SparseHeader shdr = {};
+    OUTCOME_TRYV(file_write_exact(*m_file, &shdr, sizeof(shdr)));
+    m_piece_size += sizeof(shdr);
+
+    // Skip blocks that belong to earlier pieces. Any pending chunk was
+    // flushed to the previous piece, so it is not included.
+    if (m_cur_block > 0) {
+        OUTCOME_TRYV(write_chunk(CHUNK_TYPE_DONT_CARE, m_cur_block,
+                                 nullptr, 0));
+    }
+
+    ++m_pieces;
+
+    return oc::success();
+}
+
+oc::result<void> SparseSplitter::end_piece()
+{
+    // Skip blocks that belong to later pieces
+    if (m_cur_block < m_total_blocks) {
+        OUTCOME_TRYV(write_chunk(CHUNK_TYPE_DONT_CARE,
+                                 m_total_blocks - m_cur_block, nullptr, 0));
+    }
+
+    SparseHeader shdr = {};
+    shdr.magic = SPARSE_HEADER_MAGIC;
+    shdr.major_version = SPARSE_HEADER_MAJOR_VER;
+    shdr.minor_version = 0;
+    shdr.file_hdr_sz = sizeof(SparseHeader);
+    shdr.chunk_hdr_sz = sizeof(ChunkHeader);
+    shdr.blk_sz = m_block_size;
+    shdr.total_blks = m_total_blocks;
+    shdr.total_chunks = m_piece_chunks;
+    shdr.image_checksum = 0;
+    to_le_sparse_header(shdr);
+
+    OUTCOME_TRYV(m_file->seek(static_cast<int64_t>(m_header_offset),
+                              SEEK_SET));
+    OUTCOME_TRYV(file_write_exact(*m_file, &shdr, sizeof(shdr)));
+    OUTCOME_TRYV(m_file->seek(0, SEEK_END));
+
+    m_file = nullptr;
+
+    return oc::success();
+}
+
+oc::result<void> SparseSplitter::flush_chunk()
+{
+    if (m_chunk_blocks == 0) {
+        return oc::success();
+    }
+
+    if (m_chunk_type == CHUNK_TYPE_FILL) {
+        uint32_t fill_val = mb_htole32(m_chunk_fill_val);
+        OUTCOME_TRYV(write_chunk(m_chunk_type, m_chunk_blocks,
+                                 &fill_val, sizeof(fill_val)));
+    } else {
+        // Empty for "don't care" chunks
+        OUTCOME_TRYV(write_chunk(m_chunk_type, m_chunk_blocks,
+                                 m_chunk_raw.data(), m_chunk_raw.size()));
+    }
+
+    m_chunk_type = 0;
+    m_chunk_blocks = 0;
+    m_chunk_fill_val = 0;
+    m_chunk_raw.clear();
+
+    return oc::success();
+}
+
+oc::result<void> SparseSplitter::write_chunk(uint16_t type, uint32_t blocks,
+                                             const void *data,
+                                             size_t data_size)
+{
+    ChunkHeader chdr = {};
+    chdr.chunk_type = type;
+    chdr.chunk_sz = blocks;
+    chdr.total_sz = static_cast<uint32_t>(sizeof(chdr) + data_size);
+    to_le_chunk_header(chdr);
+
+    ConstIoVec iov[] = {
+        { &chdr, sizeof(chdr) },
+        { data, data_size },
+    };
+
+    OUTCOME_TRYV(file_writev_exact(*m_file, iov, data_size > 0 ? 2 : 1));
+
+    m_piece_size += sizeof(chdr) + data_size;
+    ++m_piece_chunks;
+
+    return oc::success();
+}
+
+}
+
+// Smallest piece that can hold one raw block: a sparse header, "don't care"
+// chunks before and after the block, and the raw chunk itself
+static uint64_t min_piece_size(uint32_t block_size)
+{
+    return sizeof(SparseHeader) + 3 * sizeof(ChunkHeader) + block_size;
+}
+
+/*!
+ * \brief Split a sparse file into several smaller sparse files
+ *
+ * The chunks of \p input are copied to a series of sparse files that are each
+ * at most \p max_size bytes. Raw chunks are split at block boundaries when
+ * necessary. Fill and "don't care" chunks are never expanded. Each output
+ * file describes the full image, with the regions belonging to the other
+ * output files marked as "don't care", so flashing all of them in order
+ * produces the same result as flashing \p input.
+ *
+ * \pre \p input must be positioned at the beginning of the sparse file. It does
+ *      not need to support seeking.
+ *
+ * \param input Sparse file to split
+ * \param max_size Maximum size of each output file
+ * \param open_output Callback to get the output File handle for each piece.
+ *                    The File handles must support seeking.
+ *
+ * \return
+ *   * Number of output files if \p input is successfully split
+ *   * std::errc::invalid_argument if \p max_size is too small to hold even a
+ *     single block
+ *   * Otherwise, the error code
+ */
+oc::result<size_t> split_sparse_file(SparseFile &input, uint64_t max_size,
+                                     const SparseSplitOpenCallback &open_output)
+{
+    auto block_size = input.block_size();
+    auto total_blocks = input.size() / block_size;
+
+    if (max_size < min_piece_size(block_size)) {
+        return std::errc::invalid_argument;
+    }
+
+    SparseSplitter splitter(block_size, static_cast<uint32_t>(total_blocks),
+                            max_size, open_output);
+    std::vector<unsigned char> buf;
+
+    while (true) {
+        OUTCOME_TRY(extent, input.next_extent());
+        if (!extent) {
+            break;
+        } else if (extent->offset % block_size != 0) {
+            // Some data was already read
+            return FileError::InvalidState;
+        }
+
+        auto blocks = static_cast<uint32_t>(extent->length / block_size);
+
+        switch (extent->type) {
+        case ExtentType::Data:
+            buf.resize(static_cast<size_t>(std::min<uint64_t>(
+                    extent->length,
+                    std::max<uint64_t>(MAX_RAW_CHUNK_SIZE / block_size, 1)
+                            * block_size)));
+
+            while (blocks > 0) {
+                auto n = std::min(
+                        blocks, static_cast<uint32_t>(buf.size() / block_size));
+
+                OUTCOME_TRYV(file_read_exact(
+                        input, buf.data(), static_cast<size_t>(n) * block_size));
+                OUTCOME_TRYV(splitter.add_raw(buf.data(), n));
+
+                blocks -= n;
+            }
+            break;
+        case ExtentType::Fill: {
+            OUTCOME_TRYV(splitter.add_fill(extent->fill_val, blocks));
+            OUTCOME_TRYV(input.skip_extent());
+            break;
+        }
+        case ExtentType::Hole: {
+            OUTCOME_TRYV(splitter.add_dont_care(blocks));
+            OUTCOME_TRYV(input.skip_extent());
+            break;
+        }
+        }
+    }
+
+    return splitter.finish();
+}
+
+/*!
+ * \brief Encode a raw image as several sparse files
+ *
+ * This is the same as split_sparse_file(), except that the input is a raw
+ * image. Blocks that consist of a repeating 32-bit value are stored as fill
+ * chunks. If \p size is not a multiple of \p block_size, the last block is
+ * padded with zeros.
+ *
+ * \param input Raw image to encode
+ * \param size Size of the raw image
+ * \param block_size Block size of the output files (must be a non-zero
+ *                   multiple of 4)
+ * \param max_size Maximum size of each output file
+ * \param open_output Callback to get the output File handle for each piece.
+ *                    The File handles must support seeking.
+ *
+ * \return
+ *   * Number of output files if \p input is successfully split
+ *   * std::errc::invalid_argument if \p block_size is invalid or \p max_size
+ *     is too small to hold even a single block
+ *   * FileError::ArgumentOutOfRange if the image is too large
+ *   * Otherwise, the error code
+ */
+oc::result<size_t> split_raw_file(File &input, uint64_t size,
+                                  uint32_t block_size, uint64_t max_size,
+                                  const SparseSplitOpenCallback &open_output)
+{
+    if (block_size == 0 || block_size % sizeof(uint32_t) != 0
+            || max_size < min_piece_size(block_size)) {
+        return std::errc::invalid_argument;
+    }
+
+    uint64_t total_blocks = size / block_size + (size % block_size != 0);
+    if (total_blocks > UINT32_MAX) {
+        return FileError::ArgumentOutOfRange;
+    }
+
+    SparseSplitter splitter(block_size, static_cast<uint32_t>(total_blocks),
+                            max_size, open_output);
+    std::vector<unsigned char> block(block_size);
+
+    for (uint64_t remaining = size; remaining > 0;) {
+        auto n = static_cast<size_t>(std::min<uint64_t>(remaining, block_size));
+
+        OUTCOME_TRYV(file_read_exact(input, block.data(), n));
+        std::fill(block.begin() + static_cast<ptrdiff_t>(n), block.end(), 0);
+
+        uint32_t fill_val;
+
+        if (is_fill_block(block.data(), block.size(), fill_val)) {
+            OUTCOME_TRYV(splitter.add_fill(fill_val, 1));
+        } else {
+            OUTCOME_TRYV(splitter.add_raw(block.data(), 1));
+        }
+
+        remaining -= n;
+    }
+
+    return splitter.finish();
+}
+
+}
@@ -0,0 +1,545 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbsparse/sparse_writer.h"
+
+#include <algorithm>
+
+#include <cstring>
+
+#include "mbcommon/crc32.h"
+#include "mbcommon/endian.h"
+#include "mbcommon/file_error.h"
+#include "mbcommon/file_util.h"
+#include "mbcommon/finally.h"
+#include "mbcommon/perf.h"
+
+#include "mbsparse/fill.h"
+#include "mbsparse/sparse_p.h"
+
+namespace mb::sparse
+{
+using namespace detail;
+
+// Flush raw chunks once they reach this size to bound memory usage
+constexpr size_t MAX_RAW_CHUNK_SIZE = 1024 * 1024;
+
+static perf::Counter g_chunks_written("sparse.chunks_written");
+
+/*!
+ * \class SparseWriter
+ *
+ * \brief Write Android sparse file image.
+ *
+ * Data written to this File handle is split into blocks. Blocks that consist
+ * of a repeating 32-bit value are stored as fill chunks and all other blocks
+ * are stored as raw chunks. Consecutive blocks of the same kind are merged
+ * into one chunk. Seeking forward leaves a hole that is stored as a
+ * "don't care" chunk.
+ *
+ * If the amount of data written is not a multiple of the block size, the last
+ * block is padded with zeros when the file is closed.
+ *
+ * The sparse header is written when the file is closed, so the output file
+ * must support File::write_at().
+ */
+
+/*!
+ * \brief Construct unbound SparseWriter.
+ *
+ * The File handle will not be bound to any file. open() will need to be called
+ * to open a file.
+ */
+SparseWriter::SparseWriter()
+    : File()
+{
+    clear();
+}
+
+/*!
+ * \brief Open sparse file for writing
+ *
+ * Construct the file handle and open the file. Use is_open() to check if the
+ * file was successfully opened.
+ *
+ * \sa open(File *, uint32_t, SparseWriterFlags)
+ *
+ * \param file File to write to
+ * \param block_size Block size
+ * \param flags Writer flags
+ */
+SparseWriter::SparseWriter(File *file, uint32_t block_size,
+                           SparseWriterFlags flags)
+    : SparseWriter()
+{
+    (void) open(file, block_size, flags);
+}
+
+SparseWriter::~SparseWriter()
+{
+    (void) close();
+}
+
+SparseWriter::SparseWriter(SparseWriter &&other) noexcept
+{
+    clear();
+
+    std::swap(m_file, other.m_file);
+    std::swap(m_block_size, other.m_block_size);
+    std::swap(m_flags, other.m_flags);
+    std::swap(m_header_offset, other.m_header_offset);
+    std::swap(m_block, other.m_block);
+    std::swap(m_block_used, other.m_block_used);
+    std::swap(m_chunk_type, other.m_chunk_type);
+    std::swap(m_chunk_blocks, other.m_chunk_blocks);
+    std::swap(m_chunk_fill_val, other.m_chunk_fill_val);
+    std::swap(m_chunk_raw, other.m_chunk_raw);
+    std::swap(m_total_blocks, other.m_total_blocks);
+    std::swap(m_total_chunks, other.m_total_chunks);
+    std::swap(m_crc32, other.m_crc32);
+}
+
+SparseWriter & SparseWriter::operator=(SparseWriter &&rhs) noexcept
+{
+    if (this != &rhs) {
+        (void) close();
+
+        std::swap(m_file, rhs.m_file);
+        std::swap(m_block_size, rhs.m_block_size);
+        std::swap(m_flags, rhs.m_flags);
+        std::swap(m_header_offset, rhs.m_header_offset);
+        std::swap(m_block, rhs.m_block);
+        std::swap(m_block_used, rhs.m_block_used);
+        std::swap(m_chunk_type, rhs.m_chunk_type);
+        std::swap(m_chunk_blocks, rhs.m_chunk_blocks);
+        std::swap(m_chunk_fill_val, rhs.m_chunk_fill_val);
+        std::swap(m_chunk_raw, rhs.m_chunk_raw);
+        std::swap(m_total_blocks, rhs.m_total_blocks);
+        std::swap(m_total_chunks, rhs.m_total_chunks);
+        std::swap(m_crc32, rhs.m_crc32);
+    }
+
+    return *this;
+}
+
+/*!
+ * \brief Open sparse file for writing
+ *
+ * \note The SparseWriter will *not* take ownership of \p file. The caller must
+ *       ensure that it is properly closed and destroyed when it is no longer
+ *       needed.
+ *
+ * \pre The caller should position the file where the sparse file should begin.
+ *      A placeholder sparse header is written there immediately and replaced
+ *      with the real header when the sparse file is closed.
+ *
+ * \param file File to write to
+ * \param block_size Block size. Must be a non-zero multiple of 4.
+ * \param flags Writer flags
+ *
+ * \return Nothing if the sparse file is successfully opened. Otherwise, the
+ *         error code.
+ */
+oc::result<void> SparseWriter::open(File *file, uint32_t block_size,
+                                    SparseWriterFlags flags)
+{
+    if (is_open()) return FileError::InvalidState;
+
+    if (!file || !file->is_open()) {
+        return FileError::InvalidState;
+    }
+
+    if (block_size == 0 || block_size % sizeof(uint32_t) != 0) {
+        return std::errc::invalid_argument;
+    }
+
+    OUTCOME_TRY(offset, file->seek(0, SEEK_CUR));
+
+    SparseHeader shdr = {};
+    OUTCOME_TRYV(file_write_exact(*file, &shdr, sizeof(shdr)));
+
+    m_file = file;
+    m_block_size = block_size;
+    m_flags = flags;
+    m_header_offset = offset;
+    m_block.resize(block_size);
+
+    return oc::success();
+}
+
+/*!
+ * \brief Close sparse file
+ *
+ * The last partial block is padded with zeros, the pending chunk and the
+ * optional CRC32 chunk are written, and then the sparse header is written.
+ *
+ * \note If the sparse file is open, then no matter what value is returned, the
+ *       sparse file will be closed.
+ *
+ * \return Nothing if the sparse file is successfully finalized. Otherwise, the
+ *         error code.
+ */
+oc::result<void> SparseWriter::close()
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    auto reset = finally([&] {
+        clear();
+    });
+
+    if (m_block_used > 0) {
+        OUTCOME_TRYV(add_zeros(m_block_size - m_block_used));
+    }
+
+    OUTCOME_TRYV(flush_chunk());
+
+    if (m_flags & SparseWriterFlag::WriteCrc32) {
+        uint32_t crc32 = mb_htole32(m_crc32);
+        OUTCOME_TRYV(write_chunk(CHUNK_TYPE_CRC32, 0, &crc32, sizeof(crc32)));
+    }
+
+    SparseHeader shdr = {};
+    shdr.magic = SPARSE_HEADER_MAGIC;
+    shdr.major_version = SPARSE_HEADER_MAJOR_VER;
+    shdr.minor_version = 0;
+    shdr.file_hdr_sz = sizeof(SparseHeader);
+    shdr.chunk_hdr_sz = sizeof(ChunkHeader);
+    shdr.blk_sz = m_block_size;
+    shdr.total_blks = m_total_blocks;
+    shdr.total_chunks = m_total_chunks;
+    shdr.image_checksum = m_flags & SparseWriterFlag::WriteCrc32 ? m_crc32 : 0;
+    to_le_sparse_header(shdr);
+
+    auto ptr = reinterpret_cast<const unsigned char *>(&shdr);
+    auto offset = m_header_offset;
+    size_t remain = sizeof(shdr);
+
+    while (remain > 0) {
+        auto n = m_file->write_at(offset, ptr, remain);
+        if (!n) {
+            if (n.error() == std::errc::interrupted) {
+                continue;
+            }
+            return n.as_failure();
+        } else if (n.value() == 0) {
+            return FileError::UnexpectedEof;
+        }
+
+        ptr += n.value();
+        offset += n.value();
+        remain -= n.value();
+    }
+
+    return oc::success();
+}
+
+/*!
+ * \brief Not supported
+ *
+ * \param buf Buffer to read into
+ * \param size Buffer size
+ *
+ * \return FileError::UnsupportedRead
+ */
+oc::result<size_t> SparseWriter::read(void *buf, size_t size)
+{
+    (void) buf;
+    (void) size;
+    return FileError::UnsupportedRead;
+}
+
+/*!
+ * \brief Write data to the sparse file
+ *
+ * \param buf Buffer to write from
+ * \param size Buffer size
+ *
+ * \return \p size if all of the data is successfully written. Otherwise, the
+ *         error code.
+ */
+oc::result<size_t> SparseWriter::write(const void *buf, size_t size)
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    auto ptr = static_cast<const unsigned char *>(buf);
+    auto remain = size;
+
+    // Complete the partial block first
+    if (m_block_used > 0) {
+        auto n = std::min(remain, m_block_size - m_block_used);
+        memcpy(m_block.data() + m_block_used, ptr, n);
+        m_block_used += n;
+        ptr += n;
+        remain -= n;
+
+        if (m_block_used < m_block_size) {
+            return size;
+        }
+
+        OUTCOME_TRYV(add_block(m_block.data()));
+        m_block_used = 0;
+    }
+
+    // Process whole blocks directly from the caller's buffer
+    for (; remain >= m_block_size; ptr += m_block_size, remain -= m_block_size) {
+        OUTCOME_TRYV(add_block(ptr));
+    }
+
+    memcpy(m_block.data(), ptr, remain);
+    m_block_used = remain;
+
+    return size;
+}
+
+/*!
+ * \brief Seek sparse file
+ *
+ * Only seeking forward from the current position is supported. Skipped whole
+ * blocks are stored as a "don't care" chunk and skipped parts of blocks are
+ * filled with zeros.
+ *
+ * \param offset Offset to seek
+ * \param whence \a SEEK_SET or \a SEEK_CUR
+ *
+ * \return New offset of sparse file if the seeking was successful. Otherwise,
+ *         the error code.
+ */
+oc::result<uint64_t> SparseWriter::seek(int64_t offset, int whence)
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    uint64_t pos = static_cast<uint64_t>(m_total_blocks) * m_block_size
+            + m_block_used;
+    uint64_t new_pos;
+
+    switch (whence) {
+    case SEEK_SET:
+        if (offset < 0) {
+            return FileError::ArgumentOutOfRange;
+        }
+        new_pos = static_cast<uint64_t>(offset);
+        break;
+    case SEEK_CUR:
+        if (offset < 0) {
+            return FileError::UnsupportedSeek;
+        } else if (pos > UINT64_MAX - static_cast<uint64_t>(offset)) {
+            return FileError::IntegerOverflow;
+        }
+        new_pos = pos + static_cast<uint64_t>(offset);
+        break;
+    default:
+        return FileError::UnsupportedSeek;
+    }
+
+    if (new_pos < pos) {
+        return FileError::UnsupportedSeek;
+    }
+
+    auto gap = new_pos - pos;
+
+    // Zero-fill the rest of the partial block
+    if (m_block_used > 0 && gap > 0) {
+        auto n = std::min<uint64_t>(gap, m_block_size - m_block_used);
+        OUTCOME_TRYV(add_zeros(n));
+        gap -= n;
+    }
+
+    OUTCOME_TRYV(add_dont_care_blocks(gap / m_block_size));
+    OUTCOME_TRYV(add_zeros(gap % m_block_size));
+
+    return new_pos;
+}
+
+/*!
+ * \brief Not supported
+ *
+ * \param size New size of file
+ *
+ * \return FileError::UnsupportedTruncate
+ */
+oc::result<void> SparseWriter::truncate(uint64_t size)
+{
+    (void) size;
+    return FileError::UnsupportedTruncate;
+}
+
+bool SparseWriter::is_open()
+{
+    return m_file;
+}
+
+/*!
+ * \brief Get the number of chunks written so far
+ *
+ * \return Number of complete chunks written to the output file. The chunk
+ *         currently being merged is not included.
+ */
+uint32_t SparseWriter::chunk_count() const noexcept
+{
+    return m_total_chunks;
+}
+
+void SparseWriter::clear() noexcept
+{
+    m_file = nullptr;
+    m_block_size = 0;
+    m_flags = {};
+    m_header_offset = 0;
+    m_block.clear();
+    m_block_used = 0;
+    m_chunk_type = 0;
+    m_chunk_blocks = 0;
+    m_chunk_fill_val = 0;
+    m_chunk_raw.clear();
+    m_total_blocks = 0;
+    m_total_chunks = 0;
+    m_crc32 = 0;
+}
+
+oc::result<void> SparseWriter::add_block(const unsigned char *block)
+{
+    if (m_flags & SparseWriterFlag::WriteCrc32) {
+        m_crc32 = crc32_update(m_crc32, block, m_block_size);
+    }
+
+    uint32_t fill_val;
+
+    if (!is_fill_block(block, m_block_size, fill_val)) {
+        return extend_chunk(CHUNK_TYPE_RAW, 0, block);
+    } else if (fill_val == 0
+            && (m_flags & SparseWriterFlag::DontCareZeroBlocks)) {
+        return extend_chunk(CHUNK_TYPE_DONT_CARE, 0, nullptr);
+    } else {
+        return extend_chunk(CHUNK_TYPE_FILL, fill_val, nullptr);
+    }
+}
+
+oc::result<void> SparseWriter::add_dont_care_blocks(uint64_t count)
+{
+    for (; count > 0; --count) {
+        if (m_flags & SparseWriterFlag::WriteCrc32) {
+            // "Don't care" blocks count as zeros in the checksum
+            m_crc32 = crc32_update_repeated(m_crc32, 0, m_block_size);
+        }
+
+        OUTCOME_TRYV(extend_chunk(CHUNK_TYPE_DONT_CARE, 0, nullptr));
+    }
+
+    return oc::success();
+}
+
+oc::result<void> SparseWriter::add_zeros(uint64_t size)
+{
+    while (size > 0) {
+        auto n = static_cast<size_t>(
+                std::min<uint64_t>(size, m_block_size - m_block_used));
+        std::fill_n(m_block.begin() + static_cast<ptrdiff_t>(m_block_used), n, 0);
+        m_block_used += n;
+        size -= n;
+
+        if (m_block_used == m_block_size) {
+            OUTCOME_TRYV(add_block(m_block.data()));
+            m_block_used = 0;
+        }
+    }
+
+    return oc::success();
+}
+
+oc::result<void> SparseWriter::extend_chunk(uint16_t type, uint32_t fill_val,
+                                            const unsigned char *raw_block)
+{
+    if (m_total_blocks == UINT32_MAX) {
+        return FileError::IntegerOverflow;
+    }
+
+    bool same = m_chunk_type == type
+            && (type != CHUNK_TYPE_FILL || m_chunk_fill_val == fill_val)
+            && (type != CHUNK_TYPE_RAW
+                    || m_chunk_raw.size() + m_block_size <= MAX_RAW_CHUNK_SIZE);
+
+    if (!same) {
+        OUTCOME_TRYV(flush_chunk());
+
+        m_chunk_type = type;
+        m_chunk_fill_val = fill_val;
+    }
+
+    if (raw_block) {
+        m_chunk_raw.insert(m_chunk_raw.end(), raw_block,
+                           raw_block + m_block_size);
+    }
+
+    ++m_chunk_blocks;
+    ++m_total_blocks;
+
+    return oc::success();
+}
+
+oc::result<void> SparseWriter::flush_chunk()
+{
+    if (m_chunk_blocks == 0) {
+        return oc::success();
+    }
+
+    if (m_chunk_type == CHUNK_TYPE_FILL) {
+        uint32_t fill_val = mb_htole32(m_chunk_fill_val);
+        OUTCOME_TRYV(write_chunk(m_chunk_type, m_chunk_blocks,
+                                 &fill_val, sizeof(fill_val)));
+    } else {
+        // Empty for "don't care" chunks
+        OUTCOME_TRYV(write_chunk(m_chunk_type, m_chunk_blocks,
+                                 m_chunk_raw.data(), m_chunk_raw.size()));
+    }
+
+    m_chunk_type = 0;
+    m_chunk_blocks = 0;
+    m_chunk_fill_val = 0;
+    m_chunk_raw.clear();
+
+    return oc::success();
+}
+
+oc::result<void> SparseWriter::write_chunk(uint16_t type, uint32_t blocks,
+                                           const void *data, size_t data_size)
+{
+    if (m_total_chunks == UINT32_MAX) {
+        return FileError::IntegerOverflow;
+    }
+
+    ChunkHeader chdr = {};
+    chdr.chunk_type = type;
+    chdr.chunk_sz = blocks;
+    chdr.total_sz = static_cast<uint32_t>(sizeof(chdr) + data_size);
+    to_le_chunk_header(chdr);
+
+    ConstIoVec iov[] = {
+        { &chdr, sizeof(chdr) },
+        { data, data_size },
+    };
+
+    OUTCOME_TRYV(file_writev_exact(*m_file, iov, data_size > 0 ? 2 : 1));
+
+    ++m_total_chunks;
+    g_chunks_written.add();
+
+    return oc::success();
+}
+
+}
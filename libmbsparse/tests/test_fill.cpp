@@ -0,0 +1,148 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+#include <cstring>
+
+#include "mbsparse/fill.h"
+
+using namespace mb::sparse;
+
+TEST(SparseFillTest, FillRepeatedWritesLittleEndianPattern)
+{
+    // Sizes around the internal group size, including ones that are not a
+    // multiple of 4
+    static const size_t sizes[] = { 0, 1, 3, 4, 7, 63, 64, 65, 130, 4096 };
+
+    for (size_t size : sizes) {
+        std::vector<unsigned char> buf(size + 1, 0xaa);
+
+        fill_repeated(buf.data(), size, 0x04030201);
+
+        for (size_t i = 0; i < size; ++i) {
+            ASSERT_EQ(buf[i], i % 4 + 1) << "size " << size << ", offset " << i;
+        }
+        ASSERT_EQ(buf[size], 0xaa) << "size " << size;
+    }
+}
+
+TEST(SparseFillTest, FillRepeatedUniformBytes)
+{
+    std::vector<unsigned char> buf(100, 0xaa);
+    std::vector<unsigned char> expected(100, 0xff);
+    expected.back() = 0xaa;
+
+    fill_repeated(buf.data(), 99, 0xffffffff);
+    ASSERT_EQ(buf, expected);
+}
+
+TEST(SparseFillTest, ZeroBlock)
+{
+    static const size_t sizes[] = { 0, 1, 8, 63, 64, 100, 4096 };
+
+    for (size_t size : sizes) {
+        std::vector<unsigned char> buf(size, 0);
+        ASSERT_TRUE(is_zero_block(buf.data(), buf.size())) << size;
+
+        for (size_t i = 0; i < size; i += 7) {
+            buf[i] = 1;
+            ASSERT_FALSE(is_zero_block(buf.data(), buf.size()))
+                    << "size " << size << ", offset " << i;
+            buf[i] = 0;
+        }
+    }
+}
+
+TEST(SparseFillTest, FillBlock)
+{
+    std::vector<unsigned char> buf(4096 + 4);
+    fill_repeated(buf.data(), buf.size(), 0xdeadbeef);
+
+    uint32_t fill_val = 0;
+    ASSERT_TRUE(is_fill_block(buf.data(), buf.size(), fill_val));
+    ASSERT_EQ(fill_val, 0xdeadbeefu);
+
+    // Last byte of the tail, which is shorter than a group
+    buf.back() ^= 1;
+    ASSERT_FALSE(is_fill_block(buf.data(), buf.size(), fill_val));
+    buf.back() ^= 1;
+
+    // Byte in the middle of a group
+    buf[1000] ^= 1;
+    ASSERT_FALSE(is_fill_block(buf.data(), buf.size(), fill_val));
+    buf[1000] ^= 1;
+
+    std::vector<unsigned char> zeros(64);
+    ASSERT_TRUE(is_fill_block(zeros.data(), zeros.size(), fill_val));
+    ASSERT_EQ(fill_val, 0u);
+}
+
+TEST(SparseFillTest, FillBlockRejectsInvalidSizes)
+{
+    unsigned char buf[6] = {};
+    uint32_t fill_val;
+
+    ASSERT_FALSE(is_fill_block(buf, 0, fill_val));
+    ASSERT_FALSE(is_fill_block(buf, 2, fill_val));
+    ASSERT_FALSE(is_fill_block(buf, 6, fill_val));
+}
+
+TEST(SparseFillTest, SelectedImplementationHandlesUnalignedBuffers)
+{
+    std::vector<unsigned char> storage(256 + 16);
+
+    // Cover the vectorized paths, their tails, and every byte of a group
+    for (size_t offset = 0; offset < 16; offset += 3) {
+        for (size_t size : {4, 60, 64, 68, 128, 132, 256}) {
+            auto buf = storage.data() + offset;
+
+            fill_repeated(buf, size, 0x04030201);
+
+            for (size_t i = 0; i < size; ++i) {
+                ASSERT_EQ(buf[i], i % 4 + 1)
+                        << "Implementation: " << fill_implementation()
+                        << ", offset: " << offset << ", size: " << size;
+            }
+
+            uint32_t fill_val = 0;
+            ASSERT_TRUE(is_fill_block(buf, size, fill_val))
+                    << "Implementation: " << fill_implementation();
+            ASSERT_EQ(fill_val, 0x04030201u);
+
+            // A single word is always a fill block
+            for (size_t i = 0; size > 4 && i < size; ++i) {
+                buf[i] ^= 0x80;
+                ASSERT_FALSE(is_fill_block(buf, size, fill_val))
+                        << "Implementation: " << fill_implementation()
+                        << ", offset: " << offset << ", size: " << size
+                        << ", byte: " << i;
+                buf[i] ^= 0x80;
+            }
+
+            memset(buf, 0, size);
+            ASSERT_TRUE(is_zero_block(buf, size));
+            buf[size - 1] = 1;
+            ASSERT_FALSE(is_zero_block(buf, size));
+        }
+    }
+}
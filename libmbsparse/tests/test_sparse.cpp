@@ -19,11 +19,15 @@
 
 #include <gtest/gtest.h>
 
+#include <cstddef>
+#include <cstdlib>
+
 #include "mbsparse/sparse.h"
 
 #include "mbcommon/endian.h"
 #include "mbcommon/file/memory.h"
 #include "mbcommon/file_error.h"
+#include "mbcommon/finally.h"
 
 #include "mbsparse/sparse_error.h"
 
@@ -87,7 +91,7 @@ struct SparseTest : testing::Test
         ASSERT_TRUE(_source_file.open(&_data, &_size));
     }
 
-    void build_valid_data(bool oversized)
+    void build_valid_data(bool oversized, uint32_t crc32 = 0)
     {
         SparseHeader shdr = {};
         shdr.magic = SPARSE_HEADER_MAGIC;
@@ -161,7 +165,8 @@ struct SparseTest : testing::Test
         if (oversized) {
             ASSERT_TRUE(_source_file.write("\xaa\xbb\xcc\xdd", 4));
         }
-        ASSERT_TRUE(_source_file.write("\x00\x00\x00\x00", 4));
+        crc32 = mb_htole32(crc32);
+        ASSERT_TRUE(_source_file.write(&crc32, sizeof(crc32)));
 
         // Move back to beginning of the file
         ASSERT_TRUE(_source_file.seek(0, SEEK_SET));
@@ -729,3 +734,235 @@ TEST_F(SparseTest, ReadValidDataWithUnseekableFile)
 
     ASSERT_TRUE(_file.close());
 }
+
+TEST_F(SparseTest, IterateExtentsWithUnseekableFile)
+{
+    char buf[1024];
+    build_valid_data(true);
+
+    _source_file.set_seekability(Seekability::CanRead);
+    ASSERT_TRUE(_file.open(&_source_file));
+
+    // Raw chunk, partially read
+    ASSERT_EQ(_file.read(buf, 1), oc::success(1u));
+
+    auto extent = _file.next_extent();
+    ASSERT_TRUE(extent);
+    ASSERT_TRUE(extent.value());
+    ASSERT_EQ(extent.value()->type, ExtentType::Data);
+    ASSERT_EQ(extent.value()->offset, 1u);
+    ASSERT_EQ(extent.value()->length, 15u);
+
+    ASSERT_EQ(_file.read(buf, 15), oc::success(15u));
+    ASSERT_EQ(memcmp(buf, expected_valid_data + 1, 15), 0);
+
+    // Fill chunk, with the filler value rotated to match the position
+    ASSERT_EQ(_file.read(buf, 1), oc::success(1u));
+
+    extent = _file.next_extent();
+    ASSERT_TRUE(extent);
+    ASSERT_TRUE(extent.value());
+    ASSERT_EQ(extent.value()->type, ExtentType::Fill);
+    ASSERT_EQ(extent.value()->offset, 17u);
+    ASSERT_EQ(extent.value()->length, 15u);
+    ASSERT_EQ(extent.value()->fill_val, 0x78123456u);
+
+    ASSERT_TRUE(_file.skip_extent());
+
+    // Skip chunk
+    extent = _file.next_extent();
+    ASSERT_TRUE(extent);
+    ASSERT_TRUE(extent.value());
+    ASSERT_EQ(extent.value()->type, ExtentType::Hole);
+    ASSERT_EQ(extent.value()->offset, 32u);
+    ASSERT_EQ(extent.value()->length, 16u);
+
+    ASSERT_TRUE(_file.skip_extent());
+
+    // EOF
+    ASSERT_EQ(_file.next_extent(), oc::success(std::nullopt));
+    ASSERT_TRUE(_file.skip_extent());
+    ASSERT_EQ(_file.read(buf, sizeof(buf)), oc::success(0u));
+
+    ASSERT_TRUE(_file.close());
+}
+
+TEST_F(SparseTest, SkipDataExtentWithUnseekableFile)
+{
+    char buf[1024];
+    build_valid_data(true);
+
+    _source_file.set_seekability(Seekability::CanRead);
+    ASSERT_TRUE(_file.open(&_source_file));
+
+    // Skipping raw data must consume it from the input
+    ASSERT_TRUE(_file.skip_extent());
+
+    ASSERT_EQ(_file.read(buf, sizeof(buf)), oc::success(32u));
+    ASSERT_EQ(memcmp(buf, expected_valid_data + 16, 32), 0);
+
+    ASSERT_TRUE(_file.close());
+}
+
+TEST_F(SparseTest, VerifyCrc32WithUnseekableFile)
+{
+    char buf[1024];
+    char *ptr = buf;
+    build_valid_data(true, 0x21302e42);
+
+    _source_file.set_seekability(Seekability::CanRead);
+    ASSERT_TRUE(_file.open(&_source_file, SparseFileFlag::VerifyCrc32));
+
+    // Read one byte at a time to check that the checksum is computed
+    // incrementally
+    while (true) {
+        auto n = _file.read(ptr, 1);
+        ASSERT_TRUE(n);
+        if (n.value() == 0) {
+            break;
+        }
+        ptr += n.value();
+    }
+
+    ASSERT_EQ(ptr - buf, static_cast<ptrdiff_t>(sizeof(expected_valid_data)));
+    ASSERT_EQ(memcmp(buf, expected_valid_data, sizeof(expected_valid_data)), 0);
+
+    ASSERT_TRUE(_file.close());
+}
+
+TEST_F(SparseTest, VerifyCrc32WithSkippedExtents)
+{
+    build_valid_data(true, 0x21302e42);
+
+    ASSERT_TRUE(_file.open(&_source_file, SparseFileFlag::VerifyCrc32));
+
+    // Random access is not possible when verifying
+    ASSERT_EQ(_file.seek(0, SEEK_SET), oc::failure(FileError::UnsupportedSeek));
+
+    for (int i = 0; i < 3; ++i) {
+        ASSERT_TRUE(_file.skip_extent());
+    }
+    ASSERT_EQ(_file.next_extent(), oc::success(std::nullopt));
+
+    ASSERT_TRUE(_file.close());
+}
+
+TEST_F(SparseTest, VerifyCrc32MismatchFailure)
+{
+    char buf[1024];
+    build_valid_data(true, 0x12345678);
+
+    ASSERT_TRUE(_file.open(&_source_file, SparseFileFlag::VerifyCrc32));
+    ASSERT_EQ(_file.read(buf, sizeof(buf)),
+              oc::failure(SparseFileError::ChecksumMismatch));
+    ASSERT_TRUE(_file.close());
+
+    // Not checked unless requested
+    ASSERT_TRUE(_source_file.seek(0, SEEK_SET));
+    ASSERT_TRUE(_file.open(&_source_file));
+    ASSERT_EQ(_file.read(buf, sizeof(buf)),
+              oc::success(sizeof(expected_valid_data)));
+    ASSERT_TRUE(_file.close());
+}
+
+TEST_F(SparseTest, SaveAndLoadIndex)
+{
+    char buf[1024];
+    build_valid_data(true);
+
+    void *index_data = nullptr;
+    size_t index_size = 0;
+    auto free_index = finally([&] {
+        free(index_data);
+    });
+
+    {
+        MemoryFile index_file(&index_data, &index_size);
+        ASSERT_TRUE(index_file.is_open());
+
+        ASSERT_TRUE(_file.open(&_source_file));
+        ASSERT_TRUE(_file.save_index(index_file));
+        ASSERT_TRUE(_file.close());
+    }
+
+    ASSERT_EQ(index_size, sizeof(IndexHeader) + 4 * sizeof(IndexEntry));
+
+    ASSERT_TRUE(_source_file.seek(0, SEEK_SET));
+    ASSERT_TRUE(_file.open(&_source_file));
+
+    MemoryFile index_file(index_data, index_size);
+    ASSERT_TRUE(index_file.is_open());
+    ASSERT_TRUE(_file.load_index(index_file));
+
+    // Random access without parsing the chunk headers first
+    ASSERT_TRUE(_file.seek(33, SEEK_SET));
+    ASSERT_EQ(_file.read(buf, sizeof(buf)), oc::success(15u));
+    ASSERT_EQ(memcmp(buf, expected_valid_data + 33, 15), 0);
+
+    ASSERT_TRUE(_file.seek(0, SEEK_SET));
+    ASSERT_EQ(_file.read(buf, sizeof(buf)),
+              oc::success(sizeof(expected_valid_data)));
+    ASSERT_EQ(memcmp(buf, expected_valid_data, sizeof(expected_valid_data)), 0);
+
+    // A loaded index cannot be replaced
+    ASSERT_TRUE(index_file.seek(0, SEEK_SET));
+    ASSERT_EQ(_file.load_index(index_file),
+              oc::failure(FileError::InvalidState));
+}
+
+TEST_F(SparseTest, LoadInvalidIndexFailure)
+{
+    build_valid_data(false);
+
+    void *index_data = nullptr;
+    size_t index_size = 0;
+    auto free_index = finally([&] {
+        free(index_data);
+    });
+
+    {
+        MemoryFile index_file(&index_data, &index_size);
+        ASSERT_TRUE(index_file.is_open());
+
+        ASSERT_TRUE(_file.open(&_source_file));
+        ASSERT_TRUE(_file.save_index(index_file));
+        ASSERT_TRUE(_file.close());
+    }
+
+    auto *ptr = static_cast<unsigned char *>(index_data);
+
+    auto load = [&]() -> oc::result<void> {
+        EXPECT_TRUE(_source_file.seek(0, SEEK_SET));
+        EXPECT_TRUE(_file.open(&_source_file));
+        auto close = finally([&] {
+            (void) _file.close();
+        });
+
+        MemoryFile index_file(index_data, index_size);
+        EXPECT_TRUE(index_file.is_open());
+        return _file.load_index(index_file);
+    };
+
+    ASSERT_TRUE(load());
+
+    // Bad magic
+    ptr[0] ^= 0xff;
+    ASSERT_EQ(load(), oc::failure(SparseFileError::InvalidIndexHeader));
+    ptr[0] ^= 0xff;
+
+    // Different image
+    ptr[offsetof(IndexHeader, total_blks)] ^= 0xff;
+    ASSERT_EQ(load(), oc::failure(SparseFileError::IndexDoesNotMatchImage));
+    ptr[offsetof(IndexHeader, total_blks)] ^= 0xff;
+
+    // Non-contiguous chunk
+    ptr[sizeof(IndexHeader) + sizeof(IndexEntry)
+            + offsetof(IndexEntry, begin)] ^= 0x01;
+    ASSERT_EQ(load(), oc::failure(SparseFileError::InvalidIndexEntry));
+    ptr[sizeof(IndexHeader) + sizeof(IndexEntry)
+            + offsetof(IndexEntry, begin)] ^= 0x01;
+
+    // Truncated
+    index_size -= 1;
+    ASSERT_EQ(load(), oc::failure(SparseFileError::InvalidIndexEntry));
+}
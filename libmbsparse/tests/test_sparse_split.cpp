@@ -0,0 +1,251 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <cstdlib>
+#include <cstring>
+
+#include "mbcommon/file/memory.h"
+#include "mbcommon/file_util.h"
+
+#include "mbsparse/sparse.h"
+#include "mbsparse/sparse_p.h"
+#include "mbsparse/sparse_split.h"
+#include "mbsparse/sparse_writer.h"
+
+using namespace mb;
+using namespace mb::sparse;
+using namespace mb::sparse::detail;
+
+static constexpr uint32_t TEST_BLOCK_SIZE = 16;
+
+// Sparse header, raw chunk with one block, and "don't care" chunks before and
+// after it
+static constexpr uint64_t TEST_MIN_SIZE = sizeof(SparseHeader)
+        + 3 * sizeof(ChunkHeader) + TEST_BLOCK_SIZE;
+
+struct Piece
+{
+    void *data = nullptr;
+    size_t size = 0;
+    MemoryFile file;
+
+    ~Piece()
+    {
+        free(data);
+    }
+};
+
+struct SparseSplitTest : testing::Test
+{
+    std::vector<std::unique_ptr<Piece>> _pieces;
+
+    SparseSplitOpenCallback open_callback()
+    {
+        return [this](size_t index) -> oc::result<File *> {
+            EXPECT_EQ(index, _pieces.size());
+
+            auto piece = std::make_unique<Piece>();
+            OUTCOME_TRYV(piece->file.open(&piece->data, &piece->size));
+
+            _pieces.push_back(std::move(piece));
+            return &_pieces.back()->file;
+        };
+    }
+
+    static std::string make_raw_image()
+    {
+        std::string data;
+        for (int i = 0; i < 5; ++i) {
+            data += "0123456789abcde";
+            data += static_cast<char>('A' + i);
+        }
+        data += std::string(TEST_BLOCK_SIZE * 3, '\xaa');
+        for (int i = 0; i < 4; ++i) {
+            data += "fedcba987654321";
+            data += static_cast<char>('a' + i);
+        }
+        data += std::string(TEST_BLOCK_SIZE * 2, '\0');
+        return data;
+    }
+
+    // Combine the non-hole regions of all pieces. Bytes not covered by any
+    // piece are left as '?'.
+    std::string combine()
+    {
+        std::string result;
+
+        for (auto &piece : _pieces) {
+            MemoryFile source(piece->data, piece->size);
+            EXPECT_TRUE(source.is_open());
+
+            SparseFile file;
+            EXPECT_TRUE(file.open(&source));
+
+            if (result.empty()) {
+                result.assign(static_cast<size_t>(file.size()), '?');
+            }
+            EXPECT_EQ(file.size(), result.size());
+
+            while (true) {
+                auto extent = file.next_extent();
+                EXPECT_TRUE(extent);
+                if (!extent || !extent.value()) {
+                    break;
+                }
+
+                auto offset = static_cast<size_t>(extent.value()->offset);
+                auto length = static_cast<size_t>(extent.value()->length);
+
+                if (extent.value()->type == ExtentType::Hole) {
+                    EXPECT_TRUE(file.skip_extent());
+                } else {
+                    EXPECT_EQ(file_read_retry(file, result.data() + offset,
+                                              length),
+                              oc::success(length));
+                }
+            }
+        }
+
+        return result;
+    }
+};
+
+TEST_F(SparseSplitTest, SplitInvalidArguments)
+{
+    std::string data = make_raw_image();
+    MemoryFile input(data.data(), data.size());
+    ASSERT_TRUE(input.is_open());
+
+    auto error = oc::failure(std::errc::invalid_argument);
+
+    ASSERT_EQ(split_raw_file(input, data.size(), TEST_BLOCK_SIZE,
+                             TEST_MIN_SIZE - 1, open_callback()), error);
+    ASSERT_EQ(split_raw_file(input, data.size(), 6, TEST_MIN_SIZE,
+                             open_callback()), error);
+    ASSERT_TRUE(_pieces.empty());
+}
+
+TEST_F(SparseSplitTest, SplitRawImage)
+{
+    std::string data = make_raw_image();
+    // Partial last block
+    data += "01234567";
+
+    MemoryFile input(data.data(), data.size());
+    ASSERT_TRUE(input.is_open());
+
+    // Room for three raw blocks
+    uint64_t max_size = TEST_MIN_SIZE + 2 * TEST_BLOCK_SIZE;
+
+    auto n = split_raw_file(input, data.size(), TEST_BLOCK_SIZE, max_size,
+                            open_callback());
+    ASSERT_TRUE(n);
+    ASSERT_GT(n.value(), 1u);
+    ASSERT_EQ(n.value(), _pieces.size());
+
+    for (auto &piece : _pieces) {
+        ASSERT_LE(piece->size, max_size);
+    }
+
+    data.resize(data.size() + 8, '\0');
+    ASSERT_EQ(combine(), data);
+}
+
+TEST_F(SparseSplitTest, SplitSparseImageWithoutExpanding)
+{
+    void *sparse_data = nullptr;
+    size_t sparse_size = 0;
+    std::string expected;
+
+    {
+        MemoryFile output(&sparse_data, &sparse_size);
+        ASSERT_TRUE(output.is_open());
+
+        SparseWriter writer(&output, TEST_BLOCK_SIZE);
+        ASSERT_TRUE(writer.is_open());
+
+        std::string raw = make_raw_image();
+        expected += raw;
+        ASSERT_TRUE(file_write_exact(writer, raw.data(), raw.size()));
+
+        // Large fill and hole regions
+        std::string fill(TEST_BLOCK_SIZE * 1000, '\x55');
+        expected += fill;
+        ASSERT_TRUE(file_write_exact(writer, fill.data(), fill.size()));
+
+        expected += std::string(TEST_BLOCK_SIZE * 500, '\0');
+        ASSERT_TRUE(writer.seek(TEST_BLOCK_SIZE * 500, SEEK_CUR));
+
+        expected += raw;
+        ASSERT_TRUE(file_write_exact(writer, raw.data(), raw.size()));
+
+        ASSERT_TRUE(writer.close());
+    }
+
+    MemoryFile source(sparse_data, sparse_size);
+    ASSERT_TRUE(source.is_open());
+
+    SparseFile input;
+    ASSERT_TRUE(input.open(&source));
+
+    uint64_t max_size = TEST_MIN_SIZE + 4 * TEST_BLOCK_SIZE;
+
+    auto n = split_sparse_file(input, max_size, open_callback());
+    free(sparse_data);
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), _pieces.size());
+
+    // Each of the 18 raw blocks needs to be stored once, but the fill and
+    // hole regions do not take up any space
+    size_t total = 0;
+    for (auto &piece : _pieces) {
+        ASSERT_LE(piece->size, max_size);
+        total += piece->size;
+    }
+    ASSERT_LT(total, _pieces.size() * max_size);
+    ASSERT_LT(total, expected.size() / 10);
+
+    // The hole is not covered by any piece
+    auto result = combine();
+    ASSERT_EQ(result.size(), expected.size());
+    auto hole_begin = expected.size() - make_raw_image().size()
+            - TEST_BLOCK_SIZE * 500;
+    ASSERT_EQ(result.substr(hole_begin, TEST_BLOCK_SIZE * 500),
+              std::string(TEST_BLOCK_SIZE * 500, '?'));
+    result.replace(hole_begin, TEST_BLOCK_SIZE * 500,
+                   TEST_BLOCK_SIZE * 500, '\0');
+    ASSERT_EQ(result, expected);
+}
+
+TEST_F(SparseSplitTest, SplitFittingImageProducesOnePiece)
+{
+    std::string data = make_raw_image();
+    MemoryFile input(data.data(), data.size());
+    ASSERT_TRUE(input.is_open());
+
+    ASSERT_EQ(split_raw_file(input, data.size(), TEST_BLOCK_SIZE, 1024 * 1024,
+                             open_callback()), oc::success(1u));
+    ASSERT_EQ(combine(), data);
+}
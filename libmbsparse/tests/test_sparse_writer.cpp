@@ -0,0 +1,220 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+#include <cstdlib>
+#include <cstring>
+
+#include "mbcommon/endian.h"
+#include "mbcommon/file/memory.h"
+#include "mbcommon/file_error.h"
+#include "mbcommon/file_util.h"
+
+#include "mbsparse/sparse.h"
+#include "mbsparse/sparse_p.h"
+#include "mbsparse/sparse_writer.h"
+
+using namespace mb;
+using namespace mb::sparse;
+using namespace mb::sparse::detail;
+
+static constexpr uint32_t TEST_BLOCK_SIZE = 16;
+
+struct SparseWriterTest : testing::Test
+{
+    void *_data = nullptr;
+    size_t _size = 0;
+    MemoryFile _output;
+
+    virtual ~SparseWriterTest()
+    {
+        free(_data);
+    }
+
+    void SetUp() override
+    {
+        ASSERT_TRUE(_output.open(&_data, &_size));
+    }
+
+    SparseHeader sparse_header()
+    {
+        SparseHeader shdr;
+        EXPECT_GE(_size, sizeof(shdr));
+        memcpy(&shdr, _data, sizeof(shdr));
+
+        shdr.magic = mb_le32toh(shdr.magic);
+        shdr.blk_sz = mb_le32toh(shdr.blk_sz);
+        shdr.total_blks = mb_le32toh(shdr.total_blks);
+        shdr.total_chunks = mb_le32toh(shdr.total_chunks);
+        shdr.image_checksum = mb_le32toh(shdr.image_checksum);
+
+        return shdr;
+    }
+
+    std::vector<uint16_t> chunk_types()
+    {
+        std::vector<uint16_t> types;
+        auto ptr = static_cast<const unsigned char *>(_data);
+        size_t offset = sizeof(SparseHeader);
+
+        while (offset + sizeof(ChunkHeader) <= _size) {
+            ChunkHeader chdr;
+            memcpy(&chdr, ptr + offset, sizeof(chdr));
+            types.push_back(mb_le16toh(chdr.chunk_type));
+            offset += mb_le32toh(chdr.total_sz);
+        }
+
+        return types;
+    }
+
+    std::string expand()
+    {
+        MemoryFile source(_data, _size);
+        EXPECT_TRUE(source.is_open());
+
+        SparseFile file;
+        EXPECT_TRUE(file.open(&source));
+
+        std::string result(static_cast<size_t>(file.size()) + 1, '\0');
+        auto n = file_read_retry(file, result.data(), result.size());
+        EXPECT_TRUE(n);
+        result.resize(n ? n.value() : 0);
+
+        return result;
+    }
+};
+
+TEST_F(SparseWriterTest, OpenInvalidArguments)
+{
+    SparseWriter writer;
+
+    ASSERT_EQ(writer.open(&_output, 0),
+              oc::failure(std::errc::invalid_argument));
+    ASSERT_EQ(writer.open(&_output, 6),
+              oc::failure(std::errc::invalid_argument));
+    ASSERT_FALSE(writer.is_open());
+
+    auto error = oc::failure(FileError::InvalidState);
+    ASSERT_EQ(writer.write("", 0), error);
+    ASSERT_EQ(writer.close(), error);
+}
+
+TEST_F(SparseWriterTest, CoalesceBlocks)
+{
+    std::string data;
+    data += std::string(TEST_BLOCK_SIZE * 2, '\0');
+    data += "0123456789abcdef" "fedcba9876543210";
+    data += std::string(TEST_BLOCK_SIZE * 3, '\xaa');
+    data += std::string(TEST_BLOCK_SIZE, '\0');
+
+    {
+        SparseWriter writer(&_output, TEST_BLOCK_SIZE);
+        ASSERT_TRUE(writer.is_open());
+
+        // Write in pieces that do not line up with the blocks
+        for (size_t i = 0; i < data.size(); i += 7) {
+            auto n = std::min<size_t>(7, data.size() - i);
+            ASSERT_EQ(writer.write(data.data() + i, n), oc::success(n));
+        }
+
+        ASSERT_TRUE(writer.close());
+    }
+
+    auto shdr = sparse_header();
+    ASSERT_EQ(shdr.magic, SPARSE_HEADER_MAGIC);
+    ASSERT_EQ(shdr.blk_sz, TEST_BLOCK_SIZE);
+    ASSERT_EQ(shdr.total_blks, 8u);
+    ASSERT_EQ(shdr.total_chunks, 4u);
+    ASSERT_EQ(shdr.image_checksum, 0u);
+
+    ASSERT_EQ(chunk_types(), (std::vector<uint16_t>{
+        CHUNK_TYPE_FILL, CHUNK_TYPE_RAW, CHUNK_TYPE_FILL, CHUNK_TYPE_FILL,
+    }));
+
+    ASSERT_EQ(expand(), data);
+}
+
+TEST_F(SparseWriterTest, DontCareZeroBlocksAndHoles)
+{
+    {
+        SparseWriter writer(&_output, TEST_BLOCK_SIZE,
+                            SparseWriterFlag::DontCareZeroBlocks);
+        ASSERT_TRUE(writer.is_open());
+
+        ASSERT_TRUE(writer.write("0123456789", 10));
+        // Rest of the block is zero-filled, then two blocks are skipped
+        ASSERT_EQ(writer.seek(TEST_BLOCK_SIZE * 2 + 6, SEEK_CUR),
+                  oc::success(TEST_BLOCK_SIZE * 3));
+        ASSERT_TRUE(writer.write(std::string(TEST_BLOCK_SIZE, '\0').data(),
+                                 TEST_BLOCK_SIZE));
+        ASSERT_EQ(writer.seek(-1, SEEK_CUR),
+                  oc::failure(FileError::UnsupportedSeek));
+        // Partial last block is padded
+        ASSERT_TRUE(writer.write("x", 1));
+
+        ASSERT_TRUE(writer.close());
+    }
+
+    auto shdr = sparse_header();
+    ASSERT_EQ(shdr.total_blks, 5u);
+
+    ASSERT_EQ(chunk_types(), (std::vector<uint16_t>{
+        CHUNK_TYPE_RAW, CHUNK_TYPE_DONT_CARE, CHUNK_TYPE_RAW,
+    }));
+
+    std::string expected = "0123456789";
+    expected.resize(TEST_BLOCK_SIZE * 4);
+    expected += 'x';
+    expected.resize(TEST_BLOCK_SIZE * 5);
+
+    ASSERT_EQ(expand(), expected);
+}
+
+TEST_F(SparseWriterTest, WriteCrc32Chunk)
+{
+    std::string data = "0123456789abcdef" + std::string(TEST_BLOCK_SIZE, '\0');
+
+    {
+        SparseWriter writer(&_output, TEST_BLOCK_SIZE,
+                            SparseWriterFlag::WriteCrc32);
+        ASSERT_TRUE(writer.is_open());
+        ASSERT_TRUE(writer.write(data.data(), data.size()));
+        ASSERT_TRUE(writer.close());
+    }
+
+    // CRC32 of the expanded data (standard 802.3 polynomial)
+    constexpr uint32_t expected_crc32 = 0xf3260e68;
+
+    auto shdr = sparse_header();
+    ASSERT_EQ(shdr.image_checksum, expected_crc32);
+
+    auto types = chunk_types();
+    ASSERT_EQ(types.back(), CHUNK_TYPE_CRC32);
+
+    uint32_t crc32;
+    memcpy(&crc32, static_cast<char *>(_data) + _size - sizeof(crc32),
+           sizeof(crc32));
+    ASSERT_EQ(mb_le32toh(crc32), expected_crc32);
+
+    ASSERT_EQ(expand(), data);
+}
@@ -19,6 +19,7 @@
 
 #pragma once
 
+#include <deque>
 #include <variant>
 
 #include <sys/signal.h>
@@ -175,6 +176,38 @@ struct SysCallStopEvent
     ArchRegs regs;
 };
 
+/*!
+ * \brief Event emitted when a seccomp filter requests that a syscall be traced
+ *
+ * This event is emitted when `waitpid()` returns a status such that
+ * `WIFSTOPPED(status)` is true and `status >> 8` is
+ * `SIGTRAP | (PTRACE_EVENT_SECCOMP << 8)`, indicating that a seccomp filter
+ * returned `SECCOMP_RET_TRACE` for a syscall that the tracee is about to enter.
+ * This event is only emitted if the tracee was seized with
+ * `PTRACE_O_TRACESECCOMP`.
+ *
+ * On kernel 4.8 and newer, the seccomp stop occurs after the syscall-entry
+ * stop. If the tracee was resumed with `PTRACE_CONT`, this event takes the
+ * place of the syscall-entry stop and the tracer may modify the syscall number
+ * and arguments. The filter is not rerun for the modified syscall. If the
+ * tracee was resumed with `PTRACE_SYSCALL`, the syscall-entry stop was already
+ * reported as a SysCallStopEvent and this event should be ignored. Either way,
+ * resuming the tracee with `PTRACE_SYSCALL` results in a syscall-exit stop.
+ *
+ * Upon receiving this event, the tracer must continue the execution of the
+ * tracee via Tracee::continue_exec(). Otherwise, it will remain in the
+ * seccomp-stop state until it is detached or killed.
+ *
+ * \sa The `ptrace()` manpage for details on `PTRACE_EVENT_SECCOMP` stops
+ */
+struct SecCompStopEvent
+{
+    //! Tracee
+    pid_t tid;
+    //! Register values at the time of the seccomp-stop
+    ArchRegs regs;
+};
+
 /*!
  * \brief Event emitted when a signal is about to be delivered to a tracee
  *
@@ -405,6 +438,7 @@ using ProcessEvent = std::variant<
     ProcessExitEvent,
     ProcessDeathEvent,
     SysCallStopEvent,
+    SecCompStopEvent,
     SignalDeliveryStopEvent,
     GroupStopEvent,
     InterruptStopEvent,
@@ -414,5 +448,8 @@ using ProcessEvent = std::variant<
 >;
 
 oc::result<ProcessEvent> next_event(pid_t pid_spec) noexcept;
+oc::result<size_t> next_ready_events(pid_t pid_spec,
+                                     std::deque<ProcessEvent> &events,
+                                     size_t max_events);
 
 }
@@ -0,0 +1,122 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <cstdint>
+#include <cstdio>
+
+#include <unistd.h>
+
+#include "mbcommon/common.h"
+
+#include "mbsystrace/hooks.h"
+
+
+namespace mb::systrace
+{
+
+/*!
+ * \brief Aggregated statistics for a single syscall
+ */
+struct SysCallSummary
+{
+    //! Syscall name
+    std::string name;
+    //! Number of calls
+    uint64_t calls;
+    //! Number of calls that returned an error
+    uint64_t errors;
+    //! Cumulative time spent in the syscall
+    std::chrono::nanoseconds total;
+    //! Median latency (only set in SysCallStats::summary())
+    std::chrono::nanoseconds p50;
+    //! 90th percentile latency (only set in SysCallStats::summary())
+    std::chrono::nanoseconds p90;
+    //! 99th percentile latency (only set in SysCallStats::summary())
+    std::chrono::nanoseconds p99;
+    //! Maximum latency (only set in SysCallStats::summary())
+    std::chrono::nanoseconds max;
+};
+
+class MB_EXPORT SysCallStats final
+{
+public:
+    SysCallStats();
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(SysCallStats)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(SysCallStats)
+
+    Hooks wrap(Hooks hooks);
+
+    void reset();
+
+    std::vector<SysCallSummary> summary() const;
+    std::map<pid_t, std::vector<SysCallSummary>> per_tracee() const;
+
+    void print_summary(FILE *fp) const;
+    void print_per_tracee(FILE *fp) const;
+    std::string to_json() const;
+
+private:
+    /*! \cond INTERNAL */
+    class Histogram
+    {
+    public:
+        void add(uint64_t value);
+        uint64_t percentile(double fraction) const;
+        uint64_t max() const;
+
+    private:
+        std::vector<uint64_t> m_buckets;
+        uint64_t m_count = 0;
+        uint64_t m_max = 0;
+    };
+
+    struct Counters
+    {
+        uint64_t calls = 0;
+        uint64_t errors = 0;
+        uint64_t total_ns = 0;
+    };
+
+    struct SysCallData
+    {
+        Counters counters;
+        Histogram latencies;
+    };
+
+    using Clock = std::chrono::steady_clock;
+
+    std::map<std::string, SysCallData, std::less<>> m_syscalls;
+    std::map<pid_t, std::map<std::string, Counters, std::less<>>> m_tracees;
+    std::unordered_map<pid_t, Clock::time_point> m_pending;
+
+    void on_entry(pid_t tid);
+    void on_exit(pid_t tid, const SysCallExitInfo &info);
+    /*! \endcond */
+};
+
+}
@@ -46,6 +46,8 @@ enum class SeizeFlag
     TraceChildren = 1 << 0,
     //! Set `PTRACE_O_EXITKILL` if supported
     TryKillOnExit = 1 << 1,
+    //! Report `SECCOMP_RET_TRACE` seccomp filter results
+    TraceSecComp = 1 << 2,
 };
 MB_DECLARE_FLAGS(SeizeFlags, SeizeFlag)
 MB_DECLARE_OPERATORS_FOR_FLAGS(SeizeFlags)
@@ -75,6 +77,8 @@ enum class TraceeState
     ExecveStop,
     //! Exit stop
     ExitStop,
+    //! Seccomp stop for a syscall whose syscall-entry stop was already reported
+    SecCompStop,
 };
 
 //! Execution context of tracee
@@ -116,6 +120,9 @@ public:
     ExecMode exec_mode() const;
     void set_exec_mode(ExecMode mode);
 
+    bool syscall_filtered() const;
+    void set_syscall_filtered(bool filtered);
+
     ArchRegs regs() const;
     void set_regs(ArchRegs regs);
 
@@ -167,9 +174,16 @@ private:
     //! Whether the tracee is executing in user space or kernel space
     ExecMode m_exec_mode;
 
+    //! Whether a seccomp filter selects the syscalls that the tracee stops at
+    bool m_syscall_filtered;
+
     //! Registers prior to execution of syscall-entry/exit hooks
     ArchRegs m_regs;
 
+    //! Whether m_regs has been modified and needs to be written back before
+    //! the tracee is resumed
+    bool m_regs_dirty;
+
     //! Syscall injection status
     SysCallStatus m_sc_status;
 
@@ -195,6 +209,8 @@ private:
 
     oc::result<void> continue_exec_raw(int signal);
 
+    oc::result<void> flush_regs();
+
     // Asynchronous syscall injection
 
     oc::result<SysCallRet> inject_syscall_async_end();
@@ -19,13 +19,18 @@
 
 #pragma once
 
+#include <chrono>
+#include <deque>
 #include <functional>
 #include <memory>
 #include <optional>
+#include <string>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
 
+#include <cstdint>
+
 #include <unistd.h>
 
 #include "mbcommon/common.h"
@@ -47,6 +52,21 @@ enum class Flag
 MB_DECLARE_FLAGS(Flags, Flag)
 MB_DECLARE_OPERATORS_FOR_FLAGS(Flags)
 
+//! Counters for measuring the overhead of the Tracer event loop
+struct TracerStats
+{
+    //! Number of events dispatched
+    uint64_t events = 0;
+    //! Number of batches of events collected from the kernel
+    uint64_t batches = 0;
+    //! Largest number of events collected in a single batch
+    uint64_t max_batch_size = 0;
+    //! Time spent collecting pending events without blocking
+    std::chrono::nanoseconds collect_time{};
+    //! Time spent dispatching events, including the time spent in hooks
+    std::chrono::nanoseconds dispatch_time{};
+};
+
 class Tracee;
 
 class MB_EXPORT Tracer final
@@ -60,22 +80,38 @@ public:
 
     oc::result<void> execute(const Hooks &hooks);
     oc::result<void> execute(const Hooks &hooks, int pid_spec);
+    oc::result<bool> execute_pending(const Hooks &hooks);
     void stop_after_hook() noexcept;
 
+    const TracerStats & stats() const noexcept;
+    void reset_stats() noexcept;
+
     oc::result<Tracee *> fork(std::function<void()> child, Flags flags = {});
+    oc::result<Tracee *> fork(std::function<void()> child, Flags flags,
+                              const std::vector<std::string> &syscalls);
     oc::result<std::vector<Tracee *>> attach(pid_t tid, Flags flags = {});
 
 private:
     std::unordered_map<pid_t, std::unique_ptr<Tracee>> m_tracees;
     std::unordered_set<pid_t> m_owned_tgids;
+    std::unordered_set<pid_t> m_filtered_tids;
     std::optional<detail::ProcessEvent> m_requeued_event;
+    std::deque<detail::ProcessEvent> m_events;
+    TracerStats m_stats;
     bool m_should_stop;
 
+    oc::result<Tracee *> fork_impl(std::function<void()> child, Flags flags,
+                                   const std::vector<std::string> *syscalls);
+
     oc::result<Tracee *> add_child(pid_t tgid, pid_t tid);
     bool remove_child(pid_t tid);
 
+    oc::result<std::optional<detail::ProcessEvent>>
+    take_event(int pid_spec, bool block);
     oc::result<bool>
     dispatch_event(const Hooks &hooks, const detail::ProcessEvent &event);
+    oc::result<bool>
+    dispatch_timed(const Hooks &hooks, const detail::ProcessEvent &event);
 
     void
     execute_new_tracee_hook(const Hooks &hooks, Tracee *tracee);
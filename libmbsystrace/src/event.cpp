@@ -51,45 +51,16 @@ static oc::result<ProcessEvent> retry_or_failure(std::error_code ec)
 }
 
 /*!
- * \brief Wait for next event from child processes and tracees
+ * \brief Decode a `waitpid()` status into an event
  *
- * This function will wait for the next event using the waitpid/ptrace APIs.
+ * \param pid PID returned by `waitpid()`
+ * \param status Status returned by `waitpid()`
  *
- * The caller must respond appropriately to the events as described in each
- * event's documentation.
- *
- * \note This function will only wait on children of the calling thread. Thus,
- *       multiple Tracer instances can be used as long as they're running on
- *       different threads.
- *
- * \param pid_spec Same meaning as the \p pid parameter to waitpid().
- *   * If `< -1`, wait for any child process or tracee whose process group ID is
- *     `|pid|`
- *   * If `== -1`, wait for any child process or tracee
- *   * If `== 0`, wait for any child process or tracee whose process group ID
- *     matches that of the calling process
- *   * If `> 0`, wait for the child process or tracee whose process ID is equal
- *     to \p pid_spec
- *
- * \return Returns a ProcessEvent if an event is emitted and information about
- *         the event is successfully queried. Otherwise, returns an error code.
- *         Note that `EINTR` and `ECHILD` are not considered errors and an
- *         appropriate event will be returned.
+ * \return Returns a ProcessEvent if information about the event is successfully
+ *         queried. Otherwise, returns an error code.
  */
-oc::result<ProcessEvent> next_event(pid_t pid_spec) noexcept
+static oc::result<ProcessEvent> decode_event(pid_t pid, int status) noexcept
 {
-    int status;
-    pid_t pid = waitpid(pid_spec, &status, __WALL | __WNOTHREAD);
-    if (pid == -1) {
-        if (errno == EINTR) {
-            return RetryEvent{};
-        } else if (errno == ECHILD) {
-            return NoChildrenEvent{};
-        } else {
-            return ec_from_errno();
-        }
-    }
-
     if (WIFEXITED(status)) {
         return ProcessExitEvent{pid, status, WEXITSTATUS(status)};
     } else if (WIFSIGNALED(status)) {
@@ -128,6 +99,15 @@ oc::result<ProcessEvent> next_event(pid_t pid_spec) noexcept
                 return ExitStopEvent{pid, static_cast<int>(code)};
             }
 
+            case PTRACE_EVENT_SECCOMP: {
+                auto regs = read_regs(pid);
+                if (!regs) {
+                    return retry_or_failure(regs.error());
+                }
+
+                return SecCompStopEvent{pid, std::move(regs.value())};
+            }
+
             case PTRACE_EVENT_STOP: {
                 if (signal == SIGSTOP || signal == SIGTSTP
                         || signal == SIGTTIN || signal == SIGTTOU) {
@@ -162,4 +142,101 @@ oc::result<ProcessEvent> next_event(pid_t pid_spec) noexcept
     }
 }
 
+/*!
+ * \brief Wait for next event from child processes and tracees
+ *
+ * This function will wait for the next event using the waitpid/ptrace APIs.
+ *
+ * The caller must respond appropriately to the events as described in each
+ * event's documentation.
+ *
+ * \note This function will only wait on children of the calling thread. Thus,
+ *       multiple Tracer instances can be used as long as they're running on
+ *       different threads.
+ *
+ * \param pid_spec Same meaning as the \p pid parameter to waitpid().
+ *   * If `< -1`, wait for any child process or tracee whose process group ID is
+ *     `|pid|`
+ *   * If `== -1`, wait for any child process or tracee
+ *   * If `== 0`, wait for any child process or tracee whose process group ID
+ *     matches that of the calling process
+ *   * If `> 0`, wait for the child process or tracee whose process ID is equal
+ *     to \p pid_spec
+ *
+ * \return Returns a ProcessEvent if an event is emitted and information about
+ *         the event is successfully queried. Otherwise, returns an error code.
+ *         Note that `EINTR` and `ECHILD` are not considered errors and an
+ *         appropriate event will be returned.
+ */
+oc::result<ProcessEvent> next_event(pid_t pid_spec) noexcept
+{
+    int status;
+    pid_t pid = waitpid(pid_spec, &status, __WALL | __WNOTHREAD);
+    if (pid == -1) {
+        if (errno == EINTR) {
+            return RetryEvent{};
+        } else if (errno == ECHILD) {
+            return NoChildrenEvent{};
+        } else {
+            return ec_from_errno();
+        }
+    }
+
+    return decode_event(pid, status);
+}
+
+/*!
+ * \brief Collect events that are already pending without blocking
+ *
+ * This function calls `waitpid()` with `WNOHANG` until no more events are
+ * pending or \p max_events events have been collected. Each event is decoded in
+ * the same way as next_event(), except that RetryEvent and NoChildrenEvent are
+ * never emitted. If a process dies before its event can be decoded, the event is
+ * dropped and the death will be reported by a subsequent call.
+ *
+ * Collecting all pending events at once, instead of calling next_event() after
+ * handling each event, avoids a blocking `waitpid()` call per event and
+ * prevents a busy tracee from starving tracees that are reported later by
+ * `waitpid()`.
+ *
+ * \param pid_spec Same meaning as the \p pid_spec parameter to next_event()
+ * \param events Queue to append the events to
+ * \param max_events Maximum number of events to collect
+ *
+ * \return Returns the number of events appended to \p events. If an error
+ *         occurs, the events collected before the error are kept and the error
+ *         code is returned.
+ */
+oc::result<size_t> next_ready_events(pid_t pid_spec,
+                                     std::deque<ProcessEvent> &events,
+                                     size_t max_events)
+{
+    size_t count = 0;
+
+    while (count < max_events) {
+        int status;
+        pid_t pid = waitpid(pid_spec, &status, __WALL | __WNOTHREAD | WNOHANG);
+        if (pid == 0) {
+            break;
+        } else if (pid == -1) {
+            if (errno == EINTR || errno == ECHILD) {
+                break;
+            } else {
+                return ec_from_errno();
+            }
+        }
+
+        OUTCOME_TRY(event, decode_event(pid, status));
+
+        if (std::holds_alternative<RetryEvent>(event)) {
+            continue;
+        }
+
+        events.push_back(std::move(event));
+        ++count;
+    }
+
+    return count;
+}
+
 }
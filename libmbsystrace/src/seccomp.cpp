@@ -0,0 +1,253 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbsystrace/seccomp_p.h"
+
+#include <map>
+
+#include <cassert>
+#include <cstddef>
+#include <cstdio>
+
+#include <linux/audit.h>
+#include <linux/seccomp.h>
+#include <sys/prctl.h>
+#include <sys/utsname.h>
+
+#include "mbsystrace/arch.h"
+#include "mbsystrace/syscalls.h"
+
+
+namespace mb::systrace::detail
+{
+
+namespace
+{
+
+struct AbiInfo
+{
+    ArchAbi abi;
+    uint32_t audit_arch;
+};
+
+}
+
+// x32 shares AUDIT_ARCH_X86_64 with the native ABI. Its syscall numbers include
+// __X32_SYSCALL_BIT, so they never collide with x86_64 syscall numbers.
+#if defined(__x86_64__)
+const AbiInfo g_abis[] = {
+    {ArchAbi::X86_64, AUDIT_ARCH_X86_64},
+    {ArchAbi::X86_32, AUDIT_ARCH_I386},
+    {ArchAbi::X32, AUDIT_ARCH_X86_64},
+};
+#elif defined(__i386__)
+const AbiInfo g_abis[] = {
+    {ArchAbi::X86_32, AUDIT_ARCH_I386},
+};
+#elif defined(__aarch64__)
+const AbiInfo g_abis[] = {
+    {ArchAbi::Aarch64, AUDIT_ARCH_AARCH64},
+    {ArchAbi::Eabi, AUDIT_ARCH_ARM},
+};
+#elif defined(__arm__)
+const AbiInfo g_abis[] = {
+    {ArchAbi::Eabi, AUDIT_ARCH_ARM},
+};
+#else
+#  error Unsupported architecture
+#endif
+
+static constexpr sock_filter bpf_stmt(uint16_t code, uint32_t k)
+{
+    return BPF_STMT(code, k);
+}
+
+static constexpr sock_filter bpf_jump(uint16_t code, uint32_t k,
+                                      uint8_t jt, uint8_t jf)
+{
+    return BPF_JUMP(code, k, jt, jf);
+}
+
+/*!
+ * \brief Build seccomp-BPF program that traces a set of syscalls
+ *
+ * The program returns `SECCOMP_RET_TRACE` for the syscalls named in
+ * \p syscalls and `SECCOMP_RET_ALLOW` for everything else. Each name is
+ * resolved for every ABI supported by the architecture. Syscalls made with an
+ * unrecognized ABI are always traced.
+ *
+ * The program has the following layout. Conditional jumps only ever skip a
+ * single instruction so that the 8-bit jump offsets cannot overflow, regardless
+ * of how many syscalls are listed.
+ *
+ * \code{.unparsed}
+ *     ld [arch]
+ *     jeq <audit arch 1>, 0, 1    ; for each audit arch
+ *     ja  <section 1>
+ *     ...
+ *     ret TRACE
+ * section 1:
+ *     ld [nr]
+ *     jeq <nr 1>, 0, 1            ; for each syscall
+ *     ret TRACE
+ *     ...
+ *     ret ALLOW
+ * ...
+ * \endcode
+ *
+ * \param syscalls Syscall names. Names that are not valid for a specific ABI
+ *                 are ignored for that ABI.
+ *
+ * \return The BPF program if successful. Otherwise, returns
+ *   * `std::errc::invalid_argument` if a name is not valid for any ABI
+ *   * `std::errc::argument_list_too_long` if the program would exceed the
+ *     kernel's instruction limit
+ */
+oc::result<std::vector<sock_filter>>
+build_syscall_filter(const std::vector<std::string> &syscalls)
+{
+    // Ordered so that the generated program is deterministic
+    std::map<uint32_t, std::vector<uint32_t>> sections;
+
+    for (auto const &abi_info : g_abis) {
+        // Ensure that each audit arch gets a section even if no syscalls match
+        sections[abi_info.audit_arch];
+    }
+
+    for (auto const &name : syscalls) {
+        bool found = false;
+
+        for (auto const &abi_info : g_abis) {
+            if (auto sc = SysCall(name.c_str(), abi_info.abi)) {
+                sections[abi_info.audit_arch].push_back(
+                        static_cast<uint32_t>(sc.num()));
+                found = true;
+            }
+        }
+
+        if (!found) {
+            return std::errc::invalid_argument;
+        }
+    }
+
+    size_t size = 1 + sections.size() * 2 + 1;
+    for (auto const &[_, nums] : sections) {
+        size += 1 + nums.size() * 2 + 1;
+    }
+
+    if (size > BPF_MAXINSNS) {
+        return std::errc::argument_list_too_long;
+    }
+
+    std::vector<sock_filter> filter;
+    filter.reserve(size);
+
+    filter.push_back(bpf_stmt(BPF_LD | BPF_W | BPF_ABS,
+                              offsetof(seccomp_data, arch)));
+
+    // Offset of the first section relative to the instruction after the
+    // first `ja`
+    size_t section_offset = sections.size() * 2 - 1;
+
+    for (auto const &[audit_arch, nums] : sections) {
+        filter.push_back(bpf_jump(BPF_JMP | BPF_JEQ | BPF_K, audit_arch, 0, 1));
+        filter.push_back(bpf_stmt(BPF_JMP | BPF_JA,
+                                  static_cast<uint32_t>(section_offset)));
+
+        // The next `ja` is two instructions further, but its target is
+        // further by the size of this section
+        section_offset += 1 + nums.size() * 2 + 1 - 2;
+    }
+
+    filter.push_back(bpf_stmt(BPF_RET | BPF_K, SECCOMP_RET_TRACE));
+
+    for (auto const &[_, nums] : sections) {
+        filter.push_back(bpf_stmt(BPF_LD | BPF_W | BPF_ABS,
+                                  offsetof(seccomp_data, nr)));
+
+        for (auto nr : nums) {
+            filter.push_back(bpf_jump(BPF_JMP | BPF_JEQ | BPF_K, nr, 0, 1));
+            filter.push_back(bpf_stmt(BPF_RET | BPF_K, SECCOMP_RET_TRACE));
+        }
+
+        filter.push_back(bpf_stmt(BPF_RET | BPF_K, SECCOMP_RET_ALLOW));
+    }
+
+    assert(filter.size() == size);
+
+    return filter;
+}
+
+/*!
+ * \brief Check whether seccomp stops are reported in the order that the Tracer
+ *        expects
+ *
+ * Prior to kernel 4.8, the seccomp stop occurs before the syscall-entry stop
+ * and changes to the syscall number made by the tracer during the seccomp stop
+ * are not rechecked by the filter. The Tracer relies on the seccomp stop
+ * replacing the syscall-entry stop, so older kernels are not supported.
+ *
+ * \return Whether the running kernel is 4.8 or newer
+ */
+bool seccomp_trace_supported() noexcept
+{
+    utsname uts;
+    unsigned int major;
+    unsigned int minor;
+
+    if (uname(&uts) != 0
+            || sscanf(uts.release, "%u.%u", &major, &minor) != 2) {
+        return false;
+    }
+
+    return major > 4 || (major == 4 && minor >= 8);
+}
+
+/*!
+ * \brief Install seccomp-BPF program in the calling thread
+ *
+ * If the calling thread does not have `CAP_SYS_ADMIN`, then `no_new_privs` will
+ * be set before installing the filter. This is required by the kernel and
+ * prevents setuid/setgid binaries from gaining privileges when executed.
+ *
+ * \note This function is async-signal-safe and can be called in the child
+ *       process after `fork()`.
+ *
+ * \param filter BPF program returned by build_syscall_filter()
+ *
+ * \return Whether the filter was successfully installed
+ */
+bool install_syscall_filter(const std::vector<sock_filter> &filter) noexcept
+{
+    sock_fprog prog{
+        static_cast<unsigned short>(filter.size()),
+        const_cast<sock_filter *>(filter.data()),
+    };
+
+    if (prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, &prog) == 0) {
+        return true;
+    } else if (errno != EACCES) {
+        return false;
+    }
+
+    return prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0) == 0
+            && prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, &prog) == 0;
+}
+
+}
@@ -0,0 +1,528 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbsystrace/stats.h"
+
+#include <algorithm>
+
+#include <cinttypes>
+
+#include "mbcommon/string.h"
+
+#include "mbsystrace/tracee.h"
+
+
+namespace mb::systrace
+{
+
+// Values below 2^SUB_BITS get one bucket each. Larger values are split into
+// power-of-two ranges that are each divided into 2^SUB_BITS linear buckets, so
+// the relative error of a reported percentile is at most 1/16.
+static constexpr unsigned int SUB_BITS = 4;
+static constexpr uint64_t SUB_BUCKETS = 1 << SUB_BITS;
+
+static size_t bucket_index(uint64_t value)
+{
+    if (value < SUB_BUCKETS) {
+        return static_cast<size_t>(value);
+    }
+
+    unsigned int exp = 63 - static_cast<unsigned int>(__builtin_clzll(value));
+    uint64_t sub = (value >> (exp - SUB_BITS)) & (SUB_BUCKETS - 1);
+
+    return static_cast<size_t>((exp - SUB_BITS + 1) * SUB_BUCKETS + sub);
+}
+
+static uint64_t bucket_upper_bound(size_t index)
+{
+    if (index < SUB_BUCKETS) {
+        return index;
+    }
+
+    unsigned int exp = static_cast<unsigned int>(index / SUB_BUCKETS)
+            + SUB_BITS - 1;
+    uint64_t sub = index % SUB_BUCKETS;
+
+    return ((SUB_BUCKETS + sub + 1) << (exp - SUB_BITS)) - 1;
+}
+
+static bool is_error(SysCallRet ret)
+{
+    // Same range as the kernel's IS_ERR_VALUE()
+    return ret < 0 && ret >= -4095;
+}
+
+static double to_seconds(std::chrono::nanoseconds ns)
+{
+    return std::chrono::duration<double>(ns).count();
+}
+
+static int64_t to_micros(std::chrono::nanoseconds ns)
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(ns).count();
+}
+
+/*! \cond INTERNAL */
+
+void SysCallStats::Histogram::add(uint64_t value)
+{
+    auto index = bucket_index(value);
+
+    if (index >= m_buckets.size()) {
+        m_buckets.resize(index + 1);
+    }
+
+    ++m_buckets[index];
+    ++m_count;
+    m_max = std::max(m_max, value);
+}
+
+uint64_t SysCallStats::Histogram::percentile(double fraction) const
+{
+    if (m_count == 0) {
+        return 0;
+    }
+
+    auto rank = std::max<uint64_t>(
+            1, static_cast<uint64_t>(fraction * static_cast<double>(m_count)
+                    + 0.5));
+    uint64_t seen = 0;
+
+    for (size_t i = 0; i < m_buckets.size(); ++i) {
+        seen += m_buckets[i];
+        if (seen >= rank) {
+            return std::min(bucket_upper_bound(i), m_max);
+        }
+    }
+
+    return m_max;
+}
+
+uint64_t SysCallStats::Histogram::max() const
+{
+    return m_max;
+}
+
+/*! \endcond */
+
+/*!
+ * \class SysCallStats
+ *
+ * \brief Syscall statistics collector
+ *
+ * This collects per-syscall call counts, error counts, and latencies for all
+ * tracees, similar to `strace -c`. It is attached to a Tracer by wrapping the
+ * hooks passed to Tracer::execute().
+ *
+ * \code{.cpp}
+ * SysCallStats stats;
+ * Hooks hooks = stats.wrap({});
+ *
+ * // Create tracees
+ *
+ * if (auto r = tracer.execute(hooks); !r) {
+ *     ...
+ * }
+ *
+ * stats.print_summary(stderr);
+ * \endcode
+ *
+ * Latencies are measured by the tracer from the syscall-entry stop to the
+ * syscall-exit stop, so they include the time spent in the hooks and the
+ * overhead of the ptrace stops. Syscalls injected by the hooks are not counted.
+ * Percentiles are computed from a log-linear histogram and have a relative
+ * error of at most 1/16.
+ */
+
+/*!
+ * \brief Construct empty statistics collector
+ */
+SysCallStats::SysCallStats() = default;
+
+/*!
+ * \brief Wrap hooks to collect statistics
+ *
+ * The returned hooks record statistics and then call the corresponding hook in
+ * \p hooks, if set. The actions returned by \p hooks are passed through
+ * unchanged.
+ *
+ * \note The returned hooks reference this object, so it must outlive them.
+ *
+ * \param hooks Hooks to wrap
+ *
+ * \return Wrapped hooks
+ */
+Hooks SysCallStats::wrap(Hooks hooks)
+{
+    auto syscall_entry = std::move(hooks.syscall_entry);
+    auto syscall_exit = std::move(hooks.syscall_exit);
+    auto tracee_exit = std::move(hooks.tracee_exit);
+    auto tracee_death = std::move(hooks.tracee_death);
+
+    hooks.syscall_entry = [this, syscall_entry](
+            Tracee *tracee, const SysCallEntryInfo &info)
+            -> SysCallEntryAction {
+        if (info.status == SysCallStatus::Normal) {
+            auto name = info.syscall.name();
+            ++m_syscalls[name].counters.calls;
+            ++m_tracees[tracee->tid][name].calls;
+        }
+        if (info.status != SysCallStatus::Injected) {
+            on_entry(tracee->tid);
+        }
+
+        return syscall_entry
+                ? syscall_entry(tracee, info)
+                : action::Default{};
+    };
+    hooks.syscall_exit = [this, syscall_exit](
+            Tracee *tracee, const SysCallExitInfo &info)
+            -> SysCallExitAction {
+        if (info.status != SysCallStatus::Injected) {
+            on_exit(tracee->tid, info);
+        }
+
+        return syscall_exit
+                ? syscall_exit(tracee, info)
+                : action::Default{};
+    };
+    hooks.tracee_exit = [this, tracee_exit](pid_t tid, int exit_code)
+            -> TraceeExitAction {
+        m_pending.erase(tid);
+
+        return tracee_exit
+                ? tracee_exit(tid, exit_code)
+                : action::Default{};
+    };
+    hooks.tracee_death = [this, tracee_death](pid_t tid, int exit_signal)
+            -> TraceeDeathAction {
+        m_pending.erase(tid);
+
+        return tracee_death
+                ? tracee_death(tid, exit_signal)
+                : action::Default{};
+    };
+
+    return hooks;
+}
+
+/*!
+ * \brief Discard all collected statistics
+ */
+void SysCallStats::reset()
+{
+    m_syscalls.clear();
+    m_tracees.clear();
+    m_pending.clear();
+}
+
+void SysCallStats::on_entry(pid_t tid)
+{
+    m_pending[tid] = Clock::now();
+}
+
+void SysCallStats::on_exit(pid_t tid, const SysCallExitInfo &info)
+{
+    auto it = m_pending.find(tid);
+    if (it == m_pending.end()) {
+        // Tracee was attached in the middle of a syscall
+        return;
+    }
+
+    auto latency = static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    Clock::now() - it->second).count());
+    m_pending.erase(it);
+
+    bool error = is_error(info.ret);
+    auto name = info.syscall.name();
+
+    auto &data = m_syscalls[name];
+    data.counters.total_ns += latency;
+    data.counters.errors += error;
+    data.latencies.add(latency);
+
+    auto &counters = m_tracees[tid][name];
+    counters.total_ns += latency;
+    counters.errors += error;
+}
+
+/*!
+ * \brief Get statistics for each syscall across all tracees
+ *
+ * \return List of syscall statistics sorted by descending cumulative time
+ */
+std::vector<SysCallSummary> SysCallStats::summary() const
+{
+    std::vector<SysCallSummary> result;
+    result.reserve(m_syscalls.size());
+
+    for (auto const &[name, data] : m_syscalls) {
+        auto &h = data.latencies;
+
+        result.push_back({
+            name,
+            data.counters.calls,
+            data.counters.errors,
+            std::chrono::nanoseconds(data.counters.total_ns),
+            std::chrono::nanoseconds(h.percentile(0.5)),
+            std::chrono::nanoseconds(h.percentile(0.9)),
+            std::chrono::nanoseconds(h.percentile(0.99)),
+            std::chrono::nanoseconds(h.max()),
+        });
+    }
+
+    std::stable_sort(result.begin(), result.end(), [](auto &a, auto &b) {
+        return a.total > b.total;
+    });
+
+    return result;
+}
+
+/*!
+ * \brief Get statistics for each syscall for each tracee
+ *
+ * Percentile and maximum latencies are not tracked per tracee and are set to
+ * zero.
+ *
+ * \return Map of TIDs to lists of syscall statistics sorted by descending
+ *         cumulative time
+ */
+std::map<pid_t, std::vector<SysCallSummary>> SysCallStats::per_tracee() const
+{
+    std::map<pid_t, std::vector<SysCallSummary>> result;
+
+    for (auto const &[tid, syscalls] : m_tracees) {
+        auto &list = result[tid];
+        list.reserve(syscalls.size());
+
+        for (auto const &[name, counters] : syscalls) {
+            list.push_back({
+                name,
+                counters.calls,
+                counters.errors,
+                std::chrono::nanoseconds(counters.total_ns),
+                {},
+                {},
+                {},
+                {},
+            });
+        }
+
+        std::stable_sort(list.begin(), list.end(), [](auto &a, auto &b) {
+            return a.total > b.total;
+        });
+    }
+
+    return result;
+}
+
+static void print_table(FILE *fp, const std::vector<SysCallSummary> &list,
+                        bool percentiles)
+{
+    static constexpr char separator[] =
+            "------ ----------- ----------- --------- --------- ";
+    static constexpr char separator_percentiles[] =
+            "----------- ----------- ";
+
+    std::chrono::nanoseconds total_time{};
+    uint64_t total_calls = 0;
+    uint64_t total_errors = 0;
+
+    for (auto const &item : list) {
+        total_time += item.total;
+        total_calls += item.calls;
+        total_errors += item.errors;
+    }
+
+    fprintf(fp, "%6s %11s %11s %9s %9s ",
+            "% time", "seconds", "usecs/call", "calls", "errors");
+    if (percentiles) {
+        fprintf(fp, "%11s %11s ", "p50 usecs", "p99 usecs");
+    }
+    fprintf(fp, "syscall\n");
+
+    fprintf(fp, "%s%s----------------\n",
+            separator, percentiles ? separator_percentiles : "");
+
+    for (auto const &item : list) {
+        double percent = total_time.count() > 0
+                ? 100.0 * static_cast<double>(item.total.count())
+                        / static_cast<double>(total_time.count())
+                : 0.0;
+        auto per_call = item.calls > 0
+                ? to_micros(item.total) / static_cast<int64_t>(item.calls)
+                : 0;
+
+        fprintf(fp, "%6.2f %11.6f %11" PRId64 " %9" PRIu64 " ",
+                percent, to_seconds(item.total), per_call, item.calls);
+        if (item.errors > 0) {
+            fprintf(fp, "%9" PRIu64 " ", item.errors);
+        } else {
+            fprintf(fp, "%9s ", "");
+        }
+        if (percentiles) {
+            fprintf(fp, "%11" PRId64 " %11" PRId64 " ",
+                    to_micros(item.p50), to_micros(item.p99));
+        }
+        fprintf(fp, "%s\n", item.name.c_str());
+    }
+
+    fprintf(fp, "%s%s----------------\n",
+            separator, percentiles ? separator_percentiles : "");
+
+    fprintf(fp, "%6.2f %11.6f %11s %9" PRIu64 " ",
+            100.0, to_seconds(total_time), "", total_calls);
+    if (total_errors > 0) {
+        fprintf(fp, "%9" PRIu64 " ", total_errors);
+    } else {
+        fprintf(fp, "%9s ", "");
+    }
+    if (percentiles) {
+        fprintf(fp, "%11s %11s ", "", "");
+    }
+    fprintf(fp, "total\n");
+}
+
+/*!
+ * \brief Print `strace -c`-style summary table
+ *
+ * \param fp Output stream
+ */
+void SysCallStats::print_summary(FILE *fp) const
+{
+    print_table(fp, summary(), true);
+}
+
+/*!
+ * \brief Print `strace -c`-style summary table for each tracee
+ *
+ * \param fp Output stream
+ */
+void SysCallStats::print_per_tracee(FILE *fp) const
+{
+    bool first = true;
+
+    for (auto const &[tid, list] : per_tracee()) {
+        fprintf(fp, "%s[%d]\n", first ? "" : "\n", tid);
+        print_table(fp, list, false);
+        first = false;
+    }
+}
+
+static void append_json_summary(std::string &out, const SysCallSummary &item,
+                                bool percentiles)
+{
+    // Syscall names only contain identifier characters, so they never need to
+    // be escaped
+    out += format(R"({"name":"%s","calls":%)" PRIu64 R"(,"errors":%)" PRIu64
+                  R"(,"total_ns":%)" PRId64,
+                  item.name.c_str(), item.calls, item.errors,
+                  static_cast<int64_t>(item.total.count()));
+
+    if (percentiles) {
+        out += format(R"(,"p50_ns":%)" PRId64 R"(,"p90_ns":%)" PRId64
+                      R"(,"p99_ns":%)" PRId64 R"(,"max_ns":%)" PRId64,
+                      static_cast<int64_t>(item.p50.count()),
+                      static_cast<int64_t>(item.p90.count()),
+                      static_cast<int64_t>(item.p99.count()),
+                      static_cast<int64_t>(item.max.count()));
+    }
+
+    out += '}';
+}
+
+/*!
+ * \brief Export statistics as JSON
+ *
+ * The document has the following structure. All times are in nanoseconds.
+ *
+ * \code{.json}
+ * {
+ *     "syscalls": [
+ *         {
+ *             "name": "openat",
+ *             "calls": 10,
+ *             "errors": 2,
+ *             "total_ns": 123456,
+ *             "p50_ns": 9000,
+ *             "p90_ns": 20000,
+ *             "p99_ns": 31000,
+ *             "max_ns": 31337
+ *         }
+ *     ],
+ *     "tracees": [
+ *         {
+ *             "tid": 1234,
+ *             "syscalls": [
+ *                 {
+ *                     "name": "openat",
+ *                     "calls": 10,
+ *                     "errors": 2,
+ *                     "total_ns": 123456
+ *                 }
+ *             ]
+ *         }
+ *     ]
+ * }
+ * \endcode
+ *
+ * \return JSON document
+ */
+std::string SysCallStats::to_json() const
+{
+    std::string out = R"({"syscalls":[)";
+
+    bool first = true;
+    for (auto const &item : summary()) {
+        if (!first) {
+            out += ',';
+        }
+        append_json_summary(out, item, true);
+        first = false;
+    }
+
+    out += R"(],"tracees":[)";
+
+    first = true;
+    for (auto const &[tid, list] : per_tracee()) {
+        if (!first) {
+            out += ',';
+        }
+        out += format(R"({"tid":%d,"syscalls":[)", tid);
+
+        bool first_item = true;
+        for (auto const &item : list) {
+            if (!first_item) {
+                out += ',';
+            }
+            append_json_summary(out, item, false);
+            first_item = false;
+        }
+
+        out += "]}";
+        first = false;
+    }
+
+    out += "]}";
+
+    return out;
+}
+
+}
@@ -66,6 +66,8 @@ Tracee::Tracee(Tracer *tracer, pid_t tgid, pid_t tid)
     , m_tracer(tracer)
     , m_state(TraceeState::Detached)
     , m_exec_mode(ExecMode::User)
+    , m_syscall_filtered(false)
+    , m_regs_dirty(false)
     , m_sc_status(SysCallStatus::Normal)
     , m_inj_exec_mode()
     , m_suppress_orig_num()
@@ -151,6 +153,11 @@ oc::result<void> Tracee::signal_process(int signal)
  *   * exec_mode() will be toggled appropriately if tracee was in a syscall stop
  *   * state() will be updated to TraceeState::Executing
  *
+ * If syscall_filtered() is true, the tracee is resumed with `PTRACE_CONT`
+ * instead of `PTRACE_SYSCALL` whenever it would return to user space, so that
+ * the next syscall stop only occurs for a syscall selected by the seccomp
+ * filter.
+ *
  * \param signal If zero, continue the execution of the tracee until the next
  *               syscall is reached (or another stop event occurs). If positive,
  *               inject the specified syscall.
@@ -195,7 +202,18 @@ oc::result<void> Tracee::continue_exec_raw(int signal)
             break;
     }
 
-    if (ptrace(PTRACE_SYSCALL, tid, nullptr, signal) != 0) {
+    // Syscall stops are needed for all syscalls unless the tracee has a
+    // seccomp filter. Even then, they're needed for the syscall-exit stop of
+    // the current syscall and for the syscall-entry stop of an injected
+    // syscall, which might not be selected by the filter.
+    bool trace_syscalls = !m_syscall_filtered
+            || new_exec_mode.value_or(m_exec_mode) == ExecMode::Kernel
+            || m_sc_status == SysCallStatus::Injected;
+
+    OUTCOME_TRYV(flush_regs());
+
+    if (ptrace(trace_syscalls ? PTRACE_SYSCALL : PTRACE_CONT,
+               tid, nullptr, signal) != 0) {
         return ec_from_errno();
     }
 
@@ -208,6 +226,28 @@ oc::result<void> Tracee::continue_exec_raw(int signal)
     return oc::success();
 }
 
+/*!
+ * \brief Write modified registers back to the tracee
+ *
+ * Syscall modifications only update the register cache. The registers are
+ * written once, right before the tracee leaves the ptrace stop, no matter how
+ * many modifications were made during the stop.
+ *
+ * \return Nothing if the registers are unmodified or are successfully written.
+ *         Otherwise, returns an appropriate error code.
+ */
+oc::result<void> Tracee::flush_regs()
+{
+    if (!m_regs_dirty) {
+        return oc::success();
+    }
+
+    OUTCOME_TRYV(write_regs(tid, m_regs));
+    m_regs_dirty = false;
+
+    return oc::success();
+}
+
 /*!
  * \brief Restart tracee without continuing execution
  *
@@ -269,6 +309,10 @@ oc::result<void> Tracee::interrupt()
  * If SeizeFlag::TryKillOnExit is specified, the tracee will be killed by the
  * kernel when the tracer process exits.
  *
+ * If SeizeFlag::TraceSecComp is specified, syscalls for which a seccomp filter
+ * returns `SECCOMP_RET_TRACE` will produce a ptrace stop. This is required for
+ * tracees with syscall_filtered() set.
+ *
  * \note SeizeFlag::TryKillOnExit requires kernel 3.8 to work. If running on a
  *       system with an older kernel, the flag is a no-op.
  *
@@ -296,6 +340,9 @@ oc::result<void> Tracee::seize(SeizeFlags flags)
                 | PTRACE_O_TRACEFORK
                 | PTRACE_O_TRACEVFORK;
     }
+    if (flags & SeizeFlag::TraceSecComp) {
+        options |= PTRACE_O_TRACESECCOMP;
+    }
 
     long ret = -1;
     errno = EINVAL;
@@ -365,6 +412,13 @@ oc::result<void> Tracee::detach()
         return std::errc::invalid_argument;
     }
 
+    // Pending register modifications are only possible in a ptrace stop. If
+    // the tracee is not in a ptrace stop, this fails with ESRCH, just like
+    // PTRACE_DETACH below.
+    if (auto r = flush_regs(); !r && r.error() != std::errc::no_such_process) {
+        return r.as_failure();
+    }
+
     if (ptrace(PTRACE_DETACH, tid, nullptr, nullptr) == 0) {
         m_state = TraceeState::Detached;
         return oc::success();
@@ -489,6 +543,34 @@ void Tracee::set_exec_mode(ExecMode mode)
     m_exec_mode = mode;
 }
 
+/*!
+ * \brief Whether the tracee only stops at syscalls selected by a seccomp filter
+ *
+ * \return Whether the tracee has a seccomp filter that returns
+ *         `SECCOMP_RET_TRACE` for the syscalls that should be traced
+ */
+bool Tracee::syscall_filtered() const
+{
+    return m_syscall_filtered;
+}
+
+/*!
+ * \brief Set whether the tracee only stops at syscalls selected by a seccomp
+ *        filter
+ *
+ * \note This should normally not be changed. The owning Tracer will set this
+ *       for tracees that it creates with a syscall filter and their children.
+ *
+ * \param filtered Whether the tracee has a seccomp filter that returns
+ *                 `SECCOMP_RET_TRACE` for the syscalls that should be traced.
+ *                 Setting this for a tracee without such a filter will cause
+ *                 syscall stops to be missed.
+ */
+void Tracee::set_syscall_filtered(bool filtered)
+{
+    m_syscall_filtered = filtered;
+}
+
 /*!
  * \brief State of registers during syscall-stop
  *
@@ -507,8 +589,9 @@ ArchRegs Tracee::regs() const
  *
  * \note This function does **not** change the tracees registers. It only
  *       updates the register cache used by other functions that actually modify
- *       the registers. This should not be called by anything other than the
- *       owning Tracer.
+ *       the registers. Any unwritten modifications to the previous cache are
+ *       discarded. This should not be called by anything other than the owning
+ *       Tracer.
  *
  * \pre state() must be TraceeState::PreSysCallStop or
  *      TraceeState::PostSysCallStop
@@ -518,6 +601,7 @@ ArchRegs Tracee::regs() const
 void Tracee::set_regs(ArchRegs regs)
 {
     m_regs = regs;
+    m_regs_dirty = false;
 }
 
 /*!
@@ -111,7 +111,7 @@ Tracee::inject_syscall(SysCallNum num, const SysCallArgs &args)
             OUTCOME_TRYV(proceed_until_syscall());
             // In syscall-exit state
             OUTCOME_TRY(regs, read_regs(tid));
-            m_regs = regs;
+            set_regs(regs);
             OUTCOME_TRY(ret, inject_syscall_entry_end(false));
             OUTCOME_TRYV(continue_exec_raw(0));
             OUTCOME_TRYV(proceed_until_syscall());
@@ -128,7 +128,7 @@ Tracee::inject_syscall(SysCallNum num, const SysCallArgs &args)
             OUTCOME_TRYV(proceed_until_syscall());
             // In syscall-exit state
             OUTCOME_TRY(regs, read_regs(tid));
-            m_regs = regs;
+            set_regs(regs);
             OUTCOME_TRY(ret, inject_syscall_exit_end());
             return ret;
         }
@@ -298,7 +298,10 @@ Tracee::inject_syscall_entry_end(bool will_repeat)
     m_inj_regs.set_ip(m_inj_regs.ip() - SYSCALL_OPSIZE);
     m_inj_regs.set_pending_syscall(m_inj_regs.ptrace_syscall());
 
+    // Any modifications to the injected syscall's registers are superseded by
+    // the backup
     OUTCOME_TRYV(write_regs(tid, m_inj_regs));
+    m_regs_dirty = false;
 
     // Repeated status because the syscall-entry hook is invoked for the
     // original syscall again
@@ -350,6 +353,7 @@ oc::result<SysCallRet> Tracee::inject_syscall_exit_end()
 {
     // Restore register backup
     OUTCOME_TRYV(write_regs(tid, m_inj_regs));
+    m_regs_dirty = false;
 
     m_sc_status = SysCallStatus::Normal;
 
@@ -359,6 +363,9 @@ oc::result<SysCallRet> Tracee::inject_syscall_exit_end()
 /*!
  * \brief Modify syscall number and arguments
  *
+ * The registers are not written until the tracee is resumed, so modifying the
+ * syscall multiple times during a stop only costs a single `PTRACE_SETREGSET`.
+ *
  * \pre state() must be TraceeState::PreSysCallStop
  *
  * \return Nothing if the syscall number and arguments are successfully changed.
@@ -375,13 +382,17 @@ Tracee::modify_syscall_args(SysCallNum num, const SysCallArgs &args)
     m_regs.set_arg3(args[3]);
     m_regs.set_arg4(args[4]);
     m_regs.set_arg5(args[5]);
+    m_regs_dirty = true;
 
-    return write_regs(tid, m_regs);
+    return oc::success();
 }
 
 /*!
  * \brief Modify syscall number and return value
  *
+ * Like modify_syscall_args(), the registers are written when the tracee is
+ * resumed.
+ *
  * \pre state() must be TraceeState::PostSysCallStop
  *
  * \return Nothing if the syscall number and return value are successfully
@@ -393,8 +404,9 @@ Tracee::modify_syscall_ret(SysCallNum num, SysCallRet ret)
     m_regs.set_ptrace_syscall(num);
 
     m_regs.set_ret(ret);
+    m_regs_dirty = true;
 
-    return write_regs(tid, m_regs);
+    return oc::success();
 }
 
 /*!
@@ -19,8 +19,8 @@
 
 #include "mbsystrace/tracee.h"
 
-#include <string_view>
-#include <vector>
+#include <algorithm>
+#include <limits>
 
 #include <cerrno>
 #include <climits>
@@ -45,17 +45,26 @@ namespace mb::systrace
 // https://elixir.bootlin.com/linux/v4.15.4/source/include/linux/err.h#L18
 static constexpr int MAX_ERRNO = 4095;
 
+// Maximum number of remote iovecs passed to a single process_vm_readv() or
+// process_vm_writev() call. Must not exceed IOV_MAX.
+static constexpr size_t MAX_IOVS = 64;
+
+// Largest chunk read by read_string() at once
+static constexpr size_t MAX_STRING_CHUNK = 64 * 1024;
+
 /*!
  * \brief Get process's page size
  *
+ * The page size is queried once and cached for the lifetime of the process.
+ *
  * \return Page size if it is successfully retrieved. Otherwise, an appropriate
  *         error code.
  */
 static oc::result<uintptr_t> get_page_size()
 {
-    const long page_size = sysconf(_SC_PAGESIZE);
-    if (page_size < 0) {
-        return ec_from_errno();
+    static const long page_size = sysconf(_SC_PAGESIZE);
+    if (page_size <= 0) {
+        return std::errc::invalid_argument;
     }
 
     return static_cast<uintptr_t>(page_size);
@@ -66,30 +75,81 @@ static oc::result<uintptr_t> get_page_size()
  *
  * \pre \p addr + \p size must not overflow
  *
- * \param addr Starting address
- * \param size Size of memory block
+ * \param[in,out] addr Starting address. Will be advanced past the range
+ *                     covered by the returned `iovec`s.
+ * \param[in,out] size Size of memory block. Will be decremented by the size of
+ *                     the range covered by the returned `iovec`s.
  * \param page_size Page size
+ * \param[out] iovs Array of at least `MAX_IOVS` `iovec`s
+ *
+ * \return Number of `iovec`s written to \p iovs
+ */
+static size_t split_iovs(uintptr_t &addr, size_t &size, uintptr_t page_size,
+                         iovec *iovs)
+{
+    size_t count = 0;
+
+    while (size > 0 && count < MAX_IOVS) {
+        auto &iov = iovs[count++];
+        iov.iov_base = reinterpret_cast<void *>(addr);
+        iov.iov_len = std::min(page_size - addr % page_size, size);
+
+        addr += iov.iov_len;
+        size -= iov.iov_len;
+    }
+
+    return count;
+}
+
+/*!
+ * \brief Transfer memory between this process and a tracee
+ *
+ * The remote range is split at page boundaries so that a partial transfer
+ * occurs if a page in the middle is unmapped. At most `MAX_IOVS` pages are
+ * transferred per syscall.
  *
- * \return Vector of `iovec` split at page boundaries
+ * \param tid Thread ID of tracee
+ * \param addr Remote address
+ * \param buf Local buffer
+ * \param size Number of bytes to transfer
+ * \param write Whether to write to (instead of read from) the tracee
+ *
+ * \return Number of bytes transferred if successful. If the first remote page
+ *         could not be accessed, returns the error code of the syscall.
  */
-static std::vector<iovec>
-split_iovs(uintptr_t addr, size_t size, uintptr_t page_size)
+static oc::result<size_t> transfer_mem(pid_t tid, uintptr_t addr, void *buf,
+                                       size_t size, bool write)
 {
-    std::vector<iovec> iovs;
+    OUTCOME_TRY(page_size, get_page_size());
+
+    iovec remote_iovs[MAX_IOVS];
+    size_t total = 0;
+
+    while (size > 0) {
+        const size_t prev_size = size;
+        const size_t n_iovs = split_iovs(addr, size, page_size, remote_iovs);
+        const size_t batch = prev_size - size;
 
-    uintptr_t cur_addr = addr;
-    uintptr_t max_addr = addr + size;
+        iovec local_iov{static_cast<char *>(buf) + total, batch};
 
-    while (cur_addr < max_addr) {
-        auto &iov = iovs.emplace_back();
-        iov.iov_base = reinterpret_cast<void *>(cur_addr);
-        iov.iov_len = std::min(page_size - cur_addr % page_size,
-                               max_addr - cur_addr);
+        auto n = write
+                ? process_vm_writev(tid, &local_iov, 1, remote_iovs, n_iovs, 0)
+                : process_vm_readv(tid, &local_iov, 1, remote_iovs, n_iovs, 0);
+        if (n < 0) {
+            if (total > 0) {
+                break;
+            }
+            return ec_from_errno();
+        }
+
+        total += static_cast<size_t>(n);
 
-        cur_addr += iov.iov_len;
+        if (static_cast<size_t>(n) < batch) {
+            break;
+        }
     }
 
-    return iovs;
+    return total;
 }
 
 /*!
@@ -115,18 +175,7 @@ Tracee::read_mem(uintptr_t addr, void *buf, size_t size)
         return std::errc::value_too_large;
     }
 
-    OUTCOME_TRY(page_size, get_page_size());
-
-    std::vector<iovec> remote_iovs = split_iovs(addr, size, page_size);
-    iovec local_iov{buf, size};
-
-    auto n = process_vm_readv(tid, &local_iov, 1, remote_iovs.data(),
-                              remote_iovs.size(), 0);
-    if (n < 0) {
-        return ec_from_errno();
-    }
-
-    return static_cast<size_t>(n);
+    return transfer_mem(tid, addr, buf, size, false);
 }
 
 /*!
@@ -152,23 +201,16 @@ Tracee::write_mem(uintptr_t addr, const void *buf, size_t size)
         return std::errc::value_too_large;
     }
 
-    OUTCOME_TRY(page_size, get_page_size());
-
-    std::vector<iovec> remote_iovs = split_iovs(addr, size, page_size);
-    iovec local_iov{const_cast<void *>(buf), size};
-
-    auto n = process_vm_writev(tid, &local_iov, 1, remote_iovs.data(),
-                               remote_iovs.size(), 0);
-    if (n < 0) {
-        return ec_from_errno();
-    }
-
-    return static_cast<size_t>(n);
+    return transfer_mem(tid, addr, const_cast<void *>(buf), size, true);
 }
 
 /*!
  * \brief Read a NULL-terminated string from the process
  *
+ * The first read stops at the end of the page containing \p addr, which is
+ * enough for most strings. Subsequent reads fetch whole pages, doubling in
+ * size up to 64 KiB, directly into the result buffer.
+ *
  * \param addr Address to read string from
  *
  * \pre state() must be a ptrace stop state
@@ -177,22 +219,28 @@ Tracee::write_mem(uintptr_t addr, const void *buf, size_t size)
  */
 oc::result<std::string> Tracee::read_string(uintptr_t addr)
 {
-    std::string result;
-    result.reserve(64);
+    OUTCOME_TRY(page_size, get_page_size());
 
-    char buf[4096];
+    std::string result;
+    size_t chunk = page_size - addr % page_size;
+    size_t next_chunk = page_size;
 
     while (true) {
-        OUTCOME_TRY(n, read_mem(addr, buf, sizeof(buf)));
+        const size_t offset = result.size();
+        result.resize(offset + chunk);
 
-        size_t str_n = strnlen(buf, n);
-        result += std::string_view(buf, str_n);
+        OUTCOME_TRY(n, read_mem(addr, result.data() + offset, chunk));
 
+        size_t str_n = strnlen(result.data() + offset, n);
         if (str_n < n) {
+            result.resize(offset + str_n);
             break;
         }
 
+        result.resize(offset + n);
         addr += n;
+        chunk = next_chunk;
+        next_chunk = std::min<size_t>(next_chunk * 2, MAX_STRING_CHUNK);
     }
 
     return result;
@@ -36,6 +36,7 @@
 #include "mbcommon/integer.h"
 
 #include "mbsystrace/procfs_p.h"
+#include "mbsystrace/seccomp_p.h"
 #include "mbsystrace/syscalls.h"
 #include "mbsystrace/tracee.h"
 
@@ -50,6 +51,10 @@ namespace mb::systrace
 
 using namespace detail;
 
+//! Value of ppoll()'s sigsetsize argument in the fork() handshake indicating
+//! that the child installed the syscall filter
+static constexpr SysCallArg FILTERED_PPOLL_MARKER = 0x5ecc0;
+
 /*!
  * \class Tracer
  *
@@ -139,6 +144,65 @@ Tracer::~Tracer()
  *         Otherwise, returns a specific error code.
  */
 oc::result<Tracee *> Tracer::fork(std::function<void()> child, Flags flags)
+{
+    return fork_impl(std::move(child), flags, nullptr);
+}
+
+/*!
+ * \brief Fork a new traced process that only stops at specific syscalls
+ *
+ * This behaves like fork(std::function<void()>, Flags), except that a
+ * seccomp-BPF filter is installed in the child process so that syscall-entry
+ * and syscall-exit stops only occur for the syscalls listed in \p syscalls.
+ * The tracee is resumed with `PTRACE_CONT` instead of `PTRACE_SYSCALL`, so
+ * other syscalls do not stop the tracee at all. Signal, `execve`, new process,
+ * and exit events are reported as usual.
+ *
+ * The filter is inherited by child processes. Without a tracer, the listed
+ * syscalls would fail with `ENOSYS`, so Flag::TraceChildren is implied.
+ *
+ * If the kernel is older than 4.8 or the filter cannot be installed, the
+ * process is traced at every syscall instead. The syscall hooks must not assume
+ * that they are only called for the listed syscalls.
+ *
+ * \note If the calling process does not have `CAP_SYS_ADMIN`, `no_new_privs`
+ *       will be set for the child process, so executing setuid/setgid binaries
+ *       will not grant privileges.
+ *
+ * \warning The filter cannot be removed. If a tracee is detached, the listed
+ *          syscalls will fail with `ENOSYS` in the detached thread.
+ *
+ * \param child Function to exit in child process. If the function does not
+ *              exit itself, then the child process will exit with status code
+ *              255.
+ * \param flags Flags to control how the child process is attached.
+ * \param syscalls Names of the syscalls to stop at. Each name is resolved for
+ *                 every ABI supported by the architecture.
+ *
+ * \return If successful, returns the Tracee instance of the new tracee. If a
+ *         name in \p syscalls is not a syscall for any ABI, returns
+ *         `std::errc::invalid_argument`. Otherwise, returns a specific error
+ *         code.
+ */
+oc::result<Tracee *> Tracer::fork(std::function<void()> child, Flags flags,
+                                  const std::vector<std::string> &syscalls)
+{
+    return fork_impl(std::move(child), flags, &syscalls);
+}
+
+/*!
+ * \brief Fork a new traced process
+ *
+ * \param child Function to exit in child process
+ * \param flags Flags to control how the child process is attached.
+ * \param syscalls If not nullptr, names of the syscalls to stop at
+ *
+ * \return If successful, returns the Tracee instance of the new tracee.
+ *         Otherwise, returns a specific error code.
+ */
+oc::result<Tracee *>
+Tracer::fork_impl(std::function<void()> child, Flags flags,
+                  const std::vector<std::string> *syscalls)
 {
     SeizeFlags seize_flags = SeizeFlag::TryKillOnExit;
 
@@ -146,14 +210,37 @@ oc::result<Tracee *> Tracer::fork(std::function<void()> child, Flags flags)
         seize_flags |= SeizeFlag::TraceChildren;
     }
 
+    std::optional<std::vector<sock_filter>> filter;
+
+    if (syscalls) {
+        // ppoll() must be traced for the handshake below
+        auto filtered_syscalls = *syscalls;
+        filtered_syscalls.emplace_back("ppoll");
+
+        OUTCOME_TRY(program, build_syscall_filter(filtered_syscalls));
+
+        if (seccomp_trace_supported()) {
+            filter = std::move(program);
+            seize_flags |= SeizeFlag::TraceSecComp;
+        }
+
+        seize_flags |= SeizeFlag::TraceChildren;
+    }
+
     pid_t pid = ::fork();
 
     if (pid == 0) {
+        // The sigsetsize argument of ppoll() is ignored when sigmask is NULL,
+        // so use it to tell the parent whether the filter is active
+        SysCallArg marker = filter && install_syscall_filter(*filter)
+                ? FILTERED_PPOLL_MARKER : 0;
+
         // Loop indefinitely until the parent attaches and changes the behavior
         // of the syscall. This is better than raise(SIGSTOP) and having the
         // the parent wait for a SIGSTOP because the parent would have no way of
-        // determining which process sent the SIGSTOP.
-        while (syscall(SYS_ppoll, nullptr, 0, nullptr, nullptr) != 0);
+        // determining which process sent the SIGSTOP. If the filter is active,
+        // ppoll() fails with ENOSYS until the parent attaches.
+        while (syscall(SYS_ppoll, nullptr, 0, nullptr, nullptr, marker) != 0);
 
         child();
         _exit(255);
@@ -183,8 +270,11 @@ oc::result<Tracee *> Tracer::fork(std::function<void()> child, Flags flags)
 
     // Modify behavior of pause to allow child to continue
     Hooks hooks;
-    hooks.syscall_entry = [](auto *, auto &info) -> SysCallEntryAction {
+    hooks.syscall_entry = [](auto *t, auto &info) -> SysCallEntryAction {
         if (strcmp(info.syscall.name(), "ppoll") == 0) {
+            if (info.args[4] == FILTERED_PPOLL_MARKER) {
+                t->set_syscall_filtered(true);
+            }
             return action::SuppressSysCall{0};
         }
         return action::Default{};
@@ -292,6 +382,11 @@ oc::result<Tracee *> Tracer::add_child(pid_t tgid, pid_t tid)
     m_tracees[tid] = std::make_unique<Tracee>(this, tgid, tid);
     m_tracees[tid]->set_state(TraceeState::Executing);
 
+    // Parent reported the new process before the child's first stop
+    if (m_filtered_tids.erase(tid) > 0) {
+        m_tracees[tid]->set_syscall_filtered(true);
+    }
+
     return oc::success(m_tracees[tid].get());
 }
 
@@ -306,6 +401,8 @@ bool Tracer::remove_child(pid_t tid)
 {
     pid_t tgid;
 
+    m_filtered_tids.erase(tid);
+
     if (auto it = m_tracees.find(tid); it != m_tracees.end()) {
         tgid = it->second->tgid;
         m_tracees.erase(it);
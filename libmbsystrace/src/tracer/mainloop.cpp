@@ -19,6 +19,8 @@
 
 #include "mbsystrace/tracer.h"
 
+#include <algorithm>
+
 #include <cstring>
 
 #include "mbcommon/finally.h"
@@ -40,6 +42,11 @@ namespace mb::systrace
 
 using namespace detail;
 
+using Clock = std::chrono::steady_clock;
+
+//! Maximum number of events collected from the kernel at once
+static constexpr size_t MAX_EVENT_BATCH = 64;
+
 namespace
 {
 
@@ -100,6 +107,11 @@ static void print_event(const ProcessEvent &event)
                       e.regs.arg0(), e.regs.arg1(), e.regs.arg2(),
                       e.regs.arg3(), e.regs.arg4(), e.regs.arg5(),
                       e.regs.ret());
+            } else if constexpr (std::is_same_v<T, SecCompStopEvent>) {
+                DEBUG("SecCompStopEvent { tid=%d, abi=%d, num=%lu/%s }\n",
+                      e.tid, static_cast<int>(e.regs.abi()),
+                      e.regs.ptrace_syscall(),
+                      syscall_string(e.regs.ptrace_syscall(), e.regs.abi()));
             } else if constexpr (std::is_same_v<T, SignalDeliveryStopEvent>) {
                 DEBUG("SignalDeliveryStopEvent { tid=%d, signal=%d }\n",
                       e.tid, e.signal);
@@ -224,7 +236,18 @@ oc::result<bool> Tracer::dispatch_event(const Hooks &hooks,
                     tracee = new_tracee;
                 }
 
-                if constexpr (std::is_same_v<T, SysCallStopEvent>) {
+                if constexpr (std::is_same_v<T, SecCompStopEvent>) {
+                    // If the tracee was resumed with PTRACE_SYSCALL, the
+                    // syscall-entry stop has already been handled
+                    if (tracee->exec_mode() == ExecMode::Kernel) {
+                        tracee->set_state(TraceeState::SecCompStop);
+                        OUTCOME_TRYV(tracee->continue_exec(0));
+                        return true;
+                    }
+                }
+
+                if constexpr (std::is_same_v<T, SysCallStopEvent>
+                        || std::is_same_v<T, SecCompStopEvent>) {
                     tracee->set_regs(e.regs);
 
                     switch (tracee->exec_mode()) {
@@ -293,6 +316,18 @@ oc::result<bool> Tracer::dispatch_event(const Hooks &hooks,
                     // for the child before NewProcessStopEvent for the parent.
                     // Instead, we'll call the new tracee hook when it hits its
                     // first ptrace stop.
+
+                    // The child inherits the seccomp filter. Until this point,
+                    // the child is traced at every syscall, which is slower,
+                    // but still correct.
+                    if (tracee->syscall_filtered()) {
+                        if (auto child = find_tracee(e.new_tid)) {
+                            child->set_syscall_filtered(true);
+                        } else {
+                            m_filtered_tids.insert(e.new_tid);
+                        }
+                    }
+
                     OUTCOME_TRYV(tracee->continue_exec(0));
                     return true;
                 } else if constexpr (std::is_same_v<T, ExitStopEvent>) {
@@ -656,25 +691,42 @@ oc::result<void> Tracer::execute(const Hooks &hooks, int pid_spec)
     while (!m_should_stop && (pid_spec == -1
             ? !m_tracees.empty()
             : m_tracees.find(pid_spec) != m_tracees.end())) {
-        ProcessEvent e;
-
-        if (m_requeued_event) {
-            e = *m_requeued_event;
-            m_requeued_event.reset();
+        OUTCOME_TRY(event, take_event(pid_spec, true));
+        OUTCOME_TRY(should_continue, dispatch_timed(hooks, *event));
 
-#if DEBUG_EVENTS
-            DEBUG("[Replayed] ");
-#endif
-        } else {
-            OUTCOME_TRY(event, next_event(pid_spec));
-            e = event;
+        if (!should_continue) {
+            break;
         }
+    }
 
-#if DEBUG_EVENTS
-        print_event(e);
-#endif
+    m_should_stop = false;
+
+    return oc::success();
+}
+
+/*!
+ * \brief Dispatch pending events without blocking
+ *
+ * This is a non-blocking variant of execute(const Hooks &) for integrating the
+ * tracer into an existing event loop. All events that are already pending are
+ * dispatched and then this function returns. The caller is responsible for
+ * calling this function again when new events may be available, for example,
+ * when a `signalfd()` for `SIGCHLD` becomes readable.
+ *
+ * \param hooks Callback hooks for tracee events
+ *
+ * \return Returns whether there are still tracees to wait for if no errors
+ *         occur. Otherwise, a specific error code is returned.
+ */
+oc::result<bool> Tracer::execute_pending(const Hooks &hooks)
+{
+    while (!m_should_stop && !m_tracees.empty()) {
+        OUTCOME_TRY(event, take_event(-1, false));
+        if (!event) {
+            break;
+        }
 
-        OUTCOME_TRY(should_continue, dispatch_event(hooks, e));
+        OUTCOME_TRY(should_continue, dispatch_timed(hooks, *event));
 
         if (!should_continue) {
             break;
@@ -683,7 +735,7 @@ oc::result<void> Tracer::execute(const Hooks &hooks, int pid_spec)
 
     m_should_stop = false;
 
-    return oc::success();
+    return !m_tracees.empty();
 }
 
 /*!
@@ -700,4 +752,107 @@ void Tracer::stop_after_hook() noexcept
     m_should_stop = true;
 }
 
+/*!
+ * \brief Get event loop overhead counters
+ *
+ * \return Counters accumulated since the Tracer was constructed or since the
+ *         last call to reset_stats()
+ */
+const TracerStats & Tracer::stats() const noexcept
+{
+    return m_stats;
+}
+
+/*!
+ * \brief Reset event loop overhead counters
+ */
+void Tracer::reset_stats() noexcept
+{
+    m_stats = {};
+}
+
+/*!
+ * \brief Get next event to dispatch
+ *
+ * Requeued events are returned first. If \p pid_spec is `-1`, events are
+ * collected from the kernel in batches and queued. Otherwise, events are
+ * retrieved one at a time so that queued events for other tracees are left
+ * untouched (eg. while injecting a syscall from a hook).
+ *
+ * \param pid_spec Same meaning as the \p pid_spec parameter to execute()
+ * \param block Whether to block until an event is available. Must be true if
+ *              \p pid_spec is not `-1`.
+ *
+ * \return Returns the next event or std::nullopt if \p block is false and no
+ *         events are pending. Otherwise, returns an error code.
+ */
+oc::result<std::optional<ProcessEvent>>
+Tracer::take_event(int pid_spec, bool block)
+{
+    if (m_requeued_event) {
+        std::optional<ProcessEvent> event;
+        event.swap(m_requeued_event);
+
+#if DEBUG_EVENTS
+        DEBUG("[Replayed] ");
+#endif
+
+        return event;
+    } else if (pid_spec != -1) {
+        assert(block);
+
+        OUTCOME_TRY(event, next_event(pid_spec));
+        return std::move(event);
+    }
+
+    if (m_events.empty()) {
+        if (block) {
+            OUTCOME_TRY(event, next_event(pid_spec));
+            m_events.push_back(std::move(event));
+        }
+
+        auto start = Clock::now();
+        auto ret = next_ready_events(pid_spec, m_events, MAX_EVENT_BATCH);
+        m_stats.collect_time += Clock::now() - start;
+
+        if (!ret) {
+            return ret.as_failure();
+        } else if (m_events.empty()) {
+            return std::nullopt;
+        }
+
+        ++m_stats.batches;
+        m_stats.max_batch_size = std::max<uint64_t>(
+                m_stats.max_batch_size, m_events.size());
+    }
+
+    std::optional<ProcessEvent> event(std::move(m_events.front()));
+    m_events.pop_front();
+
+    return event;
+}
+
+/*!
+ * \brief Dispatch an event and update the overhead counters
+ *
+ * \param hooks Callback hooks for tracee events
+ * \param event Incoming event for a tracee
+ *
+ * \return Same as dispatch_event()
+ */
+oc::result<bool> Tracer::dispatch_timed(const Hooks &hooks,
+                                        const ProcessEvent &event)
+{
+#if DEBUG_EVENTS
+    print_event(event);
+#endif
+
+    auto start = Clock::now();
+    auto ret = dispatch_event(hooks, event);
+    m_stats.dispatch_time += Clock::now() - start;
+    ++m_stats.events;
+
+    return ret;
+}
+
 }
@@ -0,0 +1,142 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gmock/gmock.h>
+
+#include <atomic>
+#include <optional>
+#include <thread>
+#include <vector>
+
+#include <cstring>
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "mbsystrace/syscalls.h"
+#include "mbsystrace/tracee.h"
+#include "mbsystrace/tracer.h"
+
+using namespace mb::systrace;
+
+TEST(EventLoopTest, DispatchEventsFromManyThreads)
+{
+    static constexpr int THREADS = 8;
+    static constexpr int CALLS = 50;
+
+    int entries = 0;
+    int exits = 0;
+
+    Hooks hooks;
+
+    hooks.syscall_entry = [&](auto, auto &info) {
+        if (strcmp(info.syscall.name(), "getppid") == 0) {
+            ++entries;
+        }
+        return action::Default{};
+    };
+    hooks.syscall_exit = [&](auto, auto &info) {
+        if (strcmp(info.syscall.name(), "getppid") == 0) {
+            ++exits;
+        }
+        return action::Default{};
+    };
+
+    Tracer tracer;
+
+    ASSERT_TRUE(tracer.fork([&] {
+        std::vector<std::thread> threads;
+
+        for (int i = 0; i < THREADS; ++i) {
+            threads.emplace_back([] {
+                for (int j = 0; j < CALLS; ++j) {
+                    syscall(SYS_getppid);
+                }
+            });
+        }
+
+        for (auto &t : threads) {
+            t.join();
+        }
+
+        _exit(0);
+    }, Flag::TraceChildren));
+
+    ASSERT_TRUE(tracer.execute(hooks));
+
+    ASSERT_EQ(entries, THREADS * CALLS);
+    ASSERT_EQ(exits, THREADS * CALLS);
+
+    auto &stats = tracer.stats();
+    ASSERT_GE(stats.events, static_cast<uint64_t>(2 * THREADS * CALLS));
+    ASSERT_GT(stats.batches, 0u);
+    ASSERT_LE(stats.batches, stats.events);
+    ASSERT_GE(stats.max_batch_size, 1u);
+    ASSERT_GT(stats.dispatch_time.count(), 0);
+
+    tracer.reset_stats();
+    ASSERT_EQ(tracer.stats().events, 0u);
+}
+
+TEST(EventLoopTest, ExecutePendingDoesNotBlock)
+{
+    std::optional<int> exit_code;
+
+    Hooks hooks;
+
+    hooks.tracee_exit = [&](auto, auto code) {
+        exit_code = code;
+        return action::Default{};
+    };
+
+    Tracer tracer;
+
+    int pipefd[2];
+    ASSERT_EQ(pipe(pipefd), 0);
+
+    ASSERT_TRUE(tracer.fork([&] {
+        char c;
+        close(pipefd[1]);
+        (void) read(pipefd[0], &c, 1);
+        _exit(10);
+    }));
+
+    close(pipefd[0]);
+
+    // The child is blocked in read(), so there is nothing to dispatch
+    for (int i = 0; i < 10; ++i) {
+        auto ret = tracer.execute_pending(hooks);
+        ASSERT_TRUE(ret);
+        ASSERT_TRUE(ret.value());
+    }
+    ASSERT_FALSE(exit_code);
+
+    close(pipefd[1]);
+
+    while (true) {
+        auto ret = tracer.execute_pending(hooks);
+        ASSERT_TRUE(ret);
+        if (!ret.value()) {
+            break;
+        }
+        usleep(1000);
+    }
+
+    ASSERT_EQ(exit_code, 10);
+}
@@ -20,6 +20,8 @@
 #include <gtest/gtest.h>
 
 #include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
 #include "mbcommon/finally.h"
 
@@ -170,3 +172,48 @@ TEST(MemoryTest, ReadLargeNullTerminatedString)
 
     ASSERT_EQ(buf, expected);
 }
+
+TEST(MemoryTest, ReadStringEndingAtUnmappedPage)
+{
+    const auto page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    // Ensure string spans multiple pages and ends right before an unmapped page
+    std::string expected(page_size * 2 + 123, 'x');
+
+    std::string buf;
+    Hooks hooks;
+
+    hooks.syscall_entry = [&](auto tracee, auto &info)
+            -> SysCallEntryAction {
+        if (strcmp(info.syscall.name(), "chdir") == 0) {
+            buf = tracee->read_string(info.args[0]).value();
+
+            return action::SuppressSysCall{0};
+        } else {
+            return action::ContinueExec{};
+        }
+    };
+
+    Tracer tracer;
+
+    ASSERT_TRUE(tracer.fork([&] {
+        auto size = page_size * 4;
+        auto ptr = static_cast<char *>(mmap(nullptr, size,
+                                            PROT_READ | PROT_WRITE,
+                                            MAP_PRIVATE | MAP_ANONYMOUS,
+                                            -1, 0));
+        if (ptr == MAP_FAILED) {
+            _exit(1);
+        }
+
+        munmap(ptr + page_size * 3, page_size);
+
+        auto str = ptr + page_size * 3 - expected.size() - 1;
+        memcpy(str, expected.c_str(), expected.size() + 1);
+
+        MB_IGNORE_VALUE(chdir(str));
+    }));
+
+    ASSERT_TRUE(tracer.execute(hooks));
+
+    ASSERT_EQ(buf, expected);
+}
@@ -0,0 +1,221 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gmock/gmock.h>
+
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include <cerrno>
+#include <cstring>
+
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "mbsystrace/syscalls.h"
+#include "mbsystrace/tracee.h"
+#include "mbsystrace/tracer.h"
+
+using namespace mb::systrace;
+
+TEST(SecCompTest, OnlyFilteredSysCallsStop)
+{
+    std::vector<std::string> entries;
+    std::vector<std::string> exits;
+    bool filtered = false;
+
+    Hooks hooks;
+
+    hooks.syscall_entry = [&](auto tracee, auto &info) {
+        entries.emplace_back(info.syscall.name());
+        filtered = tracee->syscall_filtered();
+        return action::Default{};
+    };
+    hooks.syscall_exit = [&](auto, auto &info) {
+        exits.emplace_back(info.syscall.name());
+        return action::Default{};
+    };
+
+    Tracer tracer;
+
+    ASSERT_TRUE(tracer.fork([&] {
+        for (int i = 0; i < 2; ++i) {
+            syscall(SYS_getpid);
+            syscall(SYS_getppid);
+            syscall(SYS_gettid);
+        }
+        _exit(0);
+    }, {}, {"getppid"}));
+
+    ASSERT_TRUE(tracer.execute(hooks));
+
+    ASSERT_TRUE(filtered) << "Filter was not installed";
+    ASSERT_THAT(entries, testing::ElementsAre("getppid", "getppid"));
+    ASSERT_THAT(exits, testing::ElementsAre("getppid", "getppid"));
+}
+
+TEST(SecCompTest, SuppressSysCall)
+{
+    int exit_code = -1;
+
+    Hooks hooks;
+
+    hooks.syscall_entry = [](auto, auto &info) -> SysCallEntryAction {
+        if (strcmp(info.syscall.name(), "close") == 0) {
+            return action::SuppressSysCall{-EPERM};
+        }
+        return action::Default{};
+    };
+    hooks.tracee_exit = [&](auto, auto code) {
+        exit_code = code;
+        return action::Default{};
+    };
+
+    Tracer tracer;
+
+    ASSERT_TRUE(tracer.fork([&] {
+        if (close(-1) < 0) {
+            _exit(errno);
+        }
+        _exit(0);
+    }, {}, {"close"}));
+
+    ASSERT_TRUE(tracer.execute(hooks));
+
+    ASSERT_EQ(exit_code, EPERM);
+}
+
+TEST(SecCompTest, AsynchronousInjectionAtEntry)
+{
+    std::vector<SysCallStatus> entry_statuses;
+    std::vector<SysCallStatus> exit_statuses;
+
+    Hooks hooks;
+
+    hooks.syscall_entry = [&](auto tracee, auto &info) {
+        entry_statuses.push_back(info.status);
+
+        if (info.status == SysCallStatus::Normal) {
+            (void) tracee->inject_syscall_async(
+                    SysCall("getpid", info.syscall.abi()).num(), {});
+        }
+
+        return action::ContinueExec{};
+    };
+    hooks.syscall_exit = [&](auto, auto &info) {
+        exit_statuses.push_back(info.status);
+        return action::ContinueExec{};
+    };
+
+    Tracer tracer;
+
+    ASSERT_TRUE(tracer.fork([&] {
+        syscall(SYS_getppid);
+        _exit(0);
+    }, {}, {"getppid"}));
+    ASSERT_TRUE(tracer.execute(hooks));
+
+    EXPECT_THAT(entry_statuses, testing::ElementsAre(
+            SysCallStatus::Normal, SysCallStatus::Repeated));
+    EXPECT_THAT(exit_statuses, testing::ElementsAre(
+            SysCallStatus::Injected, SysCallStatus::Normal));
+}
+
+TEST(SecCompTest, SynchronousInjection)
+{
+    std::vector<SysCallRet> results;
+    pid_t tgid = -1;
+
+    Hooks hooks;
+
+    hooks.syscall_entry = [&](auto tracee, auto &info) {
+        tgid = tracee->tgid;
+
+        if (auto r = tracee->inject_syscall(
+                SysCall("getpid", info.syscall.abi()).num(), {})) {
+            results.push_back(r.value());
+        }
+
+        return action::ContinueExec{};
+    };
+    hooks.syscall_exit = [&](auto tracee, auto &info) {
+        if (auto r = tracee->inject_syscall(
+                SysCall("getpid", info.syscall.abi()).num(), {})) {
+            results.push_back(r.value());
+        }
+
+        return action::ContinueExec{};
+    };
+
+    Tracer tracer;
+
+    ASSERT_TRUE(tracer.fork([&] {
+        syscall(SYS_getppid);
+        _exit(0);
+    }, {}, {"getppid"}));
+    ASSERT_TRUE(tracer.execute(hooks));
+
+    EXPECT_THAT(results, testing::ElementsAre(tgid, tgid));
+}
+
+TEST(SecCompTest, ChildrenInheritFilter)
+{
+    std::unordered_set<pid_t> tids;
+
+    Hooks hooks;
+
+    hooks.syscall_entry = [&](auto tracee, auto &info) {
+        if (strcmp(info.syscall.name(), "getppid") == 0) {
+            tids.insert(tracee->tid);
+        }
+        return action::Default{};
+    };
+
+    Tracer tracer;
+
+    ASSERT_TRUE(tracer.fork([&] {
+        syscall(SYS_getppid);
+
+        pid_t pid = fork();
+        if (pid == 0) {
+            syscall(SYS_getppid);
+            _exit(0);
+        } else if (pid > 0) {
+            int status;
+            waitpid(pid, &status, 0);
+        }
+
+        _exit(0);
+    }, Flag::TraceChildren, {"getppid"}));
+
+    ASSERT_TRUE(tracer.execute(hooks));
+
+    ASSERT_EQ(tids.size(), 2u);
+}
+
+TEST(SecCompTest, RejectInvalidSysCallName)
+{
+    Tracer tracer;
+
+    auto r = tracer.fork([] { _exit(0); }, {}, {"not_a_syscall"});
+    ASSERT_FALSE(r);
+    ASSERT_EQ(r.error(), std::errc::invalid_argument);
+}
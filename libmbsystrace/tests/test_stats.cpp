@@ -0,0 +1,207 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gmock/gmock.h>
+
+#include <string>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "mbsystrace/stats.h"
+#include "mbsystrace/syscalls.h"
+#include "mbsystrace/tracee.h"
+#include "mbsystrace/tracer.h"
+
+using namespace mb::systrace;
+
+static void run_child(SysCallStats &stats, Hooks hooks, pid_t *tid)
+{
+    Tracer tracer;
+
+    auto tracee = tracer.fork([] {
+        for (int i = 0; i < 5; ++i) {
+            syscall(SYS_getppid);
+        }
+        for (int i = 0; i < 3; ++i) {
+            close(-1);
+        }
+        _exit(0);
+    }, {}, {"getppid", "close"});
+    ASSERT_TRUE(tracee);
+
+    if (tid) {
+        *tid = tracee.value()->tid;
+    }
+
+    ASSERT_TRUE(tracer.execute(stats.wrap(std::move(hooks))));
+}
+
+static const SysCallSummary * find(const std::vector<SysCallSummary> &list,
+                                   const char *name)
+{
+    for (auto const &item : list) {
+        if (item.name == name) {
+            return &item;
+        }
+    }
+    return nullptr;
+}
+
+TEST(SysCallStatsTest, CountCallsAndErrors)
+{
+    SysCallStats stats;
+    pid_t tid = -1;
+
+    ASSERT_NO_FATAL_FAILURE(run_child(stats, {}, &tid));
+
+    auto summary = stats.summary();
+    ASSERT_EQ(summary.size(), 2u);
+
+    auto getppid = find(summary, "getppid");
+    ASSERT_TRUE(getppid);
+    ASSERT_EQ(getppid->calls, 5u);
+    ASSERT_EQ(getppid->errors, 0u);
+    ASSERT_GT(getppid->total.count(), 0);
+    ASSERT_LE(getppid->p50, getppid->p99);
+    ASSERT_LE(getppid->p99, getppid->max);
+    ASSERT_LE(getppid->max, getppid->total);
+
+    auto close = find(summary, "close");
+    ASSERT_TRUE(close);
+    ASSERT_EQ(close->calls, 3u);
+    ASSERT_EQ(close->errors, 3u);
+
+    auto per_tracee = stats.per_tracee();
+    ASSERT_EQ(per_tracee.size(), 1u);
+    ASSERT_EQ(per_tracee.begin()->first, tid);
+
+    auto tracee_close = find(per_tracee.begin()->second, "close");
+    ASSERT_TRUE(tracee_close);
+    ASSERT_EQ(tracee_close->calls, 3u);
+    ASSERT_EQ(tracee_close->errors, 3u);
+
+    stats.reset();
+    ASSERT_TRUE(stats.summary().empty());
+    ASSERT_TRUE(stats.per_tracee().empty());
+}
+
+TEST(SysCallStatsTest, WrappedHooksAreCalled)
+{
+    SysCallStats stats;
+    int entries = 0;
+    int exit_code = -1;
+
+    Hooks hooks;
+
+    hooks.syscall_entry = [&](auto, auto &info) -> SysCallEntryAction {
+        ++entries;
+        if (info.status == SysCallStatus::Normal) {
+            return action::SuppressSysCall{-EPERM};
+        }
+        return action::Default{};
+    };
+    hooks.tracee_exit = [&](auto, auto code) {
+        exit_code = code;
+        return action::Default{};
+    };
+
+    ASSERT_NO_FATAL_FAILURE(run_child(stats, std::move(hooks), nullptr));
+
+    ASSERT_EQ(entries, 8);
+    ASSERT_EQ(exit_code, 0);
+
+    // The suppressed syscalls return -EPERM
+    auto getppid = find(stats.summary(), "getppid");
+    ASSERT_TRUE(getppid);
+    ASSERT_EQ(getppid->calls, 5u);
+    ASSERT_EQ(getppid->errors, 5u);
+}
+
+TEST(SysCallStatsTest, IgnoreInjectedSysCalls)
+{
+    SysCallStats stats;
+
+    Hooks hooks;
+
+    hooks.syscall_entry = [&](auto tracee, auto &info) {
+        if (info.status == SysCallStatus::Normal) {
+            (void) tracee->inject_syscall_async(
+                    SysCall("getpid", info.syscall.abi()).num(), {});
+        }
+        return action::ContinueExec{};
+    };
+
+    ASSERT_NO_FATAL_FAILURE(run_child(stats, std::move(hooks), nullptr));
+
+    auto summary = stats.summary();
+    ASSERT_FALSE(find(summary, "getpid"));
+
+    auto getppid = find(summary, "getppid");
+    ASSERT_TRUE(getppid);
+    ASSERT_EQ(getppid->calls, 5u);
+}
+
+TEST(SysCallStatsTest, PrintSummary)
+{
+    SysCallStats stats;
+
+    ASSERT_NO_FATAL_FAILURE(run_child(stats, {}, nullptr));
+
+    char *buf = nullptr;
+    size_t size = 0;
+
+    FILE *fp = open_memstream(&buf, &size);
+    ASSERT_TRUE(fp);
+    stats.print_summary(fp);
+    fclose(fp);
+
+    std::string output(buf, size);
+    free(buf);
+
+    ASSERT_THAT(output, testing::HasSubstr("% time"));
+    ASSERT_THAT(output, testing::ContainsRegex(" 5 +[0-9]+ +[0-9]+ getppid\n"));
+    ASSERT_THAT(output, testing::ContainsRegex("3 +3 +[0-9]+ +[0-9]+ +close\n"));
+    ASSERT_THAT(output, testing::ContainsRegex("100.00 .* 8 +3 +total\n"));
+}
+
+TEST(SysCallStatsTest, ExportJson)
+{
+    SysCallStats stats;
+    pid_t tid = -1;
+
+    ASSERT_NO_FATAL_FAILURE(run_child(stats, {}, &tid));
+
+    auto json = stats.to_json();
+
+    ASSERT_THAT(json, testing::StartsWith(R"({"syscalls":[{"name":")"));
+    ASSERT_THAT(json, testing::HasSubstr(
+            R"("name":"close","calls":3,"errors":3,"total_ns":)"));
+    ASSERT_THAT(json, testing::HasSubstr(
+            R"("name":"getppid","calls":5,"errors":0,"total_ns":)"));
+    ASSERT_THAT(json, testing::HasSubstr(R"("p99_ns":)"));
+    ASSERT_THAT(json, testing::HasSubstr(
+            R"("tracees":[{"tid":)" + std::to_string(tid)
+            + R"(,"syscalls":[)"));
+    ASSERT_THAT(json, testing::EndsWith("]}]}"));
+}
@@ -191,6 +191,43 @@ TEST(SysCallsTest, ModifySysCallArgs)
     ASSERT_EQ(exit_code, 7);
 }
 
+TEST(SysCallsTest, ModifySysCallArgsMultipleTimes)
+{
+    int exit_code = -1;
+
+    Hooks hooks;
+
+    hooks.syscall_entry = [](auto tracee, auto &info) {
+        if (strcmp(info.syscall.name(), "read") == 0) {
+            SysCall sc("exit_group", info.syscall.abi());
+            assert(sc);
+
+            // Only the last modification should be written back
+            auto args = info.args;
+            args[0] = 3;
+            (void) tracee->modify_syscall_args(info.syscall.num(), args);
+            args[0] = 5;
+            (void) tracee->modify_syscall_args(sc.num(), args);
+        }
+
+        return action::ContinueExec{};
+    };
+    hooks.tracee_exit = [&](auto, auto ec) -> TraceeExitAction {
+        exit_code = ec;
+        return action::NoAction{};
+    };
+
+    Tracer tracer;
+
+    ASSERT_TRUE(tracer.fork([&] {
+        read(7, nullptr, 0);
+    }));
+
+    ASSERT_TRUE(tracer.execute(hooks));
+
+    ASSERT_EQ(exit_code, 5);
+}
+
 TEST(SysCallsTest, ModifySysCallRet)
 {
     int exit_code = -1;
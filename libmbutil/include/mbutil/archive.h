@@ -25,6 +25,10 @@
 #include <archive.h>
 #include <archive_entry.h>
 
+#include "mbcommon/file/block_reader.h"
+#include "mbcommon/flags.h"
+#include "mbutil/hash.h"
+
 namespace mb::util
 {
 
@@ -40,6 +44,12 @@ struct ExistsInfo
     bool exists;
 };
 
+struct FileChecksum
+{
+    std::string path;
+    Sha512Digest digest;
+};
+
 enum class CompressionType : uint8_t
 {
     None,
@@ -48,28 +58,86 @@ enum class CompressionType : uint8_t
     Xz,
 };
 
+enum class TarExtractFlag : uint8_t
+{
+    // Leave regular files whose size, mode, owner, and mtime already match the
+    // archive entry untouched and replace everything else
+    SkipUnchanged = 1 << 0,
+};
+MB_DECLARE_FLAGS(TarExtractFlags, TarExtractFlag)
+MB_DECLARE_OPERATORS_FOR_FLAGS(TarExtractFlags)
+
+struct CopyProgress;
+class ZipIndex;
+
+// Input for an archive that is stored in the current entry of another archive
+struct ArchiveEntrySource
+{
+    archive *parent = nullptr;
+    // Number of bytes of the entry returned so far
+    uint64_t offset = 0;
+    // Last block read from the parent entry. It may follow a sparse hole.
+    const void *pending = nullptr;
+    size_t pending_size = 0;
+    uint64_t pending_offset = 0;
+};
+
+int libarchive_open_reader(archive *a, BlockReader &reader);
+int libarchive_open_file(archive *a, const std::string &filename,
+                         size_t block_size = BlockReader::DEFAULT_BLOCK_SIZE);
+int libarchive_open_entry(archive *a, ArchiveEntrySource &source,
+                          archive *parent);
+
 int libarchive_copy_data(archive *in, archive *out, archive_entry *entry);
 bool libarchive_copy_data_disk_to_archive(archive *in, archive *out,
-                                          archive_entry *entry);
+                                          archive_entry *entry,
+                                          CopyProgress *progress = nullptr);
 int libarchive_copy_header_and_data(archive *in, archive *out,
                                     archive_entry *entry);
 bool libarchive_tar_extract(const std::string &filename,
                             const std::string &target,
                             const std::vector<std::string> &patterns,
                             CompressionType compression,
-                            bool is_split);
+                            bool is_split,
+                            TarExtractFlags flags = {},
+                            std::vector<std::string> *entries = nullptr,
+                            CopyProgress *progress = nullptr);
 bool libarchive_tar_create(const std::string &filename,
                            const std::string &base_dir,
                            const std::vector<std::string> &paths,
                            CompressionType compression,
-                           uint64_t split_archive_size);
+                           uint64_t split_archive_size,
+                           CopyProgress *progress = nullptr,
+                           std::vector<FileChecksum> *checksums = nullptr);
+
+std::string libarchive_tar_part_name(const std::string &filename, size_t index);
+size_t libarchive_tar_part_count(const std::string &filename);
+bool libarchive_tar_create_parts(const std::string &filename,
+                                 const std::string &base_dir,
+                                 const std::vector<std::string> &paths,
+                                 CompressionType compression,
+                                 uint64_t part_size,
+                                 unsigned int max_jobs,
+                                 CopyProgress *progress = nullptr,
+                                 std::vector<FileChecksum> *checksums = nullptr);
+bool libarchive_tar_extract_parts(const std::string &filename,
+                                  const std::string &target,
+                                  const std::vector<std::string> &patterns,
+                                  CompressionType compression,
+                                  unsigned int max_jobs,
+                                  TarExtractFlags flags = {},
+                                  std::vector<std::string> *entries = nullptr,
+                                  CopyProgress *progress = nullptr);
 
 bool extract_archive(const std::string &filename, const std::string &target);
 bool extract_files(const std::string &filename, const std::string &target,
                    const std::vector<std::string> &files);
 bool extract_files2(const std::string &filename,
                     const std::vector<ExtractInfo> &files);
+bool extract_files2(const ZipIndex &index,
+                    const std::vector<ExtractInfo> &files);
 bool archive_exists(const std::string &filename,
                     std::vector<ExistsInfo> &files);
+bool archive_exists(const ZipIndex &index, std::vector<ExistsInfo> &files);
 
 }
@@ -0,0 +1,175 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <utility>
+
+#include "mbcommon/common.h"
+
+#include "mbutil/copy.h"
+#include "mbutil/delete.h"
+#include "mbutil/hash.h"
+#include "mbutil/io_scheduler.h"
+
+namespace mb::util
+{
+
+// Handle to an operation running on its own thread. Destroying the handle
+// waits for the operation to finish.
+template<typename T>
+class AsyncOp
+{
+public:
+    using CancelFn = std::function<void()>;
+
+    AsyncOp() = default;
+
+    ~AsyncOp()
+    {
+        if (m_state) {
+            m_state->thread.join();
+        }
+    }
+
+    AsyncOp(AsyncOp &&other) noexcept = default;
+
+    AsyncOp & operator=(AsyncOp &&rhs) noexcept
+    {
+        if (this != &rhs) {
+            if (m_state) {
+                m_state->thread.join();
+            }
+            m_state = std::move(rhs.m_state);
+        }
+        return *this;
+    }
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(AsyncOp)
+
+    // Run fn() on a new thread. If io_path is not empty, the operation first
+    // waits for the IoScheduler to admit a bulk operation on the disk backing
+    // that path. cancel is called by cancel() and must make fn() return soon.
+    template<typename Fn>
+    static AsyncOp run(std::string io_path, Fn &&fn, CancelFn cancel = {})
+    {
+        AsyncOp op;
+        op.m_state = std::make_shared<State>();
+        op.m_state->cancel = std::move(cancel);
+
+        op.m_state->thread = std::thread(
+                [state = op.m_state.get(), io_path = std::move(io_path),
+                 fn = std::forward<Fn>(fn)]() mutable {
+            std::optional<IoScheduler::Ticket> ticket;
+            if (!io_path.empty()) {
+                ticket = IoScheduler::instance().acquire_bulk(io_path);
+            }
+
+            auto result = fn();
+
+            ticket.reset();
+
+            {
+                std::lock_guard lock(state->mutex);
+                state->result.emplace(std::move(result));
+            }
+            state->cv.notify_all();
+        });
+
+        return op;
+    }
+
+    bool valid() const
+    {
+        return !!m_state;
+    }
+
+    bool ready() const
+    {
+        std::lock_guard lock(m_state->mutex);
+        return m_state->result.has_value();
+    }
+
+    void wait() const
+    {
+        std::unique_lock lock(m_state->mutex);
+        m_state->cv.wait(lock, [&] {
+            return m_state->result.has_value();
+        });
+    }
+
+    // Returns whether the operation finished within the timeout. Useful for
+    // reporting progress periodically while waiting.
+    template<typename Rep, typename Period>
+    bool wait_for(const std::chrono::duration<Rep, Period> &timeout) const
+    {
+        std::unique_lock lock(m_state->mutex);
+        return m_state->cv.wait_for(lock, timeout, [&] {
+            return m_state->result.has_value();
+        });
+    }
+
+    // Wait for the operation and get its result
+    T & get()
+    {
+        wait();
+        return *m_state->result;
+    }
+
+    void cancel()
+    {
+        if (m_state->cancel) {
+            m_state->cancel();
+        }
+    }
+
+private:
+    struct State
+    {
+        std::mutex mutex;
+        std::condition_variable cv;
+        std::optional<T> result;
+        CancelFn cancel;
+        std::thread thread;
+    };
+
+    std::shared_ptr<State> m_state;
+};
+
+AsyncOp<FileOpResult<void>> copy_dir_async(std::string source,
+                                           std::string target,
+                                           CopyFlags flags,
+                                           CopyProgress *progress = nullptr);
+AsyncOp<FileOpResult<void>> copy_contents_async(
+        std::string source, std::string target,
+        CopyProgress *progress = nullptr);
+AsyncOp<FileOpResult<void>> delete_recursive_async(
+        std::string path, DeleteFlags flags = {},
+        DeleteProgress *progress = nullptr);
+AsyncOp<oc::result<Sha512Digest>> sha512_hash_async(std::string path);
+
+}
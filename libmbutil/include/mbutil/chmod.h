@@ -32,6 +32,8 @@ namespace mb::util
 enum class ChmodFlag : uint8_t
 {
     Recursive   = 1 << 0,
+    // Recursive: Process directories concurrently on a pool of worker threads
+    Parallel    = 1 << 1,
 };
 MB_DECLARE_FLAGS(ChmodFlags, ChmodFlag)
 MB_DECLARE_OPERATORS_FOR_FLAGS(ChmodFlags)
@@ -33,6 +33,8 @@ enum class ChownFlag : uint8_t
 {
     FollowSymlinks  = 1 << 0,
     Recursive       = 1 << 1,
+    // Recursive: Process directories concurrently on a pool of worker threads
+    Parallel        = 1 << 2,
 };
 MB_DECLARE_FLAGS(ChownFlags, ChownFlag)
 MB_DECLARE_OPERATORS_FOR_FLAGS(ChownFlags)
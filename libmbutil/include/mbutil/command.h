@@ -19,6 +19,7 @@
 
 #pragma once
 
+#include <chrono>
 #include <functional>
 #include <memory>
 #include <optional>
@@ -56,6 +57,16 @@ using CmdRawCb = std::function<void(std::string_view data, bool error)>;
  */
 using CmdLineCb = std::function<void(std::string_view line, bool error)>;
 
+/*!
+ * \brief Multiplexed line output callback
+ *
+ * \note \a line follows the same rules as for CmdLineCb.
+ *
+ * \param index Index of the fd that \a line was read from
+ * \param line Line that was read
+ */
+using FdLineCb = std::function<void(size_t index, std::string_view line)>;
+
 struct CommandCtxPriv;
 
 struct CommandCtx
@@ -85,7 +96,11 @@ bool command_start(CommandCtx &ctx);
 int command_wait(CommandCtx &ctx);
 
 bool command_raw_reader(CommandCtx &ctx, const CmdRawCb &cb);
-bool command_line_reader(CommandCtx &ctx, const CmdLineCb &cb);
+bool command_line_reader(CommandCtx &ctx, const CmdLineCb &cb,
+                         std::optional<std::chrono::milliseconds> timeout = {});
+
+bool fd_line_reader(const std::vector<int> &fds, const FdLineCb &cb,
+                    std::optional<std::chrono::milliseconds> timeout = {});
 
 int run_command(const std::string &path,
                 const std::vector<std::string> &argv,
@@ -19,7 +19,12 @@
 
 #pragma once
 
+#include <atomic>
 #include <string>
+#include <utility>
+#include <vector>
+
+#include <cstdint>
 
 #include "mbcommon/flags.h"
 #include "mbcommon/outcome.h"
@@ -35,20 +40,46 @@ enum class CopyFlag : uint8_t
     CopyXattrs      = 1 << 1,
     ExcludeTopLevel = 1 << 2,
     FollowSymlinks  = 1 << 3,
+    // copy_dir(): Copy file contents concurrently on ThreadPool::global()
+    Parallel        = 1 << 4,
+    // Replace existing targets that are on the same filesystem as the source
+    // and have identical contents with hardlinks to the source. Only use this
+    // if neither copy is ever modified in place.
+    LinkIdentical   = 1 << 5,
 };
 MB_DECLARE_FLAGS(CopyFlags, CopyFlag)
 MB_DECLARE_OPERATORS_FOR_FLAGS(CopyFlags)
 
-oc::result<void> copy_data_fd(int fd_source, int fd_target);
+// Progress of a copy running on another thread. The counters are only ever
+// incremented. Setting `cancelled` makes the copy fail with
+// std::errc::operation_canceled as soon as the current chunk is written.
+struct CopyProgress
+{
+    // Bytes of file data copied (holes in sparse files count as copied)
+    std::atomic<uint64_t> bytes{0};
+    // Regular files fully copied
+    std::atomic<uint64_t> files{0};
+    std::atomic_bool cancelled{false};
+};
+
+oc::result<void> copy_data_fd(int fd_source, int fd_target,
+                              CopyProgress *progress = nullptr);
+oc::result<void> copy_xattrs_fd(int fd_source, int fd_target);
 FileOpResult<void> copy_xattrs(const std::string &source,
                                const std::string &target);
 FileOpResult<void> copy_stat(const std::string &source,
                              const std::string &target);
 FileOpResult<void> copy_contents(const std::string &source,
-                                 const std::string &target);
+                                 const std::string &target,
+                                 CopyProgress *progress = nullptr);
 FileOpResult<void> copy_file(const std::string &source,
-                             const std::string &target, CopyFlags flags);
+                             const std::string &target, CopyFlags flags,
+                             CopyProgress *progress = nullptr);
 FileOpResult<void> copy_dir(const std::string &source,
-                            const std::string &target, CopyFlags flags);
+                            const std::string &target, CopyFlags flags,
+                            CopyProgress *progress = nullptr);
+FileOpResult<void> copy_files(
+        const std::vector<std::pair<std::string, std::string>> &files,
+        CopyFlags flags, CopyProgress *progress = nullptr);
 
 }
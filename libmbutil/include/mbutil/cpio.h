@@ -0,0 +1,164 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <memory>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <cstdint>
+
+#include "mbcommon/file.h"
+#include "mbcommon/outcome.h"
+
+namespace mb::util
+{
+
+enum class CpioFormat
+{
+    // SVR4 portable format ("070701"). This is what the kernel unpacks.
+    Newc,
+    // SVR4 portable format with checksums ("070702")
+    Crc,
+    // POSIX.1 octet-oriented format ("070707")
+    Odc,
+};
+
+struct CpioHeader
+{
+    std::string path;
+    // File type and permission bits (S_IF* | perm)
+    uint32_t mode = 0;
+    uint32_t uid = 0;
+    uint32_t gid = 0;
+    uint32_t nlink = 1;
+    int64_t mtime = 0;
+    uint64_t ino = 0;
+    uint32_t dev_major = 0;
+    uint32_t dev_minor = 0;
+    uint32_t rdev_major = 0;
+    uint32_t rdev_minor = 0;
+    // Size of the data that follows the header. For symlinks, the data is the
+    // link target.
+    uint64_t size = 0;
+    // Sum of the data bytes (Crc format only)
+    uint32_t check = 0;
+};
+
+class CpioReader
+{
+public:
+    explicit CpioReader(File &file);
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(CpioReader)
+
+    oc::result<bool> next_header(CpioHeader &header);
+    oc::result<size_t> read_data(void *buf, size_t size);
+    oc::result<std::string> read_data_all();
+
+    std::optional<CpioFormat> format() const;
+
+private:
+    oc::result<void> skip_remaining();
+
+    File &m_file;
+    std::optional<CpioFormat> m_format;
+    // Unread data and padding of the current entry
+    uint64_t m_remain;
+    uint64_t m_padding;
+    bool m_eof;
+    // Running sum of the current entry's data (Crc format only)
+    uint32_t m_sum;
+    uint32_t m_expected_sum;
+};
+
+class CpioWriter
+{
+public:
+    CpioWriter(File &file, CpioFormat format);
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(CpioWriter)
+
+    oc::result<void> write_header(const CpioHeader &header);
+    oc::result<void> write_data(const void *buf, size_t size);
+    oc::result<void> finish();
+
+private:
+    oc::result<void> finish_entry();
+
+    File &m_file;
+    CpioFormat m_format;
+    uint64_t m_remain;
+    uint64_t m_padding;
+};
+
+class CpioArchive
+{
+public:
+    struct Entry
+    {
+        // File type and permission bits (S_IF* | perm)
+        uint32_t mode = 0;
+        uint32_t uid = 0;
+        uint32_t gid = 0;
+        int64_t mtime = 0;
+        uint32_t rdev_major = 0;
+        uint32_t rdev_minor = 0;
+        // Target of symlinks
+        std::string symlink;
+        // Contents of regular files. Regular files that share the same buffer
+        // are hardlinks. The buffer is only copied (breaking the link) when it
+        // is modified through edit().
+        std::shared_ptr<const std::string> data;
+    };
+
+    CpioArchive();
+
+    oc::result<void> load(File &file);
+    oc::result<void> save(File &file, CpioFormat format) const;
+
+    // Format of the archive that was last loaded
+    CpioFormat format() const;
+
+    size_t size() const;
+    std::vector<std::string> paths() const;
+
+    const Entry * find(const std::string &path) const;
+    std::optional<std::string> read_link(const std::string &path) const;
+
+    void insert(std::string path, Entry entry);
+    std::string * edit(const std::string &path);
+    void add_file(const std::string &path, std::string data, uint32_t perm);
+    void add_symlink(const std::string &path, const std::string &target);
+    bool rename(const std::string &from, const std::string &to);
+    bool remove(const std::string &path);
+
+    static std::string normalize_path(const std::string &path);
+
+private:
+    void add_parents(const std::string &path);
+
+    CpioFormat m_format;
+    std::unordered_map<std::string, Entry> m_entries;
+};
+
+}
@@ -19,8 +19,11 @@
 
 #pragma once
 
+#include <atomic>
 #include <string>
+#include <vector>
 
+#include "mbcommon/flags.h"
 #include "mbcommon/outcome.h"
 
 #include "mbutil/result/file_op_result.h"
@@ -28,6 +31,26 @@
 namespace mb::util
 {
 
-FileOpResult<void> delete_recursive(const std::string &path);
+enum class DeleteFlag : uint8_t
+{
+    // Remove subdirectories concurrently on ThreadPool::global()
+    Parallel        = 1 << 0,
+};
+MB_DECLARE_FLAGS(DeleteFlags, DeleteFlag)
+MB_DECLARE_OPERATORS_FOR_FLAGS(DeleteFlags)
+
+struct DeleteProgress
+{
+    // Files, symlinks and directories removed
+    std::atomic<uint64_t> entries{0};
+};
+
+FileOpResult<void> delete_recursive(const std::string &path,
+                                    DeleteFlags flags = {},
+                                    DeleteProgress *progress = nullptr);
+FileOpResult<void> delete_contents(const std::string &path,
+                                   const std::vector<std::string> &exclusions,
+                                   DeleteFlags flags = {},
+                                   DeleteProgress *progress = nullptr);
 
 }
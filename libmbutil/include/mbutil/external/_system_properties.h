@@ -97,6 +97,15 @@ int __system_property_area_init();
 */
 uint32_t __system_property_area_serial();
 
+/* Look up several properties at once. results[i] is set to the prop_info for
+** names[i], or nullptr if it doesn't exist. The lookups share a single read of
+** the area serial and go through the same cache as __system_property_find.
+**
+** Returns the number of properties that were found.
+*/
+size_t __system_property_find_batch(const char* const* names, size_t count,
+                                    const prop_info** results);
+
 /* Add a new system property.  Can only be done by a single
 ** process that has write access to the property area, and
 ** that process must handle sequencing to ensure the property
@@ -22,19 +22,38 @@
 #include <string>
 #include <vector>
 
+#include <cstdint>
+
+#include "mbcommon/file.h"
+#include "mbcommon/flags.h"
 #include "mbcommon/outcome.h"
 
 namespace mb::util
 {
 
+enum class ZeroRangeFlag : uint8_t
+{
+    // Free the blocks of regular files instead of keeping them allocated
+    Deallocate = 1 << 0,
+};
+MB_DECLARE_FLAGS(ZeroRangeFlags, ZeroRangeFlag)
+MB_DECLARE_OPERATORS_FOR_FLAGS(ZeroRangeFlags)
+
 oc::result<void> create_empty_file(const std::string &path);
 oc::result<std::string> file_first_line(const std::string &path);
 oc::result<void> file_write_data(const std::string &path,
                                  const void *data, size_t size);
+oc::result<uint64_t> file_write_changed_data(const std::string &path,
+                                             const void *data, size_t size);
+oc::result<uint64_t> file_write_changed_data(const std::string &path,
+                                             File &source, uint64_t size);
 oc::result<bool> file_find_one_of(const std::string &path,
                                   const std::vector<std::string> &items);
 oc::result<std::string> file_read_all(const std::string &path);
 
+oc::result<void> zero_range(int fd, uint64_t offset, uint64_t size,
+                            ZeroRangeFlags flags = {});
+
 oc::result<uint64_t> get_blockdev_size(const std::string &path);
 
 }
@@ -23,6 +23,7 @@
 #include <vector>
 
 #include <fts.h>
+#include <sys/stat.h>
 
 #include "mbcommon/flags.h"
 
@@ -37,10 +38,35 @@ enum class FtsFlag : uint8_t
     CrossMountPointBoundaries   = 1 << 1,
     // Call on_reached_special_file() instead of separate functions
     GroupSpecialFiles           = 1 << 2,
+    // Don't stat() non-directories if the directory entry already says what
+    // type of file it is. fts_statp will be null for those entries.
+    NoStat                      = 1 << 3,
 };
 MB_DECLARE_FLAGS(FtsFlags, FtsFlag)
 MB_DECLARE_OPERATORS_FOR_FLAGS(FtsFlags)
 
+// Entry passed to the FtsWrapper hooks. The fields have the same names and
+// meaning as the ones in FTSENT from <fts.h> (with FTS_NOCHDIR). The pointers
+// are only valid until the hook returns, except for the root entry, which
+// remains valid for the entire traversal.
+struct FtsEntry
+{
+    // Path of the file, starting with the path passed to the constructor
+    char *fts_path;
+    // Same as fts_path
+    char *fts_accpath;
+    // Filename (empty for the root if the path ends in a slash)
+    char *fts_name;
+    // File information (may be null with FtsFlag::NoStat)
+    struct stat *fts_statp;
+    // Depth of the entry (0 for the root)
+    int fts_level;
+    // One of the FTS_* constants from <fts.h>
+    int fts_info;
+    // errno value if fts_info is FTS_DNR, FTS_ERR, or FTS_NS
+    int fts_errno;
+};
+
 class FtsWrapper
 {
 public:
@@ -86,19 +112,51 @@ protected:
     std::string _path;
     // Input flags
     FtsFlags _flags;
-    // fts pointer
-    FTS *_ftsp;
-    // Current fts entry
-    FTSENT *_curr;
-    // Root (level 0) fts entry
-    FTSENT *_root;
+    // Current entry
+    FtsEntry *_curr;
+    // Root (level 0) entry
+    FtsEntry *_root;
     // Error message (valid only if run() returned false)
     std::string _error_msg;
 
 private:
+    enum class Walk : uint8_t
+    {
+        Continue,
+        Skip,
+        Stop,
+    };
+
+    struct Ancestor
+    {
+        dev_t dev;
+        ino_t ino;
+    };
+
+    Walk dispatch(FtsEntry &entry);
+    Walk walk(int parent_fd, const char *name, unsigned char d_type,
+              size_t name_offset, int level);
+    bool read_dir(int fd, std::vector<char> &entries);
+    void set_entry_path(FtsEntry &entry, size_t name_offset);
+
     bool _ran;
+    bool _ret;
+    dev_t _root_dev;
+    // Path of the current entry
+    std::string _pathbuf;
+    // Storage for the root entry
+    std::string _root_path;
+    struct stat _root_sb;
+    FtsEntry _root_entry;
+    // Directories being traversed (for detecting cycles with FollowSymlinks)
+    std::vector<Ancestor> _ancestors;
+    // Buffer for getdents64()
+    std::vector<char> _dents_buf;
 };
 
 MB_DECLARE_OPERATORS_FOR_FLAGS(FtsWrapper::Actions)
 
+bool read_dir_entries(int fd, std::vector<char> &buf,
+                      std::vector<char> &entries);
+
 }
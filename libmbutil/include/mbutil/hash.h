@@ -21,9 +21,11 @@
 
 #include <array>
 #include <string>
+#include <vector>
 
 #include <openssl/sha.h>
 
+#include "mbcommon/file.h"
 #include "mbcommon/outcome.h"
 
 namespace mb::util
@@ -32,5 +34,8 @@ namespace mb::util
 using Sha512Digest = std::array<unsigned char, SHA512_DIGEST_LENGTH>;
 
 oc::result<Sha512Digest> sha512_hash(const std::string &path);
+oc::result<Sha512Digest> sha512_hash(File &file);
+std::vector<oc::result<Sha512Digest>>
+sha512_hash_files(const std::vector<std::string> &paths);
 
 }
@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+
+#include "mbcommon/outcome.h"
+
+#include "mbutil/hash.h"
+
+namespace mb::util
+{
+
+class HashCache
+{
+public:
+    HashCache();
+
+    oc::result<void> load(const std::string &path);
+    oc::result<void> save(const std::string &path) const;
+
+    std::optional<Sha512Digest> find(const struct stat &sb) const;
+    void insert(const struct stat &sb, const Sha512Digest &digest);
+
+    oc::result<Sha512Digest> sha512_hash(const std::string &path);
+
+    bool dirty() const;
+
+    static bool same_metadata(const struct stat &a, const struct stat &b);
+
+private:
+    struct Key
+    {
+        uint64_t dev;
+        uint64_t ino;
+        uint64_t size;
+        int64_t mtime_sec;
+        int64_t ctime_sec;
+        uint32_t mtime_nsec;
+        uint32_t ctime_nsec;
+
+        bool operator==(const Key &other) const;
+    };
+
+    struct Entry
+    {
+        Key key;
+        Sha512Digest digest;
+    };
+
+    static Key key_for(const struct stat &sb);
+
+    // Oldest entries first
+    std::vector<Entry> _entries;
+    bool _dirty;
+};
+
+}
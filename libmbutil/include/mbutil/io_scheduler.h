@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include <sys/types.h>
+
+#include "mbcommon/common.h"
+#include "mbcommon/outcome.h"
+
+namespace mb::util
+{
+
+// Upper bound for the number of concurrent bulk operations on one disk
+constexpr unsigned int IO_MAX_BULK_PER_DEVICE = 4;
+
+oc::result<dev_t> io_backing_device(const std::string &path);
+unsigned int io_device_concurrency(dev_t disk);
+
+oc::result<void> io_set_bulk_priority();
+
+class IoScheduler
+{
+public:
+    class Ticket
+    {
+    public:
+        Ticket();
+        ~Ticket();
+
+        Ticket(Ticket &&other) noexcept;
+        Ticket & operator=(Ticket &&rhs) noexcept;
+
+        MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(Ticket)
+
+        void release();
+
+    private:
+        friend class IoScheduler;
+
+        IoScheduler *m_scheduler;
+        dev_t m_disk;
+        // Thread I/O priority to restore on release, or -1
+        int m_old_ioprio;
+    };
+
+    IoScheduler();
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(IoScheduler)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(IoScheduler)
+
+    Ticket acquire_bulk(const std::string &path);
+
+    void set_device_limit(dev_t disk, unsigned int limit);
+    unsigned int device_limit(dev_t disk);
+
+    static IoScheduler & instance();
+
+private:
+    struct Device
+    {
+        unsigned int limit = 0;
+        unsigned int active = 0;
+    };
+
+    Device & device(dev_t disk);
+    void release(dev_t disk);
+
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::unordered_map<dev_t, Device> m_devices;
+};
+
+}
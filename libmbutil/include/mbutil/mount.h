@@ -21,6 +21,10 @@
 
 #include <optional>
 #include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <sys/types.h>
 
 #include "mbcommon/outcome.h"
 
@@ -62,6 +66,39 @@ struct MountEntry
     std::optional<int> passno;
 };
 
+class MountTable
+{
+public:
+    MountTable();
+    ~MountTable();
+
+    MountTable(const MountTable &) = delete;
+    MountTable & operator=(const MountTable &) = delete;
+
+    oc::result<void> refresh();
+
+    const std::vector<MountEntry> & entries() const;
+
+    const MountEntry * find_by_target(const std::string &target) const;
+    std::vector<const MountEntry *>
+    find_by_source(const std::string &source) const;
+
+private:
+    oc::result<void> open_mountinfo(ino_t ns_ino);
+    oc::result<bool> changed();
+    oc::result<void> parse();
+
+    int _fd;
+    // Process and mount namespace that _fd was opened in
+    pid_t _pid;
+    ino_t _ns_ino;
+
+    std::vector<MountEntry> _entries;
+    // Index of the topmost mount for each mount point
+    std::unordered_map<std::string, size_t> _by_target;
+    std::unordered_multimap<std::string, size_t> _by_source;
+};
+
 oc::result<std::vector<MountEntry>> get_mount_entries();
 
 oc::result<void> is_mounted(const std::string &mountpoint);
@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstdint>
+
+#include "mbcommon/common.h"
+
+namespace mb::util
+{
+
+enum class StreamDirection
+{
+    Read,
+    Write,
+};
+
+class StreamCache
+{
+public:
+    // Amount of data that is read ahead, written back, or dropped at once
+    static constexpr uint64_t WINDOW_SIZE = 8 * 1024 * 1024;
+
+    StreamCache();
+    StreamCache(int fd, StreamDirection direction, uint64_t offset = 0);
+    ~StreamCache();
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(StreamCache)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(StreamCache)
+
+    void reset(int fd, StreamDirection direction, uint64_t offset = 0);
+
+    void advance(uint64_t offset);
+    void advance();
+
+    void finish();
+
+private:
+    int m_fd;
+    StreamDirection m_direction;
+    // Start of the range whose pages have not been dropped yet
+    uint64_t m_dropped;
+    // Start of the range that has not been written back or read ahead yet
+    uint64_t m_flushed;
+    // End of the range that has been processed
+    uint64_t m_end;
+};
+
+}
@@ -24,10 +24,21 @@
 #include <string>
 #include <string_view>
 #include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <cstdint>
+
+#include <sys/stat.h>
 
 #include "mbcommon/integer.h"
 
 
+namespace mb
+{
+struct prop_info;
+}
+
 namespace mb::util
 {
 
@@ -44,6 +55,8 @@ using PropertiesMap = std::unordered_map<std::string, std::string>;
 // Helper functions
 
 std::optional<std::string> property_get(const std::string &key);
+std::vector<std::optional<std::string>>
+property_get_multiple(const std::vector<std::string> &keys);
 std::string property_get_string(const std::string &key,
                                 const std::string &default_value);
 bool property_get_bool(const std::string &key, bool default_value);
@@ -68,6 +81,40 @@ bool property_iter(const std::function<PropertyIterCb> &fn);
 
 std::optional<PropertiesMap> property_get_all();
 
+class PropertySnapshot
+{
+public:
+    struct Entry
+    {
+        std::string key;
+        std::string value;
+    };
+
+    using const_iterator = std::vector<Entry>::const_iterator;
+
+    PropertySnapshot();
+
+    bool refresh();
+
+    std::optional<std::string_view> get(const std::string &key) const;
+
+    const_iterator begin() const;
+    const_iterator end() const;
+    size_t size() const;
+
+    PropertiesMap to_map() const;
+
+private:
+    // Serial of the property area at the last refresh
+    uint32_t _area_serial;
+    bool _loaded;
+    std::vector<Entry> _entries;
+    // Serial of each entry's value, in the same order as _entries
+    std::vector<uint32_t> _serials;
+    std::unordered_map<const prop_info *, size_t> _by_info;
+    std::unordered_map<std::string, size_t> _by_key;
+};
+
 // Properties file functions
 
 std::optional<std::string> property_file_get(const std::string &path,
@@ -100,4 +147,69 @@ std::optional<PropertiesMap> property_file_get_all(const std::string &path);
 
 bool property_file_write_all(const std::string &path, const PropertiesMap &map);
 
+class PropertyFile
+{
+public:
+    using Entry = std::pair<std::string_view, std::string_view>;
+    using const_iterator = std::vector<Entry>::const_iterator;
+
+    PropertyFile();
+    ~PropertyFile();
+
+    PropertyFile(PropertyFile &&other) noexcept;
+    PropertyFile & operator=(PropertyFile &&rhs) noexcept;
+
+    PropertyFile(const PropertyFile &) = delete;
+    PropertyFile & operator=(const PropertyFile &) = delete;
+
+    bool load(const std::string &path, std::string_view filter = {});
+
+    bool is_current() const;
+
+    std::optional<std::string_view> get(std::string_view key) const;
+    std::string get_string(std::string_view key,
+                           const std::string &default_value) const;
+    bool get_bool(std::string_view key, bool default_value) const;
+
+    template<typename IntType>
+    IntType get_num(std::string_view key, IntType default_value) const
+    {
+        if (auto value = get(key)) {
+            IntType result;
+            if (str_to_num(std::string(*value).c_str(), 10, result)) {
+                return result;
+            }
+        }
+
+        return default_value;
+    }
+
+    const_iterator begin() const;
+    const_iterator end() const;
+    size_t size() const;
+
+    PropertiesMap to_map() const;
+
+private:
+    struct Mapping
+    {
+        std::string path;
+        void *data;
+        size_t size;
+        dev_t dev;
+        ino_t ino;
+        struct timespec mtime;
+        off_t file_size;
+    };
+
+    bool load_impl(const std::string &path, std::string_view filter);
+    void clear();
+
+    std::vector<Mapping> _mappings;
+    // Entries in file order, including those from imported files
+    std::vector<Entry> _entries;
+    // First entry for each key
+    std::unordered_map<std::string_view, size_t> _lookup;
+};
+
 }
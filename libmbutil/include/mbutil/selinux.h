@@ -20,9 +20,11 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 
 #include <sepol/policydb/policydb.h>
 
+#include "mbcommon/flags.h"
 #include "mbcommon/outcome.h"
 
 namespace mb::util
@@ -46,8 +48,23 @@ enum class SELinuxAttr
     SockCreate,
 };
 
+enum class SELinuxRelabelFlag : uint8_t
+{
+    // Set the context of symlink targets instead of the symlinks themselves
+    FollowSymlinks  = 1 << 0,
+    // Relabel directories concurrently on ThreadPool::global()
+    Parallel        = 1 << 1,
+    // Skip trees marked by a previous relabel to the same context
+    SkipMarked      = 1 << 2,
+};
+MB_DECLARE_FLAGS(SELinuxRelabelFlags, SELinuxRelabelFlag)
+MB_DECLARE_OPERATORS_FOR_FLAGS(SELinuxRelabelFlags)
+
 bool selinux_read_policy(const std::string &path, policydb_t *pdb);
 bool selinux_write_policy(const std::string &path, policydb_t *pdb);
+bool selinux_policy_to_image(policydb_t *pdb, std::string &image);
+bool selinux_write_policy_image(const std::string &path,
+                                std::string_view image);
 oc::result<std::string> selinux_get_context(const std::string &path);
 oc::result<std::string> selinux_lget_context(const std::string &path);
 oc::result<std::string> selinux_fget_context(int fd);
@@ -60,6 +77,9 @@ oc::result<void> selinux_set_context_recursive(const std::string &path,
                                                const std::string &context);
 oc::result<void> selinux_lset_context_recursive(const std::string &path,
                                                 const std::string &context);
+oc::result<void> selinux_relabel_recursive(const std::string &path,
+                                           const std::string &context,
+                                           SELinuxRelabelFlags flags = {});
 oc::result<bool> selinux_get_enforcing();
 oc::result<void> selinux_set_enforcing(bool value);
 oc::result<std::string> selinux_get_process_attr(pid_t pid, SELinuxAttr attr);
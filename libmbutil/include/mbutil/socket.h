@@ -52,4 +52,58 @@ oc::result<void> socket_write_string_array(int fd, const std::vector<std::string
 oc::result<void> socket_receive_fds(int fd, std::vector<int> &fds);
 oc::result<void> socket_send_fds(int fd, const std::vector<int> &fds);
 
+class SocketWriter
+{
+public:
+    SocketWriter();
+
+    void write(const void *data, size_t size);
+    oc::result<void> write_bytes(const void *data, size_t len);
+    void write_uint16(uint16_t n);
+    void write_uint32(uint32_t n);
+    void write_uint64(uint64_t n);
+    void write_int16(int16_t n);
+    void write_int32(int32_t n);
+    void write_int64(int64_t n);
+    oc::result<void> write_string(const std::string &str);
+    oc::result<void> write_string_array(const std::vector<std::string> &list);
+
+    oc::result<void> flush(int fd);
+    void clear();
+
+    const unsigned char * data() const;
+    size_t size() const;
+
+private:
+    std::vector<unsigned char> _buf;
+};
+
+class SocketReader
+{
+public:
+    explicit SocketReader(int fd);
+
+    oc::result<size_t> read(void *buf, size_t size);
+    oc::result<std::vector<unsigned char>> read_bytes();
+    oc::result<uint16_t> read_uint16();
+    oc::result<uint32_t> read_uint32();
+    oc::result<uint64_t> read_uint64();
+    oc::result<int16_t> read_int16();
+    oc::result<int32_t> read_int32();
+    oc::result<int64_t> read_int64();
+    oc::result<std::string> read_string();
+    oc::result<std::vector<std::string>> read_string_array();
+
+    size_t buffered() const;
+
+private:
+    template<typename T>
+    oc::result<T> read_value();
+
+    int _fd;
+    std::vector<unsigned char> _buf;
+    size_t _begin;
+    size_t _end;
+};
+
 }
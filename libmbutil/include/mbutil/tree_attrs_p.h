@@ -0,0 +1,51 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <optional>
+#include <string>
+
+#include <sys/types.h>
+
+#include "mbcommon/outcome.h"
+
+// Internal header shared by chmod.cpp and chown.cpp
+
+namespace mb::util::detail
+{
+
+struct TreeAttrs
+{
+    // Permission bits to set on everything except symlinks
+    std::optional<mode_t> mode;
+    // Owner and group to set (unset values are left unchanged)
+    std::optional<uid_t> uid;
+    std::optional<gid_t> gid;
+    // Change the owner of symlink targets instead of the symlinks themselves
+    bool follow_symlinks = false;
+    // Process directories concurrently on a pool of worker threads
+    bool parallel = false;
+};
+
+oc::result<void> set_tree_attrs(const std::string &path,
+                                const TreeAttrs &attrs);
+
+}
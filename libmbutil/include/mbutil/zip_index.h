@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <ctime>
+
+#include <sys/stat.h>
+
+#include "mbcommon/outcome.h"
+
+#include "mbutil/result/file_op_result.h"
+
+namespace mb::util
+{
+
+class ZipIndex
+{
+public:
+    struct Entry
+    {
+        std::string name;
+        uint64_t local_header_offset;
+        uint64_t compressed_size;
+        uint64_t uncompressed_size;
+        uint32_t crc32;
+        uint16_t flags;
+        uint16_t method;
+        mode_t mode;
+        time_t mtime;
+
+        bool is_dir() const;
+        bool is_supported() const;
+    };
+
+    using ExtractList = std::vector<std::pair<const Entry *, std::string>>;
+
+    ZipIndex();
+
+    oc::result<void> load(const std::string &path);
+
+    const std::string & path() const;
+    const struct stat & file_stat() const;
+    const std::vector<Entry> & entries() const;
+
+    const Entry * find(const std::string &name) const;
+    uint64_t local_header_offset(const Entry &entry) const;
+
+    FileOpResult<void> extract(const Entry &entry,
+                               const std::string &target) const;
+    FileOpResult<void> extract(const ExtractList &list) const;
+
+private:
+    std::string _path;
+    struct stat _sb;
+    // Number of bytes preceding the zip data (eg. for self-extracting zips)
+    uint64_t _base;
+    std::vector<Entry> _entries;
+    std::unordered_map<std::string, size_t> _lookup;
+};
+
+}
@@ -20,17 +20,46 @@
 #include "mbutil/archive.h"
 
 #include <algorithm>
-#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <optional>
+#include <string_view>
+#include <thread>
 #include <cerrno>
+#include <cinttypes>
+#include <cstdio>
 #include <cstring>
 
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <lz4frame.h>
+#include <zlib.h>
+
+#include "mbcommon/common.h"
+#include "mbcommon/file/mmap.h"
 #include "mbcommon/file/standard.h"
 #include "mbcommon/finally.h"
+#include "mbcommon/perf.h"
 #include "mbcommon/string.h"
+#include "mbcommon/thread_pool.h"
 #include "mblog/logging.h"
+#include "mbutil/copy.h"
+#include "mbutil/delete.h"
 #include "mbutil/directory.h"
+#include "mbutil/fts.h"
+#include "mbutil/hash_cache.h"
+#include "mbutil/page_cache.h"
 #include "mbutil/path.h"
+#include "mbutil/zip_index.h"
 
 #define LOG_TAG "mbutil/archive"
 
@@ -53,9 +82,13 @@ namespace mb::util
 {
 
 using ScopedArchive = std::unique_ptr<archive, decltype(archive_free) *>;
+using ScopedFILE = std::unique_ptr<FILE, decltype(fclose) *>;
 using ScopedLinkResolver = std::unique_ptr<archive_entry_linkresolver,
         decltype(archive_entry_linkresolver_free) *>;
 
+static perf::Counter g_bytes_archived("util.archive.bytes_archived");
+static perf::Counter g_bytes_extracted("util.archive.bytes_extracted");
+
 int libarchive_copy_data(archive *in, archive *out, archive_entry *entry)
 {
     const void *buff;
@@ -70,6 +103,8 @@ int libarchive_copy_data(archive *in, archive *out, archive_entry *entry)
                  archive_error_string(out));
             return ARCHIVE_FAILED;
         }
+
+        g_bytes_extracted.add(size);
     }
 
     if (ret != ARCHIVE_EOF) {
@@ -87,7 +122,8 @@ int libarchive_copy_data(archive *in, archive *out, archive_entry *entry)
  * \see tar/write.c from libarchive's source code
  */
 bool libarchive_copy_data_disk_to_archive(archive *in, archive *out,
-                                          archive_entry *entry)
+                                          archive_entry *entry,
+                                          CopyProgress *progress_out)
 {
     size_t bytes_read;
     ssize_t bytes_written;
@@ -124,6 +160,13 @@ bool libarchive_copy_data_disk_to_archive(archive *in, archive *out,
 
                 progress += bytes_written;
                 sparse -= bytes_written;
+                g_bytes_archived.add(static_cast<uint64_t>(bytes_written));
+
+                if (progress_out) {
+                    progress_out->bytes.fetch_add(
+                            static_cast<uint64_t>(bytes_written),
+                            std::memory_order_relaxed);
+                }
             }
         }
 
@@ -140,6 +183,12 @@ bool libarchive_copy_data_disk_to_archive(archive *in, archive *out,
         }
 
         progress += bytes_written;
+        g_bytes_archived.add(static_cast<uint64_t>(bytes_written));
+
+        if (progress_out) {
+            progress_out->bytes.fetch_add(static_cast<uint64_t>(bytes_written),
+                                          std::memory_order_relaxed);
+        }
     }
 
     if (ret != ARCHIVE_EOF) {
@@ -167,10 +216,212 @@ int libarchive_copy_header_and_data(archive *in, archive *out,
     return ret;
 }
 
+static void la_set_error(archive *a, std::error_code ec)
+{
+    archive_set_error(a, ec.value(), "%s", ec.message().c_str());
+}
+
+static la_ssize_t la_block_read_cb(archive *a, void *userdata,
+                                   const void **buffer)
+{
+    auto *reader = static_cast<BlockReader *>(userdata);
+
+    auto n = reader->read(buffer);
+    if (!n) {
+        la_set_error(a, n.error());
+        return -1;
+    }
+
+    return static_cast<la_ssize_t>(n.value());
+}
+
+static la_int64_t la_block_skip_cb(archive *a, void *userdata,
+                                   la_int64_t request)
+{
+    auto *reader = static_cast<BlockReader *>(userdata);
+
+    auto n = reader->skip(static_cast<uint64_t>(request));
+    if (!n) {
+        la_set_error(a, n.error());
+        return ARCHIVE_FATAL;
+    }
+
+    return static_cast<la_int64_t>(n.value());
+}
+
+static la_int64_t la_block_seek_cb(archive *a, void *userdata,
+                                   la_int64_t offset, int whence)
+{
+    auto *reader = static_cast<BlockReader *>(userdata);
+
+    auto n = reader->seek(offset, whence);
+    if (!n) {
+        la_set_error(a, n.error());
+        return ARCHIVE_FATAL;
+    }
+
+    return static_cast<la_int64_t>(n.value());
+}
+
+/*!
+ * \brief Open an archive for reading from a BlockReader
+ *
+ * Unlike archive_read_open_filename(), which reads in 10 KiB blocks and reads
+ * through any data that is skipped, the data is fed to libarchive in blocks of
+ * BlockReader::block_size() bytes and skipped entries are seeked over. With a
+ * memory mapped file, no data is copied before libarchive parses it. The seek
+ * callback is also registered, so archive_read_support_format_zip_seekable()
+ * can jump straight to the central directory.
+ *
+ * \param a libarchive reader
+ * \param reader BlockReader to read from. It must outlive the archive.
+ *
+ * \return Return value of archive_read_open1()
+ */
+int libarchive_open_reader(archive *a, BlockReader &reader)
+{
+    archive_read_set_callback_data(a, &reader);
+    archive_read_set_read_callback(a, &la_block_read_cb);
+    archive_read_set_skip_callback(a, &la_block_skip_cb);
+    archive_read_set_seek_callback(a, &la_block_seek_cb);
+    return archive_read_open1(a);
+}
+
+// File opened by libarchive_open_file(). Freed by the close callback.
+struct ArchiveFileSource : BlockReader
+{
+    std::unique_ptr<File> file;
+};
+
+static int la_file_source_close_cb(archive *a, void *userdata)
+{
+    (void) a;
+    delete static_cast<ArchiveFileSource *>(static_cast<BlockReader *>(userdata));
+    return ARCHIVE_OK;
+}
+
+/*!
+ * \brief Open an archive for reading from a file
+ *
+ * This is a replacement for archive_read_open_filename(). The file is memory
+ * mapped if possible so that libarchive parses the page cache directly. If the
+ * file cannot be mapped (eg. it does not fit in the address space), it is read
+ * in blocks of \p block_size bytes instead. Either way, skipped entries are
+ * seeked over and never read. See libarchive_open_reader().
+ *
+ * \param a libarchive reader
+ * \param filename Path to archive
+ * \param block_size Size of the blocks passed to libarchive
+ *
+ * \return Return value of archive_read_open1()
+ */
+int libarchive_open_file(archive *a, const std::string &filename,
+                         size_t block_size)
+{
+    auto source = std::make_unique<ArchiveFileSource>();
+
+    if (auto file = std::make_unique<MmapFile>(); file->open(filename)) {
+        source->file = std::move(file);
+    } else {
+        auto std_file = std::make_unique<StandardFile>();
+
+        if (auto r = std_file->open(filename, FileOpenMode::ReadOnly); !r) {
+            la_set_error(a, r.error());
+            return ARCHIVE_FATAL;
+        }
+
+        source->file = std::move(std_file);
+    }
+
+    source->reset(source->file.get(), block_size);
+
+    archive_read_set_close_callback(a, &la_file_source_close_cb);
+
+    return libarchive_open_reader(a, *source.release());
+}
+
+static la_ssize_t la_entry_read_cb(archive *a, void *userdata,
+                                   const void **buffer)
+{
+    // Returned for sparse holes in the parent entry
+    static const char zeros[65536] = {};
+
+    auto *source = static_cast<ArchiveEntrySource *>(userdata);
+
+    // Returning 0 means EOF, so keep going until there's something to return
+    while (source->pending_offset + source->pending_size <= source->offset) {
+        const void *block;
+        size_t size;
+        la_int64_t offset;
+
+        int ret = archive_read_data_block(source->parent, &block, &size,
+                                          &offset);
+        if (ret == ARCHIVE_EOF) {
+            return 0;
+        } else if (ret < ARCHIVE_WARN) {
+            archive_copy_error(a, source->parent);
+            return -1;
+        } else if (offset < 0
+                || static_cast<uint64_t>(offset) < source->offset) {
+            archive_set_error(a, EINVAL,
+                              "Invalid offset in parent entry: %" PRId64,
+                              static_cast<int64_t>(offset));
+            return -1;
+        }
+
+        source->pending = block;
+        source->pending_size = size;
+        source->pending_offset = static_cast<uint64_t>(offset);
+    }
+
+    size_t n;
+
+    if (source->pending_offset > source->offset) {
+        n = static_cast<size_t>(std::min<uint64_t>(
+                source->pending_offset - source->offset, sizeof(zeros)));
+        *buffer = zeros;
+    } else {
+        n = source->pending_size;
+        *buffer = source->pending;
+    }
+
+    source->offset += n;
+
+    return static_cast<la_ssize_t>(n);
+}
+
+/*!
+ * \brief Open an archive for reading from the current entry of another archive
+ *
+ * The blocks returned by archive_read_data_block() on \p parent are passed
+ * through without being copied into an intermediate buffer. Sparse holes are
+ * filled with zeros.
+ *
+ * \param a libarchive reader
+ * \param source Read state. It must outlive the archive.
+ * \param parent Archive whose current entry is read
+ *
+ * \return Return value of archive_read_open1()
+ */
+int libarchive_open_entry(archive *a, ArchiveEntrySource &source,
+                          archive *parent)
+{
+    source = {};
+    source.parent = parent;
+
+    archive_read_set_callback_data(a, &source);
+    archive_read_set_read_callback(a, &la_entry_read_cb);
+    return archive_read_open1(a);
+}
+
 struct SplitCtx
 {
     // Current file
     StandardFile file;
+    // Offset in the current file
+    uint64_t offset = 0;
+    // The archive is streamed once, so keep it out of the page cache
+    StreamCache cache;
     // Base path if split. Otherwise, the exact file path
     std::string path;
     // Current split file. -1 to disable splitting
@@ -189,20 +440,28 @@ struct SplitCtx
         return split_num >= 0;
     }
 
+    std::string current_filename()
+    {
+        std::string filename(path);
+        if (is_split()) {
+            filename += format(".%d", split_num);
+        }
+        return filename;
+    }
+
     oc::result<void> open_if_needed(FileOpenMode mode)
     {
         if (need_open) {
             if (file.is_open()) {
+                cache.reset(-1, StreamDirection::Read);
                 OUTCOME_TRYV(file.close());
             }
 
-            std::string filename(path);
-            if (is_split()) {
-                filename += format(".%d", split_num);
-            }
-
-            OUTCOME_TRYV(file.open(filename, mode));
+            OUTCOME_TRYV(file.open(current_filename(), mode));
 
+            offset = 0;
+            cache.reset(file.native_fd(), mode == FileOpenMode::ReadOnly
+                        ? StreamDirection::Read : StreamDirection::Write);
             need_open = false;
         }
 
@@ -225,6 +484,8 @@ struct SplitCtx
         auto *ctx = static_cast<SplitCtx *>(userdata);
 
         if (ctx->file.is_open()) {
+            ctx->cache.finish();
+
             if (auto r = ctx->file.close(); !r) {
                 set_archive_error(a, r.error());
                 return ARCHIVE_FATAL;
@@ -237,14 +498,17 @@ struct SplitCtx
 
 struct SplitReaderCtx : SplitCtx
 {
-    // Read buffer
-    std::array<char, 10240> buf;
+    BlockReader reader;
 
     SplitReaderCtx(std::string path, bool is_split)
         : SplitCtx(std::move(path), is_split)
+        , reader(&file)
     {
     }
 
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(SplitReaderCtx)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(SplitReaderCtx)
+
     static la_ssize_t la_read_cb(archive *a, void *userdata,
                                  const void **buffer)
     {
@@ -260,7 +524,7 @@ struct SplitReaderCtx : SplitCtx
                 }
             }
 
-            auto n = ctx->file.read(ctx->buf.data(), ctx->buf.size());
+            auto n = ctx->reader.read(buffer);
             if (!n) {
                 set_archive_error(a, n.error());
                 return -1;
@@ -271,192 +535,1187 @@ struct SplitReaderCtx : SplitCtx
                 continue;
             }
 
-            *buffer = ctx->buf.data();
+            ctx->offset += n.value();
+            ctx->cache.advance(ctx->offset);
+
             return static_cast<la_ssize_t>(n.value());
         }
     }
 
+    // Skips never cross into the next split file. libarchive reads the
+    // remainder of the request instead.
+    static la_int64_t la_skip_cb(archive *a, void *userdata,
+                                 la_int64_t request)
+    {
+        auto *ctx = static_cast<SplitReaderCtx *>(userdata);
+        auto size = static_cast<uint64_t>(request);
+
+        if (ctx->need_open) {
+            return 0;
+        }
+
+        if (ctx->is_split()) {
+            struct stat sb;
+            if (fstat(ctx->file.native_fd(), &sb) < 0) {
+                return 0;
+            }
+
+            auto file_size = static_cast<uint64_t>(sb.st_size);
+            size = std::min(size, file_size > ctx->offset
+                            ? file_size - ctx->offset : 0);
+        }
+
+        auto n = ctx->reader.skip(size);
+        if (!n) {
+            set_archive_error(a, n.error());
+            return ARCHIVE_FATAL;
+        }
+
+        ctx->offset += n.value();
+        ctx->cache.advance(ctx->offset);
+
+        return static_cast<la_int64_t>(n.value());
+    }
+
     int archive_open(archive *a)
     {
-        return archive_read_open(a, this, nullptr, &la_read_cb, &la_close_cb);
+        return archive_read_open2(a, this, nullptr, &la_read_cb, &la_skip_cb,
+                                  &la_close_cb);
     }
 };
 
-struct SplitWriterCtx : SplitCtx
+// Compresses a stream in fixed-size blocks on a pool of worker threads. Each
+// block becomes an independent gzip member or lz4 frame. Concatenated gzip
+// members and lz4 frames are valid input for the gzip and lz4 tools and for
+// libarchive, so the output is no different to consumers than that of
+// libarchive's own single-threaded filters.
+class ParallelCompressor
 {
-    // Bytes written for current file
-    uint64_t bytes_written;
-    // Max size of split files
-    uint64_t max_size;
+public:
+    using Sink = std::function<oc::result<void>(const void *, size_t)>;
 
-    SplitWriterCtx(std::string path, uint64_t max_size)
-        : SplitCtx(std::move(path), max_size > 0)
-        , bytes_written(0)
-        , max_size(max_size)
+    ParallelCompressor(CompressionType type, Sink sink)
+        : _type(type)
+        , _sink(std::move(sink))
+        , _done(false)
     {
-    }
+        auto n_threads = thread_count(MIN_THREADS, MAX_THREADS);
 
-    static la_ssize_t la_write_cb(archive *a, void *userdata, const void *data,
-                                  size_t size)
-    {
-        auto *ctx = static_cast<SplitWriterCtx *>(userdata);
+        for (unsigned int i = 0; i < n_threads; ++i) {
+            _threads.emplace_back(&ParallelCompressor::worker, this);
+        }
 
-        const char *ptr = static_cast<const char *>(data);
-        size_t remain = size;
+        _max_pending = 2 * n_threads;
+        _current.reserve(BLOCK_SIZE);
+    }
 
-        while (remain > 0) {
-            if (auto r = ctx->open_if_needed(FileOpenMode::WriteOnly); !r) {
-                set_archive_error(a, r.error());
-                return -1;
-            }
+    ~ParallelCompressor()
+    {
+        stop();
+    }
 
-            auto to_write = static_cast<size_t>(std::min<uint64_t>(
-                    remain,
-                    ctx->is_split()
-                    ? (ctx->max_size - ctx->bytes_written)
-                    : remain));
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(ParallelCompressor)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(ParallelCompressor)
 
-            auto n = ctx->file.write(ptr, to_write);
-            if (!n) {
-                set_archive_error(a, n.error());
-                return -1;
-            }
+    oc::result<void> write(const void *data, size_t size)
+    {
+        auto ptr = static_cast<const char *>(data);
 
-            ctx->bytes_written += n.value();
-            ptr += n.value();
-            remain -= n.value();
+        while (size > 0) {
+            auto n = std::min(size, BLOCK_SIZE - _current.size());
+            _current.append(ptr, n);
+            ptr += n;
+            size -= n;
 
-            if (ctx->is_split() && ctx->bytes_written == ctx->max_size) {
-                ctx->bytes_written = 0;
-                ctx->move_to_next();
+            if (_current.size() == BLOCK_SIZE) {
+                OUTCOME_TRYV(submit());
             }
         }
 
-        return static_cast<la_ssize_t>(size);
+        return oc::success();
     }
 
-    int archive_open(archive *a)
+    // Compress the remaining data and wait for all blocks to be written
+    oc::result<void> finish()
     {
-        return archive_write_open(a, this, nullptr, &la_write_cb, &la_close_cb);
-    }
-};
+        if (!_current.empty()) {
+            OUTCOME_TRYV(submit());
+        }
 
-/*
- * The following libarchive functions are based on code from bsdtar. The main
- * difference is that they will not try to extract/add as many files as possible
- * from/to the archive. They'll immediately fail after the first error or
- * warning because an incomplete archive is useless for backups and restores.
- */
+        OUTCOME_TRYV(drain(0));
+        stop();
 
-bool libarchive_tar_extract(const std::string &filename,
-                            const std::string &target,
-                            const std::vector<std::string> &patterns,
-                            CompressionType compression,
-                            bool is_split)
-{
-    if (target.empty()) {
-        LOGE("%s: Invalid target path for extraction", target.c_str());
-        return false;
+        return oc::success();
     }
 
-    ScopedArchive matcher(archive_match_new(), archive_match_free);
-    if (!matcher) {
-        LOGE("%s: Out of memory when creating matcher", __FUNCTION__);
-        return false;
-    }
-    ScopedArchive in(archive_read_new(), archive_read_free);
-    if (!in) {
-        LOGE("%s: Out of memory when creating archive reader", __FUNCTION__);
-        return false;
-    }
-    ScopedArchive out(archive_write_disk_new(), archive_write_free);
-    if (!out) {
-        LOGE("%s: Out of memory when creating disk writer", __FUNCTION__);
-        return false;
-    }
+private:
+    // Large enough that splitting the stream barely affects the compression
+    // ratio (deflate's window is 32 KiB and lz4's is 64 KiB)
+    static constexpr size_t BLOCK_SIZE = 1024 * 1024;
+    static constexpr unsigned int MIN_THREADS = 1;
+    static constexpr unsigned int MAX_THREADS = 8;
 
-    // Set up matcher parameters
-    for (const std::string &pattern : patterns) {
-        if (archive_match_include_pattern(
-                matcher.get(), pattern.c_str()) != ARCHIVE_OK) {
-            LOGE("Invalid pattern: %s", pattern.c_str());
-            return false;
+    struct Block
+    {
+        std::string input;
+        std::string output;
+        std::error_code ec;
+        bool done = false;
+    };
+
+    void stop()
+    {
+        {
+            std::lock_guard lock(_mutex);
+            _done = true;
         }
+        _cv_jobs.notify_all();
+
+        for (auto &t : _threads) {
+            t.join();
+        }
+        _threads.clear();
     }
 
-    // Set up archive reader parameters
-    //archive_read_support_format_gnutar(in.get());
-    archive_read_support_format_tar(in.get());
+    void worker()
+    {
+        std::unique_lock lock(_mutex);
 
-    switch (compression) {
-    case CompressionType::None:
-        break;
-    case CompressionType::Lz4:
-        archive_read_support_filter_lz4(in.get());
-        break;
-    case CompressionType::Gzip:
-        archive_read_support_filter_gzip(in.get());
-        break;
-    case CompressionType::Xz:
-        archive_read_support_filter_xz(in.get());
-        break;
-    default:
-        LOGE("Invalid compression type");
-        return false;
-    }
+        while (true) {
+            _cv_jobs.wait(lock, [&] {
+                return _done || !_queue.empty();
+            });
 
-    // Set up disk writer parameters
-    archive_write_disk_set_standard_lookup(out.get());
-    archive_write_disk_set_options(out.get(), LIBARCHIVE_DISK_WRITER_FLAGS);
+            if (_queue.empty()) {
+                break;
+            }
 
-    SplitReaderCtx ctx(filename, is_split);
-    if (ctx.archive_open(in.get()) != ARCHIVE_OK) {
-        LOGE("%s: Failed to open file: %s",
-             filename.c_str(), archive_error_string(in.get()));
-        return false;
-    }
+            Block *block = _queue.front();
+            _queue.pop_front();
 
-    archive_entry *entry;
-    int ret;
-    std::string target_path;
+            lock.unlock();
+            block->ec = compress(*block);
+            lock.lock();
 
-    while (true) {
-        ret = archive_read_next_header(in.get(), &entry);
-        if (ret == ARCHIVE_EOF) {
-            break;
-        } else if (ret == ARCHIVE_RETRY) {
-            LOGW("%s: Retrying header read", filename.c_str());
-            continue;
-        } else if (ret != ARCHIVE_OK) {
-            LOGE("%s: Failed to read header: %s",
-                 filename.c_str(), archive_error_string(in.get()));
-            return false;
+            block->done = true;
+            _cv_done.notify_all();
         }
+    }
 
-        const char *path = archive_entry_pathname(entry);
-        if (!path || !*path) {
-            LOGE("%s: Header has null or empty filename", filename.c_str());
-            return false;
+    oc::result<void> submit()
+    {
+        auto block = std::make_unique<Block>();
+        block->input.swap(_current);
+        _current.reserve(BLOCK_SIZE);
+
+        {
+            std::lock_guard lock(_mutex);
+            _queue.push_back(block.get());
+            _blocks.push_back(std::move(block));
         }
+        _cv_jobs.notify_one();
 
-        LOGV("%s", path);
+        // Bound the amount of memory used by blocks in flight
+        return drain(_max_pending);
+    }
 
-        // Build path
-        target_path = target;
-        if (target_path.back() != '/' && *path != '/') {
-            target_path += '/';
-        }
-        target_path += path;
+    // Write out compressed blocks in order until at most max_pending blocks
+    // remain
+    oc::result<void> drain(size_t max_pending)
+    {
+        while (true) {
+            std::unique_ptr<Block> block;
 
-        archive_entry_set_pathname(entry, target_path.c_str());
+            {
+                std::unique_lock lock(_mutex);
 
-        // Check pattern matches
-        if (archive_match_excluded(matcher.get(), entry)) {
-            continue;
+                if (_blocks.empty()) {
+                    break;
+                }
+
+                if (_blocks.size() > max_pending) {
+                    _cv_done.wait(lock, [&] {
+                        return _blocks.front()->done;
+                    });
+                } else if (!_blocks.front()->done) {
+                    break;
+                }
+
+                block = std::move(_blocks.front());
+                _blocks.pop_front();
+            }
+
+            if (block->ec) {
+                return block->ec;
+            }
+
+            OUTCOME_TRYV(_sink(block->output.data(), block->output.size()));
         }
 
-        // Extract file
-        ret = archive_read_extract2(in.get(), entry, out.get());
+        return oc::success();
+    }
+
+    std::error_code compress(Block &block)
+    {
+        switch (_type) {
+        case CompressionType::Gzip: {
+            z_stream z = {};
+
+            // 16 selects the gzip wrapper instead of zlib's
+            if (deflateInit2(&z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16,
+                             8, Z_DEFAULT_STRATEGY) != Z_OK) {
+                return std::make_error_code(std::errc::not_enough_memory);
+            }
+
+            auto end_z = finally([&] {
+                deflateEnd(&z);
+            });
+
+            block.output.resize(deflateBound(
+                    &z, static_cast<uLong>(block.input.size())));
+
+            z.next_in = reinterpret_cast<Bytef *>(block.input.data());
+            z.avail_in = static_cast<uInt>(block.input.size());
+            z.next_out = reinterpret_cast<Bytef *>(block.output.data());
+            z.avail_out = static_cast<uInt>(block.output.size());
+
+            if (deflate(&z, Z_FINISH) != Z_STREAM_END) {
+                return std::make_error_code(std::errc::io_error);
+            }
+
+            block.output.resize(z.total_out);
+            break;
+        }
+
+        case CompressionType::Lz4: {
+            // Same frame settings as libarchive's lz4 filter
+            LZ4F_preferences_t prefs = {};
+            prefs.frameInfo.blockSizeID = LZ4F_max4MB;
+            prefs.frameInfo.blockMode = LZ4F_blockIndependent;
+            prefs.frameInfo.contentChecksumFlag = LZ4F_contentChecksumEnabled;
+
+            block.output.resize(LZ4F_compressFrameBound(
+                    block.input.size(), &prefs));
+
+            auto n = LZ4F_compressFrame(
+                    block.output.data(), block.output.size(),
+                    block.input.data(), block.input.size(), &prefs);
+            if (LZ4F_isError(n)) {
+                return std::make_error_code(std::errc::io_error);
+            }
+
+            block.output.resize(n);
+            break;
+        }
+
+        default:
+            return std::make_error_code(std::errc::invalid_argument);
+        }
+
+        // Free the input early since the block may wait a while to be written
+        std::string().swap(block.input);
+
+        return {};
+    }
+
+    CompressionType _type;
+    Sink _sink;
+    std::string _current;
+    size_t _max_pending;
+    std::mutex _mutex;
+    std::condition_variable _cv_jobs;
+    std::condition_variable _cv_done;
+    // Blocks waiting for a worker
+    std::deque<Block *> _queue;
+    // All blocks not yet written, in order
+    std::deque<std::unique_ptr<Block>> _blocks;
+    bool _done;
+    std::vector<std::thread> _threads;
+};
+
+struct SplitWriterCtx : SplitCtx
+{
+    // Bytes written for current file
+    uint64_t bytes_written;
+    // Max size of split files
+    uint64_t max_size;
+    // Compresses the data before it is written if libarchive's filters are not
+    // used
+    std::unique_ptr<ParallelCompressor> compressor;
+    // If not null, the SHA512 digest of each output file is appended here.
+    // The data is hashed as it is written, so the output is never reread.
+    std::vector<FileChecksum> *checksums;
+    SHA512_CTX sha_ctx;
+
+    SplitWriterCtx(std::string path, uint64_t max_size,
+                   std::vector<FileChecksum> *checksums)
+        : SplitCtx(std::move(path), max_size > 0)
+        , bytes_written(0)
+        , max_size(max_size)
+        , checksums(checksums)
+    {
+    }
+
+    oc::result<void> open_if_needed()
+    {
+        if (need_open && checksums) {
+            OUTCOME_TRYV(finish_checksum());
+
+            if (!SHA512_Init(&sha_ctx)) {
+                return std::errc::io_error;
+            }
+            checksums->push_back({current_filename(), {}});
+        }
+
+        return SplitCtx::open_if_needed(FileOpenMode::WriteOnly);
+    }
+
+    oc::result<void> finish_checksum()
+    {
+        if (checksums && file.is_open()
+                && !SHA512_Final(checksums->back().digest.data(), &sha_ctx)) {
+            return std::errc::io_error;
+        }
+
+        return oc::success();
+    }
+
+    oc::result<void> write_data(const void *data, size_t size)
+    {
+        const char *ptr = static_cast<const char *>(data);
+        size_t remain = size;
+
+        while (remain > 0) {
+            OUTCOME_TRYV(open_if_needed());
+
+            auto to_write = static_cast<size_t>(std::min<uint64_t>(
+                    remain,
+                    is_split() ? (max_size - bytes_written) : remain));
+
+            OUTCOME_TRY(n, file.write(ptr, to_write));
+
+            if (checksums && !SHA512_Update(&sha_ctx, ptr, n)) {
+                return std::errc::io_error;
+            }
+
+            bytes_written += n;
+            offset += n;
+            cache.advance(offset);
+            ptr += n;
+            remain -= n;
+
+            if (is_split() && bytes_written == max_size) {
+                bytes_written = 0;
+                move_to_next();
+            }
+        }
+
+        return oc::success();
+    }
+
+    static la_ssize_t la_write_cb(archive *a, void *userdata, const void *data,
+                                  size_t size)
+    {
+        auto *ctx = static_cast<SplitWriterCtx *>(userdata);
+
+        auto ret = ctx->compressor
+                ? ctx->compressor->write(data, size)
+                : ctx->write_data(data, size);
+        if (!ret) {
+            set_archive_error(a, ret.error());
+            return -1;
+        }
+
+        return static_cast<la_ssize_t>(size);
+    }
+
+    static int la_close_cb(archive *a, void *userdata)
+    {
+        auto *ctx = static_cast<SplitWriterCtx *>(userdata);
+
+        if (ctx->compressor) {
+            auto ret = ctx->compressor->finish();
+            ctx->compressor.reset();
+
+            if (!ret) {
+                set_archive_error(a, ret.error());
+                (void) SplitCtx::la_close_cb(a, userdata);
+                return ARCHIVE_FATAL;
+            }
+        }
+
+        if (auto ret = ctx->finish_checksum(); !ret) {
+            set_archive_error(a, ret.error());
+            (void) SplitCtx::la_close_cb(a, userdata);
+            return ARCHIVE_FATAL;
+        }
+
+        return SplitCtx::la_close_cb(a, userdata);
+    }
+
+    int archive_open(archive *a)
+    {
+        return archive_write_open(a, this, nullptr, &la_write_cb, &la_close_cb);
+    }
+};
+
+// Decompresses an archive on its own thread. A second libarchive reader with
+// only the raw format enabled runs the decompression filter, so the reader
+// that parses the tar stream sees uncompressed data and the filters (and
+// their handling of multiple gzip members, lz4 frames, padding, etc.) are
+// exactly the same as before.
+class StreamDecompressor
+{
+public:
+    StreamDecompressor(std::string path, bool is_split)
+        : _ctx(std::move(path), is_split)
+        , _in(archive_read_new(), archive_read_free)
+        , _errno(0)
+        , _eof(false)
+        , _done(false)
+    {
+    }
+
+    ~StreamDecompressor()
+    {
+        stop();
+    }
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(StreamDecompressor)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(StreamDecompressor)
+
+    bool start(CompressionType compression)
+    {
+        if (!_in) {
+            LOGE("%s: Out of memory when creating archive reader",
+                 __FUNCTION__);
+            return false;
+        }
+
+        archive_read_support_format_raw(_in.get());
+
+        switch (compression) {
+        case CompressionType::None:
+            break;
+        case CompressionType::Lz4:
+            archive_read_support_filter_lz4(_in.get());
+            break;
+        case CompressionType::Gzip:
+            archive_read_support_filter_gzip(_in.get());
+            break;
+        case CompressionType::Xz:
+            archive_read_support_filter_xz(_in.get());
+            break;
+        default:
+            LOGE("Invalid compression type");
+            return false;
+        }
+
+        if (_ctx.archive_open(_in.get()) != ARCHIVE_OK) {
+            LOGE("%s: Failed to open file: %s",
+                 _ctx.path.c_str(), archive_error_string(_in.get()));
+            return false;
+        }
+
+        _thread = std::thread(&StreamDecompressor::run, this);
+
+        return true;
+    }
+
+    // Open a reader on the decompressed stream
+    int archive_open(archive *a)
+    {
+        return archive_read_open(a, this, nullptr, &la_read_cb, nullptr);
+    }
+
+private:
+    static constexpr size_t CHUNK_SIZE = 1024 * 1024;
+    // Enough read-ahead to cover the parser stalling briefly on the writers
+    static constexpr size_t MAX_CHUNKS = 4;
+
+    void stop()
+    {
+        {
+            std::lock_guard lock(_mutex);
+            _done = true;
+        }
+        _cv_space.notify_all();
+
+        if (_thread.joinable()) {
+            _thread.join();
+        }
+    }
+
+    void run()
+    {
+        archive_entry *entry;
+        int ret;
+
+        while ((ret = archive_read_next_header(_in.get(), &entry))
+                == ARCHIVE_RETRY) {
+        }
+
+        if (ret == ARCHIVE_OK) {
+            while (true) {
+                std::string chunk(CHUNK_SIZE, '\0');
+
+                auto n = archive_read_data(
+                        _in.get(), chunk.data(), chunk.size());
+                if (n < 0) {
+                    ret = ARCHIVE_FATAL;
+                    break;
+                } else if (n == 0) {
+                    ret = ARCHIVE_EOF;
+                    break;
+                }
+
+                chunk.resize(static_cast<size_t>(n));
+
+                std::unique_lock lock(_mutex);
+                _cv_space.wait(lock, [&] {
+                    return _done || _chunks.size() < MAX_CHUNKS;
+                });
+
+                if (_done) {
+                    return;
+                }
+
+                _chunks.push_back(std::move(chunk));
+                _cv_chunks.notify_one();
+            }
+        }
+
+        {
+            std::lock_guard lock(_mutex);
+
+            if (ret != ARCHIVE_EOF) {
+                _errno = archive_errno(_in.get());
+                _error = archive_error_string(_in.get())
+                        ? archive_error_string(_in.get())
+                        : "Failed to decompress archive";
+            }
+            _eof = true;
+        }
+        _cv_chunks.notify_one();
+    }
+
+    static la_ssize_t la_read_cb(archive *a, void *userdata,
+                                 const void **buffer)
+    {
+        auto *sd = static_cast<StreamDecompressor *>(userdata);
+
+        {
+            std::unique_lock lock(sd->_mutex);
+            sd->_cv_chunks.wait(lock, [&] {
+                return sd->_eof || !sd->_chunks.empty();
+            });
+
+            if (sd->_chunks.empty()) {
+                if (!sd->_error.empty()) {
+                    archive_set_error(a, sd->_errno, "%s", sd->_error.c_str());
+                    return -1;
+                }
+                return 0;
+            }
+
+            sd->_current = std::move(sd->_chunks.front());
+            sd->_chunks.pop_front();
+        }
+        sd->_cv_space.notify_one();
+
+        *buffer = sd->_current.data();
+        return static_cast<la_ssize_t>(sd->_current.size());
+    }
+
+    SplitReaderCtx _ctx;
+    ScopedArchive _in;
+    std::mutex _mutex;
+    std::condition_variable _cv_chunks;
+    std::condition_variable _cv_space;
+    std::deque<std::string> _chunks;
+    // Chunk currently being parsed by libarchive
+    std::string _current;
+    int _errno;
+    std::string _error;
+    bool _eof;
+    bool _done;
+    std::thread _thread;
+};
+
+// Writes regular files on a pool of worker threads, each with its own disk
+// writer. The caller parses the archive and streams each file's data to the
+// pool in bounded chunks, so large files do not have to fit in memory.
+// Everything else is written by the caller in archive order, after waiting
+// for the pool to go idle where an entry depends on earlier files (eg. hard
+// links).
+class ExtractWriterPool
+{
+public:
+    ExtractWriterPool()
+        : _job(nullptr)
+        , _buffered(0)
+        , _busy(0)
+        , _done(false)
+        , _failed(false)
+    {
+        auto n_threads = thread_count(MIN_THREADS, MAX_THREADS);
+
+        for (unsigned int i = 0; i < n_threads; ++i) {
+            _threads.emplace_back(&ExtractWriterPool::worker, this);
+        }
+    }
+
+    ~ExtractWriterPool()
+    {
+        stop();
+    }
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(ExtractWriterPool)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(ExtractWriterPool)
+
+    bool begin_file(archive_entry *entry)
+    {
+        auto job = std::make_unique<Job>(archive_entry_clone(entry));
+        if (!job->entry) {
+            fail(format("%s: Out of memory when copying entry",
+                        archive_entry_pathname(entry)));
+            return false;
+        }
+
+        std::lock_guard lock(_mutex);
+
+        if (_failed) {
+            return false;
+        }
+
+        _job = job.get();
+        _jobs.push_back(std::move(job));
+        ++_busy;
+        _cv_work.notify_all();
+
+        return true;
+    }
+
+    bool write_data(const void *data, size_t size, int64_t offset)
+    {
+        std::unique_lock lock(_mutex);
+
+        // Always allow one chunk in so that a chunk larger than the limit
+        // does not block forever
+        _cv_space.wait(lock, [&] {
+            return _failed || _buffered == 0
+                    || _buffered + size <= MAX_BUFFERED;
+        });
+
+        if (_failed) {
+            return false;
+        }
+
+        _job->chunks.push_back({
+            std::string(static_cast<const char *>(data), size), offset});
+        _buffered += size;
+        _cv_work.notify_all();
+
+        return true;
+    }
+
+    void end_file()
+    {
+        {
+            std::lock_guard lock(_mutex);
+            _job->complete = true;
+            _job = nullptr;
+        }
+        _cv_work.notify_all();
+    }
+
+    // Wait for all files to be written
+    bool wait_idle()
+    {
+        std::unique_lock lock(_mutex);
+        _cv_space.wait(lock, [&] {
+            return _busy == 0;
+        });
+
+        return !_failed;
+    }
+
+    // Wait for all files to be written and close the workers' disk writers
+    bool finish()
+    {
+        wait_idle();
+        stop();
+
+        return !_failed;
+    }
+
+    const std::string & error() const
+    {
+        return _error;
+    }
+
+private:
+    // Beyond a few writers, flash storage gains little from more concurrent
+    // writes
+    static constexpr unsigned int MIN_THREADS = 1;
+    static constexpr unsigned int MAX_THREADS = 4;
+    // Maximum amount of file data waiting to be written
+    static constexpr size_t MAX_BUFFERED = 32 * 1024 * 1024;
+
+    struct Chunk
+    {
+        std::string data;
+        int64_t offset;
+    };
+
+    struct Job
+    {
+        std::unique_ptr<archive_entry, decltype(archive_entry_free) *> entry;
+        std::deque<Chunk> chunks;
+        bool complete = false;
+
+        explicit Job(archive_entry *e)
+            : entry(e, archive_entry_free)
+        {
+        }
+    };
+
+    void stop()
+    {
+        {
+            std::lock_guard lock(_mutex);
+            _done = true;
+        }
+        _cv_work.notify_all();
+
+        for (auto &t : _threads) {
+            t.join();
+        }
+        _threads.clear();
+    }
+
+    void fail(std::string error)
+    {
+        {
+            std::lock_guard lock(_mutex);
+
+            if (!_failed) {
+                _error = std::move(error);
+            }
+            _failed = true;
+        }
+        _cv_space.notify_all();
+    }
+
+    void worker()
+    {
+        ScopedArchive out(archive_write_disk_new(), archive_write_free);
+        if (out) {
+            archive_write_disk_set_standard_lookup(out.get());
+            archive_write_disk_set_options(out.get(),
+                                           LIBARCHIVE_DISK_WRITER_FLAGS);
+        } else {
+            fail("Out of memory when creating disk writer");
+        }
+
+        std::unique_lock lock(_mutex);
+
+        while (true) {
+            _cv_work.wait(lock, [&] {
+                return _done || !_jobs.empty();
+            });
+
+            if (_jobs.empty()) {
+                break;
+            }
+
+            auto job = std::move(_jobs.front());
+            _jobs.pop_front();
+
+            write_job(lock, out.get(), *job);
+
+            lock.unlock();
+            job.reset();
+            lock.lock();
+
+            if (--_busy == 0) {
+                _cv_space.notify_all();
+            }
+        }
+
+        lock.unlock();
+
+        if (out && archive_write_close(out.get()) != ARCHIVE_OK) {
+            fail(archive_error_string(out.get()));
+        }
+    }
+
+    // Called with the lock held. Data is consumed even after a failure so
+    // that the parser never waits on a job that will not make progress.
+    void write_job(std::unique_lock<std::mutex> &lock, archive *out, Job &job)
+    {
+        auto *entry = job.entry.get();
+        bool ok = out && !_failed;
+
+        lock.unlock();
+
+        if (ok && archive_write_header(out, entry) != ARCHIVE_OK) {
+            fail(format("%s: %s", archive_entry_pathname(entry),
+                        archive_error_string(out)));
+            ok = false;
+        }
+
+        lock.lock();
+
+        while (true) {
+            _cv_work.wait(lock, [&] {
+                return _done || job.complete || !job.chunks.empty();
+            });
+
+            if (job.chunks.empty()) {
+                break;
+            }
+
+            auto chunk = std::move(job.chunks.front());
+            job.chunks.pop_front();
+
+            lock.unlock();
+
+            if (ok && archive_write_data_block(
+                    out, chunk.data.data(), chunk.data.size(),
+                    chunk.offset) != ARCHIVE_OK) {
+                fail(format("%s: Failed to write data: %s",
+                            archive_entry_pathname(entry),
+                            archive_error_string(out)));
+                ok = false;
+            }
+            auto size = chunk.data.size();
+            std::string().swap(chunk.data);
+
+            lock.lock();
+
+            _buffered -= size;
+            _cv_space.notify_all();
+        }
+
+        if (ok && job.complete) {
+            lock.unlock();
+
+            if (archive_write_finish_entry(out) != ARCHIVE_OK) {
+                fail(format("%s: %s", archive_entry_pathname(entry),
+                            archive_error_string(out)));
+            }
+
+            lock.lock();
+        }
+    }
+
+    std::mutex _mutex;
+    // Signalled when jobs or data become available
+    std::condition_variable _cv_work;
+    // Signalled when buffered data is written or the pool becomes idle
+    std::condition_variable _cv_space;
+    std::deque<std::unique_ptr<Job>> _jobs;
+    // File currently being filled by the caller
+    Job *_job;
+    size_t _buffered;
+    // Number of queued or running jobs
+    size_t _busy;
+    bool _done;
+    std::atomic_bool _failed;
+    std::string _error;
+    std::vector<std::thread> _threads;
+};
+
+// Copy a regular file's data from the archive to the writer pool
+static bool queue_file(archive *in, ExtractWriterPool &pool,
+                       archive_entry *entry, CopyProgress *progress)
+{
+    const void *buff;
+    size_t size;
+    int64_t offset;
+    int ret;
+
+    if (!pool.begin_file(entry)) {
+        return false;
+    }
+
+    auto end_file = finally([&] {
+        pool.end_file();
+    });
+
+    while ((ret = archive_read_data_block(
+            in, &buff, &size, &offset)) == ARCHIVE_OK) {
+        if (!pool.write_data(buff, size, offset)) {
+            return false;
+        }
+
+        g_bytes_extracted.add(size);
+
+        if (progress) {
+            progress->bytes.fetch_add(size, std::memory_order_relaxed);
+        }
+    }
+
+    if (ret != ARCHIVE_EOF) {
+        LOGE("%s: %s", archive_entry_pathname(entry),
+             archive_error_string(in));
+        return false;
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Check if a regular file on disk already matches an archive entry
+ *
+ * The contents are not compared. Subsecond timestamps are only compared if the
+ * archive has them (pax_restricted archives only store them for entries that
+ * need an extended header anyway).
+ */
+static bool is_unchanged_on_disk(archive_entry *entry, const char *path)
+{
+    if (archive_entry_filetype(entry) != AE_IFREG
+            || archive_entry_hardlink(entry)) {
+        return false;
+    }
+
+    struct stat sb;
+    if (lstat(path, &sb) < 0) {
+        return false;
+    }
+
+    long nsec = archive_entry_mtime_nsec(entry);
+
+    return S_ISREG(sb.st_mode)
+            && sb.st_mode == archive_entry_mode(entry)
+            && static_cast<int64_t>(sb.st_uid) == archive_entry_uid(entry)
+            && static_cast<int64_t>(sb.st_gid) == archive_entry_gid(entry)
+            && sb.st_size == archive_entry_size(entry)
+            && sb.st_mtim.tv_sec == archive_entry_mtime(entry)
+            && (nsec == 0 || sb.st_mtim.tv_nsec == nsec);
+}
+
+/*!
+ * \brief Remove whatever is on disk at the path of an archive entry
+ *
+ * Existing directories are kept if the entry is also a directory. Everything
+ * else is removed instead of being overwritten in place, since a file may be
+ * a hard link to another file that should not change.
+ */
+static bool remove_existing(archive_entry *entry, const char *path)
+{
+    struct stat sb;
+    if (lstat(path, &sb) < 0) {
+        if (errno == ENOENT) {
+            return true;
+        }
+        LOGE("%s: Failed to stat: %s", path, strerror(errno));
+        return false;
+    }
+
+    if (S_ISDIR(sb.st_mode)) {
+        if (archive_entry_filetype(entry) == AE_IFDIR) {
+            return true;
+        } else if (auto r = delete_recursive(path); !r) {
+            LOGE("%s: Failed to delete: %s",
+                 path, r.error().message().c_str());
+            return false;
+        }
+    } else if (unlink(path) < 0 && errno != ENOENT) {
+        LOGE("%s: Failed to delete: %s", path, strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * The following libarchive functions are based on code from bsdtar. The main
+ * difference is that they will not try to extract/add as many files as possible
+ * from/to the archive. They'll immediately fail after the first error or
+ * warning because an incomplete archive is useless for backups and restores.
+ */
+
+bool libarchive_tar_extract(const std::string &filename,
+                            const std::string &target,
+                            const std::vector<std::string> &patterns,
+                            CompressionType compression,
+                            bool is_split,
+                            TarExtractFlags flags,
+                            std::vector<std::string> *entries,
+                            CopyProgress *progress)
+{
+    if (target.empty()) {
+        LOGE("%s: Invalid target path for extraction", target.c_str());
+        return false;
+    }
+
+    ScopedArchive matcher(archive_match_new(), archive_match_free);
+    if (!matcher) {
+        LOGE("%s: Out of memory when creating matcher", __FUNCTION__);
+        return false;
+    }
+    ScopedArchive in(archive_read_new(), archive_read_free);
+    if (!in) {
+        LOGE("%s: Out of memory when creating archive reader", __FUNCTION__);
+        return false;
+    }
+    ScopedArchive out(archive_write_disk_new(), archive_write_free);
+    if (!out) {
+        LOGE("%s: Out of memory when creating disk writer", __FUNCTION__);
+        return false;
+    }
+
+    // Set up matcher parameters
+    for (const std::string &pattern : patterns) {
+        if (archive_match_include_pattern(
+                matcher.get(), pattern.c_str()) != ARCHIVE_OK) {
+            LOGE("Invalid pattern: %s", pattern.c_str());
+            return false;
+        }
+    }
+
+    // Set up archive reader parameters. Decompression happens on a separate
+    // thread, so the reader only parses the tar stream.
+    //archive_read_support_format_gnutar(in.get());
+    archive_read_support_format_tar(in.get());
+
+    // Set up disk writer parameters
+    archive_write_disk_set_standard_lookup(out.get());
+    archive_write_disk_set_options(out.get(), LIBARCHIVE_DISK_WRITER_FLAGS);
+
+    StreamDecompressor decompressor(filename, is_split);
+    if (!decompressor.start(compression)) {
+        return false;
+    }
+
+    if (decompressor.archive_open(in.get()) != ARCHIVE_OK) {
+        LOGE("%s: Failed to open file: %s",
+             filename.c_str(), archive_error_string(in.get()));
+        return false;
+    }
+
+    // Regular files are written by the pool. Directories and other entries
+    // are written here in archive order, so a directory always exists before
+    // any file inside it is queued. The pool must be finished before the disk
+    // writer is closed, since that is when directory timestamps and
+    // permissions are restored.
+    ExtractWriterPool pool;
+
+    archive_entry *entry;
+    int ret;
+    std::string target_path;
+
+    while (true) {
+        ret = archive_read_next_header(in.get(), &entry);
+        if (ret == ARCHIVE_EOF) {
+            break;
+        } else if (ret == ARCHIVE_RETRY) {
+            LOGW("%s: Retrying header read", filename.c_str());
+            continue;
+        } else if (ret != ARCHIVE_OK) {
+            LOGE("%s: Failed to read header: %s",
+                 filename.c_str(), archive_error_string(in.get()));
+            return false;
+        }
+
+        const char *path = archive_entry_pathname(entry);
+        if (!path || !*path) {
+            LOGE("%s: Header has null or empty filename", filename.c_str());
+            return false;
+        }
+
+        LOGV("%s", path);
+
+        // Build path
+        target_path = target;
+        if (target_path.back() != '/' && *path != '/') {
+            target_path += '/';
+        }
+        target_path += path;
+
+        // path is owned by the entry and is invalidated when the pathname is
+        // replaced
+        std::string name_buf;
+        if (entries) {
+            name_buf = path;
+        }
+
+        archive_entry_set_pathname(entry, target_path.c_str());
+
+        // Check pattern matches
+        if (archive_match_excluded(matcher.get(), entry)) {
+            continue;
+        }
+
+        if (entries) {
+            std::string_view name(name_buf);
+            while (starts_with(name, "./")) {
+                name.remove_prefix(2);
+            }
+            while (!name.empty() && name.back() == '/') {
+                name.remove_suffix(1);
+            }
+            if (!name.empty()) {
+                entries->emplace_back(name);
+            }
+        }
+
+        if (flags & TarExtractFlag::SkipUnchanged) {
+            if (is_unchanged_on_disk(entry, target_path.c_str())) {
+                if (archive_read_data_skip(in.get()) != ARCHIVE_OK) {
+                    LOGE("%s: %s", filename.c_str(),
+                         archive_error_string(in.get()));
+                    return false;
+                }
+                if (progress && archive_entry_filetype(entry) == AE_IFREG) {
+                    progress->bytes.fetch_add(static_cast<uint64_t>(
+                            archive_entry_size(entry)),
+                            std::memory_order_relaxed);
+                    progress->files.fetch_add(1, std::memory_order_relaxed);
+                }
+                continue;
+            }
+
+            if (!remove_existing(entry, target_path.c_str())) {
+                return false;
+            }
+        }
+
+        // Hard link targets are relative to the archive root too
+        if (const char *link = archive_entry_hardlink(entry)) {
+            target_path = target;
+            if (target_path.back() != '/' && *link != '/') {
+                target_path += '/';
+            }
+            target_path += link;
+
+            archive_entry_set_hardlink(entry, target_path.c_str());
+        }
+
+        if (archive_entry_filetype(entry) == AE_IFREG
+                && !archive_entry_hardlink(entry)) {
+            if (!queue_file(in.get(), pool, entry, progress)) {
+                if (!pool.error().empty()) {
+                    LOGE("%s", pool.error().c_str());
+                }
+                return false;
+            }
+            if (progress) {
+                progress->files.fetch_add(1, std::memory_order_relaxed);
+            }
+            continue;
+        }
+
+        // A hard link's target must be fully written first
+        if (archive_entry_hardlink(entry) && !pool.wait_idle()) {
+            LOGE("%s", pool.error().c_str());
+            return false;
+        }
+
+        // Extract file
+        ret = archive_read_extract2(in.get(), entry, out.get());
         if (ret != ARCHIVE_OK) {
             LOGE("%s: %s", archive_entry_pathname(entry),
                  archive_error_string(in.get()));
@@ -464,72 +1723,532 @@ bool libarchive_tar_extract(const std::string &filename,
         }
     }
 
-    if (archive_read_close(in.get()) != ARCHIVE_OK) {
-        LOGE("%s: %s", filename.c_str(), archive_error_string(in.get()));
+    if (!pool.finish()) {
+        LOGE("%s", pool.error().c_str());
+        return false;
+    }
+
+    if (archive_read_close(in.get()) != ARCHIVE_OK) {
+        LOGE("%s: %s", filename.c_str(), archive_error_string(in.get()));
+        return false;
+    }
+
+    // Check that all patterns were matched
+    const char *pattern;
+    while ((ret = archive_match_path_unmatched_inclusions_next(
+            matcher.get(), &pattern)) == ARCHIVE_OK) {
+        LOGE("%s: Pattern not matched: %s", filename.c_str(), pattern);
+    }
+    if (ret != ARCHIVE_EOF) {
+        LOGE("%s: %s", filename.c_str(), archive_error_string(matcher.get()));
+        return false;
+    }
+
+    return archive_match_path_unmatched_inclusions(matcher.get()) == 0;
+}
+
+static bool write_file(archive *in, archive *out, archive_entry *entry,
+                       CopyProgress *progress)
+{
+    int ret;
+
+    ret = archive_write_header(out, entry);
+    if (ret != ARCHIVE_OK) {
+        LOGE("%s: %s", archive_entry_pathname(entry), archive_error_string(out));
+        return false;
+    }
+
+    if (archive_entry_size(entry) > 0 && !libarchive_copy_data_disk_to_archive(
+            in, out, entry, progress)) {
+        return false;
+    }
+
+    if (progress && archive_entry_filetype(entry) == AE_IFREG) {
+        progress->files.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Set up the disk reader and archive writer for creating a tar archive
+ *
+ * \param in Disk reader
+ * \param out Archive writer
+ * \param ctx Output context
+ * \param compression Compression type
+ *
+ * \return Whether the compression type is valid
+ */
+static bool set_up_tar_create(archive *in, archive *out, SplitWriterCtx &ctx,
+                              CompressionType compression)
+{
+    // Set up disk reader parameters
+    archive_read_disk_set_symlink_physical(in);
+    archive_read_disk_set_behavior(in, LIBARCHIVE_DISK_READER_FLAGS);
+    // We don't want to look up usernames and group names on Android
+    //archive_read_disk_set_standard_lookup(in);
+
+    // Set up archive writer parameters
+    // NOTE: We are creating POSIX pax archives instead of GNU tar archives
+    //       because libarchive's GNU tar writer is very limited. In particular,
+    //       it does not support storing sparse file information, xattrs, or
+    //       ACLs. Since this information is stored as extended attributes in
+    //       the pax archive, the GNU tar tool will not be able to extract any
+    //       of this additional metadata. In other words, extracting and
+    //       repacking a backup on a Linux machine with GNU tar will render the
+    //       backup useless.
+    //archive_write_set_format_gnutar(out);
+    archive_write_set_format_pax_restricted(out);
+    archive_write_set_bytes_per_block(out, 10240);
+
+    switch (compression) {
+    case CompressionType::None:
+        break;
+    case CompressionType::Lz4:
+    case CompressionType::Gzip:
+        // libarchive's lz4 and gzip filters are single-threaded
+        ctx.compressor = std::make_unique<ParallelCompressor>(
+                compression, [&ctx](const void *data, size_t size) {
+            return ctx.write_data(data, size);
+        });
+        break;
+    case CompressionType::Xz:
+        archive_write_add_filter_xz(out);
+        // liblzma's multithreaded encoder still produces a single .xz stream.
+        // If it is unavailable, the filter falls back to one thread.
+        (void) archive_write_set_filter_option(
+                out, "xz", "threads",
+                std::to_string(thread_count(
+                        1, std::numeric_limits<unsigned int>::max())).c_str());
+        break;
+    default:
+        LOGE("Invalid compression type");
+        return false;
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Write the hard links held back by the link resolver
+ *
+ * \return Whether all entries were successfully written
+ */
+static bool write_deferred_links(archive *in, archive *out,
+                                 archive_entry_linkresolver *resolver,
+                                 CopyProgress *progress)
+{
+    archive_entry *entry = nullptr;
+    archive_entry *sparse_entry = nullptr;
+    int ret;
+
+    archive_entry_linkify(resolver, &entry, &sparse_entry);
+
+    while (entry) {
+        // This tricky code here is to correctly read the contents of the entry
+        // because the disk reader 'in' is pointing at does not have any
+        // information about the entry by this time and using
+        // archive_read_data_block() with the disk reader consequently must
+        // fail. And we hae to re-open the entry to read the contents.
+        ret = archive_read_disk_open(in, archive_entry_sourcepath(entry));
+        if (ret != ARCHIVE_OK) {
+            LOGE("%s: %s", archive_entry_sourcepath(entry),
+                 archive_error_string(in));
+            return false;
+        }
+
+        // Invoke archive_read_next_header2() to work archive_read_data_block(),
+        // which is called via write_file() without failure.
+        archive_entry *entry2 = archive_entry_new();
+        ret = archive_read_next_header2(in, entry2);
+        archive_entry_free(entry2);
+        if (ret != ARCHIVE_OK) {
+            LOGE("%s: %s", archive_entry_sourcepath(entry),
+                 archive_error_string(in));
+            archive_entry_free(entry);
+            return false;
+        }
+
+        if (!write_file(in, out, entry, progress)) {
+            archive_entry_free(entry);
+            return false;
+        }
+        archive_entry_free(entry);
+        archive_read_close(in);
+        entry = nullptr;
+        archive_entry_linkify(resolver, &entry, &sparse_entry);
+    }
+
+    return true;
+}
+
+static int metadata_filter(archive *a, void *data, archive_entry *entry)
+{
+    (void) data;
+    (void) entry;
+
+    if (archive_read_disk_can_descend(a)) {
+        archive_read_disk_descend(a);
+    }
+    return 1;
+}
+
+/*!
+ * \brief Create pax archive with all metadata
+ *
+ * \param filename Target archive path
+ * \param base_dir Base directory for \a paths
+ * \param paths List of paths to add to the archive
+ * \param progress Optional counters for the bytes and regular files added
+ * \param checksums If not null, the path and SHA512 digest of each file
+ *                  written (more than one if the archive is split) are
+ *                  appended to this list
+ *
+ * \return Whether the archive creation was successful
+ */
+bool libarchive_tar_create(const std::string &filename,
+                           const std::string &base_dir,
+                           const std::vector<std::string> &paths,
+                           CompressionType compression,
+                           uint64_t split_archive_size,
+                           CopyProgress *progress,
+                           std::vector<FileChecksum> *checksums)
+{
+    if (base_dir.empty() && paths.empty()) {
+        LOGE("%s: No base directory or paths specified", filename.c_str());
+        return false;
+    }
+
+    // Must outlive the archive writer, which may call the close callback when
+    // it is freed
+    SplitWriterCtx ctx(filename, split_archive_size, checksums);
+
+    ScopedArchive in(archive_read_disk_new(), archive_read_free);
+    if (!in) {
+        LOGE("%s: Out of memory when creating disk reader", __FUNCTION__);
+        return false;
+    }
+    ScopedArchive out(archive_write_new(), archive_write_free);
+    if (!out) {
+        LOGE("%s: Out of memory when creating archive writer", __FUNCTION__);
+        return false;
+    }
+    ScopedLinkResolver resolver(archive_entry_linkresolver_new(),
+                                archive_entry_linkresolver_free);
+    if (!resolver) {
+        LOGE("%s: Out of memory when creating link resolver", __FUNCTION__);
+        return false;
+    }
+
+    if (!set_up_tar_create(in.get(), out.get(), ctx, compression)) {
+        return false;
+    }
+    archive_read_disk_set_metadata_filter_callback(
+            in.get(), metadata_filter, nullptr);
+
+    // Set up link resolver parameters
+    archive_entry_linkresolver_set_strategy(resolver.get(),
+                                            archive_format(out.get()));
+
+    // Open output file
+    if (ctx.archive_open(out.get()) != ARCHIVE_OK) {
+        LOGE("%s: Failed to open file: %s",
+             filename.c_str(), archive_error_string(out.get()));
+        return false;
+    }
+
+    archive_entry *entry = nullptr;
+    archive_entry *sparse_entry = nullptr;
+    int ret;
+    std::string full_path;
+
+    // Add hierarchies
+    for (const std::string &path : paths) {
+        if (path.empty()) {
+            LOGE("%s: Cannot add empty path to the archive", filename.c_str());
+            return false;
+        }
+
+        // If the path is absolute, don't append it to the base directory
+        if (path[0] == '/') {
+            full_path = path;
+        } else {
+            full_path = base_dir;
+            if (!full_path.empty() && full_path.back() != '/' && path[0] != '/') {
+                full_path += '/';
+            }
+            full_path += path;
+        }
+
+        ret = archive_read_disk_open(in.get(), full_path.c_str());
+        if (ret != ARCHIVE_OK) {
+            LOGE("%s: %s", full_path.c_str(), archive_error_string(in.get()));
+            return false;
+        }
+
+        while (true) {
+            archive_entry_free(entry);
+            entry = archive_entry_new();
+
+            ret = archive_read_next_header2(in.get(), entry);
+            if (ret == ARCHIVE_EOF) {
+                break;
+            } else if (ret != ARCHIVE_OK) {
+                LOGE("%s: Failed to read next header: %s", full_path.c_str(),
+                     archive_error_string(in.get()));
+                archive_entry_free(entry);
+                return false;
+            }
+
+            if (archive_entry_filetype(entry) != AE_IFREG) {
+                archive_entry_set_size(entry, 0);
+            }
+
+            // If our current directory tree path is not an absolute path, set
+            // the archive path to the relative path starting at base_dir
+            const char *curpath = archive_entry_pathname(entry);
+            if (curpath && path[0] != '/' && !base_dir.empty()) {
+                auto relpath = relative_path(curpath, base_dir);
+                if (!relpath) {
+                    LOGE("Failed to compute relative path of %s starting at %s: %s",
+                         curpath, base_dir.c_str(),
+                         relpath.error().message().c_str());
+                    archive_entry_free(entry);
+                    return false;
+                }
+                if (relpath.value().empty()) {
+                    // If the relative path is empty, then the current path is
+                    // the root of the directory tree. We don't need that, so
+                    // skip it.
+                    continue;
+                }
+                archive_entry_set_pathname(entry, relpath.value().c_str());
+            }
+
+            switch (archive_entry_filetype(entry)) {
+            case AE_IFSOCK:
+                LOGW("%s: Skipping socket", archive_entry_pathname(entry));
+                continue;
+            default:
+                LOGV("%s", archive_entry_pathname(entry));
+                break;
+            }
+
+            archive_entry_linkify(resolver.get(), &entry, &sparse_entry);
+
+            if (entry) {
+                if (!write_file(in.get(), out.get(), entry, progress)) {
+                    archive_entry_free(entry);
+                    return false;
+                }
+                archive_entry_free(entry);
+                entry = nullptr;
+            }
+            if (sparse_entry) {
+                if (!write_file(in.get(), out.get(), sparse_entry, progress)) {
+                    archive_entry_free(sparse_entry);
+                    return false;
+                }
+                archive_entry_free(sparse_entry);
+                sparse_entry = nullptr;
+            }
+        }
+
+        archive_entry_free(entry);
+        entry = nullptr;
+        archive_read_close(in.get());
+    }
+
+    archive_read_disk_set_metadata_filter_callback(in.get(), nullptr, nullptr);
+
+    if (!write_deferred_links(in.get(), out.get(), resolver.get(), progress)) {
         return false;
     }
 
-    // Check that all patterns were matched
-    const char *pattern;
-    while ((ret = archive_match_path_unmatched_inclusions_next(
-            matcher.get(), &pattern)) == ARCHIVE_OK) {
-        LOGE("%s: Pattern not matched: %s", filename.c_str(), pattern);
-    }
-    if (ret != ARCHIVE_EOF) {
-        LOGE("%s: %s", filename.c_str(), archive_error_string(matcher.get()));
+    if (archive_write_close(out.get()) != ARCHIVE_OK) {
+        LOGE("%s: %s", filename.c_str(), archive_error_string(out.get()));
         return false;
     }
 
-    return archive_match_path_unmatched_inclusions(matcher.get()) == 0;
+    return true;
 }
 
-static bool write_file(archive *in, archive *out, archive_entry *entry)
+/*!
+ * \brief Get the path of a part of an independently split archive
+ *
+ * \param filename Archive path
+ * \param index Part number
+ *
+ * \return `<filename>.part<index>`
+ */
+std::string libarchive_tar_part_name(const std::string &filename, size_t index)
 {
-    int ret;
+    return format("%s.part%zu", filename.c_str(), index);
+}
 
-    ret = archive_write_header(out, entry);
-    if (ret != ARCHIVE_OK) {
-        LOGE("%s: %s", archive_entry_pathname(entry), archive_error_string(out));
-        return false;
-    }
+/*!
+ * \brief Count the parts of an independently split archive
+ *
+ * \param filename Archive path
+ *
+ * \return Number of consecutive parts, starting from part 0, that exist
+ */
+size_t libarchive_tar_part_count(const std::string &filename)
+{
+    size_t count = 0;
+    struct stat sb;
 
-    if (archive_entry_size(entry) > 0) {
-        return libarchive_copy_data_disk_to_archive(in, out, entry);
+    while (stat(libarchive_tar_part_name(filename, count).c_str(), &sb) == 0) {
+        ++count;
     }
 
-    return true;
+    return count;
 }
 
-static int metadata_filter(archive *a, void *data, archive_entry *entry)
+struct PartEntry
 {
-    (void) data;
-    (void) entry;
+    // Path on disk
+    std::string path;
+    // Path in the archive
+    std::string name;
+};
 
-    if (archive_read_disk_can_descend(a)) {
-        archive_read_disk_descend(a);
+// Assigns every entry of a tree to a part. Directories all go into part 0,
+// which is extracted last so that their metadata is applied after the other
+// parts have written their contents. Other entries are added to the current
+// part until it reaches the size limit. All links to an inode go into the same
+// part so that each part can be extracted on its own.
+class PartPlanner : public FtsWrapper
+{
+public:
+    PartPlanner(std::string path, const std::string &base_dir, bool relative,
+                uint64_t part_size, std::vector<std::vector<PartEntry>> &parts,
+                std::map<std::pair<dev_t, ino_t>, size_t> &inode_parts,
+                uint64_t &cur_size)
+        : FtsWrapper(std::move(path), FtsFlag::CrossMountPointBoundaries)
+        , m_base_dir(base_dir)
+        , m_relative(relative)
+        , m_part_size(part_size)
+        , m_parts(parts)
+        , m_inode_parts(inode_parts)
+        , m_cur_size(cur_size)
+    {
+    }
+
+    Actions on_reached_directory_pre() override
+    {
+        return add(true);
+    }
+
+    Actions on_reached_file() override
+    {
+        return add(false);
+    }
+
+    Actions on_reached_symlink() override
+    {
+        return add(false);
+    }
+
+    Actions on_reached_special_file() override
+    {
+        if (S_ISSOCK(_curr->fts_statp->st_mode)) {
+            LOGW("%s: Skipping socket", _curr->fts_path);
+            return Action::Ok;
+        }
+        return add(false);
     }
-    return 1;
-}
+
+private:
+    Actions add(bool is_dir)
+    {
+        PartEntry entry;
+        entry.path = _curr->fts_path;
+
+        if (m_relative) {
+            auto relpath = relative_path(entry.path, m_base_dir);
+            if (!relpath) {
+                _error_msg = format(
+                        "Failed to compute relative path of %s starting at %s: %s",
+                        entry.path.c_str(), m_base_dir.c_str(),
+                        relpath.error().message().c_str());
+                LOGE("%s", _error_msg.c_str());
+                return Action::Fail;
+            }
+            if (relpath.value().empty()) {
+                // Same as libarchive_tar_create(), the root of the tree is
+                // not stored
+                return Action::Ok;
+            }
+            entry.name = std::move(relpath.value());
+        } else {
+            entry.name = entry.path;
+        }
+
+        if (is_dir) {
+            m_parts[0].push_back(std::move(entry));
+            return Action::Ok;
+        }
+
+        auto const *sb = _curr->fts_statp;
+        uint64_t size = S_ISREG(sb->st_mode)
+                ? static_cast<uint64_t>(sb->st_size) : 0;
+        std::pair<dev_t, ino_t> inode{sb->st_dev, sb->st_ino};
+
+        if (!S_ISDIR(sb->st_mode) && sb->st_nlink > 1) {
+            if (auto it = m_inode_parts.find(inode);
+                    it != m_inode_parts.end()) {
+                m_parts[it->second].push_back(std::move(entry));
+                return Action::Ok;
+            }
+        }
+
+        if (m_parts.size() == 1 || (m_part_size > 0
+                && m_cur_size > 0 && m_cur_size + size > m_part_size)) {
+            m_parts.emplace_back();
+            m_cur_size = 0;
+        }
+
+        m_parts.back().push_back(std::move(entry));
+        m_cur_size += size;
+
+        if (sb->st_nlink > 1) {
+            m_inode_parts.emplace(inode, m_parts.size() - 1);
+        }
+
+        return Action::Ok;
+    }
+
+    const std::string &m_base_dir;
+    bool m_relative;
+    uint64_t m_part_size;
+    std::vector<std::vector<PartEntry>> &m_parts;
+    std::map<std::pair<dev_t, ino_t>, size_t> &m_inode_parts;
+    uint64_t &m_cur_size;
+};
 
 /*!
- * \brief Create pax archive with all metadata
+ * \brief Write one part of an independently split archive
  *
- * \param filename Target archive path
- * \param base_dir Base directory for \a paths
- * \param paths List of paths to add to the archive
+ * \param filename Part path
+ * \param entries Entries to add. Directories are not descended into.
+ * \param compression Compression type
+ * \param progress Optional counters for the bytes and regular files added
+ * \param digest If not null, the SHA512 digest of the part is written here
  *
- * \return Whether the archive creation was successful
+ * \return Whether the part was successfully written
  */
-bool libarchive_tar_create(const std::string &filename,
-                           const std::string &base_dir,
-                           const std::vector<std::string> &paths,
+static bool write_tar_part(const std::string &filename,
+                           const std::vector<PartEntry> &entries,
                            CompressionType compression,
-                           uint64_t split_archive_size)
+                           CopyProgress *progress, Sha512Digest *digest)
 {
-    if (base_dir.empty() && paths.empty()) {
-        LOGE("%s: No base directory or paths specified", filename.c_str());
-        return false;
-    }
+    std::vector<FileChecksum> checksums;
+
+    // Must outlive the archive writer, which may call the close callback when
+    // it is freed
+    SplitWriterCtx ctx(filename, 0, digest ? &checksums : nullptr);
 
     ScopedArchive in(archive_read_disk_new(), archive_read_free);
     if (!in) {
@@ -548,201 +2267,363 @@ bool libarchive_tar_create(const std::string &filename,
         return false;
     }
 
-    // Set up disk reader parameters
-    archive_read_disk_set_symlink_physical(in.get());
-    archive_read_disk_set_metadata_filter_callback(
-            in.get(), metadata_filter, nullptr);
-    archive_read_disk_set_behavior(in.get(), LIBARCHIVE_DISK_READER_FLAGS);
-    // We don't want to look up usernames and group names on Android
-    //archive_read_disk_set_standard_lookup(in.get());
-
-    // Set up archive writer parameters
-    // NOTE: We are creating POSIX pax archives instead of GNU tar archives
-    //       because libarchive's GNU tar writer is very limited. In particular,
-    //       it does not support storing sparse file information, xattrs, or
-    //       ACLs. Since this information is stored as extended attributes in
-    //       the pax archive, the GNU tar tool will not be able to extract any
-    //       of this additional metadata. In other words, extracting and
-    //       repacking a backup on a Linux machine with GNU tar will render the
-    //       backup useless.
-    //archive_write_set_format_gnutar(out.get());
-    archive_write_set_format_pax_restricted(out.get());
-    archive_write_set_bytes_per_block(out.get(), 10240);
-
-    switch (compression) {
-    case CompressionType::None:
-        break;
-    case CompressionType::Lz4:
-        archive_write_add_filter_lz4(out.get());
-        break;
-    case CompressionType::Gzip:
-        archive_write_add_filter_gzip(out.get());
-        break;
-    case CompressionType::Xz:
-        archive_write_add_filter_xz(out.get());
-        break;
-    default:
-        LOGE("Invalid compression type");
+    // No metadata filter, so opening a directory only reads the directory
+    // itself
+    if (!set_up_tar_create(in.get(), out.get(), ctx, compression)) {
         return false;
     }
 
-    // Set up link resolver parameters
     archive_entry_linkresolver_set_strategy(resolver.get(),
                                             archive_format(out.get()));
 
-    // Open output file
-    SplitWriterCtx ctx(filename, split_archive_size);
     if (ctx.archive_open(out.get()) != ARCHIVE_OK) {
         LOGE("%s: Failed to open file: %s",
              filename.c_str(), archive_error_string(out.get()));
         return false;
     }
 
-    archive_entry *entry = nullptr;
-    archive_entry *sparse_entry = nullptr;
-    int ret;
-    std::string full_path;
+    for (auto const &e : entries) {
+        if (archive_read_disk_open(in.get(), e.path.c_str()) != ARCHIVE_OK) {
+            LOGE("%s: %s", e.path.c_str(), archive_error_string(in.get()));
+            return false;
+        }
+
+        archive_entry *entry = archive_entry_new();
+        archive_entry *sparse_entry = nullptr;
+
+        if (archive_read_next_header2(in.get(), entry) != ARCHIVE_OK) {
+            LOGE("%s: Failed to read header: %s",
+                 e.path.c_str(), archive_error_string(in.get()));
+            archive_entry_free(entry);
+            return false;
+        }
+
+        if (archive_entry_filetype(entry) != AE_IFREG) {
+            archive_entry_set_size(entry, 0);
+        }
+        archive_entry_set_pathname(entry, e.name.c_str());
+
+        LOGV("%s", e.name.c_str());
+
+        archive_entry_linkify(resolver.get(), &entry, &sparse_entry);
+
+        for (auto *ae : {entry, sparse_entry}) {
+            if (ae) {
+                bool ok = write_file(in.get(), out.get(), ae, progress);
+                archive_entry_free(ae);
+                if (!ok) {
+                    if (ae == entry) {
+                        archive_entry_free(sparse_entry);
+                    }
+                    return false;
+                }
+            }
+        }
+
+        archive_read_close(in.get());
+    }
+
+    if (!write_deferred_links(in.get(), out.get(), resolver.get(), progress)) {
+        return false;
+    }
+
+    if (archive_write_close(out.get()) != ARCHIVE_OK) {
+        LOGE("%s: %s", filename.c_str(), archive_error_string(out.get()));
+        return false;
+    }
+
+    if (digest && !checksums.empty()) {
+        *digest = checksums.front().digest;
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Run a task for each part, with up to \p max_jobs at a time
+ *
+ * Each task runs in its own process because libarchive's disk reader and
+ * writer may change the working directory, which is shared by all threads of a
+ * process. If \p max_jobs is 1 or less, the tasks run in this process in
+ * order.
+ *
+ * \return Whether all tasks succeeded. If a task fails, no new tasks are
+ *         started, but the running ones are allowed to finish.
+ */
+static bool run_part_jobs(size_t first, size_t last, unsigned int max_jobs,
+                          const std::function<bool(size_t)> &fn)
+{
+    if (max_jobs <= 1) {
+        for (size_t i = first; i < last; ++i) {
+            if (!fn(i)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Only wait for our own children since the caller may have others
+    std::deque<pid_t> running;
+    size_t next = first;
+    bool failed = false;
+
+    while (true) {
+        while (!failed && running.size() < max_jobs && next < last) {
+            pid_t pid = fork();
+            if (pid == 0) {
+                _exit(fn(next) ? EXIT_SUCCESS : EXIT_FAILURE);
+            } else if (pid < 0) {
+                LOGE("Failed to fork: %s", strerror(errno));
+                failed = true;
+                break;
+            }
+
+            running.push_back(pid);
+            ++next;
+        }
+
+        if (running.empty()) {
+            break;
+        }
+
+        int status;
+        if (waitpid(running.front(), &status, 0) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            LOGE("Failed to wait for process: %s", strerror(errno));
+            failed = true;
+        } else if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+            failed = true;
+        }
+
+        running.pop_front();
+    }
+
+    return !failed;
+}
+
+/*!
+ * \brief Create an archive split into independent parts
+ *
+ * Unlike the split archives created by libarchive_tar_create(), each part is a
+ * complete, separately compressed pax archive of a disjoint subset of the
+ * tree, so the parts can be created and extracted in parallel and a damaged
+ * part does not affect the others. The parts are named by
+ * libarchive_tar_part_name(). Part 0 contains all of the directories and the
+ * remaining parts contain roughly \p part_size bytes of file data each.
+ *
+ * \note The parts are written by child processes. For \p progress to be
+ *       updated while the parts are written, it must be in memory that is
+ *       shared with child processes.
+ *
+ * \param filename Target archive path
+ * \param base_dir Base directory for \a paths
+ * \param paths List of paths to add to the archive
+ * \param compression Compression type
+ * \param part_size Approximate uncompressed size of each part (0 to put all
+ *                  files in a single part)
+ * \param max_jobs Maximum number of parts to write concurrently
+ * \param progress Optional counters for the bytes and regular files added
+ * \param checksums If not null, the path and SHA512 digest of each part are
+ *                  appended to this list
+ *
+ * \return Whether the archive creation was successful
+ */
+bool libarchive_tar_create_parts(const std::string &filename,
+                                 const std::string &base_dir,
+                                 const std::vector<std::string> &paths,
+                                 CompressionType compression,
+                                 uint64_t part_size,
+                                 unsigned int max_jobs,
+                                 CopyProgress *progress,
+                                 std::vector<FileChecksum> *checksums)
+{
+    if (base_dir.empty() && paths.empty()) {
+        LOGE("%s: No base directory or paths specified", filename.c_str());
+        return false;
+    }
+
+    std::vector<std::vector<PartEntry>> parts(1);
+    std::map<std::pair<dev_t, ino_t>, size_t> inode_parts;
+    uint64_t cur_size = 0;
 
-    // Add hierarchies
     for (const std::string &path : paths) {
         if (path.empty()) {
             LOGE("%s: Cannot add empty path to the archive", filename.c_str());
             return false;
         }
 
+        std::string full_path;
+
         // If the path is absolute, don't append it to the base directory
         if (path[0] == '/') {
             full_path = path;
         } else {
             full_path = base_dir;
-            if (!full_path.empty() && full_path.back() != '/' && path[0] != '/') {
+            if (!full_path.empty() && full_path.back() != '/') {
                 full_path += '/';
             }
             full_path += path;
         }
 
-        ret = archive_read_disk_open(in.get(), full_path.c_str());
-        if (ret != ARCHIVE_OK) {
-            LOGE("%s: %s", full_path.c_str(), archive_error_string(in.get()));
-            return false;
+        PartPlanner planner(full_path, base_dir,
+                            path[0] != '/' && !base_dir.empty(), part_size,
+                            parts, inode_parts, cur_size);
+        if (!planner.run()) {
+            LOGE("%s: Failed to list files: %s",
+                 full_path.c_str(), planner.error().c_str());
+            return false;
+        }
+    }
+
+    // One digest per part, written by the child processes
+    Sha512Digest *digests = nullptr;
+    size_t digests_size = parts.size() * sizeof(Sha512Digest);
+
+    if (checksums) {
+        void *ptr = mmap(nullptr, digests_size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (ptr == MAP_FAILED) {
+            LOGE("Failed to map shared memory: %s", strerror(errno));
+            return false;
+        }
+        digests = static_cast<Sha512Digest *>(ptr);
+    }
+
+    auto unmap_digests = finally([&] {
+        if (digests) {
+            munmap(digests, digests_size);
+        }
+    });
+
+    LOGD("%s: Writing %zu parts", filename.c_str(), parts.size());
+
+    if (!run_part_jobs(0, parts.size(), max_jobs, [&](size_t i) {
+        return write_tar_part(libarchive_tar_part_name(filename, i), parts[i],
+                              compression, progress,
+                              digests ? &digests[i] : nullptr);
+    })) {
+        return false;
+    }
+
+    if (checksums) {
+        for (size_t i = 0; i < parts.size(); ++i) {
+            checksums->push_back({libarchive_tar_part_name(filename, i),
+                                  digests[i]});
         }
+    }
 
-        while (true) {
-            archive_entry_free(entry);
-            entry = archive_entry_new();
+    return true;
+}
 
-            ret = archive_read_next_header2(in.get(), entry);
-            if (ret == ARCHIVE_EOF) {
-                break;
-            } else if (ret != ARCHIVE_OK) {
-                LOGE("%s: Failed to read next header: %s", full_path.c_str(),
-                     archive_error_string(in.get()));
-                archive_entry_free(entry);
-                return false;
-            }
+/*!
+ * \brief Extract an archive created by libarchive_tar_create_parts()
+ *
+ * The parts containing files are extracted in parallel and then part 0, which
+ * contains the directories, is extracted so that the directories' metadata is
+ * not changed by the extraction of their contents.
+ *
+ * \note The parts are extracted by child processes. For \p progress to be
+ *       updated while the parts are extracted, it must be in memory that is
+ *       shared with child processes.
+ *
+ * \param filename Archive path (without the part suffix)
+ * \param target Target directory
+ * \param patterns Same as with libarchive_tar_extract()
+ * \param compression Compression type
+ * \param max_jobs Maximum number of parts to extract concurrently
+ * \param flags Same as with libarchive_tar_extract()
+ * \param entries Same as with libarchive_tar_extract()
+ * \param progress Same as with libarchive_tar_extract()
+ *
+ * \return Whether all parts were successfully extracted
+ */
+bool libarchive_tar_extract_parts(const std::string &filename,
+                                  const std::string &target,
+                                  const std::vector<std::string> &patterns,
+                                  CompressionType compression,
+                                  unsigned int max_jobs,
+                                  TarExtractFlags flags,
+                                  std::vector<std::string> *entries,
+                                  CopyProgress *progress)
+{
+    size_t count = libarchive_tar_part_count(filename);
+    if (count == 0) {
+        LOGE("%s: No parts found", filename.c_str());
+        return false;
+    }
 
-            if (archive_entry_filetype(entry) != AE_IFREG) {
-                archive_entry_set_size(entry, 0);
+    // The entries extracted by the child processes are passed back through
+    // anonymous temporary files as NULL-separated paths
+    std::vector<ScopedFILE> lists;
+    if (entries) {
+        for (size_t i = 0; i < count; ++i) {
+            ScopedFILE fp(tmpfile(), &fclose);
+            if (!fp) {
+                LOGE("Failed to create temporary file: %s", strerror(errno));
+                return false;
             }
+            lists.push_back(std::move(fp));
+        }
+    }
 
-            // If our current directory tree path is not an absolute path, set
-            // the archive path to the relative path starting at base_dir
-            const char *curpath = archive_entry_pathname(entry);
-            if (curpath && path[0] != '/' && !base_dir.empty()) {
-                auto relpath = relative_path(curpath, base_dir);
-                if (!relpath) {
-                    LOGE("Failed to compute relative path of %s starting at %s: %s",
-                         curpath, base_dir.c_str(),
-                         relpath.error().message().c_str());
-                    archive_entry_free(entry);
-                    return false;
-                }
-                if (relpath.value().empty()) {
-                    // If the relative path is empty, then the current path is
-                    // the root of the directory tree. We don't need that, so
-                    // skip it.
-                    continue;
-                }
-                archive_entry_set_pathname(entry, relpath.value().c_str());
-            }
+    auto extract_part = [&](size_t i) {
+        std::string part = libarchive_tar_part_name(filename, i);
+        std::vector<std::string> part_entries;
 
-            switch (archive_entry_filetype(entry)) {
-            case AE_IFSOCK:
-                LOGW("%s: Skipping socket", archive_entry_pathname(entry));
-                continue;
-            default:
-                LOGV("%s", archive_entry_pathname(entry));
-                break;
-            }
+        if (!libarchive_tar_extract(part, target, patterns, compression, false,
+                                    flags, entries ? &part_entries : nullptr,
+                                    progress)) {
+            return false;
+        }
 
-            archive_entry_linkify(resolver.get(), &entry, &sparse_entry);
+        if (entries) {
+            FILE *fp = lists[i].get();
 
-            if (entry) {
-                if (!write_file(in.get(), out.get(), entry)) {
-                    archive_entry_free(entry);
+            for (auto const &e : part_entries) {
+                if (fwrite(e.c_str(), 1, e.size() + 1, fp) != e.size() + 1) {
+                    LOGE("%s: Failed to save extracted entries: %s",
+                         part.c_str(), strerror(errno));
                     return false;
                 }
-                archive_entry_free(entry);
-                entry = nullptr;
             }
-            if (sparse_entry) {
-                if (!write_file(in.get(), out.get(), sparse_entry)) {
-                    archive_entry_free(sparse_entry);
-                    return false;
-                }
-                archive_entry_free(sparse_entry);
-                sparse_entry = nullptr;
+
+            if (fflush(fp) != 0) {
+                LOGE("%s: Failed to save extracted entries: %s",
+                     part.c_str(), strerror(errno));
+                return false;
             }
         }
 
-        archive_entry_free(entry);
-        entry = nullptr;
-        archive_read_close(in.get());
-    }
+        return true;
+    };
 
-    archive_read_disk_set_metadata_filter_callback(in.get(), nullptr, nullptr);
+    if (!run_part_jobs(1, count, max_jobs, extract_part)
+            || !extract_part(0)) {
+        return false;
+    }
 
-    entry = nullptr;
-    archive_entry_linkify(resolver.get(), &entry, &sparse_entry);
+    for (auto &fp : lists) {
+        // The child processes share the file offset with this process
+        rewind(fp.get());
 
-    while (entry) {
-        // This tricky code here is to correctly read the contents of the entry
-        // because the disk reader 'in' is pointing at does not have any
-        // information about the entry by this time and using
-        // archive_read_data_block() with the disk reader consequently must
-        // fail. And we hae to re-open the entry to read the contents.
-        ret = archive_read_disk_open(in.get(), archive_entry_sourcepath(entry));
-        if (ret != ARCHIVE_OK) {
-            LOGE("%s: %s", archive_entry_sourcepath(entry),
-                 archive_error_string(in.get()));
-            return false;
-        }
+        std::string name;
+        int c;
 
-        // Invoke archive_read_next_header2() to work archive_read_data_block(),
-        // which is called via write_file() without failure.
-        archive_entry *entry2 = archive_entry_new();
-        ret = archive_read_next_header2(in.get(), entry2);
-        archive_entry_free(entry2);
-        if (ret != ARCHIVE_OK) {
-            LOGE("%s: %s", archive_entry_sourcepath(entry),
-                 archive_error_string(in.get()));
-            archive_entry_free(entry);
-            return false;
+        while ((c = fgetc(fp.get())) != EOF) {
+            if (c == '\0') {
+                entries->push_back(std::move(name));
+                name.clear();
+            } else {
+                name += static_cast<char>(c);
+            }
         }
 
-        if (!write_file(in.get(), out.get(), entry)) {
-            archive_entry_free(entry);
+        if (ferror(fp.get())) {
+            LOGE("Failed to read extracted entries: %s", strerror(errno));
             return false;
         }
-        archive_entry_free(entry);
-        archive_read_close(in.get());
-        entry = nullptr;
-        archive_entry_linkify(resolver.get(), &entry, &sparse_entry);
-    }
-
-    if (archive_write_close(out.get()) != ARCHIVE_OK) {
-        LOGE("%s: %s", filename.c_str(), archive_error_string(out.get()));
-        return false;
     }
 
     return true;
@@ -757,7 +2638,7 @@ static bool set_up_input(archive *in, const std::string &filename)
     archive_read_support_format_zip(in);
     //archive_read_support_filter_xz(in);
 
-    if (archive_read_open_filename(in, filename.c_str(), 10240) != ARCHIVE_OK) {
+    if (libarchive_open_file(in, filename) != ARCHIVE_OK) {
         LOGE("%s: Failed to open archive: %s",
              filename.c_str(), archive_error_string(in));
         return false;
@@ -836,13 +2717,82 @@ bool extract_archive(const std::string &filename, const std::string &target)
     return true;
 }
 
-bool extract_files(const std::string &filename, const std::string &target,
-                   const std::vector<std::string> &files)
+// Index of the most recently used zip. The same ROM zip is usually queried
+// several times in a row, so its central directory is only parsed once.
+static std::shared_ptr<const ZipIndex> get_zip_index(const std::string &filename)
 {
-    if (files.empty()) {
+    static std::mutex mutex;
+    static std::shared_ptr<const ZipIndex> cached;
+
+    struct stat sb;
+    if (stat(filename.c_str(), &sb) < 0) {
+        return nullptr;
+    }
+
+    std::lock_guard lock(mutex);
+
+    if (cached && cached->path() == filename
+            && HashCache::same_metadata(cached->file_stat(), sb)) {
+        return cached;
+    }
+
+    auto index = std::make_shared<ZipIndex>();
+
+    if (auto r = index->load(filename); !r) {
+        LOGW("%s: Failed to read central directory: %s",
+             filename.c_str(), r.error().message().c_str());
+        return nullptr;
+    }
+
+    cached = std::move(index);
+    return cached;
+}
+
+// Extract files by seeking directly to them through the zip's central
+// directory. Returns std::nullopt if the index cannot be used, in which case
+// the caller should scan the archive instead.
+static std::optional<bool> extract_files_indexed(
+        const ZipIndex &index, const std::vector<ExtractInfo> &files)
+{
+    ZipIndex::ExtractList list;
+
+    for (const ExtractInfo &info : files) {
+        auto *entry = index.find(info.from);
+        if (!entry) {
+            LOGE("%s: File not found in archive", info.from.c_str());
+            LOGE("Not all specified files were extracted");
+            return false;
+        } else if (!entry->is_supported()) {
+            return std::nullopt;
+        }
+
+        list.emplace_back(entry, info.to);
+    }
+
+    if (auto r = index.extract(list); !r) {
+        LOGE("%s: Failed to extract: %s",
+             r.error().path.c_str(), r.error().ec.message().c_str());
         return false;
     }
 
+    return true;
+}
+
+static std::optional<bool> extract_files_indexed(
+        const std::string &filename, const std::vector<ExtractInfo> &files)
+{
+    auto index = get_zip_index(filename);
+    if (!index) {
+        return std::nullopt;
+    }
+
+    return extract_files_indexed(*index, files);
+}
+
+static bool extract_files_streaming(const std::string &filename,
+                                    const std::string &target,
+                                    const std::vector<std::string> &files)
+{
     ScopedArchive in(archive_read_new(), archive_read_free);
     ScopedArchive out(archive_write_disk_new(), archive_write_free);
 
@@ -909,13 +2859,9 @@ bool extract_files(const std::string &filename, const std::string &target,
     return true;
 }
 
-bool extract_files2(const std::string &filename,
-                    const std::vector<ExtractInfo> &files)
+static bool extract_files2_streaming(const std::string &filename,
+                                     const std::vector<ExtractInfo> &files)
 {
-    if (files.empty()) {
-        return false;
-    }
-
     ScopedArchive in(archive_read_new(), archive_read_free);
     ScopedArchive out(archive_write_disk_new(), archive_write_free);
 
@@ -964,13 +2910,9 @@ bool extract_files2(const std::string &filename,
     return true;
 }
 
-bool archive_exists(const std::string &filename,
-                    std::vector<ExistsInfo> &files)
+static bool archive_exists_streaming(const std::string &filename,
+                                     std::vector<ExistsInfo> &files)
 {
-    if (files.empty()) {
-        return false;
-    }
-
     ScopedArchive in(archive_read_new(), archive_read_free);
 
     if (!in) {
@@ -981,10 +2923,6 @@ bool archive_exists(const std::string &filename,
     archive_entry *entry;
     int ret;
 
-    for (ExistsInfo &info : files) {
-        info.exists = false;
-    }
-
     if (!set_up_input(in.get(), filename)) {
         return false;
     }
@@ -1006,4 +2944,145 @@ bool archive_exists(const std::string &filename,
     return true;
 }
 
+
+/*!
+ * \brief Extract files from a zip into a directory
+ *
+ * The files are located through the zip's central directory and extracted
+ * concurrently. If the central directory cannot be used, the archive is
+ * scanned from the beginning instead.
+ *
+ * \param filename Path to zip file
+ * \param target Output directory
+ * \param files Names of the files to extract
+ *
+ * \return Whether all of \p files were extracted
+ */
+bool extract_files(const std::string &filename, const std::string &target,
+                   const std::vector<std::string> &files)
+{
+    if (files.empty()) {
+        return false;
+    }
+
+    if (auto r = mkdir_recursive(target, S_IRWXU | S_IRWXG | S_IRWXO); !r) {
+        LOGE("%s: Failed to create directory: %s",
+             target.c_str(), r.error().message().c_str());
+        return false;
+    }
+
+    std::vector<ExtractInfo> infos;
+    for (const std::string &file : files) {
+        infos.push_back({file, target + "/" + file});
+    }
+
+    if (auto r = extract_files_indexed(filename, infos)) {
+        return *r;
+    }
+
+    return extract_files_streaming(filename, target, files);
+}
+
+/*!
+ * \brief Extract files from a zip to the specified paths
+ *
+ * This behaves like extract_files(), except that each file has its own
+ * output path.
+ *
+ * \param filename Path to zip file
+ * \param files Names of the files to extract and their output paths
+ *
+ * \return Whether all of \p files were extracted
+ */
+bool extract_files2(const std::string &filename,
+                    const std::vector<ExtractInfo> &files)
+{
+    if (files.empty()) {
+        return false;
+    }
+
+    if (auto r = extract_files_indexed(filename, files)) {
+        return *r;
+    }
+
+    return extract_files2_streaming(filename, files);
+}
+
+/*!
+ * \brief Extract files from an already indexed zip to the specified paths
+ *
+ * This behaves like extract_files2(), except that the central directory in
+ * \p index is used instead of reading it again.
+ *
+ * \param index Loaded index of the zip file
+ * \param files Names of the files to extract and their output paths
+ *
+ * \return Whether all of \p files were extracted
+ */
+bool extract_files2(const ZipIndex &index,
+                    const std::vector<ExtractInfo> &files)
+{
+    if (files.empty()) {
+        return false;
+    }
+
+    if (auto r = extract_files_indexed(index, files)) {
+        return *r;
+    }
+
+    return extract_files2_streaming(index.path(), files);
+}
+
+/*!
+ * \brief Check which files exist in a zip
+ *
+ * \param filename Path to zip file
+ * \param files Names of the files to check. ExistsInfo::exists is set for
+ *              each one.
+ *
+ * \return Whether the archive could be read
+ */
+bool archive_exists(const std::string &filename,
+                    std::vector<ExistsInfo> &files)
+{
+    if (files.empty()) {
+        return false;
+    }
+
+    for (ExistsInfo &info : files) {
+        info.exists = false;
+    }
+
+    if (auto index = get_zip_index(filename)) {
+        for (ExistsInfo &info : files) {
+            info.exists = index->find(info.path) != nullptr;
+        }
+        return true;
+    }
+
+    return archive_exists_streaming(filename, files);
+}
+
+/*!
+ * \brief Check which files exist in an already indexed zip
+ *
+ * \param index Loaded index of the zip file
+ * \param files Names of the files to check. ExistsInfo::exists is set for
+ *              each one.
+ *
+ * \return Whether the archive could be read
+ */
+bool archive_exists(const ZipIndex &index, std::vector<ExistsInfo> &files)
+{
+    if (files.empty()) {
+        return false;
+    }
+
+    for (ExistsInfo &info : files) {
+        info.exists = index.find(info.path) != nullptr;
+    }
+
+    return true;
+}
+
 }
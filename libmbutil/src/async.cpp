@@ -0,0 +1,151 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbutil/async.h"
+
+/*!
+ * \file mbutil/async.h
+ * \brief Run long file operations in the background
+ *
+ * Each operation runs on its own thread and is admitted by the IoScheduler
+ * before it touches the disk, so starting several of them at once does not
+ * oversubscribe a single device. The returned AsyncOp can be polled with
+ * AsyncOp::wait_for() to report progress and can cancel operations that
+ * support it.
+ *
+ * \code{.cpp}
+ * CopyProgress progress;
+ * auto op = copy_dir_async(source, target, CopyFlag::CopyAttributes,
+ *                          &progress);
+ *
+ * while (!op.wait_for(std::chrono::milliseconds(500))) {
+ *     report(progress.bytes);
+ * }
+ *
+ * if (auto &ret = op.get(); !ret) {
+ *     ...
+ * }
+ * \endcode
+ */
+
+namespace mb::util
+{
+
+/*!
+ * \brief Copy a directory tree in the background
+ *
+ * \param source Source directory
+ * \param target Target directory
+ * \param flags Copy flags (see copy_dir())
+ * \param progress Progress counters. Must outlive the operation. If nullptr,
+ *                 internal counters are used so that the operation can still
+ *                 be cancelled.
+ *
+ * \return Handle for the operation. AsyncOp::cancel() stops the copy at the
+ *         next file or data chunk.
+ */
+AsyncOp<FileOpResult<void>> copy_dir_async(std::string source,
+                                           std::string target,
+                                           CopyFlags flags,
+                                           CopyProgress *progress)
+{
+    std::shared_ptr<CopyProgress> owned;
+    if (!progress) {
+        owned = std::make_shared<CopyProgress>();
+        progress = owned.get();
+    }
+
+    auto io_path = target;
+
+    return AsyncOp<FileOpResult<void>>::run(std::move(io_path),
+            [source = std::move(source), target = std::move(target), flags,
+             progress, owned] {
+        return copy_dir(source, target, flags, progress);
+    }, [progress, owned] {
+        progress->cancelled = true;
+    });
+}
+
+/*!
+ * \brief Copy the contents of a file in the background
+ *
+ * \sa copy_dir_async()
+ */
+AsyncOp<FileOpResult<void>> copy_contents_async(std::string source,
+                                                std::string target,
+                                                CopyProgress *progress)
+{
+    std::shared_ptr<CopyProgress> owned;
+    if (!progress) {
+        owned = std::make_shared<CopyProgress>();
+        progress = owned.get();
+    }
+
+    auto io_path = target;
+
+    return AsyncOp<FileOpResult<void>>::run(std::move(io_path),
+            [source = std::move(source), target = std::move(target),
+             progress, owned] {
+        return copy_contents(source, target, progress);
+    }, [progress, owned] {
+        progress->cancelled = true;
+    });
+}
+
+/*!
+ * \brief Recursively delete a path in the background
+ *
+ * Deletion cannot be cancelled. AsyncOp::cancel() is a no-op.
+ *
+ * \param path Path to delete
+ * \param flags Delete flags (see delete_recursive())
+ * \param progress Progress counters. Must outlive the operation.
+ *
+ * \return Handle for the operation
+ */
+AsyncOp<FileOpResult<void>> delete_recursive_async(std::string path,
+                                                   DeleteFlags flags,
+                                                   DeleteProgress *progress)
+{
+    auto io_path = path;
+
+    return AsyncOp<FileOpResult<void>>::run(std::move(io_path),
+            [path = std::move(path), flags, progress] {
+        return delete_recursive(path, flags, progress);
+    });
+}
+
+/*!
+ * \brief Compute the SHA512 digest of a file in the background
+ *
+ * \param path Path to file
+ *
+ * \return Handle for the operation. AsyncOp::cancel() is a no-op.
+ */
+AsyncOp<oc::result<Sha512Digest>> sha512_hash_async(std::string path)
+{
+    auto io_path = path;
+
+    return AsyncOp<oc::result<Sha512Digest>>::run(std::move(io_path),
+            [path = std::move(path)] {
+        return sha512_hash(path);
+    });
+}
+
+}
@@ -19,6 +19,9 @@
 
 #include "mbutil/blkid.h"
 
+#include <algorithm>
+#include <atomic>
+#include <thread>
 #include <vector>
 
 #include <cerrno>
@@ -33,6 +36,11 @@
 // NOTE: We don't use libblkid from util-linux because we don't need most of its
 // features and it increases mbtool's binary size more than 200KiB (armeabi-v7a)
 
+// Large enough for the btrfs superblock, which is the furthest from the start
+static constexpr size_t PROBE_SIZE = 128 * 1024;
+
+static constexpr size_t MAX_PROBE_THREADS = 8;
+
 namespace mb::util
 {
 
@@ -109,12 +117,13 @@ static ProbeFunc g_probe_funcs[] = {
     { "vfat",     &is_vfat },
 };
 
-static oc::result<size_t> read_all(int fd, void *buf, size_t size)
+static oc::result<size_t> pread_all(int fd, void *buf, size_t size)
 {
     size_t total = 0;
 
     while (total < size) {
-        ssize_t n = read(fd, static_cast<char *>(buf) + total, size - total);
+        ssize_t n = pread64(fd, static_cast<char *>(buf) + total,
+                            size - total, static_cast<off64_t>(total));
         if (n == 0) {
             break;
         } else if (n < 0) {
@@ -131,10 +140,9 @@ static oc::result<size_t> read_all(int fd, void *buf, size_t size)
     return total;
 }
 
-oc::result<std::string> blkid_get_fs_type(const std::string &path)
+static oc::result<std::string> probe_path(const std::string &path,
+                                          unsigned char *buf)
 {
-    std::vector<unsigned char> buf(1024 * 1024);
-
     int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
     if (fd < 0) {
         return ec_from_errno();
@@ -144,10 +152,10 @@ oc::result<std::string> blkid_get_fs_type(const std::string &path)
         close(fd);
     });
 
-    OUTCOME_TRY(n, read_all(fd, buf.data(), buf.size()));
+    OUTCOME_TRY(n, pread_all(fd, buf, PROBE_SIZE));
 
     for (auto const &pf : g_probe_funcs) {
-        if (pf.func(buf.data(), n)) {
+        if (pf.func(buf, n)) {
             return pf.name;
         }
     }
@@ -155,4 +163,65 @@ oc::result<std::string> blkid_get_fs_type(const std::string &path)
     return "";
 }
 
+/*!
+ * \brief Detect filesystem type
+ *
+ * Only the first 128 KiB of \p path are read. Every supported filesystem's
+ * superblock lies within that range.
+ *
+ * \param path Path to block device or image
+ *
+ * \return Filesystem type (`btrfs`, `exfat`, `ext`, `f2fs`, `ntfs`,
+ *         `squashfs`, or `vfat`), an empty string if the filesystem is not
+ *         recognized, or the error code if \p path could not be read
+ */
+oc::result<std::string> blkid_get_fs_type(const std::string &path)
+{
+    std::vector<unsigned char> buf(PROBE_SIZE);
+
+    return probe_path(path, buf.data());
+}
+
+/*!
+ * \brief Detect filesystem types of multiple paths concurrently
+ *
+ * \param paths Paths to block devices or images
+ *
+ * \return The result of blkid_get_fs_type() for each path in \p paths, in
+ *         the same order
+ */
+std::vector<oc::result<std::string>>
+blkid_get_fs_types(const std::vector<std::string> &paths)
+{
+    std::vector<oc::result<std::string>> results(
+            paths.size(), std::errc::operation_canceled);
+    std::atomic_size_t next{0};
+
+    auto worker = [&] {
+        std::vector<unsigned char> buf(PROBE_SIZE);
+
+        for (size_t i; (i = next++) < paths.size();) {
+            results[i] = probe_path(paths[i], buf.data());
+        }
+    };
+
+    // Probing is bound by I/O latency rather than CPU, so this does not
+    // depend on the number of CPUs
+    auto n_threads = std::min<size_t>(MAX_PROBE_THREADS, paths.size());
+
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < n_threads; ++i) {
+        threads.emplace_back(worker);
+    }
+
+    // The calling thread does its share of the work too
+    worker();
+
+    for (auto &t : threads) {
+        t.join();
+    }
+
+    return results;
+}
+
 }
@@ -19,76 +19,35 @@
 
 #include "mbutil/chmod.h"
 
-#include <cstdlib>
-
 #include <sys/stat.h>
-#include <unistd.h>
 
 #include "mbcommon/error_code.h"
-#include "mbcommon/string.h"
-#include "mbutil/fts.h"
+#include "mbutil/tree_attrs_p.h"
 
 
 namespace mb::util
 {
 
-class RecursiveChmod : public FtsWrapper {
-public:
-    std::error_code ec;
-
-    RecursiveChmod(std::string path, mode_t perms)
-        : FtsWrapper(std::move(path), FtsFlag::GroupSpecialFiles)
-        , _perms(perms)
-    {
-    }
-
-    Actions on_reached_directory_pre() override
-    {
-        // Do nothing. Need depth-first search.
-        return Action::Ok;
-    }
-
-    Actions on_reached_directory_post() override
-    {
-        return chmod_path() ? Action::Ok : Action::Fail;
-    }
-
-    Actions on_reached_file() override
-    {
-        return chmod_path() ? Action::Ok : Action::Fail;
-    }
-
-    Actions on_reached_symlink() override
-    {
-        return Action::Skip;
-    }
-
-    Actions on_reached_special_file() override
-    {
-        return chmod_path() ? Action::Ok : Action::Fail;
-    }
-
-private:
-    mode_t _perms;
-
-    bool chmod_path()
-    {
-        if (::chmod(_curr->fts_accpath, _perms) < 0) {
-            ec = ec_from_errno();
-            return false;
-        }
-        return true;
-    }
-};
-
-
+/*!
+ * \brief Change the mode of a path
+ *
+ * With ChmodFlag::Recursive, symlinks are skipped and entries that already
+ * have the mode are not written to (see detail::set_tree_attrs()).
+ *
+ * \param path Path to change
+ * \param perms Permission bits
+ * \param flags Chmod flags
+ *
+ * \return Nothing on success or the first error that occurred
+ */
 oc::result<void> chmod(const std::string &path, mode_t perms, ChmodFlags flags)
 {
     if (flags & ChmodFlag::Recursive) {
-        RecursiveChmod fts(path, perms);
-        if (!fts.run()) {
-            return fts.ec;
-        }
+        detail::TreeAttrs attrs;
+        attrs.mode = perms;
+        attrs.parallel = flags & ChmodFlag::Parallel;
+
+        return detail::set_tree_attrs(path, attrs);
     } else {
         if (::chmod(path.c_str(), perms) < 0) {
             return ec_from_errno();
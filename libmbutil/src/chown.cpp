@@ -28,7 +28,7 @@
 #include <unistd.h>
 
 #include "mbcommon/error_code.h"
-#include "mbutil/fts.h"
+#include "mbutil/tree_attrs_p.h"
 
 
 namespace mb::util
@@ -54,55 +54,6 @@ static oc::result<void> chown_internal(const std::string &path,
     return oc::success();
 }
 
-class RecursiveChown : public FtsWrapper {
-public:
-    std::error_code ec;
-
-    RecursiveChown(std::string path, uid_t uid, gid_t gid,
-                   bool follow_symlinks)
-        : FtsWrapper(std::move(path), FtsFlag::GroupSpecialFiles)
-        , _uid(uid)
-        , _gid(gid)
-        , _follow_symlinks(follow_symlinks)
-    {
-    }
-
-    Actions on_reached_directory_post() override
-    {
-        return chown_path() ? Action::Ok : Action::Fail;
-    }
-
-    Actions on_reached_file() override
-    {
-        return chown_path() ? Action::Ok : Action::Fail;
-    }
-
-    Actions on_reached_symlink() override
-    {
-        return chown_path() ? Action::Ok : Action::Fail;
-    }
-
-    Actions on_reached_special_file() override
-    {
-        return chown_path() ? Action::Ok : Action::Fail;
-    }
-
-private:
-    uid_t _uid;
-    gid_t _gid;
-    bool _follow_symlinks;
-
-    bool chown_path()
-    {
-        if (auto r = chown_internal(
-                _curr->fts_accpath, _uid, _gid, _follow_symlinks); !r) {
-            ec = r.error();
-            return false;
-        }
-        return true;
-    }
-};
-
 // WARNING: Not thread safe! Android doesn't have getpwnam_r() or getgrnam_r()
 oc::result<void> chown(const std::string &path,
                        const std::string &user,
@@ -143,12 +94,13 @@ oc::result<void> chown(const std::string &path,
                        ChownFlags flags)
 {
     if (flags & ChownFlag::Recursive) {
-        RecursiveChown fts(path, uid, gid, flags & ChownFlag::FollowSymlinks);
-        if (!fts.run()) {
-            return fts.ec;
-        } else {
-            return oc::success();
-        }
+        detail::TreeAttrs attrs;
+        attrs.uid = uid;
+        attrs.gid = gid;
+        attrs.follow_symlinks = flags & ChownFlag::FollowSymlinks;
+        attrs.parallel = flags & ChownFlag::Parallel;
+
+        return detail::set_tree_attrs(path, attrs);
     } else {
         return chown_internal(path, uid, gid, flags & ChownFlag::FollowSymlinks);
     }
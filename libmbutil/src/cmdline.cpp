@@ -37,7 +37,7 @@ oc::result<KernelCmdlineArgs> kernel_cmdline()
 
     KernelCmdlineArgs result;
 
-    for (auto const &item : split_sv(data, " ")) {
+    for (auto const &item : split_range(data, ' ')) {
         if (item.empty()) {
             continue;
         }
@@ -20,6 +20,8 @@
 #include "mbutil/command.h"
 
 #include <array>
+#include <chrono>
+#include <memory>
 
 #include <cerrno>
 #include <cstdarg>
@@ -325,75 +327,183 @@ bool command_raw_reader(CommandCtx &ctx, const CmdRawCb &cb)
     return ret;
 }
 
-struct CommandLineReaderCtx
+// Size of each stream's line buffer. Longer lines are split.
+static constexpr size_t LINE_BUF_SIZE = 4096;
+
+struct LineStream
 {
-    std::array<char, 4096> stdout_buf;
-    std::array<char, 4096> stderr_buf;
-    size_t stdout_used = 0;
-    size_t stderr_used = 0;
+    int fd;
+    std::unique_ptr<char[]> buf;
+    // Unconsumed data is in [begin, end). Everything before scan has already
+    // been searched for a newline.
+    size_t begin;
+    size_t scan;
+    size_t end;
 };
 
-static void command_line_reader_cb(CommandLineReaderCtx &ctx,
-                                   std::string_view data, bool error,
-                                   const CmdLineCb &cb)
+// Pass each complete line in the stream's buffer to the callback. The lines
+// point into the buffer, so nothing is copied.
+static void emit_lines(LineStream &s, size_t index, const FdLineCb &cb)
+{
+    char *buf = s.buf.get();
+    char *newline;
+
+    while ((newline = static_cast<char *>(
+            memchr(buf + s.scan, '\n', s.end - s.scan)))) {
+        auto line_end = static_cast<size_t>(newline - buf) + 1;
+
+        cb(index, {buf + s.begin, line_end - s.begin});
+
+        s.begin = line_end;
+        s.scan = line_end;
+    }
+
+    s.scan = s.end;
+
+    if (s.begin == s.end) {
+        s.begin = s.scan = s.end = 0;
+    }
+}
+
+// Make room at the end of the buffer for the next read
+static void make_room(LineStream &s, size_t index, const FdLineCb &cb)
 {
-    size_t cap = (error ? ctx.stderr_buf : ctx.stdout_buf).size();
-    char *buf = (error ? ctx.stderr_buf : ctx.stdout_buf).data();
-    size_t &used = error ? ctx.stderr_used : ctx.stdout_used;
-
-    // Reached EOF
-    if (data.size() == 0 && used > 0) {
-        cb({buf, used}, error);
-        used = 0;
+    if (s.end < LINE_BUF_SIZE) {
+        return;
     }
 
-    while (data.size() > 0) {
-        // Copy as much as we can into the buffer
-        size_t n = std::min(cap - used, data.size());
-        memcpy(buf + used, data.data(), n);
+    if (s.begin > 0) {
+        // Move the partial line to the beginning of the buffer
+        memmove(s.buf.get(), s.buf.get() + s.begin, s.end - s.begin);
+        s.end -= s.begin;
+        s.scan = s.end;
+        s.begin = 0;
+    } else {
+        // The line is too long to fit in the buffer
+        cb(index, {s.buf.get(), s.end});
+        s.begin = s.scan = s.end = 0;
+    }
+}
+
+/*!
+ * \brief Read lines from several fds until all of them reach EOF
+ *
+ * The fds are multiplexed with poll() and data is read directly into a
+ * buffer per fd. Lines are passed to \p cb as views into that buffer, so they
+ * are only valid for the duration of the callback. A final line without a
+ * trailing newline is passed to \p cb when its fd reaches EOF.
+ *
+ * The fds are not closed.
+ *
+ * \param fds List of fds to read from. Negative fds are ignored.
+ * \param cb Callback for each line
+ * \param timeout Maximum amount of time to wait for all fds to reach EOF
+ *
+ * \return True if all fds reached EOF. False with errno set to ETIMEDOUT if
+ *         the timeout expired or some other value if reading or polling
+ *         failed.
+ */
+bool fd_line_reader(const std::vector<int> &fds, const FdLineCb &cb,
+                    std::optional<std::chrono::milliseconds> timeout)
+{
+    using std::chrono::milliseconds;
+    using std::chrono::steady_clock;
+
+    std::vector<LineStream> streams;
+    std::vector<pollfd> pfds;
+    size_t remaining = 0;
 
-        // Advance pointer
-        data.remove_prefix(n);
-        used += n;
+    streams.reserve(fds.size());
+    pfds.reserve(fds.size());
 
-        // Call cb for each contained line
-        char *ptr = buf;
-        size_t remain = used;
-        char *newline;
-        while ((newline = static_cast<char *>(memchr(ptr, '\n', remain)))) {
-            size_t line_size = static_cast<size_t>(newline - ptr) + 1;
+    for (int fd : fds) {
+        streams.push_back({fd, fd >= 0 ? std::make_unique<char[]>(LINE_BUF_SIZE)
+                                       : nullptr, 0, 0, 0});
+        pfds.push_back({fd, POLLIN, 0});
 
-            cb({ptr, line_size}, error);
+        if (fd >= 0) {
+            ++remaining;
+        }
+    }
+
+    std::optional<steady_clock::time_point> deadline;
+    if (timeout) {
+        deadline = steady_clock::now() + *timeout;
+    }
+
+    while (remaining > 0) {
+        int poll_timeout = -1;
 
-            // Advance pointer for next search
-            ptr += line_size;
-            remain -= line_size;
+        if (deadline) {
+            auto now = steady_clock::now();
+            if (now >= *deadline) {
+                errno = ETIMEDOUT;
+                return false;
+            }
+
+            // Round up so that poll() does not return just before the
+            // deadline
+            poll_timeout = static_cast<int>(
+                    std::chrono::ceil<milliseconds>(*deadline - now).count());
         }
 
-        // ptr now points to the character after the last newline
-        size_t consumed = static_cast<size_t>(ptr - buf);
-        if (consumed == 0 && used == cap) {
-            // If nothing was consumed and the buffer is full, then the line is
-            // too long.
-            cb({buf, used}, error);
-            consumed = used;
+        int ret = poll(pfds.data(), pfds.size(), poll_timeout);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        } else if (ret == 0) {
+            continue;
         }
 
-        // Move unconsumed data to the beginning of the buffer
-        if (consumed > 0) {
-            used -= consumed;
-            memmove(buf, ptr, used);
+        for (size_t i = 0; i < pfds.size(); ++i) {
+            auto &pfd = pfds[i];
+            auto &s = streams[i];
+
+            // Data can still be buffered in the pipe after POLLHUP, so read
+            // until EOF in every case
+            if (pfd.fd < 0 || !(pfd.revents & (POLLIN | POLLHUP | POLLERR))) {
+                continue;
+            }
+
+            make_room(s, i, cb);
+
+            ssize_t n = read(pfd.fd, s.buf.get() + s.end,
+                             LINE_BUF_SIZE - s.end);
+            if (n < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK
+                        || errno == EINTR) {
+                    continue;
+                }
+                return false;
+            } else if (n == 0) {
+                if (s.begin != s.end) {
+                    cb(i, {s.buf.get() + s.begin, s.end - s.begin});
+                }
+
+                pfd.fd = -1;
+                s.buf.reset();
+                --remaining;
+            } else {
+                s.end += static_cast<size_t>(n);
+                emit_lines(s, i, cb);
+            }
         }
     }
+
+    return true;
 }
 
-bool command_line_reader(CommandCtx &ctx, const CmdLineCb &cb)
+bool command_line_reader(CommandCtx &ctx, const CmdLineCb &cb,
+                         std::optional<std::chrono::milliseconds> timeout)
 {
-    CommandLineReaderCtx reader_ctx;
-
-    return command_raw_reader(ctx, [&](std::string_view data, bool error) {
-        command_line_reader_cb(reader_ctx, data, error, cb);
-    });
+    return fd_line_reader({
+        ctx._priv->stdout_pipe[0],
+        ctx._priv->stderr_pipe[0],
+    }, [&](size_t index, std::string_view line) {
+        cb(line, index == 1);
+    }, timeout);
 }
 
 int run_command(const std::string &path,
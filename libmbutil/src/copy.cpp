@@ -19,20 +19,38 @@
 
 #include "mbutil/copy.h"
 
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <utility>
+#include <vector>
+
 #include <cerrno>
 #include <cstdlib>
 #include <cstring>
 #include <fcntl.h>
 #include <fts.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/xattr.h>
 #include <unistd.h>
 
+#include "mbcommon/common.h"
 #include "mbcommon/error_code.h"
 #include "mbcommon/finally.h"
+#include "mbcommon/perf.h"
 #include "mbcommon/string.h"
+#include "mbcommon/thread_pool.h"
 #include "mblog/logging.h"
+#include "mbutil/file.h"
 #include "mbutil/fts.h"
+#include "mbutil/hash.h"
+#include "mbutil/page_cache.h"
 #include "mbutil/path.h"
 #include "mbutil/string.h"
 
@@ -44,35 +62,613 @@
 namespace mb::util
 {
 
-oc::result<void> copy_data_fd(int fd_source, int fd_target)
+// Data is copied with the fastest method that works for the pair of file
+// descriptors. If a method is not supported (eg. old kernel or copying across
+// filesystems), the next one in the chain is used:
+//
+//   copy_file_range() -> sendfile() -> read()/write()
+//   splice()          -> read()/write()
+enum class CopyMethod
+{
+    CopyFileRange,
+    Sendfile,
+    Splice,
+    ReadWrite,
+};
+
+static constexpr size_t COPY_BUF_SIZE = 1024 * 1024;
+static constexpr size_t COPY_BUF_ALIGN = 4096;
+// Limit per-syscall transfer size so that no single call blocks for too long
+static constexpr size_t COPY_MAX_CHUNK = 1024 * 1024 * 1024;
+// Smaller limit when progress is reported so that the counters and
+// cancellation stay responsive
+static constexpr size_t COPY_PROGRESS_CHUNK = 8 * 1024 * 1024;
+
+static perf::Counter g_copy_bytes("util.copy.bytes");
+static perf::Counter g_copy_linked("util.copy.linked");
+
+#ifndef FICLONE
+#  define FICLONE _IOW(0x94, 9, int)
+#endif
+
+static ssize_t sys_copy_file_range(int fd_in, int fd_out, size_t len)
+{
+#ifdef __NR_copy_file_range
+    return syscall(__NR_copy_file_range, fd_in, nullptr, fd_out, nullptr,
+                   len, 0u);
+#else
+    (void) fd_in;
+    (void) fd_out;
+    (void) len;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+// Whether a method failed because it cannot handle these file descriptors
+// rather than because of an I/O error
+static bool is_unsupported_error(int error)
 {
-    char buf[10240];
-    ssize_t nread;
+    return error == ENOSYS
+            || error == EINVAL
+            || error == EXDEV
+            || error == EOPNOTSUPP
+            || error == ENOTSUP
+            || error == EBADF;
+}
+
+static CopyMethod initial_copy_method(const struct stat &sb_source,
+                                      const struct stat &sb_target)
+{
+    if (S_ISFIFO(sb_source.st_mode) || S_ISFIFO(sb_target.st_mode)) {
+        return CopyMethod::Splice;
+    } else if (S_ISREG(sb_source.st_mode) && S_ISREG(sb_target.st_mode)) {
+        return CopyMethod::CopyFileRange;
+    } else if (S_ISREG(sb_source.st_mode) || S_ISBLK(sb_source.st_mode)) {
+        return CopyMethod::Sendfile;
+    } else {
+        return CopyMethod::ReadWrite;
+    }
+}
+
+class DataCopier
+{
+public:
+    DataCopier(int fd_source, int fd_target, CopyMethod method,
+               CopyProgress *progress)
+        : _fd_source(fd_source)
+        , _fd_target(fd_target)
+        , _method(method)
+        , _progress(progress)
+        , _buf(nullptr, &free)
+    {
+    }
+
+    // Keep the data out of the page cache and write it back steadily. Only
+    // worth the extra system calls for large files.
+    void stream_once()
+    {
+        auto offset = [](int fd) {
+            off_t pos = lseek(fd, 0, SEEK_CUR);
+            return pos < 0 ? uint64_t(0) : static_cast<uint64_t>(pos);
+        };
+
+        _cache_source.reset(_fd_source, StreamDirection::Read,
+                            offset(_fd_source));
+        _cache_target.reset(_fd_target, StreamDirection::Write,
+                            offset(_fd_target));
+    }
 
-    while ((nread = read(fd_source, buf, sizeof(buf))) > 0) {
-        char *out_ptr = buf;
-        ssize_t nwritten;
+    // Copy up to size bytes (or until EOF) from the current source offset to
+    // the current target offset. Returns the number of bytes copied.
+    oc::result<uint64_t> copy(uint64_t size)
+    {
+        uint64_t total = 0;
+        size_t max_chunk = _progress ? COPY_PROGRESS_CHUNK : COPY_MAX_CHUNK;
+
+        while (total < size) {
+            if (_progress && _progress->cancelled) {
+                return std::errc::operation_canceled;
+            }
+
+            auto to_copy = static_cast<size_t>(
+                    std::min<uint64_t>(size - total, max_chunk));
+            ssize_t n;
+
+            switch (_method) {
+            case CopyMethod::CopyFileRange:
+                n = sys_copy_file_range(_fd_source, _fd_target, to_copy);
+                break;
+            case CopyMethod::Sendfile:
+                n = sendfile(_fd_target, _fd_source, nullptr, to_copy);
+                break;
+            case CopyMethod::Splice:
+                n = splice(_fd_source, nullptr, _fd_target, nullptr, to_copy,
+                           SPLICE_F_MOVE);
+                break;
+            case CopyMethod::ReadWrite: {
+                OUTCOME_TRY(n_rw, read_write(to_copy));
+                n = static_cast<ssize_t>(n_rw);
+                break;
+            }
+            default:
+                MB_UNREACHABLE("Invalid copy method: %d",
+                               static_cast<int>(_method));
+            }
+
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                } else if (_method != CopyMethod::ReadWrite
+                        && is_unsupported_error(errno)) {
+                    fall_back();
+                    continue;
+                }
+                return ec_from_errno();
+            } else if (n == 0) {
+                break;
+            }
+
+            total += static_cast<uint64_t>(n);
+            if (_progress) {
+                _progress->bytes += static_cast<uint64_t>(n);
+            }
+
+            _cache_source.advance();
+            _cache_target.advance();
+        }
+
+        g_copy_bytes.add(total);
+
+        return total;
+    }
 
+    // Count data that didn't need to be copied (holes and reflinks) as
+    // progress
+    void skipped(uint64_t size)
+    {
+        if (_progress) {
+            _progress->bytes += size;
+        }
+    }
+
+private:
+    void fall_back()
+    {
+        LOGV("Copy method %d not supported: %s", static_cast<int>(_method),
+             strerror(errno));
+
+        if (_method == CopyMethod::CopyFileRange) {
+            _method = CopyMethod::Sendfile;
+        } else {
+            _method = CopyMethod::ReadWrite;
+        }
+    }
+
+    oc::result<size_t> read_write(size_t size)
+    {
+        if (!_buf) {
+            void *ptr;
+            if (int ret = posix_memalign(&ptr, COPY_BUF_ALIGN, COPY_BUF_SIZE);
+                    ret != 0) {
+                return std::error_code(ret, std::generic_category());
+            }
+            _buf.reset(static_cast<unsigned char *>(ptr));
+        }
+
+        ssize_t nread;
         do {
-            if ((nwritten = write(fd_target, out_ptr,
-                                  static_cast<size_t>(nread))) < 0) {
+            nread = read(_fd_source, _buf.get(),
+                         std::min(size, COPY_BUF_SIZE));
+        } while (nread < 0 && errno == EINTR);
+
+        if (nread < 0) {
+            return ec_from_errno();
+        }
+
+        unsigned char *out_ptr = _buf.get();
+        size_t remain = static_cast<size_t>(nread);
+
+        while (remain > 0) {
+            ssize_t nwritten = write(_fd_target, out_ptr, remain);
+            if (nwritten < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
                 return ec_from_errno();
             }
 
-            nread -= nwritten;
+            remain -= static_cast<size_t>(nwritten);
             out_ptr += nwritten;
-        } while (nread > 0);
+        }
+
+        return static_cast<size_t>(nread);
+    }
+
+    int _fd_source;
+    int _fd_target;
+    CopyMethod _method;
+    CopyProgress *_progress;
+    std::unique_ptr<unsigned char, decltype(&free)> _buf;
+    StreamCache _cache_source;
+    StreamCache _cache_target;
+};
+
+static oc::result<off_t> seek_fd(int fd, off_t offset, int whence)
+{
+    off_t ret = lseek(fd, offset, whence);
+    if (ret < 0) {
+        return ec_from_errno();
     }
+    return ret;
+}
 
-    if (nread < 0) {
+// Copy a regular file to a regular file, only copying the data extents of the
+// source file so that the target file is just as sparse. The target's final
+// size is set up front and each data extent is preallocated before it is
+// copied so that the target is not extended and fragmented write by write.
+static oc::result<void> copy_sparse_data(DataCopier &copier, int fd_source,
+                                         int fd_target, off_t size,
+                                         off_t tgt_size)
+{
+    OUTCOME_TRY(src_start, seek_fd(fd_source, 0, SEEK_CUR));
+    OUTCOME_TRY(tgt_start, seek_fd(fd_target, 0, SEEK_CUR));
+
+    // Target offset corresponding to a source offset
+    auto to_tgt = [&](off_t src_offset) {
+        return tgt_start + (src_offset - src_start);
+    };
+
+    // Turn the source range [begin, end) into a hole in the target, but only
+    // where there was already something in the target
+    auto make_hole = [&](off_t begin, off_t end) -> oc::result<void> {
+        off_t hole_begin = to_tgt(begin);
+        off_t hole_end = std::min(to_tgt(end), tgt_size);
+        if (hole_begin < hole_end) {
+            OUTCOME_TRYV(zero_range(fd_target,
+                                    static_cast<uint64_t>(hole_begin),
+                                    static_cast<uint64_t>(hole_end - hole_begin),
+                                    ZeroRangeFlag::Deallocate));
+        }
+        return oc::success();
+    };
+
+    if (src_start < size && to_tgt(size) > tgt_size
+            && ftruncate(fd_target, to_tgt(size)) < 0) {
         return ec_from_errno();
     }
 
+    off_t pos = src_start;
+
+    while (pos < size) {
+        off_t data = lseek(fd_source, pos, SEEK_DATA);
+        if (data < 0) {
+            if (errno == ENXIO) {
+                // The remainder of the file is a hole
+                data = size;
+            } else if (is_unsupported_error(errno)) {
+                // Copy the remainder without looking for holes
+                data = pos;
+            } else {
+                return ec_from_errno();
+            }
+        }
+        data = std::min(data, size);
+
+        OUTCOME_TRYV(make_hole(pos, data));
+        copier.skipped(static_cast<uint64_t>(data - pos));
+        if (data == size) {
+            pos = size;
+            break;
+        }
+
+        off_t hole = lseek(fd_source, data, SEEK_HOLE);
+        if (hole < 0) {
+            if (!is_unsupported_error(errno)) {
+                return ec_from_errno();
+            }
+            hole = size;
+        }
+        hole = std::min(hole, size);
+
+        OUTCOME_TRYV(seek_fd(fd_source, data, SEEK_SET));
+        OUTCOME_TRYV(seek_fd(fd_target, to_tgt(data), SEEK_SET));
+
+        // Best effort only. Not all filesystems support preallocation.
+        (void) fallocate(fd_target, FALLOC_FL_KEEP_SIZE, to_tgt(data),
+                         hole - data);
+
+        OUTCOME_TRY(n, copier.copy(static_cast<uint64_t>(hole - data)));
+        pos = data + static_cast<off_t>(n);
+
+        if (pos < hole) {
+            // File was truncated while copying. Don't leave behind the space
+            // that was reserved for the missing data.
+            if (to_tgt(pos) > tgt_size
+                    && ftruncate(fd_target, to_tgt(pos)) < 0) {
+                return ec_from_errno();
+            }
+            return oc::success();
+        }
+    }
+
+    OUTCOME_TRYV(seek_fd(fd_source, pos, SEEK_SET));
+    OUTCOME_TRYV(seek_fd(fd_target, to_tgt(pos), SEEK_SET));
+
+    // Copy anything that was appended while copying
+    OUTCOME_TRYV(copier.copy(UINT64_MAX));
+
     return oc::success();
 }
 
+// Copy from the current offset of fd_source to the current offset of fd_target
+// until EOF is reached. Reflinks are used if both files are empty or at offset
+// 0 and the filesystem supports it.
+oc::result<void> copy_data_fd(int fd_source, int fd_target,
+                              CopyProgress *progress)
+{
+    struct stat sb_source;
+    struct stat sb_target;
+
+    if (fstat(fd_source, &sb_source) < 0 || fstat(fd_target, &sb_target) < 0) {
+        return ec_from_errno();
+    }
+
+    DataCopier copier(fd_source, fd_target,
+                      initial_copy_method(sb_source, sb_target), progress);
+
+    bool bulk = S_ISBLK(sb_source.st_mode) || S_ISBLK(sb_target.st_mode)
+            || (S_ISREG(sb_source.st_mode) && static_cast<uint64_t>(
+                    sb_source.st_size) >= StreamCache::WINDOW_SIZE);
+
+    if (!S_ISREG(sb_source.st_mode) || !S_ISREG(sb_target.st_mode)) {
+        if (bulk) {
+            copier.stream_once();
+        }
+        OUTCOME_TRYV(copier.copy(UINT64_MAX));
+        return oc::success();
+    }
+
+    if (sb_target.st_size == 0
+            && lseek(fd_source, 0, SEEK_CUR) == 0
+            && lseek(fd_target, 0, SEEK_CUR) == 0
+            && ioctl(fd_target, FICLONE, fd_source) == 0) {
+        OUTCOME_TRYV(seek_fd(fd_source, 0, SEEK_END));
+        OUTCOME_TRYV(seek_fd(fd_target, 0, SEEK_END));
+        copier.skipped(static_cast<uint64_t>(sb_source.st_size));
+        return oc::success();
+    }
+
+    // Reflinks don't go through the page cache, so this is only set up now
+    if (bulk) {
+        copier.stream_once();
+    }
+
+    return copy_sparse_data(copier, fd_source, fd_target, sb_source.st_size,
+                            sb_target.st_size);
+}
+
+// Handle to a file whose xattrs are accessed by file descriptor if one is
+// open or by path otherwise (without following symlinks)
+struct XattrFile
+{
+    int fd;
+    const char *path;
+
+    ssize_t list(char *buf, size_t size) const
+    {
+        return fd >= 0 ? flistxattr(fd, buf, size)
+                : llistxattr(path, buf, size);
+    }
+
+    ssize_t get(const char *name, void *buf, size_t size) const
+    {
+        return fd >= 0 ? fgetxattr(fd, name, buf, size)
+                : lgetxattr(path, name, buf, size);
+    }
+
+    int set(const char *name, const void *buf, size_t size) const
+    {
+        return fd >= 0 ? fsetxattr(fd, name, buf, size, 0)
+                : lsetxattr(path, name, buf, size, 0);
+    }
+};
+
+// Copies xattrs between files, reusing its buffers across calls. Within a copy
+// session, this avoids the size probing calls for nearly every attribute and
+// stops trying once either filesystem has reported that xattrs are not
+// supported. Not thread safe, so each thread needs its own instance.
+class XattrCopier
+{
+public:
+    XattrCopier()
+        : _source_unsupported(false)
+        , _target_unsupported(false)
+    {
+        _names.resize(1024);
+        _value.resize(256);
+        _target_value.resize(256);
+    }
+
+    FileOpResult<void> copy(const XattrFile &source, const XattrFile &target)
+    {
+        if (_source_unsupported || _target_unsupported) {
+            return oc::success();
+        }
+
+        // xattr names are in a NULL-separated list
+        ssize_t size = fill(_names, [&](char *buf, size_t buf_size) {
+            return source.list(buf, buf_size);
+        });
+        if (size < 0) {
+            if (errno == ENOTSUP) {
+                LOGV("%s: xattrs not supported on source filesystem",
+                     source.path);
+                _source_unsupported = true;
+                return oc::success();
+            } else {
+                return FileOpErrorInfo{source.path, ec_from_errno()};
+            }
+        }
+
+        const char *names_end = _names.data() + size;
+
+        for (const char *name = _names.data(); name < names_end;
+                name = strchr(name, '\0') + 1) {
+            ssize_t value_size = fill(_value, [&](char *buf, size_t buf_size) {
+                return source.get(name, buf, buf_size);
+            });
+            if (value_size < 0) {
+                return FileOpErrorInfo{source.path, ec_from_errno()};
+            }
+
+            // Newly created files usually get the right SELinux label from the
+            // policy already. Setting it again is comparatively expensive.
+            if (strcmp(name, SELINUX_XATTR) == 0) {
+                ssize_t cur_size = fill(_target_value,
+                                        [&](char *buf, size_t buf_size) {
+                    return target.get(name, buf, buf_size);
+                });
+                if (cur_size == value_size && memcmp(
+                        _target_value.data(), _value.data(),
+                        static_cast<size_t>(value_size)) == 0) {
+                    continue;
+                }
+            }
+
+            if (target.set(name, _value.data(),
+                           static_cast<size_t>(value_size)) < 0) {
+                if (errno == ENOTSUP) {
+                    LOGV("%s: xattrs not supported on target filesystem",
+                         target.path);
+                    _target_unsupported = true;
+                    break;
+                } else {
+                    return FileOpErrorInfo{target.path, ec_from_errno()};
+                }
+            }
+        }
+
+        return oc::success();
+    }
+
+private:
+    static constexpr char SELINUX_XATTR[] = "security.selinux";
+
+    // Call fn with the buffer, growing it if the result doesn't fit. Returns
+    // the size of the result or -1 with errno set.
+    template<typename Fn>
+    static ssize_t fill(std::string &buf, Fn &&fn)
+    {
+        while (true) {
+            ssize_t n = fn(buf.data(), buf.size());
+            if (n >= 0 || errno != ERANGE) {
+                return n;
+            }
+
+            // Probe for the required size. The value may still change before
+            // the next call, so keep looping until it fits.
+            n = fn(nullptr, 0);
+            if (n < 0) {
+                return n;
+            }
+
+            buf.resize(std::max(buf.size() * 2, static_cast<size_t>(n)));
+        }
+    }
+
+    std::string _names;
+    std::string _value;
+    std::string _target_value;
+    bool _source_unsupported;
+    bool _target_unsupported;
+};
+
+// Replace an existing target with a hardlink to the source if both are regular
+// files on the same filesystem and their SHA512 digests match. Filesystems with
+// reflink support already share the data when copying, but ext4 does not, so
+// this is the only way to avoid storing the same content twice there. Returns
+// whether the target now refers to the source.
+static FileOpResult<bool> link_if_identical(const std::string &source,
+                                            const std::string &target,
+                                            CopyProgress *progress)
+{
+    struct stat sb_source;
+    struct stat sb_target;
+
+    if (lstat(target.c_str(), &sb_target) < 0) {
+        if (errno == ENOENT) {
+            return false;
+        }
+        return FileOpErrorInfo{target, ec_from_errno()};
+    }
+
+    if (lstat(source.c_str(), &sb_source) < 0) {
+        return FileOpErrorInfo{source, ec_from_errno()};
+    }
+
+    if (!S_ISREG(sb_source.st_mode) || !S_ISREG(sb_target.st_mode)
+            || sb_source.st_dev != sb_target.st_dev
+            || sb_source.st_size != sb_target.st_size) {
+        return false;
+    }
+
+    if (sb_source.st_ino != sb_target.st_ino) {
+        auto source_digest = sha512_hash(source);
+        if (!source_digest) {
+            return FileOpErrorInfo{source, source_digest.error()};
+        }
+
+        auto target_digest = sha512_hash(target);
+        if (!target_digest) {
+            return FileOpErrorInfo{target, target_digest.error()};
+        }
+
+        if (source_digest.value() != target_digest.value()) {
+            return false;
+        }
+
+        // Link to a temporary path first so that the target is replaced
+        // atomically
+        auto temp_path = target + ".mblink";
+
+        if (unlink(temp_path.c_str()) < 0 && errno != ENOENT) {
+            return FileOpErrorInfo{temp_path, ec_from_errno()};
+        }
+
+        if (link(source.c_str(), temp_path.c_str()) < 0) {
+            // Hardlinks may not be supported or the source may have too many
+            if (errno == EPERM || errno == EMLINK || errno == EXDEV) {
+                return false;
+            }
+            return FileOpErrorInfo{temp_path, ec_from_errno()};
+        }
+
+        if (rename(temp_path.c_str(), target.c_str()) < 0) {
+            auto ec = ec_from_errno();
+            unlink(temp_path.c_str());
+            return FileOpErrorInfo{target, ec};
+        }
+
+        g_copy_linked.add();
+    }
+
+    if (progress) {
+        progress->bytes += static_cast<uint64_t>(sb_source.st_size);
+        ++progress->files;
+    }
+
+    return true;
+}
+
+// Copy a regular file to a new path. If CopyFlag::CopyAttributes is set, the
+// ownership and mode are copied via the open file descriptors. If xattrs is not
+// null, the xattrs are copied by file descriptor as well.
 static FileOpResult<void> copy_data(const std::string &source,
-                                    const std::string &target)
+                                    const std::string &target,
+                                    CopyFlags flags = {},
+                                    XattrCopier *xattrs = nullptr,
+                                    CopyProgress *progress = nullptr)
 {
     int fd_source = open(source.c_str(), O_RDONLY | O_CLOEXEC);
     if (fd_source < 0) {
@@ -93,69 +689,58 @@ static FileOpResult<void> copy_data(const std::string &source,
         close(fd_target);
     });
 
-    if (auto r = copy_data_fd(fd_source, fd_target); !r) {
+    if (auto r = copy_data_fd(fd_source, fd_target, progress); !r) {
         // TODO: OR SOURCE?
         return FileOpErrorInfo{target, r.error()};
     }
 
+    // Same as copy_stat(). This must happen before copying the xattrs since
+    // changing the owner clears security.capability.
+    if (flags & CopyFlag::CopyAttributes) {
+        struct stat sb;
+
+        if (fstat(fd_source, &sb) < 0) {
+            return FileOpErrorInfo{source, ec_from_errno()};
+        }
+
+        if (fchown(fd_target, sb.st_uid, sb.st_gid) < 0
+                || fchmod(fd_target,
+                          sb.st_mode & static_cast<mode_t>(~S_IFMT)) < 0) {
+            return FileOpErrorInfo{target, ec_from_errno()};
+        }
+    }
+
+    if (xattrs) {
+        OUTCOME_TRYV(xattrs->copy({fd_source, source.c_str()},
+                                  {fd_target, target.c_str()}));
+    }
+
     close_target_fd.dismiss();
 
     if (close(fd_target) < 0) {
         return FileOpErrorInfo{target, ec_from_errno()};
     }
 
+    if (progress) {
+        ++progress->files;
+    }
+
     return oc::success();
 }
 
 FileOpResult<void> copy_xattrs(const std::string &source,
                                const std::string &target)
 {
-    // xattr names are in a NULL-separated list
-    ssize_t size = llistxattr(source.c_str(), nullptr, 0);
-    if (size < 0) {
-        if (errno == ENOTSUP) {
-            LOGV("%s: xattrs not supported on source filesystem",
-                 source.c_str());
-            return oc::success();
-        } else {
-            return FileOpErrorInfo{source, ec_from_errno()};
-        }
-    }
-
-    std::string names;
-    names.resize(static_cast<size_t>(size));
-
-    size = llistxattr(source.c_str(), names.data(), names.size());
-    if (size < 0) {
-        return FileOpErrorInfo{source, ec_from_errno()};
-    }
-
-    std::string value;
-
-    for (char *name = names.data(); *name; name = strchr(name, '\0') + 1) {
-        size = lgetxattr(source.c_str(), name, nullptr, 0);
-        if (size < 0) {
-            return FileOpErrorInfo{source, ec_from_errno()};
-        }
-
-        value.resize(static_cast<size_t>(size));
-
-        size = lgetxattr(source.c_str(), name, value.data(), value.size());
-        if (size < 0) {
-            return FileOpErrorInfo{source, ec_from_errno()};
-        }
+    XattrCopier copier;
+    return copier.copy({-1, source.c_str()}, {-1, target.c_str()});
+}
 
-        if (lsetxattr(target.c_str(), name, value.data(), value.size(), 0) < 0) {
-            if (errno == ENOTSUP) {
-                LOGV("%s: xattrs not supported on target filesystem",
-                     target.c_str());
-                break;
-            } else {
-                return FileOpErrorInfo{target, ec_from_errno()};
-            }
-        }
+oc::result<void> copy_xattrs_fd(int fd_source, int fd_target)
+{
+    XattrCopier copier;
+    if (auto r = copier.copy({fd_source, ""}, {fd_target, ""}); !r) {
+        return r.error().ec;
     }
-
     return oc::success();
 }
 
@@ -183,7 +768,8 @@ FileOpResult<void> copy_stat(const std::string &source,
 }
 
 FileOpResult<void> copy_contents(const std::string &source,
-                                 const std::string &target)
+                                 const std::string &target,
+                                 CopyProgress *progress)
 {
     int fd_source = open(source.c_str(), O_RDONLY | O_CLOEXEC);
     if (fd_source < 0) {
@@ -204,16 +790,21 @@ FileOpResult<void> copy_contents(const std::string &source,
         close(fd_target);
     });
 
-    if (auto r = copy_data_fd(fd_source, fd_target); !r) {
+    if (auto r = copy_data_fd(fd_source, fd_target, progress); !r) {
         // TODO: OR SOURCE?
-        return FileOpErrorInfo{target, ec_from_errno()};
+        return FileOpErrorInfo{target, r.error()};
+    }
+
+    if (progress) {
+        ++progress->files;
     }
 
     return oc::success();
 }
 
 FileOpResult<void> copy_file(const std::string &source,
-                             const std::string &target, CopyFlags flags)
+                             const std::string &target, CopyFlags flags,
+                             CopyProgress *progress)
 {
     mode_t old_umask = umask(0);
 
@@ -221,6 +812,16 @@ FileOpResult<void> copy_file(const std::string &source,
         umask(old_umask);
     });
 
+    // The target shares the source's inode, so the attributes and xattrs are
+    // already identical
+    if ((flags & CopyFlag::LinkIdentical)
+            && !(flags & CopyFlag::FollowSymlinks)) {
+        OUTCOME_TRY(linked, link_if_identical(source, target, progress));
+        if (linked) {
+            return oc::success();
+        }
+    }
+
     if (unlink(target.c_str()) < 0 && errno != ENOENT) {
         return FileOpErrorInfo{target, ec_from_errno()};
     }
@@ -270,7 +871,7 @@ FileOpResult<void> copy_file(const std::string &source,
         [[fallthrough]];
 
     case S_IFREG:
-        if (auto r = copy_data(source, target); !r) {
+        if (auto r = copy_data(source, target, {}, nullptr, progress); !r) {
             return r.as_failure();
         }
         break;
@@ -291,15 +892,134 @@ FileOpResult<void> copy_file(const std::string &source,
     return oc::success();
 }
 
+// Copy a regular file and its attributes as part of copy_dir()
+static FileOpResult<void> copy_dir_file(const std::string &source,
+                                        const std::string &target,
+                                        CopyFlags flags, XattrCopier &xattrs,
+                                        CopyProgress *progress)
+{
+    if (flags & CopyFlag::LinkIdentical) {
+        OUTCOME_TRY(linked, link_if_identical(source, target, progress));
+        if (linked) {
+            return oc::success();
+        }
+    }
+
+    if (unlink(target.c_str()) < 0 && errno != ENOENT) {
+        return FileOpErrorInfo{target, ec_from_errno()};
+    }
+
+    return copy_data(source, target, flags,
+                     (flags & CopyFlag::CopyXattrs) ? &xattrs : nullptr,
+                     progress);
+}
+
+// Copies regular files for copy_dir() and copy_files() as tasks on
+// ThreadPool::global(). Directories are still created by the thread walking
+// the tree, so a file's parent directory always exists by the time the file
+// is submitted.
+class ParallelFileCopier
+{
+public:
+    ParallelFileCopier(CopyFlags flags, CopyProgress *progress)
+        : _flags(flags)
+        , _progress(progress)
+        , _queued(0)
+    {
+    }
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(ParallelFileCopier)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(ParallelFileCopier)
+
+    void submit(std::string source, std::string target)
+    {
+        // Bound the number of tasks that have not started yet so that huge
+        // trees don't consume lots of memory. Past that, the calling thread
+        // copies the file itself.
+        if (_queued.fetch_add(1, std::memory_order_relaxed) >= MAX_QUEUED) {
+            _queued.fetch_sub(1, std::memory_order_relaxed);
+            copy(source, target);
+            return;
+        }
+
+        _group.run([this, source = std::move(source),
+                    target = std::move(target)] {
+            _queued.fetch_sub(1, std::memory_order_relaxed);
+            copy(source, target);
+        });
+    }
+
+    // Wait for all submitted files to be copied. Returns the first error that
+    // occurred, if any.
+    FileOpResult<void> finish()
+    {
+        _group.wait();
+
+        if (_error) {
+            return std::move(*_error);
+        }
+        return oc::success();
+    }
+
+private:
+    static constexpr size_t MAX_QUEUED = 256;
+
+    void copy(const std::string &source, const std::string &target)
+    {
+        auto xattrs = take_xattrs();
+
+        auto ret = copy_dir_file(source, target, _flags, *xattrs, _progress);
+
+        std::lock_guard lock(_mutex);
+
+        // Like the serial copy, keep going after a failure
+        if (!ret && !_error) {
+            LOGW("%s: Failed to copy file: %s",
+                 source.c_str(), ret.error().message().c_str());
+            _error = std::move(ret.error());
+        }
+
+        _xattrs.push_back(std::move(xattrs));
+    }
+
+    // XattrCopier is not thread safe, so each running task borrows one. They
+    // are reused for the rest of the copy so that a filesystem without xattr
+    // support is only probed a few times.
+    std::unique_ptr<XattrCopier> take_xattrs()
+    {
+        std::lock_guard lock(_mutex);
+
+        if (_xattrs.empty()) {
+            return std::make_unique<XattrCopier>();
+        }
+
+        auto xattrs = std::move(_xattrs.back());
+        _xattrs.pop_back();
+        return xattrs;
+    }
+
+    CopyFlags _flags;
+    CopyProgress *_progress;
+    // Number of submitted files that have not started yet
+    std::atomic_size_t _queued;
+    // Guards _error and _xattrs
+    std::mutex _mutex;
+    std::optional<FileOpErrorInfo> _error;
+    std::vector<std::unique_ptr<XattrCopier>> _xattrs;
+    // Declared last so that it is destroyed (and waited for) first
+    TaskGroup _group;
+};
 
 class RecursiveCopier : public FtsWrapper
 {
 public:
     FileOpErrorInfo error;
 
-    RecursiveCopier(std::string path, std::string target, CopyFlags copyflags)
+    RecursiveCopier(std::string path, std::string target, CopyFlags copyflags,
+                    CopyProgress *progress)
         : FtsWrapper(path, 0)
         , _copyflags(copyflags)
+        , _progress(progress)
         , _target(std::move(target))
     {
     }
@@ -331,11 +1051,46 @@ public:
             return false;
         }
 
+        if (_copyflags & CopyFlag::Parallel) {
+            _parallel.emplace(_copyflags, _progress);
+        }
+
         return true;
     }
 
+    bool on_post_execute(bool success) override
+    {
+        if (!_parallel) {
+            return success;
+        }
+
+        if (auto r = _parallel->finish(); !r) {
+            error = std::move(r.error());
+            success = false;
+        }
+        _parallel.reset();
+
+        // Directory attributes are applied after all of the files inside have
+        // been copied. Directories were recorded in post-order, so children
+        // are always finalized before their parents.
+        for (auto const &[source, target] : _pending_dirs) {
+            if (!cp_attrs(source, target) || !cp_xattrs(source, target)) {
+                success = false;
+            }
+        }
+        _pending_dirs.clear();
+
+        return success;
+    }
+
     Actions on_changed_path() override
     {
+        if (_progress && _progress->cancelled) {
+            error = {_curr->fts_path,
+                     std::make_error_code(std::errc::operation_canceled)};
+            return Action::Fail | Action::Stop;
+        }
+
         // Make sure we aren't copying the target on top of itself
         if (sb_target.st_dev == _curr->fts_statp->st_dev
                 && sb_target.st_ino == _curr->fts_statp->st_ino) {
@@ -410,6 +1165,11 @@ public:
 
     Actions on_reached_directory_post() override
     {
+        if (_parallel) {
+            _pending_dirs.emplace_back(_curr->fts_accpath, _curtgtpath);
+            return Action::Ok;
+        }
+
         if (!cp_attrs()) {
             return Action::Fail;
         }
@@ -423,24 +1183,17 @@ public:
 
     Actions on_reached_file() override
     {
-        if (!remove_existing_file()) {
-            return Action::Fail;
+        if (_parallel) {
+            _parallel->submit(_curr->fts_accpath, _curtgtpath);
+            return Action::Ok;
         }
 
-        // Copy file contents
-        if (auto r = copy_data(_curr->fts_accpath, _curtgtpath); !r) {
+        if (auto r = copy_dir_file(_curr->fts_accpath, _curtgtpath,
+                                   _copyflags, _xattrs, _progress); !r) {
             error = r.error();
             return Action::Fail;
         }
 
-        if (!cp_attrs()) {
-            return Action::Fail;
-        }
-
-        if (!cp_xattrs()) {
-            return Action::Fail;
-        }
-
         return Action::Ok;
     }
 
@@ -550,9 +1303,13 @@ public:
 
 private:
     CopyFlags _copyflags;
+    CopyProgress *_progress;
     std::string _target;
     struct stat sb_target;
     std::string _curtgtpath;
+    std::optional<ParallelFileCopier> _parallel;
+    std::vector<std::pair<std::string, std::string>> _pending_dirs;
+    XattrCopier _xattrs;
 
     bool remove_existing_file()
     {
@@ -565,9 +1322,14 @@ private:
     }
 
     bool cp_attrs()
+    {
+        return cp_attrs(_curr->fts_accpath, _curtgtpath);
+    }
+
+    bool cp_attrs(const std::string &source, const std::string &target)
     {
         if (_copyflags & CopyFlag::CopyAttributes) {
-            if (auto r = copy_stat(_curr->fts_accpath, _curtgtpath); !r) {
+            if (auto r = copy_stat(source, target); !r) {
                 error = r.error();
                 return false;
             }
@@ -576,9 +1338,15 @@ private:
     }
 
     bool cp_xattrs()
+    {
+        return cp_xattrs(_curr->fts_accpath, _curtgtpath);
+    }
+
+    bool cp_xattrs(const std::string &source, const std::string &target)
     {
         if (_copyflags & CopyFlag::CopyXattrs) {
-            if (auto r = copy_xattrs(_curr->fts_accpath, _curtgtpath); !r) {
+            if (auto r = _xattrs.copy({-1, source.c_str()},
+                                      {-1, target.c_str()}); !r) {
                 error = r.error();
                 return false;
             }
@@ -590,7 +1358,8 @@ private:
 
 // Copy as much as possible
 FileOpResult<void> copy_dir(const std::string &source,
-                            const std::string &target, CopyFlags flags)
+                            const std::string &target, CopyFlags flags,
+                            CopyProgress *progress)
 {
     mode_t old_umask = umask(0);
 
@@ -598,7 +1367,7 @@ FileOpResult<void> copy_dir(const std::string &source,
         umask(old_umask);
     });
 
-    RecursiveCopier copier(source, target, flags);
+    RecursiveCopier copier(source, target, flags, progress);
 
     if (!copier.run()) {
         return std::move(copier.error);
@@ -607,4 +1376,57 @@ FileOpResult<void> copy_dir(const std::string &source,
     return oc::success();
 }
 
+/*!
+ * \brief Copy a list of regular files
+ *
+ * Existing targets are replaced. The parent directories of the targets must
+ * already exist. With CopyFlag::Parallel, the files are copied concurrently as
+ * tasks on ThreadPool::global(), like copy_dir(). Like copy_dir(), copying continues after a
+ * failure.
+ *
+ * \param files List of (source, target) pairs
+ * \param flags Only CopyFlag::CopyAttributes, CopyFlag::CopyXattrs,
+ *              CopyFlag::Parallel, and CopyFlag::LinkIdentical are used
+ * \param progress Optional progress counters
+ *
+ * \return Nothing if all of the files were copied. Otherwise, the first error.
+ */
+FileOpResult<void> copy_files(
+        const std::vector<std::pair<std::string, std::string>> &files,
+        CopyFlags flags, CopyProgress *progress)
+{
+    mode_t old_umask = umask(0);
+
+    auto restore_umask = finally([&] {
+        umask(old_umask);
+    });
+
+    if (flags & CopyFlag::Parallel) {
+        ParallelFileCopier copier(flags, progress);
+
+        for (auto const &[source, target] : files) {
+            copier.submit(source, target);
+        }
+
+        return copier.finish();
+    }
+
+    XattrCopier xattrs;
+    std::optional<FileOpErrorInfo> error;
+
+    for (auto const &[source, target] : files) {
+        auto ret = copy_dir_file(source, target, flags, xattrs, progress);
+        if (!ret && !error) {
+            LOGW("%s: Failed to copy file: %s",
+                 source.c_str(), ret.error().message().c_str());
+            error = std::move(ret.error());
+        }
+    }
+
+    if (error) {
+        return std::move(*error);
+    }
+    return oc::success();
+}
+
 }
@@ -0,0 +1,805 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbutil/cpio.h"
+
+#include <algorithm>
+#include <map>
+#include <tuple>
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+
+#include <sys/stat.h>
+
+#include "mbcommon/file_error.h"
+#include "mbcommon/file_util.h"
+
+/*!
+ * \file mbutil/cpio.h
+ * \brief Streaming cpio reader and writer and in-memory cpio archive
+ */
+
+#define CPIO_MAGIC_NEWC         "070701"
+#define CPIO_MAGIC_CRC          "070702"
+#define CPIO_MAGIC_ODC          "070707"
+#define CPIO_MAGIC_SIZE         6
+
+#define CPIO_TRAILER            "TRAILER!!!"
+
+// magic + 13 8-digit hex fields
+#define CPIO_NEWC_HEADER_SIZE   110
+// magic + dev, ino, mode, uid, gid, nlink, rdev (6 digits), mtime (11 digits),
+// namesize (6 digits), filesize (11 digits)
+#define CPIO_ODC_HEADER_SIZE    76
+
+// Longer names are rejected instead of allocating arbitrary amounts of memory
+#define CPIO_MAX_NAME_SIZE      4096
+
+// Starting inode number for written newc archives (same as AOSP's mkbootfs)
+#define CPIO_FIRST_INODE        300000
+
+namespace mb::util
+{
+
+static bool parse_number(const char *str, size_t len, unsigned int base,
+                         uint64_t &out)
+{
+    uint64_t value = 0;
+
+    for (size_t i = 0; i < len; ++i) {
+        unsigned int digit;
+        char c = str[i];
+
+        if (c >= '0' && c <= '9') {
+            digit = static_cast<unsigned int>(c - '0');
+        } else if (c >= 'a' && c <= 'f') {
+            digit = static_cast<unsigned int>(c - 'a' + 10);
+        } else if (c >= 'A' && c <= 'F') {
+            digit = static_cast<unsigned int>(c - 'A' + 10);
+        } else {
+            return false;
+        }
+
+        if (digit >= base) {
+            return false;
+        }
+
+        value = value * base + digit;
+    }
+
+    out = value;
+    return true;
+}
+
+static uint64_t align4_padding(uint64_t size)
+{
+    return (4 - size % 4) % 4;
+}
+
+static oc::result<void> discard_exact(File &file, uint64_t size)
+{
+    OUTCOME_TRY(n, file_read_discard(file, size));
+    if (n != size) {
+        return FileError::UnexpectedEof;
+    }
+    return oc::success();
+}
+
+static uint32_t byte_sum(const void *buf, size_t size)
+{
+    auto ptr = static_cast<const unsigned char *>(buf);
+    uint32_t sum = 0;
+
+    for (size_t i = 0; i < size; ++i) {
+        sum += ptr[i];
+    }
+
+    return sum;
+}
+
+/*!
+ * \class CpioReader
+ *
+ * \brief Streaming reader for newc, crc and odc cpio archives
+ *
+ * The reader never seeks, so it can be used with any readable File (eg. a
+ * MemoryFile wrapping a decompressed ramdisk). The format is detected from the
+ * first header.
+ */
+
+CpioReader::CpioReader(File &file)
+    : m_file(file)
+    , m_remain(0)
+    , m_padding(0)
+    , m_eof(false)
+    , m_sum(0)
+    , m_expected_sum(0)
+{
+}
+
+/*!
+ * \brief Read the next entry's header
+ *
+ * Any unread data of the previous entry is skipped.
+ *
+ * \param[out] header Header of the next entry
+ *
+ * \return
+ *   * True if a header was read
+ *   * False if the trailer was reached
+ *   * `std::errc::bad_message` if the archive is malformed
+ *   * Otherwise, the error from reading the underlying file
+ */
+oc::result<bool> CpioReader::next_header(CpioHeader &header)
+{
+    if (m_eof) {
+        return false;
+    }
+
+    OUTCOME_TRYV(skip_remaining());
+
+    char buf[CPIO_NEWC_HEADER_SIZE];
+    OUTCOME_TRYV(file_read_exact(m_file, buf, CPIO_MAGIC_SIZE));
+
+    CpioFormat format;
+    if (memcmp(buf, CPIO_MAGIC_NEWC, CPIO_MAGIC_SIZE) == 0) {
+        format = CpioFormat::Newc;
+    } else if (memcmp(buf, CPIO_MAGIC_CRC, CPIO_MAGIC_SIZE) == 0) {
+        format = CpioFormat::Crc;
+    } else if (memcmp(buf, CPIO_MAGIC_ODC, CPIO_MAGIC_SIZE) == 0) {
+        format = CpioFormat::Odc;
+    } else {
+        return std::errc::bad_message;
+    }
+
+    if (m_format && *m_format != format) {
+        return std::errc::bad_message;
+    }
+
+    uint64_t name_size;
+    CpioHeader h;
+
+    if (format == CpioFormat::Odc) {
+        OUTCOME_TRYV(file_read_exact(m_file, buf + CPIO_MAGIC_SIZE,
+                                     CPIO_ODC_HEADER_SIZE - CPIO_MAGIC_SIZE));
+
+        uint64_t fields[10];
+        static constexpr size_t widths[10] = { 6, 6, 6, 6, 6, 6, 6, 11, 6, 11 };
+        const char *ptr = buf + CPIO_MAGIC_SIZE;
+
+        for (size_t i = 0; i < 10; ++i) {
+            if (!parse_number(ptr, widths[i], 8, fields[i])) {
+                return std::errc::bad_message;
+            }
+            ptr += widths[i];
+        }
+
+        // The device numbers are 18-bit values with the traditional 8-bit
+        // minor numbers
+        h.dev_major = static_cast<uint32_t>(fields[0] >> 8);
+        h.dev_minor = static_cast<uint32_t>(fields[0] & 0xff);
+        h.ino = fields[1];
+        h.mode = static_cast<uint32_t>(fields[2]);
+        h.uid = static_cast<uint32_t>(fields[3]);
+        h.gid = static_cast<uint32_t>(fields[4]);
+        h.nlink = static_cast<uint32_t>(fields[5]);
+        h.rdev_major = static_cast<uint32_t>(fields[6] >> 8);
+        h.rdev_minor = static_cast<uint32_t>(fields[6] & 0xff);
+        h.mtime = static_cast<int64_t>(fields[7]);
+        name_size = fields[8];
+        h.size = fields[9];
+    } else {
+        OUTCOME_TRYV(file_read_exact(m_file, buf + CPIO_MAGIC_SIZE,
+                                     CPIO_NEWC_HEADER_SIZE - CPIO_MAGIC_SIZE));
+
+        uint64_t fields[13];
+        const char *ptr = buf + CPIO_MAGIC_SIZE;
+
+        for (size_t i = 0; i < 13; ++i) {
+            if (!parse_number(ptr, 8, 16, fields[i])) {
+                return std::errc::bad_message;
+            }
+            ptr += 8;
+        }
+
+        h.ino = fields[0];
+        h.mode = static_cast<uint32_t>(fields[1]);
+        h.uid = static_cast<uint32_t>(fields[2]);
+        h.gid = static_cast<uint32_t>(fields[3]);
+        h.nlink = static_cast<uint32_t>(fields[4]);
+        h.mtime = static_cast<int64_t>(fields[5]);
+        h.size = fields[6];
+        h.dev_major = static_cast<uint32_t>(fields[7]);
+        h.dev_minor = static_cast<uint32_t>(fields[8]);
+        h.rdev_major = static_cast<uint32_t>(fields[9]);
+        h.rdev_minor = static_cast<uint32_t>(fields[10]);
+        name_size = fields[11];
+        h.check = static_cast<uint32_t>(fields[12]);
+    }
+
+    // The name includes the NUL terminator
+    if (name_size == 0 || name_size > CPIO_MAX_NAME_SIZE) {
+        return std::errc::bad_message;
+    }
+
+    h.path.resize(name_size);
+    OUTCOME_TRYV(file_read_exact(m_file, h.path.data(), name_size));
+
+    if (h.path.back() != '\0') {
+        return std::errc::bad_message;
+    }
+    h.path.pop_back();
+
+    m_format = format;
+
+    // Not all writers pad the trailer
+    if (h.path == CPIO_TRAILER) {
+        m_eof = true;
+        return false;
+    }
+
+    if (format != CpioFormat::Odc) {
+        OUTCOME_TRYV(discard_exact(
+                m_file, align4_padding(CPIO_NEWC_HEADER_SIZE + name_size)));
+    }
+
+    m_remain = h.size;
+    m_padding = format == CpioFormat::Odc ? 0 : align4_padding(h.size);
+    m_sum = 0;
+    m_expected_sum = h.check;
+
+    header = std::move(h);
+    return true;
+}
+
+/*!
+ * \brief Read data of the current entry
+ *
+ * \return Number of bytes read (0 at the end of the entry's data) or the error
+ *         from reading the underlying file. `std::errc::bad_message` is
+ *         returned if the checksum of a crc archive entry does not match.
+ */
+oc::result<size_t> CpioReader::read_data(void *buf, size_t size)
+{
+    size = static_cast<size_t>(std::min<uint64_t>(size, m_remain));
+    if (size == 0) {
+        return 0;
+    }
+
+    OUTCOME_TRYV(file_read_exact(m_file, buf, size));
+
+    m_remain -= size;
+
+    if (m_format == CpioFormat::Crc) {
+        m_sum += byte_sum(buf, size);
+        if (m_remain == 0 && m_sum != m_expected_sum) {
+            return std::errc::bad_message;
+        }
+    }
+
+    return size;
+}
+
+/*!
+ * \brief Read all remaining data of the current entry
+ */
+oc::result<std::string> CpioReader::read_data_all()
+{
+    std::string data;
+    data.resize(static_cast<size_t>(m_remain));
+
+    size_t offset = 0;
+    while (offset < data.size()) {
+        OUTCOME_TRY(n, read_data(data.data() + offset, data.size() - offset));
+        offset += n;
+    }
+
+    return std::move(data);
+}
+
+/*!
+ * \brief Format of the archive
+ *
+ * \return Format or std::nullopt if no header has been read yet
+ */
+std::optional<CpioFormat> CpioReader::format() const
+{
+    return m_format;
+}
+
+oc::result<void> CpioReader::skip_remaining()
+{
+    if (m_remain > 0 && m_format == CpioFormat::Crc) {
+        // The data must be read to verify the checksum
+        char buf[10240];
+        while (m_remain > 0) {
+            OUTCOME_TRYV(read_data(buf, sizeof(buf)));
+        }
+    }
+
+    OUTCOME_TRYV(discard_exact(m_file, m_remain + m_padding));
+
+    m_remain = 0;
+    m_padding = 0;
+
+    return oc::success();
+}
+
+/*!
+ * \class CpioWriter
+ *
+ * \brief Streaming writer for newc, crc and odc cpio archives
+ *
+ * Each header must be followed by exactly `header.size` bytes of data. The
+ * writer never seeks.
+ */
+
+CpioWriter::CpioWriter(File &file, CpioFormat format)
+    : m_file(file)
+    , m_format(format)
+    , m_remain(0)
+    , m_padding(0)
+{
+}
+
+/*!
+ * \brief Write an entry's header
+ *
+ * \return Nothing on success or the error code on failure. If a value does
+ *         not fit in the format's header fields, `std::errc::value_too_large`
+ *         is returned. If the data of the previous entry was not completely
+ *         written, `std::errc::invalid_argument` is returned.
+ */
+oc::result<void> CpioWriter::write_header(const CpioHeader &header)
+{
+    OUTCOME_TRYV(finish_entry());
+
+    uint64_t name_size = header.path.size() + 1;
+    char buf[CPIO_NEWC_HEADER_SIZE + 1];
+
+    if (m_format == CpioFormat::Odc) {
+        uint64_t dev = (uint64_t(header.dev_major) << 8) | header.dev_minor;
+        uint64_t rdev = (uint64_t(header.rdev_major) << 8) | header.rdev_minor;
+
+        if (dev > 0777777 || header.ino > 0777777 || header.mode > 0777777
+                || header.uid > 0777777 || header.gid > 0777777
+                || header.nlink > 0777777 || rdev > 0777777
+                || header.mtime < 0 || header.mtime > 077777777777
+                || name_size > 0777777 || header.size > 077777777777) {
+            return std::errc::value_too_large;
+        }
+
+        snprintf(buf, sizeof(buf),
+                 CPIO_MAGIC_ODC "%06" PRIo64 "%06" PRIo64 "%06" PRIo32
+                 "%06" PRIo32 "%06" PRIo32 "%06" PRIo32 "%06" PRIo64
+                 "%011" PRIo64 "%06" PRIo64 "%011" PRIo64,
+                 dev, header.ino, header.mode, header.uid, header.gid,
+                 header.nlink, rdev, static_cast<uint64_t>(header.mtime),
+                 name_size, header.size);
+
+        OUTCOME_TRYV(file_write_exact(m_file, buf, CPIO_ODC_HEADER_SIZE));
+        OUTCOME_TRYV(file_write_exact(m_file, header.path.c_str(), name_size));
+
+        m_padding = 0;
+    } else {
+        if (header.ino > UINT32_MAX || header.mtime < 0
+                || header.mtime > UINT32_MAX || name_size > UINT32_MAX
+                || header.size > UINT32_MAX) {
+            return std::errc::value_too_large;
+        }
+
+        snprintf(buf, sizeof(buf),
+                 "%s%08" PRIx64 "%08" PRIx32 "%08" PRIx32 "%08" PRIx32
+                 "%08" PRIx32 "%08" PRIx64 "%08" PRIx64 "%08" PRIx32
+                 "%08" PRIx32 "%08" PRIx32 "%08" PRIx32 "%08" PRIx64
+                 "%08" PRIx32,
+                 m_format == CpioFormat::Crc ? CPIO_MAGIC_CRC : CPIO_MAGIC_NEWC,
+                 header.ino, header.mode, header.uid, header.gid, header.nlink,
+                 static_cast<uint64_t>(header.mtime), header.size,
+                 header.dev_major, header.dev_minor, header.rdev_major,
+                 header.rdev_minor, name_size,
+                 m_format == CpioFormat::Crc ? header.check : 0);
+
+        static constexpr char zeros[4] = {};
+
+        OUTCOME_TRYV(file_write_exact(m_file, buf, CPIO_NEWC_HEADER_SIZE));
+        OUTCOME_TRYV(file_write_exact(m_file, header.path.c_str(), name_size));
+        OUTCOME_TRYV(file_write_exact(m_file, zeros, static_cast<size_t>(
+                align4_padding(CPIO_NEWC_HEADER_SIZE + name_size))));
+
+        m_padding = align4_padding(header.size);
+    }
+
+    m_remain = header.size;
+
+    return oc::success();
+}
+
+/*!
+ * \brief Write data of the current entry
+ *
+ * \return Nothing on success or the error code on failure. If more data than
+ *         specified in the header is written, `std::errc::invalid_argument` is
+ *         returned.
+ */
+oc::result<void> CpioWriter::write_data(const void *buf, size_t size)
+{
+    if (size > m_remain) {
+        return std::errc::invalid_argument;
+    }
+
+    OUTCOME_TRYV(file_write_exact(m_file, buf, size));
+
+    m_remain -= size;
+
+    return oc::success();
+}
+
+/*!
+ * \brief Write the trailer
+ *
+ * The underlying file is not closed.
+ */
+oc::result<void> CpioWriter::finish()
+{
+    CpioHeader trailer;
+    trailer.path = CPIO_TRAILER;
+    trailer.nlink = 1;
+
+    return write_header(trailer);
+}
+
+oc::result<void> CpioWriter::finish_entry()
+{
+    if (m_remain > 0) {
+        return std::errc::invalid_argument;
+    }
+
+    static constexpr char zeros[4] = {};
+
+    OUTCOME_TRYV(file_write_exact(m_file, zeros,
+                                  static_cast<size_t>(m_padding)));
+
+    m_padding = 0;
+
+    return oc::success();
+}
+
+/*!
+ * \class CpioArchive
+ *
+ * \brief In-memory cpio archive
+ *
+ * Paths are relative to the root of the archive (eg. "sbin/foo"). Lookups are
+ * hash-based. Entries are only sorted when the archive is saved, so that
+ * parent directories are always written before their children.
+ */
+
+CpioArchive::CpioArchive()
+    : m_format(CpioFormat::Newc)
+{
+}
+
+static CpioArchive::Entry new_entry(uint32_t mode)
+{
+    CpioArchive::Entry entry;
+    entry.mode = mode;
+    entry.mtime = time(nullptr);
+    return entry;
+}
+
+/*!
+ * \brief Load all entries from a cpio archive
+ *
+ * Hardlinked regular files (entries with the same device and inode numbers and
+ * a link count greater than one) share their contents, regardless of which
+ * link the data was stored with.
+ *
+ * \return Nothing on success or the error from CpioReader on failure
+ */
+oc::result<void> CpioArchive::load(File &file)
+{
+    CpioReader reader(file);
+    CpioHeader header;
+
+    using LinkKey = std::tuple<uint32_t, uint32_t, uint64_t>;
+    std::map<LinkKey, std::shared_ptr<std::string>> links;
+
+    m_entries.clear();
+
+    while (true) {
+        OUTCOME_TRY(has_entry, reader.next_header(header));
+        if (!has_entry) {
+            break;
+        }
+
+        OUTCOME_TRY(data, reader.read_data_all());
+
+        Entry entry;
+        entry.mode = header.mode;
+        entry.uid = header.uid;
+        entry.gid = header.gid;
+        entry.mtime = header.mtime;
+        entry.rdev_major = header.rdev_major;
+        entry.rdev_minor = header.rdev_minor;
+
+        if (S_ISLNK(header.mode)) {
+            entry.symlink = std::move(data);
+        } else if (S_ISREG(header.mode) && header.nlink > 1) {
+            auto &buf = links[{header.dev_major, header.dev_minor,
+                               header.ino}];
+            if (!buf) {
+                buf = std::make_shared<std::string>(std::move(data));
+            } else if (!data.empty()) {
+                // Shared with the links that were already loaded
+                *buf = std::move(data);
+            }
+            entry.data = buf;
+        } else if (S_ISREG(header.mode)) {
+            entry.data = std::make_shared<std::string>(std::move(data));
+        }
+
+        insert(normalize_path(header.path), std::move(entry));
+    }
+
+    m_format = *reader.format();
+
+    return oc::success();
+}
+
+/*!
+ * \brief Write all entries to a cpio archive
+ *
+ * Inode numbers are assigned sequentially. Regular files that share the same
+ * contents buffer are written as hardlinks. In the newc and crc formats, the
+ * data is stored with the last link only, like GNU cpio and the kernel
+ * expect. In the odc format, every link contains the data.
+ *
+ * \return Nothing on success or the error from CpioWriter on failure
+ */
+oc::result<void> CpioArchive::save(File &file, CpioFormat format) const
+{
+    CpioWriter writer(file, format);
+
+    auto sorted = paths();
+
+    // Hardlink groups
+    struct LinkInfo
+    {
+        uint64_t ino = 0;
+        uint32_t nlink = 0;
+        uint32_t written = 0;
+    };
+    std::unordered_map<const std::string *, LinkInfo> links;
+
+    for (auto const &path : sorted) {
+        auto const &entry = m_entries.at(path);
+        if (S_ISREG(entry.mode) && entry.data) {
+            ++links[entry.data.get()].nlink;
+        }
+    }
+
+    static const std::string empty;
+    // odc inode numbers are limited to 18 bits
+    uint64_t next_ino = format == CpioFormat::Odc ? 1 : CPIO_FIRST_INODE;
+
+    for (auto const &path : sorted) {
+        auto const &entry = m_entries.at(path);
+        const std::string *data = &empty;
+
+        CpioHeader header;
+        header.path = path;
+        header.mode = entry.mode;
+        header.uid = entry.uid;
+        header.gid = entry.gid;
+        header.mtime = entry.mtime;
+        header.rdev_major = entry.rdev_major;
+        header.rdev_minor = entry.rdev_minor;
+        header.nlink = 1;
+
+        if (S_ISLNK(entry.mode)) {
+            data = &entry.symlink;
+            header.ino = next_ino++;
+        } else if (S_ISREG(entry.mode) && entry.data) {
+            auto &link = links[entry.data.get()];
+            if (link.written == 0) {
+                link.ino = next_ino++;
+            }
+            ++link.written;
+
+            header.ino = link.ino;
+            header.nlink = link.nlink;
+
+            if (link.nlink == 1 || format == CpioFormat::Odc
+                    || link.written == link.nlink) {
+                data = entry.data.get();
+            }
+        } else {
+            header.ino = next_ino++;
+        }
+
+        header.size = data->size();
+        if (format == CpioFormat::Crc) {
+            header.check = byte_sum(data->data(), data->size());
+        }
+
+        OUTCOME_TRYV(writer.write_header(header));
+        OUTCOME_TRYV(writer.write_data(data->data(), data->size()));
+    }
+
+    return writer.finish();
+}
+
+CpioFormat CpioArchive::format() const
+{
+    return m_format;
+}
+
+size_t CpioArchive::size() const
+{
+    return m_entries.size();
+}
+
+/*!
+ * \brief Get sorted list of paths
+ *
+ * Parent directories always sort before their children.
+ */
+std::vector<std::string> CpioArchive::paths() const
+{
+    std::vector<std::string> result;
+    result.reserve(m_entries.size());
+
+    for (auto const &item : m_entries) {
+        result.push_back(item.first);
+    }
+
+    std::sort(result.begin(), result.end());
+
+    return result;
+}
+
+const CpioArchive::Entry * CpioArchive::find(const std::string &path) const
+{
+    auto it = m_entries.find(path);
+    return it == m_entries.end() ? nullptr : &it->second;
+}
+
+std::optional<std::string> CpioArchive::read_link(const std::string &path) const
+{
+    auto entry = find(path);
+    if (!entry || !S_ISLNK(entry->mode)) {
+        return std::nullopt;
+    }
+    return entry->symlink;
+}
+
+/*!
+ * \brief Add an entry, replacing any existing entry with the same path
+ */
+void CpioArchive::insert(std::string path, Entry entry)
+{
+    m_entries.insert_or_assign(std::move(path), std::move(entry));
+}
+
+/*!
+ * \brief Get mutable contents of a regular file
+ *
+ * If the contents are shared with another entry (eg. a hardlink), they are
+ * copied first.
+ *
+ * \return Pointer to the contents or nullptr if \p path is not a regular file
+ */
+std::string * CpioArchive::edit(const std::string &path)
+{
+    auto it = m_entries.find(path);
+    if (it == m_entries.end() || !S_ISREG(it->second.mode)) {
+        return nullptr;
+    }
+
+    auto &data = it->second.data;
+    if (!data) {
+        data = std::make_shared<std::string>();
+    } else if (data.use_count() > 1) {
+        data = std::make_shared<std::string>(*data);
+    }
+
+    // The buffer is uniquely owned at this point
+    return const_cast<std::string *>(data.get());
+}
+
+void CpioArchive::add_file(const std::string &path, std::string data,
+                           uint32_t perm)
+{
+    add_parents(path);
+
+    auto entry = new_entry(S_IFREG | perm);
+    entry.data = std::make_shared<std::string>(std::move(data));
+    insert(path, std::move(entry));
+}
+
+void CpioArchive::add_symlink(const std::string &path,
+                              const std::string &target)
+{
+    add_parents(path);
+
+    auto entry = new_entry(S_IFLNK | 0777);
+    entry.symlink = target;
+    insert(path, std::move(entry));
+}
+
+bool CpioArchive::rename(const std::string &from, const std::string &to)
+{
+    auto node = m_entries.extract(from);
+    if (node.empty()) {
+        return false;
+    }
+
+    add_parents(to);
+
+    node.key() = to;
+    m_entries.erase(to);
+    m_entries.insert(std::move(node));
+    return true;
+}
+
+bool CpioArchive::remove(const std::string &path)
+{
+    return m_entries.erase(path) > 0;
+}
+
+/*!
+ * \brief Normalize "/foo" and "./foo" to "foo" so paths can be compared
+ *
+ * The root directory is represented as ".".
+ */
+std::string CpioArchive::normalize_path(const std::string &path)
+{
+    size_t begin = 0;
+
+    while (true) {
+        if (path.compare(begin, 1, "/") == 0) {
+            ++begin;
+        } else if (path.compare(begin, 2, "./") == 0) {
+            begin += 2;
+        } else {
+            break;
+        }
+    }
+
+    return begin == path.size() ? "." : path.substr(begin);
+}
+
+// cpio archives need not contain directory entries, but the kernel won't
+// create missing parents when unpacking them
+void CpioArchive::add_parents(const std::string &path)
+{
+    for (auto pos = path.find('/'); pos != std::string::npos;
+            pos = path.find('/', pos + 1)) {
+        std::string parent = path.substr(0, pos);
+        if (m_entries.find(parent) == m_entries.end()) {
+            insert(std::move(parent), new_entry(S_IFDIR | 0755));
+        }
+    }
+}
+
+}
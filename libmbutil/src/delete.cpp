@@ -19,80 +19,357 @@
 
 #include "mbutil/delete.h"
 
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <optional>
+
 #include <cerrno>
-#include <cstdlib>
+#include <cstring>
+
+#include <dirent.h>
+#include <fcntl.h>
 #include <sys/stat.h>
+#include <unistd.h>
 
+#include "mbcommon/common.h"
 #include "mbcommon/error_code.h"
-#include "mbutil/fts.h"
+#include "mbcommon/thread_pool.h"
 
 
 namespace mb::util
 {
 
-class RecursiveDeleter : public FtsWrapper {
+namespace
+{
+
+// Directory whose contents are being deleted. The directory is removed from
+// its parent once its own entries have been listed and every subdirectory
+// has been removed, so rmdir() never sees a non-empty directory.
+struct DeleteNode
+{
+    std::shared_ptr<DeleteNode> parent;
+    // Name relative to the parent's fd (or the full path for the root)
+    std::string name;
+    std::string path;
+    int fd = -1;
+    // Subdirectories not yet removed, plus one for listing this directory
+    std::atomic<size_t> pending{1};
+
+    ~DeleteNode()
+    {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+};
+
+class TreeDeleter
+{
 public:
-    std::string error_path;
-    std::error_code error;
+    TreeDeleter(DeleteFlags flags, bool remove_root,
+                const std::vector<std::string> &exclusions,
+                DeleteProgress *progress)
+        : _remove_root(remove_root)
+        , _exclusions(exclusions)
+        , _progress(progress)
+        , _queued(0)
+        , _failed(false)
+    {
+        if (flags & DeleteFlag::Parallel) {
+            _group.emplace();
+        }
+    }
 
-    RecursiveDeleter(std::string path)
-        : FtsWrapper(std::move(path), FtsFlag::GroupSpecialFiles)
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(TreeDeleter)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(TreeDeleter)
+
+    FileOpResult<void> run(const std::string &path)
     {
+        auto root = std::make_shared<DeleteNode>();
+        root->name = path;
+        root->path = path;
+
+        process(std::move(root));
+
+        if (_group) {
+            _group->wait();
+        }
+
+        if (_error) {
+            return std::move(*_error);
+        }
+        return oc::success();
     }
 
-    Actions on_reached_directory_pre() override
+private:
+    // Queued directories keep their parents' fds open, so bound the number of
+    // tasks that have not started yet
+    static constexpr size_t MAX_QUEUED = 256;
+
+    // Hand a subdirectory to the global thread pool. Returns false if it
+    // should be processed by the calling thread instead.
+    bool submit(std::shared_ptr<DeleteNode> &node)
     {
-        // Do nothing. Need depth-first search, so directories are deleted in
-        // on_reached_directory_post()
-        return Action::Ok;
+        if (!_group) {
+            return false;
+        }
+
+        if (_queued.fetch_add(1, std::memory_order_relaxed) >= MAX_QUEUED) {
+            _queued.fetch_sub(1, std::memory_order_relaxed);
+            return false;
+        }
+
+        _group->run([this, node = std::move(node)]() mutable {
+            _queued.fetch_sub(1, std::memory_order_relaxed);
+            process(std::move(node));
+        });
+
+        return true;
     }
 
-    Actions on_reached_directory_post() override
+    void fail(std::string path, std::error_code ec)
     {
-        return delete_path() ? Action::Ok : Action::Fail;
+        std::lock_guard lock(_mutex);
+
+        if (!_error) {
+            _error = FileOpErrorInfo{std::move(path), ec};
+        }
+        _failed = true;
+
+        // Skip the directories that have not been started yet
+        if (_group) {
+            _group->cancel();
+        }
     }
 
-    Actions on_reached_file() override
+    // Remove the non-directory entries of a directory and queue its
+    // subdirectories
+    void process(std::shared_ptr<DeleteNode> node)
     {
-        return delete_path() ? Action::Ok : Action::Fail;
+        int parent_fd = node->parent ? node->parent->fd : AT_FDCWD;
+
+        node->fd = openat(parent_fd, node->name.c_str(),
+                          O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (node->fd < 0) {
+            fail(node->path, ec_from_errno());
+            return;
+        }
+
+        // fdopendir() takes ownership of the fd, but unlinkat() and the
+        // subdirectories still need one
+        int dir_fd = fcntl(node->fd, F_DUPFD_CLOEXEC, 0);
+        if (dir_fd < 0) {
+            fail(node->path, ec_from_errno());
+            return;
+        }
+
+        DIR *dp = fdopendir(dir_fd);
+        if (!dp) {
+            fail(node->path, ec_from_errno());
+            close(dir_fd);
+            return;
+        }
+
+        bool ok = true;
+
+        while (ok && !_failed) {
+            errno = 0;
+            auto *ent = readdir(dp);
+            if (!ent) {
+                if (errno != 0) {
+                    fail(node->path, ec_from_errno());
+                    ok = false;
+                }
+                break;
+            }
+
+            ok = delete_entry(node, ent->d_name, ent->d_type);
+        }
+
+        closedir(dp);
+
+        if (ok) {
+            release(std::move(node));
+        }
     }
 
-    Actions on_reached_symlink() override
+    bool delete_entry(const std::shared_ptr<DeleteNode> &node,
+                      const char *name, unsigned char d_type)
     {
-        return delete_path() ? Action::Ok : Action::Fail;
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+            return true;
+        }
+
+        if (!node->parent && std::find(_exclusions.begin(), _exclusions.end(),
+                                       name) != _exclusions.end()) {
+            return true;
+        }
+
+        if (d_type == DT_UNKNOWN) {
+            struct stat sb;
+            if (fstatat(node->fd, name, &sb, AT_SYMLINK_NOFOLLOW) < 0) {
+                if (errno == ENOENT) {
+                    return true;
+                }
+                fail(node->path + "/" + name, ec_from_errno());
+                return false;
+            }
+            d_type = S_ISDIR(sb.st_mode) ? DT_DIR : DT_REG;
+        }
+
+        if (d_type != DT_DIR) {
+            if (unlinkat(node->fd, name, 0) < 0) {
+                if (errno != ENOENT) {
+                    fail(node->path + "/" + name, ec_from_errno());
+                    return false;
+                }
+            } else {
+                count_entry();
+            }
+            return true;
+        }
+
+        auto child = std::make_shared<DeleteNode>();
+        child->parent = node;
+        child->name = name;
+        child->path = node->path + "/" + name;
+
+        ++node->pending;
+
+        if (!submit(child)) {
+            process(std::move(child));
+        }
+
+        return !_failed;
     }
 
-    Actions on_reached_special_file() override
+    // Drop one reference to a directory's pending work and remove it once
+    // nothing inside it remains
+    void release(std::shared_ptr<DeleteNode> node)
     {
-        return delete_path() ? Action::Ok : Action::Fail;
+        while (node && --node->pending == 0) {
+            close(node->fd);
+            node->fd = -1;
+
+            if (_failed) {
+                return;
+            }
+
+            if (node->parent) {
+                if (unlinkat(node->parent->fd, node->name.c_str(),
+                             AT_REMOVEDIR) < 0) {
+                    fail(node->path, ec_from_errno());
+                    return;
+                }
+                count_entry();
+            } else if (_remove_root) {
+                if (rmdir(node->path.c_str()) < 0) {
+                    fail(node->path, ec_from_errno());
+                    return;
+                }
+                count_entry();
+            }
+
+            node = node->parent;
+        }
     }
 
-private:
-    bool delete_path()
+    void count_entry()
     {
-        if (remove(_curr->fts_accpath) < 0) {
-            error_path = _curr->fts_path;
-            error = ec_from_errno();
-            return false;
+        if (_progress) {
+            _progress->entries.fetch_add(1, std::memory_order_relaxed);
         }
-        return true;
     }
+
+    bool _remove_root;
+    const std::vector<std::string> &_exclusions;
+    DeleteProgress *_progress;
+    // Number of submitted directories that have not started yet
+    std::atomic_size_t _queued;
+    std::atomic_bool _failed;
+    // Guards _error
+    std::mutex _mutex;
+    std::optional<FileOpErrorInfo> _error;
+    // Tasks on ThreadPool::global() if deleting in parallel. Declared last so
+    // that it is destroyed (and waited for) first.
+    std::optional<TaskGroup> _group;
 };
 
-FileOpResult<void> delete_recursive(const std::string &path)
+}
+
+/*!
+ * \brief Recursively delete a path
+ *
+ * Directories are traversed without following symlinks and entries are
+ * removed relative to their parent directory's fd. With DeleteFlag::Parallel,
+ * subdirectories are deleted concurrently as tasks on ThreadPool::global().
+ *
+ * \note It is not an error if \p path does not exist.
+ *
+ * \param path Path to delete
+ * \param flags Deletion flags
+ * \param progress Optional counter of removed entries
+ *
+ * \return Nothing if \p path was deleted or does not exist. Otherwise, the
+ *         first path that could not be deleted and the error.
+ */
+FileOpResult<void> delete_recursive(const std::string &path, DeleteFlags flags,
+                                    DeleteProgress *progress)
 {
     struct stat sb;
-    if (stat(path.c_str(), &sb) < 0 && errno == ENOENT) {
-        // Don't fail if directory does not exist
+    if (lstat(path.c_str(), &sb) < 0) {
+        if (errno == ENOENT) {
+            // Don't fail if directory does not exist
+            return oc::success();
+        }
+        return FileOpErrorInfo{path, ec_from_errno()};
+    }
+
+    if (!S_ISDIR(sb.st_mode)) {
+        if (unlink(path.c_str()) < 0) {
+            return FileOpErrorInfo{path, ec_from_errno()};
+        }
+        if (progress) {
+            ++progress->entries;
+        }
         return oc::success();
     }
 
-    RecursiveDeleter deleter(path);
-    if (!deleter.run()) {
-        return FileOpErrorInfo{std::move(deleter.error_path), deleter.error};
+    static const std::vector<std::string> no_exclusions;
+
+    TreeDeleter deleter(flags, true, no_exclusions, progress);
+    return deleter.run(path);
+}
+
+/*!
+ * \brief Delete the contents of a directory
+ *
+ * This behaves like delete_recursive(), except that \p path itself and any
+ * top-level entry whose name is listed in \p exclusions are kept.
+ *
+ * \param path Directory to empty
+ * \param exclusions Names of top-level entries to keep
+ * \param flags Deletion flags
+ * \param progress Optional counter of removed entries
+ *
+ * \return Nothing if the contents were deleted or \p path does not exist.
+ *         Otherwise, the first path that could not be deleted and the error.
+ */
+FileOpResult<void> delete_contents(const std::string &path,
+                                   const std::vector<std::string> &exclusions,
+                                   DeleteFlags flags,
+                                   DeleteProgress *progress)
+{
+    struct stat sb;
+    if (lstat(path.c_str(), &sb) < 0 && errno == ENOENT) {
+        // Don't fail if directory does not exist
+        return oc::success();
     }
 
-    return oc::success();
+    TreeDeleter deleter(flags, false, exclusions, progress);
+    return deleter.run(path);
 }
 
 }
@@ -1186,7 +1186,44 @@ static bool is_dir(const char* pathname) {
   return S_ISDIR(info.st_mode);
 }
 
+// Direct-mapped cache of recent __system_property_find() results. prop_info
+// objects are never removed from a mapped area, so a cached pointer stays
+// valid until the areas are unmapped and a hit only needs one strcmp() against
+// the prop_info's name instead of a trie walk. Misses are remembered as a
+// (area serial, name hash) pair and are only trusted while the global serial,
+// which is bumped by every __system_property_add(), is unchanged.
+#define PROP_CACHE_SIZE 256
+
+static atomic_uintptr_t prop_cache_found[PROP_CACHE_SIZE];
+static atomic_uint_least64_t prop_cache_missing[PROP_CACHE_SIZE];
+
+static uint64_t prop_cache_hash(const char* name) {
+  // FNV-1a
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (const char* p = name; *p; ++p) {
+    hash ^= static_cast<unsigned char>(*p);
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+static inline size_t prop_cache_slot(uint64_t hash) {
+  return static_cast<size_t>(hash >> 56) % PROP_CACHE_SIZE;
+}
+
+static inline uint64_t prop_cache_missing_key(uint32_t area_serial, uint64_t hash) {
+  return (static_cast<uint64_t>(area_serial) << 32) | (hash & 0xffffffffULL);
+}
+
+static void prop_cache_clear() {
+  for (size_t i = 0; i < PROP_CACHE_SIZE; ++i) {
+    atomic_store_explicit(&prop_cache_found[i], 0, memory_order_relaxed);
+    atomic_store_explicit(&prop_cache_missing[i], 0, memory_order_relaxed);
+  }
+}
+
 static void free_and_unmap_contexts() {
+  prop_cache_clear();
   list_free(&prefixes);
   list_free(&contexts);
   if (__system_property_area__) {
@@ -1265,6 +1302,41 @@ uint32_t __system_property_area_serial() {
   return atomic_load_explicit(pa->serial(), memory_order_acquire);
 }
 
+static const prop_info* find_uncached(const char* name) {
+  prop_area* pa = get_prop_area_for_name(name);
+  if (!pa) {
+    LOGE("Access denied finding property \"%s\"", name);
+    return nullptr;
+  }
+
+  return pa->find(name);
+}
+
+static const prop_info* find_cached(const char* name, uint32_t area_serial) {
+  const uint64_t hash = prop_cache_hash(name);
+  const size_t slot = prop_cache_slot(hash);
+
+  auto cached = reinterpret_cast<const prop_info*>(
+      atomic_load_explicit(&prop_cache_found[slot], memory_order_acquire));
+  if (cached && strcmp(cached->name, name) == 0) {
+    return cached;
+  }
+
+  const uint64_t missing_key = prop_cache_missing_key(area_serial, hash);
+  if (atomic_load_explicit(&prop_cache_missing[slot], memory_order_relaxed) == missing_key) {
+    return nullptr;
+  }
+
+  const prop_info* pi = find_uncached(name);
+  if (pi) {
+    atomic_store_explicit(&prop_cache_found[slot], reinterpret_cast<uintptr_t>(pi),
+                          memory_order_release);
+  } else {
+    atomic_store_explicit(&prop_cache_missing[slot], missing_key, memory_order_relaxed);
+  }
+  return pi;
+}
+
 const prop_info* __system_property_find(const char* name) {
   if (!__system_property_area__) {
     return nullptr;
@@ -1276,13 +1348,40 @@ const prop_info* __system_property_find(const char* name) {
   }
 #endif
 
-  prop_area* pa = get_prop_area_for_name(name);
-  if (!pa) {
-    LOGE("Access denied finding property \"%s\"", name);
-    return nullptr;
+  // The serial must be read before the lookup so that a property added
+  // concurrently invalidates a cached miss
+  return find_cached(name, __system_property_area_serial());
+}
+
+size_t __system_property_find_batch(const char* const* names, size_t count,
+                                    const prop_info** results) {
+  size_t found = 0;
+
+  if (!__system_property_area__) {
+    for (size_t i = 0; i < count; ++i) {
+      results[i] = nullptr;
+    }
+    return 0;
   }
 
-  return pa->find(name);
+#if MB_ENABLE_COMPAT_PROPERTIES
+  if (__predict_false(compat_mode)) {
+    for (size_t i = 0; i < count; ++i) {
+      results[i] = __system_property_find_compat(names[i]);
+      found += results[i] != nullptr;
+    }
+    return found;
+  }
+#endif
+
+  const uint32_t area_serial = __system_property_area_serial();
+
+  for (size_t i = 0; i < count; ++i) {
+    results[i] = find_cached(names[i], area_serial);
+    found += results[i] != nullptr;
+  }
+
+  return found;
 }
 
 // The C11 standard doesn't allow atomic loads from const fields,
@@ -1531,6 +1630,12 @@ int __system_property_add(const char* name, unsigned int namelen, const char* va
 
 // Wait for non-locked serial, and retrieve it with acquire semantics.
 uint32_t __system_property_serial(const prop_info* pi) {
+#if MB_ENABLE_COMPAT_PROPERTIES
+  if (__predict_false(compat_mode)) {
+    return __system_property_serial_compat(pi);
+  }
+#endif
+
   uint32_t serial = load_const_atomic(&pi->serial, memory_order_acquire);
   while (SERIAL_DIRTY(serial)) {
     __futex_wait(const_cast<_Atomic(uint_least32_t)*>(&pi->serial), serial, nullptr);
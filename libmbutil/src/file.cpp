@@ -19,7 +19,11 @@
 
 #include "mbutil/file.h"
 
+#include <algorithm>
+#include <functional>
 #include <memory>
+#include <optional>
+
 #include <cerrno>
 #include <cstdio>
 #include <cstdlib>
@@ -137,6 +141,245 @@ oc::result<void> file_write_data(const std::string &path,
     return oc::success();
 }
 
+// Granularity for comparing and rewriting data in file_write_changed_data()
+static constexpr size_t DIFF_BLOCK_SIZE = 4096;
+static constexpr size_t DIFF_CHUNK_SIZE = 1024 * 1024;
+
+static oc::result<void> pwrite_full(int fd, const void *buf, size_t size,
+                                    off64_t offset)
+{
+    auto ptr = static_cast<const unsigned char *>(buf);
+
+    while (size > 0) {
+        ssize_t n = pwrite64(fd, ptr, size, offset);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return ec_from_errno();
+        } else if (n == 0) {
+            return FileError::UnexpectedEof;
+        }
+
+        ptr += n;
+        size -= static_cast<size_t>(n);
+        offset += n;
+    }
+
+    return oc::success();
+}
+
+static oc::result<size_t> pread_full(int fd, void *buf, size_t size,
+                                     off64_t offset)
+{
+    auto ptr = static_cast<unsigned char *>(buf);
+    size_t total = 0;
+
+    while (total < size) {
+        ssize_t n = pread64(fd, ptr + total, size - total,
+                            offset + static_cast<off64_t>(total));
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return ec_from_errno();
+        } else if (n == 0) {
+            break;
+        }
+
+        total += static_cast<size_t>(n);
+    }
+
+    return total;
+}
+
+// Returns a pointer to the source data in [offset, offset + size)
+using ChunkReader = std::function<
+        oc::result<const unsigned char *>(uint64_t offset, size_t size)>;
+
+static oc::result<uint64_t> write_changed_data(const std::string &path,
+                                               uint64_t size,
+                                               const ChunkReader &read_chunk)
+{
+    struct stat sb;
+    bool is_blkdev = stat(path.c_str(), &sb) == 0 && S_ISBLK(sb.st_mode);
+
+    int fd = -1;
+    bool direct = false;
+
+    if (is_blkdev) {
+        fd = open(path.c_str(), O_RDWR | O_CLOEXEC | O_DIRECT);
+        direct = fd >= 0;
+    }
+    if (fd < 0) {
+        fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+    }
+    if (fd < 0) {
+        return ec_from_errno();
+    }
+
+    auto close_fd = finally([&] {
+        close(fd);
+    });
+
+    // O_DIRECT requires that buffers, offsets, and sizes are aligned to the
+    // logical block size
+    size_t block_size = DIFF_BLOCK_SIZE;
+    if (direct) {
+        int logical_size;
+        if (ioctl(fd, BLKSSZGET, &logical_size) == 0 && logical_size > 0) {
+            block_size = std::max(block_size,
+                                  static_cast<size_t>(logical_size));
+        }
+    }
+
+    size_t chunk_size = std::max(DIFF_CHUNK_SIZE, block_size);
+
+    void *buf_ptr;
+    if (int ret = posix_memalign(&buf_ptr, block_size, chunk_size); ret != 0) {
+        return std::error_code(ret, std::generic_category());
+    }
+    std::unique_ptr<unsigned char, decltype(free) *> buf(
+            static_cast<unsigned char *>(buf_ptr), free);
+
+    uint64_t written = 0;
+
+    for (uint64_t offset = 0; offset < size; offset += chunk_size) {
+        auto n = static_cast<size_t>(
+                std::min<uint64_t>(chunk_size, size - offset));
+        size_t n_aligned = (n + block_size - 1) / block_size * block_size;
+
+        OUTCOME_TRY(n_read, pread_full(fd, buf.get(), n_aligned,
+                                       static_cast<off64_t>(offset)));
+        OUTCOME_TRY(src, read_chunk(offset, n));
+
+        // Find runs of differing blocks and write each run with one call
+        std::optional<size_t> run_begin;
+
+        auto flush_run = [&](size_t run_end) -> oc::result<void> {
+            OUTCOME_TRYV(pwrite_full(
+                    fd, buf.get() + *run_begin, run_end - *run_begin,
+                    static_cast<off64_t>(offset + *run_begin)));
+            written += run_end - *run_begin;
+            run_begin = {};
+            return oc::success();
+        };
+
+        for (size_t block = 0; block < n; block += block_size) {
+            size_t len = std::min(block_size, n - block);
+            bool differs = block + len > n_read
+                    || memcmp(buf.get() + block, src + block, len) != 0;
+
+            if (differs) {
+                // With O_DIRECT, the bytes after the end of the data in the
+                // last block are written back with their old contents
+                memcpy(buf.get() + block, src + block, len);
+
+                if (!run_begin) {
+                    run_begin = block;
+                }
+            } else if (run_begin) {
+                OUTCOME_TRYV(flush_run(block));
+            }
+        }
+
+        if (run_begin) {
+            OUTCOME_TRYV(flush_run(direct ? n_aligned : n));
+        }
+    }
+
+    if (!is_blkdev) {
+        if (ftruncate64(fd, static_cast<off64_t>(size)) < 0) {
+            return ec_from_errno();
+        }
+    }
+
+    if (written > 0 && fdatasync(fd) < 0) {
+        return ec_from_errno();
+    }
+
+    close_fd.dismiss();
+
+    if (close(fd) < 0) {
+        return ec_from_errno();
+    }
+
+    return written;
+}
+
+/*!
+ * \brief Write data to a file or block device, skipping unchanged blocks
+ *
+ * The existing contents are compared with \p data in 4 KiB blocks and only the
+ * blocks that differ are rewritten. This avoids flash wear and is much faster
+ * when flashing an image that is already (mostly) present on a partition.
+ *
+ * Block devices are accessed with `O_DIRECT` when supported, so neither the
+ * comparison nor the writes go through (or pollute) the page cache. The device
+ * is flushed if anything was written. Regular files are created if needed and
+ * truncated to \p size, like file_write_data().
+ *
+ * \param path File or block device to write to
+ * \param data Data to write
+ * \param size Size of data
+ *
+ * \return Number of bytes that were rewritten on success or the error code on
+ *         failure
+ */
+oc::result<uint64_t> file_write_changed_data(const std::string &path,
+                                             const void *data, size_t size)
+{
+    auto src = static_cast<const unsigned char *>(data);
+
+    return write_changed_data(path, size, [&](uint64_t offset, size_t) {
+        return oc::result<const unsigned char *>(src + offset);
+    });
+}
+
+/*!
+ * \brief Write the contents of a File to a file or block device, skipping
+ *        unchanged blocks
+ *
+ * Like file_write_changed_data(const std::string &, const void *, size_t), but
+ * the data is read from \p source with File::read_at() one chunk at a time, so
+ * it does not need to be in memory. If \p source exposes mapped_data(), it is
+ * used directly.
+ *
+ * \param path File or block device to write to
+ * \param source File to read data from
+ * \param size Number of bytes to write from the beginning of \p source
+ *
+ * \return Number of bytes that were rewritten on success or the error code on
+ *         failure. FileError::UnexpectedEof is returned if \p source is
+ *         shorter than \p size.
+ */
+oc::result<uint64_t> file_write_changed_data(const std::string &path,
+                                             File &source, uint64_t size)
+{
+    if (auto data = source.mapped_data(); data && data->size >= size) {
+        return file_write_changed_data(path, data->data,
+                                       static_cast<size_t>(size));
+    }
+
+    std::vector<unsigned char> buf;
+
+    return write_changed_data(path, size, [&](uint64_t offset, size_t n)
+            -> oc::result<const unsigned char *> {
+        buf.resize(n);
+
+        for (size_t pos = 0; pos < n;) {
+            OUTCOME_TRY(n_read, source.read_at(offset + pos, buf.data() + pos,
+                                               n - pos));
+            if (n_read == 0) {
+                return FileError::UnexpectedEof;
+            }
+            pos += n_read;
+        }
+
+        return buf.data();
+    });
+}
+
 oc::result<bool> file_find_one_of(const std::string &path,
                                   const std::vector<std::string> &items)
 {
@@ -219,6 +462,161 @@ oc::result<std::string> file_read_all(const std::string &path)
     return std::move(data);
 }
 
+static bool is_unsupported_error(int error)
+{
+    return error == ENOSYS
+            || error == EINVAL
+            || error == EOPNOTSUPP
+            || error == ENOTSUP
+            || error == ENOTTY;
+}
+
+/*!
+ * \brief Write zeros to a range of a file
+ *
+ * The zeros come from private anonymous pages that are never written to, so
+ * they don't use any memory. After the first write, the writes are aligned to
+ * the buffer size, which keeps them aligned for `O_DIRECT`.
+ */
+static oc::result<void> write_zeros(int fd, uint64_t offset, uint64_t size)
+{
+    static constexpr size_t BUF_SIZE = 1024 * 1024;
+    static void *zeros = mmap(nullptr, BUF_SIZE, PROT_READ,
+                              MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (size == 0) {
+        return oc::success();
+    } else if (zeros == MAP_FAILED) {
+        return std::errc::not_enough_memory;
+    }
+
+    while (size > 0) {
+        auto n = static_cast<size_t>(std::min<uint64_t>(
+                size, BUF_SIZE - offset % BUF_SIZE));
+
+        // off_t is 32 bits on 32-bit bionic
+        auto ret = pwrite64(fd, zeros, n, static_cast<off64_t>(offset));
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return ec_from_errno();
+        } else if (ret == 0) {
+            return std::errc::io_error;
+        }
+
+        offset += static_cast<uint64_t>(ret);
+        size -= static_cast<uint64_t>(ret);
+    }
+
+    return oc::success();
+}
+
+/*!
+ * \brief Make a range of a file or block device read back as zeros
+ *
+ * The cheapest method that the kernel supports is used so that the zeros are
+ * not written from userspace:
+ *
+ * * Block devices: `BLKDISCARD` if the device guarantees that discarded
+ *   sectors read back as zeros, otherwise `BLKZEROOUT`, which lets the device
+ *   zero the sectors itself if it can. Only whole 512-byte sectors can be
+ *   zeroed this way and any partial sectors at the ends of the range are
+ *   written.
+ * * Regular files: `FALLOC_FL_ZERO_RANGE`, which converts the range to
+ *   unwritten extents, or `FALLOC_FL_PUNCH_HOLE` (preferred if
+ *   ZeroRangeFlag::Deallocate is set). If the filesystem supports neither and
+ *   the range extends to the end of the file, the file is truncated and
+ *   extended back to its original size.
+ *
+ * If none of these are supported, zeros are written to the range.
+ *
+ * The size of regular files is never changed. Any part of the range beyond the
+ * end of the file is ignored because it will read back as zeros if the file is
+ * extended.
+ *
+ * \param fd File descriptor opened for writing
+ * \param offset Start of range
+ * \param size Size of range
+ * \param flags Flags
+ *
+ * \return Nothing if the range was successfully zeroed. Otherwise, the error
+ *         code.
+ */
+oc::result<void> zero_range(int fd, uint64_t offset, uint64_t size,
+                            ZeroRangeFlags flags)
+{
+    if (size > static_cast<uint64_t>(INT64_MAX)
+            || offset > static_cast<uint64_t>(INT64_MAX) - size) {
+        return std::errc::invalid_argument;
+    }
+
+    struct stat64 sb;
+    if (fstat64(fd, &sb) < 0) {
+        return ec_from_errno();
+    }
+
+    if (S_ISBLK(sb.st_mode)) {
+        uint64_t begin = (offset + 511) / 512 * 512;
+        uint64_t end = (offset + size) / 512 * 512;
+
+        if (begin < end) {
+            uint64_t range[2] = { begin, end - begin };
+            unsigned int discard_zeroes = 0;
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wsign-conversion"
+
+            bool zeroed = (ioctl(fd, BLKDISCARDZEROES, &discard_zeroes) == 0
+                    && discard_zeroes && ioctl(fd, BLKDISCARD, &range) == 0)
+                    || ioctl(fd, BLKZEROOUT, &range) == 0;
+
+#pragma GCC diagnostic pop
+
+            if (zeroed) {
+                OUTCOME_TRYV(write_zeros(fd, offset, begin - offset));
+                return write_zeros(fd, end, offset + size - end);
+            } else if (!is_unsupported_error(errno)) {
+                return ec_from_errno();
+            }
+        }
+    } else if (S_ISREG(sb.st_mode)) {
+        auto file_size = static_cast<uint64_t>(sb.st_size);
+        if (offset >= file_size) {
+            return oc::success();
+        }
+
+        size = std::min(size, file_size - offset);
+
+        int modes[] = {
+            FALLOC_FL_ZERO_RANGE | FALLOC_FL_KEEP_SIZE,
+            FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+        };
+        if (flags & ZeroRangeFlag::Deallocate) {
+            std::swap(modes[0], modes[1]);
+        }
+
+        for (int mode : modes) {
+            if (fallocate64(fd, mode, static_cast<off64_t>(offset),
+                            static_cast<off64_t>(size)) == 0) {
+                return oc::success();
+            } else if (!is_unsupported_error(errno)) {
+                return ec_from_errno();
+            }
+        }
+
+        if (offset + size == file_size) {
+            if (ftruncate64(fd, static_cast<off64_t>(offset)) < 0
+                    || ftruncate64(fd, static_cast<off64_t>(file_size)) < 0) {
+                return ec_from_errno();
+            }
+            return oc::success();
+        }
+    }
+
+    return write_zeros(fd, offset, size);
+}
+
 oc::result<uint64_t> get_blockdev_size(const std::string &path)
 {
     int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
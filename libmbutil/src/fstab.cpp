@@ -178,7 +178,7 @@ parse_options(const MountFlag *flags_map, std::string_view options)
     unsigned long flags = 0;
     std::vector<std::string> remaining;
 
-    for (auto const &option : split_sv(options, ',')) {
+    for (auto const &option : split_range(options, ',')) {
         const MountFlag *it;
 
         for (it = flags_map; it->name; ++it) {
@@ -20,10 +20,15 @@
 #include "mbutil/fts.h"
 
 #include <cerrno>
+#include <cstddef>
 #include <cstdlib>
 #include <cstring>
 
+#include <dirent.h>
+#include <fcntl.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 
 #include "mbcommon/string.h"
 #include "mbutil/string.h"
@@ -32,23 +37,53 @@
 namespace mb::util
 {
 
+// Large enough for a few hundred entries per getdents64() call
+static constexpr size_t DENTS_BUF_SIZE = 64 * 1024;
+
+// Fixed-size part of struct linux_dirent64. The NULL-terminated name follows
+// d_type.
+struct LinuxDirent64
+{
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+};
+
+static constexpr size_t DIRENT64_NAME_OFFSET =
+        offsetof(LinuxDirent64, d_type) + 1;
+
 FtsWrapper::FtsWrapper(std::string path, FtsFlags flags)
     : _path(std::move(path))
     , _flags(flags)
-    , _ftsp(nullptr)
     , _curr(nullptr)
     , _root(nullptr)
     , _ran(false)
+    , _ret(true)
+    , _root_dev(0)
+    , _root_sb()
+    , _root_entry()
 {
 }
 
-FtsWrapper::~FtsWrapper()
-{
-    if (_ftsp) {
-        fts_close(_ftsp);
-    }
-}
+FtsWrapper::~FtsWrapper() = default;
 
+/*!
+ * \brief Traverse the tree
+ *
+ * The tree is walked with openat() and getdents64() relative to the parent
+ * directory's file descriptor, so that paths are never resolved from the
+ * root for each entry. Entries are stat()'ed with fstatat() (unless
+ * FtsFlag::NoStat allows the type to be taken from the directory entry).
+ *
+ * Like fts with FTS_NOCHDIR, directories are visited in pre-order and
+ * post-order and the post-order visit also happens for directories that were
+ * skipped. Entries within a directory are visited in the order returned by the
+ * filesystem. A directory is read completely before any of its entries are
+ * visited, so hooks may delete entries.
+ *
+ * \return Whether all hooks succeeded and no errors occurred
+ */
 bool FtsWrapper::run()
 {
     if (_ran) {
@@ -56,124 +91,294 @@ bool FtsWrapper::run()
         return false;
     }
     _ran = true;
+    _ret = true;
 
-    bool ret = true;
-    int fts_flags = 0;
+    // Pre-execute hook
+    if (!on_pre_execute()) {
+        return false;
+    }
 
-    // Don't change directories
-    fts_flags += FTS_NOCHDIR;
+    // We only support traversal of one tree
+    _root_path = _path;
+    _pathbuf = _path;
+    _root = &_root_entry;
 
-    // Don't follow symlinks by default
-    if (_flags & FtsFlag::FollowSymlinks) {
-        fts_flags |= FTS_LOGICAL;
-    } else {
-        fts_flags |= FTS_PHYSICAL;
+    auto slash = _path.rfind('/');
+    size_t name_offset = slash == std::string::npos ? 0 : slash + 1;
+
+    (void) walk(AT_FDCWD, _path.c_str(), DT_UNKNOWN, name_offset, 0);
+
+    _curr = nullptr;
+    _ancestors.clear();
+
+    if (!on_post_execute(_ret)) {
+        return false;
     }
 
-    // Don't cross mountpoint boundaries by default
-    if (!(_flags & FtsFlag::CrossMountPointBoundaries)) {
-        fts_flags |= FTS_XDEV;
+    return _ret;
+}
+
+std::string FtsWrapper::error()
+{
+    return _error_msg;
+}
+
+FtsWrapper::Walk FtsWrapper::dispatch(FtsEntry &entry)
+{
+    _curr = &entry;
+
+    switch (entry.fts_info) {
+    case FTS_NS:  // no stat()
+    case FTS_DNR: // directory not read
+    case FTS_ERR: // other error
+        _error_msg = format("fts_read error: %s", strerror(entry.fts_errno));
+        _ret = false;
+        break;
     }
 
-    // Pre-execute hook
-    if (!on_pre_execute()) {
-        return false;
+    // Current path hook
+    _error_msg = "Handler returned failure";
+    Actions result = on_changed_path();
+    if (result & Action::Fail) {
+        _ret = false;
+    }
+    if (result & Action::Next) {
+        return Walk::Continue;
+    }
+    if (result & Action::Skip) {
+        return Walk::Skip;
+    }
+    if (result & Action::Stop) {
+        return Walk::Stop;
     }
 
-    // We only support traversal of one tree
-    char *files[] = { const_cast<char *>(_path.c_str()), nullptr };
-
-    _ftsp = fts_open(files, fts_flags, nullptr);
-    if (!_ftsp) {
-        _error_msg = format("fts_open failed: %s", strerror(errno));
-        ret = false;
-    }
-
-    while (_ftsp && (_curr = fts_read(_ftsp))) {
-        switch (_curr->fts_info) {
-        case FTS_NS:  // no stat()
-        case FTS_DNR: // directory not read
-        case FTS_ERR: { // other error
-            _error_msg = format("fts_read error: %s",
-                                strerror(_curr->fts_errno));
-            ret = false;
-            break;
+    // Call other hooks
+    _error_msg = "Handler returned failure";
+
+    switch (entry.fts_info) {
+    case FTS_D: result = on_reached_directory_pre(); break;
+    case FTS_DP: result = on_reached_directory_post(); break;
+    case FTS_F: result = on_reached_file(); break;
+    case FTS_SL:
+    case FTS_SLNONE: result = on_reached_symlink(); break;
+    case FTS_DEFAULT:
+        if (_flags & FtsFlag::GroupSpecialFiles) {
+            result = on_reached_special_file();
+        } else if (!entry.fts_statp) {
+            result = Action::Skip;
+        } else {
+            switch (entry.fts_statp->st_mode & S_IFMT) {
+            case S_IFBLK: result = on_reached_block_device(); break;
+            case S_IFCHR: result = on_reached_character_device(); break;
+            case S_IFIFO: result = on_reached_fifo(); break;
+            case S_IFSOCK: result = on_reached_socket(); break;
+            default: result = Action::Skip; break;
+            }
         }
+    }
 
-        case FTS_DC:   // Not reached unless FTS_LOGICAL specified
-                       // (FTS_PHYSICAL doesn't follow symlinks)
-        case FTS_DOT:  // Not reached unless FTS_SEEDOT specified
-        case FTS_NSOK: // Not reached unless FTS_NOSTAT specified
-            continue;
-        }
+    // Handle result
+    if (result & Action::Fail) {
+        _ret = false;
+    }
+    if (result & Action::Skip) {
+        return Walk::Skip;
+    }
+    if (result & Action::Stop) {
+        return Walk::Stop;
+    }
 
-        if (_curr->fts_level == 0) {
-            _root = _curr;
-        }
+    return Walk::Continue;
+}
 
-        // Current path hook
-        _error_msg = "Handler returned failure";
-        Actions result = on_changed_path();
-        if (result & Action::Fail) {
-            ret = false;
-        }
-        if (result & Action::Next) {
-            continue;
+// Visit the entry `name` in `parent_fd`. _pathbuf must contain the full path
+// of the entry, with the name starting at `name_offset`.
+FtsWrapper::Walk FtsWrapper::walk(int parent_fd, const char *name,
+                                  unsigned char d_type, size_t name_offset,
+                                  int level)
+{
+    bool follow = _flags & FtsFlag::FollowSymlinks;
+    FtsEntry local_entry;
+    struct stat local_sb;
+    FtsEntry &entry = level == 0 ? _root_entry : local_entry;
+    struct stat &sb = level == 0 ? _root_sb : local_sb;
+
+    entry.fts_statp = &sb;
+    entry.fts_level = level;
+    entry.fts_errno = 0;
+
+    if ((_flags & FtsFlag::NoStat) && d_type != DT_UNKNOWN
+            && d_type != DT_DIR && !(follow && d_type == DT_LNK)) {
+        entry.fts_statp = nullptr;
+        entry.fts_info = d_type == DT_REG ? FTS_F
+                : d_type == DT_LNK ? FTS_SL
+                : FTS_DEFAULT;
+    } else if (fstatat(parent_fd, name, &sb,
+                       follow ? 0 : AT_SYMLINK_NOFOLLOW) == 0) {
+        if (S_ISDIR(sb.st_mode)) {
+            entry.fts_info = FTS_D;
+        } else if (S_ISLNK(sb.st_mode)) {
+            entry.fts_info = FTS_SL;
+        } else if (S_ISREG(sb.st_mode)) {
+            entry.fts_info = FTS_F;
+        } else {
+            entry.fts_info = FTS_DEFAULT;
         }
-        if (result & Action::Skip) {
-            fts_set(_ftsp, _curr, FTS_SKIP);
-            continue;
+    } else {
+        int saved_errno = errno;
+
+        if (follow && saved_errno == ENOENT
+                && fstatat(parent_fd, name, &sb, AT_SYMLINK_NOFOLLOW) == 0) {
+            // Dangling symlink
+            entry.fts_info = FTS_SLNONE;
+        } else {
+            entry.fts_info = FTS_NS;
+            entry.fts_errno = saved_errno;
         }
-        if (result & Action::Stop) {
-            break;
+    }
+
+    if (entry.fts_info == FTS_D) {
+        if (level == 0) {
+            _root_dev = sb.st_dev;
         }
 
-        // Call other hooks
-        _error_msg = "Handler returned failure";
-
-        switch (_curr->fts_info) {
-        case FTS_D: result = on_reached_directory_pre(); break;
-        case FTS_DP: result = on_reached_directory_post(); break;
-        case FTS_F: result = on_reached_file(); break;
-        case FTS_SL:
-        case FTS_SLNONE: result = on_reached_symlink(); break;
-        case FTS_DEFAULT:
-            if (_flags & FtsFlag::GroupSpecialFiles) {
-                result = on_reached_special_file();
-            } else {
-                switch (_curr->fts_statp->st_mode & S_IFMT) {
-                case S_IFBLK: result = on_reached_block_device(); break;
-                case S_IFCHR: result = on_reached_character_device(); break;
-                case S_IFIFO: result = on_reached_fifo(); break;
-                case S_IFSOCK: result = on_reached_socket(); break;
-                default: result = Action::Skip; break;
-                }
+        // Ignore directory cycles (FTS_DC), which can only happen when
+        // following symlinks
+        for (auto const &a : _ancestors) {
+            if (a.dev == sb.st_dev && a.ino == sb.st_ino) {
+                return Walk::Continue;
             }
         }
+    }
 
-        // Handle result
-        if (result & Action::Fail) {
-            ret = false;
+    set_entry_path(entry, name_offset);
+    Walk result = dispatch(entry);
+    if (result == Walk::Stop) {
+        return Walk::Stop;
+    } else if (entry.fts_info != FTS_D) {
+        return Walk::Continue;
+    }
+
+    // Don't descend into skipped directories or across mountpoint boundaries,
+    // but still do the post-order visit like fts
+    if (result != Walk::Skip && (sb.st_dev == _root_dev
+            || (_flags & FtsFlag::CrossMountPointBoundaries))) {
+        int fd = openat(parent_fd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC
+                | (follow ? 0 : O_NOFOLLOW));
+        std::vector<char> children;
+
+        if (fd < 0 || !read_dir(fd, children)) {
+            entry.fts_info = FTS_DNR;
+            entry.fts_errno = errno;
+            if (fd >= 0) {
+                close(fd);
+            }
+
+            set_entry_path(entry, name_offset);
+            return dispatch(entry) == Walk::Stop
+                    ? Walk::Stop : Walk::Continue;
         }
-        if (result & Action::Skip) {
-            fts_set(_ftsp, _curr, FTS_SKIP);
-            continue;
+
+        _ancestors.push_back({sb.st_dev, sb.st_ino});
+
+        size_t dir_len = _pathbuf.size();
+        const char *ptr = children.data();
+        const char *end = ptr + children.size();
+
+        while (ptr < end) {
+            auto child_type = static_cast<unsigned char>(*ptr);
+            const char *child_name = ptr + 1;
+            ptr = child_name + strlen(child_name) + 1;
+
+            if (_pathbuf.empty() || _pathbuf.back() != '/') {
+                _pathbuf += '/';
+            }
+            size_t child_offset = _pathbuf.size();
+            _pathbuf += child_name;
+
+            result = walk(fd, child_name, child_type, child_offset,
+                          level + 1);
+            _pathbuf.resize(dir_len);
+
+            if (result == Walk::Stop) {
+                break;
+            }
         }
-        if (result & Action::Stop) {
-            break;
+
+        _ancestors.pop_back();
+        close(fd);
+
+        if (result == Walk::Stop) {
+            return Walk::Stop;
         }
     }
 
-    if (!on_post_execute(ret)) {
-        return false;
-    }
+    entry.fts_info = FTS_DP;
+    set_entry_path(entry, name_offset);
 
-    return ret;
+    return dispatch(entry) == Walk::Stop ? Walk::Stop : Walk::Continue;
 }
 
-std::string FtsWrapper::error()
+bool FtsWrapper::read_dir(int fd, std::vector<char> &entries)
 {
-    return _error_msg;
+    return read_dir_entries(fd, _dents_buf, entries);
+}
+
+/*!
+ * \brief Read all entries of a directory with getdents64()
+ *
+ * The type and name of every entry, except for "." and "..", are appended to
+ * \p entries. Each entry is stored as the d_type byte followed by the
+ * NULL-terminated name.
+ *
+ * \param[in] fd Directory file descriptor
+ * \param[in,out] buf Buffer for getdents64(). Reusing the same buffer for
+ *                    multiple directories avoids reallocating it each time.
+ * \param[out] entries Directory entries
+ *
+ * \return Whether the directory was read successfully. errno is set on
+ *         failure.
+ */
+bool read_dir_entries(int fd, std::vector<char> &buf,
+                      std::vector<char> &entries)
+{
+    buf.resize(DENTS_BUF_SIZE);
+
+    while (true) {
+        long n = syscall(SYS_getdents64, fd, buf.data(), buf.size());
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        } else if (n == 0) {
+            return true;
+        }
+
+        for (long offset = 0; offset < n;) {
+            const char *record = buf.data() + offset;
+            auto const *d = reinterpret_cast<const LinuxDirent64 *>(record);
+            const char *d_name = record + DIRENT64_NAME_OFFSET;
+            offset += d->d_reclen;
+
+            if (strcmp(d_name, ".") == 0 || strcmp(d_name, "..") == 0) {
+                continue;
+            }
+
+            entries.push_back(static_cast<char>(d->d_type));
+            entries.insert(entries.end(), d_name, d_name + strlen(d_name) + 1);
+        }
+    }
+}
+
+void FtsWrapper::set_entry_path(FtsEntry &entry, size_t name_offset)
+{
+    // The root entry owns its path so that it stays valid during traversal
+    char *path = &entry == &_root_entry ? _root_path.data() : _pathbuf.data();
+
+    entry.fts_path = path;
+    entry.fts_accpath = path;
+    entry.fts_name = path + name_offset;
 }
 
 bool FtsWrapper::on_pre_execute() {
@@ -19,17 +19,111 @@
 
 #include "mbutil/hash.h"
 
+#include <algorithm>
+#include <atomic>
 #include <memory>
+#include <thread>
 
-#include <cstdio>
+#include <cerrno>
+#include <cstdlib>
+
+#include <fcntl.h>
+#include <unistd.h>
 
 #include "mbcommon/error_code.h"
+#include "mbcommon/finally.h"
+#include "mbcommon/thread_pool.h"
+#include "mbutil/page_cache.h"
 
 
 namespace mb::util
 {
 
-using ScopedFILE = std::unique_ptr<FILE, decltype(fclose) *>;
+// Large enough that the per-call overhead of read() is negligible compared
+// to hashing
+static constexpr size_t HASH_BUF_SIZE = 1024 * 1024;
+
+static constexpr unsigned int MAX_HASH_THREADS = 8;
+
+struct FreeDeleter
+{
+    void operator()(void *ptr) const
+    {
+        free(ptr);
+    }
+};
+
+using HashBuffer = std::unique_ptr<unsigned char, FreeDeleter>;
+
+static HashBuffer allocate_hash_buffer()
+{
+    void *buf;
+
+    if (posix_memalign(&buf, 4096, HASH_BUF_SIZE) != 0) {
+        return nullptr;
+    }
+
+    return HashBuffer(static_cast<unsigned char *>(buf));
+}
+
+// Hash a file using the caller's buffer. Files are read with plain read()
+// rather than mmap() so that a file that is truncated while it is being
+// hashed results in an error instead of SIGBUS. The SHA512 implementation
+// already picks the fastest code path (eg. ARMv8.2 SHA512 or AVX2) for the
+// CPU at runtime.
+static oc::result<Sha512Digest> sha512_hash_fd(int fd, unsigned char *buf)
+{
+    // Only hints, so failure is fine
+    StreamCache cache(fd, StreamDirection::Read);
+    uint64_t offset = 0;
+
+    SHA512_CTX ctx;
+    if (!SHA512_Init(&ctx)) {
+        return std::errc::io_error;
+    }
+
+    while (true) {
+        ssize_t n = read(fd, buf, HASH_BUF_SIZE);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return ec_from_errno();
+        } else if (n == 0) {
+            break;
+        }
+
+        if (!SHA512_Update(&ctx, buf, static_cast<size_t>(n))) {
+            return std::errc::io_error;
+        }
+
+        offset += static_cast<uint64_t>(n);
+        cache.advance(offset);
+    }
+
+    Sha512Digest digest;
+
+    if (!SHA512_Final(digest.data(), &ctx)) {
+        return std::errc::io_error;
+    }
+
+    return std::move(digest);
+}
+
+static oc::result<Sha512Digest> sha512_hash_path(const std::string &path,
+                                                 unsigned char *buf)
+{
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return ec_from_errno();
+    }
+
+    auto close_fd = finally([&] {
+        close(fd);
+    });
+
+    return sha512_hash_fd(fd, buf);
+}
 
 /*!
  * \brief Compute SHA512 hash of a file
@@ -40,30 +134,55 @@ using ScopedFILE = std::unique_ptr<FILE, decltype(fclose) *>;
  */
 oc::result<Sha512Digest> sha512_hash(const std::string &path)
 {
-    ScopedFILE fp(fopen(path.c_str(), "rbe"), fclose);
-    if (!fp) {
-        return ec_from_errno();
+    auto buf = allocate_hash_buffer();
+    if (!buf) {
+        return std::errc::not_enough_memory;
     }
 
-    std::array<unsigned char, 10240> buf;
-    size_t n;
+    return sha512_hash_path(path, buf.get());
+}
 
+/*!
+ * \brief Compute SHA512 hash of the contents of a File
+ *
+ * The data is hashed in place if \p file exposes mapped_data(). Otherwise, it
+ * is read with File::read_at(), so the file position is not changed.
+ *
+ * \param file File to hash
+ *
+ * \return The digest on success or the error code on failure
+ */
+oc::result<Sha512Digest> sha512_hash(File &file)
+{
     SHA512_CTX ctx;
     if (!SHA512_Init(&ctx)) {
         return std::errc::io_error;
     }
 
-    while ((n = fread(buf.data(), 1, buf.size(), fp.get())) > 0) {
-        if (!SHA512_Update(&ctx, buf.data(), n)) {
+    if (auto data = file.mapped_data()) {
+        if (!SHA512_Update(&ctx, data->data, data->size)) {
             return std::errc::io_error;
         }
-        if (n < buf.size()) {
-            break;
+    } else {
+        auto buf = allocate_hash_buffer();
+        if (!buf) {
+            return std::errc::not_enough_memory;
         }
-    }
 
-    if (ferror(fp.get())) {
-        return ec_from_errno();
+        uint64_t offset = 0;
+
+        while (true) {
+            OUTCOME_TRY(n, file.read_at(offset, buf.get(), HASH_BUF_SIZE));
+            if (n == 0) {
+                break;
+            }
+
+            if (!SHA512_Update(&ctx, buf.get(), n)) {
+                return std::errc::io_error;
+            }
+
+            offset += n;
+        }
     }
 
     Sha512Digest digest;
@@ -75,4 +194,52 @@ oc::result<Sha512Digest> sha512_hash(const std::string &path)
     return std::move(digest);
 }
 
+/*!
+ * \brief Compute SHA512 hashes of multiple files
+ *
+ * The files are hashed concurrently on up to one thread per CPU.
+ *
+ * \param paths Paths to files
+ *
+ * \return The digest or the error code for each file, in the same order as
+ *         \p paths
+ */
+std::vector<oc::result<Sha512Digest>>
+sha512_hash_files(const std::vector<std::string> &paths)
+{
+    std::vector<oc::result<Sha512Digest>> results(
+            paths.size(), std::errc::operation_canceled);
+    std::atomic_size_t next{0};
+
+    auto worker = [&] {
+        auto buf = allocate_hash_buffer();
+
+        for (size_t i; (i = next++) < paths.size();) {
+            if (buf) {
+                results[i] = sha512_hash_path(paths[i], buf.get());
+            } else {
+                results[i] = std::errc::not_enough_memory;
+            }
+        }
+    };
+
+    auto n_threads = std::min<size_t>(
+            thread_count(1, MAX_HASH_THREADS),
+            paths.size());
+
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < n_threads; ++i) {
+        threads.emplace_back(worker);
+    }
+
+    // The calling thread does its share of the work too
+    worker();
+
+    for (auto &t : threads) {
+        t.join();
+    }
+
+    return results;
+}
+
 }
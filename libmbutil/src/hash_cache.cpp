@@ -0,0 +1,373 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbutil/hash_cache.h"
+
+#include <algorithm>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "mbcommon/endian.h"
+#include "mbcommon/error_code.h"
+#include "mbcommon/finally.h"
+
+#include "mbutil/file.h"
+
+/*!
+ * \file mbutil/hash_cache.h
+ * \brief Persistent cache of file digests
+ */
+
+// On-disk format (all integers are little endian):
+//
+//   Header: magic[4] = "MBHC", version (u32), count (u32), reserved (u32)
+//   Entry:  dev (u64), ino (u64), size (u64), mtime_sec (i64),
+//           ctime_sec (i64), mtime_nsec (u32), ctime_nsec (u32),
+//           SHA512 digest (64 bytes)
+
+static constexpr char HASH_CACHE_MAGIC[4] = {'M', 'B', 'H', 'C'};
+static constexpr uint32_t HASH_CACHE_VERSION = 1;
+static constexpr size_t HASH_CACHE_HEADER_SIZE = 16;
+static constexpr size_t HASH_CACHE_ENTRY_SIZE = 5 * 8 + 2 * 4 + 64;
+
+// Old entries are dropped so that images that no longer exist don't
+// accumulate forever
+static constexpr size_t HASH_CACHE_MAX_ENTRIES = 256;
+
+namespace mb::util
+{
+
+static void put_u32(std::string &buf, uint32_t value)
+{
+    value = mb_htole32(value);
+    buf.append(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+static void put_u64(std::string &buf, uint64_t value)
+{
+    value = mb_htole64(value);
+    buf.append(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+static uint32_t get_u32(const char *&ptr)
+{
+    uint32_t value;
+    memcpy(&value, ptr, sizeof(value));
+    ptr += sizeof(value);
+    return mb_le32toh(value);
+}
+
+static uint64_t get_u64(const char *&ptr)
+{
+    uint64_t value;
+    memcpy(&value, ptr, sizeof(value));
+    ptr += sizeof(value);
+    return mb_le64toh(value);
+}
+
+/*!
+ * \class HashCache
+ *
+ * \brief Cache of SHA512 digests keyed by file metadata.
+ *
+ * A digest is only reused if the device, inode, size, modification time and
+ * status change time of the file are all unchanged. Since the status change
+ * time cannot be set from userspace and is updated by every write, this
+ * detects any modification of the file, including ones that preserve the
+ * modification time.
+ *
+ * Only regular files are cached.
+ */
+
+HashCache::HashCache()
+    : _dirty(false)
+{
+}
+
+bool HashCache::Key::operator==(const Key &other) const
+{
+    return dev == other.dev
+            && ino == other.ino
+            && size == other.size
+            && mtime_sec == other.mtime_sec
+            && ctime_sec == other.ctime_sec
+            && mtime_nsec == other.mtime_nsec
+            && ctime_nsec == other.ctime_nsec;
+}
+
+HashCache::Key HashCache::key_for(const struct stat &sb)
+{
+    return {
+        static_cast<uint64_t>(sb.st_dev),
+        static_cast<uint64_t>(sb.st_ino),
+        static_cast<uint64_t>(sb.st_size),
+        static_cast<int64_t>(sb.st_mtim.tv_sec),
+        static_cast<int64_t>(sb.st_ctim.tv_sec),
+        static_cast<uint32_t>(sb.st_mtim.tv_nsec),
+        static_cast<uint32_t>(sb.st_ctim.tv_nsec),
+    };
+}
+
+/*!
+ * \brief Load cache from a file
+ *
+ * On failure, the cache is left empty.
+ *
+ * \param path Path to cache file
+ *
+ * \return Nothing on success or the error code on failure. If the file is
+ *         malformed, `std::errc::bad_message` is returned.
+ */
+oc::result<void> HashCache::load(const std::string &path)
+{
+    _entries.clear();
+    _dirty = false;
+
+    OUTCOME_TRY(data, file_read_all(path));
+
+    if (data.size() < HASH_CACHE_HEADER_SIZE
+            || memcmp(data.data(), HASH_CACHE_MAGIC,
+                      sizeof(HASH_CACHE_MAGIC)) != 0) {
+        return std::errc::bad_message;
+    }
+
+    const char *ptr = data.data() + sizeof(HASH_CACHE_MAGIC);
+
+    auto version = get_u32(ptr);
+    auto count = get_u32(ptr);
+    (void) get_u32(ptr);
+
+    if (version != HASH_CACHE_VERSION || count > HASH_CACHE_MAX_ENTRIES
+            || data.size() != HASH_CACHE_HEADER_SIZE
+                    + count * HASH_CACHE_ENTRY_SIZE) {
+        return std::errc::bad_message;
+    }
+
+    std::vector<Entry> entries(count);
+
+    for (auto &entry : entries) {
+        entry.key.dev = get_u64(ptr);
+        entry.key.ino = get_u64(ptr);
+        entry.key.size = get_u64(ptr);
+        entry.key.mtime_sec = static_cast<int64_t>(get_u64(ptr));
+        entry.key.ctime_sec = static_cast<int64_t>(get_u64(ptr));
+        entry.key.mtime_nsec = get_u32(ptr);
+        entry.key.ctime_nsec = get_u32(ptr);
+        memcpy(entry.digest.data(), ptr, entry.digest.size());
+        ptr += entry.digest.size();
+    }
+
+    _entries.swap(entries);
+
+    return oc::success();
+}
+
+/*!
+ * \brief Save cache to a file
+ *
+ * The cache is written to a temporary file, which then atomically replaces
+ * \p path. The file is only accessible by the owner.
+ *
+ * \param path Path to cache file
+ *
+ * \return Nothing on success or the error code on failure
+ */
+oc::result<void> HashCache::save(const std::string &path) const
+{
+    std::string data;
+    data.reserve(HASH_CACHE_HEADER_SIZE
+            + _entries.size() * HASH_CACHE_ENTRY_SIZE);
+
+    data.append(HASH_CACHE_MAGIC, sizeof(HASH_CACHE_MAGIC));
+    put_u32(data, HASH_CACHE_VERSION);
+    put_u32(data, static_cast<uint32_t>(_entries.size()));
+    put_u32(data, 0);
+
+    for (auto const &entry : _entries) {
+        put_u64(data, entry.key.dev);
+        put_u64(data, entry.key.ino);
+        put_u64(data, entry.key.size);
+        put_u64(data, static_cast<uint64_t>(entry.key.mtime_sec));
+        put_u64(data, static_cast<uint64_t>(entry.key.ctime_sec));
+        put_u32(data, entry.key.mtime_nsec);
+        put_u32(data, entry.key.ctime_nsec);
+        data.append(reinterpret_cast<const char *>(entry.digest.data()),
+                    entry.digest.size());
+    }
+
+    std::string temp_path(path);
+    temp_path += ".tmp";
+
+    int fd = open(temp_path.c_str(),
+                  O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        return ec_from_errno();
+    }
+
+    auto remove_temp = finally([&] {
+        if (fd >= 0) {
+            close(fd);
+        }
+        unlink(temp_path.c_str());
+    });
+
+    for (size_t offset = 0; offset < data.size();) {
+        auto n = write(fd, data.data() + offset, data.size() - offset);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return ec_from_errno();
+        }
+        offset += static_cast<size_t>(n);
+    }
+
+    if (fsync(fd) < 0) {
+        return ec_from_errno();
+    }
+
+    int ret = close(fd);
+    fd = -1;
+    if (ret < 0) {
+        return ec_from_errno();
+    }
+
+    if (rename(temp_path.c_str(), path.c_str()) < 0) {
+        return ec_from_errno();
+    }
+
+    remove_temp.dismiss();
+
+    return oc::success();
+}
+
+/*!
+ * \brief Find cached digest for a file
+ *
+ * \param sb Current metadata of the file
+ *
+ * \return The digest if the file has not changed since it was cached.
+ *         Otherwise, std::nullopt.
+ */
+std::optional<Sha512Digest> HashCache::find(const struct stat &sb) const
+{
+    if (!S_ISREG(sb.st_mode)) {
+        return std::nullopt;
+    }
+
+    auto key = key_for(sb);
+
+    for (auto const &entry : _entries) {
+        if (entry.key == key) {
+            return entry.digest;
+        }
+    }
+
+    return std::nullopt;
+}
+
+/*!
+ * \brief Add digest of a file to the cache
+ *
+ * Any older entry for the same file is replaced.
+ *
+ * \param sb Metadata of the file at the time \p digest was computed
+ * \param digest SHA512 digest of the file contents
+ */
+void HashCache::insert(const struct stat &sb, const Sha512Digest &digest)
+{
+    if (!S_ISREG(sb.st_mode)) {
+        return;
+    }
+
+    auto key = key_for(sb);
+
+    _entries.erase(std::remove_if(_entries.begin(), _entries.end(),
+                                  [&](const Entry &entry) {
+        return entry.key.dev == key.dev && entry.key.ino == key.ino;
+    }), _entries.end());
+
+    if (_entries.size() >= HASH_CACHE_MAX_ENTRIES) {
+        _entries.erase(_entries.begin());
+    }
+
+    _entries.push_back({key, digest});
+    _dirty = true;
+}
+
+/*!
+ * \brief Compute SHA512 hash of a file using the cache
+ *
+ * If the file has not changed since its digest was cached, the cached digest
+ * is returned. Otherwise, the file is hashed and the cache is updated,
+ * provided that the file did not change while it was being read.
+ *
+ * \param path Path to file
+ *
+ * \return The digest on success or the error code on failure
+ */
+oc::result<Sha512Digest> HashCache::sha512_hash(const std::string &path)
+{
+    struct stat sb_before;
+    if (stat(path.c_str(), &sb_before) < 0) {
+        return ec_from_errno();
+    }
+
+    if (auto digest = find(sb_before)) {
+        return std::move(*digest);
+    }
+
+    OUTCOME_TRY(digest, util::sha512_hash(path));
+
+    struct stat sb_after;
+    if (stat(path.c_str(), &sb_after) == 0
+            && same_metadata(sb_before, sb_after)) {
+        insert(sb_after, digest);
+    }
+
+    return std::move(digest);
+}
+
+/*!
+ * \brief Check whether two stat results would map to the same cache entry
+ *
+ * \param a First file metadata
+ * \param b Second file metadata
+ *
+ * \return Whether \p a and \p b refer to the same, unmodified file
+ */
+bool HashCache::same_metadata(const struct stat &a, const struct stat &b)
+{
+    return key_for(a) == key_for(b);
+}
+
+/*!
+ * \brief Check whether the cache has changed since it was loaded
+ */
+bool HashCache::dirty() const
+{
+    return _dirty;
+}
+
+}
@@ -0,0 +1,436 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbutil/io_scheduler.h"
+
+#include <algorithm>
+#include <limits>
+#include <memory>
+
+#include <cerrno>
+#include <cstdio>
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+
+#include "mbcommon/error_code.h"
+
+#include "mbutil/file.h"
+#include "mbutil/mount.h"
+#include "mbutil/path.h"
+
+// Not exposed by the NDK's headers
+#define IOPRIO_CLASS_SHIFT      13
+#define IOPRIO_CLASS_BE         2
+#define IOPRIO_WHO_PROCESS      1
+#define IOPRIO_PRIO_VALUE(c, d) (((c) << IOPRIO_CLASS_SHIFT) | (d))
+
+// Lowest best-effort priority. The idle class is not used because it can starve
+// bulk operations indefinitely on a busy device.
+#define IOPRIO_BULK             IOPRIO_PRIO_VALUE(IOPRIO_CLASS_BE, 7)
+
+// Bounds the number of stacked devices (eg. sdcardfs -> dm -> partition) that
+// are followed
+static constexpr int MAX_DEVICE_DEPTH = 4;
+
+// Outstanding requests per concurrent bulk operation on devices that report
+// their hardware queue depth
+static constexpr unsigned int QUEUE_DEPTH_PER_OPERATION = 16;
+
+namespace mb::util
+{
+
+using ScopedDIR = std::unique_ptr<DIR, decltype(closedir) *>;
+
+static std::string sysfs_block_path(dev_t dev)
+{
+    char buf[64];
+    snprintf(buf, sizeof(buf), "/sys/dev/block/%u:%u", major(dev), minor(dev));
+    return buf;
+}
+
+static bool parse_dev(const std::string &str, dev_t &dev)
+{
+    unsigned int maj;
+    unsigned int min;
+    if (sscanf(str.c_str(), "%u:%u", &maj, &min) != 2) {
+        return false;
+    }
+    dev = makedev(maj, min);
+    return true;
+}
+
+static oc::result<dev_t> backing_device(const std::string &path, int depth);
+
+// Map a block device to the disk whose request queue serves it
+static dev_t sysfs_disk(dev_t dev, int depth)
+{
+    auto path = real_path(sysfs_block_path(dev));
+    if (!path) {
+        return dev;
+    }
+
+    std::string dir = std::move(path.value());
+
+    // Partitions share the queue of their parent disk
+    if (access((dir + "/partition").c_str(), F_OK) == 0) {
+        dir = dir_name(dir);
+    }
+
+    if (depth < MAX_DEVICE_DEPTH) {
+        // Loop devices are backed by a file on another device
+        if (auto backing = file_first_line(dir + "/loop/backing_file")) {
+            if (auto r = backing_device(backing.value(), depth + 1);
+                    r && r.value() != 0) {
+                return r.value();
+            }
+        }
+
+        // Device mapper devices with a single underlying device
+        ScopedDIR dp(opendir((dir + "/slaves").c_str()), closedir);
+        if (dp) {
+            std::string slave;
+            size_t count = 0;
+
+            while (auto ent = readdir(dp.get())) {
+                if (ent->d_name[0] != '.') {
+                    slave = ent->d_name;
+                    ++count;
+                }
+            }
+
+            dev_t slave_dev;
+            if (count == 1) {
+                if (auto str = file_first_line(
+                        dir + "/slaves/" + slave + "/dev");
+                        str && parse_dev(str.value(), slave_dev)) {
+                    return sysfs_disk(slave_dev, depth + 1);
+                }
+            }
+        }
+    }
+
+    dev_t disk;
+    if (auto str = file_first_line(dir + "/dev");
+            str && parse_dev(str.value(), disk)) {
+        return disk;
+    }
+
+    return dev;
+}
+
+static oc::result<dev_t> backing_device(const std::string &path, int depth)
+{
+    // The path may not exist yet (eg. a restore target)
+    std::string cur = path;
+    struct stat sb;
+
+    while (stat(cur.c_str(), &sb) < 0) {
+        if (errno != ENOENT || cur.empty() || cur == "/" || cur == ".") {
+            return ec_from_errno();
+        }
+        cur = dir_name(cur);
+    }
+
+    dev_t dev = S_ISBLK(sb.st_mode) ? sb.st_rdev : sb.st_dev;
+
+    // Filesystems without a block device (sdcardfs, fuse, tmpfs, etc.). If the
+    // mount source is a path, the data lives wherever that path is.
+    if (major(dev) == 0) {
+        if (depth >= MAX_DEVICE_DEPTH) {
+            return 0;
+        }
+
+        OUTCOME_TRY(entries, get_mount_entries());
+
+        auto it = std::find_if(entries.rbegin(), entries.rend(),
+                               [&](const MountEntry &entry) {
+            return entry.dev && *entry.dev == dev;
+        });
+        if (it == entries.rend() || it->source.empty()
+                || it->source[0] != '/') {
+            return 0;
+        }
+
+        return backing_device(it->source, depth + 1);
+    }
+
+    return sysfs_disk(dev, depth);
+}
+
+/*!
+ * \brief Find the disk that backs a path
+ *
+ * Partitions are mapped to their parent disk. Loop devices, single-device
+ * device mapper targets, and filesystems that are backed by a directory (eg.
+ * sdcardfs) are followed to the underlying disk.
+ *
+ * \param path Path to a file, directory, or block device. If the path does not
+ *             exist, its nearest existing parent is used.
+ *
+ * \return Device number of the disk, 0 if the path is not backed by a block
+ *         device, or an error if the path could not be stat'ed.
+ */
+oc::result<dev_t> io_backing_device(const std::string &path)
+{
+    return backing_device(path, 0);
+}
+
+/*!
+ * \brief Get the number of bulk operations a disk can serve concurrently
+ *
+ * The limit is derived from the disk's queue topology in sysfs:
+ *
+ * - Rotational disks and disks with a single queue and no reported hardware
+ *   queue depth (eg. eMMC) get 1, so that concurrent operations don't turn
+ *   sequential I/O into seeks.
+ * - Multi-queue disks (eg. NVMe) get one operation per hardware queue.
+ * - Disks that report a hardware queue depth (eg. UFS) get one operation for
+ *   every QUEUE_DEPTH_PER_OPERATION outstanding requests.
+ *
+ * The result is capped at IO_MAX_BULK_PER_DEVICE.
+ *
+ * \param disk Disk returned by io_backing_device()
+ *
+ * \return Number of concurrent bulk operations
+ */
+unsigned int io_device_concurrency(dev_t disk)
+{
+    if (disk == 0) {
+        return IO_MAX_BULK_PER_DEVICE;
+    }
+
+    std::string base = sysfs_block_path(disk);
+
+    if (auto r = file_first_line(base + "/queue/rotational");
+            r && r.value() == "1") {
+        return 1;
+    }
+
+    unsigned int hw_queues = 0;
+    ScopedDIR dp(opendir((base + "/mq").c_str()), closedir);
+    if (dp) {
+        while (auto ent = readdir(dp.get())) {
+            if (ent->d_name[0] != '.') {
+                ++hw_queues;
+            }
+        }
+    }
+
+    if (hw_queues > 1) {
+        return std::min(hw_queues, IO_MAX_BULK_PER_DEVICE);
+    }
+
+    unsigned int depth;
+    if (auto r = file_first_line(base + "/device/queue_depth");
+            r && sscanf(r.value().c_str(), "%u", &depth) == 1) {
+        return std::clamp(depth / QUEUE_DEPTH_PER_OPERATION,
+                          1u, IO_MAX_BULK_PER_DEVICE);
+    }
+
+    return 1;
+}
+
+/*!
+ * \brief Lower the I/O priority of the calling thread for bulk operations
+ *
+ * This lets the kernel's I/O scheduler serve latency-sensitive requests (eg.
+ * the daemon's stat and readlink requests) from other threads and processes
+ * first. Since the priority is inherited across fork(), it is also suitable
+ * for child processes that perform bulk I/O.
+ *
+ * \return Nothing if successful. Otherwise, the error code.
+ */
+oc::result<void> io_set_bulk_priority()
+{
+    if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, IOPRIO_BULK) < 0) {
+        return ec_from_errno();
+    }
+    return oc::success();
+}
+
+/*!
+ * \class IoScheduler
+ *
+ * \brief Admission control for bulk I/O operations
+ *
+ * Large operations, like backing up, restoring, copying, or wiping a
+ * filesystem, acquire a ticket for the path they operate on before starting.
+ * At most io_device_concurrency() tickets are handed out for each disk at a
+ * time. Other callers block in acquire_bulk() until a ticket is released.
+ *
+ * While a ticket is held, the thread runs with a lower I/O priority (see
+ * io_set_bulk_priority()), so small interactive requests are not stuck behind
+ * the bulk operations' queued requests.
+ */
+
+IoScheduler::Ticket::Ticket()
+    : m_scheduler(nullptr)
+    , m_disk(0)
+    , m_old_ioprio(-1)
+{
+}
+
+IoScheduler::Ticket::~Ticket()
+{
+    release();
+}
+
+IoScheduler::Ticket::Ticket(Ticket &&other) noexcept
+    : Ticket()
+{
+    std::swap(m_scheduler, other.m_scheduler);
+    std::swap(m_disk, other.m_disk);
+    std::swap(m_old_ioprio, other.m_old_ioprio);
+}
+
+IoScheduler::Ticket & IoScheduler::Ticket::operator=(Ticket &&rhs) noexcept
+{
+    if (this != &rhs) {
+        release();
+        std::swap(m_scheduler, rhs.m_scheduler);
+        std::swap(m_disk, rhs.m_disk);
+        std::swap(m_old_ioprio, rhs.m_old_ioprio);
+    }
+    return *this;
+}
+
+/*!
+ * \brief Release the ticket
+ *
+ * This must be called (or the ticket destroyed) on the thread that acquired
+ * the ticket because the I/O priority is a per-thread attribute.
+ */
+void IoScheduler::Ticket::release()
+{
+    if (!m_scheduler) {
+        return;
+    }
+
+    if (m_old_ioprio >= 0) {
+        syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, m_old_ioprio);
+    }
+
+    m_scheduler->release(m_disk);
+    m_scheduler = nullptr;
+}
+
+IoScheduler::IoScheduler() = default;
+
+/*!
+ * \brief Wait for the disk backing \p path to accept another bulk operation
+ *
+ * If the backing disk cannot be determined, the operation is admitted without
+ * waiting.
+ *
+ * \param path Path that the operation will read from or write to
+ *
+ * \return Ticket that must be held for the duration of the operation
+ */
+IoScheduler::Ticket IoScheduler::acquire_bulk(const std::string &path)
+{
+    auto disk = io_backing_device(path);
+
+    Ticket ticket;
+    ticket.m_scheduler = this;
+    ticket.m_disk = disk ? disk.value() : 0;
+
+    {
+        std::unique_lock lock(m_mutex);
+        auto &dev = device(ticket.m_disk);
+
+        m_cv.wait(lock, [&] {
+            return dev.active < dev.limit;
+        });
+
+        ++dev.active;
+    }
+
+    int old_ioprio = static_cast<int>(
+            syscall(SYS_ioprio_get, IOPRIO_WHO_PROCESS, 0));
+    if (old_ioprio >= 0 && io_set_bulk_priority()) {
+        ticket.m_old_ioprio = old_ioprio;
+    }
+
+    return ticket;
+}
+
+/*!
+ * \brief Override the concurrency limit of a disk
+ *
+ * \param disk Disk returned by io_backing_device()
+ * \param limit Maximum number of concurrent bulk operations (at least 1)
+ */
+void IoScheduler::set_device_limit(dev_t disk, unsigned int limit)
+{
+    {
+        std::lock_guard lock(m_mutex);
+        device(disk).limit = std::max(limit, 1u);
+    }
+    m_cv.notify_all();
+}
+
+/*!
+ * \brief Get the concurrency limit of a disk
+ *
+ * \param disk Disk returned by io_backing_device()
+ *
+ * \return Value set by set_device_limit() or io_device_concurrency()
+ */
+unsigned int IoScheduler::device_limit(dev_t disk)
+{
+    std::lock_guard lock(m_mutex);
+    return device(disk).limit;
+}
+
+/*!
+ * \brief Get the process-wide scheduler
+ */
+IoScheduler & IoScheduler::instance()
+{
+    static IoScheduler scheduler;
+    return scheduler;
+}
+
+// Must be called with m_mutex held
+IoScheduler::Device & IoScheduler::device(dev_t disk)
+{
+    auto &dev = m_devices[disk];
+    if (dev.limit == 0) {
+        // Paths without a block device are not throttled
+        dev.limit = disk == 0
+                ? std::numeric_limits<unsigned int>::max()
+                : io_device_concurrency(disk);
+    }
+    return dev;
+}
+
+void IoScheduler::release(dev_t disk)
+{
+    {
+        std::lock_guard lock(m_mutex);
+        --m_devices[disk].active;
+    }
+    m_cv.notify_all();
+}
+
+}
@@ -19,6 +19,7 @@
 
 #include "mbutil/loopdev.h"
 
+#include <mutex>
 #include <vector>
 
 #include <cerrno>
@@ -49,6 +50,22 @@
 
 #define MAX_LOOPDEVS    1024
 
+// Number of free loopdevs to remember when scanning
+#define LOOPDEV_POOL_SIZE 4
+
+// LOOP_CONFIGURE was added in Linux 5.8 and is missing from older headers
+#ifndef LOOP_CONFIGURE
+#  define LOOP_CONFIGURE 0x4C0A
+
+struct loop_config
+{
+    __u32 fd;
+    __u32 block_size;
+    struct loop_info64 info;
+    __u64 __reserved[8];
+};
+#endif
+
 
 namespace mb::util
 {
@@ -88,68 +105,116 @@ static oc::result<int> find_loopdev_by_loop_control()
 }
 
 /*!
- * \brief Find empty loopdev by dumb scan through /dev/block/loop*
+ * \brief Check if a loopdev is unused
+ *
+ * The device node is created if it does not exist.
  *
- * \return Loopdev number or the error code if:
- *         - /dev/block/loop# failed to stat where errno != ENOENT
+ * \return Whether the loopdev is unused or the error code if:
  *         - /dev/block/loop# is not a loop device
- *         - /dev/block/loop# could not be opened
+ *         - /dev/block/loop# could not be created or opened
  *         - LOOP_GET_STATUS64 ioctl failed where errno != ENXIO
  */
-static oc::result<int> find_loopdev_by_scanning()
+static oc::result<bool> is_loopdev_unused(int n)
 {
-    int fd;
     char loopdev[64];
+    loop_info64 loopinfo;
+    struct stat sb;
 
-    // Avoid /dev/block/loop0 since some installers (ahem, SuperSU) are
-    // hardcoded to use it
-    for (int n = 1; n < MAX_LOOPDEVS; ++n) {
-        loop_info64 loopinfo;
-        struct stat sb;
-
-        sprintf(loopdev, LOOP_FMT, n);
+    sprintf(loopdev, LOOP_FMT, n);
 
-        if (mknod(loopdev, S_IFBLK | 0644,
-                  static_cast<dev_t>(makedev(7, n))) < 0) {
-            if (errno != EEXIST) {
-                continue;
-            }
+    if (mknod(loopdev, S_IFBLK | 0644,
+              static_cast<dev_t>(makedev(7, n))) < 0) {
+        if (errno != EEXIST) {
+            return ec_from_errno();
         }
+    }
 
-        if ((fd = open(loopdev, O_RDWR | O_CLOEXEC)) < 0) {
-            // Loopdev does not exist. Great! loopdev_find_unused() will
-            // create it
-            if (errno == ENOENT) {
-                return n;
-            } else {
-                continue;
-            }
+    int fd = open(loopdev, O_RDWR | O_CLOEXEC);
+    if (fd < 0) {
+        // Loopdev does not exist. Great! loopdev_find_unused() will
+        // create it
+        if (errno == ENOENT) {
+            return true;
+        } else {
+            return ec_from_errno();
         }
+    }
 
-        auto close_fd = finally([&] {
-            close(fd);
-        });
+    auto close_fd = finally([&] {
+        close(fd);
+    });
+
+    if (fstat(fd, &sb) < 0) {
+        return ec_from_errno();
+    }
 
-        if (fstat(fd, &sb) < 0) {
-            // Uhhhhh...
-            continue;
+    if (!S_ISBLK(sb.st_mode) || major(sb.st_rdev) != 7) {
+        // Device isn't a loop device
+        return std::errc::no_such_device;
+    }
+
+    if (ioctl(fd, LOOP_GET_STATUS64, &loopinfo) < 0) {
+        if (errno == ENXIO) {
+            return true;
+        } else {
+            return ec_from_errno();
         }
+    }
+
+    return false;
+}
+
+/*!
+ * \brief Find empty loopdevs by dumb scan through /dev/block/loop*
+ *
+ * \param max Maximum number of loopdevs to find
+ *
+ * \return Loopdev numbers in ascending order (possibly fewer than \p max) or
+ *         `std::errc::no_such_file_or_directory` if none were found
+ */
+static oc::result<std::vector<int>> find_loopdevs_by_scanning(size_t max)
+{
+    std::vector<int> result;
 
-        if (!S_ISBLK(sb.st_mode) || major(sb.st_rdev) != 7) {
-            // Device isn't a loop device
-            continue;
+    // Avoid /dev/block/loop0 since some installers (ahem, SuperSU) are
+    // hardcoded to use it
+    for (int n = 1; n < MAX_LOOPDEVS && result.size() < max; ++n) {
+        if (auto r = is_loopdev_unused(n); r && r.value()) {
+            result.push_back(n);
         }
+    }
+
+    if (result.empty()) {
+        return std::errc::no_such_file_or_directory;
+    }
+
+    return std::move(result);
+}
 
-        if (ioctl(fd, LOOP_GET_STATUS64, &loopinfo) < 0) {
-            if (errno == ENXIO) {
-                return n;
-            } else {
-                continue;
-            }
+// Free loopdevs found by the last scan. Scanning is slow, so the extra
+// devices it finds are handed out to subsequent calls (eg. when mounting
+// several images back to back) after checking that they are still unused.
+static std::mutex pool_lock;
+static std::vector<int> pool;
+
+static oc::result<int> find_loopdev_from_pool()
+{
+    std::lock_guard<std::mutex> lock(pool_lock);
+
+    while (!pool.empty()) {
+        int n = pool.front();
+        pool.erase(pool.begin());
+
+        if (auto r = is_loopdev_unused(n); r && r.value()) {
+            return n;
         }
     }
 
-    return std::errc::no_such_file_or_directory;
+    OUTCOME_TRY(found, find_loopdevs_by_scanning(LOOPDEV_POOL_SIZE));
+
+    pool.assign(found.begin() + 1, found.end());
+
+    return found.front();
 }
 
 oc::result<std::string> loopdev_find_unused()
@@ -159,7 +224,7 @@ oc::result<std::string> loopdev_find_unused()
     // Also search by scanning if n == 0, since some installers hardcode
     // /dev/block/loop0
     if (!n || n.value() == 0) {
-        n = find_loopdev_by_scanning();
+        n = find_loopdev_from_pool();
     }
     if (!n) {
         return n.as_failure();
@@ -190,11 +255,25 @@ oc::result<void> loopdev_set_up_device(const std::string &loopdev,
         close(lfd);
     });
 
-    loop_info64 loopinfo = {};
+    loop_config config = {};
 
-    strlcpy(reinterpret_cast<char *>(loopinfo.lo_file_name), file.c_str(),
+    config.fd = static_cast<__u32>(ffd);
+    strlcpy(reinterpret_cast<char *>(config.info.lo_file_name), file.c_str(),
             LO_NAME_SIZE);
-    loopinfo.lo_offset = offset;
+    config.info.lo_offset = offset;
+    if (ro) {
+        config.info.lo_flags = LO_FLAGS_READ_ONLY;
+    }
+
+    // Attach and configure the device atomically if the kernel supports it
+    if (ioctl(lfd, LOOP_CONFIGURE, &config) == 0) {
+        return oc::success();
+    } else if (errno != EINVAL && errno != ENOTTY) {
+        return ec_from_errno();
+    }
+
+    loop_info64 &loopinfo = config.info;
+    loopinfo.lo_flags = 0;
 
     if (ioctl(lfd, LOOP_SET_FD, ffd) < 0) {
         return ec_from_errno();
@@ -21,6 +21,7 @@
 
 #include <algorithm>
 #include <memory>
+#include <mutex>
 #include <vector>
 
 #include <cerrno>
@@ -28,6 +29,8 @@
 #include <cstdlib>
 #include <cstring>
 
+#include <fcntl.h>
+#include <poll.h>
 #include <sys/mount.h>
 #include <sys/stat.h>
 #include <sys/sysmacros.h>
@@ -53,6 +56,7 @@ static constexpr int MAX_UNMOUNT_TRIES = 5;
 
 static constexpr char PROC_MOUNTS[] = "/proc/mounts";
 static constexpr char PROC_MOUNTINFO[] = "/proc/self/mountinfo";
+static constexpr char PROC_MOUNT_NS[] = "/proc/self/ns/mnt";
 static constexpr std::string_view DELETED_SUFFIX = " (deleted)";
 
 using ScopedFILE = std::unique_ptr<FILE, decltype(fclose) *>;
@@ -125,11 +129,11 @@ static void strip_deleted_suffix(std::string &path)
 static void remove_duplicate_options(const std::string &vfs_options,
                                      std::string &fs_options)
 {
-    auto vfs_list = split_sv(vfs_options, ',');
+    auto vfs_list = split_range(vfs_options, ',');
     std::vector<std::string_view> fs_list;
 
     // Slow linear search is good enough
-    for (auto const &o : split_sv(fs_options, ',')) {
+    for (auto const &o : split_range(fs_options, ',')) {
         if (std::find(vfs_list.begin(), vfs_list.end(), o) == vfs_list.end()) {
             fs_list.emplace_back(o);
         }
@@ -147,7 +151,7 @@ split_options(std::string_view options)
     std::tie(std::ignore, fs_list) = parse_mount_options(options);
 
     // Slow linear search is good enough
-    for (auto const &o : split_sv(options, ',')) {
+    for (auto const &o : split_range(options, ',')) {
         if (std::find(fs_list.begin(), fs_list.end(), o) == fs_list.end()) {
             vfs_list.emplace_back(o);
         }
@@ -156,98 +160,321 @@ split_options(std::string_view options)
     return {join(vfs_list, ','), join(fs_list, ',')};
 }
 
-oc::result<std::vector<MountEntry>> get_mount_entries()
+// Parse a line from /proc/self/mountinfo. The line is modified in place.
+static oc::result<void> parse_mountinfo_line(char *line, MountEntry &entry)
 {
-    std::vector<MountEntry> entries;
+    unsigned int id;
+    unsigned int parent;
+    unsigned int dev_maj, dev_min;
+    int root_begin, root_end;
+    int target_begin, target_end;
+    int vfs_opts_begin, vfs_opts_end;
+    int type_begin, type_end;
+    int source_begin, source_end;
+    int fs_opts_begin, fs_opts_end;
+    int count;
+
+    count = std::sscanf(line,
+                        "%u "      // [1] ID
+                        "%u "      // [2] Parent
+                        "%u:%u "   // [3] Device major:minor
+                        "%n%*s%n " // [4] Bind mount root
+                        "%n%*s%n " // [5] Mount point
+                        "%n%*s%n", // [6] VFS options
+                        &id,
+                        &parent,
+                        &dev_maj, &dev_min,
+                        &root_begin, &root_end,
+                        &target_begin, &target_end,
+                        &vfs_opts_begin, &vfs_opts_end);
+    if (count != 4) {
+        return std::errc::invalid_argument;
+    }
 
-    char *line = nullptr;
-    size_t len = 0;
+    // [7] Skip over optional fields
+    char *dash = strstr(line + target_end, " - ");
+    if (!dash) {
+        return std::errc::invalid_argument;
+    }
 
-    auto free_line = finally([&] {
-        free(line);
-    });
+    count = sscanf(dash, " - "
+                         "%n%*s%n " // [8] FS type
+                         "%n%*s%n " // [9] Source device
+                         "%n%*s%n", // [10] FS options
+                         &type_begin, &type_end,
+                         &source_begin, &source_end,
+                         &fs_opts_begin, &fs_opts_end);
+    if (count != 0) {
+        return std::errc::invalid_argument;
+    }
 
-    {
-        ScopedFILE fp(fopen(PROC_MOUNTINFO, "re"), fclose);
-        if (fp) {
-            while (getline(&line, &len, fp.get()) != -1) {
-                MountEntry &entry = entries.emplace_back();
+    // NULL terminate entries
+    line[root_end] = '\0';
+    line[target_end] = '\0';
+    line[vfs_opts_end] = '\0';
+    dash[type_end] = '\0';
+    dash[source_end] = '\0';
+    dash[fs_opts_end] = '\0';
+
+    entry.id = id;
+    entry.parent = parent;
+    entry.dev = makedev(dev_maj, dev_min);
+    entry.root = unescape_octals(line + root_begin);
+    entry.target = unescape_octals(line + target_begin);
+    entry.vfs_options = unescape_octals(line + vfs_opts_begin);
+    entry.type = unescape_octals(dash + type_begin);
+    entry.source = unescape_octals(dash + source_begin);
+    entry.fs_options = unescape_octals(dash + fs_opts_begin);
+
+    strip_deleted_suffix(entry.target);
+    remove_duplicate_options(entry.vfs_options, entry.fs_options);
 
-                unsigned int id;
-                unsigned int parent;
-                unsigned int dev_maj, dev_min;
-                int root_begin, root_end;
-                int target_begin, target_end;
-                int vfs_opts_begin, vfs_opts_end;
-                int type_begin, type_end;
-                int source_begin, source_end;
-                int fs_opts_begin, fs_opts_end;
-                int count;
+    return oc::success();
+}
 
-                count = std::sscanf(line,
-                                    "%u "      // [1] ID
-                                    "%u "      // [2] Parent
-                                    "%u:%u "   // [3] Device major:minor
-                                    "%n%*s%n " // [4] Bind mount root
-                                    "%n%*s%n " // [5] Mount point
-                                    "%n%*s%n", // [6] VFS options
-                                    &id,
-                                    &parent,
-                                    &dev_maj, &dev_min,
-                                    &root_begin, &root_end,
-                                    &target_begin, &target_end,
-                                    &vfs_opts_begin, &vfs_opts_end);
-                if (count != 4) {
-                    return std::errc::invalid_argument;
-                }
+static oc::result<ino_t> get_mount_ns_inode()
+{
+    struct stat sb;
 
-                // [7] Skip over optional fields
-                char *dash = strstr(line + target_end, " - ");
-                if (!dash) {
-                    return std::errc::invalid_argument;
-                }
+    if (stat(PROC_MOUNT_NS, &sb) < 0) {
+        return ec_from_errno();
+    }
 
-                count = sscanf(dash, " - "
-                                     "%n%*s%n " // [8] FS type
-                                     "%n%*s%n " // [9] Source device
-                                     "%n%*s%n", // [10] FS options
-                                     &type_begin, &type_end,
-                                     &source_begin, &source_end,
-                                     &fs_opts_begin, &fs_opts_end);
-                if (count != 0) {
-                    return std::errc::invalid_argument;
-                }
+    return sb.st_ino;
+}
 
-                // NULL terminate entries
-                line[root_end] = '\0';
-                line[target_end] = '\0';
-                line[vfs_opts_end] = '\0';
-                dash[type_end] = '\0';
-                dash[source_end] = '\0';
-                dash[fs_opts_end] = '\0';
-
-                entry.id = id;
-                entry.parent = parent;
-                entry.dev = makedev(dev_maj, dev_min);
-                entry.root = unescape_octals(line + root_begin);
-                entry.target = unescape_octals(line + target_begin);
-                entry.vfs_options = unescape_octals(line + vfs_opts_begin);
-                entry.type = unescape_octals(dash + type_begin);
-                entry.source = unescape_octals(dash + source_begin);
-                entry.fs_options = unescape_octals(dash + fs_opts_begin);
+/*!
+ * \class MountTable
+ *
+ * \brief Cached copy of the mount table.
+ *
+ * The table is parsed from /proc/self/mountinfo. The file is kept open and
+ * refresh() only parses it again if poll() reports that the mount table has
+ * changed. Mounts can be looked up by mount point or source in constant
+ * time.
+ *
+ * The file is reopened if the process forks (the open file would otherwise
+ * be shared with the parent, including its change notification state) or
+ * moves to a different mount namespace.
+ */
 
-                strip_deleted_suffix(entry.target);
-                remove_duplicate_options(entry.vfs_options, entry.fs_options);
-            }
+MountTable::MountTable()
+    : _fd(-1)
+    , _pid(-1)
+    , _ns_ino(0)
+{
+}
 
-            if (ferror(fp.get())) {
-                return ec_from_errno();
+MountTable::~MountTable()
+{
+    if (_fd >= 0) {
+        close(_fd);
+    }
+}
+
+oc::result<void> MountTable::open_mountinfo(ino_t ns_ino)
+{
+    if (_fd >= 0) {
+        close(_fd);
+        _fd = -1;
+    }
+
+    _fd = open(PROC_MOUNTINFO, O_RDONLY | O_CLOEXEC);
+    if (_fd < 0) {
+        return ec_from_errno();
+    }
+
+    _pid = getpid();
+    _ns_ino = ns_ino;
+
+    return oc::success();
+}
+
+// Check if the table needs to be parsed again
+oc::result<bool> MountTable::changed()
+{
+    auto ns_ino = get_mount_ns_inode();
+
+    // Old kernels have no /proc/self/ns/mnt. Without it, namespace changes
+    // cannot be detected, so the file is reopened every time.
+    if (_fd < 0 || _pid != getpid() || !ns_ino || ns_ino.value() != _ns_ino) {
+        OUTCOME_TRYV(open_mountinfo(ns_ino ? ns_ino.value() : 0));
+        return true;
+    }
+
+    // The kernel reports POLLPRI | POLLERR once for each change to the mount
+    // table since the last poll()
+    struct pollfd pfd = {};
+    pfd.fd = _fd;
+    pfd.events = POLLPRI;
+
+    int ret;
+    do {
+        ret = poll(&pfd, 1, 0);
+    } while (ret < 0 && errno == EINTR);
+
+    if (ret < 0) {
+        return ec_from_errno();
+    }
+
+    return ret > 0 && (pfd.revents & (POLLPRI | POLLERR));
+}
+
+oc::result<void> MountTable::parse()
+{
+    std::string data;
+    char buf[16384];
+
+    if (lseek(_fd, 0, SEEK_SET) < 0) {
+        return ec_from_errno();
+    }
+
+    while (true) {
+        auto n = read(_fd, buf, sizeof(buf));
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
             }
+            return ec_from_errno();
+        } else if (n == 0) {
+            break;
+        }
 
-            return std::move(entries);
+        data.append(buf, static_cast<size_t>(n));
+    }
+
+    std::vector<MountEntry> entries;
+    std::unordered_map<std::string, size_t> by_target;
+    std::unordered_multimap<std::string, size_t> by_source;
+
+    for (size_t pos = 0; pos < data.size();) {
+        auto newline = data.find('\n', pos);
+        if (newline == std::string::npos) {
+            newline = data.size();
+        } else {
+            data[newline] = '\0';
         }
+
+        if (newline > pos) {
+            OUTCOME_TRYV(parse_mountinfo_line(
+                    data.data() + pos, entries.emplace_back()));
+        }
+
+        pos = newline + 1;
     }
 
+    for (size_t i = 0; i < entries.size(); ++i) {
+        // Later mounts are on top of earlier ones
+        by_target.insert_or_assign(entries[i].target, i);
+        by_source.emplace(entries[i].source, i);
+    }
+
+    _entries.swap(entries);
+    _by_target.swap(by_target);
+    _by_source.swap(by_source);
+
+    return oc::success();
+}
+
+/*!
+ * \brief Update the table if the mounts have changed
+ *
+ * \return Nothing on success or the error code on failure. On failure, the
+ *         table is left empty.
+ */
+oc::result<void> MountTable::refresh()
+{
+    auto ret = [&]() -> oc::result<void> {
+        OUTCOME_TRY(needs_parse, changed());
+        if (needs_parse) {
+            OUTCOME_TRYV(parse());
+        }
+        return oc::success();
+    }();
+
+    if (!ret) {
+        if (_fd >= 0) {
+            close(_fd);
+            _fd = -1;
+        }
+
+        _entries.clear();
+        _by_target.clear();
+        _by_source.clear();
+    }
+
+    return ret;
+}
+
+/*!
+ * \brief All mounts in the order listed by the kernel
+ */
+const std::vector<MountEntry> & MountTable::entries() const
+{
+    return _entries;
+}
+
+/*!
+ * \brief Find the topmost mount at a mount point
+ *
+ * \param target Mount point (exact string comparison)
+ *
+ * \return Pointer to the entry or nullptr if nothing is mounted at \p target
+ */
+const MountEntry * MountTable::find_by_target(const std::string &target) const
+{
+    auto it = _by_target.find(target);
+    if (it == _by_target.end()) {
+        return nullptr;
+    }
+
+    return &_entries[it->second];
+}
+
+/*!
+ * \brief Find all mounts of a source device
+ *
+ * \param source Source device (exact string comparison)
+ *
+ * \return Pointers to the entries in no particular order
+ */
+std::vector<const MountEntry *>
+MountTable::find_by_source(const std::string &source) const
+{
+    std::vector<const MountEntry *> result;
+
+    auto [begin, end] = _by_source.equal_range(source);
+    for (auto it = begin; it != end; ++it) {
+        result.push_back(&_entries[it->second]);
+    }
+
+    return result;
+}
+
+// Table shared by the functions below
+static std::mutex mount_table_lock;
+static MountTable mount_table;
+
+oc::result<std::vector<MountEntry>> get_mount_entries()
+{
+    {
+        std::lock_guard<std::mutex> lock(mount_table_lock);
+
+        if (mount_table.refresh()) {
+            return mount_table.entries();
+        }
+    }
+
+    // Fall back to /proc/mounts if mountinfo is unavailable
+    std::vector<MountEntry> entries;
+
+    char *line = nullptr;
+    size_t len = 0;
+
+    auto free_line = finally([&] {
+        free(line);
+    });
+
     {
         ScopedFILE fp(fopen(PROC_MOUNTS, "re"), fclose);
         if (fp) {
@@ -310,6 +537,17 @@ oc::result<std::vector<MountEntry>> get_mount_entries()
 
 oc::result<void> is_mounted(const std::string &mountpoint)
 {
+    {
+        std::lock_guard<std::mutex> lock(mount_table_lock);
+
+        if (mount_table.refresh()) {
+            if (mount_table.find_by_target(mountpoint)) {
+                return oc::success();
+            }
+            return MountError::PathNotMounted;
+        }
+    }
+
     OUTCOME_TRY(entries, get_mount_entries());
 
     for (auto const &entry : entries) {
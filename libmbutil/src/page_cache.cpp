@@ -0,0 +1,226 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbutil/page_cache.h"
+
+#include <algorithm>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+/*!
+ * \file mbutil/page_cache.h
+ * \brief Page cache management for data that is streamed once
+ *
+ * Backups, restores, copies, and flashing read or write gigabytes of data that
+ * is never accessed again. Left alone, that data evicts the page cache of the
+ * foreground apps and the dirty pages pile up until they are flushed in one
+ * long stall. StreamCache keeps the footprint of such a stream to a few
+ * windows:
+ *
+ * * When reading, the next window is read ahead asynchronously and the windows
+ *   that have been consumed are dropped from the page cache.
+ * * When writing, writeback of each window is started as soon as it is full.
+ *   Once the following window is full, the previous one is waited on and
+ *   dropped, so at most two windows of dirty pages exist at any time.
+ *
+ * All of the hints are advisory. Errors (eg. for pipes or sockets) are
+ * ignored.
+ */
+
+namespace mb::util
+{
+
+static void advise(int fd, uint64_t offset, uint64_t size, int advice)
+{
+    // off_t is 32 bits on 32-bit bionic
+    (void) posix_fadvise64(fd, static_cast<off64_t>(offset),
+                           static_cast<off64_t>(size), advice);
+}
+
+static void write_back(int fd, uint64_t offset, uint64_t size,
+                       unsigned int flags)
+{
+    (void) sync_file_range(fd, static_cast<off64_t>(offset),
+                           static_cast<off64_t>(size), flags);
+}
+
+/*!
+ * \class StreamCache
+ *
+ * \brief Manage the page cache of a file that is accessed sequentially once
+ *
+ * The owner calls advance() whenever data has been read or written. Seeking
+ * forwards (eg. over holes) is fine. The stream is finished when the object is
+ * destroyed or reset.
+ */
+
+/*!
+ * \brief Construct an object that is not attached to any file
+ */
+StreamCache::StreamCache()
+    : m_fd(-1)
+    , m_direction(StreamDirection::Read)
+    , m_dropped(0)
+    , m_flushed(0)
+    , m_end(0)
+{
+}
+
+/*!
+ * \brief Construct an object that manages \p fd
+ *
+ * \param fd File descriptor, which must outlive this object
+ * \param direction Whether the file is read or written
+ * \param offset Offset where the stream starts
+ */
+StreamCache::StreamCache(int fd, StreamDirection direction, uint64_t offset)
+    : StreamCache()
+{
+    reset(fd, direction, offset);
+}
+
+StreamCache::~StreamCache()
+{
+    finish();
+}
+
+/*!
+ * \brief Finish the current stream and start managing a new one
+ *
+ * \param fd File descriptor or -1 to detach
+ * \param direction Whether the file is read or written
+ * \param offset Offset where the stream starts
+ */
+void StreamCache::reset(int fd, StreamDirection direction, uint64_t offset)
+{
+    finish();
+
+    m_fd = fd;
+    m_direction = direction;
+    m_dropped = offset;
+    m_flushed = offset;
+    m_end = offset;
+
+    if (m_fd < 0) {
+        return;
+    }
+
+    advise(m_fd, offset, 0, POSIX_FADV_NOREUSE);
+
+    if (m_direction == StreamDirection::Read) {
+        // Doubles the kernel's readahead window
+        advise(m_fd, offset, 0, POSIX_FADV_SEQUENTIAL);
+        advise(m_fd, offset, WINDOW_SIZE, POSIX_FADV_WILLNEED);
+        m_flushed += WINDOW_SIZE;
+    }
+}
+
+/*!
+ * \brief Record that the data before \p offset has been processed
+ *
+ * \param offset Offset of the end of the processed data
+ */
+void StreamCache::advance(uint64_t offset)
+{
+    if (m_fd < 0) {
+        return;
+    }
+
+    m_end = offset;
+    m_dropped = std::min(m_dropped, offset);
+
+    if (m_direction == StreamDirection::Read) {
+        // Keep a full window read ahead of the reader
+        if (m_end + WINDOW_SIZE > m_flushed) {
+            uint64_t begin = std::max(m_flushed, m_end);
+            advise(m_fd, begin, WINDOW_SIZE, POSIX_FADV_WILLNEED);
+            m_flushed = begin + WINDOW_SIZE;
+        }
+
+        // Clean pages can be dropped immediately
+        if (m_end - m_dropped >= WINDOW_SIZE) {
+            advise(m_fd, m_dropped, m_end - m_dropped, POSIX_FADV_DONTNEED);
+            m_dropped = m_end;
+        }
+    } else {
+        m_flushed = std::min(m_flushed, offset);
+
+        if (m_end - m_flushed >= WINDOW_SIZE) {
+            // Start writing back the window that was just filled
+            write_back(m_fd, m_flushed, m_end - m_flushed,
+                       SYNC_FILE_RANGE_WRITE);
+
+            // By now, the previous window has most likely been written, so
+            // waiting for it is short. Dirty pages can't be dropped.
+            if (m_flushed > m_dropped) {
+                write_back(m_fd, m_dropped, m_flushed - m_dropped,
+                           SYNC_FILE_RANGE_WAIT_BEFORE
+                           | SYNC_FILE_RANGE_WRITE
+                           | SYNC_FILE_RANGE_WAIT_AFTER);
+                advise(m_fd, m_dropped, m_flushed - m_dropped,
+                       POSIX_FADV_DONTNEED);
+                m_dropped = m_flushed;
+            }
+
+            m_flushed = m_end;
+        }
+    }
+}
+
+/*!
+ * \brief Record that the data before the current file offset has been
+ *        processed
+ */
+void StreamCache::advance()
+{
+    if (m_fd < 0) {
+        return;
+    }
+
+    off64_t offset = lseek64(m_fd, 0, SEEK_CUR);
+    if (offset >= 0) {
+        advance(static_cast<uint64_t>(offset));
+    }
+}
+
+/*!
+ * \brief Finish the stream
+ *
+ * When reading, everything that was read or read ahead is dropped from the
+ * page cache. When writing, writeback of the remaining data is started, but
+ * not waited for, so that closing the file doesn't block.
+ */
+void StreamCache::finish()
+{
+    if (m_fd < 0) {
+        return;
+    }
+
+    if (m_direction == StreamDirection::Read) {
+        uint64_t end = std::max(m_end, m_flushed);
+        advise(m_fd, m_dropped, end - m_dropped, POSIX_FADV_DONTNEED);
+    } else if (m_end > m_flushed) {
+        write_back(m_fd, m_flushed, m_end - m_flushed, SYNC_FILE_RANGE_WRITE);
+    }
+
+    m_fd = -1;
+}
+
+}
@@ -22,16 +22,19 @@
 #include <algorithm>
 #include <memory>
 #include <mutex>
-#include <unordered_set>
 #include <vector>
 
 #include <cstdio>
 #include <cstring>
 
+#include <fcntl.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <unistd.h>
 
 #include "mbcommon/common.h"
 #include "mbcommon/finally.h"
+#include "mbcommon/perf.h"
 #include "mbcommon/string.h"
 #include "mbutil/string.h"
 
@@ -48,6 +51,8 @@ namespace mb::util
 static bool initialized = false;
 static std::mutex initialized_lock;
 
+static perf::Counter g_lookups("util.properties.lookups");
+
 static void initialize_properties()
 {
     std::lock_guard<std::mutex> lock(initialized_lock);
@@ -106,6 +111,7 @@ static PropertyIterAction read_property_cb(const prop_info *pi,
 std::optional<std::string> property_get(const std::string &key)
 {
     initialize_properties();
+    g_lookups.add();
 
     const prop_info *pi = __system_property_find(key.c_str());
     if (!pi) {
@@ -123,6 +129,50 @@ std::optional<std::string> property_get(const std::string &key)
     return std::move(result);
 }
 
+/*!
+ * \brief Get the values of several properties
+ *
+ * This is equivalent to calling property_get() for each key, but all of the
+ * lookups are done with a single __system_property_find_batch() call.
+ *
+ * \param keys Property names
+ *
+ * \return Values in the same order as \p keys. Properties that do not exist
+ *         are `std::nullopt`.
+ */
+std::vector<std::optional<std::string>>
+property_get_multiple(const std::vector<std::string> &keys)
+{
+    initialize_properties();
+    g_lookups.add(keys.size());
+
+    std::vector<const char *> names;
+    std::vector<const prop_info *> infos(keys.size());
+    std::vector<std::optional<std::string>> result(keys.size());
+
+    names.reserve(keys.size());
+    for (auto const &key : keys) {
+        names.push_back(key.c_str());
+    }
+
+    __system_property_find_batch(names.data(), names.size(), infos.data());
+
+    for (size_t i = 0; i < infos.size(); ++i) {
+        if (!infos[i]) {
+            continue;
+        }
+
+        read_property_cb(infos[i], [&](std::string_view key,
+                                       std::string_view value) {
+            (void) key;
+            result[i] = value;
+            return PropertyIterAction::Stop;
+        });
+    }
+
+    return result;
+}
+
 std::string property_get_string(const std::string &key,
                                 const std::string &default_value)
 {
@@ -199,41 +249,158 @@ bool property_iter(const std::function<PropertyIterCb> &fn)
 
 std::optional<PropertiesMap> property_get_all()
 {
-    PropertiesMap result;
+    static std::mutex snapshot_lock;
+    static PropertySnapshot snapshot;
 
-    if (property_iter([&](std::string_view key, std::string_view value) {
-        result.insert_or_assign(std::string{key}, std::string{value});
-        return PropertyIterAction::Continue;
-    })) {
-        return std::move(result);
-    } else {
+    std::lock_guard<std::mutex> lock(snapshot_lock);
+
+    if (!snapshot.refresh()) {
         return std::nullopt;
     }
+
+    return snapshot.to_map();
 }
 
-// Properties file functions
+/*!
+ * \class PropertySnapshot
+ *
+ * \brief Copy of the system properties that can be cheaply refreshed.
+ *
+ * The first refresh() reads every property. Later calls do nothing if the
+ * property area's serial has not changed and otherwise only re-read the
+ * properties whose serials changed. Properties are never removed from the
+ * property area, so entries are never removed from the snapshot either.
+ */
 
-// Same as boost
-template <class T>
-inline void hash_combine(std::size_t &seed, const T &v)
+PropertySnapshot::PropertySnapshot()
+    : _area_serial(0)
+    , _loaded(false)
 {
-    seed ^= std::hash<T>()(v) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
 }
 
-struct PairHash
+/*!
+ * \brief Update the snapshot to match the current system properties
+ *
+ * \return Whether the property area could be read. If false is returned,
+ *         the snapshot may be partially updated.
+ */
+bool PropertySnapshot::refresh()
 {
-    template <typename T, typename U>
-    std::size_t operator()(const std::pair<T, U> &val) const
+    initialize_properties();
+
+    // Any property being added or updated bumps the area serial. It is read
+    // before the walk so that updates during the walk are caught next time.
+    uint32_t area_serial = __system_property_area_serial();
+    if (_loaded && area_serial != UINT32_MAX && area_serial == _area_serial) {
+        return true;
+    }
+
+    struct Ctx
     {
-        size_t seed = 0;
-        hash_combine(seed, val.first);
-        hash_combine(seed, val.second);
-        return seed;
+        PropertySnapshot *self;
+        const prop_info *pi;
+    };
+
+    bool ret = __system_property_foreach(
+            [](const prop_info *pi, void *cookie) {
+        auto *self = static_cast<PropertySnapshot *>(cookie);
+
+        auto it = self->_by_info.find(pi);
+        if (it != self->_by_info.end()
+                && self->_serials[it->second] == __system_property_serial(pi)) {
+            return;
+        }
+
+        Ctx ctx{self, pi};
+
+        __system_property_read_callback(
+                pi, [](void *cookie_, const char *name, const char *value,
+                       uint32_t serial) {
+            auto *ctx_ = static_cast<Ctx *>(cookie_);
+            auto *self_ = ctx_->self;
+
+            if (auto it_ = self_->_by_info.find(ctx_->pi);
+                    it_ != self_->_by_info.end()) {
+                self_->_entries[it_->second].value = value;
+                self_->_serials[it_->second] = serial;
+            } else {
+                size_t index = self_->_entries.size();
+
+                self_->_entries.push_back({name, value});
+                self_->_serials.push_back(serial);
+                self_->_by_info.emplace(ctx_->pi, index);
+                self_->_by_key.insert_or_assign(name, index);
+            }
+        }, &ctx);
+    }, this) == 0;
+
+    _area_serial = area_serial;
+    _loaded = ret;
+
+    return ret;
+}
+
+/*!
+ * \brief Get the value of a property in the snapshot
+ *
+ * \param key Property name
+ *
+ * \return Property value or std::nullopt if the property did not exist at the
+ *         last refresh. The value is invalidated by the next refresh().
+ */
+std::optional<std::string_view>
+PropertySnapshot::get(const std::string &key) const
+{
+    auto it = _by_key.find(key);
+    if (it == _by_key.end()) {
+        return std::nullopt;
     }
-};
 
-using DevInode = std::pair<dev_t, ino_t>;
-using DevInodeSet = std::unordered_set<DevInode, PairHash>;
+    return _entries[it->second].value;
+}
+
+/*!
+ * \brief Iterator to the first property in the snapshot
+ *
+ * Properties are in the order in which they were first seen.
+ */
+PropertySnapshot::const_iterator PropertySnapshot::begin() const
+{
+    return _entries.begin();
+}
+
+/*!
+ * \brief Iterator past the last property in the snapshot
+ */
+PropertySnapshot::const_iterator PropertySnapshot::end() const
+{
+    return _entries.end();
+}
+
+/*!
+ * \brief Number of properties in the snapshot
+ */
+size_t PropertySnapshot::size() const
+{
+    return _entries.size();
+}
+
+/*!
+ * \brief Copy the snapshot into a map
+ */
+PropertiesMap PropertySnapshot::to_map() const
+{
+    PropertiesMap result;
+    result.reserve(_entries.size());
+
+    for (auto const &entry : _entries) {
+        result.emplace(entry.key, entry.value);
+    }
+
+    return result;
+}
+
+// Properties file functions
 
 static std::string_view trim_whitespace(std::string_view sv)
 {
@@ -246,39 +413,230 @@ static std::string_view trim_whitespace(std::string_view sv)
     return sv;
 }
 
-static bool property_file_iter_impl(const std::string &path,
-                                    std::string_view filter,
-                                    const std::function<PropertyIterCb> &cb,
-                                    DevInodeSet &seen_files)
+static bool filter_matches(std::string_view filter, std::string_view key)
 {
-    ScopedFILE fp(fopen(path.c_str(), "re"), &fclose);
-    if (!fp) {
+    if (filter.empty()) {
+        return true;
+    } else if (filter.back() == '*') {
+        return starts_with(key, filter.substr(0, filter.size() - 1));
+    } else {
+        return key == filter;
+    }
+}
+
+// Most recently loaded file for the property_file_get*() functions. Callers
+// usually look up several keys from the same file in a row.
+static std::mutex cached_file_lock;
+static std::string cached_file_path;
+static PropertyFile cached_file;
+
+template<typename Fn>
+static auto with_cached_file(const std::string &path, Fn &&fn)
+        -> std::optional<decltype(fn(cached_file))>
+{
+    std::lock_guard<std::mutex> lock(cached_file_lock);
+
+    if (cached_file_path != path || !cached_file.is_current()) {
+        cached_file_path.clear();
+
+        if (!cached_file.load(path)) {
+            return std::nullopt;
+        }
+
+        cached_file_path = path;
+    }
+
+    return fn(cached_file);
+}
+
+std::optional<std::string> property_file_get(const std::string &path,
+                                             const std::string &key)
+{
+    auto value = with_cached_file(path, [&](const PropertyFile &file) {
+        return file.get(key);
+    });
+
+    if (value && *value) {
+        return std::string(**value);
+    }
+
+    return std::nullopt;
+}
+
+std::string property_file_get_string(const std::string &path,
+                                     const std::string &key,
+                                     const std::string &default_value)
+{
+    if (auto value = property_file_get(path, key); value && !value->empty()) {
+        return std::move(*value);
+    }
+
+    return default_value;
+}
+
+bool property_file_get_bool(const std::string &path, const std::string &key,
+                            bool default_value)
+{
+    if (auto value = property_file_get(path, key)) {
+        if (auto result = string_to_bool(*value)) {
+            return *result;
+        }
+    }
+
+    return default_value;
+}
+
+bool property_file_iter(const std::string &path, std::string_view filter,
+                        const std::function<PropertyIterCb> &fn)
+{
+    PropertyFile file;
+
+    if (!file.load(path, filter)) {
+        return false;
+    }
+
+    for (auto const &[key, value] : file) {
+        if (fn(key, value) == PropertyIterAction::Stop) {
+            break;
+        }
+    }
+
+    return true;
+}
+
+std::optional<PropertiesMap> property_file_get_all(const std::string &path)
+{
+    return with_cached_file(path, [](const PropertyFile &file) {
+        return file.to_map();
+    });
+}
+
+/*!
+ * \class PropertyFile
+ *
+ * \brief Parsed properties file.
+ *
+ * The file and any files it imports are mapped into memory and parsed once.
+ * The keys and values point into the mappings, so lookups do not copy any
+ * data. The mappings are private, so later changes to the files are not
+ * visible until the file is loaded again.
+ */
+
+PropertyFile::PropertyFile() = default;
+
+PropertyFile::~PropertyFile()
+{
+    clear();
+}
+
+PropertyFile::PropertyFile(PropertyFile &&other) noexcept
+    : _mappings(std::move(other._mappings))
+    , _entries(std::move(other._entries))
+    , _lookup(std::move(other._lookup))
+{
+    other._mappings.clear();
+    other._entries.clear();
+    other._lookup.clear();
+}
+
+PropertyFile & PropertyFile::operator=(PropertyFile &&rhs) noexcept
+{
+    if (this != &rhs) {
+        clear();
+
+        _mappings.swap(rhs._mappings);
+        _entries.swap(rhs._entries);
+        _lookup.swap(rhs._lookup);
+    }
+
+    return *this;
+}
+
+void PropertyFile::clear()
+{
+    for (auto const &m : _mappings) {
+        if (m.data) {
+            munmap(m.data, m.size);
+        }
+    }
+
+    _mappings.clear();
+    _entries.clear();
+    _lookup.clear();
+}
+
+/*!
+ * \brief Load and parse a properties file
+ *
+ * `import` lines are followed like in AOSP's init. Missing imported files are
+ * ignored and files that were already imported are skipped.
+ *
+ * \param path Path to properties file
+ * \param filter Only keep keys equal to \p filter or, if \p filter ends in
+ *               `*`, keys starting with the rest of \p filter. Imported files
+ *               use the filter from their `import` line instead.
+ *
+ * \return Whether the file was loaded. On failure, errno is set and the
+ *         object is left empty.
+ */
+bool PropertyFile::load(const std::string &path, std::string_view filter)
+{
+    clear();
+
+    if (!load_impl(path, filter)) {
+        int saved_errno = errno;
+        clear();
+        errno = saved_errno;
         return false;
     }
 
+    return true;
+}
+
+bool PropertyFile::load_impl(const std::string &path, std::string_view filter)
+{
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+
+    auto close_fd = finally([&] {
+        close(fd);
+    });
+
     struct stat sb;
-    if (fstat(fileno(fp.get()), &sb) < 0) {
+    if (fstat(fd, &sb) < 0) {
         return false;
     }
 
     // Ignore duplicate imports
-    DevInode di{sb.st_dev, sb.st_ino};
-    if (seen_files.find(di) != seen_files.end()) {
-        return true;
+    for (auto const &m : _mappings) {
+        if (m.dev == sb.st_dev && m.ino == sb.st_ino) {
+            return true;
+        }
     }
 
-    seen_files.emplace(di);
+    void *data = nullptr;
+    auto size = static_cast<size_t>(sb.st_size);
+
+    // Empty files cannot be mapped
+    if (size > 0) {
+        data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            return false;
+        }
+    }
 
-    char *line = nullptr;
-    size_t len = 0;
-    ssize_t read;
+    _mappings.push_back({path, data, size, sb.st_dev, sb.st_ino, sb.st_mtim,
+                         sb.st_size});
 
-    auto free_line = finally([&] {
-        free(line);
-    });
+    std::string_view contents(static_cast<const char *>(data), size);
 
-    while ((read = getline(&line, &len, fp.get())) >= 0) {
-        std::string_view sv(line, static_cast<size_t>(read));
+    while (!contents.empty()) {
+        auto newline = contents.find('\n');
+        auto sv = contents.substr(0, newline);
+        contents.remove_prefix(newline == std::string_view::npos
+                ? contents.size() : newline + 1);
 
         sv = trim_whitespace(sv);
 
@@ -298,8 +656,7 @@ static bool property_file_iter_impl(const std::string &path,
                 sv = sv.substr(0, space);
             }
 
-            if (!property_file_iter_impl(std::string(sv), new_filter, cb,
-                                         seen_files) && errno != ENOENT) {
+            if (!load_impl(std::string(sv), new_filter) && errno != ENOENT) {
                 // Missing files are OK
                 // (follows the AOSP implementation behavior)
                 return false;
@@ -313,59 +670,91 @@ static bool property_file_iter_impl(const std::string &path,
             auto key = trim_whitespace(sv.substr(0, equals));
             auto value = trim_whitespace(sv.substr(equals + 1));
 
-            if (!filter.empty()) {
-                if (filter.back() == '*') {
-                    if (!starts_with(key, filter.substr(0, filter.size() - 1))) {
-                        continue;
-                    }
-                } else {
-                    if (key != filter) {
-                        continue;
-                    }
-                }
+            if (!filter_matches(filter, key)) {
+                continue;
             }
 
-            if (cb(key, value) == PropertyIterAction::Stop) {
-                return true;
-            }
+            _lookup.emplace(key, _entries.size());
+            _entries.emplace_back(key, value);
         }
     }
 
-    return !ferror(fp.get());
+    return true;
 }
 
-std::optional<std::string> property_file_get(const std::string &path,
-                                             const std::string &key)
+/*!
+ * \brief Check whether the loaded files have not changed since loading
+ *
+ * \return False if any of the loaded files were modified, replaced or
+ *         removed, or if nothing is loaded. Files that did not exist when
+ *         the file was loaded are not checked.
+ */
+bool PropertyFile::is_current() const
 {
-    std::optional<std::string> value;
+    if (_mappings.empty()) {
+        return false;
+    }
 
-    property_file_iter(
-            path, {}, [&](std::string_view key_, std::string_view value_) {
-        if (key == key_) {
-            value = value_;
-            return PropertyIterAction::Stop;
+    for (auto const &m : _mappings) {
+        struct stat sb;
+
+        if (stat(m.path.c_str(), &sb) < 0
+                || sb.st_dev != m.dev
+                || sb.st_ino != m.ino
+                || sb.st_size != m.file_size
+                || sb.st_mtim.tv_sec != m.mtime.tv_sec
+                || sb.st_mtim.tv_nsec != m.mtime.tv_nsec) {
+            return false;
         }
-        return PropertyIterAction::Continue;
-    });
+    }
 
-    return value;
+    return true;
 }
 
-std::string property_file_get_string(const std::string &path,
-                                     const std::string &key,
-                                     const std::string &default_value)
+/*!
+ * \brief Get the value of a property
+ *
+ * \param key Property name
+ *
+ * \return Value of the first occurrence of \p key or std::nullopt if \p key
+ *         does not exist. The value is valid until the object is destroyed
+ *         or loaded again.
+ */
+std::optional<std::string_view> PropertyFile::get(std::string_view key) const
 {
-    if (auto value = property_file_get(path, key); value && !value->empty()) {
-        return std::move(*value);
+    auto it = _lookup.find(key);
+    if (it == _lookup.end()) {
+        return std::nullopt;
+    }
+
+    return _entries[it->second].second;
+}
+
+/*!
+ * \brief Get the value of a property as a string
+ *
+ * \return Value of \p key or \p default_value if \p key does not exist or
+ *         is empty
+ */
+std::string PropertyFile::get_string(std::string_view key,
+                                     const std::string &default_value) const
+{
+    if (auto value = get(key); value && !value->empty()) {
+        return std::string(*value);
     }
 
     return default_value;
 }
 
-bool property_file_get_bool(const std::string &path, const std::string &key,
-                            bool default_value)
+/*!
+ * \brief Get the value of a property as a boolean
+ *
+ * \return Value of \p key or \p default_value if \p key does not exist or
+ *         is not a boolean
+ */
+bool PropertyFile::get_bool(std::string_view key, bool default_value) const
 {
-    if (auto value = property_file_get(path, key)) {
+    if (auto value = get(key)) {
         if (auto result = string_to_bool(*value)) {
             return *result;
         }
@@ -374,26 +763,45 @@ bool property_file_get_bool(const std::string &path, const std::string &key,
     return default_value;
 }
 
-bool property_file_iter(const std::string &path, std::string_view filter,
-                        const std::function<PropertyIterCb> &fn)
+/*!
+ * \brief Iterator to the first entry in file order
+ */
+PropertyFile::const_iterator PropertyFile::begin() const
 {
-    DevInodeSet seen_files;
-    return property_file_iter_impl(path, filter, fn, seen_files);
+    return _entries.begin();
 }
 
-std::optional<PropertiesMap> property_file_get_all(const std::string &path)
+/*!
+ * \brief Iterator past the last entry
+ */
+PropertyFile::const_iterator PropertyFile::end() const
+{
+    return _entries.end();
+}
+
+/*!
+ * \brief Number of entries, including duplicate keys
+ */
+size_t PropertyFile::size() const
+{
+    return _entries.size();
+}
+
+/*!
+ * \brief Copy the entries into a map
+ *
+ * If a key occurs multiple times, the last value is used.
+ */
+PropertiesMap PropertyFile::to_map() const
 {
     PropertiesMap result;
+    result.reserve(_lookup.size());
 
-    if (property_file_iter(path, {},
-            [&](std::string_view key, std::string_view value) {
-        result.insert_or_assign(std::string{key}, std::string{value});
-        return PropertyIterAction::Continue;
-    })) {
-        return std::move(result);
-    } else {
-        return std::nullopt;
+    for (auto const &[key, value] : _entries) {
+        result.insert_or_assign(std::string(key), std::string(value));
     }
+
+    return result;
 }
 
 bool property_file_write_all(const std::string &path, const PropertiesMap &map)
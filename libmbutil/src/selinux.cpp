@@ -19,12 +19,18 @@
 
 #include "mbutil/selinux.h"
 
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <memory>
+#include <mutex>
+#include <optional>
 #include <thread>
 
 #include <cerrno>
 #include <cstring>
 
+#include <dirent.h>
 #include <fcntl.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
@@ -34,15 +40,17 @@
 
 #include <sepol/sepol.h>
 
+#include "mbcommon/common.h"
 #include "mbcommon/error_code.h"
 #include "mbcommon/finally.h"
 #include "mbcommon/string.h"
+#include "mbcommon/thread_pool.h"
 #include "mblog/logging.h"
-#include "mbutil/fts.h"
 
 #define LOG_TAG "mbutil/selinux"
 
 static constexpr char SELINUX_XATTR[] = "security.selinux";
+static constexpr char RELABEL_MARKER_XATTR[] = "security.mb_relabel_last";
 
 static constexpr int OPEN_ATTEMPTS = 5;
 
@@ -50,58 +58,331 @@ static constexpr int OPEN_ATTEMPTS = 5;
 namespace mb::util
 {
 
-class RecursiveSetContext : public FtsWrapper
+namespace
+{
+
+// Directory being relabeled. The fd is kept open for as long as any of its
+// subdirectories still need it for openat().
+struct RelabelDir
+{
+    std::shared_ptr<RelabelDir> parent;
+    // Name relative to the parent's fd (or the full path for the root)
+    std::string name;
+    std::string path;
+    int fd = -1;
+
+    ~RelabelDir()
+    {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+};
+
+class RecursiveRelabeler
 {
 public:
-    RecursiveSetContext(std::string path, std::string context,
-                        bool follow_symlinks)
-        : FtsWrapper(path, FtsFlag::GroupSpecialFiles)
-        , _context(std::move(context))
-        , _follow_symlinks(follow_symlinks)
-        , _result(oc::success())
+    RecursiveRelabeler(std::string context, SELinuxRelabelFlags flags)
+        : _context(std::move(context))
+        , _flags(flags)
+        , _queued(0)
+        , _failed(false)
     {
+        // Non-directories are labeled through their parent's fd if /proc is
+        // available, which avoids resolving the full path for every entry
+        _use_proc_fd = access("/proc/self/fd", X_OK) == 0;
+
+        _marker = _context;
+        if (_flags & SELinuxRelabelFlag::FollowSymlinks) {
+            _marker += ":follow";
+        }
+
+        if (_flags & SELinuxRelabelFlag::Parallel) {
+            _group.emplace();
+        }
     }
 
-    Actions on_reached_directory_post() override
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(RecursiveRelabeler)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(RecursiveRelabeler)
+
+    oc::result<void> run(const std::string &path)
     {
-        return set_context() ? Action::Ok : Action::Fail;
+        struct stat sb;
+        if (lstat(path.c_str(), &sb) < 0) {
+            return ec_from_errno();
+        }
+
+        if (!S_ISDIR(sb.st_mode)) {
+            if (!relabel_path(path, S_ISLNK(sb.st_mode))) {
+                return *_error;
+            }
+            return oc::success();
+        }
+
+        auto root = std::make_shared<RelabelDir>();
+        root->name = path;
+        root->path = path;
+
+        process(root);
+
+        if (_group) {
+            _group->wait();
+        }
+
+        if (_error) {
+            return *_error;
+        }
+
+        // A failure to set the marker only means the next relabel will not
+        // be able to skip the tree
+        if ((_flags & SELinuxRelabelFlag::SkipMarked) && root->fd >= 0
+                && !_skipped_root
+                && fsetxattr(root->fd, RELABEL_MARKER_XATTR, _marker.c_str(),
+                             _marker.size() + 1, 0) < 0) {
+            LOGW("%s: Failed to set relabel marker: %s",
+                 path.c_str(), strerror(errno));
+        }
+
+        return oc::success();
     }
 
-    Actions on_reached_file() override
+private:
+    // Queued directories keep their parents' fds open, so bound the number of
+    // tasks that have not started yet
+    static constexpr size_t MAX_QUEUED = 256;
+
+    // Hand a subdirectory to the global thread pool. Returns false if it
+    // should be processed by the calling thread instead.
+    bool submit(std::shared_ptr<RelabelDir> &dir)
     {
-        return set_context() ? Action::Ok : Action::Fail;
+        if (!_group) {
+            return false;
+        }
+
+        if (_queued.fetch_add(1, std::memory_order_relaxed) >= MAX_QUEUED) {
+            _queued.fetch_sub(1, std::memory_order_relaxed);
+            return false;
+        }
+
+        _group->run([this, dir = std::move(dir)] {
+            _queued.fetch_sub(1, std::memory_order_relaxed);
+            process(dir);
+        });
+
+        return true;
     }
 
-    Actions on_reached_symlink() override
+    bool fail(const std::string &path, std::error_code ec)
     {
-        return set_context() ? Action::Ok : Action::Fail;
+        LOGE("%s: Failed to set context to %s: %s",
+             path.c_str(), _context.c_str(), ec.message().c_str());
+
+        std::lock_guard lock(_mutex);
+
+        if (!_error) {
+            _error = ec;
+        }
+        _failed = true;
+
+        // Skip the directories that have not been started yet
+        if (_group) {
+            _group->cancel();
+        }
+
+        return false;
     }
 
-    Actions on_reached_special_file() override
+    // Check whether an xattr value read into buf is the same as value,
+    // ignoring the trailing NULL terminator
+    static bool xattr_matches(const char *buf, ssize_t n,
+                              const std::string &value)
     {
-        return set_context() ? Action::Ok : Action::Fail;
+        if (n <= 0) {
+            return false;
+        }
+
+        auto size = static_cast<size_t>(n);
+        if (buf[size - 1] == '\0') {
+            --size;
+        }
+
+        return value.compare(0, std::string::npos, buf, size) == 0;
     }
 
-    oc::result<void> result()
+    bool relabel_fd(int fd, const std::string &path)
     {
-        return _result;
+        char buf[256];
+
+        ssize_t n = fgetxattr(fd, SELINUX_XATTR, buf, sizeof(buf));
+        if (xattr_matches(buf, n, _context)) {
+            return true;
+        }
+
+        if (fsetxattr(fd, SELINUX_XATTR, _context.c_str(),
+                      _context.size() + 1, 0) < 0) {
+            return fail(path, ec_from_errno());
+        }
+
+        return true;
     }
 
-private:
-    std::string _context;
-    bool _follow_symlinks;
-    oc::result<void> _result;
+    bool relabel_path(const std::string &path, bool is_symlink,
+                      const char *access_path = nullptr)
+    {
+        char buf[256];
+        bool follow = is_symlink
+                && (_flags & SELinuxRelabelFlag::FollowSymlinks);
 
-    oc::result<void> set_context()
+        if (!access_path) {
+            access_path = path.c_str();
+        }
+
+        ssize_t n = follow
+                ? getxattr(access_path, SELINUX_XATTR, buf, sizeof(buf))
+                : lgetxattr(access_path, SELINUX_XATTR, buf, sizeof(buf));
+        if (xattr_matches(buf, n, _context)) {
+            return true;
+        }
+
+        int ret = follow
+                ? setxattr(access_path, SELINUX_XATTR, _context.c_str(),
+                           _context.size() + 1, 0)
+                : lsetxattr(access_path, SELINUX_XATTR, _context.c_str(),
+                            _context.size() + 1, 0);
+        if (ret < 0) {
+            return fail(path, ec_from_errno());
+        }
+
+        return true;
+    }
+
+    bool relabel_entry(const RelabelDir &dir, const char *name,
+                       bool is_symlink)
     {
-        if (_follow_symlinks) {
-            return _result = selinux_set_context(_curr->fts_accpath, _context);
+        std::string path = dir.path;
+        path += '/';
+        path += name;
+
+        if (_use_proc_fd) {
+            auto proc_path = format("/proc/self/fd/%d/%s", dir.fd, name);
+            return relabel_path(path, is_symlink, proc_path.c_str());
         } else {
-            return _result = selinux_lset_context(_curr->fts_accpath, _context);
+            return relabel_path(path, is_symlink);
+        }
+    }
+
+    // Relabel a directory and its non-directory entries and queue its
+    // subdirectories
+    void process(const std::shared_ptr<RelabelDir> &dir)
+    {
+        int parent_fd = dir->parent ? dir->parent->fd : AT_FDCWD;
+
+        dir->fd = openat(parent_fd, dir->name.c_str(),
+                         O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (dir->fd < 0) {
+            fail(dir->path, ec_from_errno());
+            return;
+        }
+
+        if (_flags & SELinuxRelabelFlag::SkipMarked) {
+            char buf[256];
+
+            ssize_t n = fgetxattr(dir->fd, RELABEL_MARKER_XATTR,
+                                  buf, sizeof(buf));
+            if (xattr_matches(buf, n, _marker)) {
+                if (!dir->parent) {
+                    _skipped_root = true;
+                }
+                return;
+            }
+        }
+
+        if (!relabel_fd(dir->fd, dir->path)) {
+            return;
+        }
+
+        // fdopendir() takes ownership of the fd, but the subdirectories still
+        // need one
+        int dir_fd = fcntl(dir->fd, F_DUPFD_CLOEXEC, 0);
+        if (dir_fd < 0) {
+            fail(dir->path, ec_from_errno());
+            return;
+        }
+
+        DIR *dp = fdopendir(dir_fd);
+        if (!dp) {
+            fail(dir->path, ec_from_errno());
+            close(dir_fd);
+            return;
+        }
+
+        auto close_dp = finally([&] {
+            closedir(dp);
+        });
+
+        while (!_failed) {
+            errno = 0;
+            auto *ent = readdir(dp);
+            if (!ent) {
+                if (errno != 0) {
+                    fail(dir->path, ec_from_errno());
+                }
+                break;
+            }
+
+            if (strcmp(ent->d_name, ".") == 0
+                    || strcmp(ent->d_name, "..") == 0) {
+                continue;
+            }
+
+            auto d_type = ent->d_type;
+
+            if (d_type == DT_UNKNOWN) {
+                struct stat sb;
+                if (fstatat(dir->fd, ent->d_name, &sb,
+                            AT_SYMLINK_NOFOLLOW) < 0) {
+                    fail(dir->path + "/" + ent->d_name, ec_from_errno());
+                    break;
+                }
+                d_type = S_ISDIR(sb.st_mode) ? DT_DIR
+                        : S_ISLNK(sb.st_mode) ? DT_LNK : DT_REG;
+            }
+
+            if (d_type != DT_DIR) {
+                relabel_entry(*dir, ent->d_name, d_type == DT_LNK);
+                continue;
+            }
+
+            auto child = std::make_shared<RelabelDir>();
+            child->parent = dir;
+            child->name = ent->d_name;
+            child->path = dir->path + "/" + ent->d_name;
+
+            if (!submit(child)) {
+                process(child);
+            }
         }
     }
+
+    std::string _context;
+    SELinuxRelabelFlags _flags;
+    // Value of RELABEL_MARKER_XATTR for this context and these flags
+    std::string _marker;
+    bool _use_proc_fd;
+    bool _skipped_root = false;
+    // Number of submitted directories that have not started yet
+    std::atomic_size_t _queued;
+    std::atomic_bool _failed;
+    // Guards _error
+    std::mutex _mutex;
+    std::optional<std::error_code> _error;
+    // Tasks on ThreadPool::global() if relabeling in parallel. Declared last
+    // so that it is destroyed (and waited for) first.
+    std::optional<TaskGroup> _group;
 };
 
+}
+
 bool selinux_read_policy(const std::string &path, policydb_t *pdb)
 {
     using namespace std::chrono_literals;
@@ -161,31 +442,68 @@ bool selinux_read_policy(const std::string &path, policydb_t *pdb)
 // /sys/fs/selinux/load requires the entire policy to be written in a single
 // write(2) call.
 // See: http://marc.info/?l=selinux&m=141882521027239&w=2
-bool selinux_write_policy(const std::string &path, policydb_t *pdb)
+/*!
+ * \brief Serialize a policydb to the binary policy format
+ *
+ * The policy is serialized directly into \p image. Unlike policydb_to_image(),
+ * this does not go through a temporary buffer and does not parse the result
+ * again to validate it. The kernel validates the policy when it is loaded.
+ *
+ * \param[in] pdb Policy to serialize
+ * \param[out] image Output buffer
+ *
+ * \return Whether the policy was successfully serialized
+ */
+bool selinux_policy_to_image(policydb_t *pdb, std::string &image)
 {
-    using namespace std::chrono_literals;
+    struct policy_file pf;
 
-    void *data;
-    size_t len;
-    sepol_handle_t *handle;
-    int fd;
+    policy_file_init(&pf);
 
     // Don't print warnings to stderr
-    handle = sepol_handle_create();
-    sepol_msg_set_callback(handle, nullptr, nullptr);
+    pf.handle = sepol_handle_create();
+    sepol_msg_set_callback(pf.handle, nullptr, nullptr);
 
     auto destroy_handle = finally([&] {
-        sepol_handle_destroy(handle);
+        sepol_handle_destroy(pf.handle);
     });
 
-    if (policydb_to_image(handle, pdb, &data, &len) < 0) {
+    // Compute the size of the image first
+    pf.type = PF_LEN;
+
+    if (policydb_write(pdb, &pf) != 0) {
+        LOGE("Failed to compute size of policydb");
+        return false;
+    }
+
+    image.resize(pf.len);
+
+    pf.type = PF_USE_MEMORY;
+    pf.data = image.data();
+    pf.len = image.size();
+
+    if (policydb_write(pdb, &pf) != 0) {
         LOGE("Failed to write policydb to memory");
         return false;
     }
 
-    auto free_data = finally([&] {
-        free(data);
-    });
+    return true;
+}
+
+/*!
+ * \brief Write a binary policy to a file (eg. /sys/fs/selinux/load)
+ *
+ * \param path Output path
+ * \param image Binary policy
+ *
+ * \return Whether the policy was successfully written
+ */
+bool selinux_write_policy_image(const std::string &path,
+                                std::string_view image)
+{
+    using namespace std::chrono_literals;
+
+    int fd;
 
     for (int i = 0; i < OPEN_ATTEMPTS; ++i) {
         fd = open(path.c_str(), O_CREAT | O_TRUNC | O_RDWR | O_CLOEXEC, 0644);
@@ -206,7 +524,7 @@ bool selinux_write_policy(const std::string &path, policydb_t *pdb)
         close(fd);
     });
 
-    if (write(fd, data, len) < 0) {
+    if (write(fd, image.data(), image.size()) < 0) {
         LOGE("%s: Failed to write sepolicy: %s", path.c_str(), strerror(errno));
         return false;
     }
@@ -214,6 +532,14 @@ bool selinux_write_policy(const std::string &path, policydb_t *pdb)
     return true;
 }
 
+bool selinux_write_policy(const std::string &path, policydb_t *pdb)
+{
+    std::string image;
+
+    return selinux_policy_to_image(pdb, image)
+            && selinux_write_policy_image(path, image);
+}
+
 oc::result<std::string> selinux_get_context(const std::string &path)
 {
     std::string value;
@@ -318,36 +644,44 @@ oc::result<void> selinux_fset_context(int fd, const std::string &context)
     return oc::success();
 }
 
-oc::result<void> selinux_set_context_recursive(const std::string &path,
-                                   const std::string &context)
+/*!
+ * \brief Recursively set the SELinux context of a path
+ *
+ * Directories are traversed without following symlinks. Directories are
+ * labeled through their fds and other entries through their parent
+ * directory's fd. Entries that already have the context are not written to.
+ *
+ * With SELinuxRelabelFlag::SkipMarked, the root is marked with the
+ * `security.mb_relabel_last` xattr after a successful relabel and any
+ * directory carrying a marker for the same context and flags is skipped along
+ * with everything beneath it. Like `security.restorecon_last`, this assumes
+ * that nothing in a marked tree is relabeled by anyone else.
+ *
+ * \param path Path to relabel
+ * \param context SELinux context
+ * \param flags Relabel flags
+ *
+ * \return Nothing on success or the first error that occurred
+ */
+oc::result<void> selinux_relabel_recursive(const std::string &path,
+                                           const std::string &context,
+                                           SELinuxRelabelFlags flags)
 {
-    RecursiveSetContext rsc(path, context, true);
-    if (!rsc.run()) {
-        auto ret = rsc.result();
-        if (ret) {
-            return ec_from_errno();
-        } else {
-            return ret.as_failure();
-        }
-    }
+    RecursiveRelabeler relabeler(context, flags);
+    return relabeler.run(path);
+}
 
-    return rsc.result();
+oc::result<void> selinux_set_context_recursive(const std::string &path,
+                                               const std::string &context)
+{
+    return selinux_relabel_recursive(path, context,
+                                     SELinuxRelabelFlag::FollowSymlinks);
 }
 
 oc::result<void> selinux_lset_context_recursive(const std::string &path,
                                                 const std::string &context)
 {
-    RecursiveSetContext rsc(path, context, false);
-    if (!rsc.run()) {
-        auto ret = rsc.result();
-        if (ret) {
-            return ec_from_errno();
-        } else {
-            return ret.as_failure();
-        }
-    }
-
-    return rsc.result();
+    return selinux_relabel_recursive(path, context, {});
 }
 
 oc::result<bool> selinux_get_enforcing()
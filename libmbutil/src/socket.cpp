@@ -19,19 +19,81 @@
 
 #include "mbutil/socket.h"
 
+#include <algorithm>
+
 #include <cerrno>
 #include <climits>
 #include <cstdlib>
 #include <cstring>
 
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 #include "mbcommon/error_code.h"
 
+// Default capacity of SocketWriter's buffer and size of SocketReader's buffer
+static constexpr size_t SOCKET_BUF_SIZE = 8192;
+
 namespace mb::util
 {
 
+// Send all of the buffers with as few sendmsg() calls as possible. The iovec
+// array is modified to track partial sends.
+static oc::result<void> send_iov(int fd, struct iovec *iov, size_t count)
+{
+    while (count > 0) {
+        struct msghdr msg = {};
+        msg.msg_iov = iov;
+        msg.msg_iovlen = static_cast<decltype(msg.msg_iovlen)>(count);
+
+        // Report EPIPE instead of raising SIGPIPE if the peer has gone away
+        auto n = sendmsg(fd, &msg, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            } else {
+                return ec_from_errno();
+            }
+        } else if (n == 0) {
+            return std::errc::io_error;
+        }
+
+        auto remain = static_cast<size_t>(n);
+
+        while (count > 0 && remain >= iov->iov_len) {
+            remain -= iov->iov_len;
+            ++iov;
+            --count;
+        }
+
+        if (count > 0) {
+            iov->iov_base = static_cast<char *>(iov->iov_base) + remain;
+            iov->iov_len -= remain;
+        }
+    }
+
+    return oc::success();
+}
+
+// Send a length-prefixed buffer in a single message
+static oc::result<void> send_with_length(int fd, const void *data, size_t len)
+{
+    if (len > INT32_MAX) {
+        return std::errc::invalid_argument;
+    }
+
+    auto len32 = static_cast<int32_t>(len);
+
+    struct iovec iov[2];
+    iov[0].iov_base = &len32;
+    iov[0].iov_len = sizeof(len32);
+    iov[1].iov_base = const_cast<void *>(data);
+    iov[1].iov_len = len;
+
+    return send_iov(fd, iov, len > 0 ? 2 : 1);
+}
+
 oc::result<size_t> socket_read(int fd, void *buf, size_t size)
 {
     // read()'s behavior is undefined when size is greater than SSIZE_MAX
@@ -108,17 +170,7 @@ oc::result<std::vector<unsigned char>> socket_read_bytes(int fd)
 
 oc::result<void> socket_write_bytes(int fd, const void *data, size_t len)
 {
-    if (len > INT32_MAX) {
-        return std::errc::invalid_argument;
-    }
-
-    OUTCOME_TRYV(socket_write_int32(fd, static_cast<int32_t>(len)));
-    OUTCOME_TRY(n, socket_write(fd, data, len));
-    if (n != len) {
-        return std::errc::io_error;
-    }
-
-    return oc::success();
+    return send_with_length(fd, data, len);
 }
 
 template<typename T>
@@ -222,17 +274,7 @@ oc::result<std::string> socket_read_string(int fd)
 
 oc::result<void> socket_write_string(int fd, const std::string &str)
 {
-    if (str.size() > INT32_MAX) {
-        return std::errc::invalid_argument;
-    }
-
-    OUTCOME_TRYV(socket_write_int32(fd, static_cast<int32_t>(str.size())));
-    OUTCOME_TRY(n, socket_write(fd, str.data(), str.size()));
-    if (n != str.size()) {
-        return std::errc::io_error;
-    }
-
-    return oc::success();
+    return send_with_length(fd, str.data(), str.size());
 }
 
 oc::result<std::vector<std::string>> socket_read_string_array(int fd)
@@ -255,17 +297,9 @@ oc::result<std::vector<std::string>> socket_read_string_array(int fd)
 
 oc::result<void> socket_write_string_array(int fd, const std::vector<std::string> &list)
 {
-    if (list.size() > INT32_MAX) {
-        return std::errc::invalid_argument;
-    }
-
-    OUTCOME_TRYV(socket_write_int32(fd, static_cast<int32_t>(list.size())));
-
-    for (const std::string &str : list) {
-        OUTCOME_TRYV(socket_write_string(fd, str));
-    }
-
-    return oc::success();
+    SocketWriter writer;
+    OUTCOME_TRYV(writer.write_string_array(list));
+    return writer.flush(fd);
 }
 
 oc::result<void> socket_receive_fds(int fd, std::vector<int> &fds)
@@ -352,4 +386,350 @@ oc::result<void> socket_send_fds(int fd, const std::vector<int> &fds)
     return oc::success();
 }
 
+/*!
+ * \class SocketWriter
+ *
+ * \brief Serializes a message into a buffer so it can be sent at once.
+ *
+ * The wire format is the same as that of the socket_write_*() functions, but
+ * the entire message is sent with a single sendmsg() call instead of one
+ * write() per field. The buffer is kept between messages, so a writer can be
+ * reused to avoid reallocating it.
+ */
+
+SocketWriter::SocketWriter()
+{
+    _buf.reserve(SOCKET_BUF_SIZE);
+}
+
+/*!
+ * \brief Append raw data
+ */
+void SocketWriter::write(const void *data, size_t size)
+{
+    auto ptr = static_cast<const unsigned char *>(data);
+    _buf.insert(_buf.end(), ptr, ptr + size);
+}
+
+/*!
+ * \brief Append length-prefixed data
+ *
+ * \return Nothing on success or `std::errc::invalid_argument` if \p len does
+ *         not fit in the 32-bit length field
+ */
+oc::result<void> SocketWriter::write_bytes(const void *data, size_t len)
+{
+    if (len > INT32_MAX) {
+        return std::errc::invalid_argument;
+    }
+
+    write_int32(static_cast<int32_t>(len));
+    write(data, len);
+
+    return oc::success();
+}
+
+void SocketWriter::write_uint16(uint16_t n)
+{
+    write(&n, sizeof(n));
+}
+
+void SocketWriter::write_uint32(uint32_t n)
+{
+    write(&n, sizeof(n));
+}
+
+void SocketWriter::write_uint64(uint64_t n)
+{
+    write(&n, sizeof(n));
+}
+
+void SocketWriter::write_int16(int16_t n)
+{
+    write(&n, sizeof(n));
+}
+
+void SocketWriter::write_int32(int32_t n)
+{
+    write(&n, sizeof(n));
+}
+
+void SocketWriter::write_int64(int64_t n)
+{
+    write(&n, sizeof(n));
+}
+
+/*!
+ * \brief Append length-prefixed string
+ *
+ * \return Nothing on success or `std::errc::invalid_argument` if the string
+ *         is too long
+ */
+oc::result<void> SocketWriter::write_string(const std::string &str)
+{
+    return write_bytes(str.data(), str.size());
+}
+
+/*!
+ * \brief Append count-prefixed array of length-prefixed strings
+ *
+ * \return Nothing on success or `std::errc::invalid_argument` if the array
+ *         or any of its strings is too long. On failure, the buffer is left
+ *         unchanged.
+ */
+oc::result<void> SocketWriter::write_string_array(
+        const std::vector<std::string> &list)
+{
+    if (list.size() > INT32_MAX) {
+        return std::errc::invalid_argument;
+    }
+
+    size_t total = sizeof(int32_t);
+
+    for (const std::string &str : list) {
+        if (str.size() > INT32_MAX) {
+            return std::errc::invalid_argument;
+        }
+        total += sizeof(int32_t) + str.size();
+    }
+
+    _buf.reserve(_buf.size() + total);
+
+    write_int32(static_cast<int32_t>(list.size()));
+
+    for (const std::string &str : list) {
+        write_int32(static_cast<int32_t>(str.size()));
+        write(str.data(), str.size());
+    }
+
+    return oc::success();
+}
+
+/*!
+ * \brief Send the buffered message
+ *
+ * The buffer is cleared once the message is sent.
+ *
+ * \param fd Socket file descriptor
+ *
+ * \return Nothing on success or the error code on failure. On failure, an
+ *         unknown amount of the message may have been sent and the buffer is
+ *         left unchanged.
+ */
+oc::result<void> SocketWriter::flush(int fd)
+{
+    if (_buf.empty()) {
+        return oc::success();
+    }
+
+    struct iovec iov;
+    iov.iov_base = _buf.data();
+    iov.iov_len = _buf.size();
+
+    OUTCOME_TRYV(send_iov(fd, &iov, 1));
+
+    clear();
+
+    return oc::success();
+}
+
+/*!
+ * \brief Discard the buffered message
+ *
+ * The buffer's capacity is kept for the next message.
+ */
+void SocketWriter::clear()
+{
+    _buf.clear();
+}
+
+/*!
+ * \brief Pointer to the buffered message
+ */
+const unsigned char * SocketWriter::data() const
+{
+    return _buf.data();
+}
+
+/*!
+ * \brief Size of the buffered message
+ */
+size_t SocketWriter::size() const
+{
+    return _buf.size();
+}
+
+/*!
+ * \class SocketReader
+ *
+ * \brief Buffered reader for the socket_write_*() wire format.
+ *
+ * Small fields are served from a buffer that is filled with as much data as
+ * the socket has available, so reading a message usually takes a single
+ * read() call. Because the reader may consume data belonging to the next
+ * message, all reads from the socket must go through the same reader and the
+ * socket must not be polled for readability while data is buffered (see
+ * buffered()).
+ */
+
+SocketReader::SocketReader(int fd)
+    : _fd(fd)
+    , _buf(SOCKET_BUF_SIZE)
+    , _begin(0)
+    , _end(0)
+{
+}
+
+/*!
+ * \brief Read raw data
+ *
+ * This behaves like socket_read(). Reads that are larger than the buffer
+ * bypass it once the buffered data is used up.
+ *
+ * \return Number of bytes read, which is less than \p size only if the end
+ *         of the stream was reached, or the error code on failure
+ */
+oc::result<size_t> SocketReader::read(void *buf, size_t size)
+{
+    if (size > SSIZE_MAX) {
+        return std::errc::invalid_argument;
+    }
+
+    auto out = static_cast<unsigned char *>(buf);
+    size_t total = 0;
+
+    while (total < size) {
+        if (_begin == _end) {
+            if (size - total >= _buf.size()) {
+                OUTCOME_TRY(n, socket_read(_fd, out + total, size - total));
+                total += n;
+                break;
+            }
+
+            auto n = ::read(_fd, _buf.data(), _buf.size());
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                } else {
+                    return ec_from_errno();
+                }
+            } else if (n == 0) {
+                break;
+            }
+
+            _begin = 0;
+            _end = static_cast<size_t>(n);
+        }
+
+        auto n = std::min(size - total, _end - _begin);
+        memcpy(out + total, _buf.data() + _begin, n);
+        _begin += n;
+        total += n;
+    }
+
+    return total;
+}
+
+template<typename T>
+oc::result<T> SocketReader::read_value()
+{
+    T value;
+    OUTCOME_TRY(size, read(&value, sizeof(T)));
+    if (size != sizeof(T)) {
+        return std::errc::io_error;
+    }
+    return oc::success(value);
+}
+
+oc::result<std::vector<unsigned char>> SocketReader::read_bytes()
+{
+    OUTCOME_TRY(len, read_int32());
+    if (len < 0) {
+        return std::errc::bad_message;
+    }
+
+    std::vector<unsigned char> buf(static_cast<size_t>(len));
+
+    OUTCOME_TRY(n, read(buf.data(), buf.size()));
+    if (n != buf.size()) {
+        return std::errc::io_error;
+    }
+
+    return std::move(buf);
+}
+
+oc::result<uint16_t> SocketReader::read_uint16()
+{
+    return read_value<uint16_t>();
+}
+
+oc::result<uint32_t> SocketReader::read_uint32()
+{
+    return read_value<uint32_t>();
+}
+
+oc::result<uint64_t> SocketReader::read_uint64()
+{
+    return read_value<uint64_t>();
+}
+
+oc::result<int16_t> SocketReader::read_int16()
+{
+    return read_value<int16_t>();
+}
+
+oc::result<int32_t> SocketReader::read_int32()
+{
+    return read_value<int32_t>();
+}
+
+oc::result<int64_t> SocketReader::read_int64()
+{
+    return read_value<int64_t>();
+}
+
+oc::result<std::string> SocketReader::read_string()
+{
+    OUTCOME_TRY(len, read_int32());
+    if (len < 0) {
+        return std::errc::bad_message;
+    }
+
+    std::string buf;
+    buf.resize(static_cast<size_t>(len));
+
+    OUTCOME_TRY(n, read(buf.data(), buf.size()));
+    if (n != buf.size()) {
+        return std::errc::io_error;
+    }
+
+    return std::move(buf);
+}
+
+oc::result<std::vector<std::string>> SocketReader::read_string_array()
+{
+    OUTCOME_TRY(len, read_int32());
+    if (len < 0) {
+        return std::errc::bad_message;
+    }
+
+    std::vector<std::string> buf;
+    buf.reserve(static_cast<size_t>(len));
+
+    for (int32_t i = 0; i < len; ++i) {
+        OUTCOME_TRY(str, read_string());
+        buf.push_back(std::move(str));
+    }
+
+    return std::move(buf);
+}
+
+/*!
+ * \brief Number of bytes that have been received, but not yet consumed
+ */
+size_t SocketReader::buffered() const
+{
+    return _end - _begin;
+}
+
 }
@@ -0,0 +1,388 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "mbutil/tree_attrs_p.h"
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+#include <cerrno>
+#include <cstring>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "mbcommon/common.h"
+#include "mbcommon/error_code.h"
+#include "mbcommon/perf.h"
+#include "mbcommon/thread_pool.h"
+#include "mbutil/fts.h"
+
+
+namespace mb::util::detail
+{
+
+// Number of entries whose mode or owner was changed
+static perf::Counter g_changed("util.tree_attrs.changed");
+// Number of entries that already had the requested mode and owner
+static perf::Counter g_unchanged("util.tree_attrs.unchanged");
+
+namespace
+{
+
+// Directory whose entries are being changed. The directory itself is changed
+// once everything beneath it is done, like the post-order visit of the
+// FtsWrapper-based implementation, so that removing permissions from a
+// directory never prevents its contents from being reached.
+struct AttrDir
+{
+    std::shared_ptr<AttrDir> parent;
+    // Name relative to the parent's fd (or the full path for the root)
+    std::string name;
+    int fd = -1;
+    struct stat sb;
+    // Subdirectories not yet done, plus one for listing this directory
+    std::atomic<size_t> pending{1};
+
+    ~AttrDir()
+    {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+};
+
+class TreeAttrChanger
+{
+public:
+    explicit TreeAttrChanger(const TreeAttrs &attrs)
+        : _attrs(attrs)
+        , _queued(0)
+        , _failed(false)
+    {
+        if (_attrs.parallel) {
+            _group.emplace();
+        }
+    }
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(TreeAttrChanger)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(TreeAttrChanger)
+
+    oc::result<void> run(const std::string &path)
+    {
+        struct stat sb;
+        if (lstat(path.c_str(), &sb) < 0) {
+            return ec_from_errno();
+        }
+
+        if (!S_ISDIR(sb.st_mode)) {
+            if (!change_entry(AT_FDCWD, path.c_str(), sb)) {
+                return *_error;
+            }
+            return oc::success();
+        }
+
+        _root_dev = sb.st_dev;
+
+        auto root = std::make_shared<AttrDir>();
+        root->name = path;
+
+        process(std::move(root));
+
+        if (_group) {
+            _group->wait();
+        }
+
+        if (_error) {
+            return *_error;
+        }
+        return oc::success();
+    }
+
+private:
+    // Queued directories keep their parents' fds open, so bound the number of
+    // tasks that have not started yet
+    static constexpr size_t MAX_QUEUED = 256;
+
+    // Hand a subdirectory to the global thread pool. Returns false if it
+    // should be processed by the calling thread instead.
+    bool submit(std::shared_ptr<AttrDir> &dir)
+    {
+        if (!_group) {
+            return false;
+        }
+
+        if (_queued.fetch_add(1, std::memory_order_relaxed) >= MAX_QUEUED) {
+            _queued.fetch_sub(1, std::memory_order_relaxed);
+            return false;
+        }
+
+        _group->run([this, dir = std::move(dir)]() mutable {
+            _queued.fetch_sub(1, std::memory_order_relaxed);
+            process(std::move(dir));
+        });
+
+        return true;
+    }
+
+    bool fail(std::error_code ec)
+    {
+        std::lock_guard lock(_mutex);
+
+        if (!_error) {
+            _error = ec;
+        }
+        _failed = true;
+
+        // Skip the directories that have not been started yet
+        if (_group) {
+            _group->cancel();
+        }
+
+        return false;
+    }
+
+    bool needs_chown(const struct stat &sb) const
+    {
+        return (_attrs.uid && sb.st_uid != *_attrs.uid)
+                || (_attrs.gid && sb.st_gid != *_attrs.gid);
+    }
+
+    bool needs_chmod(const struct stat &sb) const
+    {
+        return _attrs.mode && (sb.st_mode & 07777) != (*_attrs.mode & 07777);
+    }
+
+    uid_t chown_uid() const
+    {
+        return _attrs.uid ? *_attrs.uid : static_cast<uid_t>(-1);
+    }
+
+    gid_t chown_gid() const
+    {
+        return _attrs.gid ? *_attrs.gid : static_cast<gid_t>(-1);
+    }
+
+    // Change a non-directory entry relative to its parent directory's fd. The
+    // owner is changed first since chown() may clear the setuid/setgid bits.
+    bool change_entry(int dir_fd, const char *name, const struct stat &sb)
+    {
+        if (S_ISLNK(sb.st_mode)) {
+            if (!_attrs.uid && !_attrs.gid) {
+                // Symlink permissions cannot be changed
+                return true;
+            }
+
+            struct stat target_sb;
+            int flags = AT_SYMLINK_NOFOLLOW;
+
+            if (_attrs.follow_symlinks) {
+                flags = 0;
+
+                // Dangling symlinks are left to fchownat() to report
+                if (fstatat(dir_fd, name, &target_sb, 0) == 0
+                        && !needs_chown(target_sb)) {
+                    g_unchanged.add();
+                    return true;
+                }
+            } else if (!needs_chown(sb)) {
+                g_unchanged.add();
+                return true;
+            }
+
+            if (fchownat(dir_fd, name, chown_uid(), chown_gid(), flags) < 0) {
+                return fail(ec_from_errno());
+            }
+
+            g_changed.add();
+            return true;
+        }
+
+        bool do_chown = needs_chown(sb);
+        bool do_chmod = needs_chmod(sb);
+
+        if (!do_chown && !do_chmod) {
+            g_unchanged.add();
+            return true;
+        }
+
+        if (do_chown && fchownat(dir_fd, name, chown_uid(), chown_gid(),
+                                 AT_SYMLINK_NOFOLLOW) < 0) {
+            return fail(ec_from_errno());
+        }
+        if (do_chmod && fchmodat(dir_fd, name, *_attrs.mode, 0) < 0) {
+            return fail(ec_from_errno());
+        }
+
+        g_changed.add();
+        return true;
+    }
+
+    bool change_dir(const AttrDir &dir)
+    {
+        bool do_chown = needs_chown(dir.sb);
+        bool do_chmod = needs_chmod(dir.sb);
+
+        if (!do_chown && !do_chmod) {
+            g_unchanged.add();
+            return true;
+        }
+
+        if (do_chown && fchown(dir.fd, chown_uid(), chown_gid()) < 0) {
+            return fail(ec_from_errno());
+        }
+        if (do_chmod && fchmod(dir.fd, *_attrs.mode) < 0) {
+            return fail(ec_from_errno());
+        }
+
+        g_changed.add();
+        return true;
+    }
+
+    // Change the non-directory entries of a directory and queue its
+    // subdirectories. Entries are stat()'ed relative to the directory's fd and
+    // only written to if they differ from the requested attributes.
+    void process(std::shared_ptr<AttrDir> dir)
+    {
+        // Reused for every directory processed by this thread
+        thread_local std::vector<char> dents_buf;
+        std::vector<char> entries;
+
+        int parent_fd = dir->parent ? dir->parent->fd : AT_FDCWD;
+
+        dir->fd = openat(parent_fd, dir->name.c_str(),
+                         O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (dir->fd < 0 || fstat(dir->fd, &dir->sb) < 0) {
+            fail(ec_from_errno());
+            return;
+        }
+
+        // Like FtsWrapper, don't descend across mountpoint boundaries, but
+        // still change the mountpoint itself
+        if (dir->sb.st_dev == _root_dev) {
+            if (!read_dir_entries(dir->fd, dents_buf, entries)) {
+                fail(ec_from_errno());
+                return;
+            }
+        }
+
+        const char *ptr = entries.data();
+        const char *end = ptr + entries.size();
+
+        while (ptr < end && !_failed) {
+            auto d_type = static_cast<unsigned char>(*ptr);
+            const char *name = ptr + 1;
+            ptr = name + strlen(name) + 1;
+
+            struct stat sb;
+
+            // Subdirectories are stat()'ed through their own fd
+            if (d_type != DT_DIR) {
+                if (fstatat(dir->fd, name, &sb, AT_SYMLINK_NOFOLLOW) < 0) {
+                    if (errno == ENOENT) {
+                        continue;
+                    }
+                    fail(ec_from_errno());
+                    return;
+                }
+
+                if (!S_ISDIR(sb.st_mode)) {
+                    if (!change_entry(dir->fd, name, sb)) {
+                        return;
+                    }
+                    continue;
+                }
+            }
+
+            auto child = std::make_shared<AttrDir>();
+            child->parent = dir;
+            child->name = name;
+
+            ++dir->pending;
+
+            if (!submit(child)) {
+                process(std::move(child));
+            }
+        }
+
+        if (!_failed) {
+            release(std::move(dir));
+        }
+    }
+
+    // Drop one reference to a directory's pending work and change the
+    // directory once nothing beneath it remains
+    void release(std::shared_ptr<AttrDir> dir)
+    {
+        while (dir && --dir->pending == 0) {
+            if (_failed || !change_dir(*dir)) {
+                return;
+            }
+
+            close(dir->fd);
+            dir->fd = -1;
+
+            dir = dir->parent;
+        }
+    }
+
+    const TreeAttrs &_attrs;
+    dev_t _root_dev = 0;
+    // Number of submitted directories that have not started yet
+    std::atomic_size_t _queued;
+    std::atomic_bool _failed;
+    // Guards _error
+    std::mutex _mutex;
+    std::optional<std::error_code> _error;
+    // Tasks on ThreadPool::global() if processing in parallel. Declared last
+    // so that it is destroyed (and waited for) first.
+    std::optional<TaskGroup> _group;
+};
+
+}
+
+/*!
+ * \brief Recursively change the mode and owner of a path
+ *
+ * Directories are read with getdents64() and traversed without following
+ * symlinks or crossing mountpoint boundaries. Entries are stat()'ed and
+ * changed relative to their parent directory's fd and entries that already
+ * have the requested mode and owner are not written to. Directories are
+ * changed after their contents. With TreeAttrs::parallel, subdirectories are
+ * processed concurrently as tasks on ThreadPool::global().
+ *
+ * \param path Path to change
+ * \param attrs Attributes to set
+ *
+ * \return Nothing on success or the first error that occurred
+ */
+oc::result<void> set_tree_attrs(const std::string &path,
+                                const TreeAttrs &attrs)
+{
+    TreeAttrChanger changer(attrs);
+    return changer.run(path);
+}
+
+}
@@ -0,0 +1,773 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbutil/zip_index.h"
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+#include <cerrno>
+#include <climits>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <zlib.h>
+
+#include "mbcommon/crc32.h"
+#include "mbcommon/endian.h"
+#include "mbcommon/error_code.h"
+#include "mbcommon/finally.h"
+#include "mbcommon/thread_pool.h"
+
+#include "mbutil/directory.h"
+
+/*!
+ * \file mbutil/zip_index.h
+ * \brief Random access to zip members through the central directory
+ */
+
+static constexpr uint32_t ZIP_LOCAL_HEADER_MAGIC = 0x04034b50;
+static constexpr uint32_t ZIP_CD_HEADER_MAGIC = 0x02014b50;
+static constexpr uint32_t ZIP_EOCD_MAGIC = 0x06054b50;
+static constexpr uint32_t ZIP_EOCD64_MAGIC = 0x06064b50;
+static constexpr uint32_t ZIP_EOCD64_LOCATOR_MAGIC = 0x07064b50;
+
+static constexpr size_t ZIP_LOCAL_HEADER_SIZE = 30;
+static constexpr size_t ZIP_CD_HEADER_SIZE = 46;
+static constexpr size_t ZIP_EOCD_SIZE = 22;
+static constexpr size_t ZIP_EOCD64_SIZE = 56;
+static constexpr size_t ZIP_EOCD64_LOCATOR_SIZE = 20;
+static constexpr size_t ZIP_MAX_COMMENT_SIZE = 65535;
+
+static constexpr uint16_t ZIP_EXTRA_ZIP64 = 0x0001;
+static constexpr uint16_t ZIP_EXTRA_TIMESTAMP = 0x5455;
+
+static constexpr uint16_t ZIP_FLAG_ENCRYPTED = 1 << 0;
+
+static constexpr uint16_t ZIP_METHOD_STORED = 0;
+static constexpr uint16_t ZIP_METHOD_DEFLATED = 8;
+
+static constexpr uint8_t ZIP_HOST_UNIX = 3;
+
+static constexpr size_t ZIP_BUF_SIZE = 256 * 1024;
+
+static constexpr unsigned int MAX_EXTRACT_THREADS = 4;
+
+namespace mb::util
+{
+
+static uint16_t get_u16(const unsigned char *ptr)
+{
+    uint16_t value;
+    memcpy(&value, ptr, sizeof(value));
+    return mb_le16toh(value);
+}
+
+static uint32_t get_u32(const unsigned char *ptr)
+{
+    uint32_t value;
+    memcpy(&value, ptr, sizeof(value));
+    return mb_le32toh(value);
+}
+
+static uint64_t get_u64(const unsigned char *ptr)
+{
+    uint64_t value;
+    memcpy(&value, ptr, sizeof(value));
+    return mb_le64toh(value);
+}
+
+static oc::result<void> pread_fully(int fd, void *buf, size_t size,
+                                    uint64_t offset)
+{
+    auto ptr = static_cast<unsigned char *>(buf);
+
+    while (size > 0) {
+        ssize_t n = pread64(fd, ptr, size, static_cast<off64_t>(offset));
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return ec_from_errno();
+        } else if (n == 0) {
+            return std::errc::bad_message;
+        }
+
+        ptr += n;
+        size -= static_cast<size_t>(n);
+        offset += static_cast<uint64_t>(n);
+    }
+
+    return oc::success();
+}
+
+static oc::result<void> write_fully(int fd, const void *buf, size_t size)
+{
+    auto ptr = static_cast<const unsigned char *>(buf);
+
+    while (size > 0) {
+        ssize_t n = write(fd, ptr, size);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return ec_from_errno();
+        }
+
+        ptr += n;
+        size -= static_cast<size_t>(n);
+    }
+
+    return oc::success();
+}
+
+static time_t dos_time_to_unix(uint16_t time, uint16_t date)
+{
+    struct tm tm = {};
+    tm.tm_sec = (time & 0x1f) * 2;
+    tm.tm_min = (time >> 5) & 0x3f;
+    tm.tm_hour = time >> 11;
+    tm.tm_mday = date & 0x1f;
+    tm.tm_mon = ((date >> 5) & 0xf) - 1;
+    tm.tm_year = (date >> 9) + 80;
+    tm.tm_isdst = -1;
+
+    return mktime(&tm);
+}
+
+// Apply the zip64 and extended timestamp extra fields
+static bool parse_extra_fields(const unsigned char *ptr, size_t size,
+                               uint32_t csize, uint32_t usize,
+                               uint32_t offset, ZipIndex::Entry &entry)
+{
+    while (size >= 4) {
+        auto id = get_u16(ptr);
+        auto len = get_u16(ptr + 2);
+        ptr += 4;
+        size -= 4;
+
+        if (len > size) {
+            return false;
+        }
+
+        if (id == ZIP_EXTRA_ZIP64) {
+            // Only the fields that overflowed are present, in this order
+            const unsigned char *field = ptr;
+            size_t remain = len;
+
+            for (auto [value, target] : {
+                std::pair{usize, &entry.uncompressed_size},
+                std::pair{csize, &entry.compressed_size},
+                std::pair{offset, &entry.local_header_offset},
+            }) {
+                if (value != UINT32_MAX) {
+                    continue;
+                } else if (remain < 8) {
+                    return false;
+                }
+
+                *target = get_u64(field);
+                field += 8;
+                remain -= 8;
+            }
+        } else if (id == ZIP_EXTRA_TIMESTAMP && len >= 5 && (ptr[0] & 1)) {
+            entry.mtime = static_cast<time_t>(
+                    static_cast<int32_t>(get_u32(ptr + 1)));
+        }
+
+        ptr += len;
+        size -= len;
+    }
+
+    return true;
+}
+
+/*!
+ * \class ZipIndex
+ *
+ * \brief Index of the members of a zip file.
+ *
+ * The index is built from the central directory, so loading it only reads
+ * the end of the file, regardless of the size of the archive. Members can
+ * then be looked up by name in constant time and extracted by seeking
+ * directly to their data.
+ *
+ * Only stored and deflated members that are not encrypted can be extracted.
+ * The index does not keep the file open and can be used from multiple
+ * threads concurrently once loaded.
+ */
+
+/*!
+ * \brief Check whether the entry is a directory
+ */
+bool ZipIndex::Entry::is_dir() const
+{
+    return S_ISDIR(mode);
+}
+
+/*!
+ * \brief Check whether the entry can be extracted by ZipIndex::extract()
+ */
+bool ZipIndex::Entry::is_supported() const
+{
+    return !(flags & ZIP_FLAG_ENCRYPTED)
+            && (method == ZIP_METHOD_STORED || method == ZIP_METHOD_DEFLATED);
+}
+
+ZipIndex::ZipIndex()
+    : _sb()
+    , _base(0)
+{
+}
+
+/*!
+ * \brief Build the index from a zip file's central directory
+ *
+ * On failure, the index is left empty.
+ *
+ * \param path Path to zip file
+ *
+ * \return Nothing on success or the error code on failure. If the file is
+ *         not a valid zip, `std::errc::bad_message` is returned. Multi-disk
+ *         archives are not supported.
+ */
+oc::result<void> ZipIndex::load(const std::string &path)
+{
+    _path.clear();
+    _sb = {};
+    _base = 0;
+    _entries.clear();
+    _lookup.clear();
+
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return ec_from_errno();
+    }
+
+    auto close_fd = finally([&] {
+        close(fd);
+    });
+
+    struct stat sb;
+    if (fstat(fd, &sb) < 0) {
+        return ec_from_errno();
+    } else if (!S_ISREG(sb.st_mode)) {
+        return std::errc::bad_message;
+    }
+
+    auto file_size = static_cast<uint64_t>(sb.st_size);
+    if (file_size < ZIP_EOCD_SIZE) {
+        return std::errc::bad_message;
+    }
+
+    // The end of central directory record is followed only by the comment
+    auto tail_size = static_cast<size_t>(std::min<uint64_t>(
+            file_size, ZIP_EOCD_SIZE + ZIP_MAX_COMMENT_SIZE));
+    auto tail_offset = file_size - tail_size;
+    std::vector<unsigned char> tail(tail_size);
+
+    OUTCOME_TRYV(pread_fully(fd, tail.data(), tail.size(), tail_offset));
+
+    const unsigned char *eocd = nullptr;
+
+    for (size_t i = tail_size - ZIP_EOCD_SIZE + 1; i-- > 0;) {
+        if (get_u32(&tail[i]) == ZIP_EOCD_MAGIC
+                && i + ZIP_EOCD_SIZE + get_u16(&tail[i + 20]) <= tail_size) {
+            eocd = &tail[i];
+            break;
+        }
+    }
+
+    if (!eocd) {
+        return std::errc::bad_message;
+    }
+
+    uint64_t eocd_offset = tail_offset
+            + static_cast<uint64_t>(eocd - tail.data());
+    uint32_t disk = get_u16(eocd + 4);
+    uint32_t cd_disk = get_u16(eocd + 6);
+    uint64_t count = get_u16(eocd + 10);
+    uint64_t cd_size = get_u32(eocd + 12);
+    uint64_t cd_offset = get_u32(eocd + 16);
+    uint64_t base = 0;
+
+    if (count == UINT16_MAX || cd_size == UINT32_MAX
+            || cd_offset == UINT32_MAX) {
+        if (eocd_offset < ZIP_EOCD64_LOCATOR_SIZE) {
+            return std::errc::bad_message;
+        }
+
+        unsigned char locator[ZIP_EOCD64_LOCATOR_SIZE];
+        OUTCOME_TRYV(pread_fully(fd, locator, sizeof(locator),
+                                 eocd_offset - sizeof(locator)));
+
+        if (get_u32(locator) != ZIP_EOCD64_LOCATOR_MAGIC) {
+            return std::errc::bad_message;
+        }
+
+        unsigned char eocd64[ZIP_EOCD64_SIZE];
+        OUTCOME_TRYV(pread_fully(fd, eocd64, sizeof(eocd64),
+                                 get_u64(locator + 8)));
+
+        if (get_u32(eocd64) != ZIP_EOCD64_MAGIC) {
+            return std::errc::bad_message;
+        }
+
+        disk = get_u32(eocd64 + 16);
+        cd_disk = get_u32(eocd64 + 20);
+        count = get_u64(eocd64 + 32);
+        cd_size = get_u64(eocd64 + 40);
+        cd_offset = get_u64(eocd64 + 48);
+    } else {
+        // Offsets are relative to the start of the zip data, which is not
+        // the start of the file if something was prepended to it
+        if (eocd_offset < cd_size || eocd_offset - cd_size < cd_offset) {
+            return std::errc::bad_message;
+        }
+        base = eocd_offset - cd_size - cd_offset;
+    }
+
+    if (disk != 0 || cd_disk != 0) {
+        return std::errc::not_supported;
+    }
+
+    if (cd_offset > file_size || cd_size > file_size - cd_offset - base
+            || count > cd_size / ZIP_CD_HEADER_SIZE) {
+        return std::errc::bad_message;
+    }
+
+    std::vector<unsigned char> cd(static_cast<size_t>(cd_size));
+    OUTCOME_TRYV(pread_fully(fd, cd.data(), cd.size(), base + cd_offset));
+
+    std::vector<Entry> entries;
+    std::unordered_map<std::string, size_t> lookup;
+    entries.reserve(static_cast<size_t>(count));
+    lookup.reserve(static_cast<size_t>(count));
+
+    const unsigned char *ptr = cd.data();
+    const unsigned char *end = cd.data() + cd.size();
+
+    for (uint64_t i = 0; i < count; ++i) {
+        if (static_cast<size_t>(end - ptr) < ZIP_CD_HEADER_SIZE
+                || get_u32(ptr) != ZIP_CD_HEADER_MAGIC) {
+            return std::errc::bad_message;
+        }
+
+        auto version_made_by = get_u16(ptr + 4);
+        auto csize = get_u32(ptr + 20);
+        auto usize = get_u32(ptr + 24);
+        size_t name_size = get_u16(ptr + 28);
+        size_t extra_size = get_u16(ptr + 30);
+        size_t comment_size = get_u16(ptr + 32);
+        auto external_attrs = get_u32(ptr + 38);
+        auto offset = get_u32(ptr + 42);
+
+        if (static_cast<size_t>(end - ptr) < ZIP_CD_HEADER_SIZE + name_size
+                + extra_size + comment_size) {
+            return std::errc::bad_message;
+        }
+
+        Entry entry;
+        entry.name.assign(reinterpret_cast<const char *>(
+                ptr + ZIP_CD_HEADER_SIZE), name_size);
+        entry.local_header_offset = offset;
+        entry.compressed_size = csize;
+        entry.uncompressed_size = usize;
+        entry.crc32 = get_u32(ptr + 16);
+        entry.flags = get_u16(ptr + 8);
+        entry.method = get_u16(ptr + 10);
+        entry.mtime = dos_time_to_unix(get_u16(ptr + 12), get_u16(ptr + 14));
+
+        if (!parse_extra_fields(ptr + ZIP_CD_HEADER_SIZE + name_size,
+                                extra_size, csize, usize, offset, entry)) {
+            return std::errc::bad_message;
+        }
+
+        // Same defaults as libarchive for archives not created on unix
+        auto unix_mode = static_cast<mode_t>(external_attrs >> 16);
+        bool trailing_slash = !entry.name.empty()
+                && entry.name.back() == '/';
+
+        if ((version_made_by >> 8) == ZIP_HOST_UNIX && unix_mode != 0) {
+            entry.mode = unix_mode;
+        } else if (trailing_slash) {
+            entry.mode = S_IFDIR | 0755;
+        } else {
+            entry.mode = S_IFREG | 0644;
+        }
+
+        if (trailing_slash && !S_ISDIR(entry.mode)) {
+            entry.mode = (entry.mode & 07777) | S_IFDIR;
+        }
+
+        // Later entries with the same name shadow earlier ones, like they
+        // would when extracting the whole archive
+        lookup[entry.name] = entries.size();
+        entries.push_back(std::move(entry));
+
+        ptr += ZIP_CD_HEADER_SIZE + name_size + extra_size + comment_size;
+    }
+
+    _path = path;
+    _sb = sb;
+    _base = base;
+    _entries.swap(entries);
+    _lookup.swap(lookup);
+
+    return oc::success();
+}
+
+/*!
+ * \brief Path of the zip file the index was loaded from
+ */
+const std::string & ZipIndex::path() const
+{
+    return _path;
+}
+
+/*!
+ * \brief Metadata of the zip file at the time the index was loaded
+ *
+ * This can be compared against the current metadata of the file to check if
+ * the index is still valid.
+ */
+const struct stat & ZipIndex::file_stat() const
+{
+    return _sb;
+}
+
+/*!
+ * \brief All entries in central directory order
+ */
+const std::vector<ZipIndex::Entry> & ZipIndex::entries() const
+{
+    return _entries;
+}
+
+/*!
+ * \brief Find entry by name
+ *
+ * \param name Entry name
+ *
+ * \return Pointer to entry or nullptr if there is no entry named \p name
+ */
+const ZipIndex::Entry * ZipIndex::find(const std::string &name) const
+{
+    auto it = _lookup.find(name);
+    if (it == _lookup.end()) {
+        return nullptr;
+    }
+
+    return &_entries[it->second];
+}
+
+/*!
+ * \brief Get the offset of an entry's local header in the file
+ *
+ * Unlike Entry::local_header_offset, this accounts for any data preceding the
+ * zip. A streaming zip reader can start reading at this offset to read the
+ * entry without scanning the preceding entries.
+ *
+ * \param entry Entry from this index
+ *
+ * \return Offset from the beginning of the file
+ */
+uint64_t ZipIndex::local_header_offset(const Entry &entry) const
+{
+    return _base + entry.local_header_offset;
+}
+
+// Decompress an entry's data and pass it to the callback in chunks
+template<typename Fn>
+static oc::result<void> read_entry_data(int fd, uint64_t offset,
+                                        const ZipIndex::Entry &entry,
+                                        Fn &&callback)
+{
+    std::vector<unsigned char> in_buf(ZIP_BUF_SIZE);
+    uint64_t remain = entry.compressed_size;
+    uint64_t total = 0;
+    uint32_t crc = 0;
+
+    auto emit = [&](const unsigned char *data, size_t size) {
+        crc = crc32_update(crc, data, size);
+        total += size;
+        return callback(data, size);
+    };
+
+    if (entry.method == ZIP_METHOD_STORED) {
+        while (remain > 0) {
+            auto n = static_cast<size_t>(
+                    std::min<uint64_t>(remain, in_buf.size()));
+
+            OUTCOME_TRYV(pread_fully(fd, in_buf.data(), n, offset));
+            offset += n;
+            remain -= n;
+
+            OUTCOME_TRYV(emit(in_buf.data(), n));
+        }
+    } else {
+        std::vector<unsigned char> out_buf(ZIP_BUF_SIZE);
+        z_stream z = {};
+
+        // Negative window bits for raw deflate data
+        if (inflateInit2(&z, -MAX_WBITS) != Z_OK) {
+            return std::errc::not_enough_memory;
+        }
+
+        auto end_z = finally([&] {
+            inflateEnd(&z);
+        });
+
+        int ret = Z_OK;
+        bool output_full = false;
+
+        while (ret != Z_STREAM_END) {
+            // More input is only needed if the previous call did not stop
+            // because the output buffer was full
+            if (z.avail_in == 0 && !output_full) {
+                if (remain == 0) {
+                    return std::errc::bad_message;
+                }
+
+                auto n = static_cast<size_t>(
+                        std::min<uint64_t>(remain, in_buf.size()));
+
+                OUTCOME_TRYV(pread_fully(fd, in_buf.data(), n, offset));
+                offset += n;
+                remain -= n;
+
+                z.next_in = in_buf.data();
+                z.avail_in = static_cast<uInt>(n);
+            }
+
+            z.next_out = out_buf.data();
+            z.avail_out = static_cast<uInt>(out_buf.size());
+
+            ret = inflate(&z, Z_NO_FLUSH);
+            if (ret != Z_OK && ret != Z_STREAM_END) {
+                return std::errc::bad_message;
+            }
+
+            output_full = z.avail_out == 0;
+            OUTCOME_TRYV(emit(out_buf.data(), out_buf.size() - z.avail_out));
+        }
+    }
+
+    if (total != entry.uncompressed_size || crc != entry.crc32) {
+        return std::errc::bad_message;
+    }
+
+    return oc::success();
+}
+
+static FileOpResult<void> extract_entry(int fd, uint64_t base,
+                                        uint64_t file_size,
+                                        const ZipIndex::Entry &entry,
+                                        const std::string &target)
+{
+    auto error = [&](std::error_code ec) {
+        return FileOpErrorInfo{target, ec};
+    };
+
+    if (!entry.is_supported()) {
+        return error(std::make_error_code(std::errc::not_supported));
+    }
+
+    unsigned char header[ZIP_LOCAL_HEADER_SIZE];
+    auto header_offset = base + entry.local_header_offset;
+
+    if (auto r = pread_fully(fd, header, sizeof(header), header_offset); !r) {
+        return error(r.error());
+    } else if (get_u32(header) != ZIP_LOCAL_HEADER_MAGIC) {
+        return error(std::make_error_code(std::errc::bad_message));
+    }
+
+    // The local header's name and extra field may differ from the central
+    // directory's, so the data offset can only be computed from it
+    auto data_offset = header_offset + ZIP_LOCAL_HEADER_SIZE
+            + get_u16(header + 26) + get_u16(header + 28);
+    if (data_offset > file_size
+            || entry.compressed_size > file_size - data_offset) {
+        return error(std::make_error_code(std::errc::bad_message));
+    }
+
+    struct timespec times[2];
+    times[0].tv_sec = entry.mtime;
+    times[0].tv_nsec = 0;
+    times[1] = times[0];
+
+    if (auto r = mkdir_parent(target, 0755); !r) {
+        return error(r.error());
+    }
+
+    if (entry.is_dir()) {
+        if (mkdir(target.c_str(), 0700) < 0 && errno != EEXIST) {
+            return error(ec_from_errno());
+        }
+        if (chmod(target.c_str(), entry.mode & 07777) < 0
+                || utimensat(AT_FDCWD, target.c_str(), times, 0) < 0) {
+            return error(ec_from_errno());
+        }
+        return oc::success();
+    }
+
+    // Replace rather than overwrite existing files, like libarchive's
+    // ARCHIVE_EXTRACT_UNLINK, so that running executables can be replaced
+    if (unlink(target.c_str()) < 0 && errno != ENOENT) {
+        return error(ec_from_errno());
+    }
+
+    if (S_ISLNK(entry.mode)) {
+        if (entry.uncompressed_size >= PATH_MAX) {
+            return error(std::make_error_code(std::errc::bad_message));
+        }
+
+        std::string link_target;
+
+        if (auto r = read_entry_data(fd, data_offset, entry,
+                [&](const void *data, size_t size) -> oc::result<void> {
+                    link_target.append(static_cast<const char *>(data), size);
+                    return oc::success();
+                }); !r) {
+            return error(r.error());
+        }
+
+        if (symlink(link_target.c_str(), target.c_str()) < 0) {
+            return error(ec_from_errno());
+        }
+
+        return oc::success();
+    }
+
+    int out_fd = open(target.c_str(),
+                      O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC,
+                      0600);
+    if (out_fd < 0) {
+        return error(ec_from_errno());
+    }
+
+    auto close_out_fd = finally([&] {
+        if (out_fd >= 0) {
+            close(out_fd);
+        }
+    });
+
+    if (auto r = read_entry_data(fd, data_offset, entry,
+            [&](const void *data, size_t size) {
+                return write_fully(out_fd, data, size);
+            }); !r) {
+        return error(r.error());
+    }
+
+    if (fchmod(out_fd, entry.mode & 07777) < 0
+            || futimens(out_fd, times) < 0) {
+        return error(ec_from_errno());
+    }
+
+    int ret = close(out_fd);
+    out_fd = -1;
+    if (ret < 0) {
+        return error(ec_from_errno());
+    }
+
+    return oc::success();
+}
+
+/*!
+ * \brief Extract an entry
+ *
+ * The parent directories of \p target are created if needed and an existing
+ * file at \p target is replaced. The permissions and modification time of
+ * the entry are restored. The data is verified against the CRC32 checksum in
+ * the central directory.
+ *
+ * \param entry Entry from this index
+ * \param target Output path
+ *
+ * \return Nothing on success or the output path and error code on failure
+ */
+FileOpResult<void> ZipIndex::extract(const Entry &entry,
+                                     const std::string &target) const
+{
+    return extract({{&entry, target}});
+}
+
+/*!
+ * \brief Extract multiple entries
+ *
+ * This behaves like extract(const Entry &, const std::string &), except that
+ * the entries are extracted concurrently and the zip file is only opened
+ * once.
+ *
+ * \param list Entries from this index and their output paths
+ *
+ * \return Nothing if all entries were extracted. Otherwise, the output path
+ *         and error code of the first failed entry in \p list.
+ */
+FileOpResult<void> ZipIndex::extract(const ExtractList &list) const
+{
+    int fd = open(_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return FileOpErrorInfo{_path, ec_from_errno()};
+    }
+
+    auto close_fd = finally([&] {
+        close(fd);
+    });
+
+    auto file_size = static_cast<uint64_t>(_sb.st_size);
+    std::vector<FileOpResult<void>> results(list.size(), oc::success());
+    std::atomic_size_t next{0};
+
+    auto worker = [&] {
+        for (size_t i; (i = next++) < list.size();) {
+            results[i] = extract_entry(fd, _base, file_size, *list[i].first,
+                                       list[i].second);
+        }
+    };
+
+    auto n_threads = std::min<size_t>(
+            thread_count(1, MAX_EXTRACT_THREADS),
+            list.size());
+
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < n_threads; ++i) {
+        threads.emplace_back(worker);
+    }
+
+    // The calling thread does its share of the work too
+    worker();
+
+    for (auto &t : threads) {
+        t.join();
+    }
+
+    for (auto &r : results) {
+        if (!r) {
+            return std::move(r.error());
+        }
+    }
+
+    return oc::success();
+}
+
+}
@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <string>
+
+#include <cstdlib>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include "mbutil/delete.h"
+
+// Fixture that creates an empty directory under $TMPDIR (or /tmp) for each
+// test and recursively deletes it afterwards
+class TemporaryDirTest : public ::testing::Test
+{
+protected:
+    void SetUp() override
+    {
+        const char *tmpdir = getenv("TMPDIR");
+        std::string path = tmpdir && *tmpdir ? tmpdir : "/tmp";
+        path += "/mbutil_test.XXXXXX";
+
+        ASSERT_TRUE(mkdtemp(path.data()));
+        _dir = path;
+    }
+
+    void TearDown() override
+    {
+        (void) mb::util::delete_recursive(_dir);
+    }
+
+    // Create a new, empty regular file with mode 0600
+    static void create_file(const std::string &path)
+    {
+        int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC,
+                      0600);
+        ASSERT_GE(fd, 0);
+        close(fd);
+    }
+
+    std::string _dir;
+};
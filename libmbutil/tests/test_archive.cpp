@@ -19,7 +19,25 @@
 
 #include <gtest/gtest.h>
 
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "mbcommon/file/memory.h"
+#include "mbcommon/string.h"
+
 #include "mbutil/archive.h"
+#include "mbutil/file.h"
+
+#include "temp_dir_test.h"
+
+using namespace mb;
+using namespace mb::util;
 
 using ScopedArchive = std::unique_ptr<archive, decltype(archive_free) *>;
 using ScopedArchiveEntry =
@@ -66,3 +84,347 @@ TEST(ArchiveTest, CheckUtf8FilenamesWork)
     ASSERT_EQ(archive_write_close(a.get()), ARCHIVE_OK)
             << archive_error_string(a.get());
 }
+
+class ArchiveCompressionTest
+    : public TemporaryDirTest
+    , public ::testing::WithParamInterface<CompressionType>
+{
+protected:
+    void SetUp() override
+    {
+        TemporaryDirTest::SetUp();
+
+        ASSERT_EQ(mkdir((_dir + "/source").c_str(), 0700), 0);
+        ASSERT_EQ(mkdir((_dir + "/target").c_str(), 0700), 0);
+
+        // Several compression blocks worth of data that is compressible, but
+        // not trivially so
+        _data.resize(3 * 1024 * 1024 + 321);
+        uint32_t state = 1;
+        for (auto &c : _data) {
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+            c = static_cast<char>('a' + state % 8);
+        }
+
+        ASSERT_TRUE(file_write_data(_dir + "/source/large",
+                                    _data.data(), _data.size()));
+        ASSERT_TRUE(file_write_data(_dir + "/source/small", "abc", 3));
+    }
+
+    void check_extracted()
+    {
+        auto large = file_read_all(_dir + "/target/large");
+        ASSERT_TRUE(large);
+        ASSERT_EQ(large.value(), _data);
+
+        auto small = file_read_all(_dir + "/target/small");
+        ASSERT_TRUE(small);
+        ASSERT_EQ(small.value(), "abc");
+    }
+
+    std::string _data;
+};
+
+TEST_P(ArchiveCompressionTest, CreateAndExtract)
+{
+    std::string archive_path = _dir + "/backup.tar";
+
+    ASSERT_TRUE(libarchive_tar_create(archive_path, _dir + "/source",
+                                      {"large", "small"}, GetParam(), 0));
+    ASSERT_TRUE(libarchive_tar_extract(archive_path, _dir + "/target",
+                                       {}, GetParam(), false));
+    check_extracted();
+}
+
+TEST_P(ArchiveCompressionTest, CreateAndExtractSplit)
+{
+    std::string archive_path = _dir + "/backup.tar";
+
+    ASSERT_TRUE(libarchive_tar_create(archive_path, _dir + "/source",
+                                      {"large", "small"}, GetParam(),
+                                      256 * 1024));
+
+    struct stat sb;
+    ASSERT_EQ(stat((archive_path + ".1").c_str(), &sb), 0);
+
+    ASSERT_TRUE(libarchive_tar_extract(archive_path, _dir + "/target",
+                                       {}, GetParam(), true));
+    check_extracted();
+}
+
+TEST_P(ArchiveCompressionTest, CreateAndExtractTree)
+{
+    std::string archive_path = _dir + "/backup.tar";
+    std::string source = _dir + "/source";
+
+    // Enough files to keep all writers busy while directories are created
+    for (int i = 0; i < 8; ++i) {
+        auto subdir = format("%s/dir%d", source.c_str(), i);
+        ASSERT_EQ(mkdir(subdir.c_str(), 0700), 0);
+        ASSERT_EQ(mkdir((subdir + "/nested").c_str(), 0750), 0);
+
+        for (int j = 0; j < 16; ++j) {
+            auto contents = format("%d/%d", i, j);
+            ASSERT_TRUE(file_write_data(
+                    format("%s/nested/file%d", subdir.c_str(), j),
+                    contents.data(), contents.size()));
+        }
+    }
+
+    ASSERT_EQ(link((source + "/large").c_str(),
+                   (source + "/dir0/large_link").c_str()), 0);
+    ASSERT_EQ(symlink("../small", (source + "/dir0/small_link").c_str()), 0);
+
+    for (int i = 0; i < 8; ++i) {
+        struct timespec times[2] = {{1000000000, 0}, {1000000000, 0}};
+        ASSERT_EQ(utimensat(AT_FDCWD, format("%s/dir%d", source.c_str(), i)
+                                    .c_str(), times, 0), 0);
+    }
+
+    ASSERT_TRUE(libarchive_tar_create(archive_path, source, {"."},
+                                      GetParam(), 0));
+    ASSERT_TRUE(libarchive_tar_extract(archive_path, _dir + "/target",
+                                       {}, GetParam(), false));
+    check_extracted();
+
+    std::string target = _dir + "/target";
+
+    for (int i = 0; i < 8; ++i) {
+        auto subdir = format("%s/dir%d", target.c_str(), i);
+
+        for (int j = 0; j < 16; ++j) {
+            auto contents = file_read_all(
+                    format("%s/nested/file%d", subdir.c_str(), j));
+            ASSERT_TRUE(contents);
+            ASSERT_EQ(contents.value(), format("%d/%d", i, j));
+        }
+
+        // Directory metadata must be restored after the files are written
+        struct stat sb;
+        ASSERT_EQ(stat(subdir.c_str(), &sb), 0);
+        ASSERT_EQ(sb.st_mtime, 1000000000);
+        ASSERT_EQ(stat((subdir + "/nested").c_str(), &sb), 0);
+        ASSERT_EQ(sb.st_mode & 07777, 0750u);
+    }
+
+    struct stat sb_large;
+    struct stat sb_link;
+    ASSERT_EQ(stat((target + "/large").c_str(), &sb_large), 0);
+    ASSERT_EQ(stat((target + "/dir0/large_link").c_str(), &sb_link), 0);
+    ASSERT_EQ(sb_large.st_ino, sb_link.st_ino);
+
+    auto small = file_read_all(target + "/dir0/small_link");
+    ASSERT_TRUE(small);
+    ASSERT_EQ(small.value(), "abc");
+}
+
+TEST_P(ArchiveCompressionTest, CreateAndExtractParts)
+{
+    std::string archive_path = _dir + "/backup.tar";
+    std::string source = _dir + "/source";
+
+    for (int i = 0; i < 4; ++i) {
+        auto subdir = format("%s/dir%d", source.c_str(), i);
+        ASSERT_EQ(mkdir(subdir.c_str(), 0750), 0);
+
+        for (int j = 0; j < 4; ++j) {
+            ASSERT_TRUE(file_write_data(format("%s/file%d", subdir.c_str(), j),
+                                        _data.data(), 256 * 1024));
+        }
+    }
+
+    ASSERT_EQ(link((source + "/large").c_str(),
+                   (source + "/dir3/large_link").c_str()), 0);
+    ASSERT_EQ(symlink("../small", (source + "/dir0/small_link").c_str()), 0);
+
+    struct timespec times[2] = {{1000000000, 0}, {1000000000, 0}};
+    ASSERT_EQ(utimensat(AT_FDCWD, (source + "/dir1").c_str(), times, 0), 0);
+
+    std::vector<FileChecksum> checksums;
+    ASSERT_TRUE(libarchive_tar_create_parts(archive_path, source, {"."},
+                                            GetParam(), 512 * 1024, 4,
+                                            nullptr, &checksums));
+
+    size_t count = libarchive_tar_part_count(archive_path);
+    ASSERT_GT(count, 2u);
+    ASSERT_EQ(checksums.size(), count);
+    ASSERT_EQ(checksums[0].path, libarchive_tar_part_name(archive_path, 0));
+
+    std::vector<std::string> entries;
+    ASSERT_TRUE(libarchive_tar_extract_parts(archive_path, _dir + "/target",
+                                             {}, GetParam(), 4, {}, &entries));
+    check_extracted();
+
+    std::string target = _dir + "/target";
+
+    for (int i = 0; i < 4; ++i) {
+        for (int j = 0; j < 4; ++j) {
+            auto contents = file_read_all(
+                    format("%s/dir%d/file%d", target.c_str(), i, j));
+            ASSERT_TRUE(contents);
+            ASSERT_EQ(contents.value(), _data.substr(0, 256 * 1024));
+        }
+    }
+
+    // Directories are extracted last, so their metadata must be intact
+    struct stat sb;
+    ASSERT_EQ(stat((target + "/dir1").c_str(), &sb), 0);
+    ASSERT_EQ(sb.st_mtime, 1000000000);
+    ASSERT_EQ(sb.st_mode & 07777, 0750u);
+
+    struct stat sb_link;
+    ASSERT_EQ(stat((target + "/large").c_str(), &sb), 0);
+    ASSERT_EQ(stat((target + "/dir3/large_link").c_str(), &sb_link), 0);
+    ASSERT_EQ(sb.st_ino, sb_link.st_ino);
+
+    auto small = file_read_all(target + "/dir0/small_link");
+    ASSERT_TRUE(small);
+    ASSERT_EQ(small.value(), "abc");
+
+    // 4 directories, 16 files, and the 4 other entries
+    ASSERT_EQ(entries.size(), 24u);
+}
+
+INSTANTIATE_TEST_CASE_P(AllCompressionTypes, ArchiveCompressionTest,
+                        ::testing::Values(CompressionType::None,
+                                          CompressionType::Lz4,
+                                          CompressionType::Gzip,
+                                          CompressionType::Xz));
+
+// Behaves like a regular file that cannot be accessed as a mapping and counts
+// the number of bytes read
+class CountingMemoryFile : public MemoryFile
+{
+public:
+    using MemoryFile::MemoryFile;
+
+    oc::result<size_t> read(void *buf, size_t size) override
+    {
+        OUTCOME_TRY(n, MemoryFile::read(buf, size));
+        bytes_read += n;
+        return n;
+    }
+
+    std::optional<ConstIoVec> mapped_data() override
+    {
+        return std::nullopt;
+    }
+
+    size_t bytes_read = 0;
+};
+
+static std::string create_tar(
+        const std::vector<std::pair<std::string, std::string>> &files)
+{
+    ScopedArchive a(archive_write_new(), archive_write_free);
+    EXPECT_TRUE(a);
+
+    EXPECT_EQ(archive_write_set_format_pax_restricted(a.get()), ARCHIVE_OK);
+
+    std::string buf(16 * 1024 * 1024, '\0');
+    size_t used = 0;
+
+    EXPECT_EQ(archive_write_open_memory(a.get(), buf.data(), buf.size(), &used),
+              ARCHIVE_OK) << archive_error_string(a.get());
+
+    for (auto const &[name, data] : files) {
+        ScopedArchiveEntry entry(archive_entry_new(), archive_entry_free);
+        EXPECT_TRUE(entry);
+
+        archive_entry_set_pathname(entry.get(), name.c_str());
+        archive_entry_set_filetype(entry.get(), AE_IFREG);
+        archive_entry_set_perm(entry.get(), 0644);
+        archive_entry_set_size(entry.get(), static_cast<la_int64_t>(data.size()));
+
+        EXPECT_EQ(archive_write_header(a.get(), entry.get()), ARCHIVE_OK)
+                << archive_error_string(a.get());
+        EXPECT_EQ(archive_write_data(a.get(), data.data(), data.size()),
+                  static_cast<la_ssize_t>(data.size()));
+    }
+
+    EXPECT_EQ(archive_write_close(a.get()), ARCHIVE_OK)
+            << archive_error_string(a.get());
+
+    buf.resize(used);
+    return buf;
+}
+
+static std::string read_entry_data(archive *a)
+{
+    std::string result;
+    char buf[4096];
+    la_ssize_t n;
+
+    while ((n = archive_read_data(a, buf, sizeof(buf))) > 0) {
+        result.append(buf, static_cast<size_t>(n));
+    }
+    EXPECT_EQ(n, 0) << archive_error_string(a);
+
+    return result;
+}
+
+TEST(ArchiveReaderTest, SkippedEntriesAreNotRead)
+{
+    auto tar = create_tar({
+        {"large", std::string(8 * 1024 * 1024, 'x')},
+        {"small", "Hello, world!"},
+    });
+
+    CountingMemoryFile file(tar.data(), tar.size());
+    ASSERT_TRUE(file.is_open());
+
+    BlockReader reader(&file, 64 * 1024);
+
+    ScopedArchive a(archive_read_new(), archive_read_free);
+    ASSERT_TRUE(a);
+    ASSERT_EQ(archive_read_support_format_tar(a.get()), ARCHIVE_OK);
+    ASSERT_EQ(libarchive_open_reader(a.get(), reader), ARCHIVE_OK)
+            << archive_error_string(a.get());
+
+    archive_entry *entry;
+
+    ASSERT_EQ(archive_read_next_header(a.get(), &entry), ARCHIVE_OK);
+    ASSERT_STREQ(archive_entry_pathname(entry), "large");
+    ASSERT_EQ(archive_read_next_header(a.get(), &entry), ARCHIVE_OK);
+    ASSERT_STREQ(archive_entry_pathname(entry), "small");
+    ASSERT_EQ(read_entry_data(a.get()), "Hello, world!");
+
+    ASSERT_LT(file.bytes_read, 1024u * 1024u);
+}
+
+TEST(ArchiveReaderTest, ReadNestedArchiveFromEntry)
+{
+    auto inner = create_tar({{"file", "nested data"}});
+    auto outer = create_tar({{"inner.tar", inner}});
+
+    MemoryFile file(outer.data(), outer.size());
+    ASSERT_TRUE(file.is_open());
+
+    BlockReader reader(&file);
+
+    ScopedArchive a(archive_read_new(), archive_read_free);
+    ASSERT_TRUE(a);
+    ASSERT_EQ(archive_read_support_format_tar(a.get()), ARCHIVE_OK);
+    ASSERT_EQ(libarchive_open_reader(a.get(), reader), ARCHIVE_OK)
+            << archive_error_string(a.get());
+
+    archive_entry *entry;
+
+    ASSERT_EQ(archive_read_next_header(a.get(), &entry), ARCHIVE_OK);
+    ASSERT_STREQ(archive_entry_pathname(entry), "inner.tar");
+
+    ScopedArchive nested(archive_read_new(), archive_read_free);
+    ASSERT_TRUE(nested);
+    ASSERT_EQ(archive_read_support_format_tar(nested.get()), ARCHIVE_OK);
+
+    ArchiveEntrySource source;
+    ASSERT_EQ(libarchive_open_entry(nested.get(), source, a.get()), ARCHIVE_OK)
+            << archive_error_string(nested.get());
+
+    ASSERT_EQ(archive_read_next_header(nested.get(), &entry), ARCHIVE_OK);
+    ASSERT_STREQ(archive_entry_pathname(entry), "file");
+    ASSERT_EQ(read_entry_data(nested.get()), "nested data");
+    ASSERT_EQ(archive_read_next_header(nested.get(), &entry), ARCHIVE_EOF);
+}
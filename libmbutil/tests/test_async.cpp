@@ -0,0 +1,151 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+
+#include <sys/stat.h>
+
+#include "mbcommon/error_code.h"
+#include "mbcommon/file/standard.h"
+
+#include "mbutil/async.h"
+#include "mbutil/delete.h"
+
+#include "temp_dir_test.h"
+
+using namespace mb;
+using namespace mb::util;
+using namespace std::chrono_literals;
+
+class AsyncTest : public TemporaryDirTest
+{
+protected:
+    void write_file(const std::string &path, const std::string &data)
+    {
+        StandardFile file;
+        ASSERT_TRUE(file.open(path, FileOpenMode::WriteOnly));
+        ASSERT_TRUE(file.write(data.data(), data.size()));
+        ASSERT_TRUE(file.close());
+    }
+};
+
+TEST_F(AsyncTest, RunReturnsResult)
+{
+    std::atomic_bool release{false};
+
+    auto op = AsyncOp<int>::run({}, [&] {
+        while (!release) {
+            std::this_thread::sleep_for(1ms);
+        }
+        return 42;
+    });
+
+    ASSERT_TRUE(op.valid());
+    ASSERT_FALSE(op.wait_for(10ms));
+    ASSERT_FALSE(op.ready());
+
+    release = true;
+
+    ASSERT_EQ(op.get(), 42);
+    ASSERT_TRUE(op.ready());
+}
+
+TEST_F(AsyncTest, CancelCallsCancelFunction)
+{
+    std::atomic_bool cancelled{false};
+
+    auto op = AsyncOp<bool>::run({}, [&] {
+        while (!cancelled) {
+            std::this_thread::sleep_for(1ms);
+        }
+        return true;
+    }, [&] {
+        cancelled = true;
+    });
+
+    op.cancel();
+    ASSERT_TRUE(op.get());
+}
+
+TEST_F(AsyncTest, MoveTransfersOperation)
+{
+    auto op = AsyncOp<int>::run(_dir, [] { return 1; });
+    AsyncOp<int> op2;
+    ASSERT_FALSE(op2.valid());
+
+    op2 = std::move(op);
+    ASSERT_FALSE(op.valid());
+    ASSERT_TRUE(op2.valid());
+    ASSERT_EQ(op2.get(), 1);
+}
+
+TEST_F(AsyncTest, CopyDirAndDelete)
+{
+    auto source = _dir + "/source";
+    auto target = _dir + "/target";
+
+    ASSERT_EQ(mkdir(source.c_str(), 0755), 0);
+    ASSERT_NO_FATAL_FAILURE(write_file(source + "/a", "hello"));
+    ASSERT_NO_FATAL_FAILURE(write_file(source + "/b", "world!"));
+
+    CopyProgress progress;
+    auto copy_op = copy_dir_async(source, target, CopyFlag::ExcludeTopLevel,
+                                  &progress);
+    ASSERT_TRUE(copy_op.get());
+    ASSERT_EQ(progress.files, 2u);
+    ASSERT_EQ(progress.bytes, 11u);
+
+    struct stat sb;
+    ASSERT_EQ(stat((target + "/b").c_str(), &sb), 0);
+    ASSERT_EQ(sb.st_size, 6);
+
+    auto hash_op = sha512_hash_async(target + "/a");
+    auto digest = hash_op.get();
+    ASSERT_TRUE(digest);
+    auto expected = sha512_hash(source + "/a");
+    ASSERT_TRUE(expected);
+    ASSERT_EQ(digest.value(), expected.value());
+
+    DeleteProgress delete_progress;
+    auto delete_op = delete_recursive_async(target, {}, &delete_progress);
+    ASSERT_TRUE(delete_op.get());
+    ASSERT_EQ(delete_progress.entries, 3u);
+    ASSERT_NE(stat(target.c_str(), &sb), 0);
+}
+
+TEST_F(AsyncTest, CancelledCopyFails)
+{
+    auto source = _dir + "/source";
+    auto target = _dir + "/target";
+
+    ASSERT_EQ(mkdir(source.c_str(), 0755), 0);
+    ASSERT_NO_FATAL_FAILURE(write_file(source + "/a", "hello"));
+
+    CopyProgress progress;
+    progress.cancelled = true;
+
+    auto op = copy_dir_async(source, target, CopyFlag::ExcludeTopLevel,
+                             &progress);
+    ASSERT_FALSE(op.get());
+}
@@ -0,0 +1,158 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "mbcommon/perf.h"
+
+#include "mbutil/chmod.h"
+
+#include "temp_dir_test.h"
+
+using namespace mb;
+using namespace mb::util;
+
+class ChmodTest : public TemporaryDirTest
+{
+protected:
+    void TearDown() override
+    {
+        (void) util::chmod(_dir, 0700, ChmodFlag::Recursive);
+        TemporaryDirTest::TearDown();
+    }
+
+    // Create a tree that is wide and deep enough to use every worker thread
+    static void create_tree(const std::string &path, int depth)
+    {
+        ASSERT_EQ(mkdir(path.c_str(), 0700), 0);
+
+        for (int i = 0; i < 4; ++i) {
+            create_file(path + "/file" + std::to_string(i));
+        }
+        ASSERT_EQ(symlink("file0", (path + "/link").c_str()), 0);
+
+        if (depth > 0) {
+            for (int i = 0; i < 4; ++i) {
+                create_tree(path + "/dir" + std::to_string(i), depth - 1);
+            }
+        }
+    }
+
+    static mode_t mode(const std::string &path)
+    {
+        struct stat sb;
+        EXPECT_EQ(lstat(path.c_str(), &sb), 0);
+        return sb.st_mode & 07777;
+    }
+
+    static uint64_t counter(const char *name)
+    {
+        for (auto const &m : perf::snapshot()) {
+            if (m.name == name) {
+                return m.count;
+            }
+        }
+        return 0;
+    }
+};
+
+TEST_F(ChmodTest, ChmodTree)
+{
+    std::string tree = _dir + "/tree";
+    create_tree(tree, 2);
+
+    ASSERT_TRUE(util::chmod(tree, 0750, ChmodFlag::Recursive));
+
+    ASSERT_EQ(mode(tree), 0750u);
+    ASSERT_EQ(mode(tree + "/file0"), 0750u);
+    ASSERT_EQ(mode(tree + "/dir3"), 0750u);
+    ASSERT_EQ(mode(tree + "/dir3/dir1/file2"), 0750u);
+}
+
+TEST_F(ChmodTest, ChmodTreeParallel)
+{
+    std::string tree = _dir + "/tree";
+    create_tree(tree, 3);
+
+    ASSERT_TRUE(util::chmod(tree, 0755, ChmodFlag::Recursive
+                                      | ChmodFlag::Parallel));
+
+    ASSERT_EQ(mode(tree), 0755u);
+    ASSERT_EQ(mode(tree + "/dir0/dir1/dir2/file3"), 0755u);
+    ASSERT_EQ(mode(tree + "/dir3/dir2/dir1"), 0755u);
+}
+
+TEST_F(ChmodTest, ChmodRemovingSearchPermission)
+{
+    if (geteuid() == 0) {
+        GTEST_SKIP() << "Permissions are not enforced for root";
+    }
+
+    // Directories must be changed after their contents
+    std::string tree = _dir + "/tree";
+    create_tree(tree, 2);
+
+    ASSERT_TRUE(util::chmod(tree, 0600, ChmodFlag::Recursive
+                                      | ChmodFlag::Parallel));
+    ASSERT_EQ(::chmod(tree.c_str(), 0700), 0);
+    ASSERT_EQ(mode(tree + "/dir1"), 0600u);
+}
+
+TEST_F(ChmodTest, ChmodSkipsUnchangedEntries)
+{
+    std::string tree = _dir + "/tree";
+    create_tree(tree, 1);
+
+    ASSERT_TRUE(util::chmod(tree, 0700, ChmodFlag::Recursive));
+    ASSERT_EQ(::chmod((tree + "/dir2/file1").c_str(), 0644), 0);
+
+    auto changed = counter("util.tree_attrs.changed");
+    auto unchanged = counter("util.tree_attrs.unchanged");
+
+    ASSERT_TRUE(util::chmod(tree, 0700, ChmodFlag::Recursive));
+
+    // 5 directories and 20 files, with symlinks not counted
+    ASSERT_EQ(counter("util.tree_attrs.changed") - changed, 1u);
+    ASSERT_EQ(counter("util.tree_attrs.unchanged") - unchanged, 24u);
+    ASSERT_EQ(mode(tree + "/dir2/file1"), 0700u);
+}
+
+TEST_F(ChmodTest, ChmodDoesNotFollowSymlinks)
+{
+    std::string tree = _dir + "/tree";
+    create_tree(tree, 0);
+    ASSERT_EQ(symlink(tree.c_str(), (_dir + "/link").c_str()), 0);
+
+    ASSERT_TRUE(util::chmod(_dir + "/link", 0750, ChmodFlag::Recursive));
+    ASSERT_EQ(mode(tree), 0700u);
+    ASSERT_EQ(mode(tree + "/file0"), 0600u);
+}
+
+TEST_F(ChmodTest, ChmodMissingPath)
+{
+    auto ret = util::chmod(_dir + "/missing", 0700, ChmodFlag::Recursive);
+    ASSERT_FALSE(ret);
+    ASSERT_EQ(ret.error(), std::errc::no_such_file_or_directory);
+}
@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "mbutil/chown.h"
+
+#include "temp_dir_test.h"
+
+using namespace mb;
+using namespace mb::util;
+
+class ChownTest : public TemporaryDirTest
+{
+protected:
+    static void create_tree(const std::string &path, int depth)
+    {
+        ASSERT_EQ(mkdir(path.c_str(), 0700), 0);
+
+        create_file(path + "/file");
+        ASSERT_EQ(symlink("file", (path + "/link").c_str()), 0);
+
+        if (depth > 0) {
+            for (int i = 0; i < 4; ++i) {
+                create_tree(path + "/dir" + std::to_string(i), depth - 1);
+            }
+        }
+    }
+
+    static struct stat lstat_path(const std::string &path)
+    {
+        struct stat sb{};
+        EXPECT_EQ(lstat(path.c_str(), &sb), 0);
+        return sb;
+    }
+};
+
+TEST_F(ChownTest, ChownTreeParallel)
+{
+    std::string tree = _dir + "/tree";
+    create_tree(tree, 3);
+
+    // Changing to the current owner is always permitted. When running as
+    // root, change everything to another owner instead.
+    uid_t uid = geteuid() == 0 ? 1234 : geteuid();
+    gid_t gid = geteuid() == 0 ? 5678 : getegid();
+
+    ASSERT_TRUE(util::chown(tree, uid, gid, ChownFlag::Recursive
+                                          | ChownFlag::Parallel));
+
+    for (auto const &path : {
+        tree,
+        tree + "/file",
+        tree + "/link",
+        tree + "/dir2/dir0/dir3",
+        tree + "/dir2/dir0/dir3/file",
+    }) {
+        auto sb = lstat_path(path);
+        ASSERT_EQ(sb.st_uid, uid) << path;
+        ASSERT_EQ(sb.st_gid, gid) << path;
+    }
+}
+
+TEST_F(ChownTest, ChownKeepsMode)
+{
+    std::string tree = _dir + "/tree";
+    create_tree(tree, 1);
+    ASSERT_EQ(::chmod((tree + "/dir1/file").c_str(), 0640), 0);
+
+    ASSERT_TRUE(util::chown(tree, geteuid(), getegid(),
+                            ChownFlag::Recursive));
+
+    ASSERT_EQ(lstat_path(tree + "/dir1/file").st_mode & 07777, 0640u);
+}
+
+TEST_F(ChownTest, ChownMissingPath)
+{
+    auto ret = util::chown(_dir + "/missing", geteuid(), getegid(),
+                           ChownFlag::Recursive);
+    ASSERT_FALSE(ret);
+    ASSERT_EQ(ret.error(), std::errc::no_such_file_or_directory);
+}
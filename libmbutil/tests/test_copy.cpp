@@ -0,0 +1,415 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/xattr.h>
+#include <unistd.h>
+
+#include "mbcommon/finally.h"
+
+#include "mbutil/copy.h"
+
+#include "temp_dir_test.h"
+
+using namespace mb;
+using namespace mb::util;
+
+class CopyTest : public TemporaryDirTest
+{
+protected:
+    void SetUp() override
+    {
+        TemporaryDirTest::SetUp();
+
+        _fd_source = open((_dir + "/source").c_str(),
+                          O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+        ASSERT_GE(_fd_source, 0);
+        _fd_target = open((_dir + "/target").c_str(),
+                          O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+        ASSERT_GE(_fd_target, 0);
+    }
+
+    void TearDown() override
+    {
+        if (_fd_source >= 0) {
+            close(_fd_source);
+        }
+        if (_fd_target >= 0) {
+            close(_fd_target);
+        }
+        TemporaryDirTest::TearDown();
+    }
+
+    static std::vector<char> read_all(int fd)
+    {
+        std::vector<char> data;
+        char buf[4096];
+        ssize_t n;
+
+        EXPECT_EQ(lseek(fd, 0, SEEK_SET), 0);
+
+        while ((n = read(fd, buf, sizeof(buf))) > 0) {
+            data.insert(data.end(), buf, buf + n);
+        }
+        EXPECT_EQ(n, 0);
+
+        return data;
+    }
+
+    static void write_at(int fd, off_t offset, const std::string &data)
+    {
+        ASSERT_EQ(pwrite(fd, data.data(), data.size(), offset),
+                  static_cast<ssize_t>(data.size()));
+    }
+
+    int _fd_source = -1;
+    int _fd_target = -1;
+};
+
+TEST_F(CopyTest, CopyRegularFile)
+{
+    std::string data(3 * 1024 * 1024 + 123, '\0');
+    for (size_t i = 0; i < data.size(); ++i) {
+        data[i] = static_cast<char>(i * 7);
+    }
+    write_at(_fd_source, 0, data);
+
+    ASSERT_EQ(lseek(_fd_source, 0, SEEK_SET), 0);
+    ASSERT_TRUE(copy_data_fd(_fd_source, _fd_target));
+
+    // Both offsets must be at the end, like with read()/write()
+    ASSERT_EQ(lseek(_fd_source, 0, SEEK_CUR),
+              static_cast<off_t>(data.size()));
+    ASSERT_EQ(lseek(_fd_target, 0, SEEK_CUR),
+              static_cast<off_t>(data.size()));
+
+    auto result = read_all(_fd_target);
+    ASSERT_EQ(std::string(result.begin(), result.end()), data);
+}
+
+TEST_F(CopyTest, CopyFromCurrentOffsets)
+{
+    write_at(_fd_source, 0, "0123456789");
+    write_at(_fd_target, 0, "abc");
+
+    ASSERT_EQ(lseek(_fd_source, 4, SEEK_SET), 4);
+    ASSERT_EQ(lseek(_fd_target, 1, SEEK_SET), 1);
+    ASSERT_TRUE(copy_data_fd(_fd_source, _fd_target));
+
+    auto result = read_all(_fd_target);
+    ASSERT_EQ(std::string(result.begin(), result.end()), "a456789");
+}
+
+TEST_F(CopyTest, CopyPreservesHoles)
+{
+    constexpr off_t size = 64 * 1024 * 1024;
+
+    write_at(_fd_source, 0, "head");
+    write_at(_fd_source, size / 2, "middle");
+    ASSERT_EQ(ftruncate(_fd_source, size), 0);
+
+    ASSERT_TRUE(copy_data_fd(_fd_source, _fd_target));
+
+    struct stat sb;
+    ASSERT_EQ(fstat(_fd_target, &sb), 0);
+    ASSERT_EQ(sb.st_size, size);
+
+    // Allow for filesystems without hole support, which allocate everything
+    struct stat sb_source;
+    ASSERT_EQ(fstat(_fd_source, &sb_source), 0);
+    if (sb_source.st_blocks * 512 < size) {
+        ASSERT_LT(sb.st_blocks * 512, size);
+    }
+
+    auto result = read_all(_fd_target);
+    ASSERT_EQ(result.size(), static_cast<size_t>(size));
+    ASSERT_EQ(std::string(result.data(), 4), "head");
+    ASSERT_EQ(std::string(result.data() + size / 2, 6), "middle");
+    ASSERT_EQ(result[size - 1], '\0');
+}
+
+TEST_F(CopyTest, CopyReportsProgress)
+{
+    constexpr off_t size = 32 * 1024 * 1024;
+
+    write_at(_fd_source, 0, "head");
+    write_at(_fd_source, size - 4, "tail");
+
+    CopyProgress progress;
+    ASSERT_TRUE(copy_data_fd(_fd_source, _fd_target, &progress));
+
+    // Holes count as copied so that the total matches the file size
+    ASSERT_EQ(progress.bytes, static_cast<uint64_t>(size));
+}
+
+TEST_F(CopyTest, CancelledCopyFails)
+{
+    write_at(_fd_source, 0, "0123456789");
+
+    CopyProgress progress;
+    progress.cancelled = true;
+
+    auto ret = copy_data_fd(_fd_source, _fd_target, &progress);
+    ASSERT_FALSE(ret);
+    ASSERT_EQ(ret.error(), std::errc::operation_canceled);
+}
+
+TEST_F(CopyTest, CopyOverwritesExistingDataWithHoles)
+{
+    constexpr off_t size = 1024 * 1024;
+
+    write_at(_fd_source, size / 2, "data");
+    ASSERT_EQ(ftruncate(_fd_source, size), 0);
+    write_at(_fd_target, 0, std::string(size + 10, 'x'));
+
+    ASSERT_TRUE(copy_data_fd(_fd_source, _fd_target));
+    ASSERT_EQ(lseek(_fd_target, 0, SEEK_CUR), size);
+
+    // Data past the end of the source is left alone, like with write()
+    auto result = read_all(_fd_target);
+    std::string expected(size, '\0');
+    expected.replace(size / 2, 4, "data");
+    expected += std::string(10, 'x');
+    ASSERT_EQ(std::string(result.begin(), result.end()), expected);
+}
+
+TEST_F(CopyTest, CopyFromPipe)
+{
+    int pipe_fds[2];
+    ASSERT_EQ(pipe(pipe_fds), 0);
+
+    auto close_read_end = finally([&] {
+        close(pipe_fds[0]);
+    });
+
+    constexpr char data[] = "Hello, world!";
+    ASSERT_EQ(write(pipe_fds[1], data, sizeof(data) - 1),
+              static_cast<ssize_t>(sizeof(data) - 1));
+    close(pipe_fds[1]);
+
+    ASSERT_TRUE(copy_data_fd(pipe_fds[0], _fd_target));
+
+    auto result = read_all(_fd_target);
+    ASSERT_EQ(std::string(result.begin(), result.end()), data);
+}
+
+TEST_F(CopyTest, CopyXattrsFd)
+{
+    // Larger than the initial buffers to test that they are grown
+    std::string large_value(1000, 'v');
+
+    if (fsetxattr(_fd_source, "user.small", "1", 1, 0) < 0) {
+        GTEST_SKIP() << "user xattrs not supported: " << strerror(errno);
+    }
+    ASSERT_EQ(fsetxattr(_fd_source, "user.large", large_value.data(),
+                        large_value.size(), 0), 0);
+    for (int i = 0; i < 30; ++i) {
+        auto name = "user.attribute_with_a_long_name_" + std::to_string(i);
+        ASSERT_EQ(fsetxattr(_fd_source, name.c_str(), "x", 1, 0), 0);
+    }
+
+    ASSERT_TRUE(copy_xattrs_fd(_fd_source, _fd_target));
+
+    char buf[8192];
+    ASSERT_EQ(fgetxattr(_fd_target, "user.small", buf, sizeof(buf)), 1);
+    ASSERT_EQ(buf[0], '1');
+    ASSERT_EQ(fgetxattr(_fd_target, "user.large", buf, sizeof(buf)),
+              static_cast<ssize_t>(large_value.size()));
+    ASSERT_EQ(std::string(buf, large_value.size()), large_value);
+    ASSERT_EQ(fgetxattr(_fd_target, "user.attribute_with_a_long_name_29",
+                        buf, sizeof(buf)), 1);
+}
+
+TEST_F(CopyTest, ParallelCopyDir)
+{
+    auto source = _dir + "/tree";
+    auto target = _dir + "/copy";
+
+    ASSERT_EQ(mkdir(source.c_str(), 0755), 0);
+    ASSERT_EQ(mkdir(target.c_str(), 0755), 0);
+
+    for (int i = 0; i < 8; ++i) {
+        auto subdir = source + "/dir" + std::to_string(i);
+        ASSERT_EQ(mkdir(subdir.c_str(), 0755), 0);
+
+        for (int j = 0; j < 50; ++j) {
+            auto path = subdir + "/file" + std::to_string(j);
+            int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+            ASSERT_GE(fd, 0);
+            write_at(fd, 0, path);
+            close(fd);
+        }
+
+        // Must only be applied after the files inside have been copied
+        ASSERT_EQ(chmod(subdir.c_str(), 0555), 0);
+    }
+
+    auto restore_modes = finally([&] {
+        for (int i = 0; i < 8; ++i) {
+            auto suffix = "/dir" + std::to_string(i);
+            chmod((source + suffix).c_str(), 0755);
+            chmod((target + suffix).c_str(), 0755);
+        }
+    });
+
+    ASSERT_TRUE(copy_dir(source, target, CopyFlag::CopyAttributes
+                                       | CopyFlag::ExcludeTopLevel
+                                       | CopyFlag::Parallel));
+
+    for (int i = 0; i < 8; ++i) {
+        auto suffix = "/dir" + std::to_string(i);
+
+        struct stat sb;
+        ASSERT_EQ(stat((target + suffix).c_str(), &sb), 0);
+        ASSERT_EQ(sb.st_mode & 0777, 0555u);
+
+        for (int j = 0; j < 50; ++j) {
+            auto file_suffix = suffix + "/file" + std::to_string(j);
+
+            int fd = open((target + file_suffix).c_str(), O_RDONLY | O_CLOEXEC);
+            ASSERT_GE(fd, 0);
+            auto data = read_all(fd);
+            close(fd);
+
+            ASSERT_EQ(std::string(data.begin(), data.end()),
+                      source + file_suffix);
+        }
+    }
+}
+
+TEST_F(CopyTest, CopyDirCountsFiles)
+{
+    auto source = _dir + "/tree";
+    auto target = _dir + "/copy";
+
+    ASSERT_EQ(mkdir(source.c_str(), 0755), 0);
+
+    for (int i = 0; i < 20; ++i) {
+        auto path = source + "/file" + std::to_string(i);
+        int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+        ASSERT_GE(fd, 0);
+        write_at(fd, 0, "0123456789");
+        close(fd);
+    }
+
+    CopyProgress progress;
+    ASSERT_TRUE(copy_dir(source, target, CopyFlag::ExcludeTopLevel
+                                       | CopyFlag::Parallel, &progress));
+
+    ASSERT_EQ(progress.files, 20u);
+    ASSERT_EQ(progress.bytes, 200u);
+}
+
+TEST_F(CopyTest, CopyFilesReplacesTargets)
+{
+    std::vector<std::pair<std::string, std::string>> files;
+
+    for (int i = 0; i < 20; ++i) {
+        auto source = _dir + "/source" + std::to_string(i);
+        auto target = _dir + "/target" + std::to_string(i);
+
+        int fd = open(source.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+        ASSERT_GE(fd, 0);
+        write_at(fd, 0, source);
+        close(fd);
+
+        fd = open(target.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+        ASSERT_GE(fd, 0);
+        write_at(fd, 0, "old");
+        close(fd);
+
+        ASSERT_EQ(chmod(source.c_str(), 0600), 0);
+
+        files.emplace_back(std::move(source), std::move(target));
+    }
+
+    CopyProgress progress;
+    ASSERT_TRUE(copy_files(files, CopyFlag::CopyAttributes
+                                | CopyFlag::Parallel, &progress));
+
+    ASSERT_EQ(progress.files, 20u);
+
+    for (auto const &[source, target] : files) {
+        int fd = open(target.c_str(), O_RDONLY | O_CLOEXEC);
+        ASSERT_GE(fd, 0);
+        auto data = read_all(fd);
+        close(fd);
+
+        ASSERT_EQ(std::string(data.begin(), data.end()), source);
+
+        struct stat sb;
+        ASSERT_EQ(stat(target.c_str(), &sb), 0);
+        ASSERT_EQ(sb.st_mode & 0777, 0600u);
+    }
+}
+
+TEST_F(CopyTest, LinkIdenticalDeduplicatesTargets)
+{
+    auto source = _dir + "/tree";
+    auto target = _dir + "/copy";
+
+    ASSERT_EQ(mkdir(source.c_str(), 0755), 0);
+    ASSERT_EQ(mkdir(target.c_str(), 0755), 0);
+
+    auto create = [&](const std::string &path, const std::string &data) {
+        int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                      0644);
+        ASSERT_GE(fd, 0);
+        write_at(fd, 0, data);
+        close(fd);
+    };
+
+    create(source + "/same", "identical");
+    create(target + "/same", "identical");
+    create(source + "/different", "new data");
+    create(target + "/different", "old data");
+    create(source + "/missing", "missing");
+
+    CopyProgress progress;
+    ASSERT_TRUE(copy_dir(source, target, CopyFlag::ExcludeTopLevel
+                                       | CopyFlag::LinkIdentical, &progress));
+
+    ASSERT_EQ(progress.files, 3u);
+
+    auto inode = [](const std::string &path) {
+        struct stat sb;
+        EXPECT_EQ(lstat(path.c_str(), &sb), 0);
+        return sb.st_ino;
+    };
+
+    ASSERT_EQ(inode(source + "/same"), inode(target + "/same"));
+    ASSERT_NE(inode(source + "/different"), inode(target + "/different"));
+    ASSERT_NE(inode(source + "/missing"), inode(target + "/missing"));
+    ASSERT_NE(access((target + "/same.mblink").c_str(), F_OK), 0);
+
+    int fd = open((target + "/different").c_str(), O_RDONLY | O_CLOEXEC);
+    ASSERT_GE(fd, 0);
+    auto data = read_all(fd);
+    close(fd);
+
+    ASSERT_EQ(std::string(data.begin(), data.end()), "new data");
+}
@@ -0,0 +1,382 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <map>
+#include <memory>
+#include <string>
+
+#include <cstdlib>
+
+#include <sys/stat.h>
+
+#include <archive.h>
+#include <archive_entry.h>
+
+#include "mbcommon/file/memory.h"
+#include "mbcommon/file_error.h"
+
+#include "mbutil/cpio.h"
+
+using namespace mb;
+using namespace mb::util;
+
+using ScopedArchive = std::unique_ptr<archive, decltype(archive_free) *>;
+using ScopedArchiveEntry =
+        std::unique_ptr<archive_entry, decltype(archive_entry_free) *>;
+
+struct LaEntry
+{
+    unsigned int mode;
+    std::string data;
+    std::string symlink;
+};
+
+// Read an archive with libarchive to check that it's readable by other tools
+static std::map<std::string, LaEntry> read_with_libarchive(
+        const std::string &data)
+{
+    std::map<std::string, LaEntry> result;
+
+    ScopedArchive a(archive_read_new(), &archive_read_free);
+    EXPECT_TRUE(a);
+    archive_read_support_format_cpio(a.get());
+    EXPECT_EQ(archive_read_open_memory(a.get(), data.data(), data.size()),
+              ARCHIVE_OK);
+
+    archive_entry *entry;
+    while (archive_read_next_header(a.get(), &entry) == ARCHIVE_OK) {
+        LaEntry &le = result[archive_entry_pathname(entry)];
+        le.mode = archive_entry_mode(entry);
+        if (auto target = archive_entry_symlink(entry)) {
+            le.symlink = target;
+        }
+
+        char buf[1024];
+        la_ssize_t n;
+        while ((n = archive_read_data(a.get(), buf, sizeof(buf))) > 0) {
+            le.data.append(buf, static_cast<size_t>(n));
+        }
+        EXPECT_GE(n, 0);
+
+        // libarchive only returns the data with the link that stores it
+        if (auto target = archive_entry_hardlink(entry)) {
+            auto &other = result[target];
+            if (le.data.empty()) {
+                le.data = other.data;
+            } else {
+                other.data = le.data;
+            }
+        }
+    }
+
+    return result;
+}
+
+class CpioTest : public ::testing::Test
+{
+protected:
+    void TearDown() override
+    {
+        free(_buf);
+    }
+
+    std::string save(const CpioArchive &archive, CpioFormat format)
+    {
+        MemoryFile file(&_buf, &_size);
+        EXPECT_TRUE(archive.save(file, format));
+        EXPECT_TRUE(file.close());
+
+        return std::string(static_cast<char *>(_buf), _size);
+    }
+
+    std::string write_with_libarchive(int format, bool hardlink)
+    {
+        std::string out;
+
+        ScopedArchive a(archive_write_new(), &archive_write_free);
+        EXPECT_TRUE(a);
+        EXPECT_EQ(archive_write_set_format(a.get(), format), ARCHIVE_OK);
+        archive_write_set_bytes_in_last_block(a.get(), 1);
+        EXPECT_EQ(archive_write_open(a.get(), &out, nullptr,
+                                     [](archive *, void *userdata,
+                                        const void *buf, size_t size) {
+            static_cast<std::string *>(userdata)->append(
+                    static_cast<const char *>(buf), size);
+            return static_cast<la_ssize_t>(size);
+        }, nullptr), ARCHIVE_OK);
+
+        ScopedArchiveEntry entry(archive_entry_new(), &archive_entry_free);
+        EXPECT_TRUE(entry);
+
+        auto add = [&](const char *path, unsigned int mode,
+                       const std::string &data, unsigned int nlink,
+                       la_int64_t ino) {
+            archive_entry_clear(entry.get());
+            archive_entry_set_pathname(entry.get(), path);
+            archive_entry_set_mode(entry.get(), mode);
+            archive_entry_set_nlink(entry.get(), nlink);
+            archive_entry_set_ino(entry.get(), ino);
+            archive_entry_set_mtime(entry.get(), 1000000000, 0);
+            archive_entry_set_size(entry.get(),
+                                   static_cast<la_int64_t>(data.size()));
+            EXPECT_EQ(archive_write_header(a.get(), entry.get()), ARCHIVE_OK);
+            if (!data.empty()) {
+                EXPECT_EQ(archive_write_data(a.get(), data.data(),
+                                             data.size()),
+                          static_cast<la_ssize_t>(data.size()));
+            }
+        };
+
+        add("sbin", S_IFDIR | 0755, {}, 2, 10);
+        add("sbin/foo", S_IFREG | 0750, "foo contents", hardlink ? 2 : 1, 11);
+        add("sbin/bar", S_IFREG | 0644, "bar", 1, 12);
+        if (hardlink) {
+            // Data is stored with the first link
+            add("sbin/foo2", S_IFREG | 0750, {}, 2, 11);
+        }
+
+        EXPECT_EQ(archive_write_close(a.get()), ARCHIVE_OK);
+
+        return out;
+    }
+
+    void *_buf = nullptr;
+    size_t _size = 0;
+};
+
+TEST_F(CpioTest, RoundTripNewc)
+{
+    CpioArchive archive;
+    archive.add_file("sbin/foo", "foo contents", 0750);
+    archive.add_file("init.rc", std::string(1021, 'x'), 0640);
+    archive.add_symlink("init", "sbin/foo");
+
+    auto data = save(archive, CpioFormat::Newc);
+    ASSERT_EQ(data.compare(0, 6, "070701"), 0);
+
+    MemoryFile file(data.data(), data.size());
+    CpioArchive loaded;
+    ASSERT_TRUE(loaded.load(file));
+
+    ASSERT_EQ(loaded.format(), CpioFormat::Newc);
+    ASSERT_EQ(loaded.paths(), (std::vector<std::string>{
+        "init", "init.rc", "sbin", "sbin/foo"
+    }));
+
+    auto entry = loaded.find("sbin/foo");
+    ASSERT_TRUE(entry);
+    ASSERT_EQ(entry->mode, static_cast<uint32_t>(S_IFREG | 0750));
+    ASSERT_EQ(*entry->data, "foo contents");
+
+    ASSERT_TRUE(S_ISDIR(loaded.find("sbin")->mode));
+    ASSERT_EQ(*loaded.find("init.rc")->data, std::string(1021, 'x'));
+    ASSERT_EQ(loaded.read_link("init"), std::optional<std::string>("sbin/foo"));
+    ASSERT_FALSE(loaded.read_link("init.rc"));
+
+    auto la = read_with_libarchive(data);
+    ASSERT_EQ(la.size(), 4u);
+    ASSERT_EQ(la["sbin/foo"].data, "foo contents");
+    ASSERT_EQ(la["init"].symlink, "sbin/foo");
+}
+
+TEST_F(CpioTest, RoundTripOdcAndCrc)
+{
+    for (auto format : { CpioFormat::Odc, CpioFormat::Crc }) {
+        CpioArchive archive;
+        archive.add_file("a/b/c", "abc", 0644);
+
+        auto data = save(archive, format);
+
+        MemoryFile file(data.data(), data.size());
+        CpioArchive loaded;
+        ASSERT_TRUE(loaded.load(file));
+        ASSERT_EQ(loaded.format(), format);
+        ASSERT_EQ(loaded.size(), 3u);
+        ASSERT_EQ(*loaded.find("a/b/c")->data, "abc");
+
+        auto la = read_with_libarchive(data);
+        ASSERT_EQ(la["a/b/c"].data, "abc");
+
+        free(_buf);
+        _buf = nullptr;
+        _size = 0;
+    }
+}
+
+TEST_F(CpioTest, LoadLibarchiveHardlinks)
+{
+    for (auto format : { ARCHIVE_FORMAT_CPIO_SVR4_NOCRC,
+                         ARCHIVE_FORMAT_CPIO_POSIX }) {
+        auto data = write_with_libarchive(format, true);
+
+        MemoryFile file(data.data(), data.size());
+        CpioArchive archive;
+        ASSERT_TRUE(archive.load(file));
+
+        auto foo = archive.find("sbin/foo");
+        auto foo2 = archive.find("sbin/foo2");
+        ASSERT_TRUE(foo);
+        ASSERT_TRUE(foo2);
+        ASSERT_EQ(foo->data, foo2->data);
+        ASSERT_EQ(*foo->data, "foo contents");
+        ASSERT_EQ(*archive.find("sbin/bar")->data, "bar");
+
+        // Editing one link must not affect the other
+        *archive.edit("sbin/foo2") = "new";
+        ASSERT_EQ(*archive.find("sbin/foo")->data, "foo contents");
+        ASSERT_EQ(*archive.find("sbin/foo2")->data, "new");
+    }
+}
+
+TEST_F(CpioTest, SaveHardlinks)
+{
+    CpioArchive archive;
+    archive.add_file("foo", "contents", 0644);
+    auto entry = *archive.find("foo");
+    archive.insert("bar", entry);
+
+    auto data = save(archive, CpioFormat::Newc);
+
+    // The data should only be stored once
+    ASSERT_EQ(data.find("contents"), data.rfind("contents"));
+
+    auto la = read_with_libarchive(data);
+    ASSERT_EQ(la["foo"].data, "contents");
+    ASSERT_EQ(la["bar"].data, "contents");
+
+    MemoryFile file(data.data(), data.size());
+    CpioArchive loaded;
+    ASSERT_TRUE(loaded.load(file));
+    ASSERT_EQ(loaded.find("foo")->data, loaded.find("bar")->data);
+    ASSERT_EQ(*loaded.find("foo")->data, "contents");
+}
+
+TEST_F(CpioTest, StreamingReadSkipsUnreadData)
+{
+    auto data = write_with_libarchive(ARCHIVE_FORMAT_CPIO_SVR4_NOCRC, false);
+
+    MemoryFile file(data.data(), data.size());
+    CpioReader reader(file);
+    CpioHeader header;
+
+    ASSERT_EQ(reader.next_header(header), oc::success(true));
+    ASSERT_EQ(header.path, "sbin");
+    ASSERT_EQ(reader.format(), CpioFormat::Newc);
+
+    ASSERT_EQ(reader.next_header(header), oc::success(true));
+    ASSERT_EQ(header.path, "sbin/foo");
+    ASSERT_EQ(header.size, 12u);
+    ASSERT_EQ(header.mtime, 1000000000);
+
+    char buf[3];
+    ASSERT_EQ(reader.read_data(buf, sizeof(buf)), oc::success(3u));
+    ASSERT_EQ(std::string(buf, 3), "foo");
+
+    ASSERT_EQ(reader.next_header(header), oc::success(true));
+    ASSERT_EQ(header.path, "sbin/bar");
+    ASSERT_EQ(reader.read_data_all(), oc::success(std::string("bar")));
+    ASSERT_EQ(reader.read_data(buf, sizeof(buf)), oc::success(0u));
+
+    ASSERT_EQ(reader.next_header(header), oc::success(false));
+    ASSERT_EQ(reader.next_header(header), oc::success(false));
+}
+
+TEST_F(CpioTest, RejectMalformedArchives)
+{
+    CpioArchive archive;
+    archive.add_file("foo", "contents", 0644);
+
+    auto data = save(archive, CpioFormat::Crc);
+
+    // Truncated
+    {
+        MemoryFile file(data.data(), data.size() - 20);
+        CpioArchive loaded;
+        auto ret = loaded.load(file);
+        ASSERT_FALSE(ret);
+        ASSERT_EQ(ret.error(), FileError::UnexpectedEof);
+    }
+
+    // Truncated in the middle of data that is skipped
+    {
+        auto newc = save(archive, CpioFormat::Newc);
+        newc.resize(newc.find("contents") + 4);
+
+        MemoryFile file(newc.data(), newc.size());
+        CpioReader reader(file);
+        CpioHeader header;
+
+        ASSERT_EQ(reader.next_header(header), oc::success(true));
+        ASSERT_EQ(header.path, "foo");
+        auto ret = reader.next_header(header);
+        ASSERT_FALSE(ret);
+        ASSERT_EQ(ret.error(), FileError::UnexpectedEof);
+    }
+
+    // Bad checksum
+    {
+        auto corrupt = data;
+        corrupt[corrupt.find("contents")] = 'C';
+
+        MemoryFile file(corrupt.data(), corrupt.size());
+        CpioArchive loaded;
+        auto ret = loaded.load(file);
+        ASSERT_FALSE(ret);
+        ASSERT_EQ(ret.error(), std::errc::bad_message);
+    }
+
+    // Bad magic
+    {
+        auto corrupt = data;
+        corrupt[0] = 'x';
+
+        MemoryFile file(corrupt.data(), corrupt.size());
+        CpioArchive loaded;
+        auto ret = loaded.load(file);
+        ASSERT_FALSE(ret);
+        ASSERT_EQ(ret.error(), std::errc::bad_message);
+    }
+}
+
+TEST_F(CpioTest, NormalizePaths)
+{
+    ASSERT_EQ(CpioArchive::normalize_path("/foo"), "foo");
+    ASSERT_EQ(CpioArchive::normalize_path("./foo/bar"), "foo/bar");
+    ASSERT_EQ(CpioArchive::normalize_path(".//./foo"), "foo");
+    ASSERT_EQ(CpioArchive::normalize_path("./"), ".");
+    ASSERT_EQ(CpioArchive::normalize_path("."), ".");
+}
+
+TEST_F(CpioTest, RenameAndRemove)
+{
+    CpioArchive archive;
+    archive.add_file("init", "init", 0750);
+
+    ASSERT_TRUE(archive.rename("init", "sbin/init.real"));
+    ASSERT_FALSE(archive.find("init"));
+    ASSERT_TRUE(archive.find("sbin"));
+    ASSERT_EQ(*archive.find("sbin/init.real")->data, "init");
+
+    ASSERT_TRUE(archive.remove("sbin/init.real"));
+    ASSERT_FALSE(archive.remove("sbin/init.real"));
+    ASSERT_FALSE(archive.rename("missing", "foo"));
+    ASSERT_EQ(archive.size(), 1u);
+}
@@ -0,0 +1,142 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+#include <cerrno>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "mbutil/delete.h"
+
+#include "temp_dir_test.h"
+
+using namespace mb;
+using namespace mb::util;
+
+class DeleteTest : public TemporaryDirTest
+{
+protected:
+    // Create a tree that is wide and deep enough to use every worker thread
+    // and to overflow the job queue
+    static void create_tree(const std::string &path, int depth)
+    {
+        ASSERT_EQ(mkdir(path.c_str(), 0700), 0);
+
+        for (int i = 0; i < 8; ++i) {
+            create_file(path + "/file" + std::to_string(i));
+        }
+        ASSERT_EQ(symlink("file0", (path + "/link").c_str()), 0);
+
+        if (depth > 0) {
+            for (int i = 0; i < 6; ++i) {
+                create_tree(path + "/dir" + std::to_string(i), depth - 1);
+            }
+        }
+    }
+
+    static bool exists(const std::string &path)
+    {
+        struct stat sb;
+        return lstat(path.c_str(), &sb) == 0;
+    }
+};
+
+TEST_F(DeleteTest, DeleteTree)
+{
+    std::string tree = _dir + "/tree";
+    create_tree(tree, 3);
+
+    ASSERT_TRUE(delete_recursive(tree));
+    ASSERT_FALSE(exists(tree));
+}
+
+TEST_F(DeleteTest, DeleteTreeParallel)
+{
+    std::string tree = _dir + "/tree";
+    create_tree(tree, 4);
+
+    ASSERT_TRUE(delete_recursive(tree, DeleteFlag::Parallel));
+    ASSERT_FALSE(exists(tree));
+}
+
+TEST_F(DeleteTest, DeleteDoesNotFollowSymlinks)
+{
+    std::string tree = _dir + "/tree";
+    create_tree(tree, 1);
+    ASSERT_EQ(symlink(tree.c_str(), (_dir + "/link").c_str()), 0);
+
+    ASSERT_TRUE(delete_recursive(_dir + "/link", DeleteFlag::Parallel));
+    ASSERT_FALSE(exists(_dir + "/link"));
+    ASSERT_TRUE(exists(tree + "/dir0/file0"));
+}
+
+TEST_F(DeleteTest, DeleteMissingPath)
+{
+    ASSERT_TRUE(delete_recursive(_dir + "/missing"));
+    ASSERT_TRUE(delete_contents(_dir + "/missing", {}));
+}
+
+TEST_F(DeleteTest, DeleteContentsKeepsExclusions)
+{
+    std::string tree = _dir + "/tree";
+    create_tree(tree, 2);
+
+    ASSERT_TRUE(delete_contents(tree, {"dir1", "file3"},
+                                DeleteFlag::Parallel));
+    ASSERT_TRUE(exists(tree));
+    ASSERT_TRUE(exists(tree + "/dir1/dir0/file0"));
+    ASSERT_TRUE(exists(tree + "/file3"));
+    ASSERT_FALSE(exists(tree + "/dir0"));
+    ASSERT_FALSE(exists(tree + "/file0"));
+    ASSERT_FALSE(exists(tree + "/link"));
+}
+
+TEST_F(DeleteTest, DeleteCountsEntries)
+{
+    std::string tree = _dir + "/tree";
+    create_tree(tree, 1);
+
+    // 9 entries in each of the 7 directories, plus the 6 subdirectories
+    DeleteProgress progress;
+    ASSERT_TRUE(delete_contents(tree, {}, DeleteFlag::Parallel, &progress));
+    ASSERT_EQ(progress.entries, 7u * 9u + 6u);
+    ASSERT_TRUE(exists(tree));
+}
+
+TEST_F(DeleteTest, DeleteReportsFirstFailure)
+{
+    if (geteuid() == 0) {
+        GTEST_SKIP() << "Permissions are not enforced for root";
+    }
+
+    std::string tree = _dir + "/tree";
+    create_tree(tree, 2);
+    ASSERT_EQ(chmod((tree + "/dir2").c_str(), 0500), 0);
+
+    auto ret = delete_recursive(tree, DeleteFlag::Parallel);
+    ASSERT_EQ(chmod((tree + "/dir2").c_str(), 0700), 0);
+
+    ASSERT_FALSE(ret);
+    ASSERT_EQ(ret.error().ec, std::errc::permission_denied);
+    ASSERT_EQ(ret.error().path.compare(0, tree.size() + 5, tree + "/dir2"), 0);
+}
@@ -0,0 +1,180 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <string>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "mbcommon/file/fd.h"
+#include "mbcommon/file_error.h"
+
+#include "mbutil/file.h"
+
+#include "temp_dir_test.h"
+
+using namespace mb;
+using namespace mb::util;
+
+class FileTest : public TemporaryDirTest
+{
+protected:
+    static std::string make_data(size_t size, char seed)
+    {
+        std::string data(size, '\0');
+        for (size_t i = 0; i < size; ++i) {
+            data[i] = static_cast<char>(seed + static_cast<char>(i * 7));
+        }
+        return data;
+    }
+};
+
+TEST_F(FileTest, WriteChangedDataCreatesFile)
+{
+    auto path = _dir + "/image";
+    auto data = make_data(10000, 1);
+
+    auto written = file_write_changed_data(path, data.data(), data.size());
+    ASSERT_TRUE(written);
+    ASSERT_EQ(written.value(), data.size());
+
+    auto contents = file_read_all(path);
+    ASSERT_TRUE(contents);
+    ASSERT_EQ(contents.value(), data);
+}
+
+TEST_F(FileTest, WriteChangedDataSkipsIdenticalBlocks)
+{
+    auto path = _dir + "/image";
+    auto data = make_data(3 * 1024 * 1024 + 123, 1);
+
+    ASSERT_TRUE(file_write_data(path, data.data(), data.size()));
+
+    // Identical data writes nothing
+    auto written = file_write_changed_data(path, data.data(), data.size());
+    ASSERT_TRUE(written);
+    ASSERT_EQ(written.value(), 0u);
+
+    // Change two bytes in separate 4 KiB blocks, one in the partial last block
+    data[5000] ^= 0x55;
+    data[data.size() - 1] ^= 0x55;
+
+    written = file_write_changed_data(path, data.data(), data.size());
+    ASSERT_TRUE(written);
+    ASSERT_EQ(written.value(), 4096u + (data.size() % 4096));
+
+    auto contents = file_read_all(path);
+    ASSERT_TRUE(contents);
+    ASSERT_EQ(contents.value(), data);
+}
+
+TEST_F(FileTest, WriteChangedDataTruncatesFile)
+{
+    auto path = _dir + "/image";
+    auto old_data = make_data(20000, 1);
+    auto data = old_data.substr(0, 5000);
+
+    ASSERT_TRUE(file_write_data(path, old_data.data(), old_data.size()));
+
+    auto written = file_write_changed_data(path, data.data(), data.size());
+    ASSERT_TRUE(written);
+    ASSERT_EQ(written.value(), 0u);
+
+    auto contents = file_read_all(path);
+    ASSERT_TRUE(contents);
+    ASSERT_EQ(contents.value(), data);
+}
+
+TEST_F(FileTest, WriteChangedDataFromFile)
+{
+    auto source_path = _dir + "/source";
+    auto path = _dir + "/image";
+    auto data = make_data(2 * 1024 * 1024 + 4567, 3);
+    auto old_data = data;
+    old_data[1024 * 1024 + 10] ^= 0x55;
+
+    ASSERT_TRUE(file_write_data(source_path, data.data(), data.size()));
+    ASSERT_TRUE(file_write_data(path, old_data.data(), old_data.size()));
+
+    // FdFile has no mapped_data(), so the chunks are read from the file
+    FdFile source;
+    ASSERT_TRUE(source.open(source_path, FileOpenMode::ReadOnly));
+
+    auto written = file_write_changed_data(path, source, data.size());
+    ASSERT_TRUE(written);
+    ASSERT_EQ(written.value(), 4096u);
+
+    auto contents = file_read_all(path);
+    ASSERT_TRUE(contents);
+    ASSERT_EQ(contents.value(), data);
+
+    ASSERT_EQ(file_write_changed_data(path, source, data.size() + 1),
+              oc::failure(FileError::UnexpectedEof));
+}
+
+TEST_F(FileTest, ZeroRangeKeepsSurroundingData)
+{
+    auto path = _dir + "/image";
+    auto data = make_data(3 * 1024 * 1024 + 123, 1);
+
+    ASSERT_TRUE(file_write_data(path, data.data(), data.size()));
+
+    for (auto flags : {ZeroRangeFlags(),
+                       ZeroRangeFlags(ZeroRangeFlag::Deallocate)}) {
+        int fd = open(path.c_str(), O_WRONLY | O_CLOEXEC);
+        ASSERT_GE(fd, 0);
+
+        // Unaligned on both ends
+        auto ret = zero_range(fd, 1000, 2 * 1024 * 1024 + 77, flags);
+        close(fd);
+        ASSERT_TRUE(ret) << ret.error().message();
+
+        std::fill_n(data.begin() + 1000, 2 * 1024 * 1024 + 77, '\0');
+
+        auto contents = file_read_all(path);
+        ASSERT_TRUE(contents);
+        ASSERT_EQ(contents.value(), data);
+    }
+}
+
+TEST_F(FileTest, ZeroRangeDoesNotExtendFile)
+{
+    auto path = _dir + "/image";
+    auto data = make_data(10000, 1);
+
+    ASSERT_TRUE(file_write_data(path, data.data(), data.size()));
+
+    int fd = open(path.c_str(), O_WRONLY | O_CLOEXEC);
+    ASSERT_GE(fd, 0);
+
+    auto ret = zero_range(fd, 9000, 5000);
+    auto ret2 = zero_range(fd, 20000, 5000);
+    close(fd);
+    ASSERT_TRUE(ret) << ret.error().message();
+    ASSERT_TRUE(ret2) << ret2.error().message();
+
+    std::fill(data.begin() + 9000, data.end(), '\0');
+
+    auto contents = file_read_all(path);
+    ASSERT_TRUE(contents);
+    ASSERT_EQ(contents.value(), data);
+}
@@ -0,0 +1,205 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include <fts.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "mbutil/fts.h"
+
+#include "temp_dir_test.h"
+
+using namespace mb;
+using namespace mb::util;
+
+class RecordingWalker : public FtsWrapper
+{
+public:
+    std::vector<std::string> visits;
+    std::string skip_name;
+
+    RecordingWalker(std::string path, FtsFlags flags)
+        : FtsWrapper(std::move(path), flags)
+    {
+    }
+
+    Actions on_reached_directory_pre() override
+    {
+        record("D");
+        return !skip_name.empty() && skip_name == _curr->fts_name
+                ? Action::Skip : Action::Ok;
+    }
+
+    Actions on_reached_directory_post() override
+    {
+        return record("DP");
+    }
+
+    Actions on_reached_file() override
+    {
+        return record("F");
+    }
+
+    Actions on_reached_symlink() override
+    {
+        return record("SL");
+    }
+
+    Actions on_reached_special_file() override
+    {
+        return record("S");
+    }
+
+private:
+    Actions record(const char *type)
+    {
+        EXPECT_STREQ(_curr->fts_path, _curr->fts_accpath);
+        EXPECT_STREQ(_root->fts_path, _path.c_str());
+
+        visits.push_back(std::string(type) + " "
+                + std::to_string(_curr->fts_level) + " "
+                + _curr->fts_path + " " + _curr->fts_name);
+        return Action::Ok;
+    }
+};
+
+class FtsTest : public TemporaryDirTest
+{
+protected:
+    void SetUp() override
+    {
+        TemporaryDirTest::SetUp();
+
+        ASSERT_EQ(mkdir((_dir + "/a").c_str(), 0755), 0);
+        ASSERT_EQ(mkdir((_dir + "/a/b").c_str(), 0755), 0);
+        ASSERT_EQ(mkdir((_dir + "/c").c_str(), 0755), 0);
+        create_file(_dir + "/file");
+        create_file(_dir + "/a/file");
+        create_file(_dir + "/a/b/file");
+        ASSERT_EQ(symlink("a", (_dir + "/link").c_str()), 0);
+        ASSERT_EQ(mkfifo((_dir + "/c/fifo").c_str(), 0644), 0);
+    }
+
+    // Traverse with the libc fts implementation for comparison
+    static std::vector<std::string> libc_fts(const std::string &path)
+    {
+        std::vector<std::string> visits;
+        char *paths[] = { const_cast<char *>(path.c_str()), nullptr };
+
+        FTS *ftsp = fts_open(paths, FTS_NOCHDIR | FTS_PHYSICAL | FTS_XDEV,
+                             nullptr);
+        EXPECT_TRUE(ftsp);
+
+        while (FTSENT *ent = fts_read(ftsp)) {
+            const char *type;
+            switch (ent->fts_info) {
+            case FTS_D: type = "D"; break;
+            case FTS_DP: type = "DP"; break;
+            case FTS_F: type = "F"; break;
+            case FTS_SL: type = "SL"; break;
+            default: type = "S"; break;
+            }
+
+            visits.push_back(std::string(type) + " "
+                    + std::to_string(ent->fts_level) + " "
+                    + ent->fts_path + " " + ent->fts_name);
+        }
+
+        fts_close(ftsp);
+
+        return visits;
+    }
+};
+
+TEST_F(FtsTest, MatchesLibcFts)
+{
+    for (auto const &path : {_dir, _dir + "/"}) {
+        RecordingWalker walker(path, FtsFlag::GroupSpecialFiles);
+        ASSERT_TRUE(walker.run());
+
+        auto expected = libc_fts(path);
+        ASSERT_EQ(walker.visits.size(), expected.size());
+
+        // Order within a directory depends on the filesystem
+        std::sort(walker.visits.begin(), walker.visits.end());
+        std::sort(expected.begin(), expected.end());
+        ASSERT_EQ(walker.visits, expected);
+    }
+}
+
+TEST_F(FtsTest, PostOrderAfterChildren)
+{
+    RecordingWalker walker(_dir, FtsFlag::GroupSpecialFiles);
+    ASSERT_TRUE(walker.run());
+
+    auto index_of = [&](const std::string &visit) {
+        auto it = std::find(walker.visits.begin(), walker.visits.end(), visit);
+        EXPECT_NE(it, walker.visits.end()) << visit;
+        return it - walker.visits.begin();
+    };
+
+    ASSERT_EQ(index_of("D 0 " + _dir + " " + _dir.substr(_dir.rfind('/') + 1)),
+              0);
+    ASSERT_LT(index_of("D 1 " + _dir + "/a a"),
+              index_of("F 3 " + _dir + "/a/b/file file"));
+    ASSERT_LT(index_of("F 3 " + _dir + "/a/b/file file"),
+              index_of("DP 2 " + _dir + "/a/b b"));
+    ASSERT_LT(index_of("DP 2 " + _dir + "/a/b b"),
+              index_of("DP 1 " + _dir + "/a a"));
+    ASSERT_EQ(walker.visits.back(),
+              "DP 0 " + _dir + " " + _dir.substr(_dir.rfind('/') + 1));
+}
+
+TEST_F(FtsTest, SkippedDirectoryHasPostOrderVisit)
+{
+    RecordingWalker walker(_dir, FtsFlag::GroupSpecialFiles);
+    walker.skip_name = "a";
+    ASSERT_TRUE(walker.run());
+
+    for (auto const &visit : walker.visits) {
+        ASSERT_EQ(visit.find(_dir + "/a/"), std::string::npos) << visit;
+    }
+    ASSERT_NE(std::find(walker.visits.begin(), walker.visits.end(),
+                        "DP 1 " + _dir + "/a a"), walker.visits.end());
+}
+
+TEST_F(FtsTest, NoStatUsesDirectoryEntryType)
+{
+    RecordingWalker walker(_dir, FtsFlag::GroupSpecialFiles
+                               | FtsFlag::NoStat);
+    ASSERT_TRUE(walker.run());
+
+    auto expected = libc_fts(_dir);
+    std::sort(walker.visits.begin(), walker.visits.end());
+    std::sort(expected.begin(), expected.end());
+    ASSERT_EQ(walker.visits, expected);
+}
+
+TEST_F(FtsTest, MissingRootFails)
+{
+    RecordingWalker walker(_dir + "/nonexistent", 0);
+    ASSERT_FALSE(walker.run());
+    ASSERT_TRUE(walker.visits.empty());
+}
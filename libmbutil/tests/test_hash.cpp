@@ -0,0 +1,254 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "mbcommon/file/fd.h"
+#include "mbcommon/file/memory.h"
+
+#include "mbutil/file.h"
+#include "mbutil/hash.h"
+#include "mbutil/hash_cache.h"
+#include "mbutil/string.h"
+
+#include "temp_dir_test.h"
+
+using namespace mb;
+using namespace mb::util;
+
+class HashTest : public TemporaryDirTest
+{
+protected:
+    std::string create_file(const std::string &name, const std::string &data)
+    {
+        std::string path = _dir + "/" + name;
+
+        int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC,
+                      0600);
+        EXPECT_GE(fd, 0);
+        EXPECT_EQ(write(fd, data.data(), data.size()),
+                  static_cast<ssize_t>(data.size()));
+        close(fd);
+
+        return path;
+    }
+
+    static std::string hex(const Sha512Digest &digest)
+    {
+        return hex_string(digest.data(), digest.size());
+    }
+};
+
+static constexpr char EMPTY_SHA512[] =
+        "cf83e1357eefb8bdf1542850d66d8007d620e4050b5715dc83f4a921d36ce9ce"
+        "47d0d13c5d85f2b0ff8318d2877eec2f63b931bd47417a81a538327af927da3e";
+static constexpr char ABC_SHA512[] =
+        "ddaf35a193617abacc417349ae20413112e6fa4e89a97ea20a9eeee64b55d39a"
+        "2192992a274fc1a836ba3c23a3feebbd454d4423643ce80e2a9ac94fa54ca49f";
+
+TEST_F(HashTest, HashFile)
+{
+    auto empty = sha512_hash(create_file("empty", ""));
+    ASSERT_TRUE(empty);
+    ASSERT_EQ(hex(empty.value()), EMPTY_SHA512);
+
+    auto abc = sha512_hash(create_file("abc", "abc"));
+    ASSERT_TRUE(abc);
+    ASSERT_EQ(hex(abc.value()), ABC_SHA512);
+}
+
+TEST_F(HashTest, HashFileHandle)
+{
+    // Mapped data is hashed in place
+    std::string data = "abc";
+    MemoryFile mem_file(data.data(), data.size());
+    auto abc = sha512_hash(mem_file);
+    ASSERT_TRUE(abc);
+    ASSERT_EQ(hex(abc.value()), ABC_SHA512);
+
+    // Other files are read in chunks
+    auto path = create_file("large", std::string(3 * 1024 * 1024 + 5, 'x'));
+    FdFile fd_file;
+    ASSERT_TRUE(fd_file.open(path, FileOpenMode::ReadOnly));
+    auto large = sha512_hash(fd_file);
+    ASSERT_TRUE(large);
+    auto expected = sha512_hash(path);
+    ASSERT_TRUE(expected);
+    ASSERT_EQ(large.value(), expected.value());
+}
+
+TEST_F(HashTest, HashMissingFile)
+{
+    auto ret = sha512_hash(_dir + "/missing");
+    ASSERT_FALSE(ret);
+    ASSERT_EQ(ret.error(), std::errc::no_such_file_or_directory);
+}
+
+TEST_F(HashTest, HashFilesInInputOrder)
+{
+    // Larger than one read buffer
+    std::string large(3 * 1024 * 1024 + 17, '\0');
+    for (size_t i = 0; i < large.size(); ++i) {
+        large[i] = static_cast<char>(i * 31);
+    }
+    auto large_path = create_file("large", large);
+    auto large_digest = sha512_hash(large_path);
+    ASSERT_TRUE(large_digest);
+
+    std::vector<std::string> paths;
+    for (int i = 0; i < 40; ++i) {
+        switch (i % 4) {
+        case 0:
+            paths.push_back(create_file(std::to_string(i), "abc"));
+            break;
+        case 1:
+            paths.push_back(create_file(std::to_string(i), ""));
+            break;
+        case 2:
+            paths.push_back(large_path);
+            break;
+        case 3:
+            paths.push_back(_dir + "/missing");
+            break;
+        }
+    }
+
+    auto results = sha512_hash_files(paths);
+    ASSERT_EQ(results.size(), paths.size());
+
+    for (size_t i = 0; i < results.size(); ++i) {
+        switch (i % 4) {
+        case 0:
+            ASSERT_TRUE(results[i]);
+            ASSERT_EQ(hex(results[i].value()), ABC_SHA512);
+            break;
+        case 1:
+            ASSERT_TRUE(results[i]);
+            ASSERT_EQ(hex(results[i].value()), EMPTY_SHA512);
+            break;
+        case 2:
+            ASSERT_TRUE(results[i]);
+            ASSERT_EQ(results[i].value(), large_digest.value());
+            break;
+        case 3:
+            ASSERT_FALSE(results[i]);
+            ASSERT_EQ(results[i].error(),
+                      std::errc::no_such_file_or_directory);
+            break;
+        }
+    }
+}
+
+TEST_F(HashTest, HashNoFiles)
+{
+    ASSERT_TRUE(sha512_hash_files({}).empty());
+}
+
+TEST_F(HashTest, CacheReusesDigestUntilModified)
+{
+    auto path = create_file("image", "abc");
+
+    struct stat sb;
+    ASSERT_EQ(stat(path.c_str(), &sb), 0);
+
+    HashCache cache;
+    ASSERT_FALSE(cache.find(sb));
+
+    // A fake entry proves that the file is not hashed again
+    Sha512Digest fake{};
+    cache.insert(sb, fake);
+    ASSERT_TRUE(cache.dirty());
+
+    auto digest = cache.sha512_hash(path);
+    ASSERT_TRUE(digest);
+    ASSERT_EQ(digest.value(), fake);
+
+    // Same size and modification time, but the status change time differs
+    int fd = open(path.c_str(), O_WRONLY | O_CLOEXEC);
+    ASSERT_GE(fd, 0);
+    ASSERT_EQ(pwrite(fd, "xyz", 3, 0), 3);
+    struct timespec times[2] = {sb.st_atim, sb.st_mtim};
+    ASSERT_EQ(futimens(fd, times), 0);
+    close(fd);
+
+    digest = cache.sha512_hash(path);
+    ASSERT_TRUE(digest);
+    ASSERT_NE(digest.value(), fake);
+    ASSERT_EQ(digest.value(), sha512_hash(path).value());
+
+    // The new digest replaces the stale entry
+    ASSERT_EQ(stat(path.c_str(), &sb), 0);
+    ASSERT_EQ(cache.find(sb), digest.value());
+}
+
+TEST_F(HashTest, CacheSaveAndLoad)
+{
+    auto path = create_file("image", "abc");
+    auto cache_path = _dir + "/cache";
+
+    HashCache cache;
+    auto digest = cache.sha512_hash(path);
+    ASSERT_TRUE(digest);
+    ASSERT_EQ(hex(digest.value()), ABC_SHA512);
+    ASSERT_TRUE(cache.save(cache_path));
+
+    struct stat sb;
+    ASSERT_EQ(stat(cache_path.c_str(), &sb), 0);
+    ASSERT_EQ(sb.st_mode & 0777, 0600u);
+
+    HashCache loaded;
+    ASSERT_TRUE(loaded.load(cache_path));
+    ASSERT_FALSE(loaded.dirty());
+
+    ASSERT_EQ(stat(path.c_str(), &sb), 0);
+    ASSERT_EQ(loaded.find(sb), digest.value());
+}
+
+TEST_F(HashTest, CacheRejectsMalformedFile)
+{
+    auto path = create_file("image", "abc");
+    auto cache_path = _dir + "/cache";
+
+    HashCache cache;
+    ASSERT_TRUE(cache.sha512_hash(path));
+    ASSERT_TRUE(cache.save(cache_path));
+
+    // Truncate the last entry
+    auto data = file_read_all(cache_path);
+    ASSERT_TRUE(data);
+    data.value().pop_back();
+    ASSERT_TRUE(file_write_data(cache_path, data.value().data(),
+                                data.value().size()));
+
+    HashCache loaded;
+    auto ret = loaded.load(cache_path);
+    ASSERT_FALSE(ret);
+    ASSERT_EQ(ret.error(), std::errc::bad_message);
+
+    struct stat sb;
+    ASSERT_EQ(stat(path.c_str(), &sb), 0);
+    ASSERT_FALSE(loaded.find(sb));
+}
@@ -0,0 +1,109 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "mbutil/io_scheduler.h"
+
+#include "temp_dir_test.h"
+
+using namespace mb;
+using namespace mb::util;
+
+using IoSchedulerTest = TemporaryDirTest;
+
+TEST_F(IoSchedulerTest, MissingPathUsesNearestParent)
+{
+    auto dir_dev = io_backing_device(_dir);
+    ASSERT_TRUE(dir_dev) << dir_dev.error().message();
+
+    auto missing_dev = io_backing_device(_dir + "/does/not/exist");
+    ASSERT_TRUE(missing_dev) << missing_dev.error().message();
+
+    ASSERT_EQ(missing_dev.value(), dir_dev.value());
+}
+
+TEST_F(IoSchedulerTest, DeviceConcurrencyIsBounded)
+{
+    auto disk = io_backing_device(_dir);
+    ASSERT_TRUE(disk);
+
+    auto n = io_device_concurrency(disk.value());
+    ASSERT_GE(n, 1u);
+    ASSERT_LE(n, IO_MAX_BULK_PER_DEVICE);
+}
+
+TEST_F(IoSchedulerTest, LimitsConcurrentTickets)
+{
+    auto disk = io_backing_device(_dir);
+    ASSERT_TRUE(disk);
+
+    IoScheduler scheduler;
+    scheduler.set_device_limit(disk.value(), 2);
+    ASSERT_EQ(scheduler.device_limit(disk.value()), 2u);
+
+    std::atomic_uint active(0);
+    std::atomic_uint max_active(0);
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 6; ++i) {
+        threads.emplace_back([&] {
+            auto ticket = scheduler.acquire_bulk(_dir);
+
+            unsigned int n = ++active;
+            unsigned int prev = max_active.load();
+            while (prev < n && !max_active.compare_exchange_weak(prev, n)) {}
+
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            --active;
+        });
+    }
+
+    for (auto &t : threads) {
+        t.join();
+    }
+
+    ASSERT_EQ(max_active.load(), 2u);
+}
+
+TEST_F(IoSchedulerTest, MovedTicketIsReleasedOnce)
+{
+    auto disk = io_backing_device(_dir);
+    ASSERT_TRUE(disk);
+
+    IoScheduler scheduler;
+    scheduler.set_device_limit(disk.value(), 1);
+
+    {
+        auto ticket = scheduler.acquire_bulk(_dir);
+        IoScheduler::Ticket moved(std::move(ticket));
+        ticket.release();
+        moved.release();
+        moved.release();
+    }
+
+    // Would block forever if the slot was leaked
+    auto ticket = scheduler.acquire_bulk(_dir);
+}
@@ -0,0 +1,118 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "mbutil/file.h"
+#include "mbutil/page_cache.h"
+
+#include "temp_dir_test.h"
+
+using namespace mb;
+using namespace mb::util;
+
+class PageCacheTest : public TemporaryDirTest
+{
+protected:
+    void SetUp() override
+    {
+        TemporaryDirTest::SetUp();
+
+        // Several windows and a partial one
+        _data.resize(3 * StreamCache::WINDOW_SIZE + 12345);
+        for (size_t i = 0; i < _data.size(); ++i) {
+            _data[i] = static_cast<char>(i * 31 + i / 4096);
+        }
+    }
+
+    std::string _data;
+};
+
+TEST_F(PageCacheTest, WriteAndReadStream)
+{
+    auto path = _dir + "/stream";
+
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    ASSERT_GE(fd, 0);
+
+    {
+        StreamCache cache(fd, StreamDirection::Write);
+
+        for (size_t offset = 0; offset < _data.size();) {
+            auto n = write(fd, _data.data() + offset,
+                           std::min<size_t>(_data.size() - offset, 1000000));
+            ASSERT_GT(n, 0);
+            offset += static_cast<size_t>(n);
+            cache.advance();
+        }
+    }
+
+    ASSERT_EQ(close(fd), 0);
+
+    fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    ASSERT_GE(fd, 0);
+
+    std::string contents;
+
+    {
+        StreamCache cache(fd, StreamDirection::Read);
+        char buf[65536];
+
+        while (true) {
+            auto n = read(fd, buf, sizeof(buf));
+            ASSERT_GE(n, 0);
+            if (n == 0) {
+                break;
+            }
+            contents.append(buf, static_cast<size_t>(n));
+            cache.advance(contents.size());
+        }
+    }
+
+    ASSERT_EQ(close(fd), 0);
+    ASSERT_EQ(contents, _data);
+}
+
+TEST_F(PageCacheTest, IgnoresUnsupportedFiles)
+{
+    int fds[2];
+    ASSERT_EQ(pipe(fds), 0);
+
+    {
+        StreamCache read_cache(fds[0], StreamDirection::Read);
+        StreamCache write_cache(fds[1], StreamDirection::Write);
+
+        ASSERT_EQ(write(fds[1], "abc", 3), 3);
+        write_cache.advance();
+        write_cache.advance(StreamCache::WINDOW_SIZE * 2);
+
+        char buf[3];
+        ASSERT_EQ(read(fds[0], buf, sizeof(buf)), 3);
+        read_cache.advance();
+        read_cache.advance(StreamCache::WINDOW_SIZE * 2);
+    }
+
+    close(fds[0]);
+    close(fds[1]);
+}
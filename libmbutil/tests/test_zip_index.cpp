@@ -0,0 +1,301 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+
+#include "mbutil/archive.h"
+#include "mbutil/file.h"
+#include "mbutil/zip_index.h"
+
+#include "temp_dir_test.h"
+
+using namespace mb;
+using namespace mb::util;
+
+using ScopedArchive = std::unique_ptr<archive, decltype(archive_free) *>;
+using ScopedArchiveEntry =
+        std::unique_ptr<archive_entry, decltype(archive_entry_free) *>;
+
+class ZipIndexTest : public TemporaryDirTest
+{
+protected:
+    void SetUp() override
+    {
+        TemporaryDirTest::SetUp();
+        _zip = _dir + "/test.zip";
+
+        // Larger than the extraction buffers and not very compressible
+        _large.resize(1024 * 1024 + 123);
+        uint32_t state = 1;
+        for (auto &c : _large) {
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+            c = static_cast<char>(state);
+        }
+    }
+
+    void add_entry(archive *a, const char *name, mode_t mode,
+                   const std::string &data)
+    {
+        ScopedArchiveEntry entry(archive_entry_new(), &archive_entry_free);
+        ASSERT_TRUE(entry);
+
+        archive_entry_set_pathname(entry.get(), name);
+        archive_entry_set_mode(entry.get(), mode);
+        archive_entry_set_size(entry.get(), static_cast<la_int64_t>(
+                S_ISDIR(mode) ? 0 : data.size()));
+        archive_entry_set_mtime(entry.get(), 1000000000, 0);
+
+        ASSERT_EQ(archive_write_header(a, entry.get()), ARCHIVE_OK);
+        if (!data.empty()) {
+            ASSERT_EQ(archive_write_data(a, data.data(), data.size()),
+                      static_cast<la_ssize_t>(data.size()));
+        }
+    }
+
+    void create_zip(bool store = false)
+    {
+        ScopedArchive a(archive_write_new(), &archive_write_free);
+        ASSERT_TRUE(a);
+
+        ASSERT_EQ(archive_write_set_format_zip(a.get()), ARCHIVE_OK);
+        ASSERT_EQ(archive_write_set_format_option(
+                a.get(), "zip", "compression", store ? "store" : "deflate"),
+                  ARCHIVE_OK);
+        ASSERT_EQ(archive_write_open_filename(a.get(), _zip.c_str()),
+                  ARCHIVE_OK);
+
+        add_entry(a.get(), "update-binary", S_IFREG | 0755, "#!/sbin/sh\n");
+        add_entry(a.get(), "multiboot/", S_IFDIR | 0750, "");
+        add_entry(a.get(), "multiboot/info.prop", S_IFREG | 0644,
+                  "foo=bar\n");
+        add_entry(a.get(), "system.img", S_IFREG | 0600, _large);
+
+        ASSERT_EQ(archive_write_close(a.get()), ARCHIVE_OK);
+    }
+
+    void check_extract_multiple(bool store)
+    {
+        ASSERT_NO_FATAL_FAILURE(create_zip(store));
+
+        ZipIndex index;
+        ASSERT_TRUE(index.load(_zip));
+
+        ZipIndex::ExtractList list;
+        for (auto const &entry : index.entries()) {
+            list.emplace_back(&entry, _dir + "/out/" + entry.name);
+        }
+
+        ASSERT_TRUE(index.extract(list));
+
+        auto data = file_read_all(_dir + "/out/system.img");
+        ASSERT_TRUE(data);
+        ASSERT_EQ(data.value(), _large);
+
+        data = file_read_all(_dir + "/out/multiboot/info.prop");
+        ASSERT_TRUE(data);
+        ASSERT_EQ(data.value(), "foo=bar\n");
+
+        struct stat sb;
+        ASSERT_EQ(stat((_dir + "/out/update-binary").c_str(), &sb), 0);
+        ASSERT_EQ(sb.st_mode & 07777, 0755u);
+        ASSERT_EQ(sb.st_mtime, 1000000000);
+        ASSERT_EQ(stat((_dir + "/out/multiboot").c_str(), &sb), 0);
+        ASSERT_TRUE(S_ISDIR(sb.st_mode));
+        ASSERT_EQ(sb.st_mode & 07777, 0750u);
+    }
+
+    std::string _zip;
+    std::string _large;
+};
+
+TEST_F(ZipIndexTest, LoadAndFind)
+{
+    ASSERT_NO_FATAL_FAILURE(create_zip());
+
+    ZipIndex index;
+    ASSERT_TRUE(index.load(_zip));
+    ASSERT_EQ(index.entries().size(), 4u);
+
+    auto *entry = index.find("system.img");
+    ASSERT_TRUE(entry);
+    ASSERT_EQ(entry->uncompressed_size, _large.size());
+    ASSERT_EQ(entry->mode, S_IFREG | 0600u);
+    ASSERT_EQ(entry->mtime, 1000000000);
+    ASSERT_TRUE(entry->is_supported());
+
+    entry = index.find("multiboot/");
+    ASSERT_TRUE(entry);
+    ASSERT_TRUE(entry->is_dir());
+
+    ASSERT_FALSE(index.find("missing"));
+}
+
+TEST_F(ZipIndexTest, ExtractMultipleDeflated)
+{
+    check_extract_multiple(false);
+}
+
+TEST_F(ZipIndexTest, ExtractMultipleStored)
+{
+    check_extract_multiple(true);
+}
+
+TEST_F(ZipIndexTest, ExtractWithPrependedData)
+{
+    ASSERT_NO_FATAL_FAILURE(create_zip());
+
+    auto zip = file_read_all(_zip);
+    ASSERT_TRUE(zip);
+    auto data = "#!/bin/sh\nexit 0\n" + zip.value();
+    ASSERT_TRUE(file_write_data(_zip, data.data(), data.size()));
+
+    ZipIndex index;
+    ASSERT_TRUE(index.load(_zip));
+
+    auto *entry = index.find("system.img");
+    ASSERT_TRUE(entry);
+    ASSERT_TRUE(index.extract(*entry, _dir + "/system.img"));
+
+    auto extracted = file_read_all(_dir + "/system.img");
+    ASSERT_TRUE(extracted);
+    ASSERT_EQ(extracted.value(), _large);
+}
+
+TEST_F(ZipIndexTest, StreamFromLocalHeaderOffset)
+{
+    ASSERT_NO_FATAL_FAILURE(create_zip());
+
+    auto zip = file_read_all(_zip);
+    ASSERT_TRUE(zip);
+    auto data = "#!/bin/sh\nexit 0\n" + zip.value();
+    ASSERT_TRUE(file_write_data(_zip, data.data(), data.size()));
+
+    ZipIndex index;
+    ASSERT_TRUE(index.load(_zip));
+
+    auto *entry = index.find("multiboot/info.prop");
+    ASSERT_TRUE(entry);
+
+    auto offset = index.local_header_offset(*entry);
+    ASSERT_LT(offset, data.size());
+
+    // The entry is the first one a streaming reader sees
+    ScopedArchive a(archive_read_new(), &archive_read_free);
+    ASSERT_TRUE(a);
+    ASSERT_EQ(archive_read_support_format_zip_streamable(a.get()), ARCHIVE_OK);
+    ASSERT_EQ(archive_read_open_memory(a.get(), data.data() + offset,
+                                       data.size() - offset), ARCHIVE_OK);
+
+    archive_entry *a_entry;
+    ASSERT_EQ(archive_read_next_header(a.get(), &a_entry), ARCHIVE_OK);
+    ASSERT_STREQ(archive_entry_pathname(a_entry), "multiboot/info.prop");
+
+    char buf[64];
+    auto n = archive_read_data(a.get(), buf, sizeof(buf));
+    ASSERT_EQ(std::string(buf, static_cast<size_t>(std::max<la_ssize_t>(n, 0))),
+              "foo=bar\n");
+}
+
+TEST_F(ZipIndexTest, ExtractDetectsCorruption)
+{
+    ASSERT_NO_FATAL_FAILURE(create_zip(true));
+
+    auto zip = file_read_all(_zip);
+    ASSERT_TRUE(zip);
+    auto data = std::move(zip.value());
+    auto pos = data.find("foo=bar");
+    ASSERT_NE(pos, std::string::npos);
+    data[pos] = 'g';
+    ASSERT_TRUE(file_write_data(_zip, data.data(), data.size()));
+
+    ZipIndex index;
+    ASSERT_TRUE(index.load(_zip));
+
+    auto *entry = index.find("multiboot/info.prop");
+    ASSERT_TRUE(entry);
+
+    auto r = index.extract(*entry, _dir + "/info.prop");
+    ASSERT_FALSE(r);
+    ASSERT_EQ(r.error().ec, std::errc::bad_message);
+}
+
+TEST_F(ZipIndexTest, LoadRejectsNonZip)
+{
+    ASSERT_TRUE(file_write_data(_zip, _large.data(), _large.size()));
+
+    ZipIndex index;
+    auto r = index.load(_zip);
+    ASSERT_FALSE(r);
+    ASSERT_EQ(r.error(), std::errc::bad_message);
+}
+
+TEST_F(ZipIndexTest, ArchiveHelpersUseIndex)
+{
+    ASSERT_NO_FATAL_FAILURE(create_zip());
+
+    std::vector<ExistsInfo> exists{{"update-binary", false},
+                                   {"missing", true}};
+    ASSERT_TRUE(archive_exists(_zip, exists));
+    ASSERT_TRUE(exists[0].exists);
+    ASSERT_FALSE(exists[1].exists);
+
+    ASSERT_TRUE(extract_files2(_zip, {{"multiboot/info.prop",
+                                       _dir + "/info.prop"}}));
+    auto data = file_read_all(_dir + "/info.prop");
+    ASSERT_TRUE(data);
+    ASSERT_EQ(data.value(), "foo=bar\n");
+
+    ASSERT_FALSE(extract_files(_zip, _dir + "/out", {"missing"}));
+}
+
+TEST_F(ZipIndexTest, ArchiveFunctionsUseIndex)
+{
+    ASSERT_NO_FATAL_FAILURE(create_zip());
+
+    ZipIndex index;
+    ASSERT_TRUE(index.load(_zip));
+
+    std::vector<ExistsInfo> exists{
+        { "multiboot/info.prop", false },
+        { "missing", true },
+    };
+    ASSERT_TRUE(archive_exists(index, exists));
+    ASSERT_TRUE(exists[0].exists);
+    ASSERT_FALSE(exists[1].exists);
+
+    ASSERT_TRUE(extract_files2(index, {
+        { "multiboot/info.prop", _dir + "/info.prop" },
+    }));
+
+    auto data = file_read_all(_dir + "/info.prop");
+    ASSERT_TRUE(data);
+    ASSERT_EQ(data.value(), "foo=bar\n");
+
+    ASSERT_FALSE(extract_files2(index, {
+        { "missing", _dir + "/missing" },
+    }));
+}
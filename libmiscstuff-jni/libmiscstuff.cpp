@@ -18,8 +18,11 @@
  */
 
 #include <memory>
+#include <optional>
+#include <string>
 
 #include <cerrno>
+#include <cinttypes>
 #include <cstdarg>
 #include <cstdlib>
 #include <cstring>
@@ -30,10 +33,12 @@
 #include <jni.h>
 
 #include "mbcommon/common.h"
+#include "mbcommon/file/memory.h"
 #include "mbcommon/finally.h"
 
 #include "mbbootimg/entry.h"
 #include "mbbootimg/header.h"
+#include "mbbootimg/probe_cache.h"
 #include "mbbootimg/reader.h"
 
 #include "mblog/android_logger.h"
@@ -45,6 +50,7 @@
     Java_com_github_chenxiaolong_dualbootpatcher_nativelib_libmiscstuff_LibMiscStuff_ ## method
 
 #define IOException             "java/io/IOException"
+#define IllegalArgumentException "java/lang/IllegalArgumentException"
 #define OutOfMemoryError        "java/lang/OutOfMemoryError"
 
 using namespace mb;
@@ -52,6 +58,10 @@ using namespace mb::bootimg;
 
 typedef std::unique_ptr<archive, decltype(archive_free) *> ScopedArchive;
 
+// The app lists the boot images of every installed ROM each time the ROM list
+// is refreshed, so remember the detected formats for the life of the process
+static ProbeCache g_probe_cache;
+
 extern "C" {
 
 MB_PRINTF(3, 4)
@@ -237,57 +247,33 @@ static la_ssize_t laBootImgReadCb(archive *a, void *userdata,
     return static_cast<la_ssize_t>(bytesRead.value());
 }
 
-JNIEXPORT jstring JNICALL
-CLASS_METHOD(getBootImageRomId)(JNIEnv *env, jclass clazz, jstring jfilename)
+// Reads /romid from the ramdisk of an opened boot image. rom_id is left empty
+// if the ramdisk has no /romid. Returns false after throwing a Java exception
+// if an error occurs.
+static bool read_rom_id(JNIEnv *env, Reader reader, const char *name,
+                        std::optional<std::string> &rom_id)
 {
-    (void) clazz;
-
-    Reader reader;
-
-    const char *filename = env->GetStringUTFChars(jfilename, nullptr);
-    if (!filename) {
-        return nullptr;
-    }
-
-    auto free_filename = finally([&] {
-        if (filename) {
-            env->ReleaseStringUTFChars(jfilename, filename);
-        }
-    });
-
-    // Open input boot image
-    if (auto r = reader.enable_formats_all(); !r) {
-        throw_exception(env, IOException,
-                        "Failed to enable all boot image formats: %s",
-                        r.error().message().c_str());
-        return nullptr;
-    }
-    if (auto r = reader.open_filename(filename); !r) {
-        throw_exception(env, IOException,
-                        "%s: Failed to open boot image for reading: %s",
-                        filename, r.error().message().c_str());
-        return nullptr;
-    }
+    rom_id = std::nullopt;
 
     // Read header
     if (auto header = reader.read_header(); !header) {
         throw_exception(env, IOException,
                         "%s: Failed to read header: %s",
-                        filename, header.error().message().c_str());
-        return nullptr;
+                        name, header.error().message().c_str());
+        return false;
     }
 
     // Go to ramdisk
     if (auto entry = reader.go_to_entry(EntryType::Ramdisk); !entry) {
         if (entry.error() == ReaderError::EndOfEntries) {
             throw_exception(env, IOException,
-                            "%s: Boot image is missing ramdisk", filename);
+                            "%s: Boot image is missing ramdisk", name);
         } else {
             throw_exception(env, IOException,
                             "%s: Failed to find ramdisk entry: %s",
-                            filename, entry.error().message().c_str());
+                            name, entry.error().message().c_str());
         }
-        return nullptr;
+        return false;
     }
 
     ScopedArchive a(archive_read_new(), &archive_read_free);
@@ -296,7 +282,7 @@ CLASS_METHOD(getBootImageRomId)(JNIEnv *env, jclass clazz, jstring jfilename)
 
     if (!a) {
         throw_exception(env, IOException, "Failed to allocate archive");
-        return nullptr;
+        return false;
     }
 
     // Enable support for common ramdisk formats
@@ -313,16 +299,16 @@ CLASS_METHOD(getBootImageRomId)(JNIEnv *env, jclass clazz, jstring jfilename)
     if (laret != ARCHIVE_OK) {
         throw_exception(env, IOException,
                         "%s: Failed to open ramdisk: %s",
-                        filename, archive_error_string(a.get()));
-        return nullptr;
+                        name, archive_error_string(a.get()));
+        return false;
     }
 
     while ((laret = archive_read_next_header(a.get(), &aEntry)) == ARCHIVE_OK) {
         const char *path = archive_entry_pathname(aEntry);
         if (!path) {
             throw_exception(env, IOException,
-                            "%s: Ramdisk entry has no path", filename);
-            return nullptr;
+                            "%s: Ramdisk entry has no path", name);
+            return false;
         }
 
         if (strcmp(path, "romid") == 0) {
@@ -334,8 +320,8 @@ CLASS_METHOD(getBootImageRomId)(JNIEnv *env, jclass clazz, jstring jfilename)
             if (n_read < 0) {
                 throw_exception(env, IOException,
                                 "%s: Failed to read ramdisk entry: %s",
-                                filename, archive_error_string(a.get()));
-                return nullptr;
+                                name, archive_error_string(a.get()));
+                return false;
             }
 
             // NULL-terminate
@@ -345,23 +331,185 @@ CLASS_METHOD(getBootImageRomId)(JNIEnv *env, jclass clazz, jstring jfilename)
             n_read = archive_read_data(a.get(), &dummy, 1);
             if (n_read != 0) {
                 throw_exception(env, IOException,
-                                "%s: /romid in ramdisk is too large",
-                                filename);
-                return nullptr;
+                                "%s: /romid in ramdisk is too large", name);
+                return false;
             }
 
-            return env->NewStringUTF(buf);
+            rom_id = buf;
+            return true;
         }
     }
 
     if (laret != ARCHIVE_EOF) {
         throw_exception(env, IOException,
                         "%s: Failed to read ramdisk entry header: %s",
-                        filename, archive_error_string(a.get()));
+                        name, archive_error_string(a.get()));
+        return false;
+    }
+
+    return true;
+}
+
+static bool read_rom_id_from_file(JNIEnv *env, const char *filename,
+                                  std::optional<std::string> &rom_id)
+{
+    Reader reader;
+
+    // Open input boot image
+    if (auto r = reader.enable_formats_all(); !r) {
+        throw_exception(env, IOException,
+                        "Failed to enable all boot image formats: %s",
+                        r.error().message().c_str());
+        return false;
+    }
+    if (auto r = reader.set_probe_cache(&g_probe_cache); !r) {
+        throw_exception(env, IOException,
+                        "Failed to set boot image probe cache: %s",
+                        r.error().message().c_str());
+        return false;
+    }
+    if (auto r = reader.open_filename(filename); !r) {
+        throw_exception(env, IOException,
+                        "%s: Failed to open boot image for reading: %s",
+                        filename, r.error().message().c_str());
+        return false;
+    }
+
+    return read_rom_id(env, std::move(reader), filename, rom_id);
+}
+
+JNIEXPORT jstring JNICALL
+CLASS_METHOD(getBootImageRomId)(JNIEnv *env, jclass clazz, jstring jfilename)
+{
+    (void) clazz;
+
+    const char *filename = env->GetStringUTFChars(jfilename, nullptr);
+    if (!filename) {
+        return nullptr;
+    }
+
+    auto free_filename = finally([&] {
+        if (filename) {
+            env->ReleaseStringUTFChars(jfilename, filename);
+        }
+    });
+
+    std::optional<std::string> rom_id;
+    if (!read_rom_id_from_file(env, filename, rom_id) || !rom_id) {
+        return nullptr;
+    }
+
+    return env->NewStringUTF(rom_id->c_str());
+}
+
+// Batched version of getBootImageRomId() to avoid a JNI round trip for each
+// boot image. Elements are null for boot images without a ROM ID.
+JNIEXPORT jobjectArray JNICALL
+CLASS_METHOD(getBootImageRomIds)(JNIEnv *env, jclass clazz,
+                                 jobjectArray jfilenames)
+{
+    (void) clazz;
+
+    jsize count = env->GetArrayLength(jfilenames);
+
+    jclass string_class = env->FindClass("java/lang/String");
+    if (!string_class) {
+        return nullptr;
+    }
+
+    jobjectArray result = env->NewObjectArray(count, string_class, nullptr);
+    if (!result) {
+        return nullptr;
+    }
+
+    for (jsize i = 0; i < count; ++i) {
+        auto jfilename = static_cast<jstring>(
+                env->GetObjectArrayElement(jfilenames, i));
+        if (!jfilename) {
+            throw_exception(env, IllegalArgumentException,
+                            "Filename at index %d is null",
+                            static_cast<int>(i));
+            return nullptr;
+        }
+
+        // Local references must be freed since the array can be larger than
+        // the local reference table
+        auto free_jfilename = finally([&] {
+            env->DeleteLocalRef(jfilename);
+        });
+
+        const char *filename = env->GetStringUTFChars(jfilename, nullptr);
+        if (!filename) {
+            return nullptr;
+        }
+
+        auto free_filename = finally([&] {
+            env->ReleaseStringUTFChars(jfilename, filename);
+        });
+
+        std::optional<std::string> rom_id;
+        if (!read_rom_id_from_file(env, filename, rom_id)) {
+            return nullptr;
+        }
+
+        if (rom_id) {
+            jstring jrom_id = env->NewStringUTF(rom_id->c_str());
+            if (!jrom_id) {
+                return nullptr;
+            }
+            env->SetObjectArrayElement(result, i, jrom_id);
+            env->DeleteLocalRef(jrom_id);
+        }
+    }
+
+    return result;
+}
+
+// Same as getBootImageRomId(), but reads the boot image straight out of a
+// direct ByteBuffer (eg. from ByteBuffer.allocateDirect() or a mapped file)
+// instead of copying it through the JNI boundary
+JNIEXPORT jstring JNICALL
+CLASS_METHOD(getBootImageRomIdFromBuffer)(JNIEnv *env, jclass clazz,
+                                          jobject jbuffer, jint size)
+{
+    (void) clazz;
+
+    void *buf = env->GetDirectBufferAddress(jbuffer);
+    jlong capacity = env->GetDirectBufferCapacity(jbuffer);
+    if (!buf || capacity < 0) {
+        throw_exception(env, IllegalArgumentException,
+                        "Buffer is not a direct buffer");
+        return nullptr;
+    } else if (size < 0 || size > capacity) {
+        throw_exception(env, IllegalArgumentException,
+                        "Size %d is out of range for buffer with capacity %"
+                        PRId64, static_cast<int>(size),
+                        static_cast<int64_t>(capacity));
+        return nullptr;
+    }
+
+    Reader reader;
+
+    if (auto r = reader.enable_formats_all(); !r) {
+        throw_exception(env, IOException,
+                        "Failed to enable all boot image formats: %s",
+                        r.error().message().c_str());
+        return nullptr;
+    }
+    if (auto r = reader.open(std::make_unique<MemoryFile>(
+            buf, static_cast<size_t>(size))); !r) {
+        throw_exception(env, IOException,
+                        "<buffer>: Failed to open boot image for reading: %s",
+                        r.error().message().c_str());
+        return nullptr;
+    }
+
+    std::optional<std::string> rom_id;
+    if (!read_rom_id(env, std::move(reader), "<buffer>", rom_id) || !rom_id) {
         return nullptr;
     }
 
-    return nullptr;
+    return env->NewStringUTF(rom_id->c_str());
 }
 
 JNIEXPORT jboolean JNICALL
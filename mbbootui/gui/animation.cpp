@@ -41,7 +41,7 @@ GUIAnimation::GUIAnimation(xml_node<>* node) : GUIObject(node)
     }
 
     // Fetch the render sizes
-    if (mAnimation && mAnimation->GetResource()) {
+    if (mAnimation) {
         mRenderW = mAnimation->GetWidth();
         mRenderH = mAnimation->GetHeight();
 
@@ -111,3 +111,8 @@ int GUIAnimation::Update()
     }
     return 0;
 }
+
+int GUIAnimation::GetDamageRect(int& x, int& y, int& w, int& h)
+{
+    return GetRenderPos(x, y, w, h);
+}
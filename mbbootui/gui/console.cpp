@@ -20,6 +20,7 @@
 
 #include "gui/console.hpp"
 
+#include <algorithm>
 #include <cstring>
 
 #define GUI_CONSOLE_BUFFER_SIZE 512
@@ -202,7 +203,7 @@ GUIConsole::GUIConsole(xml_node<>* node) : GUIScrollList(node)
 
             mSlideoutImage = LoadAttrImage(child, "resource");
 
-            if (mSlideoutImage && mSlideoutImage->GetResource()) {
+            if (mSlideoutImage) {
                 mSlideoutW = mSlideoutImage->GetWidth();
                 mSlideoutH = mSlideoutImage->GetHeight();
                 if (mPlacement == CENTER || mPlacement == CENTER_X_ONLY) {
@@ -229,7 +230,11 @@ int GUIConsole::RenderSlideout()
 int GUIConsole::RenderConsole()
 {
     Translate_Now();
-    AddLines(&gConsole, &gConsoleColor, &mLastCount, &rConsole, &rConsoleColor);
+    if (AddLines(&gConsole, &gConsoleColor, &mLastCount, &rConsole, &rConsoleColor)) {
+        // The new lines may have been clipped away, so make sure the next
+        // Update() repaints them
+        mUpdate = 1;
+    }
     GUIScrollList::Render();
 
     // if last line is fully visible, keep tracking the last line when new lines are added
@@ -307,6 +312,23 @@ int GUIConsole::Update()
     return 0;
 }
 
+int GUIConsole::GetDamageRect(int& x, int& y, int& w, int& h)
+{
+    GetRenderPos(x, y, w, h);
+
+    if (mSlideout) {
+        // Showing or hiding the console toggles between the list and the
+        // slideout button
+        int x2 = std::max(x + w, mSlideoutX + mSlideoutW);
+        int y2 = std::max(y + h, mSlideoutY + mSlideoutH);
+        x = std::min(x, mSlideoutX);
+        y = std::min(y, mSlideoutY);
+        w = x2 - x;
+        h = y2 - y;
+    }
+    return 0;
+}
+
 // IsInRegion - Checks if the request is handled by this object
 //  Return 1 if this object handles the request, 0 if not
 int GUIConsole::IsInRegion(int x, int y)
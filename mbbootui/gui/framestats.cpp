@@ -0,0 +1,187 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "gui/framestats.hpp"
+
+#include <algorithm>
+
+#include <cinttypes>
+#include <cstdio>
+
+#include "mblog/logging.h"
+
+#include "gui/pages.hpp"
+#include "gui/resources.hpp"
+
+#define LOG_TAG "mbbootui/gui/framestats"
+
+// Input that didn't lead to a new frame within this long probably didn't
+// change anything on screen
+static constexpr auto MAX_INPUT_LATENCY = std::chrono::seconds(1);
+
+static constexpr int OVERLAY_PADDING = 4;
+
+FrameStats frameStats;
+
+using namespace std::chrono;
+
+FrameStats::Samples::Samples() : m_next(0)
+{
+}
+
+void FrameStats::Samples::Add(Clock::duration d)
+{
+    auto us = duration_cast<microseconds>(d).count();
+    auto value = static_cast<uint32_t>(std::min<decltype(us)>(
+            std::max<decltype(us)>(us, 0), UINT32_MAX));
+
+    if (m_samples.size() < MAX_SAMPLES) {
+        m_samples.push_back(value);
+    } else {
+        m_samples[m_next] = value;
+    }
+    m_next = (m_next + 1) % MAX_SAMPLES;
+}
+
+bool FrameStats::Samples::Empty() const
+{
+    return m_samples.empty();
+}
+
+uint32_t FrameStats::Samples::Last() const
+{
+    if (m_samples.empty()) {
+        return 0;
+    }
+    return m_samples[(m_next + MAX_SAMPLES - 1) % MAX_SAMPLES];
+}
+
+void FrameStats::Samples::Log(const char *name) const
+{
+    if (m_samples.empty()) {
+        LOGI("%s: no samples", name);
+        return;
+    }
+
+    std::vector<uint32_t> sorted(m_samples);
+    std::sort(sorted.begin(), sorted.end());
+
+    // Nearest-rank percentiles
+    auto percentile = [&](size_t p) {
+        size_t rank = (p * sorted.size() + 99) / 100;
+        return sorted[std::max<size_t>(rank, 1) - 1];
+    };
+
+    LOGI("%s (%zu samples): p50=%" PRIu32 "us, p90=%" PRIu32 "us,"
+         " p99=%" PRIu32 "us, max=%" PRIu32 "us",
+         name, sorted.size(), percentile(50), percentile(90),
+         percentile(99), sorted.back());
+}
+
+FrameStats::FrameStats()
+    : m_input_pending(false)
+    , m_frame_interval(Clock::duration::zero())
+{
+}
+
+void FrameStats::InputReceived(Clock::time_point time)
+{
+    if (!m_input_pending) {
+        m_input_pending = true;
+        m_input_time = time;
+    }
+}
+
+void FrameStats::FrameFlipped(Clock::time_point render_start,
+                              Clock::time_point render_end,
+                              Clock::time_point flip_end)
+{
+    m_render.Add(render_end - render_start);
+    m_flip.Add(flip_end - render_end);
+
+    if (m_input_pending) {
+        auto latency = flip_end - m_input_time;
+        if (latency <= MAX_INPUT_LATENCY) {
+            m_latency.Add(latency);
+        }
+        m_input_pending = false;
+    }
+
+    if (m_last_flip != Clock::time_point()) {
+        m_frame_interval = flip_end - m_last_flip;
+    }
+    m_last_flip = flip_end;
+}
+
+static FontResource * overlay_font()
+{
+    const ResourceManager *resources = PageManager::GetResources();
+    if (!resources) {
+        return nullptr;
+    }
+    return resources->FindFont("font_s");
+}
+
+GRRect FrameStats::OverlayRect() const
+{
+    FontResource *font = overlay_font();
+    if (!font) {
+        return { 0, 0, 0, 0 };
+    }
+
+    return { 0, 0, gr_fb_width(), font->GetHeight() + 2 * OVERLAY_PADDING };
+}
+
+void FrameStats::DrawOverlay() const
+{
+    FontResource *font = overlay_font();
+    if (!font) {
+        return;
+    }
+
+    auto interval_us = duration_cast<microseconds>(m_frame_interval).count();
+
+    char text[128];
+    snprintf(text, sizeof(text),
+             "render %.1f ms | flip %.1f ms | input %.1f ms | %.0f fps",
+             m_render.Last() / 1000.0, m_flip.Last() / 1000.0,
+             m_latency.Last() / 1000.0,
+             interval_us > 0 ? 1000000.0 / interval_us : 0.0);
+
+    GRRect rect = OverlayRect();
+    gr_color(0, 0, 0, 160);
+    gr_fill(rect.x, rect.y, rect.w, rect.h);
+    gr_color(0, 255, 0, 255);
+    gr_textEx_scaleW(OVERLAY_PADDING, OVERLAY_PADDING, text,
+                     font->GetResource(), rect.w - 2 * OVERLAY_PADDING,
+                     TOP_LEFT, 0);
+}
+
+void FrameStats::LogSummary() const
+{
+    LOGI("Frame statistics:");
+    m_render.Log("Render time");
+    m_flip.Log("Flip time");
+    m_latency.Log("Input to display latency");
+
+    GRFrameStats stats;
+    gr_fb_frame_stats(&stats);
+    LOGI("Frames: %" PRIu64 ", missed vsyncs: %" PRIu64,
+         stats.frames, stats.missed_vsyncs);
+}
@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <vector>
+
+#include <cstdint>
+
+#include "minuitwrp/minui.h"
+
+// Frame timing instrumentation for the developer overlay. Enabled by setting
+// tw_frame_stats to 1 (eg. with mbbootui's --frame-stats option).
+class FrameStats
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    FrameStats();
+
+    // Record an input event. Its timestamp must come from CLOCK_MONOTONIC
+    // (see ev_init()). Only the oldest event since the last frame counts.
+    void InputReceived(Clock::time_point time);
+
+    // Record a frame that finished rendering at render_end and was handed to
+    // the display at flip_end
+    void FrameFlipped(Clock::time_point render_start,
+                      Clock::time_point render_end,
+                      Clock::time_point flip_end);
+
+    // Screen region covered by the overlay
+    GRRect OverlayRect() const;
+
+    // Draw the most recent timings at the top of the screen
+    void DrawOverlay() const;
+
+    // Log the percentiles of all recorded timings
+    void LogSummary() const;
+
+private:
+    class Samples
+    {
+    public:
+        Samples();
+
+        void Add(Clock::duration d);
+        bool Empty() const;
+        uint32_t Last() const;
+        void Log(const char *name) const;
+
+    private:
+        static constexpr size_t MAX_SAMPLES = 4096;
+
+        // Most recent durations in microseconds
+        std::vector<uint32_t> m_samples;
+        size_t m_next;
+    };
+
+    Samples m_render;
+    Samples m_flip;
+    Samples m_latency;
+
+    bool m_input_pending;
+    Clock::time_point m_input_time;
+    Clock::time_point m_last_flip;
+    Clock::duration m_frame_interval;
+};
+
+extern FrameStats frameStats;
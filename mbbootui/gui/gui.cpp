@@ -20,6 +20,7 @@
 
 #include <atomic>
 #include <chrono>
+#include <cinttypes>
 
 #include <linux/input.h>
 #include <unistd.h>
@@ -36,6 +37,7 @@
 #include "minuitwrp/minui.h"
 
 #include "gui/blanktimer.hpp"
+#include "gui/framestats.hpp"
 #include "gui/hardwarekeyboard.hpp"
 #include "gui/mousecursor.hpp"
 #include "gui/objects.hpp"
@@ -57,6 +59,8 @@ using namespace std::chrono;
 // Global values
 static int gGuiInitialized = 0;
 static std::atomic_int gForceRender;
+// Whether the frame timing overlay is enabled
+static bool gFrameStats = false;
 blanktimer blankTimer;
 static float scale_theme_w = 1;
 static float scale_theme_h = 1;
@@ -79,7 +83,9 @@ void flip()
         write(gRecorder, &time, sizeof(timespec));
         gr_write_frame_to_file(gRecorder);
     }
-    gr_flip();
+
+    GRRect damage = PageManager::TakeFrameDamage();
+    gr_flip_damage(&damage, 1);
 }
 
 void rapidxml::parse_error_handler(const char *what, void *where)
@@ -192,6 +198,12 @@ bool InputHandler::processInput(int timeout_ms)
         break;
     }
 
+    if (gFrameStats) {
+        // ev_init() switches input devices to CLOCK_MONOTONIC timestamps
+        frameStats.InputReceived(steady_clock::time_point(
+                seconds(ev.time.tv_sec) + microseconds(ev.time.tv_usec)));
+    }
+
     blankTimer.resetTimerAndUnblank();
     return true;  // we got an event, so there might be more in the queue
 }
@@ -404,6 +416,33 @@ static void loopTimer(int input_timeout_ms)
     } while (1);
 }
 
+// Render the current page and display it
+static void renderFrame()
+{
+    // Draw into a buffer that's no longer on screen so that flip() doesn't
+    // stall
+    gr_fb_wait_frame(-1);
+
+    // Images drawn in earlier frames may now be evicted from the cache
+    LazySurface::NewFrame();
+
+    if (!gFrameStats) {
+        PageManager::Render();
+        flip();
+        return;
+    }
+
+    // The page has to be repainted underneath the overlay
+    PageManager::AddDamage(frameStats.OverlayRect());
+
+    auto render_start = steady_clock::now();
+    PageManager::Render();
+    frameStats.DrawOverlay();
+    auto render_end = steady_clock::now();
+    flip();
+    frameStats.FrameFlipped(render_start, render_end, steady_clock::now());
+}
+
 static int runPages(const char *page_name, const int stop_on_page_done)
 {
     DataManager::SetValue(VAR_TW_PAGE_DONE, 0);
@@ -426,6 +465,8 @@ static int runPages(const char *page_name, const int stop_on_page_done)
     int idle_frames = 0;
 
     for (;;) {
+        gFrameStats = DataManager::GetIntValue(VAR_TW_FRAME_STATS) != 0;
+
         loopTimer(input_timeout_ms);
         if (g_pty_fd > 0) {
             // TODO: this is not nice, we should have one central select for input, pty
@@ -453,14 +494,13 @@ static int runPages(const char *page_name, const int stop_on_page_done)
 
 #ifndef PRINT_RENDER_TIME
             if (ret > 1) {
-                PageManager::Render();
-            }
-
-            if (ret > 0) {
+                renderFrame();
+            } else if (ret > 0) {
                 flip();
             }
 #else
             if (ret > 1) {
+                gr_fb_wait_frame(-1);
                 auto start = steady_clock::now();
                 PageManager::Render();
                 auto end = steady_clock::now();
@@ -473,14 +513,20 @@ static int runPages(const char *page_name, const int stop_on_page_done)
                 LOGI("Render(): %" PRId64 " ms, flip(): %" PRId64 " ms, total: %" PRId64 " ms",
                      render_t.count(), flip_t.count(),
                      render_t.count() + flip_t.count());
+
+                GRFrameStats stats;
+                gr_fb_frame_stats(&stats);
+                LOGI("Frames: %" PRIu64 ", missed vsyncs: %" PRIu64 ", max render: %" PRIu64 " us",
+                     stats.frames, stats.missed_vsyncs,
+                     stats.max_render_ns / 1000);
             } else if (ret > 0) {
                 flip();
             }
 #endif
         } else {
             gForceRender = 0;
-            PageManager::Render();
-            flip();
+            PageManager::InvalidateAll();
+            renderFrame();
             input_timeout_ms = 0;
         }
 
@@ -18,7 +18,7 @@ GUIImage::GUIImage(xml_node<>* node) : GUIObject(node)
     // Load the placement
     LoadPlacement(FindNode(node, "placement"), &mRenderX, &mRenderY, nullptr, nullptr, &mPlacement);
 
-    if (mImage && mImage->GetResource()) {
+    if (mImage) {
         mRenderW = mImage->GetWidth();
         mRenderH = mImage->GetHeight();
 
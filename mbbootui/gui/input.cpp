@@ -74,7 +74,7 @@ GUIInput::GUIInput(xml_node<>* node)
         mBackground = LoadAttrImage(child, "resource");
         mBackgroundColor = LoadAttrColor(child, "color", mBackgroundColor);
     }
-    if (mBackground && mBackground->GetResource()) {
+    if (mBackground) {
         mBackgroundW = mBackground->GetWidth();
         mBackgroundH = mBackground->GetHeight();
     }
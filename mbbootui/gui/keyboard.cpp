@@ -105,7 +105,7 @@ GUIKeyboard::GUIKeyboard(xml_node<>* node)
     }
 
     // Check the first image to get height and width
-    if (layouts[0].keyboardImg && layouts[0].keyboardImg->GetResource()) {
+    if (layouts[0].keyboardImg) {
         mRenderW = layouts[0].keyboardImg->GetWidth();
         mRenderH = layouts[0].keyboardImg->GetHeight();
     }
@@ -50,6 +50,16 @@ public:
         return 0;
     }
 
+    // GetDamageRect - Returns the region that must be repainted after Update()
+    //  returned >0. The region must cover both what was drawn before and what
+    //  will be drawn next.
+    //  Return 0 on success, <0 if unknown and the full screen must be repainted
+    virtual int GetDamageRect(int& x __unused, int& y __unused,
+                              int& w __unused, int& h __unused)
+    {
+        return -1;
+    }
+
     // GetRenderPos - Returns the current position of the object
     virtual int GetRenderPos(int& x, int& y, int& w, int& h)
     {
@@ -83,11 +83,43 @@ MouseCursor *PageManager::mMouseCursor = nullptr;
 HardwareKeyboard *PageManager::mHardwareKeyboard = nullptr;
 bool PageManager::mReloadTheme = false;
 std::string PageManager::mStartPage = "main";
+GRRect PageManager::mDamage = { 0, 0, 0, 0 };
+std::atomic_bool PageManager::mDamageAll(true);
+GRRect PageManager::mFrameDamage[2] = {};
 std::vector<language_struct> Language_List;
 
 int tw_x_offset = 0;
 int tw_y_offset = 0;
 
+static bool rect_empty(const GRRect& rect)
+{
+    return rect.w <= 0 || rect.h <= 0;
+}
+
+static GRRect rect_union(const GRRect& a, const GRRect& b)
+{
+    if (rect_empty(a)) {
+        return b;
+    } else if (rect_empty(b)) {
+        return a;
+    }
+
+    int x1 = std::min(a.x, b.x);
+    int y1 = std::min(a.y, b.y);
+    int x2 = std::max(a.x + a.w, b.x + b.w);
+    int y2 = std::max(a.y + a.h, b.y + b.h);
+    return { x1, y1, x2 - x1, y2 - y1 };
+}
+
+static GRRect rect_clip_to_screen(const GRRect& rect)
+{
+    int x1 = std::max(rect.x, 0);
+    int y1 = std::max(rect.y, 0);
+    int x2 = std::min(rect.x + rect.w, gr_fb_width());
+    int y2 = std::min(rect.y + rect.h, gr_fb_height());
+    return { x1, y1, std::max(x2 - x1, 0), std::max(y2 - y1, 0) };
+}
+
 // Helper routine to convert a string to a color declaration
 int ConvertStrToColor(std::string str, COLOR* color)
 {
@@ -532,7 +564,12 @@ int Page::Update()
         int ret = (*iter)->Update();
         if (ret < 0) {
             LOGE("An update request has failed.");
-        } else if (ret > retCode) {
+            continue;
+        }
+        if (ret > 0) {
+            PageManager::AddDamage(*iter);
+        }
+        if (ret > retCode) {
             retCode = ret;
         }
     }
@@ -632,10 +669,22 @@ void Page::SetPageFocus(int inFocus)
 
 int Page::NotifyVarChange(const std::string& varName, const std::string& value)
 {
+    bool visibilityChanged = false;
+
     for (auto iter = mObjects.begin(); iter != mObjects.end(); ++iter) {
+        bool wasVisible = (*iter)->isConditionTrue();
         if ((*iter)->NotifyVarChange(varName, value)) {
             LOGE("An action handler errored on NotifyVarChange.");
         }
+        if ((*iter)->isConditionTrue() != wasVisible) {
+            visibilityChanged = true;
+        }
+    }
+
+    // Objects that appear or disappear don't necessarily report it in
+    // Update(), so don't rely on their damage
+    if (visibilityChanged) {
+        PageManager::InvalidateAll();
     }
     return 0;
 }
@@ -921,6 +970,7 @@ int PageSet::SetPage(const std::string& page)
         mCurrentPage = tmp;
         mCurrentPage->SetPageFocus(1);
         mCurrentPage->NotifyVarChange("", "");
+        PageManager::InvalidateAll();
         return 0;
     } else {
         LOGE("Unable to locate page (%s)", page.c_str());
@@ -964,6 +1014,7 @@ int PageSet::SetOverlay(Page* page)
             }
         }
     }
+    PageManager::InvalidateAll();
     return 0;
 }
 
@@ -1442,6 +1493,7 @@ PageSet* PageManager::SelectPackage(const std::string& name)
         mCurrentSet = tmp;
         mCurrentSet->MakeEmergencyConsoleIfNeeded();
         mCurrentSet->NotifyVarChange("", "");
+        InvalidateAll();
     } else {
         LOGE("Unable to find package.");
     }
@@ -1572,19 +1624,85 @@ int PageManager::IsCurrentPage(Page* page)
     return (mCurrentSet ? mCurrentSet->IsCurrentPage(page) : 0);
 }
 
+GRRect PageManager::GetRepaintRegion()
+{
+    if (mDamageAll.exchange(false)) {
+        mDamage = { 0, 0, gr_fb_width(), gr_fb_height() };
+    }
+
+    // The drawing surface still contains the frame from `age` flips ago, so
+    // everything that changed since then has to be repainted
+    int age = gr_fb_buffer_age();
+    if (age < 1 || age > 1 + (int) (sizeof(mFrameDamage) / sizeof(mFrameDamage[0]))) {
+        // Whatever is on the surface is unknown, so the whole frame must be
+        // repainted and presented
+        mDamage = { 0, 0, gr_fb_width(), gr_fb_height() };
+        return mDamage;
+    }
+
+    GRRect region = mDamage;
+    for (int i = 0; i < age - 1; ++i) {
+        region = rect_union(region, mFrameDamage[i]);
+    }
+    return rect_clip_to_screen(region);
+}
+
 int PageManager::Render()
 {
     if (blankTimer.isScreenOff()) {
         return 0;
     }
 
+    GRRect region = GetRepaintRegion();
+    if (rect_empty(region)) {
+        return 0;
+    }
+
+    // Everything is redrawn within the region in the usual order so that
+    // overlapping objects and overlays still come out right
+    gr_clip_bounds(&region);
+
     int res = (mCurrentSet ? mCurrentSet->Render() : -1);
     if (mMouseCursor) {
         mMouseCursor->Render();
     }
+
+    gr_clip_bounds(nullptr);
     return res;
 }
 
+void PageManager::AddDamage(RenderObject* object)
+{
+    GRRect rect;
+    if (object->GetDamageRect(rect.x, rect.y, rect.w, rect.h) < 0) {
+        rect = { 0, 0, gr_fb_width(), gr_fb_height() };
+    }
+    AddDamage(rect);
+}
+
+void PageManager::AddDamage(const GRRect& rect)
+{
+    mDamage = rect_union(mDamage, rect);
+}
+
+void PageManager::InvalidateAll()
+{
+    // May be called from action threads, so this is only picked up by the
+    // next Render()
+    mDamageAll = true;
+}
+
+GRRect PageManager::TakeFrameDamage()
+{
+    GRRect damage = rect_clip_to_screen(mDamage);
+
+    mFrameDamage[1] = mFrameDamage[0];
+    mFrameDamage[0] = damage;
+    mDamage = { 0, 0, 0, 0 };
+
+    return damage;
+}
+
 HardwareKeyboard *PageManager::GetHardwareKeyboard()
 {
     if (!mHardwareKeyboard) {
@@ -1648,10 +1766,18 @@ int PageManager::Update()
 
     if (mMouseCursor) {
         int c_res = mMouseCursor->Update();
+        if (c_res > 0) {
+            AddDamage(mMouseCursor);
+        }
         if (c_res > res) {
             res = c_res;
         }
     }
+
+    // Make sure that invalidations from outside of Update() get rendered
+    if (res >= 0 && res < 2 && mDamageAll) {
+        res = 2;
+    }
     return res;
 }
 
@@ -3,11 +3,13 @@
 #ifndef _PAGES_HEADER_HPP
 #define _PAGES_HEADER_HPP
 
+#include <atomic>
 #include <string>
 #include <unordered_map>
 #include <vector>
 
 #include "minzip/Zip.h"
+#include "minuitwrp/minui.h"
 
 #include "gui/gui.hpp"
 #include "gui/rapidxml.hpp"
@@ -185,12 +187,22 @@ public:
 
     static HardwareKeyboard *GetHardwareKeyboard();
 
+    // Damage tracking. Render() only repaints the regions reported since the
+    // last frame (plus whatever the backend's buffer age requires)
+    static void AddDamage(RenderObject* object);
+    static void AddDamage(const GRRect& rect);
+    static void InvalidateAll();
+    // Returns the region changed by the frame that is about to be flipped
+    // and starts a new frame
+    static GRRect TakeFrameDamage();
+
     static xml_node<>* FindStyle(std::string name);
     static void AddStringResource(std::string resource_source, std::string resource_name, std::string value);
 
 protected:
     static PageSet* FindPackage(const std::string& name);
     static void LoadLanguageListDir(const std::string& dir);
+    static GRRect GetRepaintRegion();
 
 protected:
     static std::unordered_map<std::string, PageSet*> mPageSets;
@@ -200,6 +212,9 @@ protected:
     static bool mReloadTheme;
     static std::string mStartPage;
     static LoadingContext* currentLoadingContext;
+    static GRRect mDamage;
+    static std::atomic_bool mDamageAll;
+    static GRRect mFrameDamage[2]; // Damage of previous frames, newest first
 };
 
 #endif  // _PAGES_HEADER_HPP
@@ -72,10 +72,7 @@ GUIPatternPassword::GUIPatternPassword(xml_node<>* node) : GUIObject(node)
         Resize(size);
     }
 
-    if (!mDotImage
-            || !mDotImage->GetResource()
-            || !mActiveDotImage
-            || !mActiveDotImage->GetResource()) {
+    if (!mDotImage || !mActiveDotImage) {
         mDotCircle = gr_render_circle(mDotRadius, mDotColor.red,
                                       mDotColor.green, mDotColor.blue,
                                       mDotColor.alpha);
@@ -51,8 +51,6 @@ int GUIProgressBar::Render()
         return 0;
     }
 
-    // This handles making sure timing updates occur
-    Update();
     return RenderInternal();
 }
 
@@ -148,6 +146,11 @@ int GUIProgressBar::Update()
     return 2;
 }
 
+int GUIProgressBar::GetDamageRect(int& x, int& y, int& w, int& h)
+{
+    return GetRenderPos(x, y, w, h);
+}
+
 int GUIProgressBar::NotifyVarChange(const std::string& varName,
                                     const std::string& value)
 {
@@ -34,6 +34,9 @@ public:
     //  Return 0 if nothing to update, 1 on success and contiue, >1 if full render required, and <0 on error
     virtual int Update();
 
+    // GetDamageRect - Returns the region that must be repainted after Update()
+    virtual int GetDamageRect(int& x, int& y, int& w, int& h);
+
     // NotifyVarChange - Notify of a variable change
     //  Returns 0 on success, <0 on error
     virtual int NotifyVarChange(const std::string& varName, const std::string& value);
@@ -2,8 +2,13 @@
 
 #include "gui/objects.hpp"
 
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
 #include <iomanip>
 #include <iostream>
+#include <mutex>
+#include <thread>
 
 #include <fcntl.h>
 #include <unistd.h>
@@ -18,6 +23,29 @@
 
 #define TMP_RESOURCE_NAME   "/tmp/extract.bin"
 
+// Upper bound for the memory used by decoded images that aren't pinned
+#define SURFACE_CACHE_MAX_BYTES (32 * 1024 * 1024)
+
+// Number of threads used to decode images in the background after a theme is
+// loaded
+#define PREFETCH_MAX_THREADS 4
+
+// Decoded lazy surfaces, protected by sSurfaceLock since pages can be loaded
+// outside of the render thread and images are prefetched by worker threads
+static std::mutex sSurfaceLock;
+static std::condition_variable sSurfaceCond;
+static std::vector<LazySurface*> sDecoded;
+static size_t sDecodedBytes = 0;
+static uint64_t sFrame = 0;
+static std::deque<LazySurface*> sPrefetchQueue;
+static unsigned int sPrefetchThreads = 0;
+
+static size_t surface_bytes(gr_surface surface)
+{
+    return static_cast<size_t>(gr_get_width(surface))
+            * gr_get_height(surface) * 4;
+}
+
 Resource::Resource(xml_node<>* node, ZipArchive* pZip __unused)
 {
     if (node && node->first_attribute("name")) {
@@ -101,6 +129,186 @@ void Resource::CheckAndScaleImage(gr_surface source, gr_surface* destination, in
     }
 }
 
+LazySurface::LazySurface(const std::string& file, bool retain_aspect)
+    : mFile(file)
+    , mRetainAspect(retain_aspect)
+    , mPinned(false)
+    , mDecoding(false)
+    , mFailed(false)
+    , mSurface(nullptr)
+    , mWidth(0)
+    , mHeight(0)
+    , mLastUsed(0)
+{
+}
+
+LazySurface::~LazySurface()
+{
+    std::unique_lock<std::mutex> lock(sSurfaceLock);
+    auto it = std::find(sPrefetchQueue.begin(), sPrefetchQueue.end(), this);
+    if (it != sPrefetchQueue.end()) {
+        sPrefetchQueue.erase(it);
+    }
+    sSurfaceCond.wait(lock, [this] { return !mDecoding; });
+    Drop();
+}
+
+bool LazySurface::Load(ZipArchive* pZip)
+{
+    int width, height;
+
+    if (pZip || res_get_surface_size(mFile.c_str(), &width, &height) != 0) {
+        gr_surface surface = Decode(pZip);
+        std::lock_guard<std::mutex> lock(sSurfaceLock);
+        Install(surface);
+        mPinned = pZip != nullptr;
+        return mSurface != nullptr;
+    }
+
+    // Must match the size computed by res_scale_surface()
+    if (get_scale_w() != 0 && get_scale_h() != 0) {
+        float scale_w = get_scale_w(), scale_h = get_scale_h();
+        if (mRetainAspect) {
+            scale_w = scale_h = std::min(scale_w, scale_h);
+        }
+        width = static_cast<int>(width * scale_w);
+        height = static_cast<int>(height * scale_h);
+    }
+
+    mWidth = width;
+    mHeight = height;
+    return true;
+}
+
+gr_surface LazySurface::Get()
+{
+    std::unique_lock<std::mutex> lock(sSurfaceLock);
+    // A prefetch worker might already be decoding this image
+    sSurfaceCond.wait(lock, [this] { return !mDecoding; });
+    if (!mSurface && !mPinned && !mFailed) {
+        mDecoding = true;
+        lock.unlock();
+        gr_surface surface = Decode(nullptr);
+        lock.lock();
+        Install(surface);
+    }
+    mLastUsed = sFrame;
+    return mSurface;
+}
+
+void LazySurface::NewFrame()
+{
+    std::lock_guard<std::mutex> lock(sSurfaceLock);
+    ++sFrame;
+}
+
+void LazySurface::Prefetch(const std::vector<LazySurface*>& surfaces)
+{
+    if (surfaces.empty()) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(sSurfaceLock);
+    sPrefetchQueue.insert(sPrefetchQueue.end(), surfaces.begin(), surfaces.end());
+
+    unsigned int threads = std::min(std::max(std::thread::hardware_concurrency(), 1u),
+                                    static_cast<unsigned int>(PREFETCH_MAX_THREADS));
+    while (sPrefetchThreads < threads && sPrefetchThreads < sPrefetchQueue.size()) {
+        std::thread(&LazySurface::PrefetchWorker).detach();
+        ++sPrefetchThreads;
+    }
+}
+
+void LazySurface::PrefetchWorker()
+{
+    std::unique_lock<std::mutex> lock(sSurfaceLock);
+    while (!sPrefetchQueue.empty()) {
+        LazySurface* s = sPrefetchQueue.front();
+        sPrefetchQueue.pop_front();
+        if (s->mSurface || s->mDecoding || s->mPinned || s->mFailed) {
+            continue;
+        }
+
+        // Don't evict images that have already been drawn
+        size_t bytes = static_cast<size_t>(s->mWidth) * s->mHeight * 4;
+        if (sDecodedBytes + bytes > SURFACE_CACHE_MAX_BYTES) {
+            sPrefetchQueue.clear();
+            break;
+        }
+
+        s->mDecoding = true;
+        lock.unlock();
+        gr_surface surface = s->Decode(nullptr);
+        lock.lock();
+        s->Install(surface);
+    }
+    --sPrefetchThreads;
+}
+
+gr_surface LazySurface::Decode(ZipArchive* pZip) const
+{
+    gr_surface temp_surface = nullptr;
+    gr_surface surface = nullptr;
+
+    Resource::LoadImage(pZip, mFile, &temp_surface);
+    Resource::CheckAndScaleImage(temp_surface, &surface, mRetainAspect);
+    return surface;
+}
+
+void LazySurface::Install(gr_surface surface)
+{
+    mDecoding = false;
+    sSurfaceCond.notify_all();
+
+    if (!surface) {
+        mFailed = true;
+        return;
+    }
+
+    mSurface = surface;
+    mWidth = gr_get_width(mSurface);
+    mHeight = gr_get_height(mSurface);
+    mLastUsed = sFrame;
+
+    sDecoded.push_back(this);
+    sDecodedBytes += surface_bytes(mSurface);
+    Trim();
+}
+
+void LazySurface::Drop()
+{
+    if (!mSurface) {
+        return;
+    }
+
+    auto it = std::find(sDecoded.begin(), sDecoded.end(), this);
+    if (it != sDecoded.end()) {
+        sDecoded.erase(it);
+    }
+    sDecodedBytes -= surface_bytes(mSurface);
+    res_free_surface(mSurface);
+    mSurface = nullptr;
+}
+
+void LazySurface::Trim()
+{
+    // Surfaces drawn in the current frame may still be in use, so the cache
+    // can temporarily grow past its limit
+    while (sDecodedBytes > SURFACE_CACHE_MAX_BYTES) {
+        LazySurface* victim = nullptr;
+        for (LazySurface* s : sDecoded) {
+            if (!s->mPinned && s->mLastUsed < sFrame
+                    && (!victim || s->mLastUsed < victim->mLastUsed)) {
+                victim = s;
+            }
+        }
+        if (!victim) {
+            break;
+        }
+        victim->Drop();
+    }
+}
+
 FontResource::FontResource(xml_node<>* node, ZipArchive* pZip)
     : Resource(node, pZip)
 {
@@ -196,9 +404,7 @@ ImageResource::ImageResource(xml_node<>* node, ZipArchive* pZip)
     : Resource(node, pZip)
 {
     std::string file;
-    gr_surface temp_surface = nullptr;
 
-    mSurface = nullptr;
     if (!node) {
         LOGE("ImageResource node is NULL");
         return;
@@ -213,15 +419,14 @@ ImageResource::ImageResource(xml_node<>* node, ZipArchive* pZip)
 
     bool retain_aspect = (node->first_attribute("retainaspect") != nullptr);
     // the value does not matter, if retainaspect is present, we assume that we want to retain it
-    LoadImage(pZip, file, &temp_surface);
-    CheckAndScaleImage(temp_surface, &mSurface, retain_aspect);
+    std::unique_ptr<LazySurface> surface(new LazySurface(file, retain_aspect));
+    if (surface->Load(pZip)) {
+        mSurface = std::move(surface);
+    }
 }
 
 ImageResource::~ImageResource()
 {
-    if (mSurface) {
-        res_free_surface(mSurface);
-    }
 }
 
 AnimationResource::AnimationResource(xml_node<>* node, ZipArchive* pZip)
@@ -247,11 +452,10 @@ AnimationResource::AnimationResource(xml_node<>* node, ZipArchive* pZip)
         std::ostringstream fileName;
         fileName << file << std::setfill ('0') << std::setw (3) << fileNum;
 
-        gr_surface surface, temp_surface = nullptr;
-        LoadImage(pZip, fileName.str(), &temp_surface);
-        CheckAndScaleImage(temp_surface, &surface, retain_aspect);
-        if (surface) {
-            mSurfaces.push_back(surface);
+        std::unique_ptr<LazySurface> surface(
+                new LazySurface(fileName.str(), retain_aspect));
+        if (surface->Load(pZip)) {
+            mSurfaces.push_back(std::move(surface));
             fileNum++;
         } else {
             break; // Done loading animation images
@@ -261,11 +465,6 @@ AnimationResource::AnimationResource(xml_node<>* node, ZipArchive* pZip)
 
 AnimationResource::~AnimationResource()
 {
-    for (auto it = mSurfaces.begin(); it != mSurfaces.end(); ++it) {
-        res_free_surface(*it);
-    }
-
-    mSurfaces.clear();
 }
 
 FontResource* ResourceManager::FindFont(const std::string& name) const
@@ -373,6 +572,10 @@ void ResourceManager::LoadResources(xml_node<>* resList, ZipArchive* pZip,
         return;
     }
 
+    // Images are only decoded when they're first drawn. Decode them in the
+    // background in the order they're listed so most are ready by then.
+    std::vector<LazySurface*> prefetch;
+
     for (xml_node<>* child = resList->first_node(); child; child = child->next_sibling()) {
         std::string type = child->name();
         if (type == "resource") {
@@ -411,8 +614,9 @@ void ResourceManager::LoadResources(xml_node<>* resList, ZipArchive* pZip,
             }
         } else if (type == "image") {
             ImageResource* res = new ImageResource(child, pZip);
-            if (res->GetResource()) {
+            if (res->IsValid()) {
                 mImages.push_back(res);
+                res->CollectSurfaces(prefetch);
             } else {
                 error = true;
                 delete res;
@@ -421,6 +625,7 @@ void ResourceManager::LoadResources(xml_node<>* resList, ZipArchive* pZip,
             AnimationResource* res = new AnimationResource(child, pZip);
             if (res->GetResourceCount()) {
                 mAnimations.push_back(res);
+                res->CollectSurfaces(prefetch);
             } else {
                 error = true;
                 delete res;
@@ -455,6 +660,8 @@ void ResourceManager::LoadResources(xml_node<>* resList, ZipArchive* pZip,
             }
         }
     }
+
+    LazySurface::Prefetch(prefetch);
 }
 
 ResourceManager::~ResourceManager()
@@ -3,6 +3,8 @@
 #ifndef _RESOURCE_HEADER
 #define _RESOURCE_HEADER
 
+#include <memory>
+
 #include "minuitwrp/minui.h"
 
 #include "gui/rapidxml.hpp"
@@ -26,6 +28,8 @@ private:
     std::string mName;
 
 protected:
+    friend class LazySurface;
+
     static int ExtractResource(ZipArchive* pZip,
                                const std::string& folderName,
                                const std::string& fileName,
@@ -37,6 +41,61 @@ protected:
                                    int retain_aspect);
 };
 
+// An image that is only decoded when it's first drawn. Decoded surfaces are
+// kept in a bounded cache and surfaces that haven't been drawn in the current
+// frame may be freed to make room for new ones. They are decoded again the
+// next time they're needed.
+class LazySurface
+{
+public:
+    LazySurface(const std::string& file, bool retain_aspect);
+    ~LazySurface();
+
+    // Reads the scaled size of the image. Images that can't be probed cheaply
+    // and images in zip archives are decoded immediately.
+    bool Load(ZipArchive* pZip);
+
+    gr_surface Get();
+
+    int GetWidth()
+    {
+        return mWidth;
+    }
+
+    int GetHeight()
+    {
+        return mHeight;
+    }
+
+    // Called at the start of every frame
+    static void NewFrame();
+
+    // Decodes the surfaces in the background, in order, until the cache is
+    // full
+    static void Prefetch(const std::vector<LazySurface*>& surfaces);
+
+private:
+    gr_surface Decode(ZipArchive* pZip) const;
+    void Install(gr_surface surface);
+    void Drop();
+    static void Trim();
+    static void PrefetchWorker();
+
+private:
+    std::string mFile;
+    bool mRetainAspect;
+    // Images from zip archives can't be decoded again after the archive is
+    // closed
+    bool mPinned;
+    // Set while the surface is being decoded without holding the cache lock
+    bool mDecoding;
+    bool mFailed;
+    gr_surface mSurface;
+    int mWidth;
+    int mHeight;
+    uint64_t mLastUsed;
+};
+
 class FontResource : public Resource
 {
 public:
@@ -85,33 +144,33 @@ public:
 public:
     gr_surface GetResource()
     {
-#if 0
-        return this ? mSurface : nullptr;
-#else
-        return mSurface;
-#endif
+        return mSurface ? mSurface->Get() : nullptr;
     }
 
     int GetWidth()
     {
-#if 0
-        return gr_get_width(this ? mSurface : nullptr);
-#else
-        return gr_get_width(mSurface);
-#endif
+        return mSurface ? mSurface->GetWidth() : 0;
     }
 
     int GetHeight()
     {
-#if 0
-        return gr_get_height(this ? mSurface : nullptr);
-#else
-        return gr_get_height(mSurface);
-#endif
+        return mSurface ? mSurface->GetHeight() : 0;
+    }
+
+    bool IsValid()
+    {
+        return mSurface != nullptr;
+    }
+
+    void CollectSurfaces(std::vector<LazySurface*>& surfaces)
+    {
+        if (mSurface) {
+            surfaces.push_back(mSurface.get());
+        }
     }
 
 protected:
-    gr_surface mSurface;
+    std::unique_ptr<LazySurface> mSurface;
 };
 
 class AnimationResource : public Resource
@@ -123,38 +182,22 @@ public:
 public:
     gr_surface GetResource()
     {
-#if 0
-        return (!this || mSurfaces.empty()) ? nullptr : mSurfaces.at(0);
-#else
-        return mSurfaces.empty() ? nullptr : mSurfaces.at(0);
-#endif
+        return mSurfaces.empty() ? nullptr : mSurfaces.at(0)->Get();
     }
 
     gr_surface GetResource(int entry)
     {
-#if 0
-        return (!this || mSurfaces.empty()) ? nullptr : mSurfaces.at(entry);
-#else
-        return mSurfaces.empty() ? nullptr : mSurfaces.at(entry);
-#endif
+        return mSurfaces.empty() ? nullptr : mSurfaces.at(entry)->Get();
     }
 
     int GetWidth()
     {
-#if 0
-        return gr_get_width(this ? GetResource() : nullptr);
-#else
-        return gr_get_width(GetResource());
-#endif
+        return mSurfaces.empty() ? 0 : mSurfaces.at(0)->GetWidth();
     }
 
     int GetHeight()
     {
-#if 0
-        return gr_get_height(this ? GetResource() : nullptr);
-#else
-        return gr_get_height(GetResource());
-#endif
+        return mSurfaces.empty() ? 0 : mSurfaces.at(0)->GetHeight();
     }
 
     int GetResourceCount()
@@ -162,8 +205,15 @@ public:
         return mSurfaces.size();
     }
 
+    void CollectSurfaces(std::vector<LazySurface*>& surfaces)
+    {
+        for (auto const& surface : mSurfaces) {
+            surfaces.push_back(surface.get());
+        }
+    }
+
 protected:
-    std::vector<gr_surface> mSurfaces;
+    std::vector<std::unique_ptr<LazySurface>> mSurfaces;
 };
 
 class ResourceManager
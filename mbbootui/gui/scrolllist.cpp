@@ -115,7 +115,7 @@ GUIScrollList::GUIScrollList(xml_node<>* node) : GUIObject(node)
         mHeaderSeparatorColor = LoadAttrColor(child, "separatorcolor", mSeparatorColor);
         mHeaderSeparatorH = LoadAttrIntScaleY(child, "separatorheight", mSeparatorH);
 
-        if (mHeaderIcon && mHeaderIcon->GetResource()) {
+        if (mHeaderIcon) {
             mHeaderIconWidth = mHeaderIcon->GetWidth();
             mHeaderIconHeight = mHeaderIcon->GetHeight();
             if (mHeaderIconHeight > mHeaderH) {
@@ -401,6 +401,13 @@ int GUIScrollList::Update()
     return 0;
 }
 
+int GUIScrollList::GetDamageRect(int& x, int& y, int& w, int& h)
+{
+    // Everything, including the header and fast scroll bar, is drawn inside
+    // the list's bounds
+    return GetRenderPos(x, y, w, h);
+}
+
 size_t GUIScrollList::HitTestItem(int x __unused, int y)
 {
     // We only care about y position
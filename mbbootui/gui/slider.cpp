@@ -62,7 +62,7 @@ GUISlider::GUISlider(xml_node<>* node) : GUIObject(node)
         sSliderLabel->SetRenderPos(sTextX, sTextY);
         sSliderLabel->SetMaxWidth(mRenderW);
     }
-    if (sTouch && sTouch->GetResource()) {
+    if (sTouch) {
         sTouchW = sTouch->GetWidth();  // Width of the "touch image" that follows the touch (arrow)
         sTouchH = sTouch->GetHeight(); // Height of the "touch image" that follows the touch (arrow)
     }
@@ -208,7 +208,7 @@ int GUISliderValue::SetRenderPos(int x, int y, int w, int h)
     mActionW = mRenderW;
     mActionH = mRenderH;
 
-    if (mBackgroundImage && mBackgroundImage->GetResource()) {
+    if (mBackgroundImage) {
         mLineW = mBackgroundImage->GetWidth();
         mLineH = mBackgroundImage->GetHeight();
     } else {
@@ -96,14 +96,9 @@ int GUIText::Render()
         return -1;
     }
 
-    mLastValue = gui_parse_text(mText);
-
-    mVarChanged = 0;
-
-    __attribute__((unused))
-    int x = mRenderX, y = mRenderY;
-    __attribute__((unused))
-    int width = gr_ttf_measureEx(mLastValue.c_str(), fontResource);
+    // Only Update() tracks the last value so that changes are still detected
+    // if this render was clipped away
+    std::string value = gui_parse_text(mText);
 
     if (isHighlighted) {
         gr_color(mHighlightColor.red, mHighlightColor.green,
@@ -112,7 +107,7 @@ int GUIText::Render()
         gr_color(mColor.red, mColor.green, mColor.blue, mColor.alpha);
     }
 
-    gr_textEx_scaleW(mRenderX, mRenderY, mLastValue.c_str(), fontResource,
+    gr_textEx_scaleW(mRenderX, mRenderY, value.c_str(), fontResource,
                      maxWidth, mPlacement, scaleWidth);
 
     return 0;
@@ -138,6 +133,8 @@ int GUIText::Update()
         return 0;
     }
 
+    mVarChanged = 0;
+
     std::string newValue = gui_parse_text(mText);
     if (mLastValue == newValue) {
         return 0;
@@ -147,6 +144,23 @@ int GUIText::Update()
     return 2;
 }
 
+int GUIText::GetDamageRect(int& x, int& y, int& w, int& h)
+{
+    // The width depends on the text, its placement and whether it had to be
+    // scaled down, so just damage the whole line
+    x = 0;
+    y = mRenderY;
+    w = gr_fb_width();
+    h = mFontHeight;
+
+    if (mPlacement == CENTER || mPlacement == TEXT_ONLY_RIGHT) {
+        y -= h / 2;
+    } else if (mPlacement == BOTTOM_LEFT || mPlacement == BOTTOM_RIGHT) {
+        y -= h;
+    }
+    return 0;
+}
+
 int GUIText::GetCurrentBounds(int& w, int& h)
 {
     void* fontResource = nullptr;
@@ -156,8 +170,7 @@ int GUIText::GetCurrentBounds(int& w, int& h)
     }
 
     h = mFontHeight;
-    mLastValue = gui_parse_text(mText);
-    w = gr_ttf_measureEx(mLastValue.c_str(), fontResource);
+    w = gr_ttf_measureEx(gui_parse_text(mText).c_str(), fontResource);
     return 0;
 }
 
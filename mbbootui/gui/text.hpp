@@ -37,6 +37,9 @@ public:
     //  Return 0 if nothing to update, 1 on success and contiue, >1 if full render required, and <0 on error
     virtual int Update();
 
+    // GetDamageRect - Returns the region that must be repainted after Update()
+    virtual int GetDamageRect(int& x, int& y, int& w, int& h);
+
     // Retrieve the size of the current string (dynamic strings may change per call)
     virtual int GetCurrentBounds(int& w, int& h);
 
@@ -31,6 +31,7 @@
 #include "mbdevice/json.h"
 #include "mblog/logging.h"
 #include "mbpatcher/patcherconfig.h"
+#include "mbutil/archive.h"
 #include "mbutil/copy.h"
 #include "mbutil/directory.h"
 #include "mbutil/file.h"
@@ -39,6 +40,7 @@
 #include <android/log.h>
 
 #include "gui/console.hpp"
+#include "gui/framestats.hpp"
 #include "gui/gui.h"
 // #include "gui/gui.hpp"
 #include "gui/pages.hpp"
@@ -150,7 +152,7 @@ static bool extract_theme(const std::string &path, const std::string &target,
     archive_write_disk_set_standard_lookup(out.get());
     archive_write_disk_set_options(out.get(), flags);
 
-    if (archive_read_open_filename(in.get(), path.c_str(), 10240) != ARCHIVE_OK) {
+    if (mb::util::libarchive_open_file(in.get(), path) != ARCHIVE_OK) {
         LOGE("%s: Failed to open file: %s",
              path.c_str(), archive_error_string(in.get()));
         return false;
@@ -352,6 +354,7 @@ static void usage(FILE *stream)
             "\n"
             "Options:\n"
             "  --no-log-file  Display output to stdout/stderr instead of log file\n"
+            "  --frame-stats  Show frame timings on screen and log them on exit\n"
             "  -h, --help     Display this help text\n");
 }
 
@@ -359,10 +362,12 @@ int main(int argc, char *argv[])
 {
     enum {
         OPT_NO_LOG_FILE = 1000,
+        OPT_FRAME_STATS = 1001,
     };
 
     static struct option long_options[] = {
         { "no-log-file", no_argument, 0, OPT_NO_LOG_FILE },
+        { "frame-stats", no_argument, 0, OPT_FRAME_STATS },
         { "help",        no_argument, 0, 'h'             },
         { 0, 0, 0, 0 }
     };
@@ -370,6 +375,7 @@ int main(int argc, char *argv[])
     int opt;
     int long_index = 0;
     bool no_log_file = false;
+    bool frame_stats = false;
 
     while ((opt = getopt_long(argc, argv, "h", long_options, &long_index)) != -1) {
         switch (opt) {
@@ -377,6 +383,10 @@ int main(int argc, char *argv[])
             no_log_file = true;
             break;
 
+        case OPT_FRAME_STATS:
+            frame_stats = true;
+            break;
+
         case 'h':
             usage(stdout);
             return EXIT_SUCCESS;
@@ -451,6 +461,9 @@ int main(int argc, char *argv[])
 
     LOGV("Loading default values...");
     DataManager::SetDefaultValues();
+    if (frame_stats) {
+        DataManager::SetValue(VAR_TW_FRAME_STATS, 1);
+    }
 
     // Set daemon version
     std::string mbtool_version;
@@ -490,6 +503,10 @@ int main(int argc, char *argv[])
     //gui_start();
     gui_startPage("autoboot", 1, 0);
 
+    if (DataManager::GetIntValue(VAR_TW_FRAME_STATS) != 0) {
+        frameStats.LogSummary();
+    }
+
     // Exit action
     std::string exit_action;
     DataManager::GetValue(VAR_TW_EXIT_ACTION, exit_action);
@@ -16,6 +16,7 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -40,6 +41,8 @@ struct adf_surface_pdata
     __u32 offset;
     __u32 pitch;
     unsigned char* adf_data;
+    // Signals once the surface is no longer scanned out, or -1
+    int fence_fd;
 };
 
 struct adf_pdata
@@ -52,14 +55,20 @@ struct adf_pdata
     unsigned int current_surface;
     unsigned int n_surfaces;
     adf_surface_pdata surfaces[2];
+
+    uint64_t refresh_ns;
 };
 
+// Give up waiting for a fence after this long
+#define ADF_FENCE_TIMEOUT_MS 1000
+
 static GRSurface* adf_flip(minui_backend *backend);
 static void adf_blank(minui_backend *backend, bool blank);
 
 static int adf_surface_init(adf_pdata *pdata, drm_mode_modeinfo *mode, adf_surface_pdata *surf)
 {
     memset(surf, 0, sizeof(*surf));
+    surf->fence_fd = -1;
 
     surf->fd = adf_interface_simple_buffer_alloc(pdata->intf_fd, mode->hdisplay,
             mode->vdisplay, pdata->format, &surf->offset, &surf->pitch);
@@ -106,6 +115,16 @@ static int adf_interface_init(adf_pdata *pdata)
         return err;
     }
 
+    if (intf_data.current_mode.clock > 0 && intf_data.current_mode.htotal > 0
+            && intf_data.current_mode.vtotal > 0) {
+        // The pixel clock is in kHz
+        pdata->refresh_ns = static_cast<uint64_t>(intf_data.current_mode.htotal)
+                * intf_data.current_mode.vtotal * 1000000u
+                / intf_data.current_mode.clock;
+    } else {
+        pdata->refresh_ns = 0;
+    }
+
     err = adf_surface_init(pdata, &intf_data.current_mode, &pdata->surfaces[0]);
     if (err < 0) {
         fprintf(stderr, "allocating surface 0 failed: %s\n", strerror(-err));
@@ -241,23 +260,69 @@ static GRSurface* adf_init(minui_backend *backend)
     return ret;
 }
 
+// Wait until the surface's previous post has been replaced on screen. Returns
+// 0 when the surface is free, 1 on timeout, or -1 on error.
+static int adf_fence_wait(adf_surface_pdata *surf, int timeout_ms)
+{
+    if (surf->fence_fd < 0) {
+        return 0;
+    }
+
+    pollfd pfd = { surf->fence_fd, POLLIN, 0 };
+    int ret;
+    do {
+        ret = poll(&pfd, 1, timeout_ms);
+    } while (ret < 0 && errno == EINTR);
+
+    if (ret == 0) {
+        return 1;
+    } else if (ret < 0) {
+        perror("poll() failed");
+    }
+
+    close(surf->fence_fd);
+    surf->fence_fd = -1;
+    return ret < 0 ? -1 : 0;
+}
+
 static GRSurface* adf_flip(minui_backend *backend)
 {
     adf_pdata *pdata = (adf_pdata *)backend;
     adf_surface_pdata *surf = &pdata->surfaces[pdata->current_surface];
 
+    // Don't tear the frame that's still being scanned out
+    if (adf_fence_wait(surf, ADF_FENCE_TIMEOUT_MS) == 1) {
+        fprintf(stderr, "timed out waiting for adf fence\n");
+        close(surf->fence_fd);
+        surf->fence_fd = -1;
+    }
+
     memcpy(surf->adf_data, surf->base.data, surf->pitch * surf->base.height);
-    int fence_fd = adf_interface_simple_post(pdata->intf_fd, pdata->eng_id,
+    surf->fence_fd = adf_interface_simple_post(pdata->intf_fd, pdata->eng_id,
             surf->base.width, surf->base.height, pdata->format, surf->fd,
             surf->offset, surf->pitch, -1);
-    if (fence_fd >= 0) {
-        close(fence_fd);
+    if (surf->fence_fd < 0) {
+        surf->fence_fd = -1;
     }
 
     pdata->current_surface = (pdata->current_surface + 1) % pdata->n_surfaces;
     return &pdata->surfaces[pdata->current_surface].base;
 }
 
+static int adf_wait_frame(minui_backend *backend, int timeout_ms)
+{
+    adf_pdata *pdata = (adf_pdata *)backend;
+    return adf_fence_wait(&pdata->surfaces[pdata->current_surface], timeout_ms);
+}
+
+static void adf_frame_stats(minui_backend *backend, GRFrameStats *stats)
+{
+    adf_pdata *pdata = (adf_pdata *)backend;
+    // Fences only say when a buffer was released, not when its successor
+    // was shown, so late frames can't be detected
+    stats->refresh_ns = pdata->refresh_ns;
+}
+
 static void adf_blank(minui_backend *backend, bool blank)
 {
     adf_pdata *pdata = (adf_pdata *)backend;
@@ -267,6 +332,9 @@ static void adf_blank(minui_backend *backend, bool blank)
 
 static void adf_surface_destroy(adf_surface_pdata *surf)
 {
+    if (surf->fence_fd >= 0) {
+        close(surf->fence_fd);
+    }
     munmap(surf->adf_data, surf->pitch * surf->base.height);
     close(surf->fd);
 }
@@ -298,5 +366,7 @@ extern "C" struct minui_backend * BACKEND_FUNCTION(adf)()
     pdata->base.flip = adf_flip;
     pdata->base.blank = adf_blank;
     pdata->base.exit = adf_exit;
+    pdata->base.wait_frame = adf_wait_frame;
+    pdata->base.frame_stats = adf_frame_stats;
     return &pdata->base;
 }
@@ -14,8 +14,13 @@
  * limitations under the License.
  */
 
+#include <algorithm>
+#include <vector>
+
 #include <drm_fourcc.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -44,14 +49,36 @@ struct drm_surface
     uint32_t handle;
 };
 
-static drm_surface *drm_surfaces[2];
+// With three buffers, the next frame can be drawn while the previous flip is
+// still waiting for vsync: one buffer is scanned out, one may be queued and
+// one is drawn into
+#define DRM_NUM_BUFFERS 3
+
+// Give up waiting for a flip event after this long (eg. if the CRTC was
+// disabled while a flip was queued)
+#define DRM_FLIP_TIMEOUT_MS 1000
+
+static drm_surface *drm_surfaces[DRM_NUM_BUFFERS];
 static int current_buffer;
+static int front_buffer;
+static int pending_buffer;
+
+// Whether a flip has been queued, but has not reached the screen yet
+static bool flip_pending;
+static uint64_t flip_submit_ns;
+
+static bool timestamps_monotonic;
+static uint64_t refresh_ns;
+static uint64_t missed_vsyncs;
 
 static drmModeCrtc *main_monitor_crtc;
 static drmModeConnector *main_monitor_connector;
 
 static int drm_fd = -1;
 
+// Cleared if the driver rejects drmModeDirtyFB()
+static bool dirty_fb_supported = true;
+
 static void drm_disable_crtc(int drm_fd, drmModeCrtc *crtc)
 {
     if (crtc) {
@@ -81,13 +108,84 @@ static void drm_enable_crtc(int drm_fd, drmModeCrtc *crtc,
     }
 }
 
+static void drm_page_flip_handler(int fd __unused, unsigned int sequence __unused,
+                                  unsigned int tv_sec, unsigned int tv_usec,
+                                  void *user_data __unused)
+{
+    uint64_t shown_ns;
+    if (timestamps_monotonic) {
+        shown_ns = static_cast<uint64_t>(tv_sec) * 1000000000u
+                + static_cast<uint64_t>(tv_usec) * 1000u;
+    } else {
+        shown_ns = gr_monotonic_ns();
+    }
+
+    missed_vsyncs += gr_missed_vsyncs(flip_submit_ns, shown_ns, refresh_ns);
+    front_buffer = pending_buffer;
+    flip_pending = false;
+}
+
+// Wait for the queued flip to complete. Returns 0 if no flip is pending
+// anymore, 1 on timeout, or -1 on error.
+static int drm_wait_flip(int timeout_ms)
+{
+    drmEventContext evctx;
+    memset(&evctx, 0, sizeof(evctx));
+    evctx.version = 2;
+    evctx.page_flip_handler = drm_page_flip_handler;
+
+    uint64_t deadline_ns = gr_monotonic_ns()
+            + static_cast<uint64_t>(std::max(timeout_ms, 0)) * 1000000u;
+
+    while (flip_pending) {
+        int wait_ms = -1;
+        if (timeout_ms >= 0) {
+            uint64_t now_ns = gr_monotonic_ns();
+            wait_ms = now_ns >= deadline_ns
+                    ? 0 : (deadline_ns - now_ns + 999999) / 1000000;
+        }
+
+        pollfd pfd = { drm_fd, POLLIN, 0 };
+        int ret = poll(&pfd, 1, wait_ms);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("poll() failed");
+            return -1;
+        } else if (ret == 0) {
+            return 1;
+        }
+
+        ret = drmHandleEvent(drm_fd, &evctx);
+        if (ret != 0) {
+            printf("drmHandleEvent failed ret=%d\n", ret);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+// Wait for the queued flip before changing the CRTC configuration
+static void drm_finish_flip()
+{
+    if (drm_wait_flip(DRM_FLIP_TIMEOUT_MS) != 0) {
+        printf("Timed out waiting for page flip\n");
+        front_buffer = pending_buffer;
+        flip_pending = false;
+    }
+}
+
 static void drm_blank(minui_backend* backend __unused, bool blank)
 {
+    drm_finish_flip();
+
     if (blank) {
         drm_disable_crtc(drm_fd, main_monitor_crtc);
     } else {
         drm_enable_crtc(drm_fd, main_monitor_crtc,
-                        drm_surfaces[current_buffer]);
+                        drm_surfaces[front_buffer]);
     }
 }
 
@@ -473,19 +571,40 @@ static GRSurface* drm_init(minui_backend* backend __unused)
 
     drmModeFreeResources(res);
 
-    drm_surfaces[0] = drm_create_surface(width, height);
-    drm_surfaces[1] = drm_create_surface(width, height);
-    if (!drm_surfaces[0] || !drm_surfaces[1]) {
-        drm_destroy_surface(drm_surfaces[0]);
-        drm_destroy_surface(drm_surfaces[1]);
-        drmModeFreeResources(res);
-        close(drm_fd);
-        return nullptr;
+    for (i = 0; i < DRM_NUM_BUFFERS; ++i) {
+        drm_surfaces[i] = drm_create_surface(width, height);
+        if (!drm_surfaces[i]) {
+            while (i-- > 0) {
+                drm_destroy_surface(drm_surfaces[i]);
+                drm_surfaces[i] = nullptr;
+            }
+            close(drm_fd);
+            return nullptr;
+        }
     }
 
+    uint64_t cap = 0;
+    timestamps_monotonic =
+            drmGetCap(drm_fd, DRM_CAP_TIMESTAMP_MONOTONIC, &cap) == 0 && cap;
+
+    const drmModeModeInfo &mode = main_monitor_crtc->mode;
+    if (mode.clock > 0 && mode.htotal > 0 && mode.vtotal > 0) {
+        // The pixel clock is in kHz
+        refresh_ns = static_cast<uint64_t>(mode.htotal) * mode.vtotal
+                * 1000000u / mode.clock;
+    } else if (mode.vrefresh > 0) {
+        refresh_ns = 1000000000u / mode.vrefresh;
+    } else {
+        refresh_ns = 0;
+    }
+
+    flip_pending = false;
+    missed_vsyncs = 0;
     current_buffer = 0;
+    front_buffer = DRM_NUM_BUFFERS - 1;
+    pending_buffer = front_buffer;
 
-    drm_enable_crtc(drm_fd, main_monitor_crtc, drm_surfaces[1]);
+    drm_enable_crtc(drm_fd, main_monitor_crtc, drm_surfaces[front_buffer]);
 
     return &(drm_surfaces[0]->base);
 }
@@ -494,21 +613,92 @@ static GRSurface* drm_flip(minui_backend* backend __unused)
 {
     int ret;
 
+    // Only one flip can be queued at a time. Usually, the previous one
+    // completed while this frame was being drawn.
+    drm_finish_flip();
+
     ret = drmModePageFlip(drm_fd, main_monitor_crtc->crtc_id,
-                          drm_surfaces[current_buffer]->fb_id, 0, nullptr);
+                          drm_surfaces[current_buffer]->fb_id,
+                          DRM_MODE_PAGE_FLIP_EVENT, nullptr);
     if (ret < 0) {
         printf("drmModePageFlip failed ret=%d\n", ret);
         return nullptr;
     }
-    current_buffer = 1 - current_buffer;
+
+    flip_pending = true;
+    flip_submit_ns = gr_monotonic_ns();
+    pending_buffer = current_buffer;
+
+    // Neither scanned out nor queued
+    current_buffer = (current_buffer + 1) % DRM_NUM_BUFFERS;
     return &(drm_surfaces[current_buffer]->base);
 }
 
+static int drm_buffer_age(minui_backend* backend __unused)
+{
+    // The buffers are used round-robin, so the one being drawn into was
+    // displayed DRM_NUM_BUFFERS flips ago
+    return DRM_NUM_BUFFERS;
+}
+
+static int drm_wait_frame(minui_backend* backend __unused, int timeout_ms)
+{
+    return drm_wait_flip(timeout_ms);
+}
+
+static void drm_frame_stats(minui_backend* backend __unused,
+                            GRFrameStats* stats)
+{
+    stats->missed_vsyncs = missed_vsyncs;
+    stats->refresh_ns = refresh_ns;
+}
+
+static GRSurface* drm_flip_damage(minui_backend* backend,
+                                  const GRRect* rects, int count)
+{
+    drm_surface *surface = drm_surfaces[current_buffer];
+
+    // Panels that need explicit updates (eg. command mode DSI panels) only
+    // have to transfer the changed regions
+    if (dirty_fb_supported && count > 0) {
+        std::vector<drmModeClip> clips(count);
+        int n = 0;
+
+        for (int i = 0; i < count; ++i) {
+            int x1 = std::max(rects[i].x, 0);
+            int y1 = std::max(rects[i].y, 0);
+            int x2 = std::min(rects[i].x + rects[i].w, surface->base.width);
+            int y2 = std::min(rects[i].y + rects[i].h, surface->base.height);
+
+            if (x1 < x2 && y1 < y2) {
+                clips[n].x1 = x1;
+                clips[n].y1 = y1;
+                clips[n].x2 = x2;
+                clips[n].y2 = y2;
+                ++n;
+            }
+        }
+
+        if (n > 0) {
+            int ret = drmModeDirtyFB(drm_fd, surface->fb_id, clips.data(), n);
+            if (ret < 0) {
+                printf("drmModeDirtyFB failed ret=%d; disabling partial updates\n", ret);
+                dirty_fb_supported = false;
+            }
+        }
+    }
+
+    return drm_flip(backend);
+}
+
 static void drm_exit(minui_backend* backend __unused)
 {
+    drm_finish_flip();
     drm_disable_crtc(drm_fd, main_monitor_crtc);
-    drm_destroy_surface(drm_surfaces[0]);
-    drm_destroy_surface(drm_surfaces[1]);
+    for (int i = 0; i < DRM_NUM_BUFFERS; ++i) {
+        drm_destroy_surface(drm_surfaces[i]);
+        drm_surfaces[i] = nullptr;
+    }
     drmModeFreeCrtc(main_monitor_crtc);
     drmModeFreeConnector(main_monitor_connector);
     close(drm_fd);
@@ -520,6 +710,10 @@ static minui_backend drm_backend = {
     .flip = drm_flip,
     .blank = drm_blank,
     .exit = drm_exit,
+    .buffer_age = drm_buffer_age,
+    .flip_damage = drm_flip_damage,
+    .wait_frame = drm_wait_frame,
+    .frame_stats = drm_frame_stats,
 };
 
 extern "C" struct minui_backend * BACKEND_FUNCTION(drm)() {
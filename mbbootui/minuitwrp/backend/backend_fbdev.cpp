@@ -14,6 +14,9 @@
  * limitations under the License.
  */
 
+#include <algorithm>
+
+#include <errno.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
@@ -41,12 +44,29 @@ static GRSurface* fbdev_init(minui_backend*);
 static GRSurface* fbdev_flip(minui_backend*);
 static void fbdev_blank(minui_backend*, bool);
 static void fbdev_exit(minui_backend*);
+static int fbdev_buffer_age(minui_backend*);
+static GRSurface* fbdev_flip_damage(minui_backend*, const GRRect*, int);
+static int fbdev_wait_frame(minui_backend*, int);
+static void fbdev_frame_stats(minui_backend*, GRFrameStats*);
 
 static GRSurface gr_framebuffer[2];
 static bool double_buffered;
 static GRSurface* gr_draw = nullptr;
 static int displayed_buffer;
 
+// Rows copied to the framebuffer by the previous flip. With double buffering,
+// the back buffer is two frames old and these rows must be copied again.
+static int last_damage_begin;
+static int last_damage_end;
+
+// When the framebuffer was last panned to the other buffer, or 0 if the pan
+// has reached the screen. Until then, the old front buffer is still scanned
+// out and must not be copied into.
+static uint64_t pan_submit_ns;
+static bool wait_for_vsync_supported;
+static uint64_t refresh_ns;
+static uint64_t missed_vsyncs;
+
 static fb_var_screeninfo vi;
 static int fb_fd = -1;
 static __u32 smem_len;
@@ -56,6 +76,10 @@ static minui_backend my_backend = {
     .flip = fbdev_flip,
     .blank = fbdev_blank,
     .exit = fbdev_exit,
+    .buffer_age = fbdev_buffer_age,
+    .flip_damage = fbdev_flip_damage,
+    .wait_frame = fbdev_wait_frame,
+    .frame_stats = fbdev_frame_stats,
 };
 
 extern "C" struct minui_backend * BACKEND_FUNCTION(fbdev)()
@@ -116,6 +140,7 @@ static void set_displayed_framebuffer(unsigned n)
         perror("active fb swap failed");
     }
     displayed_buffer = n;
+    pan_submit_ns = gr_monotonic_ns();
 }
 
 static GRSurface* fbdev_init(minui_backend* backend)
@@ -265,6 +290,22 @@ static GRSurface* fbdev_init(minui_backend* backend)
     fb_fd = fd;
     set_displayed_framebuffer(0);
 
+    // The pixel clock is in picoseconds. Some drivers report nonsense, so
+    // only trust refresh rates between 10 and 240 Hz.
+    refresh_ns = 0;
+    if (vi.pixclock > 0) {
+        uint64_t htotal = vi.left_margin + vi.xres + vi.right_margin
+                + vi.hsync_len;
+        uint64_t vtotal = vi.upper_margin + vi.yres + vi.lower_margin
+                + vi.vsync_len;
+        uint64_t ns = htotal * vtotal * vi.pixclock / 1000;
+        if (ns >= 1000000000u / 240 && ns <= 1000000000u / 10) {
+            refresh_ns = ns;
+        }
+    }
+    wait_for_vsync_supported = true;
+    missed_vsyncs = 0;
+
     printf("framebuffer: %d (%d x %d)\n", fb_fd, gr_draw->width, gr_draw->height);
 
     fbdev_blank(backend, true);
@@ -272,17 +313,27 @@ static GRSurface* fbdev_init(minui_backend* backend)
 
     smem_len = fi.smem_len;
 
+    last_damage_begin = 0;
+    last_damage_end = gr_draw->height;
+
     return gr_draw;
 }
 
-static GRSurface* fbdev_flip(minui_backend* backend __unused)
+// Copy rows [begin, end) of the in-memory surface to the framebuffer and
+// display it.
+static void fbdev_flip_rows(int begin, int end)
 {
+    // Don't tear the frame that's still being scanned out
+    if (double_buffered) {
+        fbdev_wait_frame(&my_backend, -1);
+    }
+
     if (tw_device.tw_pixel_format() == mb::device::TwPixelFormat::Bgra8888) {
         // In case of BGRA, do some byte swapping
         unsigned int idx;
         unsigned char tmp;
         unsigned char* ucfb_vaddr = (unsigned char*)gr_draw->data;
-        for (idx = 0 ; idx < (gr_draw->height * gr_draw->row_bytes);
+        for (idx = begin * gr_draw->row_bytes; idx < (end * gr_draw->row_bytes);
                 idx += 4) {
             tmp = ucfb_vaddr[idx];
             ucfb_vaddr[idx    ] = ucfb_vaddr[idx + 2];
@@ -290,15 +341,18 @@ static GRSurface* fbdev_flip(minui_backend* backend __unused)
         }
     }
     if (!(tw_device.tw_flags() & mb::device::TwFlag::BoardHasFlippedScreen)) {
+        size_t offset = begin * gr_draw->row_bytes;
+        size_t size = (end - begin) * gr_draw->row_bytes;
+
         if (double_buffered) {
             // Copy from the in-memory surface to the framebuffer.
-            memcpy(gr_framebuffer[1-displayed_buffer].data, gr_draw->data,
-                   gr_draw->height * gr_draw->row_bytes);
+            memcpy(gr_framebuffer[1-displayed_buffer].data + offset,
+                   gr_draw->data + offset, size);
             set_displayed_framebuffer(1-displayed_buffer);
         } else {
             // Copy from the in-memory surface to the framebuffer.
-            memcpy(gr_framebuffer[0].data, gr_draw->data,
-                   gr_draw->height * gr_draw->row_bytes);
+            memcpy(gr_framebuffer[0].data + offset,
+                   gr_draw->data + offset, size);
         }
     } else {
         int gr_active_fb = 0;
@@ -306,10 +360,14 @@ static GRSurface* fbdev_flip(minui_backend* backend __unused)
             gr_active_fb = 1-displayed_buffer;
         }
 
+        // Source rows [begin, end) end up upside down in the framebuffer
+        unsigned int dst_begin = gr_draw->height - end;
+        unsigned int dst_end = gr_draw->height - begin;
+
         /* flip buffer 180 degrees for devices with physically inverted screens */
         unsigned int row_pixels = gr_draw->row_bytes / gr_framebuffer[0].pixel_bytes;
         if (gr_framebuffer[0].pixel_bytes == 4) {
-            for (unsigned int y = 0; y < gr_draw->height; ++y) {
+            for (unsigned int y = dst_begin; y < dst_end; ++y) {
                 uint32_t* dst = reinterpret_cast<uint32_t*>(gr_framebuffer[gr_active_fb].data) + y * row_pixels;
                 uint32_t* src = reinterpret_cast<uint32_t*>(gr_draw->data) + (gr_draw->height - y - 1) * row_pixels + gr_draw->width;
                 for (unsigned int x = 0; x < gr_draw->width; ++x) {
@@ -317,7 +375,7 @@ static GRSurface* fbdev_flip(minui_backend* backend __unused)
                 }
             }
         } else {
-            for (unsigned int y = 0; y < gr_draw->height; ++y) {
+            for (unsigned int y = dst_begin; y < dst_end; ++y) {
                 uint16_t* dst = reinterpret_cast<uint16_t*>(gr_framebuffer[gr_active_fb].data) + y * row_pixels;
                 uint16_t* src = reinterpret_cast<uint16_t*>(gr_draw->data) + (gr_draw->height - y - 1) * row_pixels + gr_draw->width;
                 for (unsigned int x = 0; x < gr_draw->width; ++x) {
@@ -330,6 +388,117 @@ static GRSurface* fbdev_flip(minui_backend* backend __unused)
             set_displayed_framebuffer(1-displayed_buffer);
         }
     }
+}
+
+static GRSurface* fbdev_flip(minui_backend* backend __unused)
+{
+    fbdev_flip_rows(0, gr_draw->height);
+
+    last_damage_begin = 0;
+    last_damage_end = gr_draw->height;
+
+    return gr_draw;
+}
+
+static int fbdev_buffer_age(minui_backend* backend __unused)
+{
+    // The BGRA byte swap happens in place, so the in-memory surface no longer
+    // holds what was drawn after a flip
+    if (tw_device.tw_pixel_format() == mb::device::TwPixelFormat::Bgra8888) {
+        return 0;
+    }
+
+    // Otherwise, the in-memory surface is never touched by flips
+    return 1;
+}
+
+static int fbdev_wait_frame(minui_backend* backend __unused, int timeout_ms)
+{
+    if (pan_submit_ns == 0) {
+        return 0;
+    }
+
+    // The pan takes effect at the first vsync after it was issued
+    if (!wait_for_vsync_supported || (refresh_ns != 0
+            && gr_monotonic_ns() - pan_submit_ns >= refresh_ns)) {
+        pan_submit_ns = 0;
+        return 0;
+    }
+
+    // FBIO_WAITFORVSYNC can't be polled, so the timeout is either zero or at
+    // most one refresh interval
+    if (timeout_ms == 0) {
+        return 1;
+    }
+
+    __u32 crtc = 0;
+    if (ioctl(fb_fd, FBIO_WAITFORVSYNC, &crtc) < 0) {
+        if (errno == EINTR) {
+            return 1;
+        }
+        perror("FBIO_WAITFORVSYNC failed; not pacing frames");
+        wait_for_vsync_supported = false;
+    } else {
+        missed_vsyncs += gr_missed_vsyncs(pan_submit_ns, gr_monotonic_ns(),
+                                          refresh_ns);
+    }
+
+    pan_submit_ns = 0;
+    return 0;
+}
+
+static void fbdev_frame_stats(minui_backend* backend __unused,
+                              GRFrameStats* stats)
+{
+    stats->missed_vsyncs = missed_vsyncs;
+    stats->refresh_ns = refresh_ns;
+}
+
+static GRSurface* fbdev_flip_damage(minui_backend* backend,
+                                    const GRRect* rects, int count)
+{
+    if (tw_device.tw_pixel_format() == mb::device::TwPixelFormat::Bgra8888) {
+        return fbdev_flip(backend);
+    }
+
+    // Copying whole rows keeps each copy a single contiguous memcpy
+    int begin = gr_draw->height;
+    int end = 0;
+
+    for (int i = 0; i < count; ++i) {
+        if (rects[i].w <= 0 || rects[i].h <= 0) {
+            continue;
+        }
+        begin = std::min(begin, rects[i].y);
+        end = std::max(end, rects[i].y + rects[i].h);
+    }
+
+    begin = std::max(begin, 0);
+    end = std::min(end, gr_draw->height);
+
+    int copy_begin = begin;
+    int copy_end = end;
+
+    if (double_buffered && last_damage_begin < last_damage_end) {
+        if (copy_begin >= copy_end) {
+            copy_begin = last_damage_begin;
+            copy_end = last_damage_end;
+        } else {
+            copy_begin = std::min(copy_begin, last_damage_begin);
+            copy_end = std::max(copy_end, last_damage_end);
+        }
+    }
+
+    // Nothing changed, so keep displaying the current buffer
+    if (copy_begin >= copy_end) {
+        return gr_draw;
+    }
+
+    fbdev_flip_rows(copy_begin, copy_end);
+
+    last_damage_begin = begin;
+    last_damage_end = end;
+
     return gr_draw;
 }
 
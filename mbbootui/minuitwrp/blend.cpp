@@ -0,0 +1,349 @@
+/*
+ * Copyright (C) 2018 Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "blend.h"
+
+#include <cstring>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#  include <arm_neon.h>
+#  define BLEND_USE_NEON 1
+#elif defined(__SSE2__)
+#  include <emmintrin.h>
+#  define BLEND_USE_SSE2 1
+#endif
+
+// (v / 255) rounded to the nearest integer for v <= 255 * 255
+static inline uint8_t div255(unsigned int v)
+{
+    v += 128;
+    return static_cast<uint8_t>((v + (v >> 8)) >> 8);
+}
+
+static inline void blend_pixel(uint8_t *d, const uint8_t *s, bool swap_rb)
+{
+    uint8_t a = s[3];
+    uint8_t ia = 255 - a;
+
+    if (a == 255) {
+        d[0] = s[swap_rb ? 2 : 0];
+        d[1] = s[1];
+        d[2] = s[swap_rb ? 0 : 2];
+        d[3] = 255;
+    } else if (a != 0) {
+        d[0] = div255(s[swap_rb ? 2 : 0] * a + d[0] * ia);
+        d[1] = div255(s[1] * a + d[1] * ia);
+        d[2] = div255(s[swap_rb ? 0 : 2] * a + d[2] * ia);
+        d[3] = div255(a * a + d[3] * ia);
+    }
+}
+
+#if BLEND_USE_SSE2
+
+static inline __m128i sse2_swap_rb(__m128i p)
+{
+    __m128i ga = _mm_and_si128(p, _mm_set1_epi32(0xff00ff00));
+    __m128i rb = _mm_and_si128(p, _mm_set1_epi32(0x00ff00ff));
+    rb = _mm_or_si128(_mm_slli_epi32(rb, 16), _mm_srli_epi32(rb, 16));
+    return _mm_or_si128(ga, rb);
+}
+
+// Same as div255() for each 16-bit lane
+static inline __m128i sse2_div255(__m128i v)
+{
+    v = _mm_add_epi16(v, _mm_set1_epi16(128));
+    return _mm_srli_epi16(_mm_add_epi16(v, _mm_srli_epi16(v, 8)), 8);
+}
+
+// Blend two unpacked pixels
+static inline __m128i sse2_blend_half(__m128i s, __m128i d)
+{
+    __m128i a = _mm_shufflelo_epi16(s, _MM_SHUFFLE(3, 3, 3, 3));
+    a = _mm_shufflehi_epi16(a, _MM_SHUFFLE(3, 3, 3, 3));
+    __m128i ia = _mm_xor_si128(a, _mm_set1_epi16(0xff));
+
+    return sse2_div255(_mm_add_epi16(_mm_mullo_epi16(s, a),
+                                     _mm_mullo_epi16(d, ia)));
+}
+
+#endif
+
+void blend_fill(uint8_t *dst, size_t dst_stride, int w, int h, uint32_t pixel)
+{
+    for (int y = 0; y < h; ++y) {
+        uint32_t *d = reinterpret_cast<uint32_t *>(dst + y * dst_stride);
+        int x = 0;
+
+#if BLEND_USE_NEON
+        uint32x4_t v = vdupq_n_u32(pixel);
+        for (; x + 4 <= w; x += 4) {
+            vst1q_u32(d + x, v);
+        }
+#elif BLEND_USE_SSE2
+        __m128i v = _mm_set1_epi32(static_cast<int>(pixel));
+        for (; x + 4 <= w; x += 4) {
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(d + x), v);
+        }
+#endif
+
+        for (; x < w; ++x) {
+            d[x] = pixel;
+        }
+    }
+}
+
+void blend_fill_alpha(uint8_t *dst, size_t dst_stride, int w, int h,
+                      const uint8_t color[4])
+{
+    uint8_t a = color[3];
+    uint8_t ia = 255 - a;
+
+    for (int y = 0; y < h; ++y) {
+        uint8_t *d = dst + y * dst_stride;
+        int x = 0;
+
+#if BLEND_USE_NEON
+        uint16x8_t c[4];
+        for (int i = 0; i < 4; ++i) {
+            c[i] = vdupq_n_u16(color[i] * a);
+        }
+        uint8x8_t via = vdup_n_u8(ia);
+
+        for (; x + 8 <= w; x += 8) {
+            uint8x8x4_t p = vld4_u8(d + x * 4);
+            for (int i = 0; i < 4; ++i) {
+                uint16x8_t t = vmlal_u8(c[i], p.val[i], via);
+                p.val[i] = vraddhn_u16(t, vrshrq_n_u16(t, 8));
+            }
+            vst4_u8(d + x * 4, p);
+        }
+#elif BLEND_USE_SSE2
+        __m128i c = _mm_setr_epi16(
+                static_cast<short>(color[0] * a), static_cast<short>(color[1] * a),
+                static_cast<short>(color[2] * a), static_cast<short>(color[3] * a),
+                static_cast<short>(color[0] * a), static_cast<short>(color[1] * a),
+                static_cast<short>(color[2] * a), static_cast<short>(color[3] * a));
+        __m128i via = _mm_set1_epi16(ia);
+        __m128i zero = _mm_setzero_si128();
+
+        for (; x + 4 <= w; x += 4) {
+            __m128i *p = reinterpret_cast<__m128i *>(d + x * 4);
+            __m128i v = _mm_loadu_si128(p);
+            __m128i lo = _mm_unpacklo_epi8(v, zero);
+            __m128i hi = _mm_unpackhi_epi8(v, zero);
+            lo = sse2_div255(_mm_add_epi16(_mm_mullo_epi16(lo, via), c));
+            hi = sse2_div255(_mm_add_epi16(_mm_mullo_epi16(hi, via), c));
+            _mm_storeu_si128(p, _mm_packus_epi16(lo, hi));
+        }
+#endif
+
+        for (; x < w; ++x) {
+            uint8_t *p = d + x * 4;
+            for (int i = 0; i < 4; ++i) {
+                p[i] = div255(color[i] * a + p[i] * ia);
+            }
+        }
+    }
+}
+
+void blend_copy(uint8_t *dst, size_t dst_stride,
+                const uint8_t *src, size_t src_stride,
+                int w, int h, bool swap_rb)
+{
+    for (int y = 0; y < h; ++y) {
+        uint8_t *d = dst + y * dst_stride;
+        const uint8_t *s = src + y * src_stride;
+
+        if (!swap_rb) {
+            memcpy(d, s, static_cast<size_t>(w) * 4);
+            continue;
+        }
+
+        int x = 0;
+
+#if BLEND_USE_NEON
+        for (; x + 8 <= w; x += 8) {
+            uint8x8x4_t p = vld4_u8(s + x * 4);
+            uint8x8_t tmp = p.val[0];
+            p.val[0] = p.val[2];
+            p.val[2] = tmp;
+            vst4_u8(d + x * 4, p);
+        }
+#elif BLEND_USE_SSE2
+        for (; x + 4 <= w; x += 4) {
+            __m128i p = _mm_loadu_si128(
+                    reinterpret_cast<const __m128i *>(s + x * 4));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(d + x * 4),
+                             sse2_swap_rb(p));
+        }
+#endif
+
+        for (; x < w; ++x) {
+            d[x * 4 + 0] = s[x * 4 + 2];
+            d[x * 4 + 1] = s[x * 4 + 1];
+            d[x * 4 + 2] = s[x * 4 + 0];
+            d[x * 4 + 3] = s[x * 4 + 3];
+        }
+    }
+}
+
+void blend_over(uint8_t *dst, size_t dst_stride,
+                const uint8_t *src, size_t src_stride,
+                int w, int h, bool swap_rb)
+{
+    for (int y = 0; y < h; ++y) {
+        uint8_t *d = dst + y * dst_stride;
+        const uint8_t *s = src + y * src_stride;
+        int x = 0;
+
+#if BLEND_USE_NEON
+        for (; x + 8 <= w; x += 8) {
+            uint8x8x4_t sp = vld4_u8(s + x * 4);
+            if (swap_rb) {
+                uint8x8_t tmp = sp.val[0];
+                sp.val[0] = sp.val[2];
+                sp.val[2] = tmp;
+            }
+
+            // Skip fully transparent runs, which are common in icons
+            uint64_t alpha = vget_lane_u64(vreinterpret_u64_u8(sp.val[3]), 0);
+            if (alpha == 0) {
+                continue;
+            } else if (alpha == UINT64_MAX) {
+                vst4_u8(d + x * 4, sp);
+                continue;
+            }
+
+            uint8x8x4_t dp = vld4_u8(d + x * 4);
+            uint8x8_t ia = vmvn_u8(sp.val[3]);
+
+            for (int i = 0; i < 4; ++i) {
+                uint16x8_t t = vmull_u8(sp.val[i], sp.val[3]);
+                t = vmlal_u8(t, dp.val[i], ia);
+                dp.val[i] = vraddhn_u16(t, vrshrq_n_u16(t, 8));
+            }
+            vst4_u8(d + x * 4, dp);
+        }
+#elif BLEND_USE_SSE2
+        __m128i zero = _mm_setzero_si128();
+        __m128i alpha_mask = _mm_set1_epi32(static_cast<int>(0xff000000));
+
+        for (; x + 4 <= w; x += 4) {
+            __m128i *dp = reinterpret_cast<__m128i *>(d + x * 4);
+            __m128i sp = _mm_loadu_si128(
+                    reinterpret_cast<const __m128i *>(s + x * 4));
+            if (swap_rb) {
+                sp = sse2_swap_rb(sp);
+            }
+
+            // Skip fully transparent runs, which are common in icons
+            __m128i alpha = _mm_and_si128(sp, alpha_mask);
+            if (_mm_movemask_epi8(_mm_cmpeq_epi32(alpha, zero)) == 0xffff) {
+                continue;
+            } else if (_mm_movemask_epi8(
+                    _mm_cmpeq_epi32(alpha, alpha_mask)) == 0xffff) {
+                _mm_storeu_si128(dp, sp);
+                continue;
+            }
+
+            __m128i dv = _mm_loadu_si128(dp);
+            __m128i lo = sse2_blend_half(_mm_unpacklo_epi8(sp, zero),
+                                         _mm_unpacklo_epi8(dv, zero));
+            __m128i hi = sse2_blend_half(_mm_unpackhi_epi8(sp, zero),
+                                         _mm_unpackhi_epi8(dv, zero));
+            _mm_storeu_si128(dp, _mm_packus_epi16(lo, hi));
+        }
+#endif
+
+        for (; x < w; ++x) {
+            blend_pixel(d + x * 4, s + x * 4, swap_rb);
+        }
+    }
+}
+
+void blend_mask(uint8_t *dst, size_t dst_stride,
+                const uint8_t *mask, size_t mask_stride,
+                int w, int h, const uint8_t color[4])
+{
+    for (int y = 0; y < h; ++y) {
+        uint8_t *d = dst + y * dst_stride;
+        const uint8_t *m = mask + y * mask_stride;
+        int x = 0;
+
+#if BLEND_USE_NEON
+        uint8x8_t c[3];
+        for (int i = 0; i < 3; ++i) {
+            c[i] = vdup_n_u8(color[i]);
+        }
+
+        for (; x + 8 <= w; x += 8) {
+            uint8x8_t a = vld1_u8(m + x);
+
+            // Skip the gaps between glyphs
+            if (vget_lane_u64(vreinterpret_u64_u8(a), 0) == 0) {
+                continue;
+            }
+
+            uint8x8x4_t dp = vld4_u8(d + x * 4);
+            uint8x8_t ia = vmvn_u8(a);
+
+            for (int i = 0; i < 4; ++i) {
+                uint16x8_t t = vmull_u8(i < 3 ? c[i] : a, a);
+                t = vmlal_u8(t, dp.val[i], ia);
+                dp.val[i] = vraddhn_u16(t, vrshrq_n_u16(t, 8));
+            }
+            vst4_u8(d + x * 4, dp);
+        }
+#elif BLEND_USE_SSE2
+        __m128i zero = _mm_setzero_si128();
+        __m128i c = _mm_setr_epi16(color[0], color[1], color[2], 0,
+                                   color[0], color[1], color[2], 0);
+        __m128i alpha_lanes = _mm_setr_epi16(0, 0, 0, -1, 0, 0, 0, -1);
+
+        for (; x + 4 <= w; x += 4) {
+            int32_t coverage;
+            memcpy(&coverage, m + x, sizeof(coverage));
+
+            // Skip the gaps between glyphs
+            if (coverage == 0) {
+                continue;
+            }
+
+            // Spread each pixel's coverage across its four channels
+            __m128i a = _mm_unpacklo_epi8(_mm_cvtsi32_si128(coverage), zero);
+            a = _mm_unpacklo_epi16(a, a);
+            __m128i a_lo = _mm_unpacklo_epi32(a, a);
+            __m128i a_hi = _mm_unpackhi_epi32(a, a);
+
+            __m128i *dp = reinterpret_cast<__m128i *>(d + x * 4);
+            __m128i dv = _mm_loadu_si128(dp);
+
+            __m128i lo = sse2_blend_half(
+                    _mm_or_si128(c, _mm_and_si128(a_lo, alpha_lanes)),
+                    _mm_unpacklo_epi8(dv, zero));
+            __m128i hi = sse2_blend_half(
+                    _mm_or_si128(c, _mm_and_si128(a_hi, alpha_lanes)),
+                    _mm_unpackhi_epi8(dv, zero));
+            _mm_storeu_si128(dp, _mm_packus_epi16(lo, hi));
+        }
+#endif
+
+        for (; x < w; ++x) {
+            uint8_t s[4] = { color[0], color[1], color[2], m[x] };
+            blend_pixel(d + x * 4, s, false);
+        }
+    }
+}
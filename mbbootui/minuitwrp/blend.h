@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2018 Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Fast paths for the common 32bpp drawing operations that would otherwise go
+// through pixelflinger's generic rasterizer. All pixels are 4 bytes in memory
+// order (eg. R, G, B, A) and strides are in bytes. If swap_rb is true, the
+// first and third channels of the source are exchanged while writing to the
+// destination.
+//
+// Blending matches pixelflinger's GGL_SRC_ALPHA, GGL_ONE_MINUS_SRC_ALPHA
+// configuration, with the source alpha taken from the fourth channel and
+// applied to all four channels.
+
+// Fill the rectangle with an opaque pixel
+void blend_fill(uint8_t *dst, size_t dst_stride, int w, int h, uint32_t pixel);
+
+// Blend a translucent color (in destination channel order) over the rectangle
+void blend_fill_alpha(uint8_t *dst, size_t dst_stride, int w, int h,
+                      const uint8_t color[4]);
+
+// Copy opaque pixels
+void blend_copy(uint8_t *dst, size_t dst_stride,
+                const uint8_t *src, size_t src_stride,
+                int w, int h, bool swap_rb);
+
+// Blend non-premultiplied source pixels over the destination
+void blend_over(uint8_t *dst, size_t dst_stride,
+                const uint8_t *src, size_t src_stride,
+                int w, int h, bool swap_rb);
+
+// Blend a color (in destination channel order) over the destination using an
+// 8-bit coverage mask as the alpha. The color's own alpha is ignored, like
+// pixelflinger's GGL_REPLACE mode for alpha-only textures.
+void blend_mask(uint8_t *dst, size_t dst_stride,
+                const uint8_t *mask, size_t mask_stride,
+                int w, int h, const uint8_t color[4]);
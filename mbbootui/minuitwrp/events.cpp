@@ -101,6 +101,9 @@ struct ev
 
     struct position p, mt_p;
     int down;
+
+    /* Whether the kernel timestamps events with CLOCK_MONOTONIC */
+    int monotonic_time;
 };
 
 static struct pollfd ev_fds[MAX_DEVICES];
@@ -324,6 +327,13 @@ int ev_init(void)
             ev_fds[ev_count].events = POLLIN;
             evs[ev_count].fd = &ev_fds[ev_count];
 
+            /* Use the same clock as the GUI's frame timing */
+            evs[ev_count].monotonic_time = 0;
+#ifdef EVIOCSCLOCKID
+            int clk = CLOCK_MONOTONIC;
+            evs[ev_count].monotonic_time = ioctl(fd, EVIOCSCLOCKID, &clk) == 0;
+#endif
+
             /* Load virtualkeys if there are any */
             vk_init(&evs[ev_count]);
 
@@ -764,6 +774,12 @@ int ev_get(struct input_event *ev, int timeout_ms)
             if (ev_fds[n].revents & POLLIN) {
                 r = read(ev_fds[n].fd, ev, sizeof(*ev));
                 if (r == sizeof(*ev)) {
+                    if (!evs[n].monotonic_time) {
+                        /* Older kernels only have CLOCK_REALTIME stamps */
+                        clock_gettime(CLOCK_MONOTONIC, &curr);
+                        ev->time.tv_sec = curr.tv_sec;
+                        ev->time.tv_usec = curr.tv_nsec / 1000;
+                    }
                     if (!vk_modify(&evs[n], ev)) {
                         return 0;
                     }
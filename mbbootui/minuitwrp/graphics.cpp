@@ -14,6 +14,8 @@
  * limitations under the License.
  */
 
+#include <algorithm>
+
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
@@ -36,6 +38,7 @@
 #include "config/config.hpp"
 #include "backend/backend.h"
 #include "minui.h"
+#include "blend.h"
 #include "graphics.h"
 #include "gui/placement.h"
 
@@ -48,13 +51,17 @@ struct GRFont
 
 static minui_backend* gr_backend = nullptr;
 
+static GRFrameStats gr_frame_stats;
+// When gr_fb_wait_frame() last returned, or 0 if the current frame's render
+// time is unknown
+static uint64_t gr_frame_start_ns = 0;
+
 static int overscan_offset_x = 0;
 static int overscan_offset_y = 0;
 
 static unsigned char gr_current_r = 255;
 static unsigned char gr_current_g = 255;
 static unsigned char gr_current_b = 255;
-__attribute__((unused))
 static unsigned char gr_current_a = 255;
 __attribute__((unused))
 static unsigned char rgb_555[2];
@@ -71,6 +78,17 @@ static GGLContext *gr_context = 0;
 GGLSurface gr_mem_surface;
 static int gr_is_curr_clr_opaque = 0;
 
+static GRRect gr_bounds;
+static bool gr_has_bounds = false;
+
+// Scissor rectangle currently set in pixelflinger
+static GRRect gr_scissor;
+static bool gr_scissor_enabled = false;
+
+// Whether the blend.h fast paths can draw directly into the surface: -1 if
+// not, otherwise 1 if R and B are swapped relative to the resources
+static int gr_fast_swap_rb = -1;
+
 #if 0 // unused
 static bool outside(int x, int y)
 {
@@ -136,15 +154,104 @@ int gr_textEx_scaleW(int x, int y, const char *s, void* pFont, int max_width, in
 void gr_clip(int x, int y, int w, int h)
 {
     GGLContext *gl = gr_context;
+
+    if (gr_has_bounds) {
+        int x2 = std::min(x + w, gr_bounds.x + gr_bounds.w);
+        int y2 = std::min(y + h, gr_bounds.y + gr_bounds.h);
+        x = std::max(x, gr_bounds.x);
+        y = std::max(y, gr_bounds.y);
+        w = std::max(x2 - x, 0);
+        h = std::max(y2 - y, 0);
+    }
+
     gl->scissor(gl, x, y, w, h);
     gl->enable(gl, GGL_SCISSOR_TEST);
+
+    gr_scissor = { x, y, w, h };
+    gr_scissor_enabled = true;
 }
 
 void gr_noclip()
 {
     GGLContext *gl = gr_context;
+
+    if (gr_has_bounds) {
+        gl->scissor(gl, gr_bounds.x, gr_bounds.y, gr_bounds.w, gr_bounds.h);
+        gl->enable(gl, GGL_SCISSOR_TEST);
+
+        gr_scissor = gr_bounds;
+        gr_scissor_enabled = true;
+        return;
+    }
+
     gl->scissor(gl, 0, 0, gr_fb_width(), gr_fb_height());
     gl->disable(gl, GGL_SCISSOR_TEST);
+
+    gr_scissor_enabled = false;
+}
+
+// Intersect the rectangle with the drawing surface and the scissor rectangle.
+// Returns false if nothing is left.
+static bool gr_clip_to_target(int *x, int *y, int *w, int *h)
+{
+    int x1 = std::max(*x, 0);
+    int y1 = std::max(*y, 0);
+    int x2 = std::min(*x + *w, static_cast<int>(gr_mem_surface.width));
+    int y2 = std::min(*y + *h, static_cast<int>(gr_mem_surface.height));
+
+    if (gr_scissor_enabled) {
+        x1 = std::max(x1, gr_scissor.x);
+        y1 = std::max(y1, gr_scissor.y);
+        x2 = std::min(x2, gr_scissor.x + gr_scissor.w);
+        y2 = std::min(y2, gr_scissor.y + gr_scissor.h);
+    }
+
+    if (x1 >= x2 || y1 >= y2) {
+        return false;
+    }
+
+    *x = x1;
+    *y = y1;
+    *w = x2 - x1;
+    *h = y2 - y1;
+    return true;
+}
+
+static uint8_t* gr_target_pixel(int x, int y)
+{
+    return gr_mem_surface.data + (y * gr_mem_surface.stride + x) * 4;
+}
+
+static int gr_get_fast_swap_rb()
+{
+    // gr_color() and the PNG loader already swizzle for these, which the fast
+    // paths don't replicate
+    if (tw_device.tw_pixel_format() == mb::device::TwPixelFormat::Abgr8888
+            || tw_device.tw_pixel_format() == mb::device::TwPixelFormat::Bgra8888) {
+        return -1;
+    }
+
+    switch (gr_mem_surface.format) {
+    case GGL_PIXEL_FORMAT_RGBX_8888:
+    case GGL_PIXEL_FORMAT_RGBA_8888:
+        return 0;
+    case GGL_PIXEL_FORMAT_BGRA_8888:
+        return 1;
+    default:
+        // Leave 565 (which pixelflinger dithers) and anything else alone
+        return -1;
+    }
+}
+
+void gr_clip_bounds(const GRRect *rect)
+{
+    if (rect) {
+        gr_bounds = *rect;
+        gr_has_bounds = true;
+    } else {
+        gr_has_bounds = false;
+    }
+    gr_noclip();
 }
 
 void gr_line(int x0, int y0, int x1, int y1, int width)
@@ -215,6 +322,10 @@ void gr_color(unsigned char r, unsigned char g, unsigned char b, unsigned char a
     }
     gl->color4xv(gl, color);
 
+    gr_current_r = r;
+    gr_current_g = g;
+    gr_current_b = b;
+    gr_current_a = a;
     gr_is_curr_clr_opaque = (a == 255);
 }
 
@@ -246,6 +357,29 @@ void gr_fill(int x, int y, int w, int h)
 {
     GGLContext *gl = gr_context;
 
+    if (gr_fast_swap_rb >= 0) {
+        if (!gr_clip_to_target(&x, &y, &w, &h) || gr_current_a == 0) {
+            return;
+        }
+
+        uint8_t color[4] = {
+            gr_fast_swap_rb ? gr_current_b : gr_current_r,
+            gr_current_g,
+            gr_fast_swap_rb ? gr_current_r : gr_current_b,
+            gr_current_a,
+        };
+        size_t stride = gr_mem_surface.stride * 4;
+
+        if (gr_is_curr_clr_opaque) {
+            uint32_t pixel;
+            memcpy(&pixel, color, sizeof(pixel));
+            blend_fill(gr_target_pixel(x, y), stride, w, h, pixel);
+        } else {
+            blend_fill_alpha(gr_target_pixel(x, y), stride, w, h, color);
+        }
+        return;
+    }
+
     if (gr_is_curr_clr_opaque) {
         gl->disable(gl, GGL_BLEND);
     }
@@ -266,6 +400,35 @@ void gr_blit(gr_surface source, int sx, int sy, int w, int h, int dx, int dy)
     GGLContext *gl = gr_context;
     GGLSurface *surface = (GGLSurface*)source;
 
+    if (gr_fast_swap_rb >= 0
+            && (surface->format == GGL_PIXEL_FORMAT_RGBX_8888
+                    || surface->format == GGL_PIXEL_FORMAT_RGBA_8888)) {
+        int cx = dx, cy = dy, cw = w, ch = h;
+        if (!gr_clip_to_target(&cx, &cy, &cw, &ch)) {
+            return;
+        }
+
+        int csx = sx + (cx - dx);
+        int csy = sy + (cy - dy);
+
+        // Reads outside of the texture are left to pixelflinger's wrapping
+        if (csx >= 0 && csy >= 0 && csx + cw <= static_cast<int>(surface->width)
+                && csy + ch <= static_cast<int>(surface->height)) {
+            const uint8_t *src = surface->data + (csy * surface->stride + csx) * 4;
+            size_t src_stride = surface->stride * 4;
+            size_t dst_stride = gr_mem_surface.stride * 4;
+
+            if (surface->format == GGL_PIXEL_FORMAT_RGBX_8888) {
+                blend_copy(gr_target_pixel(cx, cy), dst_stride, src, src_stride,
+                           cw, ch, gr_fast_swap_rb);
+            } else {
+                blend_over(gr_target_pixel(cx, cy), dst_stride, src, src_stride,
+                           cw, ch, gr_fast_swap_rb);
+            }
+            return;
+        }
+    }
+
     if (surface->format == GGL_PIXEL_FORMAT_RGBX_8888) {
         gl->disable(gl, GGL_BLEND);
     }
@@ -284,6 +447,34 @@ void gr_blit(gr_surface source, int sx, int sy, int w, int h, int dx, int dy)
     }
 }
 
+bool gr_blit_alpha_mask(gr_surface mask, int x, int y, int w, int h)
+{
+    GGLSurface *surface = (GGLSurface*)mask;
+
+    if (gr_fast_swap_rb < 0 || surface->format != GGL_PIXEL_FORMAT_A_8
+            || w > static_cast<int>(surface->width)
+            || h > static_cast<int>(surface->height)) {
+        return false;
+    }
+
+    int cx = x, cy = y, cw = w, ch = h;
+    if (!gr_clip_to_target(&cx, &cy, &cw, &ch)) {
+        return true;
+    }
+
+    uint8_t color[4] = {
+        gr_fast_swap_rb ? gr_current_b : gr_current_r,
+        gr_current_g,
+        gr_fast_swap_rb ? gr_current_r : gr_current_b,
+        255,
+    };
+
+    blend_mask(gr_target_pixel(cx, cy), gr_mem_surface.stride * 4,
+               surface->data + (cy - y) * surface->stride + (cx - x),
+               surface->stride, cw, ch, color);
+    return true;
+}
+
 unsigned int gr_get_width(gr_surface surface)
 {
     if (surface == nullptr) {
@@ -300,15 +491,86 @@ unsigned int gr_get_height(gr_surface surface)
     return ((GGLSurface*) surface)->height;
 }
 
-void gr_flip()
+static void gr_bind_draw_surface()
 {
-    gr_draw = gr_backend->flip(gr_backend);
     // On double buffered back ends, when we flip, we need to tell
     // pixel flinger to draw to the other buffer
     gr_mem_surface.data = (GGLubyte*)gr_draw->data;
     gr_context->colorBuffer(gr_context, &gr_mem_surface);
 }
 
+static void gr_frame_submitted(uint64_t submit_ns)
+{
+    uint64_t now = gr_monotonic_ns();
+
+    ++gr_frame_stats.frames;
+    gr_frame_stats.total_wait_ns += now - submit_ns;
+
+    if (gr_frame_start_ns != 0) {
+        uint64_t render_ns = submit_ns - gr_frame_start_ns;
+        gr_frame_stats.last_render_ns = render_ns;
+        gr_frame_stats.max_render_ns =
+                std::max(gr_frame_stats.max_render_ns, render_ns);
+        gr_frame_stats.total_render_ns += render_ns;
+        gr_frame_start_ns = 0;
+    }
+}
+
+void gr_flip()
+{
+    uint64_t submit_ns = gr_monotonic_ns();
+    gr_draw = gr_backend->flip(gr_backend);
+    gr_frame_submitted(submit_ns);
+    gr_bind_draw_surface();
+}
+
+void gr_flip_damage(const GRRect *rects, int count)
+{
+    if (!gr_backend->flip_damage) {
+        gr_flip();
+        return;
+    }
+
+    uint64_t submit_ns = gr_monotonic_ns();
+    gr_draw = gr_backend->flip_damage(gr_backend, rects, count);
+    gr_frame_submitted(submit_ns);
+    gr_bind_draw_surface();
+}
+
+int gr_fb_wait_frame(int timeout_ms)
+{
+    uint64_t start_ns = gr_monotonic_ns();
+    int ret = 0;
+
+    if (gr_backend->wait_frame) {
+        ret = gr_backend->wait_frame(gr_backend, timeout_ms);
+    }
+
+    gr_frame_start_ns = gr_monotonic_ns();
+    gr_frame_stats.total_wait_ns += gr_frame_start_ns - start_ns;
+
+    return ret;
+}
+
+void gr_fb_frame_stats(GRFrameStats *stats)
+{
+    *stats = gr_frame_stats;
+    stats->missed_vsyncs = 0;
+    stats->refresh_ns = 0;
+
+    if (gr_backend->frame_stats) {
+        gr_backend->frame_stats(gr_backend, stats);
+    }
+}
+
+int gr_fb_buffer_age(void)
+{
+    if (!gr_backend->buffer_age) {
+        return 0;
+    }
+    return gr_backend->buffer_age(gr_backend);
+}
+
 static void get_memory_surface(GGLSurface* ms)
 {
     ms->version = sizeof(*ms);
@@ -362,6 +624,7 @@ int gr_init(void)
 
     // Set up pixelflinger
     get_memory_surface(&gr_mem_surface);
+    gr_fast_swap_rb = gr_get_fast_swap_rb();
     gglInit(&gr_context);
     GGLContext *gl = gr_context;
     gl->colorBuffer(gl, &gr_mem_surface);
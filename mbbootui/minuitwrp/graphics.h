@@ -17,8 +17,33 @@
 #ifndef _GRAPHICS_H_
 #define _GRAPHICS_H_
 
+#include <time.h>
+
 #include "minui.h"
 
+// Draws an alpha-only (A_8) surface at (x, y) with the current color through
+// the blend.h fast paths. Returns false if the caller must fall back to
+// pixelflinger.
+bool gr_blit_alpha_mask(gr_surface mask, int x, int y, int w, int h);
+
+static inline uint64_t gr_monotonic_ns()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000u + ts.tv_nsec;
+}
+
+// Number of refresh intervals a frame submitted at submit_ns missed if it
+// reached the screen at shown_ns
+static inline uint64_t gr_missed_vsyncs(uint64_t submit_ns, uint64_t shown_ns,
+                                        uint64_t refresh_ns)
+{
+    if (refresh_ns == 0 || shown_ns <= submit_ns) {
+        return 0;
+    }
+    return (shown_ns - submit_ns) / refresh_ns;
+}
+
 // TODO: lose the function pointers.
 struct minui_backend
 {
@@ -35,6 +60,24 @@ struct minui_backend
 
     // Device cleanup when drawing is done.
     void (*exit)(minui_backend*);
+
+    // Returns the number of flips since the current drawing surface was
+    // last displayed, or 0 if its contents are undefined. Optional; the
+    // drawing surface is assumed to be undefined if this is null.
+    int (*buffer_age)(minui_backend*);
+
+    // Like flip(), but only the given rectangles changed since the previous
+    // frame. Optional; flip() is used if this is null.
+    GRSurface* (*flip_damage)(minui_backend*, const GRRect*, int);
+
+    // Blocks until the drawing surface can be flipped without waiting for a
+    // previous flip, for at most the given number of milliseconds (-1 to
+    // wait forever). Returns 0 when ready, 1 on timeout, or -1 on error.
+    // Optional; flips are assumed to never wait if this is null.
+    int (*wait_frame)(minui_backend*, int);
+
+    // Fills in the missed_vsyncs and refresh_ns statistics. Optional.
+    void (*frame_stats)(minui_backend*, GRFrameStats*);
 };
 
 #endif
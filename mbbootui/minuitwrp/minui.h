@@ -18,6 +18,7 @@
 #define _MINUI_H_
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <sys/types.h>
 
 #include "gui/placement.h"
@@ -36,6 +37,30 @@ struct GRSurface
     __u32 format;
 };
 
+struct GRRect
+{
+    int x;
+    int y;
+    int w;
+    int h;
+};
+
+struct GRFrameStats
+{
+    // Frames submitted with gr_flip() or gr_flip_damage()
+    uint64_t frames;
+    // Refresh intervals by which flips were late reaching the screen
+    uint64_t missed_vsyncs;
+    // Time from gr_fb_wait_frame() returning until the frame was submitted
+    uint64_t last_render_ns;
+    uint64_t max_render_ns;
+    uint64_t total_render_ns;
+    // Time spent blocked in gr_fb_wait_frame() and the flip functions
+    uint64_t total_wait_ns;
+    // Display refresh interval, or 0 if unknown
+    uint64_t refresh_ns;
+};
+
 typedef void* gr_surface;
 typedef unsigned short gr_pixel;
 
@@ -49,11 +74,26 @@ int gr_fb_width(void);
 int gr_fb_height(void);
 gr_pixel *gr_fb_data(void);
 void gr_flip(void);
+// Like gr_flip(), but only the given rectangles changed since the previous
+// frame. Backends that can't push partial updates flip the whole frame.
+void gr_flip_damage(const struct GRRect *rects, int count);
+// Number of flips since the drawing surface was last displayed, or 0 if its
+// contents are undefined and the next frame must be drawn in full.
+int gr_fb_buffer_age(void);
+// Block until the drawing surface can be flipped without waiting for an
+// earlier flip to reach the screen, for at most timeout_ms milliseconds (-1 to
+// wait forever). Returns 0 when ready, 1 on timeout and -1 on error. Calling
+// this right before drawing a frame also marks the start of its render time.
+int gr_fb_wait_frame(int timeout_ms);
+void gr_fb_frame_stats(struct GRFrameStats *stats);
 void gr_fb_blank(bool blank);
 
 void gr_color(unsigned char r, unsigned char g, unsigned char b, unsigned char a);
 void gr_clip(int x, int y, int w, int h);
 void gr_noclip();
+// Restrict all drawing to rect (or lift the restriction if rect is NULL).
+// gr_clip() and gr_noclip() operate within these bounds.
+void gr_clip_bounds(const struct GRRect *rect);
 void gr_fill(int x, int y, int w, int h);
 void gr_line(int x0, int y0, int x1, int y1, int width);
 gr_surface gr_render_circle(int radius, unsigned char r, unsigned char g, unsigned char b, unsigned char a);
@@ -93,6 +133,9 @@ int ev_has_mouse(void);
 
 // Returns 0 if no error, else negative.
 int res_create_surface(const char* name, gr_surface* pSurface);
+// Reads the dimensions of a PNG image without decoding it. Returns 0 if no
+// error, else negative.
+int res_get_surface_size(const char* name, int* width, int* height);
 void res_free_surface(gr_surface surface);
 int res_scale_surface(gr_surface source, gr_surface* destination, float scale_w, float scale_h);
 
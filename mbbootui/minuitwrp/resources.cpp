@@ -23,6 +23,7 @@
 
 #include <sys/ioctl.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 
 #include <linux/fb.h>
@@ -54,91 +55,62 @@ static GGLSurface* malloc_surface(size_t data_size)
     return surface;
 }
 
-static int open_png(const char* name, png_structp* png_ptr, png_infop* info_ptr,
-                    png_uint_32* width, png_uint_32* height, png_byte* channels, FILE** fpp)
+// PNG files are mapped into memory and libpng reads straight out of the
+// mapping instead of copying everything through stdio buffers
+struct png_mapping
+{
+    const unsigned char* data;
+    size_t size;
+    size_t offset;
+};
+
+static int map_png(const char* name, png_mapping* map)
 {
     char resPath[256];
-    unsigned char header[8];
-    int result = 0;
-    int color_type, bit_depth;
-    size_t bytesRead;
+    struct stat sb;
+    void* addr;
+    int fd;
 
     snprintf(resPath, sizeof(resPath)-1, "%s/images/%s.png", tw_resource_path.c_str(), name);
     resPath[sizeof(resPath)-1] = '\0';
-    FILE* fp = fopen(resPath, "rbe");
-    if (fp == nullptr) {
-        fp = fopen(name, "rbe");
-        if (fp == nullptr) {
-            result = -1;
-            goto exit;
+    fd = open(resPath, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        fd = open(name, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return -1;
         }
     }
 
-    bytesRead = fread(header, 1, sizeof(header), fp);
-    if (bytesRead != sizeof(header)) {
-        result = -2;
-        goto exit;
-    }
-
-    if (png_sig_cmp(header, 0, sizeof(header))) {
-        result = -3;
-        goto exit;
-    }
-
-    *png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
-    if (!*png_ptr) {
-        result = -4;
-        goto exit;
+    if (fstat(fd, &sb) < 0 || sb.st_size < 8) {
+        close(fd);
+        return -2;
     }
 
-    *info_ptr = png_create_info_struct(*png_ptr);
-    if (!*info_ptr) {
-        result = -5;
-        goto exit;
+    addr = mmap(nullptr, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+        return -2;
     }
 
-    if (setjmp(png_jmpbuf(*png_ptr))) {
-        result = -6;
-        goto exit;
-    }
-
-    png_init_io(*png_ptr, fp);
-    png_set_sig_bytes(*png_ptr, sizeof(header));
-    png_read_info(*png_ptr, *info_ptr);
-
-    png_get_IHDR(*png_ptr, *info_ptr, width, height, &bit_depth,
-            &color_type, nullptr, nullptr, nullptr);
+    map->data = reinterpret_cast<const unsigned char*>(addr);
+    map->size = sb.st_size;
+    map->offset = 0;
+    return 0;
+}
 
-    *channels = png_get_channels(*png_ptr, *info_ptr);
-
-    if (bit_depth == 8 && *channels == 3 && color_type == PNG_COLOR_TYPE_RGB) {
-        // 8-bit RGB images: great, nothing to do.
-    } else if (bit_depth <= 8 && *channels == 1 && color_type == PNG_COLOR_TYPE_GRAY) {
-        // 1-, 2-, 4-, or 8-bit gray images: expand to 8-bit gray.
-        png_set_expand_gray_1_2_4_to_8(*png_ptr);
-    } else if (bit_depth <= 8 && *channels == 1 && color_type == PNG_COLOR_TYPE_PALETTE) {
-        // paletted images: expand to 8-bit RGB.  Note that we DON'T
-        // currently expand the tRNS chunk (if any) to an alpha
-        // channel, because minui doesn't support alpha channels in
-        // general.
-        png_set_palette_to_rgb(*png_ptr);
-        *channels = 3;
-    } else if (color_type == PNG_COLOR_TYPE_PALETTE) {
-        png_set_palette_to_rgb(*png_ptr);
-    }
-
-    *fpp = fp;
-    return result;
+static void unmap_png(png_mapping* map)
+{
+    munmap(const_cast<unsigned char*>(map->data), map->size);
+}
 
-  exit:
-    if (result < 0) {
-        png_destroy_read_struct(png_ptr, info_ptr, nullptr);
-    }
-    if (fp != nullptr) {
-        fclose(fp);
+static void read_png_mapping(png_structp png_ptr, png_bytep out, png_size_t length)
+{
+    png_mapping* map = reinterpret_cast<png_mapping*>(png_get_io_ptr(png_ptr));
+    if (length > map->size - map->offset) {
+        png_error(png_ptr, "Read past end of file");
     }
-
-    return result;
+    memcpy(out, map->data + map->offset, length);
+    map->offset += length;
 }
 
 // "display" surfaces are transformed into the framebuffer's required
@@ -165,110 +137,133 @@ static GGLSurface* init_display_surface(png_uint_32 width, png_uint_32 height)
     return surface;
 }
 
-// Copy 'input_row' to 'output_row', transforming it to the
-// framebuffer pixel format.  The input format depends on the value of
-// 'channels':
-//
-//   1 - input is 8-bit grayscale
-//   3 - input is 24-bit RGB
-//   4 - input is 32-bit RGBA/RGBX
-//
-// 'width' is the number of pixels in the row.
-static void transform_rgb_to_draw(unsigned char* input_row,
-                                  unsigned char* output_row,
-                                  int channels, int width)
-{
-    int x;
-    unsigned char* ip = input_row;
-    unsigned char* op = output_row;
-
-    switch (channels) {
-    case 1:
-        // expand gray level to RGBX
-        for (x = 0; x < width; ++x) {
-            *op++ = *ip;
-            *op++ = *ip;
-            *op++ = *ip;
-            *op++ = 0xff;
-            ip++;
-        }
-        break;
-
-    case 3:
-        // expand RGBA to RGBX
-        for (x = 0; x < width; ++x) {
-            *op++ = *ip++;
-            *op++ = *ip++;
-            *op++ = *ip++;
-            *op++ = 0xff;
-        }
-        break;
-
-    case 4:
-        // copy RGBA to RGBX
-        memcpy(output_row, input_row, width*4);
-        break;
-    }
-}
-
-int res_create_surface_png(const char* name, gr_surface* pSurface)
+// Read the size of the PNG image and, if pSurface is not null, decode it.
+// libpng is configured to produce the display pixel format directly, so rows
+// are decoded straight into the surface without an intermediate buffer.
+static int decode_png(const char* name, int* pWidth, int* pHeight,
+                      gr_surface* pSurface)
 {
-    GGLSurface* surface = nullptr;
-    int result = 0;
+    png_mapping map;
     png_structp png_ptr = nullptr;
     png_infop info_ptr = nullptr;
-    png_uint_32 width, height;
-    png_byte channels;
-    FILE* fp;
-    unsigned char* p_row;
-    unsigned int y;
-
-    *pSurface = nullptr;
+    GGLSurface* volatile surface = nullptr;
+    png_bytep* volatile rows = nullptr;
+    volatile int result = 0;
+    png_uint_32 width, height, y;
+    int color_type, bit_depth;
 
-    result = open_png(name, &png_ptr, &info_ptr, &width, &height, &channels, &fp);
+    result = map_png(name, &map);
     if (result < 0) {
         return result;
     }
 
-    surface = init_display_surface(width, height);
-    if (surface == nullptr) {
-        result = -8;
+    if (png_sig_cmp(map.data, 0, 8)) {
+        result = -3;
         goto exit;
     }
 
+    png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
+    if (!png_ptr) {
+        result = -4;
+        goto exit;
+    }
+
+    info_ptr = png_create_info_struct(png_ptr);
+    if (!info_ptr) {
+        result = -5;
+        goto exit;
+    }
+
+    if (setjmp(png_jmpbuf(png_ptr))) {
+        result = -6;
+        goto exit;
+    }
+
+    png_set_read_fn(png_ptr, &map, read_png_mapping);
+    png_read_info(png_ptr, info_ptr);
+
+    png_get_IHDR(png_ptr, info_ptr, &width, &height, &bit_depth,
+            &color_type, nullptr, nullptr, nullptr);
+
+    *pWidth = width;
+    *pHeight = height;
+
+    if (!pSurface) {
+        goto exit;
+    }
+
+    // Expand everything to 8-bit RGB(A). For paletted images, this also
+    // turns the tRNS chunk (if any) into an alpha channel.
+    if (bit_depth == 16) {
+        png_set_strip_16(png_ptr);
+    }
+    if (color_type == PNG_COLOR_TYPE_PALETTE) {
+        png_set_palette_to_rgb(png_ptr);
+    } else if (!(color_type & PNG_COLOR_MASK_COLOR)) {
+        if (bit_depth < 8) {
+            png_set_expand_gray_1_2_4_to_8(png_ptr);
+        }
+        png_set_gray_to_rgb(png_ptr);
+    }
+    // Images without alpha are stored as RGBX
+    png_set_filler(png_ptr, 0xff, PNG_FILLER_AFTER);
     if (tw_device.tw_pixel_format() == mb::device::TwPixelFormat::Abgr8888
             || tw_device.tw_pixel_format() == mb::device::TwPixelFormat::Bgra8888) {
         png_set_bgr(png_ptr);
     }
+    png_set_interlace_handling(png_ptr);
+    png_read_update_info(png_ptr, info_ptr);
+    color_type = png_get_color_type(png_ptr, info_ptr);
+
+    if (png_get_rowbytes(png_ptr, info_ptr) != width * 4) {
+        result = -7;
+        goto exit;
+    }
+
+    surface = init_display_surface(width, height);
+    if (surface == nullptr) {
+        result = -8;
+        goto exit;
+    }
 
-    p_row = reinterpret_cast<unsigned char*>(malloc(width * 4));
-    if (p_row == nullptr) {
+    rows = reinterpret_cast<png_bytep*>(malloc(height * sizeof(png_bytep)));
+    if (rows == nullptr) {
         result = -9;
         goto exit;
     }
     for (y = 0; y < height; ++y) {
-        png_read_row(png_ptr, p_row, nullptr);
-        transform_rgb_to_draw(p_row, surface->data + y * width * 4, channels, width);
+        rows[y] = surface->data + y * width * 4;
     }
-    free(p_row);
 
-    if (channels == 3) {
-        surface->format = GGL_PIXEL_FORMAT_RGBX_8888;
-    } else {
+    png_read_image(png_ptr, rows);
+
+    if (color_type & PNG_COLOR_MASK_ALPHA) {
         surface->format = GGL_PIXEL_FORMAT_RGBA_8888;
+    } else {
+        surface->format = GGL_PIXEL_FORMAT_RGBX_8888;
     }
 
     *pSurface = (gr_surface) surface;
 
 exit:
-    fclose(fp);
-    png_destroy_read_struct(&png_ptr, &info_ptr, nullptr);
+    free(rows);
     if (result < 0 && surface != nullptr) {
         free(surface);
     }
+    png_destroy_read_struct(&png_ptr, &info_ptr, nullptr);
+    unmap_png(&map);
     return result;
 }
 
+int res_create_surface_png(const char* name, gr_surface* pSurface)
+{
+    int width, height;
+
+    *pSurface = nullptr;
+
+    return decode_png(name, &width, &height, pSurface);
+}
+
 #ifdef TW_INCLUDE_JPEG
 int res_create_surface_jpg(const char* name, gr_surface* pSurface)
 {
@@ -393,6 +388,16 @@ int res_create_surface(const char* name, gr_surface* pSurface)
     return ret;
 }
 
+int res_get_surface_size(const char* name, int* width, int* height)
+{
+    if (!name) {
+        return -1;
+    }
+
+    // Only the PNG header is cheap to read without decoding the image
+    return decode_png(name, width, height, nullptr);
+}
+
 void res_free_surface(gr_surface surface)
 {
     GGLSurface* pSurface = (GGLSurface*) surface;
@@ -6,6 +6,7 @@
 #include <stdio.h>
 
 #include "minui.h"
+#include "graphics.h"
 
 #include <cutils/hashmap.h>
 #include <ft2build.h>
@@ -18,6 +19,33 @@
 #define STRING_CACHE_MAX_ENTRIES 400
 #define STRING_CACHE_TRUNCATE_ENTRIES 150
 
+// Glyph bitmaps are packed into one alpha-only texture per font. The texture
+// is split into horizontal shelves and the least recently drawn shelf is
+// evicted when it runs out of space.
+#define GLYPH_ATLAS_MIN_SIZE 256
+#define GLYPH_ATLAS_MAX_SIZE 2048
+#define GLYPH_ATLAS_MAX_SHELVES 64
+
+typedef struct
+{
+    int y;
+    int height;
+    int used_width;
+    uint32_t last_used;
+} GlyphAtlasShelf;
+
+typedef struct
+{
+    GGLSurface surface;
+    // Height of the shelves opened for glyphs no taller than a text line
+    int line_height;
+    int used_height;
+    int shelf_count;
+    GlyphAtlasShelf shelves[GLYPH_ATLAS_MAX_SHELVES];
+    // Incremented for every string drawn
+    uint32_t clock;
+} GlyphAtlas;
+
 typedef struct
 {
     int size;
@@ -35,6 +63,7 @@ typedef struct
     int base;
     FT_Face face;
     Hashmap *glyph_cache;
+    GlyphAtlas atlas;
     Hashmap *string_cache;
     struct StringCacheEntry *string_cache_head;
     struct StringCacheEntry *string_cache_tail;
@@ -45,7 +74,17 @@ typedef struct
 typedef struct
 {
     FT_BBox bbox;
-    FT_BitmapGlyph glyph;
+    int advance;
+    // Bitmap metrics, valid once the glyph has been rendered
+    bool rendered;
+    int left;
+    int top;
+    int width;
+    int height;
+    // Location in the atlas, or -1 if the bitmap isn't in the atlas
+    int shelf;
+    int atlas_x;
+    int atlas_y;
 } TrueTypeCacheEntry;
 
 typedef struct
@@ -54,10 +93,18 @@ typedef struct
     int max_width;
 } StringCacheKey;
 
+typedef struct
+{
+    int char_idx;
+    int x;
+} ShapedGlyph;
+
 struct StringCacheEntry
 {
-    GGLSurface surface;
+    int width;
     int rendered_bytes; // number of bytes from C string rendered, not number of UTF8 characters!
+    int glyph_count;
+    ShapedGlyph *glyphs;
     StringCacheKey *key;
     struct StringCacheEntry *prev;
     struct StringCacheEntry *next;
@@ -273,9 +320,7 @@ void *gr_ttf_scaleFont(void *font, int max_width, int measured_width)
 
 static bool gr_ttf_freeFontCache(void *key, void *value, void *context __unused)
 {
-    TrueTypeCacheEntry *e = (TrueTypeCacheEntry *)value;
-    FT_Done_Glyph((FT_Glyph)e->glyph);
-    free(e);
+    free(value);
     free(key);
     return true;
 }
@@ -287,7 +332,7 @@ static bool gr_ttf_freeStringCache(void *key, void *value, void *context __unuse
     free(k);
 
     StringCacheEntry *e = (StringCacheEntry *)value;
-    free(e->surface.data);
+    free(e->glyphs);
     free(e);
     return true;
 }
@@ -314,6 +359,7 @@ void gr_ttf_freeFont(void *font)
         hashmapFree(d->string_cache);
         hashmapForEach(d->glyph_cache, gr_ttf_freeFontCache, nullptr);
         hashmapFree(d->glyph_cache);
+        free(d->atlas.surface.data);
         pthread_mutex_destroy(&d->mutex);
         free(d);
     }
@@ -321,32 +367,29 @@ void gr_ttf_freeFont(void *font)
     pthread_mutex_unlock(&font_data.mutex);
 }
 
-static TrueTypeCacheEntry *gr_ttf_glyph_cache_peek(TrueTypeFont *font, int char_index)
-{
-    return (TrueTypeCacheEntry *)hashmapGet(font->glyph_cache, &char_index);
-}
-
+// Only loads the glyph's metrics. The bitmap is rendered into the atlas when
+// the glyph is first drawn.
 static TrueTypeCacheEntry *gr_ttf_glyph_cache_get(TrueTypeFont *font, int char_index)
 {
     TrueTypeCacheEntry *res = (TrueTypeCacheEntry *)hashmapGet(font->glyph_cache, &char_index);
     if (!res) {
-        int error = FT_Load_Glyph(font->face, char_index, FT_LOAD_RENDER);
+        int error = FT_Load_Glyph(font->face, char_index, FT_LOAD_DEFAULT);
         if (error) {
             fprintf(stderr, "Failed to load glyph idx %d: %d\n", char_index, error);
             return nullptr;
         }
 
-        FT_BitmapGlyph glyph;
-        error = FT_Get_Glyph(font->face->glyph, (FT_Glyph*)&glyph);
-        if (error) {
-            fprintf(stderr, "Failed to copy glyph %d: %d\n", char_index, error);
-            return nullptr;
-        }
+        FT_GlyphSlot slot = font->face->glyph;
 
         res = (TrueTypeCacheEntry *)malloc(sizeof(TrueTypeCacheEntry));
         memset(res, 0, sizeof(TrueTypeCacheEntry));
-        res->glyph = glyph;
-        FT_Glyph_Get_CBox((FT_Glyph)glyph, FT_GLYPH_BBOX_PIXELS, &res->bbox);
+        res->advance = slot->advance.x >> 6;
+        // Same as FT_Glyph_Get_CBox() with FT_GLYPH_BBOX_PIXELS
+        res->bbox.xMin = slot->metrics.horiBearingX >> 6;
+        res->bbox.xMax = (slot->metrics.horiBearingX + slot->metrics.width + 63) >> 6;
+        res->bbox.yMin = (slot->metrics.horiBearingY - slot->metrics.height) >> 6;
+        res->bbox.yMax = (slot->metrics.horiBearingY + 63) >> 6;
+        res->shelf = -1;
 
         int *key = (int *)malloc(sizeof(int));
         *key = char_index;
@@ -357,68 +400,178 @@ static TrueTypeCacheEntry *gr_ttf_glyph_cache_get(TrueTypeFont *font, int char_i
     return res;
 }
 
-static int gr_ttf_copy_glyph_to_surface(GGLSurface *dest, FT_BitmapGlyph glyph, int offX, int offY, int base)
+static bool gr_ttf_atlas_unmap_shelf(void *key __unused, void *value, void *context)
+{
+    TrueTypeCacheEntry *e = (TrueTypeCacheEntry *)value;
+    int shelf = *(int *)context;
+    if (shelf < 0 || e->shelf == shelf) {
+        e->shelf = -1;
+    }
+    return true;
+}
+
+static bool gr_ttf_atlas_init(TrueTypeFont *font)
+{
+    GlyphAtlas *a = &font->atlas;
+    if (a->surface.data) {
+        return true;
+    }
+
+    // Room for at least 8 rows of 8 glyphs
+    int size = GLYPH_ATLAS_MIN_SIZE;
+    while (size < GLYPH_ATLAS_MAX_SIZE && size < font->max_height * 8) {
+        size *= 2;
+    }
+
+    a->surface.version = sizeof(a->surface);
+    a->surface.width = size;
+    a->surface.height = size;
+    a->surface.stride = size;
+    a->surface.format = GGL_PIXEL_FORMAT_A_8;
+    a->surface.data = (GGLubyte *) malloc(size * size);
+    if (!a->surface.data) {
+        fprintf(stderr, "Failed to allocate %dx%d glyph atlas\n", size, size);
+        return false;
+    }
+
+    a->line_height = MAX(font->max_height, 1);
+    a->used_height = 0;
+    a->shelf_count = 0;
+    return true;
+}
+
+// Finds room for a w x h bitmap, evicting the least recently drawn shelf if
+// necessary. Returns the shelf index or -1 if the bitmap can never fit.
+static int gr_ttf_atlas_alloc(TrueTypeFont *font, int w, int h, int *x, int *y)
 {
-    unsigned y;
-    uint8_t *src_itr = glyph->bitmap.buffer;
-    uint8_t *dest_itr = dest->data;
+    GlyphAtlas *a = &font->atlas;
+    int atlas_w = a->surface.width;
+    int atlas_h = a->surface.height;
+    int best = -1;
+    int i;
 
-    if (glyph->bitmap.pixel_mode != FT_PIXEL_MODE_GRAY) {
-        fprintf(stderr, "Unsupported pixel mode in FT_BitmapGlyph %d\n", glyph->bitmap.pixel_mode);
+    if (w > atlas_w || h > atlas_h) {
         return -1;
     }
 
-    dest_itr += (offY + base - glyph->top)*dest->stride + (offX + glyph->left);
+    // Tightest open shelf
+    for (i = 0; i < a->shelf_count; ++i) {
+        GlyphAtlasShelf *s = &a->shelves[i];
+        if (s->height >= h && s->used_width + w <= atlas_w
+                && (best < 0 || s->height < a->shelves[best].height)) {
+            best = i;
+        }
+    }
+
+    if (best < 0) {
+        int shelf_h = MAX(h, a->line_height);
+        if (a->shelf_count < GLYPH_ATLAS_MAX_SHELVES
+                && a->used_height + shelf_h <= atlas_h) {
+            best = a->shelf_count++;
+            a->shelves[best].y = a->used_height;
+            a->shelves[best].height = shelf_h;
+            a->used_height += shelf_h;
+        } else {
+            for (i = 0; i < a->shelf_count; ++i) {
+                GlyphAtlasShelf *s = &a->shelves[i];
+                if (s->height >= h && (best < 0
+                        || s->last_used < a->shelves[best].last_used)) {
+                    best = i;
+                }
+            }
+
+            if (best >= 0) {
+                hashmapForEach(font->glyph_cache, gr_ttf_atlas_unmap_shelf, &best);
+            } else {
+                // Only shorter shelves are left, so start over
+                int all = -1;
+                hashmapForEach(font->glyph_cache, gr_ttf_atlas_unmap_shelf, &all);
+                best = 0;
+                a->shelf_count = 1;
+                a->shelves[0].y = 0;
+                a->shelves[0].height = MAX(h, a->line_height);
+                a->used_height = a->shelves[0].height;
+            }
+        }
+        a->shelves[best].used_width = 0;
+    }
+
+    GlyphAtlasShelf *s = &a->shelves[best];
+    *x = s->used_width;
+    *y = s->y;
+    s->used_width += w;
+    return best;
+}
+
+// Makes sure the glyph's bitmap is in the atlas. Returns false if there is
+// nothing to draw.
+static bool gr_ttf_atlas_get(TrueTypeFont *font, TrueTypeCacheEntry *ent, int char_index)
+{
+    GlyphAtlas *a = &font->atlas;
+
+    if (ent->shelf >= 0) {
+        a->shelves[ent->shelf].last_used = a->clock;
+        return true;
+    } else if (ent->rendered && (ent->width == 0 || ent->height == 0)) {
+        return false;
+    }
+
+    int error = FT_Load_Glyph(font->face, char_index, FT_LOAD_RENDER);
+    if (error) {
+        fprintf(stderr, "Failed to render glyph idx %d: %d\n", char_index, error);
+        return false;
+    }
+
+    FT_GlyphSlot slot = font->face->glyph;
+    if (slot->bitmap.pixel_mode != FT_PIXEL_MODE_GRAY) {
+        fprintf(stderr, "Unsupported pixel mode in FT_Bitmap %d\n", slot->bitmap.pixel_mode);
+        return false;
+    }
 
-    // FIXME: if glyph->left is negative and everything else is 0 (e.g. letter 'j' in Roboto-Regular),
-    // the result might end up being before the buffer - I'm not sure how to properly handle this.
-    if (dest_itr < dest->data) {
-        dest_itr = dest->data;
+    ent->rendered = true;
+    ent->left = slot->bitmap_left;
+    ent->top = slot->bitmap_top;
+    ent->width = slot->bitmap.width;
+    ent->height = slot->bitmap.rows;
+    if (ent->width == 0 || ent->height == 0) {
+        return false;
     }
 
-    for (y = 0; y < glyph->bitmap.rows; ++y) {
-        memcpy(dest_itr, src_itr, glyph->bitmap.width);
-        src_itr += glyph->bitmap.pitch;
-        dest_itr += dest->stride;
+    ent->shelf = gr_ttf_atlas_alloc(font, ent->width, ent->height,
+                                    &ent->atlas_x, &ent->atlas_y);
+    if (ent->shelf < 0) {
+        fprintf(stderr, "Glyph idx %d (%dx%d) does not fit in the atlas\n",
+                char_index, ent->width, ent->height);
+        return false;
     }
-    return 0;
+    a->shelves[ent->shelf].last_used = a->clock;
+
+    uint8_t *src_itr = slot->bitmap.buffer;
+    uint8_t *dest_itr = a->surface.data + ent->atlas_y * a->surface.stride + ent->atlas_x;
+    for (int y = 0; y < ent->height; ++y) {
+        memcpy(dest_itr, src_itr, ent->width);
+        src_itr += slot->bitmap.pitch;
+        dest_itr += a->surface.stride;
+    }
+    return true;
 }
 
 static void gr_ttf_calcMaxFontHeight(TrueTypeFont *f)
 {
     char c;
     int char_idx;
-    int error;
-    FT_Glyph glyph;
     FT_BBox bbox;
-    FT_BBox bbox_glyph;
     TrueTypeCacheEntry *ent;
 
-    bbox.yMin = bbox_glyph.yMin = LONG_MAX;
-    bbox.yMax = bbox_glyph.yMax = LONG_MIN;
+    bbox.yMin = LONG_MAX;
+    bbox.yMax = LONG_MIN;
 
     for (c = '!'; c <= '~'; ++c) {
         char_idx = FT_Get_Char_Index(f->face, c);
-        ent = gr_ttf_glyph_cache_peek(f, char_idx);
+        ent = gr_ttf_glyph_cache_get(f, char_idx);
         if (ent) {
             bbox.yMin = MIN(bbox.yMin, ent->bbox.yMin);
             bbox.yMax = MAX(bbox.yMax, ent->bbox.yMax);
-        } else {
-            error = FT_Load_Glyph(f->face, char_idx, 0);
-            if (error) {
-                continue;
-            }
-
-            error = FT_Get_Glyph(f->face->glyph, &glyph);
-            if (error) {
-                continue;
-            }
-
-            FT_Glyph_Get_CBox(glyph, FT_GLYPH_BBOX_PIXELS, &bbox_glyph);
-            bbox.yMin = MIN(bbox.yMin, bbox_glyph.yMin);
-            bbox.yMax = MAX(bbox.yMax, bbox_glyph.yMax);
-
-            FT_Done_Glyph(glyph);
         }
     }
 
@@ -435,91 +588,68 @@ static void gr_ttf_calcMaxFontHeight(TrueTypeFont *f)
     f->base += f->size / 4;
 }
 
-// returns number of bytes from const char *text rendered to fit max_width, not number of UTF8 characters!
-static int gr_ttf_render_text(TrueTypeFont *font, GGLSurface *surface, const char *text, int max_width)
+// Lays out as much of the text as fits in max_width using the cached glyph
+// advances. Returns number of bytes from const char *text that fit, not
+// number of UTF8 characters!
+static int gr_ttf_shape_text(TrueTypeFont *font, StringCacheEntry *entry, const char *text, int max_width)
 {
     TrueTypeFont *f = font;
     TrueTypeCacheEntry *ent;
     int bytes_rendered = 0, total_w = 0;
     int utf_bytes = 0;
     unsigned int unicode = 0;
-    int i, x, diff, char_idx, prev_idx = 0;
-    int height;
+    int diff, kern, char_idx, prev_idx = 0;
     FT_Vector delta;
-    uint8_t *data = nullptr;
     const char *text_itr = text;
-    int *char_idxs;
-    int char_idxs_len = 0;
-
-    char_idxs = (int *) malloc(strlen(text) * sizeof(int));
-
-    while (*text_itr) {
-        utf_bytes = utf8_to_unicode(text_itr, &unicode);
-        text_itr += utf_bytes;
-        bytes_rendered += utf_bytes;
-
-        char_idx = FT_Get_Char_Index(f->face, unicode);
-        char_idxs[char_idxs_len] = char_idx;
-
-        ent = gr_ttf_glyph_cache_get(f, char_idx);
-        if (ent) {
-            diff = ent->glyph->root.advance.x >> 16;
-
-            if (FT_HAS_KERNING(f->face) && prev_idx && char_idx) {
-                FT_Get_Kerning(f->face, prev_idx, char_idx, FT_KERNING_DEFAULT, &delta);
-                diff += delta.x >> 6;
-            }
-
-            if (max_width != -1 && total_w + diff > max_width) {
-                break;
-            }
-
-            total_w += diff;
-        }
-        prev_idx = char_idx;
-        ++char_idxs_len;
-    }
+    ShapedGlyph *glyphs;
+    int glyph_count = 0;
 
     if (font->max_height == -1) {
         gr_ttf_calcMaxFontHeight(font);
     }
 
     if (font->max_height == -1) {
-        free(char_idxs);
         return -1;
     }
 
-    height = font->max_height;
+    glyphs = (ShapedGlyph *) malloc(MAX(strlen(text), 1) * sizeof(ShapedGlyph));
+    if (!glyphs) {
+        return -1;
+    }
 
-    data = (uint8_t *) malloc(total_w*height);
-    memset(data, 0, total_w*height);
-    x = 0;
-    prev_idx = 0;
+    while (*text_itr) {
+        utf_bytes = utf8_to_unicode(text_itr, &unicode);
+        text_itr += utf_bytes;
+        bytes_rendered += utf_bytes;
 
-    surface->version = sizeof(*surface);
-    surface->width = total_w;
-    surface->height = height;
-    surface->stride = total_w;
-    surface->data = (GGLubyte*)data;
-    surface->format = GGL_PIXEL_FORMAT_A_8;
+        char_idx = FT_Get_Char_Index(f->face, unicode);
 
-    for (i = 0; i < char_idxs_len; ++i) {
-        char_idx = char_idxs[i];
+        kern = 0;
         if (FT_HAS_KERNING(f->face) && prev_idx && char_idx) {
             FT_Get_Kerning(f->face, prev_idx, char_idx, FT_KERNING_DEFAULT, &delta);
-            x += delta.x >> 6;
+            kern = delta.x >> 6;
         }
 
         ent = gr_ttf_glyph_cache_get(f, char_idx);
         if (ent) {
-            gr_ttf_copy_glyph_to_surface(surface, ent->glyph, x, 0, font->base);
-            x += ent->glyph->root.advance.x >> 16;
-        }
+            diff = ent->advance + kern;
 
+            if (max_width != -1 && total_w + diff > max_width) {
+                break;
+            }
+
+            glyphs[glyph_count].char_idx = char_idx;
+            glyphs[glyph_count].x = total_w + kern;
+            ++glyph_count;
+
+            total_w += diff;
+        }
         prev_idx = char_idx;
     }
 
-    free(char_idxs);
+    entry->width = total_w;
+    entry->glyph_count = glyph_count;
+    entry->glyphs = glyphs;
     return bytes_rendered;
 }
 
@@ -533,6 +663,25 @@ static StringCacheEntry *gr_ttf_string_cache_peek(TrueTypeFont *font, const char
     return (StringCacheEntry *)hashmapGet(font->string_cache, &k);
 }
 
+static void gr_ttf_string_cache_truncate(TrueTypeFont *font)
+{
+    if (hashmapSize(font->string_cache) < STRING_CACHE_MAX_ENTRIES) {
+        return;
+    }
+
+    int i;
+    StringCacheEntry *ent;
+    for (i = 0; i < STRING_CACHE_TRUNCATE_ENTRIES; ++i) {
+        ent = font->string_cache_head;
+        font->string_cache_head = ent->next;
+        font->string_cache_head->prev = nullptr;
+
+        hashmapRemove(font->string_cache, ent->key);
+
+        gr_ttf_freeStringCache(ent->key, ent, nullptr);
+    }
+}
+
 static StringCacheEntry *gr_ttf_string_cache_get(TrueTypeFont *font, const char *text, int max_width)
 {
     StringCacheEntry *res;
@@ -545,7 +694,7 @@ static StringCacheEntry *gr_ttf_string_cache_get(TrueTypeFont *font, const char
     if (!res) {
         res = (StringCacheEntry *)malloc(sizeof(StringCacheEntry));
         memset(res, 0, sizeof(StringCacheEntry));
-        res->rendered_bytes = gr_ttf_render_text(font, &res->surface, text, max_width);
+        res->rendered_bytes = gr_ttf_shape_text(font, res, text, max_width);
         if (res->rendered_bytes < 0) {
             free(res);
             return nullptr;
@@ -567,6 +716,9 @@ static StringCacheEntry *gr_ttf_string_cache_get(TrueTypeFont *font, const char
         font->string_cache_tail = res;
 
         hashmapPut(font->string_cache, new_key, res);
+
+        // Long console output adds new strings on every line
+        gr_ttf_string_cache_truncate(font);
     } else if (res->next) {
         // move this entry to the tail of the linked list
         // if it isn't already there
@@ -584,22 +736,6 @@ static StringCacheEntry *gr_ttf_string_cache_get(TrueTypeFont *font, const char
         res->prev = font->string_cache_tail;
         res->prev->next = res;
         font->string_cache_tail = res;
-
-        // truncate old entries
-        if (hashmapSize(font->string_cache) >= STRING_CACHE_MAX_ENTRIES) {
-            printf("Truncating string cache entries.\n");
-            int i;
-            StringCacheEntry *ent;
-            for (i = 0; i < STRING_CACHE_TRUNCATE_ENTRIES; ++i) {
-                ent = font->string_cache_head;
-                font->string_cache_head = ent->next;
-                font->string_cache_head->prev = nullptr;
-
-                hashmapRemove(font->string_cache, ent->key);
-
-                gr_ttf_freeStringCache(ent->key, ent, nullptr);
-            }
-        }
     }
     return res;
 }
@@ -612,7 +748,7 @@ int gr_ttf_measureEx(const char *s, void *font)
     pthread_mutex_lock(&f->mutex);
     StringCacheEntry *e = gr_ttf_string_cache_get(f, s, -1);
     if (e) {
-        res = e->surface.width;
+        res = e->width;
     }
     pthread_mutex_unlock(&f->mutex);
 
@@ -661,7 +797,7 @@ int gr_ttf_maxExW(const char *s, void *font, int max_width)
             continue;
         }
 
-        total_w += ent->glyph->root.advance.x >> 16;
+        total_w += ent->advance;
         max_bytes += utf_bytes;
     }
     pthread_mutex_unlock(&f->mutex);
@@ -689,7 +825,8 @@ int gr_ttf_textExWH(void *context, int x, int y, const char *s, void *pFont, int
         return -1;
     }
 
-    int y_bottom = y + e->surface.height;
+    int y_bottom = y + font->max_height;
+    int x_right = x + e->width;
     int res = e->rendered_bytes;
 
     if (max_height != -1 && max_height < y_bottom) {
@@ -700,15 +837,71 @@ int gr_ttf_textExWH(void *context, int x, int y, const char *s, void *pFont, int
         }
     }
 
-    gl->bindTexture(gl, &e->surface);
-    gl->texEnvi(gl, GGL_TEXTURE_ENV, GGL_TEXTURE_ENV_MODE, GGL_REPLACE);
-    gl->texGeni(gl, GGL_S, GGL_TEXTURE_GEN_MODE, GGL_ONE_TO_ONE);
-    gl->texGeni(gl, GGL_T, GGL_TEXTURE_GEN_MODE, GGL_ONE_TO_ONE);
+    if (!gr_ttf_atlas_init(font)) {
+        pthread_mutex_unlock(&font->mutex);
+        return -1;
+    }
 
-    gl->enable(gl, GGL_TEXTURE_2D);
-    gl->texCoord2i(gl, -x, -y);
-    gl->recti(gl, x, y, x + e->surface.width, y_bottom);
-    gl->disable(gl, GGL_TEXTURE_2D);
+    GlyphAtlas *a = &font->atlas;
+    bool use_gl = false;
+    ++a->clock;
+
+    // Draw each glyph straight from the atlas, clipped to the box the whole
+    // string used to be rendered into
+    for (int i = 0; i < e->glyph_count; ++i) {
+        int char_idx = e->glyphs[i].char_idx;
+        TrueTypeCacheEntry *ent = gr_ttf_glyph_cache_get(font, char_idx);
+        if (!ent || !gr_ttf_atlas_get(font, ent, char_idx)) {
+            continue;
+        }
+
+        int gx = x + e->glyphs[i].x + ent->left;
+        int gy = y + font->base - ent->top;
+        int sx = ent->atlas_x;
+        int sy = ent->atlas_y;
+        int gw = ent->width;
+        int gh = ent->height;
+
+        if (gx < x) {
+            sx += x - gx;
+            gw -= x - gx;
+            gx = x;
+        }
+        if (gy < y) {
+            sy += y - gy;
+            gh -= y - gy;
+            gy = y;
+        }
+        gw = MIN(gw, x_right - gx);
+        gh = MIN(gh, y_bottom - gy);
+        if (gw <= 0 || gh <= 0) {
+            continue;
+        }
+
+        if (!use_gl) {
+            GGLSurface quad = a->surface;
+            quad.width = gw;
+            quad.height = gh;
+            quad.data = a->surface.data + sy * a->surface.stride + sx;
+            if (gr_blit_alpha_mask(&quad, gx, gy, gw, gh)) {
+                continue;
+            }
+
+            use_gl = true;
+            gl->bindTexture(gl, &a->surface);
+            gl->texEnvi(gl, GGL_TEXTURE_ENV, GGL_TEXTURE_ENV_MODE, GGL_REPLACE);
+            gl->texGeni(gl, GGL_S, GGL_TEXTURE_GEN_MODE, GGL_ONE_TO_ONE);
+            gl->texGeni(gl, GGL_T, GGL_TEXTURE_GEN_MODE, GGL_ONE_TO_ONE);
+            gl->enable(gl, GGL_TEXTURE_2D);
+        }
+
+        gl->texCoord2i(gl, sx - gx, sy - gy);
+        gl->recti(gl, gx, gy, gx + gw, gy + gh);
+    }
+
+    if (use_gl) {
+        gl->disable(gl, GGL_TEXTURE_2D);
+    }
 
     pthread_mutex_unlock(&font->mutex);
     return res;
@@ -734,7 +927,7 @@ static bool gr_ttf_dump_stats_count_string_cache(void *key __unused, void *value
 {
     int *string_cache_size = (int *) context;
     StringCacheEntry *e = (StringCacheEntry *) value;
-    *string_cache_size += e->surface.height*e->surface.width + sizeof(StringCacheEntry);
+    *string_cache_size += e->glyph_count * sizeof(ShapedGlyph) + sizeof(StringCacheEntry);
     return true;
 }
 
@@ -754,10 +947,12 @@ static bool gr_ttf_dump_stats_font(void *key, void *value, void *context)
            "    max_height: %d\n"
            "    base: %d\n"
            "    glyph_cache: %zu entries\n"
+           "    glyph_atlas: %ux%u, %d shelves\n"
            "    string_cache: %zu entries (%.2f kB)\n",
            k->path, k->size, k->dpi,
            f->refcount, f->max_height, f->base,
            hashmapSize(f->glyph_cache),
+           f->atlas.surface.width, f->atlas.surface.height, f->atlas.shelf_count,
            hashmapSize(f->string_cache), ((double)string_cache_size)/1024);
 
     pthread_mutex_unlock(&f->mutex);
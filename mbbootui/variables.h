@@ -123,4 +123,7 @@
 // Autoboot timeout
 #define VAR_TW_AUTOBOOT_TIMEOUT         "tw_autoboot_timeout"
 
+// Whether to show the frame timing overlay
+#define VAR_TW_FRAME_STATS              "tw_frame_stats"
+
 #endif  // _VARIABLES_HEADER_
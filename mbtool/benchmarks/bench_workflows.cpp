@@ -0,0 +1,659 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Whole-workflow benchmarks for mbtool
+//
+// Every benchmark works on synthetic data that is generated from the workload
+// parameters, so results are comparable between commits as long as the
+// parameters (which are included in the JSON output) are the same:
+//
+//   --param=workdir=<dir>          Scratch directory (default:
+//                                  /data/local/tmp/mbtool_bench)
+//   --param=files=<n>              Number of files in the /data tree
+//   --param=file_size=<bytes>      Size of each file
+//   --param=dir_fanout=<n>         Directories per level of the /data tree
+//   --param=boot_size=<bytes>      Size of the boot image for switch_rom
+//   --param=mbtool_recovery=<path> mbtool_recovery binary for backup,
+//                                  restore, and install
+//   --param=install_zip=<path>     Patched ROM zip for the install benchmark
+//
+// The backup, restore, switch_rom, and install benchmarks must run as root.
+// They run in a child process with a private mount namespace that is chrooted
+// into a sandbox with its own /system, /cache, and /data, so the device's real
+// ROMs are never touched. The work takes seconds per iteration, so
+// `--min-time=0` (one iteration each) is usually what you want.
+
+#include "benchmark.h"
+
+#include <algorithm>
+#include <functional>
+#include <optional>
+#include <vector>
+
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <archive.h>
+#include <archive_entry.h>
+
+#include "mbcommon/finally.h"
+#include "mbcommon/string.h"
+#include "mbutil/archive.h"
+#include "mbutil/command.h"
+#include "mbutil/copy.h"
+#include "mbutil/delete.h"
+#include "mbutil/directory.h"
+#include "mbutil/file.h"
+#include "mbutil/zip_index.h"
+
+#include "util/multiboot.h"
+#include "util/switcher.h"
+#include "util/wipe.h"
+
+using namespace mb;
+using namespace mb::bench;
+using namespace std::chrono;
+
+// ROM that the sandboxed workflows operate on
+static constexpr char SANDBOX_ROM_ID[] = "dual";
+static constexpr char SANDBOX_DATA_DIR[] = "/data/multiboot/dual/data";
+static constexpr char SANDBOX_BOOT_BLOCKDEV[] = "/tmp/boot";
+static constexpr char SANDBOX_BACKUP_DIR[] = "/tmp/backup";
+static constexpr char SANDBOX_MBTOOL[] = "/mbtool_recovery";
+static constexpr char SANDBOX_INSTALL_ZIP[] = "/tmp/install.zip";
+
+struct Workload
+{
+    uint64_t files;
+    uint64_t file_size;
+    uint64_t dir_fanout;
+};
+
+static const Workload & workload()
+{
+    static Workload w{
+        param_u64("files", 2000),
+        param_u64("file_size", 16384),
+        std::max<uint64_t>(param_u64("dir_fanout", 16), 1),
+    };
+    return w;
+}
+
+static const std::string & work_dir()
+{
+    return param("workdir", "/data/local/tmp/mbtool_bench");
+}
+
+static uint64_t workload_bytes()
+{
+    return workload().files * workload().file_size;
+}
+
+// Fill a buffer with deterministic data. The first half is pseudo-random
+// (xorshift64*) and the second half is repetitive, so the data compresses
+// roughly 2:1, like a typical mix of apps and databases.
+static void fill_data(std::vector<unsigned char> &buf, uint64_t seed)
+{
+    uint64_t x = seed * UINT64_C(0x9e3779b97f4a7c15) + 1;
+    size_t half = buf.size() / 2;
+
+    for (size_t i = 0; i < half; ++i) {
+        x ^= x >> 12;
+        x ^= x << 25;
+        x ^= x >> 27;
+        buf[i] = static_cast<unsigned char>((x * UINT64_C(0x2545f4914f6cdd1d)) >> 56);
+    }
+    for (size_t i = half; i < buf.size(); ++i) {
+        buf[i] = static_cast<unsigned char>("mbtool benchmark data\n"[i % 22]);
+    }
+}
+
+// Relative path of the ith file in a generated tree. Files are spread over a
+// two-level directory hierarchy.
+static std::string tree_file_path(uint64_t i)
+{
+    auto fanout = workload().dir_fanout;
+    return format("d%02" PRIu64 "/d%02" PRIu64 "/f%06" PRIu64,
+                  i % fanout, (i / fanout) % fanout, i);
+}
+
+static bool create_tree(const std::string &dir)
+{
+    std::vector<unsigned char> buf(workload().file_size);
+
+    for (uint64_t i = 0; i < workload().files; ++i) {
+        auto path = dir + "/" + tree_file_path(i);
+
+        if (auto r = util::mkdir_parent(path, 0771); !r) {
+            fprintf(stderr, "%s: Failed to create parent directory: %s\n",
+                    path.c_str(), r.error().message().c_str());
+            return false;
+        }
+
+        fill_data(buf, i);
+
+        if (auto r = util::file_write_data(path, buf.data(), buf.size()); !r) {
+            fprintf(stderr, "%s: Failed to write file: %s\n",
+                    path.c_str(), r.error().message().c_str());
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Source /data tree that is shared by all benchmarks
+static const std::string * source_tree()
+{
+    static std::optional<std::string> path = [] {
+        std::string dir = work_dir() + "/source";
+        std::optional<std::string> result;
+
+        fprintf(stderr, "Generating %" PRIu64 " files in %s...\n",
+                workload().files, dir.c_str());
+
+        (void) util::delete_recursive(dir);
+        if (create_tree(dir)) {
+            result = std::move(dir);
+        }
+
+        return result;
+    }();
+
+    return path ? &*path : nullptr;
+}
+
+static bool write_rom_zip(const std::string &zip_path, const std::string &tree)
+{
+    archive *a = archive_write_new();
+    if (!a) {
+        return false;
+    }
+
+    auto free_a = finally([&] {
+        archive_write_free(a);
+    });
+
+    archive_entry *entry = archive_entry_new();
+    if (!entry) {
+        return false;
+    }
+
+    auto free_entry = finally([&] {
+        archive_entry_free(entry);
+    });
+
+    if (archive_write_set_format_zip(a) != ARCHIVE_OK
+            || archive_write_open_filename(a, zip_path.c_str()) != ARCHIVE_OK) {
+        fprintf(stderr, "%s: Failed to create zip: %s\n",
+                zip_path.c_str(), archive_error_string(a));
+        return false;
+    }
+
+    for (uint64_t i = 0; i < workload().files; ++i) {
+        auto rel_path = tree_file_path(i);
+
+        auto contents = util::file_read_all(tree + "/" + rel_path);
+        if (!contents) {
+            return false;
+        }
+
+        archive_entry_clear(entry);
+        archive_entry_set_pathname(entry, ("system/" + rel_path).c_str());
+        archive_entry_set_filetype(entry, AE_IFREG);
+        archive_entry_set_perm(entry, 0644);
+        archive_entry_set_size(entry, static_cast<la_int64_t>(
+                contents.value().size()));
+
+        if (archive_write_header(a, entry) != ARCHIVE_OK
+                || archive_write_data(a, contents.value().data(),
+                                      contents.value().size())
+                        != static_cast<la_ssize_t>(contents.value().size())) {
+            fprintf(stderr, "%s: Failed to write zip entry: %s\n",
+                    zip_path.c_str(), archive_error_string(a));
+            return false;
+        }
+    }
+
+    return archive_write_close(a) == ARCHIVE_OK;
+}
+
+// Synthetic ROM zip containing the source tree under system/
+static const std::string * rom_zip()
+{
+    static std::optional<std::string> path = [] {
+        std::string zip_path = work_dir() + "/rom.zip";
+        std::optional<std::string> result;
+
+        if (auto tree = source_tree(); tree && write_rom_zip(zip_path, *tree)) {
+            result = std::move(zip_path);
+        }
+
+        return result;
+    }();
+
+    return path ? &*path : nullptr;
+}
+
+MB_BENCHMARK(workflow_copy_dir)
+{
+    state.pause_timing();
+    auto source = source_tree();
+    auto target = work_dir() + "/copy";
+    state.resume_timing();
+
+    if (!source) {
+        return state.skip("Failed to generate source tree");
+    }
+
+    for (uint64_t i = 0; i < state.iterations(); ++i) {
+        state.pause_timing();
+        (void) util::delete_recursive(target);
+        state.resume_timing();
+
+        if (auto r = util::copy_dir(*source, target,
+                                    util::CopyFlag::CopyAttributes
+                                    | util::CopyFlag::CopyXattrs
+                                    | util::CopyFlag::ExcludeTopLevel
+                                    | util::CopyFlag::Parallel); !r) {
+            return state.skip("copy_dir failed: " + r.error().message());
+        }
+    }
+
+    state.pause_timing();
+    (void) util::delete_recursive(target);
+    state.resume_timing();
+
+    state.set_bytes_processed(state.iterations() * workload_bytes());
+}
+
+MB_BENCHMARK(workflow_wipe_directory)
+{
+    state.pause_timing();
+    auto source = source_tree();
+    auto target = work_dir() + "/wipe";
+    state.resume_timing();
+
+    if (!source) {
+        return state.skip("Failed to generate source tree");
+    }
+
+    for (uint64_t i = 0; i < state.iterations(); ++i) {
+        state.pause_timing();
+        (void) util::delete_recursive(target);
+        auto r = util::copy_dir(*source, target,
+                                util::CopyFlag::ExcludeTopLevel);
+        state.resume_timing();
+
+        if (!r) {
+            return state.skip("copy_dir failed: " + r.error().message());
+        }
+
+        if (!wipe_directory(target, {})) {
+            return state.skip("wipe_directory failed");
+        }
+    }
+
+    state.pause_timing();
+    (void) util::delete_recursive(target);
+    state.resume_timing();
+
+    state.set_counter("files", static_cast<double>(workload().files));
+}
+
+// The data path of an install: index the ROM zip and extract it
+MB_BENCHMARK(workflow_rom_zip_extract)
+{
+    state.pause_timing();
+    auto zip_path = rom_zip();
+    auto target = work_dir() + "/extract";
+    state.resume_timing();
+
+    if (!zip_path) {
+        return state.skip("Failed to generate ROM zip");
+    }
+
+    for (uint64_t i = 0; i < state.iterations(); ++i) {
+        state.pause_timing();
+        (void) util::delete_recursive(target);
+        state.resume_timing();
+
+        util::ZipIndex index;
+        if (auto r = index.load(*zip_path); !r) {
+            return state.skip("Failed to index zip: " + r.error().message());
+        }
+
+        util::ZipIndex::ExtractList list;
+        for (auto const &entry : index.entries()) {
+            if (!entry.is_dir()) {
+                list.emplace_back(&entry, target + "/" + entry.name);
+            }
+        }
+
+        if (auto r = index.extract(list); !r) {
+            return state.skip("Failed to extract zip: " + r.error().message());
+        }
+    }
+
+    state.pause_timing();
+    (void) util::delete_recursive(target);
+    state.resume_timing();
+
+    state.set_bytes_processed(state.iterations() * workload_bytes());
+}
+
+static std::string sandbox_dir()
+{
+    return work_dir() + "/sandbox";
+}
+
+// Build the sandbox root filesystem. The same sandbox is reused by all of the
+// sandboxed benchmarks.
+static bool create_sandbox()
+{
+    static std::optional<bool> created;
+    if (created) {
+        return *created;
+    }
+    created = false;
+
+    auto source = source_tree();
+    if (!source) {
+        return false;
+    }
+
+    auto root = sandbox_dir();
+    (void) util::delete_recursive(root);
+
+    for (auto const &dir : {"/system", "/cache", "/data", "/dev", "/proc",
+                            "/tmp", "/system/multiboot/dual/system",
+                            "/cache/multiboot/dual/cache"}) {
+        if (auto r = util::mkdir_recursive(root + dir, 0755); !r) {
+            fprintf(stderr, "%s%s: Failed to create directory: %s\n",
+                    root.c_str(), dir, r.error().message().c_str());
+            return false;
+        }
+    }
+
+    if (auto r = util::copy_dir(*source, root + SANDBOX_DATA_DIR,
+                                util::CopyFlag::ExcludeTopLevel); !r) {
+        fprintf(stderr, "Failed to populate sandbox /data: %s\n",
+                r.error().message().c_str());
+        return false;
+    }
+
+    // Installed ROMs are detected by their boot images
+    std::vector<unsigned char> boot(param_u64("boot_size", 16 * 1024 * 1024));
+    fill_data(boot, 0xb007);
+
+    for (auto const &id : {"primary", SANDBOX_ROM_ID}) {
+        auto path = format("%s" MULTIBOOT_DIR "/%s/boot.img",
+                           root.c_str(), id);
+        if (!util::mkdir_parent(path, 0775)
+                || !util::file_write_data(path, boot.data(), boot.size())) {
+            fprintf(stderr, "%s: Failed to write boot image\n", path.c_str());
+            return false;
+        }
+    }
+
+    if (!util::file_write_data(root + SANDBOX_BOOT_BLOCKDEV,
+                               boot.data(), boot.size())) {
+        return false;
+    }
+
+    // The binary is copied because it must be inside the chroot
+    auto const &mbtool = param("mbtool_recovery",
+                               "/data/local/tmp/mbtool_recovery");
+    if (util::copy_file(mbtool, root + SANDBOX_MBTOOL, {})) {
+        (void) chmod((root + SANDBOX_MBTOOL).c_str(), 0755);
+    }
+
+    auto const &install_zip = param("install_zip", "");
+    if (!install_zip.empty()) {
+        (void) util::copy_file(install_zip, root + SANDBOX_INSTALL_ZIP, {});
+    }
+
+    created = true;
+    return true;
+}
+
+// Enter the sandbox in a private mount namespace. The root and the partitions
+// are bind mounted onto themselves so that they are mount points, as mbtool
+// expects.
+static bool enter_sandbox()
+{
+    auto root = sandbox_dir();
+
+    if (unshare(CLONE_NEWNS) < 0
+            || mount("", "/", "", MS_PRIVATE | MS_REC, "") < 0) {
+        fprintf(stderr, "Failed to unshare mount namespace: %s\n",
+                strerror(errno));
+        return false;
+    }
+
+    for (auto const &dir : {"", "/system", "/cache", "/data"}) {
+        auto path = root + dir;
+        if (mount(path.c_str(), path.c_str(), "", MS_BIND, "") < 0) {
+            fprintf(stderr, "%s: Failed to bind mount: %s\n",
+                    path.c_str(), strerror(errno));
+            return false;
+        }
+    }
+
+    if (mount("proc", (root + "/proc").c_str(), "proc", 0, "") < 0
+            || mount("/dev", (root + "/dev").c_str(), "",
+                     MS_BIND | MS_REC, "") < 0) {
+        fprintf(stderr, "Failed to mount /proc or /dev: %s\n",
+                strerror(errno));
+        return false;
+    }
+
+    if (chroot(root.c_str()) < 0 || chdir("/") < 0) {
+        fprintf(stderr, "%s: Failed to chroot: %s\n",
+                root.c_str(), strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+static bool run_mbtool(const std::vector<std::string> &args)
+{
+    std::vector<std::string> argv{SANDBOX_MBTOOL};
+    argv.insert(argv.end(), args.begin(), args.end());
+
+    int status = util::run_command(argv[0], argv, {}, {}, {});
+    if (status < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "%s %s failed\n", SANDBOX_MBTOOL, args[0].c_str());
+        return false;
+    }
+
+    return true;
+}
+
+struct SandboxResult
+{
+    bool success;
+    int64_t ns;
+};
+
+/*!
+ * \brief Run a workflow in the sandbox
+ *
+ * \param prepare Called once in the sandbox before any iteration (untimed)
+ * \param setup Called before every iteration (untimed)
+ * \param run The measured workflow
+ */
+static void run_in_sandbox(State &state,
+                           const std::function<bool()> &prepare,
+                           const std::function<bool()> &setup,
+                           const std::function<bool()> &run)
+{
+    if (geteuid() != 0) {
+        return state.skip("Must be run as root");
+    }
+
+    if (!create_sandbox()) {
+        return state.skip("Failed to create sandbox");
+    }
+
+    int pipe_fds[2];
+    if (pipe2(pipe_fds, O_CLOEXEC) < 0) {
+        return state.skip("Failed to create pipe");
+    }
+
+    fflush(stdout);
+    fflush(stderr);
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(pipe_fds[0]);
+        close(pipe_fds[1]);
+        return state.skip("Failed to fork");
+    } else if (pid == 0) {
+        close(pipe_fds[0]);
+
+        SandboxResult result{false, 0};
+
+        if (enter_sandbox() && prepare()) {
+            nanoseconds total(0);
+            result.success = true;
+
+            for (uint64_t i = 0; i < state.iterations(); ++i) {
+                if (!setup()) {
+                    result.success = false;
+                    break;
+                }
+
+                auto start = steady_clock::now();
+                bool ret = run();
+                total += duration_cast<nanoseconds>(steady_clock::now() - start);
+
+                if (!ret) {
+                    result.success = false;
+                    break;
+                }
+            }
+
+            result.ns = total.count();
+        }
+
+        ssize_t n = write(pipe_fds[1], &result, sizeof(result));
+        _exit(n == sizeof(result) ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    close(pipe_fds[1]);
+
+    SandboxResult result{false, 0};
+    ssize_t n;
+    do {
+        n = read(pipe_fds[0], &result, sizeof(result));
+    } while (n < 0 && errno == EINTR);
+    close(pipe_fds[0]);
+
+    int status;
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR);
+
+    if (n != sizeof(result) || !result.success) {
+        return state.skip("Workflow failed (see stderr)");
+    }
+
+    state.set_manual_time(nanoseconds(result.ns));
+}
+
+static bool has_mbtool()
+{
+    struct stat sb;
+    return stat((sandbox_dir() + SANDBOX_MBTOOL).c_str(), &sb) == 0;
+}
+
+static bool delete_backup()
+{
+    return !!util::delete_recursive(SANDBOX_BACKUP_DIR);
+}
+
+static bool backup_rom()
+{
+    return run_mbtool({"backup", "-r", SANDBOX_ROM_ID, "-t", "data",
+                       "-d", SANDBOX_BACKUP_DIR, "-f"});
+}
+
+MB_BENCHMARK(workflow_backup)
+{
+    if (!create_sandbox() || !has_mbtool()) {
+        return state.skip("Set --param=mbtool_recovery=<path>");
+    }
+
+    run_in_sandbox(state, [] { return true; }, delete_backup, backup_rom);
+
+    state.set_bytes_processed(state.iterations() * workload_bytes());
+}
+
+MB_BENCHMARK(workflow_restore)
+{
+    if (!create_sandbox() || !has_mbtool()) {
+        return state.skip("Set --param=mbtool_recovery=<path>");
+    }
+
+    run_in_sandbox(state, [] {
+        return delete_backup() && backup_rom();
+    }, [] {
+        return true;
+    }, [] {
+        return run_mbtool({"restore", "-r", SANDBOX_ROM_ID, "-t", "data",
+                           "-d", SANDBOX_BACKUP_DIR});
+    });
+
+    state.set_bytes_processed(state.iterations() * workload_bytes());
+}
+
+MB_BENCHMARK(workflow_switch_rom)
+{
+    run_in_sandbox(state, [] { return true; }, [] { return true; }, [] {
+        return switch_rom(SANDBOX_ROM_ID, SANDBOX_BOOT_BLOCKDEV, {}, true)
+                == SwitchRomResult::Succeeded;
+    });
+
+    state.set_bytes_processed(state.iterations()
+            * param_u64("boot_size", 16 * 1024 * 1024));
+}
+
+MB_BENCHMARK(workflow_install)
+{
+    if (param("install_zip", "").empty()) {
+        return state.skip("Set --param=install_zip=<patched ROM zip>");
+    } else if (!create_sandbox() || !has_mbtool()) {
+        return state.skip("Set --param=mbtool_recovery=<path>");
+    }
+
+    run_in_sandbox(state, [] { return true; }, [] { return true; }, [] {
+        return run_mbtool({"rom-installer", "-r", SANDBOX_ROM_ID,
+                           SANDBOX_INSTALL_ZIP});
+    });
+}
@@ -41,6 +41,7 @@ public:
     static void detect_directories();
 
     static std::string get_shared_data_path(const std::string &pkg);
+    static std::string get_shared_apk_path(const std::string &pkg);
 
     static bool initialize_directories();
     static bool create_shared_data_directory(const std::string &pkg, uid_t uid);
@@ -48,6 +49,9 @@ public:
 
     static bool mount_shared_directory(const std::string &pkg, uid_t uid);
     static bool unmount_shared_directory(const std::string &pkg);
+
+    static bool sync_shared_apk(const Package &pkg);
+    static bool unmount_shared_apks(const std::string &pkg);
 };
 
 }
@@ -22,6 +22,18 @@
 namespace mb
 {
 
-bool connection_version_3(int fd);
+struct ConnectionOptions
+{
+    // Run privileged or long-running requests (eg. SignedExec or switching
+    // ROMs) in a child process. This must be set when the connection is served
+    // by a thread in the daemon process.
+    bool isolate_privileged = false;
+    // Unshare the mount namespace in isolated child processes
+    bool unshare_mounts = true;
+};
+
+bool connection_version_3(int fd, const ConnectionOptions &options);
+
+bool setup_signed_exec_dir();
 
 }
\ No newline at end of file
@@ -18,6 +18,8 @@
 #pragma once
 
 #include <algorithm>
+#include <chrono>
+#include <condition_variable>
 #include <mutex>
 #include <optional>
 #include <string>
@@ -57,6 +59,11 @@ class DeviceHandler {
 
     BlockDevMap GetBlockDeviceMap() const;
 
+    // Incremented every time a device event is handled
+    uint64_t EventGeneration() const;
+    bool WaitForEvent(uint64_t generation, std::chrono::milliseconds timeout) const;
+    bool WaitForPath(const std::string& path, std::chrono::milliseconds timeout) const;
+
   private:
     bool FindPlatformDevice(std::string path, std::string* platform_device_path) const;
     void MakeDevice(const std::string& path, bool block, int major, int minor) const;
@@ -65,9 +72,14 @@ class DeviceHandler {
 
     std::string sysfs_mount_point_;
     mutable std::optional<std::string> boot_device_;
+    mutable std::once_flag boot_device_once_;
 
     BlockDevMap block_dev_mappings_;
     mutable std::mutex block_dev_mappings_guard_;
+
+    uint64_t event_generation_ = 0;
+    mutable std::mutex event_guard_;
+    mutable std::condition_variable event_cv_;
 };
 
 // Exposed for testing
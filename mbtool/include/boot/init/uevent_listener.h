@@ -20,6 +20,8 @@
 #include <chrono>
 #include <functional>
 #include <optional>
+#include <string>
+#include <vector>
 
 #include <dirent.h>
 
@@ -43,6 +45,7 @@ class UeventListener {
     UeventListener();
 
     void RegenerateUevents(const ListenerCallback& callback) const;
+    std::vector<Uevent> RegenerateUeventsParallel(unsigned int num_threads) const;
     ListenerAction RegenerateUeventsForPath(const std::string& path,
                                             const ListenerCallback& callback) const;
     void Poll(const ListenerCallback& callback, int cancel_fd,
@@ -51,6 +54,9 @@ class UeventListener {
   private:
     bool ReadUevent(Uevent* uevent) const;
     ListenerAction RegenerateUeventsForDir(DIR* d, const ListenerCallback& callback) const;
+    void SplitRegenerationPath(const std::string& path, int depth,
+                               std::vector<std::string>* dirs,
+                               const ListenerCallback& callback) const;
 
     android::base::unique_fd device_fd_;
 };
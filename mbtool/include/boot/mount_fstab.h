@@ -60,5 +60,6 @@ bool mount_fstab(const char *path, const std::shared_ptr<Rom> &rom,
                  const device::Device &device, MountFlags flags,
                  const android::init::DeviceHandler &handler);
 bool mount_rom(const std::shared_ptr<Rom> &rom);
+bool mount_all_system_images();
 
 }
@@ -170,16 +170,34 @@ MB_DECLARE_OPERATORS_FOR_FLAGS(Package::Flags)
 MB_DECLARE_OPERATORS_FOR_FLAGS(Package::PublicFlags)
 MB_DECLARE_OPERATORS_FOR_FLAGS(Package::PrivateFlags)
 
+enum class PackagesLoadFlag : uint8_t
+{
+    // Do not parse the <sigs> elements. Packages::sigs and Package::sig_indexes
+    // will be empty.
+    SkipSigs            = 1u << 0,
+};
+MB_DECLARE_FLAGS(PackagesLoadFlags, PackagesLoadFlag)
+MB_DECLARE_OPERATORS_FOR_FLAGS(PackagesLoadFlags)
+
 class Packages
 {
 public:
     std::vector<std::shared_ptr<Package>> pkgs;
     std::unordered_map<std::string, std::string> sigs;
 
-    bool load_xml(const std::string &path);
+    bool load_xml(const std::string &path, PackagesLoadFlags flags = {});
+    bool load_cached(const std::string &path, const std::string &cache_path,
+                     PackagesLoadFlags flags = {});
 
     std::shared_ptr<Package> find_by_uid(uid_t uid) const;
     std::shared_ptr<Package> find_by_pkg(const std::string &pkg_id) const;
+
+private:
+    std::unordered_map<uid_t, std::shared_ptr<Package>> m_by_uid;
+    std::unordered_map<std::string, std::shared_ptr<Package>> m_by_name;
+
+    bool parse_xml(const std::string &path, PackagesLoadFlags flags);
+    void build_indexes();
 };
 
 }
@@ -17,10 +17,14 @@
 
 #pragma once
 
+#include <condition_variable>
+#include <memory>
+#include <mutex>
 #include <optional>
 #include <string>
 #include <string_view>
 #include <thread>
+#include <unordered_map>
 
 #include "mbcommon/common.h"
 
@@ -54,13 +58,27 @@ private:
     int m_stopper_pipe[2];
     std::thread m_thread;
 
+    // persist.* properties waiting to be written to disk
+    std::mutex m_persist_lock;
+    std::condition_variable m_persist_cv;
+    std::unordered_map<std::string, std::string> m_persist_pending;
+    bool m_persist_stop;
+    std::thread m_persist_thread;
+
     uint32_t set_internal(const std::string &name, std::string_view value);
 
     int create_socket();
 
     void socket_handler_loop();
-    void socket_handle_set_property();
+    void socket_accept_connections(
+            int epoll_fd,
+            std::unordered_map<int, std::unique_ptr<SocketConnection>> &conns);
+    bool socket_handle_request(SocketConnection &socket);
     void socket_handle_set_property_impl(SocketConnection &socket,
                                          const std::string &name,
                                          std::string_view value, bool legacy);
+
+    void persist_loop();
+    void queue_persistent_property(const std::string &name,
+                                   std::string_view value);
 };
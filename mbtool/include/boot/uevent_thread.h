@@ -49,6 +49,7 @@ private:
     std::thread m_thread;
     bool m_is_running;
 
+    void coldboot();
     void thread_func();
 };
 
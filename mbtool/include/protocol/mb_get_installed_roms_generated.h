@@ -23,7 +23,8 @@ struct MbRom FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
     VT_CACHE_PATH = 8,
     VT_DATA_PATH = 10,
     VT_VERSION = 12,
-    VT_BUILD = 14
+    VT_BUILD = 14,
+    VT_THUMBNAIL_PATH = 16
   };
   const flatbuffers::String *id() const {
     return GetPointer<const flatbuffers::String *>(VT_ID);
@@ -43,6 +44,9 @@ struct MbRom FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
   const flatbuffers::String *build() const {
     return GetPointer<const flatbuffers::String *>(VT_BUILD);
   }
+  const flatbuffers::String *thumbnail_path() const {
+    return GetPointer<const flatbuffers::String *>(VT_THUMBNAIL_PATH);
+  }
   bool Verify(flatbuffers::Verifier &verifier) const {
     return VerifyTableStart(verifier) &&
            VerifyOffset(verifier, VT_ID) &&
@@ -57,6 +61,8 @@ struct MbRom FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
            verifier.Verify(version()) &&
            VerifyOffset(verifier, VT_BUILD) &&
            verifier.Verify(build()) &&
+           VerifyOffset(verifier, VT_THUMBNAIL_PATH) &&
+           verifier.Verify(thumbnail_path()) &&
            verifier.EndTable();
   }
 };
@@ -82,6 +88,9 @@ struct MbRomBuilder {
   void add_build(flatbuffers::Offset<flatbuffers::String> build) {
     fbb_.AddOffset(MbRom::VT_BUILD, build);
   }
+  void add_thumbnail_path(flatbuffers::Offset<flatbuffers::String> thumbnail_path) {
+    fbb_.AddOffset(MbRom::VT_THUMBNAIL_PATH, thumbnail_path);
+  }
   explicit MbRomBuilder(flatbuffers::FlatBufferBuilder &_fbb)
         : fbb_(_fbb) {
     start_ = fbb_.StartTable();
@@ -101,8 +110,10 @@ inline flatbuffers::Offset<MbRom> CreateMbRom(
     flatbuffers::Offset<flatbuffers::String> cache_path = 0,
     flatbuffers::Offset<flatbuffers::String> data_path = 0,
     flatbuffers::Offset<flatbuffers::String> version = 0,
-    flatbuffers::Offset<flatbuffers::String> build = 0) {
+    flatbuffers::Offset<flatbuffers::String> build = 0,
+    flatbuffers::Offset<flatbuffers::String> thumbnail_path = 0) {
   MbRomBuilder builder_(_fbb);
+  builder_.add_thumbnail_path(thumbnail_path);
   builder_.add_build(build);
   builder_.add_version(version);
   builder_.add_data_path(data_path);
@@ -119,7 +130,8 @@ inline flatbuffers::Offset<MbRom> CreateMbRomDirect(
     const char *cache_path = nullptr,
     const char *data_path = nullptr,
     const char *version = nullptr,
-    const char *build = nullptr) {
+    const char *build = nullptr,
+    const char *thumbnail_path = nullptr) {
   return mbtool::daemon::v3::CreateMbRom(
       _fbb,
       id ? _fbb.CreateString(id) : 0,
@@ -127,7 +139,8 @@ inline flatbuffers::Offset<MbRom> CreateMbRomDirect(
       cache_path ? _fbb.CreateString(cache_path) : 0,
       data_path ? _fbb.CreateString(data_path) : 0,
       version ? _fbb.CreateString(version) : 0,
-      build ? _fbb.CreateString(build) : 0);
+      build ? _fbb.CreateString(build) : 0,
+      thumbnail_path ? _fbb.CreateString(thumbnail_path) : 0);
 }
 
 struct MbGetInstalledRomsRequest FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
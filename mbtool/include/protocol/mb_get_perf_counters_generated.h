@@ -0,0 +1,252 @@
+// automatically generated by the FlatBuffers compiler, do not modify
+
+
+#ifndef FLATBUFFERS_GENERATED_MBGETPERFCOUNTERS_MBTOOL_DAEMON_V3_H_
+#define FLATBUFFERS_GENERATED_MBGETPERFCOUNTERS_MBTOOL_DAEMON_V3_H_
+
+#include "flatbuffers/flatbuffers.h"
+
+namespace mbtool {
+namespace daemon {
+namespace v3 {
+
+struct PerfMetric;
+
+struct MbGetPerfCountersRequest;
+
+struct MbGetPerfCountersResponse;
+
+enum PerfMetricType {
+  PerfMetricType_COUNTER = 0,
+  PerfMetricType_HISTOGRAM = 1,
+  PerfMetricType_MIN = PerfMetricType_COUNTER,
+  PerfMetricType_MAX = PerfMetricType_HISTOGRAM
+};
+
+inline const PerfMetricType (&EnumValuesPerfMetricType())[2] {
+  static const PerfMetricType values[] = {
+    PerfMetricType_COUNTER,
+    PerfMetricType_HISTOGRAM
+  };
+  return values;
+}
+
+inline const char * const *EnumNamesPerfMetricType() {
+  static const char * const names[] = {
+    "COUNTER",
+    "HISTOGRAM",
+    nullptr
+  };
+  return names;
+}
+
+inline const char *EnumNamePerfMetricType(PerfMetricType e) {
+  const size_t index = static_cast<int>(e);
+  return EnumNamesPerfMetricType()[index];
+}
+
+struct PerfMetric FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
+  enum {
+    VT_NAME = 4,
+    VT_TYPE = 6,
+    VT_COUNT = 8,
+    VT_SUM = 10,
+    VT_MAX = 12,
+    VT_BUCKETS = 14
+  };
+  const flatbuffers::String *name() const {
+    return GetPointer<const flatbuffers::String *>(VT_NAME);
+  }
+  PerfMetricType type() const {
+    return static_cast<PerfMetricType>(GetField<int16_t>(VT_TYPE, 0));
+  }
+  uint64_t count() const {
+    return GetField<uint64_t>(VT_COUNT, 0);
+  }
+  uint64_t sum() const {
+    return GetField<uint64_t>(VT_SUM, 0);
+  }
+  uint64_t max() const {
+    return GetField<uint64_t>(VT_MAX, 0);
+  }
+  const flatbuffers::Vector<uint64_t> *buckets() const {
+    return GetPointer<const flatbuffers::Vector<uint64_t> *>(VT_BUCKETS);
+  }
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           VerifyOffset(verifier, VT_NAME) &&
+           verifier.Verify(name()) &&
+           VerifyField<int16_t>(verifier, VT_TYPE) &&
+           VerifyField<uint64_t>(verifier, VT_COUNT) &&
+           VerifyField<uint64_t>(verifier, VT_SUM) &&
+           VerifyField<uint64_t>(verifier, VT_MAX) &&
+           VerifyOffset(verifier, VT_BUCKETS) &&
+           verifier.Verify(buckets()) &&
+           verifier.EndTable();
+  }
+};
+
+struct PerfMetricBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  void add_name(flatbuffers::Offset<flatbuffers::String> name) {
+    fbb_.AddOffset(PerfMetric::VT_NAME, name);
+  }
+  void add_type(PerfMetricType type) {
+    fbb_.AddElement<int16_t>(PerfMetric::VT_TYPE, static_cast<int16_t>(type), 0);
+  }
+  void add_count(uint64_t count) {
+    fbb_.AddElement<uint64_t>(PerfMetric::VT_COUNT, count, 0);
+  }
+  void add_sum(uint64_t sum) {
+    fbb_.AddElement<uint64_t>(PerfMetric::VT_SUM, sum, 0);
+  }
+  void add_max(uint64_t max) {
+    fbb_.AddElement<uint64_t>(PerfMetric::VT_MAX, max, 0);
+  }
+  void add_buckets(flatbuffers::Offset<flatbuffers::Vector<uint64_t>> buckets) {
+    fbb_.AddOffset(PerfMetric::VT_BUCKETS, buckets);
+  }
+  explicit PerfMetricBuilder(flatbuffers::FlatBufferBuilder &_fbb)
+        : fbb_(_fbb) {
+    start_ = fbb_.StartTable();
+  }
+  PerfMetricBuilder &operator=(const PerfMetricBuilder &);
+  flatbuffers::Offset<PerfMetric> Finish() {
+    const auto end = fbb_.EndTable(start_);
+    auto o = flatbuffers::Offset<PerfMetric>(end);
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<PerfMetric> CreatePerfMetric(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    flatbuffers::Offset<flatbuffers::String> name = 0,
+    PerfMetricType type = PerfMetricType_COUNTER,
+    uint64_t count = 0,
+    uint64_t sum = 0,
+    uint64_t max = 0,
+    flatbuffers::Offset<flatbuffers::Vector<uint64_t>> buckets = 0) {
+  PerfMetricBuilder builder_(_fbb);
+  builder_.add_max(max);
+  builder_.add_sum(sum);
+  builder_.add_count(count);
+  builder_.add_buckets(buckets);
+  builder_.add_name(name);
+  builder_.add_type(type);
+  return builder_.Finish();
+}
+
+inline flatbuffers::Offset<PerfMetric> CreatePerfMetricDirect(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    const char *name = nullptr,
+    PerfMetricType type = PerfMetricType_COUNTER,
+    uint64_t count = 0,
+    uint64_t sum = 0,
+    uint64_t max = 0,
+    const std::vector<uint64_t> *buckets = nullptr) {
+  return mbtool::daemon::v3::CreatePerfMetric(
+      _fbb,
+      name ? _fbb.CreateString(name) : 0,
+      type,
+      count,
+      sum,
+      max,
+      buckets ? _fbb.CreateVector<uint64_t>(*buckets) : 0);
+}
+
+struct MbGetPerfCountersRequest FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
+  enum {
+    VT_RESET = 4
+  };
+  bool reset() const {
+    return GetField<uint8_t>(VT_RESET, 0) != 0;
+  }
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           VerifyField<uint8_t>(verifier, VT_RESET) &&
+           verifier.EndTable();
+  }
+};
+
+struct MbGetPerfCountersRequestBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  void add_reset(bool reset) {
+    fbb_.AddElement<uint8_t>(MbGetPerfCountersRequest::VT_RESET, static_cast<uint8_t>(reset), 0);
+  }
+  explicit MbGetPerfCountersRequestBuilder(flatbuffers::FlatBufferBuilder &_fbb)
+        : fbb_(_fbb) {
+    start_ = fbb_.StartTable();
+  }
+  MbGetPerfCountersRequestBuilder &operator=(const MbGetPerfCountersRequestBuilder &);
+  flatbuffers::Offset<MbGetPerfCountersRequest> Finish() {
+    const auto end = fbb_.EndTable(start_);
+    auto o = flatbuffers::Offset<MbGetPerfCountersRequest>(end);
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<MbGetPerfCountersRequest> CreateMbGetPerfCountersRequest(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    bool reset = false) {
+  MbGetPerfCountersRequestBuilder builder_(_fbb);
+  builder_.add_reset(reset);
+  return builder_.Finish();
+}
+
+struct MbGetPerfCountersResponse FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
+  enum {
+    VT_METRICS = 4
+  };
+  const flatbuffers::Vector<flatbuffers::Offset<PerfMetric>> *metrics() const {
+    return GetPointer<const flatbuffers::Vector<flatbuffers::Offset<PerfMetric>> *>(VT_METRICS);
+  }
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           VerifyOffset(verifier, VT_METRICS) &&
+           verifier.Verify(metrics()) &&
+           verifier.VerifyVectorOfTables(metrics()) &&
+           verifier.EndTable();
+  }
+};
+
+struct MbGetPerfCountersResponseBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  void add_metrics(flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<PerfMetric>>> metrics) {
+    fbb_.AddOffset(MbGetPerfCountersResponse::VT_METRICS, metrics);
+  }
+  explicit MbGetPerfCountersResponseBuilder(flatbuffers::FlatBufferBuilder &_fbb)
+        : fbb_(_fbb) {
+    start_ = fbb_.StartTable();
+  }
+  MbGetPerfCountersResponseBuilder &operator=(const MbGetPerfCountersResponseBuilder &);
+  flatbuffers::Offset<MbGetPerfCountersResponse> Finish() {
+    const auto end = fbb_.EndTable(start_);
+    auto o = flatbuffers::Offset<MbGetPerfCountersResponse>(end);
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<MbGetPerfCountersResponse> CreateMbGetPerfCountersResponse(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<PerfMetric>>> metrics = 0) {
+  MbGetPerfCountersResponseBuilder builder_(_fbb);
+  builder_.add_metrics(metrics);
+  return builder_.Finish();
+}
+
+inline flatbuffers::Offset<MbGetPerfCountersResponse> CreateMbGetPerfCountersResponseDirect(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    const std::vector<flatbuffers::Offset<PerfMetric>> *metrics = nullptr) {
+  return mbtool::daemon::v3::CreateMbGetPerfCountersResponse(
+      _fbb,
+      metrics ? _fbb.CreateVector<flatbuffers::Offset<PerfMetric>>(*metrics) : 0);
+}
+
+}  // namespace v3
+}  // namespace daemon
+}  // namespace mbtool
+
+#endif  // FLATBUFFERS_GENERATED_MBGETPERFCOUNTERS_MBTOOL_DAEMON_V3_H_
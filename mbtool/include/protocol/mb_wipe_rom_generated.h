@@ -12,6 +12,8 @@ namespace v3 {
 
 struct MbWipeRomRequest;
 
+struct MbWipeRomProgressResponse;
+
 struct MbWipeRomResponse;
 
 enum MbWipeTarget {
@@ -55,7 +57,8 @@ inline const char *EnumNameMbWipeTarget(MbWipeTarget e) {
 struct MbWipeRomRequest FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
   enum {
     VT_ROM_ID = 4,
-    VT_TARGETS = 6
+    VT_TARGETS = 6,
+    VT_REPORT_PROGRESS = 8
   };
   const flatbuffers::String *rom_id() const {
     return GetPointer<const flatbuffers::String *>(VT_ROM_ID);
@@ -63,12 +66,16 @@ struct MbWipeRomRequest FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
   const flatbuffers::Vector<int16_t> *targets() const {
     return GetPointer<const flatbuffers::Vector<int16_t> *>(VT_TARGETS);
   }
+  bool report_progress() const {
+    return GetField<uint8_t>(VT_REPORT_PROGRESS, 0) != 0;
+  }
   bool Verify(flatbuffers::Verifier &verifier) const {
     return VerifyTableStart(verifier) &&
            VerifyOffset(verifier, VT_ROM_ID) &&
            verifier.Verify(rom_id()) &&
            VerifyOffset(verifier, VT_TARGETS) &&
            verifier.Verify(targets()) &&
+           VerifyField<uint8_t>(verifier, VT_REPORT_PROGRESS) &&
            verifier.EndTable();
   }
 };
@@ -82,6 +89,9 @@ struct MbWipeRomRequestBuilder {
   void add_targets(flatbuffers::Offset<flatbuffers::Vector<int16_t>> targets) {
     fbb_.AddOffset(MbWipeRomRequest::VT_TARGETS, targets);
   }
+  void add_report_progress(bool report_progress) {
+    fbb_.AddElement<uint8_t>(MbWipeRomRequest::VT_REPORT_PROGRESS, static_cast<uint8_t>(report_progress), 0);
+  }
   explicit MbWipeRomRequestBuilder(flatbuffers::FlatBufferBuilder &_fbb)
         : fbb_(_fbb) {
     start_ = fbb_.StartTable();
@@ -97,21 +107,85 @@ struct MbWipeRomRequestBuilder {
 inline flatbuffers::Offset<MbWipeRomRequest> CreateMbWipeRomRequest(
     flatbuffers::FlatBufferBuilder &_fbb,
     flatbuffers::Offset<flatbuffers::String> rom_id = 0,
-    flatbuffers::Offset<flatbuffers::Vector<int16_t>> targets = 0) {
+    flatbuffers::Offset<flatbuffers::Vector<int16_t>> targets = 0,
+    bool report_progress = false) {
   MbWipeRomRequestBuilder builder_(_fbb);
   builder_.add_targets(targets);
   builder_.add_rom_id(rom_id);
+  builder_.add_report_progress(report_progress);
   return builder_.Finish();
 }
 
 inline flatbuffers::Offset<MbWipeRomRequest> CreateMbWipeRomRequestDirect(
     flatbuffers::FlatBufferBuilder &_fbb,
     const char *rom_id = nullptr,
-    const std::vector<int16_t> *targets = nullptr) {
+    const std::vector<int16_t> *targets = nullptr,
+    bool report_progress = false) {
   return mbtool::daemon::v3::CreateMbWipeRomRequest(
       _fbb,
       rom_id ? _fbb.CreateString(rom_id) : 0,
-      targets ? _fbb.CreateVector<int16_t>(*targets) : 0);
+      targets ? _fbb.CreateVector<int16_t>(*targets) : 0,
+      report_progress);
+}
+
+struct MbWipeRomProgressResponse FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
+  enum {
+    VT_ENTRIES_DELETED = 4,
+    VT_TARGETS_DONE = 6,
+    VT_TARGETS_TOTAL = 8
+  };
+  uint64_t entries_deleted() const {
+    return GetField<uint64_t>(VT_ENTRIES_DELETED, 0);
+  }
+  uint32_t targets_done() const {
+    return GetField<uint32_t>(VT_TARGETS_DONE, 0);
+  }
+  uint32_t targets_total() const {
+    return GetField<uint32_t>(VT_TARGETS_TOTAL, 0);
+  }
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           VerifyField<uint64_t>(verifier, VT_ENTRIES_DELETED) &&
+           VerifyField<uint32_t>(verifier, VT_TARGETS_DONE) &&
+           VerifyField<uint32_t>(verifier, VT_TARGETS_TOTAL) &&
+           verifier.EndTable();
+  }
+};
+
+struct MbWipeRomProgressResponseBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  void add_entries_deleted(uint64_t entries_deleted) {
+    fbb_.AddElement<uint64_t>(MbWipeRomProgressResponse::VT_ENTRIES_DELETED, entries_deleted, 0);
+  }
+  void add_targets_done(uint32_t targets_done) {
+    fbb_.AddElement<uint32_t>(MbWipeRomProgressResponse::VT_TARGETS_DONE, targets_done, 0);
+  }
+  void add_targets_total(uint32_t targets_total) {
+    fbb_.AddElement<uint32_t>(MbWipeRomProgressResponse::VT_TARGETS_TOTAL, targets_total, 0);
+  }
+  explicit MbWipeRomProgressResponseBuilder(flatbuffers::FlatBufferBuilder &_fbb)
+        : fbb_(_fbb) {
+    start_ = fbb_.StartTable();
+  }
+  MbWipeRomProgressResponseBuilder &operator=(const MbWipeRomProgressResponseBuilder &);
+  flatbuffers::Offset<MbWipeRomProgressResponse> Finish() {
+    const auto end = fbb_.EndTable(start_);
+    auto o = flatbuffers::Offset<MbWipeRomProgressResponse>(end);
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<MbWipeRomProgressResponse> CreateMbWipeRomProgressResponse(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    uint64_t entries_deleted = 0,
+    uint32_t targets_done = 0,
+    uint32_t targets_total = 0) {
+  MbWipeRomProgressResponseBuilder builder_(_fbb);
+  builder_.add_entries_deleted(entries_deleted);
+  builder_.add_targets_total(targets_total);
+  builder_.add_targets_done(targets_done);
+  return builder_.Finish();
 }
 
 struct MbWipeRomResponse FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
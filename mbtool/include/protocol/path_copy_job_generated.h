@@ -0,0 +1,437 @@
+// automatically generated by the FlatBuffers compiler, do not modify
+
+
+#ifndef FLATBUFFERS_GENERATED_PATHCOPYJOB_MBTOOL_DAEMON_V3_H_
+#define FLATBUFFERS_GENERATED_PATHCOPYJOB_MBTOOL_DAEMON_V3_H_
+
+#include "flatbuffers/flatbuffers.h"
+
+namespace mbtool {
+namespace daemon {
+namespace v3 {
+
+struct PathCopyJobError;
+
+struct PathCopyJobStartRequest;
+
+struct PathCopyJobStartResponse;
+
+struct PathCopyJobProgressResponse;
+
+struct PathCopyJobFinishedResponse;
+
+struct PathCopyJobCancelRequest;
+
+struct PathCopyJobCancelResponse;
+
+struct PathCopyJobError FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
+  enum {
+    VT_ERRNO_VALUE = 4,
+    VT_MSG = 6
+  };
+  int32_t errno_value() const {
+    return GetField<int32_t>(VT_ERRNO_VALUE, 0);
+  }
+  const flatbuffers::String *msg() const {
+    return GetPointer<const flatbuffers::String *>(VT_MSG);
+  }
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           VerifyField<int32_t>(verifier, VT_ERRNO_VALUE) &&
+           VerifyOffset(verifier, VT_MSG) &&
+           verifier.Verify(msg()) &&
+           verifier.EndTable();
+  }
+};
+
+struct PathCopyJobErrorBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  void add_errno_value(int32_t errno_value) {
+    fbb_.AddElement<int32_t>(PathCopyJobError::VT_ERRNO_VALUE, errno_value, 0);
+  }
+  void add_msg(flatbuffers::Offset<flatbuffers::String> msg) {
+    fbb_.AddOffset(PathCopyJobError::VT_MSG, msg);
+  }
+  explicit PathCopyJobErrorBuilder(flatbuffers::FlatBufferBuilder &_fbb)
+        : fbb_(_fbb) {
+    start_ = fbb_.StartTable();
+  }
+  PathCopyJobErrorBuilder &operator=(const PathCopyJobErrorBuilder &);
+  flatbuffers::Offset<PathCopyJobError> Finish() {
+    const auto end = fbb_.EndTable(start_);
+    auto o = flatbuffers::Offset<PathCopyJobError>(end);
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<PathCopyJobError> CreatePathCopyJobError(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    int32_t errno_value = 0,
+    flatbuffers::Offset<flatbuffers::String> msg = 0) {
+  PathCopyJobErrorBuilder builder_(_fbb);
+  builder_.add_msg(msg);
+  builder_.add_errno_value(errno_value);
+  return builder_.Finish();
+}
+
+inline flatbuffers::Offset<PathCopyJobError> CreatePathCopyJobErrorDirect(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    int32_t errno_value = 0,
+    const char *msg = nullptr) {
+  return mbtool::daemon::v3::CreatePathCopyJobError(
+      _fbb,
+      errno_value,
+      msg ? _fbb.CreateString(msg) : 0);
+}
+
+struct PathCopyJobStartRequest FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
+  enum {
+    VT_SOURCE = 4,
+    VT_TARGET = 6,
+    VT_RECURSIVE = 8
+  };
+  const flatbuffers::String *source() const {
+    return GetPointer<const flatbuffers::String *>(VT_SOURCE);
+  }
+  const flatbuffers::String *target() const {
+    return GetPointer<const flatbuffers::String *>(VT_TARGET);
+  }
+  bool recursive() const {
+    return GetField<uint8_t>(VT_RECURSIVE, 0) != 0;
+  }
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           VerifyOffset(verifier, VT_SOURCE) &&
+           verifier.Verify(source()) &&
+           VerifyOffset(verifier, VT_TARGET) &&
+           verifier.Verify(target()) &&
+           VerifyField<uint8_t>(verifier, VT_RECURSIVE) &&
+           verifier.EndTable();
+  }
+};
+
+struct PathCopyJobStartRequestBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  void add_source(flatbuffers::Offset<flatbuffers::String> source) {
+    fbb_.AddOffset(PathCopyJobStartRequest::VT_SOURCE, source);
+  }
+  void add_target(flatbuffers::Offset<flatbuffers::String> target) {
+    fbb_.AddOffset(PathCopyJobStartRequest::VT_TARGET, target);
+  }
+  void add_recursive(bool recursive) {
+    fbb_.AddElement<uint8_t>(PathCopyJobStartRequest::VT_RECURSIVE, static_cast<uint8_t>(recursive), 0);
+  }
+  explicit PathCopyJobStartRequestBuilder(flatbuffers::FlatBufferBuilder &_fbb)
+        : fbb_(_fbb) {
+    start_ = fbb_.StartTable();
+  }
+  PathCopyJobStartRequestBuilder &operator=(const PathCopyJobStartRequestBuilder &);
+  flatbuffers::Offset<PathCopyJobStartRequest> Finish() {
+    const auto end = fbb_.EndTable(start_);
+    auto o = flatbuffers::Offset<PathCopyJobStartRequest>(end);
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<PathCopyJobStartRequest> CreatePathCopyJobStartRequest(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    flatbuffers::Offset<flatbuffers::String> source = 0,
+    flatbuffers::Offset<flatbuffers::String> target = 0,
+    bool recursive = false) {
+  PathCopyJobStartRequestBuilder builder_(_fbb);
+  builder_.add_target(target);
+  builder_.add_source(source);
+  builder_.add_recursive(recursive);
+  return builder_.Finish();
+}
+
+inline flatbuffers::Offset<PathCopyJobStartRequest> CreatePathCopyJobStartRequestDirect(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    const char *source = nullptr,
+    const char *target = nullptr,
+    bool recursive = false) {
+  return mbtool::daemon::v3::CreatePathCopyJobStartRequest(
+      _fbb,
+      source ? _fbb.CreateString(source) : 0,
+      target ? _fbb.CreateString(target) : 0,
+      recursive);
+}
+
+struct PathCopyJobStartResponse FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
+  enum {
+    VT_JOB_ID = 4
+  };
+  uint64_t job_id() const {
+    return GetField<uint64_t>(VT_JOB_ID, 0);
+  }
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           VerifyField<uint64_t>(verifier, VT_JOB_ID) &&
+           verifier.EndTable();
+  }
+};
+
+struct PathCopyJobStartResponseBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  void add_job_id(uint64_t job_id) {
+    fbb_.AddElement<uint64_t>(PathCopyJobStartResponse::VT_JOB_ID, job_id, 0);
+  }
+  explicit PathCopyJobStartResponseBuilder(flatbuffers::FlatBufferBuilder &_fbb)
+        : fbb_(_fbb) {
+    start_ = fbb_.StartTable();
+  }
+  PathCopyJobStartResponseBuilder &operator=(const PathCopyJobStartResponseBuilder &);
+  flatbuffers::Offset<PathCopyJobStartResponse> Finish() {
+    const auto end = fbb_.EndTable(start_);
+    auto o = flatbuffers::Offset<PathCopyJobStartResponse>(end);
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<PathCopyJobStartResponse> CreatePathCopyJobStartResponse(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    uint64_t job_id = 0) {
+  PathCopyJobStartResponseBuilder builder_(_fbb);
+  builder_.add_job_id(job_id);
+  return builder_.Finish();
+}
+
+struct PathCopyJobProgressResponse FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
+  enum {
+    VT_JOB_ID = 4,
+    VT_BYTES_DONE = 6,
+    VT_BYTES_TOTAL = 8,
+    VT_FILES_DONE = 10
+  };
+  uint64_t job_id() const {
+    return GetField<uint64_t>(VT_JOB_ID, 0);
+  }
+  uint64_t bytes_done() const {
+    return GetField<uint64_t>(VT_BYTES_DONE, 0);
+  }
+  uint64_t bytes_total() const {
+    return GetField<uint64_t>(VT_BYTES_TOTAL, 0);
+  }
+  uint64_t files_done() const {
+    return GetField<uint64_t>(VT_FILES_DONE, 0);
+  }
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           VerifyField<uint64_t>(verifier, VT_JOB_ID) &&
+           VerifyField<uint64_t>(verifier, VT_BYTES_DONE) &&
+           VerifyField<uint64_t>(verifier, VT_BYTES_TOTAL) &&
+           VerifyField<uint64_t>(verifier, VT_FILES_DONE) &&
+           verifier.EndTable();
+  }
+};
+
+struct PathCopyJobProgressResponseBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  void add_job_id(uint64_t job_id) {
+    fbb_.AddElement<uint64_t>(PathCopyJobProgressResponse::VT_JOB_ID, job_id, 0);
+  }
+  void add_bytes_done(uint64_t bytes_done) {
+    fbb_.AddElement<uint64_t>(PathCopyJobProgressResponse::VT_BYTES_DONE, bytes_done, 0);
+  }
+  void add_bytes_total(uint64_t bytes_total) {
+    fbb_.AddElement<uint64_t>(PathCopyJobProgressResponse::VT_BYTES_TOTAL, bytes_total, 0);
+  }
+  void add_files_done(uint64_t files_done) {
+    fbb_.AddElement<uint64_t>(PathCopyJobProgressResponse::VT_FILES_DONE, files_done, 0);
+  }
+  explicit PathCopyJobProgressResponseBuilder(flatbuffers::FlatBufferBuilder &_fbb)
+        : fbb_(_fbb) {
+    start_ = fbb_.StartTable();
+  }
+  PathCopyJobProgressResponseBuilder &operator=(const PathCopyJobProgressResponseBuilder &);
+  flatbuffers::Offset<PathCopyJobProgressResponse> Finish() {
+    const auto end = fbb_.EndTable(start_);
+    auto o = flatbuffers::Offset<PathCopyJobProgressResponse>(end);
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<PathCopyJobProgressResponse> CreatePathCopyJobProgressResponse(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    uint64_t job_id = 0,
+    uint64_t bytes_done = 0,
+    uint64_t bytes_total = 0,
+    uint64_t files_done = 0) {
+  PathCopyJobProgressResponseBuilder builder_(_fbb);
+  builder_.add_files_done(files_done);
+  builder_.add_bytes_total(bytes_total);
+  builder_.add_bytes_done(bytes_done);
+  builder_.add_job_id(job_id);
+  return builder_.Finish();
+}
+
+struct PathCopyJobFinishedResponse FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
+  enum {
+    VT_JOB_ID = 4,
+    VT_CANCELLED = 6,
+    VT_BYTES_DONE = 8,
+    VT_FILES_DONE = 10,
+    VT_ERROR = 12
+  };
+  uint64_t job_id() const {
+    return GetField<uint64_t>(VT_JOB_ID, 0);
+  }
+  bool cancelled() const {
+    return GetField<uint8_t>(VT_CANCELLED, 0) != 0;
+  }
+  uint64_t bytes_done() const {
+    return GetField<uint64_t>(VT_BYTES_DONE, 0);
+  }
+  uint64_t files_done() const {
+    return GetField<uint64_t>(VT_FILES_DONE, 0);
+  }
+  const PathCopyJobError *error() const {
+    return GetPointer<const PathCopyJobError *>(VT_ERROR);
+  }
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           VerifyField<uint64_t>(verifier, VT_JOB_ID) &&
+           VerifyField<uint8_t>(verifier, VT_CANCELLED) &&
+           VerifyField<uint64_t>(verifier, VT_BYTES_DONE) &&
+           VerifyField<uint64_t>(verifier, VT_FILES_DONE) &&
+           VerifyOffset(verifier, VT_ERROR) &&
+           verifier.VerifyTable(error()) &&
+           verifier.EndTable();
+  }
+};
+
+struct PathCopyJobFinishedResponseBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  void add_job_id(uint64_t job_id) {
+    fbb_.AddElement<uint64_t>(PathCopyJobFinishedResponse::VT_JOB_ID, job_id, 0);
+  }
+  void add_cancelled(bool cancelled) {
+    fbb_.AddElement<uint8_t>(PathCopyJobFinishedResponse::VT_CANCELLED, static_cast<uint8_t>(cancelled), 0);
+  }
+  void add_bytes_done(uint64_t bytes_done) {
+    fbb_.AddElement<uint64_t>(PathCopyJobFinishedResponse::VT_BYTES_DONE, bytes_done, 0);
+  }
+  void add_files_done(uint64_t files_done) {
+    fbb_.AddElement<uint64_t>(PathCopyJobFinishedResponse::VT_FILES_DONE, files_done, 0);
+  }
+  void add_error(flatbuffers::Offset<PathCopyJobError> error) {
+    fbb_.AddOffset(PathCopyJobFinishedResponse::VT_ERROR, error);
+  }
+  explicit PathCopyJobFinishedResponseBuilder(flatbuffers::FlatBufferBuilder &_fbb)
+        : fbb_(_fbb) {
+    start_ = fbb_.StartTable();
+  }
+  PathCopyJobFinishedResponseBuilder &operator=(const PathCopyJobFinishedResponseBuilder &);
+  flatbuffers::Offset<PathCopyJobFinishedResponse> Finish() {
+    const auto end = fbb_.EndTable(start_);
+    auto o = flatbuffers::Offset<PathCopyJobFinishedResponse>(end);
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<PathCopyJobFinishedResponse> CreatePathCopyJobFinishedResponse(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    uint64_t job_id = 0,
+    bool cancelled = false,
+    uint64_t bytes_done = 0,
+    uint64_t files_done = 0,
+    flatbuffers::Offset<PathCopyJobError> error = 0) {
+  PathCopyJobFinishedResponseBuilder builder_(_fbb);
+  builder_.add_files_done(files_done);
+  builder_.add_bytes_done(bytes_done);
+  builder_.add_job_id(job_id);
+  builder_.add_error(error);
+  builder_.add_cancelled(cancelled);
+  return builder_.Finish();
+}
+
+struct PathCopyJobCancelRequest FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
+  enum {
+    VT_JOB_ID = 4
+  };
+  uint64_t job_id() const {
+    return GetField<uint64_t>(VT_JOB_ID, 0);
+  }
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           VerifyField<uint64_t>(verifier, VT_JOB_ID) &&
+           verifier.EndTable();
+  }
+};
+
+struct PathCopyJobCancelRequestBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  void add_job_id(uint64_t job_id) {
+    fbb_.AddElement<uint64_t>(PathCopyJobCancelRequest::VT_JOB_ID, job_id, 0);
+  }
+  explicit PathCopyJobCancelRequestBuilder(flatbuffers::FlatBufferBuilder &_fbb)
+        : fbb_(_fbb) {
+    start_ = fbb_.StartTable();
+  }
+  PathCopyJobCancelRequestBuilder &operator=(const PathCopyJobCancelRequestBuilder &);
+  flatbuffers::Offset<PathCopyJobCancelRequest> Finish() {
+    const auto end = fbb_.EndTable(start_);
+    auto o = flatbuffers::Offset<PathCopyJobCancelRequest>(end);
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<PathCopyJobCancelRequest> CreatePathCopyJobCancelRequest(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    uint64_t job_id = 0) {
+  PathCopyJobCancelRequestBuilder builder_(_fbb);
+  builder_.add_job_id(job_id);
+  return builder_.Finish();
+}
+
+struct PathCopyJobCancelResponse FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
+  enum {
+    VT_SUCCESS = 4
+  };
+  bool success() const {
+    return GetField<uint8_t>(VT_SUCCESS, 0) != 0;
+  }
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           VerifyField<uint8_t>(verifier, VT_SUCCESS) &&
+           verifier.EndTable();
+  }
+};
+
+struct PathCopyJobCancelResponseBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  void add_success(bool success) {
+    fbb_.AddElement<uint8_t>(PathCopyJobCancelResponse::VT_SUCCESS, static_cast<uint8_t>(success), 0);
+  }
+  explicit PathCopyJobCancelResponseBuilder(flatbuffers::FlatBufferBuilder &_fbb)
+        : fbb_(_fbb) {
+    start_ = fbb_.StartTable();
+  }
+  PathCopyJobCancelResponseBuilder &operator=(const PathCopyJobCancelResponseBuilder &);
+  flatbuffers::Offset<PathCopyJobCancelResponse> Finish() {
+    const auto end = fbb_.EndTable(start_);
+    auto o = flatbuffers::Offset<PathCopyJobCancelResponse>(end);
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<PathCopyJobCancelResponse> CreatePathCopyJobCancelResponse(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    bool success = false) {
+  PathCopyJobCancelResponseBuilder builder_(_fbb);
+  builder_.add_success(success);
+  return builder_.Finish();
+}
+
+}  // namespace v3
+}  // namespace daemon
+}  // namespace mbtool
+
+#endif  // FLATBUFFERS_GENERATED_PATHCOPYJOB_MBTOOL_DAEMON_V3_H_
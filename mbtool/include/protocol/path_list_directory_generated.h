@@ -0,0 +1,323 @@
+// automatically generated by the FlatBuffers compiler, do not modify
+
+
+#ifndef FLATBUFFERS_GENERATED_PATHLISTDIRECTORY_MBTOOL_DAEMON_V3_H_
+#define FLATBUFFERS_GENERATED_PATHLISTDIRECTORY_MBTOOL_DAEMON_V3_H_
+
+#include "flatbuffers/flatbuffers.h"
+
+#include "file_stat_generated.h"
+
+namespace mbtool {
+namespace daemon {
+namespace v3 {
+
+struct PathListDirectoryError;
+
+struct PathDirectoryEntry;
+
+struct PathListDirectoryRequest;
+
+struct PathListDirectoryResponse;
+
+struct PathListDirectoryError FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
+  enum {
+    VT_ERRNO_VALUE = 4,
+    VT_MSG = 6
+  };
+  int32_t errno_value() const {
+    return GetField<int32_t>(VT_ERRNO_VALUE, 0);
+  }
+  const flatbuffers::String *msg() const {
+    return GetPointer<const flatbuffers::String *>(VT_MSG);
+  }
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           VerifyField<int32_t>(verifier, VT_ERRNO_VALUE) &&
+           VerifyOffset(verifier, VT_MSG) &&
+           verifier.Verify(msg()) &&
+           verifier.EndTable();
+  }
+};
+
+struct PathListDirectoryErrorBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  void add_errno_value(int32_t errno_value) {
+    fbb_.AddElement<int32_t>(PathListDirectoryError::VT_ERRNO_VALUE, errno_value, 0);
+  }
+  void add_msg(flatbuffers::Offset<flatbuffers::String> msg) {
+    fbb_.AddOffset(PathListDirectoryError::VT_MSG, msg);
+  }
+  explicit PathListDirectoryErrorBuilder(flatbuffers::FlatBufferBuilder &_fbb)
+        : fbb_(_fbb) {
+    start_ = fbb_.StartTable();
+  }
+  PathListDirectoryErrorBuilder &operator=(const PathListDirectoryErrorBuilder &);
+  flatbuffers::Offset<PathListDirectoryError> Finish() {
+    const auto end = fbb_.EndTable(start_);
+    auto o = flatbuffers::Offset<PathListDirectoryError>(end);
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<PathListDirectoryError> CreatePathListDirectoryError(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    int32_t errno_value = 0,
+    flatbuffers::Offset<flatbuffers::String> msg = 0) {
+  PathListDirectoryErrorBuilder builder_(_fbb);
+  builder_.add_msg(msg);
+  builder_.add_errno_value(errno_value);
+  return builder_.Finish();
+}
+
+inline flatbuffers::Offset<PathListDirectoryError> CreatePathListDirectoryErrorDirect(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    int32_t errno_value = 0,
+    const char *msg = nullptr) {
+  return mbtool::daemon::v3::CreatePathListDirectoryError(
+      _fbb,
+      errno_value,
+      msg ? _fbb.CreateString(msg) : 0);
+}
+
+struct PathDirectoryEntry FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
+  enum {
+    VT_NAME = 4,
+    VT_TYPE = 6,
+    VT_STAT = 8,
+    VT_LABEL = 10
+  };
+  const flatbuffers::String *name() const {
+    return GetPointer<const flatbuffers::String *>(VT_NAME);
+  }
+  uint8_t type() const {
+    return GetField<uint8_t>(VT_TYPE, 0);
+  }
+  const StructStat *stat() const {
+    return GetPointer<const StructStat *>(VT_STAT);
+  }
+  const flatbuffers::String *label() const {
+    return GetPointer<const flatbuffers::String *>(VT_LABEL);
+  }
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           VerifyOffset(verifier, VT_NAME) &&
+           verifier.Verify(name()) &&
+           VerifyField<uint8_t>(verifier, VT_TYPE) &&
+           VerifyOffset(verifier, VT_STAT) &&
+           verifier.VerifyTable(stat()) &&
+           VerifyOffset(verifier, VT_LABEL) &&
+           verifier.Verify(label()) &&
+           verifier.EndTable();
+  }
+};
+
+struct PathDirectoryEntryBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  void add_name(flatbuffers::Offset<flatbuffers::String> name) {
+    fbb_.AddOffset(PathDirectoryEntry::VT_NAME, name);
+  }
+  void add_type(uint8_t type) {
+    fbb_.AddElement<uint8_t>(PathDirectoryEntry::VT_TYPE, type, 0);
+  }
+  void add_stat(flatbuffers::Offset<StructStat> stat) {
+    fbb_.AddOffset(PathDirectoryEntry::VT_STAT, stat);
+  }
+  void add_label(flatbuffers::Offset<flatbuffers::String> label) {
+    fbb_.AddOffset(PathDirectoryEntry::VT_LABEL, label);
+  }
+  explicit PathDirectoryEntryBuilder(flatbuffers::FlatBufferBuilder &_fbb)
+        : fbb_(_fbb) {
+    start_ = fbb_.StartTable();
+  }
+  PathDirectoryEntryBuilder &operator=(const PathDirectoryEntryBuilder &);
+  flatbuffers::Offset<PathDirectoryEntry> Finish() {
+    const auto end = fbb_.EndTable(start_);
+    auto o = flatbuffers::Offset<PathDirectoryEntry>(end);
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<PathDirectoryEntry> CreatePathDirectoryEntry(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    flatbuffers::Offset<flatbuffers::String> name = 0,
+    uint8_t type = 0,
+    flatbuffers::Offset<StructStat> stat = 0,
+    flatbuffers::Offset<flatbuffers::String> label = 0) {
+  PathDirectoryEntryBuilder builder_(_fbb);
+  builder_.add_label(label);
+  builder_.add_stat(stat);
+  builder_.add_name(name);
+  builder_.add_type(type);
+  return builder_.Finish();
+}
+
+inline flatbuffers::Offset<PathDirectoryEntry> CreatePathDirectoryEntryDirect(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    const char *name = nullptr,
+    uint8_t type = 0,
+    flatbuffers::Offset<StructStat> stat = 0,
+    const char *label = nullptr) {
+  return mbtool::daemon::v3::CreatePathDirectoryEntry(
+      _fbb,
+      name ? _fbb.CreateString(name) : 0,
+      type,
+      stat,
+      label ? _fbb.CreateString(label) : 0);
+}
+
+struct PathListDirectoryRequest FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
+  enum {
+    VT_PATH = 4,
+    VT_WITH_STAT = 6,
+    VT_WITH_LABELS = 8,
+    VT_FOLLOW_SYMLINKS = 10
+  };
+  const flatbuffers::String *path() const {
+    return GetPointer<const flatbuffers::String *>(VT_PATH);
+  }
+  bool with_stat() const {
+    return GetField<uint8_t>(VT_WITH_STAT, 0) != 0;
+  }
+  bool with_labels() const {
+    return GetField<uint8_t>(VT_WITH_LABELS, 0) != 0;
+  }
+  bool follow_symlinks() const {
+    return GetField<uint8_t>(VT_FOLLOW_SYMLINKS, 0) != 0;
+  }
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           VerifyOffset(verifier, VT_PATH) &&
+           verifier.Verify(path()) &&
+           VerifyField<uint8_t>(verifier, VT_WITH_STAT) &&
+           VerifyField<uint8_t>(verifier, VT_WITH_LABELS) &&
+           VerifyField<uint8_t>(verifier, VT_FOLLOW_SYMLINKS) &&
+           verifier.EndTable();
+  }
+};
+
+struct PathListDirectoryRequestBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  void add_path(flatbuffers::Offset<flatbuffers::String> path) {
+    fbb_.AddOffset(PathListDirectoryRequest::VT_PATH, path);
+  }
+  void add_with_stat(bool with_stat) {
+    fbb_.AddElement<uint8_t>(PathListDirectoryRequest::VT_WITH_STAT, static_cast<uint8_t>(with_stat), 0);
+  }
+  void add_with_labels(bool with_labels) {
+    fbb_.AddElement<uint8_t>(PathListDirectoryRequest::VT_WITH_LABELS, static_cast<uint8_t>(with_labels), 0);
+  }
+  void add_follow_symlinks(bool follow_symlinks) {
+    fbb_.AddElement<uint8_t>(PathListDirectoryRequest::VT_FOLLOW_SYMLINKS, static_cast<uint8_t>(follow_symlinks), 0);
+  }
+  explicit PathListDirectoryRequestBuilder(flatbuffers::FlatBufferBuilder &_fbb)
+        : fbb_(_fbb) {
+    start_ = fbb_.StartTable();
+  }
+  PathListDirectoryRequestBuilder &operator=(const PathListDirectoryRequestBuilder &);
+  flatbuffers::Offset<PathListDirectoryRequest> Finish() {
+    const auto end = fbb_.EndTable(start_);
+    auto o = flatbuffers::Offset<PathListDirectoryRequest>(end);
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<PathListDirectoryRequest> CreatePathListDirectoryRequest(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    flatbuffers::Offset<flatbuffers::String> path = 0,
+    bool with_stat = false,
+    bool with_labels = false,
+    bool follow_symlinks = false) {
+  PathListDirectoryRequestBuilder builder_(_fbb);
+  builder_.add_path(path);
+  builder_.add_follow_symlinks(follow_symlinks);
+  builder_.add_with_labels(with_labels);
+  builder_.add_with_stat(with_stat);
+  return builder_.Finish();
+}
+
+inline flatbuffers::Offset<PathListDirectoryRequest> CreatePathListDirectoryRequestDirect(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    const char *path = nullptr,
+    bool with_stat = false,
+    bool with_labels = false,
+    bool follow_symlinks = false) {
+  return mbtool::daemon::v3::CreatePathListDirectoryRequest(
+      _fbb,
+      path ? _fbb.CreateString(path) : 0,
+      with_stat,
+      with_labels,
+      follow_symlinks);
+}
+
+struct PathListDirectoryResponse FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
+  enum {
+    VT_ENTRIES = 4,
+    VT_ERROR = 6
+  };
+  const flatbuffers::Vector<flatbuffers::Offset<PathDirectoryEntry>> *entries() const {
+    return GetPointer<const flatbuffers::Vector<flatbuffers::Offset<PathDirectoryEntry>> *>(VT_ENTRIES);
+  }
+  const PathListDirectoryError *error() const {
+    return GetPointer<const PathListDirectoryError *>(VT_ERROR);
+  }
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           VerifyOffset(verifier, VT_ENTRIES) &&
+           verifier.Verify(entries()) &&
+           verifier.VerifyVectorOfTables(entries()) &&
+           VerifyOffset(verifier, VT_ERROR) &&
+           verifier.VerifyTable(error()) &&
+           verifier.EndTable();
+  }
+};
+
+struct PathListDirectoryResponseBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  void add_entries(flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<PathDirectoryEntry>>> entries) {
+    fbb_.AddOffset(PathListDirectoryResponse::VT_ENTRIES, entries);
+  }
+  void add_error(flatbuffers::Offset<PathListDirectoryError> error) {
+    fbb_.AddOffset(PathListDirectoryResponse::VT_ERROR, error);
+  }
+  explicit PathListDirectoryResponseBuilder(flatbuffers::FlatBufferBuilder &_fbb)
+        : fbb_(_fbb) {
+    start_ = fbb_.StartTable();
+  }
+  PathListDirectoryResponseBuilder &operator=(const PathListDirectoryResponseBuilder &);
+  flatbuffers::Offset<PathListDirectoryResponse> Finish() {
+    const auto end = fbb_.EndTable(start_);
+    auto o = flatbuffers::Offset<PathListDirectoryResponse>(end);
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<PathListDirectoryResponse> CreatePathListDirectoryResponse(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<PathDirectoryEntry>>> entries = 0,
+    flatbuffers::Offset<PathListDirectoryError> error = 0) {
+  PathListDirectoryResponseBuilder builder_(_fbb);
+  builder_.add_error(error);
+  builder_.add_entries(entries);
+  return builder_.Finish();
+}
+
+inline flatbuffers::Offset<PathListDirectoryResponse> CreatePathListDirectoryResponseDirect(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    const std::vector<flatbuffers::Offset<PathDirectoryEntry>> *entries = nullptr,
+    flatbuffers::Offset<PathListDirectoryError> error = 0) {
+  return mbtool::daemon::v3::CreatePathListDirectoryResponse(
+      _fbb,
+      entries ? _fbb.CreateVector<flatbuffers::Offset<PathDirectoryEntry>>(*entries) : 0,
+      error);
+}
+
+}  // namespace v3
+}  // namespace daemon
+}  // namespace mbtool
+
+#endif  // FLATBUFFERS_GENERATED_PATHLISTDIRECTORY_MBTOOL_DAEMON_V3_H_
@@ -10,6 +10,7 @@
 #include "crypto_get_pw_type_generated.h"
 #include "file_chmod_generated.h"
 #include "file_close_generated.h"
+#include "file_get_fd_generated.h"
 #include "file_open_generated.h"
 #include "file_read_generated.h"
 #include "file_seek_generated.h"
@@ -20,14 +21,17 @@
 #include "mb_get_booted_rom_id_generated.h"
 #include "mb_get_installed_roms_generated.h"
 #include "mb_get_packages_count_generated.h"
+#include "mb_get_perf_counters_generated.h"
 #include "mb_get_version_generated.h"
 #include "mb_set_kernel_generated.h"
 #include "mb_switch_rom_generated.h"
 #include "mb_wipe_rom_generated.h"
 #include "path_chmod_generated.h"
 #include "path_copy_generated.h"
+#include "path_copy_job_generated.h"
 #include "path_delete_generated.h"
 #include "path_get_directory_size_generated.h"
+#include "path_list_directory_generated.h"
 #include "path_mkdir_generated.h"
 #include "path_readlink_generated.h"
 #include "path_selinux_get_label_generated.h"
@@ -40,6 +44,8 @@ namespace mbtool {
 namespace daemon {
 namespace v3 {
 
+struct BatchRequest;
+
 struct Request;
 
 enum RequestType {
@@ -73,11 +79,17 @@ enum RequestType {
   RequestType_CryptoDecryptRequest = 27,
   RequestType_CryptoGetPwTypeRequest = 28,
   RequestType_PathReadlinkRequest = 29,
+  RequestType_BatchRequest = 30,
+  RequestType_FileGetFdRequest = 31,
+  RequestType_PathCopyJobStartRequest = 32,
+  RequestType_PathCopyJobCancelRequest = 33,
+  RequestType_MbGetPerfCountersRequest = 34,
+  RequestType_PathListDirectoryRequest = 35,
   RequestType_MIN = RequestType_NONE,
-  RequestType_MAX = RequestType_PathReadlinkRequest
+  RequestType_MAX = RequestType_PathListDirectoryRequest
 };
 
-inline const RequestType (&EnumValuesRequestType())[30] {
+inline const RequestType (&EnumValuesRequestType())[36] {
   static const RequestType values[] = {
     RequestType_NONE,
     RequestType_FileChmodRequest,
@@ -108,7 +120,13 @@ inline const RequestType (&EnumValuesRequestType())[30] {
     RequestType_PathMkdirRequest,
     RequestType_CryptoDecryptRequest,
     RequestType_CryptoGetPwTypeRequest,
-    RequestType_PathReadlinkRequest
+    RequestType_PathReadlinkRequest,
+    RequestType_BatchRequest,
+    RequestType_FileGetFdRequest,
+    RequestType_PathCopyJobStartRequest,
+    RequestType_PathCopyJobCancelRequest,
+    RequestType_MbGetPerfCountersRequest,
+    RequestType_PathListDirectoryRequest
   };
   return values;
 }
@@ -145,6 +163,12 @@ inline const char * const *EnumNamesRequestType() {
     "CryptoDecryptRequest",
     "CryptoGetPwTypeRequest",
     "PathReadlinkRequest",
+    "BatchRequest",
+    "FileGetFdRequest",
+    "PathCopyJobStartRequest",
+    "PathCopyJobCancelRequest",
+    "MbGetPerfCountersRequest",
+    "PathListDirectoryRequest",
     nullptr
   };
   return names;
@@ -275,13 +299,89 @@ template<> struct RequestTypeTraits<PathReadlinkRequest> {
   static const RequestType enum_value = RequestType_PathReadlinkRequest;
 };
 
+template<> struct RequestTypeTraits<BatchRequest> {
+  static const RequestType enum_value = RequestType_BatchRequest;
+};
+
+template<> struct RequestTypeTraits<FileGetFdRequest> {
+  static const RequestType enum_value = RequestType_FileGetFdRequest;
+};
+
+template<> struct RequestTypeTraits<PathCopyJobStartRequest> {
+  static const RequestType enum_value = RequestType_PathCopyJobStartRequest;
+};
+
+template<> struct RequestTypeTraits<PathCopyJobCancelRequest> {
+  static const RequestType enum_value = RequestType_PathCopyJobCancelRequest;
+};
+
+template<> struct RequestTypeTraits<MbGetPerfCountersRequest> {
+  static const RequestType enum_value = RequestType_MbGetPerfCountersRequest;
+};
+
+template<> struct RequestTypeTraits<PathListDirectoryRequest> {
+  static const RequestType enum_value = RequestType_PathListDirectoryRequest;
+};
+
 bool VerifyRequestType(flatbuffers::Verifier &verifier, const void *obj, RequestType type);
 bool VerifyRequestTypeVector(flatbuffers::Verifier &verifier, const flatbuffers::Vector<flatbuffers::Offset<void>> *values, const flatbuffers::Vector<uint8_t> *types);
 
+struct BatchRequest FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
+  enum {
+    VT_REQUESTS = 4
+  };
+  const flatbuffers::Vector<flatbuffers::Offset<Request>> *requests() const {
+    return GetPointer<const flatbuffers::Vector<flatbuffers::Offset<Request>> *>(VT_REQUESTS);
+  }
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           VerifyOffset(verifier, VT_REQUESTS) &&
+           verifier.Verify(requests()) &&
+           verifier.VerifyVectorOfTables(requests()) &&
+           verifier.EndTable();
+  }
+};
+
+struct BatchRequestBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  void add_requests(flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<Request>>> requests) {
+    fbb_.AddOffset(BatchRequest::VT_REQUESTS, requests);
+  }
+  explicit BatchRequestBuilder(flatbuffers::FlatBufferBuilder &_fbb)
+        : fbb_(_fbb) {
+    start_ = fbb_.StartTable();
+  }
+  BatchRequestBuilder &operator=(const BatchRequestBuilder &);
+  flatbuffers::Offset<BatchRequest> Finish() {
+    const auto end = fbb_.EndTable(start_);
+    auto o = flatbuffers::Offset<BatchRequest>(end);
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<BatchRequest> CreateBatchRequest(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<Request>>> requests = 0) {
+  BatchRequestBuilder builder_(_fbb);
+  builder_.add_requests(requests);
+  return builder_.Finish();
+}
+
+inline flatbuffers::Offset<BatchRequest> CreateBatchRequestDirect(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    const std::vector<flatbuffers::Offset<Request>> *requests = nullptr) {
+  return mbtool::daemon::v3::CreateBatchRequest(
+      _fbb,
+      requests ? _fbb.CreateVector<flatbuffers::Offset<Request>>(*requests) : 0);
+}
+
 struct Request FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
   enum {
     VT_REQUEST_TYPE = 4,
-    VT_REQUEST = 6
+    VT_REQUEST = 6,
+    VT_ID = 8,
+    VT_BACKGROUND = 10
   };
   RequestType request_type() const {
     return static_cast<RequestType>(GetField<uint8_t>(VT_REQUEST_TYPE, 0));
@@ -377,11 +477,37 @@ struct Request FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
   const PathReadlinkRequest *request_as_PathReadlinkRequest() const {
     return request_type() == RequestType_PathReadlinkRequest ? static_cast<const PathReadlinkRequest *>(request()) : nullptr;
   }
+  const BatchRequest *request_as_BatchRequest() const {
+    return request_type() == RequestType_BatchRequest ? static_cast<const BatchRequest *>(request()) : nullptr;
+  }
+  const FileGetFdRequest *request_as_FileGetFdRequest() const {
+    return request_type() == RequestType_FileGetFdRequest ? static_cast<const FileGetFdRequest *>(request()) : nullptr;
+  }
+  const PathCopyJobStartRequest *request_as_PathCopyJobStartRequest() const {
+    return request_type() == RequestType_PathCopyJobStartRequest ? static_cast<const PathCopyJobStartRequest *>(request()) : nullptr;
+  }
+  const PathCopyJobCancelRequest *request_as_PathCopyJobCancelRequest() const {
+    return request_type() == RequestType_PathCopyJobCancelRequest ? static_cast<const PathCopyJobCancelRequest *>(request()) : nullptr;
+  }
+  const MbGetPerfCountersRequest *request_as_MbGetPerfCountersRequest() const {
+    return request_type() == RequestType_MbGetPerfCountersRequest ? static_cast<const MbGetPerfCountersRequest *>(request()) : nullptr;
+  }
+  const PathListDirectoryRequest *request_as_PathListDirectoryRequest() const {
+    return request_type() == RequestType_PathListDirectoryRequest ? static_cast<const PathListDirectoryRequest *>(request()) : nullptr;
+  }
+  uint64_t id() const {
+    return GetField<uint64_t>(VT_ID, 0);
+  }
+  bool background() const {
+    return GetField<uint8_t>(VT_BACKGROUND, 0) != 0;
+  }
   bool Verify(flatbuffers::Verifier &verifier) const {
     return VerifyTableStart(verifier) &&
            VerifyField<uint8_t>(verifier, VT_REQUEST_TYPE) &&
            VerifyOffset(verifier, VT_REQUEST) &&
            VerifyRequestType(verifier, request(), request_type()) &&
+           VerifyField<uint64_t>(verifier, VT_ID) &&
+           VerifyField<uint8_t>(verifier, VT_BACKGROUND) &&
            verifier.EndTable();
   }
 };
@@ -502,6 +628,30 @@ template<> inline const PathReadlinkRequest *Request::request_as<PathReadlinkReq
   return request_as_PathReadlinkRequest();
 }
 
+template<> inline const BatchRequest *Request::request_as<BatchRequest>() const {
+  return request_as_BatchRequest();
+}
+
+template<> inline const FileGetFdRequest *Request::request_as<FileGetFdRequest>() const {
+  return request_as_FileGetFdRequest();
+}
+
+template<> inline const PathCopyJobStartRequest *Request::request_as<PathCopyJobStartRequest>() const {
+  return request_as_PathCopyJobStartRequest();
+}
+
+template<> inline const PathCopyJobCancelRequest *Request::request_as<PathCopyJobCancelRequest>() const {
+  return request_as_PathCopyJobCancelRequest();
+}
+
+template<> inline const MbGetPerfCountersRequest *Request::request_as<MbGetPerfCountersRequest>() const {
+  return request_as_MbGetPerfCountersRequest();
+}
+
+template<> inline const PathListDirectoryRequest *Request::request_as<PathListDirectoryRequest>() const {
+  return request_as_PathListDirectoryRequest();
+}
+
 struct RequestBuilder {
   flatbuffers::FlatBufferBuilder &fbb_;
   flatbuffers::uoffset_t start_;
@@ -511,6 +661,12 @@ struct RequestBuilder {
   void add_request(flatbuffers::Offset<void> request) {
     fbb_.AddOffset(Request::VT_REQUEST, request);
   }
+  void add_id(uint64_t id) {
+    fbb_.AddElement<uint64_t>(Request::VT_ID, id, 0);
+  }
+  void add_background(bool background) {
+    fbb_.AddElement<uint8_t>(Request::VT_BACKGROUND, static_cast<uint8_t>(background), 0);
+  }
   explicit RequestBuilder(flatbuffers::FlatBufferBuilder &_fbb)
         : fbb_(_fbb) {
     start_ = fbb_.StartTable();
@@ -526,9 +682,13 @@ struct RequestBuilder {
 inline flatbuffers::Offset<Request> CreateRequest(
     flatbuffers::FlatBufferBuilder &_fbb,
     RequestType request_type = RequestType_NONE,
-    flatbuffers::Offset<void> request = 0) {
+    flatbuffers::Offset<void> request = 0,
+    uint64_t id = 0,
+    bool background = false) {
   RequestBuilder builder_(_fbb);
+  builder_.add_id(id);
   builder_.add_request(request);
+  builder_.add_background(background);
   builder_.add_request_type(request_type);
   return builder_.Finish();
 }
@@ -654,6 +814,30 @@ inline bool VerifyRequestType(flatbuffers::Verifier &verifier, const void *obj,
       auto ptr = reinterpret_cast<const PathReadlinkRequest *>(obj);
       return verifier.VerifyTable(ptr);
     }
+    case RequestType_BatchRequest: {
+      auto ptr = reinterpret_cast<const BatchRequest *>(obj);
+      return verifier.VerifyTable(ptr);
+    }
+    case RequestType_FileGetFdRequest: {
+      auto ptr = reinterpret_cast<const FileGetFdRequest *>(obj);
+      return verifier.VerifyTable(ptr);
+    }
+    case RequestType_PathCopyJobStartRequest: {
+      auto ptr = reinterpret_cast<const PathCopyJobStartRequest *>(obj);
+      return verifier.VerifyTable(ptr);
+    }
+    case RequestType_PathCopyJobCancelRequest: {
+      auto ptr = reinterpret_cast<const PathCopyJobCancelRequest *>(obj);
+      return verifier.VerifyTable(ptr);
+    }
+    case RequestType_MbGetPerfCountersRequest: {
+      auto ptr = reinterpret_cast<const MbGetPerfCountersRequest *>(obj);
+      return verifier.VerifyTable(ptr);
+    }
+    case RequestType_PathListDirectoryRequest: {
+      auto ptr = reinterpret_cast<const PathListDirectoryRequest *>(obj);
+      return verifier.VerifyTable(ptr);
+    }
     default: return false;
   }
 }
@@ -10,6 +10,7 @@
 #include "crypto_get_pw_type_generated.h"
 #include "file_chmod_generated.h"
 #include "file_close_generated.h"
+#include "file_get_fd_generated.h"
 #include "file_open_generated.h"
 #include "file_read_generated.h"
 #include "file_seek_generated.h"
@@ -20,14 +21,17 @@
 #include "mb_get_booted_rom_id_generated.h"
 #include "mb_get_installed_roms_generated.h"
 #include "mb_get_packages_count_generated.h"
+#include "mb_get_perf_counters_generated.h"
 #include "mb_get_version_generated.h"
 #include "mb_set_kernel_generated.h"
 #include "mb_switch_rom_generated.h"
 #include "mb_wipe_rom_generated.h"
 #include "path_chmod_generated.h"
 #include "path_copy_generated.h"
+#include "path_copy_job_generated.h"
 #include "path_delete_generated.h"
 #include "path_get_directory_size_generated.h"
+#include "path_list_directory_generated.h"
 #include "path_mkdir_generated.h"
 #include "path_readlink_generated.h"
 #include "path_selinux_get_label_generated.h"
@@ -44,6 +48,8 @@ struct Invalid;
 
 struct Unsupported;
 
+struct BatchResponse;
+
 struct Response;
 
 enum ResponseType {
@@ -80,11 +86,20 @@ enum ResponseType {
   ResponseType_CryptoDecryptResponse = 30,
   ResponseType_CryptoGetPwTypeResponse = 31,
   ResponseType_PathReadlinkResponse = 32,
+  ResponseType_BatchResponse = 33,
+  ResponseType_FileGetFdResponse = 34,
+  ResponseType_PathCopyJobStartResponse = 35,
+  ResponseType_PathCopyJobProgressResponse = 36,
+  ResponseType_PathCopyJobFinishedResponse = 37,
+  ResponseType_PathCopyJobCancelResponse = 38,
+  ResponseType_MbWipeRomProgressResponse = 39,
+  ResponseType_MbGetPerfCountersResponse = 40,
+  ResponseType_PathListDirectoryResponse = 41,
   ResponseType_MIN = ResponseType_NONE,
-  ResponseType_MAX = ResponseType_PathReadlinkResponse
+  ResponseType_MAX = ResponseType_PathListDirectoryResponse
 };
 
-inline const ResponseType (&EnumValuesResponseType())[33] {
+inline const ResponseType (&EnumValuesResponseType())[42] {
   static const ResponseType values[] = {
     ResponseType_NONE,
     ResponseType_Invalid,
@@ -118,7 +133,16 @@ inline const ResponseType (&EnumValuesResponseType())[33] {
     ResponseType_PathMkdirResponse,
     ResponseType_CryptoDecryptResponse,
     ResponseType_CryptoGetPwTypeResponse,
-    ResponseType_PathReadlinkResponse
+    ResponseType_PathReadlinkResponse,
+    ResponseType_BatchResponse,
+    ResponseType_FileGetFdResponse,
+    ResponseType_PathCopyJobStartResponse,
+    ResponseType_PathCopyJobProgressResponse,
+    ResponseType_PathCopyJobFinishedResponse,
+    ResponseType_PathCopyJobCancelResponse,
+    ResponseType_MbWipeRomProgressResponse,
+    ResponseType_MbGetPerfCountersResponse,
+    ResponseType_PathListDirectoryResponse
   };
   return values;
 }
@@ -158,6 +182,15 @@ inline const char * const *EnumNamesResponseType() {
     "CryptoDecryptResponse",
     "CryptoGetPwTypeResponse",
     "PathReadlinkResponse",
+    "BatchResponse",
+    "FileGetFdResponse",
+    "PathCopyJobStartResponse",
+    "PathCopyJobProgressResponse",
+    "PathCopyJobFinishedResponse",
+    "PathCopyJobCancelResponse",
+    "MbWipeRomProgressResponse",
+    "MbGetPerfCountersResponse",
+    "PathListDirectoryResponse",
     nullptr
   };
   return names;
@@ -300,6 +333,42 @@ template<> struct ResponseTypeTraits<PathReadlinkResponse> {
   static const ResponseType enum_value = ResponseType_PathReadlinkResponse;
 };
 
+template<> struct ResponseTypeTraits<BatchResponse> {
+  static const ResponseType enum_value = ResponseType_BatchResponse;
+};
+
+template<> struct ResponseTypeTraits<FileGetFdResponse> {
+  static const ResponseType enum_value = ResponseType_FileGetFdResponse;
+};
+
+template<> struct ResponseTypeTraits<PathCopyJobStartResponse> {
+  static const ResponseType enum_value = ResponseType_PathCopyJobStartResponse;
+};
+
+template<> struct ResponseTypeTraits<PathCopyJobProgressResponse> {
+  static const ResponseType enum_value = ResponseType_PathCopyJobProgressResponse;
+};
+
+template<> struct ResponseTypeTraits<PathCopyJobFinishedResponse> {
+  static const ResponseType enum_value = ResponseType_PathCopyJobFinishedResponse;
+};
+
+template<> struct ResponseTypeTraits<PathCopyJobCancelResponse> {
+  static const ResponseType enum_value = ResponseType_PathCopyJobCancelResponse;
+};
+
+template<> struct ResponseTypeTraits<MbWipeRomProgressResponse> {
+  static const ResponseType enum_value = ResponseType_MbWipeRomProgressResponse;
+};
+
+template<> struct ResponseTypeTraits<MbGetPerfCountersResponse> {
+  static const ResponseType enum_value = ResponseType_MbGetPerfCountersResponse;
+};
+
+template<> struct ResponseTypeTraits<PathListDirectoryResponse> {
+  static const ResponseType enum_value = ResponseType_PathListDirectoryResponse;
+};
+
 bool VerifyResponseType(flatbuffers::Verifier &verifier, const void *obj, ResponseType type);
 bool VerifyResponseTypeVector(flatbuffers::Verifier &verifier, const flatbuffers::Vector<flatbuffers::Offset<void>> *values, const flatbuffers::Vector<uint8_t> *types);
 
@@ -359,10 +428,52 @@ inline flatbuffers::Offset<Unsupported> CreateUnsupported(
   return builder_.Finish();
 }
 
+struct BatchResponse FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
+  enum {
+    VT_COUNT = 4
+  };
+  uint32_t count() const {
+    return GetField<uint32_t>(VT_COUNT, 0);
+  }
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           VerifyField<uint32_t>(verifier, VT_COUNT) &&
+           verifier.EndTable();
+  }
+};
+
+struct BatchResponseBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  void add_count(uint32_t count) {
+    fbb_.AddElement<uint32_t>(BatchResponse::VT_COUNT, count, 0);
+  }
+  explicit BatchResponseBuilder(flatbuffers::FlatBufferBuilder &_fbb)
+        : fbb_(_fbb) {
+    start_ = fbb_.StartTable();
+  }
+  BatchResponseBuilder &operator=(const BatchResponseBuilder &);
+  flatbuffers::Offset<BatchResponse> Finish() {
+    const auto end = fbb_.EndTable(start_);
+    auto o = flatbuffers::Offset<BatchResponse>(end);
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<BatchResponse> CreateBatchResponse(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    uint32_t count = 0) {
+  BatchResponseBuilder builder_(_fbb);
+  builder_.add_count(count);
+  return builder_.Finish();
+}
+
 struct Response FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
   enum {
     VT_RESPONSE_TYPE = 4,
-    VT_RESPONSE = 6
+    VT_RESPONSE = 6,
+    VT_ID = 8,
+    VT_MORE = 10
   };
   ResponseType response_type() const {
     return static_cast<ResponseType>(GetField<uint8_t>(VT_RESPONSE_TYPE, 0));
@@ -467,11 +578,46 @@ struct Response FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
   const PathReadlinkResponse *response_as_PathReadlinkResponse() const {
     return response_type() == ResponseType_PathReadlinkResponse ? static_cast<const PathReadlinkResponse *>(response()) : nullptr;
   }
+  const BatchResponse *response_as_BatchResponse() const {
+    return response_type() == ResponseType_BatchResponse ? static_cast<const BatchResponse *>(response()) : nullptr;
+  }
+  const FileGetFdResponse *response_as_FileGetFdResponse() const {
+    return response_type() == ResponseType_FileGetFdResponse ? static_cast<const FileGetFdResponse *>(response()) : nullptr;
+  }
+  const PathCopyJobStartResponse *response_as_PathCopyJobStartResponse() const {
+    return response_type() == ResponseType_PathCopyJobStartResponse ? static_cast<const PathCopyJobStartResponse *>(response()) : nullptr;
+  }
+  const PathCopyJobProgressResponse *response_as_PathCopyJobProgressResponse() const {
+    return response_type() == ResponseType_PathCopyJobProgressResponse ? static_cast<const PathCopyJobProgressResponse *>(response()) : nullptr;
+  }
+  const PathCopyJobFinishedResponse *response_as_PathCopyJobFinishedResponse() const {
+    return response_type() == ResponseType_PathCopyJobFinishedResponse ? static_cast<const PathCopyJobFinishedResponse *>(response()) : nullptr;
+  }
+  const PathCopyJobCancelResponse *response_as_PathCopyJobCancelResponse() const {
+    return response_type() == ResponseType_PathCopyJobCancelResponse ? static_cast<const PathCopyJobCancelResponse *>(response()) : nullptr;
+  }
+  const MbWipeRomProgressResponse *response_as_MbWipeRomProgressResponse() const {
+    return response_type() == ResponseType_MbWipeRomProgressResponse ? static_cast<const MbWipeRomProgressResponse *>(response()) : nullptr;
+  }
+  const MbGetPerfCountersResponse *response_as_MbGetPerfCountersResponse() const {
+    return response_type() == ResponseType_MbGetPerfCountersResponse ? static_cast<const MbGetPerfCountersResponse *>(response()) : nullptr;
+  }
+  const PathListDirectoryResponse *response_as_PathListDirectoryResponse() const {
+    return response_type() == ResponseType_PathListDirectoryResponse ? static_cast<const PathListDirectoryResponse *>(response()) : nullptr;
+  }
+  uint64_t id() const {
+    return GetField<uint64_t>(VT_ID, 0);
+  }
+  bool more() const {
+    return GetField<uint8_t>(VT_MORE, 0) != 0;
+  }
   bool Verify(flatbuffers::Verifier &verifier) const {
     return VerifyTableStart(verifier) &&
            VerifyField<uint8_t>(verifier, VT_RESPONSE_TYPE) &&
            VerifyOffset(verifier, VT_RESPONSE) &&
            VerifyResponseType(verifier, response(), response_type()) &&
+           VerifyField<uint64_t>(verifier, VT_ID) &&
+           VerifyField<uint8_t>(verifier, VT_MORE) &&
            verifier.EndTable();
   }
 };
@@ -604,6 +750,42 @@ template<> inline const PathReadlinkResponse *Response::response_as<PathReadlink
   return response_as_PathReadlinkResponse();
 }
 
+template<> inline const BatchResponse *Response::response_as<BatchResponse>() const {
+  return response_as_BatchResponse();
+}
+
+template<> inline const FileGetFdResponse *Response::response_as<FileGetFdResponse>() const {
+  return response_as_FileGetFdResponse();
+}
+
+template<> inline const PathCopyJobStartResponse *Response::response_as<PathCopyJobStartResponse>() const {
+  return response_as_PathCopyJobStartResponse();
+}
+
+template<> inline const PathCopyJobProgressResponse *Response::response_as<PathCopyJobProgressResponse>() const {
+  return response_as_PathCopyJobProgressResponse();
+}
+
+template<> inline const PathCopyJobFinishedResponse *Response::response_as<PathCopyJobFinishedResponse>() const {
+  return response_as_PathCopyJobFinishedResponse();
+}
+
+template<> inline const PathCopyJobCancelResponse *Response::response_as<PathCopyJobCancelResponse>() const {
+  return response_as_PathCopyJobCancelResponse();
+}
+
+template<> inline const MbWipeRomProgressResponse *Response::response_as<MbWipeRomProgressResponse>() const {
+  return response_as_MbWipeRomProgressResponse();
+}
+
+template<> inline const MbGetPerfCountersResponse *Response::response_as<MbGetPerfCountersResponse>() const {
+  return response_as_MbGetPerfCountersResponse();
+}
+
+template<> inline const PathListDirectoryResponse *Response::response_as<PathListDirectoryResponse>() const {
+  return response_as_PathListDirectoryResponse();
+}
+
 struct ResponseBuilder {
   flatbuffers::FlatBufferBuilder &fbb_;
   flatbuffers::uoffset_t start_;
@@ -613,6 +795,12 @@ struct ResponseBuilder {
   void add_response(flatbuffers::Offset<void> response) {
     fbb_.AddOffset(Response::VT_RESPONSE, response);
   }
+  void add_id(uint64_t id) {
+    fbb_.AddElement<uint64_t>(Response::VT_ID, id, 0);
+  }
+  void add_more(bool more) {
+    fbb_.AddElement<uint8_t>(Response::VT_MORE, static_cast<uint8_t>(more), 0);
+  }
   explicit ResponseBuilder(flatbuffers::FlatBufferBuilder &_fbb)
         : fbb_(_fbb) {
     start_ = fbb_.StartTable();
@@ -628,9 +816,13 @@ struct ResponseBuilder {
 inline flatbuffers::Offset<Response> CreateResponse(
     flatbuffers::FlatBufferBuilder &_fbb,
     ResponseType response_type = ResponseType_NONE,
-    flatbuffers::Offset<void> response = 0) {
+    flatbuffers::Offset<void> response = 0,
+    uint64_t id = 0,
+    bool more = false) {
   ResponseBuilder builder_(_fbb);
+  builder_.add_id(id);
   builder_.add_response(response);
+  builder_.add_more(more);
   builder_.add_response_type(response_type);
   return builder_.Finish();
 }
@@ -768,6 +960,42 @@ inline bool VerifyResponseType(flatbuffers::Verifier &verifier, const void *obj,
       auto ptr = reinterpret_cast<const PathReadlinkResponse *>(obj);
       return verifier.VerifyTable(ptr);
     }
+    case ResponseType_BatchResponse: {
+      auto ptr = reinterpret_cast<const BatchResponse *>(obj);
+      return verifier.VerifyTable(ptr);
+    }
+    case ResponseType_FileGetFdResponse: {
+      auto ptr = reinterpret_cast<const FileGetFdResponse *>(obj);
+      return verifier.VerifyTable(ptr);
+    }
+    case ResponseType_PathCopyJobStartResponse: {
+      auto ptr = reinterpret_cast<const PathCopyJobStartResponse *>(obj);
+      return verifier.VerifyTable(ptr);
+    }
+    case ResponseType_PathCopyJobProgressResponse: {
+      auto ptr = reinterpret_cast<const PathCopyJobProgressResponse *>(obj);
+      return verifier.VerifyTable(ptr);
+    }
+    case ResponseType_PathCopyJobFinishedResponse: {
+      auto ptr = reinterpret_cast<const PathCopyJobFinishedResponse *>(obj);
+      return verifier.VerifyTable(ptr);
+    }
+    case ResponseType_PathCopyJobCancelResponse: {
+      auto ptr = reinterpret_cast<const PathCopyJobCancelResponse *>(obj);
+      return verifier.VerifyTable(ptr);
+    }
+    case ResponseType_MbWipeRomProgressResponse: {
+      auto ptr = reinterpret_cast<const MbWipeRomProgressResponse *>(obj);
+      return verifier.VerifyTable(ptr);
+    }
+    case ResponseType_MbGetPerfCountersResponse: {
+      auto ptr = reinterpret_cast<const MbGetPerfCountersResponse *>(obj);
+      return verifier.VerifyTable(ptr);
+    }
+    case ResponseType_PathListDirectoryResponse: {
+      auto ptr = reinterpret_cast<const PathListDirectoryResponse *>(obj);
+      return verifier.VerifyTable(ptr);
+    }
     default: return false;
   }
 }
@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <cstdint>
+
+namespace mb
+{
+
+// A file belonging to a backup target (eg. one part of a split archive)
+struct BackupCatalogFile
+{
+    // File name relative to the backup directory
+    std::string name;
+    uint64_t size;
+    // Modification time in seconds since the epoch
+    int64_t mtime;
+    // Hex SHA512 digest or empty if the file has no recorded checksum
+    std::string sha512;
+};
+
+struct BackupCatalogTarget
+{
+    // Target name (eg. "system" or "boot")
+    std::string name;
+    // Backup name used to restore the target (for split archives, the name
+    // without the ".<n>" or ".part<n>" suffix)
+    std::string archive;
+    // "tar", "snapshot", "sparse", or "file"
+    std::string format;
+    // Compression name for "tar" archives (eg. "lz4"). Empty otherwise.
+    std::string compression;
+    bool split;
+    // Files in the order they should be read
+    std::vector<BackupCatalogFile> files;
+
+    uint64_t total_size() const;
+};
+
+struct BackupCatalog
+{
+    std::string rom_id;
+    // Creation time in seconds since the epoch
+    int64_t timestamp;
+    std::vector<BackupCatalogTarget> targets;
+
+    const BackupCatalogTarget * find(std::string_view name) const;
+};
+
+bool backup_catalog_add_files(BackupCatalogTarget &target,
+                              const std::string &backup_dir,
+                              const std::string &checksums_name);
+
+bool backup_catalog_write(const std::string &path,
+                          const BackupCatalog &catalog);
+bool backup_catalog_read(const std::string &path, BackupCatalog &catalog);
+
+}
@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <cstdint>
+
+#include "mbcommon/common.h"
+#include "mbutil/copy.h"
+
+namespace mb
+{
+
+enum class TargetState : uint8_t
+{
+    Pending,
+    Running,
+    Succeeded,
+    Failed,
+};
+
+// Progress of a single backup or restore target. These live in memory shared
+// with the backup job processes, so they only contain lock-free atomics.
+struct TargetProgress
+{
+    char name[16];
+    // Bytes and files processed so far
+    util::CopyProgress counters;
+    // Expected number of bytes (0 if unknown)
+    std::atomic<uint64_t> total_bytes{0};
+    // CLOCK_MONOTONIC timestamps
+    std::atomic<uint64_t> start_ns{0};
+    std::atomic<uint64_t> end_ns{0};
+    std::atomic<TargetState> state{TargetState::Pending};
+
+    void begin();
+    void end(bool success);
+};
+
+class ProgressReporter
+{
+public:
+    explicit ProgressReporter(size_t max_targets);
+    ~ProgressReporter();
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(ProgressReporter)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(ProgressReporter)
+
+    TargetProgress * add_target(const char *name, uint64_t total_bytes = 0);
+
+    void start();
+    void stop();
+
+    bool write_timings(const std::string &path) const;
+
+private:
+    void report_loop();
+    void report(bool final);
+
+    TargetProgress *m_targets;
+    size_t m_max_targets;
+    size_t m_count;
+
+    // Bytes reported in the previous interval for computing the current rate
+    std::vector<uint64_t> m_last_bytes;
+    uint64_t m_last_ns;
+
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    bool m_stop;
+    std::thread m_thread;
+};
+
+uint64_t read_target_timing_bytes(const std::string &path,
+                                  const std::string &name);
+uint64_t estimate_tree_size(const std::string &path,
+                            const std::vector<std::string> &exclusions);
+
+}
@@ -0,0 +1,38 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <string>
+
+namespace mb
+{
+
+bool boot_store_save(const std::string &boot_image_path,
+                     const std::string &manifest_path,
+                     const std::string &store_dir);
+
+bool boot_store_restore(const std::string &manifest_path,
+                        const std::string &store_dir,
+                        const std::string &output_path);
+
+bool boot_store_verify(const std::string &manifest_path,
+                       const std::string &store_dir);
+
+}
@@ -0,0 +1,56 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "mbcommon/flags.h"
+#include "mbutil/copy.h"
+
+namespace mb
+{
+
+enum class SnapshotRestoreFlag : uint8_t
+{
+    // Leave files that already match the manifest untouched and replace
+    // everything else
+    SkipUnchanged = 1 << 0,
+};
+MB_DECLARE_FLAGS(SnapshotRestoreFlags, SnapshotRestoreFlag)
+MB_DECLARE_OPERATORS_FOR_FLAGS(SnapshotRestoreFlags)
+
+bool snapshot_create(const std::string &manifest_path,
+                     const std::string &store_dir,
+                     const std::string &directory,
+                     const std::vector<std::string> &exclusions,
+                     util::CopyProgress *progress = nullptr);
+
+bool snapshot_restore(const std::string &manifest_path,
+                      const std::string &store_dir,
+                      const std::string &directory,
+                      SnapshotRestoreFlags flags = {},
+                      std::vector<std::string> *entries = nullptr,
+                      util::CopyProgress *progress = nullptr);
+
+bool snapshot_verify(const std::string &manifest_path,
+                     const std::string &store_dir);
+
+}
@@ -20,15 +20,20 @@
 #pragma once
 
 #include <memory>
+#include <optional>
 #include <string>
 #include <string_view>
 #include <unordered_map>
 
+#include "mbcommon/arena.h"
 #include "mbcommon/common.h"
 #include "mbcommon/flags.h"
 #include "mbdevice/device.h"
+#include "mbutil/zip_index.h"
 
+#include "recovery/stage_timer.h"
 #include "util/legacy_property_service.h"
+#include "util/multiboot.h"
 #include "util/roms.h"
 
 namespace mb
@@ -37,6 +42,9 @@ namespace mb
 enum class InstallerFlag : uint8_t
 {
     SkipMountingVolumes     = 1 << 0,
+    // Keep the chroot after installation and reuse it for the next one if it
+    // is still set up (requires the mount namespace to be kept alive)
+    ReuseChroot             = 1 << 1,
 };
 MB_DECLARE_FLAGS(InstallerFlags, InstallerFlag)
 MB_DECLARE_OPERATORS_FOR_FLAGS(InstallerFlags)
@@ -106,14 +114,27 @@ protected:
     bool _use_legacy_props;
     LegacyPropertyService _legacy_prop_svc;
 
+    // Central directory of the zip file, read once during initialization. If
+    // this is null, lookups fall back to scanning the zip.
+    std::unique_ptr<util::ZipIndex> _zip_index;
+
     std::string _temp_image_path;
     bool _has_block_image;
     bool _copy_to_temp_image;
+    // State of the temporary image right after /system was copied to it
+    std::optional<SystemSnapshot> _system_snapshot;
     bool _is_aroma;
     bool _use_fuse_exfat;
 
     std::vector<std::string> _associated_loop_devs;
 
+    // Resource usage of each installation stage
+    StageTimer _stage_timer;
+
+    // Memory for short-lived containers built during the installation. It is
+    // released all at once after on_cleanup().
+    Arena _arena;
+
     std::string in_chroot(const std::string &path) const;
 
     static bool is_aroma(const std::string &path);
@@ -129,6 +150,9 @@ private:
                            const std::vector<std::string> &argv);
 
     bool create_chroot();
+    bool build_chroot();
+    bool reset_chroot();
+    bool release_chroot() const;
     bool destroy_chroot() const;
     bool mount_efs() const;
 
@@ -28,6 +28,12 @@ namespace mb
 {
 class File;
 
+namespace bootimg
+{
+class Reader;
+class Writer;
+}
+
 class InstallerUtil
 {
 public:
@@ -39,16 +45,23 @@ public:
                              const std::string &output_file,
                              int format,
                              const std::vector<int> &filters);
+    static bool pack_ramdisk(const std::string &input_dir,
+                             bootimg::Writer &writer,
+                             int format,
+                             const std::vector<int> &filters);
 
     static bool patch_boot_image(const std::string &input_file,
                                  const std::string &output_file,
                                  const std::vector<std::function<RamdiskPatcherFn>> &rps);
-    static bool patch_ramdisk(const std::string &input_file,
-                              const std::string &output_file,
-                              unsigned int depth,
+    static bool patch_ramdisk(bootimg::Reader &reader,
+                              bootimg::Writer &writer,
                               const std::vector<std::function<RamdiskPatcherFn>> &rps);
-    static bool patch_ramdisk_dir(const std::string &ramdisk_dir,
-                                  const std::vector<std::function<RamdiskPatcherFn>> &rps);
+    static bool edit_boot_image(const std::string &input_file,
+                                const std::string &output_file,
+                                const RamdiskEdits &edits);
+    static bool edit_ramdisk(bootimg::Reader &reader,
+                             bootimg::Writer &writer,
+                             const RamdiskEdits &edits);
     static bool patch_kernel_rkp(const std::string &input_file,
                                  const std::string &output_file);
 
@@ -56,6 +69,14 @@ public:
                              const std::string &with);
 
 private:
+    using CopyRamdiskFn = bool(bootimg::Reader &reader,
+                               bootimg::Writer &writer,
+                               const std::string &tmpdir);
+
+    static bool patch_boot_image(const std::string &input_file,
+                                 const std::string &output_file,
+                                 const std::function<CopyRamdiskFn> &copy_ramdisk);
+
     static bool copy_file_to_file(File &fin, File &fout, uint64_t to_copy);
     static bool copy_file_to_file_eof(File &fin, File &fout);
 };
@@ -21,15 +21,65 @@
 
 #include <functional>
 #include <string>
+#include <vector>
+
+#include "mbutil/cpio.h"
+
+struct archive_entry;
 
 namespace mb
 {
 
-using RamdiskPatcherFn = bool(const std::string &dir);
+using RamdiskEntry = util::CpioArchive::Entry;
+
+/*!
+ * \brief In-memory model of a cpio ramdisk
+ *
+ * See util::CpioArchive. The compression filters are remembered so that the
+ * ramdisk can be written back the same way it was read.
+ */
+class Ramdisk : public util::CpioArchive
+{
+public:
+    // Compression filters (libarchive filter codes) of the ramdisk
+    std::vector<int> filters;
+};
+
+using RamdiskPatcherFn = bool(Ramdisk &ramdisk);
+
+// Edits applied in memory while the ramdisk is streamed from one boot image
+// to another (see InstallerUtil::edit_ramdisk())
+enum class RamdiskAction
+{
+    Keep,
+    // Write the entry with the modified data
+    Replace,
+    Remove,
+};
+
+using RamdiskEntryFn = RamdiskAction(archive_entry *entry, std::string &data);
+
+struct RamdiskFile
+{
+    std::string path;
+    std::string data;
+    unsigned int mode;
+};
+
+struct RamdiskEdits
+{
+    // Regular files to add or to replace existing entries with
+    std::vector<RamdiskFile> files;
+    // Called for every other entry with the entry's data
+    std::function<RamdiskEntryFn> on_entry;
+};
 
 std::function<RamdiskPatcherFn>
 rp_write_rom_id(const std::string &rom_id);
 
+RamdiskFile
+rf_rom_id(const std::string &rom_id);
+
 std::function<RamdiskPatcherFn>
 rp_restore_default_prop();
 
@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <functional>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <cstdint>
+
+#include "mbcommon/common.h"
+
+namespace mb
+{
+
+// Resources used by one stage. CPU time and I/O include child processes that
+// were reaped during the stage (eg. the updater).
+struct StageTiming
+{
+    std::string name;
+    bool success;
+    uint64_t wall_ns;
+    uint64_t user_cpu_ns;
+    uint64_t sys_cpu_ns;
+    // Bytes fetched from and sent to the storage layer
+    uint64_t read_bytes;
+    uint64_t write_bytes;
+};
+
+class StageTimer
+{
+public:
+    using Hook = std::function<void(const StageTiming &)>;
+
+    StageTimer();
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(StageTimer)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(StageTimer)
+
+    void set_hook(Hook hook);
+
+    void start(std::string name);
+    void stop(bool success = true);
+
+    const std::vector<StageTiming> & timings() const;
+
+    void log_summary() const;
+    bool write_json(const std::string &path) const;
+
+private:
+    struct Sample
+    {
+        uint64_t wall_ns;
+        uint64_t user_cpu_ns;
+        uint64_t sys_cpu_ns;
+        uint64_t read_bytes;
+        uint64_t write_bytes;
+    };
+
+    static Sample sample();
+
+    Hook m_hook;
+    std::optional<std::string> m_name;
+    Sample m_start;
+    std::vector<StageTiming> m_timings;
+};
+
+}
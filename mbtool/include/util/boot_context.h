@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "mbcommon/common.h"
+#include "mbdevice/device.h"
+#include "mbutil/cmdline.h"
+
+namespace mb
+{
+
+class Rom;
+
+class BootContext
+{
+public:
+    BootContext();
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(BootContext)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(BootContext)
+
+    const util::KernelCmdlineArgs & kernel_cmdline();
+    const device::Device * device();
+    const std::string & rom_id();
+    std::shared_ptr<Rom> current_rom();
+
+    std::string find_block_dev(const std::vector<std::string> &search_dirs,
+                               const std::string &partition);
+
+    static BootContext & instance();
+
+private:
+    std::mutex m_mutex;
+    std::optional<util::KernelCmdlineArgs> m_cmdline;
+    std::optional<std::optional<device::Device>> m_device;
+    std::optional<std::string> m_rom_id;
+    std::shared_ptr<Rom> m_current_rom;
+    // Key is the search directories and the partition name, separated by NUL
+    std::unordered_map<std::string, std::string> m_block_devs;
+};
+
+}
@@ -20,6 +20,11 @@
 #pragma once
 
 #include <string>
+#include <unordered_map>
+
+#include <ctime>
+
+#include <sys/stat.h>
 
 #define INTERNAL_STORAGE_ROOT           "/data/media"
 #define INTERNAL_STORAGE                INTERNAL_STORAGE_ROOT "/0"
@@ -27,6 +32,10 @@
 #define MULTIBOOT_LOG_INSTALLER         INTERNAL_STORAGE "/MultiBoot.log"
 #define MULTIBOOT_LOG_APPSYNC           MULTIBOOT_DIR "/appsync.log"
 #define MULTIBOOT_LOG_DAEMON            MULTIBOOT_DIR "/daemon.log"
+#define MULTIBOOT_BINARY_LOG_DIR        "/data/multiboot/logs"
+#define MULTIBOOT_BINARY_LOG_DAEMON     MULTIBOOT_BINARY_LOG_DIR "/daemon.mblog"
+#define MULTIBOOT_BINARY_LOG_SIZE       (4 * 1024 * 1024)
+#define MULTIBOOT_TIMING_INSTALLER      MULTIBOOT_DIR "/installer_timing.json"
 
 #define ABOOT_PARTITION                 "/dev/block/platform/msm_sdcc.1/by-name/aboot"
 
@@ -76,7 +85,23 @@
 namespace mb
 {
 
+// State of a file used to detect whether it was modified after a snapshot
+struct SystemFileState
+{
+    ino_t ino;
+    mode_t mode;
+    off64_t size;
+    timespec mtime;
+    timespec ctime;
+};
+
+// Map of paths, relative to the snapshotted directory, to their states
+using SystemSnapshot = std::unordered_map<std::string, SystemFileState>;
+
 bool copy_system(const std::string &source, const std::string &target);
+bool snapshot_system(const std::string &path, SystemSnapshot &snapshot);
+bool copy_system_changes(const std::string &source, const std::string &target,
+                         const SystemSnapshot &snapshot);
 
 bool fix_multiboot_permissions();
 
@@ -0,0 +1,50 @@
+/*
+ * Copyright (C) 2014-2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include <cstdint>
+
+#include "mbutil/hash.h"
+
+// Directory (on the raw data partition) for caching patched boot files
+#define PATCH_CACHE_DIR                 "/data/multiboot/cache"
+
+namespace mb
+{
+
+std::string patch_cache_path(const std::string &name);
+
+std::optional<util::Sha512Digest>
+patch_cache_key(const std::string &source, std::string_view variant,
+                uint32_t version);
+std::optional<util::Sha512Digest>
+patch_cache_stat_key(const std::string &source, std::string_view variant,
+                     uint32_t version);
+
+bool patch_cache_load(const std::string &path, const util::Sha512Digest &key,
+                      std::string &data);
+void patch_cache_save(const std::string &path, const util::Sha512Digest &key,
+                      std::string_view data);
+
+}
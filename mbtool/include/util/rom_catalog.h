@@ -0,0 +1,46 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "util/roms.h"
+
+namespace mb
+{
+
+struct RomCatalogEntry
+{
+    std::shared_ptr<Rom> rom;
+    std::string system_path;
+    std::string cache_path;
+    std::string data_path;
+    // From build.prop or the properties cached in the ROM's config
+    std::string version;
+    std::string build;
+    // Empty if the ROM has no thumbnail
+    std::string thumbnail_path;
+};
+
+std::vector<RomCatalogEntry> rom_catalog_get();
+
+}
@@ -30,6 +30,8 @@ struct SharedPackage
 {
     std::string pkg_id;
     bool share_data;
+    // Keep the APKs in sync with the other ROMs that share the package
+    bool share_apk;
 };
 
 struct RomConfig
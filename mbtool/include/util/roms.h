@@ -77,6 +77,7 @@ private:
     void add_data_roms();
     void add_extsd_roms();
 public:
+    void add_all();
     void add_installed();
 
     std::shared_ptr<Rom> find_by_id(const std::string &id) const;
@@ -85,6 +86,7 @@ public:
 
     static std::shared_ptr<Rom> create_rom(const std::string &id);
     static bool is_valid(const std::string &id);
+    static bool is_installed(Rom &rom);
 
     static std::string get_system_partition();
     static std::string get_cache_partition();
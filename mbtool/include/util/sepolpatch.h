@@ -20,6 +20,7 @@
 #pragma once
 
 #include <string>
+#include <vector>
 
 #include <sepol/policydb/policydb.h>
 
@@ -106,6 +107,54 @@ bool selinux_add_to_role(policydb_t *pdb,
                          const char *role_name,
                          const char *type_name);
 
+// Batched rule changes
+
+class SELinuxRuleBatch
+{
+public:
+    explicit SELinuxRuleBatch(policydb_t *pdb);
+
+    bool add_rules(const char *source_str,
+                   const char *target_str,
+                   const char *class_str,
+                   const std::vector<std::string> &perms);
+    bool remove_rules(const char *source_str,
+                      const char *target_str,
+                      const char *class_str,
+                      const std::vector<std::string> &perms);
+    bool grant_all_perms(uint16_t source_type_val,
+                         uint16_t target_type_val);
+    bool grant_all_perms(uint16_t source_type_val,
+                         uint16_t target_type_val,
+                         uint16_t class_val);
+
+    void add_raw(const avtab_key_t &key, uint32_t perms);
+    void remove_raw(const avtab_key_t &key, uint32_t perms);
+
+    SELinuxResult apply();
+
+private:
+    struct Change
+    {
+        // Packed avtab_key_t fields
+        uint64_t key;
+        uint32_t perms;
+        bool remove;
+    };
+
+    policydb_t *_pdb;
+    std::vector<Change> _changes;
+    // Mask of all permissions for each class (indexed by class value - 1)
+    std::vector<uint32_t> _class_perms;
+
+    bool set_rules(const char *source_str,
+                   const char *target_str,
+                   const char *class_str,
+                   const std::vector<std::string> &perms,
+                   bool remove);
+    uint32_t class_perms(uint16_t class_val);
+};
+
 // Patching functions
 
 enum class SELinuxPatch
@@ -117,11 +166,14 @@ enum class SELinuxPatch
     StripNoAudit,
 };
 
-bool selinux_apply_patch(policydb_t *pdb, SELinuxPatch patch);
+SELinuxResult selinux_apply_patch(policydb_t *pdb, SELinuxPatch patch);
 
 bool patch_sepolicy(const std::string &source,
                     const std::string &target,
                     SELinuxPatch patch);
+bool patch_sepolicy_cached(const std::string &source,
+                           const std::string &target,
+                           SELinuxPatch patch);
 bool patch_loaded_sepolicy(SELinuxPatch patch);
 
 int sepolpatch_main(int argc, char *argv[]);
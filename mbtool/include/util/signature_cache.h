@@ -0,0 +1,57 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <optional>
+
+#include <cstdint>
+
+#include "mbsign/sign.h"
+
+// File (on the raw data partition) recording successful signature checks
+#define SIG_CACHE_PATH                  "/data/multiboot/sigverify_cache.bin"
+
+namespace mb
+{
+
+struct SigCacheKey
+{
+    // Identity and metadata of the signed file
+    uint64_t fsid;
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t size;
+    int64_t mtime_sec;
+    int64_t ctime_sec;
+    uint32_t mtime_nsec;
+    uint32_t ctime_nsec;
+    // SHA-512 digest of the signature
+    unsigned char sig_digest[64];
+
+    bool operator==(const SigCacheKey &other) const;
+    bool operator!=(const SigCacheKey &other) const;
+};
+
+std::optional<SigCacheKey> sig_cache_key(int fd, const sign::Signature &sig);
+
+bool sig_cache_find(const SigCacheKey &key);
+void sig_cache_insert(const SigCacheKey &key);
+
+}
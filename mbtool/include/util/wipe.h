@@ -19,17 +19,50 @@
 
 #pragma once
 
+#include <atomic>
+
+#include "mbutil/delete.h"
+
 #include "util/roms.h"
 
 namespace mb
 {
 
+enum class WipeTarget : uint8_t
+{
+    System,
+    Cache,
+    Data,
+    DalvikCache,
+    Multiboot,
+};
+
+struct WipeProgress
+{
+    // Entries deleted by all targets
+    util::DeleteProgress deleted;
+    // Targets that have finished (successfully or not)
+    std::atomic<unsigned int> targets_done{0};
+};
+
 bool wipe_directory(const std::string &directory,
-                    const std::vector<std::string> &exclusions);
-bool wipe_system(const std::shared_ptr<Rom> &rom);
-bool wipe_cache(const std::shared_ptr<Rom> &rom);
-bool wipe_data(const std::shared_ptr<Rom> &rom);
-bool wipe_dalvik_cache(const std::shared_ptr<Rom> &rom);
-bool wipe_multiboot(const std::shared_ptr<Rom> &rom);
+                    const std::vector<std::string> &exclusions,
+                    util::DeleteProgress *progress = nullptr);
+bool prune_directory(const std::string &directory,
+                     const std::vector<std::string> &exclusions,
+                     const std::vector<std::string> &keep);
+bool wipe_system(const std::shared_ptr<Rom> &rom,
+                 util::DeleteProgress *progress = nullptr);
+bool wipe_cache(const std::shared_ptr<Rom> &rom,
+                util::DeleteProgress *progress = nullptr);
+bool wipe_data(const std::shared_ptr<Rom> &rom,
+               util::DeleteProgress *progress = nullptr);
+bool wipe_dalvik_cache(const std::shared_ptr<Rom> &rom,
+                       util::DeleteProgress *progress = nullptr);
+bool wipe_multiboot(const std::shared_ptr<Rom> &rom,
+                    util::DeleteProgress *progress = nullptr);
+std::vector<bool> wipe_rom(const std::shared_ptr<Rom> &rom,
+                           const std::vector<WipeTarget> &targets,
+                           WipeProgress *progress = nullptr);
 
 }
@@ -21,6 +21,7 @@
 
 #include <algorithm>
 #include <chrono>
+#include <string_view>
 #include <thread>
 
 #include <cassert>
@@ -30,8 +31,8 @@
 
 #include <fcntl.h>
 #include <getopt.h>
-#include <poll.h>
 #include <signal.h>
+#include <sys/epoll.h>
 #include <sys/mount.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
@@ -61,6 +62,7 @@
 #include "boot/appsyncmanager.h"
 #include "boot/packages.h"
 #include "util/multiboot.h"
+#include "util/patch_cache.h"
 #include "util/romconfig.h"
 #include "util/roms.h"
 
@@ -81,6 +83,12 @@
 #define INSTALLD_SOCKET_CONTEXT         "u:object_r:installd_socket:s0"
 
 #define COMMAND_BUF_SIZE                1024
+// Number of bytes read from each command to check if it should be hooked
+#define COMMAND_NAME_READ_SIZE          32
+// Maximum number of reply bytes to forward per event
+#define REPLY_SPLICE_SIZE               65536
+// Number of commands between latency reports
+#define LATENCY_REPORT_INTERVAL         100
 
 #define PACKAGES_XML_PATH_FMT           "%s/system/packages.xml"
 
@@ -125,7 +133,9 @@ static bool load_config_files()
             LOGW("%s: Failed to load config for ROM %s",
                  config_path.c_str(), rom->id.c_str());
         }
-        if (!rom_packages.load_xml(packages_path)) {
+        if (!rom_packages.load_cached(
+                packages_path, patch_cache_path("packages_" + rom->id + ".bin"),
+                PackagesLoadFlag::SkipSigs)) {
             LOGW("%s: Failed to load packages for ROM %s",
                  packages_path.c_str(), rom->id.c_str());
         }
@@ -146,6 +156,8 @@ static bool load_config_files()
         LOGD("[Config] - Package:                 %s", pkg.pkg_id.c_str());
         LOGD("[Config] - Share data:              %s",
              pkg.share_data ? "true" : "false");
+        LOGD("[Config] - Share APK:               %s",
+             pkg.share_apk ? "true" : "false");
     }
 
     return true;
@@ -216,6 +228,11 @@ static bool prepare_appsync()
             LOGW("Failed to mount shared data directory");
             shared_pkg.share_data = false;
         }
+
+        if (shared_pkg.share_apk && !AppSyncManager::sync_shared_apk(*pkg)) {
+            LOGW("Failed to sync shared APKs");
+            shared_pkg.share_apk = false;
+        }
     }
 
     stop = steady_clock::now();
@@ -298,81 +315,6 @@ static int create_new_socket()
     return fd;
 }
 
-/*
- * Socket messages are prefixed with 16-bit unsigned value (little-endian)
- * indicating the number of bytes that follow. The data should be treated as
- * a string and a null terminator must be added to the end.
- */
-
-/*!
- * \brief Receive a message from a socket
- */
-static bool receive_message(int fd, char *buf, std::size_t size,
-                            bool is_async, int &async_id)
-{
-    if (is_async) {
-        auto ret = util::socket_read_int32(fd);
-        if (!ret) {
-            LOGE("Failed to receive async command ID: %s",
-                 ret.error().message().c_str());
-            return false;
-        }
-        async_id = ret.value();
-    }
-
-    auto count = util::socket_read_uint16(fd);
-    if (!count) {
-        LOGE("Failed to read command size: %s",
-             count.error().message().c_str());
-        return false;
-    }
-
-    if (count.value() < 1 || count.value() >= size) {
-        LOGE("Invalid size %u", count.value());
-        return false;
-    }
-
-    if (auto ret = util::socket_read(fd, buf, count.value());
-            !ret || ret.value() != count.value()) {
-        LOGE("Failed to read command: %s", ret.error().message().c_str());
-        return false;
-    }
-
-    buf[count.value()] = 0;
-
-    return true;
-}
-
-/*!
- * \brief Send a message to a socket
- */
-static bool send_message(int fd, const char *command,
-                         bool is_async, int async_id)
-{
-    auto count = static_cast<uint16_t>(strlen(command));
-
-    if (is_async) {
-        if (auto ret = util::socket_write_int32(fd, async_id); !ret) {
-            LOGE("Failed to write async command ID: %s",
-                 ret.error().message().c_str());
-            return false;
-        }
-    }
-
-    if (auto ret = util::socket_write_uint16(fd, count); !ret) {
-        LOGE("Failed to write command size: %s", ret.error().message().c_str());
-        return false;
-    }
-
-    if (auto ret = util::socket_write(fd, command, count);
-            !ret || ret.value() != count) {
-        LOGE("Failed to write command: %s", ret.error().message().c_str());
-        return false;
-    }
-
-    return true;
-}
-
 /*!
  * \brief Connect to the installd socket at INSTALLD_SOCKET_PATH
  *
@@ -480,12 +422,12 @@ static bool do_remove(const std::vector<std::string> &args)
 
     for (auto it = config.shared_pkgs.begin();
             it != config.shared_pkgs.end(); ++it) {
-        const SharedPackage &shared_pkg = *it;
-
-        if (shared_pkg.pkg_id != pkgname) {
+        if (it->pkg_id != pkgname) {
             continue;
         }
 
+        SharedPackage shared_pkg = *it;
+
         // Need to remove from the shared_pkgs list to prevent the linklib hook
         // from triggering if the user decides to reinstall a package that was
         // previously shared.
@@ -502,6 +444,14 @@ static bool do_remove(const std::vector<std::string> &args)
             LOGD(TAG "Data is not shared");
         }
 
+        // Read-only APK mounts would prevent the code path from being removed
+        if (shared_pkg.share_apk) {
+            LOGV(TAG "Attempting to unmount shared APKs");
+            if (!AppSyncManager::unmount_shared_apks(pkgname)) {
+                return false;
+            }
+        }
+
         return true;
     }
 
@@ -538,173 +488,404 @@ static void handle_command(const std::vector<std::string> &args)
     }
 }
 
-static bool handle_installd_event(int client_fd, int installd_fd,
-                                  bool is_async)
+static bool is_hooked_command(std::string_view name)
 {
-    // Use the same buffer size as installd
-    char buf[COMMAND_BUF_SIZE];
+    return std::any_of(std::begin(cmds), std::end(cmds),
+                       [&](const CommandInfo &cmd) {
+        return name == cmd.name;
+    });
+}
 
-    int async_id;
+struct LatencyCounter
+{
+    uint64_t count = 0;
+    nanoseconds total{0};
+    nanoseconds max{0};
+
+    void add(nanoseconds duration)
+    {
+        ++count;
+        total += duration;
+        max = std::max(max, duration);
+    }
 
-    auto start = steady_clock::now();
+    void log(const char *name) const
+    {
+        if (count == 0) {
+            return;
+        }
 
-    auto start_installd = steady_clock::now();
-    if (!receive_message(
-            installd_fd, buf, sizeof(buf), is_async, async_id)) {
-        LOGE("Failed to receive reply from installd");
-        return false;
+        LOGD("- %-8s %8" PRIu64 " messages, avg %6" PRIu64 "us, max %6" PRIu64 "us",
+             name, count,
+             static_cast<uint64_t>(
+                     duration_cast<microseconds>(total).count()) / count,
+             static_cast<uint64_t>(
+                     duration_cast<microseconds>(max).count()));
     }
-    auto stop_installd = steady_clock::now();
+};
 
-    std::vector<std::string> args = parse_args(buf);
-    LOGD("Received async (probably) reply: %s", args_to_string(args).c_str());
+/*!
+ * \brief Time spent in the proxy for each connection
+ *
+ * This excludes the time that installd takes to process the commands, so it
+ * shows how much latency the proxy itself adds.
+ */
+struct ProxyStats
+{
+    // Forwarding commands to installd (excluding hooks)
+    LatencyCounter requests;
+    // Forwarding replies to the client
+    LatencyCounter replies;
+    // Running the hooks for commands that affect shared apps
+    LatencyCounter hooks;
+
+    void log() const
+    {
+        LOGD("Proxy latency:");
+        requests.log("Requests");
+        replies.log("Replies");
+        hooks.log("Hooks");
+    }
+};
 
-    auto start_send = steady_clock::now();
-    if (!send_message(client_fd, buf, is_async, async_id)) {
-        LOGE("Failed to send reply to client");
-        return false;
+/*!
+ * \brief Move data between two sockets
+ *
+ * The data is spliced through a pipe, so it is never copied to userspace. If
+ * the kernel can't splice the sockets, the data is copied through a buffer
+ * instead.
+ */
+class SocketForwarder
+{
+public:
+    SocketForwarder() : m_pipe{-1, -1}, m_splice(true)
+    {
+        if (pipe2(m_pipe, O_CLOEXEC) < 0) {
+            LOGW("Failed to create pipe; copying data instead of splicing: %s",
+                 strerror(errno));
+            m_splice = false;
+        }
     }
-    auto stop_send = steady_clock::now();
 
-    auto stop = steady_clock::now();
+    ~SocketForwarder()
+    {
+        for (int fd : m_pipe) {
+            if (fd >= 0) {
+                close(fd);
+            }
+        }
+    }
 
-    LOGD("Command stats:");
-    LOGD("- Time to send result back to client:  %" PRIu64 "ms",
-         static_cast<uint64_t>(duration_cast<milliseconds>(
-                stop_send - start_send).count()));
-    LOGD("- Time to receive reply from installd: %" PRIu64 "ms",
-         static_cast<uint64_t>(duration_cast<milliseconds>(
-                stop_installd - start_installd).count()));
-    LOGD("- Time to complete entire proxy logic: %" PRIu64 "ms",
-         static_cast<uint64_t>(duration_cast<milliseconds>(
-                stop - start).count()));
-    LOGD("---");
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(SocketForwarder)
+
+    /*!
+     * \brief Forward up to \p size bytes that are available to read
+     *
+     * \return Number of bytes forwarded, 0 on EOF, or -1 with errno set on
+     *         error
+     */
+    ssize_t forward(int in_fd, int out_fd, size_t size)
+    {
+        if (m_splice) {
+            ssize_t n = splice_data(in_fd, out_fd, size);
+            if (n >= 0 || errno != EINVAL) {
+                return n;
+            }
 
-    return true;
-}
+            LOGW("Sockets can't be spliced; copying data instead");
+            m_splice = false;
+        }
+
+        return copy_data(in_fd, out_fd, size);
+    }
+
+    /*!
+     * \brief Forward exactly \p size bytes
+     *
+     * \return Whether all of the data was forwarded. errno is set on failure.
+     */
+    bool forward_exact(int in_fd, int out_fd, size_t size)
+    {
+        while (size > 0) {
+            ssize_t n = forward(in_fd, out_fd, size);
+            if (n < 0) {
+                return false;
+            } else if (n == 0) {
+                errno = ECONNRESET;
+                return false;
+            }
+
+            size -= static_cast<size_t>(n);
+        }
+
+        return true;
+    }
+
+private:
+    ssize_t splice_data(int in_fd, int out_fd, size_t size)
+    {
+        ssize_t n;
+
+        do {
+            n = splice(in_fd, nullptr, m_pipe[1], nullptr, size,
+                       SPLICE_F_MOVE);
+        } while (n < 0 && errno == EINTR);
 
-static bool handle_android_event(int client_fd, int installd_fd,
-                                 bool can_appsync, bool is_async)
+        if (n <= 0) {
+            return n;
+        }
+
+        for (ssize_t remain = n; remain > 0;) {
+            ssize_t m = splice(m_pipe[0], nullptr, out_fd, nullptr,
+                               static_cast<size_t>(remain), SPLICE_F_MOVE);
+            if (m < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                // The data is stuck in the pipe, so there's no falling back
+                // to copying
+                if (errno == EINVAL) {
+                    errno = EIO;
+                }
+                return -1;
+            }
+
+            remain -= m;
+        }
+
+        return n;
+    }
+
+    ssize_t copy_data(int in_fd, int out_fd, size_t size)
+    {
+        char buf[4096];
+        ssize_t n;
+
+        do {
+            n = read(in_fd, buf, std::min(size, sizeof(buf)));
+        } while (n < 0 && errno == EINTR);
+
+        if (n <= 0) {
+            return n;
+        }
+
+        if (auto r = util::socket_write(out_fd, buf, static_cast<size_t>(n));
+                !r) {
+            errno = r.error().value();
+            return -1;
+        } else if (r.value() != static_cast<size_t>(n)) {
+            errno = EIO;
+            return -1;
+        }
+
+        return n;
+    }
+
+    int m_pipe[2];
+    bool m_splice;
+};
+
+struct ProxyConnection
 {
-    // Use the same buffer size as installd
-    char buf[COMMAND_BUF_SIZE];
+    int client_fd;
+    int installd_fd;
+    bool can_appsync;
+    bool is_async;
+    SocketForwarder forwarder;
+    ProxyStats stats;
+};
 
-    steady_clock::time_point start_hook, stop_hook;
+/*
+ * Socket messages are prefixed with 16-bit unsigned value (little-endian)
+ * indicating the number of bytes that follow. The data should be treated as
+ * a string and a null terminator must be added to the end.
+ */
+
+/*!
+ * \brief Forward a command from the client to installd
+ *
+ * Only the beginning of the command is read to check its name. If the command
+ * doesn't need to be hooked, the rest of it is spliced to installd as is.
+ */
+static bool forward_request(ProxyConnection &conn)
+{
+    auto start = steady_clock::now();
 
-    int async_id;
+    // [int32 async ID (async installd only)] [uint16 size]
+    unsigned char header[sizeof(int32_t) + sizeof(uint16_t)];
+    size_t header_size = conn.is_async ? sizeof(header) : sizeof(uint16_t);
 
-    if (!receive_message(client_fd, buf, sizeof(buf), is_async, async_id)) {
-        LOGE("Failed to receive request from client");
+    auto n = util::socket_read(conn.client_fd, header, header_size);
+    if (!n) {
+        LOGE("Failed to read command header: %s",
+             n.error().message().c_str());
+        return false;
+    } else if (n.value() == 0) {
+        LOGD("Client closed the connection");
+        return false;
+    } else if (n.value() != header_size) {
+        LOGE("Connection closed before command header was received");
         return false;
     }
 
-    auto start = steady_clock::now();
+    uint16_t size;
+    memcpy(&size, header + header_size - sizeof(size), sizeof(size));
+
+    if (size < 1 || size >= COMMAND_BUF_SIZE) {
+        LOGE("Invalid size %u", size);
+        return false;
+    }
+
+    // Use the same buffer size as installd
+    char buf[COMMAND_BUF_SIZE];
+    size_t have = 0;
+    bool hook = false;
+
+    if (conn.can_appsync) {
+        // Read enough to identify any hooked command. If the name is longer
+        // than that, the truncated name won't match anything.
+        have = std::min<size_t>(size, COMMAND_NAME_READ_SIZE);
+
+        if (auto r = util::socket_read(conn.client_fd, buf, have);
+                !r || r.value() != have) {
+            LOGE("Failed to read command: %s",
+                 r ? "Unexpected EOF" : r.error().message().c_str());
+            return false;
+        }
 
-    std::vector<std::string> args = parse_args(buf);
+        std::string_view prefix(buf, have);
+        hook = is_hooked_command(prefix.substr(0, prefix.find(' ')));
+    }
 
-    bool log_result = true;
+    nanoseconds hook_time{0};
 
-    if (args.empty()) {
-        LOGE("Invalid command (empty message)");
-    } else {
-        const std::string &cmd = args[0];
-
-        if (cmd == "ping"
-                || cmd == "freecache") {
-            LOGD("Received unimportant command: [%s, ...]", cmd.c_str());
-        } else if (cmd == "aapt"
-                || cmd == "aapt_with_common") {
-            LOGD("Received CyanogenMod-specific command: %s",
-                 args_to_string(args).c_str());
-        } else if (cmd == "rmrcl"
-                || cmd == "asyncDexopt"
-                || cmd == "changeDexOwner") {
-            LOGD("Received Touchwiz-specific command: %s",
-                 args_to_string(args).c_str());
-            if (cmd == "asyncDexopt") {
-                LOGD("Expecting future installd reply for 'asyncDexopt'");
-            }
-        } else if (cmd == "getsize") {
-            // Get size is so annoying we don't want it to show... EVER!
-            log_result = false;
-        } else if (cmd == "install"
-                || cmd == "dexopt"
-                || cmd == "markbootcomplete"
-                || cmd == "movedex"
-                || cmd == "rmdex"
-                || cmd == "remove"
-                || cmd == "rename"
-                || cmd == "fixuid"
-                || cmd == "rmcache"
-                || cmd == "rmcodecache"
-                || cmd == "rmuserdata"
-                || cmd == "movefiles"
-                || cmd == "linklib"
-                || cmd == "mkuserdata"
-                || cmd == "mkuserconfig"
-                || cmd == "rmuser"
-                || cmd == "idmap"
-                || cmd == "restorecondata"
-                || cmd == "patchoat") {
-            LOGD("Received command: %s", args_to_string(args).c_str());
-
-            if (can_appsync) {
-                start_hook = steady_clock::now();
-                handle_command(args);
-                stop_hook = steady_clock::now();
-            }
-        } else {
-            LOGW("Unrecognized command: %s", args_to_string(args).c_str());
+    if (hook) {
+        if (auto r = util::socket_read(conn.client_fd, buf + have,
+                                       size - have);
+                !r || r.value() != size - have) {
+            LOGE("Failed to read command: %s",
+                 r ? "Unexpected EOF" : r.error().message().c_str());
+            return false;
         }
+        buf[size] = '\0';
+        have = size;
+
+        std::vector<std::string> args = parse_args(buf);
+        LOGD("Received command: %s", args_to_string(args).c_str());
+
+        auto start_hook = steady_clock::now();
+        handle_command(args);
+        hook_time = steady_clock::now() - start_hook;
+
+        conn.stats.hooks.add(hook_time);
     }
 
-    auto start_installd = steady_clock::now();
-    if (!send_message(installd_fd, buf, is_async, async_id)) {
-        LOGE("Failed to send request to installd");
+    // Send the header and whatever was read of the command with a single
+    // syscall
+    util::SocketWriter writer;
+    writer.write(header, header_size);
+    writer.write(buf, have);
+
+    if (auto r = writer.flush(conn.installd_fd); !r) {
+        LOGE("Failed to send command to installd: %s",
+             r.error().message().c_str());
         return false;
     }
-    if (!receive_message(
-            installd_fd, buf, sizeof(buf), is_async, async_id)) {
-        LOGE("Failed to receive reply from installd");
+
+    if (!conn.forwarder.forward_exact(
+            conn.client_fd, conn.installd_fd, size - have)) {
+        LOGE("Failed to forward command to installd: %s", strerror(errno));
         return false;
     }
-    auto stop_installd = steady_clock::now();
 
-    args = parse_args(buf);
+    conn.stats.requests.add(steady_clock::now() - start - hook_time);
 
-    if (log_result) {
-        LOGD("Sending reply: %s", args_to_string(args).c_str());
+    if (conn.stats.requests.count % LATENCY_REPORT_INTERVAL == 0) {
+        conn.stats.log();
     }
 
-    auto start_send = steady_clock::now();
-    if (!send_message(client_fd, buf, is_async, async_id)) {
-        LOGE("Failed to send reply to client");
+    return true;
+}
+
+/*!
+ * \brief Forward replies from installd to the client
+ *
+ * Replies are never inspected, so whatever is available is spliced to the
+ * client without regard to message boundaries.
+ */
+static bool forward_reply(ProxyConnection &conn)
+{
+    auto start = steady_clock::now();
+
+    ssize_t n = conn.forwarder.forward(
+            conn.installd_fd, conn.client_fd, REPLY_SPLICE_SIZE);
+    if (n < 0) {
+        LOGE("Failed to forward reply to client: %s", strerror(errno));
+        return false;
+    } else if (n == 0) {
+        LOGD("installd closed the connection");
         return false;
     }
-    auto stop_send = steady_clock::now();
 
-    auto stop = steady_clock::now();
+    conn.stats.replies.add(steady_clock::now() - start);
 
-    if (log_result) {
-        LOGD("Command stats:");
-        LOGD("- Time to send result back to client:  %" PRIu64 "ms",
-             static_cast<uint64_t>(duration_cast<milliseconds>(
-                    stop_send - start_send).count()));
-        LOGD("- Time to complete installd command:   %" PRIu64 "ms",
-             static_cast<uint64_t>(duration_cast<milliseconds>(
-                    stop_installd - start_installd).count()));
-        if (can_appsync) {
-            LOGD("- Time to hook installd command:       %" PRIu64 "ms",
-                 static_cast<uint64_t>(duration_cast<milliseconds>(
-                        stop_hook - start_hook).count()));
+    return true;
+}
+
+/*!
+ * \brief Proxy a client connection until either side disconnects
+ *
+ * Requests and replies are forwarded independently from an epoll event loop,
+ * so a reply from installd never waits for the proxy to finish reading the
+ * next request (or vice versa).
+ */
+static void proxy_connection(ProxyConnection &conn)
+{
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0) {
+        LOGE("Failed to create epoll instance: %s", strerror(errno));
+        return;
+    }
+
+    auto close_epoll_fd = finally([&] {
+        close(epoll_fd);
+    });
+
+    for (int fd : { conn.client_fd, conn.installd_fd }) {
+        epoll_event ev = {};
+        ev.events = EPOLLIN;
+        ev.data.fd = fd;
+
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            LOGE("Failed to add socket to epoll instance: %s",
+                 strerror(errno));
+            return;
         }
-        LOGD("- Time to complete entire proxy logic: %" PRIu64 "ms",
-             static_cast<uint64_t>(duration_cast<milliseconds>(
-                    stop - start).count()));
-        LOGD("---");
     }
 
-    return true;
+    while (true) {
+        epoll_event events[2];
+
+        int n = epoll_wait(epoll_fd, events, 2, -1);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            LOGE("Failed to wait for events: %s", strerror(errno));
+            return;
+        }
+
+        for (int i = 0; i < n; ++i) {
+            // Reading detects EOF and errors, so hangups don't need special
+            // handling
+            bool ret = events[i].data.fd == conn.client_fd
+                    ? forward_request(conn)
+                    : forward_reply(conn);
+            if (!ret) {
+                return;
+            }
+        }
+    }
 }
 
 /**
@@ -727,6 +908,11 @@ static bool handle_android_event(int client_fd, int installd_fd,
  */
 static bool proxy_process(int fd, bool can_appsync)
 {
+    // Report EPIPE instead of dying if either side goes away while data is
+    // being forwarded. This is done after installd is spawned so that it
+    // doesn't inherit the ignored disposition.
+    signal(SIGPIPE, SIG_IGN);
+
     while (true) {
         int client_fd = accept4(fd, nullptr, nullptr, SOCK_CLOEXEC);
         if (client_fd < 0) {
@@ -753,8 +939,6 @@ static bool proxy_process(int fd, bool can_appsync)
         });
 
         // Check if we're using some variant of the CyanogenMood async installd
-        // NOTE: We'll effectively make the connection sychronous because we
-        //       always wait for a reply before receiving the next command.
         // See: https://github.com/CyanogenMod/android_frameworks_native/commit/8124b181d4b5a3a44796fdb0e3ea4e4171f102c7
         bool is_async = false;
         if (auto r = util::file_find_one_of(INSTALLD_PATH,
@@ -765,30 +949,12 @@ static bool proxy_process(int fd, bool can_appsync)
 
         LOGD("---");
 
-        pollfd fds[2] = {};
-        fds[0].fd = client_fd;
-        fds[0].events = POLLIN;
-        fds[1].fd = installd_fd;
-        fds[1].events = POLLIN;
-
-        while (true) {
-            fds[0].revents = 0;
-            fds[1].revents = 1;
+        ProxyConnection conn{client_fd, installd_fd, can_appsync, is_async,
+                             {}, {}};
 
-            if (poll(fds, 2, -1) < 0) {
-                LOGE("Failed to poll() fds: %s", strerror(errno));
-                break;
-            }
+        proxy_connection(conn);
 
-            if (fds[0].revents & POLLIN && !handle_android_event(
-                    client_fd, installd_fd, can_appsync, is_async)) {
-                break;
-            }
-            if (fds[1].revents & POLLIN && !handle_installd_event(
-                    client_fd, installd_fd, is_async)) {
-                break;
-            }
-        }
+        conn.stats.log();
     }
 }
 
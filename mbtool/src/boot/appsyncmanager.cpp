@@ -20,28 +20,59 @@
 #include "boot/appsyncmanager.h"
 
 #include <algorithm>
+#include <optional>
+#include <unordered_map>
+#include <vector>
 
 #include <cerrno>
+#include <cinttypes>
+#include <cstring>
 
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
 #include <sys/mount.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include "mbcommon/error_code.h"
+#include "mbcommon/finally.h"
+#include "mbcommon/integer.h"
+#include "mbcommon/string.h"
 #include "mblog/logging.h"
 #include "mbutil/chown.h"
+#include "mbutil/copy.h"
+#include "mbutil/delete.h"
 #include "mbutil/directory.h"
+#include "mbutil/file.h"
 #include "mbutil/fts.h"
 #include "mbutil/selinux.h"
 
 #define LOG_TAG "mbtool/boot/appsyncmanager"
 
 #define APP_SHARING_DATA_DIR            "/data/multiboot/_appsharing/data"
+#define APP_SHARING_APK_DIR             "/data/multiboot/_appsharing/apk"
+
+// Max mtime (in ms) of the APKs in a shared APK directory
+#define SHARED_APK_TIMESTAMP_FILE       ".timestamp"
 
 #define USER_DATA_DIR                   "/data/data"
 
+#ifndef FICLONE
+#  define FICLONE _IOW(0x94, 9, int)
+#endif
+
 static std::string _as_data_dir;
+static std::string _as_apk_dir;
 static std::string _user_data_dir;
 
+// Cleared after the first reflink fails because the filesystem doesn't
+// support it. Shared APKs are bind mounted from then on.
+static bool _reflink_supported = true;
+
+// APK bind mounts made by sync_shared_apk(), by package
+static std::unordered_map<std::string, std::vector<std::string>> _apk_mounts;
+
 namespace mb
 {
 
@@ -75,12 +106,168 @@ public:
     }
 };
 
+/*!
+ * \brief List the APKs in a package's code directory
+ *
+ * \return Sorted file names of the regular files ending in ".apk"
+ */
+static oc::result<std::vector<std::string>> list_apks(const std::string &dir)
+{
+    DIR *dp = opendir(dir.c_str());
+    if (!dp) {
+        return ec_from_errno();
+    }
+
+    auto close_dp = finally([&] {
+        closedir(dp);
+    });
+
+    std::vector<std::string> names;
+    struct dirent *ent;
+
+    while ((errno = 0, ent = readdir(dp))) {
+        if (ent->d_type == DT_REG && ends_with(ent->d_name, ".apk")) {
+            names.push_back(ent->d_name);
+        }
+    }
+    if (errno != 0) {
+        return ec_from_errno();
+    }
+
+    std::sort(names.begin(), names.end());
+
+    return std::move(names);
+}
+
+/*!
+ * \brief Get the latest mtime of the APKs in a directory
+ *
+ * This matches how the package manager computes PackageSetting.timeStamp for
+ * packages with split APKs.
+ *
+ * \return Timestamp in milliseconds
+ */
+static oc::result<uint64_t> apks_timestamp(const std::string &dir,
+                                           const std::vector<std::string> &apks)
+{
+    uint64_t timestamp = 0;
+
+    for (auto const &apk : apks) {
+        struct stat sb;
+        if (stat((dir + "/" + apk).c_str(), &sb) < 0) {
+            return ec_from_errno();
+        }
+
+        auto ms = static_cast<uint64_t>(sb.st_mtim.tv_sec) * 1000
+                + static_cast<uint64_t>(sb.st_mtim.tv_nsec) / 1000000;
+        timestamp = std::max(timestamp, ms);
+    }
+
+    return timestamp;
+}
+
+static bool is_reflink_unsupported(const std::error_code &ec)
+{
+    return ec == std::errc::operation_not_supported
+            || ec == std::errc::inappropriate_io_control_operation
+            || ec == std::errc::invalid_argument
+            || ec == std::errc::cross_device_link;
+}
+
+/*!
+ * \brief Replace a file with a copy of another file
+ *
+ * The copy gets the owner, mode, xattrs (including the SELinux label), and
+ * timestamps of the source. It is written to a temporary file, which is then
+ * renamed over \p target.
+ *
+ * \param reflink_only If true, fail instead of copying the data when the
+ *                     filesystem cannot share the source's extents
+ */
+static oc::result<void> clone_file(const std::string &source,
+                                   const std::string &target,
+                                   bool reflink_only)
+{
+    std::string temp(target);
+    temp += ".mbtmp";
+
+    int fd_source = open(source.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd_source < 0) {
+        return ec_from_errno();
+    }
+
+    auto close_source_fd = finally([&] {
+        close(fd_source);
+    });
+
+    unlink(temp.c_str());
+
+    int fd_target = open(temp.c_str(),
+                         O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    if (fd_target < 0) {
+        return ec_from_errno();
+    }
+
+    bool renamed = false;
+
+    auto close_target_fd = finally([&] {
+        if (fd_target >= 0) {
+            close(fd_target);
+        }
+        if (!renamed) {
+            unlink(temp.c_str());
+        }
+    });
+
+    if (ioctl(fd_target, FICLONE, fd_source) < 0) {
+        if (reflink_only) {
+            return ec_from_errno();
+        }
+        OUTCOME_TRYV(util::copy_data_fd(fd_source, fd_target));
+    }
+
+    struct stat sb;
+    if (fstat(fd_source, &sb) < 0) {
+        return ec_from_errno();
+    }
+
+    // The owner must be set before the xattrs since changing it clears
+    // security.capability
+    if (fchown(fd_target, sb.st_uid, sb.st_gid) < 0
+            || fchmod(fd_target, sb.st_mode & static_cast<mode_t>(~S_IFMT)) < 0) {
+        return ec_from_errno();
+    }
+
+    OUTCOME_TRYV(util::copy_xattrs_fd(fd_source, fd_target));
+
+    // The package manager compares the mtime against PackageSetting.timeStamp
+    struct timespec times[2] = { sb.st_atim, sb.st_mtim };
+    if (futimens(fd_target, times) < 0) {
+        return ec_from_errno();
+    }
+
+    int ret = close(fd_target);
+    fd_target = -1;
+    if (ret < 0) {
+        return ec_from_errno();
+    }
+
+    if (rename(temp.c_str(), target.c_str()) < 0) {
+        return ec_from_errno();
+    }
+    renamed = true;
+
+    return oc::success();
+}
+
 void AppSyncManager::detect_directories()
 {
     _as_data_dir = get_raw_path(APP_SHARING_DATA_DIR);
+    _as_apk_dir = get_raw_path(APP_SHARING_APK_DIR);
     _user_data_dir = USER_DATA_DIR;
 
     LOGD("App sharing app data directory: %s", _as_data_dir.c_str());
+    LOGD("App sharing APK directory:      %s", _as_apk_dir.c_str());
     LOGD("User app data directory:        %s", _user_data_dir.c_str());
 }
 
@@ -95,13 +282,26 @@ std::string AppSyncManager::get_shared_data_path(const std::string &pkg)
     return path;
 }
 
+/*!
+ * \brief Get shared APK path for a package
+ */
+std::string AppSyncManager::get_shared_apk_path(const std::string &pkg)
+{
+    std::string path(_as_apk_dir);
+    path += "/";
+    path += pkg;
+    return path;
+}
+
 bool AppSyncManager::initialize_directories()
 {
-    if (auto r = util::mkdir_recursive(_as_data_dir, 0751);
-            !r && r.error() != std::errc::file_exists) {
-        LOGW("%s: Failed to create directory: %s", _as_data_dir.c_str(),
-             r.error().message().c_str());
-        return false;
+    for (auto const &dir : {_as_data_dir, _as_apk_dir}) {
+        if (auto r = util::mkdir_recursive(dir, 0751);
+                !r && r.error() != std::errc::file_exists) {
+            LOGW("%s: Failed to create directory: %s", dir.c_str(),
+                 r.error().message().c_str());
+            return false;
+        }
     }
 
     return true;
@@ -125,7 +325,8 @@ bool AppSyncManager::create_shared_data_directory(const std::string &pkg, uid_t
     }
 
     if (auto r = util::chown(
-            data_path, uid, uid, util::ChownFlag::Recursive); !r) {
+            data_path, uid, uid,
+            util::ChownFlag::Recursive | util::ChownFlag::Parallel); !r) {
         LOGW("[%s] %s: Failed to chown: %s",
              pkg.c_str(), data_path.c_str(), r.error().message().c_str());
         return false;
@@ -142,8 +343,8 @@ bool AppSyncManager::fix_shared_data_permissions()
         context.swap(ret.value());
     }
 
-    if (auto ret = util::selinux_lset_context_recursive(
-            _as_data_dir, context); !ret) {
+    if (auto ret = util::selinux_relabel_recursive(
+            _as_data_dir, context, util::SELinuxRelabelFlag::Parallel); !ret) {
         LOGW("%s: Failed to set context recursively to %s: %s",
              _as_data_dir.c_str(), context.c_str(),
              ret.error().message().c_str());
@@ -165,7 +366,8 @@ bool AppSyncManager::mount_shared_directory(const std::string &pkg, uid_t uid)
              pkg.c_str(), target.c_str(), r.error().message().c_str());
         return false;
     }
-    if (auto r = util::chown(target, uid, uid, util::ChownFlag::Recursive); !r) {
+    if (auto r = util::chown(target, uid, uid, util::ChownFlag::Recursive
+                                                | util::ChownFlag::Parallel); !r) {
         LOGW("[%s] %s: Failed to chown: %s",
              pkg.c_str(), target.c_str(), r.error().message().c_str());
         return false;
@@ -200,4 +402,266 @@ bool AppSyncManager::unmount_shared_directory(const std::string &pkg)
     return true;
 }
 
+static std::optional<uint64_t> read_shared_apk_timestamp(const std::string &dir)
+{
+    auto line = util::file_first_line(dir + "/" SHARED_APK_TIMESTAMP_FILE);
+    if (!line) {
+        return std::nullopt;
+    }
+
+    uint64_t timestamp;
+    if (!str_to_num(line.value().c_str(), 10, timestamp)) {
+        return std::nullopt;
+    }
+
+    return timestamp;
+}
+
+/*!
+ * \brief Replace the shared APKs with the ones from this ROM
+ */
+static bool export_shared_apks(const std::string &pkg,
+                               const std::string &code_path,
+                               const std::vector<std::string> &apks,
+                               uint64_t timestamp)
+{
+    std::string shared_path = AppSyncManager::get_shared_apk_path(pkg);
+    std::string temp_path(shared_path);
+    temp_path += ".tmp";
+
+    LOGV("[%s] Exporting APKs to %s", pkg.c_str(), shared_path.c_str());
+
+    // Populate a new directory so that an interrupted export never leaves a
+    // mix of old and new APKs behind
+    (void) util::delete_recursive(temp_path);
+
+    if (mkdir(temp_path.c_str(), 0751) < 0) {
+        LOGW("[%s] %s: Failed to create directory: %s",
+             pkg.c_str(), temp_path.c_str(), strerror(errno));
+        return false;
+    }
+
+    for (auto const &apk : apks) {
+        // Shares extents with the ROM's copy where possible
+        if (auto r = clone_file(code_path + "/" + apk,
+                                temp_path + "/" + apk, false); !r) {
+            LOGW("[%s] %s: Failed to copy APK: %s",
+                 pkg.c_str(), apk.c_str(), r.error().message().c_str());
+            return false;
+        }
+    }
+
+    auto timestamp_str = format("%" PRIu64 "\n", timestamp);
+    if (auto r = util::file_write_data(
+            temp_path + "/" SHARED_APK_TIMESTAMP_FILE,
+            timestamp_str.data(), timestamp_str.size()); !r) {
+        LOGW("[%s] Failed to write timestamp: %s",
+             pkg.c_str(), r.error().message().c_str());
+        return false;
+    }
+
+    if (auto r = util::delete_recursive(shared_path);
+            !r && r.error().ec != std::errc::no_such_file_or_directory) {
+        LOGW("[%s] %s", pkg.c_str(), r.error().message().c_str());
+        return false;
+    }
+
+    if (rename(temp_path.c_str(), shared_path.c_str()) < 0) {
+        LOGW("[%s] %s: Failed to rename: %s",
+             pkg.c_str(), temp_path.c_str(), strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Replace this ROM's APKs with reflinked copies of the shared APKs
+ *
+ * \return Nothing if successful, std::errc::operation_not_supported if the
+ *         filesystem doesn't support reflinks, or the error otherwise
+ */
+static oc::result<void> reflink_shared_apks(const std::string &pkg,
+                                            const std::string &code_path,
+                                            const std::string &shared_path,
+                                            const std::vector<std::string> &apks)
+{
+    LOGV("[%s] Reflinking shared APKs into %s", pkg.c_str(), code_path.c_str());
+
+    for (auto const &apk : apks) {
+        if (auto r = clone_file(shared_path + "/" + apk,
+                                code_path + "/" + apk, true); !r) {
+            if (is_reflink_unsupported(r.error())) {
+                return std::errc::operation_not_supported;
+            }
+            LOGW("[%s] %s: Failed to reflink APK: %s",
+                 pkg.c_str(), apk.c_str(), r.error().message().c_str());
+            return r.as_failure();
+        }
+    }
+
+    return oc::success();
+}
+
+/*!
+ * \brief Bind mount the shared APKs read-only over this ROM's APKs
+ *
+ * The mounts only last until the next reboot. They are read-only so that the
+ * package manager can't modify the shared copies when it updates or removes
+ * the package.
+ */
+static bool bind_mount_shared_apks(const std::string &pkg,
+                                   const std::string &code_path,
+                                   const std::string &shared_path,
+                                   const std::vector<std::string> &apks)
+{
+    LOGV("[%s] Bind mounting shared APKs into %s",
+         pkg.c_str(), code_path.c_str());
+
+    auto &mounts = _apk_mounts[pkg];
+
+    for (auto const &apk : apks) {
+        std::string source(shared_path + "/" + apk);
+        std::string target(code_path + "/" + apk);
+
+        // Only existing files can be mounted over. Creating placeholders
+        // would break the package if the mounts are missing on a later boot.
+        if (access(target.c_str(), F_OK) < 0) {
+            LOGW("[%s] %s: Split APK not installed in this ROM",
+                 pkg.c_str(), apk.c_str());
+            return false;
+        }
+
+        if (mount(source.c_str(), target.c_str(), "", MS_BIND, "") < 0) {
+            LOGW("[%s] %s: Failed to bind mount: %s",
+                 pkg.c_str(), target.c_str(), strerror(errno));
+            return false;
+        }
+
+        mounts.push_back(target);
+
+        if (mount("", target.c_str(), "", MS_REMOUNT | MS_BIND | MS_RDONLY,
+                  "") < 0) {
+            LOGW("[%s] %s: Failed to remount as read-only: %s",
+                 pkg.c_str(), target.c_str(), strerror(errno));
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Synchronize a package's APKs with the shared copy
+ *
+ * The shared directory holds the newest APKs seen in any ROM along with their
+ * timestamp. If this ROM has newer APKs, they replace the shared ones.
+ * Otherwise, if this ROM's APKs are older, the shared APKs are reflinked into
+ * the package's code path, which costs no additional space or copying. If the
+ * filesystem doesn't support reflinks, the shared APKs are bind mounted
+ * instead.
+ *
+ * The APK mtimes are compared instead of PackageSetting.timeStamp because the
+ * package manager updates the latter to match bind mounted APKs, which no
+ * longer exist on the next boot. Packages whose APKs match the shared timestamp
+ * only cost a few stat() calls, so only apps updated since the last sync are
+ * touched.
+ */
+bool AppSyncManager::sync_shared_apk(const Package &pkg)
+{
+    auto const &code_path = pkg.code_path;
+
+    if (!starts_with(code_path, "/data/app/")) {
+        LOGW("[%s] %s: Not an installed app. APKs will not be shared",
+             pkg.name.c_str(), code_path.c_str());
+        return false;
+    }
+
+    auto apks = list_apks(code_path);
+    if (!apks) {
+        LOGW("[%s] %s: Failed to list APKs: %s", pkg.name.c_str(),
+             code_path.c_str(), apks.error().message().c_str());
+        return false;
+    } else if (apks.value().empty()) {
+        LOGW("[%s] %s: No APKs found", pkg.name.c_str(), code_path.c_str());
+        return false;
+    }
+
+    auto apks_ts = apks_timestamp(code_path, apks.value());
+    if (!apks_ts) {
+        LOGW("[%s] %s: Failed to stat APKs: %s", pkg.name.c_str(),
+             code_path.c_str(), apks_ts.error().message().c_str());
+        return false;
+    }
+
+    std::string shared_path = get_shared_apk_path(pkg.name);
+    auto shared_ts = read_shared_apk_timestamp(shared_path);
+
+    // This ROM has the newest version of the app (or is the first ROM to
+    // share it)
+    if (!shared_ts || apks_ts.value() > *shared_ts) {
+        return export_shared_apks(pkg.name, code_path, apks.value(),
+                                  apks_ts.value());
+    }
+
+    // Already in sync
+    if (apks_ts.value() == *shared_ts) {
+        LOGV("[%s] APKs are up to date", pkg.name.c_str());
+        return true;
+    }
+
+    auto shared_apks = list_apks(shared_path);
+    if (!shared_apks) {
+        LOGW("[%s] %s: Failed to list APKs: %s", pkg.name.c_str(),
+             shared_path.c_str(), shared_apks.error().message().c_str());
+        return false;
+    }
+
+    if (_reflink_supported) {
+        auto r = reflink_shared_apks(pkg.name, code_path, shared_path,
+                                     shared_apks.value());
+        if (r) {
+            return true;
+        } else if (r.error() != std::errc::operation_not_supported) {
+            return false;
+        }
+
+        LOGD("Reflinks are not supported. Falling back to bind mounts");
+        _reflink_supported = false;
+    }
+
+    if (!bind_mount_shared_apks(pkg.name, code_path, shared_path,
+                                shared_apks.value())) {
+        (void) unmount_shared_apks(pkg.name);
+        return false;
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Unmount the APK bind mounts made by sync_shared_apk()
+ */
+bool AppSyncManager::unmount_shared_apks(const std::string &pkg)
+{
+    auto it = _apk_mounts.find(pkg);
+    if (it == _apk_mounts.end()) {
+        return true;
+    }
+
+    bool ret = true;
+
+    for (auto const &target : it->second) {
+        if (umount2(target.c_str(), MNT_DETACH) < 0 && errno != EINVAL) {
+            LOGW("[%s] %s: Failed to unmount: %s",
+                 pkg.c_str(), target.c_str(), strerror(errno));
+            ret = false;
+        }
+    }
+
+    _apk_mounts.erase(it);
+
+    return ret;
+}
+
 }
@@ -0,0 +1,223 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "boot/boot_timing.h"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+
+#include <rapidjson/filewritestream.h>
+#include <rapidjson/writer.h>
+
+#include "mblog/logging.h"
+#include "mbutil/directory.h"
+
+#define LOG_TAG "mbtool/boot/boot_timing"
+
+// Maximum number of phases that can be recorded. Phases started after the
+// array is full are silently dropped.
+#define MAX_BOOT_PHASES 64
+
+typedef std::unique_ptr<FILE, decltype(fclose) *> ScopedFILE;
+
+namespace mb
+{
+
+struct BootPhase
+{
+    const char *name;
+    // CLOCK_MONOTONIC timestamps
+    uint64_t start_us;
+    uint64_t end_us;
+    // CLOCK_PROCESS_CPUTIME_ID timestamps
+    uint64_t cpu_start_us;
+    uint64_t cpu_end_us;
+    std::atomic_bool done;
+};
+
+static BootPhase g_phases[MAX_BOOT_PHASES];
+static std::atomic_int g_phase_count{0};
+
+static uint64_t clock_us(clockid_t clock)
+{
+    timespec ts;
+
+    if (clock_gettime(clock, &ts) < 0) {
+        return 0;
+    }
+
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000
+            + static_cast<uint64_t>(ts.tv_nsec) / 1000;
+}
+
+/*!
+ * \brief Start recording a boot phase
+ *
+ * \param name Name of the phase. Must be a string literal or otherwise outlive
+ *             the process (only the pointer is stored).
+ */
+BootTimer::BootTimer(const char *name)
+{
+    _index = g_phase_count.fetch_add(1, std::memory_order_relaxed);
+
+    if (_index >= MAX_BOOT_PHASES) {
+        _index = -1;
+        return;
+    }
+
+    auto &phase = g_phases[_index];
+    phase.name = name;
+    phase.cpu_start_us = clock_us(CLOCK_PROCESS_CPUTIME_ID);
+    phase.start_us = clock_us(CLOCK_MONOTONIC);
+}
+
+BootTimer::~BootTimer()
+{
+    stop();
+}
+
+/*!
+ * \brief Finish recording the boot phase
+ *
+ * Calling this more than once has no effect.
+ */
+void BootTimer::stop()
+{
+    if (_index < 0) {
+        return;
+    }
+
+    auto &phase = g_phases[_index];
+    phase.end_us = clock_us(CLOCK_MONOTONIC);
+    phase.cpu_end_us = clock_us(CLOCK_PROCESS_CPUTIME_ID);
+    phase.done.store(true, std::memory_order_release);
+
+    _index = -1;
+}
+
+static int recorded_phases()
+{
+    return std::min(g_phase_count.load(std::memory_order_relaxed),
+                    MAX_BOOT_PHASES);
+}
+
+/*!
+ * \brief Log the duration of all completed boot phases
+ *
+ * CPU times are for the whole process, so they include time spent by other
+ * threads (eg. the uevent thread) while the phase was running.
+ */
+void boot_timing_log()
+{
+    int count = recorded_phases();
+
+    LOGI("Boot timing (%d phases):", count);
+
+    for (int i = 0; i < count; ++i) {
+        auto const &phase = g_phases[i];
+
+        if (!phase.done.load(std::memory_order_acquire)) {
+            LOGI("- %s: still running", phase.name);
+            continue;
+        }
+
+        LOGI("- %s: %" PRIu64 "ms (CPU: %" PRIu64 "ms; start: %" PRIu64 "ms)",
+             phase.name, (phase.end_us - phase.start_us) / 1000,
+             (phase.cpu_end_us - phase.cpu_start_us) / 1000,
+             phase.start_us / 1000);
+    }
+}
+
+/*!
+ * \brief Write all completed boot phases to a JSON file
+ *
+ * The file contains a `phases` array where each entry has the phase `name`,
+ * the `start_us` and `end_us` CLOCK_MONOTONIC timestamps, and the process CPU
+ * time spent during the phase as `cpu_us`.
+ *
+ * \param path Output path (parent directories are created if needed)
+ *
+ * \return Whether the file was successfully written
+ */
+bool boot_timing_write_json(const std::string &path)
+{
+    using namespace rapidjson;
+
+    if (auto r = util::mkdir_parent(path, 0755); !r) {
+        LOGE("%s: Failed to create parent directory: %s",
+             path.c_str(), r.error().message().c_str());
+        return false;
+    }
+
+    ScopedFILE fp(fopen(path.c_str(), "we"), &fclose);
+    if (!fp) {
+        LOGE("%s: Failed to open for writing: %s",
+             path.c_str(), strerror(errno));
+        return false;
+    }
+
+    char buf[4096];
+    FileWriteStream os(fp.get(), buf, sizeof(buf));
+    Writer<FileWriteStream> writer(os);
+
+    writer.StartObject();
+    writer.Key("phases");
+    writer.StartArray();
+
+    for (int i = 0; i < recorded_phases(); ++i) {
+        auto const &phase = g_phases[i];
+
+        if (!phase.done.load(std::memory_order_acquire)) {
+            continue;
+        }
+
+        writer.StartObject();
+        writer.Key("name");
+        writer.String(phase.name);
+        writer.Key("start_us");
+        writer.Uint64(phase.start_us);
+        writer.Key("end_us");
+        writer.Uint64(phase.end_us);
+        writer.Key("cpu_us");
+        writer.Uint64(phase.cpu_end_us - phase.cpu_start_us);
+        writer.EndObject();
+    }
+
+    writer.EndArray();
+    writer.EndObject();
+    os.Flush();
+
+    if (fclose(fp.release()) != 0) {
+        LOGE("%s: Failed to close file: %s",
+             path.c_str(), strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+}
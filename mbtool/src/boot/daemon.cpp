@@ -21,11 +21,15 @@
 
 #include <algorithm>
 #include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
 #include <thread>
 
 #include <fcntl.h>
 #include <getopt.h>
 #include <sched.h>
+#include <sys/epoll.h>
 #include <sys/mount.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
@@ -35,8 +39,10 @@
 
 #include "mbcommon/common.h"
 #include "mbcommon/finally.h"
+#include "mbcommon/integer.h"
 #include "mbcommon/string.h"
 #include "mbcommon/version.h"
+#include "mblog/binary_logger.h"
 #include "mblog/logging.h"
 #include "mblog/kmsg_logger.h"
 #include "mblog/stdio_logger.h"
@@ -46,8 +52,10 @@
 #include "mbutil/socket.h"
 
 #include "boot/daemon_v3.h"
+#include "boot/mount_fstab.h"
 #include "boot/packages.h"
 #include "util/multiboot.h"
+#include "util/patch_cache.h"
 #include "util/roms.h"
 #include "util/sepolpatch.h"
 #include "util/validcerts.h"
@@ -62,6 +70,9 @@
 #define RESPONSE_OK "OK"                        // Generic accepted response
 #define RESPONSE_UNSUPPORTED "UNSUPPORTED"      // Generic unsupported response
 
+// Default number of threads for serving connections in the daemon process
+#define DEFAULT_WORKERS         4
+
 
 namespace mb
 {
@@ -74,7 +85,16 @@ static bool sigstop_when_ready = false;
 static bool allow_root_client = false;
 static bool log_to_kmsg = false;
 static bool log_to_stdio = false;
+static bool log_binary = false;
 static bool no_unshare = false;
+static bool mount_images = false;
+static unsigned int num_workers = DEFAULT_WORKERS;
+
+// Connections waiting for a worker thread
+static std::mutex queue_lock;
+static std::condition_variable queue_cv;
+static std::deque<int> queue;
+static size_t idle_workers = 0;
 
 static ScopedFILE log_fp(nullptr, [](FILE *fp) {
     if (fp) {
@@ -92,7 +112,9 @@ static bool verify_credentials(uid_t uid)
     // which case, there's not much we can do to prevent damage.
 
     Packages pkgs;
-    if (!pkgs.load_xml(PACKAGES_XML)) {
+    if (!pkgs.load_cached(PACKAGES_XML,
+                          patch_cache_path("packages_current.bin"),
+                          PackagesLoadFlag::SkipSigs)) {
         LOGE("Failed to load " PACKAGES_XML);
         return false;
     }
@@ -124,7 +146,7 @@ static bool verify_credentials(uid_t uid)
     return false;
 }
 
-static bool client_connection(int fd)
+static bool client_connection(int fd, bool threaded)
 {
     LOGD("Accepted connection from %d", fd);
 
@@ -136,8 +158,12 @@ static bool client_connection(int fd)
         return false;
     }
 
-    (void) util::set_process_title(format(
-            "mbtool connection from pid: %u", cred.pid));
+    // The process title can't be changed when serving the connection from a
+    // thread since it would hide the daemon from --replace
+    if (!threaded) {
+        (void) util::set_process_title(format(
+                "mbtool connection from pid: %u", cred.pid));
+    }
 
     LOGD("Client PID: %u", cred.pid);
     LOGD("Client UID: %u", cred.uid);
@@ -187,7 +213,11 @@ static bool client_connection(int fd)
             return false;
         }
 
-        connection_version_3(fd);
+        ConnectionOptions options;
+        options.isolate_privileged = threaded;
+        options.unshare_mounts = !no_unshare;
+
+        connection_version_3(fd, options);
         return true;
     } else {
         LOGE("Unsupported interface version: %d", version.value());
@@ -196,6 +226,208 @@ static bool client_connection(int fd)
     }
 }
 
+/*!
+ * \brief Serve a connection in a new child process
+ *
+ * The child gets its own mount namespace (unless --no-unshare was passed) and
+ * exits when the connection is closed.
+ *
+ * \param fd Listening socket
+ * \param client_fd Client socket (closed in the parent process)
+ */
+static void fork_connection(int fd, int client_fd)
+{
+    pid_t child_pid = fork();
+    if (child_pid < 0) {
+        LOGE("Failed to fork: %s", strerror(errno));
+    } else if (child_pid == 0) {
+        if (!no_unshare) {
+            if (unshare(CLONE_NEWNS) < 0) {
+                LOGE("unshare() failed: %s", strerror(errno));
+                _exit(127);
+            }
+
+            if (mount("", "/", "", MS_PRIVATE | MS_REC, "") < 0) {
+                LOGE("Failed to set private mount propagation: %s",
+                     strerror(errno));
+                _exit(127);
+            }
+        }
+
+        // Change the process name so --replace doesn't kill existing
+        // connections
+        if (auto ret = util::set_process_title(
+                "mbtool connection initializing"); !ret) {
+            LOGE("Failed to set process title: %s",
+                 ret.error().message().c_str());
+            _exit(127);
+        }
+
+        // Restore default SIGCHLD handler
+        struct sigaction sa;
+        sa.sa_handler = SIG_DFL;
+        sigemptyset(&sa.sa_mask);
+        sa.sa_flags = 0;
+        if (sigaction(SIGCHLD, &sa, 0) < 0) {
+            LOGE("Failed to set default SIGCHLD handler: %s",
+                 strerror(errno));
+            _exit(127);
+        }
+
+        // Don't need the listening socket fd
+        close(fd);
+
+        bool ret = client_connection(client_fd, false);
+        close(client_fd);
+        _exit(ret ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+    close(client_fd);
+}
+
+static void worker_thread()
+{
+    while (true) {
+        int client_fd;
+
+        {
+            std::unique_lock<std::mutex> lock(queue_lock);
+
+            ++idle_workers;
+            queue_cv.wait(lock, [] { return !queue.empty(); });
+            --idle_workers;
+
+            client_fd = queue.front();
+            queue.pop_front();
+        }
+
+        client_connection(client_fd, true);
+        close(client_fd);
+    }
+}
+
+/*!
+ * \brief Hand a connection to an idle worker thread
+ *
+ * Connections are never queued behind busy workers since a single connection
+ * can stay open for a long time (eg. while the app is browsing files).
+ *
+ * \return Whether a worker thread will serve the connection
+ */
+static bool dispatch_to_worker(int client_fd)
+{
+    {
+        std::lock_guard<std::mutex> lock(queue_lock);
+
+        if (idle_workers <= queue.size()) {
+            return false;
+        }
+
+        queue.push_back(client_fd);
+    }
+
+    queue_cv.notify_one();
+    return true;
+}
+
+/*!
+ * \brief Serve connections from an epoll event loop and a worker thread pool
+ *
+ * Connections are served by a fixed number of threads in the daemon process,
+ * avoiding a fork() for each of the short-lived connections that the app
+ * makes. If all workers are busy, the connection is served by a child process
+ * instead, as it would be without the thread pool. Requests that mount
+ * filesystems or run external programs are always run in a child process (see
+ * connection_version_3()).
+ *
+ * \param fd Listening socket
+ */
+static bool serve_connections(int fd)
+{
+    int flags = fcntl(fd, F_GETFL);
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+        LOGE("Failed to make socket non-blocking: %s", strerror(errno));
+        return false;
+    }
+
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0) {
+        LOGE("Failed to create epoll instance: %s", strerror(errno));
+        return false;
+    }
+
+    auto close_epoll_fd = finally([&] {
+        close(epoll_fd);
+    });
+
+    epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        LOGE("Failed to add socket to epoll instance: %s", strerror(errno));
+        return false;
+    }
+
+    for (unsigned int i = 0; i < num_workers; ++i) {
+        std::thread(worker_thread).detach();
+    }
+
+    LOGD("Serving connections with %u worker threads", num_workers);
+
+    while (true) {
+        epoll_event events[1];
+
+        int n = epoll_wait(epoll_fd, events, 1, -1);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            LOGE("Failed to wait for connections: %s", strerror(errno));
+            return false;
+        }
+
+        // Accept all pending connections
+        while (true) {
+            int client_fd = accept4(fd, nullptr, nullptr, SOCK_CLOEXEC);
+            if (client_fd < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK
+                        || errno == EINTR) {
+                    break;
+                } else if (errno == ECONNABORTED) {
+                    continue;
+                }
+                LOGE("Failed to accept connection on socket: %s",
+                     strerror(errno));
+                return false;
+            }
+
+            if (!dispatch_to_worker(client_fd)) {
+                LOGV("All workers are busy; forking for connection");
+                fork_connection(fd, client_fd);
+            }
+        }
+    }
+}
+
+/*!
+ * \brief Check and mount the ROMs' system images in a background process
+ *
+ * This is deferred from mount_rom() so that boot time does not grow with the
+ * number of installed image-based ROMs.
+ */
+static void mount_images_in_background()
+{
+    pid_t pid = fork();
+    if (pid < 0) {
+        LOGW("Failed to fork for mounting images: %s", strerror(errno));
+    } else if (pid == 0) {
+        // Allow waiting for e2fsck
+        signal(SIGCHLD, SIG_DFL);
+
+        _exit(mount_all_system_images() ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+}
+
 static bool run_daemon()
 {
     int fd = socket(AF_LOCAL, SOCK_STREAM | SOCK_CLOEXEC, 0);
@@ -256,55 +488,24 @@ static bool run_daemon()
         }
     }
 
-    LOGD("Socket ready, waiting for connections");
-
-    int client_fd;
-    while ((client_fd = accept4(fd, nullptr, nullptr, SOCK_CLOEXEC)) >= 0) {
-        pid_t child_pid = fork();
-        if (child_pid < 0) {
-            LOGE("Failed to fork: %s", strerror(errno));
-        } else if (child_pid == 0) {
-            if (!no_unshare) {
-                if (unshare(CLONE_NEWNS) < 0) {
-                    LOGE("unshare() failed: %s", strerror(errno));
-                    _exit(127);
-                }
-
-                if (mount("", "/", "", MS_PRIVATE | MS_REC, "") < 0) {
-                    LOGE("Failed to set private mount propagation: %s",
-                         strerror(errno));
-                    _exit(127);
-                }
-            }
+    // Verified SignedExec binaries are shared by all connections
+    if (!setup_signed_exec_dir()) {
+        LOGW("Verified SignedExec binaries will not be reused");
+    }
 
-            // Change the process name so --replace doesn't kill existing
-            // connections
-            if (auto ret = util::set_process_title(
-                    "mbtool connection initializing"); !ret) {
-                LOGE("Failed to set process title: %s",
-                     ret.error().message().c_str());
-                _exit(127);
-            }
+    if (mount_images) {
+        mount_images_in_background();
+    }
 
-            // Restore default SIGCHLD handler
-            struct sigaction sa;
-            sa.sa_handler = SIG_DFL;
-            sigemptyset(&sa.sa_mask);
-            sa.sa_flags = 0;
-            if (sigaction(SIGCHLD, &sa, 0) < 0) {
-                LOGE("Failed to set default SIGCHLD handler: %s",
-                     strerror(errno));
-                _exit(127);
-            }
+    LOGD("Socket ready, waiting for connections");
 
-            // Don't need the listening socket fd
-            close(fd);
+    if (num_workers > 0) {
+        return serve_connections(fd);
+    }
 
-            bool ret = client_connection(client_fd);
-            close(client_fd);
-            _exit(ret ? EXIT_SUCCESS : EXIT_FAILURE);
-        }
-        close(client_fd);
+    int client_fd;
+    while ((client_fd = accept4(fd, nullptr, nullptr, SOCK_CLOEXEC)) >= 0) {
+        fork_connection(fd, client_fd);
     }
 
     if (client_fd < 0) {
@@ -362,6 +563,24 @@ static bool daemon_init()
         // Default; do nothing
     } else if (log_to_kmsg) {
         log::set_logger(std::make_shared<log::KmsgLogger>(false));
+    } else if (log_binary) {
+        if (auto r = util::mkdir_parent(MULTIBOOT_BINARY_LOG_DAEMON, 0775);
+                !r && r.error() != std::errc::file_exists) {
+            LOGE("Failed to create parent directory of %s: %s",
+                 MULTIBOOT_BINARY_LOG_DAEMON, strerror(errno));
+            return false;
+        }
+
+        auto logger = std::make_shared<log::BinaryLogger>(
+                get_raw_path(MULTIBOOT_BINARY_LOG_DAEMON),
+                MULTIBOOT_BINARY_LOG_SIZE);
+        if (!logger->is_open()) {
+            LOGE("Failed to open binary log file %s",
+                 MULTIBOOT_BINARY_LOG_DAEMON);
+            return false;
+        }
+
+        log::set_logger(std::move(logger));
     } else {
         if (auto r = util::mkdir_parent(MULTIBOOT_LOG_DAEMON, 0775);
                 !r && r.error() != std::errc::file_exists) {
@@ -479,7 +698,13 @@ static void daemon_usage(bool error)
             "                   fully initialized\n"
             "  --log-to-kmsg    Send log output to kernel log instead of file\n"
             "  --log-to-stdio   Send log output to stdout/stderr\n"
-            "  --no-unshare     Don't unshare mount namespace\n");
+            "  --log-binary     Send log output to a compact binary ring buffer\n"
+            "                   file (decode with mblogdecode)\n"
+            "  --no-unshare     Don't unshare mount namespace\n"
+            "  --mount-images   Check and mount system images in the background\n"
+            "  --workers <N>    Number of threads for serving connections\n"
+            "                   (default: %d; 0 to fork for every connection)\n",
+            DEFAULT_WORKERS);
 }
 
 int daemon_main(int argc, char *argv[])
@@ -498,6 +723,9 @@ int daemon_main(int argc, char *argv[])
         OPT_LOG_TO_KMSG = 1003,
         OPT_LOG_TO_STDIO = 1004,
         OPT_NO_UNSHARE = 1005,
+        OPT_WORKERS = 1006,
+        OPT_LOG_BINARY = 1007,
+        OPT_MOUNT_IMAGES = 1008,
     };
 
     static struct option long_options[] = {
@@ -509,7 +737,10 @@ int daemon_main(int argc, char *argv[])
         {"sigstop-when-ready", no_argument, 0, OPT_SIGSTOP_WHEN_READY},
         {"log-to-kmsg",        no_argument, 0, OPT_LOG_TO_KMSG},
         {"log-to-stdio",       no_argument, 0, OPT_LOG_TO_STDIO},
+        {"log-binary",         no_argument, 0, OPT_LOG_BINARY},
         {"no-unshare",         no_argument, 0, OPT_NO_UNSHARE},
+        {"mount-images",       no_argument, 0, OPT_MOUNT_IMAGES},
+        {"workers",            required_argument, 0, OPT_WORKERS},
         {0, 0, 0, 0}
     };
 
@@ -549,10 +780,25 @@ int daemon_main(int argc, char *argv[])
             log_to_stdio = true;
             break;
 
+        case OPT_LOG_BINARY:
+            log_binary = true;
+            break;
+
         case OPT_NO_UNSHARE:
             no_unshare = true;
             break;
 
+        case OPT_MOUNT_IMAGES:
+            mount_images = true;
+            break;
+
+        case OPT_WORKERS:
+            if (!str_to_num(optarg, 10, num_workers)) {
+                fprintf(stderr, "Invalid number of workers: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+
         default:
             daemon_usage(1);
             return EXIT_FAILURE;
@@ -19,35 +19,62 @@
 
 #include "boot/daemon_v3.h"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
 #include <unordered_map>
-#include <unordered_set>
+#include <vector>
 
+#include <cinttypes>
+#include <cstddef>
+#include <cstring>
+
+#include <dirent.h>
 #include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
 #include <sys/mount.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/vfs.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
+#include <linux/magic.h>
+
+#include <openssl/sha.h>
+
+#include "mbcommon/common.h"
 #include "mbcommon/error_code.h"
 #include "mbcommon/finally.h"
+#include "mbcommon/perf.h"
 #include "mbcommon/string.h"
 #include "mbcommon/version.h"
 #include "mblog/logging.h"
+#include "mbutil/async.h"
 #include "mbutil/command.h"
 #include "mbutil/copy.h"
 #include "mbutil/delete.h"
 #include "mbutil/directory.h"
-#include "mbutil/fts.h"
+#include "mbutil/io_scheduler.h"
 #include "mbutil/path.h"
-#include "mbutil/properties.h"
+#include "mbutil/process.h"
 #include "mbutil/reboot.h"
 #include "mbutil/selinux.h"
 #include "mbutil/socket.h"
 #include "mbutil/string.h"
 
+#include "boot/directory_size.h"
 #include "boot/init.h"
 #include "boot/packages.h"
-#include "util/romconfig.h"
+#include "util/boot_context.h"
+#include "util/patch_cache.h"
+#include "util/rom_catalog.h"
 #include "util/roms.h"
 #include "util/signature.h"
 #include "util/switcher.h"
@@ -68,25 +95,262 @@
 
 #define LOG_TAG "mbtool/boot/daemon_v3"
 
+// Root-only tmpfs for verifying and running SignedExec binaries
+#define SIGNED_EXEC_DIR "/mbtool_exec_tmp"
+// Verified binaries kept in SIGNED_EXEC_DIR before old ones are discarded
+#define SIGNED_EXEC_MAX_CACHED 16
+
 namespace mb
 {
 
 namespace v3 = mbtool::daemon::v3;
 namespace fb = flatbuffers;
 
-static std::unordered_map<int, int> fd_map;
-static int fd_count = 0;
+// Size of the read-ahead buffer for files opened read-only
+#define FILE_READ_AHEAD_SIZE (128 * 1024)
+
+/*!
+ * \brief Files opened by the client
+ *
+ * Files are stored in a dense slot array. The ID given to the client holds the
+ * slot index in the low 16 bits and the slot's generation in the high bits.
+ * The generation is bumped when a file is closed, so a stale ID is rejected
+ * instead of referring to whatever file reuses the slot.
+ *
+ * Regular files opened read-only get a read-ahead buffer so that sequential
+ * reads in small sizes don't each need a read() syscall. The kernel's file
+ * offset is then ahead of the client's position by the amount of unread data
+ * in the buffer. sync_position() moves it back before any operation that
+ * depends on it.
+ */
+class FileTable
+{
+public:
+    struct File
+    {
+        int fd = -1;
+        bool read_ahead = false;
+        std::vector<unsigned char> buf;
+        // Unread data is buf[buf_begin, buf_end)
+        size_t buf_begin = 0;
+        size_t buf_end = 0;
+    };
+
+    int32_t add(int fd, bool read_ahead)
+    {
+        uint32_t index;
+
+        if (!m_free.empty()) {
+            index = m_free.back();
+            m_free.pop_back();
+        } else if (m_slots.size() <= MAX_INDEX) {
+            index = static_cast<uint32_t>(m_slots.size());
+            m_slots.emplace_back();
+        } else {
+            return -1;
+        }
+
+        auto &slot = m_slots[index];
+        slot.used = true;
+        slot.file.fd = fd;
+        slot.file.read_ahead = read_ahead;
+
+        return static_cast<int32_t>(slot.generation << INDEX_BITS | index);
+    }
+
+    File * find(int32_t id)
+    {
+        auto index = static_cast<uint32_t>(id) & MAX_INDEX;
+        auto generation = static_cast<uint32_t>(id) >> INDEX_BITS;
+
+        if (id < 0 || index >= m_slots.size()) {
+            return nullptr;
+        }
+
+        auto &slot = m_slots[index];
+        if (!slot.used || slot.generation != generation) {
+            return nullptr;
+        }
+
+        return &slot.file;
+    }
+
+    //! Remove a file from the table and return its fd (or -1)
+    int remove(int32_t id)
+    {
+        auto file = find(id);
+        if (!file) {
+            return -1;
+        }
+
+        auto index = static_cast<uint32_t>(id) & MAX_INDEX;
+        auto &slot = m_slots[index];
+        int fd = slot.file.fd;
+
+        slot.file = {};
+        slot.used = false;
+        slot.generation = (slot.generation + 1) & MAX_GENERATION;
+        m_free.push_back(index);
+
+        return fd;
+    }
+
+    void close_all()
+    {
+        for (auto &slot : m_slots) {
+            if (slot.used) {
+                close(slot.file.fd);
+            }
+        }
+        m_slots.clear();
+        m_free.clear();
+    }
+
+    static void sync_position(File &file)
+    {
+        auto unread = file.buf_end - file.buf_begin;
+
+        if (unread > 0 && lseek64(file.fd, -static_cast<off64_t>(unread),
+                                  SEEK_CUR) < 0) {
+            LOGW("Failed to rewind read-ahead data: %s", strerror(errno));
+        }
+
+        file.buf_begin = file.buf_end = 0;
+    }
+
+private:
+    static constexpr uint32_t INDEX_BITS = 16;
+    static constexpr uint32_t MAX_INDEX = (1u << INDEX_BITS) - 1;
+    // Keep IDs positive since the protocol uses signed integers
+    static constexpr uint32_t MAX_GENERATION = (1u << (31 - INDEX_BITS)) - 1;
+
+    struct Slot
+    {
+        File file;
+        uint32_t generation = 0;
+        bool used = false;
+    };
+
+    std::vector<Slot> m_slots;
+    std::vector<uint32_t> m_free;
+};
+
+// These are per-thread because connections may be served concurrently by
+// threads in the daemon process. A thread only serves one connection at a
+// time.
+static thread_local FileTable open_files;
+
+// ID of the request being handled. It is copied to every response frame sent
+// for the request.
+static thread_local uint64_t request_id = 0;
+
+// Serializes writes to the client socket, which background copy jobs also send
+// messages to. Recursive so that a handler can hold it across several writes.
+static thread_local std::recursive_mutex *write_lock = nullptr;
+
+// Maximum number of background requests run concurrently for a connection
+#define MAX_BACKGROUND_WORKERS 2
+
+#define COPY_JOB_PROGRESS_INTERVAL std::chrono::milliseconds(500)
+#define WIPE_PROGRESS_INTERVAL std::chrono::milliseconds(500)
+
+// Approximate maximum size of a response frame. Responses whose size depends on
+// the request are capped (file reads) or split into several frames (directory
+// listings) so that the daemon's memory usage doesn't depend on what the client
+// asks for.
+#define MAX_RESPONSE_SIZE (256 * 1024)
+// Builders kept around for reuse by each thread
+#define MAX_POOLED_BUILDERS 4
+
+// Response builders that can be reused by this thread. Clearing a builder keeps
+// its buffer, so most responses don't need to allocate.
+static thread_local std::vector<std::unique_ptr<fb::FlatBufferBuilder>>
+        builder_pool;
+
+// Takes a builder from builder_pool and returns it, cleared, when destroyed.
+// Nested users, like output callbacks that run while a handler is building its
+// own response, get separate builders.
+class PooledBuilder
+{
+public:
+    PooledBuilder()
+    {
+        if (builder_pool.empty()) {
+            m_builder = std::make_unique<fb::FlatBufferBuilder>();
+        } else {
+            m_builder = std::move(builder_pool.back());
+            builder_pool.pop_back();
+        }
+    }
+
+    ~PooledBuilder()
+    {
+        // Don't keep builders that grew past the frame size limit
+        if (m_builder->GetSize() <= MAX_RESPONSE_SIZE
+                && builder_pool.size() < MAX_POOLED_BUILDERS) {
+            m_builder->Clear();
+            builder_pool.push_back(std::move(m_builder));
+        }
+    }
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(PooledBuilder)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(PooledBuilder)
+
+    fb::FlatBufferBuilder & operator*()
+    {
+        return *m_builder;
+    }
+
+private:
+    std::unique_ptr<fb::FlatBufferBuilder> m_builder;
+};
+
+// Background copy started by PathCopyJobStartRequest
+struct CopyJob
+{
+    uint64_t id;
+    // ID of the start request. Used for all of the job's messages.
+    uint64_t request_id;
+    std::string source;
+    std::string target;
+    bool recursive;
+    util::CopyProgress progress;
+    std::atomic_bool finished{false};
+    std::thread thread;
+};
+
+static thread_local std::unordered_map<uint64_t, std::unique_ptr<CopyJob>>
+        copy_jobs;
+static thread_local uint64_t copy_job_count = 0;
+
+static std::unique_lock<std::recursive_mutex> v3_lock_writes()
+{
+    if (write_lock) {
+        return std::unique_lock<std::recursive_mutex>(*write_lock);
+    }
+    return {};
+}
+
+static fb::Offset<v3::Response>
+v3_create_response(fb::FlatBufferBuilder &builder, v3::ResponseType type,
+                   fb::Offset<void> response, bool more = false)
+{
+    return v3::CreateResponse(builder, type, response, request_id, more);
+}
 
 static bool v3_send_response(int fd, const fb::FlatBufferBuilder &builder)
 {
+    auto lock = v3_lock_writes();
+
     return util::socket_write_bytes(
             fd, builder.GetBufferPointer(), builder.GetSize()).has_value();
 }
 
 static bool v3_send_response_invalid(int fd)
 {
-    fb::FlatBufferBuilder builder;
-    auto response = v3::CreateResponse(builder, v3::ResponseType_Invalid,
+    PooledBuilder pooled_builder;
+    auto &builder = *pooled_builder;
+    auto response = v3_create_response(builder, v3::ResponseType_Invalid,
                                        v3::CreateInvalid(builder).Union());
     builder.Finish(response);
     return v3_send_response(fd, builder);
@@ -94,8 +358,9 @@ static bool v3_send_response_invalid(int fd)
 
 static bool v3_send_response_unsupported(int fd)
 {
-    fb::FlatBufferBuilder builder;
-    auto response = v3::CreateResponse(builder, v3::ResponseType_Unsupported,
+    PooledBuilder pooled_builder;
+    auto &builder = *pooled_builder;
+    auto response = v3_create_response(builder, v3::ResponseType_Unsupported,
                                        v3::CreateUnsupported(builder).Union());
     builder.Finish(response);
     return v3_send_response(fd, builder);
@@ -104,11 +369,12 @@ static bool v3_send_response_unsupported(int fd)
 static bool v3_file_chmod(int fd, const v3::Request *msg)
 {
     auto request = static_cast<const v3::FileChmodRequest *>(msg->request());
-    if (fd_map.find(request->id()) == fd_map.end()) {
+    auto file = open_files.find(request->id());
+    if (!file) {
         return v3_send_response_invalid(fd);
     }
 
-    int ffd = fd_map[request->id()];
+    int ffd = file->fd;
 
     // Don't allow setting setuid or setgid permissions
     mode_t mode = static_cast<mode_t>(request->mode());
@@ -117,7 +383,8 @@ static bool v3_file_chmod(int fd, const v3::Request *msg)
         return v3_send_response_invalid(fd);
     }
 
-    fb::FlatBufferBuilder builder;
+    PooledBuilder pooled_builder;
+    auto &builder = *pooled_builder;
     fb::Offset<v3::FileChmodError> error;
 
     bool ret = fchmod(ffd, mode) == 0;
@@ -132,7 +399,7 @@ static bool v3_file_chmod(int fd, const v3::Request *msg)
             builder, ret, ret ? nullptr : strerror(saved_errno), error);
 
     // Wrap response
-    builder.Finish(v3::CreateResponse(
+    builder.Finish(v3_create_response(
             builder, v3::ResponseType_FileChmodResponse, response.Union()));
 
     return v3_send_response(fd, builder);
@@ -141,16 +408,15 @@ static bool v3_file_chmod(int fd, const v3::Request *msg)
 static bool v3_file_close(int fd, const v3::Request *msg)
 {
     auto request = static_cast<const v3::FileCloseRequest *>(msg->request());
-    auto it = fd_map.find(request->id());
-    if (it == fd_map.end()) {
+
+    // Remove ID from table
+    int ffd = open_files.remove(request->id());
+    if (ffd < 0) {
         return v3_send_response_invalid(fd);
     }
 
-    // Remove ID from map
-    int ffd = it->second;
-    fd_map.erase(it);
-
-    fb::FlatBufferBuilder builder;
+    PooledBuilder pooled_builder;
+    auto &builder = *pooled_builder;
     fb::Offset<v3::FileCloseError> error;
 
     bool ret = close(ffd) == 0;
@@ -165,12 +431,50 @@ static bool v3_file_close(int fd, const v3::Request *msg)
             builder, ret, ret ? nullptr : strerror(saved_errno), error);
 
     // Wrap response
-    builder.Finish(v3::CreateResponse(
+    builder.Finish(v3_create_response(
             builder, v3::ResponseType_FileCloseResponse, response.Union()));
 
     return v3_send_response(fd, builder);
 }
 
+static bool v3_file_get_fd(int fd, const v3::Request *msg)
+{
+    auto request = static_cast<const v3::FileGetFdRequest *>(msg->request());
+    auto file = open_files.find(request->id());
+    if (!file) {
+        return v3_send_response_invalid(fd);
+    }
+
+    // The client will use the file offset directly
+    FileTable::sync_position(*file);
+
+    PooledBuilder pooled_builder;
+    auto &builder = *pooled_builder;
+
+    auto response = v3::CreateFileGetFdResponse(builder);
+
+    // Wrap response
+    builder.Finish(v3_create_response(
+            builder, v3::ResponseType_FileGetFdResponse, response.Union()));
+
+    // Don't let copy job messages get between the response and the fd
+    auto lock = v3_lock_writes();
+
+    if (!v3_send_response(fd, builder)) {
+        return false;
+    }
+
+    // Pass the file descriptor so the client can transfer data directly
+    // instead of copying it through FileRead/FileWrite requests
+    if (auto ret = util::socket_send_fds(fd, { file->fd }); !ret) {
+        LOGE("Failed to send file descriptor: %s",
+             ret.error().message().c_str());
+        return false;
+    }
+
+    return true;
+}
+
 static bool v3_file_open(int fd, const v3::Request *msg)
 {
     auto request = static_cast<const v3::FileOpenRequest *>(msg->request());
@@ -200,7 +504,8 @@ static bool v3_file_open(int fd, const v3::Request *msg)
         }
     }
 
-    fb::FlatBufferBuilder builder;
+    PooledBuilder pooled_builder;
+    auto &builder = *pooled_builder;
     fb::Offset<v3::FileOpenError> error;
     int id = -1;
 
@@ -209,10 +514,20 @@ static bool v3_file_open(int fd, const v3::Request *msg)
     int saved_errno = errno;
 
     if (ffd >= 0) {
+        struct stat sb;
+        bool read_ahead = (flags & O_ACCMODE) == O_RDONLY
+                && fstat(ffd, &sb) == 0 && S_ISREG(sb.st_mode);
+
         // Assign a new ID
-        id = fd_count++;
-        fd_map[id] = ffd;
-    } else {
+        id = open_files.add(ffd, read_ahead);
+        if (id < 0) {
+            close(ffd);
+            ffd = -1;
+            saved_errno = EMFILE;
+        }
+    }
+
+    if (ffd < 0) {
         error = v3::CreateFileOpenErrorDirect(
                 builder, saved_errno, strerror(saved_errno));
     }
@@ -222,29 +537,88 @@ static bool v3_file_open(int fd, const v3::Request *msg)
             error);
 
     // Wrap response
-    builder.Finish(v3::CreateResponse(
+    builder.Finish(v3_create_response(
             builder, v3::ResponseType_FileOpenResponse, response.Union()));
 
     return v3_send_response(fd, builder);
 }
 
+/*!
+ * \brief Read from a client file, using its read-ahead buffer if it has one
+ *
+ * Data is served from the buffer first. If that's not enough, small reads
+ * refill the buffer with a single read() and large reads bypass it.
+ *
+ * \return Number of bytes read or -1 with errno set if nothing could be read
+ */
+static ssize_t v3_file_read_buffered(FileTable::File &file, void *buf,
+                                     size_t size)
+{
+    if (!file.read_ahead) {
+        return read(file.fd, buf, size);
+    }
+
+    auto out = static_cast<unsigned char *>(buf);
+    size_t n = std::min(size, file.buf_end - file.buf_begin);
+
+    if (n > 0) {
+        memcpy(out, file.buf.data() + file.buf_begin, n);
+        file.buf_begin += n;
+    }
+
+    if (n == size) {
+        return static_cast<ssize_t>(n);
+    }
+
+    ssize_t ret;
+
+    if (size - n >= FILE_READ_AHEAD_SIZE) {
+        ret = read(file.fd, out + n, size - n);
+        if (ret > 0) {
+            n += static_cast<size_t>(ret);
+        }
+    } else {
+        file.buf.resize(FILE_READ_AHEAD_SIZE);
+
+        ret = read(file.fd, file.buf.data(), file.buf.size());
+        if (ret > 0) {
+            size_t to_copy = std::min(size - n, static_cast<size_t>(ret));
+            memcpy(out + n, file.buf.data(), to_copy);
+            n += to_copy;
+            file.buf_begin = to_copy;
+            file.buf_end = static_cast<size_t>(ret);
+        } else {
+            file.buf_begin = file.buf_end = 0;
+        }
+    }
+
+    // Report the error on the next read if some data was already copied
+    if (ret < 0 && n == 0) {
+        return -1;
+    }
+
+    return static_cast<ssize_t>(n);
+}
+
 static bool v3_file_read(int fd, const v3::Request *msg)
 {
     auto request = static_cast<const v3::FileReadRequest *>(msg->request());
-    auto it = fd_map.find(request->id());
-    if (it == fd_map.end()) {
+    auto file = open_files.find(request->id());
+    if (!file) {
         return v3_send_response_invalid(fd);
     }
 
-    int ffd = it->second;
-
-    std::vector<unsigned char> buf(static_cast<size_t>(request->count()));
+    // Short reads are allowed, so the buffer (and the response) is capped
+    // regardless of the requested size
+    std::vector<unsigned char> buf(static_cast<size_t>(
+            std::min<uint64_t>(request->count(), MAX_RESPONSE_SIZE)));
 
-    fb::FlatBufferBuilder builder;
+    PooledBuilder pooled_builder;
+    auto &builder = *pooled_builder;
     fb::Offset<v3::FileReadError> error;
     fb::Offset<fb::Vector<unsigned char>> data;
 
-    ssize_t ret = read(ffd, buf.data(), buf.size());
+    ssize_t ret = v3_file_read_buffered(*file, buf.data(), buf.size());
     int saved_errno = errno;
 
     if (ret >= 0) {
@@ -260,7 +634,7 @@ static bool v3_file_read(int fd, const v3::Request *msg)
             static_cast<size_t>(ret), data, error);
 
     // Wrap response
-    builder.Finish(v3::CreateResponse(
+    builder.Finish(v3_create_response(
             builder, v3::ResponseType_FileReadResponse, response.Union()));
 
     return v3_send_response(fd, builder);
@@ -269,12 +643,12 @@ static bool v3_file_read(int fd, const v3::Request *msg)
 static bool v3_file_seek(int fd, const v3::Request *msg)
 {
     auto request = static_cast<const v3::FileSeekRequest *>(msg->request());
-    auto it = fd_map.find(request->id());
-    if (it == fd_map.end()) {
+    auto file = open_files.find(request->id());
+    if (!file) {
         return v3_send_response_invalid(fd);
     }
 
-    int ffd = it->second;
+    int ffd = file->fd;
     int64_t offset = request->offset();
     int whence;
 
@@ -288,9 +662,13 @@ static bool v3_file_seek(int fd, const v3::Request *msg)
         return v3_send_response_invalid(fd);
     }
 
-    fb::FlatBufferBuilder builder;
+    PooledBuilder pooled_builder;
+    auto &builder = *pooled_builder;
     fb::Offset<v3::FileSeekError> error;
 
+    // SEEK_CUR is relative to the client's position
+    FileTable::sync_position(*file);
+
     // Ahh, posix...
     errno = 0;
     off64_t new_offset = lseek64(ffd, offset, whence);
@@ -307,7 +685,7 @@ static bool v3_file_seek(int fd, const v3::Request *msg)
             error);
 
     // Wrap response
-    builder.Finish(v3::CreateResponse(
+    builder.Finish(v3_create_response(
             builder, v3::ResponseType_FileSeekResponse, response.Union()));
 
     return v3_send_response(fd, builder);
@@ -317,14 +695,15 @@ static bool v3_file_selinux_get_label(int fd, const v3::Request *msg)
 {
     auto request = static_cast<const v3::FileSELinuxGetLabelRequest *>(
             msg->request());
-    auto it = fd_map.find(request->id());
-    if (it == fd_map.end()) {
+    auto file = open_files.find(request->id());
+    if (!file) {
         return v3_send_response_invalid(fd);
     }
 
-    int ffd = it->second;
+    int ffd = file->fd;
 
-    fb::FlatBufferBuilder builder;
+    PooledBuilder pooled_builder;
+    auto &builder = *pooled_builder;
     fb::Offset<v3::FileSELinuxGetLabelError> error;
 
     auto label = util::selinux_fget_context(ffd);
@@ -339,7 +718,7 @@ static bool v3_file_selinux_get_label(int fd, const v3::Request *msg)
             label ? label.value().c_str() : nullptr, error);
 
     // Wrap response
-    builder.Finish(v3::CreateResponse(
+    builder.Finish(v3_create_response(
             builder, v3::ResponseType_PathSELinuxGetLabelResponse,
             response.Union()));
 
@@ -350,14 +729,15 @@ static bool v3_file_selinux_set_label(int fd, const v3::Request *msg)
 {
     auto request = static_cast<const v3::FileSELinuxSetLabelRequest *>(
             msg->request());
-    auto it = fd_map.find(request->id());
-    if (it == fd_map.end() || !request->label()) {
+    auto file = open_files.find(request->id());
+    if (!file || !request->label()) {
         return v3_send_response_invalid(fd);
     }
 
-    int ffd = it->second;
+    int ffd = file->fd;
 
-    fb::FlatBufferBuilder builder;
+    PooledBuilder pooled_builder;
+    auto &builder = *pooled_builder;
     fb::Offset<v3::FileSELinuxSetLabelError> error;
 
     auto ret = util::selinux_fset_context(ffd, request->label()->str());
@@ -371,24 +751,45 @@ static bool v3_file_selinux_set_label(int fd, const v3::Request *msg)
             error);
 
     // Wrap response
-    builder.Finish(v3::CreateResponse(
+    builder.Finish(v3_create_response(
             builder, v3::ResponseType_FileSELinuxSetLabelResponse,
             response.Union()));
 
     return v3_send_response(fd, builder);
 }
 
+static fb::Offset<v3::StructStat> v3_create_struct_stat(
+        fb::FlatBufferBuilder &builder, const struct stat &sb)
+{
+    v3::StructStatBuilder ssb(builder);
+    ssb.add_dev(sb.st_dev);
+    ssb.add_ino(sb.st_ino);
+    ssb.add_mode(sb.st_mode);
+    ssb.add_nlink(sb.st_nlink);
+    ssb.add_uid(sb.st_uid);
+    ssb.add_gid(sb.st_gid);
+    ssb.add_rdev(sb.st_rdev);
+    ssb.add_size(static_cast<uint64_t>(sb.st_size));
+    ssb.add_blksize(static_cast<uint64_t>(sb.st_blksize));
+    ssb.add_blocks(static_cast<uint64_t>(sb.st_blocks));
+    ssb.add_atime(static_cast<uint64_t>(sb.st_atime));
+    ssb.add_mtime(static_cast<uint64_t>(sb.st_mtime));
+    ssb.add_ctime(static_cast<uint64_t>(sb.st_ctime));
+    return ssb.Finish();
+}
+
 static bool v3_file_stat(int fd, const v3::Request *msg)
 {
     auto request = static_cast<const v3::FileStatRequest *>(msg->request());
-    auto it = fd_map.find(request->id());
-    if (it == fd_map.end()) {
+    auto file = open_files.find(request->id());
+    if (!file) {
         return v3_send_response_invalid(fd);
     }
 
-    int ffd = it->second;
+    int ffd = file->fd;
 
-    fb::FlatBufferBuilder builder;
+    PooledBuilder pooled_builder;
+    auto &builder = *pooled_builder;
     fb::Offset<v3::FileStatError> error;
     fb::Offset<v3::StructStat> statbuf;
     struct stat sb;
@@ -397,21 +798,7 @@ static bool v3_file_stat(int fd, const v3::Request *msg)
     int saved_errno = errno;
 
     if (ret) {
-        v3::StructStatBuilder ssb(builder);
-        ssb.add_dev(sb.st_dev);
-        ssb.add_ino(sb.st_ino);
-        ssb.add_mode(sb.st_mode);
-        ssb.add_nlink(sb.st_nlink);
-        ssb.add_uid(sb.st_uid);
-        ssb.add_gid(sb.st_gid);
-        ssb.add_rdev(sb.st_rdev);
-        ssb.add_size(static_cast<uint64_t>(sb.st_size));
-        ssb.add_blksize(static_cast<uint64_t>(sb.st_blksize));
-        ssb.add_blocks(static_cast<uint64_t>(sb.st_blocks));
-        ssb.add_atime(static_cast<uint64_t>(sb.st_atime));
-        ssb.add_mtime(static_cast<uint64_t>(sb.st_mtime));
-        ssb.add_ctime(static_cast<uint64_t>(sb.st_ctime));
-        statbuf = ssb.Finish();
+        statbuf = v3_create_struct_stat(builder, sb);
     } else {
         error = v3::CreateFileStatErrorDirect(
                 builder, saved_errno, strerror(saved_errno));
@@ -422,7 +809,7 @@ static bool v3_file_stat(int fd, const v3::Request *msg)
             error);
 
     // Wrap response
-    builder.Finish(v3::CreateResponse(
+    builder.Finish(v3_create_response(
             builder, v3::ResponseType_FileStatResponse, response.Union()));
 
     return v3_send_response(fd, builder);
@@ -431,14 +818,18 @@ static bool v3_file_stat(int fd, const v3::Request *msg)
 static bool v3_file_write(int fd, const v3::Request *msg)
 {
     auto request = static_cast<const v3::FileWriteRequest *>(msg->request());
-    auto it = fd_map.find(request->id());
-    if (it == fd_map.end() || !request->data()) {
+    auto file = open_files.find(request->id());
+    if (!file || !request->data()) {
         return v3_send_response_invalid(fd);
     }
 
-    int ffd = it->second;
+    // Write at the client's position
+    FileTable::sync_position(*file);
 
-    fb::FlatBufferBuilder builder;
+    int ffd = file->fd;
+
+    PooledBuilder pooled_builder;
+    auto &builder = *pooled_builder;
     fb::Offset<v3::FileWriteError> error;
 
     ssize_t ret = write(ffd, request->data()->Data(), request->data()->size());
@@ -454,7 +845,7 @@ static bool v3_file_write(int fd, const v3::Request *msg)
             static_cast<size_t>(ret), error);
 
     // Wrap response
-    builder.Finish(v3::CreateResponse(
+    builder.Finish(v3_create_response(
             builder, v3::ResponseType_FileWriteResponse, response.Union()));
 
     return v3_send_response(fd, builder);
@@ -474,7 +865,8 @@ static bool v3_path_chmod(int fd, const v3::Request *msg)
         return v3_send_response_invalid(fd);
     }
 
-    fb::FlatBufferBuilder builder;
+    PooledBuilder pooled_builder;
+    auto &builder = *pooled_builder;
     fb::Offset<v3::PathChmodError> error;
 
     bool ret = chmod(request->path()->c_str(), mode) == 0;
@@ -489,7 +881,7 @@ static bool v3_path_chmod(int fd, const v3::Request *msg)
             builder, ret, ret ? nullptr : strerror(saved_errno), error);
 
     // Wrap response
-    builder.Finish(v3::CreateResponse(
+    builder.Finish(v3_create_response(
             builder, v3::ResponseType_PathChmodResponse, response.Union()));
 
     return v3_send_response(fd, builder);
@@ -502,7 +894,8 @@ static bool v3_path_copy(int fd, const v3::Request *msg)
         return v3_send_response_invalid(fd);
     }
 
-    fb::FlatBufferBuilder builder;
+    PooledBuilder pooled_builder;
+    auto &builder = *pooled_builder;
     fb::Offset<v3::PathCopyError> error;
 
     auto ret = util::copy_contents(request->source()->str(),
@@ -517,12 +910,201 @@ static bool v3_path_copy(int fd, const v3::Request *msg)
             error);
 
     // Wrap response
-    builder.Finish(v3::CreateResponse(
+    builder.Finish(v3_create_response(
             builder, v3::ResponseType_PathCopyResponse, response.Union()));
 
     return v3_send_response(fd, builder);
 }
 
+static void v3_path_copy_job_send_progress(int fd, CopyJob &job,
+                                           uint64_t bytes_total)
+{
+    PooledBuilder pooled_builder;
+    auto &builder = *pooled_builder;
+
+    auto response = v3::CreatePathCopyJobProgressResponse(
+            builder, job.id, job.progress.bytes, bytes_total,
+            job.progress.files);
+
+    // Wrap response
+    builder.Finish(v3_create_response(
+            builder, v3::ResponseType_PathCopyJobProgressResponse,
+            response.Union()));
+
+    if (!v3_send_response(fd, builder)) {
+        LOGE("Failed to send copy job progress: %s", strerror(errno));
+    }
+}
+
+/*!
+ * \brief Run a copy job and report its progress to the client
+ *
+ * The copy runs as an AsyncOp, which also waits for the IoScheduler to admit
+ * it, while this thread sends a progress message every
+ * COPY_JOB_PROGRESS_INTERVAL until it finishes.
+ */
+static void v3_path_copy_job_thread(int fd, CopyJob *job,
+                                    std::recursive_mutex *lock)
+{
+    // Messages sent from this thread belong to the start request
+    write_lock = lock;
+    request_id = job->request_id;
+
+    uint64_t bytes_total = 0;
+
+    if (job->recursive) {
+        if (auto size = directory_size(job->source, {})) {
+            bytes_total = size.value();
+        }
+    } else {
+        struct stat sb;
+        if (stat(job->source.c_str(), &sb) == 0) {
+            bytes_total = static_cast<uint64_t>(sb.st_size);
+        }
+    }
+
+    util::AsyncOp<util::FileOpResult<void>> op;
+
+    if (job->recursive) {
+        op = util::copy_dir_async(job->source, job->target,
+                                  util::CopyFlag::CopyAttributes
+                                          | util::CopyFlag::CopyXattrs
+                                          | util::CopyFlag::ExcludeTopLevel
+                                          | util::CopyFlag::Parallel,
+                                  &job->progress);
+    } else {
+        op = util::copy_contents_async(job->source, job->target,
+                                       &job->progress);
+    }
+
+    while (!op.wait_for(COPY_JOB_PROGRESS_INTERVAL)) {
+        v3_path_copy_job_send_progress(fd, *job, bytes_total);
+    }
+
+    auto &ret = op.get();
+
+    PooledBuilder pooled_builder;
+    auto &builder = *pooled_builder;
+    fb::Offset<v3::PathCopyJobError> error;
+    bool cancelled = false;
+
+    if (!ret) {
+        auto ec = ret.error().ec;
+        cancelled = ec == std::errc::operation_canceled;
+        error = v3::CreatePathCopyJobErrorDirect(
+                builder, ec.value(), ret.error().message().c_str());
+    }
+
+    auto response = v3::CreatePathCopyJobFinishedResponse(
+            builder, job->id, cancelled, job->progress.bytes,
+            job->progress.files, error);
+
+    // Wrap response
+    builder.Finish(v3_create_response(
+            builder, v3::ResponseType_PathCopyJobFinishedResponse,
+            response.Union()));
+
+    if (!v3_send_response(fd, builder)) {
+        LOGE("Failed to send copy job result: %s", strerror(errno));
+    }
+
+    job->finished = true;
+}
+
+/*!
+ * \brief Join the threads of copy jobs that are done
+ *
+ * \param cancel Cancel and wait for all jobs instead
+ */
+static void v3_path_copy_job_reap(bool cancel)
+{
+    for (auto it = copy_jobs.begin(); it != copy_jobs.end();) {
+        auto &job = it->second;
+
+        if (cancel) {
+            job->progress.cancelled = true;
+        } else if (!job->finished) {
+            ++it;
+            continue;
+        }
+
+        job->thread.join();
+        it = copy_jobs.erase(it);
+    }
+}
+
+static bool v3_path_copy_job_start(int fd, const v3::Request *msg)
+{
+    auto request = static_cast<const v3::PathCopyJobStartRequest *>(
+            msg->request());
+    if (!request->source() || !request->target()) {
+        return v3_send_response_invalid(fd);
+    }
+
+    v3_path_copy_job_reap(false);
+
+    auto job = std::make_unique<CopyJob>();
+    job->id = ++copy_job_count;
+    job->request_id = request_id;
+    job->source = request->source()->str();
+    job->target = request->target()->str();
+    job->recursive = request->recursive();
+
+    uint64_t job_id = job->id;
+
+    PooledBuilder pooled_builder;
+    auto &builder = *pooled_builder;
+
+    auto response = v3::CreatePathCopyJobStartResponse(builder, job_id);
+
+    // Wrap response
+    builder.Finish(v3_create_response(
+            builder, v3::ResponseType_PathCopyJobStartResponse,
+            response.Union()));
+
+    // Hold the lock so that the start response is sent before the job's
+    // messages
+    auto lock = v3_lock_writes();
+
+    if (!v3_send_response(fd, builder)) {
+        return false;
+    }
+
+    job->thread = std::thread(&v3_path_copy_job_thread, fd, job.get(),
+                              write_lock);
+    copy_jobs.emplace(job_id, std::move(job));
+
+    return true;
+}
+
+static bool v3_path_copy_job_cancel(int fd, const v3::Request *msg)
+{
+    auto request = static_cast<const v3::PathCopyJobCancelRequest *>(
+            msg->request());
+
+    v3_path_copy_job_reap(false);
+
+    auto it = copy_jobs.find(request->job_id());
+    bool found = it != copy_jobs.end() && !it->second->finished;
+
+    if (found) {
+        // The job reports the cancellation in its finished message
+        it->second->progress.cancelled = true;
+    }
+
+    PooledBuilder pooled_builder;
+    auto &builder = *pooled_builder;
+
+    auto response = v3::CreatePathCopyJobCancelResponse(builder, found);
+
+    // Wrap response
+    builder.Finish(v3_create_response(
+            builder, v3::ResponseType_PathCopyJobCancelResponse,
+            response.Union()));
+
+    return v3_send_response(fd, builder);
+}
+
 static bool v3_path_delete(int fd, const v3::Request *msg)
 {
     auto request = static_cast<const v3::PathDeleteRequest *>(msg->request());
@@ -559,7 +1141,8 @@ static bool v3_path_delete(int fd, const v3::Request *msg)
         return v3_send_response_invalid(fd);
     }
 
-    fb::FlatBufferBuilder builder;
+    PooledBuilder pooled_builder;
+    auto &builder = *pooled_builder;
     fb::Offset<v3::PathDeleteError> error;
 
     if (!ret) {
@@ -571,7 +1154,7 @@ static bool v3_path_delete(int fd, const v3::Request *msg)
             builder, ret, ret ? nullptr : ec.message().c_str(), error);
 
     // Wrap response
-    builder.Finish(v3::CreateResponse(
+    builder.Finish(v3_create_response(
             builder, v3::ResponseType_PathDeleteResponse, response.Union()));
 
     return v3_send_response(fd, builder);
@@ -591,7 +1174,8 @@ static bool v3_path_mkdir(int fd, const v3::Request *msg)
         return v3_send_response_invalid(fd);
     }
 
-    fb::FlatBufferBuilder builder;
+    PooledBuilder pooled_builder;
+    auto &builder = *pooled_builder;
     fb::Offset<v3::PathMkdirError> error;
 
     oc::result<void> ret = oc::success();
@@ -613,7 +1197,7 @@ static bool v3_path_mkdir(int fd, const v3::Request *msg)
             error);
 
     // Wrap response
-    builder.Finish(v3::CreateResponse(
+    builder.Finish(v3_create_response(
             builder, v3::ResponseType_PathMkdirResponse, response.Union()));
 
     return v3_send_response(fd, builder);
@@ -628,7 +1212,8 @@ static bool v3_path_readlink(int fd, const v3::Request *msg)
 
     auto target = util::read_link(request->path()->str());
 
-    fb::FlatBufferBuilder builder;
+    PooledBuilder pooled_builder;
+    auto &builder = *pooled_builder;
     fb::Offset<v3::PathReadlinkError> error;
 
     if (!target) {
@@ -641,7 +1226,7 @@ static bool v3_path_readlink(int fd, const v3::Request *msg)
             builder, target ? target.value().c_str() : nullptr, error);
 
     // Wrap response
-    builder.Finish(v3::CreateResponse(
+    builder.Finish(v3_create_response(
             builder, v3::ResponseType_PathReadlinkResponse, response.Union()));
 
     return v3_send_response(fd, builder);
@@ -662,7 +1247,8 @@ static bool v3_path_selinux_get_label(int fd, const v3::Request *msg)
         label = util::selinux_lget_context(request->path()->str());
     }
 
-    fb::FlatBufferBuilder builder;
+    PooledBuilder pooled_builder;
+    auto &builder = *pooled_builder;
     fb::Offset<v3::PathSELinuxGetLabelError> error;
 
     if (!label) {
@@ -676,7 +1262,7 @@ static bool v3_path_selinux_get_label(int fd, const v3::Request *msg)
             label ? label.value().c_str() : nullptr, error);
 
     // Wrap response
-    builder.Finish(v3::CreateResponse(
+    builder.Finish(v3_create_response(
             builder, v3::ResponseType_PathSELinuxGetLabelResponse,
             response.Union()));
 
@@ -700,7 +1286,8 @@ static bool v3_path_selinux_set_label(int fd, const v3::Request *msg)
                                          request->label()->str());
     }
 
-    fb::FlatBufferBuilder builder;
+    PooledBuilder pooled_builder;
+    auto &builder = *pooled_builder;
     fb::Offset<v3::PathSELinuxSetLabelError> error;
 
     if (!ret) {
@@ -713,62 +1300,13 @@ static bool v3_path_selinux_set_label(int fd, const v3::Request *msg)
             error);
 
     // Wrap response
-    builder.Finish(v3::CreateResponse(
+    builder.Finish(v3_create_response(
             builder, v3::ResponseType_PathSELinuxSetLabelResponse,
             response.Union()));
 
     return v3_send_response(fd, builder);
 }
 
-class DirectorySizeGetter : public util::FtsWrapper {
-public:
-    DirectorySizeGetter(std::string path, std::vector<std::string> exclusions)
-        : FtsWrapper(path, util::FtsFlag::GroupSpecialFiles)
-        , _exclusions(std::move(exclusions))
-        , _total(0)
-    {
-    }
-
-    Actions on_changed_path() override
-    {
-        // Exclude first-level directories
-        if (_curr->fts_level == 1) {
-            if (std::find(_exclusions.begin(), _exclusions.end(), _curr->fts_name)
-                    != _exclusions.end()) {
-                return Action::Skip;
-            }
-        }
-
-        return Action::Ok;
-    }
-
-    Actions on_reached_file() override
-    {
-        dev_t dev = static_cast<dev_t>(_curr->fts_statp->st_dev);
-        ino_t ino = static_cast<ino_t>(_curr->fts_statp->st_ino);
-
-        // If this file has been visited before (hard link), then skip it
-        if (_links.find(dev) != _links.end()
-                && _links[dev].find(ino) != _links[dev].end()) {
-            return Action::Ok;
-        }
-
-        _total += static_cast<uint64_t>(_curr->fts_statp->st_size);
-        _links[dev].emplace(ino);
-
-        return Action::Ok;
-    }
-
-    uint64_t total() const {
-        return _total;
-    }
-
-private:
-    std::vector<std::string> _exclusions;
-    std::unordered_map<dev_t, std::unordered_set<ino_t>> _links;
-    uint64_t _total;
-};
-
 static bool v3_path_get_directory_size(int fd, const v3::Request *msg)
 {
     auto request = static_cast<const v3::PathGetDirectorySizeRequest *>(
@@ -784,157 +1322,456 @@ static bool v3_path_get_directory_size(int fd, const v3::Request *msg)
         }
     }
 
-    DirectorySizeGetter dsg(request->path()->str(), std::move(exclusions));
-    bool ret = dsg.run();
-    int saved_errno = errno;
+    auto size = directory_size(request->path()->str(), exclusions);
 
-    fb::FlatBufferBuilder builder;
+    PooledBuilder pooled_builder;
+    auto &builder = *pooled_builder;
     fb::Offset<v3::PathGetDirectorySizeError> error;
+    std::string error_msg;
 
-    if (!ret) {
+    if (!size) {
+        error_msg = size.error().message();
         error = v3::CreatePathGetDirectorySizeErrorDirect(
-                builder, saved_errno, strerror(saved_errno));
+                builder, size.error().value(), error_msg.c_str());
     }
 
     auto response = v3::CreatePathGetDirectorySizeResponseDirect(
-            builder, ret, ret ? nullptr : strerror(saved_errno), dsg.total(),
-            error);
+            builder, !!size, size ? nullptr : error_msg.c_str(),
+            size ? size.value() : 0, error);
 
     // Wrap response
-    builder.Finish(v3::CreateResponse(
+    builder.Finish(v3_create_response(
             builder, v3::ResponseType_PathGetDirectorySizeResponse,
             response.Union()));
 
     return v3_send_response(fd, builder);
 }
 
-static void signed_exec_output_cb(int fd, std::string_view line)
+// Record layout returned by getdents64(). The name follows d_type.
+struct LinuxDirent64
 {
-    fb::FlatBufferBuilder builder;
-    auto line_id = builder.CreateString(line.data(), line.size());
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+};
 
-    // Create response
-    auto response = v3::CreateSignedExecOutputResponse(builder, line_id);
+static constexpr size_t DIRENT64_NAME_OFFSET =
+        offsetof(LinuxDirent64, d_type) + 1;
 
-    // Wrap response
-    builder.Finish(v3::CreateResponse(
-            builder, v3::ResponseType_SignedExecOutputResponse,
-            response.Union()));
+static bool v3_path_list_directory(int fd, const v3::Request *msg)
+{
+    auto request = static_cast<const v3::PathListDirectoryRequest *>(
+            msg->request());
+    if (!request->path()) {
+        return v3_send_response_invalid(fd);
+    }
 
-    if (!v3_send_response(fd, builder)) {
-        // Can't kill the connection from this callback (yet...)
-        LOGE("Failed to send output line: %s", strerror(errno));
-    }
-}
+    std::string path = request->path()->str();
+    int stat_flags = request->follow_symlinks() ? 0 : AT_SYMLINK_NOFOLLOW;
 
-static bool v3_signed_exec(int fd, const v3::Request *msg)
-{
-    using namespace std::placeholders;
+    PooledBuilder pooled_builder;
+    auto &builder = *pooled_builder;
+    std::vector<fb::Offset<v3::PathDirectoryEntry>> entries;
+    fb::Offset<v3::PathListDirectoryError> error;
 
-    auto request = static_cast<const v3::SignedExecRequest *>(msg->request());
-    if (!request->binary_path() || !request->signature_path()) {
-        return v3_send_response_invalid(fd);
-    }
+    // The whole listing is built from a single directory fd. Entries are
+    // stat'ed relative to it instead of resolving the full path each time.
+    int dfd = open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dfd < 0) {
+        int saved_errno = errno;
+        error = v3::CreatePathListDirectoryErrorDirect(
+                builder, saved_errno, strerror(saved_errno));
+    } else {
+        auto close_dfd = finally([&] {
+            close(dfd);
+        });
 
-    static const char *temp_dir = "/mbtool_exec_tmp";
+        std::vector<char> buf(64 * 1024);
 
-    std::string target_binary;
-    std::string target_sig;
-    std::vector<std::string> argv;
-    int status;
-    SigVerifyResult sig_result;
-    bool mounted_tmpfs = false;
-    // Variables that are part of the response
-    v3::SignedExecResult result = v3::SignedExecResult_OTHER_ERROR;
-    std::string error_msg;
-    int exit_status = -1;
-    int term_sig = -1;
+        while (true) {
+            long n = syscall(SYS_getdents64, dfd, buf.data(), buf.size());
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                int saved_errno = errno;
+                entries.clear();
+                error = v3::CreatePathListDirectoryErrorDirect(
+                        builder, saved_errno, strerror(saved_errno));
+                break;
+            } else if (n == 0) {
+                break;
+            }
 
-    target_binary = temp_dir;
-    target_binary += "/binary";
-    target_sig = temp_dir;
-    target_sig += "/binary.sig";
+            for (long pos = 0; pos < n;) {
+                const char *record = buf.data() + pos;
+                auto const *d = reinterpret_cast<const LinuxDirent64 *>(record);
+                const char *name = record + DIRENT64_NAME_OFFSET;
+                pos += d->d_reclen;
 
-    // Unmount tmpfs when we're done
-    auto unmount_tmpfs = finally([&]{
-        if (mounted_tmpfs) {
-            umount(temp_dir);
+                if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+                    continue;
+                }
+
+                // Entries that disappear or can't be stat'ed are still
+                // listed, just without the optional fields
+                fb::Offset<v3::StructStat> statbuf;
+                if (request->with_stat()) {
+                    struct stat sb;
+                    if (fstatat(dfd, name, &sb, stat_flags) == 0) {
+                        statbuf = v3_create_struct_stat(builder, sb);
+                    }
+                }
+
+                std::string label;
+                if (request->with_labels()) {
+                    std::string entry_path(path);
+                    entry_path += '/';
+                    entry_path += name;
+
+                    auto result = request->follow_symlinks()
+                            ? util::selinux_get_context(entry_path)
+                            : util::selinux_lget_context(entry_path);
+                    if (result) {
+                        label = std::move(result.value());
+                    }
+                }
+
+                entries.push_back(v3::CreatePathDirectoryEntryDirect(
+                        builder, name, d->d_type, statbuf,
+                        label.empty() ? nullptr : label.c_str()));
+
+                // Send what we have so far as a partial response instead of
+                // letting the builder grow with the size of the directory
+                if (builder.GetSize() >= MAX_RESPONSE_SIZE) {
+                    auto response = v3::CreatePathListDirectoryResponseDirect(
+                            builder, &entries);
+
+                    builder.Finish(v3_create_response(
+                            builder,
+                            v3::ResponseType_PathListDirectoryResponse,
+                            response.Union(), true));
+
+                    if (!v3_send_response(fd, builder)) {
+                        return false;
+                    }
+
+                    builder.Clear();
+                    entries.clear();
+                }
+            }
         }
-    });
+    }
+
+    auto response = v3::CreatePathListDirectoryResponseDirect(
+            builder, error.IsNull() ? &entries : nullptr, error);
+
+    // Wrap response
+    builder.Finish(v3_create_response(
+            builder, v3::ResponseType_PathListDirectoryResponse,
+            response.Union()));
+
+    return v3_send_response(fd, builder);
+}
+
+static void signed_exec_output_cb(int fd, std::string_view line)
+{
+    PooledBuilder pooled_builder;
+    auto &builder = *pooled_builder;
+    auto line_id = builder.CreateString(line.data(), line.size());
+
+    // Create response
+    auto response = v3::CreateSignedExecOutputResponse(builder, line_id);
 
+    // Wrap response
+    builder.Finish(v3_create_response(
+            builder, v3::ResponseType_SignedExecOutputResponse,
+            response.Union()));
+
+    if (!v3_send_response(fd, builder)) {
+        // Can't kill the connection from this callback (yet...)
+        LOGE("Failed to send output line: %s", strerror(errno));
+    }
+}
+
+/*!
+ * \brief Mount a root-only tmpfs at SIGNED_EXEC_DIR
+ *
+ * \param[out] error_msg Error message on failure
+ */
+static bool mount_signed_exec_dir(std::string &error_msg)
+{
     if (mount("", "/", "", MS_REMOUNT, "") < 0) {
-        result = v3::SignedExecResult_OTHER_ERROR;
         error_msg = format("Failed to remount / as rw: %s", strerror(errno));
         LOGE("%s", error_msg.c_str());
-        goto done;
+        return false;
     }
 
-    if ((mkdir(temp_dir, 0000) < 0 && errno != EEXIST)
-            || chmod(temp_dir, 0000) < 0) {
-        result = v3::SignedExecResult_OTHER_ERROR;
+    if ((mkdir(SIGNED_EXEC_DIR, 0000) < 0 && errno != EEXIST)
+            || chmod(SIGNED_EXEC_DIR, 0000) < 0) {
         error_msg = format("Failed to create temp directory: %s",
                            strerror(errno));
         LOGE("%s", error_msg.c_str());
-        goto done;
+        return false;
     }
 
     if (mount("", "/", "", MS_REMOUNT | MS_RDONLY, "") < 0) {
         LOGW("Failed to remount / as ro: %s", strerror(errno));
     }
 
-    if (mount("tmpfs", temp_dir, "tmpfs", 0, "mode=000,uid=0,gid=0") < 0) {
-        result = v3::SignedExecResult_OTHER_ERROR;
+    if (mount("tmpfs", SIGNED_EXEC_DIR, "tmpfs", 0,
+              "mode=000,uid=0,gid=0") < 0) {
         error_msg = format("Failed to mount tmpfs at temp directory: %s",
                            strerror(errno));
         LOGE("%s", error_msg.c_str());
-        goto done;
+        return false;
     }
-    mounted_tmpfs = true;
+
+    return true;
+}
+
+static size_t count_signed_exec_entries()
+{
+    DIR *dp = opendir(SIGNED_EXEC_DIR);
+    if (!dp) {
+        return 0;
+    }
+
+    auto close_dp = finally([&] {
+        closedir(dp);
+    });
+
+    size_t count = 0;
+
+    while (auto ent = readdir(dp)) {
+        if (strcmp(ent->d_name, ".") != 0 && strcmp(ent->d_name, "..") != 0) {
+            ++count;
+        }
+    }
+
+    return count;
+}
+
+static bool is_signed_exec_dir_mounted()
+{
+    struct statfs sfs;
+    return statfs(SIGNED_EXEC_DIR, &sfs) == 0
+            && static_cast<unsigned long>(sfs.f_type) == TMPFS_MAGIC;
+}
+
+/*!
+ * \brief Keep a tmpfs mounted at SIGNED_EXEC_DIR for the daemon's lifetime
+ *
+ * This must be called from the daemon process before any connection is served.
+ * Since isolated requests run in mount namespaces copied from the daemon's, the
+ * tmpfs is shared by all of them and verified binaries copied there by
+ * SignedExec can be reused by later requests.
+ *
+ * \return Whether the directory is available
+ */
+bool setup_signed_exec_dir()
+{
+    if (is_signed_exec_dir_mounted()) {
+        return true;
+    }
+
+    std::string error_msg;
+    return mount_signed_exec_dir(error_msg);
+}
+
+/*!
+ * \brief Get the name of the cached copy of a signed binary
+ *
+ * The name covers the identity and metadata of both the binary and its
+ * signature, so a modified or replaced file never maps to an existing copy.
+ *
+ * \return Name or an empty string if either file could not be stat'ed
+ */
+static std::string signed_exec_cache_name(const std::string &binary,
+                                          const std::string &sig)
+{
+    std::string key;
+
+    for (auto const &path : { binary, sig }) {
+        struct stat sb;
+        if (stat(path.c_str(), &sb) < 0) {
+            return {};
+        }
+
+        key += format("%s:%" PRIu64 ":%" PRIu64 ":%" PRIu64
+                      ":%" PRId64 ".%ld:%" PRId64 ".%ld\n", path.c_str(),
+                      static_cast<uint64_t>(sb.st_dev),
+                      static_cast<uint64_t>(sb.st_ino),
+                      static_cast<uint64_t>(sb.st_size),
+                      static_cast<int64_t>(sb.st_mtim.tv_sec),
+                      static_cast<long>(sb.st_mtim.tv_nsec),
+                      static_cast<int64_t>(sb.st_ctim.tv_sec),
+                      static_cast<long>(sb.st_ctim.tv_nsec));
+    }
+
+    unsigned char digest[SHA512_DIGEST_LENGTH];
+    SHA512(reinterpret_cast<const unsigned char *>(key.data()), key.size(),
+           digest);
+
+    return util::hex_string(digest, SHA512_DIGEST_LENGTH / 2);
+}
+
+/*!
+ * \brief Copy a signed binary to a directory and verify it
+ *
+ * \param[out] result Result on failure
+ * \param[out] error_msg Error message on failure
+ */
+static bool prepare_signed_binary(const v3::SignedExecRequest *request,
+                                  const std::string &target_binary,
+                                  const std::string &target_sig,
+                                  v3::SignedExecResult &result,
+                                  std::string &error_msg)
+{
+    result = v3::SignedExecResult_OTHER_ERROR;
 
     // Copy binary to tmpfs
     if (auto r = util::copy_file(
             request->binary_path()->str(), target_binary, 0); !r) {
-        result = v3::SignedExecResult_OTHER_ERROR;
         error_msg = format("Failed to copy binary to tmpfs: %s",
                            r.error().message().c_str());
         LOGE("%s", error_msg.c_str());
-        goto done;
+        return false;
     }
 
     // Copy signature to tmpfs
     if (auto r = util::copy_file(
             request->signature_path()->str(), target_sig, 0); !r) {
-        result = v3::SignedExecResult_OTHER_ERROR;
         error_msg = format("Failed to copy signature to tmpfs: %s",
                            r.error().message().c_str());
         LOGE("%s", error_msg.c_str());
-        goto done;
+        return false;
     }
 
     // Verify signature
-    sig_result = verify_signature(target_binary.c_str(), target_sig.c_str());
+    auto sig_result = verify_signature(target_binary.c_str(),
+                                       target_sig.c_str());
     if (sig_result != SigVerifyResult::Valid) {
         if (sig_result == SigVerifyResult::Invalid) {
             result = v3::SignedExecResult_INVALID_SIGNATURE;
             error_msg = format("%s: Invalid signature",
                                request->binary_path()->c_str());
         } else {
-            result = v3::SignedExecResult_OTHER_ERROR;
             error_msg = format("%s: Failed to verify signature",
                                request->binary_path()->c_str());
         }
 
         LOGE("%s", error_msg.c_str());
-        goto done;
+        return false;
     }
 
     // Make binary executable
     if (chmod(target_binary.c_str(), 0700) < 0) {
-        result = v3::SignedExecResult_OTHER_ERROR;
         error_msg = format("Failed to chmod binary in tmpfs: %s",
                            strerror(errno));
         LOGE("%s", error_msg.c_str());
-        goto done;
+        return false;
+    }
+
+    return true;
+}
+
+static bool v3_signed_exec(int fd, const v3::Request *msg)
+{
+    using namespace std::placeholders;
+
+    auto request = static_cast<const v3::SignedExecRequest *>(msg->request());
+    if (!request->binary_path() || !request->signature_path()) {
+        return v3_send_response_invalid(fd);
+    }
+
+    std::string exec_dir;
+    std::string staging_dir;
+    std::string cache_name;
+    std::string target_binary;
+    std::string target_sig;
+    std::vector<std::string> argv;
+    int status;
+    bool mounted_tmpfs = false;
+    // Variables that are part of the response
+    v3::SignedExecResult result = v3::SignedExecResult_OTHER_ERROR;
+    std::string error_msg;
+    int exit_status = -1;
+    int term_sig = -1;
+
+    // Unmount tmpfs when we're done
+    auto unmount_tmpfs = finally([&]{
+        if (!staging_dir.empty()) {
+            (void) util::delete_recursive(staging_dir);
+        }
+        if (mounted_tmpfs) {
+            umount(SIGNED_EXEC_DIR);
+        }
+    });
+
+    if (is_signed_exec_dir_mounted()) {
+        // Shared with other requests (see setup_signed_exec_dir()). A binary
+        // is only published under its cache name after it has been verified.
+        cache_name = signed_exec_cache_name(request->binary_path()->str(),
+                                            request->signature_path()->str());
+
+        struct stat sb;
+        if (!cache_name.empty()) {
+            exec_dir = SIGNED_EXEC_DIR "/" + cache_name;
+        }
+        if (!exec_dir.empty() && stat(exec_dir.c_str(), &sb) == 0
+                && S_ISDIR(sb.st_mode)) {
+            LOGV("%s: Using previously verified copy",
+                 request->binary_path()->c_str());
+        } else {
+            staging_dir = SIGNED_EXEC_DIR "/staging.XXXXXX";
+            if (!mkdtemp(staging_dir.data())) {
+                staging_dir.clear();
+                error_msg = format("Failed to create temp directory: %s",
+                                   strerror(errno));
+                LOGE("%s", error_msg.c_str());
+                goto done;
+            }
+            exec_dir = staging_dir;
+        }
+    } else {
+        if (!mount_signed_exec_dir(error_msg)) {
+            goto done;
+        }
+        mounted_tmpfs = true;
+        exec_dir = SIGNED_EXEC_DIR;
+    }
+
+    target_binary = exec_dir + "/binary";
+    target_sig = exec_dir + "/binary.sig";
+
+    if (exec_dir == SIGNED_EXEC_DIR || exec_dir == staging_dir) {
+        if (!prepare_signed_binary(request, target_binary, target_sig,
+                                   result, error_msg)) {
+            goto done;
+        }
+    }
+
+    // Publish the verified copy if the source files didn't change while they
+    // were being copied
+    if (!staging_dir.empty() && !cache_name.empty()
+            && signed_exec_cache_name(request->binary_path()->str(),
+                                      request->signature_path()->str())
+                    == cache_name) {
+        std::string cache_dir = SIGNED_EXEC_DIR "/" + cache_name;
+
+        if (count_signed_exec_entries() > SIGNED_EXEC_MAX_CACHED) {
+            (void) util::delete_contents(SIGNED_EXEC_DIR,
+                                         { util::base_name(staging_dir) });
+        }
+
+        if (rename(staging_dir.c_str(), cache_dir.c_str()) == 0) {
+            staging_dir.clear();
+            exec_dir = cache_dir;
+            target_binary = exec_dir + "/binary";
+            target_sig = exec_dir + "/binary.sig";
+        }
     }
 
     // Build arguments
@@ -970,7 +1807,8 @@ static bool v3_signed_exec(int fd, const v3::Request *msg)
     }
 
 done:
-    fb::FlatBufferBuilder builder;
+    PooledBuilder pooled_builder;
+    auto &builder = *pooled_builder;
     fb::Offset<fb::String> error_msg_id = 0;
     fb::Offset<v3::SignedExecError> error;
 
@@ -985,7 +1823,7 @@ done:
             builder, result, error_msg_id, exit_status, term_sig, error);
 
     // Wrap response
-    builder.Finish(v3::CreateResponse(
+    builder.Finish(v3_create_response(
             builder, v3::ResponseType_SignedExecResponse, response.Union()));
 
     return v3_send_response(fd, builder);
@@ -995,9 +1833,10 @@ static bool v3_mb_get_booted_rom_id(int fd, const v3::Request *msg)
 {
     (void) msg;
 
-    fb::FlatBufferBuilder builder;
+    PooledBuilder pooled_builder;
+    auto &builder = *pooled_builder;
     fb::Offset<fb::String> id;
-    auto rom = Roms::get_current_rom();
+    auto rom = BootContext::instance().current_rom();
     if (rom) {
         id = builder.CreateString(rom->id);
     }
@@ -1006,7 +1845,7 @@ static bool v3_mb_get_booted_rom_id(int fd, const v3::Request *msg)
     auto response = v3::CreateMbGetBootedRomIdResponse(builder, id);
 
     // Wrap response
-    builder.Finish(v3::CreateResponse(
+    builder.Finish(v3_create_response(
             builder, v3::ResponseType_MbGetBootedRomIdResponse,
             response.Union()));
 
@@ -1017,61 +1856,28 @@ static bool v3_mb_get_installed_roms(int fd, const v3::Request *msg)
 {
     (void) msg;
 
-    fb::FlatBufferBuilder builder;
-
-    Roms roms;
-    roms.add_installed();
+    PooledBuilder pooled_builder;
+    auto &builder = *pooled_builder;
 
     std::vector<fb::Offset<v3::MbRom>> fb_roms;
 
-    for (auto r : roms.roms) {
-        std::string system_path = r->full_system_path();
-        std::string cache_path = r->full_cache_path();
-        std::string data_path = r->full_data_path();
-
-        auto fb_id = builder.CreateString(r->id);
-        auto fb_system_path = builder.CreateString(system_path);
-        auto fb_cache_path = builder.CreateString(cache_path);
-        auto fb_data_path = builder.CreateString(data_path);
+    for (auto const &entry : rom_catalog_get()) {
+        auto fb_id = builder.CreateString(entry.rom->id);
+        auto fb_system_path = builder.CreateString(entry.system_path);
+        auto fb_cache_path = builder.CreateString(entry.cache_path);
+        auto fb_data_path = builder.CreateString(entry.data_path);
         fb::Offset<fb::String> fb_version;
         fb::Offset<fb::String> fb_build;
+        fb::Offset<fb::String> fb_thumbnail_path;
 
-        std::string build_prop;
-        if (r->system_is_image) {
-            build_prop += "/raw/images/";
-            build_prop += r->id;
-        } else {
-            build_prop += system_path;
+        if (!entry.version.empty()) {
+            fb_version = builder.CreateString(entry.version);
         }
-        build_prop += "/build.prop";
-
-        struct {
-            const char *key;
-            fb::Offset<fb::String> &offset;
-        } needed_props[] = {
-            { "ro.build.version.release", fb_version },
-            { "ro.build.display.id", fb_build },
-        };
-
-        RomConfig config;
-        config.load_file(r->config_path());
-        auto &props = config.cached_props;
-
-        util::property_file_iter(build_prop, {}, [&](std::string_view key,
-                                                     std::string_view value) {
-            for (auto const &item : needed_props) {
-                if (item.key == key) {
-                    props.insert_or_assign(std::string(key), std::string(value));
-                }
-            }
-
-            return util::PropertyIterAction::Continue;
-        });
-
-        for (auto const &item : needed_props) {
-            if (auto it = props.find(item.key); it != props.end()) {
-                item.offset = builder.CreateString(it->second);
-            }
+        if (!entry.build.empty()) {
+            fb_build = builder.CreateString(entry.build);
+        }
+        if (!entry.thumbnail_path.empty()) {
+            fb_thumbnail_path = builder.CreateString(entry.thumbnail_path);
         }
 
         v3::MbRomBuilder mrb(builder);
@@ -1081,6 +1887,7 @@ static bool v3_mb_get_installed_roms(int fd, const v3::Request *msg)
         mrb.add_data_path(fb_data_path);
         mrb.add_version(fb_version);
         mrb.add_build(fb_build);
+        mrb.add_thumbnail_path(fb_thumbnail_path);
         auto fb_rom = mrb.Finish();
 
         fb_roms.push_back(fb_rom);
@@ -1091,7 +1898,7 @@ static bool v3_mb_get_installed_roms(int fd, const v3::Request *msg)
             builder, &fb_roms);
 
     // Wrap response
-    builder.Finish(v3::CreateResponse(
+    builder.Finish(v3_create_response(
             builder, v3::ResponseType_MbGetInstalledRomsResponse,
             response.Union()));
 
@@ -1102,13 +1909,14 @@ static bool v3_mb_get_version(int fd, const v3::Request *msg)
 {
     (void) msg;
 
-    fb::FlatBufferBuilder builder;
+    PooledBuilder pooled_builder;
+    auto &builder = *pooled_builder;
 
     // Get version
     auto response = v3::CreateMbGetVersionResponseDirect(builder, version());
 
     // Wrap response
-    builder.Finish(v3::CreateResponse(
+    builder.Finish(v3_create_response(
             builder, v3::ResponseType_MbGetVersionResponse, response.Union()));
 
     return v3_send_response(fd, builder);
@@ -1121,7 +1929,8 @@ static bool v3_mb_set_kernel(int fd, const v3::Request *msg)
         return v3_send_response_invalid(fd);
     }
 
-    fb::FlatBufferBuilder builder;
+    PooledBuilder pooled_builder;
+    auto &builder = *pooled_builder;
     fb::Offset<v3::MbSetKernelError> error;
 
     bool ret = set_kernel(request->rom_id()->str(),
@@ -1135,7 +1944,7 @@ static bool v3_mb_set_kernel(int fd, const v3::Request *msg)
     auto response = v3::CreateMbSetKernelResponse(builder, ret, error);
 
     // Wrap response
-    builder.Finish(v3::CreateResponse(
+    builder.Finish(v3_create_response(
             builder, v3::ResponseType_MbSetKernelResponse, response.Union()));
 
     return v3_send_response(fd, builder);
@@ -1158,7 +1967,8 @@ static bool v3_mb_switch_rom(int fd, const v3::Request *msg)
 
     bool force_update_checksums = request->force_update_checksums();
 
-    fb::FlatBufferBuilder builder;
+    PooledBuilder pooled_builder;
+    auto &builder = *pooled_builder;
     fb::Offset<v3::MbSwitchRomError> error;
 
     SwitchRomResult ret = switch_rom(request->rom_id()->str(),
@@ -1192,12 +2002,32 @@ static bool v3_mb_switch_rom(int fd, const v3::Request *msg)
             builder, success, fb_ret, error);
 
     // Wrap response
-    builder.Finish(v3::CreateResponse(
+    builder.Finish(v3_create_response(
             builder, v3::ResponseType_MbSwitchRomResponse, response.Union()));
 
     return v3_send_response(fd, builder);
 }
 
+static void v3_mb_wipe_rom_send_progress(int fd, const WipeProgress &progress,
+                                         uint32_t targets_total)
+{
+    PooledBuilder pooled_builder;
+    auto &builder = *pooled_builder;
+
+    auto response = v3::CreateMbWipeRomProgressResponse(
+            builder, progress.deleted.entries, progress.targets_done,
+            targets_total);
+
+    // Wrap response
+    builder.Finish(v3_create_response(
+            builder, v3::ResponseType_MbWipeRomProgressResponse,
+            response.Union()));
+
+    if (!v3_send_response(fd, builder)) {
+        LOGE("Failed to send wipe progress: %s", strerror(errno));
+    }
+}
+
 static bool v3_mb_wipe_rom(int fd, const v3::Request *msg)
 {
     auto request = static_cast<const v3::MbWipeRomRequest *>(msg->request());
@@ -1217,7 +2047,7 @@ static bool v3_mb_wipe_rom(int fd, const v3::Request *msg)
     }
 
     // The GUI should check this, but we'll enforce it here
-    auto current_rom = Roms::get_current_rom();
+    auto current_rom = BootContext::instance().current_rom();
     if (current_rom && current_rom->id == rom->id) {
         LOGE("Cannot wipe currently booted ROM: %s", rom->id.c_str());
         return v3_send_response_invalid(fd);
@@ -1234,39 +2064,85 @@ static bool v3_mb_wipe_rom(int fd, const v3::Request *msg)
                  raw_system.c_str(), strerror(errno));
         }
 
-        for (short target : *request->targets()) {
-            bool success = false;
+        std::vector<int16_t> fb_targets;
+        std::vector<WipeTarget> targets;
 
+        for (short target : *request->targets()) {
             if (target == v3::MbWipeTarget_SYSTEM) {
-                success = wipe_system(rom);
+                targets.push_back(WipeTarget::System);
             } else if (target == v3::MbWipeTarget_CACHE) {
-                success = wipe_cache(rom);
+                targets.push_back(WipeTarget::Cache);
             } else if (target == v3::MbWipeTarget_DATA) {
-                success = wipe_data(rom);
+                targets.push_back(WipeTarget::Data);
             } else if (target == v3::MbWipeTarget_DALVIK_CACHE) {
-                success = wipe_dalvik_cache(rom);
+                targets.push_back(WipeTarget::DalvikCache);
             } else if (target == v3::MbWipeTarget_MULTIBOOT) {
-                success = wipe_multiboot(rom);
+                targets.push_back(WipeTarget::Multiboot);
             } else {
                 LOGE("Unknown wipe target %d", target);
+                failed.push_back(target);
+                continue;
             }
 
-            if (success) {
-                succeeded.push_back(target);
+            fb_targets.push_back(target);
+        }
+
+        WipeProgress progress;
+        std::vector<bool> results;
+
+        if (request->report_progress()) {
+            std::mutex mutex;
+            std::condition_variable cv;
+            bool done = false;
+
+            std::thread wiper([&] {
+                auto r = wipe_rom(rom, targets, &progress);
+
+                std::lock_guard<std::mutex> guard(mutex);
+                results = std::move(r);
+                done = true;
+                cv.notify_one();
+            });
+
+            {
+                std::unique_lock<std::mutex> guard(mutex);
+
+                while (!cv.wait_for(guard, WIPE_PROGRESS_INTERVAL,
+                                    [&] { return done; })) {
+                    guard.unlock();
+                    v3_mb_wipe_rom_send_progress(
+                            fd, progress,
+                            static_cast<uint32_t>(request->targets()->size()));
+                    guard.lock();
+                }
+            }
+
+            wiper.join();
+        } else {
+            results = wipe_rom(rom, targets, &progress);
+        }
+
+        LOGV("Wiped %zu targets and deleted %" PRIu64 " entries",
+             targets.size(), progress.deleted.entries.load());
+
+        for (size_t i = 0; i < targets.size(); ++i) {
+            if (results[i]) {
+                succeeded.push_back(fb_targets[i]);
             } else {
-                failed.push_back(target);
+                failed.push_back(fb_targets[i]);
             }
         }
     }
 
-    fb::FlatBufferBuilder builder;
+    PooledBuilder pooled_builder;
+    auto &builder = *pooled_builder;
 
     // Create response
     auto response = v3::CreateMbWipeRomResponseDirect(
             builder, &succeeded, &failed);
 
     // Wrap response
-    builder.Finish(v3::CreateResponse(
+    builder.Finish(v3_create_response(
             builder, v3::ResponseType_MbWipeRomResponse, response.Union()));
 
     return v3_send_response(fd, builder);
@@ -1292,14 +2168,17 @@ static bool v3_mb_get_packages_count(int fd, const v3::Request *msg)
     std::string packages_xml(rom->full_data_path());
     packages_xml += "/system/packages.xml";
 
-    fb::FlatBufferBuilder builder;
+    PooledBuilder pooled_builder;
+    auto &builder = *pooled_builder;
     fb::Offset<v3::MbGetPackagesCountError> error;
     unsigned int system_pkgs = 0;
     unsigned int update_pkgs = 0;
     unsigned int other_pkgs = 0;
 
     Packages pkgs;
-    bool ret = pkgs.load_xml(packages_xml);
+    bool ret = pkgs.load_cached(
+            packages_xml, patch_cache_path("packages_" + rom->id + ".bin"),
+            PackagesLoadFlag::SkipSigs);
 
     if (ret) {
         for (std::shared_ptr<Package> pkg : pkgs.pkgs) {
@@ -1324,18 +2203,54 @@ static bool v3_mb_get_packages_count(int fd, const v3::Request *msg)
             builder, ret, system_pkgs, update_pkgs, other_pkgs, error);
 
     // Wrap response
-    builder.Finish(v3::CreateResponse(
+    builder.Finish(v3_create_response(
             builder, v3::ResponseType_MbGetPackagesCountResponse,
             response.Union()));
 
     return v3_send_response(fd, builder);
 }
 
+static bool v3_mb_get_perf_counters(int fd, const v3::Request *msg)
+{
+    auto request = static_cast<const v3::MbGetPerfCountersRequest *>(
+            msg->request());
+
+    auto metrics = perf::snapshot();
+    if (request->reset()) {
+        perf::reset();
+    }
+
+    PooledBuilder pooled_builder;
+    auto &builder = *pooled_builder;
+    std::vector<fb::Offset<v3::PerfMetric>> fb_metrics;
+
+    for (auto const &m : metrics) {
+        fb_metrics.push_back(v3::CreatePerfMetricDirect(
+                builder, m.name.c_str(),
+                m.type == perf::MetricType::Histogram
+                        ? v3::PerfMetricType_HISTOGRAM
+                        : v3::PerfMetricType_COUNTER,
+                m.count, m.sum, m.max,
+                m.buckets.empty() ? nullptr : &m.buckets));
+    }
+
+    auto response = v3::CreateMbGetPerfCountersResponseDirect(
+            builder, &fb_metrics);
+
+    // Wrap response
+    builder.Finish(v3_create_response(
+            builder, v3::ResponseType_MbGetPerfCountersResponse,
+            response.Union()));
+
+    return v3_send_response(fd, builder);
+}
+
 static bool v3_reboot(int fd, const v3::Request *msg)
 {
     auto request = static_cast<const v3::RebootRequest *>(msg->request());
 
-    fb::FlatBufferBuilder builder;
+    PooledBuilder pooled_builder;
+    auto &builder = *pooled_builder;
     fb::Offset<v3::RebootError> error;
 
     std::string reboot_arg;
@@ -1369,7 +2284,7 @@ static bool v3_reboot(int fd, const v3::Request *msg)
     auto response = v3::CreateRebootResponse(builder, ret, error);
 
     // Wrap response
-    builder.Finish(v3::CreateResponse(
+    builder.Finish(v3_create_response(
             builder, v3::ResponseType_RebootResponse, response.Union()));
 
     return v3_send_response(fd, builder);
@@ -1379,7 +2294,8 @@ static bool v3_shutdown(int fd, const v3::Request *msg)
 {
     auto request = static_cast<const v3::ShutdownRequest *>(msg->request());
 
-    fb::FlatBufferBuilder builder;
+    PooledBuilder pooled_builder;
+    auto &builder = *pooled_builder;
     fb::Offset<v3::ShutdownError> error;
 
     // The client probably won't get the chance to see the success message, but
@@ -1408,7 +2324,7 @@ static bool v3_shutdown(int fd, const v3::Request *msg)
     auto response = v3::CreateShutdownResponse(builder, ret, error);
 
     // Wrap response
-    builder.Finish(v3::CreateResponse(
+    builder.Finish(v3_create_response(
             builder, v3::ResponseType_ShutdownResponse, response.Union()));
 
     return v3_send_response(fd, builder);
@@ -1425,6 +2341,7 @@ struct RequestMap
 static RequestMap request_map[] = {
     { v3::RequestType_FileChmodRequest, v3_file_chmod },
     { v3::RequestType_FileCloseRequest, v3_file_close },
+    { v3::RequestType_FileGetFdRequest, v3_file_get_fd },
     { v3::RequestType_FileOpenRequest, v3_file_open },
     { v3::RequestType_FileReadRequest, v3_file_read },
     { v3::RequestType_FileSeekRequest, v3_file_seek },
@@ -1434,12 +2351,15 @@ static RequestMap request_map[] = {
     { v3::RequestType_FileWriteRequest, v3_file_write },
     { v3::RequestType_PathChmodRequest, v3_path_chmod },
     { v3::RequestType_PathCopyRequest, v3_path_copy },
+    { v3::RequestType_PathCopyJobStartRequest, v3_path_copy_job_start },
+    { v3::RequestType_PathCopyJobCancelRequest, v3_path_copy_job_cancel },
     { v3::RequestType_PathDeleteRequest, v3_path_delete },
     { v3::RequestType_PathMkdirRequest, v3_path_mkdir },
     { v3::RequestType_PathReadlinkRequest, v3_path_readlink },
     { v3::RequestType_PathSELinuxGetLabelRequest, v3_path_selinux_get_label },
     { v3::RequestType_PathSELinuxSetLabelRequest, v3_path_selinux_set_label },
     { v3::RequestType_PathGetDirectorySizeRequest, v3_path_get_directory_size },
+    { v3::RequestType_PathListDirectoryRequest, v3_path_list_directory },
     { v3::RequestType_SignedExecRequest, v3_signed_exec },
     { v3::RequestType_MbGetBootedRomIdRequest, v3_mb_get_booted_rom_id },
     { v3::RequestType_MbGetInstalledRomsRequest, v3_mb_get_installed_roms },
@@ -1448,25 +2368,381 @@ static RequestMap request_map[] = {
     { v3::RequestType_MbSwitchRomRequest, v3_mb_switch_rom },
     { v3::RequestType_MbWipeRomRequest, v3_mb_wipe_rom },
     { v3::RequestType_MbGetPackagesCountRequest, v3_mb_get_packages_count },
+    { v3::RequestType_MbGetPerfCountersRequest, v3_mb_get_perf_counters },
     { v3::RequestType_RebootRequest, v3_reboot },
     { v3::RequestType_ShutdownRequest, v3_shutdown },
     { v3::RequestType_NONE, nullptr }
 };
 
-bool connection_version_3(int fd)
+/*!
+ * \brief Check if a request must not run in a shared daemon process
+ *
+ * These requests mount filesystems, flash the boot partition, or run external
+ * programs (which requires waiting for child processes, but the daemon ignores
+ * SIGCHLD), so they are kept out of the daemon process.
+ */
+static bool is_isolated_request(v3::RequestType type)
+{
+    switch (type) {
+    case v3::RequestType_SignedExecRequest:
+    case v3::RequestType_MbSetKernelRequest:
+    case v3::RequestType_MbSwitchRomRequest:
+    case v3::RequestType_MbWipeRomRequest:
+    case v3::RequestType_RebootRequest:
+    case v3::RequestType_ShutdownRequest:
+        return true;
+    default:
+        return false;
+    }
+}
+
+/*!
+ * \brief Run a request handler in a child process
+ *
+ * The child process gets its own mount namespace (unless disabled) so that
+ * mounts made by the handler (eg. SignedExec remounting the rootfs) are not
+ * visible to the daemon or other connections. The child writes the response
+ * directly to the client socket and reports the handler's return value back
+ * through a pipe.
+ *
+ * \return Handler return value or false if the child process failed
+ */
+static bool run_isolated(request_handler_fn fn, int fd,
+                         const v3::Request *request,
+                         const ConnectionOptions &options)
+{
+    int pipe_fds[2];
+    if (pipe2(pipe_fds, O_CLOEXEC) < 0) {
+        LOGE("Failed to create pipe: %s", strerror(errno));
+        return false;
+    }
+
+    // Copy jobs must not write to the socket while the child owns it
+    auto lock = v3_lock_writes();
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        LOGE("Failed to fork: %s", strerror(errno));
+        close(pipe_fds[0]);
+        close(pipe_fds[1]);
+        return false;
+    } else if (pid == 0) {
+        close(pipe_fds[0]);
+
+        // The child has no other threads. Its copy of the lock is held.
+        write_lock = nullptr;
+
+        // Restore default SIGCHLD handler so that the handler can wait for
+        // the processes it spawns
+        struct sigaction sa;
+        sa.sa_handler = SIG_DFL;
+        sigemptyset(&sa.sa_mask);
+        sa.sa_flags = 0;
+        if (sigaction(SIGCHLD, &sa, 0) < 0) {
+            LOGE("Failed to set default SIGCHLD handler: %s",
+                 strerror(errno));
+            _exit(127);
+        }
+
+        // Change the process name so --replace doesn't kill the request
+        (void) util::set_process_title("mbtool connection request");
+
+        if (options.unshare_mounts) {
+            if (unshare(CLONE_NEWNS) < 0) {
+                LOGE("unshare() failed: %s", strerror(errno));
+                _exit(127);
+            }
+
+            if (mount("", "/", "", MS_PRIVATE | MS_REC, "") < 0) {
+                LOGE("Failed to set private mount propagation: %s",
+                     strerror(errno));
+                _exit(127);
+            }
+        }
+
+        char result = fn(fd, request) ? 1 : 0;
+        ssize_t n = write(pipe_fds[1], &result, 1);
+        _exit(n == 1 ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    close(pipe_fds[1]);
+
+    // The daemon ignores SIGCHLD, so the child is reaped automatically. Its
+    // result is read from the pipe instead of the exit status. EOF without a
+    // result means that the child died.
+    char result = 0;
+    ssize_t n;
+    do {
+        n = read(pipe_fds[0], &result, 1);
+    } while (n < 0 && errno == EINTR);
+
+    close(pipe_fds[0]);
+
+    return n == 1 && result;
+}
+
+/*!
+ * \brief Get the latency histogram for a request type
+ *
+ * The histograms are named "daemon.v3.<request type>" and record the time
+ * taken to handle each request in microseconds, including the time spent in
+ * the child process for isolated requests.
+ */
+static perf::Histogram & request_histogram(v3::RequestType type)
+{
+    static auto histograms = [] {
+        std::vector<std::unique_ptr<perf::Histogram>> result;
+        for (auto t : v3::EnumValuesRequestType()) {
+            result.push_back(std::make_unique<perf::Histogram>(
+                    format("daemon.v3.%s", v3::EnumNameRequestType(t))));
+        }
+        return result;
+    }();
+
+    return *histograms[static_cast<size_t>(type)];
+}
+
+/*!
+ * \brief Handle a single request
+ *
+ * \return False if a connection error occurred. Failed operations are
+ *         reported to the client and do not count as connection errors.
+ */
+static bool v3_dispatch(int fd, const v3::Request *request,
+                        const ConnectionOptions &options)
+{
+    v3::RequestType type = request->request_type();
+    request_handler_fn fn = nullptr;
+
+    request_id = request->id();
+
+    for (auto iter = request_map; iter->fn; ++iter) {
+        if (type == iter->type) {
+            fn = iter->fn;
+            break;
+        }
+    }
+
+    if (!fn) {
+        // Invalid command; allow further commands
+        return v3_send_response_unsupported(fd);
+    }
+
+    perf::ScopedTimer timer(request_histogram(type));
+
+    if (options.isolate_privileged && is_isolated_request(type)) {
+        return run_isolated(fn, fd, request, options);
+    } else {
+        return fn(fd, request);
+    }
+}
+
+/*!
+ * \brief Check if a request may run on a background worker
+ *
+ * These requests can take minutes on large directories or ROMs. They only
+ * operate on paths, not on the connection's open files, so they can safely run
+ * alongside the requests that follow them.
+ */
+static bool is_background_request(v3::RequestType type)
+{
+    switch (type) {
+    case v3::RequestType_PathCopyRequest:
+    case v3::RequestType_PathDeleteRequest:
+    case v3::RequestType_PathGetDirectorySizeRequest:
+    case v3::RequestType_MbWipeRomRequest:
+        return true;
+    default:
+        return false;
+    }
+}
+
+/*!
+ * \brief Requests that the client asked to run in the background
+ *
+ * Workers are started on demand, up to MAX_BACKGROUND_WORKERS per connection,
+ * and run with a lowered I/O priority so that the connection's inline
+ * requests (and other connections) stay responsive. Each request's responses
+ * are sent from the worker as soon as they are ready.
+ *
+ * When the connection ends, running requests are allowed to finish, but
+ * queued requests are dropped since there is no one left to receive the
+ * responses.
+ */
+class BackgroundQueue
+{
+public:
+    BackgroundQueue(int fd, const ConnectionOptions &options,
+                    std::recursive_mutex &write_lock)
+        : m_fd(fd)
+        , m_options(options)
+        , m_write_lock(write_lock)
+        , m_idle(0)
+        , m_stop(false)
+    {
+    }
+
+    ~BackgroundQueue()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_cv.notify_all();
+
+        for (auto &t : m_workers) {
+            t.join();
+        }
+    }
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(BackgroundQueue)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(BackgroundQueue)
+
+    /*!
+     * \brief Queue a verified request frame
+     */
+    void submit(std::vector<unsigned char> frame)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        m_pending.push_back(std::move(frame));
+
+        if (m_idle < m_pending.size()
+                && m_workers.size() < MAX_BACKGROUND_WORKERS) {
+            m_workers.emplace_back(&BackgroundQueue::worker, this);
+        } else {
+            m_cv.notify_one();
+        }
+    }
+
+private:
+    void worker()
+    {
+        write_lock = &m_write_lock;
+
+        if (auto r = util::io_set_bulk_priority(); !r) {
+            LOGW("Failed to lower I/O priority: %s",
+                 r.error().message().c_str());
+        }
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+
+        while (true) {
+            ++m_idle;
+            m_cv.wait(lock, [&] { return m_stop || !m_pending.empty(); });
+            --m_idle;
+
+            if (m_stop) {
+                break;
+            }
+
+            auto frame = std::move(m_pending.front());
+            m_pending.pop_front();
+
+            lock.unlock();
+
+            const v3::Request *request = v3::GetRequest(frame.data());
+            if (!v3_dispatch(m_fd, request, m_options)) {
+                LOGW("Failed to send response for background request %"
+                     PRIu64, request->id());
+            }
+
+            lock.lock();
+        }
+
+        builder_pool.clear();
+    }
+
+    int m_fd;
+    const ConnectionOptions &m_options;
+    std::recursive_mutex &m_write_lock;
+
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::deque<std::vector<unsigned char>> m_pending;
+    std::vector<std::thread> m_workers;
+    size_t m_idle;
+    bool m_stop;
+};
+
+/*!
+ * \brief Handle all requests in a BatchRequest
+ *
+ * The requests are handled in order and their responses are sent as soon as
+ * they are ready, so a client can submit many operations in one frame without
+ * waiting for a round trip for each one. A BatchResponse with the batch's ID
+ * is sent at the end. Nested batches are not allowed.
+ */
+static bool v3_batch(int fd, const v3::Request *msg,
+                     const ConnectionOptions &options)
+{
+    auto batch = static_cast<const v3::BatchRequest *>(msg->request());
+    uint32_t count = 0;
+
+    if (batch->requests()) {
+        for (const v3::Request *request : *batch->requests()) {
+            bool ret;
+
+            if (request->request_type() == v3::RequestType_BatchRequest) {
+                request_id = request->id();
+                ret = v3_send_response_invalid(fd);
+            } else {
+                ret = v3_dispatch(fd, request, options);
+            }
+
+            if (!ret) {
+                return false;
+            }
+
+            ++count;
+        }
+    }
+
+    request_id = msg->id();
+
+    PooledBuilder pooled_builder;
+    auto &builder = *pooled_builder;
+    auto response = v3::CreateBatchResponse(builder, count);
+
+    // Wrap response
+    builder.Finish(v3_create_response(
+            builder, v3::ResponseType_BatchResponse, response.Union()));
+
+    return v3_send_response(fd, builder);
+}
+
+bool connection_version_3(int fd, const ConnectionOptions &options)
 {
     std::string command;
+    std::recursive_mutex conn_write_lock;
+
+    write_lock = &conn_write_lock;
+
+    auto stop_copy_jobs = finally([&]{
+        // Jobs write to the socket, so they must be gone before it is closed
+        v3_path_copy_job_reap(true);
+        write_lock = nullptr;
+    });
+
+    auto free_builders = finally([&]{
+        // Don't hold on to response buffers while the thread is idle
+        builder_pool.clear();
+    });
 
     auto close_all_fds = finally([&]{
         // Ensure opened fd's are closed if the connection is lost
-        for (auto &p : fd_map) {
-            close(p.second);
-        }
-        fd_map.clear();
+        open_files.close_all();
     });
 
+    // Declared after the write lock, which its workers use
+    BackgroundQueue background(fd, options, conn_write_lock);
+
+    // Requests are read through a buffer so that the length prefix and the
+    // data usually arrive in a single read
+    util::SocketReader reader(fd);
+
     while (1) {
-        auto data = util::socket_read_bytes(fd);
+        auto data = reader.read_bytes();
         if (!data) {
             LOGE("Failed to read request: %s",  data.error().message().c_str());
             return false;
@@ -1479,25 +2755,21 @@ bool connection_version_3(int fd)
         }
 
         const v3::Request *request = v3::GetRequest(data.value().data());
-        v3::RequestType type = request->request_type();
-        request_handler_fn fn = nullptr;
 
-        for (auto iter = request_map; iter->fn; ++iter) {
-            if (type == iter->type) {
-                fn = iter->fn;
-                break;
-            }
+        if (request->background()
+                && is_background_request(request->request_type())) {
+            background.submit(std::move(data.value()));
+            continue;
         }
 
         // NOTE: A false return value indicates a connection error, not a
         //       command failure!
-        bool ret = true;
+        bool ret;
 
-        if (fn) {
-            ret = fn(fd, request);
+        if (request->request_type() == v3::RequestType_BatchRequest) {
+            ret = v3_batch(fd, request, options);
         } else {
-            // Invalid command; allow further commands
-            ret = v3_send_response_unsupported(fd);
+            ret = v3_dispatch(fd, request, options);
         }
 
         if (!ret) {
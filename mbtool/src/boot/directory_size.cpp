@@ -0,0 +1,484 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "boot/directory_size.h"
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+
+#include <cerrno>
+#include <cstring>
+
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "mbcommon/error_code.h"
+#include "mblog/logging.h"
+#include "mbutil/fts.h"
+
+#define LOG_TAG "mbtool/boot/directory_size"
+
+// Upper bound on the number of threads used to walk a directory tree
+#define MAX_WALK_THREADS        4
+
+#define WATCH_MASK \
+    (IN_CREATE | IN_DELETE | IN_MODIFY | IN_MOVED_FROM | IN_MOVED_TO \
+            | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR)
+
+namespace mb
+{
+
+// Directory sizes are cached in the daemon, keyed by the path and the set of
+// exclusions. Every directory in a cached tree has an inotify watch, so any
+// change inside the tree invalidates the entry. If a watch can't be added (eg.
+// max_user_watches is reached), the result is returned, but not cached.
+
+struct CacheEntry
+{
+    // Whether the walk finished and `total` is usable
+    bool complete = false;
+    // Cleared when an inotify event is received for one of the watches
+    bool valid = true;
+    uint64_t total = 0;
+    // Watch descriptors used by this entry
+    std::unordered_set<int> wds;
+};
+
+static std::once_flag g_cache_once;
+static std::mutex g_cache_lock;
+static int g_inotify_fd = -1;
+static std::unordered_map<std::string, CacheEntry> g_entries;
+// Watch descriptor -> keys of entries using the watch
+static std::unordered_map<int, std::unordered_set<std::string>> g_watches;
+
+static std::string cache_key(const std::string &path,
+                             std::vector<std::string> exclusions)
+{
+    std::sort(exclusions.begin(), exclusions.end());
+
+    std::string key(path);
+    for (auto const &exclusion : exclusions) {
+        key += '\0';
+        key += exclusion;
+    }
+
+    return key;
+}
+
+/*!
+ * \brief Release the watches used by an entry
+ *
+ * \pre g_cache_lock is held
+ */
+static void release_watches(const std::string &key, CacheEntry &entry)
+{
+    for (int wd : entry.wds) {
+        auto it = g_watches.find(wd);
+        if (it == g_watches.end()) {
+            continue;
+        }
+
+        it->second.erase(key);
+        if (it->second.empty()) {
+            inotify_rm_watch(g_inotify_fd, wd);
+            g_watches.erase(it);
+        }
+    }
+
+    entry.wds.clear();
+}
+
+/*!
+ * \brief Mark an entry as stale and free its watches
+ *
+ * \pre g_cache_lock is held
+ */
+static void invalidate_entry(const std::string &key)
+{
+    auto it = g_entries.find(key);
+    if (it != g_entries.end()) {
+        it->second.valid = false;
+        release_watches(key, it->second);
+    }
+}
+
+static void inotify_thread()
+{
+    alignas(inotify_event) char buf[4096];
+
+    while (true) {
+        ssize_t n = read(g_inotify_fd, buf, sizeof(buf));
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            LOGE("Failed to read inotify events: %s", strerror(errno));
+            break;
+        }
+
+        std::lock_guard<std::mutex> lock(g_cache_lock);
+
+        for (char *ptr = buf; ptr < buf + n;) {
+            auto *event = reinterpret_cast<inotify_event *>(ptr);
+            ptr += sizeof(inotify_event) + event->len;
+
+            if (event->mask & IN_Q_OVERFLOW) {
+                // Events were lost, so nothing can be trusted
+                for (auto &[key, entry] : g_entries) {
+                    entry.valid = false;
+                    release_watches(key, entry);
+                }
+                continue;
+            }
+
+            auto it = g_watches.find(event->wd);
+            if (it == g_watches.end()) {
+                continue;
+            }
+
+            // Copy since invalidating may remove the watch
+            auto keys = it->second;
+            for (auto const &key : keys) {
+                invalidate_entry(key);
+            }
+
+            if (event->mask & IN_IGNORED) {
+                // The kernel already removed the watch
+                g_watches.erase(event->wd);
+            }
+        }
+    }
+
+    // Caching can't work without events
+    std::lock_guard<std::mutex> lock(g_cache_lock);
+    close(g_inotify_fd);
+    g_inotify_fd = -1;
+    g_entries.clear();
+    g_watches.clear();
+}
+
+static void init_cache()
+{
+    g_inotify_fd = inotify_init1(IN_CLOEXEC);
+    if (g_inotify_fd < 0) {
+        LOGW("Failed to initialize inotify: %s", strerror(errno));
+        return;
+    }
+
+    std::thread(&inotify_thread).detach();
+}
+
+/*!
+ * \brief Watch a directory for changes on behalf of a cache entry
+ *
+ * \return Whether the watch was added. If false, the entry is marked stale.
+ */
+static bool add_watch(const std::string &key, const char *path)
+{
+    std::lock_guard<std::mutex> lock(g_cache_lock);
+
+    auto it = g_entries.find(key);
+    if (it == g_entries.end() || !it->second.valid || g_inotify_fd < 0) {
+        return false;
+    }
+
+    int wd = inotify_add_watch(g_inotify_fd, path, WATCH_MASK);
+    if (wd < 0) {
+        if (errno == ENOSPC) {
+            LOGW("inotify watch limit reached; not caching size of tree");
+        } else {
+            LOGW("%s: Failed to add inotify watch: %s", path, strerror(errno));
+        }
+        invalidate_entry(key);
+        return false;
+    }
+
+    g_watches[wd].insert(key);
+    it->second.wds.insert(wd);
+
+    return true;
+}
+
+// Sizes of hard linked files, deduplicated by (device, inode)
+using LinkMap = std::unordered_map<dev_t, std::unordered_map<ino_t, uint64_t>>;
+
+class DirectorySizeWalker : public util::FtsWrapper
+{
+public:
+    DirectorySizeWalker(std::string path,
+                        const std::vector<std::string> *exclusions,
+                        const std::string *key, LinkMap &links)
+        : FtsWrapper(std::move(path), util::FtsFlag::GroupSpecialFiles)
+        , _exclusions(exclusions)
+        , _key(key)
+        , _links(links)
+        , _total(0)
+        , _errno(0)
+    {
+    }
+
+    Actions on_changed_path() override
+    {
+        switch (_curr->fts_info) {
+        case FTS_NS:
+        case FTS_DNR:
+        case FTS_ERR:
+            _errno = _curr->fts_errno;
+            return Action::Fail;
+        }
+
+        // Exclude first-level directories
+        if (_exclusions && _curr->fts_level == 1) {
+            if (std::find(_exclusions->begin(), _exclusions->end(),
+                          _curr->fts_name) != _exclusions->end()) {
+                return Action::Skip;
+            }
+        }
+
+        // Subdirectories of the root are handed off to other threads
+        if (_subdirs && _curr->fts_level == 1 && _curr->fts_info == FTS_D) {
+            if (_curr->fts_statp->st_dev == _root->fts_statp->st_dev) {
+                _subdirs->push_back(_curr->fts_path);
+            }
+            return Action::Skip;
+        }
+
+        return Action::Ok;
+    }
+
+    Actions on_reached_directory_pre() override
+    {
+        // Watch the directory before its entries are read so that no changes
+        // are missed
+        if (_key && _curr->fts_statp->st_dev == _root->fts_statp->st_dev
+                && !add_watch(*_key, _curr->fts_accpath)) {
+            // Keep walking, but stop trying to cache the result
+            _key = nullptr;
+        }
+
+        return Action::Ok;
+    }
+
+    Actions on_reached_file() override
+    {
+        auto size = static_cast<uint64_t>(_curr->fts_statp->st_size);
+
+        if (_curr->fts_statp->st_nlink > 1) {
+            // Hard links are counted once when merging the results
+            dev_t dev = static_cast<dev_t>(_curr->fts_statp->st_dev);
+            ino_t ino = static_cast<ino_t>(_curr->fts_statp->st_ino);
+            _links[dev].emplace(ino, size);
+        } else {
+            _total += size;
+        }
+
+        return Action::Ok;
+    }
+
+    void collect_subdirs(std::vector<std::string> *subdirs)
+    {
+        _subdirs = subdirs;
+    }
+
+    uint64_t total() const
+    {
+        return _total;
+    }
+
+    int error() const
+    {
+        return _errno;
+    }
+
+    bool cacheable() const
+    {
+        return _key != nullptr;
+    }
+
+private:
+    const std::vector<std::string> *_exclusions;
+    const std::string *_key;
+    LinkMap &_links;
+    std::vector<std::string> *_subdirs = nullptr;
+    uint64_t _total;
+    int _errno;
+};
+
+/*!
+ * \brief Compute the size of a directory tree
+ *
+ * The first level of the tree is read on the calling thread. The remaining
+ * subtrees on the same filesystem are then split between worker threads.
+ *
+ * \param path Directory path
+ * \param exclusions Names of first-level entries to skip
+ * \param key Cache key to register inotify watches for or nullptr
+ * \param[out] cacheable Whether all watches were successfully added
+ */
+static oc::result<uint64_t> walk_tree(const std::string &path,
+                                      const std::vector<std::string> &exclusions,
+                                      const std::string *key, bool &cacheable)
+{
+    std::vector<std::string> subdirs;
+    LinkMap root_links;
+
+    DirectorySizeWalker root_walker(path, &exclusions, key, root_links);
+    root_walker.collect_subdirs(&subdirs);
+
+    if (!root_walker.run()) {
+        return ec_from_errno(root_walker.error() ? root_walker.error() : EIO);
+    }
+
+    struct Tally
+    {
+        LinkMap links;
+        uint64_t total = 0;
+        int error = 0;
+        bool cacheable = true;
+    };
+
+    auto n_threads = std::min<size_t>(
+            std::clamp(std::thread::hardware_concurrency(),
+                       1u, static_cast<unsigned int>(MAX_WALK_THREADS)),
+            subdirs.size());
+    std::vector<Tally> tallies(n_threads);
+    std::vector<std::thread> threads;
+    std::atomic_size_t next{0};
+
+    auto worker = [&](Tally &tally) {
+        for (size_t i; (i = next++) < subdirs.size();) {
+            DirectorySizeWalker walker(subdirs[i], nullptr, key, tally.links);
+
+            bool ret = walker.run();
+            tally.total += walker.total();
+            tally.cacheable = tally.cacheable && walker.cacheable();
+
+            if (!ret) {
+                tally.error = walker.error() ? walker.error() : EIO;
+                // Make the other threads stop picking up new subtrees
+                next = subdirs.size();
+                break;
+            }
+        }
+    };
+
+    for (size_t i = 1; i < n_threads; ++i) {
+        threads.emplace_back(worker, std::ref(tallies[i]));
+    }
+    if (n_threads > 0) {
+        worker(tallies[0]);
+    }
+    for (auto &t : threads) {
+        t.join();
+    }
+
+    uint64_t total = root_walker.total();
+    cacheable = root_walker.cacheable();
+
+    auto merge_links = [&](const LinkMap &links) {
+        for (auto const &[dev, inodes] : links) {
+            auto &merged = root_links[dev];
+
+            for (auto const &[ino, size] : inodes) {
+                merged.emplace(ino, size);
+            }
+        }
+    };
+
+    for (auto const &tally : tallies) {
+        if (tally.error) {
+            return ec_from_errno(tally.error);
+        }
+
+        total += tally.total;
+        cacheable = cacheable && tally.cacheable;
+        merge_links(tally.links);
+    }
+
+    for (auto const &[dev, inodes] : root_links) {
+        (void) dev;
+        for (auto const &[ino, size] : inodes) {
+            (void) ino;
+            total += size;
+        }
+    }
+
+    return total;
+}
+
+/*!
+ * \brief Get the total size of the regular files in a directory tree
+ *
+ * Hard linked files are counted once and the walk does not cross mount point
+ * boundaries. Results are cached until something in the tree changes.
+ *
+ * \param path Directory path
+ * \param exclusions Names of first-level entries to skip
+ *
+ * \return Total size in bytes or the error code if the tree could not be
+ *         fully walked
+ */
+oc::result<uint64_t> directory_size(const std::string &path,
+                                    const std::vector<std::string> &exclusions)
+{
+    std::call_once(g_cache_once, &init_cache);
+
+    std::string key = cache_key(path, exclusions);
+
+    {
+        std::lock_guard<std::mutex> lock(g_cache_lock);
+
+        if (g_inotify_fd >= 0) {
+            auto &entry = g_entries[key];
+
+            if (entry.complete && entry.valid) {
+                return entry.total;
+            } else if (!entry.valid) {
+                // Start over with a fresh entry
+                release_watches(key, entry);
+                entry = {};
+            }
+        }
+    }
+
+    bool cacheable = false;
+    auto total = walk_tree(path, exclusions, &key, cacheable);
+
+    std::lock_guard<std::mutex> lock(g_cache_lock);
+
+    auto it = g_entries.find(key);
+    if (it != g_entries.end()) {
+        if (total && cacheable && it->second.valid) {
+            it->second.complete = true;
+            it->second.total = total.value();
+        } else {
+            release_watches(key, it->second);
+            g_entries.erase(it);
+        }
+    }
+
+    return total;
+}
+
+}
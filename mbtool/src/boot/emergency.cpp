@@ -31,7 +31,6 @@
 #include "mbcommon/error_code.h"
 #include "mbcommon/finally.h"
 #include "mbcommon/outcome.h"
-#include "mbdevice/json.h"
 #include "mblog/logging.h"
 #include "mbutil/directory.h"
 #include "mbutil/file.h"
@@ -41,12 +40,11 @@
 #include "mbutil/time.h"
 #include "mbutil/vibrate.h"
 
+#include "util/boot_context.h"
 #include "util/multiboot.h"
 
 #define LOG_TAG "mbtool/boot/emergency"
 
-using namespace mb::device;
-
 namespace mb
 {
 
@@ -154,14 +152,7 @@ void emergency_reboot()
     LOGW("--- EMERGENCY REBOOT FROM MBTOOL ---");
 
     std::vector<EmergencyMount> ems;
-    Device device;
-    JsonError error;
-    bool loaded_json = false;
-
-    auto contents = util::file_read_all(DEVICE_JSON_PATH);
-    if (contents) {
-        loaded_json = device_from_json(contents.value(), device, error);
-    }
+    auto device = BootContext::instance().device();
 
     // /data
     {
@@ -175,8 +166,8 @@ void emergency_reboot()
 
         LOGV("Searching for data partition block device paths");
 
-        if (loaded_json) {
-            for (auto const &path : device.data_block_devs()) {
+        if (device) {
+            for (auto const &path : device->data_block_devs()) {
                 LOGV("- %s", path.c_str());
                 em.paths.push_back(path);
             }
@@ -203,8 +194,8 @@ void emergency_reboot()
 
         LOGV("Searching for cache partition block device paths");
 
-        if (loaded_json) {
-            for (auto const &path : device.cache_block_devs()) {
+        if (device) {
+            for (auto const &path : device->cache_block_devs()) {
                 LOGV("- %s", path.c_str());
                 em.paths.push_back(path);
             }
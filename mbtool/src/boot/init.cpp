@@ -45,7 +45,7 @@
 #include "mbcommon/finally.h"
 #include "mbcommon/string.h"
 #include "mbcommon/version.h"
-#include "mbdevice/json.h"
+#include "mbdevice/device.h"
 #include "mblog/kmsg_logger.h"
 #include "mblog/logging.h"
 #include "mbutil/chown.h"
@@ -61,13 +61,16 @@
 #include "mbutil/selinux.h"
 #include "mbutil/string.h"
 
+#include "boot/boot_timing.h"
 #include "boot/daemon.h"
 #include "boot/emergency.h"
 #include "boot/mount_fstab.h"
 #include "boot/property_service.h"
 #include "boot/uevent_thread.h"
 #include "util/android_api.h"
+#include "util/boot_context.h"
 #include "util/multiboot.h"
+#include "util/patch_cache.h"
 #include "util/romconfig.h"
 #include "util/sepolpatch.h"
 #include "util/signature.h"
@@ -80,6 +83,10 @@
 #error Unknown PCRE path for architecture
 #endif
 
+// Increment when fix_file_contexts() changes so that stale cached
+// file_contexts are not used
+#define FILE_CONTEXTS_PATCH_VERSION 1
+
 #define LOG_TAG "mbtool/boot/init"
 
 using namespace mb::device;
@@ -197,20 +204,15 @@ static bool stop_daemon()
 
 static bool set_kernel_properties()
 {
-    if (auto cmdline = util::kernel_cmdline()) {
-        for (auto const &[k, v] : cmdline.value()) {
-            LOGV("Kernel cmdline option %s=%s",
-                 k.c_str(), v ? v->c_str() : "(no value)");
-
-            if (starts_with(k, "androidboot.") && k.size() > 12 && v) {
-                std::string key("ro.boot.");
-                key += std::string_view(k).substr(12);
-                g_property_service.set(key, *v);
-            }
+    for (auto const &[k, v] : BootContext::instance().kernel_cmdline()) {
+        LOGV("Kernel cmdline option %s=%s",
+             k.c_str(), v ? v->c_str() : "(no value)");
+
+        if (starts_with(k, "androidboot.") && k.size() > 12 && v) {
+            std::string key("ro.boot.");
+            key += std::string_view(k).substr(12);
+            g_property_service.set(key, *v);
         }
-    } else {
-        LOGW("Failed get kernel cmdline: %s",
-             cmdline.error().message().c_str());
     }
 
     struct {
@@ -268,16 +270,6 @@ static bool properties_cleanup()
     return true;
 }
 
-static std::string get_rom_id()
-{
-    auto rom_id = util::file_first_line("/romid");
-    if (!rom_id) {
-        return {};
-    }
-
-    return std::move(rom_id.value());
-}
-
 // Operating on paths instead of fd's should be safe enough since, at this
 // point, we're the only process alive on the system.
 static bool replace_file(const char *replace, const char *with)
@@ -416,6 +408,57 @@ static bool fix_binary_file_contexts(const char *path)
     return replace_file(path, new_path.c_str());
 }
 
+/*!
+ * \brief Patch file_contexts using a cached copy of the result if possible
+ *
+ * The patched file is stored in \a /data/multiboot/cache/ on the raw data
+ * partition, keyed by the contents of the unpatched file. On the next boot with
+ * the same file_contexts, the cached copy is used directly. This avoids parsing
+ * the text file and, for the binary format, running file-contexts-tool to
+ * decompile and recompile (and recompile every regex in) the file.
+ *
+ * \note /data must be mounted (at /raw/data)
+ */
+static bool fix_file_contexts_cached(const char *path, bool binary)
+{
+    const char *variant = binary ? "file_contexts.bin" : "file_contexts";
+    auto key = patch_cache_key(path, variant, FILE_CONTEXTS_PATCH_VERSION);
+    auto cache_path = patch_cache_path(variant);
+    std::string data;
+
+    if (key && patch_cache_load(cache_path, *key, data)) {
+        LOGD("%s: Using cached patched file_contexts", cache_path.c_str());
+
+        std::string new_path(path);
+        new_path += ".new";
+
+        if (auto r = util::file_write_data(new_path, data.data(), data.size());
+                !r) {
+            LOGE("%s: Failed to write file: %s",
+                 new_path.c_str(), r.error().message().c_str());
+            unlink(new_path.c_str());
+            return false;
+        }
+
+        return replace_file(path, new_path.c_str());
+    }
+
+    if (!(binary ? fix_binary_file_contexts(path) : fix_file_contexts(path))) {
+        return false;
+    }
+
+    if (key) {
+        if (auto r = util::file_read_all(path)) {
+            patch_cache_save(cache_path, *key, r.value());
+        } else {
+            LOGW("%s: Failed to read patched file: %s",
+                 path, r.error().message().c_str());
+        }
+    }
+
+    return true;
+}
+
 static bool is_completely_whitespace(const char *str)
 {
     while (*str) {
@@ -513,7 +556,7 @@ static bool add_mbtool_services(bool enable_appsync)
     }
 
     static const char *daemon_service =
-            "service mbtooldaemon /mbtool daemon\n"
+            "service mbtooldaemon /mbtool daemon --mount-images\n"
             "    class main\n"
             "    user root\n"
             "    oneshot\n"
@@ -663,7 +706,8 @@ static bool add_props_to_dbp_prop()
     // Write version property
     fprintf(fp.get(), PROP_MULTIBOOT_VERSION "=%s\n", version());
     // Write ROM ID property
-    fprintf(fp.get(), PROP_MULTIBOOT_ROM_ID "=%s\n", get_rom_id().c_str());
+    fprintf(fp.get(), PROP_MULTIBOOT_ROM_ID "=%s\n",
+            BootContext::instance().rom_id().c_str());
 
     return true;
 }
@@ -860,10 +904,13 @@ static bool disable_spota()
 {
     static const char *spota_dir = "/data/security/spota";
 
-    auto props = util::property_file_get_all(BUILD_PROP_PATH);
+    util::PropertyFile props;
 
-    if (props && strcasecmp((*props)["ro.product.brand"].c_str(), "samsung") != 0
-            && strcasecmp((*props)["ro.product.manufacturer"].c_str(), "samsung") != 0) {
+    if (props.load(BUILD_PROP_PATH)
+            && strcasecmp(props.get_string("ro.product.brand", {}).c_str(),
+                          "samsung") != 0
+            && strcasecmp(props.get_string("ro.product.manufacturer", {}).c_str(),
+                          "samsung") != 0) {
         // Not a Samsung device
         LOGV("Not mounting empty tmpfs over: %s", spota_dir);
         return true;
@@ -999,7 +1046,7 @@ static bool launch_boot_menu()
     if (stat(BOOT_UI_SKIP_PATH, &sb) == 0) {
         auto skip_rom = util::file_first_line(BOOT_UI_SKIP_PATH);
 
-        std::string rom_id = get_rom_id();
+        auto const &rom_id = BootContext::instance().rom_id();
 
         if (skip_rom && skip_rom.value() == rom_id) {
             LOGV("Performing one-time skipping of Boot UI");
@@ -1123,6 +1170,8 @@ int init_main(int argc, char *argv[])
         }
     }
 
+    BootTimer init_timer("init_main");
+
     // Mount base directories
     mkdir("/dev", 0755);
     mkdir("/proc", 0755);
@@ -1154,25 +1203,19 @@ int init_main(int argc, char *argv[])
     LOGV("Booting up with version %s (%s)",
          version(), git_version());
 
-    auto contents = util::file_read_all(DEVICE_JSON_PATH);
-    if (!contents) {
-        LOGE("%s: Failed to read file: %s", DEVICE_JSON_PATH,
-             contents.error().message().c_str());
-        emergency_reboot();
-    }
-
     // Start probing for devices so we have somewhere to write logs for
     // critical_failure()
     UeventThread uevent_thread;
     uevent_thread.start();
 
-    Device device;
-    JsonError error;
-
-    if (!device_from_json(contents.value(), device, error)) {
-        LOGE("%s: Failed to load device definition", DEVICE_JSON_PATH);
+    auto device_ptr = BootContext::instance().device();
+    if (!device_ptr) {
         emergency_reboot();
-    } else if (device.validate()) {
+    }
+
+    const Device &device = *device_ptr;
+
+    if (device.validate()) {
         LOGE("%s: Device definition validation failed", DEVICE_JSON_PATH);
         emergency_reboot();
     }
@@ -1183,7 +1226,10 @@ int init_main(int argc, char *argv[])
     add_props_to_dbp_prop();
 
     // initialize properties
-    properties_setup();
+    {
+        BootTimer timer("properties_setup");
+        properties_setup();
+    }
 
     std::string fstab(find_fstab());
 
@@ -1197,7 +1243,7 @@ int init_main(int argc, char *argv[])
     }
 
     // Get ROM ID from /romid
-    std::string rom_id = get_rom_id();
+    auto const &rom_id = BootContext::instance().rom_id();
     std::shared_ptr<Rom> rom = Roms::create_rom(rom_id);
     if (!rom) {
         LOGE("Unknown ROM ID: %s", rom_id.c_str());
@@ -1213,30 +1259,40 @@ int init_main(int argc, char *argv[])
             | MountFlag::MountCache
             | MountFlag::MountData
             | MountFlag::MountExternalSd;
+    BootTimer mount_fstab_timer("mount_fstab");
     if (!mount_fstab(fstab.c_str(), rom, device, flags,
                      uevent_thread.device_handler())) {
         LOGE("Failed to mount fstab");
         emergency_reboot();
     }
+    mount_fstab_timer.stop();
 
     LOGV("Successfully mounted fstab");
 
-    if (!launch_boot_menu()) {
-        LOGE("Failed to run boot menu");
-        // Continue anyway since boot menu might not run on every device
+    {
+        BootTimer timer("launch_boot_menu");
+        if (!launch_boot_menu()) {
+            LOGE("Failed to run boot menu");
+            // Continue anyway since boot menu might not run on every device
+        }
     }
 
-    // Mount selinuxfs
-    selinux_mount();
-    // Load pre-boot policy
-    patch_sepolicy(util::SELINUX_DEFAULT_POLICY_FILE, util::SELINUX_LOAD_FILE,
-                   SELinuxPatch::PreBoot);
+    {
+        BootTimer timer("patch_sepolicy_preboot");
+        // Mount selinuxfs
+        selinux_mount();
+        // Load pre-boot policy
+        patch_sepolicy_cached(util::SELINUX_DEFAULT_POLICY_FILE,
+                              util::SELINUX_LOAD_FILE, SELinuxPatch::PreBoot);
+    }
 
     // Mount ROM (bind mount directory or mount images, etc.)
+    BootTimer mount_rom_timer("mount_rom");
     if (!mount_rom(rom)) {
         LOGE("Failed to mount ROM directories and images");
         emergency_reboot();
     }
+    mount_rom_timer.stop();
 
     std::string config_path(rom->config_path());
     RomConfig config;
@@ -1248,11 +1304,12 @@ int init_main(int argc, char *argv[])
     LOGD("Enable appsync: %d", config.indiv_app_sharing);
 
     // Make runtime ramdisk modifications
+    BootTimer ramdisk_timer("ramdisk_modifications");
     if (access(FILE_CONTEXTS, R_OK) == 0) {
-        fix_file_contexts(FILE_CONTEXTS);
+        fix_file_contexts_cached(FILE_CONTEXTS, false);
     }
     if (access(FILE_CONTEXTS_BIN, R_OK) == 0) {
-        fix_binary_file_contexts(FILE_CONTEXTS_BIN);
+        fix_file_contexts_cached(FILE_CONTEXTS_BIN, true);
     }
     write_fstab_hack(fstab.c_str());
     add_mbtool_services(config.indiv_app_sharing);
@@ -1268,18 +1325,25 @@ int init_main(int argc, char *argv[])
 
     // Disable spota
     disable_spota();
+    ramdisk_timer.stop();
 
     // Patch SELinux policy
+    BootTimer sepolicy_timer("patch_sepolicy");
     struct stat sb;
     if (stat(util::SELINUX_DEFAULT_POLICY_FILE, &sb) == 0) {
-        if (!patch_sepolicy(util::SELINUX_DEFAULT_POLICY_FILE,
-                            util::SELINUX_DEFAULT_POLICY_FILE,
-                            SELinuxPatch::Main)) {
+        if (!patch_sepolicy_cached(util::SELINUX_DEFAULT_POLICY_FILE,
+                                   util::SELINUX_DEFAULT_POLICY_FILE,
+                                   SELinuxPatch::Main)) {
             LOGW("%s: Failed to patch policy",
                  util::SELINUX_DEFAULT_POLICY_FILE);
             emergency_reboot();
         }
     }
+    sepolicy_timer.stop();
+
+    init_timer.stop();
+    boot_timing_log();
+    boot_timing_write_json(get_raw_path("/data/multiboot/boot_timing.json"));
 
     // Kill uevent thread and close uevent socket
     uevent_thread.stop();
@@ -29,10 +29,11 @@
 
 #include "mblog/logging.h"
 
-#include "mbutil/cmdline.h"
 #include "mbutil/directory.h"
 #include "mbutil/path.h"
 
+#include "util/boot_context.h"
+
 #define LOG_TAG "mbtool/boot/init/devices"
 
 namespace android {
@@ -40,16 +41,14 @@ namespace init {
 
 static std::string GetBootDevice()
 {
-    std::string result;
+    auto const &cmdline = mb::BootContext::instance().kernel_cmdline();
 
-    if (auto cmdline = mb::util::kernel_cmdline()) {
-        auto it = cmdline.value().find("androidboot.bootdevice");
-        if (it != cmdline.value().end() && it->second) {
-            it->second->swap(result);
-        }
+    auto it = cmdline.find("androidboot.bootdevice");
+    if (it != cmdline.end() && it->second) {
+        return *it->second;
     }
 
-    return result;
+    return {};
 }
 
 /* Given a path that may start with a PCI device, populate the supplied buffer
@@ -195,9 +194,9 @@ std::vector<std::string> DeviceHandler::GetBlockDeviceSymlinks(const Uevent& uev
     };
 
     // Legacy /dev/block/bootdevice support
-    if (!boot_device_) {
+    std::call_once(boot_device_once_, [&] {
         boot_device_ = GetBootDevice();
-    }
+    });
     if (!boot_device_->empty()
             && device.find(*boot_device_) != std::string::npos) {
         LOGE("Boot device is %s", device.c_str());
@@ -232,6 +231,45 @@ BlockDevMap DeviceHandler::GetBlockDeviceMap() const
     return block_dev_mappings_;
 }
 
+uint64_t DeviceHandler::EventGeneration() const
+{
+    std::lock_guard<std::mutex> lock(event_guard_);
+    return event_generation_;
+}
+
+// Wait until a device event newer than the one with the specified generation
+// has been handled. Returns false if the timeout expired first.
+bool DeviceHandler::WaitForEvent(uint64_t generation, std::chrono::milliseconds timeout) const
+{
+    std::unique_lock<std::mutex> lock(event_guard_);
+    return event_cv_.wait_for(lock, timeout, [&] {
+        return event_generation_ != generation;
+    });
+}
+
+// Event-driven replacement for mb::util::wait_for_path() for paths that are
+// created while handling device events (eg. /dev/block/.../by-name/*).
+bool DeviceHandler::WaitForPath(const std::string& path, std::chrono::milliseconds timeout) const
+{
+    using namespace std::chrono;
+
+    auto until = steady_clock::now() + timeout;
+
+    while (true) {
+        auto generation = EventGeneration();
+
+        if (access(path.c_str(), F_OK) == 0) {
+            return true;
+        }
+
+        auto now = steady_clock::now();
+        if (now >= until
+                || !WaitForEvent(generation, duration_cast<milliseconds>(until - now))) {
+            return access(path.c_str(), F_OK) == 0;
+        }
+    }
+}
+
 void DeviceHandler::HandleDevice(const std::string& action, const std::string& devpath, bool block,
                                  int major, int minor, const std::vector<std::string>& links) const {
     if (action == "add") {
@@ -335,6 +373,12 @@ void DeviceHandler::HandleDeviceEvent(const Uevent& uevent) {
             block_dev_mappings_.erase(uevent.path);
         }
     }
+
+    {
+        std::lock_guard<std::mutex> lock(event_guard_);
+        ++event_generation_;
+    }
+    event_cv_.notify_all();
 }
 
 DeviceHandler::DeviceHandler()
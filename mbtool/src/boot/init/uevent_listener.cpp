@@ -17,7 +17,11 @@
 
 #include "boot/init/uevent_listener.h"
 
+#include <algorithm>
+#include <atomic>
 #include <memory>
+#include <mutex>
+#include <thread>
 
 #include <cerrno>
 #include <cstring>
@@ -186,6 +190,88 @@ void UeventListener::RegenerateUevents(const ListenerCallback& callback) const {
     }
 }
 
+// Poke the uevent file of the directories down to `depth` levels below `path`
+// and add the directories at that depth to `dirs`.
+void UeventListener::SplitRegenerationPath(const std::string& path, int depth,
+                                           std::vector<std::string>* dirs,
+                                           const ListenerCallback& callback) const {
+    if (depth == 0) {
+        dirs->push_back(path);
+        return;
+    }
+
+    std::unique_ptr<DIR, decltype(&closedir)> d(opendir(path.c_str()), closedir);
+    if (!d) return;
+
+    int fd = openat(dirfd(d.get()), "uevent", O_WRONLY | O_CLOEXEC);
+    if (fd >= 0) {
+        write(fd, "add\n", 4);
+        close(fd);
+
+        Uevent uevent;
+        while (ReadUevent(&uevent)) {
+            callback(uevent);
+        }
+    }
+
+    dirent* de;
+    while ((de = readdir(d.get())) != nullptr) {
+        if (de->d_type != DT_DIR || de->d_name[0] == '.') continue;
+
+        SplitRegenerationPath(path + "/" + de->d_name, depth - 1, dirs, callback);
+    }
+}
+
+// Parallel version of RegenerateUevents() for coldboot. The regeneration paths are split into
+// their second level subdirectories (/sys/devices alone is a handful of huge trees) and the
+// subdirectories are walked by `num_threads` threads.
+//
+// Every thread drains the shared netlink socket, so a thread may receive events triggered by
+// another thread. For that reason, the events are collected and returned instead of being
+// passed to a callback. The order of the events is not deterministic.
+std::vector<Uevent> UeventListener::RegenerateUeventsParallel(unsigned int num_threads) const {
+    std::vector<Uevent> uevents;
+    std::mutex uevents_guard;
+
+    ListenerCallback collect = [&](const Uevent& uevent) {
+        std::lock_guard<std::mutex> lock(uevents_guard);
+        uevents.push_back(uevent);
+        return ListenerAction::kContinue;
+    };
+
+    std::vector<std::string> dirs;
+    for (const auto path : kRegenerationPaths) {
+        SplitRegenerationPath(path, 2, &dirs, collect);
+    }
+
+    std::atomic_size_t next{0};
+
+    auto worker = [&] {
+        for (size_t i; (i = next.fetch_add(1)) < dirs.size();) {
+            RegenerateUeventsForPath(dirs[i], collect);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned int i = 1; i < std::max(num_threads, 1u); ++i) {
+        threads.emplace_back(worker);
+    }
+
+    worker();
+
+    for (auto& t : threads) {
+        t.join();
+    }
+
+    // Pick up any events that have not been drained yet
+    Uevent uevent;
+    while (ReadUevent(&uevent)) {
+        collect(uevent);
+    }
+
+    return uevents;
+}
+
 void UeventListener::Poll(const ListenerCallback& callback, int cancel_fd,
                           const std::optional<std::chrono::milliseconds> relative_timeout) const {
     using namespace std::chrono;
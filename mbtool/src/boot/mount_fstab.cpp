@@ -20,10 +20,18 @@
 #include "boot/mount_fstab.h"
 
 #include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
 #include <thread>
+#include <unordered_set>
+#include <vector>
 
 #include <cerrno>
+#include <cinttypes>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
@@ -40,14 +48,18 @@
 #include <unistd.h>
 
 #include "mbcommon/string.h"
+#include "mbcommon/thread_pool.h"
 #include "mbdevice/device.h"
+#include "mblog/base_logger.h"
 #include "mblog/logging.h"
+#include "mblog/stdio_logger.h"
 #include "mbutil/blkid.h"
 #include "mbutil/command.h"
 #include "mbutil/copy.h"
 #include "mbutil/directory.h"
 #include "mbutil/file.h"
 #include "mbutil/fstab.h"
+#include "mbutil/io_scheduler.h"
 #include "mbutil/mount.h"
 #include "mbutil/path.h"
 #include "mbutil/properties.h"
@@ -90,7 +102,8 @@ namespace mb
  *
  * \return Whether some fstab entry was successfully mounted at the mount point
  */
-static bool create_dir_and_mount(const std::vector<util::FstabRec> &recs,
+static bool create_dir_and_mount(const android::init::DeviceHandler &handler,
+                                 const std::vector<util::FstabRec> &recs,
                                  const char *mount_point, mode_t perms)
 {
     if (recs.empty()) {
@@ -121,7 +134,7 @@ static bool create_dir_and_mount(const std::vector<util::FstabRec> &recs,
         if (rec.fs_mgr_flags & util::MF_WAIT) {
             LOGD("%s: Waiting up to 20 seconds for block device",
                  rec.blk_device.c_str());
-            util::wait_for_path(rec.blk_device, std::chrono::seconds(20));
+            handler.WaitForPath(rec.blk_device, std::chrono::seconds(20));
         }
 
         // Try mounting
@@ -214,17 +227,6 @@ generic_fstab_data_entries(const Device &device)
     return result;
 }
 
-static bool path_matches(const char *path, const char *pattern)
-{
-    // Vold uses prefix matching if no '*' exists. Otherwise, globbing is used.
-
-    if (strchr(pattern, '*')) {
-        return fnmatch(pattern, path, 0) == 0;
-    } else {
-        return starts_with(path, pattern);
-    }
-}
-
 static void dump(std::string_view line, bool error)
 {
     (void) error;
@@ -251,14 +253,15 @@ static bool mount_exfat_fuse(const char *source, const char *target)
     uid_t uid = get_media_rw_uid();
 
     // Check signatures
-    SigVerifyResult result;
-    result = verify_signature("/sbin/fsck.exfat", "/sbin/fsck.exfat.sig");
-    if (result != SigVerifyResult::Valid) {
+    auto results = verify_signatures({
+        {"/sbin/fsck.exfat", "/sbin/fsck.exfat.sig"},
+        {"/sbin/mount.exfat", "/sbin/mount.exfat.sig"},
+    });
+    if (results[0] != SigVerifyResult::Valid) {
         LOGE("Invalid fsck.exfat signature");
         return false;
     }
-    result = verify_signature("/sbin/mount.exfat", "/sbin/mount.exfat.sig");
-    if (result != SigVerifyResult::Valid) {
+    if (results[1] != SigVerifyResult::Valid) {
         LOGE("Invalid mount.exfat signature");
         return false;
     }
@@ -368,7 +371,20 @@ static bool mount_ext4(const char *source, const char *target)
     }
 }
 
-static bool try_extsd_mount(const char *block_dev, const char *mount_point)
+// Filesystem of the external SD that mount_fstab() mounted. This determines
+// which of vold's helpers wrap_extsd_binaries() needs to replace.
+enum class ExtsdFs
+{
+    Unknown,
+    Vfat,
+    Exfat,
+    Ext4,
+};
+
+static std::atomic<ExtsdFs> g_extsd_fs{ExtsdFs::Unknown};
+
+static bool try_extsd_mount(const char *block_dev, const char *mount_point,
+                            const oc::result<std::string> &fstype)
 {
     bool use_fuse_exfat = false;
 
@@ -390,7 +406,6 @@ static bool try_extsd_mount(const char *block_dev, const char *mount_point)
         }
     }
 
-    auto fstype = util::blkid_get_fs_type(block_dev);
     if (!fstype) {
         LOGE("%s: Failed to detect filesystem type: %s",
              block_dev, fstype.error().message().c_str());
@@ -400,12 +415,21 @@ static bool try_extsd_mount(const char *block_dev, const char *mount_point)
         LOGD("Using fuse-exfat: %d", use_fuse_exfat);
 
         auto func = use_fuse_exfat ? &mount_exfat_fuse : &mount_exfat_kernel;
-        return func(block_dev, mount_point);
+        if (func(block_dev, mount_point)) {
+            g_extsd_fs = ExtsdFs::Exfat;
+            return true;
+        }
     } else if (fstype.value() == "vfat") {
-        return mount_vfat(block_dev, mount_point);
+        if (mount_vfat(block_dev, mount_point)) {
+            g_extsd_fs = ExtsdFs::Vfat;
+            return true;
+        }
     } else if (fstype.value() == "ext") {
         // Assume ext4
-        return mount_ext4(block_dev, mount_point);
+        if (mount_ext4(block_dev, mount_point)) {
+            g_extsd_fs = ExtsdFs::Ext4;
+            return true;
+        }
     } else {
         LOGE("%s: Cannot handle filesystem: %s",
              block_dev, fstype.value().c_str());
@@ -442,6 +466,64 @@ static std::vector<std::string> split_patterns(const char *patterns)
     return result;
 }
 
+/*!
+ * \brief Matcher for the sysfs path patterns of external SD fstab entries
+ *
+ * Like vold, patterns without a '*' match any path that they are a prefix of
+ * and other patterns are matched with fnmatch(). The patterns are parsed once
+ * and the prefixes are kept sorted and prefix-free, so at most one of them can
+ * match a path and it is found with a binary search. Only the true globs are
+ * passed to fnmatch().
+ */
+class ExtsdPatternMatcher
+{
+public:
+    explicit ExtsdPatternMatcher(const std::vector<util::FstabRec> &recs)
+    {
+        std::vector<std::string> prefixes;
+
+        for (const util::FstabRec &rec : recs) {
+            for (auto &pattern : split_patterns(rec.blk_device.c_str())) {
+                LOGD("Matching devices against pattern: %s", pattern.c_str());
+
+                if (pattern.find('*') != std::string::npos) {
+                    m_globs.push_back(std::move(pattern));
+                } else {
+                    prefixes.push_back(std::move(pattern));
+                }
+            }
+        }
+
+        // A prefix sorts before every string that starts with it, so any
+        // prefix that is redundant immediately follows the one covering it
+        std::sort(prefixes.begin(), prefixes.end());
+
+        for (auto &prefix : prefixes) {
+            if (m_prefixes.empty() || !starts_with(prefix, m_prefixes.back())) {
+                m_prefixes.push_back(std::move(prefix));
+            }
+        }
+    }
+
+    bool matches(const std::string &path) const
+    {
+        // The only prefix that can match is the greatest one not after path
+        auto it = std::upper_bound(m_prefixes.begin(), m_prefixes.end(), path);
+        if (it != m_prefixes.begin() && starts_with(path, *std::prev(it))) {
+            return true;
+        }
+
+        return std::any_of(m_globs.begin(), m_globs.end(),
+                           [&](const std::string &glob) {
+            return fnmatch(glob.c_str(), path.c_str(), 0) == 0;
+        });
+    }
+
+private:
+    std::vector<std::string> m_prefixes;
+    std::vector<std::string> m_globs;
+};
+
 /*!
  * \brief Mount specified external SD fstab entries to /raw/extsd
  *
@@ -452,7 +534,7 @@ static bool mount_extsd_fstab_entries(const android::init::DeviceHandler &handle
                                       const std::vector<util::FstabRec> &extsd_recs,
                                       const char *mount_point, mode_t perms)
 {
-    using namespace std::chrono_literals;
+    using namespace std::chrono;
 
     if (extsd_recs.empty()) {
         LOGD("No external SD fstab entries to mount");
@@ -468,56 +550,78 @@ static bool mount_extsd_fstab_entries(const android::init::DeviceHandler &handle
     }
 
     // We can't wait for a block device path to appear since we don't know the
-    // block device path. Thus, we'll match the paths a number of times with a
-    // delay between each attempt.
-    static const int max_attempts = 10;
+    // block device path. Thus, we'll look for matching devices again every
+    // time a new device event is handled until the timeout expires. Whether a
+    // device matches only depends on its sysfs path, so each path is only
+    // checked against the patterns the first time it is seen.
+    static const auto timeout = 10s;
 
-    for (int i = 0; i < max_attempts; ++i) {
-        LOGV("[Attempt %d/%d] Finding and mounting external SD",
-             i + 1, max_attempts);
+    ExtsdPatternMatcher matcher(extsd_recs);
+    std::unordered_set<std::string> seen_paths;
+    std::vector<std::string> matched_paths;
 
+    auto until = steady_clock::now() + timeout;
+
+    for (int i = 1; ; ++i) {
+        LOGV("[Attempt %d] Finding and mounting external SD", i);
+
+        auto generation = handler.EventGeneration();
         auto devices_map = handler.GetBlockDeviceMap();
 
-        for (const util::FstabRec &rec : extsd_recs) {
-            std::vector<std::string> patterns =
-                    split_patterns(rec.blk_device.c_str());
+        for (auto const &pair : devices_map) {
+            if (seen_paths.insert(pair.first).second
+                    && matcher.matches(pair.first)) {
+                matched_paths.push_back(pair.first);
+            }
+        }
 
-            // Match sysfs path pattern
-            for (const std::string &pattern : patterns) {
-                LOGD("Matching devices against pattern: %s", pattern.c_str());
+        // Collect all candidates first so that their filesystems can be
+        // probed concurrently
+        std::vector<std::string> candidates;
 
-                for (auto const &pair : devices_map) {
-                    auto const &info = pair.second;
-
-                    if (path_matches(pair.first.c_str(), pattern.c_str())) {
-                        LOGV("Matched external SD block dev: "
-                             "major=%d; minor=%d; name=%s; number=%d; path=%s",
-                             info.major, info.minor, info.partition_name.c_str(),
-                             info.partition_num, info.path.c_str());
-
-                        if (info.partition_num != -1
-                                && info.partition_num != 1) {
-                            LOGV("Skipping external SD partnum %d",
-                                 info.partition_num);
-                            continue;
-                        }
-
-                        if (try_extsd_mount(info.path.c_str(), mount_point)) {
-                            return true;
-                        }
-                    }
-                }
+        for (auto const &sysfs_path : matched_paths) {
+            // The device may have been removed since it was matched
+            auto it = devices_map.find(sysfs_path);
+            if (it == devices_map.end()) {
+                continue;
+            }
+
+            auto const &info = it->second;
+
+            LOGV("Matched external SD block dev: "
+                 "major=%d; minor=%d; name=%s; number=%d; path=%s",
+                 info.major, info.minor, info.partition_name.c_str(),
+                 info.partition_num, info.path.c_str());
+
+            if (info.partition_num != -1 && info.partition_num != 1) {
+                LOGV("Skipping external SD partnum %d", info.partition_num);
+                continue;
+            }
+
+            candidates.push_back(info.path);
+        }
+
+        auto fstypes = util::blkid_get_fs_types(candidates);
+
+        for (size_t j = 0; j < candidates.size(); ++j) {
+            if (try_extsd_mount(candidates[j].c_str(), mount_point,
+                                fstypes[j])) {
+                return true;
             }
         }
 
-        if (i < max_attempts - 1) {
-            LOGW("No external SD patterns were matched; waiting 1 second");
-            std::this_thread::sleep_for(1s);
+        auto now = steady_clock::now();
+        if (now >= until) {
+            break;
         }
+
+        LOGW("No external SD patterns were matched; waiting for new devices");
+        handler.WaitForEvent(generation,
+                             duration_cast<milliseconds>(until - now));
     }
 
-    LOGE("No external SD patterns were matched after %d attempts",
-         max_attempts);
+    LOGE("No external SD patterns were matched after %lld seconds",
+         static_cast<long long>(timeout.count()));
 
     return false;
 }
@@ -597,48 +701,108 @@ static bool mount_target(const char *source, const char *target, bool bind,
 }
 
 /*!
- * \brief Mount all system image files to /raw/images/[ROM ID]
+ * \brief Check a system image before it is mounted
+ *
+ * `e2fsck -p` only performs a full check if the filesystem was not cleanly
+ * unmounted, so this is cheap for images that are in a good state.
+ */
+static void fsck_system_image(const std::string &path)
+{
+    std::vector<std::string> argv{ "e2fsck", "-p", path };
+
+    int ret = util::run_command(argv[0], argv, {}, {}, &dump);
+    if (ret < 0) {
+        LOGW("%s: Failed to launch e2fsck: %s", path.c_str(), strerror(errno));
+    } else if (WEXITSTATUS(ret) != 0 && WEXITSTATUS(ret) != 1) {
+        LOGW("%s: e2fsck returned: %d", path.c_str(), WEXITSTATUS(ret));
+    }
+}
+
+/*!
+ * \brief Check and mount all system image files to /raw/images/[ROM ID]
+ *
+ * None of these mounts are needed to boot, so this is run by the daemon after
+ * boot instead of by mount_rom(). The images are checked in parallel, with
+ * images on the same disk admitted by util::IoScheduler. The booted ROM's
+ * image is already mounted at /system, so it is not checked. Mounting is done
+ * serially because concurrent loopdev allocations race with each other.
+ *
+ * \return Whether all images were successfully mounted
  */
-static bool mount_all_system_images()
+bool mount_all_system_images()
 {
     Roms roms;
     roms.add_installed();
 
-    bool failed = false;
-
+    std::vector<std::shared_ptr<Rom>> images;
     for (const std::shared_ptr<Rom> &rom : roms.roms) {
         if (rom->system_is_image) {
-            std::string mount_point(IMAGES_MOUNT_POINT);
-            mount_point += "/";
-            mount_point += rom->id;
-            std::string system_path(rom->full_system_path());
-
-            if (!mount_target(system_path.c_str(), mount_point.c_str(),
-                              false, true)) {
-                LOGW("Failed to mount image for %s", rom->id.c_str());
-                failed = true;
-            }
+            images.push_back(rom);
+        }
+    }
+
+    auto current_rom = Roms::get_current_rom();
+
+    run_bounded(images.size(), util::IO_MAX_BULK_PER_DEVICE, [&](size_t i) {
+        if (current_rom && current_rom->id == images[i]->id) {
+            return;
+        }
+
+        std::string system_path(images[i]->full_system_path());
+        auto ticket = util::IoScheduler::instance().acquire_bulk(system_path);
+
+        fsck_system_image(system_path);
+    });
+
+    bool failed = false;
+
+    for (const std::shared_ptr<Rom> &rom : images) {
+        std::string mount_point(IMAGES_MOUNT_POINT);
+        mount_point += "/";
+        mount_point += rom->id;
+        std::string system_path(rom->full_system_path());
+
+        if (!mount_target(system_path.c_str(), mount_point.c_str(),
+                          false, true)) {
+            LOGW("Failed to mount image for %s", rom->id.c_str());
+            failed = true;
         }
     }
 
     return !failed;
 }
 
-static bool disable_fsck(const char *fsck_binary)
+/*!
+ * \brief Check the fsck wrapper's signature
+ *
+ * The signature is only verified the first time the wrapper is needed.
+ */
+static bool verify_fsck_wrapper()
 {
-    SigVerifyResult result;
-    result = verify_signature(FSCK_WRAPPER, FSCK_WRAPPER_SIG);
-    if (result != SigVerifyResult::Valid) {
-        LOGE("%s: Invalid signature", FSCK_WRAPPER);
-        return false;
-    }
+    static const bool valid = [] {
+        if (verify_signature(FSCK_WRAPPER, FSCK_WRAPPER_SIG)
+                != SigVerifyResult::Valid) {
+            LOGE("%s: Invalid signature", FSCK_WRAPPER);
+            return false;
+        }
+        return true;
+    }();
+
+    return valid;
+}
 
+static bool disable_fsck(const char *fsck_binary)
+{
     struct stat sb;
     if (stat(fsck_binary, &sb) < 0) {
         LOGE("%s: Failed to stat: %s", fsck_binary, strerror(errno));
         return errno == ENOENT;
     }
 
+    if (!verify_fsck_wrapper()) {
+        return false;
+    }
+
     std::string target(WRAPPED_BINARIES_DIR);
     target += "/";
     target += util::base_name(fsck_binary);
@@ -716,8 +880,24 @@ static bool copy_mount_exfat()
     return true;
 }
 
+/*!
+ * \brief Replace vold's helpers for the external SD's filesystem
+ *
+ * Only the helpers for the filesystem that was detected when the external SD
+ * was mounted are replaced. If the filesystem is not known, all of them are
+ * replaced.
+ */
 static bool wrap_extsd_binaries()
 {
+    ExtsdFs fs = g_extsd_fs;
+    bool wrap_vfat = fs == ExtsdFs::Unknown || fs == ExtsdFs::Vfat;
+    bool wrap_exfat = fs == ExtsdFs::Unknown || fs == ExtsdFs::Exfat;
+
+    if (!wrap_vfat && !wrap_exfat) {
+        LOGV("No external SD binaries need to be wrapped");
+        return true;
+    }
+
     if (mkdir(WRAPPED_BINARIES_DIR, 0755) < 0 && errno != EEXIST) {
         return false;
     }
@@ -726,19 +906,23 @@ static bool wrap_extsd_binaries()
 
     // Online fsck is not possible so we'll have to prevent Vold from trying
     // to run fsck_msdos and failing.
-    if (!disable_fsck("/system/bin/fsck_msdos")) {
-        ret = false;
-    }
-    if (!disable_fsck("/system/bin/fsck_msdos_mtk")) {
-        ret = false;
-    }
-    if (!disable_fsck("/system/bin/fsck.exfat")) {
-        ret = false;
+    if (wrap_vfat) {
+        if (!disable_fsck("/system/bin/fsck_msdos")) {
+            ret = false;
+        }
+        if (!disable_fsck("/system/bin/fsck_msdos_mtk")) {
+            ret = false;
+        }
     }
+    if (wrap_exfat) {
+        if (!disable_fsck("/system/bin/fsck.exfat")) {
+            ret = false;
+        }
 
-    // Ensure our copy of mount.exfat is used
-    if (!copy_mount_exfat()) {
-        ret = false;
+        // Ensure our copy of mount.exfat is used
+        if (!copy_mount_exfat()) {
+            ret = false;
+        }
     }
 
     // Remount read-only to avoid further modifications to the temporary dir
@@ -873,6 +1057,212 @@ static bool process_fstab(const char *path, const std::shared_ptr<Rom> &rom,
     return true;
 }
 
+/*!
+ * \brief Mount operation that can run concurrently with other mount operations
+ */
+struct MountJob
+{
+    MountJob(std::string mount_point_, std::function<bool()> fn_)
+        : mount_point(std::move(mount_point_)), fn(std::move(fn_))
+    {
+    }
+
+    // Jobs mounting at or below another job's mount point wait for that job
+    std::string mount_point;
+    std::function<bool()> fn;
+
+    // Filled in by run_mount_jobs()
+    bool result = false;
+    std::chrono::steady_clock::duration elapsed{};
+    std::vector<log::LogRecord> log_records;
+};
+
+// Log records of the mount job running on the current thread
+static thread_local std::vector<log::LogRecord> *t_job_log_records = nullptr;
+
+/*!
+ * \brief Logger that holds back log records from mount jobs
+ *
+ * Records logged by a mount job are stored in the job so that they can be
+ * replayed in job order when all jobs are done. Records from other threads are
+ * passed through to the wrapped logger.
+ */
+class MountJobLogger : public log::BaseLogger
+{
+public:
+    explicit MountJobLogger(std::shared_ptr<log::BaseLogger> logger)
+        : _logger(std::move(logger))
+    {
+    }
+
+    void log(const log::LogRecord &rec) override
+    {
+        if (t_job_log_records) {
+            t_job_log_records->push_back(rec);
+        } else {
+            _logger->log(rec);
+        }
+    }
+
+    bool formatted() override
+    {
+        return _logger->formatted();
+    }
+
+private:
+    std::shared_ptr<log::BaseLogger> _logger;
+};
+
+static bool is_parent_mount_point(const std::string &parent,
+                                  const std::string &child)
+{
+    if (parent.empty() || !starts_with(child, parent)) {
+        return false;
+    }
+
+    return parent.back() == '/'
+            || (child.size() > parent.size() && child[parent.size()] == '/');
+}
+
+/*!
+ * \brief Run mount jobs concurrently, respecting mount point dependencies
+ *
+ * A job depends on every job that mounts at a parent of its mount point and on
+ * every earlier job that mounts at the same mount point. Jobs without pending
+ * dependencies run in parallel. If a dependency fails, the job is not run and
+ * is treated as failed.
+ *
+ * Log messages from the jobs are emitted in job order once all jobs have
+ * completed, followed by a report of how long each job took.
+ *
+ * \param jobs Mount jobs (results are stored in each job)
+ *
+ * \return Whether all jobs succeeded
+ */
+static bool run_mount_jobs(std::vector<MountJob> &jobs)
+{
+    using namespace std::chrono;
+
+    if (jobs.empty()) {
+        return true;
+    }
+
+    std::vector<std::vector<size_t>> deps(jobs.size());
+
+    for (size_t i = 0; i < jobs.size(); ++i) {
+        for (size_t j = 0; j < jobs.size(); ++j) {
+            if (i == j) {
+                continue;
+            }
+
+            auto const &parent = jobs[j].mount_point;
+            auto const &child = jobs[i].mount_point;
+
+            if (is_parent_mount_point(parent, child)
+                    || (j < i && util::path_compare(parent, child) == 0)) {
+                deps[i].push_back(j);
+            }
+        }
+    }
+
+    std::mutex state_lock;
+    std::condition_variable state_cv;
+    std::vector<bool> done(jobs.size());
+
+    auto run_job = [&](size_t i) {
+        auto &job = jobs[i];
+        bool deps_ok = true;
+
+        {
+            std::unique_lock<std::mutex> lock(state_lock);
+
+            state_cv.wait(lock, [&] {
+                return std::all_of(deps[i].begin(), deps[i].end(),
+                                   [&](size_t j) { return done[j]; });
+            });
+
+            for (size_t j : deps[i]) {
+                deps_ok = deps_ok && jobs[j].result;
+            }
+        }
+
+        t_job_log_records = &job.log_records;
+
+        auto start = steady_clock::now();
+        bool result = false;
+
+        if (deps_ok) {
+            result = job.fn();
+        } else {
+            LOGE("%s: Skipping because a parent mount failed",
+                 job.mount_point.c_str());
+        }
+
+        auto elapsed = steady_clock::now() - start;
+
+        t_job_log_records = nullptr;
+
+        {
+            std::lock_guard<std::mutex> lock(state_lock);
+
+            job.result = result;
+            job.elapsed = elapsed;
+            done[i] = true;
+        }
+
+        state_cv.notify_all();
+    };
+
+    auto orig_logger = log::logger();
+    if (!orig_logger) {
+        orig_logger = std::make_shared<log::StdioLogger>(stdout);
+    }
+    log::set_logger(std::make_shared<MountJobLogger>(orig_logger));
+
+    auto start = steady_clock::now();
+
+    // Each job gets its own thread since most of the time is spent waiting for
+    // block devices and the kernel
+    std::vector<std::thread> threads;
+    threads.reserve(jobs.size() - 1);
+
+    for (size_t i = 1; i < jobs.size(); ++i) {
+        threads.emplace_back(run_job, i);
+    }
+
+    run_job(0);
+
+    for (auto &t : threads) {
+        t.join();
+    }
+
+    auto stop = steady_clock::now();
+
+    log::set_logger(orig_logger);
+
+    for (auto const &job : jobs) {
+        for (auto const &rec : job.log_records) {
+            orig_logger->log(rec);
+        }
+    }
+
+    bool ret = true;
+
+    LOGD("Mount timing report:");
+    for (auto const &job : jobs) {
+        LOGD("- %s: %s in %" PRIu64 "ms", job.mount_point.c_str(),
+             job.result ? "succeeded" : "failed",
+             static_cast<uint64_t>(duration_cast<milliseconds>(
+                    job.elapsed).count()));
+        ret = ret && job.result;
+    }
+    LOGD("- Total: %" PRIu64 "ms",
+         static_cast<uint64_t>(duration_cast<milliseconds>(
+                stop - start).count()));
+
+    return ret;
+}
+
 /*!
  * \brief Mount system, cache, and data entries from fstab
  *
@@ -898,36 +1288,27 @@ bool mount_fstab(const char *path, const std::shared_ptr<Rom> &rom,
         return false;
     }
 
-    bool ret = true;
+    std::vector<MountJob> jobs;
 
-    // Mount system
-    if (ret && !recs.system.empty()) {
-        if (create_dir_and_mount(recs.system, SYSTEM_MOUNT_POINT, 0755)) {
-            successful.push_back(SYSTEM_MOUNT_POINT);
-        } else {
-            LOGE("Failed to mount " SYSTEM_MOUNT_POINT);
-            ret = false;
-        }
+    if (!recs.system.empty()) {
+        jobs.emplace_back(SYSTEM_MOUNT_POINT, [&] {
+            return create_dir_and_mount(
+                    handler, recs.system, SYSTEM_MOUNT_POINT, 0755);
+        });
     }
 
-    // Mount cache
-    if (ret && !recs.cache.empty()) {
-        if (create_dir_and_mount(recs.cache, CACHE_MOUNT_POINT, 0755)) {
-            successful.push_back(CACHE_MOUNT_POINT);
-        } else {
-            LOGE("Failed to mount " CACHE_MOUNT_POINT);
-            ret = false;
-        }
+    if (!recs.cache.empty()) {
+        jobs.emplace_back(CACHE_MOUNT_POINT, [&] {
+            return create_dir_and_mount(
+                    handler, recs.cache, CACHE_MOUNT_POINT, 0755);
+        });
     }
 
-    // Mount data
-    if (ret && !recs.data.empty()) {
-        if (create_dir_and_mount(recs.data, DATA_MOUNT_POINT, 0755)) {
-            successful.push_back(DATA_MOUNT_POINT);
-        } else {
-            LOGE("Failed to mount " DATA_MOUNT_POINT);
-            ret = false;
-        }
+    if (!recs.data.empty()) {
+        jobs.emplace_back(DATA_MOUNT_POINT, [&] {
+            return create_dir_and_mount(
+                    handler, recs.data, DATA_MOUNT_POINT, 0755);
+        });
     }
 
     // Mount external SD only if ROM is installed on the external SD. This is
@@ -940,13 +1321,21 @@ bool mount_fstab(const char *path, const std::shared_ptr<Rom> &rom,
         LOGV("Skipping extsd mount because ROM is not an extsd-slot");
     }
 
-    if (ret && !recs.extsd.empty() && require_extsd) {
-        if (mount_extsd_fstab_entries(
-                handler, recs.extsd, EXTSD_MOUNT_POINT, 0755)) {
-            successful.push_back(EXTSD_MOUNT_POINT);
+    if (!recs.extsd.empty() && require_extsd) {
+        jobs.emplace_back(EXTSD_MOUNT_POINT, [&] {
+            return mount_extsd_fstab_entries(
+                    handler, recs.extsd, EXTSD_MOUNT_POINT, 0755);
+        });
+    }
+
+    // The partitions are independent, so they are mounted in parallel
+    bool ret = run_mount_jobs(jobs);
+
+    for (auto const &job : jobs) {
+        if (job.result) {
+            successful.push_back(job.mount_point);
         } else {
-            LOGE("Failed to mount " EXTSD_MOUNT_POINT);
-            ret = false;
+            LOGE("Failed to mount %s", job.mount_point.c_str());
         }
     }
 
@@ -1016,8 +1405,6 @@ bool mount_rom(const std::shared_ptr<Rom> &rom)
         return false;
     }
 
-    mount_all_system_images();
-
     bool require_extsd = rom->system_source == Rom::Source::ExternalSd
             || rom->cache_source == Rom::Source::ExternalSd
             || rom->data_source == Rom::Source::ExternalSd;
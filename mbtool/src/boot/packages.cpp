@@ -19,7 +19,7 @@
 
 #include "boot/packages.h"
 
-#include <algorithm>
+#include <string_view>
 
 #include <cassert>
 #include <cstdlib>
@@ -32,8 +32,14 @@
 #include "mbcommon/integer.h"
 #include "mblog/logging.h"
 
+#include "util/patch_cache.h"
+
 #define LOG_TAG "mbtool/util/packages"
 
+// Version of the serialized data in the packages.xml cache. This must be
+// incremented when the Package fields or their order change.
+#define PACKAGES_CACHE_VERSION          1
+
 
 namespace mb
 {
@@ -97,8 +103,10 @@ static bool parse_tag_cert(pugi::xml_node node, Packages *pkgs,
                            std::shared_ptr<Package> pkg);
 static bool parse_tag_sigs(pugi::xml_node node, Packages *pkgs,
                            std::shared_ptr<Package> pkg);
-static bool parse_tag_package(pugi::xml_node node, Packages *pkgs);
-static bool parse_tag_packages(pugi::xml_node node, Packages *pkgs);
+static bool parse_tag_package(pugi::xml_node node, Packages *pkgs,
+                              PackagesLoadFlags flags);
+static bool parse_tag_packages(pugi::xml_node node, Packages *pkgs,
+                               PackagesLoadFlags flags);
 
 
 Package::Package() :
@@ -313,13 +321,35 @@ void Package::dump()
 #undef DUMP_PRIVATE_FLAG_IF_SET
 }
 
-bool Packages::load_xml(const std::string &path)
+/*!
+ * \brief Load packages from packages.xml
+ *
+ * \param path Path to packages.xml
+ * \param flags Parts of the file to skip
+ *
+ * \return Whether the file was successfully parsed
+ */
+bool Packages::load_xml(const std::string &path, PackagesLoadFlags flags)
+{
+    if (!parse_xml(path, flags)) {
+        return false;
+    }
+
+    build_indexes();
+
+    return true;
+}
+
+bool Packages::parse_xml(const std::string &path, PackagesLoadFlags flags)
 {
     pkgs.clear();
     sigs.clear();
 
+    // Comments, processing instructions, and CDATA sections never contain
+    // anything we need, so don't bother creating nodes for them
     pugi::xml_document doc;
-    pugi::xml_parse_result result = doc.load_file(path.c_str());
+    pugi::xml_parse_result result = doc.load_file(
+            path.c_str(), pugi::parse_minimal | pugi::parse_escapes);
     if (!result) {
         LOGE("Failed to parse XML file: %s: %s",
              path.c_str(), result.description());
@@ -334,7 +364,7 @@ bool Packages::load_xml(const std::string &path)
         }
 
         if (strcmp(cur_node.name(), TAG_PACKAGES) == 0) {
-            if (!parse_tag_packages(cur_node, this)) {
+            if (!parse_tag_packages(cur_node, this, flags)) {
                 return false;
             }
         } else {
@@ -413,7 +443,8 @@ static bool parse_tag_sigs(pugi::xml_node node, Packages *pkgs,
     return true;
 }
 
-static bool parse_tag_package(pugi::xml_node node, Packages *pkgs)
+static bool parse_tag_package(pugi::xml_node node, Packages *pkgs,
+                              PackagesLoadFlags flags)
 {
     assert(strcmp(node.name(), TAG_PACKAGE) == 0);
 
@@ -525,7 +556,9 @@ static bool parse_tag_package(pugi::xml_node node, Packages *pkgs)
                 || strcmp(cur_node.name(), TAG_UPGRADE_KEYSET) == 0) {
             // Ignore
         } else if (strcmp(cur_node.name(), TAG_SIGS) == 0) {
-            if (!parse_tag_sigs(cur_node, pkgs, pkg)) {
+            if (flags & PackagesLoadFlag::SkipSigs) {
+                continue;
+            } else if (!parse_tag_sigs(cur_node, pkgs, pkg)) {
                 return false;
             }
         } else {
@@ -538,7 +571,8 @@ static bool parse_tag_package(pugi::xml_node node, Packages *pkgs)
     return true;
 }
 
-static bool parse_tag_packages(pugi::xml_node node, Packages *pkgs)
+static bool parse_tag_packages(pugi::xml_node node, Packages *pkgs,
+                               PackagesLoadFlags flags)
 {
     assert(strcmp(node.name(), TAG_PACKAGES) == 0);
 
@@ -550,7 +584,7 @@ static bool parse_tag_packages(pugi::xml_node node, Packages *pkgs)
         if (strcmp(cur_node.name(), TAG_PACKAGES) == 0) {
             LOGW("Nested <%s> is not allowed", TAG_PACKAGES);
         } else if (strcmp(cur_node.name(), TAG_PACKAGE) == 0) {
-            if (!parse_tag_package(cur_node, pkgs)) {
+            if (!parse_tag_package(cur_node, pkgs, flags)) {
                 return false;
             }
         } else if (strcmp(cur_node.name(), TAG_DATABASE_VERSION) == 0
@@ -571,22 +605,250 @@ static bool parse_tag_packages(pugi::xml_node node, Packages *pkgs)
     return true;
 }
 
+static void put_u64(std::string &out, uint64_t value)
+{
+    out.append(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+static void put_string(std::string &out, const std::string &value)
+{
+    put_u64(out, value.size());
+    out += value;
+}
+
+class CacheReader
+{
+public:
+    explicit CacheReader(std::string_view data) : m_data(data)
+    {
+    }
+
+    template<typename T>
+    bool get_int(T &value)
+    {
+        uint64_t raw;
+        if (m_data.size() < sizeof(raw)) {
+            return false;
+        }
+        memcpy(&raw, m_data.data(), sizeof(raw));
+        m_data.remove_prefix(sizeof(raw));
+        value = static_cast<T>(raw);
+        return true;
+    }
+
+    bool get_string(std::string &value)
+    {
+        uint64_t size;
+        if (!get_int(size) || size > m_data.size()) {
+            return false;
+        }
+        value = m_data.substr(0, size);
+        m_data.remove_prefix(size);
+        return true;
+    }
+
+    bool at_end() const
+    {
+        return m_data.empty();
+    }
+
+private:
+    std::string_view m_data;
+};
+
+static std::string serialize_packages(const Packages &packages)
+{
+    std::string out;
+
+    put_u64(out, packages.pkgs.size());
+
+    for (auto const &pkg : packages.pkgs) {
+        put_string(out, pkg->name);
+        put_string(out, pkg->real_name);
+        put_string(out, pkg->code_path);
+        put_string(out, pkg->resource_path);
+        put_string(out, pkg->native_library_path);
+        put_string(out, pkg->primary_cpu_abi);
+        put_string(out, pkg->secondary_cpu_abi);
+        put_string(out, pkg->cpu_abi_override);
+        put_u64(out, pkg->pkg_flags);
+        put_u64(out, pkg->pkg_public_flags);
+        put_u64(out, pkg->pkg_private_flags);
+        put_u64(out, pkg->timestamp);
+        put_u64(out, pkg->first_install_time);
+        put_u64(out, pkg->last_update_time);
+        put_u64(out, static_cast<uint64_t>(pkg->version));
+        put_u64(out, static_cast<uint64_t>(pkg->is_shared_user));
+        put_u64(out, static_cast<uint64_t>(pkg->user_id));
+        put_u64(out, static_cast<uint64_t>(pkg->shared_user_id));
+        put_string(out, pkg->uid_error);
+        put_string(out, pkg->install_status);
+        put_string(out, pkg->installer);
+
+        put_u64(out, pkg->sig_indexes.size());
+        for (auto const &index : pkg->sig_indexes) {
+            put_string(out, index);
+        }
+    }
+
+    put_u64(out, packages.sigs.size());
+    for (auto const &[index, key] : packages.sigs) {
+        put_string(out, index);
+        put_string(out, key);
+    }
+
+    return out;
+}
+
+static bool deserialize_packages(std::string_view data, Packages &packages)
+{
+    CacheReader reader(data);
+    uint64_t count;
+
+    packages.pkgs.clear();
+    packages.sigs.clear();
+
+    if (!reader.get_int(count)) {
+        return false;
+    }
+
+    for (uint64_t i = 0; i < count; ++i) {
+        auto pkg = std::make_shared<Package>();
+        uint64_t flags;
+        uint64_t public_flags;
+        uint64_t private_flags;
+        uint64_t sig_count;
+
+        if (!reader.get_string(pkg->name)
+                || !reader.get_string(pkg->real_name)
+                || !reader.get_string(pkg->code_path)
+                || !reader.get_string(pkg->resource_path)
+                || !reader.get_string(pkg->native_library_path)
+                || !reader.get_string(pkg->primary_cpu_abi)
+                || !reader.get_string(pkg->secondary_cpu_abi)
+                || !reader.get_string(pkg->cpu_abi_override)
+                || !reader.get_int(flags)
+                || !reader.get_int(public_flags)
+                || !reader.get_int(private_flags)
+                || !reader.get_int(pkg->timestamp)
+                || !reader.get_int(pkg->first_install_time)
+                || !reader.get_int(pkg->last_update_time)
+                || !reader.get_int(pkg->version)
+                || !reader.get_int(pkg->is_shared_user)
+                || !reader.get_int(pkg->user_id)
+                || !reader.get_int(pkg->shared_user_id)
+                || !reader.get_string(pkg->uid_error)
+                || !reader.get_string(pkg->install_status)
+                || !reader.get_string(pkg->installer)
+                || !reader.get_int(sig_count)) {
+            return false;
+        }
+
+        pkg->pkg_flags = static_cast<Package::Flag>(flags);
+        pkg->pkg_public_flags = static_cast<Package::PublicFlag>(public_flags);
+        pkg->pkg_private_flags =
+                static_cast<Package::PrivateFlag>(private_flags);
+
+        for (uint64_t j = 0; j < sig_count; ++j) {
+            if (!reader.get_string(pkg->sig_indexes.emplace_back())) {
+                return false;
+            }
+        }
+
+        packages.pkgs.push_back(std::move(pkg));
+    }
+
+    if (!reader.get_int(count)) {
+        return false;
+    }
+
+    for (uint64_t i = 0; i < count; ++i) {
+        std::string index;
+        std::string key;
+
+        if (!reader.get_string(index) || !reader.get_string(key)) {
+            return false;
+        }
+
+        packages.sigs.insert_or_assign(std::move(index), std::move(key));
+    }
+
+    return reader.at_end();
+}
+
+/*!
+ * \brief Load packages from packages.xml, using a cached copy if possible
+ *
+ * The parsed packages are stored in a compact binary form at \p cache_path.
+ * The cache entry is used as long as packages.xml has not been replaced or
+ * modified (based on its inode, size, and mtime). Otherwise, packages.xml is
+ * parsed and the cache entry is rewritten.
+ *
+ * \param path Path to packages.xml
+ * \param cache_path Path to cache entry (see patch_cache_path())
+ * \param flags Parts of the file to skip
+ *
+ * \return Whether the packages were successfully loaded
+ */
+bool Packages::load_cached(const std::string &path,
+                           const std::string &cache_path,
+                           PackagesLoadFlags flags)
+{
+    auto key = patch_cache_stat_key(
+            path, (flags & PackagesLoadFlag::SkipSigs) ? "nosigs" : "full",
+            PACKAGES_CACHE_VERSION);
+
+    if (std::string data; key && patch_cache_load(cache_path, *key, data)) {
+        if (deserialize_packages(data, *this)) {
+            build_indexes();
+            return true;
+        }
+
+        LOGW("%s: Invalid packages cache entry", cache_path.c_str());
+    }
+
+    if (!parse_xml(path, flags)) {
+        return false;
+    }
+
+    build_indexes();
+
+    // The key was computed before parsing, so if packages.xml was replaced in
+    // the meantime, the stale key just won't match on the next load
+    if (key) {
+        patch_cache_save(cache_path, *key, serialize_packages(*this));
+    }
+
+    return true;
+}
+
+void Packages::build_indexes()
+{
+    m_by_uid.clear();
+    m_by_name.clear();
+
+    m_by_uid.reserve(pkgs.size());
+    m_by_name.reserve(pkgs.size());
+
+    // If there are duplicates, the first package wins
+    for (auto const &pkg : pkgs) {
+        if (!pkg->is_shared_user) {
+            m_by_uid.emplace(static_cast<uid_t>(pkg->user_id), pkg);
+        }
+        m_by_name.emplace(pkg->name, pkg);
+    }
+}
+
 std::shared_ptr<Package> Packages::find_by_uid(uid_t uid) const
 {
-    auto it = std::find_if(pkgs.begin(), pkgs.end(),
-                           [&](const std::shared_ptr<Package> &pkg) {
-        return !pkg->is_shared_user && pkg->user_id == static_cast<int>(uid);
-    });
-    return it == pkgs.end() ? std::shared_ptr<Package>() : *it;
+    auto it = m_by_uid.find(uid);
+    return it == m_by_uid.end() ? std::shared_ptr<Package>() : it->second;
 }
 
 std::shared_ptr<Package> Packages::find_by_pkg(const std::string &pkg_id) const
 {
-    auto it = std::find_if(pkgs.begin(), pkgs.end(),
-                           [&](const std::shared_ptr<Package> &pkg) {
-        return pkg->name == pkg_id;
-    });
-    return it == pkgs.end() ? std::shared_ptr<Package>() : *it;
+    auto it = m_by_name.find(pkg_id);
+    return it == m_by_name.end() ? std::shared_ptr<Package>() : it->second;
 }
 
 }
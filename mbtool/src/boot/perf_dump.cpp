@@ -0,0 +1,238 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "boot/perf_dump.h"
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <getopt.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "mbcommon/finally.h"
+#include "mbcommon/perf.h"
+#include "mbutil/socket.h"
+
+// flatbuffers
+#include "protocol/request_generated.h"
+#include "protocol/response_generated.h"
+
+namespace v3 = mbtool::daemon::v3;
+namespace fb = flatbuffers;
+
+namespace mb
+{
+
+static void perf_dump_usage(bool error)
+{
+    FILE *stream = error ? stderr : stdout;
+
+    fprintf(stream,
+            "Usage: perf-dump [OPTION...]\n"
+            "\n"
+            "Options:\n"
+            "  -r, --reset      Reset counters after printing them\n"
+            "  -h, --help       Display this help message\n"
+            "\n"
+            "This tool prints the performance counters of the running mbtool\n"
+            "daemon. Only work done in the daemon process is counted.\n");
+}
+
+static int connect_daemon()
+{
+    int fd = socket(AF_LOCAL, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        fprintf(stderr, "Failed to create socket: %s\n", strerror(errno));
+        return -1;
+    }
+
+    char abs_name[] = "\0mbtool.daemon";
+    size_t abs_name_len = sizeof(abs_name) - 1;
+
+    sockaddr_un addr = {};
+    addr.sun_family = AF_LOCAL;
+    memcpy(addr.sun_path, abs_name, abs_name_len);
+
+    socklen_t addr_len = static_cast<socklen_t>(offsetof(sockaddr_un, sun_path))
+            + static_cast<socklen_t>(abs_name_len);
+
+    if (connect(fd, reinterpret_cast<sockaddr *>(&addr), addr_len) < 0) {
+        fprintf(stderr, "Failed to connect to daemon: %s\n", strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+static bool handshake(int fd)
+{
+    auto auth = util::socket_read_string(fd);
+    if (!auth) {
+        fprintf(stderr, "Failed to read credentials response: %s\n",
+                auth.error().message().c_str());
+        return false;
+    } else if (auth.value() != "ALLOW") {
+        fprintf(stderr, "Daemon denied the connection. "
+                "Is it running with --allow-root-client?\n");
+        return false;
+    }
+
+    if (auto r = util::socket_write_int32(fd, 3); !r) {
+        fprintf(stderr, "Failed to send interface version: %s\n",
+                r.error().message().c_str());
+        return false;
+    }
+
+    auto version = util::socket_read_string(fd);
+    if (!version) {
+        fprintf(stderr, "Failed to read version response: %s\n",
+                version.error().message().c_str());
+        return false;
+    } else if (version.value() != "OK") {
+        fprintf(stderr, "Daemon does not support interface version 3\n");
+        return false;
+    }
+
+    return true;
+}
+
+static bool get_perf_counters(int fd, bool reset,
+                              std::vector<perf::MetricSnapshot> &metrics_out)
+{
+    fb::FlatBufferBuilder builder;
+    auto fb_request = v3::CreateMbGetPerfCountersRequest(builder, reset);
+    builder.Finish(v3::CreateRequest(
+            builder, v3::RequestType_MbGetPerfCountersRequest,
+            fb_request.Union()));
+
+    if (auto r = util::socket_write_bytes(
+            fd, builder.GetBufferPointer(), builder.GetSize()); !r) {
+        fprintf(stderr, "Failed to send request: %s\n",
+                r.error().message().c_str());
+        return false;
+    }
+
+    auto data = util::socket_read_bytes(fd);
+    if (!data) {
+        fprintf(stderr, "Failed to read response: %s\n",
+                data.error().message().c_str());
+        return false;
+    }
+
+    auto verifier = fb::Verifier(data.value().data(), data.value().size());
+    if (!v3::VerifyResponseBuffer(verifier)) {
+        fprintf(stderr, "Received invalid buffer\n");
+        return false;
+    }
+
+    auto response = v3::GetResponse(data.value().data())
+            ->response_as_MbGetPerfCountersResponse();
+    if (!response) {
+        fprintf(stderr, "Daemon does not support performance counters\n");
+        return false;
+    }
+
+    metrics_out.clear();
+
+    if (auto metrics = response->metrics()) {
+        for (auto m : *metrics) {
+            perf::MetricSnapshot s{};
+            if (m->name()) {
+                s.name = m->name()->str();
+            }
+            s.type = m->type() == v3::PerfMetricType_HISTOGRAM
+                    ? perf::MetricType::Histogram
+                    : perf::MetricType::Counter;
+            s.count = m->count();
+            s.sum = m->sum();
+            s.max = m->max();
+            if (m->buckets()) {
+                s.buckets.assign(m->buckets()->begin(), m->buckets()->end());
+            }
+
+            metrics_out.push_back(std::move(s));
+        }
+    }
+
+    return true;
+}
+
+int perf_dump_main(int argc, char *argv[])
+{
+    bool reset = false;
+
+    int opt;
+
+    static constexpr char short_options[] = "rh";
+    static struct option long_options[] = {
+        {"reset", no_argument, 0, 'r'},
+        {"help",  no_argument, 0, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    int long_index = 0;
+
+    while ((opt = getopt_long(argc, argv, short_options,
+                              long_options, &long_index)) != -1) {
+        switch (opt) {
+        case 'r':
+            reset = true;
+            break;
+        case 'h':
+            perf_dump_usage(false);
+            return EXIT_SUCCESS;
+        default:
+            perf_dump_usage(true);
+            return EXIT_FAILURE;
+        }
+    }
+
+    // There should be no other arguments
+    if (argc - optind != 0) {
+        perf_dump_usage(true);
+        return EXIT_FAILURE;
+    }
+
+    int fd = connect_daemon();
+    if (fd < 0) {
+        return EXIT_FAILURE;
+    }
+
+    auto close_fd = finally([&] {
+        close(fd);
+    });
+
+    std::vector<perf::MetricSnapshot> metrics;
+
+    if (!handshake(fd) || !get_perf_counters(fd, reset, metrics)) {
+        return EXIT_FAILURE;
+    }
+
+    fputs(perf::format_snapshot(metrics).c_str(), stdout);
+
+    return EXIT_SUCCESS;
+}
+
+}
@@ -17,8 +17,12 @@
 
 #include "boot/property_service.h"
 
+#include <algorithm>
 #include <chrono>
+#include <memory>
 #include <string_view>
+#include <unordered_map>
+#include <vector>
 
 #include <cerrno>
 #include <cstdio>
@@ -27,10 +31,11 @@
 
 #include <fcntl.h>
 #include <netinet/in.h>
-#include <sys/poll.h>
+#include <sys/epoll.h>
 #include <sys/select.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 #include <sys/un.h>
 #include <unistd.h>
@@ -52,11 +57,30 @@
 
 #define LOG_TAG "mbtool/boot/property_service"
 
+// Directory where init stores persistent properties, one file per property.
+// This is the layout used before Android 9. Newer versions of init only read
+// it if PERSISTENT_PROPERTY_FILE does not exist.
+#define PERSISTENT_PROPERTY_DIR         "/data/property"
+#define PERSISTENT_PROPERTY_FILE        PERSISTENT_PROPERTY_DIR "/persistent_properties"
+
+using namespace std::chrono;
+
+// Time that a client has to send a complete request
+static constexpr milliseconds REQUEST_TIMEOUT(2000);
+// Time to wait for more persist.* properties before writing them to disk
+static constexpr milliseconds PERSIST_WRITE_DELAY(250);
+// Maximum number of connections being served at the same time
+static constexpr size_t MAX_CONNECTIONS = 64;
+// Maximum size of a name or value in a PROP_MSG_SETPROP2 request
+static constexpr uint32_t MAX_STRING_SIZE = 0xffff;
+
 class SocketConnection
 {
 public:
     SocketConnection(int fd)
         : m_fd(fd)
+        , m_deadline(steady_clock::now() + REQUEST_TIMEOUT)
+        , m_eof(false)
     {
     }
 
@@ -73,63 +97,57 @@ public:
         return m_fd;
     }
 
-    mb::oc::result<void> recv_data(void *data, size_t size,
-                                   std::chrono::milliseconds &timeout)
+    steady_clock::time_point deadline() const
     {
-        char *ptr = static_cast<char *>(data);
-        size_t remain = size;
+        return m_deadline;
+    }
 
-        while (timeout.count() > 0 && remain > 0) {
-            OUTCOME_TRYV(poll_socket(timeout));
+    bool eof() const
+    {
+        return m_eof;
+    }
+
+    std::string_view data() const
+    {
+        return m_buf;
+    }
+
+    /*!
+     * \brief Receive all data that is currently available without blocking
+     */
+    mb::oc::result<void> recv_available()
+    {
+        char buf[1024];
 
+        while (true) {
             auto result = TEMP_FAILURE_RETRY(
-                    recv(m_fd, ptr, remain, MSG_DONTWAIT));
+                    recv(m_fd, buf, sizeof(buf), MSG_DONTWAIT));
             if (result < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    break;
+                }
                 return mb::ec_from_errno();
             } else if (result == 0) {
+                m_eof = true;
                 break;
             }
 
-            ptr += result;
-            remain -= result;
-        }
+            m_buf.append(buf, static_cast<size_t>(result));
 
-        if (remain > 0) {
-            return std::errc::io_error;
+            // Requests are never this large
+            if (m_buf.size() > sizeof(uint32_t)
+                    + 2 * (sizeof(uint32_t) + MAX_STRING_SIZE)) {
+                return std::errc::message_size;
+            }
         }
 
         return mb::oc::success();
     }
 
-
-    mb::oc::result<uint32_t> recv_uint32(std::chrono::milliseconds &timeout)
-    {
-        uint32_t value;
-        OUTCOME_TRYV(recv_data(&value, sizeof(value), timeout));
-        return value;
-    }
-
-    mb::oc::result<std::string> recv_string(std::chrono::milliseconds &timeout)
-    {
-        OUTCOME_TRY(len, recv_uint32(timeout));
-        if (len == 0) {
-            return "";
-        } else if (len > 0xffff) {
-            return std::errc::not_enough_memory;
-        }
-
-        std::string str;
-        str.resize(len);
-
-        OUTCOME_TRYV(recv_data(str.data(), str.size(), timeout));
-
-        return std::move(str);
-    }
-
     mb::oc::result<void> send_uint32(uint32_t value)
     {
         auto result = TEMP_FAILURE_RETRY(
-                send(m_fd, &value, sizeof(value), 0));
+                send(m_fd, &value, sizeof(value), MSG_NOSIGNAL));
         if (result < 0) {
             return mb::ec_from_errno();
         } else if (result != sizeof(value)) {
@@ -141,43 +159,55 @@ public:
 
 private:
     int m_fd;
+    steady_clock::time_point m_deadline;
+    bool m_eof;
+    std::string m_buf;
+};
 
-    mb::oc::result<void> poll_socket(std::chrono::milliseconds &timeout)
-    {
-        using namespace std::chrono;
-
-        pollfd pfd;
-        pfd.fd = m_fd;
-        pfd.events = POLLIN;
-        pfd.revents = 0;
+static bool take_uint32(std::string_view &buf, uint32_t &value)
+{
+    if (buf.size() < sizeof(value)) {
+        return false;
+    }
 
-        while (timeout.count() > 0) {
-            auto start = steady_clock::now();
-            int nr = poll(&pfd, 1, timeout.count());
+    memcpy(&value, buf.data(), sizeof(value));
+    buf.remove_prefix(sizeof(value));
 
-            if (nr > 0) {
-                return mb::oc::success();
-            } else if (nr == 0) {
-                break;
-            } else if (errno != EINTR) {
-                return mb::ec_from_errno();
-            }
+    return true;
+}
 
-            auto end = steady_clock::now();
-            auto elapsed = duration_cast<milliseconds>(end - start);
+enum class TakeResult
+{
+    Ok,
+    Incomplete,
+    TooLarge,
+};
 
-            timeout = (elapsed > timeout) ? 0ms : (timeout - elapsed);
-        }
+static TakeResult take_string(std::string_view &buf, std::string &str)
+{
+    std::string_view temp = buf;
+    uint32_t len;
 
-        LOGW("Socket timed out waiting for data");
-        return std::errc::timed_out;
+    if (!take_uint32(temp, len)) {
+        return TakeResult::Incomplete;
+    } else if (len > MAX_STRING_SIZE) {
+        return TakeResult::TooLarge;
+    } else if (temp.size() < len) {
+        return TakeResult::Incomplete;
     }
-};
+
+    str = temp.substr(0, len);
+    temp.remove_prefix(len);
+    buf = temp;
+
+    return TakeResult::Ok;
+}
 
 PropertyService::PropertyService()
     : m_initialized(false)
     , m_setter_fd(-1)
     , m_stopper_pipe{-1, -1}
+    , m_persist_stop(false)
 {
 }
 
@@ -314,6 +344,8 @@ bool PropertyService::start_thread()
         return false;
     }
 
+    m_persist_stop = false;
+    m_persist_thread = std::thread(&PropertyService::persist_loop, this);
     m_thread = std::thread(&PropertyService::socket_handler_loop, this);
 
     LOGD("Started property service");
@@ -334,6 +366,14 @@ bool PropertyService::stop_thread()
 
     m_thread.join();
 
+    // Write out any persist.* properties that are still pending
+    {
+        std::lock_guard<std::mutex> lock(m_persist_lock);
+        m_persist_stop = true;
+    }
+    m_persist_cv.notify_one();
+    m_persist_thread.join();
+
     close(std::exchange(m_setter_fd, -1));
     close(std::exchange(m_stopper_pipe[0], -1));
     close(std::exchange(m_stopper_pipe[1], -1));
@@ -388,107 +428,236 @@ int PropertyService::create_socket()
     return fd;
 }
 
+/*!
+ * \brief Serve property requests from an epoll event loop
+ *
+ * Requests are read without blocking, so a slow client doesn't hold up any of
+ * the other connections. Each client has REQUEST_TIMEOUT to send a complete
+ * request.
+ */
 void PropertyService::socket_handler_loop()
 {
-    pollfd fds[2];
-    fds[0].fd = m_stopper_pipe[0];
-    fds[0].events = POLLIN;
-    fds[1].fd = m_setter_fd;
-    fds[1].events = POLLIN;
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0) {
+        LOGE("Failed to create epoll instance: %s", strerror(errno));
+        return;
+    }
+
+    auto close_epoll_fd = mb::finally([&] {
+        close(epoll_fd);
+    });
+
+    for (int fd : { m_stopper_pipe[0], m_setter_fd }) {
+        epoll_event ev = {};
+        ev.events = EPOLLIN;
+        ev.data.fd = fd;
+
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            LOGE("Failed to add fd to epoll instance: %s", strerror(errno));
+            return;
+        }
+    }
+
+    std::unordered_map<int, std::unique_ptr<SocketConnection>> conns;
+
+    auto close_conn = [&](int fd) {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+        conns.erase(fd);
+    };
 
     while (true) {
-        fds[0].revents = 0;
-        fds[1].revents = 0;
+        int timeout = -1;
+
+        if (!conns.empty()) {
+            auto deadline = std::min_element(conns.begin(), conns.end(),
+                                             [](auto const &a, auto const &b) {
+                return a.second->deadline() < b.second->deadline();
+            })->second->deadline();
+            auto remain = duration_cast<milliseconds>(
+                    deadline - steady_clock::now()).count();
+
+            timeout = static_cast<int>(std::clamp<decltype(remain)>(
+                    remain + 1, 0, REQUEST_TIMEOUT.count()));
+        }
 
-        if (poll(fds, 2, -1) < 0) {
+        epoll_event events[16];
+
+        int n = epoll_wait(epoll_fd, events, 16, timeout);
+        if (n < 0) {
             if (errno == EINTR) {
                 continue;
             } else {
-                LOGE("Failed to poll socket: %s", strerror(errno));
+                LOGE("Failed to wait for events: %s", strerror(errno));
                 return;
             }
         }
-        if (fds[0].revents & POLLIN) {
-            LOGV("Received notification to stop property service");
-            break;
+
+        for (int i = 0; i < n; ++i) {
+            int fd = events[i].data.fd;
+
+            if (fd == m_stopper_pipe[0]) {
+                LOGV("Received notification to stop property service");
+                return;
+            } else if (fd == m_setter_fd) {
+                socket_accept_connections(epoll_fd, conns);
+                continue;
+            }
+
+            auto it = conns.find(fd);
+            if (it == conns.end()) {
+                continue;
+            }
+
+            if (socket_handle_request(*it->second)) {
+                close_conn(fd);
+            }
         }
-        if (fds[1].revents & POLLIN) {
-            socket_handle_set_property();
+
+        // Drop clients that didn't send a complete request in time
+        auto now = steady_clock::now();
+
+        for (auto it = conns.begin(); it != conns.end();) {
+            if (it->second->deadline() > now) {
+                ++it;
+                continue;
+            }
+
+            LOGW("Socket timed out waiting for data");
+
+            // Same replies as when the data can't be read
+            std::string_view data = it->second->data();
+            uint32_t cmd;
+            if (!take_uint32(data, cmd)) {
+                (void) it->second->send_uint32(PROP_ERROR_READ_CMD);
+            } else if (cmd == PROP_MSG_SETPROP2) {
+                (void) it->second->send_uint32(PROP_ERROR_READ_DATA);
+            }
+
+            int fd = it->first;
+            ++it;
+            close_conn(fd);
         }
     }
 }
 
-void PropertyService::socket_handle_set_property()
+void PropertyService::socket_accept_connections(
+        int epoll_fd,
+        std::unordered_map<int, std::unique_ptr<SocketConnection>> &conns)
 {
-    static constexpr std::chrono::milliseconds DEFAULT_TIMEOUT(2000);
+    while (true) {
+        int fd = accept4(m_setter_fd, nullptr, nullptr,
+                         SOCK_CLOEXEC | SOCK_NONBLOCK);
+        if (fd < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR
+                    && errno != ECONNABORTED) {
+                LOGE("Failed to accept socket connection: %s",
+                     strerror(errno));
+            }
+            if (errno == ECONNABORTED || errno == EINTR) {
+                continue;
+            }
+            return;
+        }
 
-    int fd = accept4(m_setter_fd, nullptr, nullptr, SOCK_CLOEXEC);
-    if (fd == -1) {
-        LOGE("Failed to accept socket connection: %s", strerror(errno));
-        return;
-    }
+        auto conn = std::make_unique<SocketConnection>(fd);
 
-    SocketConnection socket(fd);
-    auto timeout = DEFAULT_TIMEOUT;
+        if (conns.size() >= MAX_CONNECTIONS) {
+            LOGW("Too many connections; rejecting client");
+            continue;
+        }
 
-    auto cmd = socket.recv_uint32(timeout);
-    if (!cmd) {
-        LOGE("Failed to read command from socket: %s",
-             cmd.error().message().c_str());
-        (void) socket.send_uint32(PROP_ERROR_READ_CMD);
-        return;
+        epoll_event ev = {};
+        ev.events = EPOLLIN;
+        ev.data.fd = fd;
+
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            LOGE("Failed to add socket to epoll instance: %s",
+                 strerror(errno));
+            continue;
+        }
+
+        conns.emplace(fd, std::move(conn));
     }
+}
 
-    switch (cmd.value()) {
-    case PROP_MSG_SETPROP: {
-        char name[PROP_NAME_MAX];
-        char value[PROP_VALUE_MAX];
+/*!
+ * \brief Handle the data received on a connection
+ *
+ * \return Whether the connection is finished and should be closed
+ */
+bool PropertyService::socket_handle_request(SocketConnection &socket)
+{
+    auto ret = socket.recv_available();
 
-        if (auto r = socket.recv_data(name, PROP_NAME_MAX, timeout); !r) {
-            LOGE("Failed to receive name from the socket: %s",
-                 r.error().message().c_str());
-            return;
+    std::string_view data = socket.data();
+    uint32_t cmd;
+
+    // Treat errors like EOF so that the client gets the same replies as when
+    // a blocking read fails
+    bool done = !ret || socket.eof();
+
+    if (!ret) {
+        LOGE("Failed to read from socket: %s", ret.error().message().c_str());
+    }
+
+    if (!take_uint32(data, cmd)) {
+        if (done) {
+            LOGE("Failed to read command from socket");
+            (void) socket.send_uint32(PROP_ERROR_READ_CMD);
         }
+        return done;
+    }
 
-        if (auto r = socket.recv_data(value, PROP_VALUE_MAX, timeout); !r) {
-            LOGE("Failed to receive value from the socket: %s",
-                 r.error().message().c_str());
-            return;
+    switch (cmd) {
+    case PROP_MSG_SETPROP: {
+        if (data.size() < PROP_NAME_MAX + PROP_VALUE_MAX) {
+            if (done) {
+                LOGE("Failed to receive name and value from the socket");
+            }
+            return done;
         }
 
-        name[PROP_NAME_MAX - 1] = '\0';
-        value[PROP_VALUE_MAX - 1] = '\0';
+        // The fixed size fields are null terminated at the last byte if the
+        // client didn't do it
+        const char *name_buf = data.data();
+        const char *value_buf = data.data() + PROP_NAME_MAX;
+        std::string_view name(name_buf, strnlen(name_buf, PROP_NAME_MAX - 1));
+        std::string_view value(value_buf,
+                               strnlen(value_buf, PROP_VALUE_MAX - 1));
 
-        socket_handle_set_property_impl(socket, name, value, true);
-        break;
+        socket_handle_set_property_impl(socket, std::string(name), value, true);
+        return true;
     }
 
     case PROP_MSG_SETPROP2: {
-        auto name = socket.recv_string(timeout);
-        if (!name) {
-            LOGE("Failed to receive name from the socket: %s",
-                 name.error().message().c_str());
-            (void) socket.send_uint32(PROP_ERROR_READ_DATA);
-            return;
-        }
+        std::string name;
+        std::string value;
 
-        auto value = socket.recv_string(timeout);
-        if (!value) {
-            LOGE("Failed to receive value from the socket: %s",
-                 value.error().message().c_str());
-            (void) socket.send_uint32(PROP_ERROR_READ_DATA);
-            return;
+        for (auto *str : { &name, &value }) {
+            switch (take_string(data, *str)) {
+            case TakeResult::Ok:
+                continue;
+            case TakeResult::Incomplete:
+                if (!done) {
+                    return false;
+                }
+                [[fallthrough]];
+            case TakeResult::TooLarge:
+                LOGE("Failed to receive %s from the socket",
+                     str == &name ? "name" : "value");
+                (void) socket.send_uint32(PROP_ERROR_READ_DATA);
+                return true;
+            }
         }
 
-        socket_handle_set_property_impl(socket, name.value(), value.value(),
-                                        false);
-        break;
-      }
+        socket_handle_set_property_impl(socket, name, value, false);
+        return true;
+    }
 
     default:
-        LOGE("Invalid command: %u", cmd.value());
+        LOGE("Invalid command: %u", cmd);
         (void) socket.send_uint32(PROP_ERROR_INVALID_CMD);
-        break;
+        return true;
     }
 }
 
@@ -512,13 +681,139 @@ void PropertyService::socket_handle_set_property_impl(SocketConnection &socket,
             (void) socket.send_uint32(PROP_SUCCESS);
         }
     } else {
-        uint32_t result = set(name, value);
+        uint32_t result = set_internal(name, value);
+        if (result == PROP_SUCCESS && mb::starts_with(name, "persist.")) {
+            queue_persistent_property(name, value);
+        }
         if (!legacy) {
             (void) socket.send_uint32(result);
         }
     }
 }
 
+static void write_persistent_properties(
+        const std::unordered_map<std::string, std::string> &props)
+{
+    if (struct stat sb; stat(PERSISTENT_PROPERTY_FILE, &sb) == 0) {
+        LOGW("Not persisting %zu properties: init reads them from %s",
+             props.size(), PERSISTENT_PROPERTY_FILE);
+        return;
+    }
+
+    int dir_fd = open(PERSISTENT_PROPERTY_DIR,
+                      O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd < 0) {
+        LOGW("%s: Failed to open directory: %s",
+             PERSISTENT_PROPERTY_DIR, strerror(errno));
+        return;
+    }
+
+    auto close_dir_fd = mb::finally([&] {
+        close(dir_fd);
+    });
+
+    // Pairs of temporary path and final path
+    std::vector<std::pair<std::string, std::string>> renames;
+
+    for (auto const &[name, value] : props) {
+        std::string temp_path(PERSISTENT_PROPERTY_DIR "/.temp.XXXXXX");
+
+        int fd = mkostemp(temp_path.data(), O_CLOEXEC);
+        if (fd < 0) {
+            LOGE("%s: Failed to create temporary file: %s",
+                 temp_path.c_str(), strerror(errno));
+            continue;
+        }
+
+        // Values are shorter than PROP_VALUE_MAX, so one write is enough
+        auto n = TEMP_FAILURE_RETRY(write(fd, value.data(), value.size()));
+        bool ok = n >= 0 && static_cast<size_t>(n) == value.size();
+
+        if (!ok) {
+            LOGE("%s: Failed to write property: %s",
+                 temp_path.c_str(), n < 0 ? strerror(errno) : "Short write");
+        }
+
+        close(fd);
+
+        if (!ok) {
+            unlink(temp_path.c_str());
+            continue;
+        }
+
+        renames.emplace_back(std::move(temp_path),
+                             PERSISTENT_PROPERTY_DIR "/" + name);
+    }
+
+    // Flush the contents of all of the files at once. syncfs() is called
+    // directly because older versions of bionic don't provide a wrapper.
+    if (syscall(__NR_syncfs, dir_fd) < 0) {
+        LOGW("%s: Failed to sync filesystem: %s",
+             PERSISTENT_PROPERTY_DIR, strerror(errno));
+    }
+
+    for (auto const &[temp_path, path] : renames) {
+        if (rename(temp_path.c_str(), path.c_str()) < 0) {
+            LOGE("%s: Failed to rename to %s: %s",
+                 temp_path.c_str(), path.c_str(), strerror(errno));
+            unlink(temp_path.c_str());
+        }
+    }
+
+    // Make the renames durable
+    if (fsync(dir_fd) < 0) {
+        LOGW("%s: Failed to sync directory: %s",
+             PERSISTENT_PROPERTY_DIR, strerror(errno));
+    }
+
+    LOGD("Persisted %zu properties", renames.size());
+}
+
+void PropertyService::queue_persistent_property(const std::string &name,
+                                                std::string_view value)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_persist_lock);
+        m_persist_pending.insert_or_assign(name, std::string(value));
+    }
+    m_persist_cv.notify_one();
+}
+
+/*!
+ * \brief Write persist.* properties to disk in batches
+ *
+ * After a property is queued, more properties are collected for
+ * PERSIST_WRITE_DELAY before anything is written. All of the files in the
+ * batch are synced with a single syncfs() instead of one fsync() per file.
+ */
+void PropertyService::persist_loop()
+{
+    std::unique_lock<std::mutex> lock(m_persist_lock);
+
+    while (true) {
+        m_persist_cv.wait(lock, [&] {
+            return m_persist_stop || !m_persist_pending.empty();
+        });
+
+        if (m_persist_pending.empty()) {
+            // Stopping and there's nothing left to write
+            return;
+        }
+
+        // Coalesce any writes that follow shortly after
+        m_persist_cv.wait_for(lock, PERSIST_WRITE_DELAY, [&] {
+            return m_persist_stop;
+        });
+
+        auto batch = std::move(m_persist_pending);
+        m_persist_pending.clear();
+
+        lock.unlock();
+        write_persistent_properties(batch);
+        lock.lock();
+    }
+}
+
 bool PropertyService::load_properties_file(const std::string &path,
                                            std::string_view filter)
 {
@@ -19,6 +19,10 @@
 
 #include "boot/uevent_thread.h"
 
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
 #include <cerrno>
 #include <cstring>
 
@@ -31,6 +35,9 @@
 
 #define LOG_TAG "mbtool/boot/uevent_thread"
 
+// Maximum number of threads to use for coldboot
+#define MAX_COLDBOOT_THREADS 8
+
 namespace mb
 {
 
@@ -68,11 +75,7 @@ bool UeventThread::start()
     // if it fails
     m_uevent_listener = UeventListener();
 
-    // Regenerate events for devices already detected
-    m_uevent_listener->RegenerateUevents([&](const Uevent &uevent) {
-        m_device_handler.HandleDeviceEvent(uevent);
-        return ListenerAction::kContinue;
-    });
+    coldboot();
 
     m_thread = std::thread(&UeventThread::thread_func, this);
 
@@ -115,6 +118,42 @@ const android::init::DeviceHandler & UeventThread::device_handler() const
     return m_device_handler;
 }
 
+/*!
+ * \brief Regenerate and handle events for devices that were already detected
+ *
+ * Like ueventd's parallel coldboot, the /sys walk and the handling of the
+ * resulting events are both split across multiple threads.
+ */
+void UeventThread::coldboot()
+{
+    unsigned int num_threads = std::clamp<unsigned int>(
+            std::thread::hardware_concurrency(), 1u, MAX_COLDBOOT_THREADS);
+
+    auto uevents = m_uevent_listener->RegenerateUeventsParallel(num_threads);
+
+    std::atomic_size_t next{0};
+
+    auto worker = [&] {
+        for (size_t i; (i = next.fetch_add(1)) < uevents.size();) {
+            m_device_handler.HandleDeviceEvent(uevents[i]);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned int i = 1; i < num_threads; ++i) {
+        threads.emplace_back(worker);
+    }
+
+    worker();
+
+    for (auto &t : threads) {
+        t.join();
+    }
+
+    LOGV("Handled %zu coldboot uevents using %u threads",
+         uevents.size(), num_threads);
+}
+
 void UeventThread::thread_func()
 {
     m_uevent_listener->Poll([&](const Uevent &uevent) {
@@ -37,6 +37,7 @@
 #include "boot/auditd.h"
 #include "boot/daemon.h"
 #include "boot/init.h"
+#include "boot/perf_dump.h"
 #include "boot/properties.h"
 #include "boot/reboot.h"
 #include "boot/uevent_dump.h"
@@ -44,10 +45,16 @@
 #include "util/signature.h"
 #endif
 
+#include "mbcommon/memory_budget.h"
 #include "mbcommon/version.h"
 #include "mbutil/process.h"
 #include "mbutil/string.h"
 
+#include "util/startup_profile.h"
+
+// Directory for temporary files of in-memory operations that exceed the memory
+// budget
+#define MEMORY_SPILL_DIR "/data/local/tmp"
 
 static int mbtool_main(int argc, char *argv[]);
 
@@ -75,6 +82,7 @@ static Tool g_tools[] = {
     { "auditd", mb::auditd_main },
     { "daemon", mb::daemon_main },
     { "init", mb::init_main },
+    { "perf-dump", mb::perf_dump_main },
     { "properties", mb::properties_main },
     { "reboot", mb::reboot_main },
     { "sepolpatch", mb::sepolpatch_main },
@@ -132,6 +140,7 @@ static int main_multicall(int argc, char *argv[])
 
     const Tool *tool = find_tool(name);
     if (tool) {
+        mb::startup_profile_report(tool->name);
         return tool->func(argc, argv);
     } else {
         fprintf(stderr, "%s: tool not found\n", name);
@@ -149,6 +158,7 @@ static int main_normal(int argc, char *argv[])
     char *name = argv[1];
     const Tool *tool = find_tool(name);
     if (tool) {
+        mb::startup_profile_report(tool->name);
         return tool->func(argc - 1, argv + 1);
     } else {
         fprintf(stderr, "%s: tool not found\n", name);
@@ -168,6 +178,8 @@ static int mbtool_main(int argc, char *argv[])
 
 int main(int argc, char *argv[])
 {
+    mb::startup_profile_mark("static-init");
+
     // This works because argv is NULL-terminated
     char **argv_copy = mb::util::dup_cstring_list(argv);
     if (!argv_copy) {
@@ -187,6 +199,20 @@ int main(int argc, char *argv[])
         fprintf(stderr, "Failed to set default locale\n");
     }
 
+    // Bound the memory used for whole images and archives. The limit is only
+    // computed if a tool uses the budget. If that fails (eg. /proc is not
+    // mounted yet during early init), the budget is unlimited. Neither Android
+    // nor recovery have a disk-backed /tmp.
+    auto &budget = mb::MemoryBudget::instance();
+#ifdef RECOVERY
+    budget.set_auto_limit(mb::MemoryContext::Recovery);
+#else
+    budget.set_auto_limit(mb::MemoryContext::System);
+#endif
+    budget.set_spill_dir(MEMORY_SPILL_DIR);
+
+    mb::startup_profile_mark("setup");
+
     int ret;
 
     char *no_multicall = getenv("MBTOOL_NO_MULTICALL");
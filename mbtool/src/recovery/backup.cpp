@@ -20,19 +20,28 @@
 #include "recovery/backup.h"
 
 #include <algorithm>
+#include <atomic>
 #include <cstdlib>
 #include <cstring>
+#include <functional>
 #include <memory>
 #include <string>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 
 #include <dirent.h>
 #include <getopt.h>
 #include <sys/mount.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
 
 #include <archive.h>
 #include <archive_entry.h>
 
+#include "mbcommon/finally.h"
 #include "mbcommon/integer.h"
 #include "mbcommon/string.h"
 #include "mblog/logging.h"
@@ -41,11 +50,18 @@
 #include "mbutil/delete.h"
 #include "mbutil/directory.h"
 #include "mbutil/file.h"
+#include "mbutil/hash.h"
+#include "mbutil/io_scheduler.h"
 #include "mbutil/mount.h"
 #include "mbutil/path.h"
 #include "mbutil/selinux.h"
 #include "mbutil/string.h"
 
+#include "recovery/backup_catalog.h"
+#include "recovery/backup_progress.h"
+#include "recovery/block_backup.h"
+#include "recovery/boot_store.h"
+#include "recovery/chunk_store.h"
 #include "recovery/installer_util.h"
 #include "recovery/image.h"
 #include "util/multiboot.h"
@@ -78,6 +94,19 @@ constexpr char BACKUP_NAME_PREFIX_DATA[]   = "data";
 constexpr char BACKUP_NAME_BOOT_IMAGE[]    = "boot.img";
 constexpr char BACKUP_NAME_CONFIG[]        = "config.json";
 constexpr char BACKUP_NAME_THUMBNAIL[]     = "thumbnail.webp";
+// Per-target statistics of the backup and of the last restore from it
+constexpr char BACKUP_NAME_TIMINGS[]       = "timings.json";
+constexpr char BACKUP_NAME_RESTORE_TIMINGS[] = "restore_timings.json";
+// Index of all files in the backup (see recovery/backup_catalog.cpp)
+constexpr char BACKUP_NAME_CATALOG[]       = "catalog.json";
+
+// Extension of snapshot manifests (backups made with --chunk-store)
+constexpr char SNAPSHOT_EXTENSION[]        = ".manifest";
+// Extension of block-level image backups (backups made with --block-level)
+constexpr char SPARSE_IMAGE_EXTENSION[]    = ".sparse.img";
+// Extension of the SHA512 checksum list written next to each archive. It has
+// the same format as the output of sha512sum.
+constexpr char CHECKSUMS_EXTENSION[]       = ".sha512";
 
 // Max file size for FAT32
 constexpr uint64_t DEFAULT_ARCHIVE_SPLIT_SIZE = UINT32_MAX - 1;
@@ -107,10 +136,9 @@ static struct CompressionMap
 
 static BackupTargets parse_targets_string(const std::string &targets)
 {
-    auto targets_list = split_sv(targets, ",");
     BackupTargets result(0);
 
-    for (auto const &target : targets_list) {
+    for (auto const &target : split_range(targets, ',')) {
         if (target == "all") {
             result |= BackupTarget::All;
         } else if (target == "system") {
@@ -162,6 +190,28 @@ static std::string find_compressed_backup(const std::string &backup_dir,
     std::string unsplit_path;
     std::string split_path;
 
+    unsplit_path = backup_dir;
+    unsplit_path += "/";
+    unsplit_path += name;
+    unsplit_path += SNAPSHOT_EXTENSION;
+
+    if (access(unsplit_path.c_str(), R_OK) == 0) {
+        compression = util::CompressionType::None;
+        is_split = false;
+        return name + SNAPSHOT_EXTENSION;
+    }
+
+    unsplit_path = backup_dir;
+    unsplit_path += "/";
+    unsplit_path += name;
+    unsplit_path += SPARSE_IMAGE_EXTENSION;
+
+    if (access(unsplit_path.c_str(), R_OK) == 0) {
+        compression = util::CompressionType::None;
+        is_split = false;
+        return name + SPARSE_IMAGE_EXTENSION;
+    }
+
     for (auto i = g_compression_map; i->name; ++i) {
         unsplit_path = backup_dir;
         unsplit_path += "/";
@@ -175,7 +225,9 @@ static std::string find_compressed_backup(const std::string &backup_dir,
             compression = i->type;
             is_split = false;
             return name + i->extension;
-        } else if (access(split_path.c_str(), R_OK) == 0) {
+        } else if (access(split_path.c_str(), R_OK) == 0
+                || access(util::libarchive_tar_part_name(
+                        unsplit_path, 0).c_str(), R_OK) == 0) {
             compression = i->type;
             is_split = true;
             return name + i->extension;
@@ -184,12 +236,99 @@ static std::string find_compressed_backup(const std::string &backup_dir,
     return {};
 }
 
+/*!
+ * \brief Find the backup of a partition
+ *
+ * Same as find_compressed_backup(), except that the catalog is used if it has
+ * an entry for the partition so that the backup directory doesn't need to be
+ * probed.
+ *
+ * \param backup_dir Backup directory
+ * \param catalog Catalog of the backup (may be null)
+ * \param name Backup name prefix
+ * \param[out] compression Compression type
+ * \param[out] is_split Whether the archive is split into multiple chunks
+ *
+ * \return Archive name or empty string if the backup is not found
+ */
+static std::string find_backup(const std::string &backup_dir,
+                               const BackupCatalog *catalog,
+                               const std::string &name,
+                               util::CompressionType &compression,
+                               bool &is_split)
+{
+    if (catalog) {
+        if (auto target = catalog->find(name)) {
+            compression = util::CompressionType::None;
+
+            if (target->format != "tar" || parse_compression_type(
+                    target->compression.c_str(), compression)) {
+                is_split = target->split;
+                return target->archive;
+            }
+
+            LOGW("%s: Unknown compression in catalog: %s",
+                 name.c_str(), target->compression.c_str());
+        }
+    }
+
+    return find_compressed_backup(backup_dir, name, compression, is_split);
+}
+
+static bool is_snapshot(const std::string &path)
+{
+    return ends_with(path, SNAPSHOT_EXTENSION);
+}
+
+// Whether a split archive was created by util::libarchive_tar_create_parts()
+static bool has_parts(const std::string &path)
+{
+    return access(util::libarchive_tar_part_name(path, 0).c_str(), F_OK) == 0;
+}
+
+static bool write_checksums(const std::string &path,
+                            const std::vector<util::FileChecksum> &checksums)
+{
+    std::string data;
+
+    for (auto const &checksum : checksums) {
+        data += util::hex_string(checksum.digest.data(),
+                                 checksum.digest.size());
+        data += "  ";
+        data += util::base_name(checksum.path);
+        data += '\n';
+    }
+
+    if (auto r = util::file_write_data(path, data.data(), data.size()); !r) {
+        LOGE("%s: Failed to write checksums: %s",
+             path.c_str(), r.error().message().c_str());
+        return false;
+    }
+
+    return true;
+}
+
 static bool backup_directory(const std::string &output_file,
                              const std::string &directory,
                              const std::vector<std::string> &exclusions,
+                             const std::string &chunk_store,
                              util::CompressionType compression,
-                             uint64_t split_archive_size)
+                             uint64_t split_archive_size,
+                             bool parallel_parts,
+                             TargetProgress *progress)
 {
+    util::CopyProgress *counters = nullptr;
+    if (progress) {
+        progress->total_bytes.store(estimate_tree_size(directory, exclusions),
+                                    std::memory_order_relaxed);
+        counters = &progress->counters;
+    }
+
+    if (!chunk_store.empty()) {
+        return snapshot_create(output_file, chunk_store, directory,
+                               exclusions, counters);
+    }
+
     ScopedDIR dp(opendir(directory.c_str()), closedir);
     if (!dp) {
         LOGE("%s: Failed to open directory: %s",
@@ -217,56 +356,112 @@ static bool backup_directory(const std::string &output_file,
         return false;
     }
 
-    return util::libarchive_tar_create(output_file, directory, contents,
-                                       compression, split_archive_size);
+    // The archive is hashed while it is written
+    std::vector<util::FileChecksum> checksums;
+    bool ret;
+
+    if (parallel_parts) {
+        ret = util::libarchive_tar_create_parts(
+                output_file, directory, contents, compression,
+                split_archive_size,
+                std::max(std::thread::hardware_concurrency(), 1u), counters,
+                &checksums);
+    } else {
+        ret = util::libarchive_tar_create(output_file, directory, contents,
+                                          compression, split_archive_size,
+                                          counters, &checksums);
+    }
+
+    return ret && write_checksums(output_file + CHECKSUMS_EXTENSION, checksums);
 }
 
 static bool restore_directory(const std::string &input_file,
                               const std::string &directory,
                               const std::vector<std::string> &exclusions,
+                              const std::string &chunk_store,
                               util::CompressionType compression,
-                              bool is_split)
+                              bool is_split,
+                              bool delta,
+                              util::CopyProgress *progress)
 {
+    if (delta) {
+        // Only write what changed and then remove what isn't in the backup
+        std::vector<std::string> entries;
+        bool ret;
+
+        if (is_snapshot(input_file)) {
+            ret = snapshot_restore(input_file, chunk_store, directory,
+                                   SnapshotRestoreFlag::SkipUnchanged,
+                                   &entries, progress);
+        } else if (is_split && has_parts(input_file)) {
+            ret = util::libarchive_tar_extract_parts(
+                    input_file, directory, {}, compression,
+                    std::max(std::thread::hardware_concurrency(), 1u),
+                    util::TarExtractFlag::SkipUnchanged, &entries, progress);
+        } else {
+            ret = util::libarchive_tar_extract(
+                    input_file, directory, {}, compression, is_split,
+                    util::TarExtractFlag::SkipUnchanged, &entries, progress);
+        }
+
+        return ret && prune_directory(directory, exclusions, entries);
+    }
+
     if (!wipe_directory(directory, exclusions)) {
         return false;
     }
 
+    if (is_snapshot(input_file)) {
+        return snapshot_restore(input_file, chunk_store, directory, {},
+                                nullptr, progress);
+    } else if (is_split && has_parts(input_file)) {
+        return util::libarchive_tar_extract_parts(
+                input_file, directory, {}, compression,
+                std::max(std::thread::hardware_concurrency(), 1u), {}, nullptr,
+                progress);
+    }
+
     return util::libarchive_tar_extract(input_file, directory, {}, compression,
-                                        is_split);
+                                        is_split, {}, nullptr, progress);
 }
 
 static bool backup_image(const std::string &output_file,
                          const std::string &image,
+                         const std::string &mount_point,
                          const std::vector<std::string> &exclusions,
+                         const std::string &chunk_store,
                          util::CompressionType compression,
-                         uint64_t split_archive_size)
+                         uint64_t split_archive_size,
+                         bool parallel_parts,
+                         TargetProgress *progress)
 {
-    if (auto r = util::mkdir_recursive(BACKUP_MNT_DIR, 0755);
+    if (auto r = util::mkdir_recursive(mount_point, 0755);
             !r && r.error() != std::errc::file_exists) {
         LOGE("%s: Failed to create directory: %s",
-             BACKUP_MNT_DIR, strerror(errno));
+             mount_point.c_str(), strerror(errno));
         return false;
     }
 
     fsck_ext4_image(image);
 
     if (auto ret = util::mount(
-            image, BACKUP_MNT_DIR, "ext4", MS_RDONLY, ""); !ret) {
-        LOGE("Failed to mount %s at %s: %s", image.c_str(), BACKUP_MNT_DIR,
-             ret.error().message().c_str());
+            image, mount_point, "ext4", MS_RDONLY, ""); !ret) {
+        LOGE("Failed to mount %s at %s: %s", image.c_str(),
+             mount_point.c_str(), ret.error().message().c_str());
         return false;
     }
 
-    bool ret = backup_directory(output_file, BACKUP_MNT_DIR, exclusions,
-                                compression, split_archive_size);
+    bool ret = backup_directory(output_file, mount_point, exclusions,
+                                chunk_store, compression, split_archive_size,
+                                parallel_parts, progress);
 
-    if (auto umount_ret = util::umount(BACKUP_MNT_DIR); !umount_ret) {
-        LOGE("Failed to unmount %s: %s", BACKUP_MNT_DIR,
+    if (auto umount_ret = util::umount(mount_point); !umount_ret) {
+        LOGE("Failed to unmount %s: %s", mount_point.c_str(),
              umount_ret.error().message().c_str());
         return false;
     }
 
-    rmdir(BACKUP_MNT_DIR);
+    rmdir(mount_point.c_str());
 
     return ret;
 }
@@ -275,8 +470,11 @@ static bool restore_image(const std::string &input_file,
                           const std::string &image,
                           uint64_t size,
                           const std::vector<std::string> &exclusions,
+                          const std::string &chunk_store,
                           util::CompressionType compression,
-                          bool is_split)
+                          bool is_split,
+                          bool delta,
+                          util::CopyProgress *progress)
 {
     if (auto r = util::mkdir_parent(image, S_IRWXU); !r) {
         LOGE("%s: Failed to create parent directory: %s",
@@ -313,7 +511,8 @@ static bool restore_image(const std::string &input_file,
     }
 
     bool ret = restore_directory(input_file, BACKUP_MNT_DIR, exclusions,
-                                 compression, is_split);
+                                 chunk_store, compression, is_split, delta,
+                                 progress);
 
     if (auto umount_ret = util::umount(BACKUP_MNT_DIR); !umount_ret) {
         LOGE("Failed to unmount %s: %s", BACKUP_MNT_DIR,
@@ -329,15 +528,21 @@ static bool restore_image(const std::string &input_file,
 /*!
  * \brief Backup boot image of a ROM
  *
+ * If a chunk store is used, the boot image entries are added to the store and
+ * only a manifest is written to the backup directory. Boot images of different
+ * ROMs usually share the same kernel, so it is only stored once.
+ *
  * \param rom ROM
  * \param backup_dir Backup directory
+ * \param chunk_store Chunk store or empty to copy the boot image as is
  *
  * \return Result::Succeeded if the boot image was successfully backed up
  *         Result::Failed if an error occured
  *         Result::FilesMissing if the boot image doesn't exist
  */
 static Result backup_boot_image(const std::shared_ptr<Rom> &rom,
-                                const std::string &backup_dir)
+                                const std::string &backup_dir,
+                                const std::string &chunk_store)
 {
     std::string boot_image_path(rom->boot_image_path());
     std::string boot_image_backup(backup_dir);
@@ -347,7 +552,13 @@ static Result backup_boot_image(const std::shared_ptr<Rom> &rom,
     struct stat sb;
     if (stat(boot_image_path.c_str(), &sb) == 0) {
         LOGI("=== Backing up %s ===", boot_image_path.c_str());
-        if (auto r = util::copy_file(
+        if (!chunk_store.empty()) {
+            if (!boot_store_save(boot_image_path,
+                                 boot_image_backup + SNAPSHOT_EXTENSION,
+                                 chunk_store)) {
+                return Result::Failed;
+            }
+        } else if (auto r = util::copy_file(
                 boot_image_path, boot_image_backup, 0); !r) {
             LOGE("%s", r.error().message().c_str());
             return Result::Failed;
@@ -365,32 +576,59 @@ static Result backup_boot_image(const std::shared_ptr<Rom> &rom,
  *
  * \param rom ROM
  * \param backup_dir Backup directory
+ * \param chunk_store Chunk store to use instead of the one recorded in a
+ *                    boot image manifest (may be empty)
  *
  * \return Result::Succeeded if the boot image was successfully restored
  *         Result::Failed if an error occured
  *         Result::FilesMissing if the boot image backup doesn't exist
  */
 static Result restore_boot_image(const std::shared_ptr<Rom> &rom,
-                                 const std::string &backup_dir)
+                                 const std::string &backup_dir,
+                                 const std::string &chunk_store)
 {
     std::string boot_image_path(rom->boot_image_path());
     std::string boot_image_backup(backup_dir);
     boot_image_backup += '/';
     boot_image_backup += BACKUP_NAME_BOOT_IMAGE;
+    std::string boot_image_manifest(boot_image_backup);
+    boot_image_manifest += SNAPSHOT_EXTENSION;
+    std::string boot_image_temp;
+
+    auto delete_temp = finally([&] {
+        if (!boot_image_temp.empty()) {
+            unlink(boot_image_temp.c_str());
+        }
+    });
 
     struct stat sb;
     if (stat(boot_image_backup.c_str(), &sb) < 0) {
-        LOGW("=== %s does not exist ===", boot_image_backup.c_str());
-        return Result::FilesMissing;
+        if (stat(boot_image_manifest.c_str(), &sb) < 0) {
+            LOGW("=== %s does not exist ===", boot_image_backup.c_str());
+            return Result::FilesMissing;
+        }
+
+        LOGI("=== Rebuilding boot image from %s ===",
+             boot_image_manifest.c_str());
+
+        boot_image_temp = boot_image_path;
+        boot_image_temp += ".orig";
+
+        if (!boot_store_restore(boot_image_manifest, chunk_store,
+                                boot_image_temp)) {
+            return Result::Failed;
+        }
+
+        boot_image_backup = boot_image_temp;
     }
 
     LOGI("=== Restoring to %s ===", boot_image_path.c_str());
 
-    std::vector<std::function<RamdiskPatcherFn>> rps;
-    rps.push_back(rp_write_rom_id(rom->id));
+    RamdiskEdits edits;
+    edits.files.push_back(rf_rom_id(rom->id));
 
-    if (!InstallerUtil::patch_boot_image(
-            boot_image_backup, boot_image_path, rps)) {
+    if (!InstallerUtil::edit_boot_image(
+            boot_image_backup, boot_image_path, edits)) {
         LOGE("Failed to patch boot image");
         return Result::Failed;
     }
@@ -508,9 +746,17 @@ static Result restore_configs(const std::shared_ptr<Rom> &rom,
  * \param backup_dir Backup directory
  * \param archive_name Backup archive name
  * \param is_image Whether \a path is an ext4 image
+ * \param mount_point Where to mount \a path if it is an image
+ * \param block_level Whether to copy the allocated blocks of the image instead
+ *                    of its files (ignored if \a path is not an image)
  * \param exclusions List of top-level directories to exclude from the backup
+ * \param chunk_store Chunk store for an incremental snapshot or empty to
+ *                    create an archive
  * \param compression Compression type
  * \param split_archive_size Max size for each split file
+ * \param parallel_parts Whether to split the archive into independent parts
+ *                       that are written in parallel
+ * \param progress Progress of the target (may be null)
  *
  * \return Result::Succeeded if the directory/image was successfully backed up
  *         Result::Failed if an error occured
@@ -520,9 +766,14 @@ static Result backup_partition(const std::string &path,
                                const std::string &backup_dir,
                                const std::string &archive_name,
                                bool is_image,
+                               const std::string &mount_point,
+                               bool block_level,
                                const std::vector<std::string> &exclusions,
+                               const std::string &chunk_store,
                                util::CompressionType compression,
-                               uint64_t split_archive_size)
+                               uint64_t split_archive_size,
+                               bool parallel_parts,
+                               TargetProgress *progress)
 {
     std::string archive(backup_dir);
     archive += '/';
@@ -533,12 +784,38 @@ static Result backup_partition(const std::string &path,
     struct stat sb;
     if (stat(path.c_str(), &sb) == 0) {
         LOGI("=== Backing up %s ===", path.c_str());
-        if (is_image) {
-            ret = backup_image(archive, path, exclusions, compression,
-                               split_archive_size);
+        if (progress) {
+            progress->begin();
+        }
+
+        if (is_image && block_level) {
+            util::CopyProgress *counters = nullptr;
+            if (progress) {
+                // Only the allocated blocks are copied, which the image's
+                // allocated size approximates
+                progress->total_bytes.store(std::min<uint64_t>(
+                        static_cast<uint64_t>(sb.st_blocks) * 512,
+                        static_cast<uint64_t>(sb.st_size)),
+                        std::memory_order_relaxed);
+                counters = &progress->counters;
+            }
+
+            // Unlike mounting, reading the bitmaps directly doesn't replay
+            // the journal
+            fsck_ext4_image(path);
+            ret = backup_ext4_image_blocks(path, archive, counters);
+        } else if (is_image) {
+            ret = backup_image(archive, path, mount_point, exclusions,
+                               chunk_store, compression, split_archive_size,
+                               parallel_parts, progress);
         } else {
-            ret = backup_directory(archive, path, exclusions, compression,
-                                   split_archive_size);
+            ret = backup_directory(archive, path, exclusions, chunk_store,
+                                   compression, split_archive_size,
+                                   parallel_parts, progress);
+        }
+
+        if (progress) {
+            progress->end(ret);
         }
     } else {
         LOGW("=== %s does not exist ===", path.c_str());
@@ -557,8 +834,13 @@ static Result backup_partition(const std::string &path,
  * \param is_image Whether \a path is an ext4 image
  * \param exclusions List of top-level directories to exclude from the wipe
  *                   process before restoring
+ * \param chunk_store Chunk store to use instead of the one recorded in a
+ *                    snapshot manifest (may be empty)
  * \param compression Compression type
  * \param is_split Whether the archive is split into multiple chunks
+ * \param delta Whether to only replace the files that differ from the backup
+ *              instead of wiping the target first
+ * \param progress Progress of the target (may be null)
  *
  * \return Result::Succeeded if the directory/image was successfully restored
  *         Result::Failed if an error occured
@@ -571,8 +853,11 @@ static Result restore_partition(const std::string &path,
                                 bool is_image,
                                 uint64_t image_size,
                                 const std::vector<std::string> &exclusions,
+                                const std::string &chunk_store,
                                 util::CompressionType compression,
-                                bool is_split)
+                                bool is_split,
+                                bool delta,
+                                TargetProgress *progress)
 {
     std::string archive(backup_dir);
     archive += '/';
@@ -584,14 +869,40 @@ static Result restore_partition(const std::string &path,
     bool ret = false;
 
     struct stat sb;
-    if (stat(is_split ? split_archive.c_str() : archive.c_str(), &sb) == 0) {
+    if (stat(is_split ? split_archive.c_str() : archive.c_str(), &sb) == 0
+            || (is_split && has_parts(archive))) {
+        // Wait for other bulk operations on the target disk (eg. a concurrent
+        // wipe) and run at a lower I/O priority than interactive requests
+        auto ticket = util::IoScheduler::instance().acquire_bulk(path);
+
         LOGI("=== Restoring to %s ===", path.c_str());
-        if (is_image) {
+        if (progress) {
+            progress->begin();
+        }
+
+        auto *counters = progress ? &progress->counters : nullptr;
+
+        if (ends_with(archive_name, SPARSE_IMAGE_EXTENSION)) {
+            if (!is_image) {
+                LOGE("%s: Block-level backups can only be restored to images",
+                     path.c_str());
+            } else if (auto r = util::mkdir_parent(path, S_IRWXU); !r) {
+                LOGE("%s: Failed to create parent directory: %s",
+                     path.c_str(), r.error().message().c_str());
+            } else {
+                ret = restore_ext4_image_blocks(archive, path, counters);
+            }
+        } else if (is_image) {
             ret = restore_image(archive, path, image_size, exclusions,
-                                compression, is_split);
+                                chunk_store, compression, is_split, delta,
+                                counters);
         } else {
-            ret = restore_directory(archive, path, exclusions, compression,
-                                    is_split);
+            ret = restore_directory(archive, path, exclusions, chunk_store,
+                                    compression, is_split, delta, counters);
+        }
+
+        if (progress) {
+            progress->end(ret);
         }
     } else {
         LOGW("=== %s does not exist ===", archive.c_str());
@@ -601,10 +912,233 @@ static Result restore_partition(const std::string &path,
     return ret ? Result::Succeeded : Result::Failed;
 }
 
+struct BackupJob
+{
+    std::string path;
+    std::string archive_name;
+    bool is_image;
+    std::string mount_point;
+    bool block_level;
+    std::vector<std::string> exclusions;
+    // Disk that the data is read from (see util::io_backing_device())
+    dev_t dev;
+    // In shared memory, so it can be updated from the job's process
+    TargetProgress *progress;
+
+    pid_t pid;
+    bool finished;
+    Result result;
+};
+
+static Result run_backup_job(const BackupJob &job,
+                             const std::string &output_dir,
+                             const std::string &chunk_store,
+                             util::CompressionType compression,
+                             uint64_t split_archive_size,
+                             bool parallel_parts)
+{
+    // Runs at a lower I/O priority than interactive requests
+    auto ticket = util::IoScheduler::instance().acquire_bulk(job.path);
+
+    return backup_partition(job.path, output_dir, job.archive_name,
+                            job.is_image, job.mount_point, job.block_level,
+                            job.exclusions, chunk_store, compression,
+                            split_archive_size, parallel_parts, job.progress);
+}
+
+/*!
+ * \brief Back up partitions, running up to \a max_jobs of them concurrently
+ *
+ * Each job runs in its own process, so it gets its own libarchive reader,
+ * writer, and compression threads (libarchive's disk reader may change the
+ * working directory, which is shared by all threads of a process). Targets on
+ * different partitions of the same disk share its I/O bandwidth, so at most
+ * util::io_device_concurrency() jobs read from the same disk at a time. The
+ * jobs run at a lower I/O priority so that they don't delay the daemon's
+ * interactive requests.
+ *
+ * If a job fails, no new jobs are started, but the running ones are allowed
+ * to finish.
+ *
+ * \return Whether all jobs completed without failing
+ */
+static bool run_backup_jobs(std::vector<BackupJob> &jobs,
+                            const std::string &output_dir,
+                            const std::string &chunk_store,
+                            util::CompressionType compression,
+                            uint64_t split_archive_size,
+                            bool parallel_parts,
+                            unsigned int max_jobs)
+{
+    if (max_jobs <= 1) {
+        for (auto &job : jobs) {
+            if (run_backup_job(job, output_dir, chunk_store, compression,
+                               split_archive_size, parallel_parts)
+                    == Result::Failed) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    std::unordered_map<dev_t, unsigned int> device_jobs;
+    std::unordered_map<dev_t, unsigned int> device_limits;
+
+    for (auto const &job : jobs) {
+        if (device_limits.find(job.dev) == device_limits.end()) {
+            device_limits[job.dev] = util::io_device_concurrency(job.dev);
+        }
+    }
+
+    unsigned int running = 0;
+    bool failed = false;
+
+    while (true) {
+        for (auto &job : jobs) {
+            if (failed || running >= max_jobs) {
+                break;
+            } else if (job.pid >= 0 || job.finished
+                    || device_jobs[job.dev] >= device_limits[job.dev]) {
+                continue;
+            }
+
+            pid_t pid = fork();
+            if (pid == 0) {
+                _exit(static_cast<int>(run_backup_job(
+                        job, output_dir, chunk_store, compression,
+                        split_archive_size, parallel_parts)));
+            } else if (pid < 0) {
+                LOGE("Failed to fork: %s", strerror(errno));
+                failed = true;
+                break;
+            }
+
+            job.pid = pid;
+            ++running;
+            ++device_jobs[job.dev];
+        }
+
+        if (running == 0) {
+            break;
+        }
+
+        int status;
+        pid_t pid = waitpid(-1, &status, 0);
+        if (pid < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            LOGE("Failed to wait for backup jobs: %s", strerror(errno));
+            return false;
+        }
+
+        auto it = std::find_if(jobs.begin(), jobs.end(),
+                               [&](const BackupJob &job) {
+            return job.pid == pid;
+        });
+        if (it == jobs.end()) {
+            continue;
+        }
+
+        it->pid = -1;
+        it->finished = true;
+        it->result = WIFEXITED(status)
+                ? static_cast<Result>(WEXITSTATUS(status))
+                : Result::Failed;
+
+        --running;
+        --device_jobs[it->dev];
+
+        if (it->result == Result::Failed) {
+            LOGE("=== Failed to back up %s ===", it->path.c_str());
+            failed = true;
+        }
+    }
+
+    return !failed;
+}
+
+/*!
+ * \brief Write the catalog of a finished backup
+ *
+ * \param rom_id ROM ID
+ * \param output_dir Backup directory
+ * \param jobs Partition backup jobs
+ * \param compression Compression type of the tar archives
+ *
+ * \return Whether the catalog was successfully written
+ */
+static bool write_catalog(const std::string &rom_id,
+                          const std::string &output_dir,
+                          const std::vector<BackupJob> &jobs,
+                          util::CompressionType compression)
+{
+    BackupCatalog catalog{};
+    catalog.rom_id = rom_id;
+    catalog.timestamp = time(nullptr);
+
+    auto add_target = [&](const char *name, std::string archive,
+                          const char *format, const char *compression_name,
+                          const std::string &checksums_name) {
+        BackupCatalogTarget target{};
+        target.name = name;
+        target.archive = std::move(archive);
+        target.format = format;
+        target.compression = compression_name;
+
+        if (backup_catalog_add_files(target, output_dir, checksums_name)) {
+            catalog.targets.push_back(std::move(target));
+        }
+    };
+
+    const char *compression_name = "";
+    for (auto i = g_compression_map; i->name; ++i) {
+        if (compression == i->type) {
+            compression_name = i->name;
+            break;
+        }
+    }
+
+    for (auto const &job : jobs) {
+        if (is_snapshot(job.archive_name)) {
+            add_target(job.progress->name, job.archive_name, "snapshot", "",
+                       {});
+        } else if (ends_with(job.archive_name, SPARSE_IMAGE_EXTENSION)) {
+            add_target(job.progress->name, job.archive_name, "sparse", "", {});
+        } else {
+            add_target(job.progress->name, job.archive_name, "tar",
+                       compression_name,
+                       job.archive_name + CHECKSUMS_EXTENSION);
+        }
+    }
+
+    struct stat sb;
+    std::string boot_name(BACKUP_NAME_BOOT_IMAGE);
+
+    if (stat((output_dir + "/" + boot_name + SNAPSHOT_EXTENSION).c_str(),
+             &sb) == 0) {
+        add_target("boot", boot_name + SNAPSHOT_EXTENSION, "snapshot", "", {});
+    } else if (stat((output_dir + "/" + boot_name).c_str(), &sb) == 0) {
+        add_target("boot", boot_name, "file", "", {});
+    }
+
+    if (stat((output_dir + "/" + BACKUP_NAME_CONFIG).c_str(), &sb) == 0) {
+        add_target("config", BACKUP_NAME_CONFIG, "file", "", {});
+    }
+    if (stat((output_dir + "/" + BACKUP_NAME_THUMBNAIL).c_str(), &sb) == 0) {
+        add_target("thumbnail", BACKUP_NAME_THUMBNAIL, "file", "", {});
+    }
+
+    return backup_catalog_write(output_dir + "/" + BACKUP_NAME_CATALOG,
+                                catalog);
+}
+
 static bool backup_rom(const std::shared_ptr<Rom> &rom,
                        const std::string &output_dir, BackupTargets targets,
+                       const std::string &chunk_store, bool block_level,
                        util::CompressionType compression,
-                       uint64_t split_archive_size)
+                       uint64_t split_archive_size, bool parallel_parts,
+                       unsigned int max_jobs)
 {
     if (!targets) {
         LOGE("No backup targets specified");
@@ -638,17 +1172,45 @@ static bool backup_rom(const std::shared_ptr<Rom> &rom,
         LOGI("             %s", thumbnail_path.c_str());
     }
     LOGI("- Backup directory: %s", output_dir.c_str());
+    if (!chunk_store.empty()) {
+        LOGI("- Chunk store: %s", chunk_store.c_str());
+    }
+    if (block_level) {
+        LOGI("- Block-level image backups");
+    }
 
-    std::string output_system = get_compressed_backup_name(
-            BACKUP_NAME_PREFIX_SYSTEM, compression);
-    std::string output_cache = get_compressed_backup_name(
-            BACKUP_NAME_PREFIX_CACHE, compression);
-    std::string output_data = get_compressed_backup_name(
-            BACKUP_NAME_PREFIX_DATA, compression);
+    std::string output_system;
+    std::string output_cache;
+    std::string output_data;
+
+    if (chunk_store.empty()) {
+        output_system = get_compressed_backup_name(
+                BACKUP_NAME_PREFIX_SYSTEM, compression);
+        output_cache = get_compressed_backup_name(
+                BACKUP_NAME_PREFIX_CACHE, compression);
+        output_data = get_compressed_backup_name(
+                BACKUP_NAME_PREFIX_DATA, compression);
+    } else {
+        output_system = std::string(BACKUP_NAME_PREFIX_SYSTEM)
+                + SNAPSHOT_EXTENSION;
+        output_cache = std::string(BACKUP_NAME_PREFIX_CACHE)
+                + SNAPSHOT_EXTENSION;
+        output_data = std::string(BACKUP_NAME_PREFIX_DATA)
+                + SNAPSHOT_EXTENSION;
+    }
+
+    // Don't leave behind a catalog from a previous backup to this directory
+    std::string catalog_path(output_dir + "/" + BACKUP_NAME_CATALOG);
+    if (unlink(catalog_path.c_str()) < 0 && errno != ENOENT) {
+        LOGE("%s: Failed to remove old catalog: %s",
+             catalog_path.c_str(), strerror(errno));
+        return false;
+    }
 
     // Backup boot image
     if (targets & BackupTarget::Boot
-            && backup_boot_image(rom, output_dir) == Result::Failed) {
+            && backup_boot_image(rom, output_dir, chunk_store)
+                    == Result::Failed) {
         return false;
     }
 
@@ -658,44 +1220,73 @@ static bool backup_rom(const std::shared_ptr<Rom> &rom,
         return false;
     }
 
+    std::vector<BackupJob> jobs;
+    ProgressReporter reporter(3);
+
+    auto add_job = [&](const std::string &path, const std::string &archive,
+                       bool is_image, const char *prefix,
+                       std::vector<std::string> exclusions) {
+        BackupJob job{};
+        job.path = path;
+        job.archive_name = archive;
+        job.is_image = is_image;
+        job.block_level = is_image && block_level;
+        if (job.block_level) {
+            job.archive_name = prefix;
+            job.archive_name += SPARSE_IMAGE_EXTENSION;
+        }
+        job.mount_point = BACKUP_MNT_DIR;
+        job.mount_point += '_';
+        job.mount_point += prefix;
+        job.exclusions = std::move(exclusions);
+        auto disk = util::io_backing_device(path);
+        job.dev = disk ? disk.value() : 0;
+        job.progress = reporter.add_target(prefix);
+        job.pid = -1;
+        job.finished = false;
+        job.result = Result::Failed;
+        jobs.push_back(std::move(job));
+    };
+
     // Backup system
     if (targets & BackupTarget::System) {
-        Result ret = backup_partition(
-                system_path, output_dir, output_system,
-                rom->system_is_image, { "multiboot" }, compression,
-                split_archive_size);
-        if (ret == Result::Failed) {
-            return false;
-        }
+        add_job(system_path, output_system, rom->system_is_image,
+                BACKUP_NAME_PREFIX_SYSTEM, { "multiboot" });
     }
 
     // Backup cache
     if (targets & BackupTarget::Cache) {
-        Result ret = backup_partition(
-                cache_path, output_dir, output_cache,
-                rom->cache_is_image, { "multiboot" }, compression,
-                split_archive_size);
-        if (ret == Result::Failed) {
-            return false;
-        }
+        add_job(cache_path, output_cache, rom->cache_is_image,
+                BACKUP_NAME_PREFIX_CACHE, { "multiboot" });
     }
 
     // Backup data
     if (targets & BackupTarget::Data) {
-        Result ret = backup_partition(
-                data_path, output_dir, output_data,
-                rom->data_is_image, { "media", "multiboot" }, compression,
-                split_archive_size);
-        if (ret == Result::Failed) {
-            return false;
-        }
+        add_job(data_path, output_data, rom->data_is_image,
+                BACKUP_NAME_PREFIX_DATA, { "media", "multiboot" });
     }
 
-    return true;
+    reporter.start();
+    bool ret = run_backup_jobs(jobs, output_dir, chunk_store, compression,
+                               split_archive_size, parallel_parts, max_jobs);
+    reporter.stop();
+
+    if (!jobs.empty()) {
+        reporter.write_timings(output_dir + "/" + BACKUP_NAME_TIMINGS);
+    }
+
+    // Only complete backups get a catalog. Restoring from an incomplete one
+    // probes the directory as before.
+    if (ret) {
+        write_catalog(rom->id, output_dir, jobs, compression);
+    }
+
+    return ret;
 }
 
 static bool restore_rom(const std::shared_ptr<Rom> &rom,
-                        const std::string &input_dir, BackupTargets targets)
+                        const std::string &input_dir, BackupTargets targets,
+                        const std::string &chunk_store, bool delta)
 {
     if (!targets) {
         LOGE("No restore targets specified");
@@ -741,7 +1332,8 @@ static bool restore_rom(const std::shared_ptr<Rom> &rom,
 
     // Restore boot image
     if (targets & BackupTarget::Boot
-            && restore_boot_image(rom, input_dir) == Result::Failed) {
+            && restore_boot_image(rom, input_dir, chunk_store)
+                    == Result::Failed) {
         return false;
     }
 
@@ -753,6 +1345,31 @@ static bool restore_rom(const std::shared_ptr<Rom> &rom,
 
     fix_multiboot_permissions();
 
+    // Locate the archives with the catalog if the backup has one
+    BackupCatalog catalog;
+    const BackupCatalog *catalog_ptr = backup_catalog_read(
+            input_dir + "/" + BACKUP_NAME_CATALOG, catalog) ? &catalog : nullptr;
+
+    // The byte counts recorded when the backup was made are the totals
+    const std::string timings_path(input_dir + "/" + BACKUP_NAME_TIMINGS);
+    ProgressReporter reporter(3);
+
+    auto add_target = [&](const char *prefix) {
+        return reporter.add_target(
+                prefix, read_target_timing_bytes(timings_path, prefix));
+    };
+
+    reporter.start();
+
+    auto stop_reporter = finally([&] {
+        reporter.stop();
+        if (targets & (BackupTarget::System | BackupTarget::Cache
+                | BackupTarget::Data)) {
+            reporter.write_timings(
+                    input_dir + "/" + BACKUP_NAME_RESTORE_TIMINGS);
+        }
+    });
+
     // Restore system
     if (targets & BackupTarget::System) {
         auto image_size = util::mount_get_total_size(
@@ -765,8 +1382,9 @@ static bool restore_rom(const std::shared_ptr<Rom> &rom,
         util::CompressionType compression;
         bool is_split;
 
-        std::string path = find_compressed_backup(
-                input_dir, BACKUP_NAME_PREFIX_SYSTEM, compression, is_split);
+        std::string path = find_backup(
+                input_dir, catalog_ptr, BACKUP_NAME_PREFIX_SYSTEM, compression,
+                is_split);
         if (path.empty()) {
             LOGE("Backup of /system not found");
             return false;
@@ -774,7 +1392,8 @@ static bool restore_rom(const std::shared_ptr<Rom> &rom,
 
         Result ret = restore_partition(
                 system_path, input_dir, path, rom->system_is_image,
-                image_size.value(), {}, compression, is_split);
+                image_size.value(), {}, chunk_store, compression, is_split,
+                delta, add_target(BACKUP_NAME_PREFIX_SYSTEM));
         if (ret == Result::Failed) {
             return false;
         }
@@ -785,8 +1404,9 @@ static bool restore_rom(const std::shared_ptr<Rom> &rom,
         util::CompressionType compression;
         bool is_split;
 
-        std::string path = find_compressed_backup(
-                input_dir, BACKUP_NAME_PREFIX_CACHE, compression, is_split);
+        std::string path = find_backup(
+                input_dir, catalog_ptr, BACKUP_NAME_PREFIX_CACHE, compression,
+                is_split);
         if (path.empty()) {
             LOGE("Backup of /cache not found");
             return false;
@@ -794,7 +1414,8 @@ static bool restore_rom(const std::shared_ptr<Rom> &rom,
 
         Result ret = restore_partition(
                 cache_path, input_dir, path, rom->cache_is_image,
-                DEFAULT_IMAGE_SIZE, {}, compression, is_split);
+                DEFAULT_IMAGE_SIZE, {}, chunk_store, compression, is_split,
+                delta, add_target(BACKUP_NAME_PREFIX_CACHE));
         if (ret == Result::Failed) {
             return false;
         }
@@ -805,8 +1426,9 @@ static bool restore_rom(const std::shared_ptr<Rom> &rom,
         util::CompressionType compression;
         bool is_split;
 
-        std::string path = find_compressed_backup(
-                input_dir, BACKUP_NAME_PREFIX_DATA, compression, is_split);
+        std::string path = find_backup(
+                input_dir, catalog_ptr, BACKUP_NAME_PREFIX_DATA, compression,
+                is_split);
         if (path.empty()) {
             LOGE("Backup of /data not found");
             return false;
@@ -814,7 +1436,8 @@ static bool restore_rom(const std::shared_ptr<Rom> &rom,
 
         Result ret = restore_partition(
                 data_path, input_dir, path, rom->data_is_image,
-                DEFAULT_IMAGE_SIZE, { "media" }, compression, is_split);
+                DEFAULT_IMAGE_SIZE, { "media" }, chunk_store, compression,
+                is_split, delta, add_target(BACKUP_NAME_PREFIX_DATA));
         if (ret == Result::Failed) {
             return false;
         }
@@ -823,6 +1446,178 @@ static bool restore_rom(const std::shared_ptr<Rom> &rom,
     return true;
 }
 
+// Queue a task for each file listed in the checksum file of an archive
+static bool add_checksum_tasks(const std::string &archive_path,
+                               std::vector<std::function<bool()>> &tasks)
+{
+    std::string checksums_path(archive_path + CHECKSUMS_EXTENSION);
+    std::string dir(util::dir_name(archive_path));
+
+    auto contents = util::file_read_all(checksums_path);
+    if (!contents) {
+        LOGE("%s: Failed to read checksums: %s", checksums_path.c_str(),
+             contents.error().message().c_str());
+        return false;
+    }
+
+    for (auto const &line : split_range(contents.value(), '\n')) {
+        if (line.empty()) {
+            continue;
+        }
+
+        // <hex digest>  <file name>
+        constexpr size_t hex_size = std::tuple_size_v<util::Sha512Digest> * 2;
+
+        if (line.size() <= hex_size + 2
+                || line.substr(hex_size, 2) != "  "
+                || line.find('/') != std::string_view::npos) {
+            LOGE("%s: Invalid line: %s", checksums_path.c_str(),
+                 std::string(line).c_str());
+            return false;
+        }
+
+        std::string expected(line.substr(0, hex_size));
+        std::string path(dir);
+        path += '/';
+        path += line.substr(hex_size + 2);
+
+        tasks.push_back([expected = std::move(expected),
+                         path = std::move(path)] {
+            auto digest = util::sha512_hash(path);
+            if (!digest) {
+                LOGE("%s: Failed to hash: %s",
+                     path.c_str(), digest.error().message().c_str());
+                return false;
+            }
+
+            if (util::hex_string(digest.value().data(), digest.value().size())
+                    != expected) {
+                LOGE("%s: Checksum mismatch", path.c_str());
+                return false;
+            }
+
+            LOGV("%s: OK", path.c_str());
+            return true;
+        });
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Check the integrity of the partition backups in a backup directory
+ *
+ * Archives are checked against the checksums recorded while they were written,
+ * snapshots against their manifest digest and chunk IDs, and block-level
+ * backups against their CRC32 checksums. The files are checked concurrently on
+ * up to one thread per CPU.
+ *
+ * \param backup_dir Backup directory
+ * \param targets Targets to check. Targets that were not backed up are skipped.
+ * \param chunk_store Chunk store to use instead of the one recorded in a
+ *                    snapshot manifest (may be empty)
+ *
+ * \return Whether all of the backups were found to be intact
+ */
+static bool verify_backup(const std::string &backup_dir, BackupTargets targets,
+                          const std::string &chunk_store)
+{
+    static constexpr std::pair<BackupTarget, const char *> partitions[] = {
+        { BackupTarget::System, BACKUP_NAME_PREFIX_SYSTEM },
+        { BackupTarget::Cache,  BACKUP_NAME_PREFIX_CACHE },
+        { BackupTarget::Data,   BACKUP_NAME_PREFIX_DATA },
+    };
+
+    std::vector<std::function<bool()>> tasks;
+
+    BackupCatalog catalog;
+    const BackupCatalog *catalog_ptr = backup_catalog_read(
+            backup_dir + "/" + BACKUP_NAME_CATALOG, catalog) ? &catalog : nullptr;
+
+    for (auto const &[target, prefix] : partitions) {
+        if (!(targets & target)) {
+            continue;
+        }
+
+        util::CompressionType compression;
+        bool is_split;
+
+        std::string name = find_backup(
+                backup_dir, catalog_ptr, prefix, compression, is_split);
+        if (name.empty()) {
+            LOGW("Backup of /%s not found", prefix);
+            continue;
+        }
+
+        std::string path(backup_dir);
+        path += '/';
+        path += name;
+
+        LOGI("Verifying %s", path.c_str());
+
+        if (is_snapshot(name)) {
+            tasks.push_back([path, &chunk_store] {
+                return snapshot_verify(path, chunk_store);
+            });
+        } else if (ends_with(name, SPARSE_IMAGE_EXTENSION)) {
+            tasks.push_back([path] {
+                return verify_ext4_image_blocks(path);
+            });
+        } else if (!add_checksum_tasks(path, tasks)) {
+            return false;
+        }
+    }
+
+    if (targets & BackupTarget::Boot) {
+        std::string path(backup_dir);
+        path += '/';
+        path += BACKUP_NAME_BOOT_IMAGE;
+        path += SNAPSHOT_EXTENSION;
+
+        struct stat sb;
+        if (stat(path.c_str(), &sb) == 0) {
+            LOGI("Verifying %s", path.c_str());
+
+            tasks.push_back([path, &chunk_store] {
+                return boot_store_verify(path, chunk_store);
+            });
+        }
+    }
+
+    if (tasks.empty()) {
+        LOGE("%s: No backups to verify", backup_dir.c_str());
+        return false;
+    }
+
+    std::atomic_size_t next{0};
+    std::atomic_bool failed{false};
+
+    // Keep going after a failure to report every bad file
+    auto worker = [&] {
+        for (size_t i; (i = next++) < tasks.size();) {
+            if (!tasks[i]()) {
+                failed = true;
+            }
+        }
+    };
+
+    auto n_threads = std::min<size_t>(
+            std::max(std::thread::hardware_concurrency(), 1u), tasks.size());
+
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < n_threads; ++i) {
+        threads.emplace_back(worker);
+    }
+
+    worker();
+
+    for (auto &t : threads) {
+        t.join();
+    }
+
+    return !failed;
+}
+
 static bool unshare_mount_namespace()
 {
     if (unshare(CLONE_NEWNS) < 0) {
@@ -924,8 +1719,24 @@ static void backup_usage(FILE *stream)
             "  -s, --split-size <size>\n"
             "                   Split archive maximum size in bytes (0 to disable)\n"
             "                   (Default: %" PRIu64 " bytes)\n"
+            "  -p, --parallel-parts\n"
+            "                   Split archives into independently compressed parts\n"
+            "                   of about the split size that are created and\n"
+            "                   restored in parallel\n"
             "  -d, --backupdir <directory>\n"
             "                   Directory to store backup\n"
+            "  -j, --jobs <N>   Number of targets to back up concurrently\n"
+            "                   (Default: 1)\n"
+            "  -k, --chunk-store <directory>\n"
+            "                   Create an incremental snapshot that stores file\n"
+            "                   contents in this directory, which can be shared\n"
+            "                   by all backups, instead of archives\n"
+            "  -b, --block-level\n"
+            "                   Back up the allocated blocks of image-based\n"
+            "                   targets as sparse images instead of their files\n"
+            "  -V, --verify     Check the integrity of the existing backup in the\n"
+            "                   backup directory instead of creating one\n"
+            "                   (-r is not needed)\n"
             "  -f, --force      Allow overwriting old backup with the same name\n"
             "  -h, --help       Display this help message\n"
             "\n"
@@ -949,6 +1760,13 @@ static void restore_usage(FILE *stream)
             "                   (Default: 'all')\n"
             "  -d, --backupdir <directory>\n"
             "                   Backup directory to restore from\n"
+            "  -k, --chunk-store <directory>\n"
+            "                   Chunk store for snapshots if it was moved since\n"
+            "                   the backup was made\n"
+            "  -D, --delta      Only replace files that differ from the backup\n"
+            "                   instead of wiping the targets first\n"
+            "  -V, --verify     Check the integrity of the backup first and do\n"
+            "                   not restore anything if it is damaged\n"
             "  -h, --help       Display this help message\n"
             "\n"
             "Valid backup targets: 'all' or some combination of the following:\n"
@@ -962,13 +1780,18 @@ int backup_main(int argc, char *argv[])
 {
     int opt;
 
-    static const char *short_options = "r:t:c:d:s:fh";
+    static const char *short_options = "r:t:c:d:s:pj:k:bVfh";
     static struct option long_options[] = {
         {"romid",       required_argument, 0, 'r'},
         {"targets",     required_argument, 0, 't'},
         {"compression", required_argument, 0, 'c'},
         {"backupdir",   required_argument, 0, 'd'},
         {"split-size",  required_argument, 0, 's'},
+        {"parallel-parts", no_argument,    0, 'p'},
+        {"jobs",        required_argument, 0, 'j'},
+        {"chunk-store", required_argument, 0, 'k'},
+        {"block-level", no_argument,       0, 'b'},
+        {"verify",      no_argument,       0, 'V'},
         {"force",       no_argument,       0, 'f'},
         {"help",        no_argument,       0, 'h'},
         {0, 0, 0, 0}
@@ -981,6 +1804,11 @@ int backup_main(int argc, char *argv[])
     std::string backupdir;
     util::CompressionType compression = util::CompressionType::Lz4;
     uint64_t split_archive_size = DEFAULT_ARCHIVE_SPLIT_SIZE;
+    bool parallel_parts = false;
+    unsigned int jobs = 1;
+    std::string chunk_store;
+    bool block_level = false;
+    bool verify = false;
     bool force = false;
 
     while ((opt = getopt_long(argc, argv, short_options,
@@ -1007,6 +1835,24 @@ int backup_main(int argc, char *argv[])
                 return EXIT_FAILURE;
             }
             break;
+        case 'p':
+            parallel_parts = true;
+            break;
+        case 'j':
+            if (!str_to_num(optarg, 10, jobs) || jobs == 0) {
+                fprintf(stderr, "Invalid number of jobs: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'k':
+            chunk_store = optarg;
+            break;
+        case 'b':
+            block_level = true;
+            break;
+        case 'V':
+            verify = true;
+            break;
         case 'f':
             force = true;
             break;
@@ -1025,7 +1871,7 @@ int backup_main(int argc, char *argv[])
         return EXIT_FAILURE;
     }
 
-    if (romid.empty()) {
+    if (romid.empty() && !verify) {
         fprintf(stderr, "No ROM ID specified\n");
         return EXIT_FAILURE;
     }
@@ -1041,6 +1887,16 @@ int backup_main(int argc, char *argv[])
         return EXIT_FAILURE;
     }
 
+    if (verify) {
+        if (verify_backup(backupdir, targets, chunk_store)) {
+            LOGI("=== Backup is intact ===");
+            return EXIT_SUCCESS;
+        } else {
+            LOGI("=== Backup is damaged ===");
+            return EXIT_FAILURE;
+        }
+    }
+
     warn_selinux_context();
 
     if (!unshare_mount_namespace()) {
@@ -1073,8 +1929,9 @@ int backup_main(int argc, char *argv[])
         return EXIT_FAILURE;
     }
 
-    bool ret = backup_rom(rom, backupdir, targets, compression,
-                          split_archive_size);
+    bool ret = backup_rom(rom, backupdir, targets, chunk_store, block_level,
+                          compression, split_archive_size, parallel_parts,
+                          jobs);
     if (ret) {
         LOGI("=== Finished ===");
         return EXIT_SUCCESS;
@@ -1088,12 +1945,15 @@ int restore_main(int argc, char *argv[])
 {
     int opt;
 
-    static const char *short_options = "r:t:d:h";
+    static const char *short_options = "r:t:d:k:DVh";
     static struct option long_options[] = {
-        {"romid",     required_argument, 0, 'r'},
-        {"targets",   required_argument, 0, 't'},
-        {"backupdir", required_argument, 0, 'd'},
-        {"help",      no_argument,       0, 'h'},
+        {"romid",       required_argument, 0, 'r'},
+        {"targets",     required_argument, 0, 't'},
+        {"backupdir",   required_argument, 0, 'd'},
+        {"chunk-store", required_argument, 0, 'k'},
+        {"delta",       no_argument,       0, 'D'},
+        {"verify",      no_argument,       0, 'V'},
+        {"help",        no_argument,       0, 'h'},
         {0, 0, 0, 0}
     };
 
@@ -1102,6 +1962,9 @@ int restore_main(int argc, char *argv[])
     std::string romid;
     std::string targets_str("all");
     std::string backupdir;
+    std::string chunk_store;
+    bool delta = false;
+    bool verify = false;
 
     while ((opt = getopt_long(argc, argv, short_options,
             long_options, &long_index)) != -1) {
@@ -1115,6 +1978,15 @@ int restore_main(int argc, char *argv[])
         case 'd':
             backupdir = optarg;
             break;
+        case 'k':
+            chunk_store = optarg;
+            break;
+        case 'D':
+            delta = true;
+            break;
+        case 'V':
+            verify = true;
+            break;
         case 'h':
             restore_usage(stdout);
             return EXIT_SUCCESS;
@@ -1174,7 +2046,12 @@ int restore_main(int argc, char *argv[])
         return EXIT_FAILURE;
     }
 
-    bool ret = restore_rom(rom, backupdir, targets);
+    if (verify && !verify_backup(backupdir, targets, chunk_store)) {
+        fprintf(stderr, "Backup is damaged; nothing was restored\n");
+        return EXIT_FAILURE;
+    }
+
+    bool ret = restore_rom(rom, backupdir, targets, chunk_store, delta);
     if (ret) {
         LOGI("=== Finished ===");
         return EXIT_SUCCESS;
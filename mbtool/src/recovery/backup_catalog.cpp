@@ -0,0 +1,400 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "recovery/backup_catalog.h"
+
+#include <unordered_map>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <rapidjson/document.h>
+#include <rapidjson/stringbuffer.h>
+#include <rapidjson/writer.h>
+
+#include "mbcommon/string.h"
+#include "mblog/logging.h"
+#include "mbutil/archive.h"
+#include "mbutil/file.h"
+
+#define LOG_TAG "mbtool/recovery/backup_catalog"
+
+// Bump when making incompatible changes to the format
+#define CATALOG_VERSION         1
+
+namespace mb
+{
+
+// The catalog is a JSON file written once all targets of a backup have
+// finished:
+//
+//   {
+//     "version": 1,
+//     "rom_id": "<ROM ID>",
+//     "timestamp": <seconds since epoch>,
+//     "targets": [
+//       {
+//         "name": "system",
+//         "archive": "system.tar.lz4",
+//         "format": "tar",
+//         "compression": "lz4",
+//         "split": true,
+//         "size": <total bytes>,
+//         "files": [
+//           { "name": "system.tar.lz4.0", "size": <bytes>,
+//             "mtime": <seconds since epoch>, "sha512": "<hex>" },
+//           ...
+//         ]
+//       },
+//       ...
+//     ]
+//   }
+//
+// It lets restore and the app find every archive with a single read instead of
+// probing the backup directory for each possible file name.
+
+/*!
+ * \brief Total size of all files belonging to the target
+ */
+uint64_t BackupCatalogTarget::total_size() const
+{
+    uint64_t size = 0;
+    for (auto const &file : files) {
+        size += file.size;
+    }
+    return size;
+}
+
+/*!
+ * \brief Find a target by name
+ *
+ * \return Target or nullptr if the target is not in the catalog
+ */
+const BackupCatalogTarget * BackupCatalog::find(std::string_view name) const
+{
+    for (auto const &target : targets) {
+        if (target.name == name) {
+            return &target;
+        }
+    }
+    return nullptr;
+}
+
+static bool stat_file(const std::string &backup_dir, std::string name,
+                      BackupCatalogFile &file)
+{
+    std::string path(backup_dir);
+    path += '/';
+    path += name;
+
+    struct stat sb;
+    if (stat(path.c_str(), &sb) < 0) {
+        return false;
+    }
+
+    file.name = std::move(name);
+    file.size = static_cast<uint64_t>(sb.st_size);
+    file.mtime = sb.st_mtime;
+    return true;
+}
+
+/*!
+ * \brief Record the files of a finished target
+ *
+ * If \p target.archive does not exist, the parts of a split archive
+ * (`<archive>.0`, `<archive>.1`, ...) or of an archive split into independent
+ * parts (`<archive>.part0`, `<archive>.part1`, ...) are recorded instead and
+ * \p target.split is set.
+ *
+ * \param target Target with the archive name set
+ * \param backup_dir Backup directory
+ * \param checksums_name Name of the checksum list in sha512sum format written
+ *                       alongside the archive (empty if there is none)
+ *
+ * \return Whether any files were found
+ */
+bool backup_catalog_add_files(BackupCatalogTarget &target,
+                              const std::string &backup_dir,
+                              const std::string &checksums_name)
+{
+    BackupCatalogFile file{};
+
+    target.files.clear();
+
+    if (stat_file(backup_dir, target.archive, file)) {
+        target.split = false;
+        target.files.push_back(std::move(file));
+    } else {
+        target.split = true;
+        for (size_t i = 0; stat_file(backup_dir, format(
+                "%s.%zu", target.archive.c_str(), i), file); ++i) {
+            target.files.push_back(std::move(file));
+        }
+        if (target.files.empty()) {
+            for (size_t i = 0; stat_file(backup_dir,
+                    util::libarchive_tar_part_name(target.archive, i), file);
+                    ++i) {
+                target.files.push_back(std::move(file));
+            }
+        }
+    }
+
+    if (target.files.empty()) {
+        LOGW("%s/%s: No files found for catalog",
+             backup_dir.c_str(), target.archive.c_str());
+        return false;
+    }
+
+    if (checksums_name.empty()) {
+        return true;
+    }
+
+    auto contents = util::file_read_all(backup_dir + "/" + checksums_name);
+    if (!contents) {
+        LOGW("%s: Failed to read checksums: %s", checksums_name.c_str(),
+             contents.error().message().c_str());
+        return true;
+    }
+
+    // <hex digest>  <file name>
+    std::unordered_map<std::string_view, std::string_view> digests;
+
+    for (auto const &line : split_range(contents.value(), '\n')) {
+        auto pos = line.find("  ");
+        if (pos != std::string_view::npos) {
+            digests.emplace(line.substr(pos + 2), line.substr(0, pos));
+        }
+    }
+
+    for (auto &f : target.files) {
+        if (auto it = digests.find(f.name); it != digests.end()) {
+            f.sha512 = it->second;
+        }
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Write a backup catalog
+ *
+ * The catalog is written to a temporary file first, so a partially written
+ * catalog is never seen by readers.
+ *
+ * \param path Output path
+ * \param catalog Catalog to write
+ *
+ * \return Whether the file was successfully written
+ */
+bool backup_catalog_write(const std::string &path, const BackupCatalog &catalog)
+{
+    using namespace rapidjson;
+
+    StringBuffer sb;
+    Writer<StringBuffer> writer(sb);
+
+    writer.StartObject();
+    writer.Key("version");
+    writer.Uint(CATALOG_VERSION);
+    writer.Key("rom_id");
+    writer.String(catalog.rom_id);
+    writer.Key("timestamp");
+    writer.Int64(catalog.timestamp);
+    writer.Key("targets");
+    writer.StartArray();
+
+    for (auto const &target : catalog.targets) {
+        writer.StartObject();
+        writer.Key("name");
+        writer.String(target.name);
+        writer.Key("archive");
+        writer.String(target.archive);
+        writer.Key("format");
+        writer.String(target.format);
+        writer.Key("compression");
+        writer.String(target.compression);
+        writer.Key("split");
+        writer.Bool(target.split);
+        writer.Key("size");
+        writer.Uint64(target.total_size());
+        writer.Key("files");
+        writer.StartArray();
+
+        for (auto const &file : target.files) {
+            writer.StartObject();
+            writer.Key("name");
+            writer.String(file.name);
+            writer.Key("size");
+            writer.Uint64(file.size);
+            writer.Key("mtime");
+            writer.Int64(file.mtime);
+            if (!file.sha512.empty()) {
+                writer.Key("sha512");
+                writer.String(file.sha512);
+            }
+            writer.EndObject();
+        }
+
+        writer.EndArray();
+        writer.EndObject();
+    }
+
+    writer.EndArray();
+    writer.EndObject();
+
+    std::string temp_path(path);
+    temp_path += ".tmp";
+
+    if (auto r = util::file_write_data(temp_path, sb.GetString(),
+                                       sb.GetSize()); !r) {
+        LOGE("%s: Failed to write catalog: %s",
+             temp_path.c_str(), r.error().message().c_str());
+        return false;
+    }
+
+    if (rename(temp_path.c_str(), path.c_str()) < 0) {
+        LOGE("%s: Failed to rename to %s: %s",
+             temp_path.c_str(), path.c_str(), strerror(errno));
+        unlink(temp_path.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+static bool get_string(const rapidjson::Value &obj, const char *key,
+                       std::string &out)
+{
+    auto it = obj.FindMember(key);
+    if (it == obj.MemberEnd() || !it->value.IsString()) {
+        return false;
+    }
+    out.assign(it->value.GetString(), it->value.GetStringLength());
+    return true;
+}
+
+/*!
+ * \brief Read a backup catalog
+ *
+ * \param path Path to catalog
+ * \param[out] catalog Catalog to fill in
+ *
+ * \return Whether the catalog exists and is valid. Callers should fall back to
+ *         probing the backup directory if it is not.
+ */
+bool backup_catalog_read(const std::string &path, BackupCatalog &catalog)
+{
+    using namespace rapidjson;
+
+    auto contents = util::file_read_all(path);
+    if (!contents) {
+        if (contents.error() != std::errc::no_such_file_or_directory) {
+            LOGW("%s: Failed to read catalog: %s",
+                 path.c_str(), contents.error().message().c_str());
+        }
+        return false;
+    }
+
+    Document d;
+
+    if (d.Parse(contents.value().data(), contents.value().size())
+            .HasParseError() || !d.IsObject()) {
+        LOGW("%s: Failed to parse catalog", path.c_str());
+        return false;
+    }
+
+    auto version = d.FindMember("version");
+    if (version == d.MemberEnd() || !version->value.IsUint()
+            || version->value.GetUint() != CATALOG_VERSION) {
+        LOGW("%s: Unsupported catalog version", path.c_str());
+        return false;
+    }
+
+    auto timestamp = d.FindMember("timestamp");
+    auto targets = d.FindMember("targets");
+
+    if (!get_string(d, "rom_id", catalog.rom_id)
+            || timestamp == d.MemberEnd() || !timestamp->value.IsInt64()
+            || targets == d.MemberEnd() || !targets->value.IsArray()) {
+        LOGW("%s: Invalid catalog", path.c_str());
+        return false;
+    }
+
+    catalog.timestamp = timestamp->value.GetInt64();
+    catalog.targets.clear();
+
+    for (auto const &t : targets->value.GetArray()) {
+        BackupCatalogTarget target{};
+
+        if (!t.IsObject()) {
+            LOGW("%s: Invalid target in catalog", path.c_str());
+            return false;
+        }
+
+        auto split = t.FindMember("split");
+        auto files = t.FindMember("files");
+
+        if (!get_string(t, "name", target.name)
+                || !get_string(t, "archive", target.archive)
+                || !get_string(t, "format", target.format)
+                || !get_string(t, "compression", target.compression)
+                || split == t.MemberEnd() || !split->value.IsBool()
+                || files == t.MemberEnd() || !files->value.IsArray()) {
+            LOGW("%s: Invalid target in catalog", path.c_str());
+            return false;
+        }
+
+        target.split = split->value.GetBool();
+
+        for (auto const &f : files->value.GetArray()) {
+            BackupCatalogFile file{};
+
+            if (!f.IsObject()) {
+                LOGW("%s: Invalid file in catalog", path.c_str());
+                return false;
+            }
+
+            auto size = f.FindMember("size");
+            auto mtime = f.FindMember("mtime");
+
+            if (!get_string(f, "name", file.name)
+                    || size == f.MemberEnd() || !size->value.IsUint64()
+                    || mtime == f.MemberEnd() || !mtime->value.IsInt64()) {
+                LOGW("%s: Invalid file in catalog", path.c_str());
+                return false;
+            }
+
+            file.size = size->value.GetUint64();
+            file.mtime = mtime->value.GetInt64();
+            get_string(f, "sha512", file.sha512);
+
+            target.files.push_back(std::move(file));
+        }
+
+        catalog.targets.push_back(std::move(target));
+    }
+
+    return true;
+}
+
+}
@@ -0,0 +1,446 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "recovery/backup_progress.h"
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <new>
+
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <rapidjson/document.h>
+#include <rapidjson/filereadstream.h>
+#include <rapidjson/filewritestream.h>
+#include <rapidjson/writer.h>
+
+#include "mblog/logging.h"
+#include "mbutil/fts.h"
+
+#define LOG_TAG "mbtool/recovery/backup_progress"
+
+// Interval between progress reports
+#define PROGRESS_INTERVAL       std::chrono::seconds(1)
+
+typedef std::unique_ptr<FILE, decltype(fclose) *> ScopedFILE;
+
+namespace mb
+{
+
+// Progress reports are written to stdout, one line per running target:
+//
+//   progress target=<name> state=<running|succeeded|failed> bytes=<n>
+//            total=<n> files=<n> rate=<bytes/s> eta=<s> elapsed=<ms>
+//
+// (on a single line). `total` is 0 and `eta` is -1 if the size of the target
+// is unknown. A final line is printed for every target when the run finishes.
+
+static uint64_t monotonic_ns()
+{
+    timespec ts;
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0) {
+        return 0;
+    }
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000
+            + static_cast<uint64_t>(ts.tv_nsec);
+}
+
+static const char * state_name(TargetState state)
+{
+    switch (state) {
+    case TargetState::Pending:
+        return "pending";
+    case TargetState::Running:
+        return "running";
+    case TargetState::Succeeded:
+        return "succeeded";
+    case TargetState::Failed:
+        return "failed";
+    }
+    return "unknown";
+}
+
+void TargetProgress::begin()
+{
+    start_ns.store(monotonic_ns(), std::memory_order_relaxed);
+    state.store(TargetState::Running, std::memory_order_release);
+}
+
+void TargetProgress::end(bool success)
+{
+    end_ns.store(monotonic_ns(), std::memory_order_relaxed);
+    state.store(success ? TargetState::Succeeded : TargetState::Failed,
+                std::memory_order_release);
+}
+
+/*!
+ * \brief Create a progress reporter
+ *
+ * The per-target progress structures are allocated in anonymous shared memory
+ * so that backup jobs running in child processes can update them.
+ *
+ * \param max_targets Maximum number of targets that can be added
+ */
+ProgressReporter::ProgressReporter(size_t max_targets)
+    : m_targets(nullptr)
+    , m_max_targets(max_targets)
+    , m_count(0)
+    , m_last_ns(0)
+    , m_stop(false)
+{
+    if (max_targets == 0) {
+        return;
+    }
+
+    void *mem = mmap(nullptr, sizeof(TargetProgress) * max_targets,
+                     PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS,
+                     -1, 0);
+    if (mem == MAP_FAILED) {
+        LOGW("Failed to allocate shared memory for progress: %s",
+             strerror(errno));
+        m_max_targets = 0;
+        return;
+    }
+
+    m_targets = static_cast<TargetProgress *>(mem);
+    for (size_t i = 0; i < max_targets; ++i) {
+        new (&m_targets[i]) TargetProgress();
+    }
+}
+
+ProgressReporter::~ProgressReporter()
+{
+    stop();
+
+    if (m_targets) {
+        for (size_t i = 0; i < m_max_targets; ++i) {
+            m_targets[i].~TargetProgress();
+        }
+        munmap(m_targets, sizeof(TargetProgress) * m_max_targets);
+    }
+}
+
+/*!
+ * \brief Add a target
+ *
+ * \param name Name of the target (truncated to 15 characters)
+ * \param total_bytes Expected number of bytes or 0 if unknown. This can also be
+ *                    set later via TargetProgress::total_bytes.
+ *
+ * \return Progress structure for the target or nullptr if the maximum number of
+ *         targets was reached
+ */
+TargetProgress * ProgressReporter::add_target(const char *name,
+                                              uint64_t total_bytes)
+{
+    if (m_count >= m_max_targets) {
+        return nullptr;
+    }
+
+    auto *target = &m_targets[m_count++];
+    snprintf(target->name, sizeof(target->name), "%s", name);
+    target->total_bytes.store(total_bytes, std::memory_order_relaxed);
+    m_last_bytes.push_back(0);
+
+    return target;
+}
+
+/*!
+ * \brief Start reporting progress periodically on a separate thread
+ */
+void ProgressReporter::start()
+{
+    if (m_thread.joinable()) {
+        return;
+    }
+
+    m_stop = false;
+    m_last_ns = monotonic_ns();
+    m_thread = std::thread(&ProgressReporter::report_loop, this);
+}
+
+/*!
+ * \brief Stop the reporting thread and print the final state of all targets
+ */
+void ProgressReporter::stop()
+{
+    if (!m_thread.joinable()) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_cv.notify_one();
+    m_thread.join();
+
+    report(true);
+}
+
+void ProgressReporter::report_loop()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    while (!m_cv.wait_for(lock, PROGRESS_INTERVAL, [&] { return m_stop; })) {
+        report(false);
+    }
+}
+
+void ProgressReporter::report(bool final)
+{
+    uint64_t now = monotonic_ns();
+    uint64_t interval_ns = std::max<uint64_t>(now - m_last_ns, 1);
+    m_last_ns = now;
+
+    for (size_t i = 0; i < m_count; ++i) {
+        auto &target = m_targets[i];
+        auto state = target.state.load(std::memory_order_acquire);
+
+        if (state == TargetState::Pending
+                || (!final && state != TargetState::Running)) {
+            continue;
+        }
+
+        uint64_t bytes = target.counters.bytes.load(std::memory_order_relaxed);
+        uint64_t files = target.counters.files.load(std::memory_order_relaxed);
+        uint64_t total = target.total_bytes.load(std::memory_order_relaxed);
+        uint64_t start = target.start_ns.load(std::memory_order_relaxed);
+        uint64_t end = state == TargetState::Running
+                ? now : target.end_ns.load(std::memory_order_relaxed);
+        uint64_t elapsed_ns = std::max<uint64_t>(end - start, 1);
+
+        // The rate is for the last interval while running and the average for
+        // the whole target at the end
+        uint64_t rate;
+        if (final) {
+            rate = bytes * 1000000000 / elapsed_ns;
+        } else {
+            rate = (bytes - m_last_bytes[i]) * 1000000000 / interval_ns;
+        }
+        m_last_bytes[i] = bytes;
+
+        // The ETA is based on the average rate, which is more stable
+        int64_t eta = -1;
+        uint64_t avg_rate = bytes * 1000000000 / elapsed_ns;
+        if (state != TargetState::Running) {
+            eta = 0;
+        } else if (total > 0 && avg_rate > 0) {
+            eta = static_cast<int64_t>(
+                    (total > bytes ? total - bytes : 0) / avg_rate);
+        }
+
+        char buf[512];
+        int n = snprintf(buf, sizeof(buf),
+                         "progress target=%s state=%s bytes=%" PRIu64
+                         " total=%" PRIu64 " files=%" PRIu64 " rate=%" PRIu64
+                         " eta=%" PRId64 " elapsed=%" PRIu64 "\n",
+                         target.name, state_name(state), bytes, total, files,
+                         rate, eta, elapsed_ns / 1000000);
+
+        // Backup jobs may fork while this thread is running, so stdio (and its
+        // locks) must not be used here
+        if (n > 0) {
+            (void) !write(STDOUT_FILENO, buf, std::min<size_t>(
+                    static_cast<size_t>(n), sizeof(buf) - 1));
+        }
+    }
+}
+
+/*!
+ * \brief Write the final statistics of all finished targets to a JSON file
+ *
+ * The file contains a `targets` array where each entry has the target `name`,
+ * the `result`, the number of `bytes` and `files` processed, the `duration_ms`,
+ * and the average `rate` in bytes per second.
+ *
+ * \param path Output path
+ *
+ * \return Whether the file was successfully written
+ */
+bool ProgressReporter::write_timings(const std::string &path) const
+{
+    using namespace rapidjson;
+
+    ScopedFILE fp(fopen(path.c_str(), "we"), &fclose);
+    if (!fp) {
+        LOGE("%s: Failed to open for writing: %s",
+             path.c_str(), strerror(errno));
+        return false;
+    }
+
+    char buf[4096];
+    FileWriteStream os(fp.get(), buf, sizeof(buf));
+    Writer<FileWriteStream> writer(os);
+
+    writer.StartObject();
+    writer.Key("targets");
+    writer.StartArray();
+
+    for (size_t i = 0; i < m_count; ++i) {
+        auto const &target = m_targets[i];
+        auto state = target.state.load(std::memory_order_acquire);
+
+        if (state != TargetState::Succeeded && state != TargetState::Failed) {
+            continue;
+        }
+
+        uint64_t bytes = target.counters.bytes.load(std::memory_order_relaxed);
+        uint64_t duration_ns = std::max<uint64_t>(
+                target.end_ns.load(std::memory_order_relaxed)
+                - target.start_ns.load(std::memory_order_relaxed), 1);
+
+        writer.StartObject();
+        writer.Key("name");
+        writer.String(target.name);
+        writer.Key("result");
+        writer.String(state_name(state));
+        writer.Key("bytes");
+        writer.Uint64(bytes);
+        writer.Key("files");
+        writer.Uint64(target.counters.files.load(std::memory_order_relaxed));
+        writer.Key("duration_ms");
+        writer.Uint64(duration_ns / 1000000);
+        writer.Key("rate");
+        writer.Uint64(bytes * 1000000000 / duration_ns);
+        writer.EndObject();
+    }
+
+    writer.EndArray();
+    writer.EndObject();
+
+    os.Flush();
+
+    if (fclose(fp.release()) != 0) {
+        LOGE("%s: Failed to close file: %s",
+             path.c_str(), strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Get the number of bytes recorded for a target in a timings file
+ *
+ * This is used as the expected size when restoring a backup.
+ *
+ * \return Number of bytes or 0 if the file or target doesn't exist
+ */
+uint64_t read_target_timing_bytes(const std::string &path,
+                                  const std::string &name)
+{
+    using namespace rapidjson;
+
+    ScopedFILE fp(fopen(path.c_str(), "re"), &fclose);
+    if (!fp) {
+        return 0;
+    }
+
+    char buf[4096];
+    FileReadStream is(fp.get(), buf, sizeof(buf));
+    Document d;
+
+    if (d.ParseStream(is).HasParseError() || !d.IsObject()) {
+        LOGW("%s: Failed to parse timings", path.c_str());
+        return 0;
+    }
+
+    auto targets = d.FindMember("targets");
+    if (targets == d.MemberEnd() || !targets->value.IsArray()) {
+        return 0;
+    }
+
+    for (auto const &target : targets->value.GetArray()) {
+        if (!target.IsObject()) {
+            continue;
+        }
+
+        auto t_name = target.FindMember("name");
+        auto t_bytes = target.FindMember("bytes");
+
+        if (t_name != target.MemberEnd() && t_name->value.IsString()
+                && t_name->value.GetString() == name
+                && t_bytes != target.MemberEnd()
+                && t_bytes->value.IsUint64()) {
+            return t_bytes->value.GetUint64();
+        }
+    }
+
+    return 0;
+}
+
+class TreeSizeWalker : public util::FtsWrapper
+{
+public:
+    TreeSizeWalker(std::string path, const std::vector<std::string> &exclusions)
+        : FtsWrapper(std::move(path), util::FtsFlag::GroupSpecialFiles)
+        , m_exclusions(exclusions)
+    {
+    }
+
+    Actions on_changed_path() override
+    {
+        if (_curr->fts_level == 1
+                && std::find(m_exclusions.begin(), m_exclusions.end(),
+                             _curr->fts_name) != m_exclusions.end()) {
+            return Action::Skip;
+        }
+
+        return Action::Ok;
+    }
+
+    Actions on_reached_file() override
+    {
+        if (_curr->fts_statp) {
+            total += static_cast<uint64_t>(_curr->fts_statp->st_size);
+        }
+        return Action::Ok;
+    }
+
+    uint64_t total = 0;
+
+private:
+    const std::vector<std::string> &m_exclusions;
+};
+
+/*!
+ * \brief Estimate the number of bytes that backing up a directory will read
+ *
+ * Errors are ignored, since the result is only used for progress reporting.
+ *
+ * \return Total size of the regular files in the tree
+ */
+uint64_t estimate_tree_size(const std::string &path,
+                            const std::vector<std::string> &exclusions)
+{
+    TreeSizeWalker walker(path, exclusions);
+    (void) walker.run();
+    return walker.total;
+}
+
+}
@@ -0,0 +1,613 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "recovery/block_backup.h"
+
+#include <algorithm>
+#include <vector>
+
+#include <cerrno>
+#include <cinttypes>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "mbcommon/endian.h"
+#include "mbcommon/file/standard.h"
+#include "mbcommon/file_util.h"
+#include "mbcommon/finally.h"
+#include "mblog/logging.h"
+#include "mbsparse/sparse.h"
+#include "mbsparse/sparse_writer.h"
+#include "mbutil/page_cache.h"
+
+#define LOG_TAG "mbtool/recovery/block_backup"
+
+namespace mb
+{
+
+// Block-level backups only copy the blocks that the ext4 block bitmaps mark
+// as allocated. They are stored as Android sparse images, with unallocated
+// blocks recorded as "don't care" chunks.
+
+constexpr uint64_t EXT4_SUPERBLOCK_OFFSET       = 1024;
+constexpr size_t EXT4_SUPERBLOCK_SIZE           = 1024;
+constexpr uint16_t EXT4_SUPER_MAGIC             = 0xef53;
+
+constexpr uint32_t EXT4_FEATURE_COMPAT_SPARSE_SUPER2    = 0x0200;
+constexpr uint32_t EXT4_FEATURE_INCOMPAT_RECOVER        = 0x0004;
+constexpr uint32_t EXT4_FEATURE_INCOMPAT_META_BG        = 0x0010;
+constexpr uint32_t EXT4_FEATURE_INCOMPAT_64BIT          = 0x0080;
+constexpr uint32_t EXT4_FEATURE_RO_COMPAT_SPARSE_SUPER  = 0x0001;
+constexpr uint32_t EXT4_FEATURE_RO_COMPAT_GDT_CSUM      = 0x0010;
+constexpr uint32_t EXT4_FEATURE_RO_COMPAT_METADATA_CSUM = 0x0400;
+
+constexpr uint16_t EXT4_BG_BLOCK_UNINIT         = 0x0002;
+
+// Amount of data read from the image at a time
+constexpr size_t COPY_BUFFER_SIZE               = 1024 * 1024;
+
+struct Ext4Layout
+{
+    uint32_t block_size;
+    uint64_t blocks_count;
+    uint32_t first_data_block;
+    uint32_t blocks_per_group;
+    uint32_t group_count;
+    uint32_t desc_size;
+    uint32_t gdt_blocks;
+    uint32_t itable_blocks;
+    bool sparse_super;
+    bool has_csum;
+};
+
+static uint16_t get_le16(const unsigned char *buf, size_t offset)
+{
+    uint16_t value;
+    memcpy(&value, buf + offset, sizeof(value));
+    return mb_le16toh(value);
+}
+
+static uint32_t get_le32(const unsigned char *buf, size_t offset)
+{
+    uint32_t value;
+    memcpy(&value, buf + offset, sizeof(value));
+    return mb_le32toh(value);
+}
+
+static bool pread_fully(int fd, void *buf, size_t size, uint64_t offset)
+{
+    auto *ptr = static_cast<unsigned char *>(buf);
+
+    while (size > 0) {
+        ssize_t n = pread64(fd, ptr, size, static_cast<off64_t>(offset));
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        } else if (n == 0) {
+            errno = EIO;
+            return false;
+        }
+        ptr += n;
+        size -= static_cast<size_t>(n);
+        offset += static_cast<uint64_t>(n);
+    }
+
+    return true;
+}
+
+static bool read_layout(const std::string &image, int fd, Ext4Layout &layout)
+{
+    unsigned char sb[EXT4_SUPERBLOCK_SIZE];
+
+    if (!pread_fully(fd, sb, sizeof(sb), EXT4_SUPERBLOCK_OFFSET)) {
+        LOGE("%s: Failed to read superblock: %s",
+             image.c_str(), strerror(errno));
+        return false;
+    }
+
+    if (get_le16(sb, 56) != EXT4_SUPER_MAGIC) {
+        LOGE("%s: Not an ext4 filesystem", image.c_str());
+        return false;
+    }
+
+    uint32_t inodes_per_group = get_le32(sb, 40);
+    uint32_t log_block_size = get_le32(sb, 24);
+    uint32_t rev_level = get_le32(sb, 76);
+    uint32_t feature_compat = get_le32(sb, 92);
+    uint32_t feature_incompat = get_le32(sb, 96);
+    uint32_t feature_ro_compat = get_le32(sb, 100);
+    uint32_t inode_size = rev_level == 0 ? 128 : get_le16(sb, 88);
+    uint32_t reserved_gdt_blocks = get_le16(sb, 206);
+
+    if (feature_incompat & EXT4_FEATURE_INCOMPAT_RECOVER) {
+        LOGE("%s: Journal needs to be replayed", image.c_str());
+        return false;
+    }
+    if ((feature_incompat & EXT4_FEATURE_INCOMPAT_META_BG)
+            || (feature_compat & EXT4_FEATURE_COMPAT_SPARSE_SUPER2)) {
+        LOGE("%s: Unsupported group descriptor layout", image.c_str());
+        return false;
+    }
+    if (log_block_size > 6) {
+        LOGE("%s: Invalid block size", image.c_str());
+        return false;
+    }
+
+    layout.block_size = 1024u << log_block_size;
+    layout.blocks_count = get_le32(sb, 4);
+    layout.first_data_block = get_le32(sb, 20);
+    layout.blocks_per_group = get_le32(sb, 32);
+    layout.desc_size = 32;
+    layout.sparse_super =
+            feature_ro_compat & EXT4_FEATURE_RO_COMPAT_SPARSE_SUPER;
+    layout.has_csum = feature_ro_compat & (EXT4_FEATURE_RO_COMPAT_GDT_CSUM
+            | EXT4_FEATURE_RO_COMPAT_METADATA_CSUM);
+
+    if (feature_incompat & EXT4_FEATURE_INCOMPAT_64BIT) {
+        layout.blocks_count |= static_cast<uint64_t>(get_le32(sb, 336)) << 32;
+        layout.desc_size = get_le16(sb, 254);
+    }
+
+    if (layout.blocks_per_group == 0
+            || layout.blocks_per_group > layout.block_size * 8
+            || layout.blocks_count <= layout.first_data_block
+            || layout.desc_size < 32
+            || layout.desc_size > layout.block_size
+            || inode_size == 0) {
+        LOGE("%s: Invalid superblock", image.c_str());
+        return false;
+    }
+
+    uint64_t groups = (layout.blocks_count - layout.first_data_block
+            + layout.blocks_per_group - 1) / layout.blocks_per_group;
+    if (groups > UINT32_MAX) {
+        LOGE("%s: Invalid superblock", image.c_str());
+        return false;
+    }
+
+    layout.group_count = static_cast<uint32_t>(groups);
+    layout.gdt_blocks = static_cast<uint32_t>(
+            (groups * layout.desc_size + layout.block_size - 1)
+            / layout.block_size) + reserved_gdt_blocks;
+    layout.itable_blocks = static_cast<uint32_t>(
+            (static_cast<uint64_t>(inodes_per_group) * inode_size
+            + layout.block_size - 1) / layout.block_size);
+
+    return true;
+}
+
+static bool is_power_of(uint32_t n, uint32_t base)
+{
+    while (n > 1 && n % base == 0) {
+        n /= base;
+    }
+    return n == 1;
+}
+
+static bool group_has_super(const Ext4Layout &layout, uint32_t group)
+{
+    return !layout.sparse_super || group <= 1
+            || is_power_of(group, 3)
+            || is_power_of(group, 5)
+            || is_power_of(group, 7);
+}
+
+static void mark_blocks(std::vector<bool> &allocated, uint64_t start,
+                        uint64_t count)
+{
+    uint64_t end = std::min<uint64_t>(start + count, allocated.size());
+    for (uint64_t i = start; i < end; ++i) {
+        allocated[i] = true;
+    }
+}
+
+/*!
+ * \brief Build a bitmap of all the allocated blocks in an ext4 image
+ *
+ * Groups with uninitialized block bitmaps only contain metadata, so the
+ * superblock backups, group descriptors, and every group's bitmaps and inode
+ * table are always marked as allocated, regardless of what the bitmaps say.
+ */
+static bool read_allocated_blocks(const std::string &image, int fd,
+                                  const Ext4Layout &layout,
+                                  std::vector<bool> &allocated)
+{
+    allocated.assign(layout.blocks_count, false);
+
+    // Boot sector (only outside of group 0 if the block size is 1024 bytes)
+    mark_blocks(allocated, 0, layout.first_data_block + 1);
+
+    std::vector<unsigned char> gdt(
+            static_cast<size_t>(layout.group_count) * layout.desc_size);
+    if (!pread_fully(fd, gdt.data(), gdt.size(),
+                     static_cast<uint64_t>(layout.first_data_block + 1)
+                     * layout.block_size)) {
+        LOGE("%s: Failed to read group descriptors: %s",
+             image.c_str(), strerror(errno));
+        return false;
+    }
+
+    std::vector<unsigned char> bitmap(layout.block_size);
+
+    for (uint32_t group = 0; group < layout.group_count; ++group) {
+        const unsigned char *desc = gdt.data()
+                + static_cast<size_t>(group) * layout.desc_size;
+        uint64_t group_start = layout.first_data_block
+                + static_cast<uint64_t>(group) * layout.blocks_per_group;
+
+        uint64_t block_bitmap = get_le32(desc, 0);
+        uint64_t inode_bitmap = get_le32(desc, 4);
+        uint64_t inode_table = get_le32(desc, 8);
+        uint16_t flags = get_le16(desc, 18);
+
+        if (layout.desc_size >= 64) {
+            block_bitmap |= static_cast<uint64_t>(get_le32(desc, 32)) << 32;
+            inode_bitmap |= static_cast<uint64_t>(get_le32(desc, 36)) << 32;
+            inode_table |= static_cast<uint64_t>(get_le32(desc, 40)) << 32;
+        }
+
+        if (group_has_super(layout, group)) {
+            mark_blocks(allocated, group_start, 1 + layout.gdt_blocks);
+        }
+        mark_blocks(allocated, block_bitmap, 1);
+        mark_blocks(allocated, inode_bitmap, 1);
+        mark_blocks(allocated, inode_table, layout.itable_blocks);
+
+        if (layout.has_csum && (flags & EXT4_BG_BLOCK_UNINIT)) {
+            continue;
+        }
+
+        if (block_bitmap >= layout.blocks_count
+                || !pread_fully(fd, bitmap.data(), bitmap.size(),
+                                block_bitmap * layout.block_size)) {
+            LOGE("%s: Failed to read block bitmap for group %" PRIu32 ": %s",
+                 image.c_str(), group, strerror(errno));
+            return false;
+        }
+
+        uint64_t group_blocks = std::min<uint64_t>(
+                layout.blocks_per_group, layout.blocks_count - group_start);
+
+        for (uint64_t i = 0; i < group_blocks; ++i) {
+            if (bitmap[i / 8] & (1u << (i % 8))) {
+                allocated[group_start + i] = true;
+            }
+        }
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Back up the allocated blocks of an ext4 image
+ *
+ * The image must not be mounted and should have been checked with
+ * fsck_ext4_image() so that the bitmaps are consistent.
+ *
+ * \param image Path to ext4 image
+ * \param output_file Output sparse image
+ * \param progress Optional counters for the bytes copied
+ *
+ * \return Whether the image was successfully backed up
+ */
+bool backup_ext4_image_blocks(const std::string &image,
+                              const std::string &output_file,
+                              util::CopyProgress *progress)
+{
+    int fd = open(image.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        LOGE("%s: Failed to open: %s", image.c_str(), strerror(errno));
+        return false;
+    }
+
+    auto close_fd = finally([&] {
+        close(fd);
+    });
+
+    Ext4Layout layout;
+    std::vector<bool> allocated;
+
+    if (!read_layout(image, fd, layout)
+            || !read_allocated_blocks(image, fd, layout, allocated)) {
+        return false;
+    }
+
+    util::StreamCache in_cache(fd, util::StreamDirection::Read);
+
+    StandardFile file;
+    sparse::SparseWriter writer;
+
+    if (auto r = file.open(output_file, FileOpenMode::WriteOnly); !r) {
+        LOGE("%s: Failed to open for writing: %s",
+             output_file.c_str(), r.error().message().c_str());
+        return false;
+    }
+
+    util::StreamCache out_cache(file.native_fd(), util::StreamDirection::Write);
+
+    if (auto r = writer.open(&file, layout.block_size,
+                             sparse::SparseWriterFlag::DontCareZeroBlocks
+                             | sparse::SparseWriterFlag::WriteCrc32); !r) {
+        LOGE("%s: Failed to open sparse writer: %s",
+             output_file.c_str(), r.error().message().c_str());
+        return false;
+    }
+
+    std::vector<unsigned char> buf(
+            std::max<size_t>(COPY_BUFFER_SIZE, layout.block_size));
+    const uint64_t buf_blocks = buf.size() / layout.block_size;
+    uint64_t copied_blocks = 0;
+
+    for (uint64_t block = 0; block < layout.blocks_count;) {
+        if (!allocated[block]) {
+            ++block;
+            continue;
+        }
+
+        // Copy the run of allocated blocks in buffer-sized pieces
+        uint64_t n = 1;
+        while (n < buf_blocks && block + n < layout.blocks_count
+                && allocated[block + n]) {
+            ++n;
+        }
+
+        uint64_t offset = block * layout.block_size;
+        size_t size = static_cast<size_t>(n * layout.block_size);
+
+        if (!pread_fully(fd, buf.data(), size, offset)) {
+            LOGE("%s: Failed to read: %s", image.c_str(), strerror(errno));
+            return false;
+        }
+
+        in_cache.advance(offset + size);
+
+        if (auto r = writer.seek(static_cast<int64_t>(offset), SEEK_SET); !r) {
+            LOGE("%s: Failed to seek: %s",
+                 output_file.c_str(), r.error().message().c_str());
+            return false;
+        } else if (auto r2 = file_write_exact(writer, buf.data(), size); !r2) {
+            LOGE("%s: Failed to write: %s",
+                 output_file.c_str(), r2.error().message().c_str());
+            return false;
+        }
+
+        out_cache.advance();
+
+        block += n;
+        copied_blocks += n;
+
+        if (progress) {
+            progress->bytes.fetch_add(size, std::memory_order_relaxed);
+        }
+    }
+
+    // Unallocated blocks at the end of the image
+    if (auto r = writer.seek(static_cast<int64_t>(
+            layout.blocks_count * layout.block_size), SEEK_SET); !r) {
+        LOGE("%s: Failed to seek: %s",
+             output_file.c_str(), r.error().message().c_str());
+        return false;
+    }
+
+    if (auto r = writer.close(); !r) {
+        LOGE("%s: Failed to finalize sparse image: %s",
+             output_file.c_str(), r.error().message().c_str());
+        return false;
+    }
+
+    out_cache.finish();
+
+    if (auto r = file.close(); !r) {
+        LOGE("%s: Failed to close: %s",
+             output_file.c_str(), r.error().message().c_str());
+        return false;
+    }
+
+    if (progress) {
+        progress->files.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    LOGI("%s: Copied %" PRIu64 " of %" PRIu64 " blocks", image.c_str(),
+         copied_blocks, layout.blocks_count);
+
+    return true;
+}
+
+/*!
+ * \brief Restore an ext4 image from a block-level backup
+ *
+ * The sparse image is read sequentially. Data and non-zero fill chunks are
+ * written to \a image and everything else is left as holes. Any existing
+ * image is replaced.
+ *
+ * \param input_file Sparse image created by backup_ext4_image_blocks()
+ * \param image Path to ext4 image
+ * \param progress Optional counters for the bytes written
+ *
+ * \return Whether the image was successfully restored
+ */
+bool restore_ext4_image_blocks(const std::string &input_file,
+                               const std::string &image,
+                               util::CopyProgress *progress)
+{
+    StandardFile in_file;
+    sparse::SparseFile sparse_file;
+    StandardFile out_file;
+
+    if (auto r = in_file.open(input_file, FileOpenMode::ReadOnly); !r) {
+        LOGE("%s: Failed to open: %s",
+             input_file.c_str(), r.error().message().c_str());
+        return false;
+    }
+
+    if (auto r = sparse_file.open(&in_file,
+                                  sparse::SparseFileFlag::VerifyCrc32); !r) {
+        LOGE("%s: Failed to open sparse image: %s",
+             input_file.c_str(), r.error().message().c_str());
+        return false;
+    }
+
+    if (auto r = out_file.open(image, FileOpenMode::WriteOnly); !r) {
+        LOGE("%s: Failed to open for writing: %s",
+             image.c_str(), r.error().message().c_str());
+        return false;
+    }
+
+    util::StreamCache in_cache(in_file.native_fd(),
+                               util::StreamDirection::Read);
+    util::StreamCache out_cache(out_file.native_fd(),
+                                util::StreamDirection::Write);
+
+    if (auto r = out_file.truncate(sparse_file.size()); !r) {
+        LOGE("%s: Failed to truncate file: %s",
+             image.c_str(), r.error().message().c_str());
+        return false;
+    }
+
+    std::vector<unsigned char> buf(COPY_BUFFER_SIZE);
+
+    while (true) {
+        auto extent = sparse_file.next_extent();
+        if (!extent) {
+            LOGE("%s: Failed to read chunk: %s",
+                 input_file.c_str(), extent.error().message().c_str());
+            return false;
+        } else if (!extent.value()) {
+            break;
+        }
+
+        auto const &e = *extent.value();
+
+        if (e.type == sparse::ExtentType::Hole
+                || (e.type == sparse::ExtentType::Fill && e.fill_val == 0)) {
+            if (auto r = sparse_file.skip_extent(); !r) {
+                LOGE("%s: Failed to skip chunk: %s",
+                     input_file.c_str(), r.error().message().c_str());
+                return false;
+            }
+            continue;
+        }
+
+        if (auto r = out_file.seek(static_cast<int64_t>(e.offset), SEEK_SET);
+                !r) {
+            LOGE("%s: Failed to seek: %s",
+                 image.c_str(), r.error().message().c_str());
+            return false;
+        }
+
+        // Data and fill extents are both read through the sparse file, which
+        // expands fill values into bytes
+        for (uint64_t remaining = e.length; remaining > 0;) {
+            size_t n = static_cast<size_t>(
+                    std::min<uint64_t>(remaining, buf.size()));
+
+            if (auto r = file_read_exact(sparse_file, buf.data(), n); !r) {
+                LOGE("%s: Failed to read: %s",
+                     input_file.c_str(), r.error().message().c_str());
+                return false;
+            } else if (auto r2 = file_write_exact(out_file, buf.data(), n);
+                    !r2) {
+                LOGE("%s: Failed to write: %s",
+                     image.c_str(), r2.error().message().c_str());
+                return false;
+            }
+
+            remaining -= n;
+
+            in_cache.advance();
+            out_cache.advance(e.offset + e.length - remaining);
+
+            if (progress) {
+                progress->bytes.fetch_add(n, std::memory_order_relaxed);
+            }
+        }
+    }
+
+    in_cache.finish();
+    out_cache.finish();
+
+    if (auto r = out_file.close(); !r) {
+        LOGE("%s: Failed to close: %s",
+             image.c_str(), r.error().message().c_str());
+        return false;
+    }
+
+    if (progress) {
+        progress->files.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Check the CRC32 checksums of a block-level backup
+ *
+ * The whole sparse image is read, but nothing is written.
+ *
+ * \param input_file Sparse image created by backup_ext4_image_blocks()
+ *
+ * \return Whether the sparse image is intact
+ */
+bool verify_ext4_image_blocks(const std::string &input_file)
+{
+    StandardFile in_file;
+    sparse::SparseFile sparse_file;
+
+    if (auto r = in_file.open(input_file, FileOpenMode::ReadOnly); !r) {
+        LOGE("%s: Failed to open: %s",
+             input_file.c_str(), r.error().message().c_str());
+        return false;
+    }
+
+    if (auto r = sparse_file.open(&in_file,
+                                  sparse::SparseFileFlag::VerifyCrc32); !r) {
+        LOGE("%s: Failed to open sparse image: %s",
+             input_file.c_str(), r.error().message().c_str());
+        return false;
+    }
+
+    // Skipping an extent still reads and checksums its data. Skipping at the
+    // end checks the checksum of the whole image.
+    while (true) {
+        auto extent = sparse_file.next_extent();
+        if (!extent) {
+            LOGE("%s: Failed to read chunk: %s",
+                 input_file.c_str(), extent.error().message().c_str());
+            return false;
+        }
+
+        if (auto r = sparse_file.skip_extent(); !r) {
+            LOGE("%s: Failed to verify chunk: %s",
+                 input_file.c_str(), r.error().message().c_str());
+            return false;
+        }
+
+        if (!extent.value()) {
+            break;
+        }
+    }
+
+    return true;
+}
+
+}
@@ -0,0 +1,667 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "recovery/boot_store.h"
+
+#include <array>
+#include <optional>
+#include <string_view>
+#include <unordered_map>
+
+#include <cerrno>
+#include <cinttypes>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <openssl/sha.h>
+
+#include "mbbootimg/entry.h"
+#include "mbbootimg/format.h"
+#include "mbbootimg/header.h"
+#include "mbbootimg/reader.h"
+#include "mbbootimg/writer.h"
+#include "mbcommon/finally.h"
+#include "mbcommon/integer.h"
+#include "mbcommon/string.h"
+#include "mblog/logging.h"
+#include "mbutil/directory.h"
+#include "mbutil/path.h"
+#include "mbutil/properties.h"
+#include "mbutil/string.h"
+
+#include "recovery/bootimg_util.h"
+#include "util/multiboot.h"
+
+#define LOG_TAG "mbtool/recovery/boot_store"
+
+using namespace mb::bootimg;
+
+namespace mb
+{
+
+// Per-ROM boot images mostly differ only in their ramdisks, so the entries of
+// a boot image are stored individually by the hash of their contents. A boot
+// image is described by a manifest, which is a properties file containing the
+// format, the header fields, and the hash of each entry, and is rebuilt with
+// the boot image writer. Entries are stored whole since the writer needs all
+// of them anyway and a ramdisk shared by two boot images is identical byte for
+// byte.
+//
+// The blobs live in the chunk store next to the snapshot chunks:
+//   <store>/bootimg/<first 2 hex digits>/<64 hex digits>
+
+constexpr char KEY_STORE[]          = "store";
+constexpr char KEY_FORMAT[]         = "format";
+constexpr char KEY_BOARD_NAME[]     = "header.board_name";
+constexpr char KEY_KERNEL_CMDLINE[] = "header.kernel_cmdline";
+constexpr char KEY_PREFIX_ENTRY[]   = "entry.";
+
+constexpr size_t BUF_SIZE = 64 * 1024;
+
+static constexpr struct
+{
+    const char *key;
+    std::optional<uint32_t> (Header::*get)() const;
+    bool (Header::*set)(std::optional<uint32_t>);
+} HEADER_U32_FIELDS[] = {
+    { "header.page_size",
+      &Header::page_size, &Header::set_page_size },
+    { "header.kernel_address",
+      &Header::kernel_address, &Header::set_kernel_address },
+    { "header.ramdisk_address",
+      &Header::ramdisk_address, &Header::set_ramdisk_address },
+    { "header.secondboot_address",
+      &Header::secondboot_address, &Header::set_secondboot_address },
+    { "header.kernel_tags_address",
+      &Header::kernel_tags_address, &Header::set_kernel_tags_address },
+    { "header.sony_ipl_address",
+      &Header::sony_ipl_address, &Header::set_sony_ipl_address },
+    { "header.sony_rpm_address",
+      &Header::sony_rpm_address, &Header::set_sony_rpm_address },
+    { "header.sony_appsbl_address",
+      &Header::sony_appsbl_address, &Header::set_sony_appsbl_address },
+    { "header.entrypoint_address",
+      &Header::entrypoint_address, &Header::set_entrypoint_address },
+};
+
+using BlobId = std::array<unsigned char, 32>;
+
+struct BlobRef
+{
+    uint64_t size;
+    BlobId id;
+};
+
+struct Manifest
+{
+    std::string store_dir;
+    Format format;
+    util::PropertiesMap props;
+    std::unordered_map<int, BlobRef> entries;
+};
+
+class BlobHasher
+{
+public:
+    BlobHasher()
+    {
+        SHA512_Init(&m_ctx);
+    }
+
+    void update(const void *data, size_t size)
+    {
+        SHA512_Update(&m_ctx, data, size);
+        m_size += size;
+    }
+
+    BlobRef finish()
+    {
+        unsigned char digest[SHA512_DIGEST_LENGTH];
+        BlobRef ref;
+
+        SHA512_Final(digest, &m_ctx);
+        memcpy(ref.id.data(), digest, ref.id.size());
+        ref.size = m_size;
+
+        return ref;
+    }
+
+private:
+    SHA512_CTX m_ctx;
+    uint64_t m_size = 0;
+};
+
+static std::string blob_path(const std::string &store_dir, const BlobId &id)
+{
+    std::string hex = util::hex_string(id.data(), id.size());
+
+    std::string path(store_dir);
+    path += "/bootimg/";
+    path += hex.substr(0, 2);
+    path += '/';
+    path += hex;
+
+    return path;
+}
+
+static bool parse_blob_ref(std::string_view value, BlobRef &ref)
+{
+    auto pieces = split(value, ':');
+    if (pieces.size() != 2
+            || !str_to_num(pieces[0].c_str(), 10, ref.size)
+            || pieces[1].size() != ref.id.size() * 2) {
+        return false;
+    }
+
+    for (size_t i = 0; i < ref.id.size(); ++i) {
+        unsigned char c;
+        if (!str_to_num(pieces[1].substr(i * 2, 2).c_str(), 16, c)) {
+            return false;
+        }
+        ref.id[i] = c;
+    }
+
+    return true;
+}
+
+static bool write_fully(int fd, const void *buf, size_t size)
+{
+    auto ptr = static_cast<const char *>(buf);
+
+    while (size > 0) {
+        ssize_t n = write(fd, ptr, size);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        ptr += n;
+        size -= static_cast<size_t>(n);
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Store the data of the current boot image entry
+ *
+ * The data is hashed while it is written to a temporary file, which is then
+ * renamed into place. If the store already has the blob, the temporary file
+ * is discarded instead.
+ *
+ * \param reader Reader positioned at the entry
+ * \param store_dir Store directory
+ * \param[out] ref Reference to the stored blob
+ * \param[out] reused Whether the store already had the blob
+ */
+static bool store_entry(Reader &reader, const std::string &store_dir,
+                        BlobRef &ref, bool &reused)
+{
+    std::string temp_path(store_dir);
+    temp_path += "/bootimg/.";
+    temp_path += std::to_string(getpid());
+    temp_path += ".tmp";
+
+    if (auto r = util::mkdir_recursive(util::dir_name(temp_path), 0700); !r) {
+        LOGE("%s: Failed to create directory: %s",
+             temp_path.c_str(), r.error().message().c_str());
+        return false;
+    }
+
+    int fd = open(temp_path.c_str(),
+                  O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        LOGE("%s: Failed to open for writing: %s",
+             temp_path.c_str(), strerror(errno));
+        return false;
+    }
+
+    auto close_fd = finally([&] {
+        if (fd >= 0) {
+            close(fd);
+        }
+        unlink(temp_path.c_str());
+    });
+
+    BlobHasher hasher;
+
+    auto consume = [&](const void *data, size_t size) {
+        hasher.update(data, size);
+        if (!write_fully(fd, data, size)) {
+            LOGE("%s: Failed to write data: %s",
+                 temp_path.c_str(), strerror(errno));
+            return false;
+        }
+        return true;
+    };
+
+    if (auto view = reader.read_data_view()) {
+        if (!consume(view.value().data, view.value().size)) {
+            return false;
+        }
+    } else if (view.error() == ReaderError::UnsupportedDataView) {
+        char buf[BUF_SIZE];
+
+        while (true) {
+            auto n_read = reader.read_data(buf, sizeof(buf));
+            if (!n_read) {
+                LOGE("Failed to read boot image entry data: %s",
+                     n_read.error().message().c_str());
+                return false;
+            } else if (n_read.value() == 0) {
+                break;
+            }
+
+            if (!consume(buf, n_read.value())) {
+                return false;
+            }
+        }
+    } else {
+        LOGE("Failed to read boot image entry data: %s",
+             view.error().message().c_str());
+        return false;
+    }
+
+    ref = hasher.finish();
+
+    std::string path = blob_path(store_dir, ref.id);
+
+    struct stat sb;
+    if (stat(path.c_str(), &sb) == 0
+            && static_cast<uint64_t>(sb.st_size) == ref.size) {
+        reused = true;
+        return true;
+    }
+
+    if (fsync(fd) < 0 || close(fd) < 0) {
+        fd = -1;
+        LOGE("%s: Failed to close file: %s",
+             temp_path.c_str(), strerror(errno));
+        return false;
+    }
+    fd = -1;
+
+    if (auto r = util::mkdir_recursive(util::dir_name(path), 0700); !r) {
+        LOGE("%s: Failed to create directory: %s",
+             path.c_str(), r.error().message().c_str());
+        return false;
+    }
+
+    if (rename(temp_path.c_str(), path.c_str()) < 0) {
+        LOGE("%s: Failed to rename blob: %s",
+             temp_path.c_str(), strerror(errno));
+        return false;
+    }
+
+    reused = false;
+    return true;
+}
+
+/*!
+ * \brief Add the entries of a boot image to a store
+ *
+ * \param boot_image_path Path to boot image file or block device
+ * \param manifest_path Path to write the manifest to
+ * \param store_dir Store directory
+ *
+ * \return Whether the boot image was successfully stored
+ */
+bool boot_store_save(const std::string &boot_image_path,
+                     const std::string &manifest_path,
+                     const std::string &store_dir)
+{
+    Reader reader;
+
+    if (auto r = reader.enable_formats_all(); !r) {
+        LOGE("Failed to enable boot image formats: %s",
+             r.error().message().c_str());
+        return false;
+    }
+    if (auto r = bi_open_mapped(reader, boot_image_path); !r) {
+        LOGE("%s: Failed to open boot image for reading: %s",
+             boot_image_path.c_str(), r.error().message().c_str());
+        return false;
+    }
+
+    auto header = reader.read_header();
+    if (!header) {
+        LOGE("%s: Failed to read header: %s",
+             boot_image_path.c_str(), header.error().message().c_str());
+        return false;
+    }
+
+    util::PropertiesMap props;
+    props[KEY_STORE] = store_dir;
+    props[KEY_FORMAT] = format_to_name(*reader.format());
+
+    if (auto name = header.value().board_name()) {
+        props[KEY_BOARD_NAME] = *name;
+    }
+    if (auto cmdline = header.value().kernel_cmdline()) {
+        props[KEY_KERNEL_CMDLINE] = *cmdline;
+    }
+    for (auto const &field : HEADER_U32_FIELDS) {
+        if (auto value = (header.value().*field.get)()) {
+            props[field.key] = std::to_string(*value);
+        }
+    }
+
+    uint64_t new_bytes = 0;
+    uint64_t reused_bytes = 0;
+
+    while (true) {
+        auto entry = reader.read_entry();
+        if (!entry) {
+            if (entry.error() == ReaderError::EndOfEntries) {
+                break;
+            }
+            LOGE("%s: Failed to read entry: %s",
+                 boot_image_path.c_str(), entry.error().message().c_str());
+            return false;
+        }
+
+        BlobRef ref;
+        bool reused;
+
+        if (!store_entry(reader, store_dir, ref, reused)) {
+            return false;
+        }
+
+        (reused ? reused_bytes : new_bytes) += ref.size;
+
+        std::string key(KEY_PREFIX_ENTRY);
+        key += std::to_string(static_cast<int>(entry.value().type()));
+
+        props[key] = format("%" PRIu64 ":%s", ref.size,
+                            util::hex_string(ref.id.data(),
+                                             ref.id.size()).c_str());
+    }
+
+    if (!util::property_file_write_all(manifest_path, props)) {
+        LOGE("%s: Failed to write manifest: %s",
+             manifest_path.c_str(), strerror(errno));
+        return false;
+    }
+
+    LOGI("%s: Stored %" PRIu64 " new bytes, reused %" PRIu64 " bytes",
+         boot_image_path.c_str(), new_bytes, reused_bytes);
+
+    return true;
+}
+
+static bool read_manifest(const std::string &manifest_path,
+                          const std::string &store_dir, Manifest &manifest)
+{
+    auto props = util::property_file_get_all(manifest_path);
+    if (!props) {
+        LOGE("%s: Failed to read manifest", manifest_path.c_str());
+        return false;
+    }
+
+    auto const &format_name = (*props)[KEY_FORMAT];
+    auto format = name_to_format(format_name);
+    if (!format) {
+        LOGE("%s: Unknown boot image format: '%s'",
+             manifest_path.c_str(), format_name.c_str());
+        return false;
+    }
+
+    manifest.store_dir = store_dir.empty() ? (*props)[KEY_STORE] : store_dir;
+    manifest.format = *format;
+    manifest.entries.clear();
+
+    for (auto const &[key, value] : *props) {
+        if (!starts_with(key, KEY_PREFIX_ENTRY)) {
+            continue;
+        }
+
+        int type;
+        BlobRef ref;
+
+        if (!str_to_num(key.c_str() + strlen(KEY_PREFIX_ENTRY), 10, type)
+                || !parse_blob_ref(value, ref)) {
+            LOGE("%s: Invalid entry: %s=%s",
+                 manifest_path.c_str(), key.c_str(), value.c_str());
+            return false;
+        }
+
+        manifest.entries[type] = ref;
+    }
+
+    manifest.props = std::move(*props);
+
+    return true;
+}
+
+/*!
+ * \brief Read a blob from the store and check it against its reference
+ *
+ * \param fn Callback for each block of data. Returns false to stop reading.
+ */
+template<typename Fn>
+static bool read_blob(const std::string &store_dir, const BlobRef &ref,
+                      Fn &&fn)
+{
+    std::string path = blob_path(store_dir, ref.id);
+
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        LOGE("%s: Failed to open blob: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+
+    auto close_fd = finally([&] {
+        close(fd);
+    });
+
+    BlobHasher hasher;
+    char buf[BUF_SIZE];
+
+    while (true) {
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            LOGE("%s: Failed to read blob: %s", path.c_str(), strerror(errno));
+            return false;
+        } else if (n == 0) {
+            break;
+        }
+
+        hasher.update(buf, static_cast<size_t>(n));
+
+        if (!fn(buf, static_cast<size_t>(n))) {
+            return false;
+        }
+    }
+
+    auto actual = hasher.finish();
+    if (actual.size != ref.size || actual.id != ref.id) {
+        LOGE("%s: Blob is corrupted", path.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Rebuild a boot image from a manifest
+ *
+ * The blobs are verified as they are streamed into the boot image writer. If
+ * verification fails, the output is left incomplete, so it should be written
+ * to a temporary file first if that matters.
+ *
+ * \param manifest_path Path to manifest
+ * \param store_dir Store directory to use instead of the one recorded in the
+ *                  manifest (may be empty)
+ * \param output_path Path to output boot image file or block device
+ *
+ * \return Whether the boot image was successfully rebuilt
+ */
+bool boot_store_restore(const std::string &manifest_path,
+                        const std::string &store_dir,
+                        const std::string &output_path)
+{
+    Manifest manifest;
+
+    if (!read_manifest(manifest_path, store_dir, manifest)) {
+        return false;
+    }
+
+    Writer writer;
+
+    if (auto r = writer.set_format(manifest.format); !r) {
+        LOGE("Failed to set output boot image format: %s",
+             r.error().message().c_str());
+        return false;
+    }
+    if (auto r = writer.open_filename(output_path); !r) {
+        LOGE("%s: Failed to open boot image for writing: %s",
+             output_path.c_str(), r.error().message().c_str());
+        return false;
+    }
+
+    auto header = writer.get_header();
+    if (!header) {
+        LOGE("%s: Failed to get header: %s",
+             output_path.c_str(), header.error().message().c_str());
+        return false;
+    }
+
+    auto &props = manifest.props;
+
+    if (auto it = props.find(KEY_BOARD_NAME); it != props.end()) {
+        header.value().set_board_name(it->second);
+    }
+    if (auto it = props.find(KEY_KERNEL_CMDLINE); it != props.end()) {
+        header.value().set_kernel_cmdline(it->second);
+    }
+    for (auto const &field : HEADER_U32_FIELDS) {
+        if (auto it = props.find(field.key); it != props.end()) {
+            uint32_t value;
+            if (!str_to_num(it->second.c_str(), 10, value)) {
+                LOGE("%s: Invalid header field: %s=%s", manifest_path.c_str(),
+                     field.key, it->second.c_str());
+                return false;
+            }
+            (header.value().*field.set)(value);
+        }
+    }
+
+    if (auto r = writer.write_header(header.value()); !r) {
+        LOGE("%s: Failed to write header: %s",
+             output_path.c_str(), r.error().message().c_str());
+        return false;
+    }
+
+    while (true) {
+        auto entry = writer.get_entry();
+        if (!entry) {
+            if (entry.error() == WriterError::EndOfEntries) {
+                break;
+            }
+            LOGE("%s: Failed to get entry: %s",
+                 output_path.c_str(), entry.error().message().c_str());
+            return false;
+        }
+
+        auto type = entry.value().type();
+
+        if (auto r = writer.write_entry(entry.value()); !r) {
+            LOGE("%s: Failed to write entry: %s",
+                 output_path.c_str(), r.error().message().c_str());
+            return false;
+        }
+
+        // Loki images embed the device's aboot, which is not part of the
+        // original boot image
+        if (type == EntryType::Aboot) {
+            if (!bi_copy_file_to_data(ABOOT_PARTITION, writer)) {
+                return false;
+            }
+            continue;
+        }
+
+        auto it = manifest.entries.find(static_cast<int>(type));
+        if (it == manifest.entries.end()) {
+            continue;
+        }
+
+        bool ret = read_blob(manifest.store_dir, it->second,
+                             [&](const void *data, size_t size) {
+            if (auto r = writer.write_data(data, size); !r) {
+                LOGE("%s: Failed to write entry data: %s",
+                     output_path.c_str(), r.error().message().c_str());
+                return false;
+            }
+            return true;
+        });
+        if (!ret) {
+            return false;
+        }
+    }
+
+    if (auto r = writer.close(); !r) {
+        LOGE("%s: Failed to close boot image: %s",
+             output_path.c_str(), r.error().message().c_str());
+        return false;
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Check that every blob referenced by a manifest is intact
+ *
+ * \param manifest_path Path to manifest
+ * \param store_dir Store directory to use instead of the one recorded in the
+ *                  manifest (may be empty)
+ *
+ * \return Whether all of the blobs are present and intact
+ */
+bool boot_store_verify(const std::string &manifest_path,
+                       const std::string &store_dir)
+{
+    Manifest manifest;
+
+    if (!read_manifest(manifest_path, store_dir, manifest)) {
+        return false;
+    }
+
+    bool ret = true;
+
+    // Keep going to report every bad blob
+    for (auto const &item : manifest.entries) {
+        if (!read_blob(manifest.store_dir, item.second,
+                       [](const void *, size_t) {
+            return true;
+        })) {
+            ret = false;
+        }
+    }
+
+    return ret;
+}
+
+}
@@ -25,6 +25,7 @@
 
 #include <unistd.h>
 
+#include "mbcommon/file/mmap.h"
 #include "mblog/logging.h"
 
 #define LOG_TAG "mbtool/recovery/bootimg_util"
@@ -38,8 +39,57 @@ using namespace mb::bootimg;
 namespace mb
 {
 
+/*!
+ * \brief Open boot image, memory mapping it if possible
+ *
+ * If the file can be mapped, the bi_copy_data_*() functions will copy entry
+ * data directly out of the mapping instead of through an intermediate buffer.
+ *
+ * \param reader Reader with the formats to detect already enabled
+ * \param path Path to boot image file or block device
+ *
+ * \return Nothing if the boot image is successfully opened. Otherwise, the
+ *         error code.
+ */
+oc::result<void> bi_open_mapped(Reader &reader, const std::string &path)
+{
+    auto file = std::make_unique<MmapFile>();
+
+    if (file->open(path)) {
+        return reader.open(std::move(file));
+    }
+
+    return reader.open_filename(path);
+}
+
+static bool write_fully(int fd, const void *buf, size_t size)
+{
+    auto ptr = static_cast<const char *>(buf);
+
+    while (size > 0) {
+        ssize_t n_written = write(fd, ptr, size);
+        if (n_written <= 0) {
+            LOGE("Failed to write data: %s", strerror(errno));
+            return false;
+        }
+
+        ptr += n_written;
+        size -= static_cast<size_t>(n_written);
+    }
+
+    return true;
+}
+
 bool bi_copy_data_to_fd(Reader &reader, int fd)
 {
+    if (auto view = reader.read_data_view()) {
+        return write_fully(fd, view.value().data, view.value().size);
+    } else if (view.error() != ReaderError::UnsupportedDataView) {
+        LOGE("Failed to read boot image entry data: %s",
+             view.error().message().c_str());
+        return false;
+    }
+
     char buf[BUF_SIZE];
 
     while (true) {
@@ -52,17 +102,8 @@ bool bi_copy_data_to_fd(Reader &reader, int fd)
             break;
         }
 
-        size_t remain = n_read.value();
-
-        while (remain > 0) {
-            ssize_t n_written = write(
-                    fd, buf + (n_read.value() - remain), remain);
-            if (n_written <= 0) {
-                LOGE("Failed to write data: %s", strerror(errno));
-                return false;
-            }
-
-            remain -= static_cast<size_t>(n_written);
+        if (!write_fully(fd, buf, n_read.value())) {
+            return false;
         }
     }
 
@@ -141,29 +182,4 @@ bool bi_copy_data_to_file(Reader &reader, const std::string &path)
     return true;
 }
 
-bool bi_copy_data_to_data(Reader &reader, Writer &writer)
-{
-    char buf[10240];
-
-    while (true) {
-        auto n_read = reader.read_data(buf, sizeof(buf));
-        if (!n_read) {
-            LOGE("Failed to read boot image entry data: %s",
-                 n_read.error().message().c_str());
-            return false;
-        } else if (n_read.value() == 0) {
-            break;
-        }
-
-        auto n_written = writer.write_data(buf, n_read.value());
-        if (!n_written) {
-            LOGE("Failed to write entry data: %s",
-                 n_written.error().message().c_str());
-            return false;
-        }
-    }
-
-    return true;
-}
-
 }
@@ -0,0 +1,1314 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "recovery/chunk_store.h"
+
+#include <algorithm>
+#include <array>
+#include <map>
+#include <set>
+#include <string_view>
+#include <utility>
+
+#include <cerrno>
+#include <cinttypes>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/syscall.h>
+#include <sys/xattr.h>
+#include <unistd.h>
+
+#include <openssl/sha.h>
+
+#include "mbcommon/finally.h"
+#include "mblog/logging.h"
+#include "mbutil/delete.h"
+#include "mbutil/directory.h"
+#include "mbutil/file.h"
+#include "mbutil/copy.h"
+#include "mbutil/fts.h"
+#include "mbutil/page_cache.h"
+#include "mbutil/path.h"
+
+#define LOG_TAG "mbtool/recovery/chunk_store"
+
+#define MANIFEST_MAGIC          "MBSNAP01"
+
+namespace mb
+{
+
+// A snapshot of a directory tree consists of a manifest, which lists every
+// file along with its metadata, and a chunk store shared by all snapshots.
+// File contents are split into variable-size chunks at content-defined
+// boundaries (FastCDC-style gear hashing), so an insertion or deletion only
+// changes the chunks around it. Chunks are named after the hash of their
+// contents and are only ever written once, so unchanged data is not stored
+// again by later snapshots.
+//
+// Store layout:
+//   <store>/chunks/<first 2 hex digits>/<64 hex digits>
+
+constexpr size_t CHUNK_SIZE_MIN = 16 * 1024;
+constexpr size_t CHUNK_SIZE_AVG = 64 * 1024;
+constexpr size_t CHUNK_SIZE_MAX = 256 * 1024;
+
+// Normalized chunking: cut points are harder to match before the average size
+// is reached and easier after, which narrows the chunk size distribution
+constexpr uint64_t CHUNK_MASK_SMALL = 0xffffc00000000000ull; // 18 bits
+constexpr uint64_t CHUNK_MASK_LARGE = 0xfffc000000000000ull; // 14 bits
+
+// Chunks are identified by the first 256 bits of the SHA-512 digest of their
+// contents
+constexpr size_t CHUNK_ID_SIZE = 32;
+
+using ChunkId = std::array<unsigned char, CHUNK_ID_SIZE>;
+
+enum class EntryType : uint8_t
+{
+    Directory,
+    File,
+    Symlink,
+    // Another name for a file that appeared earlier in the manifest
+    HardLink,
+    // Block device, character device, or FIFO
+    Special,
+};
+
+struct ChunkRef
+{
+    ChunkId id;
+    uint64_t size;
+};
+
+struct ManifestEntry
+{
+    EntryType type;
+    // Relative to the snapshot root (empty for the root itself)
+    std::string path;
+    mode_t mode;
+    uid_t uid;
+    gid_t gid;
+    dev_t rdev;
+    timespec mtime;
+    std::vector<std::pair<std::string, std::string>> xattrs;
+    // Symlink target or path of the hard link's original
+    std::string target;
+    std::vector<ChunkRef> chunks;
+};
+
+struct ManifestHeader
+{
+    char magic[8];
+    uint64_t size;
+    // SHA-512 digest of the manifest data that follows the header
+    unsigned char digest[SHA512_DIGEST_LENGTH];
+};
+
+static constexpr std::array<uint64_t, 256> make_gear_table()
+{
+    std::array<uint64_t, 256> table{};
+    uint64_t state = 0x9e3779b97f4a7c15ull;
+
+    // splitmix64
+    for (auto &value : table) {
+        state += 0x9e3779b97f4a7c15ull;
+        uint64_t z = state;
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+        value = z ^ (z >> 31);
+    }
+
+    return table;
+}
+
+static constexpr auto GEAR_TABLE = make_gear_table();
+
+/*!
+ * \brief Find the end of the next chunk
+ *
+ * \param data Unchunked data
+ * \param size Size of \a data (only the first CHUNK_SIZE_MAX bytes are used)
+ *
+ * \return Size of the chunk at the beginning of \a data
+ */
+static size_t find_cut_point(const unsigned char *data, size_t size)
+{
+    if (size <= CHUNK_SIZE_MIN) {
+        return size;
+    }
+
+    size = std::min(size, CHUNK_SIZE_MAX);
+    size_t normal = std::min(size, CHUNK_SIZE_AVG);
+    uint64_t fp = 0;
+    size_t i = CHUNK_SIZE_MIN;
+
+    for (; i < normal; ++i) {
+        fp = (fp << 1) + GEAR_TABLE[data[i]];
+        if (!(fp & CHUNK_MASK_SMALL)) {
+            return i + 1;
+        }
+    }
+
+    for (; i < size; ++i) {
+        fp = (fp << 1) + GEAR_TABLE[data[i]];
+        if (!(fp & CHUNK_MASK_LARGE)) {
+            return i + 1;
+        }
+    }
+
+    return size;
+}
+
+static ChunkId compute_chunk_id(const unsigned char *data, size_t size)
+{
+    unsigned char digest[SHA512_DIGEST_LENGTH];
+    ChunkId id;
+
+    SHA512(data, size, digest);
+    memcpy(id.data(), digest, id.size());
+
+    return id;
+}
+
+static std::string chunk_id_hex(const ChunkId &id)
+{
+    static constexpr char digits[] = "0123456789abcdef";
+    std::string hex;
+
+    hex.reserve(id.size() * 2);
+    for (unsigned char c : id) {
+        hex += digits[c >> 4];
+        hex += digits[c & 0xf];
+    }
+
+    return hex;
+}
+
+static bool read_fully(int fd, unsigned char *buf, size_t size, size_t &n_read)
+{
+    n_read = 0;
+
+    while (n_read < size) {
+        ssize_t n = read(fd, buf + n_read, size - n_read);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        } else if (n == 0) {
+            break;
+        }
+        n_read += static_cast<size_t>(n);
+    }
+
+    return true;
+}
+
+static bool write_fully(int fd, const unsigned char *buf, size_t size)
+{
+    while (size > 0) {
+        ssize_t n = write(fd, buf, size);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        buf += n;
+        size -= static_cast<size_t>(n);
+    }
+
+    return true;
+}
+
+class ChunkStore
+{
+public:
+    explicit ChunkStore(std::string dir) : m_dir(std::move(dir))
+    {
+    }
+
+    std::string chunk_path(const ChunkId &id) const
+    {
+        std::string hex = chunk_id_hex(id);
+
+        std::string path(m_dir);
+        path += "/chunks/";
+        path += hex.substr(0, 2);
+        path += '/';
+        path += hex;
+
+        return path;
+    }
+
+    /*!
+     * \brief Add a chunk to the store if it isn't already there
+     *
+     * Multiple processes may add chunks to the same store concurrently. Each
+     * one writes to its own temporary file and renames it into place, which
+     * is harmless if another process stored the same chunk first.
+     */
+    bool put(const unsigned char *data, size_t size, ChunkId &id)
+    {
+        id = compute_chunk_id(data, size);
+        std::string path = chunk_path(id);
+
+        struct stat sb;
+        if (stat(path.c_str(), &sb) == 0
+                && static_cast<uint64_t>(sb.st_size) == size) {
+            ++reused_chunks;
+            reused_bytes += size;
+            return true;
+        }
+
+        if (auto r = util::mkdir_recursive(util::dir_name(path), 0700); !r) {
+            LOGE("%s: Failed to create directory: %s",
+                 path.c_str(), r.error().message().c_str());
+            return false;
+        }
+
+        std::string temp_path(path);
+        temp_path += '.';
+        temp_path += std::to_string(getpid());
+        temp_path += ".tmp";
+
+        if (auto r = util::file_write_data(
+                temp_path, reinterpret_cast<const char *>(data), size); !r) {
+            LOGE("%s: Failed to write chunk: %s",
+                 temp_path.c_str(), r.error().message().c_str());
+            unlink(temp_path.c_str());
+            return false;
+        }
+
+        if (rename(temp_path.c_str(), path.c_str()) < 0) {
+            LOGE("%s: Failed to rename chunk: %s",
+                 temp_path.c_str(), strerror(errno));
+            unlink(temp_path.c_str());
+            return false;
+        }
+
+        ++new_chunks;
+        new_bytes += size;
+        return true;
+    }
+
+    bool get(const ChunkRef &ref, std::string &data) const
+    {
+        std::string path = chunk_path(ref.id);
+
+        auto contents = util::file_read_all(path);
+        if (!contents) {
+            LOGE("%s: Failed to read chunk: %s",
+                 path.c_str(), contents.error().message().c_str());
+            return false;
+        }
+
+        data = std::move(contents.value());
+
+        if (data.size() != ref.size || compute_chunk_id(
+                reinterpret_cast<const unsigned char *>(data.data()),
+                data.size()) != ref.id) {
+            LOGE("%s: Chunk is corrupted", path.c_str());
+            return false;
+        }
+
+        return true;
+    }
+
+    bool sync()
+    {
+        int fd = open(m_dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd < 0) {
+            LOGE("%s: Failed to open directory: %s",
+                 m_dir.c_str(), strerror(errno));
+            return false;
+        }
+
+        auto close_fd = finally([&] {
+            close(fd);
+        });
+
+        if (syscall(__NR_syncfs, fd) < 0) {
+            LOGE("%s: Failed to sync: %s", m_dir.c_str(), strerror(errno));
+            return false;
+        }
+
+        return true;
+    }
+
+    uint64_t new_chunks = 0;
+    uint64_t new_bytes = 0;
+    uint64_t reused_chunks = 0;
+    uint64_t reused_bytes = 0;
+
+private:
+    std::string m_dir;
+};
+
+static void put_u64(std::string &out, uint64_t value)
+{
+    out.append(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+static void put_string(std::string &out, std::string_view value)
+{
+    put_u64(out, value.size());
+    out += value;
+}
+
+static void put_entry(std::string &out, const ManifestEntry &entry)
+{
+    put_u64(out, static_cast<uint64_t>(entry.type));
+    put_string(out, entry.path);
+    put_u64(out, entry.mode);
+    put_u64(out, entry.uid);
+    put_u64(out, entry.gid);
+    put_u64(out, entry.rdev);
+    put_u64(out, static_cast<uint64_t>(entry.mtime.tv_sec));
+    put_u64(out, static_cast<uint64_t>(entry.mtime.tv_nsec));
+
+    put_u64(out, entry.xattrs.size());
+    for (auto const &[name, value] : entry.xattrs) {
+        put_string(out, name);
+        put_string(out, value);
+    }
+
+    put_string(out, entry.target);
+
+    put_u64(out, entry.chunks.size());
+    for (auto const &chunk : entry.chunks) {
+        out.append(reinterpret_cast<const char *>(chunk.id.data()),
+                   chunk.id.size());
+        put_u64(out, chunk.size);
+    }
+}
+
+class ManifestReader
+{
+public:
+    explicit ManifestReader(std::string_view data) : m_data(data)
+    {
+    }
+
+    bool at_end() const
+    {
+        return m_data.empty();
+    }
+
+    template<typename T>
+    bool get_int(T &value)
+    {
+        uint64_t raw;
+        if (m_data.size() < sizeof(raw)) {
+            return false;
+        }
+        memcpy(&raw, m_data.data(), sizeof(raw));
+        m_data.remove_prefix(sizeof(raw));
+        value = static_cast<T>(raw);
+        return true;
+    }
+
+    bool get_bytes(unsigned char *buf, size_t size)
+    {
+        if (m_data.size() < size) {
+            return false;
+        }
+        memcpy(buf, m_data.data(), size);
+        m_data.remove_prefix(size);
+        return true;
+    }
+
+    bool get_string(std::string &value)
+    {
+        uint64_t size;
+        if (!get_int(size) || m_data.size() < size) {
+            return false;
+        }
+        value = m_data.substr(0, size);
+        m_data.remove_prefix(size);
+        return true;
+    }
+
+    bool get_entry(ManifestEntry &entry)
+    {
+        uint64_t n_xattrs;
+        uint64_t n_chunks;
+
+        if (!get_int(entry.type)
+                || entry.type > EntryType::Special
+                || !get_string(entry.path)
+                || !get_int(entry.mode)
+                || !get_int(entry.uid)
+                || !get_int(entry.gid)
+                || !get_int(entry.rdev)
+                || !get_int(entry.mtime.tv_sec)
+                || !get_int(entry.mtime.tv_nsec)
+                || !get_int(n_xattrs)) {
+            return false;
+        }
+
+        entry.xattrs.clear();
+        for (uint64_t i = 0; i < n_xattrs; ++i) {
+            std::string name;
+            std::string value;
+            if (!get_string(name) || !get_string(value)) {
+                return false;
+            }
+            entry.xattrs.emplace_back(std::move(name), std::move(value));
+        }
+
+        if (!get_string(entry.target) || !get_int(n_chunks)) {
+            return false;
+        }
+
+        entry.chunks.clear();
+        for (uint64_t i = 0; i < n_chunks; ++i) {
+            ChunkRef chunk;
+            if (!get_bytes(chunk.id.data(), chunk.id.size())
+                    || !get_int(chunk.size)) {
+                return false;
+            }
+            entry.chunks.push_back(chunk);
+        }
+
+        // Reject paths that would escape the restore directory
+        if (entry.path.compare(0, 1, "/") == 0
+                || entry.path == ".." || entry.path.compare(0, 3, "../") == 0
+                || entry.path.find("/../") != std::string::npos
+                || (entry.path.size() >= 3 && entry.path.compare(
+                        entry.path.size() - 3, 3, "/..") == 0)) {
+            return false;
+        }
+
+        return true;
+    }
+
+private:
+    std::string_view m_data;
+};
+
+static bool read_xattrs(const char *path,
+                        std::vector<std::pair<std::string, std::string>> &out)
+{
+    out.clear();
+
+    ssize_t size = llistxattr(path, nullptr, 0);
+    if (size < 0) {
+        // Not an error if the filesystem doesn't support xattrs
+        return errno == ENOTSUP;
+    } else if (size == 0) {
+        return true;
+    }
+
+    std::string names(static_cast<size_t>(size), '\0');
+    size = llistxattr(path, names.data(), names.size());
+    if (size < 0) {
+        return false;
+    }
+    names.resize(static_cast<size_t>(size));
+
+    for (size_t pos = 0; pos < names.size();) {
+        std::string name(names.c_str() + pos);
+        pos += name.size() + 1;
+
+        ssize_t value_size = lgetxattr(path, name.c_str(), nullptr, 0);
+        if (value_size < 0) {
+            return false;
+        }
+
+        std::string value(static_cast<size_t>(value_size), '\0');
+        value_size = lgetxattr(path, name.c_str(), value.data(), value.size());
+        if (value_size < 0) {
+            return false;
+        }
+        value.resize(static_cast<size_t>(value_size));
+
+        out.emplace_back(std::move(name), std::move(value));
+    }
+
+    return true;
+}
+
+class SnapshotWalker : public util::FtsWrapper
+{
+public:
+    SnapshotWalker(std::string path, const std::vector<std::string> &exclusions,
+                   ChunkStore &store, std::string &manifest,
+                   util::CopyProgress *progress)
+        : FtsWrapper(std::move(path), util::FtsFlag::GroupSpecialFiles)
+        , m_exclusions(exclusions)
+        , m_store(store)
+        , m_manifest(manifest)
+        , m_progress(progress)
+        , m_buf(CHUNK_SIZE_MAX * 4)
+    {
+    }
+
+    Actions on_changed_path() override
+    {
+        switch (_curr->fts_info) {
+        case FTS_DNR:
+        case FTS_ERR:
+        case FTS_NS:
+            _error_msg = format_error("Failed to read", _curr->fts_errno);
+            return Action::Fail;
+        }
+
+        if (_curr->fts_level == 1
+                && std::find(m_exclusions.begin(), m_exclusions.end(),
+                             _curr->fts_name) != m_exclusions.end()) {
+            return Action::Skip;
+        }
+
+        return Action::Ok;
+    }
+
+    Actions on_reached_directory_pre() override
+    {
+        ManifestEntry entry;
+        if (!init_entry(entry, EntryType::Directory)) {
+            return Action::Fail;
+        }
+
+        put_entry(m_manifest, entry);
+        return Action::Ok;
+    }
+
+    Actions on_reached_file() override
+    {
+        ManifestEntry entry;
+        auto *sb = _curr->fts_statp;
+
+        if (sb->st_nlink > 1) {
+            auto key = std::make_pair(sb->st_dev, sb->st_ino);
+            auto it = m_links.find(key);
+
+            if (it != m_links.end()) {
+                entry.type = EntryType::HardLink;
+                entry.path = relative_path();
+                entry.mode = sb->st_mode;
+                entry.uid = sb->st_uid;
+                entry.gid = sb->st_gid;
+                entry.rdev = 0;
+                entry.mtime = sb->st_mtim;
+                entry.target = it->second;
+
+                put_entry(m_manifest, entry);
+                return Action::Ok;
+            }
+
+            m_links.emplace(key, relative_path());
+        }
+
+        if (!init_entry(entry, EntryType::File) || !chunk_file(entry)) {
+            return Action::Fail;
+        }
+
+        if (m_progress) {
+            m_progress->files.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        put_entry(m_manifest, entry);
+        return Action::Ok;
+    }
+
+    Actions on_reached_symlink() override
+    {
+        ManifestEntry entry;
+        if (!init_entry(entry, EntryType::Symlink)) {
+            return Action::Fail;
+        }
+
+        auto target = util::read_link(_curr->fts_accpath);
+        if (!target) {
+            _error_msg = format_error("Failed to read symlink",
+                                      target.error().value());
+            return Action::Fail;
+        }
+        entry.target = std::move(target.value());
+
+        put_entry(m_manifest, entry);
+        return Action::Ok;
+    }
+
+    Actions on_reached_special_file() override
+    {
+        // Sockets can't be restored meaningfully
+        if (S_ISSOCK(_curr->fts_statp->st_mode)) {
+            return Action::Ok;
+        }
+
+        ManifestEntry entry;
+        if (!init_entry(entry, EntryType::Special)) {
+            return Action::Fail;
+        }
+
+        put_entry(m_manifest, entry);
+        return Action::Ok;
+    }
+
+private:
+    const std::vector<std::string> &m_exclusions;
+    ChunkStore &m_store;
+    std::string &m_manifest;
+    util::CopyProgress *m_progress;
+    std::vector<unsigned char> m_buf;
+    // (dev, inode) -> relative path of first occurrence
+    std::map<std::pair<dev_t, ino_t>, std::string> m_links;
+
+    std::string format_error(const char *msg, int error)
+    {
+        std::string result(_curr->fts_path);
+        result += ": ";
+        result += msg;
+        result += ": ";
+        result += strerror(error);
+        return result;
+    }
+
+    std::string relative_path() const
+    {
+        std::string_view path(_curr->fts_path);
+        path.remove_prefix(std::min(path.size(), _path.size()));
+        while (!path.empty() && path.front() == '/') {
+            path.remove_prefix(1);
+        }
+        return std::string(path);
+    }
+
+    bool init_entry(ManifestEntry &entry, EntryType type)
+    {
+        auto *sb = _curr->fts_statp;
+
+        entry.type = type;
+        entry.path = relative_path();
+        entry.mode = sb->st_mode;
+        entry.uid = sb->st_uid;
+        entry.gid = sb->st_gid;
+        entry.rdev = type == EntryType::Special ? sb->st_rdev : 0;
+        entry.mtime = sb->st_mtim;
+
+        if (!read_xattrs(_curr->fts_accpath, entry.xattrs)) {
+            _error_msg = format_error("Failed to read xattrs", errno);
+            return false;
+        }
+
+        return true;
+    }
+
+    bool chunk_file(ManifestEntry &entry)
+    {
+        int fd = open(_curr->fts_accpath, O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+        if (fd < 0) {
+            _error_msg = format_error("Failed to open", errno);
+            return false;
+        }
+
+        auto close_fd = finally([&] {
+            close(fd);
+        });
+
+        util::StreamCache cache(fd, util::StreamDirection::Read);
+        uint64_t offset = 0;
+
+        size_t begin = 0;
+        size_t end = 0;
+        bool eof = false;
+
+        while (true) {
+            // Keep at least one maximum-size chunk buffered so that cut points
+            // don't depend on read sizes
+            if (!eof && end - begin < CHUNK_SIZE_MAX) {
+                memmove(m_buf.data(), m_buf.data() + begin, end - begin);
+                end -= begin;
+                begin = 0;
+
+                size_t n;
+                if (!read_fully(fd, m_buf.data() + end, m_buf.size() - end,
+                                n)) {
+                    _error_msg = format_error("Failed to read", errno);
+                    return false;
+                }
+                end += n;
+                eof = end < m_buf.size();
+
+                offset += n;
+                cache.advance(offset);
+            }
+
+            if (begin == end) {
+                break;
+            }
+
+            size_t size = find_cut_point(m_buf.data() + begin, end - begin);
+
+            ChunkRef chunk;
+            chunk.size = size;
+            if (!m_store.put(m_buf.data() + begin, size, chunk.id)) {
+                _error_msg = std::string(_curr->fts_path)
+                        + ": Failed to store chunk";
+                return false;
+            }
+            entry.chunks.push_back(chunk);
+
+            if (m_progress) {
+                m_progress->bytes.fetch_add(size, std::memory_order_relaxed);
+            }
+
+            begin += size;
+        }
+
+        return true;
+    }
+};
+
+/*!
+ * \brief Create an incremental snapshot of a directory
+ *
+ * Only chunks that aren't already present in \a store_dir are written. The
+ * manifest records \a store_dir, so a snapshot can be restored without
+ * specifying the store again as long as it hasn't moved.
+ *
+ * \param manifest_path Output manifest file
+ * \param store_dir Chunk store directory (created if it doesn't exist)
+ * \param directory Directory to snapshot
+ * \param exclusions List of top-level directories to exclude
+ * \param progress Optional counters for the bytes and regular files read
+ *
+ * \return Whether the snapshot was successfully created
+ */
+bool snapshot_create(const std::string &manifest_path,
+                     const std::string &store_dir,
+                     const std::string &directory,
+                     const std::vector<std::string> &exclusions,
+                     util::CopyProgress *progress)
+{
+    if (auto r = util::mkdir_recursive(store_dir, 0700); !r) {
+        LOGE("%s: Failed to create directory: %s",
+             store_dir.c_str(), r.error().message().c_str());
+        return false;
+    }
+
+    auto abs_store_dir = util::real_path(store_dir);
+    if (!abs_store_dir) {
+        LOGE("%s: Failed to resolve path: %s",
+             store_dir.c_str(), abs_store_dir.error().message().c_str());
+        return false;
+    }
+
+    ChunkStore store(abs_store_dir.value());
+    std::string manifest;
+
+    put_string(manifest, abs_store_dir.value());
+
+    SnapshotWalker walker(directory, exclusions, store, manifest, progress);
+    if (!walker.run()) {
+        LOGE("%s", walker.error().c_str());
+        return false;
+    }
+
+    // Make sure that all chunks are on disk before the manifest that
+    // references them
+    if (!store.sync()) {
+        return false;
+    }
+
+    ManifestHeader header = {};
+    memcpy(header.magic, MANIFEST_MAGIC, sizeof(header.magic));
+    header.size = manifest.size();
+    SHA512(reinterpret_cast<const unsigned char *>(manifest.data()),
+           manifest.size(), header.digest);
+
+    manifest.insert(0, reinterpret_cast<const char *>(&header),
+                    sizeof(header));
+
+    std::string temp_path = manifest_path + ".tmp";
+
+    if (auto r = util::file_write_data(temp_path, manifest.data(),
+                                       manifest.size()); !r) {
+        LOGE("%s: Failed to write manifest: %s",
+             temp_path.c_str(), r.error().message().c_str());
+        unlink(temp_path.c_str());
+        return false;
+    }
+
+    if (rename(temp_path.c_str(), manifest_path.c_str()) < 0) {
+        LOGE("%s: Failed to rename manifest: %s",
+             temp_path.c_str(), strerror(errno));
+        unlink(temp_path.c_str());
+        return false;
+    }
+
+    LOGI("%s: Stored %" PRIu64 " new chunks (%" PRIu64 " bytes), reused %"
+         PRIu64 " chunks (%" PRIu64 " bytes)", directory.c_str(),
+         store.new_chunks, store.new_bytes, store.reused_chunks,
+         store.reused_bytes);
+
+    return true;
+}
+
+static bool restore_metadata(const std::string &path,
+                             const ManifestEntry &entry)
+{
+    // chown() clears the setuid/setgid bits and file capabilities, so it has
+    // to come first
+    if (lchown(path.c_str(), entry.uid, entry.gid) < 0) {
+        LOGE("%s: Failed to chown: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+
+    if (entry.type != EntryType::Symlink
+            && chmod(path.c_str(), entry.mode & 07777) < 0) {
+        LOGE("%s: Failed to chmod: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+
+    for (auto const &[name, value] : entry.xattrs) {
+        if (lsetxattr(path.c_str(), name.c_str(), value.data(), value.size(),
+                      0) < 0) {
+            // The ROM won't boot without its SELinux labels and capabilities,
+            // but other xattrs aren't essential
+            if (name.compare(0, 9, "security.") == 0) {
+                LOGE("%s: Failed to set xattr %s: %s",
+                     path.c_str(), name.c_str(), strerror(errno));
+                return false;
+            }
+            LOGW("%s: Failed to set xattr %s: %s",
+                 path.c_str(), name.c_str(), strerror(errno));
+        }
+    }
+
+    timespec times[2] = { entry.mtime, entry.mtime };
+    if (utimensat(AT_FDCWD, path.c_str(), times, AT_SYMLINK_NOFOLLOW) < 0) {
+        LOGE("%s: Failed to set modification time: %s",
+             path.c_str(), strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+static bool restore_file(const std::string &path, const ManifestEntry &entry,
+                         const ChunkStore &store, util::CopyProgress *progress)
+{
+    int fd = open(path.c_str(),
+                  O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | O_NOFOLLOW, 0600);
+    if (fd < 0) {
+        LOGE("%s: Failed to open: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+
+    auto close_fd = finally([&] {
+        close(fd);
+    });
+
+    std::string data;
+
+    for (auto const &chunk : entry.chunks) {
+        if (!store.get(chunk, data)) {
+            return false;
+        }
+
+        if (!write_fully(fd, reinterpret_cast<const unsigned char *>(
+                data.data()), data.size())) {
+            LOGE("%s: Failed to write: %s", path.c_str(), strerror(errno));
+            return false;
+        }
+
+        if (progress) {
+            progress->bytes.fetch_add(data.size(), std::memory_order_relaxed);
+        }
+    }
+
+    return true;
+}
+
+static bool timespec_equal(const timespec &a, const timespec &b)
+{
+    return a.tv_sec == b.tv_sec && a.tv_nsec == b.tv_nsec;
+}
+
+static uint64_t entry_size(const ManifestEntry &entry)
+{
+    uint64_t size = 0;
+    for (auto const &chunk : entry.chunks) {
+        size += chunk.size;
+    }
+    return size;
+}
+
+/*!
+ * \brief Check if an existing file's contents match the chunks of an entry
+ *
+ * The file is split at the entry's chunk boundaries and each piece is hashed,
+ * which is much cheaper on flash storage than rewriting the file.
+ */
+static bool contents_match(const std::string &path, const ManifestEntry &entry)
+{
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+    if (fd < 0) {
+        return false;
+    }
+
+    auto close_fd = finally([&] {
+        close(fd);
+    });
+
+    std::vector<unsigned char> buf(CHUNK_SIZE_MAX);
+
+    for (auto const &chunk : entry.chunks) {
+        size_t n;
+        if (chunk.size > buf.size()
+                || !read_fully(fd, buf.data(), chunk.size, n)
+                || n != chunk.size
+                || compute_chunk_id(buf.data(), n) != chunk.id) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Remove whatever is at the path of an entry
+ *
+ * Existing directories are kept if the entry is also a directory. Files are
+ * never overwritten in place since they may be hard links to other files.
+ */
+static bool remove_existing(const std::string &path, EntryType type)
+{
+    struct stat sb;
+    if (lstat(path.c_str(), &sb) < 0) {
+        if (errno == ENOENT) {
+            return true;
+        }
+        LOGE("%s: Failed to stat: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+
+    if (S_ISDIR(sb.st_mode)) {
+        if (type == EntryType::Directory) {
+            return true;
+        } else if (auto r = util::delete_recursive(path); !r) {
+            LOGE("%s: Failed to delete: %s",
+                 path.c_str(), r.error().message().c_str());
+            return false;
+        }
+    } else if (unlink(path.c_str()) < 0 && errno != ENOENT) {
+        LOGE("%s: Failed to delete: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+enum class FileState
+{
+    // Needs to be written
+    Changed,
+    // Same contents, but different metadata
+    SameContents,
+    // Contents and metadata match
+    Unchanged,
+};
+
+static FileState compare_file(const std::string &path,
+                              const ManifestEntry &entry)
+{
+    struct stat sb;
+    if (lstat(path.c_str(), &sb) < 0 || !S_ISREG(sb.st_mode)
+            || static_cast<uint64_t>(sb.st_size) != entry_size(entry)) {
+        return FileState::Changed;
+    }
+
+    if (sb.st_mode == entry.mode && sb.st_uid == entry.uid
+            && sb.st_gid == entry.gid
+            && timespec_equal(sb.st_mtim, entry.mtime)) {
+        return FileState::Unchanged;
+    }
+
+    // A hard-linked file would have the other names' metadata changed too
+    if (sb.st_nlink == 1 && contents_match(path, entry)) {
+        return FileState::SameContents;
+    }
+
+    return FileState::Changed;
+}
+
+// Read a manifest and check its digest. On success, body refers to the part of
+// contents after the header.
+static bool read_manifest(const std::string &manifest_path,
+                          std::string &contents, std::string_view &body)
+{
+    auto data = util::file_read_all(manifest_path);
+    if (!data) {
+        LOGE("%s: Failed to read manifest: %s",
+             manifest_path.c_str(), data.error().message().c_str());
+        return false;
+    }
+
+    contents = std::move(data.value());
+    body = contents;
+
+    ManifestHeader header;
+    unsigned char digest[SHA512_DIGEST_LENGTH];
+
+    if (body.size() < sizeof(header)) {
+        LOGE("%s: Manifest is truncated", manifest_path.c_str());
+        return false;
+    }
+
+    memcpy(&header, body.data(), sizeof(header));
+    body.remove_prefix(sizeof(header));
+
+    if (memcmp(header.magic, MANIFEST_MAGIC, sizeof(header.magic)) != 0) {
+        LOGE("%s: Not a snapshot manifest", manifest_path.c_str());
+        return false;
+    }
+
+    SHA512(reinterpret_cast<const unsigned char *>(body.data()), body.size(),
+           digest);
+    if (header.size != body.size()
+            || memcmp(header.digest, digest, sizeof(digest)) != 0) {
+        LOGE("%s: Manifest is corrupted", manifest_path.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Restore a snapshot into a directory
+ *
+ * Without SnapshotRestoreFlag::SkipUnchanged, the directory should be empty
+ * (except for any top-level directories that were excluded when the snapshot
+ * was created). With it, existing files whose metadata matches the manifest
+ * are left alone, files with matching contents only have their metadata
+ * updated, and everything else in the manifest is replaced. Files that are
+ * not in the manifest are not removed.
+ *
+ * \param manifest_path Snapshot manifest
+ * \param store_dir Chunk store directory or empty to use the one recorded in
+ *                  the manifest
+ * \param directory Target directory
+ * \param flags Restore flags
+ * \param entries If not null, the relative paths of all entries in the
+ *                manifest are appended to this list
+ * \param progress Optional counters for the bytes and regular files restored.
+ *                 Files that were left untouched are counted too.
+ *
+ * \return Whether the snapshot was successfully restored
+ */
+bool snapshot_restore(const std::string &manifest_path,
+                      const std::string &store_dir,
+                      const std::string &directory,
+                      SnapshotRestoreFlags flags,
+                      std::vector<std::string> *entries,
+                      util::CopyProgress *progress)
+{
+    std::string contents;
+    std::string_view data;
+
+    if (!read_manifest(manifest_path, contents, data)) {
+        return false;
+    }
+
+    ManifestReader reader(data);
+    std::string recorded_store_dir;
+
+    if (!reader.get_string(recorded_store_dir)) {
+        LOGE("%s: Manifest is corrupted", manifest_path.c_str());
+        return false;
+    }
+
+    ChunkStore store(store_dir.empty() ? recorded_store_dir : store_dir);
+    // Directory metadata is restored last since creating entries inside a
+    // directory changes its modification time
+    std::vector<std::pair<std::string, ManifestEntry>> dirs;
+    ManifestEntry entry;
+
+    while (!reader.at_end()) {
+        if (!reader.get_entry(entry)) {
+            LOGE("%s: Manifest is corrupted", manifest_path.c_str());
+            return false;
+        }
+
+        std::string path(directory);
+        if (!entry.path.empty()) {
+            path += '/';
+            path += entry.path;
+
+            if (entries) {
+                entries->push_back(entry.path);
+            }
+        }
+
+        if (flags & SnapshotRestoreFlag::SkipUnchanged) {
+            if (entry.type == EntryType::File) {
+                auto state = compare_file(path, entry);
+                if (state != FileState::Changed && progress) {
+                    progress->bytes.fetch_add(entry_size(entry),
+                                              std::memory_order_relaxed);
+                    progress->files.fetch_add(1, std::memory_order_relaxed);
+                }
+
+                if (state == FileState::Unchanged) {
+                    continue;
+                } else if (state == FileState::SameContents) {
+                    if (!restore_metadata(path, entry)) {
+                        return false;
+                    }
+                    continue;
+                }
+            }
+
+            if (!entry.path.empty() && !remove_existing(path, entry.type)) {
+                return false;
+            }
+        }
+
+        switch (entry.type) {
+        case EntryType::Directory:
+            if (mkdir(path.c_str(), 0700) < 0 && errno != EEXIST) {
+                LOGE("%s: Failed to create directory: %s",
+                     path.c_str(), strerror(errno));
+                return false;
+            }
+            dirs.emplace_back(std::move(path), std::move(entry));
+            continue;
+
+        case EntryType::File:
+            if (!restore_file(path, entry, store, progress)) {
+                return false;
+            }
+            if (progress) {
+                progress->files.fetch_add(1, std::memory_order_relaxed);
+            }
+            break;
+
+        case EntryType::Symlink:
+            if (symlink(entry.target.c_str(), path.c_str()) < 0) {
+                LOGE("%s: Failed to create symlink: %s",
+                     path.c_str(), strerror(errno));
+                return false;
+            }
+            break;
+
+        case EntryType::HardLink: {
+            std::string target(directory);
+            target += '/';
+            target += entry.target;
+
+            if (link(target.c_str(), path.c_str()) < 0) {
+                LOGE("%s: Failed to create hard link to %s: %s",
+                     path.c_str(), target.c_str(), strerror(errno));
+                return false;
+            }
+            // Metadata is shared with the original file
+            continue;
+        }
+
+        case EntryType::Special:
+            if (mknod(path.c_str(), entry.mode & ~07777, entry.rdev) < 0) {
+                LOGE("%s: Failed to create special file: %s",
+                     path.c_str(), strerror(errno));
+                return false;
+            }
+            break;
+        }
+
+        if (!restore_metadata(path, entry)) {
+            return false;
+        }
+    }
+
+    for (auto it = dirs.rbegin(); it != dirs.rend(); ++it) {
+        if (!restore_metadata(it->first, it->second)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Check that a snapshot can be restored
+ *
+ * The manifest digest is checked and every chunk referenced by the manifest is
+ * read from the store and hashed. Nothing is written.
+ *
+ * \param manifest_path Snapshot manifest
+ * \param store_dir Chunk store directory or empty to use the one recorded in
+ *                  the manifest
+ *
+ * \return Whether the manifest and all of its chunks are intact
+ */
+bool snapshot_verify(const std::string &manifest_path,
+                     const std::string &store_dir)
+{
+    std::string contents;
+    std::string_view data;
+
+    if (!read_manifest(manifest_path, contents, data)) {
+        return false;
+    }
+
+    ManifestReader reader(data);
+    std::string recorded_store_dir;
+
+    if (!reader.get_string(recorded_store_dir)) {
+        LOGE("%s: Manifest is corrupted", manifest_path.c_str());
+        return false;
+    }
+
+    ChunkStore store(store_dir.empty() ? recorded_store_dir : store_dir);
+    // Chunks shared by multiple files only need to be checked once
+    std::set<ChunkId> checked;
+    ManifestEntry entry;
+    std::string chunk_data;
+    uint64_t failed = 0;
+
+    while (!reader.at_end()) {
+        if (!reader.get_entry(entry)) {
+            LOGE("%s: Manifest is corrupted", manifest_path.c_str());
+            return false;
+        }
+
+        for (auto const &chunk : entry.chunks) {
+            if (checked.insert(chunk.id).second
+                    && !store.get(chunk, chunk_data)) {
+                // Keep going to report every bad chunk
+                ++failed;
+            }
+        }
+    }
+
+    if (failed > 0) {
+        LOGE("%s: %" PRIu64 " of %zu chunks are missing or corrupted",
+             manifest_path.c_str(), failed, checked.size());
+        return false;
+    }
+
+    return true;
+}
+
+}
@@ -21,9 +21,11 @@
 
 // C++
 #include <algorithm>
+#include <array>
 #include <chrono>
 
 // C
+#include <cinttypes>
 #include <cstring>
 
 // Linux/posix
@@ -34,6 +36,7 @@
 #include <sys/mount.h>
 #include <sys/stat.h>
 #include <sys/sysmacros.h>
+#include <sys/uio.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
@@ -100,6 +103,11 @@
 
 #define HELPER_TOOL             "/update-binary-tool"
 
+// Minimum interval between set_progress commands forwarded to the recovery.
+// Faster updates move the progress bar by invisible amounts, but each one
+// makes the recovery redraw the screen.
+#define PROGRESS_FORWARD_INTERVAL std::chrono::milliseconds(100)
+
 
 using namespace mb::device;
 
@@ -107,7 +115,6 @@ namespace mb
 {
 
 using ScopedDIR = std::unique_ptr<DIR, decltype(closedir) *>;
-using ScopedFILE = std::unique_ptr<FILE, decltype(fclose) *>;
 
 const std::string Installer::CANCELLED = "cancelled";
 
@@ -309,6 +316,71 @@ bool Installer::create_chroot()
         return false;
     }
 
+    if ((_flags & InstallerFlag::ReuseChroot) && reset_chroot()) {
+        LOGD("Reusing chroot from the previous installation");
+    } else if (!build_chroot()) {
+        return false;
+    }
+
+    // Copy properties for read-only access if legacy properties are not
+    // supported. These are copied for every installation because they may
+    // have changed since the chroot was built.
+    for (auto const &path : {
+        // TWRP properties backup when legacy properties are enabled
+        PROPERTIES_CTX_TWRP_BACKUP,
+        // Standard properties path
+        PROPERTIES_CTX,
+    }) {
+        LOGV("Looking for properties at: %s", path);
+
+        if (struct stat sb; log_stat(path, &sb) == 0) {
+            if (S_ISDIR(sb.st_mode)) {
+                LOGV("Found >=7.0 style properties");
+
+                if (!log_copy_dir(path, in_chroot(CHROOT_PROPERTIES),
+                                  util::CopyFlag::CopyAttributes
+                                | util::CopyFlag::CopyXattrs
+                                | util::CopyFlag::ExcludeTopLevel)) {
+                    return false;
+                }
+
+                break;
+            } else if (S_ISREG(sb.st_mode)) {
+                if (_api_ver >= 19) {
+                    LOGV("Found 4.4-6.0 style properties");
+
+                    if (!log_copy_file(path, in_chroot(CHROOT_PROPERTIES),
+                                       util::CopyFlag::CopyAttributes
+                                     | util::CopyFlag::CopyXattrs
+                                     | util::CopyFlag::ExcludeTopLevel)) {
+                        return false;
+                    }
+
+                    break;
+                } else {
+                    LOGW("Android <4.4 style properties are NOT SUPPORTED");
+                    LOGW("Flashing >=8.0 ROMs will fail");
+                }
+            }
+        }
+    }
+
+    // Mount EFS partition so patched Odin images can properly set up multi-CSC
+    if (!mount_efs()) {
+        return false;
+    }
+
+    (void) util::create_empty_file(in_chroot("/.chroot"));
+
+    return true;
+}
+
+/*!
+ * \brief Build the parts of the chroot that do not change between
+ *        installations
+ */
+bool Installer::build_chroot()
+{
     // Unmount everything previously mounted in the chroot
     if (!log_unmount_all(_chroot)) {
         return false;
@@ -416,59 +488,61 @@ bool Installer::create_chroot()
         return false;
     }
 
-    // Copy properties for read-only access if legacy properties are not
-    // supported
-    for (auto const &path : {
-        // TWRP properties backup when legacy properties are enabled
-        PROPERTIES_CTX_TWRP_BACKUP,
-        // Standard properties path
-        PROPERTIES_CTX,
-    }) {
-        LOGV("Looking for properties at: %s", path);
-
-        if (struct stat sb; log_stat(path, &sb) == 0) {
-            if (S_ISDIR(sb.st_mode)) {
-                LOGV("Found >=7.0 style properties");
+    return true;
+}
 
-                if (!log_copy_dir(path, in_chroot(CHROOT_PROPERTIES),
-                                  util::CopyFlag::CopyAttributes
-                                | util::CopyFlag::CopyXattrs
-                                | util::CopyFlag::ExcludeTopLevel)) {
-                    return false;
-                }
+/*!
+ * \brief Clear the per-installation state from a chroot left behind by the
+ *        previous installation
+ *
+ * \return Whether the chroot can be reused. If false, the chroot should be
+ *         rebuilt with build_chroot().
+ */
+bool Installer::reset_chroot()
+{
+    if (access(in_chroot("/.chroot").c_str(), F_OK) < 0) {
+        return false;
+    }
 
-                break;
-            } else if (S_ISREG(sb.st_mode)) {
-                if (_api_ver >= 19) {
-                    LOGV("Found 4.4-6.0 style properties");
+    for (auto const &path : { _chroot, in_chroot("/dev"),
+                              in_chroot("/dev/pts"), in_chroot("/proc"),
+                              in_chroot("/sys"), in_chroot("/tmp") }) {
+        if (!util::is_mounted(path)) {
+            LOGW("%s is not mounted; rebuilding chroot", path.c_str());
+            return false;
+        }
+    }
 
-                    if (!log_copy_file(path, in_chroot(CHROOT_PROPERTIES),
-                                       util::CopyFlag::CopyAttributes
-                                     | util::CopyFlag::CopyXattrs
-                                     | util::CopyFlag::ExcludeTopLevel)) {
-                        return false;
-                    }
+    // In case the previous installation did not finish cleaning up
+    if (!release_chroot()) {
+        return false;
+    }
 
-                    break;
-                } else {
-                    LOGW("Android <4.4 style properties are NOT SUPPORTED");
-                    LOGW("Flashing >=8.0 ROMs will fail");
-                }
-            }
+    for (auto const &path : { "/mb", "/tmp" }) {
+        if (auto r = util::delete_contents(in_chroot(path), {}); !r) {
+            LOGE("Failed to clear %s: %s",
+                 in_chroot(path).c_str(), r.error().message().c_str());
+            return false;
         }
     }
 
-    // Mount EFS partition so patched Odin images can properly set up multi-CSC
-    if (!mount_efs()) {
+    // Put back the busybox binary that was replaced by the wrapper script
+    std::string busybox_orig = in_chroot("/sbin/busybox_orig");
+    if (access(busybox_orig.c_str(), F_OK) == 0
+            && rename(busybox_orig.c_str(),
+                      in_chroot("/sbin/busybox").c_str()) < 0) {
+        LOGE("%s: Failed to restore: %s", busybox_orig.c_str(),
+             strerror(errno));
         return false;
     }
 
-    (void) util::create_empty_file(in_chroot("/.chroot"));
-
     return true;
 }
 
-bool Installer::destroy_chroot() const
+/*!
+ * \brief Undo the mounts and loop devices set up for a single installation
+ */
+bool Installer::release_chroot() const
 {
     // Disassociate loop devices that the ROM installer may have assigned
     // (grr, SuperSU...)
@@ -491,6 +565,37 @@ bool Installer::destroy_chroot() const
     log_umount(in_chroot("/data").c_str());
     log_umount(in_chroot("/efs").c_str());
 
+    // Bind mounts of the zip file and the ROM's partitions or images
+    if (auto ret = util::unmount_all(in_chroot("/mb")); !ret) {
+        LOGE("Failed to unmount mount points in %s: %s",
+             in_chroot("/mb").c_str(), ret.error().message().c_str());
+        return false;
+    }
+
+    if (_flags & InstallerFlag::ReuseChroot) {
+        // The mount namespace outlives this installation, so the partitions
+        // mounted by create_chroot() must be released explicitly
+        for (auto const &path : { "/system", "/cache", "/data", "/efs" }) {
+            if (util::is_mounted(path)) {
+                log_umount(path);
+            }
+        }
+    }
+
+    return true;
+}
+
+bool Installer::destroy_chroot() const
+{
+    if (!release_chroot()) {
+        return false;
+    }
+
+    if (_flags & InstallerFlag::ReuseChroot) {
+        LOGD("Keeping chroot for the next installation");
+        return true;
+    }
+
     log_umount(in_chroot("/dev/pts").c_str());
     log_umount(in_chroot("/dev").c_str());
     log_umount(in_chroot("/proc").c_str());
@@ -659,25 +764,30 @@ bool Installer::extract_multiboot_files()
         });
     }
 
-    if (!util::extract_files2(_zip_file, files)) {
+    if (!(_zip_index ? util::extract_files2(*_zip_index, files)
+                     : util::extract_files2(_zip_file, files))) {
         LOGE("Failed to extract all multiboot files");
         return false;
     }
 
-    std::vector<std::string> sigcheck{
+    std::vector<std::pair<std::string, std::string>> sigcheck;
+    for (auto const &item : {
         _temp + "/mbtool",
         _temp + "/bb-wrapper.sh",
         _temp + "/binaries/file-contexts-tool",
         _temp + "/binaries/fsck-wrapper",
         _temp + "/binaries/mbtool",
         _temp + "/binaries/mount.exfat",
-    };
+    }) {
+        sigcheck.emplace_back(item, item + ".sig");
+    }
 
-    for (auto const &item : sigcheck) {
-        SigVerifyResult result =
-                verify_signature(item.c_str(), (item + ".sig").c_str());
-        if (result != SigVerifyResult::Valid) {
-            LOGE("%s: Signature verification failed", item.c_str());
+    auto results = verify_signatures(sigcheck);
+
+    for (size_t i = 0; i < sigcheck.size(); ++i) {
+        if (results[i] != SigVerifyResult::Valid) {
+            LOGE("%s: Signature verification failed",
+                 sigcheck[i].first.c_str());
             return false;
         }
     }
@@ -740,6 +850,10 @@ bool Installer::create_image(const std::string &path, uint64_t size)
 /*!
  * \brief Copy a /system directory to an image file
  *
+ * After copying to the image, a snapshot of the image is taken. When copying
+ * back, only the files that changed since the snapshot are copied if one is
+ * available. Otherwise, \p source should be wiped beforehand.
+ *
  * \param source Source directory
  * \param image Target image file
  * \param reverse If non-zero, then the image file is the source and the
@@ -774,17 +888,32 @@ bool Installer::system_image_copy(const std::string &source,
     });
 
     if (reverse) {
-        if (!copy_system(temp_mnt, source)) {
+        if (_system_snapshot) {
+            if (!copy_system_changes(temp_mnt, source, *_system_snapshot)) {
+                LOGE("Failed to copy changed system files from %s to %s",
+                     temp_mnt.c_str(), source.c_str());
+                return false;
+            }
+        } else if (!copy_system(temp_mnt, source)) {
             LOGE("Failed to copy system files from %s to %s",
                  temp_mnt.c_str(), source.c_str());
             return false;
         }
     } else {
+        _system_snapshot.reset();
+
         if (!copy_system(source, temp_mnt)) {
             LOGE("Failed to copy system files from %s to %s",
                  source.c_str(), temp_mnt.c_str());
             return false;
         }
+
+        // Not fatal: the target will be wiped and fully copied back instead
+        if (SystemSnapshot snapshot; snapshot_system(temp_mnt, snapshot)) {
+            _system_snapshot = std::move(snapshot);
+        } else {
+            LOGW("Failed to snapshot %s", temp_mnt.c_str());
+        }
     }
 
     if (auto ret = util::umount(temp_mnt); !ret) {
@@ -972,72 +1101,158 @@ bool Installer::set_up_properties()
             : set_up_modern_properties();
 }
 
+/*!
+ * \brief Write an updater command line to the recovery's command fd
+ */
+static bool forward_command(int fd, std::string_view line)
+{
+    std::array<iovec, 2> iovs{{
+        { const_cast<char *>(line.data()), line.size() },
+        { const_cast<char *>("\n"), 1 },
+    }};
+    iovec *iov = iovs.data();
+    int iov_count = static_cast<int>(iovs.size());
+
+    while (iov_count > 0) {
+        ssize_t n = writev(fd, iov, iov_count);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+
+        auto written = static_cast<size_t>(n);
+        while (iov_count > 0 && written >= iov->iov_len) {
+            written -= iov->iov_len;
+            ++iov;
+            --iov_count;
+        }
+        if (iov_count > 0) {
+            iov->iov_base = static_cast<char *>(iov->iov_base) + written;
+            iov->iov_len -= written;
+        }
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Handle the updater's output and command pipes
+ *
+ * In passthrough mode, \p stdio_fd is -1 and commands are forwarded to the
+ * recovery. set_progress commands are coalesced to at most one every
+ * PROGRESS_FORWARD_INTERVAL. The latest pending one is always sent before any
+ * other command and when the updater exits, so the recovery never misses the
+ * final state.
+ *
+ * \param stdio_fd Updater's stdout and stderr (or -1)
+ * \param command_fd Updater's command pipe
+ */
 bool Installer::updater_fd_reader(int stdio_fd, int command_fd)
 {
-    int status;
-    pid_t pid = fork();
+    using std::chrono::steady_clock;
 
-    if (pid < 0) {
-        LOGE("Failed to fork updater fd reader process");
-    } else if (pid == 0) {
-        // Don't need command_fd in the child process
-        close(command_fd);
+    std::string pending_progress;
+    steady_clock::time_point last_progress;
+    uint64_t coalesced = 0;
+    bool forward_ok = true;
 
-        // Read program output in child process (stdout, stderr)
-        char buf[1024];
+    auto forward = [&](std::string_view line) {
+        if (forward_ok && !forward_command(_output_fd, line)) {
+            LOGE("Failed to forward updater command: %s", strerror(errno));
+            forward_ok = false;
+        }
+    };
 
-        ScopedFILE fp(fdopen(stdio_fd, "rb"), fclose);
-        if (!fp) {
-            _exit(EXIT_FAILURE);
+    auto flush_progress = [&] {
+        if (!pending_progress.empty()) {
+            forward(pending_progress);
+            pending_progress.clear();
+            last_progress = steady_clock::now();
         }
+    };
 
-        while (fgets(buf, sizeof(buf), fp.get())) {
-            command_output(buf);
+    // Read program output (stdout, stderr) and the special command fd
+    // together. Lines are handled in the order they arrive.
+    bool ret = util::fd_line_reader({stdio_fd, command_fd},
+                                    [&](size_t index, std::string_view line) {
+        if (index == 0) {
+            command_output(line);
+            return;
         }
 
-        _exit(EXIT_SUCCESS);
-    } else {
-        // Read special command fd in parent process
+        // Similar parsing to AOSP recovery
+        auto is_delim = [](char c) { return c == ' ' || c == '\n'; };
 
-        char buf[1024];
-        char *save_ptr;
+        while (!line.empty() && is_delim(line.front())) {
+            line.remove_prefix(1);
+        }
 
-        // Similar parsing to AOSP recovery
-        ScopedFILE fp(fdopen(command_fd, "rb"), fclose);
+        auto cmd_end = std::find_if(line.begin(), line.end(), is_delim);
+        std::string_view cmd = line.substr(
+                0, static_cast<size_t>(cmd_end - line.begin()));
+
+        if (cmd.empty()) {
+            return;
+        } else if (_passthrough) {
+            if (cmd == "set_progress") {
+                // Only the latest value matters
+                if (!pending_progress.empty()) {
+                    ++coalesced;
+                }
 
-        while (fgets(buf, sizeof(buf), fp.get())) {
-            char *cmd = strtok_r(buf, " \n", &save_ptr);
-            if (!cmd) {
-                continue;
-            } else if (strcmp(cmd, "progress") == 0
-                    || strcmp(cmd, "set_progress") == 0
-                    || strcmp(cmd, "wipe_cache") == 0
-                    || strcmp(cmd, "clear_display") == 0
-                    || strcmp(cmd, "enable_reboot") == 0) {
-                // Ignore
-            } else if (strcmp(cmd, "ui_print") == 0) {
-                char *str = strtok_r(nullptr, "\n", &save_ptr);
-                if (str) {
-                    updater_print(str);
-                } else {
-                    updater_print("\n");
+                auto now = steady_clock::now();
+                if (now - last_progress < PROGRESS_FORWARD_INTERVAL) {
+                    // The buffer's capacity is reused, so this does not
+                    // allocate after the first few updates
+                    pending_progress.assign(line);
+                    return;
                 }
+                pending_progress.clear();
+                last_progress = now;
             } else {
-                LOGE("Unknown updater command: %s", cmd);
+                flush_progress();
+            }
+            forward(line);
+        } else if (cmd == "progress"
+                || cmd == "set_progress"
+                || cmd == "wipe_cache"
+                || cmd == "clear_display"
+                || cmd == "enable_reboot") {
+            // Ignore
+        } else if (cmd == "ui_print") {
+            // Skip the delimiter following the command
+            auto str = line.substr(std::min(cmd.size() + 1, line.size()));
+
+            while (!str.empty() && str.front() == '\n') {
+                str.remove_prefix(1);
             }
-        }
 
-        do {
-            if (waitpid(pid, &status, 0) < 0) {
-                LOGE("Failed to waitpid(): %s", strerror(errno));
-                return false;
+            str = str.substr(0, str.find('\n'));
+
+            if (!str.empty()) {
+                updater_print(str);
+            } else {
+                updater_print("\n");
             }
-        } while (!WIFEXITED(status) && !WIFSIGNALED(status));
+        } else {
+            LOGE("Unknown updater command: %.*s",
+                 static_cast<int>(cmd.size()), cmd.data());
+        }
+    });
 
-        return true;
+    if (!ret) {
+        LOGE("Failed to read updater output: %s", strerror(errno));
     }
 
-    return false;
+    flush_progress();
+
+    if (coalesced > 0) {
+        LOGD("Coalesced %" PRIu64 " updater progress updates", coalesced);
+    }
+
+    return ret && forward_ok;
 }
 
 /*!
@@ -1097,15 +1312,15 @@ bool Installer::run_real_updater()
     pid_t pid;
     int pipe_fds[2];
     int stdio_fds[2];
-    if (!_passthrough) {
-        if (pipe(pipe_fds) < 0) {
-            return false;
-        }
-        if (pipe(stdio_fds) < 0) {
-            close(pipe_fds[0]);
-            close(pipe_fds[1]);
-            return false;
-        }
+    // The command pipe is read even in passthrough mode so that progress
+    // updates can be coalesced before they reach the recovery
+    if (pipe(pipe_fds) < 0) {
+        return false;
+    }
+    if (!_passthrough && pipe(stdio_fds) < 0) {
+        close(pipe_fds[0]);
+        close(pipe_fds[1]);
+        return false;
     }
 
     // Run updater in the chroot
@@ -1118,7 +1333,7 @@ bool Installer::run_real_updater()
 #endif
         "/mb/updater",
         format("%d", _interface),
-        format("%d", _passthrough ? _output_fd : pipe_fds[1]),
+        format("%d", pipe_fds[1]),
         "/mb/install.zip"
     };
 
@@ -1132,9 +1347,9 @@ bool Installer::run_real_updater()
 
     if ((pid = fork()) >= 0) {
         if (pid == 0) {
+            // Close read ends of the pipes
+            close(pipe_fds[0]);
             if (!_passthrough) {
-                // Close read ends of the pipes
-                close(pipe_fds[0]);
                 close(stdio_fds[0]);
             }
 
@@ -1174,16 +1389,19 @@ bool Installer::run_real_updater()
             LOGE("Failed to execute updater: %s", strerror(errno));
             _exit(127);
         } else {
+            // Close write ends of the pipes
+            close(pipe_fds[1]);
             if (!_passthrough) {
-                // Close write ends of the pipes
-                close(pipe_fds[1]);
                 close(stdio_fds[1]);
+            }
 
-                if (!updater_fd_reader(stdio_fds[0], pipe_fds[0])) {
-                    LOGW("Updater fd reader process failed");
-                }
+            if (!updater_fd_reader(_passthrough ? -1 : stdio_fds[0],
+                                   pipe_fds[0])) {
+                LOGW("Updater fd reader process failed");
+            }
 
-                close(pipe_fds[0]);
+            close(pipe_fds[0]);
+            if (!_passthrough) {
                 close(stdio_fds[0]);
             }
 
@@ -1213,6 +1431,12 @@ bool Installer::run_real_updater()
     if (pid < 0) {
         LOGE("Failed to execute %s: %s",
              "/mb/updater", strerror(errno));
+        close(pipe_fds[0]);
+        close(pipe_fds[1]);
+        if (!_passthrough) {
+            close(stdio_fds[0]);
+            close(stdio_fds[1]);
+        }
         return false;
     }
 
@@ -1377,13 +1601,26 @@ Installer::ProceedState Installer::install_stage_initialize()
 
     LOGD("[Installer] Initialization stage");
 
+    // ROM zips can be several GB, so read the central directory once and use
+    // it for every lookup and extraction
+    if (auto index = std::make_unique<util::ZipIndex>();
+            auto r = index->load(_zip_file)) {
+        LOGD("Indexed %zu zip entries", index->entries().size());
+        _zip_index = std::move(index);
+    } else {
+        LOGW("%s: Failed to read central directory: %s",
+             _zip_file.c_str(), r.error().message().c_str());
+    }
+
     std::vector<util::ExistsInfo> info{
         { "system.transfer.list", false },
         { "system.new.dat", false },
         { "system.img", false },
         { "system.img.sparse", false },
+        { "system.img.sparse.lz4", false },
     };
-    if (!util::archive_exists(_zip_file, info)) {
+    if (!(_zip_index ? util::archive_exists(*_zip_index, info)
+                     : util::archive_exists(_zip_file, info))) {
         LOGE("Failed to read zip file");
     } else {
         _has_block_image = false;
@@ -1394,7 +1631,7 @@ Installer::ProceedState Installer::install_stage_initialize()
                 // Flashing an Odin image discards the system image anyway, so
                 // there's no point in copying the data.
                 // TODO: libmbpatcher should be setting this option in info.prop
-                if (item.path != "system.img.sparse") {
+                if (!starts_with(item.path, "system.img.sparse")) {
                     _copy_to_temp_image = true;
                 }
                 break;
@@ -1554,13 +1791,17 @@ Installer::ProceedState Installer::install_stage_check_device()
     }
 
     // Other block devices to copy
-    std::vector<std::string> devs;
-    devs.insert(devs.end(), boot_devs.begin(), boot_devs.end());
-    devs.insert(devs.end(), recovery_devs.begin(), recovery_devs.end());
-    devs.insert(devs.end(), extra_devs.begin(), extra_devs.end());
+    ArenaVector<const std::string *> devs{
+            ArenaAllocator<const std::string *>(_arena)};
+    for (auto const *list : {&boot_devs, &recovery_devs, &extra_devs}) {
+        for (auto const &dev : *list) {
+            devs.push_back(&dev);
+        }
+    }
 
     // Copy block devices to the chroot
-    for (auto const &dev : devs) {
+    for (auto const *dev_ptr : devs) {
+        auto const &dev = *dev_ptr;
         std::string dev_path(in_chroot(dev));
 
         if (auto r = util::mkdir_parent(dev_path, 0755); !r) {
@@ -1899,15 +2140,15 @@ Installer::ProceedState Installer::install_stage_installation()
     run_command_chroot(_chroot, { HELPER_TOOL, "mount", "/system" });
 
     // Grab version and display ID so that can be cached in config.json later
-    if (auto props = util::property_file_get_all(in_chroot(BUILD_PROP_PATH))) {
+    if (util::PropertyFile props; props.load(in_chroot(BUILD_PROP_PATH))) {
         auto to_cache = {
             "ro.build.version.release",
             "ro.build.display.id",
         };
 
         for (auto const &prop : to_cache) {
-            if (auto it = props->find(prop); it != props->end()) {
-                _cached_prop[it->first] = it->second;
+            if (auto value = props.get(prop)) {
+                _cached_prop[prop] = *value;
             }
         }
     }
@@ -1967,8 +2208,9 @@ Installer::ProceedState Installer::install_stage_unmount_filesystems()
                 && (_has_block_image || _rom->id == "primary")) {
             display_msg("Copying temporary image to system");
 
-            // Format system directory
-            if (!wipe_directory(_system_path, {})) {
+            // Format system directory unless only the files changed by the
+            // installer will be copied back
+            if (!_system_snapshot && !wipe_directory(_system_path, {})) {
                 display_msg("Failed to wipe %s", _system_path.c_str());
                 return ProceedState::Fail;
             }
@@ -2094,6 +2336,10 @@ void Installer::install_stage_cleanup(Installer::ProceedState ret)
 
     on_cleanup(ret);
 
+    LOGD("Installer arena: %zu bytes allocated, %zu bytes reserved",
+         _arena.bytes_allocated(), _arena.bytes_reserved());
+    _arena.release();
+
     LOGV("Finished cleanup");
 }
 
@@ -2108,42 +2354,63 @@ bool Installer::start_installation()
 
     ProceedState ret = ProceedState::Fail;
 
+    _stage_timer.set_hook([](const StageTiming &t) {
+        LOGD("[Installer] Stage %s took %" PRIu64 "ms", t.name.c_str(),
+             t.wall_ns / 1000000);
+    });
+
     auto when_finished = finally([&] {
+        _stage_timer.start("cleanup");
         install_stage_cleanup(ret);
+        _stage_timer.stop();
+
+        _stage_timer.log_summary();
+        (void) _stage_timer.write_json(MULTIBOOT_TIMING_INSTALLER);
     });
 
+    auto run_stage = [&](const char *name, ProceedState (Installer::*stage)()) {
+        _stage_timer.start(name);
+        ProceedState stage_ret = (this->*stage)();
+        _stage_timer.stop(stage_ret != ProceedState::Fail);
+        return stage_ret;
+    };
 
-    ret = install_stage_initialize();
+    ret = run_stage("initialize", &Installer::install_stage_initialize);
     if (ret == ProceedState::Fail) return false;
     else if (ret == ProceedState::Cancel) return true;
 
-    ret = install_stage_create_chroot();
+    ret = run_stage("create_chroot", &Installer::install_stage_create_chroot);
     if (ret == ProceedState::Fail) return false;
     else if (ret == ProceedState::Cancel) return true;
 
-    ret = install_stage_set_up_environment();
+    ret = run_stage("set_up_environment",
+                    &Installer::install_stage_set_up_environment);
     if (ret == ProceedState::Fail) return false;
     else if (ret == ProceedState::Cancel) return true;
 
-    ret = install_stage_check_device();
+    ret = run_stage("check_device", &Installer::install_stage_check_device);
     if (ret == ProceedState::Fail) return false;
     else if (ret == ProceedState::Cancel) return true;
 
-    ret = install_stage_get_install_type();
+    ret = run_stage("get_install_type",
+                    &Installer::install_stage_get_install_type);
     if (ret == ProceedState::Fail) return false;
     else if (ret == ProceedState::Cancel) return true;
 
-    ret = install_stage_set_up_chroot();
+    ret = run_stage("set_up_chroot", &Installer::install_stage_set_up_chroot);
     if (ret == ProceedState::Fail) return false;
     else if (ret == ProceedState::Cancel) return true;
 
-    ret = install_stage_mount_filesystems();
+    ret = run_stage("mount_filesystems",
+                    &Installer::install_stage_mount_filesystems);
     if (ret == ProceedState::Fail) return false;
     else if (ret == ProceedState::Cancel) return true;
 
-    ProceedState install_ret = install_stage_installation();
+    ProceedState install_ret =
+            run_stage("installation", &Installer::install_stage_installation);
 
-    ret = install_stage_unmount_filesystems();
+    ret = run_stage("unmount_filesystems",
+                    &Installer::install_stage_unmount_filesystems);
     if (ret == ProceedState::Fail) return false;
     else if (ret == ProceedState::Cancel) return true;
 
@@ -2151,7 +2418,7 @@ bool Installer::start_installation()
     if (ret == ProceedState::Fail) return false;
     else if (ret == ProceedState::Cancel) return true;
 
-    ret = install_stage_finish();
+    ret = run_stage("finish", &Installer::install_stage_finish);
     if (ret == ProceedState::Fail) return false;
     else if (ret == ProceedState::Cancel) return true;
 
@@ -19,6 +19,7 @@
 
 #include "recovery/installer_util.h"
 
+#include <algorithm>
 #include <memory>
 #include <optional>
 
@@ -26,6 +27,7 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <ctime>
 
 #include <fcntl.h>
 #include <sys/stat.h>
@@ -40,6 +42,7 @@
 
 #include "mbcommon/file.h"
 #include "mbcommon/file_util.h"
+#include "mbcommon/file/memory.h"
 #include "mbcommon/file/standard.h"
 #include "mbcommon/finally.h"
 #include "mbcommon/string.h"
@@ -185,19 +188,46 @@ static int metadata_filter(archive *a, void *data, archive_entry *entry)
     return 1;
 }
 
-bool InstallerUtil::pack_ramdisk(const std::string &input_dir,
-                                 const std::string &output_file,
-                                 int format,
-                                 const std::vector<int> &filters)
+static bool setup_ramdisk_archive(archive *aout, int format,
+                                  const std::vector<int> &filters)
+{
+    if (archive_write_set_format(aout, format) != ARCHIVE_OK) {
+        LOGE("Failed to set output archive format: %s",
+             archive_error_string(aout));
+        return false;
+    }
+    for (const int &filter : filters) {
+        if (archive_write_add_filter(aout, filter) != ARCHIVE_OK) {
+            LOGE("Failed to add output archive filter: %s",
+                 archive_error_string(aout));
+            return false;
+        }
+
+        // Use all cores for xz compression. This is a no-op if liblzma was
+        // built without multithreading support.
+        if (filter == ARCHIVE_FILTER_XZ
+                && archive_write_set_filter_option(aout, "xz", "threads", "0")
+                        != ARCHIVE_OK) {
+            LOGV("Failed to enable multithreaded xz compression: %s",
+                 archive_error_string(aout));
+        }
+    }
+
+    archive_write_set_bytes_per_block(aout, 512);
+
+    return true;
+}
+
+static bool write_ramdisk_archive(archive *aout, const std::string &input_dir,
+                                  const std::string &output_name)
 {
     ScopedArchive ain(archive_read_disk_new(), archive_read_free);
-    ScopedArchive aout(archive_write_new(), archive_write_free);
     ScopedArchiveEntry entry(archive_entry_new(), archive_entry_free);
     std::string full_path;
     int ret;
 
-    if (!ain || !aout || !entry) {
-        LOGE("Failed to allocate archive reader, writer, or entry instance");
+    if (!ain || !entry) {
+        LOGE("Failed to allocate archive reader or entry instance");
         return false;
     }
 
@@ -208,29 +238,6 @@ bool InstallerUtil::pack_ramdisk(const std::string &input_dir,
     // We don't want to look up usernames and group names on Android
     //archive_read_disk_set_standard_lookup(in.get());
 
-    if (archive_write_set_format(aout.get(), format) != ARCHIVE_OK) {
-        LOGE("Failed to set output archive format: %s",
-             archive_error_string(aout.get()));
-        return false;
-    }
-    for (const int &filter : filters) {
-        if (archive_write_add_filter(aout.get(), filter) != ARCHIVE_OK) {
-            LOGE("Failed to add output archive filter: %s",
-                 archive_error_string(aout.get()));
-            return false;
-        }
-    }
-
-    archive_write_set_bytes_per_block(aout.get(), 512);
-
-    // Open output file
-    if (archive_write_open_filename(aout.get(), output_file.c_str())
-            != ARCHIVE_OK) {
-        LOGE("%s: Failed to open for writing: %s",
-             output_file.c_str(), archive_error_string(aout.get()));
-        return false;
-    }
-
     ret = archive_read_disk_open(ain.get(), input_dir.c_str());
     if (ret != ARCHIVE_OK) {
         LOGE("%s: %s", input_dir.c_str(), archive_error_string(ain.get()));
@@ -272,10 +279,10 @@ bool InstallerUtil::pack_ramdisk(const std::string &input_dir,
             archive_entry_set_pathname(entry.get(), relpath.value().c_str());
         }
 
-        ret = archive_write_header(aout.get(), entry.get());
+        ret = archive_write_header(aout, entry.get());
         if (ret != ARCHIVE_OK) {
-            LOGE("%s: %s", output_file.c_str(),
-                 archive_error_string(aout.get()));
+            LOGE("%s: %s", output_name.c_str(),
+                 archive_error_string(aout));
             return false;
         }
 
@@ -284,10 +291,10 @@ bool InstallerUtil::pack_ramdisk(const std::string &input_dir,
 
         if (archive_entry_size(entry.get()) > 0) {
             while ((n = archive_read_data(ain.get(), buf, sizeof(buf))) > 0) {
-                if (archive_write_data(aout.get(), buf, static_cast<size_t>(n))
+                if (archive_write_data(aout, buf, static_cast<size_t>(n))
                         != n) {
                     LOGE("Failed to write archive entry data: %s",
-                         archive_error_string(aout.get()));
+                         archive_error_string(aout));
                     return false;
                 }
             }
@@ -302,17 +309,705 @@ bool InstallerUtil::pack_ramdisk(const std::string &input_dir,
 
     archive_read_close(ain.get());
 
+    if (archive_write_close(aout) != ARCHIVE_OK) {
+        LOGE("%s: %s", output_name.c_str(), archive_error_string(aout));
+        return false;
+    }
+
+    return true;
+}
+
+static la_ssize_t bootimg_writer_write_cb(archive *a, void *userdata,
+                                          const void *buf, size_t size)
+{
+    auto writer = static_cast<Writer *>(userdata);
+
+    auto n = writer->write_data(buf, size);
+    if (!n) {
+        archive_set_error(a, ARCHIVE_FATAL, "Failed to write entry data: %s",
+                          n.error().message().c_str());
+        return -1;
+    }
+
+    return static_cast<la_ssize_t>(n.value());
+}
+
+bool InstallerUtil::pack_ramdisk(const std::string &input_dir,
+                                 const std::string &output_file,
+                                 int format,
+                                 const std::vector<int> &filters)
+{
+    ScopedArchive aout(archive_write_new(), archive_write_free);
+
+    if (!aout) {
+        LOGE("Failed to allocate archive writer instance");
+        return false;
+    }
+
+    if (!setup_ramdisk_archive(aout.get(), format, filters)) {
+        return false;
+    }
+
+    // Open output file
+    if (archive_write_open_filename(aout.get(), output_file.c_str())
+            != ARCHIVE_OK) {
+        LOGE("%s: Failed to open for writing: %s",
+             output_file.c_str(), archive_error_string(aout.get()));
+        return false;
+    }
+
+    return write_ramdisk_archive(aout.get(), input_dir, output_file);
+}
+
+/*!
+ * \brief Pack ramdisk directly into the current boot image entry
+ *
+ * The archive is compressed as it is written to \p writer, so no temporary
+ * compressed file is needed.
+ */
+bool InstallerUtil::pack_ramdisk(const std::string &input_dir,
+                                 Writer &writer,
+                                 int format,
+                                 const std::vector<int> &filters)
+{
+    ScopedArchive aout(archive_write_new(), archive_write_free);
+
+    if (!aout) {
+        LOGE("Failed to allocate archive writer instance");
+        return false;
+    }
+
+    if (!setup_ramdisk_archive(aout.get(), format, filters)) {
+        return false;
+    }
+
+    // Don't pad the last block like archive_write_open_filename() does for
+    // regular files
+    archive_write_set_bytes_in_last_block(aout.get(), 1);
+
+    if (archive_write_open(aout.get(), &writer, nullptr,
+                           &bootimg_writer_write_cb, nullptr) != ARCHIVE_OK) {
+        LOGE("Failed to open boot image entry for writing: %s",
+             archive_error_string(aout.get()));
+        return false;
+    }
+
+    return write_ramdisk_archive(aout.get(), input_dir, "<ramdisk>");
+}
+
+static la_ssize_t string_write_cb(archive *a, void *userdata,
+                                  const void *buf, size_t size)
+{
+    (void) a;
+
+    static_cast<std::string *>(userdata)->append(
+            static_cast<const char *>(buf), size);
+
+    return static_cast<la_ssize_t>(size);
+}
+
+static archive * new_ramdisk_reader(const void *data, size_t size)
+{
+    archive *a = archive_read_new();
+    if (!a) {
+        LOGE("Failed to allocate archive reader instance");
+        return nullptr;
+    }
+
+    archive_read_support_filter_gzip(a);
+    archive_read_support_filter_lz4(a);
+    archive_read_support_filter_lzma(a);
+    archive_read_support_filter_xz(a);
+    archive_read_support_format_cpio(a);
+
+    // libarchive does not modify the buffer
+    if (archive_read_open_memory(a, const_cast<void *>(data), size)
+            != ARCHIVE_OK) {
+        LOGE("Failed to open ramdisk for reading: %s", archive_error_string(a));
+        archive_read_free(a);
+        return nullptr;
+    }
+
+    return a;
+}
+
+// Normalize "/foo" and "./foo" to "foo" so paths can be compared
+static const char * ramdisk_path_of(const char *path)
+{
+    while (true) {
+        if (path[0] == '/') {
+            ++path;
+        } else if (path[0] == '.' && path[1] == '/') {
+            path += 2;
+        } else {
+            break;
+        }
+    }
+    return *path ? path : ".";
+}
+
+// Read the next header and normalize its path. On EOF, returns true and sets
+// eof.
+static bool next_ramdisk_header(archive *ain, archive_entry *&entry,
+                                bool &eof)
+{
+    while (true) {
+        int ret = archive_read_next_header(ain, &entry);
+        if (ret == ARCHIVE_EOF) {
+            eof = true;
+            return true;
+        } else if (ret == ARCHIVE_RETRY) {
+            continue;
+        } else if (ret != ARCHIVE_OK && ret != ARCHIVE_WARN) {
+            LOGE("Failed to read ramdisk header: %s",
+                 archive_error_string(ain));
+            return false;
+        }
+
+        const char *path = archive_entry_pathname(entry);
+        if (!path || !*path) {
+            LOGE("Ramdisk header has null or empty filename");
+            return false;
+        }
+
+        archive_entry_set_pathname(entry, ramdisk_path_of(path));
+
+        eof = false;
+        return true;
+    }
+}
+
+static bool read_ramdisk_data(archive *ain, archive_entry *entry,
+                              std::string &data)
+{
+    data.clear();
+
+    if (archive_entry_filetype(entry) != AE_IFREG
+            || archive_entry_size(entry) <= 0) {
+        return true;
+    }
+
+    data.reserve(static_cast<size_t>(archive_entry_size(entry)));
+
+    char buf[10240];
+    la_ssize_t n;
+
+    while ((n = archive_read_data(ain, buf, sizeof(buf))) > 0) {
+        data.append(buf, static_cast<size_t>(n));
+    }
+
+    if (n < 0) {
+        LOGE("%s: Failed to read archive entry data: %s",
+             archive_entry_pathname(entry), archive_error_string(ain));
+        return false;
+    }
+
+    return true;
+}
+
+static bool write_ramdisk_entry(archive *aout, archive_entry *entry,
+                                const std::string &data)
+{
+    if (archive_entry_filetype(entry) == AE_IFREG) {
+        archive_entry_set_size(entry, static_cast<la_int64_t>(data.size()));
+    }
+
+    if (archive_write_header(aout, entry) != ARCHIVE_OK) {
+        LOGE("%s: Failed to write header: %s",
+             archive_entry_pathname(entry), archive_error_string(aout));
+        return false;
+    }
+
+    if (!data.empty() && archive_write_data(aout, data.data(), data.size())
+            != static_cast<la_ssize_t>(data.size())) {
+        LOGE("%s: Failed to write archive entry data: %s",
+             archive_entry_pathname(entry), archive_error_string(aout));
+        return false;
+    }
+
+    return true;
+}
+
+// Check if the ramdisk contains a nested ramdisk. Like patch_ramdisk(), only
+// the nested ramdisk is patched if it exists.
+static bool has_nested_ramdisk(const void *data, size_t size, bool &result)
+{
+    ScopedArchive ain(new_ramdisk_reader(data, size), archive_read_free);
+    if (!ain) {
+        return false;
+    }
+
+    archive_entry *entry;
+    bool eof;
+
+    result = false;
+
+    while (next_ramdisk_header(ain.get(), entry, eof)) {
+        if (eof) {
+            return true;
+        } else if (strcmp(archive_entry_pathname(entry),
+                          "sbin/ramdisk.cpio") == 0) {
+            result = true;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static bool rewrite_ramdisk(const void *data, size_t size, unsigned int depth,
+                            const RamdiskEdits &edits,
+                            archive_write_callback *write_cb, void *userdata)
+{
+    bool nested = false;
+
+    // Doubly-nested ramdisks are treated as regular files
+    if (depth == 0 && !has_nested_ramdisk(data, size, nested)) {
+        return false;
+    }
+
+    ScopedArchive ain(new_ramdisk_reader(data, size), archive_read_free);
+    ScopedArchive aout(archive_write_new(), archive_write_free);
+    if (!ain || !aout) {
+        LOGE("Failed to allocate archive reader or writer instance");
+        return false;
+    }
+
+    archive_entry *entry;
+    bool eof;
+
+    // The format and filters are only known after reading the first header
+    if (!next_ramdisk_header(ain.get(), entry, eof)) {
+        return false;
+    }
+
+    std::vector<int> filters;
+    for (int i = 0; i < archive_filter_count(ain.get()); ++i) {
+        int code = archive_filter_code(ain.get(), i);
+        if (code != ARCHIVE_FILTER_NONE) {
+            filters.push_back(code);
+        }
+    }
+
+    if (!setup_ramdisk_archive(aout.get(), archive_format(ain.get()),
+                               filters)) {
+        return false;
+    }
+
+    archive_write_set_bytes_in_last_block(aout.get(), 1);
+
+    if (archive_write_open(aout.get(), userdata, nullptr, write_cb, nullptr)
+            != ARCHIVE_OK) {
+        LOGE("Failed to open ramdisk for writing: %s",
+             archive_error_string(aout.get()));
+        return false;
+    }
+
+    // Edits are not applied to the outer ramdisk if there's a nested one
+    const bool apply_edits = !nested;
+    std::vector<bool> files_used(edits.files.size());
+    std::string entry_data;
+
+    while (!eof) {
+        if (!read_ramdisk_data(ain.get(), entry, entry_data)) {
+            return false;
+        }
+
+        const char *path = archive_entry_pathname(entry);
+        auto action = RamdiskAction::Keep;
+
+        if (nested && strcmp(path, "sbin/ramdisk.cpio") == 0) {
+            std::string new_data;
+
+            if (!rewrite_ramdisk(entry_data.data(), entry_data.size(),
+                                 depth + 1, edits, &string_write_cb,
+                                 &new_data)) {
+                return false;
+            }
+
+            entry_data.swap(new_data);
+            action = RamdiskAction::Replace;
+        } else if (apply_edits) {
+            auto it = std::find_if(edits.files.begin(), edits.files.end(),
+                                   [&](const RamdiskFile &f) {
+                return f.path == path;
+            });
+
+            if (it != edits.files.end()) {
+                files_used[static_cast<size_t>(it - edits.files.begin())]
+                        = true;
+                archive_entry_set_filetype(entry, AE_IFREG);
+                archive_entry_set_perm(entry, it->mode);
+                archive_entry_set_nlink(entry, 1);
+                archive_entry_set_hardlink(entry, nullptr);
+                archive_entry_set_symlink(entry, nullptr);
+                entry_data = it->data;
+                action = RamdiskAction::Replace;
+            } else if (edits.on_entry) {
+                action = edits.on_entry(entry, entry_data);
+            }
+        }
+
+        if (action == RamdiskAction::Remove) {
+            LOGV("Removing ramdisk entry: %s", path);
+        } else {
+            if (action == RamdiskAction::Replace) {
+                LOGV("Replacing ramdisk entry: %s", path);
+            }
+
+            if (!write_ramdisk_entry(aout.get(), entry, entry_data)) {
+                return false;
+            }
+        }
+
+        if (!next_ramdisk_header(ain.get(), entry, eof)) {
+            return false;
+        }
+    }
+
+    // Add new files at the end (cpio does not require any ordering)
+    if (apply_edits) {
+        ScopedArchiveEntry new_entry(archive_entry_new(), archive_entry_free);
+        if (!new_entry) {
+            LOGE("Failed to allocate archive entry instance");
+            return false;
+        }
+
+        for (size_t i = 0; i < edits.files.size(); ++i) {
+            if (files_used[i]) {
+                continue;
+            }
+
+            auto const &file = edits.files[i];
+            LOGV("Adding ramdisk entry: %s", file.path.c_str());
+
+            archive_entry_clear(new_entry.get());
+            archive_entry_set_pathname(new_entry.get(), file.path.c_str());
+            archive_entry_set_filetype(new_entry.get(), AE_IFREG);
+            archive_entry_set_perm(new_entry.get(), file.mode);
+            archive_entry_set_nlink(new_entry.get(), 1);
+            archive_entry_set_mtime(new_entry.get(), time(nullptr), 0);
+
+            if (!write_ramdisk_entry(aout.get(), new_entry.get(), file.data)) {
+                return false;
+            }
+        }
+    }
+
+    if (archive_write_close(aout.get()) != ARCHIVE_OK) {
+        LOGE("Failed to close ramdisk: %s", archive_error_string(aout.get()));
+        return false;
+    }
+
+    return true;
+}
+
+// Decompress the ramdisk. libarchive is only used for its compression filters.
+// The cpio archive itself is parsed by util::CpioArchive.
+static bool decompress_ramdisk(const void *data, size_t size,
+                               std::string &cpio, std::vector<int> &filters)
+{
+    ScopedArchive ain(archive_read_new(), archive_read_free);
+    if (!ain) {
+        LOGE("Failed to allocate archive reader instance");
+        return false;
+    }
+
+    archive_read_support_filter_gzip(ain.get());
+    archive_read_support_filter_lz4(ain.get());
+    archive_read_support_filter_lzma(ain.get());
+    archive_read_support_filter_xz(ain.get());
+    archive_read_support_format_raw(ain.get());
+
+    // libarchive does not modify the buffer
+    if (archive_read_open_memory(ain.get(), const_cast<void *>(data), size)
+            != ARCHIVE_OK) {
+        LOGE("Failed to open ramdisk for reading: %s",
+             archive_error_string(ain.get()));
+        return false;
+    }
+
+    archive_entry *entry;
+    int ret = archive_read_next_header(ain.get(), &entry);
+    if (ret != ARCHIVE_OK && ret != ARCHIVE_WARN) {
+        LOGE("Failed to read ramdisk header: %s",
+             archive_error_string(ain.get()));
+        return false;
+    }
+
+    cpio.clear();
+
+    char buf[10240];
+    la_ssize_t n;
+
+    while ((n = archive_read_data(ain.get(), buf, sizeof(buf))) > 0) {
+        cpio.append(buf, static_cast<size_t>(n));
+    }
+
+    if (n < 0) {
+        LOGE("Failed to decompress ramdisk: %s",
+             archive_error_string(ain.get()));
+        return false;
+    }
+
+    filters.clear();
+    for (int i = 0; i < archive_filter_count(ain.get()); ++i) {
+        int code = archive_filter_code(ain.get(), i);
+        if (code != ARCHIVE_FILTER_NONE) {
+            filters.push_back(code);
+        }
+    }
+
+    return true;
+}
+
+static bool compress_ramdisk(const std::string &cpio,
+                             const std::vector<int> &filters,
+                             archive_write_callback *write_cb,
+                             void *userdata)
+{
+    ScopedArchive aout(archive_write_new(), archive_write_free);
+    ScopedArchiveEntry entry(archive_entry_new(), archive_entry_free);
+    if (!aout || !entry) {
+        LOGE("Failed to allocate archive writer or entry instance");
+        return false;
+    }
+
+    if (!setup_ramdisk_archive(aout.get(), ARCHIVE_FORMAT_RAW, filters)) {
+        return false;
+    }
+
+    archive_write_set_bytes_in_last_block(aout.get(), 1);
+
+    if (archive_write_open(aout.get(), userdata, nullptr, write_cb, nullptr)
+            != ARCHIVE_OK) {
+        LOGE("Failed to open ramdisk for writing: %s",
+             archive_error_string(aout.get()));
+        return false;
+    }
+
+    archive_entry_set_pathname(entry.get(), "ramdisk.cpio");
+    archive_entry_set_filetype(entry.get(), AE_IFREG);
+
+    if (!write_ramdisk_entry(aout.get(), entry.get(), cpio)) {
+        return false;
+    }
+
     if (archive_write_close(aout.get()) != ARCHIVE_OK) {
-        LOGE("%s: %s", output_file.c_str(), archive_error_string(aout.get()));
+        LOGE("Failed to close ramdisk: %s", archive_error_string(aout.get()));
+        return false;
+    }
+
+    return true;
+}
+
+static bool read_ramdisk_model(const void *data, size_t size,
+                               Ramdisk &ramdisk)
+{
+    std::string cpio;
+
+    if (!decompress_ramdisk(data, size, cpio, ramdisk.filters)) {
+        return false;
+    }
+
+    MemoryFile file(cpio.data(), cpio.size());
+
+    if (auto r = ramdisk.load(file); !r) {
+        LOGE("Failed to load ramdisk: %s", r.error().message().c_str());
+        return false;
+    }
+
+    return true;
+}
+
+static bool write_ramdisk_model(const Ramdisk &ramdisk,
+                                archive_write_callback *write_cb,
+                                void *userdata)
+{
+    void *buf = nullptr;
+    size_t size = 0;
+
+    auto free_buf = finally([&] {
+        free(buf);
+    });
+
+    {
+        MemoryFile file(&buf, &size);
+
+        if (auto r = ramdisk.save(file, ramdisk.format()); !r) {
+            LOGE("Failed to save ramdisk: %s", r.error().message().c_str());
+            return false;
+        }
+    }
+
+    return compress_ramdisk({static_cast<const char *>(buf), size},
+                            ramdisk.filters, write_cb, userdata);
+}
+
+static bool patch_ramdisk_model(Ramdisk &ramdisk, unsigned int depth,
+                                const std::vector<std::function<RamdiskPatcherFn>> &rps)
+{
+    // Only the nested ramdisk is patched if it exists. Doubly-nested ramdisks
+    // are treated as regular files.
+    if (depth == 0) {
+        if (auto nested_data = ramdisk.edit("sbin/ramdisk.cpio")) {
+            Ramdisk nested;
+
+            if (!read_ramdisk_model(nested_data->data(), nested_data->size(),
+                                    nested)
+                    || !patch_ramdisk_model(nested, depth + 1, rps)) {
+                return false;
+            }
+
+            std::string new_data;
+
+            if (!write_ramdisk_model(nested, &string_write_cb, &new_data)) {
+                return false;
+            }
+
+            nested_data->swap(new_data);
+            return true;
+        }
+    }
+
+    for (auto const &rp : rps) {
+        if (!rp(ramdisk)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool read_entry_data(Reader &reader, std::string &buf,
+                            const void *&data, size_t &size)
+{
+    if (auto view = reader.read_data_view()) {
+        data = view.value().data;
+        size = view.value().size;
+    } else if (view.error() == ReaderError::UnsupportedDataView) {
+        char chunk[10240];
+
+        while (true) {
+            auto n = reader.read_data(chunk, sizeof(chunk));
+            if (!n) {
+                LOGE("Failed to read boot image entry data: %s",
+                     n.error().message().c_str());
+                return false;
+            } else if (n.value() == 0) {
+                break;
+            }
+
+            buf.append(chunk, n.value());
+        }
+
+        data = buf.data();
+        size = buf.size();
+    } else {
+        LOGE("Failed to read boot image entry data: %s",
+             view.error().message().c_str());
         return false;
     }
 
     return true;
 }
 
+/*!
+ * \brief Patch the current ramdisk entry without extracting it
+ *
+ * The ramdisk is decompressed in memory and its cpio records are passed
+ * through to \p writer, recompressed with the original filters, with
+ * \p edits applied. No files are created on the filesystem. Like
+ * patch_ramdisk(), only the nested ramdisk is modified if the ramdisk contains
+ * sbin/ramdisk.cpio.
+ *
+ * \param reader Reader positioned at the ramdisk entry
+ * \param writer Writer positioned at the ramdisk entry
+ * \param edits Files to add or replace and callback for all other entries
+ */
+bool InstallerUtil::edit_ramdisk(Reader &reader, Writer &writer,
+                                 const RamdiskEdits &edits)
+{
+    std::string buf;
+    const void *data;
+    size_t size;
+
+    if (!read_entry_data(reader, buf, data, size)) {
+        return false;
+    }
+
+    return rewrite_ramdisk(data, size, 0, edits, &bootimg_writer_write_cb,
+                           &writer);
+}
+
+/*!
+ * \brief Patch the current ramdisk entry in memory
+ *
+ * The ramdisk is decompressed into a Ramdisk model and all of \p rps are run
+ * against it. Only the final result is compressed and written to \p writer.
+ * If the ramdisk contains sbin/ramdisk.cpio, only the nested ramdisk is
+ * patched.
+ *
+ * \param reader Reader positioned at the ramdisk entry
+ * \param writer Writer positioned at the ramdisk entry
+ * \param rps Ramdisk patchers to run
+ */
+bool InstallerUtil::patch_ramdisk(Reader &reader, Writer &writer,
+                                  const std::vector<std::function<RamdiskPatcherFn>> &rps)
+{
+    std::string buf;
+    const void *data;
+    size_t size;
+    Ramdisk ramdisk;
+
+    if (!read_entry_data(reader, buf, data, size)
+            || !read_ramdisk_model(data, size, ramdisk)) {
+        return false;
+    }
+
+    // The compressed ramdisk is no longer needed
+    buf = {};
+
+    if (!patch_ramdisk_model(ramdisk, 0, rps)) {
+        return false;
+    }
+
+    return write_ramdisk_model(ramdisk, &bootimg_writer_write_cb, &writer);
+}
+
 bool InstallerUtil::patch_boot_image(const std::string &input_file,
                                      const std::string &output_file,
                                      const std::vector<std::function<RamdiskPatcherFn>> &rps)
+{
+    return patch_boot_image(input_file, output_file,
+                            [&](Reader &reader, Writer &writer,
+                                const std::string &tmpdir) {
+        (void) tmpdir;
+        return patch_ramdisk(reader, writer, rps);
+    });
+}
+
+/*!
+ * \brief Patch the ramdisk of a boot image without extracting it
+ *
+ * Unlike patch_boot_image(), the ramdisk is never written to the
+ * filesystem. See edit_ramdisk().
+ */
+bool InstallerUtil::edit_boot_image(const std::string &input_file,
+                                    const std::string &output_file,
+                                    const RamdiskEdits &edits)
+{
+    return patch_boot_image(input_file, output_file,
+                            [&](Reader &reader, Writer &writer,
+                                const std::string &tmpdir) {
+        (void) tmpdir;
+        return edit_ramdisk(reader, writer, edits);
+    });
+}
+
+bool InstallerUtil::patch_boot_image(const std::string &input_file,
+                                     const std::string &output_file,
+                                     const std::function<CopyRamdiskFn> &copy_ramdisk)
 {
     std::string tmpdir = format("%s.XXXXXX", output_file.c_str());
 
@@ -340,7 +1035,7 @@ bool InstallerUtil::patch_boot_image(const std::string &input_file,
              r.error().message().c_str());
         return false;
     }
-    if (auto r = reader.open_filename(input_file); !r) {
+    if (auto r = bi_open_mapped(reader, input_file); !r) {
         LOGE("%s: Failed to open boot image for reading: %s",
              input_file.c_str(), r.error().message().c_str());
         return false;
@@ -423,25 +1118,7 @@ bool InstallerUtil::patch_boot_image(const std::string &input_file,
             if (type == EntryType::Ramdisk) {
                 LOGD("%s: Writing patched ramdisk", output_file.c_str());
 
-                std::string ramdisk_in(tmpdir);
-                ramdisk_in += "/ramdisk.in";
-                std::string ramdisk_out(tmpdir);
-                ramdisk_out += "/ramdisk.out";
-
-                auto delete_temp_files = finally([&]{
-                    unlink(ramdisk_in.c_str());
-                    unlink(ramdisk_out.c_str());
-                });
-
-                if (!bi_copy_data_to_file(reader, ramdisk_in)) {
-                    return false;
-                }
-
-                if (!patch_ramdisk(ramdisk_in, ramdisk_out, 0, rps)) {
-                    return false;
-                }
-
-                if (!bi_copy_file_to_data(ramdisk_out, writer)) {
+                if (!copy_ramdisk(reader, writer, tmpdir)) {
                     return false;
                 }
             } else if (type == EntryType::Kernel) {
@@ -472,7 +1149,10 @@ bool InstallerUtil::patch_boot_image(const std::string &input_file,
                 LOGD("%s: Copying entry directly", output_file.c_str());
 
                 // Copy entry directly
-                if (!bi_copy_data_to_data(reader, writer)) {
+                if (auto r = writer.copy_entry_from(reader, type); !r) {
+                    LOGE("%s: Failed to copy entry: %d: %s",
+                         output_file.c_str(), type,
+                         r.error().message().c_str());
                     return false;
                 }
             }
@@ -488,67 +1168,6 @@ bool InstallerUtil::patch_boot_image(const std::string &input_file,
     return true;
 }
 
-bool InstallerUtil::patch_ramdisk(const std::string &input_file,
-                                  const std::string &output_file,
-                                  unsigned int depth,
-                                  const std::vector<std::function<RamdiskPatcherFn>> &rps)
-{
-    if (depth > 1) {
-        LOGV("Ignoring doubly-nested ramdisk");
-        return true;
-    }
-
-    std::string tmpdir = format("%s.XXXXXX", output_file.c_str());
-
-    if (!mkdtemp(tmpdir.data())) {
-        LOGE("Failed to create temporary directory: %s", strerror(errno));
-        return false;
-    }
-
-    auto delete_temp_dir = finally([&]{
-        (void) util::delete_recursive(tmpdir);
-    });
-
-    int format;
-    std::vector<int> filters;
-
-    // Extract ramdisk
-    if (!unpack_ramdisk(input_file, tmpdir, format, filters)) {
-        return false;
-    }
-
-    // Patch ramdisk
-    std::string nested(tmpdir);
-    nested += "/sbin/ramdisk.cpio";
-    struct stat sb;
-    bool ret;
-
-    if (stat(nested.c_str(), &sb) == 0) {
-        ret = patch_ramdisk(nested, nested, depth + 1, rps);
-    } else {
-        ret = patch_ramdisk_dir(tmpdir, rps);
-    }
-
-    // Pack ramdisk
-    if (!pack_ramdisk(tmpdir, output_file, format, filters)) {
-        return false;
-    }
-
-    return ret;
-}
-
-bool InstallerUtil::patch_ramdisk_dir(const std::string &ramdisk_dir,
-                                      const std::vector<std::function<RamdiskPatcherFn>> &rps)
-{
-    for (auto const &rp : rps) {
-        if (!rp(ramdisk_dir)) {
-            return false;
-        }
-    }
-
-    return true;
-}
-
 bool InstallerUtil::patch_kernel_rkp(const std::string &input_file,
                                      const std::string &output_file)
 {
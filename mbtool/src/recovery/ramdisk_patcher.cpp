@@ -20,23 +20,15 @@
 #include "recovery/ramdisk_patcher.h"
 
 #include <algorithm>
-#include <memory>
 
 #include <cerrno>
-#include <cstdio>
-#include <cstdlib>
 #include <cstring>
 
-#include <sys/stat.h>
-#include <unistd.h>
-
-#include "mbcommon/finally.h"
 #include "mbcommon/string.h"
 #include "mblog/logging.h"
-#include "mbutil/copy.h"
+#include "mbutil/file.h"
 #include "mbutil/path.h"
 
-#include "recovery/installer_util.h"
 #include "util/multiboot.h"
 
 #define LOG_TAG "mbtool/recovery/ramdisk_patcher"
@@ -44,125 +36,62 @@
 namespace mb
 {
 
-using ScopedFILE = std::unique_ptr<FILE, decltype(fclose) *>;
-
-static bool _rp_write_rom_id(const std::string &dir, const std::string &rom_id)
+// Paths in the model never have a leading slash
+static std::string ramdisk_path(const char *path)
 {
-    std::string path(dir);
-    path += "/romid";
-
-    ScopedFILE fp(fopen(path.c_str(), "wbe"), fclose);
-    if (!fp) {
-        LOGE("%s: Failed to open for writing: %s",
-             path.c_str(), strerror(errno));
-        return false;
+    while (*path == '/') {
+        ++path;
     }
-
-    if (fputs(rom_id.c_str(), fp.get()) == EOF) {
-        LOGE("%s: Failed to write ROM ID: %s",
-             path.c_str(), strerror(errno));
-        return false;
-    }
-
-    if (fchmod(fileno(fp.get()), 0664) < 0) {
-        LOGE("%s: Failed to chmod: %s",
-             path.c_str(), strerror(errno));
-        return false;
-    }
-
-    if (fclose(fp.release()) < 0) {
-        LOGE("%s: Failed to close file: %s",
-             path.c_str(), strerror(errno));
-        return false;
-    }
-
-    return true;
+    return path;
 }
 
 std::function<RamdiskPatcherFn>
 rp_write_rom_id(const std::string &rom_id)
 {
-    using namespace std::placeholders;
-
-    return std::bind(_rp_write_rom_id, _1, rom_id);
+    return [rom_id](Ramdisk &ramdisk) {
+        auto file = rf_rom_id(rom_id);
+        ramdisk.add_file(file.path, std::move(file.data), file.mode);
+        return true;
+    };
 }
 
-static bool _rp_restore_default_prop(const std::string &dir)
+RamdiskFile
+rf_rom_id(const std::string &rom_id)
 {
-    std::string path(dir);
-    path += DEFAULT_PROP_PATH;
-
-    ScopedFILE fp_in(fopen(path.c_str(), "rbe"), fclose);
-    if (!fp_in) {
-        if (errno == ENOENT) {
-            LOGV("%s: Ignoring non-existent file", path.c_str());
-            return true;
-        } else {
-            LOGE("%s: Failed to open for reading: %s",
-                 path.c_str(), strerror(errno));
-            return false;
-        }
-    }
+    return { "romid", rom_id, 0664 };
+}
 
-    std::string tmp_path = format("%s.XXXXXX", path.c_str());
+static bool _rp_restore_default_prop(Ramdisk &ramdisk)
+{
+    std::string path = ramdisk_path(DEFAULT_PROP_PATH);
 
-    const int tmp_fd = mkstemp(tmp_path.data());
-    if (tmp_fd < 0) {
-        LOGE("%s: Failed to create temporary file: %s",
-             path.c_str(), strerror(errno));
-        return false;
+    // Newer ramdisks symlink default.prop to prop.default
+    if (auto target = ramdisk.read_link(path)) {
+        path = ramdisk_path(target->c_str());
     }
 
-    auto unlink_tmp_path = finally([&tmp_path] {
-        unlink(tmp_path.c_str());
-    });
-
-    auto close_tmp_fd = finally([&tmp_fd] {
-        close(tmp_fd);
-    });
-
-    ScopedFILE fp_out(fdopen(tmp_fd, "wb"), fclose);
-    if (!fp_out) {
-        LOGE("%s: Failed to open for writing: %s",
-             tmp_path.c_str(), strerror(errno));
-        return false;
+    auto data = ramdisk.edit(path);
+    if (!data) {
+        LOGV("%s: Ignoring non-existent file", path.c_str());
+        return true;
     }
 
-    // fp_out will automatically close the fd
-    close_tmp_fd.dismiss();
+    std::string new_data;
+    new_data.reserve(data->size());
 
-    char *buf = nullptr;
-    size_t buf_size = 0;
-    ssize_t n;
+    for (size_t begin = 0; begin < data->size();) {
+        size_t end = data->find('\n', begin);
+        end = end == std::string::npos ? data->size() : end + 1;
 
-    auto free_buf = finally([&buf] {
-        free(buf);
-    });
-
-    while ((n = getline(&buf, &buf_size, fp_in.get())) >= 0) {
         // Remove old multiboot properties
-        if (starts_with(buf, "ro.patcher.")) {
-            continue;
+        if (data->compare(begin, strlen("ro.patcher."), "ro.patcher.") != 0) {
+            new_data.append(*data, begin, end - begin);
         }
 
-        if (fwrite(buf, 1, static_cast<size_t>(n), fp_out.get())
-                != static_cast<size_t>(n)) {
-            LOGE("%s: Failed to write file: %s",
-                 tmp_path.c_str(), strerror(errno));
-            return false;
-        }
+        begin = end;
     }
 
-    // Manually close file to ensure we catch write errors
-    if (fclose(fp_out.release()) < 0) {
-        LOGE("%s: Failed to close file: %s",
-             tmp_path.c_str(), strerror(errno));
-        return false;
-    }
-
-    if (!InstallerUtil::replace_file(path.c_str(), tmp_path)) {
-        return false;
-    }
+    data->swap(new_data);
 
     return true;
 }
@@ -173,48 +102,18 @@ rp_restore_default_prop()
     return _rp_restore_default_prop;
 }
 
-static bool _rp_add_dbp_prop(const std::string &dir,
-                             const std::string &device_id, bool use_fuse_exfat)
-{
-    std::string path(dir);
-    path += DBP_PROP_PATH;
-
-    ScopedFILE fp(fopen(path.c_str(), "wbe"), fclose);
-    if (!fp) {
-        LOGE("%s: Failed to open for writing: %s",
-             path.c_str(), strerror(errno));
-        return false;
-    }
-
-    // Write new properties
-    if (fprintf(fp.get(), PROP_DEVICE "=%s\n", device_id.c_str()) < 0
-            || fprintf(fp.get(), PROP_USE_FUSE_EXFAT "=%s\n",
-                    use_fuse_exfat ? "true" : "false") < 0) {
-        LOGE("%s: Failed to write properties: %s",
-             path.c_str(), strerror(errno));
-        return false;
-    }
-
-    // Manually close file to ensure we catch write errors
-    if (fclose(fp.release()) < 0) {
-        LOGE("%s: Failed to close file: %s",
-             path.c_str(), strerror(errno));
-        return false;
-    }
-
-    return true;
-}
-
 std::function<RamdiskPatcherFn>
 rp_add_dbp_prop(const std::string &device_id, bool use_fuse_exfat)
 {
-    using namespace std::placeholders;
-
-    return std::bind(_rp_add_dbp_prop, _1, device_id, use_fuse_exfat);
+    return [device_id, use_fuse_exfat](Ramdisk &ramdisk) {
+        ramdisk.add_file(ramdisk_path(DBP_PROP_PATH), format(
+                PROP_DEVICE "=%s\n" PROP_USE_FUSE_EXFAT "=%s\n",
+                device_id.c_str(), use_fuse_exfat ? "true" : "false"), 0644);
+        return true;
+    };
 }
 
-static bool _rp_add_binaries(const std::string &dir,
-                             const std::string &binaries_dir)
+static bool _rp_add_binaries(Ramdisk &ramdisk, const std::string &binaries_dir)
 {
     struct CopySpec
     {
@@ -238,18 +137,15 @@ static bool _rp_add_binaries(const std::string &dir,
         std::string source(binaries_dir);
         source += "/";
         source += item.from;
-        std::string target(dir);
-        target += "/";
-        target += item.to;
 
-        if (auto r = util::copy_file(source, target, 0); !r) {
-            LOGE("%s", r.error().message().c_str());
-            return false;
-        }
-        if (chmod(target.c_str(), item.perm) < 0) {
-            LOGE("%s: Failed to chmod: %s", target.c_str(), strerror(errno));
+        auto data = util::file_read_all(source);
+        if (!data) {
+            LOGE("%s: Failed to read file: %s",
+                 source.c_str(), data.error().message().c_str());
             return false;
         }
+
+        ramdisk.add_file(item.to, std::move(data.value()), item.perm);
     }
 
     return true;
@@ -263,20 +159,10 @@ rp_add_binaries(const std::string &binaries_dir)
     return std::bind(_rp_add_binaries, _1, binaries_dir);
 }
 
-static bool _rp_symlink_fuse_exfat(const std::string &dir)
+static bool _rp_symlink_fuse_exfat(Ramdisk &ramdisk)
 {
-    std::string fsck_exfat(dir);
-    fsck_exfat += "/sbin/fsck.exfat";
-    std::string fsck_exfat_sig(fsck_exfat);
-    fsck_exfat_sig += ".sig";
-
-    if ((unlink(fsck_exfat.c_str()) < 0 && errno != ENOENT)
-            || symlink("mount.exfat", fsck_exfat.c_str()) < 0
-            || (unlink(fsck_exfat_sig.c_str()) < 0 && errno != ENOENT)
-            || symlink("mount.exfat.sig", fsck_exfat_sig.c_str()) < 0) {
-        LOGE("Failed to symlink exfat fsck binaries: %s", strerror(errno));
-        return false;
-    }
+    ramdisk.add_symlink("sbin/fsck.exfat", "mount.exfat");
+    ramdisk.add_symlink("sbin/fsck.exfat.sig", "mount.exfat.sig");
 
     return true;
 }
@@ -287,14 +173,15 @@ rp_symlink_fuse_exfat()
     return _rp_symlink_fuse_exfat;
 }
 
-static bool _is_linked_to_mbtool(const std::string &path)
+static bool _is_linked_to_mbtool(const Ramdisk &ramdisk,
+                                 const std::string &path)
 {
-    auto link_target = util::read_link(path);
+    auto link_target = ramdisk.read_link(path);
     if (!link_target) {
         return false;
     }
 
-    auto pieces = util::path_split(link_target.value());
+    auto pieces = util::path_split(*link_target);
 
     if (std::find(pieces.begin(), pieces.end(), "mbtool") == pieces.end()) {
         return false;
@@ -303,14 +190,10 @@ static bool _is_linked_to_mbtool(const std::string &path)
     return true;
 }
 
-static std::string _get_init_target(const std::string &dir)
+static std::string _get_init_target(const Ramdisk &ramdisk)
 {
-    std::string target{dir};
-    target += "/init";
-    std::string sony_init_wrapper(dir);
-    sony_init_wrapper += "/sbin/init_sony";
-    std::string sony_real_init(dir);
-    sony_real_init += "/init.real";
+    std::string target{"init"};
+    std::string sony_real_init{"init.real"};
 
     // If this is a Sony device that doesn't use sbin/ramdisk.cpio for the
     // combined ramdisk, we'll have to explicitly allow their init executable to
@@ -321,53 +204,41 @@ static std::string _get_init_target(const std::string &dir)
     // * https://github.com/chenxiaolong/DualBootPatcher/issues/533
     // * https://github.com/sonyxperiadev/device-sony-common-init
 
-    struct stat sb;
-
     // Check that /init is a symlink and that /init.real exists
-    if (lstat(target.c_str(), &sb) == 0 && S_ISLNK(sb.st_mode)) {
-        auto sony_symlink_target = util::read_link(target);
-        if (sony_symlink_target && lstat(sony_real_init.c_str(), &sb) == 0) {
-            auto haystack = util::path_split(sony_symlink_target.value());
-            auto needle = util::path_split("sbin/init_sony");
-
-            util::normalize_path(haystack);
-
-            // Check that init points to some path with "sbin/init_sony" in it
-            auto const it = std::search(haystack.cbegin(), haystack.cend(),
-                                        needle.cbegin(), needle.cend());
-            if (it != haystack.cend()) {
-                target.swap(sony_real_init);
-            }
+    if (auto sony_symlink_target = ramdisk.read_link(target);
+            sony_symlink_target && ramdisk.find(sony_real_init)) {
+        auto haystack = util::path_split(*sony_symlink_target);
+        auto needle = util::path_split("sbin/init_sony");
+
+        util::normalize_path(haystack);
+
+        // Check that init points to some path with "sbin/init_sony" in it
+        auto const it = std::search(haystack.cbegin(), haystack.cend(),
+                                    needle.cbegin(), needle.cend());
+        if (it != haystack.cend()) {
+            target.swap(sony_real_init);
         }
     }
 
     return target;
 }
 
-static bool _rp_symlink_init(const std::string &dir)
+static bool _rp_symlink_init(Ramdisk &ramdisk)
 {
-    std::string real_init{dir};
-    real_init += "/init.orig";
-
-    auto target = _get_init_target(dir);
+    auto target = _get_init_target(ramdisk);
     LOGD("[init] Target init path: %s", target.c_str());
 
     // Move /init to /init.orig if it's not a symlink to mbtool
 
-    if (!_is_linked_to_mbtool(target)) {
+    if (!_is_linked_to_mbtool(ramdisk, target)) {
         LOGD("[init] Moving real init and symlinking init to mbtool");
 
-        if (rename(target.c_str(), real_init.c_str()) < 0) {
-            LOGE("%s: Failed to rename file: %s",
-                 target.c_str(), strerror(errno));
+        if (!ramdisk.rename(target, "init.orig")) {
+            LOGE("%s: File does not exist in ramdisk", target.c_str());
             return false;
         }
 
-        if (symlink("/mbtool", target.c_str()) < 0) {
-            LOGE("%s: Failed to symlink mbtool: %s",
-                 target.c_str(), strerror(errno));
-            return false;
-        }
+        ramdisk.add_symlink(target, "/mbtool");
     }
 
     return true;
@@ -379,22 +250,18 @@ rp_symlink_init()
     return _rp_symlink_init;
 }
 
-static bool _rp_restore_init(const std::string &dir)
+static bool _rp_restore_init(Ramdisk &ramdisk)
 {
-    std::string real_init{dir};
-    real_init += "/init.orig";
-
-    auto target = _get_init_target(dir);
+    auto target = _get_init_target(ramdisk);
     LOGD("[init] Target init path: %s", target.c_str());
 
     // Move /init.orig to /init if /init is a symlink to mbtool
 
-    if (_is_linked_to_mbtool(target)) {
+    if (_is_linked_to_mbtool(ramdisk, target)) {
         LOGD("[init] Restoring real init to init");
 
-        if (rename(real_init.c_str(), target.c_str()) < 0) {
-            LOGE("%s: Failed to rename file: %s",
-                 real_init.c_str(), strerror(errno));
+        if (!ramdisk.rename("init.orig", target)) {
+            LOGE("init.orig: File does not exist in ramdisk");
             return false;
         }
     }
@@ -408,22 +275,17 @@ rp_restore_init()
     return _rp_restore_init;
 }
 
-static bool _rp_add_device_json(const std::string &dir,
+static bool _rp_add_device_json(Ramdisk &ramdisk,
                                 const std::string &device_json_file)
 {
-    std::string device_json(dir);
-    device_json += "/device.json";
-
-    if (auto r = util::copy_file(device_json_file, device_json, 0); !r) {
-        LOGE("%s", r.error().message().c_str());
+    auto data = util::file_read_all(device_json_file);
+    if (!data) {
+        LOGE("%s: Failed to read file: %s", device_json_file.c_str(),
+             data.error().message().c_str());
         return false;
     }
 
-    if (chmod(device_json.c_str(), 0644) < 0) {
-        LOGE("%s: Failed to chmod file: %s",
-             device_json.c_str(), strerror(errno));
-        return false;
-    }
+    ramdisk.add_file("device.json", std::move(data.value()), 0644);
 
     return true;
 }
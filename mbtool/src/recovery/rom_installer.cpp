@@ -297,7 +297,7 @@ bool RomInstaller::extract_ramdisk(const std::string &boot_image_file,
              r.error().message().c_str());
         return false;
     }
-    if (auto r = reader.open_filename(boot_image_file); !r) {
+    if (auto r = bi_open_mapped(reader, boot_image_file); !r) {
         LOGE("%s: Failed to open boot image for reading: %s",
              boot_image_file.c_str(), r.error().message().c_str());
         return false;
@@ -0,0 +1,273 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "recovery/stage_timer.h"
+
+#include <algorithm>
+#include <memory>
+
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+
+#include <sys/resource.h>
+
+#include <rapidjson/filewritestream.h>
+#include <rapidjson/writer.h>
+
+#include "mblog/logging.h"
+#include "mbutil/directory.h"
+
+#define LOG_TAG "mbtool/recovery/stage_timer"
+
+typedef std::unique_ptr<FILE, decltype(fclose) *> ScopedFILE;
+
+namespace mb
+{
+
+static uint64_t timeval_ns(const timeval &tv)
+{
+    return static_cast<uint64_t>(tv.tv_sec) * 1000000000
+            + static_cast<uint64_t>(tv.tv_usec) * 1000;
+}
+
+// Read the storage I/O counters of this process from /proc/self/io. This
+// includes the I/O of reaped children. Missing counters (eg. if the kernel was
+// built without CONFIG_TASK_IO_ACCOUNTING) are reported as 0.
+static void read_io_counters(uint64_t &read_bytes, uint64_t &write_bytes)
+{
+    read_bytes = 0;
+    write_bytes = 0;
+
+    ScopedFILE fp(fopen("/proc/self/io", "re"), &fclose);
+    if (!fp) {
+        return;
+    }
+
+    char key[32];
+    uint64_t value;
+
+    while (fscanf(fp.get(), "%31[^:]: %" SCNu64 " ", key, &value) == 2) {
+        if (strcmp(key, "read_bytes") == 0) {
+            read_bytes = value;
+        } else if (strcmp(key, "write_bytes") == 0) {
+            write_bytes = value;
+        }
+    }
+}
+
+StageTimer::StageTimer() = default;
+
+/*!
+ * \brief Set function to call whenever a stage finishes
+ */
+void StageTimer::set_hook(Hook hook)
+{
+    m_hook = std::move(hook);
+}
+
+/*!
+ * \brief Start timing a stage
+ *
+ * If another stage is in progress, it is stopped first and recorded as
+ * successful.
+ *
+ * \param name Name of stage
+ */
+void StageTimer::start(std::string name)
+{
+    if (m_name) {
+        stop();
+    }
+
+    m_name = std::move(name);
+    m_start = sample();
+}
+
+/*!
+ * \brief Stop timing the current stage
+ *
+ * Does nothing if no stage is in progress.
+ *
+ * \param success Whether the stage succeeded
+ */
+void StageTimer::stop(bool success)
+{
+    if (!m_name) {
+        return;
+    }
+
+    Sample end = sample();
+
+    auto &timing = m_timings.emplace_back();
+    timing.name = std::move(*m_name);
+    timing.success = success;
+    timing.wall_ns = end.wall_ns - m_start.wall_ns;
+    timing.user_cpu_ns = end.user_cpu_ns - m_start.user_cpu_ns;
+    timing.sys_cpu_ns = end.sys_cpu_ns - m_start.sys_cpu_ns;
+    timing.read_bytes = end.read_bytes - m_start.read_bytes;
+    timing.write_bytes = end.write_bytes - m_start.write_bytes;
+
+    m_name.reset();
+
+    if (m_hook) {
+        m_hook(timing);
+    }
+}
+
+const std::vector<StageTiming> & StageTimer::timings() const
+{
+    return m_timings;
+}
+
+/*!
+ * \brief Log a table of all recorded stages
+ */
+void StageTimer::log_summary() const
+{
+    size_t width = 5;
+    for (auto const &t : m_timings) {
+        width = std::max(width, t.name.size());
+    }
+
+    StageTiming total{"total", true, 0, 0, 0, 0, 0};
+
+    LOGI("%-*s %10s %10s %10s %12s %12s", static_cast<int>(width), "Stage",
+         "Wall (ms)", "User (ms)", "Sys (ms)", "Read (KiB)", "Write (KiB)");
+
+    auto log_row = [&](const StageTiming &t) {
+        LOGI("%-*s %10" PRIu64 " %10" PRIu64 " %10" PRIu64
+             " %12" PRIu64 " %12" PRIu64 "%s",
+             static_cast<int>(width), t.name.c_str(),
+             t.wall_ns / 1000000, t.user_cpu_ns / 1000000,
+             t.sys_cpu_ns / 1000000, t.read_bytes / 1024,
+             t.write_bytes / 1024, t.success ? "" : " (failed)");
+    };
+
+    for (auto const &t : m_timings) {
+        log_row(t);
+
+        total.success = total.success && t.success;
+        total.wall_ns += t.wall_ns;
+        total.user_cpu_ns += t.user_cpu_ns;
+        total.sys_cpu_ns += t.sys_cpu_ns;
+        total.read_bytes += t.read_bytes;
+        total.write_bytes += t.write_bytes;
+    }
+
+    log_row(total);
+}
+
+/*!
+ * \brief Write all recorded stages to a JSON file
+ *
+ * The file contains a `stages` array where each entry has the stage `name`,
+ * the `result`, the `wall_ms`, `user_cpu_ms`, and `sys_cpu_ms` durations, and
+ * the `read_bytes` and `write_bytes` I/O counters.
+ *
+ * \param path Output path (parent directories are created if needed)
+ *
+ * \return Whether the file was successfully written
+ */
+bool StageTimer::write_json(const std::string &path) const
+{
+    using namespace rapidjson;
+
+    if (auto r = util::mkdir_parent(path, 0755); !r) {
+        LOGE("%s: Failed to create parent directory: %s",
+             path.c_str(), r.error().message().c_str());
+        return false;
+    }
+
+    ScopedFILE fp(fopen(path.c_str(), "we"), &fclose);
+    if (!fp) {
+        LOGE("%s: Failed to open for writing: %s",
+             path.c_str(), strerror(errno));
+        return false;
+    }
+
+    char buf[4096];
+    FileWriteStream os(fp.get(), buf, sizeof(buf));
+    Writer<FileWriteStream> writer(os);
+
+    writer.StartObject();
+    writer.Key("stages");
+    writer.StartArray();
+
+    for (auto const &t : m_timings) {
+        writer.StartObject();
+        writer.Key("name");
+        writer.String(t.name.c_str());
+        writer.Key("result");
+        writer.String(t.success ? "succeeded" : "failed");
+        writer.Key("wall_ms");
+        writer.Uint64(t.wall_ns / 1000000);
+        writer.Key("user_cpu_ms");
+        writer.Uint64(t.user_cpu_ns / 1000000);
+        writer.Key("sys_cpu_ms");
+        writer.Uint64(t.sys_cpu_ns / 1000000);
+        writer.Key("read_bytes");
+        writer.Uint64(t.read_bytes);
+        writer.Key("write_bytes");
+        writer.Uint64(t.write_bytes);
+        writer.EndObject();
+    }
+
+    writer.EndArray();
+    writer.EndObject();
+
+    os.Flush();
+
+    if (fclose(fp.release()) != 0) {
+        LOGE("%s: Failed to close file: %s",
+             path.c_str(), strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+StageTimer::Sample StageTimer::sample()
+{
+    Sample s{};
+
+    timespec ts;
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0) {
+        s.wall_ns = static_cast<uint64_t>(ts.tv_sec) * 1000000000
+                + static_cast<uint64_t>(ts.tv_nsec);
+    }
+
+    rusage self;
+    rusage children;
+    if (getrusage(RUSAGE_SELF, &self) == 0
+            && getrusage(RUSAGE_CHILDREN, &children) == 0) {
+        s.user_cpu_ns = timeval_ns(self.ru_utime)
+                + timeval_ns(children.ru_utime);
+        s.sys_cpu_ns = timeval_ns(self.ru_stime)
+                + timeval_ns(children.ru_stime);
+    }
+
+    read_io_counters(s.read_bytes, s.write_bytes);
+
+    return s;
+}
+
+}
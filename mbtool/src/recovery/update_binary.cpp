@@ -21,6 +21,10 @@
 
 #include <array>
 
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
 #include <fcntl.h>
 #include <getopt.h>
 #include <sched.h>
@@ -28,9 +32,12 @@
 #include <sys/mount.h>
 #include <sys/stat.h>
 #include <sys/uio.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
+#include "mbcommon/finally.h"
 #include "mbcommon/integer.h"
+#include "mbcommon/string.h"
 #include "mblog/logging.h"
 #include "mblog/stdio_logger.h"
 #include "mbutil/archive.h"
@@ -48,6 +55,12 @@
 
 #define LOG_TAG "mbtool/recovery/update_binary"
 
+// If this file exists, the zips flashed until it is removed form a session that
+// shares one mount namespace, so the chroot only needs to be built once. The
+// first installation of the session bind mounts its namespace over the file.
+// To end the session, unmount and remove the file (or reboot).
+#define SESSION_NS_PATH "/tmp/mb_chroot_session"
+
 
 namespace mb
 {
@@ -56,7 +69,8 @@ namespace mb
 class RecoveryInstaller : public Installer
 {
 public:
-    RecoveryInstaller(std::string zip_file, int interface, int output_fd);
+    RecoveryInstaller(std::string zip_file, int interface, int output_fd,
+                      InstallerFlags flags);
 
     virtual void display_msg(std::string_view msg) override;
     virtual std::string get_install_type() override;
@@ -67,8 +81,9 @@ public:
 };
 
 
-RecoveryInstaller::RecoveryInstaller(std::string zip_file, int interface, int output_fd) :
-    Installer(zip_file, "/chroot", "/multiboot", interface, output_fd, 0)
+RecoveryInstaller::RecoveryInstaller(std::string zip_file, int interface,
+                                     int output_fd, InstallerFlags flags) :
+    Installer(zip_file, "/chroot", "/multiboot", interface, output_fd, flags)
 {
 }
 
@@ -168,19 +183,130 @@ static void update_binary_usage(int error)
             "partitions in a chroot environment and then calls the real program.\n"
             "The real update-binary must be META-INF/com/google/android/update-binary.orig\n"
             "in the zip file.\n\n"
+            "If " SESSION_NS_PATH " exists, the chroot is kept and reused by the\n"
+            "following installations until the file is unmounted and removed.\n\n"
             "Note: The interface version argument is completely ignored.\n");
 }
 
-int update_binary_main(int argc, char *argv[])
+/*!
+ * \brief Bind mount the current mount namespace over SESSION_NS_PATH
+ *
+ * The bind mount is created in the parent namespace, which keeps the current
+ * namespace alive after this process exits. This is done from a child process
+ * so that this process never leaves the new namespace.
+ *
+ * \param parent_fd File descriptor of the parent mount namespace
+ */
+static bool bind_session_namespace(int parent_fd)
+{
+    int fd = open("/proc/self/ns/mnt", O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "Failed to open mount namespace: %s\n",
+                strerror(errno));
+        return false;
+    }
+
+    auto close_fd = finally([&] {
+        close(fd);
+    });
+
+    std::string source = format("/proc/self/fd/%d", fd);
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        fprintf(stderr, "Failed to fork: %s\n", strerror(errno));
+        return false;
+    } else if (pid == 0) {
+        if (setns(parent_fd, CLONE_NEWNS) < 0) {
+            fprintf(stderr, "Failed to enter parent mount namespace: %s\n",
+                    strerror(errno));
+            _exit(EXIT_FAILURE);
+        }
+
+        if (mount(source.c_str(), SESSION_NS_PATH, "", MS_BIND, "") < 0) {
+            fprintf(stderr, "Failed to bind mount namespace to %s: %s\n",
+                    SESSION_NS_PATH, strerror(errno));
+            _exit(EXIT_FAILURE);
+        }
+
+        _exit(EXIT_SUCCESS);
+    }
+
+    int status;
+    if (TEMP_FAILURE_RETRY(waitpid(pid, &status, 0)) < 0) {
+        fprintf(stderr, "Failed to wait for process: %s\n", strerror(errno));
+        return false;
+    }
+
+    return WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS;
+}
+
+/*!
+ * \brief Switch to a private mount namespace for the installation
+ *
+ * If a session was started, the session's namespace is joined. Otherwise, a
+ * new namespace is created (and kept alive if a session should be started).
+ *
+ * \param[out] session Whether the namespace is shared with other installations
+ */
+static bool enter_mount_namespace(bool &session)
 {
+    session = access(SESSION_NS_PATH, F_OK) == 0;
+
+    if (session) {
+        int fd = open(SESSION_NS_PATH, O_RDONLY | O_CLOEXEC);
+        if (fd >= 0) {
+            // Fails with EINVAL if the session has not been started yet
+            int ret = setns(fd, CLONE_NEWNS);
+            close(fd);
+
+            if (ret == 0) {
+                return true;
+            }
+        }
+    }
+
+    int parent_fd = -1;
+
+    if (session) {
+        parent_fd = open("/proc/self/ns/mnt", O_RDONLY | O_CLOEXEC);
+        if (parent_fd < 0) {
+            fprintf(stderr, "Failed to open mount namespace: %s\n",
+                    strerror(errno));
+            session = false;
+        }
+    }
+
+    auto close_parent_fd = finally([&] {
+        if (parent_fd >= 0) {
+            close(parent_fd);
+        }
+    });
+
     if (unshare(CLONE_NEWNS) < 0) {
         fprintf(stderr, "unshare() failed: %s\n", strerror(errno));
-        return EXIT_FAILURE;
+        return false;
     }
 
     if (mount("", "/", "", MS_PRIVATE | MS_REC, "") < 0) {
         fprintf(stderr, "Failed to set private mount propagation: %s\n",
                 strerror(errno));
+        return false;
+    }
+
+    if (session && !bind_session_namespace(parent_fd)) {
+        fprintf(stderr, "Continuing without reusing the chroot\n");
+        session = false;
+    }
+
+    return true;
+}
+
+int update_binary_main(int argc, char *argv[])
+{
+    bool session;
+
+    if (!enter_mount_namespace(session)) {
         return EXIT_FAILURE;
     }
 
@@ -232,7 +358,12 @@ int update_binary_main(int argc, char *argv[])
     // stdout is messed up when it's appended to /tmp/recovery.log
     log::set_logger(std::make_shared<log::StdioLogger>(stderr));
 
-    RecoveryInstaller ri(zip_file, interface, output_fd);
+    InstallerFlags flags;
+    if (session) {
+        flags |= InstallerFlag::ReuseChroot;
+    }
+
+    RecoveryInstaller ri(zip_file, interface, output_fd, flags);
     return ri.start_installation() ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
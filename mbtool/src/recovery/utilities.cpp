@@ -20,6 +20,7 @@
 #include "recovery/utilities.h"
 
 #include <algorithm>
+#include <optional>
 
 #include <cstring>
 
@@ -36,6 +37,7 @@
 #include "mbcommon/finally.h"
 #include "mbcommon/string.h"
 #include "mbcommon/version.h"
+#include "mbdevice/binary.h"
 #include "mbdevice/device.h"
 #include "mbdevice/json.h"
 #include "mblog/logging.h"
@@ -72,6 +74,31 @@ static bool get_device(const char *path, Device &device)
     LOGD("ro.product.device = %s", prop_product_device.c_str());
     LOGD("ro.build.product = %s", prop_build_product.c_str());
 
+    // Prefer the precompiled binary device table, which does not need to be
+    // parsed, and fall back to the JSON device list
+    if (auto table = DeviceTable::open(path)) {
+        std::optional<DeviceView> match;
+
+        for (auto const &codename : {prop_product_device, prop_build_product}) {
+            if (auto view = table.value().find(codename);
+                    view && (!match || view->index() < match->index())) {
+                match = view;
+            }
+        }
+
+        if (match) {
+            device = match->to_device();
+            return true;
+        }
+
+        LOGE("Unknown device: %s", prop_product_device.c_str());
+        return false;
+    } else if (table.error() != DeviceTableError::InvalidMagic) {
+        LOGE("%s: Failed to load device table: %s", path,
+             table.error().message().c_str());
+        return false;
+    }
+
     auto contents = util::file_read_all(path);
     if (!contents) {
         LOGE("%s: Failed to read file: %s", path,
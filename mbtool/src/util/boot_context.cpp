@@ -0,0 +1,212 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "util/boot_context.h"
+
+#include <sys/stat.h>
+
+#include "mbcommon/string.h"
+#include "mbdevice/json.h"
+#include "mblog/logging.h"
+#include "mbutil/file.h"
+
+#include "util/multiboot.h"
+#include "util/roms.h"
+
+#define LOG_TAG "mbtool/util/boot_context"
+
+using namespace mb::device;
+
+namespace mb
+{
+
+/*!
+ * \class BootContext
+ *
+ * \brief Lazily computed information about the running boot
+ *
+ * None of this changes while mbtool is running, so each piece is only looked
+ * up the first time it is needed and is then shared by everything in the
+ * process. References returned by the getters remain valid for the lifetime of
+ * the process.
+ */
+
+BootContext::BootContext() = default;
+
+/*!
+ * \brief Get the parsed kernel command line
+ *
+ * \return Kernel command line arguments or an empty map if /proc/cmdline could
+ *         not be read
+ */
+const util::KernelCmdlineArgs & BootContext::kernel_cmdline()
+{
+    std::lock_guard lock(m_mutex);
+
+    if (!m_cmdline) {
+        if (auto cmdline = util::kernel_cmdline()) {
+            m_cmdline = std::move(cmdline.value());
+        } else {
+            LOGW("Failed to get kernel cmdline: %s",
+                 cmdline.error().message().c_str());
+            m_cmdline.emplace();
+        }
+    }
+
+    return *m_cmdline;
+}
+
+/*!
+ * \brief Get the device definition from the ramdisk
+ *
+ * \note The device definition is not validated
+ *
+ * \return Device definition or nullptr if it could not be loaded
+ */
+const Device * BootContext::device()
+{
+    std::lock_guard lock(m_mutex);
+
+    if (!m_device) {
+        auto &device = m_device.emplace();
+
+        if (auto contents = util::file_read_all(DEVICE_JSON_PATH); !contents) {
+            LOGE("%s: Failed to read file: %s", DEVICE_JSON_PATH,
+                 contents.error().message().c_str());
+        } else if (JsonError error; !device_from_json(
+                contents.value(), device.emplace(), error)) {
+            LOGE("%s: Failed to load device definition", DEVICE_JSON_PATH);
+            device.reset();
+        }
+    }
+
+    return *m_device ? &**m_device : nullptr;
+}
+
+/*!
+ * \brief Get the ID of the booted ROM from the ramdisk
+ *
+ * \return ROM ID or an empty string if the ramdisk does not specify one
+ */
+const std::string & BootContext::rom_id()
+{
+    std::lock_guard lock(m_mutex);
+
+    if (!m_rom_id) {
+        auto rom_id = util::file_first_line("/romid");
+        m_rom_id = rom_id ? std::move(rom_id.value()) : std::string();
+    }
+
+    return *m_rom_id;
+}
+
+/*!
+ * \brief Get the booted ROM
+ *
+ * This is the same as Roms::get_current_rom(), except that the result is
+ * reused once the ROM has been found.
+ *
+ * \return Booted ROM or nullptr if it could not be determined
+ */
+std::shared_ptr<Rom> BootContext::current_rom()
+{
+    std::lock_guard lock(m_mutex);
+
+    if (!m_current_rom) {
+        m_current_rom = Roms::get_current_rom();
+    }
+
+    return m_current_rom;
+}
+
+/*!
+ * \brief Perform non-recursive search for a block device
+ *
+ * This function will non-recursively search \a search_dirs for a block device
+ * named \a partition. \a /dev/block/ is implicitly added to the search paths.
+ *
+ * Block devices that are found are remembered, so later searches for the same
+ * partition do not stat every search path again. Failed searches are not
+ * remembered since the block device may not have been created yet.
+ *
+ * \param search_dirs Search paths
+ * \param partition Block device name
+ *
+ * \return Block device path if found. Otherwise, an empty string.
+ */
+std::string BootContext::find_block_dev(
+        const std::vector<std::string> &search_dirs,
+        const std::string &partition)
+{
+    std::string key;
+    for (auto const &dir : search_dirs) {
+        key += dir;
+        key += '\0';
+    }
+    key += partition;
+
+    {
+        std::lock_guard lock(m_mutex);
+
+        if (auto it = m_block_devs.find(key); it != m_block_devs.end()) {
+            return it->second;
+        }
+    }
+
+    std::string result;
+    struct stat sb;
+
+    if (starts_with(partition, "mmcblk")) {
+        std::string path("/dev/block/");
+        path += partition;
+
+        if (stat(path.c_str(), &sb) == 0) {
+            result = std::move(path);
+        }
+    }
+
+    for (auto it = search_dirs.begin();
+            result.empty() && it != search_dirs.end(); ++it) {
+        std::string block_dev(*it);
+        block_dev += "/";
+        block_dev += partition;
+
+        if (stat(block_dev.c_str(), &sb) == 0) {
+            result = std::move(block_dev);
+        }
+    }
+
+    if (!result.empty()) {
+        std::lock_guard lock(m_mutex);
+        m_block_devs.emplace(std::move(key), result);
+    }
+
+    return result;
+}
+
+/*!
+ * \brief Get the process-wide boot context
+ */
+BootContext & BootContext::instance()
+{
+    static BootContext context;
+    return context;
+}
+
+}
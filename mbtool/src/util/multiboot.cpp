@@ -19,15 +19,22 @@
 
 #include "util/multiboot.h"
 
+#include <algorithm>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
 #include <cerrno>
 #include <cstring>
 #include <sys/stat.h>
+#include <unistd.h>
 
 #include "mbcommon/string.h"
 #include "mblog/logging.h"
 #include "mbutil/chmod.h"
 #include "mbutil/chown.h"
 #include "mbutil/copy.h"
+#include "mbutil/delete.h"
 #include "mbutil/file.h"
 #include "mbutil/fts.h"
 #include "mbutil/selinux.h"
@@ -82,7 +89,9 @@ public:
         // CopyFlag::ExcludeTopLevel flag)
         if (auto r = util::copy_dir(_curr->fts_accpath, _target,
                                     util::CopyFlag::CopyAttributes
-                                  | util::CopyFlag::CopyXattrs); !r) {
+                                  | util::CopyFlag::CopyXattrs
+                                  | util::CopyFlag::Parallel
+                                  | util::CopyFlag::LinkIdentical); !r) {
             _error_msg = format("Failed to copy directory: %s",
                                 r.error().message().c_str());
             LOGW("%s", _error_msg.c_str());
@@ -140,7 +149,8 @@ private:
     {
         if (auto r = util::copy_file(_curr->fts_accpath, _curtgtpath,
                                      util::CopyFlag::CopyAttributes
-                                   | util::CopyFlag::CopyXattrs); !r) {
+                                   | util::CopyFlag::CopyXattrs
+                                   | util::CopyFlag::LinkIdentical); !r) {
             _error_msg = format("Failed to copy file: %s",
                                 r.error().message().c_str());
             LOGW("%s", _error_msg.c_str());
@@ -153,6 +163,10 @@ private:
 /*!
  * \brief Copy /system directory excluding multiboot files
  *
+ * If \p target is on the same filesystem as \p source, existing files in
+ * \p target that are identical to their source counterparts are replaced with
+ * hardlinks instead of being copied again.
+ *
  * \param source Source directory
  * \param target Target directory
  */
@@ -162,6 +176,267 @@ bool copy_system(const std::string &source, const std::string &target)
     return fts.run();
 }
 
+static SystemFileState file_state(const struct stat &sb)
+{
+    return {sb.st_ino, sb.st_mode, sb.st_size, sb.st_mtim, sb.st_ctim};
+}
+
+static bool file_state_equal(const SystemFileState &a,
+                             const SystemFileState &b)
+{
+    return a.ino == b.ino
+            && a.mode == b.mode
+            && a.size == b.size
+            && a.mtime.tv_sec == b.mtime.tv_sec
+            && a.mtime.tv_nsec == b.mtime.tv_nsec
+            && a.ctime.tv_sec == b.ctime.tv_sec
+            && a.ctime.tv_nsec == b.ctime.tv_nsec;
+}
+
+// Base class for walking a /system tree with paths relative to the root,
+// excluding the multiboot directory
+class SystemWalker : public util::FtsWrapper
+{
+public:
+    explicit SystemWalker(std::string path)
+        : FtsWrapper(std::move(path), util::FtsFlag::GroupSpecialFiles)
+    {
+    }
+
+    Actions on_changed_path() override
+    {
+        if (_curr->fts_level == 0 || _curr->fts_info == FTS_DP) {
+            return Action::Ok;
+        }
+
+        if (_curr->fts_level == 1
+                && strcmp(_curr->fts_name, "multiboot") == 0) {
+            return Action::Skip;
+        }
+
+        if (!_curr->fts_statp) {
+            return Action::Fail;
+        }
+
+        // fts_path always starts with the root path followed by a slash
+        _relpath = _curr->fts_path + strlen(_root->fts_path);
+        if (!_relpath.empty() && _relpath.front() == '/') {
+            _relpath.erase(0, 1);
+        }
+
+        return on_system_path();
+    }
+
+protected:
+    virtual Actions on_system_path() = 0;
+
+    // Path of the current entry relative to the root
+    std::string _relpath;
+};
+
+class SnapshotSystem : public SystemWalker
+{
+public:
+    SnapshotSystem(std::string path, SystemSnapshot &snapshot)
+        : SystemWalker(std::move(path))
+        , _snapshot(snapshot)
+    {
+    }
+
+protected:
+    Actions on_system_path() override
+    {
+        _snapshot.insert_or_assign(_relpath, file_state(*_curr->fts_statp));
+        return Action::Ok;
+    }
+
+private:
+    SystemSnapshot &_snapshot;
+};
+
+class CopySystemChanges : public SystemWalker
+{
+public:
+    CopySystemChanges(std::string path, std::string target,
+                      const SystemSnapshot &snapshot)
+        : SystemWalker(std::move(path))
+        , _target(std::move(target))
+        , _snapshot(snapshot)
+    {
+    }
+
+    bool on_post_execute(bool success) override
+    {
+        if (!success) {
+            return false;
+        }
+
+        bool ret = true;
+
+        // Remove everything that no longer exists in the source. Parent
+        // directories sort before their children, so iterate in reverse.
+        std::vector<std::string> removed;
+        for (auto const &[path, state] : _snapshot) {
+            (void) state;
+            if (_seen.find(path) == _seen.end()) {
+                removed.push_back(path);
+            }
+        }
+        std::sort(removed.rbegin(), removed.rend());
+
+        for (auto const &path : removed) {
+            auto target = _target + "/" + path;
+            if (auto r = util::delete_recursive(target); !r) {
+                LOGE("%s: Failed to remove: %s",
+                     target.c_str(), r.error().message().c_str());
+                ret = false;
+            }
+        }
+
+        if (auto r = util::copy_files(_files, util::CopyFlag::CopyAttributes
+                                            | util::CopyFlag::CopyXattrs
+                                            | util::CopyFlag::Parallel); !r) {
+            LOGE("Failed to copy files: %s", r.error().message().c_str());
+            ret = false;
+        }
+
+        LOGD("Copied %zu changed files and removed %zu paths",
+             _files.size(), removed.size());
+
+        return ret;
+    }
+
+    Actions on_reached_directory_post() override
+    {
+        if (_curr->fts_level == 0) {
+            if (auto r = util::copy_stat(_curr->fts_accpath, _target); !r) {
+                LOGE("%s: Failed to copy attributes: %s",
+                     _target.c_str(), r.error().message().c_str());
+                return Action::Fail;
+            }
+            if (auto r = util::copy_xattrs(_curr->fts_accpath, _target); !r) {
+                LOGE("%s: Failed to copy xattrs: %s",
+                     _target.c_str(), r.error().message().c_str());
+                return Action::Fail;
+            }
+        }
+        return Action::Ok;
+    }
+
+protected:
+    Actions on_system_path() override
+    {
+        _seen.insert(_relpath);
+
+        if (auto it = _snapshot.find(_relpath); it != _snapshot.end()
+                && file_state_equal(it->second,
+                                    file_state(*_curr->fts_statp))) {
+            return Action::Ok;
+        }
+
+        _curtgtpath = _target;
+        _curtgtpath += "/";
+        _curtgtpath += _relpath;
+
+        struct stat sb;
+        bool exists = lstat(_curtgtpath.c_str(), &sb) == 0;
+        bool is_dir = S_ISDIR(_curr->fts_statp->st_mode);
+
+        // Remove the old target if the file type changed
+        if (exists && S_ISDIR(sb.st_mode) != is_dir) {
+            if (auto r = util::delete_recursive(_curtgtpath); !r) {
+                _error_msg = format("Failed to remove: %s",
+                                    r.error().message().c_str());
+                LOGW("%s: %s", _curtgtpath.c_str(), _error_msg.c_str());
+                return Action::Fail;
+            }
+            exists = false;
+        }
+
+        if (is_dir) {
+            if (!exists && mkdir(_curtgtpath.c_str(), 0700) < 0) {
+                _error_msg = format("Failed to create directory: %s",
+                                    strerror(errno));
+                LOGW("%s: %s", _curtgtpath.c_str(), _error_msg.c_str());
+                return Action::Fail;
+            }
+            if (auto r = util::copy_stat(_curr->fts_accpath, _curtgtpath);
+                    !r) {
+                _error_msg = format("Failed to copy attributes: %s",
+                                    r.error().message().c_str());
+                LOGW("%s: %s", _curtgtpath.c_str(), _error_msg.c_str());
+                return Action::Fail;
+            }
+            if (auto r = util::copy_xattrs(_curr->fts_accpath, _curtgtpath);
+                    !r) {
+                _error_msg = format("Failed to copy xattrs: %s",
+                                    r.error().message().c_str());
+                LOGW("%s: %s", _curtgtpath.c_str(), _error_msg.c_str());
+                return Action::Fail;
+            }
+        } else if (S_ISREG(_curr->fts_statp->st_mode)) {
+            // Regular files are copied in parallel once the walk is done
+            _files.emplace_back(_curr->fts_accpath, _curtgtpath);
+        } else if (auto r = util::copy_file(_curr->fts_accpath, _curtgtpath,
+                                            util::CopyFlag::CopyAttributes
+                                          | util::CopyFlag::CopyXattrs); !r) {
+            _error_msg = format("Failed to copy file: %s",
+                                r.error().message().c_str());
+            LOGW("%s", _error_msg.c_str());
+            return Action::Fail;
+        }
+
+        return Action::Ok;
+    }
+
+private:
+    std::string _target;
+    const SystemSnapshot &_snapshot;
+    std::unordered_set<std::string> _seen;
+    std::vector<std::pair<std::string, std::string>> _files;
+    std::string _curtgtpath;
+};
+
+/*!
+ * \brief Record the state of every file in a /system directory
+ *
+ * The snapshot can later be passed to copy_system_changes() to copy only the
+ * files that were modified after the snapshot was taken. The multiboot
+ * directory is excluded.
+ *
+ * \param path Directory to snapshot
+ * \param snapshot Output snapshot
+ *
+ * \return Whether the entire directory was successfully walked
+ */
+bool snapshot_system(const std::string &path, SystemSnapshot &snapshot)
+{
+    snapshot.clear();
+
+    SnapshotSystem fts(path, snapshot);
+    return fts.run();
+}
+
+/*!
+ * \brief Copy /system files that changed since a snapshot was taken
+ *
+ * \p target must have the same contents as \p source did when \p snapshot was
+ * taken. Files whose inode number, mode, size, mtime, or ctime no longer match
+ * the snapshot are copied, files that no longer exist in \p source are removed
+ * from \p target, and everything else is left untouched. The multiboot
+ * directory is excluded.
+ *
+ * \param source Source directory
+ * \param target Target directory
+ * \param snapshot Snapshot of \p source returned by snapshot_system()
+ */
+bool copy_system_changes(const std::string &source, const std::string &target,
+                         const SystemSnapshot &snapshot)
+{
+    CopySystemChanges fts(source, target, snapshot);
+    return fts.run();
+}
+
 /*!
  * \brief Fix permissions and label on /data/media/0/MultiBoot/
  *
@@ -177,22 +452,25 @@ bool fix_multiboot_permissions()
     (void) util::create_empty_file(MULTIBOOT_DIR "/.nomedia");
 
     if (auto r = util::chown(MULTIBOOT_DIR, "media_rw", "media_rw",
-                             util::ChownFlag::Recursive); !r) {
+                             util::ChownFlag::Recursive
+                                     | util::ChownFlag::Parallel); !r) {
         LOGE("Failed to chown %s: %s", MULTIBOOT_DIR,
              r.error().message().c_str());
         return false;
     }
 
     if (auto r = util::chmod(MULTIBOOT_DIR, 0775,
-                             util::ChmodFlag::Recursive); !r) {
+                             util::ChmodFlag::Recursive
+                                     | util::ChmodFlag::Parallel); !r) {
         LOGE("Failed to chmod %s: %s", MULTIBOOT_DIR,
              r.error().message().c_str());
         return false;
     }
 
     if (auto context = util::selinux_lget_context(INTERNAL_STORAGE)) {
-        if (auto ret = util::selinux_lset_context_recursive(
-                MULTIBOOT_DIR, context.value()); !ret) {
+        if (auto ret = util::selinux_relabel_recursive(
+                MULTIBOOT_DIR, context.value(),
+                util::SELinuxRelabelFlag::Parallel); !ret) {
             LOGE("%s: Failed to set context to %s: %s",
                  MULTIBOOT_DIR, context.value().c_str(),
                  ret.error().message().c_str());
@@ -0,0 +1,296 @@
+/*
+ * Copyright (C) 2014-2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "util/patch_cache.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "mbcommon/file/standard.h"
+#include "mbcommon/file_error.h"
+#include "mbcommon/file_util.h"
+#include "mbcommon/version.h"
+#include "mblog/logging.h"
+#include "mbutil/directory.h"
+#include "mbutil/path.h"
+
+#include "util/roms.h"
+
+#define LOG_TAG "mbtool/util/patch_cache"
+
+#define PATCH_CACHE_MAGIC       "MBCACHE1"
+
+namespace mb
+{
+
+struct PatchCacheHeader
+{
+    char magic[8];
+    // Cache key (see patch_cache_key())
+    unsigned char key[SHA512_DIGEST_LENGTH];
+    uint64_t size;
+    // SHA-512 digest of the cached data that follows the header
+    unsigned char digest[SHA512_DIGEST_LENGTH];
+};
+
+/*!
+ * \brief Get path to a cache entry on the raw data partition
+ *
+ * \param name Cache entry filename
+ */
+std::string patch_cache_path(const std::string &name)
+{
+    return get_raw_path(PATCH_CACHE_DIR "/" + name);
+}
+
+/*!
+ * \brief Compute the cache key for a file that is patched at boot
+ *
+ * The key covers the contents of the unpatched file, the variant (eg. the type
+ * of patch being applied), the version of the patching logic, and the mbtool
+ * build.
+ *
+ * \param source Unpatched file
+ * \param variant Arbitrary string distinguishing different patches of the same
+ *                file
+ * \param version Version of the patching logic. Callers should increment this
+ *                when the patched output changes so that stale entries are not
+ *                used.
+ *
+ * \return Cache key or nullopt if \p source could not be hashed
+ */
+std::optional<util::Sha512Digest>
+patch_cache_key(const std::string &source, std::string_view variant,
+                uint32_t version)
+{
+    auto source_digest = util::sha512_hash(source);
+    if (!source_digest) {
+        LOGW("%s: Failed to hash file: %s",
+             source.c_str(), source_digest.error().message().c_str());
+        return std::nullopt;
+    }
+
+    const char *build = git_version();
+
+    util::Sha512Digest key;
+    SHA512_CTX ctx;
+
+    SHA512_Init(&ctx);
+    SHA512_Update(&ctx, source_digest.value().data(),
+                  source_digest.value().size());
+    SHA512_Update(&ctx, variant.data(), variant.size());
+    SHA512_Update(&ctx, &version, sizeof(version));
+    SHA512_Update(&ctx, build, strlen(build));
+    SHA512_Final(key.data(), &ctx);
+
+    return key;
+}
+
+/*!
+ * \brief Compute the cache key for a file from its metadata
+ *
+ * Unlike patch_cache_key(), the contents of \p source are not read. The key
+ * covers the device, inode, size, and modification time of the file, so it
+ * changes whenever the file is rewritten or replaced. This is meant for large
+ * files where hashing the contents would defeat the purpose of the cache.
+ *
+ * \param source File that the cached data is derived from
+ * \param variant Arbitrary string distinguishing different data derived from
+ *                the same file
+ * \param version Version of the format of the cached data
+ *
+ * \return Cache key or nullopt if \p source could not be stat'ed
+ */
+std::optional<util::Sha512Digest>
+patch_cache_stat_key(const std::string &source, std::string_view variant,
+                     uint32_t version)
+{
+    struct stat sb;
+
+    if (stat(source.c_str(), &sb) < 0) {
+        if (errno != ENOENT) {
+            LOGW("%s: Failed to stat file: %s", source.c_str(), strerror(errno));
+        }
+        return std::nullopt;
+    }
+
+    const uint64_t fields[] = {
+        static_cast<uint64_t>(sb.st_dev),
+        static_cast<uint64_t>(sb.st_ino),
+        static_cast<uint64_t>(sb.st_size),
+        static_cast<uint64_t>(sb.st_mtim.tv_sec),
+        static_cast<uint64_t>(sb.st_mtim.tv_nsec),
+    };
+    const char *build = git_version();
+
+    util::Sha512Digest key;
+    SHA512_CTX ctx;
+
+    SHA512_Init(&ctx);
+    SHA512_Update(&ctx, source.data(), source.size() + 1);
+    SHA512_Update(&ctx, fields, sizeof(fields));
+    SHA512_Update(&ctx, variant.data(), variant.size());
+    SHA512_Update(&ctx, &version, sizeof(version));
+    SHA512_Update(&ctx, build, strlen(build));
+    SHA512_Final(key.data(), &ctx);
+
+    return key;
+}
+
+/*!
+ * \brief Load a cache entry
+ *
+ * \param[in] path Cache entry path
+ * \param[in] key Expected cache key
+ * \param[out] data Cached data
+ *
+ * \return Whether the entry exists, matches \p key, and is intact
+ */
+bool patch_cache_load(const std::string &path, const util::Sha512Digest &key,
+                      std::string &data)
+{
+    StandardFile file;
+
+    if (auto r = file.open(path, FileOpenMode::ReadOnly); !r) {
+        if (r.error() != std::errc::no_such_file_or_directory) {
+            LOGW("%s: Failed to open cache entry: %s",
+                 path.c_str(), r.error().message().c_str());
+        }
+        return false;
+    }
+
+    PatchCacheHeader header;
+
+    if (auto r = file_read_exact(file, &header, sizeof(header)); !r) {
+        if (r.error() == FileError::UnexpectedEof) {
+            LOGW("%s: Cache entry is truncated", path.c_str());
+        } else {
+            LOGW("%s: Failed to read cache entry: %s",
+                 path.c_str(), r.error().message().c_str());
+        }
+        return false;
+    }
+
+    if (memcmp(header.magic, PATCH_CACHE_MAGIC, sizeof(header.magic)) != 0
+            || memcmp(header.key, key.data(), key.size()) != 0) {
+        LOGV("%s: Cache entry is for a different file or patch", path.c_str());
+        return false;
+    }
+
+    auto file_size = file.seek(0, SEEK_END);
+    if (!file_size || file_size.value() < sizeof(header)
+            || header.size != file_size.value() - sizeof(header)) {
+        LOGW("%s: Cache entry has the wrong size", path.c_str());
+        return false;
+    }
+
+    // Read the data straight into the output buffer. Cached policies are
+    // several megabytes, so reading the whole entry and copying the data out
+    // of it would be noticeable during boot.
+    std::string buf;
+    buf.resize(static_cast<size_t>(header.size));
+
+    if (auto r = file.seek(sizeof(header), SEEK_SET); !r) {
+        LOGW("%s: Failed to seek cache entry: %s",
+             path.c_str(), r.error().message().c_str());
+        return false;
+    }
+    if (auto r = file_read_exact(file, buf.data(), buf.size()); !r) {
+        LOGW("%s: Failed to read cache entry: %s",
+             path.c_str(), r.error().message().c_str());
+        return false;
+    }
+
+    util::Sha512Digest digest;
+    SHA512(reinterpret_cast<const unsigned char *>(buf.data()), buf.size(),
+           digest.data());
+
+    if (memcmp(header.digest, digest.data(), digest.size()) != 0) {
+        LOGW("%s: Cache entry is corrupt", path.c_str());
+        return false;
+    }
+
+    data = std::move(buf);
+
+    return true;
+}
+
+/*!
+ * \brief Store a cache entry
+ *
+ * Failures are logged, but otherwise ignored since the cache is only an
+ * optimization.
+ *
+ * \param path Cache entry path
+ * \param key Cache key
+ * \param data Data to cache
+ */
+void patch_cache_save(const std::string &path, const util::Sha512Digest &key,
+                      std::string_view data)
+{
+    PatchCacheHeader header = {};
+
+    memcpy(header.magic, PATCH_CACHE_MAGIC, sizeof(header.magic));
+    memcpy(header.key, key.data(), key.size());
+    header.size = data.size();
+    SHA512(reinterpret_cast<const unsigned char *>(data.data()), data.size(),
+           header.digest);
+
+    if (auto r = util::mkdir_recursive(util::dir_name(path), 0700); !r) {
+        LOGW("%s: Failed to create cache directory: %s",
+             path.c_str(), r.error().message().c_str());
+        return;
+    }
+
+    // Write to a temporary file first so that an interrupted write can never
+    // leave a truncated cache entry behind
+    std::string temp_path = path + ".tmp";
+    const ConstIoVec iov[] = {
+        { &header, sizeof(header) },
+        { data.data(), data.size() },
+    };
+
+    StandardFile file;
+
+    auto r = file.open(temp_path, FileOpenMode::WriteOnly);
+    if (r) {
+        r = file_writev_exact(file, iov, 2);
+    }
+    if (r) {
+        r = file.close();
+    }
+    if (!r) {
+        LOGW("%s: Failed to write cache entry: %s",
+             temp_path.c_str(), r.error().message().c_str());
+        unlink(temp_path.c_str());
+        return;
+    }
+
+    if (rename(temp_path.c_str(), path.c_str()) < 0) {
+        LOGW("%s: Failed to rename cache entry: %s",
+             temp_path.c_str(), strerror(errno));
+        unlink(temp_path.c_str());
+    }
+}
+
+}
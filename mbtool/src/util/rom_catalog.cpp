@@ -0,0 +1,229 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "util/rom_catalog.h"
+
+#include <algorithm>
+#include <mutex>
+
+#include <sys/stat.h>
+
+#include "mblog/logging.h"
+#include "mbutil/properties.h"
+
+#include "util/multiboot.h"
+#include "util/romconfig.h"
+
+#define LOG_TAG "mbtool/util/rom_catalog"
+
+namespace mb
+{
+
+// Listing the installed ROMs means scanning the slot directories and parsing
+// every ROM's build.prop and config file. The result is kept until one of the
+// files or directories it was derived from changes, which is checked with a
+// stat() per path.
+
+struct PathStamp
+{
+    std::string path;
+    bool exists;
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    timespec mtime;
+    timespec ctime;
+};
+
+struct RomCatalog
+{
+    bool valid = false;
+    std::string extsd_partition;
+    std::vector<PathStamp> stamps;
+    std::vector<RomCatalogEntry> entries;
+};
+
+static std::mutex g_catalog_lock;
+static RomCatalog g_catalog;
+
+static PathStamp stamp_path(std::string path)
+{
+    PathStamp stamp{};
+    struct stat sb;
+
+    stamp.path = std::move(path);
+
+    if (stat(stamp.path.c_str(), &sb) == 0) {
+        stamp.exists = true;
+        stamp.dev = sb.st_dev;
+        stamp.ino = sb.st_ino;
+        stamp.size = sb.st_size;
+        stamp.mtime = sb.st_mtim;
+        stamp.ctime = sb.st_ctim;
+    }
+
+    return stamp;
+}
+
+static bool operator==(const timespec &a, const timespec &b)
+{
+    return a.tv_sec == b.tv_sec && a.tv_nsec == b.tv_nsec;
+}
+
+static bool is_unchanged(const PathStamp &stamp)
+{
+    PathStamp now = stamp_path(stamp.path);
+
+    return now.exists == stamp.exists
+            && now.dev == stamp.dev
+            && now.ino == stamp.ino
+            && now.size == stamp.size
+            && now.mtime == stamp.mtime
+            && now.ctime == stamp.ctime;
+}
+
+static bool is_current(const RomCatalog &catalog)
+{
+    if (!catalog.valid) {
+        return false;
+    }
+
+    // The paths of the extsd ROMs depend on where the SD card is mounted
+    if (Roms::get_extsd_partition() != catalog.extsd_partition) {
+        return false;
+    }
+
+    return std::all_of(catalog.stamps.begin(), catalog.stamps.end(),
+                       &is_unchanged);
+}
+
+static void read_rom_props(RomCatalogEntry &entry, const std::string &build_prop)
+{
+    static constexpr char PROP_VERSION[] = "ro.build.version.release";
+    static constexpr char PROP_BUILD[] = "ro.build.display.id";
+
+    // Properties cached in the config are used if build.prop can't be read
+    // (eg. the system image isn't mounted)
+    RomConfig config;
+    config.load_file(entry.rom->config_path());
+    auto &props = config.cached_props;
+
+    util::property_file_iter(build_prop, {}, [&](std::string_view key,
+                                                 std::string_view value) {
+        if (key == PROP_VERSION || key == PROP_BUILD) {
+            props.insert_or_assign(std::string(key), std::string(value));
+        }
+
+        return util::PropertyIterAction::Continue;
+    });
+
+    if (auto it = props.find(PROP_VERSION); it != props.end()) {
+        entry.version = it->second;
+    }
+    if (auto it = props.find(PROP_BUILD); it != props.end()) {
+        entry.build = it->second;
+    }
+}
+
+static void build_catalog(RomCatalog &catalog)
+{
+    catalog = {};
+
+    // Slot directories are stamped first so that a ROM added while scanning
+    // causes a rescan next time
+    catalog.extsd_partition = Roms::get_extsd_partition();
+    catalog.stamps.push_back(stamp_path(get_raw_path("/data/multiboot")));
+    if (catalog.extsd_partition.empty()) {
+        catalog.stamps.push_back(stamp_path(get_raw_path(MULTIBOOT_DIR)));
+    } else {
+        catalog.stamps.push_back(stamp_path(
+                catalog.extsd_partition + "/multiboot"));
+    }
+
+    Roms all_roms;
+    all_roms.add_all();
+
+    for (auto const &rom : all_roms.roms) {
+        std::string system_path = rom->full_system_path();
+
+        // Paths checked by Roms::is_installed()
+        catalog.stamps.push_back(stamp_path(
+                get_raw_path(rom->boot_image_path())));
+        catalog.stamps.push_back(stamp_path(system_path));
+        if (!rom->system_is_image) {
+            catalog.stamps.push_back(stamp_path(system_path + "/build.prop"));
+        }
+
+        if (!Roms::is_installed(*rom)) {
+            continue;
+        }
+
+        RomCatalogEntry entry;
+        entry.rom = rom;
+        entry.system_path = std::move(system_path);
+        entry.cache_path = rom->full_cache_path();
+        entry.data_path = rom->full_data_path();
+
+        std::string build_prop;
+        if (rom->system_is_image) {
+            build_prop += "/raw/images/";
+            build_prop += rom->id;
+        } else {
+            build_prop += entry.system_path;
+        }
+        build_prop += "/build.prop";
+
+        catalog.stamps.push_back(stamp_path(build_prop));
+        catalog.stamps.push_back(stamp_path(rom->config_path()));
+
+        PathStamp thumbnail = stamp_path(rom->thumbnail_path());
+        if (thumbnail.exists) {
+            entry.thumbnail_path = thumbnail.path;
+        }
+        catalog.stamps.push_back(std::move(thumbnail));
+
+        read_rom_props(entry, build_prop);
+
+        catalog.entries.push_back(std::move(entry));
+    }
+
+    catalog.valid = true;
+}
+
+/*!
+ * \brief Get the installed ROMs
+ *
+ * The list is only rebuilt if the slot directories or any of the ROMs' files
+ * changed since the last call.
+ *
+ * \return List of installed ROMs with their paths and properties
+ */
+std::vector<RomCatalogEntry> rom_catalog_get()
+{
+    std::lock_guard<std::mutex> lock(g_catalog_lock);
+
+    if (!is_current(g_catalog)) {
+        LOGD("Rebuilding installed ROM list");
+        build_catalog(g_catalog);
+    }
+
+    return g_catalog.entries;
+}
+
+}
@@ -19,16 +19,19 @@
 
 #include "util/romconfig.h"
 
+#include <mutex>
+
 #include <cerrno>
 
+#include <sys/stat.h>
+
 #include <rapidjson/document.h>
 #include <rapidjson/error/en.h>
-#include <rapidjson/filereadstream.h>
 #include <rapidjson/filewritestream.h>
-#include <rapidjson/reader.h>
 #include <rapidjson/writer.h>
 
 #include "mblog/logging.h"
+#include "mbutil/file.h"
 
 #define LOG_TAG "mbtool/util/romconfig"
 
@@ -40,6 +43,7 @@
 #define KEY_PACKAGES               "packages"
 #define KEY_PACKAGE_ID             "pkg_id"
 #define KEY_SHARE_DATA             "share_data"
+#define KEY_SHARE_APK              "share_apk"
 
 using namespace rapidjson;
 
@@ -48,6 +52,59 @@ namespace mb
 
 using ScopedFILE = std::unique_ptr<FILE, decltype(fclose) *>;
 
+// Config files are read for every ROM whenever the ROM list or the appsync
+// state is loaded, but rarely change. Parsed configs are kept until the file's
+// stat() metadata changes.
+
+struct ConfigStamp
+{
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    timespec mtime;
+    timespec ctime;
+};
+
+struct CachedConfig
+{
+    ConfigStamp stamp;
+    RomConfig config;
+};
+
+static std::mutex g_cache_lock;
+static std::unordered_map<std::string, CachedConfig> g_cache;
+
+static bool stamp_file(const std::string &path, ConfigStamp &stamp)
+{
+    struct stat sb;
+
+    if (stat(path.c_str(), &sb) < 0) {
+        return false;
+    }
+
+    stamp.dev = sb.st_dev;
+    stamp.ino = sb.st_ino;
+    stamp.size = sb.st_size;
+    stamp.mtime = sb.st_mtim;
+    stamp.ctime = sb.st_ctim;
+
+    return true;
+}
+
+static bool operator==(const timespec &a, const timespec &b)
+{
+    return a.tv_sec == b.tv_sec && a.tv_nsec == b.tv_nsec;
+}
+
+static bool operator==(const ConfigStamp &a, const ConfigStamp &b)
+{
+    return a.dev == b.dev
+            && a.ino == b.ino
+            && a.size == b.size
+            && a.mtime == b.mtime
+            && a.ctime == b.ctime;
+}
+
 /*
  * Example JSON structure:
  *
@@ -63,7 +120,8 @@ using ScopedFILE = std::unique_ptr<FILE, decltype(fclose) *>;
  *         "packages": [
  *             {
  *                 "pkg_id": "com.android.chrome",
- *                 "share_data": true
+ *                 "share_data": true,
+ *                 "share_apk": true
  *             },{
  *                 "pkg_id": "com.android.vending",
  *                 "share_data": true
@@ -111,6 +169,12 @@ static bool load_app_sharing_packages(RomConfig &config, const Value &node)
                     return false;
                 }
                 shared_pkg.share_data = pkg_item.value.GetBool();
+            } else if (key == KEY_SHARE_APK) {
+                if (!pkg_item.value.IsBool()) {
+                    LOGE("%s[%zu].%s: Not a boolean", context, i, key.c_str());
+                    return false;
+                }
+                shared_pkg.share_apk = pkg_item.value.GetBool();
             } else {
                 LOGW("%s[%zu].%s: Skipping unknown key", context, i, key.c_str());
             }
@@ -145,7 +209,7 @@ static bool load_app_sharing(RomConfig &config, const Value &node)
             }
             config.indiv_app_sharing = item.value.GetBool();
         } else if (key == KEY_PACKAGES) {
-            if (!load_app_sharing_packages(config, node)) {
+            if (!load_app_sharing_packages(config, item.value)) {
                 return false;
             }
         } else {
@@ -221,26 +285,48 @@ static bool load_root(RomConfig &config, const Value &node)
 
 bool RomConfig::load_file(const std::string &path)
 {
-    ScopedFILE fp(fopen(path.c_str(), "re"), &fclose);
-    if (!fp) {
-        LOGE("%s: Failed to open for reading: %s",
-             path.c_str(), strerror(errno));
+    ConfigStamp stamp;
+    bool have_stamp = stamp_file(path, stamp);
+
+    if (have_stamp) {
+        std::lock_guard<std::mutex> lock(g_cache_lock);
+
+        if (auto it = g_cache.find(path);
+                it != g_cache.end() && it->second.stamp == stamp) {
+            *this = it->second.config;
+            return true;
+        }
+    }
+
+    auto contents = util::file_read_all(path);
+    if (!contents) {
+        LOGE("%s: Failed to read file: %s",
+             path.c_str(), contents.error().message().c_str());
         return false;
     }
 
-    char buf[65536];
-    Reader reader;
-    FileReadStream is(fp.get(), buf, sizeof(buf));
+    // The files are small, so parse them in place instead of copying every
+    // string into the document
     Document d;
 
-    if (d.ParseStream(is).HasParseError()) {
-        fprintf(stderr, "Error at offset %zu: %s\n",
-                reader.GetErrorOffset(),
-                GetParseError_En(reader.GetParseErrorCode()));
+    if (d.ParseInsitu(contents.value().data()).HasParseError()) {
+        LOGE("%s: Error at offset %zu: %s", path.c_str(), d.GetErrorOffset(),
+             GetParseError_En(d.GetParseError()));
+        return false;
+    }
+
+    RomConfig config;
+    if (!load_root(config, d)) {
         return false;
     }
 
-    return load_root(*this, d);
+    if (have_stamp) {
+        std::lock_guard<std::mutex> lock(g_cache_lock);
+        g_cache[path] = { stamp, config };
+    }
+
+    *this = std::move(config);
+    return true;
 }
 
 bool RomConfig::save_file(const std::string &path)
@@ -282,6 +368,9 @@ bool RomConfig::save_file(const std::string &path)
 
             v_shared_pkg.AddMember(KEY_PACKAGE_ID, sp.pkg_id, alloc);
             v_shared_pkg.AddMember(KEY_SHARE_DATA, sp.share_data, alloc);
+            if (sp.share_apk) {
+                v_shared_pkg.AddMember(KEY_SHARE_APK, sp.share_apk, alloc);
+            }
 
             v_shared_pkgs.PushBack(v_shared_pkg, alloc);
         }
@@ -314,6 +403,11 @@ bool RomConfig::save_file(const std::string &path)
         return false;
     }
 
+    if (ConfigStamp stamp; stamp_file(path, stamp)) {
+        std::lock_guard<std::mutex> lock(g_cache_lock);
+        g_cache[path] = { stamp, *this };
+    }
+
     return true;
 }
 
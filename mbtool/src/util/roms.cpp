@@ -39,7 +39,7 @@
 #define LOG_TAG "mbtool/util/roms"
 
 
-static std::vector<std::string> extsd_mount_points{
+static constexpr const char *extsd_mount_points[] = {
     "/raw/extsd",
     "/external_sd",
     "/external_sdcard",
@@ -287,35 +287,21 @@ void Roms::add_extsd_roms()
     std::move(temp_roms.begin(), temp_roms.end(), std::back_inserter(roms));
 }
 
+void Roms::add_all()
+{
+    add_builtin();
+    add_data_roms();
+    add_extsd_roms();
+}
+
 void Roms::add_installed()
 {
     Roms all_roms;
-    all_roms.add_builtin();
-    all_roms.add_data_roms();
-    all_roms.add_extsd_roms();
-
-    struct stat sb;
+    all_roms.add_all();
 
     for (auto rom : all_roms.roms) {
-        std::string boot_path = get_raw_path(rom->boot_image_path());
-        std::string system_path = rom->full_system_path();
-
-        if (stat(boot_path.c_str(), &sb) == 0) {
-            // If boot image exists, assume that the ROM is installed
+        if (is_installed(*rom)) {
             roms.push_back(rom);
-        } else if (rom->system_is_image) {
-            // If /system is on an ext4 image, check if the image exists
-            if (stat(system_path.c_str(), &sb) == 0 && S_ISREG(sb.st_mode)) {
-                roms.push_back(rom);
-            }
-        } else {
-            // If /system is bind-mounted, check if build.prop exists
-            std::string build_prop(system_path);
-            build_prop += "/build.prop";
-
-            if (stat(build_prop.c_str(), &sb) == 0 && S_ISREG(sb.st_mode)) {
-                roms.push_back(rom);
-            }
         }
     }
 }
@@ -414,6 +400,27 @@ bool Roms::is_valid(const std::string &id)
             || (id != "extsd-slot-" && starts_with(id.c_str(), "extsd-slot-"));
 }
 
+bool Roms::is_installed(Rom &rom)
+{
+    std::string boot_path = get_raw_path(rom.boot_image_path());
+    std::string system_path = rom.full_system_path();
+    struct stat sb;
+
+    if (stat(boot_path.c_str(), &sb) == 0) {
+        // If boot image exists, assume that the ROM is installed
+        return true;
+    } else if (rom.system_is_image) {
+        // If /system is on an ext4 image, check if the image exists
+        return stat(system_path.c_str(), &sb) == 0 && S_ISREG(sb.st_mode);
+    } else {
+        // If /system is bind-mounted, check if build.prop exists
+        std::string build_prop(system_path);
+        build_prop += "/build.prop";
+
+        return stat(build_prop.c_str(), &sb) == 0 && S_ISREG(sb.st_mode);
+    }
+}
+
 std::string Roms::get_system_partition()
 {
     struct stat sb;
@@ -460,8 +467,8 @@ std::string Roms::get_extsd_partition()
 {
     // Try hard-coded mount points first
     struct stat sb;
-    for (const std::string &mount_point : extsd_mount_points) {
-        if (stat(mount_point.c_str(), &sb) == 0) {
+    for (const char *mount_point : extsd_mount_points) {
+        if (stat(mount_point, &sb) == 0) {
             if (util::is_mounted(mount_point)) {
                 return mount_point;
             }
@@ -19,10 +19,12 @@
 
 #include "util/sepolpatch.h"
 
+#include <algorithm>
 #include <memory>
 
 #include <climits>
 #include <cstdio>
+#include <cstring>
 
 #include <fcntl.h>
 #include <getopt.h>
@@ -41,15 +43,21 @@
 #include "mbcommon/common.h"
 #include "mbcommon/finally.h"
 #include "mbcommon/integer.h"
+#include "mbcommon/perf.h"
 #include "mbcommon/string.h"
 #include "mblog/logging.h"
 #include "mbutil/selinux.h"
 
 #include "util/android_api.h"
 #include "util/multiboot.h"
+#include "util/patch_cache.h"
 
 #define LOG_TAG "mbtool/util/sepolpatch"
 
+// Increment when the rules added or removed by selinux_apply_patch() change so
+// that stale cached policies are not used
+#define SEPOLICY_PATCH_VERSION  1
+
 
 extern "C" int policydb_index_decls(sepol_handle_t *handle, policydb_t *p);
 
@@ -58,6 +66,11 @@ namespace mb
 
 using ScopedFILE = std::unique_ptr<FILE, decltype(fclose) *>;
 
+// Number of avtab entries inserted or modified
+static perf::Counter g_avtab_edits("sepol.avtab_edits");
+// Number of policy writes skipped because the policy already had all rules
+static perf::Counter g_writes_skipped("sepol.writes_skipped");
+
 /*!
  * Add or remove rule.
  *
@@ -95,6 +108,7 @@ SELinuxResult selinux_raw_set_avtab_rule(policydb_t *pdb,
             if (avtab_insert(&pdb->te_avtab, &key, &av_new) != 0) {
                 return SELinuxResult::Error;
             }
+            g_avtab_edits.add();
             return SELinuxResult::Changed;
         }
     } else {
@@ -106,9 +120,12 @@ SELinuxResult selinux_raw_set_avtab_rule(policydb_t *pdb,
             av->data |= (1U << (perm_val - 1));
         }
 
-        return (av->data == old_data)
-                ? SELinuxResult::Unchanged
-                : SELinuxResult::Changed;
+        if (av->data == old_data) {
+            return SELinuxResult::Unchanged;
+        }
+
+        g_avtab_edits.add();
+        return SELinuxResult::Changed;
     }
 }
 
@@ -133,15 +150,19 @@ SELinuxResult selinux_raw_set_type_trans(policydb_t *pdb,
         if (avtab_insert(&pdb->te_avtab, &key, &av_new) != 0) {
             return SELinuxResult::Error;
         }
+        g_avtab_edits.add();
         return SELinuxResult::Changed;
     } else {
         auto old_data = av->data;
 
         av->data = default_type_val;
 
-        return (av->data == old_data)
-                ? SELinuxResult::Unchanged
-                : SELinuxResult::Changed;
+        if (av->data == old_data) {
+            return SELinuxResult::Unchanged;
+        }
+
+        g_avtab_edits.add();
+        return SELinuxResult::Changed;
     }
 }
 
@@ -150,71 +171,26 @@ SELinuxResult selinux_raw_grant_all_perms(policydb_t *pdb,
                                           uint16_t target_type_val,
                                           uint16_t class_val)
 {
-    SELinuxResult result(SELinuxResult::Unchanged);
+    SELinuxRuleBatch batch(pdb);
 
-    auto clazz = pdb->class_val_to_struct[class_val - 1];
-    if (!clazz) {
+    if (!batch.grant_all_perms(source_type_val, target_type_val, class_val)) {
         return SELinuxResult::Error;
     }
 
-    // Class-specific permissions
-    hashtab_t tables[] = { clazz->permissions.table, nullptr, nullptr };
-    if (clazz->comdatum) {
-        tables[1] = clazz->comdatum->permissions.table;
-    }
-
-    for (auto table = tables; *table; ++table) {
-        for (uint32_t bucket = 0; bucket < (*table)->size; ++bucket) {
-            for (hashtab_ptr_t cur = (*table)->htable[bucket]; cur;
-                    cur = cur->next) {
-                auto perm_datum = static_cast<perm_datum_t *>(cur->datum);
-
-                SELinuxResult ret = selinux_raw_set_avtab_rule(
-                        pdb, source_type_val, target_type_val, class_val,
-                        perm_datum->s.value, false);
-
-                switch (ret) {
-                case SELinuxResult::Error:
-                    return ret;
-                case SELinuxResult::Changed:
-                    result = ret;
-                    break;
-                case SELinuxResult::Unchanged:
-                    // Ignore
-                    break;
-                }
-            }
-        }
-    }
-
-    return result;
+    return batch.apply();
 }
 
 SELinuxResult selinux_raw_grant_all_perms(policydb_t *pdb,
                                           uint16_t source_type_val,
                                           uint16_t target_type_val)
 {
-    SELinuxResult result(SELinuxResult::Unchanged);
+    SELinuxRuleBatch batch(pdb);
 
-    for (uint32_t class_val = 1; class_val <= pdb->p_classes.nprim;
-            ++class_val) {
-        SELinuxResult ret = selinux_raw_grant_all_perms(
-                pdb, source_type_val, target_type_val,
-                static_cast<uint16_t>(class_val));
-
-        switch (ret) {
-        case SELinuxResult::Error:
-            return ret;
-        case SELinuxResult::Changed:
-            result = ret;
-            break;
-        case SELinuxResult::Unchanged:
-            // Ignore
-            break;
-        }
+    if (!batch.grant_all_perms(source_type_val, target_type_val)) {
+        return SELinuxResult::Error;
     }
 
-    return result;
+    return batch.apply();
 }
 
 SELinuxResult selinux_raw_set_permissive(policydb_t *pdb,
@@ -416,27 +392,28 @@ bool selinux_make_all_permissive(policydb_t *pdb)
     return true;
 }
 
-bool selinux_make_permissive(policydb_t *pdb,
-                             const char *type_str)
+static SELinuxResult make_permissive(policydb_t *pdb,
+                                     const char *type_str)
 {
     type_datum_t *type = find_type(pdb, type_str);
     if (!type) {
         LOGV("Type %s not found in policy", type_str);
-        return false;
+        return SELinuxResult::Error;
     }
 
     SELinuxResult result = selinux_raw_set_permissive(
             pdb, static_cast<uint16_t>(type->s.value), true);
-    switch (result) {
-    case SELinuxResult::Changed:
-    case SELinuxResult::Unchanged:
-        return true;
-    case SELinuxResult::Error:
+    if (result == SELinuxResult::Error) {
         LOGE("Failed to set type %s to permissive", type_str);
-        [[fallthrough]];
-    default:
-        return false;
     }
+
+    return result;
+}
+
+bool selinux_make_permissive(policydb_t *pdb,
+                             const char *type_str)
+{
+    return make_permissive(pdb, type_str) != SELinuxResult::Error;
 }
 
 bool selinux_set_allow_rule(policydb_t *pdb,
@@ -709,50 +686,64 @@ SELinuxResult selinux_create_type(policydb_t *pdb,
  *         False if the specified type and attribute do not exist or if an
  *         error occurs
  */
-bool selinux_set_attribute(policydb_t *pdb,
-                           const char *type_name,
-                           const char *attr_name)
+static SELinuxResult set_attribute(policydb_t *pdb,
+                                   const char *type_name,
+                                   const char *attr_name)
 {
     // Find type
     type_datum_t *type = find_type(pdb, type_name);
     if (!type || type->flavor != TYPE_TYPE) {
-        return false;
+        return SELinuxResult::Error;
     }
 
     // Find attribute
     type_datum_t *attr = find_type(pdb, attr_name);
     if (!attr || attr->flavor != TYPE_ATTRIB) {
-        return false;
+        return SELinuxResult::Error;
     }
 
-    auto ret = selinux_raw_set_attribute(
+    return selinux_raw_set_attribute(
             pdb, static_cast<uint16_t>(type->s.value),
             static_cast<uint16_t>(attr->s.value));
-    return ret != SELinuxResult::Error;
 }
 
-bool selinux_add_to_role(policydb_t *pdb,
-                         const char *role_name,
-                         const char *type_name)
+bool selinux_set_attribute(policydb_t *pdb,
+                           const char *type_name,
+                           const char *attr_name)
+{
+    return set_attribute(pdb, type_name, attr_name) != SELinuxResult::Error;
+}
+
+static SELinuxResult add_to_role(policydb_t *pdb,
+                                 const char *role_name,
+                                 const char *type_name)
 {
     role_datum_t *role = find_role(pdb, role_name);
     if (!role) {
-        return false;
+        return SELinuxResult::Error;
     }
 
     type_datum_t *type = find_type(pdb, type_name);
     if (!type) {
-        return false;
+        return SELinuxResult::Error;
     }
 
-    auto ret = selinux_raw_add_to_role(
+    return selinux_raw_add_to_role(
             pdb, static_cast<uint16_t>(role->s.value),
             static_cast<uint16_t>(type->s.value));
-    return ret != SELinuxResult::Error;
 }
 
-static void selinux_strip_no_audit(policydb_t *pdb)
+bool selinux_add_to_role(policydb_t *pdb,
+                         const char *role_name,
+                         const char *type_name)
+{
+    return add_to_role(pdb, role_name, type_name) != SELinuxResult::Error;
+}
+
+static SELinuxResult selinux_strip_no_audit(policydb_t *pdb)
 {
+    SELinuxResult result = SELinuxResult::Unchanged;
+
 #if 0
     // This implementation works, but is confusing since it won't be printed
     // correctly via libsepol (including sesearch):
@@ -764,6 +755,7 @@ static void selinux_strip_no_audit(policydb_t *pdb)
                 // Clear all permission bits
                 // (auditdeny/dontaudit datum is a mask)
                 cur->datum.data = ~0U;
+                result = SELinuxResult::Changed;
             } else if (cur->key.specified & AVTAB_XPERMS_DONTAUDIT) {
                 // xperms currently not handled
             }
@@ -786,6 +778,8 @@ static void selinux_strip_no_audit(policydb_t *pdb)
                     pdb->te_avtab.htable[i] = cur = cur->next;
                 }
 
+                result = SELinuxResult::Changed;
+
                 if (to_free->key.specified & AVTAB_XPERMS) {
                     free(to_free->datum.xperms);
                 }
@@ -801,40 +795,177 @@ static void selinux_strip_no_audit(policydb_t *pdb)
         }
     }
 #endif
+
+    return result;
 }
 
-// Patching functions
+// Batched rule changes
 
-// Fail fast
-#define ff(expr) \
-    do { \
-        if (!(expr)) return false; \
-    } while (0)
+static inline uint64_t pack_avtab_key(const avtab_key_t &key)
+{
+    return (static_cast<uint64_t>(key.source_type) << 48)
+            | (static_cast<uint64_t>(key.target_type) << 32)
+            | (static_cast<uint64_t>(key.target_class) << 16)
+            | static_cast<uint64_t>(key.specified);
+}
+
+static inline avtab_key_t unpack_avtab_key(uint64_t packed)
+{
+    avtab_key_t key;
+    key.source_type = static_cast<uint16_t>(packed >> 48);
+    key.target_type = static_cast<uint16_t>(packed >> 32);
+    key.target_class = static_cast<uint16_t>(packed >> 16);
+    key.specified = static_cast<uint16_t>(packed);
+    return key;
+}
+
+/*!
+ * \brief Collects avtab changes so they can be applied in one pass
+ *
+ * Symbol names are resolved once per rule (instead of once per permission)
+ * and all permissions for the same avtab key are merged into a single mask.
+ * apply() then sorts the changes by key and performs exactly one avtab lookup
+ * (and at most one insertion) per distinct key. Changes to the avtab do not
+ * require the policy to be reindexed.
+ *
+ * Changes are applied in the order they were added, so removing a permission
+ * after adding it in the same batch leaves it removed.
+ *
+ * Since the lookup compares the merged masks against the existing entries, the
+ * avtab is only written to for keys that are not already satisfied. A batch
+ * whose rules are all present (eg. a policy that was patched before) is a
+ * read-only scan and apply() returns SELinuxResult::Unchanged.
+ */
+SELinuxRuleBatch::SELinuxRuleBatch(policydb_t *pdb)
+    : _pdb(pdb)
+{
+}
 
-static inline bool add_rules(policydb_t *pdb,
-                             const char *source,
-                             const char *target,
-                             const char *clazz,
-                             const std::vector<std::string> &perms)
+bool SELinuxRuleBatch::set_rules(const char *source_str,
+                                 const char *target_str,
+                                 const char *class_str,
+                                 const std::vector<std::string> &perms,
+                                 bool remove)
 {
-    for (auto const &perm : perms) {
-        if (!selinux_add_rule(pdb, source, target, clazz, perm.c_str())) {
+    type_datum_t *source = find_type(_pdb, source_str);
+    if (!source) {
+        LOGE("Source type %s does not exist", source_str);
+        return false;
+    }
+
+    type_datum_t *target = find_type(_pdb, target_str);
+    if (!target) {
+        LOGE("Target type %s does not exist", target_str);
+        return false;
+    }
+
+    class_datum_t *clazz = find_class(_pdb, class_str);
+    if (!clazz) {
+        LOGE("Class %s does not exist", class_str);
+        return false;
+    }
+
+    uint32_t mask = 0;
+
+    for (auto const &perm_str : perms) {
+        perm_datum_t *perm = find_perm(clazz, perm_str.c_str());
+        if (!perm) {
+            LOGE("Perm %s does not exist in class %s",
+                 perm_str.c_str(), class_str);
             return false;
         }
+
+        mask |= 1U << (perm->s.value - 1);
     }
 
+    avtab_key_t key;
+    key.source_type = static_cast<uint16_t>(source->s.value);
+    key.target_type = static_cast<uint16_t>(target->s.value);
+    key.target_class = static_cast<uint16_t>(clazz->s.value);
+    key.specified = AVTAB_ALLOWED;
+
+    _changes.push_back({pack_avtab_key(key), mask, remove});
+
     return true;
 }
 
-[[maybe_unused]]
-static inline bool remove_rules(policydb_t *pdb,
-                                const char *source,
-                                const char *target,
-                                const char *clazz,
-                                const std::vector<std::string> &perms)
+bool SELinuxRuleBatch::add_rules(const char *source_str,
+                                 const char *target_str,
+                                 const char *class_str,
+                                 const std::vector<std::string> &perms)
+{
+    return set_rules(source_str, target_str, class_str, perms, false);
+}
+
+bool SELinuxRuleBatch::remove_rules(const char *source_str,
+                                    const char *target_str,
+                                    const char *class_str,
+                                    const std::vector<std::string> &perms)
 {
-    for (auto const &perm : perms) {
-        if (!selinux_remove_rule(pdb, source, target, clazz, perm.c_str())) {
+    return set_rules(source_str, target_str, class_str, perms, true);
+}
+
+uint32_t SELinuxRuleBatch::class_perms(uint16_t class_val)
+{
+    if (_class_perms.empty()) {
+        _class_perms.resize(_pdb->p_classes.nprim);
+
+        for (uint32_t i = 0; i < _pdb->p_classes.nprim; ++i) {
+            auto clazz = _pdb->class_val_to_struct[i];
+            if (!clazz) {
+                continue;
+            }
+
+            // Class-specific and common permissions
+            hashtab_t tables[] = { clazz->permissions.table, nullptr, nullptr };
+            if (clazz->comdatum) {
+                tables[1] = clazz->comdatum->permissions.table;
+            }
+
+            for (auto table = tables; *table; ++table) {
+                for (uint32_t bucket = 0; bucket < (*table)->size; ++bucket) {
+                    for (hashtab_ptr_t cur = (*table)->htable[bucket]; cur;
+                            cur = cur->next) {
+                        auto perm = static_cast<perm_datum_t *>(cur->datum);
+                        _class_perms[i] |= 1U << (perm->s.value - 1);
+                    }
+                }
+            }
+        }
+    }
+
+    return _class_perms[class_val - 1];
+}
+
+bool SELinuxRuleBatch::grant_all_perms(uint16_t source_type_val,
+                                       uint16_t target_type_val,
+                                       uint16_t class_val)
+{
+    if (class_val < 1 || class_val > _pdb->p_classes.nprim
+            || !_pdb->class_val_to_struct[class_val - 1]) {
+        return false;
+    }
+
+    if (auto mask = class_perms(class_val)) {
+        avtab_key_t key;
+        key.source_type = source_type_val;
+        key.target_type = target_type_val;
+        key.target_class = class_val;
+        key.specified = AVTAB_ALLOWED;
+
+        add_raw(key, mask);
+    }
+
+    return true;
+}
+
+bool SELinuxRuleBatch::grant_all_perms(uint16_t source_type_val,
+                                       uint16_t target_type_val)
+{
+    for (uint32_t class_val = 1; class_val <= _pdb->p_classes.nprim;
+            ++class_val) {
+        if (!grant_all_perms(source_type_val, target_type_val,
+                             static_cast<uint16_t>(class_val))) {
             return false;
         }
     }
@@ -842,15 +973,107 @@ static inline bool remove_rules(policydb_t *pdb,
     return true;
 }
 
-static bool apply_pre_boot_patches(policydb_t *pdb)
+void SELinuxRuleBatch::add_raw(const avtab_key_t &key, uint32_t perms)
+{
+    _changes.push_back({pack_avtab_key(key), perms, false});
+}
+
+void SELinuxRuleBatch::remove_raw(const avtab_key_t &key, uint32_t perms)
+{
+    _changes.push_back({pack_avtab_key(key), perms, true});
+}
+
+/*!
+ * \brief Apply and clear all pending changes
+ *
+ * \return Whether a change was made
+ */
+SELinuxResult SELinuxRuleBatch::apply()
 {
+    SELinuxResult result = SELinuxResult::Unchanged;
+
+    // Stable so that changes to the same key keep their relative order
+    std::stable_sort(_changes.begin(), _changes.end(),
+                     [](const Change &a, const Change &b) {
+        return a.key < b.key;
+    });
+
+    for (auto it = _changes.begin(); it != _changes.end();) {
+        uint64_t packed = it->key;
+        uint32_t to_add = 0;
+        uint32_t to_remove = 0;
+
+        for (; it != _changes.end() && it->key == packed; ++it) {
+            if (it->remove) {
+                to_remove |= it->perms;
+                to_add &= ~it->perms;
+            } else {
+                to_add |= it->perms;
+                to_remove &= ~it->perms;
+            }
+        }
+
+        avtab_key_t key = unpack_avtab_key(packed);
+        avtab_datum_t *av = avtab_search(&_pdb->te_avtab, &key);
+
+        if (!av) {
+            if (to_add == 0) {
+                continue;
+            }
+
+            avtab_datum_t av_new = {};
+            av_new.data = to_add;
+            if (avtab_insert(&_pdb->te_avtab, &key, &av_new) != 0) {
+                LOGE("Failed to add rule to avtab");
+                _changes.clear();
+                return SELinuxResult::Error;
+            }
+
+            g_avtab_edits.add();
+            result = SELinuxResult::Changed;
+        } else {
+            auto new_data = (av->data & ~to_remove) | to_add;
+
+            if (new_data != av->data) {
+                av->data = new_data;
+                g_avtab_edits.add();
+                result = SELinuxResult::Changed;
+            }
+        }
+    }
+
+    _changes.clear();
+
+    return result;
+}
+
+// Patching functions
+
+// Fail fast
+#define ff(expr) \
+    do { \
+        if (!(expr)) return SELinuxResult::Error; \
+    } while (0)
+
+// Fail fast and remember whether the policy was changed
+#define ffr(result, expr) \
+    do { \
+        auto ret_ = (expr); \
+        if (ret_ == SELinuxResult::Error) return SELinuxResult::Error; \
+        if (ret_ == SELinuxResult::Changed) (result) = SELinuxResult::Changed; \
+    } while (0)
+
+static SELinuxResult apply_pre_boot_patches(policydb_t *pdb)
+{
+    SELinuxResult result = SELinuxResult::Unchanged;
+
     // We are going to allow everything. The stage 1 policy is not a security
     // concern because the real (secure) policy will be loaded by the real /init
     // binary. This temporary policy exists solely for stage 2 to prepare the
     // environment for the real /init.
 
     // For most ROMs, we can just make the kernel domain permissive
-    ff(selinux_make_permissive(pdb, "kernel"));
+    ffr(result, make_permissive(pdb, "kernel"));
 
     // For TW 6.0 ROMs, the kernel #define's the permissive flag to be 0, so
     // per-type permissive flags are completely ignored. For these ROMs, we'll
@@ -858,9 +1081,11 @@ static bool apply_pre_boot_patches(policydb_t *pdb)
 
     type_datum_t *kernel = find_type(pdb, "kernel");
     if (!kernel) {
-        return false;
+        return SELinuxResult::Error;
     }
 
+    SELinuxRuleBatch batch(pdb);
+
     // For all attributes
     for (uint32_t type_val = 1; type_val <= pdb->p_types.nprim; ++type_val) {
         // Skip non-attributes
@@ -868,47 +1093,45 @@ static bool apply_pre_boot_patches(policydb_t *pdb)
             continue;
         }
 
-        auto ret = selinux_raw_grant_all_perms(
-                pdb, static_cast<uint16_t>(kernel->s.value),
-                static_cast<uint16_t>(type_val));
-        switch (ret) {
-        case SELinuxResult::Changed:
-        case SELinuxResult::Unchanged:
-            break;
-        case SELinuxResult::Error:
+        if (!batch.grant_all_perms(static_cast<uint16_t>(kernel->s.value),
+                                   static_cast<uint16_t>(type_val))) {
             LOGE("Failed to grant all perms for: %s -> %s",
                  "kernel", pdb->p_type_val_to_name[type_val - 1]);
-            return false;
+            return SELinuxResult::Error;
         }
     }
 
     // Allow the real init to load the "secure" SELinux policy
-    ff(selinux_add_rule(pdb, "kernel", "kernel", "security", "load_policy"));
+    ff(batch.add_rules("kernel", "kernel", "security", { "load_policy" }));
 
-    return true;
+    ffr(result, batch.apply());
+
+    return result;
 }
 
-static bool copy_attributes(policydb_t *pdb,
-                            const char *source_type,
-                            const char *target_type)
+static SELinuxResult copy_attributes(policydb_t *pdb,
+                                     const char *source_type,
+                                     const char *target_type)
 {
     if (strcmp(source_type, target_type) == 0) {
         LOGE("Source and target types are the same: %s", source_type);
-        return false;
+        return SELinuxResult::Error;
     }
 
     auto source = find_type(pdb, source_type);
     if (!source) {
         LOGE("Source type %s does not exist", source_type);
-        return false;
+        return SELinuxResult::Error;
     }
 
     auto target = find_type(pdb, target_type);
     if (!target) {
         LOGE("Target type %s does not exist", target_type);
-        return false;
+        return SELinuxResult::Error;
     }
 
+    SELinuxResult result = SELinuxResult::Unchanged;
+
     std::vector<uint16_t> attributes;
     ebitmap_node *n;
     unsigned int bit;
@@ -930,16 +1153,18 @@ static bool copy_attributes(policydb_t *pdb,
             LOGE("Failed to set attribute %s for type %s",
                  pdb->p_type_val_to_name[attr - 1],
                  pdb->p_type_val_to_name[target->s.value - 1]);
-            return false;
+            return SELinuxResult::Error;
+        } else if (ret == SELinuxResult::Changed) {
+            result = SELinuxResult::Changed;
         }
     }
 
-    return true;
+    return result;
 }
 
-static bool copy_avtab_rules(policydb_t *pdb,
-                             const char *source_type,
-                             const char *target_type)
+static SELinuxResult copy_avtab_rules(policydb_t *pdb,
+                                      const char *source_type,
+                                      const char *target_type)
 {
     std::vector<std::pair<avtab_key_t, avtab_datum_t>> to_add;
 
@@ -947,19 +1172,19 @@ static bool copy_avtab_rules(policydb_t *pdb,
 
     if (strcmp(source_type, target_type) == 0) {
         LOGE("Source and target types are the same: %s", source_type);
-        return false;
+        return SELinuxResult::Error;
     }
 
     source = find_type(pdb, source_type);
     if (!source) {
         LOGE("Source type %s does not exist", source_type);
-        return false;
+        return SELinuxResult::Error;
     }
 
     target = find_type(pdb, target_type);
     if (!target) {
         LOGE("Target type %s does not exist", target_type);
-        return false;
+        return SELinuxResult::Error;
     }
 
     // Gather rules to copy
@@ -978,31 +1203,23 @@ static bool copy_avtab_rules(policydb_t *pdb,
         }
     }
 
-    avtab_datum_t *datum;
-    for (auto &pair : to_add) {
-        datum = avtab_search(&pdb->te_avtab, &pair.first);
+    // New keys are created and existing keys get the additional perms
+    SELinuxRuleBatch batch(pdb);
 
-        if (!datum) {
-            // Create new avtab rule if the key doesn't exist
-            if (avtab_insert(&pdb->te_avtab, &pair.first, &pair.second) != 0) {
-                LOGE("Failed to add rule to avtab");
-                return false;
-            }
-        } else {
-            // Add additional perms if the key already exists
-            datum->data |= pair.second.data;
-        }
+    for (auto const &pair : to_add) {
+        batch.add_raw(pair.first, pair.second.data);
     }
 
-    return true;
+    return batch.apply();
 }
 
 /*!
  * \brief Patch SEPolicy to allow media_data_file-labeled /data/media to work on
  *        Android >= 5.0
  */
-static bool fix_data_media_rules(policydb_t *pdb)
+static SELinuxResult fix_data_media_rules(policydb_t *pdb)
 {
+    SELinuxResult result = SELinuxResult::Unchanged;
     auto sdk_version = get_sdk_version(SdkVersionSource::BuildProp);
     const char *expected_type;
 
@@ -1018,7 +1235,7 @@ static bool fix_data_media_rules(policydb_t *pdb)
     if (!find_type(pdb, expected_type)) {
         LOGW("Type %s doesn't exist. Won't touch %s related rules",
              expected_type, INTERNAL_STORAGE_ROOT);
-        return true;
+        return result;
     }
 
     auto context = util::selinux_lget_context(INTERNAL_STORAGE_ROOT);
@@ -1026,14 +1243,14 @@ static bool fix_data_media_rules(policydb_t *pdb)
         LOGE("%s: Failed to get context: %s",
              INTERNAL_STORAGE_ROOT, context.error().message().c_str());
         // Don't fail if /data/media does not exist
-        return errno == ENOENT;
+        return errno == ENOENT ? result : SELinuxResult::Error;
     }
 
     std::vector<std::string> pieces = split(context.value(), ':');
     if (pieces.size() < 3) {
         LOGE("%s: Malformed context string: %s",
              INTERNAL_STORAGE_ROOT, context.value().c_str());
-        return false;
+        return SELinuxResult::Error;
     }
     const std::string &type = pieces[2];
 
@@ -1042,46 +1259,50 @@ static bool fix_data_media_rules(policydb_t *pdb)
     if (type != expected_type) {
         if (!find_type(pdb, type.c_str())) {
             LOGV("Type %s does not exist. Creating it", type.c_str());
-            ff(selinux_create_type(pdb, type.c_str()) != SELinuxResult::Error);
-            ff(copy_attributes(pdb, expected_type, type.c_str()));
+            ffr(result, selinux_create_type(pdb, type.c_str()));
+            ffr(result, copy_attributes(pdb, expected_type, type.c_str()));
         }
 
         LOGV("Copying %s rules to %s because of improper %s SELinux label",
              expected_type, type.c_str(), INTERNAL_STORAGE_ROOT);
-        ff(copy_avtab_rules(pdb, expected_type, type.c_str()));
+        ffr(result, copy_avtab_rules(pdb, expected_type, type.c_str()));
 
         // Required for MLS on Android 7.1
-        ff(selinux_set_attribute(pdb, type.c_str(), "mlstrustedobject"));
+        ffr(result, set_attribute(pdb, type.c_str(), "mlstrustedobject"));
     }
 
-    return true;
+    return result;
 }
 
-static bool create_mbtool_types(policydb_t *pdb)
+static SELinuxResult create_mbtool_types(policydb_t *pdb)
 {
+    SELinuxResult result = SELinuxResult::Unchanged;
+
     // Used for running any mbtool commands
-    ff(selinux_create_type(pdb, "mb_exec") != SELinuxResult::Error);
-    ff(selinux_add_to_role(pdb, "r", "mb_exec"));
-    ff(selinux_set_attribute(pdb, "mb_exec", "domain"));
-    ff(selinux_set_attribute(pdb, "mb_exec", "mlstrustedobject"));
-    ff(selinux_set_attribute(pdb, "mb_exec", "mlstrustedsubject"));
+    ffr(result, selinux_create_type(pdb, "mb_exec"));
+    ffr(result, add_to_role(pdb, "r", "mb_exec"));
+    ffr(result, set_attribute(pdb, "mb_exec", "domain"));
+    ffr(result, set_attribute(pdb, "mb_exec", "mlstrustedobject"));
+    ffr(result, set_attribute(pdb, "mb_exec", "mlstrustedsubject"));
+
+    SELinuxRuleBatch batch(pdb);
 
     // Allow setting the current process context from init to mb_exec
-    ff(add_rules(pdb, "init", "mb_exec", "process", {
+    ff(batch.add_rules("init", "mb_exec", "process", {
         "noatsecure", "rlimitinh", "setcurrent", "siginh", "transition",
         //"dyntransition",
     }));
 
     // Allow installd to connect to appsync's socket
-    ff(add_rules(pdb, "installd", "mb_exec", "unix_stream_socket", {
+    ff(batch.add_rules("installd", "mb_exec", "unix_stream_socket", {
         "accept", "listen", "read", "write",
     }));
     if (find_type(pdb, "system_server")) {
-        ff(add_rules(pdb, "system_server", "mb_exec", "unix_stream_socket", {
+        ff(batch.add_rules("system_server", "mb_exec", "unix_stream_socket", {
             "connectto",
         }));
     } else {
-        ff(add_rules(pdb, "system", "mb_exec", "unix_stream_socket", {
+        ff(batch.add_rules("system", "mb_exec", "unix_stream_socket", {
             "connectto",
         }));
     }
@@ -1094,50 +1315,50 @@ static bool create_mbtool_types(policydb_t *pdb)
         if (strcmp(name, "untrusted_app") == 0
                 || (starts_with(name, "untrusted_app_")
                         && str_to_num(name + 14, 10, dummy))) {
-            ff(add_rules(pdb, name, "mb_exec", "unix_stream_socket", {
+            ff(batch.add_rules(name, "mb_exec", "unix_stream_socket", {
                 "connectto",
             }));
         }
     }
 
     // Allow zygote to write to our stdout pipe when rebooting
-    ff(add_rules(pdb, "zygote", "init", "fifo_file", { "write" }));
+    ff(batch.add_rules("zygote", "init", "fifo_file", { "write" }));
 
     // Allow 'am' to use fds (eg. pipes) inherited from the daemon
     if (find_type(pdb, "system_server")) {
-        ff(add_rules(pdb, "system_server", "mb_exec", "fd", { "use" }));
-        ff(add_rules(pdb, "system_server", "mb_exec", "fifo_file", { "write" }));
+        ff(batch.add_rules("system_server", "mb_exec", "fd", { "use" }));
+        ff(batch.add_rules("system_server", "mb_exec", "fifo_file", { "write" }));
     }
 
     // Allow rebooting via the android.intent.action.REBOOT intent
     if (find_type(pdb, "activity_service")) {
-        ff(add_rules(pdb, "zygote", "activity_service", "service_manager", { "find" }));
+        ff(batch.add_rules("zygote", "activity_service", "service_manager", { "find" }));
     }
     if (find_type(pdb, "system_server")) {
-        ff(add_rules(pdb, "zygote", "system_server", "binder", { "call" }));
+        ff(batch.add_rules("zygote", "system_server", "binder", { "call" }));
     }
 
-    ff(add_rules(pdb, "zygote", "init", "unix_stream_socket", { "read", "write" }));
-    ff(add_rules(pdb, "zygote", "servicemanager", "binder", { "call" }));
+    ff(batch.add_rules("zygote", "init", "unix_stream_socket", { "read", "write" }));
+    ff(batch.add_rules("zygote", "servicemanager", "binder", { "call" }));
 
-    ff(add_rules(pdb, "servicemanager", "mb_exec", "binder", { "transfer" }));
-    ff(add_rules(pdb, "servicemanager", "mb_exec", "dir", { "search" }));
-    ff(add_rules(pdb, "servicemanager", "mb_exec", "file", { "open", "read" }));
-    ff(add_rules(pdb, "servicemanager", "mb_exec", "process", { "getattr" }));
-    ff(add_rules(pdb, "servicemanager", "zygote", "dir", { "search" }));
-    ff(add_rules(pdb, "servicemanager", "zygote", "file", { "open" }));
-    ff(add_rules(pdb, "servicemanager", "zygote", "file", { "read" }));
-    ff(add_rules(pdb, "servicemanager", "zygote", "process", { "getattr" }));
+    ff(batch.add_rules("servicemanager", "mb_exec", "binder", { "transfer" }));
+    ff(batch.add_rules("servicemanager", "mb_exec", "dir", { "search" }));
+    ff(batch.add_rules("servicemanager", "mb_exec", "file", { "open", "read" }));
+    ff(batch.add_rules("servicemanager", "mb_exec", "process", { "getattr" }));
+    ff(batch.add_rules("servicemanager", "zygote", "dir", { "search" }));
+    ff(batch.add_rules("servicemanager", "zygote", "file", { "open" }));
+    ff(batch.add_rules("servicemanager", "zygote", "file", { "read" }));
+    ff(batch.add_rules("servicemanager", "zygote", "process", { "getattr" }));
 
     // For in-app flashing
-    ff(add_rules(pdb, "rootfs", "tmpfs", "filesystem", { "associate" }));
-    ff(add_rules(pdb, "tmpfs",  "rootfs", "filesystem", { "associate" }));
-    ff(add_rules(pdb, "kernel", "mb_exec", "fd", { "use" }));
+    ff(batch.add_rules("rootfs", "tmpfs", "filesystem", { "associate" }));
+    ff(batch.add_rules("tmpfs",  "rootfs", "filesystem", { "associate" }));
+    ff(batch.add_rules("kernel", "mb_exec", "fd", { "use" }));
 
     // Give mb_exec <insert diety here> permissions
     type_datum_t *mb_exec = find_type(pdb, "mb_exec");
     if (!mb_exec) {
-        return false;
+        return SELinuxResult::Error;
     }
 
     // For all attributes
@@ -1147,85 +1368,118 @@ static bool create_mbtool_types(policydb_t *pdb)
             continue;
         }
 
-        auto ret = selinux_raw_grant_all_perms(
-                pdb, static_cast<uint16_t>(mb_exec->s.value),
-                static_cast<uint16_t>(type_val));
-        switch (ret) {
-        case SELinuxResult::Changed:
-        case SELinuxResult::Unchanged:
-            break;
-        case SELinuxResult::Error:
+        if (!batch.grant_all_perms(static_cast<uint16_t>(mb_exec->s.value),
+                                   static_cast<uint16_t>(type_val))) {
             LOGE("Failed to grant all perms for: %s -> %s",
                  "mb_exec", pdb->p_type_val_to_name[type_val - 1]);
-            return false;
+            return SELinuxResult::Error;
         }
     }
 
-    return true;
+    ffr(result, batch.apply());
+
+    return result;
 }
 
-static bool apply_main_patches(policydb_t *pdb)
+static SELinuxResult apply_main_patches(policydb_t *pdb)
 {
-    ff(fix_data_media_rules(pdb));
-    ff(create_mbtool_types(pdb));
+    SELinuxResult result = SELinuxResult::Unchanged;
 
-    return true;
+    ffr(result, fix_data_media_rules(pdb));
+    ffr(result, create_mbtool_types(pdb));
+
+    return result;
 }
 
-static bool apply_cwm_recovery_patches(policydb_t *pdb)
+static SELinuxResult apply_cwm_recovery_patches(policydb_t *pdb)
 {
-    // Debugging rules (for CWM and Philz)
-    ff(add_rules(pdb, "adbd",  "block_device",    "blk_file",   { "relabelto" }));
-    ff(add_rules(pdb, "adbd",  "graphics_device", "chr_file",   { "relabelto" }));
-    ff(add_rules(pdb, "adbd",  "graphics_device", "dir",        { "relabelto" }));
-    ff(add_rules(pdb, "adbd",  "input_device",    "chr_file",   { "relabelto" }));
-    ff(add_rules(pdb, "adbd",  "input_device",    "dir",        { "relabelto" }));
-    ff(add_rules(pdb, "adbd",  "rootfs",          "dir",        { "relabelto" }));
-    ff(add_rules(pdb, "adbd",  "rootfs",          "file",       { "relabelto" }));
-    ff(add_rules(pdb, "adbd",  "rootfs",          "lnk_file",   { "relabelto" }));
-    ff(add_rules(pdb, "adbd",  "system_file",     "file",       { "relabelto" }));
-    ff(add_rules(pdb, "adbd",  "tmpfs",           "file",       { "relabelto" }));
-
-    ff(add_rules(pdb, "rootfs", "tmpfs",          "filesystem", { "associate" }));
-    ff(add_rules(pdb, "tmpfs",  "rootfs",         "filesystem", { "associate" }));
+    SELinuxRuleBatch batch(pdb);
 
-    return true;
+    // Debugging rules (for CWM and Philz)
+    ff(batch.add_rules("adbd",  "block_device",    "blk_file",   { "relabelto" }));
+    ff(batch.add_rules("adbd",  "graphics_device", "chr_file",   { "relabelto" }));
+    ff(batch.add_rules("adbd",  "graphics_device", "dir",        { "relabelto" }));
+    ff(batch.add_rules("adbd",  "input_device",    "chr_file",   { "relabelto" }));
+    ff(batch.add_rules("adbd",  "input_device",    "dir",        { "relabelto" }));
+    ff(batch.add_rules("adbd",  "rootfs",          "dir",        { "relabelto" }));
+    ff(batch.add_rules("adbd",  "rootfs",          "file",       { "relabelto" }));
+    ff(batch.add_rules("adbd",  "rootfs",          "lnk_file",   { "relabelto" }));
+    ff(batch.add_rules("adbd",  "system_file",     "file",       { "relabelto" }));
+    ff(batch.add_rules("adbd",  "tmpfs",           "file",       { "relabelto" }));
+
+    ff(batch.add_rules("rootfs", "tmpfs",          "filesystem", { "associate" }));
+    ff(batch.add_rules("tmpfs",  "rootfs",         "filesystem", { "associate" }));
+
+    return batch.apply();
 }
 
-bool selinux_apply_patch(policydb_t *pdb, SELinuxPatch patch)
+/*!
+ * \brief Apply a patch to a policy
+ *
+ * Every rule is checked against the policy before it is written, so applying
+ * a patch to a policy that already contains all of its rules (eg. a policy
+ * patched by a previous boot or by another tool) leaves the policy untouched.
+ *
+ * \param pdb Policy object
+ * \param patch Patch to apply
+ *
+ * \return SELinuxResult::Unchanged if the policy already satisfied the patch,
+ *         SELinuxResult::Changed if rules were added or removed, or
+ *         SELinuxResult::Error if the patch could not be applied
+ */
+SELinuxResult selinux_apply_patch(policydb_t *pdb, SELinuxPatch patch)
 {
-    bool ret = false;
-
     switch (patch) {
     case SELinuxPatch::PreBoot:
-        ret = apply_pre_boot_patches(pdb);
-        break;
+        return apply_pre_boot_patches(pdb);
     case SELinuxPatch::Main:
-        ret = apply_main_patches(pdb);
-        break;
+        return apply_main_patches(pdb);
     case SELinuxPatch::CwmRecovery:
-        ret = apply_cwm_recovery_patches(pdb);
-        break;
+        return apply_cwm_recovery_patches(pdb);
     case SELinuxPatch::StripNoAudit:
-        selinux_strip_no_audit(pdb);
-        ret = true;
-        break;
+        return selinux_strip_no_audit(pdb);
     case SELinuxPatch::None:
         break;
     }
 
-    return ret;
+    return SELinuxResult::Error;
 }
 
-bool patch_sepolicy(const std::string &source,
-                    const std::string &target,
-                    SELinuxPatch patch)
+/*!
+ * \brief Check if writing an unmodified policy to \p target is a no-op
+ *
+ * This is the case when the policy is patched in place or when the currently
+ * loaded policy would be reloaded.
+ */
+static bool is_same_policy(const std::string &source,
+                           const std::string &target)
+{
+    return source == target
+            || (source == util::SELINUX_POLICY_FILE
+                    && target == util::SELINUX_LOAD_FILE);
+}
+
+/*!
+ * \brief Read and patch a policy
+ *
+ * \param[in] source Policy to patch
+ * \param[in] patch Patch to apply
+ * \param[in] skip_unchanged Leave \p image empty instead of serializing the
+ *                           policy if the patch did not change anything
+ * \param[out] image Patched policy
+ *
+ * \return Result of selinux_apply_patch()
+ */
+static SELinuxResult read_and_patch_sepolicy(const std::string &source,
+                                             SELinuxPatch patch,
+                                             bool skip_unchanged,
+                                             std::string &image)
 {
     policydb_t pdb;
 
     if (policydb_init(&pdb) < 0) {
         LOGE("Failed to initialize policydb");
-        return false;
+        return SELinuxResult::Error;
     }
 
     auto destroy_pdb = finally([&]{
@@ -1234,17 +1488,104 @@ bool patch_sepolicy(const std::string &source,
 
     if (!util::selinux_read_policy(source, &pdb)) {
         LOGE("%s: Failed to load SELinux policy", source.c_str());
-        return false;
+        return SELinuxResult::Error;
     }
 
     LOGD("Policy version: %u", pdb.policyvers);
 
-    if (!selinux_apply_patch(&pdb, patch)) {
+    auto result = selinux_apply_patch(&pdb, patch);
+    if (result == SELinuxResult::Error) {
         LOGE("%s: Failed to apply policy patch", source.c_str());
+        return SELinuxResult::Error;
+    }
+
+    image.clear();
+
+    if (result == SELinuxResult::Unchanged && skip_unchanged) {
+        LOGD("%s: Policy already contains all rules from the patch",
+             source.c_str());
+        return result;
+    }
+
+    if (!util::selinux_policy_to_image(&pdb, image)) {
+        return SELinuxResult::Error;
+    }
+
+    return result;
+}
+
+/*!
+ * \brief Patch a policy
+ *
+ * If \p target is the same as \p source (or \p source is the loaded policy and
+ * \p target is the load file) and the policy already contains all of the
+ * patch's rules, nothing is written. In particular, the loaded policy is not
+ * reloaded.
+ */
+bool patch_sepolicy(const std::string &source,
+                    const std::string &target,
+                    SELinuxPatch patch)
+{
+    bool same = is_same_policy(source, target);
+    std::string image;
+
+    auto result = read_and_patch_sepolicy(source, patch, same, image);
+    if (result == SELinuxResult::Error) {
         return false;
+    } else if (result == SELinuxResult::Unchanged && same) {
+        g_writes_skipped.add();
+        return true;
+    }
+
+    if (!util::selinux_write_policy_image(target, image)) {
+        LOGE("%s: Failed to write SELinux policy", target.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Patch a policy using a cached copy of the result if possible
+ *
+ * This behaves like patch_sepolicy(), except that the patched policy is stored
+ * in \a /data/multiboot/cache/ on the raw data partition. On the next call
+ * with the same source policy, patch, and mbtool build, the cached policy is
+ * written to \p target without being parsed or patched again.
+ *
+ * Like patch_sepolicy(), nothing is written if the policy already contains all
+ * of the patch's rules and \p target is the same as \p source. This is cached
+ * as an empty entry.
+ *
+ * \note /data must be mounted (at /raw/data during boot)
+ */
+bool patch_sepolicy_cached(const std::string &source,
+                           const std::string &target,
+                           SELinuxPatch patch)
+{
+    auto variant = std::to_string(static_cast<int>(patch));
+    auto key = patch_cache_key(source, variant, SEPOLICY_PATCH_VERSION);
+    auto cache_path = patch_cache_path("sepolicy_" + variant + ".bin");
+    bool same = is_same_policy(source, target);
+    std::string image;
+
+    // An empty entry is only usable if nothing needs to be written
+    if (key && patch_cache_load(cache_path, *key, image)
+            && (same || !image.empty())) {
+        LOGD("%s: Using cached patched policy", cache_path.c_str());
+    } else if (read_and_patch_sepolicy(source, patch, same, image)
+            == SELinuxResult::Error) {
+        return false;
+    } else if (key) {
+        patch_cache_save(cache_path, *key, image);
+    }
+
+    if (image.empty()) {
+        g_writes_skipped.add();
+        return true;
     }
 
-    if (!util::selinux_write_policy(target, &pdb)) {
+    if (!util::selinux_write_policy_image(target, image)) {
         LOGE("%s: Failed to write SELinux policy", target.c_str());
         return false;
     }
@@ -19,10 +19,20 @@
 
 #include "util/signature.h"
 
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+#include <cerrno>
 #include <cstdlib>
 #include <cstring>
 
+#include <fcntl.h>
 #include <getopt.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #ifdef __clang__
 #  pragma GCC diagnostic push
@@ -38,15 +48,20 @@
 #  pragma GCC diagnostic pop
 #endif
 
+#include "mbcommon/finally.h"
 #include "mblog/logging.h"
 #include "mbsign/sign.h"
 
+#include "util/signature_cache.h"
 #include "util/validcerts.h"
 
 #define LOG_TAG "mbtool/util/signature"
 
 #define COMPILE_ERROR_STRINGS 0
 
+// Maximum number of files verified concurrently by verify_signatures()
+#define MAX_VERIFY_THREADS 4
+
 using ScopedBIO = std::unique_ptr<BIO, decltype(BIO_free) *>;
 using mb::sign::ScopedEVP_PKEY;
 using ScopedX509 = std::unique_ptr<X509, decltype(X509_free) *>;
@@ -106,49 +121,20 @@ static void openssl_log_errors()
     ERR_print_errors_cb(&log_callback, nullptr);
 }
 
-static SigVerifyResult verify_signature_with_key(const char *path,
-                                                 const char *sig_path,
-                                                 EVP_PKEY &public_key)
-{
-    ScopedBIO bio_data_in(BIO_new_file(path, "rb"), BIO_free);
-    if (!bio_data_in) {
-        LOGE("%s: Failed to open input file", path);
-        openssl_log_errors();
-        return SigVerifyResult::Failure;
-    }
-
-    ScopedBIO bio_sig_in(BIO_new_file(sig_path, "rb"), BIO_free);
-    if (!bio_sig_in) {
-        LOGE("%s: Failed to open signature file", sig_path);
-        openssl_log_errors();
-        return SigVerifyResult::Failure;
-    }
-
-    auto ret = sign::verify_data(*bio_data_in, *bio_sig_in, public_key);
-    if (!ret) {
-        if (ret.error().ec == sign::Error::BadSignature) {
-            return SigVerifyResult::Invalid;
-        } else {
-            LOGE("%s: Failed to verify signature: %s", sig_path,
-                 ret.error().ec.message().c_str());
-            if (ret.error().has_openssl_error) {
-                openssl_log_errors();
-            }
-            return SigVerifyResult::Failure;
-        }
-    }
-
-    return SigVerifyResult::Valid;
-}
+// Public keys of the trusted certificates. They are parsed once per process
+// and shared by all (possibly concurrent) verifications.
+static std::once_flag g_trusted_keys_once;
+static std::vector<ScopedEVP_PKEY> g_trusted_keys;
+static bool g_trusted_keys_loaded = false;
 
-SigVerifyResult verify_signature(const char *path, const char *sig_path)
+static void load_trusted_keys()
 {
     for (const std::string &hex_der : valid_certs) {
         std::string der;
         if (!hex2bin(hex_der, der)) {
             LOGE("Failed to convert hex-encoded certificate to binary: %s",
                  hex_der.c_str());
-            return SigVerifyResult::Failure;
+            return;
         }
 
         // Cast to (void *) is okay since BIO_new_mem_buf() creates a read-only
@@ -159,7 +145,7 @@ SigVerifyResult verify_signature(const char *path, const char *sig_path)
             LOGE("Failed to create BIO for X509 certificate: %s",
                  hex_der.c_str());
             openssl_log_errors();
-            return SigVerifyResult::Failure;
+            return;
         }
 
         // Load DER-encoded certificate
@@ -167,7 +153,7 @@ SigVerifyResult verify_signature(const char *path, const char *sig_path)
         if (!cert) {
             LOGE("Failed to load X509 certificate: %s", hex_der.c_str());
             openssl_log_errors();
-            return SigVerifyResult::Failure;
+            return;
         }
 
         // Get public key from certificate
@@ -176,22 +162,165 @@ SigVerifyResult verify_signature(const char *path, const char *sig_path)
             LOGE("Failed to load public key from X509 certificate: %s",
                  hex_der.c_str());
             openssl_log_errors();
-            return SigVerifyResult::Failure;
+            return;
         }
 
-        SigVerifyResult result =
-                verify_signature_with_key(path, sig_path, *public_key);
-        if (result == SigVerifyResult::Invalid) {
-            // Keep trying ...
-            continue;
+        g_trusted_keys.push_back(std::move(public_key));
+    }
+
+    g_trusted_keys_loaded = true;
+}
+
+static const std::vector<ScopedEVP_PKEY> * trusted_keys()
+{
+    std::call_once(g_trusted_keys_once, &load_trusted_keys);
+    return g_trusted_keys_loaded ? &g_trusted_keys : nullptr;
+}
+
+// Hash the file in a single pass straight out of a read-only mapping
+static sign::Result<std::vector<unsigned char>>
+digest_file(int fd, const sign::Signature &sig)
+{
+    struct stat sb;
+    if (fstat(fd, &sb) < 0) {
+        return sign::ErrorInfo{std::error_code(errno, std::generic_category()),
+                               false};
+    }
+
+    auto size = static_cast<size_t>(sb.st_size);
+    if (size == 0) {
+        return sign::digest_data(nullptr, 0, sig);
+    }
+
+    void *data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+        return sign::ErrorInfo{std::error_code(errno, std::generic_category()),
+                               false};
+    }
+
+    auto unmap_data = finally([&] {
+        munmap(data, size);
+    });
+
+    madvise(data, size, MADV_SEQUENTIAL);
+
+    return sign::digest_data(data, size, sig);
+}
+
+SigVerifyResult verify_signature(const char *path, const char *sig_path)
+{
+    auto keys = trusted_keys();
+    if (!keys) {
+        return SigVerifyResult::Failure;
+    }
+
+    ScopedBIO bio_sig_in(BIO_new_file(sig_path, "rb"), BIO_free);
+    if (!bio_sig_in) {
+        LOGE("%s: Failed to open signature file", sig_path);
+        openssl_log_errors();
+        return SigVerifyResult::Failure;
+    }
+
+    auto sig = sign::load_signature(*bio_sig_in);
+    if (!sig) {
+        LOGE("%s: Failed to load signature: %s", sig_path,
+             sig.error().ec.message().c_str());
+        if (sig.error().has_openssl_error) {
+            openssl_log_errors();
         }
+        return SigVerifyResult::Failure;
+    }
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        LOGE("%s: Failed to open input file: %s", path, strerror(errno));
+        return SigVerifyResult::Failure;
+    }
+
+    auto close_fd = finally([&] {
+        close(fd);
+    });
 
-        return result;
+    // Skip the crypto entirely if this exact file was already verified against
+    // this exact signature
+    auto cache_key = sig_cache_key(fd, sig.value());
+    if (cache_key && sig_cache_find(*cache_key)) {
+        LOGV("%s: Signature previously verified", path);
+        return SigVerifyResult::Valid;
+    }
+
+    // The data is only hashed once no matter how many keys there are
+    auto digest = digest_file(fd, sig.value());
+    if (!digest) {
+        LOGE("%s: Failed to hash input file: %s", path,
+             digest.error().ec.message().c_str());
+        if (digest.error().has_openssl_error) {
+            openssl_log_errors();
+        }
+        return SigVerifyResult::Failure;
+    }
+
+    for (auto const &key : *keys) {
+        auto ret = sign::verify_digest(digest.value(), sig.value(), *key);
+        if (ret) {
+            // Only record the result if the file didn't change while it was
+            // being hashed
+            if (cache_key && sig_cache_key(fd, sig.value()) == cache_key) {
+                sig_cache_insert(*cache_key);
+            }
+            return SigVerifyResult::Valid;
+        } else if (ret.error().ec != sign::Error::BadSignature) {
+            LOGE("%s: Failed to verify signature: %s", sig_path,
+                 ret.error().ec.message().c_str());
+            if (ret.error().has_openssl_error) {
+                openssl_log_errors();
+            }
+            return SigVerifyResult::Failure;
+        }
+
+        // Keep trying ...
     }
 
     return SigVerifyResult::Invalid;
 }
 
+std::vector<SigVerifyResult>
+verify_signatures(const std::vector<std::pair<std::string, std::string>> &files)
+{
+    std::vector<SigVerifyResult> results(files.size(),
+                                         SigVerifyResult::Failure);
+
+    // Parse the keys before starting any threads
+    if (!trusted_keys()) {
+        return results;
+    }
+
+    auto n_threads = std::min<size_t>(
+            std::clamp(std::thread::hardware_concurrency(),
+                       1u, static_cast<unsigned int>(MAX_VERIFY_THREADS)),
+            files.size());
+    std::vector<std::thread> threads;
+    std::atomic_size_t next{0};
+
+    auto worker = [&] {
+        for (size_t i; (i = next++) < files.size();) {
+            results[i] = verify_signature(files[i].first.c_str(),
+                                          files[i].second.c_str());
+        }
+    };
+
+    for (size_t i = 1; i < n_threads; ++i) {
+        threads.emplace_back(worker);
+    }
+    worker();
+
+    for (auto &t : threads) {
+        t.join();
+    }
+
+    return results;
+}
+
 static void sigverify_usage(FILE *stream)
 {
     fprintf(stream,
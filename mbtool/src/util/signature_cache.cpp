@@ -0,0 +1,376 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "util/signature_cache.h"
+
+#include <algorithm>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+#include <unistd.h>
+
+#include <openssl/sha.h>
+
+#include "mbcommon/finally.h"
+#include "mbcommon/version.h"
+#include "mblog/logging.h"
+
+#include "util/roms.h"
+#include "util/validcerts.h"
+
+#define LOG_TAG "mbtool/util/signature_cache"
+
+#define SIG_CACHE_MAGIC         "MBSIGC01"
+
+// Oldest entries are dropped once this many files have been recorded
+#define SIG_CACHE_MAX_ENTRIES   128
+
+namespace mb
+{
+
+struct SigCacheHeader
+{
+    char magic[8];
+    // Digest of the trusted certificates and the mbtool build. Entries recorded
+    // by a different build are never trusted.
+    unsigned char keyring[SHA512_DIGEST_LENGTH];
+    uint32_t count;
+    uint32_t reserved;
+};
+
+static_assert(sizeof(SigCacheKey) == 6 * 8 + 2 * 4 + 64,
+              "SigCacheKey must not have padding");
+
+static std::mutex g_lock;
+static bool g_loaded = false;
+// Metadata of the cache file when it was last read or written
+static struct stat g_file_sb;
+static std::vector<SigCacheKey> g_entries;
+
+bool SigCacheKey::operator==(const SigCacheKey &other) const
+{
+    return memcmp(this, &other, sizeof(*this)) == 0;
+}
+
+bool SigCacheKey::operator!=(const SigCacheKey &other) const
+{
+    return !(*this == other);
+}
+
+static void keyring_digest(unsigned char out[SHA512_DIGEST_LENGTH])
+{
+    const char *build = git_version();
+
+    SHA512_CTX ctx;
+
+    SHA512_Init(&ctx);
+    for (auto const &cert : valid_certs) {
+        SHA512_Update(&ctx, cert.data(), cert.size());
+        SHA512_Update(&ctx, "", 1);
+    }
+    SHA512_Update(&ctx, build, strlen(build));
+    SHA512_Final(out, &ctx);
+}
+
+static bool same_file(const struct stat &a, const struct stat &b)
+{
+    return a.st_dev == b.st_dev
+            && a.st_ino == b.st_ino
+            && a.st_size == b.st_size
+            && a.st_mtim.tv_sec == b.st_mtim.tv_sec
+            && a.st_mtim.tv_nsec == b.st_mtim.tv_nsec
+            && a.st_ctim.tv_sec == b.st_ctim.tv_sec
+            && a.st_ctim.tv_nsec == b.st_ctim.tv_nsec;
+}
+
+static bool read_fully(int fd, void *buf, size_t size)
+{
+    auto ptr = static_cast<char *>(buf);
+
+    while (size > 0) {
+        ssize_t n = read(fd, ptr, size);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n <= 0) {
+            return false;
+        }
+        ptr += n;
+        size -= static_cast<size_t>(n);
+    }
+
+    return true;
+}
+
+static bool write_fully(int fd, const void *buf, size_t size)
+{
+    auto ptr = static_cast<const char *>(buf);
+
+    while (size > 0) {
+        ssize_t n = write(fd, ptr, size);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n < 0) {
+            return false;
+        }
+        ptr += n;
+        size -= static_cast<size_t>(n);
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Reload the entries if the cache file changed since it was last read
+ *
+ * Other mbtool processes (eg. isolated daemon requests) may have added entries.
+ * Anything unexpected about the file results in an empty cache.
+ *
+ * \pre g_lock is held
+ */
+static void reload_locked(const std::string &path)
+{
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+    if (fd < 0) {
+        g_entries.clear();
+        g_loaded = false;
+        return;
+    }
+
+    auto close_fd = finally([&] {
+        close(fd);
+    });
+
+    struct stat sb;
+    if (fstat(fd, &sb) < 0) {
+        g_entries.clear();
+        g_loaded = false;
+        return;
+    }
+
+    if (g_loaded && same_file(sb, g_file_sb)) {
+        return;
+    }
+
+    g_entries.clear();
+    g_loaded = true;
+    g_file_sb = sb;
+
+    // Only trust the file if nobody but root could have written it
+    if (!S_ISREG(sb.st_mode) || sb.st_uid != 0
+            || (sb.st_mode & (S_IRWXG | S_IRWXO)) != 0) {
+        LOGW("%s: Ignoring cache file that is not private to root",
+             path.c_str());
+        return;
+    }
+
+    SigCacheHeader header;
+    unsigned char keyring[SHA512_DIGEST_LENGTH];
+    keyring_digest(keyring);
+
+    if (!read_fully(fd, &header, sizeof(header))
+            || memcmp(header.magic, SIG_CACHE_MAGIC, sizeof(header.magic)) != 0
+            || memcmp(header.keyring, keyring, sizeof(keyring)) != 0
+            || header.count > SIG_CACHE_MAX_ENTRIES
+            || static_cast<uint64_t>(sb.st_size) != sizeof(header)
+                    + header.count * sizeof(SigCacheKey)) {
+        return;
+    }
+
+    std::vector<SigCacheKey> entries(header.count);
+
+    if (!read_fully(fd, entries.data(), entries.size() * sizeof(SigCacheKey))) {
+        return;
+    }
+
+    g_entries.swap(entries);
+}
+
+/*!
+ * \brief Atomically replace the cache file with the current entries
+ *
+ * \pre g_lock is held
+ */
+static void save_locked(const std::string &path)
+{
+    std::string temp_path(path);
+    temp_path += ".XXXXXX";
+
+    int fd = mkostemp(temp_path.data(), O_CLOEXEC);
+    if (fd < 0) {
+        // The data partition is not mounted yet or multiboot has never been
+        // set up. Nothing is cached in that case.
+        if (errno != ENOENT) {
+            LOGW("%s: Failed to create temporary file: %s",
+                 temp_path.c_str(), strerror(errno));
+        }
+        return;
+    }
+
+    auto remove_temp = finally([&] {
+        if (fd >= 0) {
+            close(fd);
+        }
+        unlink(temp_path.c_str());
+    });
+
+    SigCacheHeader header = {};
+    memcpy(header.magic, SIG_CACHE_MAGIC, sizeof(header.magic));
+    keyring_digest(header.keyring);
+    header.count = static_cast<uint32_t>(g_entries.size());
+
+    if (fchmod(fd, 0600) < 0
+            || !write_fully(fd, &header, sizeof(header))
+            || !write_fully(fd, g_entries.data(),
+                            g_entries.size() * sizeof(SigCacheKey))
+            || fsync(fd) < 0) {
+        LOGW("%s: Failed to write cache: %s",
+             temp_path.c_str(), strerror(errno));
+        return;
+    }
+
+    struct stat sb;
+    bool have_sb = fstat(fd, &sb) == 0;
+
+    int ret = close(fd);
+    fd = -1;
+    if (ret < 0 || rename(temp_path.c_str(), path.c_str()) < 0) {
+        LOGW("%s: Failed to replace cache: %s", path.c_str(), strerror(errno));
+        return;
+    }
+
+    remove_temp.dismiss();
+
+    // Renaming doesn't change the inode, so the next lookup won't reread what
+    // was just written
+    if (have_sb) {
+        g_file_sb = sb;
+        g_loaded = true;
+    }
+}
+
+/*!
+ * \brief Compute the cache key for a signed file
+ *
+ * The key covers the filesystem, inode, size, and modification and status
+ * change times of the file along with the signature that it is checked
+ * against. Any change to the file or a different signature results in a
+ * different key.
+ *
+ * \param fd File descriptor of the signed file
+ * \param sig Signature of the file
+ *
+ * \return Cache key or nullopt if the file is not a regular file or could not
+ *         be stat'ed
+ */
+std::optional<SigCacheKey> sig_cache_key(int fd, const sign::Signature &sig)
+{
+    struct stat sb;
+    struct statfs sfs;
+
+    if (fstat(fd, &sb) < 0 || !S_ISREG(sb.st_mode) || fstatfs(fd, &sfs) < 0) {
+        return std::nullopt;
+    }
+
+    SigCacheKey key = {};
+
+    static_assert(sizeof(sfs.f_fsid) == sizeof(key.fsid));
+    memcpy(&key.fsid, &sfs.f_fsid, sizeof(key.fsid));
+    key.dev = static_cast<uint64_t>(sb.st_dev);
+    key.ino = static_cast<uint64_t>(sb.st_ino);
+    key.size = static_cast<uint64_t>(sb.st_size);
+    key.mtime_sec = static_cast<int64_t>(sb.st_mtim.tv_sec);
+    key.ctime_sec = static_cast<int64_t>(sb.st_ctim.tv_sec);
+    key.mtime_nsec = static_cast<uint32_t>(sb.st_mtim.tv_nsec);
+    key.ctime_nsec = static_cast<uint32_t>(sb.st_ctim.tv_nsec);
+
+    uint32_t version = sig.version;
+
+    SHA512_CTX ctx;
+
+    SHA512_Init(&ctx);
+    SHA512_Update(&ctx, &version, sizeof(version));
+    SHA512_Update(&ctx, sig.data.data(), sig.data.size());
+    SHA512_Final(key.sig_digest, &ctx);
+
+    return key;
+}
+
+/*!
+ * \brief Check if a file was previously verified successfully
+ *
+ * \param key Cache key from sig_cache_key()
+ *
+ * \return Whether the same file was verified against the same signature
+ */
+bool sig_cache_find(const SigCacheKey &key)
+{
+    std::lock_guard<std::mutex> lock(g_lock);
+
+    reload_locked(get_raw_path(SIG_CACHE_PATH));
+
+    return std::find(g_entries.begin(), g_entries.end(), key)
+            != g_entries.end();
+}
+
+/*!
+ * \brief Record that a file was verified successfully
+ *
+ * \param key Cache key from sig_cache_key(). The caller must make sure that
+ *            the file did not change between computing the key and verifying
+ *            the signature.
+ */
+void sig_cache_insert(const SigCacheKey &key)
+{
+    std::lock_guard<std::mutex> lock(g_lock);
+
+    auto path = get_raw_path(SIG_CACHE_PATH);
+
+    reload_locked(path);
+
+    if (std::find(g_entries.begin(), g_entries.end(), key)
+            != g_entries.end()) {
+        return;
+    }
+
+    // Drop entries for older versions of the file
+    g_entries.erase(std::remove_if(g_entries.begin(), g_entries.end(),
+                                   [&](const SigCacheKey &entry) {
+        return entry.fsid == key.fsid && entry.dev == key.dev
+                && entry.ino == key.ino;
+    }), g_entries.end());
+
+    if (g_entries.size() >= SIG_CACHE_MAX_ENTRIES) {
+        g_entries.erase(g_entries.begin());
+    }
+
+    g_entries.push_back(key);
+
+    save_locked(path);
+}
+
+}
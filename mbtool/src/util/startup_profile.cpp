@@ -0,0 +1,173 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "util/startup_profile.h"
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include "mbcommon/string.h"
+
+// Maximum number of marks per process. Later marks are dropped.
+#define MAX_STARTUP_MARKS 16
+
+namespace mb
+{
+
+struct StartupMark
+{
+    const char *name;
+    // CLOCK_MONOTONIC timestamp
+    uint64_t time_us;
+    // CLOCK_PROCESS_CPUTIME_ID timestamp
+    uint64_t cpu_us;
+    // Minor and major page faults so far
+    long minflt;
+    long majflt;
+};
+
+// Everything is plain data so that none of this needs a static initializer
+static const char *g_output = nullptr;
+static StartupMark g_marks[MAX_STARTUP_MARKS];
+static int g_mark_count = 0;
+
+static uint64_t clock_us(clockid_t clock)
+{
+    timespec ts;
+
+    if (clock_gettime(clock, &ts) < 0) {
+        return 0;
+    }
+
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000
+            + static_cast<uint64_t>(ts.tv_nsec) / 1000;
+}
+
+static void record_mark(const char *name)
+{
+    if (g_mark_count >= MAX_STARTUP_MARKS) {
+        return;
+    }
+
+    auto &mark = g_marks[g_mark_count++];
+    mark.name = name;
+    mark.time_us = clock_us(CLOCK_MONOTONIC);
+    mark.cpu_us = clock_us(CLOCK_PROCESS_CPUTIME_ID);
+
+    rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+        mark.minflt = usage.ru_minflt;
+        mark.majflt = usage.ru_majflt;
+    }
+}
+
+// Runs before the static initializers of all libraries (which use the default
+// priority), so the time until main() marks "static-init" is their total cost
+__attribute__((constructor(101)))
+static void startup_profile_init()
+{
+    g_output = getenv(STARTUP_PROFILE_ENV);
+    if (g_output && !*g_output) {
+        g_output = nullptr;
+    }
+
+    if (g_output) {
+        record_mark("start");
+    }
+}
+
+/*!
+ * \brief Record the end of a startup phase
+ *
+ * This does nothing unless the `MBTOOL_STARTUP_PROFILE` environment variable
+ * is set, so it is cheap enough to leave in the startup path.
+ *
+ * \param name Name of the phase that just ended. Must be a string literal or
+ *             otherwise outlive the process (only the pointer is stored).
+ */
+void startup_profile_mark(const char *name)
+{
+    if (g_output) {
+        record_mark(name);
+    }
+}
+
+/*!
+ * \brief Report the durations of the recorded startup phases
+ *
+ * The report is a single line containing the wall clock time, CPU time, and
+ * page faults of each phase. Phases are measured from the previous mark (or
+ * from before the first static initializer ran).
+ *
+ * Since the init and appsync tools replace the process with another program,
+ * this should be called right before the tool is run.
+ *
+ * \param tool Name of the tool that is about to run
+ */
+void startup_profile_report(const char *tool)
+{
+    if (!g_output || g_mark_count == 0) {
+        return;
+    }
+
+    std::string line = format("mbtool startup [%s]:", tool);
+
+    for (int i = 1; i < g_mark_count; ++i) {
+        auto const &prev = g_marks[i - 1];
+        auto const &cur = g_marks[i];
+
+        line += format(" %s=%" PRIu64 "us/cpu=%" PRIu64 "us/flt=%ld+%ld",
+                       cur.name,
+                       cur.time_us - prev.time_us, cur.cpu_us - prev.cpu_us,
+                       cur.minflt - prev.minflt, cur.majflt - prev.majflt);
+    }
+
+    line += format(" total=%" PRIu64 "us\n",
+                   g_marks[g_mark_count - 1].time_us - g_marks[0].time_us);
+
+    int fd;
+
+    if (strcmp(g_output, "1") == 0) {
+        fd = STDERR_FILENO;
+    } else {
+        fd = open(g_output, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            return;
+        }
+    }
+
+    // Best effort
+    (void) !write(fd, line.data(), line.size());
+
+    if (fd != STDERR_FILENO) {
+        close(fd);
+    }
+
+    // Only report once if a tool dispatches to another tool
+    g_output = nullptr;
+}
+
+}
@@ -22,6 +22,7 @@
 #include <array>
 
 #include <cerrno>
+#include <cinttypes>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
@@ -31,6 +32,9 @@
 
 #include <openssl/sha.h>
 
+#include "mbcommon/file/fd.h"
+#include "mbcommon/file/spill.h"
+#include "mbcommon/file_util.h"
 #include "mbcommon/finally.h"
 #include "mbcommon/string.h"
 #include "mblog/logging.h"
@@ -39,16 +43,20 @@
 #include "mbutil/copy.h"
 #include "mbutil/directory.h"
 #include "mbutil/file.h"
+#include "mbutil/hash.h"
+#include "mbutil/hash_cache.h"
 #include "mbutil/path.h"
 #include "mbutil/properties.h"
 #include "mbutil/string.h"
 
+#include "util/boot_context.h"
 #include "util/multiboot.h"
 #include "util/roms.h"
 
 #define LOG_TAG "mbtool/util/switcher"
 
 #define CHECKSUMS_PATH "/data/multiboot/checksums.prop"
+#define HASH_CACHE_PATH "/data/multiboot/hash_cache.bin"
 
 namespace mb
 {
@@ -170,53 +178,39 @@ void ChecksumProps::set(const std::string &rom_id, const std::string &image,
     m_props[key] += sha512;
 }
 
-struct Flashable
-{
-    std::string image;
-    std::string block_dev;
-    std::string expected_hash;
-    std::string hash;
-    std::string data;
-};
-
 /*!
- * \brief Perform non-recursive search for a block device
- *
- * This function will non-recursively search \a search_dirs for a block device
- * named \a partition. \a /dev/block/ is implicitly added to the search paths.
+ * \brief Read an image into a SpillFile
  *
- * \param search_dirs Search paths
- * \param partition Block device name
- *
- * \return Block device path if found. Otherwise, an empty string.
+ * Images are read completely before anything is flashed so that they can't
+ * change between verifying the checksum and flashing. They stay in memory if
+ * the memory budget allows it and go to an unlinked temporary file otherwise.
  */
-static std::string find_block_dev(const std::vector<std::string> &search_dirs,
-                                  const std::string &partition)
+static oc::result<void> read_image(const std::string &path, SpillFile &file)
 {
-    struct stat sb;
-
-    if (starts_with(partition, "mmcblk")) {
-        std::string path("/dev/block/");
-        path += partition;
+    FdFile source;
+    OUTCOME_TRYV(source.open(path, FileOpenMode::ReadOnly));
 
-        if (stat(path.c_str(), &sb) == 0) {
-            return path;
-        }
+    struct stat sb;
+    OUTCOME_TRYV(file.open());
+    if (fstat(source.native_fd(), &sb) == 0 && S_ISREG(sb.st_mode)) {
+        OUTCOME_TRYV(file.reserve(static_cast<uint64_t>(sb.st_size)));
     }
 
-    for (auto const &path : search_dirs) {
-        std::string block_dev(path);
-        block_dev += "/";
-        block_dev += partition;
+    OUTCOME_TRYV(file_copy(source, file, UINT64_MAX));
 
-        if (stat(block_dev.c_str(), &sb) == 0) {
-            return block_dev;
-        }
-    }
-
-    return {};
+    return oc::success();
 }
 
+struct Flashable
+{
+    std::string image;
+    std::string block_dev;
+    std::string expected_hash;
+    std::string hash;
+    // In memory unless the memory budget is exhausted
+    SpillFile data;
+};
+
 static bool add_extra_images(const std::string &multiboot_dir,
                              const std::vector<std::string> &block_dev_dirs,
                              std::vector<Flashable> *flashables)
@@ -258,7 +252,8 @@ static bool add_extra_images(const std::string &multiboot_dir,
             continue;
         }
 
-        std::string block_dev = find_block_dev(block_dev_dirs, partition);
+        std::string block_dev = BootContext::instance().find_block_dev(
+                block_dev_dirs, partition);
         if (block_dev.empty()) {
             LOGW("Couldn't find block device for partition %s",
                  partition.c_str());
@@ -344,22 +339,43 @@ SwitchRomResult switch_rom(const std::string &id,
     ChecksumProps props;
     props.load_file();
 
+    std::string hash_cache_path = get_raw_path(HASH_CACHE_PATH);
+    util::HashCache hash_cache;
+    (void) hash_cache.load(hash_cache_path);
+
     for (Flashable &f : flashables) {
-        // If memory becomes an issue, an alternative method is to create a
-        // temporary directory in /data/multiboot/ that's only writable by root
-        // and copy the images there.
-        if (auto r = util::file_read_all(f.image)) {
-            f.data = std::move(r.value());
-        } else {
+        // The cached digest can only be used if the image did not change
+        // while it was being read
+        struct stat sb_before;
+        struct stat sb_after;
+        bool unchanged = stat(f.image.c_str(), &sb_before) == 0;
+
+        if (auto r = read_image(f.image, f.data); !r) {
             LOGE("%s: Failed to read image: %s",
                  f.image.c_str(), r.error().message().c_str());
             return SwitchRomResult::Failed;
         }
 
+        unchanged = unchanged && stat(f.image.c_str(), &sb_after) == 0
+                && util::HashCache::same_metadata(sb_before, sb_after);
+
         // Get actual sha512sum
-        std::array<unsigned char, SHA512_DIGEST_LENGTH> digest;
-        SHA512(reinterpret_cast<const unsigned char *>(f.data.data()),
-               f.data.size(), digest.data());
+        util::Sha512Digest digest;
+        if (auto cached = unchanged ? hash_cache.find(sb_after)
+                                    : std::nullopt) {
+            digest = *cached;
+        } else {
+            if (auto r = util::sha512_hash(f.data)) {
+                digest = r.value();
+            } else {
+                LOGE("%s: Failed to hash image: %s",
+                     f.image.c_str(), r.error().message().c_str());
+                return SwitchRomResult::Failed;
+            }
+            if (unchanged) {
+                hash_cache.insert(sb_after, digest);
+            }
+        }
         f.hash = util::hex_string(digest.data(), digest.size());
 
         if (force_update_checksums) {
@@ -381,6 +397,14 @@ SwitchRomResult switch_rom(const std::string &id,
         }
     }
 
+    if (hash_cache.dirty()) {
+        (void) util::mkdir_parent(hash_cache_path, 0755);
+        if (auto r = hash_cache.save(hash_cache_path); !r) {
+            LOGW("%s: Failed to save hash cache: %s",
+                 hash_cache_path.c_str(), r.error().message().c_str());
+        }
+    }
+
     // Fail if we're missing expected hashes. We do this last to make sure
     // CHECKSUM_INVALID is returned if some checksums don't match (for the ones
     // that aren't missing).
@@ -391,10 +415,15 @@ SwitchRomResult switch_rom(const std::string &id,
         }
     }
 
-    // Now we can flash the images
+    // Now we can flash the images. Only the blocks that differ from what's
+    // already on the partition are written, so re-selecting the current ROM
+    // or flashing extra images that are shared between ROMs is cheap.
     for (Flashable &f : flashables) {
-        if (auto r = util::file_write_data(
-                f.block_dev, f.data.data(), f.data.size()); !r) {
+        if (auto r = util::file_write_changed_data(
+                f.block_dev, f.data, f.data.size())) {
+            LOGD("%s: Rewrote %" PRIu64 " of %" PRIu64 " bytes",
+                 f.block_dev.c_str(), r.value(), f.data.size());
+        } else {
             LOGE("%s: Failed to write image: %s",
                  f.block_dev.c_str(), r.error().message().c_str());
             return SwitchRomResult::Failed;
@@ -20,6 +20,10 @@
 #include "util/wipe.h"
 
 #include <algorithm>
+#include <memory>
+#include <string_view>
+#include <thread>
+#include <unordered_set>
 
 #include <cerrno>
 #include <cstring>
@@ -31,6 +35,7 @@
 #include "mblog/logging.h"
 #include "mbutil/delete.h"
 #include "mbutil/fts.h"
+#include "mbutil/io_scheduler.h"
 #include "mbutil/mount.h"
 #include "mbutil/string.h"
 
@@ -41,84 +46,112 @@
 namespace mb
 {
 
-class WipeDirectory : public util::FtsWrapper {
+bool wipe_directory(const std::string &directory,
+                    const std::vector<std::string> &exclusions,
+                    util::DeleteProgress *progress)
+{
+    std::vector<std::string> new_exclusions{ "multiboot" };
+    new_exclusions.insert(new_exclusions.end(),
+                          exclusions.begin(), exclusions.end());
+
+    // Wiping a ROM's /data can take a long time with large app caches
+    auto ret = util::delete_contents(directory, new_exclusions,
+                                     util::DeleteFlag::Parallel, progress);
+    if (!ret) {
+        LOGW("Failed to remove: %s", ret.error().message().c_str());
+        return false;
+    }
+
+    return true;
+}
+
+class PruneWalker : public util::FtsWrapper
+{
 public:
-    WipeDirectory(std::string path, std::vector<std::string> exclusions)
-        : FtsWrapper(path, util::FtsFlag::GroupSpecialFiles)
-        , _exclusions(std::move(exclusions))
+    PruneWalker(std::string path, const std::vector<std::string> &exclusions,
+                const std::unordered_set<std::string_view> &keep)
+        : FtsWrapper(std::move(path), util::FtsFlag::GroupSpecialFiles)
+        , m_exclusions(exclusions)
+        , m_keep(keep)
     {
     }
 
     Actions on_changed_path() override
     {
-        // Exclude first-level directories
-        if (_curr->fts_level == 1) {
-            if (std::find(_exclusions.begin(), _exclusions.end(), _curr->fts_name)
-                    != _exclusions.end()) {
-                return Action::Skip;
-            }
+        if (_curr->fts_level == 0 || _curr->fts_info == FTS_DP) {
+            return Action::Ok;
         }
 
-        return Action::Ok;
-    }
+        if (_curr->fts_level == 1
+                && std::find(m_exclusions.begin(), m_exclusions.end(),
+                             _curr->fts_name) != m_exclusions.end()) {
+            return Action::Skip;
+        }
 
-    Actions on_reached_directory_pre() override
-    {
-        // Do nothing. Need depth-first search, so directories are deleted
-        // in FTS_DP
-        return Action::Ok;
-    }
+        std::string_view path(_curr->fts_path);
+        path.remove_prefix(std::min(path.size(), _path.size()));
+        while (!path.empty() && path.front() == '/') {
+            path.remove_prefix(1);
+        }
 
-    Actions on_reached_directory_post() override
-    {
-        return delete_path() ? Action::Ok : Action::Fail;
-    }
+        if (m_keep.find(path) != m_keep.end()) {
+            return Action::Ok;
+        }
 
-    Actions on_reached_file() override
-    {
-        return delete_path() ? Action::Ok : Action::Fail;
-    }
+        LOGV("Removing %s", _curr->fts_path);
 
-    Actions on_reached_symlink() override
-    {
-        return delete_path() ? Action::Ok : Action::Fail;
-    }
+        if (auto r = util::delete_recursive(_curr->fts_path); !r) {
+            _error_msg = _curr->fts_path;
+            _error_msg += ": Failed to delete: ";
+            _error_msg += r.error().message();
+            return Action::Fail | Action::Stop;
+        }
 
-    Actions on_reached_special_file() override
-    {
-        return delete_path() ? Action::Ok : Action::Fail;
+        return Action::Skip;
     }
 
 private:
-    std::vector<std::string> _exclusions;
-
-    bool delete_path()
-    {
-        if (_curr->fts_level >= 1 && remove(_curr->fts_accpath) < 0) {
-            _error_msg = format("%s: Failed to remove: %s",
-                                _curr->fts_path, strerror(errno));
-            LOGW("%s", _error_msg.c_str());
-            return false;
-        }
-        return true;
-    }
+    const std::vector<std::string> &m_exclusions;
+    const std::unordered_set<std::string_view> &m_keep;
 };
 
-bool wipe_directory(const std::string &directory,
-                    const std::vector<std::string> &exclusions)
+/*!
+ * \brief Delete everything in a directory except for the specified paths
+ *
+ * This is the counterpart to wipe_directory() for restoring over an existing
+ * tree: only the entries that are not in the backup are removed.
+ *
+ * \param directory Directory to prune
+ * \param exclusions List of top-level paths to exclude (in addition to
+ *                   "multiboot")
+ * \param keep Paths, relative to \a directory, to keep. The parent directories
+ *             of these paths are kept as well.
+ *
+ * \return Whether all other entries were successfully deleted
+ */
+bool prune_directory(const std::string &directory,
+                     const std::vector<std::string> &exclusions,
+                     const std::vector<std::string> &keep)
 {
-    struct stat sb;
-    if (stat(directory.c_str(), &sb) < 0 && errno == ENOENT) {
-        // Don't fail if directory does not exist
-        return true;
-    }
-
     std::vector<std::string> new_exclusions{ "multiboot" };
     new_exclusions.insert(new_exclusions.end(),
                           exclusions.begin(), exclusions.end());
 
-    WipeDirectory wd(directory, std::move(new_exclusions));
-    return wd.run();
+    std::unordered_set<std::string_view> keep_set;
+    for (std::string_view path : keep) {
+        while (!path.empty() && keep_set.insert(path).second) {
+            auto slash = path.rfind('/');
+            path = path.substr(0, slash == std::string_view::npos ? 0 : slash);
+        }
+    }
+
+    PruneWalker walker(directory, new_exclusions, keep_set);
+    if (!walker.run()) {
+        LOGE("%s", walker.error().c_str());
+        return false;
+    }
+
+    return true;
 }
 
 /*!
@@ -130,7 +163,8 @@ bool wipe_directory(const std::string &directory,
  *
  * \return True if file was deleted or doesn't exist. False, otherwise.
  */
-static bool log_wipe_file(const std::string &path)
+static bool log_wipe_file(const std::string &path,
+                          util::DeleteProgress *progress)
 {
     LOGV("Wiping file %s", path.c_str());
 
@@ -149,7 +183,13 @@ static bool log_wipe_file(const std::string &path)
         return false;
     }
 
-    bool ret = unlink(path.c_str()) == 0 || errno == ENOENT;
+    // Unlinking the image only frees its extents, so this does not depend on
+    // the number of files inside it
+    bool ret = unlink(path.c_str()) == 0;
+    if (ret && progress) {
+        ++progress->entries;
+    }
+    ret = ret || errno == ENOENT;
     LOGV("-> %s", ret ? "Succeeded" : "Failed");
     return ret;
 }
@@ -162,11 +202,13 @@ static bool log_wipe_file(const std::string &path)
  *
  * \param mountpoint Mountpoint root to wipe
  * \param exclusions List of first-level paths to exclude
+ * \param progress Optional counter of deleted entries
  *
  * \return True if the path was wiped or doesn't exist. False, otherwise
  */
 static bool log_wipe_directory(const std::string &mountpoint,
-                               const std::vector<std::string> &exclusions)
+                               const std::vector<std::string> &exclusions,
+                               util::DeleteProgress *progress)
 {
     if (exclusions.empty()) {
         LOGV("Wiping directory %s", mountpoint.c_str());
@@ -190,15 +232,24 @@ static bool log_wipe_directory(const std::string &mountpoint,
         return false;
     }
 
-    bool ret = wipe_directory(mountpoint, exclusions);
+    // Wiping several targets on the same disk concurrently only makes them
+    // compete for its queue
+    auto ticket = util::IoScheduler::instance().acquire_bulk(mountpoint);
+
+    bool ret = wipe_directory(mountpoint, exclusions, progress);
     LOGV("-> %s", ret ? "Succeeded" : "Failed");
     return ret;
 }
 
-static bool log_delete_recursive(const std::string &path)
+static bool log_delete_recursive(const std::string &path,
+                                 util::DeleteProgress *progress)
 {
     LOGV("Recursively deleting %s", path.c_str());
-    if (auto r = util::delete_recursive(path)) {
+
+    auto ticket = util::IoScheduler::instance().acquire_bulk(path);
+
+    if (auto r = util::delete_recursive(
+            path, util::DeleteFlag::Parallel, progress)) {
         LOGV("-> Succeeded");
         return true;
     } else {
@@ -207,7 +258,8 @@ static bool log_delete_recursive(const std::string &path)
     }
 }
 
-bool wipe_system(const std::shared_ptr<Rom> &rom)
+bool wipe_system(const std::shared_ptr<Rom> &rom,
+                 util::DeleteProgress *progress)
 {
     std::string path = rom->full_system_path();
     if (path.empty()) {
@@ -222,16 +274,17 @@ bool wipe_system(const std::shared_ptr<Rom> &rom)
         mount_point += rom->id;
         (void) util::umount(mount_point);
 
-        ret = log_wipe_file(path);
+        ret = log_wipe_file(path, progress);
     } else {
-        ret = log_wipe_directory(path, {});
+        ret = log_wipe_directory(path, {}, progress);
         // Try removing ROM's /system if it's empty
         remove(path.c_str());
     }
     return ret;
 }
 
-bool wipe_cache(const std::shared_ptr<Rom> &rom)
+bool wipe_cache(const std::shared_ptr<Rom> &rom,
+                util::DeleteProgress *progress)
 {
     std::string path = rom->full_cache_path();
     if (path.empty()) {
@@ -241,16 +294,17 @@ bool wipe_cache(const std::shared_ptr<Rom> &rom)
 
     bool ret;
     if (rom->cache_is_image) {
-        ret = log_wipe_file(path);
+        ret = log_wipe_file(path, progress);
     } else {
-        ret = log_wipe_directory(path, {});
+        ret = log_wipe_directory(path, {}, progress);
         // Try removing ROM's /cache if it's empty
         remove(path.c_str());
     }
     return ret;
 }
 
-bool wipe_data(const std::shared_ptr<Rom> &rom)
+bool wipe_data(const std::shared_ptr<Rom> &rom,
+               util::DeleteProgress *progress)
 {
     std::string path = rom->full_data_path();
     if (path.empty()) {
@@ -260,9 +314,9 @@ bool wipe_data(const std::shared_ptr<Rom> &rom)
 
     bool ret;
     if (rom->data_is_image) {
-        ret = log_wipe_file(path);
+        ret = log_wipe_file(path, progress);
     } else {
-        ret = log_wipe_directory(path, { "media" });
+        ret = log_wipe_directory(path, { "media" }, progress);
         // Try removing ROM's /data/media and /data if they're empty
         remove((path + "/media").c_str());
         remove(path.c_str());
@@ -270,7 +324,8 @@ bool wipe_data(const std::shared_ptr<Rom> &rom)
     return ret;
 }
 
-bool wipe_dalvik_cache(const std::shared_ptr<Rom> &rom)
+bool wipe_dalvik_cache(const std::shared_ptr<Rom> &rom,
+                       util::DeleteProgress *progress)
 {
     if (rom->data_is_image || rom->cache_is_image) {
         LOGE("Wiping dalvik-cache for ROMs that use data or cache images is "
@@ -297,17 +352,105 @@ bool wipe_dalvik_cache(const std::shared_ptr<Rom> &rom)
     // util::delete_recursive() returns true if the path does not
     // exist (ie. returns false only on errors), which is exactly
     // what we want
-    return log_delete_recursive(data_path)
-            && log_delete_recursive(cache_path);
+    return log_delete_recursive(data_path, progress)
+            && log_delete_recursive(cache_path, progress);
 }
 
-bool wipe_multiboot(const std::shared_ptr<Rom> &rom)
+bool wipe_multiboot(const std::shared_ptr<Rom> &rom,
+                    util::DeleteProgress *progress)
 {
     // Delete /data/media/0/MultiBoot/[ROM ID]
     std::string multiboot_path(MULTIBOOT_DIR);
     multiboot_path += '/';
     multiboot_path += rom->id;
-    return log_delete_recursive(multiboot_path);
+    return log_delete_recursive(multiboot_path, progress);
+}
+
+static bool wipe_target(const std::shared_ptr<Rom> &rom, WipeTarget target,
+                        util::DeleteProgress *progress)
+{
+    switch (target) {
+    case WipeTarget::System:
+        return wipe_system(rom, progress);
+    case WipeTarget::Cache:
+        return wipe_cache(rom, progress);
+    case WipeTarget::Data:
+        return wipe_data(rom, progress);
+    case WipeTarget::DalvikCache:
+        return wipe_dalvik_cache(rom, progress);
+    case WipeTarget::Multiboot:
+        return wipe_multiboot(rom, progress);
+    }
+
+    return false;
+}
+
+/*!
+ * \brief Wipe several targets of a ROM concurrently
+ *
+ * The system, cache, data, and multiboot targets do not overlap, so each of
+ * them is wiped on its own thread. Targets that live on the same disk are
+ * admitted by util::IoScheduler, so slow single-queue storage only wipes one
+ * of them at a time. The dalvik-cache target lives inside the cache and data
+ * directories and is wiped after the others have finished.
+ *
+ * \param rom ROM to wipe
+ * \param targets Targets to wipe
+ * \param progress Optional counters that are updated while wiping
+ *
+ * \return Whether each target in \p targets was successfully wiped
+ */
+std::vector<bool> wipe_rom(const std::shared_ptr<Rom> &rom,
+                           const std::vector<WipeTarget> &targets,
+                           WipeProgress *progress)
+{
+    // std::vector<bool> elements can't be written from multiple threads
+    std::unique_ptr<bool[]> results(new bool[targets.size()]());
+    util::DeleteProgress *deleted = progress ? &progress->deleted : nullptr;
+
+    // Index of the first occurrence of each target. Duplicates are only wiped
+    // once.
+    auto first = [&](size_t i) {
+        return static_cast<size_t>(
+                std::find(targets.begin(), targets.end(), targets[i])
+                - targets.begin());
+    };
+
+    auto run = [&](size_t i) {
+        results[i] = wipe_target(rom, targets[i], deleted);
+        if (progress) {
+            ++progress->targets_done;
+        }
+    };
+
+    std::vector<std::thread> threads;
+
+    for (size_t i = 0; i < targets.size(); ++i) {
+        if (first(i) == i && targets[i] != WipeTarget::DalvikCache) {
+            threads.emplace_back(run, i);
+        }
+    }
+
+    for (auto &t : threads) {
+        t.join();
+    }
+
+    for (size_t i = 0; i < targets.size(); ++i) {
+        if (first(i) == i && targets[i] == WipeTarget::DalvikCache) {
+            run(i);
+        }
+    }
+
+    for (size_t i = 0; i < targets.size(); ++i) {
+        if (auto j = first(i); j != i) {
+            results[i] = results[j];
+            if (progress) {
+                ++progress->targets_done;
+            }
+        }
+    }
+
+    return std::vector<bool>(results.get(), results.get() + targets.size());
 }
 
 }
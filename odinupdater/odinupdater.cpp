@@ -18,8 +18,13 @@
  */
 
 #include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <condition_variable>
+#include <deque>
 #include <memory>
+#include <mutex>
+#include <string>
 #include <thread>
 #include <vector>
 
@@ -35,9 +40,11 @@
 #include <sys/wait.h>
 
 // libmbcommon
+#include "mbcommon/common.h"
 #include "mbcommon/error_code.h"
-#include "mbcommon/file/standard.h"
+#include "mbcommon/file/read_ahead.h"
 #include "mbcommon/file_error.h"
+#include "mbcommon/file_util.h"
 #include "mbcommon/finally.h"
 #include "mbcommon/integer.h"
 #include "mbcommon/string.h"
@@ -49,12 +56,15 @@
 #include "mbdevice/json.h"
 
 // libmbutil
+#include "mbutil/archive.h"
 #include "mbutil/command.h"
 #include "mbutil/copy.h"
 #include "mbutil/delete.h"
 #include "mbutil/file.h"
 #include "mbutil/mount.h"
+#include "mbutil/page_cache.h"
 #include "mbutil/properties.h"
+#include "mbutil/zip_index.h"
 
 // minizip
 #include <archive.h>
@@ -94,6 +104,10 @@ static int interface;
 static int output_fd;
 static const char *zip_file;
 
+// Central directory of the zip. Each entry is read by starting at its local
+// header instead of scanning the zip from the beginning.
+static mb::util::ZipIndex zip_index;
+
 static std::string sales_code;
 static std::string system_block_dev;
 static std::string boot_block_dev;
@@ -172,17 +186,105 @@ static bool umount_system()
     return run_command({ "umount", "/system" });
 }
 
-static bool la_open_zip(archive *a, const char *filename)
+// Reads the zip file starting at an entry's local header. A streaming zip
+// reader then sees that entry first, so the entries before it are never
+// scanned.
+struct ZipEntrySource
+{
+    ZipEntrySource() = default;
+
+    ~ZipEntrySource()
+    {
+        cache.finish();
+
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(ZipEntrySource)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(ZipEntrySource)
+
+    int fd = -1;
+    uint64_t offset = 0;
+    // The entry is read once from start to end
+    mb::util::StreamCache cache;
+    char buf[65536];
+};
+
+static la_ssize_t la_zip_source_read_cb(archive *a, void *userdata,
+                                        const void **buffer)
+{
+    auto *source = static_cast<ZipEntrySource *>(userdata);
+    *buffer = source->buf;
+
+    ssize_t n;
+    do {
+        n = pread64(source->fd, source->buf, sizeof(source->buf),
+                    static_cast<off64_t>(source->offset));
+    } while (n < 0 && errno == EINTR);
+
+    if (n < 0) {
+        archive_set_error(a, errno, "Failed to read zip: %s", strerror(errno));
+        return -1;
+    }
+
+    source->offset += static_cast<uint64_t>(n);
+    source->cache.advance(source->offset);
+    return n;
+}
+
+static const mb::util::ZipIndex::Entry * find_zip_entry(const char *filename)
+{
+    auto *entry = zip_index.find(filename);
+    if (!entry) {
+        error("%s: Failed to find %s in zip", zip_file, filename);
+    }
+    return entry;
+}
+
+// Large images may be stored as LZ4 frames with an additional ".lz4" suffix
+// (see PatcherConfig::image_compression()).
+static const mb::util::ZipIndex::Entry * find_image_entry(const char *filename,
+                                                          bool &lz4)
+{
+    std::string lz4_filename(filename);
+    lz4_filename += ".lz4";
+
+    if (auto *entry = zip_index.find(filename)) {
+        lz4 = false;
+        return entry;
+    } else if ((entry = zip_index.find(lz4_filename))) {
+        lz4 = true;
+        return entry;
+    }
+
+    error("%s: Failed to find %s in zip", zip_file, filename);
+    return nullptr;
+}
+
+static bool la_open_zip(archive *a, ZipEntrySource &source,
+                        const mb::util::ZipIndex::Entry &entry)
 {
-    if (archive_read_support_format_zip(a) != ARCHIVE_OK) {
+    if (archive_read_support_format_zip_streamable(a) != ARCHIVE_OK) {
         error("libarchive: Failed to enable zip support: %s",
               archive_error_string(a));
         return false;
     }
 
-    if (archive_read_open_filename(a, zip_file, 10240) != ARCHIVE_OK) {
+    source.fd = open64(zip_file, O_RDONLY | O_CLOEXEC | O_LARGEFILE);
+    if (source.fd < 0) {
+        error("%s: Failed to open: %s", zip_file, strerror(errno));
+        return false;
+    }
+    source.offset = zip_index.local_header_offset(entry);
+    source.cache.reset(source.fd, mb::util::StreamDirection::Read,
+                       source.offset);
+
+    if (archive_read_open2(a, &source, nullptr, &la_zip_source_read_cb,
+                           nullptr, nullptr) != ARCHIVE_OK) {
         error("libarchive: %s: Failed to open zip: %s",
-              filename, archive_error_string(a));
+              entry.name.c_str(), archive_error_string(a));
         return false;
     }
 
@@ -213,6 +315,39 @@ static ExtractResult la_skip_to(archive *a, const char *filename,
     return ExtractResult::Missing;
 }
 
+// Reader for an LZ4 frame stored in the current entry of another archive
+struct Lz4EntryReader
+{
+    ScopedArchive a{nullptr, &archive_read_free};
+    mb::util::ArchiveEntrySource source;
+};
+
+static bool la_open_lz4_entry(Lz4EntryReader &reader, archive *parent,
+                              const char *filename)
+{
+    reader.a.reset(archive_read_new());
+
+    if (!reader.a) {
+        error("Out of memory");
+        return false;
+    }
+
+    archive_entry *entry;
+
+    if (archive_read_support_filter_lz4(reader.a.get()) != ARCHIVE_OK
+            || archive_read_support_format_raw(reader.a.get()) != ARCHIVE_OK
+            || mb::util::libarchive_open_entry(reader.a.get(), reader.source,
+                                               parent) != ARCHIVE_OK
+            || archive_read_next_header(reader.a.get(), &entry)
+                    != ARCHIVE_OK) {
+        error("libarchive: %s: Failed to open LZ4 stream: %s",
+              filename, archive_error_string(reader.a.get()));
+        return false;
+    }
+
+    return true;
+}
+
 static bool load_sales_code()
 {
     auto line = mb::util::file_first_line(EFS_SALES_CODE_FILE);
@@ -241,6 +376,19 @@ static bool load_block_devs()
     Device device;
 
     {
+        auto *zip_entry = find_zip_entry(DEVICE_JSON_FILE);
+        if (!zip_entry) {
+            return false;
+        }
+
+        static constexpr size_t max_size = 10240;
+
+        if (zip_entry->uncompressed_size >= max_size) {
+            error("%s is too large", DEVICE_JSON_FILE);
+            return false;
+        }
+
+        ZipEntrySource source;
         archive *a = archive_read_new();
         if (!a) {
             error("Out of memory");
@@ -251,7 +399,7 @@ static bool load_block_devs()
             archive_read_free(a);
         });
 
-        if (!la_open_zip(a, zip_file)) {
+        if (!la_open_zip(a, source, *zip_entry)) {
             return false;
         }
 
@@ -260,13 +408,6 @@ static bool load_block_devs()
             return false;
         }
 
-        static constexpr size_t max_size = 10240;
-
-        if (archive_entry_size(entry) >= static_cast<int64_t>(max_size)) {
-            error("%s is too large", DEVICE_JSON_FILE);
-            return false;
-        }
-
         std::vector<char> buf(max_size);
         la_ssize_t n;
 
@@ -387,87 +528,374 @@ private:
     archive *m_archive;
 };
 
+// Writes buffers to the output file on a separate thread so that producing the
+// next buffer (decompressing, verifying checksums) overlaps with writing the
+// previous one. Block devices are opened with O_DIRECT so that the large
+// writes go straight to the device instead of through the page cache.
+class PipelinedWriter
+{
+public:
+    static constexpr size_t BUFFER_SIZE = 4 * 1024 * 1024;
+    static constexpr size_t BUFFER_COUNT = 3;
+    static constexpr size_t ALIGNMENT = 4096;
+
+    struct Buffer
+    {
+        std::unique_ptr<char, decltype(free) *> data{nullptr, &free};
+        uint64_t offset;
+        size_t size;
+        // Progress to report once the buffer has been written
+        double progress;
+    };
+
+    PipelinedWriter() = default;
+
+    ~PipelinedWriter()
+    {
+        finish();
+
+        if (m_fd >= 0) {
+            close(m_fd);
+        }
+    }
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(PipelinedWriter)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(PipelinedWriter)
+
+    bool open(const char *path)
+    {
+        int flags = O_CREAT | O_TRUNC | O_WRONLY | O_CLOEXEC | O_LARGEFILE;
+        struct stat sb;
+
+        m_path = path;
+        m_direct = ::stat(path, &sb) == 0 && S_ISBLK(sb.st_mode);
+
+        m_fd = open64(path, flags | (m_direct ? O_DIRECT : 0), 0600);
+        if (m_fd < 0 && m_direct && errno == EINVAL) {
+            // The driver does not support direct I/O
+            m_direct = false;
+            m_fd = open64(path, flags, 0600);
+        }
+        if (m_fd < 0) {
+            error("%s: Failed to open: %s", path, strerror(errno));
+            return false;
+        }
+
+        if (fstat(m_fd, &m_sb) < 0) {
+            error("%s: Failed to stat: %s", path, strerror(errno));
+            return false;
+        }
+
+        for (size_t i = 0; i < BUFFER_COUNT; ++i) {
+            void *ptr;
+            if (posix_memalign(&ptr, ALIGNMENT, BUFFER_SIZE) != 0) {
+                error("Out of memory");
+                return false;
+            }
+
+            auto &buf = m_buffers.emplace_back(std::make_unique<Buffer>());
+            buf->data.reset(static_cast<char *>(ptr));
+            m_free.push_back(buf.get());
+        }
+
+        m_thread = std::thread(&PipelinedWriter::writer, this);
+
+        return true;
+    }
+
+    int fd() const
+    {
+        return m_fd;
+    }
+
+    const struct stat & stat() const
+    {
+        return m_sb;
+    }
+
+    //! Get an empty buffer. Returns nullptr if a write has failed.
+    Buffer * acquire()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cv.wait(lock, [&] { return !m_free.empty() || m_failed; });
+
+        if (m_failed) {
+            return nullptr;
+        }
+
+        Buffer *buf = m_free.front();
+        m_free.pop_front();
+        return buf;
+    }
+
+    //! Queue a buffer from acquire() to be written
+    void submit(Buffer *buf)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_queued.push_back(buf);
+        }
+        m_cv.notify_all();
+    }
+
+    //! Wait for all queued buffers to be written
+    bool finish()
+    {
+        if (m_thread.joinable()) {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_done = true;
+            }
+            m_cv.notify_all();
+            m_thread.join();
+
+            if (m_failed) {
+                error("%s: Failed to write: %s",
+                      m_path.c_str(), strerror(m_errno));
+            }
+        }
+
+        return !m_failed;
+    }
+
+private:
+    bool write_buffer(const Buffer &buf)
+    {
+        if (m_direct && (buf.offset % ALIGNMENT != 0
+                || buf.size % ALIGNMENT != 0)) {
+            // Only the tail of a raw image can be unaligned. Write it through
+            // the page cache.
+            int flags = fcntl(m_fd, F_GETFL);
+            if (flags < 0 || fcntl(m_fd, F_SETFL, flags & ~O_DIRECT) < 0) {
+                return false;
+            }
+            m_direct = false;
+        }
+
+        const char *ptr = buf.data.get();
+        size_t remaining = buf.size;
+        auto offset = static_cast<off64_t>(buf.offset);
+
+        while (remaining > 0) {
+            ssize_t n = pwrite64(m_fd, ptr, remaining, offset);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return false;
+            }
+
+            ptr += n;
+            remaining -= static_cast<size_t>(n);
+            offset += n;
+        }
+
+        return true;
+    }
+
+    void writer()
+    {
+        double reported = 0;
+
+        // Direct I/O bypasses the page cache already. Otherwise, write back
+        // steadily instead of letting gigabytes of dirty pages accumulate.
+        mb::util::StreamCache cache(m_direct ? -1 : m_fd,
+                                    mb::util::StreamDirection::Write);
+
+        while (true) {
+            Buffer *buf;
+
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_cv.wait(lock, [&] { return !m_queued.empty() || m_done; });
+
+                if (m_queued.empty()) {
+                    break;
+                }
+
+                buf = m_queued.front();
+                m_queued.pop_front();
+            }
+
+            bool ok = m_failed || write_buffer(*buf);
+            int error_code = errno;
+            double progress = buf->progress;
+
+            if (ok) {
+                cache.advance(buf->offset + buf->size);
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (!ok && !m_failed) {
+                    m_failed = true;
+                    m_errno = error_code;
+                }
+                m_free.push_back(buf);
+            }
+            m_cv.notify_all();
+
+            // Rate limit: update progress only after difference exceeds 0.1%
+            if (ok && progress - reported >= 0.001) {
+                set_progress(progress);
+                reported = progress;
+            }
+        }
+    }
+
+    std::string m_path;
+    int m_fd = -1;
+    struct stat m_sb = {};
+    bool m_direct = false;
+
+    std::vector<std::unique_ptr<Buffer>> m_buffers;
+    std::deque<Buffer *> m_free;
+    std::deque<Buffer *> m_queued;
+
+    std::thread m_thread;
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    bool m_done = false;
+    std::atomic_bool m_failed{false};
+    int m_errno = 0;
+};
+
 static ExtractResult extract_sparse_file(const char *zip_filename,
                                          const char *out_filename)
 {
     using namespace std::placeholders;
 
+    bool lz4;
+    auto *zip_entry = find_image_entry(zip_filename, lz4);
+    if (!zip_entry) {
+        return ExtractResult::Missing;
+    }
+
+    ZipEntrySource source;
     ScopedArchive a{archive_read_new(), &archive_read_free};
-    LibArchiveEntryFile file(a.get());
-    mb::sparse::SparseFile sparse_file;
-    mb::StandardFile out_file;
+    Lz4EntryReader lz4_reader;
 
     if (!a) {
         error("Out of memory");
         return ExtractResult::Error;
     }
 
-    if (!la_open_zip(a.get(), zip_file)) {
+    if (!la_open_zip(a.get(), source, *zip_entry)) {
         return ExtractResult::Error;
     }
 
     archive_entry *entry;
-    if (auto r = la_skip_to(a.get(), zip_filename, &entry);
+    if (auto r = la_skip_to(a.get(), zip_entry->name.c_str(), &entry);
             r != ExtractResult::Ok) {
         return r;
     }
 
-    if (auto r = sparse_file.open(&file); !r) {
+    if (lz4 && !la_open_lz4_entry(lz4_reader, a.get(), zip_filename)) {
+        return ExtractResult::Error;
+    }
+
+    LibArchiveEntryFile file(lz4 ? lz4_reader.a.get() : a.get());
+    mb::ReadAheadFile read_ahead_file;
+    mb::sparse::SparseFile sparse_file;
+    PipelinedWriter writer;
+
+    // Decompress on a separate thread so that it overlaps with writing to the
+    // block device
+    if (auto r = read_ahead_file.open(&file); !r) {
+        error("Failed to start reading %s: %s",
+              zip_filename, r.error().message().c_str());
+        return ExtractResult::Error;
+    }
+
+    // Verifying is free since the image is read sequentially anyway
+    if (auto r = sparse_file.open(
+            &read_ahead_file, mb::sparse::SparseFileFlag::VerifyCrc32); !r) {
         error("Failed to open sparse file: %s",
               r.error().message().c_str());
         return ExtractResult::Error;
     }
 
-    if (auto r = out_file.open(out_filename, mb::FileOpenMode::WriteOnly); !r) {
-        error("%s: Failed to open for writing: %s",
-              out_filename, r.error().message().c_str());
+    if (!writer.open(out_filename)) {
         return ExtractResult::Error;
     }
 
-    char buf[10240];
+    int out_fd = writer.fd();
+    const struct stat &sb = writer.stat();
+
     uint64_t cur_bytes = 0;
     uint64_t max_bytes = sparse_file.size();
-    uint64_t old_bytes = 0;
 
     set_progress(0);
 
     while (true) {
-        auto n = sparse_file.read(buf, sizeof(buf));
-        if (!n) {
+        auto extent = sparse_file.next_extent();
+        if (!extent) {
             error("Failed to read sparse file %s: %s",
-                  zip_filename, n.error().message().c_str());
+                  zip_filename, extent.error().message().c_str());
             return ExtractResult::Error;
-        } else if (n.value() == 0) {
+        } else if (!extent.value()) {
             break;
         }
 
-        // Rate limit: update progress only after difference exceeds 0.1%
-        double old_ratio = static_cast<double>(old_bytes) / max_bytes;
-        double new_ratio = static_cast<double>(cur_bytes) / max_bytes;
-        if (new_ratio - old_ratio >= 0.001) {
-            set_progress(new_ratio);
-            old_bytes = cur_bytes;
+        const auto &e = *extent.value();
+
+        // Holes don't need to be written at all and zero-filled regions can
+        // be zeroed by the kernel. Only data (and non-zero fill patterns)
+        // needs to pass through the buffer. If zeroing fails (eg. an
+        // unaligned write to an O_DIRECT block device), the zeros are written
+        // through the buffer like any other data.
+        if (e.type == mb::sparse::ExtentType::Hole
+                || (e.type == mb::sparse::ExtentType::Fill && e.fill_val == 0
+                        && mb::util::zero_range(
+                                out_fd, e.offset, e.length,
+                                mb::util::ZeroRangeFlag::Deallocate))) {
+            if (auto r = sparse_file.skip_extent(); !r) {
+                error("Failed to read sparse file %s: %s",
+                      zip_filename, r.error().message().c_str());
+                return ExtractResult::Error;
+            }
+
+            cur_bytes += e.length;
+            continue;
         }
 
-        char *out_ptr = buf;
+        for (uint64_t remaining = e.length; remaining > 0;) {
+            auto *buf = writer.acquire();
+            if (!buf) {
+                writer.finish();
+                return ExtractResult::Error;
+            }
 
-        while (n.value() > 0) {
-            auto n_written = out_file.write(buf, n.value());
-            if (!n_written) {
-                error("%s: Failed to write file: %s",
-                      out_filename, n_written.error().message().c_str());
+            auto to_read = static_cast<size_t>(std::min<uint64_t>(
+                    PipelinedWriter::BUFFER_SIZE, remaining));
+
+            if (auto r = mb::file_read_exact(
+                    sparse_file, buf->data.get(), to_read); !r) {
+                error("Failed to read sparse file %s: %s",
+                      zip_filename, r.error().message().c_str());
                 return ExtractResult::Error;
             }
 
-            n.value() -= n_written.value();
-            out_ptr += n_written.value();
-            cur_bytes += n_written.value();
+            buf->offset = cur_bytes;
+            buf->size = to_read;
+
+            remaining -= to_read;
+            cur_bytes += to_read;
+
+            buf->progress = static_cast<double>(cur_bytes) / max_bytes;
+            writer.submit(buf);
         }
     }
 
-    if (auto r = out_file.close(); !r) {
-        error("%s: Failed to close file: %s",
-              out_filename, r.error().message().c_str());
+    if (!writer.finish()) {
+        return ExtractResult::Error;
+    }
+
+    // A trailing hole needs to be accounted for in regular files
+    if (S_ISREG(sb.st_mode) && ftruncate64(
+            out_fd, static_cast<off64_t>(max_bytes)) < 0) {
+        error("%s: Failed to truncate file: %s",
+              out_filename, strerror(errno));
         return ExtractResult::Error;
     }
 
@@ -477,76 +905,89 @@ static ExtractResult extract_sparse_file(const char *zip_filename,
 static ExtractResult extract_raw_file(const char *zip_filename,
                                       const char *out_filename)
 {
+    bool lz4;
+    auto *zip_entry = find_image_entry(zip_filename, lz4);
+    if (!zip_entry) {
+        return ExtractResult::Missing;
+    }
+
+    ZipEntrySource source;
     ScopedArchive a{archive_read_new(), &archive_read_free};
-    char buf[10240];
-    la_ssize_t n;
-    int fd;
-    uint64_t cur_bytes = 0;
-    uint64_t max_bytes = 0;
-    uint64_t old_bytes = 0;
-    double old_ratio;
-    double new_ratio;
+    PipelinedWriter writer;
+    la_ssize_t n = 0;
+    uint64_t offset = 0;
 
     if (!a) {
         error("Out of memory");
         return ExtractResult::Error;
     }
 
-    if (!la_open_zip(a.get(), zip_file)) {
+    if (!la_open_zip(a.get(), source, *zip_entry)) {
         return ExtractResult::Error;
     }
 
     archive_entry *entry;
-    auto result = la_skip_to(a.get(), zip_filename, &entry);
+    auto result = la_skip_to(a.get(), zip_entry->name.c_str(), &entry);
     if (result != ExtractResult::Ok) {
         return result;
     }
 
-    max_bytes = static_cast<uint64_t>(archive_entry_size(entry));
+    // Progress is based on how much of the zip entry has been consumed. The
+    // size in the local header may be missing, so use the central directory's.
+    uint64_t max_bytes = zip_entry->uncompressed_size;
 
-    fd = open64(out_filename,
-                O_CREAT | O_TRUNC | O_WRONLY | O_CLOEXEC | O_LARGEFILE, 0600);
-    if (fd < 0) {
-        error("%s: Failed to open: %s", out_filename, strerror(errno));
+    Lz4EntryReader lz4_reader;
+    if (lz4 && !la_open_lz4_entry(lz4_reader, a.get(), zip_filename)) {
         return ExtractResult::Error;
     }
 
-    auto close_fd = mb::finally([fd]{
-        close(fd);
-    });
+    archive *data = lz4 ? lz4_reader.a.get() : a.get();
+
+    if (!writer.open(out_filename)) {
+        return ExtractResult::Error;
+    }
 
     set_progress(0);
 
-    while ((n = archive_read_data(a.get(), buf, sizeof(buf))) > 0) {
-        // Rate limit: update progress only after difference exceeds 0.1%
-        old_ratio = static_cast<double>(old_bytes) / max_bytes;
-        new_ratio = static_cast<double>(cur_bytes) / max_bytes;
-        if (new_ratio - old_ratio >= 0.001) {
-            set_progress(new_ratio);
-            old_bytes = cur_bytes;
+    while (true) {
+        auto *buf = writer.acquire();
+        if (!buf) {
+            writer.finish();
+            return ExtractResult::Error;
         }
 
-        char *out_ptr = buf;
-        ssize_t nwritten;
+        // Fill the whole buffer so that only the last write can be unaligned
+        size_t size = 0;
 
-        do {
-            if ((nwritten = write(fd, out_ptr, static_cast<size_t>(n))) < 0) {
-                error("%s: Failed to write: %s",
-                      out_filename, strerror(errno));
-                return ExtractResult::Error;
-            }
+        while (size < PipelinedWriter::BUFFER_SIZE
+                && (n = archive_read_data(data, buf->data.get() + size,
+                                          PipelinedWriter::BUFFER_SIZE - size))
+                        > 0) {
+            size += static_cast<size_t>(n);
+        }
+        if (n < 0) {
+            error("libarchive: %s: Failed to read %s: %s",
+                  zip_file, zip_filename, archive_error_string(data));
+            return ExtractResult::Error;
+        } else if (size == 0) {
+            break;
+        }
 
-            n -= nwritten;
-            out_ptr += nwritten;
-        } while (n > 0);
-    }
-    if (n != 0) {
-        error("libarchive: %s: Failed to read %s: %s",
-              zip_file, zip_filename, archive_error_string(a.get()));
-        return ExtractResult::Error;
+        buf->offset = offset;
+        buf->size = size;
+
+        offset += size;
+
+        buf->progress = static_cast<double>(lz4 ? lz4_reader.source.offset : offset)
+                / max_bytes;
+        writer.submit(buf);
+
+        if (n == 0) {
+            break;
+        }
     }
 
-    return ExtractResult::Ok;
+    return writer.finish() ? ExtractResult::Ok : ExtractResult::Error;
 }
 
 static bool disable_vaultkeeper(const char *path)
@@ -816,8 +1257,7 @@ static bool flash_carrier_package_zip(const char *zip_path)
                                  | ARCHIVE_EXTRACT_MAC_METADATA
                                  | ARCHIVE_EXTRACT_SPARSE);
 
-    if (archive_read_open_filename(in.get(), zip_path, 10240)
-            != ARCHIVE_OK) {
+    if (mb::util::libarchive_open_file(in.get(), zip_path) != ARCHIVE_OK) {
         error("libarchive: %s: Failed to open file: %s",
               zip_path, archive_error_string(in.get()));
         return false;
@@ -1066,5 +1506,11 @@ int main(int argc, char *argv[])
 
     zip_file = argv[3];
 
+    if (auto r = zip_index.load(zip_file); !r) {
+        error("%s: Failed to read zip: %s",
+              zip_file, r.error().message().c_str());
+        return EXIT_FAILURE;
+    }
+
     return flash_zip() ? EXIT_SUCCESS : EXIT_FAILURE;
 }
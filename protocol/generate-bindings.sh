@@ -7,6 +7,7 @@ files=(
     v3/crypto_get_pw_type.fbs
     v3/file_chmod.fbs
     v3/file_close.fbs
+    v3/file_get_fd.fbs
     v3/file_open.fbs
     v3/file_read.fbs
     v3/file_seek.fbs
@@ -17,14 +18,17 @@ files=(
     v3/mb_get_booted_rom_id.fbs
     v3/mb_get_installed_roms.fbs
     v3/mb_get_packages_count.fbs
+    v3/mb_get_perf_counters.fbs
     v3/mb_get_version.fbs
     v3/mb_set_kernel.fbs
     v3/mb_switch_rom.fbs
     v3/mb_wipe_rom.fbs
     v3/path_chmod.fbs
     v3/path_copy.fbs
+    v3/path_copy_job.fbs
     v3/path_delete.fbs
     v3/path_get_directory_size.fbs
+    v3/path_list_directory.fbs
     v3/path_mkdir.fbs
     v3/path_readlink.fbs
     v3/path_selinux_get_label.fbs
@@ -1,5 +1,5 @@
 /*
- * Copyright (C) 2016-2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ * Copyright (C) 2016-2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
  *
  * This file is part of DualBootPatcher
  *
@@ -17,12 +17,20 @@
  * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
+#include <atomic>
 #include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
 
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 
+#include <getopt.h>
+
 #include <openssl/err.h>
 
 // libmbsign
@@ -30,6 +38,10 @@
 
 using ScopedBIO = std::unique_ptr<BIO, decltype(BIO_free) *>;
 
+// Serializes messages (and the OpenSSL error queue dumps that follow them) from
+// the batch worker threads
+static std::mutex g_output_lock;
+
 static void openssl_log_errors()
 {
     ERR_print_errors_fp(stderr);
@@ -38,24 +50,207 @@ static void openssl_log_errors()
 static void usage(FILE *stream)
 {
     fprintf(stream,
-            "Usage: signtool <PKCS12 file> <input file> <output signature file>\n\n"
+            "Usage: signtool <PKCS12 file> <input file> <output signature file>\n"
+            "       signtool --batch [-j <jobs>] <PKCS12 file> <input file>...\n"
+            "       signtool --verify [-j <jobs>] <PKCS12 file> <input file>...\n\n"
+            "In batch mode, the signature of each input file is written to\n"
+            "<input file>.sig. In verify mode, each input file is checked\n"
+            "against <input file>.sig. The key is only loaded once and the\n"
+            "files are processed concurrently.\n\n"
+            "Options:\n"
+            "  -b, --batch      Sign multiple files\n"
+            "  -V, --verify     Verify multiple files\n"
+            "  -j, --jobs <N>   Number of files to process concurrently\n"
+            "                   (default: number of CPUs)\n"
+            "  -h, --help       Display this help message\n\n"
             "NOTE: This is not a general purpose tool for signing files!\n"
             "It is only meant for use with mbtool.\n");
 }
 
+static bool sign_file(EVP_PKEY &private_key, const char *file_input,
+                      const char *file_output)
+{
+    ScopedBIO bio_data_in(BIO_new_file(file_input, "rb"), BIO_free);
+    if (!bio_data_in) {
+        std::lock_guard<std::mutex> lock(g_output_lock);
+        fprintf(stderr, "%s: Failed to open input file\n", file_input);
+        openssl_log_errors();
+        return false;
+    }
+    ScopedBIO bio_sig_out(BIO_new_file(file_output, "wb"), BIO_free);
+    if (!bio_sig_out) {
+        std::lock_guard<std::mutex> lock(g_output_lock);
+        fprintf(stderr, "%s: Failed to open output file\n", file_output);
+        openssl_log_errors();
+        return false;
+    }
+
+    if (auto ret = mb::sign::sign_data(
+            *bio_data_in, *bio_sig_out, private_key); !ret) {
+        std::lock_guard<std::mutex> lock(g_output_lock);
+        fprintf(stderr, "%s: Failed to sign data: %s\n",
+                file_input, ret.error().ec.message().c_str());
+        if (ret.error().has_openssl_error) {
+            openssl_log_errors();
+        }
+        return false;
+    }
+
+    if (!BIO_free(bio_data_in.release())) {
+        std::lock_guard<std::mutex> lock(g_output_lock);
+        fprintf(stderr, "%s: Failed to close input file\n", file_input);
+        openssl_log_errors();
+        return false;
+    }
+
+    if (!BIO_free(bio_sig_out.release())) {
+        std::lock_guard<std::mutex> lock(g_output_lock);
+        fprintf(stderr, "%s: Failed to close output file\n", file_output);
+        openssl_log_errors();
+        return false;
+    }
+
+    return true;
+}
+
+static bool verify_file(EVP_PKEY &public_key, const char *file_input,
+                        const char *file_sig)
+{
+    ScopedBIO bio_data_in(BIO_new_file(file_input, "rb"), BIO_free);
+    if (!bio_data_in) {
+        std::lock_guard<std::mutex> lock(g_output_lock);
+        fprintf(stderr, "%s: Failed to open input file\n", file_input);
+        openssl_log_errors();
+        return false;
+    }
+    ScopedBIO bio_sig_in(BIO_new_file(file_sig, "rb"), BIO_free);
+    if (!bio_sig_in) {
+        std::lock_guard<std::mutex> lock(g_output_lock);
+        fprintf(stderr, "%s: Failed to open signature file\n", file_sig);
+        openssl_log_errors();
+        return false;
+    }
+
+    if (auto ret = mb::sign::verify_data(
+            *bio_data_in, *bio_sig_in, public_key); !ret) {
+        std::lock_guard<std::mutex> lock(g_output_lock);
+        if (ret.error().ec == mb::sign::Error::BadSignature) {
+            fprintf(stderr, "%s: Invalid signature\n", file_input);
+        } else {
+            fprintf(stderr, "%s: Failed to verify signature: %s\n",
+                    file_input, ret.error().ec.message().c_str());
+        }
+        if (ret.error().has_openssl_error) {
+            openssl_log_errors();
+        }
+        return false;
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Run \p fn on each file using a pool of \p jobs threads
+ *
+ * \return Number of files for which \p fn failed
+ */
+template<typename Fn>
+static size_t run_batch(const std::vector<const char *> &files,
+                        unsigned int jobs, Fn fn)
+{
+    std::atomic_size_t next{0};
+    std::atomic_size_t failed{0};
+
+    auto worker = [&] {
+        for (size_t i; (i = next++) < files.size();) {
+            if (!fn(files[i])) {
+                ++failed;
+            }
+        }
+    };
+
+    auto n_threads = std::min<size_t>(jobs, files.size());
+    std::vector<std::thread> threads;
+
+    for (size_t i = 1; i < n_threads; ++i) {
+        threads.emplace_back(worker);
+    }
+    worker();
+
+    for (auto &t : threads) {
+        t.join();
+    }
+
+    return failed;
+}
+
 int main(int argc, char *argv[])
 {
     ERR_load_crypto_strings();
     OpenSSL_add_all_algorithms();
 
-    if (argc != 4) {
+    enum class Mode
+    {
+        Single,
+        Batch,
+        Verify,
+    };
+
+    Mode mode = Mode::Single;
+    unsigned int jobs = std::max(std::thread::hardware_concurrency(), 1u);
+
+    int opt;
+
+    static const char short_options[] = "bVj:h";
+
+    static struct option long_options[] = {
+        {"batch",  no_argument,       nullptr, 'b'},
+        {"verify", no_argument,       nullptr, 'V'},
+        {"jobs",   required_argument, nullptr, 'j'},
+        {"help",   no_argument,       nullptr, 'h'},
+        {nullptr,  0,                 nullptr, 0},
+    };
+
+    int long_index = 0;
+
+    while ((opt = getopt_long(argc, argv, short_options,
+                              long_options, &long_index)) != -1) {
+        switch (opt) {
+        case 'b':
+            mode = Mode::Batch;
+            break;
+
+        case 'V':
+            mode = Mode::Verify;
+            break;
+
+        case 'j': {
+            char *end;
+            unsigned long value = strtoul(optarg, &end, 10);
+            if (!*optarg || *end || value == 0 || value > 1024) {
+                fprintf(stderr, "Invalid number of jobs: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            jobs = static_cast<unsigned int>(value);
+            break;
+        }
+
+        case 'h':
+            usage(stdout);
+            return EXIT_SUCCESS;
+
+        default:
+            usage(stderr);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (mode == Mode::Single ? argc - optind != 3 : argc - optind < 2) {
         usage(stderr);
         return EXIT_FAILURE;
     }
 
-    const char *file_pkcs12 = argv[1];
-    const char *file_input = argv[2];
-    const char *file_output = argv[3];
+    const char *file_pkcs12 = argv[optind];
 
     const char *pass = getenv("MBSIGN_PASSPHRASE");
     if (!pass) {
@@ -64,44 +259,52 @@ int main(int argc, char *argv[])
         return EXIT_FAILURE;
     }
 
+    if (mode == Mode::Verify) {
+        auto public_key = mb::sign::load_public_key_from_file(
+                file_pkcs12, mb::sign::KeyFormat::Pkcs12, pass);
+        if (!public_key) {
+            return EXIT_FAILURE;
+        }
+
+        std::vector<const char *> files(argv + optind + 1, argv + argc);
+
+        size_t failed = run_batch(files, jobs, [&](const char *file) {
+            std::string file_sig(file);
+            file_sig += ".sig";
+            return verify_file(*public_key.value(), file, file_sig.c_str());
+        });
+
+        if (failed > 0) {
+            fprintf(stderr, "%zu of %zu files failed verification\n",
+                    failed, files.size());
+            return EXIT_FAILURE;
+        }
+
+        return EXIT_SUCCESS;
+    }
+
     auto private_key = mb::sign::load_private_key_from_file(
             file_pkcs12, mb::sign::KeyFormat::Pkcs12, pass);
     if (!private_key) {
         return EXIT_FAILURE;
     }
 
-    ScopedBIO bio_data_in(BIO_new_file(file_input, "rb"), BIO_free);
-    if (!bio_data_in) {
-        fprintf(stderr, "%s: Failed to open input file\n", file_input);
-        openssl_log_errors();
-        return EXIT_FAILURE;
-    }
-    ScopedBIO bio_sig_out(BIO_new_file(file_output, "wb"), BIO_free);
-    if (!bio_sig_out) {
-        fprintf(stderr, "%s: Failed to open output file\n", file_output);
-        openssl_log_errors();
-        return EXIT_FAILURE;
+    if (mode == Mode::Single) {
+        return sign_file(*private_key.value(), argv[optind + 1],
+                         argv[optind + 2]) ? EXIT_SUCCESS : EXIT_FAILURE;
     }
 
-    if (auto ret = mb::sign::sign_data(
-            *bio_data_in, *bio_sig_out, *private_key.value()); !ret) {
-        fprintf(stderr, "Failed to sign data: %s\n",
-                ret.error().ec.message().c_str());
-        if (ret.error().has_openssl_error) {
-            openssl_log_errors();
-        }
-        return EXIT_FAILURE;
-    }
+    std::vector<const char *> files(argv + optind + 1, argv + argc);
 
-    if (!BIO_free(bio_data_in.release())) {
-        fprintf(stderr, "%s: Failed to close input file\n", file_input);
-        openssl_log_errors();
-        return EXIT_FAILURE;
-    }
+    size_t failed = run_batch(files, jobs, [&](const char *file) {
+        std::string file_sig(file);
+        file_sig += ".sig";
+        return sign_file(*private_key.value(), file, file_sig.c_str());
+    });
 
-    if (!BIO_free(bio_sig_out.release())) {
-        fprintf(stderr, "%s: Failed to close output file\n", file_output);
-        openssl_log_errors();
+    if (failed > 0) {
+        fprintf(stderr, "%zu of %zu files could not be signed\n",
+                failed, files.size());
         return EXIT_FAILURE;
     }
 